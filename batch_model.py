@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+"""Rewrites a batch 1 TFLite model to run several frames per Invoke().
+
+Usage:
+    batch_model.py [--batch N] MODEL OUTPUT
+
+MODEL is either a .tflite flatbuffer or a .cc file with the model as C
+array, OUTPUT is written in the same format. FullyConnectedBatchResolver
+in fc_batch.h reads each weight once for two rows of input, so when two
+frames or crops are ready a model with batch 2, the default, halves the
+weight traffic of its FullyConnected layers per frame. Input tensor then
+holds the frames one after the other, output a row of scores for each.
+
+First dimension of every activation tensor is changed from 1 to N, and
+the same in the new shape of each Reshape, both its options and its shape
+tensor, so no table grows and offsets stay. Subgraph inputs must have
+batch 1. Other shape constants, for example begin and end of
+StridedSlice, are not touched, such operators are listed and have to be
+checked by hand.
+
+Activations and arena are N times larger, a memory plan made for batch 1
+is wrong then, so a model that has one is refused. Run gen_memory_plan.py
+and check arena size afterwards. Conv2DWinogradResolver and
+Conv2DFrameStackResolver need batch 1 and fail in Prepare().
+"""
+
+import struct
+import sys
+
+import gen_model_ops as ops
+import gen_memory_plan as plan
+
+TENSOR_SHAPE_SIGNATURE = 7
+OPERATOR_BUILTIN_OPTIONS = 4
+RESHAPE_NEW_SHAPE = 0
+
+# Operators with shape constants other than of Reshape
+SHAPE_OPERATORS = {32: "BatchToSpaceNd", 34: "Pad", 38: "SpaceToBatchNd",
+                   45: "StridedSlice", 60: "PadV2", 65: "Slice",
+                   69: "Tile", 77: "Pack", 83: "Unpack"}
+
+
+def set_batch(buf, vector, batch):
+    """Sets first element of an int32 vector that is 1, returns True if
+    it was."""
+    if vector is None or not ops.u32(buf, vector) or \
+            struct.unpack_from("<i", buf, vector + 4)[0] != 1:
+        return False
+    struct.pack_into("<i", buf, vector + 4, batch)
+    return True
+
+
+def rebatch(buf, batch):
+    """Returns number of changed tensors, buf is a bytearray."""
+    if buf[4:8] != b"TFL3":
+        raise ValueError("not a TFLite flatbuffer")
+
+    model = ops.u32(buf, 0)
+    for table in ops.vector_tables(buf, model, plan.MODEL_METADATA):
+        name_pos = ops.field_pos(buf, table, plan.METADATA_NAME_FIELD)
+        if plan.string_at(buf, name_pos) == plan.METADATA_NAME:
+            raise ValueError("model has a memory plan, batch the model "
+                             "before gen_memory_plan.py")
+    subgraphs = ops.vector_tables(buf, model, ops.MODEL_SUBGRAPHS)
+    if len(subgraphs) != 1:
+        raise ValueError("only models with one subgraph are supported")
+    subgraph = subgraphs[0]
+
+    codes = []
+    for opcode in ops.vector_tables(buf, model, ops.MODEL_OPERATOR_CODES):
+        code = plan.scalar(buf, opcode, ops.OPCODE_DEPRECATED_BUILTIN_CODE,
+                           "<b")
+        codes.append(max(code, plan.scalar(buf, opcode,
+                                           ops.OPCODE_BUILTIN_CODE, "<i")))
+
+    buffers = ops.vector_tables(buf, model, plan.MODEL_BUFFERS)
+    tensors = ops.vector_tables(buf, subgraph, plan.SUBGRAPH_TENSORS)
+    infos = plan.arena_tensors(buf, model, subgraph)
+
+    for i in ops.int_vector(buf, subgraph, plan.SUBGRAPH_INPUTS):
+        shape = ops.int_vector(buf, tensors[i], plan.TENSOR_SHAPE)
+        if not shape or shape[0] != 1:
+            raise ValueError("input tensor %d has no batch 1" % i)
+
+    count = 0
+    for i, tensor in enumerate(tensors):
+        # Variable tensors are in the arena too, only constants keep shape
+        data = ops.vector_pos(buf, buffers[plan.scalar(
+            buf, tensor, plan.TENSOR_BUFFER, "<I")], plan.BUFFER_DATA)
+        if infos[i] is None and data is not None and ops.u32(buf, data):
+            continue
+        if set_batch(buf, ops.vector_pos(buf, tensor, plan.TENSOR_SHAPE),
+                     batch):
+            set_batch(buf, ops.vector_pos(buf, tensor,
+                                          TENSOR_SHAPE_SIGNATURE), batch)
+            count += 1
+
+    shapes = set()
+    for index, operator in enumerate(ops.vector_tables(
+            buf, subgraph, ops.SUBGRAPH_OPERATORS)):
+        code = codes[plan.scalar(buf, operator, ops.OPERATOR_OPCODE_INDEX,
+                                 "<I")]
+        if code in SHAPE_OPERATORS:
+            print("Operator %d %s: shape constants are not changed"
+                  % (index, SHAPE_OPERATORS[code]))
+        if code != plan.RESHAPE:
+            continue
+        pos = ops.field_pos(buf, operator, OPERATOR_BUILTIN_OPTIONS)
+        if pos is not None:
+            set_batch(buf, ops.vector_pos(buf, pos + ops.u32(buf, pos),
+                                          RESHAPE_NEW_SHAPE), batch)
+        inputs = ops.int_vector(buf, operator, plan.OPERATOR_INPUTS)
+        # Shape tensor may be shared, it is changed once
+        if len(inputs) > 1 and inputs[1] >= 0 and inputs[1] not in shapes:
+            shapes.add(inputs[1])
+            set_batch(buf, ops.vector_pos(buf, buffers[plan.scalar(
+                buf, tensors[inputs[1]], plan.TENSOR_BUFFER, "<I")],
+                plan.BUFFER_DATA), batch)
+    return count
+
+
+def main():
+    args = sys.argv[1:]
+    batch = 2
+    if len(args) == 4 and args[0] == "--batch":
+        batch = int(args[1])
+        args = args[2:]
+    if len(args) != 2 or batch < 2:
+        print("Usage:\nbatch_model.py [--batch N] MODEL OUTPUT")
+        return 1
+
+    model_path, output_path = args
+    if model_path.endswith(".cc") != output_path.endswith(".cc"):
+        print("MODEL and OUTPUT have to be in the same format")
+        return 1
+
+    try:
+        buf = bytearray(ops.read_model(model_path))
+        count = rebatch(buf, batch)
+    except (ValueError, struct.error, IndexError) as e:
+        print("%s: %s" % (model_path, e))
+        return 1
+
+    ops.write_model(output_path, model_path, buf)
+    print("Batch %d: changed %d tensor(s)" % (batch, count))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Runs a validation set on the board, tensors are streamed from host.
+
+Usage:
+    eval_stream.py PORT TENSORS [LABELS] [--baud=N] [--csv=FILE]
+
+PORT is the console of power_test, USART2 or the USB CDC port of
+USB_CONSOLE, baud rate is ignored by the latter. TENSORS is a .npy array
+of int8 input tensors, already quantized with the input scale and zero
+point of the model, one tensor per row of the first axis. LABELS is an
+optional .npy array of class indexes, accuracy is printed for it.
+
+Script sends "EVAL <count>" and answers every "EVAL SEND n" line of the
+board with tensor n and its CRC-32. Board asks for the next tensor before
+it invokes the current one, so transfer and Invoke() overlap, look at
+inference_eval(). Every result line carries cycles, microseconds and raw
+int8 outputs, --csv writes them with one row per tensor. Damaged tensors
+are reported by the board and counted, they are not sent again.
+"""
+
+import re
+import struct
+import sys
+import zlib
+
+import numpy as np
+import serial
+
+READY = re.compile(r"EVAL READY (\d+) (\d+)")
+SEND = re.compile(r"EVAL SEND (\d+)")
+RESULT = re.compile(r"EVAL (\d+) (-?\d+(?: -?\d+)*|CRC|FAILED|TIMEOUT)$")
+
+
+def run(port, tensors):
+    """Yields (index, cycles, us, outputs) of every tensor, cycles is None
+    for tensors that were damaged on the way."""
+    port.reset_input_buffer()
+    port.write(b"EVAL %d\n" % len(tensors))
+    while True:
+        line = port.readline().decode("ascii", "replace").strip()
+        if not line:
+            raise RuntimeError("board does not answer")
+        if "NOT OK" in line:
+            raise RuntimeError("board refused EVAL")
+        match = READY.search(line)
+        if match:
+            break
+    size, outputs = int(match.group(1)), int(match.group(2))
+    if tensors[0].nbytes != size:
+        raise RuntimeError("model takes %d bytes, tensors have %d"
+                           % (size, tensors[0].nbytes))
+
+    done = 0
+    while done < len(tensors):
+        line = port.readline().decode("ascii", "replace").strip()
+        if not line:
+            raise RuntimeError("board stopped after %d tensors" % done)
+        match = SEND.search(line)
+        if match:
+            data = tensors[int(match.group(1))].tobytes()
+            port.write(data + struct.pack("<I", zlib.crc32(data)))
+            continue
+        match = RESULT.search(line)
+        if not match:
+            continue
+        index, values = int(match.group(1)), match.group(2)
+        if values in ("FAILED", "TIMEOUT"):
+            raise RuntimeError("tensor %d: %s" % (index, values))
+        done += 1
+        if values == "CRC":
+            yield index, None, None, None
+            continue
+        numbers = [int(v) for v in values.split()]
+        if len(numbers) != outputs + 2:
+            raise RuntimeError("tensor %d: %d outputs instead of %d"
+                               % (index, len(numbers) - 2, outputs))
+        yield index, numbers[0], numbers[1], numbers[2:]
+
+
+def main():
+    args = sys.argv[1:]
+    if len(args) < 2 or args[0].startswith("-"):
+        print(__doc__.split("\n\n")[1])
+        return 1
+
+    baud = 115200
+    csv = None
+    files = []
+    for arg in args:
+        name, _, value = arg.partition("=")
+        if name == "--baud":
+            baud = int(value)
+        elif name == "--csv":
+            csv = value
+        elif arg.startswith("-"):
+            print("Unknown argument %s" % arg)
+            return 1
+        else:
+            files.append(arg)
+
+    tensors = np.load(files[1])
+    if tensors.dtype != np.int8:
+        print("%s: tensors have to be int8, not %s" % (files[1], tensors.dtype))
+        return 1
+    tensors = tensors.reshape(len(tensors), -1)
+    labels = np.load(files[2]) if len(files) > 2 else None
+
+    results = []
+    damaged = 0
+    with serial.Serial(files[0], baud, timeout=10) as port:
+        try:
+            for index, cycles, us, outputs in run(port, tensors):
+                if cycles is None:
+                    damaged += 1
+                    continue
+                results.append((index, cycles, us, outputs))
+        except RuntimeError as e:
+            print("%s: %s" % (files[0], e))
+            return 1
+
+    if csv:
+        with open(csv, "w") as f:
+            f.write("index,cycles,us,outputs\n")
+            for index, cycles, us, outputs in results:
+                f.write("%d,%d,%d,%s\n" % (index, cycles, us,
+                                           " ".join(map(str, outputs))))
+
+    print("%d tensors, %d damaged on the way" % (len(results), damaged))
+    if not results:
+        return 1
+    cycles = np.array([r[1] for r in results])
+    us = np.array([r[2] for r in results])
+    print("cycles: median %d, p99 %d, max %d"
+          % (np.median(cycles), np.percentile(cycles, 99), cycles.max()))
+    print("us: median %d, p99 %d, max %d"
+          % (np.median(us), np.percentile(us, 99), us.max()))
+    if labels is not None:
+        correct = sum(int(np.argmax(r[3])) == int(labels[r[0]])
+                      for r in results)
+        print("accuracy: %.2f %% (%d of %d)"
+              % (100.0 * correct / len(results), correct, len(results)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,214 @@
+#!/usr/bin/env python3
+"""Fuses Conv2D and the MaxPool2D right after it into one operator.
+
+Usage:
+    fuse_conv_pool.py MODEL OUTPUT
+
+MODEL is either a .tflite flatbuffer or a .cc file with the model as C
+array, OUTPUT is written in the same format. Conv2D -> MaxPool2D stacks
+write every Conv2D output in full only for MaxPool2D to read it once and
+shrink it, in our thermal models first of them is most of the arena.
+Fused Conv2D writes pooled output directly: Conv2DPoolResolver in
+conv_pool_fused.h computes K conv rows at a time and keeps their KxK
+maximum, so full resolution tensor never exists. Conv2DSpecialisedResolver
+does the same for the first layer. Fused model needs Conv2DPoolResolver,
+original Conv2D kernel can not run it.
+
+Flatbuffer is edited in place, so its size and all offsets stay the same:
+output of Conv2D points to output of MaxPool2D and MaxPool2D is removed
+from operators vector, later operators move one slot forward. Full
+resolution tensor stays in the model, nothing uses it. Pool has to be
+KxK with stride K and no activation, VALID or dividing input size, with
+the same quantization on both sides, so it is exact for int8. ReLU is
+not a separate operator, converter folds it into Conv2D. Kernel finds K
+from the output size, pools where another K gives the same size are
+left alone. Regenerate memory plan and arena size afterwards.
+"""
+
+import struct
+import sys
+
+import gen_model_ops as ops
+
+CONV_2D = 3
+MAX_POOL_2D = 17
+
+# Schema field indices, rest of them are in gen_model_ops.py
+SUBGRAPH_TENSORS = 0
+SUBGRAPH_OUTPUTS = 2
+OPERATOR_INPUTS = 1
+OPERATOR_OUTPUTS = 2
+OPERATOR_BUILTIN_OPTIONS = 4
+TENSOR_SHAPE = 0
+TENSOR_QUANTIZATION = 4
+QUANTIZATION_SCALE = 2
+QUANTIZATION_ZERO_POINT = 3
+POOL_PADDING = 0
+POOL_STRIDE_W = 1
+POOL_STRIDE_H = 2
+POOL_FILTER_W = 3
+POOL_FILTER_H = 4
+POOL_ACTIVATION = 5
+PADDING_SAME = 0
+
+
+def opcode_codes(buf, model):
+    codes = []
+    for opcode in ops.vector_tables(buf, model, ops.MODEL_OPERATOR_CODES):
+        code = 0
+        pos = ops.field_pos(buf, opcode, ops.OPCODE_DEPRECATED_BUILTIN_CODE)
+        if pos is not None:
+            code = struct.unpack_from("<b", buf, pos)[0]
+        pos = ops.field_pos(buf, opcode, ops.OPCODE_BUILTIN_CODE)
+        if pos is not None:
+            code = max(code, struct.unpack_from("<i", buf, pos)[0])
+        codes.append(code)
+    return codes
+
+
+def scalar(buf, table, index, fmt, default=0):
+    pos = ops.field_pos(buf, table, index)
+    return default if pos is None else struct.unpack_from(fmt, buf, pos)[0]
+
+
+def vector_bytes(buf, table, index, element_size):
+    vector = ops.vector_pos(buf, table, index)
+    if vector is None:
+        return b""
+    end = vector + 4 + element_size * ops.u32(buf, vector)
+    return bytes(buf[vector + 4:end])
+
+
+def quantization(buf, tensor):
+    pos = ops.field_pos(buf, tensor, TENSOR_QUANTIZATION)
+    if pos is None:
+        return None
+    table = pos + ops.u32(buf, pos)
+    return (vector_bytes(buf, table, QUANTIZATION_SCALE, 4),
+            vector_bytes(buf, table, QUANTIZATION_ZERO_POINT, 8))
+
+
+def pool_factor(buf, pool, tensors):
+    """Returns K of KxK pool that can be fused, 0 if it can not."""
+    pos = ops.field_pos(buf, pool, OPERATOR_BUILTIN_OPTIONS)
+    if pos is None:
+        return 0
+    options = pos + ops.u32(buf, pos)
+    k = scalar(buf, options, POOL_FILTER_W, "<i")
+    if k < 2 or scalar(buf, options, POOL_FILTER_H, "<i") != k or \
+            scalar(buf, options, POOL_STRIDE_W, "<i") != k or \
+            scalar(buf, options, POOL_STRIDE_H, "<i") != k or \
+            scalar(buf, options, POOL_ACTIVATION, "<b") != 0:
+        return 0
+
+    source = ops.int_vector(buf, pool, OPERATOR_INPUTS)[0]
+    result = ops.int_vector(buf, pool, OPERATOR_OUTPUTS)[0]
+    in_shape = ops.int_vector(buf, tensors[source], TENSOR_SHAPE)
+    out_shape = ops.int_vector(buf, tensors[result], TENSOR_SHAPE)
+    if len(in_shape) != 4 or len(out_shape) != 4 or \
+            in_shape[0] != 1 or in_shape[3] != out_shape[3] or \
+            in_shape[1] // k != out_shape[1] or \
+            in_shape[2] // k != out_shape[2]:
+        return 0
+
+    # SAME pads windows at the edge, which fused kernel does not do
+    if scalar(buf, options, POOL_PADDING, "<b") == PADDING_SAME and \
+            (in_shape[1] % k or in_shape[2] % k):
+        return 0
+
+    # Kernel takes the smallest K that gives output size
+    for other in range(2, k):
+        if in_shape[1] // other == out_shape[1] and \
+                in_shape[2] // other == out_shape[2]:
+            return 0
+
+    q = quantization(buf, tensors[source])
+    if q is None or q != quantization(buf, tensors[result]):
+        return 0
+    return k
+
+
+def fuse(buf):
+    """Returns number of fused pairs, buf is a bytearray."""
+    if buf[4:8] != b"TFL3":
+        raise ValueError("not a TFLite flatbuffer")
+
+    model = ops.u32(buf, 0)
+    codes = opcode_codes(buf, model)
+    subgraph = ops.vector_tables(buf, model, ops.MODEL_SUBGRAPHS)[0]
+    tensors = ops.vector_tables(buf, subgraph, SUBGRAPH_TENSORS)
+    operators = ops.vector_pos(buf, subgraph, ops.SUBGRAPH_OPERATORS)
+    output_tensors = ops.int_vector(buf, subgraph, SUBGRAPH_OUTPUTS)
+
+    def operator_at(index):
+        element = operators + 4 + 4 * index
+        return element + ops.u32(buf, element)
+
+    def code_of(operator):
+        pos = ops.field_pos(buf, operator, ops.OPERATOR_OPCODE_INDEX)
+        return codes[ops.u32(buf, pos) if pos is not None else 0]
+
+    fused = 0
+    index = 0
+    while index + 1 < ops.u32(buf, operators):
+        count = ops.u32(buf, operators)
+        conv = operator_at(index)
+        pool = operator_at(index + 1)
+        index += 1
+        if code_of(conv) != CONV_2D or code_of(pool) != MAX_POOL_2D:
+            continue
+
+        result = ops.int_vector(buf, conv, OPERATOR_OUTPUTS)[0]
+        if ops.int_vector(buf, pool, OPERATOR_INPUTS)[0] != result or \
+                result in output_tensors:
+            continue
+        users = [i for i in range(count) if i != index and
+                 result in ops.int_vector(buf, operator_at(i), OPERATOR_INPUTS)]
+        if users or not pool_factor(buf, pool, tensors):
+            continue
+
+        # Conv2D writes what MaxPool2D wrote
+        outputs = ops.vector_pos(buf, conv, OPERATOR_OUTPUTS)
+        struct.pack_into("<i", buf, outputs + 4,
+                         ops.int_vector(buf, pool, OPERATOR_OUTPUTS)[0])
+
+        # Offsets are relative to their element, moved one slot down they
+        # point 4 bytes further
+        for i in range(index, count - 1):
+            element = operators + 4 + 4 * i
+            struct.pack_into("<I", buf, element,
+                             ops.u32(buf, element + 4) + 4)
+        struct.pack_into("<I", buf, operators + 4 + 4 * (count - 1), 0)
+        struct.pack_into("<I", buf, operators, count - 1)
+        fused += 1
+    return fused
+
+
+def main():
+    if len(sys.argv) != 3:
+        print("Usage:\nfuse_conv_pool.py MODEL OUTPUT")
+        return 1
+
+    model_path, output_path = sys.argv[1:]
+    if model_path.endswith(".cc") != output_path.endswith(".cc"):
+        print("MODEL and OUTPUT have to be in the same format")
+        return 1
+
+    try:
+        buf = bytearray(ops.read_model(model_path))
+        fused = fuse(buf)
+    except (ValueError, struct.error, IndexError) as e:
+        print("%s: %s" % (model_path, e))
+        return 1
+
+    if not fused:
+        print("%s: model has no Conv2D and MaxPool2D to fuse" % model_path)
+        return 1
+
+    ops.write_model(output_path, model_path, buf)
+    print("Fused %d Conv2D and MaxPool2D pair(s)" % fused)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""Generates assembly file that links a binary file as it is.
+
+Usage:
+    gen_blob.py INPUT OUTPUT_S [--align=N] [--section=NAME]
+
+INPUT is for example .tflite model or .npy image. Assembly includes it
+with .incbin, so there is no C array to compile and the object only
+changes with the file. It defines the same symbols as xxd -i in the
+folder of the file:
+
+    extern const unsigned char cifar_tflite[];
+    extern const unsigned int cifar_tflite_len;
+
+It also defines CRC-32 of the included bytes, the one of zlib, so
+firmware can check the blob, for example with crc_hw.c of power_test:
+
+    extern const unsigned int cifar_tflite_crc32;
+
+Array starts on N byte boundary, 32 by default, which is a cache line
+of Cortex-M7, and goes into section NAME.<symbol>, ".rodata.<symbol>" by
+default, so linker scripts place it like data of -fdata-sections. Other
+sections, for example for external QSPI flash, need a linker fragment
+that places them.
+
+Only data of .npy files is included, their header is skipped, so the
+array holds the samples in the order and type numpy saved them.
+"""
+
+import os
+import re
+import struct
+import sys
+import zlib
+
+NPY_MAGIC = b"\x93NUMPY"
+
+
+def npy_data_offset(path):
+    with open(path, "rb") as f:
+        head = f.read(12)
+    if head[:6] != NPY_MAGIC:
+        raise ValueError("not a .npy file")
+    # Version 1 has 2 byte header length, later ones 4 byte
+    if head[6] == 1:
+        return 10 + struct.unpack_from("<H", head, 8)[0]
+    return 12 + struct.unpack_from("<I", head, 8)[0]
+
+
+def main():
+    args = [arg for arg in sys.argv[1:] if not arg.startswith("--")]
+    if len(args) != 2:
+        print("Usage:\ngen_blob.py INPUT OUTPUT_S [--align=N] "
+              "[--section=NAME]")
+        return 1
+
+    align = 32
+    section = ".rodata"
+    for arg in sys.argv[1:]:
+        if arg.startswith("--align="):
+            align = int(arg[len("--align="):], 0)
+        elif arg.startswith("--section="):
+            section = arg[len("--section="):]
+
+    source, output = args
+    name = re.sub(r"[^A-Za-z0-9_]", "_", os.path.basename(source))
+    skip = 0
+    if source.endswith(".npy"):
+        try:
+            skip = npy_data_offset(source)
+        except (ValueError, struct.error) as e:
+            print("%s: %s" % (source, e), file=sys.stderr)
+            return 1
+
+    with open(source, "rb") as f:
+        f.seek(skip)
+        crc = zlib.crc32(f.read()) & 0xFFFFFFFF
+
+    # % form of .type works on ARM, where @ starts a comment, and on host
+    with open(output, "w") as f:
+        f.write("/* Generated by gen_blob.py from %s, do not edit */\n" % source)
+        f.write("    .section %s.%s, \"a\"\n" % (section, name))
+        f.write("    .balign %d\n" % align)
+        f.write("    .global %s\n" % name)
+        f.write("    .type %s, %%object\n" % name)
+        f.write("%s:\n" % name)
+        f.write("    .incbin \"%s\", %d\n" % (os.path.abspath(source), skip))
+        f.write("%s_end:\n" % name)
+        f.write("    .size %s, %s_end - %s\n" % (name, name, name))
+        f.write("    .balign 4\n")
+        f.write("    .global %s_len\n" % name)
+        f.write("    .type %s_len, %%object\n" % name)
+        f.write("%s_len:\n" % name)
+        f.write("    .int %s_end - %s\n" % (name, name))
+        f.write("    .size %s_len, 4\n" % name)
+        f.write("    .global %s_crc32\n" % name)
+        f.write("    .type %s_crc32, %%object\n" % name)
+        f.write("%s_crc32:\n" % name)
+        f.write("    .int 0x%08x\n" % crc)
+        f.write("    .size %s_crc32, 4\n" % name)
+        # Host linker would otherwise make stack of tests executable
+        f.write("    .section .note.GNU-stack, \"\", %progbits\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,337 @@
+#!/usr/bin/env python3
+"""Plans tensor arena of a TFLite model on the host and stores the plan in it.
+
+Usage:
+    gen_memory_plan.py [--search NODES] MODEL OUTPUT
+
+MODEL is either a .tflite flatbuffer or a .cc file with the model as C
+array, OUTPUT is written in the same format.
+
+TFLite Micro runs GreedyMemoryPlanner over all activation tensors in
+AllocateTensors(), on every boot. When model has "OfflineMemoryAllocation"
+metadata with offset of each tensor, planner places tensors at those
+offsets and only plans what is left, for example scratch buffers that
+kernels request. This tool does the same greedy planning once, with
+lifetimes computed the way micro_allocator.cc computes them, checks that
+no two live tensors overlap and writes offsets into the model.
+
+Reshape, Squeeze and ExpandDims only change the shape, so their output
+gets the offset of their input and both are planned as one tensor that
+lives as long as either of them. Reshape kernel of TFLite Micro copies
+only when output is at another address, so the copy and the second
+activation of the size of the input are gone. Outputs of aliasing
+operators that do not have the size of their input are planned as usual.
+
+Greedy packing is not always the tightest one. With --search the order
+tensors are placed in is searched as well, branch and bound over up to
+NODES partial orders, each tensor at the lowest offset that is free over
+its lifetime. Lowest placement in the order of the offsets of any plan
+gives a head no larger than that plan, so a search that finishes has
+found the smallest head. Search stops early at the largest sum of
+tensors live at one operator, no plan can be smaller. Small graphs of
+this repository finish in well under a second, printed result tells
+whether the head is proven smallest.
+
+Metadata table "min_runtime_version", which the converter adds and TFLite
+Micro does not read, is renamed and its buffer points to the plan, so no
+table has to be rebuilt. New string and plan are appended at the end of
+the flatbuffer, offsets to them point forward as flatbuffers require.
+
+Printed head size is what the plan needs, check ARENA_REPORT=1 build
+afterwards, scratch buffers are added on top of it.
+"""
+
+import struct
+import sys
+
+import gen_model_ops as ops
+
+METADATA_NAME = b"OfflineMemoryAllocation"
+REPLACED_METADATA = b"min_runtime_version"
+BUFFER_ALIGNMENT = 16
+
+# Schema field indices, rest of them are in gen_model_ops.py
+MODEL_BUFFERS = 4
+MODEL_METADATA = 6
+METADATA_NAME_FIELD = 0
+METADATA_BUFFER = 1
+BUFFER_DATA = 0
+SUBGRAPH_TENSORS = 0
+SUBGRAPH_INPUTS = 1
+SUBGRAPH_OUTPUTS = 2
+OPERATOR_INPUTS = 1
+OPERATOR_OUTPUTS = 2
+TENSOR_SHAPE = 0
+TENSOR_TYPE = 1
+TENSOR_BUFFER = 2
+TENSOR_IS_VARIABLE = 5
+
+# Operators whose output is the input with another shape
+RESHAPE = 22
+SQUEEZE = 43
+EXPAND_DIMS = 70
+VIEW_OPERATORS = (RESHAPE, SQUEEZE, EXPAND_DIMS)
+
+# TensorType from schema.fbs and its size in bytes
+TYPE_SIZES = {0: 4, 1: 2, 2: 4, 3: 1, 4: 8, 6: 1, 7: 2, 8: 8, 9: 1, 10: 8}
+
+
+def string_at(buf, pos):
+    start = pos + ops.u32(buf, pos)
+    return bytes(buf[start + 4:start + 4 + ops.u32(buf, start)])
+
+
+def scalar(buf, table, index, fmt, default=0):
+    pos = ops.field_pos(buf, table, index)
+    return default if pos is None else struct.unpack_from(fmt, buf, pos)[0]
+
+
+def arena_tensors(buf, model, subgraph):
+    """Returns [size, first, last] of each tensor, None for tensors that
+    are not planned in the arena."""
+    buffers = ops.vector_tables(buf, model, MODEL_BUFFERS)
+    tensors = ops.vector_tables(buf, subgraph, SUBGRAPH_TENSORS)
+    operators = ops.vector_tables(buf, subgraph, ops.SUBGRAPH_OPERATORS)
+
+    infos = []
+    for tensor in tensors:
+        data = ops.vector_pos(buf, buffers[scalar(buf, tensor, TENSOR_BUFFER,
+                                                  "<I")], BUFFER_DATA)
+        constant = data is not None and ops.u32(buf, data) > 0
+        variable = scalar(buf, tensor, TENSOR_IS_VARIABLE, "<B")
+        if constant or variable:
+            infos.append(None)
+            continue
+
+        tensor_type = scalar(buf, tensor, TENSOR_TYPE, "<b")
+        if tensor_type not in TYPE_SIZES:
+            raise ValueError("tensor type %d is not supported" % tensor_type)
+        size = TYPE_SIZES[tensor_type]
+        for dim in ops.int_vector(buf, tensor, TENSOR_SHAPE):
+            size *= dim
+        size = (size + BUFFER_ALIGNMENT - 1) & ~(BUFFER_ALIGNMENT - 1)
+        infos.append([size, -1, -1])
+
+    # Same lifetimes as AllocationInfoBuilder::AddTensors()
+    for i in ops.int_vector(buf, subgraph, SUBGRAPH_INPUTS):
+        if infos[i]:
+            infos[i][1] = 0
+    for i in ops.int_vector(buf, subgraph, SUBGRAPH_OUTPUTS):
+        if infos[i]:
+            infos[i][2] = len(operators) - 1
+    for index in range(len(operators) - 1, -1, -1):
+        for i in ops.int_vector(buf, operators[index], OPERATOR_INPUTS):
+            if i >= 0 and infos[i] and infos[i][2] < index:
+                infos[i][2] = index
+        for i in ops.int_vector(buf, operators[index], OPERATOR_OUTPUTS):
+            if infos[i] and (infos[i][1] == -1 or infos[i][1] > index):
+                infos[i][1] = index
+
+    # Tensors that nothing uses are left to the planner on target
+    return [info if info and info[1] != -1 else None for info in infos]
+
+
+def aliases(buf, model, subgraph, infos):
+    """Returns {output: input} of planned tensors that view operators share,
+    input is the first tensor of a chain of views."""
+    codes = []
+    for opcode in ops.vector_tables(buf, model, ops.MODEL_OPERATOR_CODES):
+        code = scalar(buf, opcode, ops.OPCODE_DEPRECATED_BUILTIN_CODE, "<b")
+        codes.append(max(code, scalar(buf, opcode, ops.OPCODE_BUILTIN_CODE,
+                                      "<i")))
+
+    shared = {}
+    for operator in ops.vector_tables(buf, subgraph, ops.SUBGRAPH_OPERATORS):
+        if codes[scalar(buf, operator, ops.OPERATOR_OPCODE_INDEX, "<I")] \
+                not in VIEW_OPERATORS:
+            continue
+        source = ops.int_vector(buf, operator, OPERATOR_INPUTS)[0]
+        result = ops.int_vector(buf, operator, OPERATOR_OUTPUTS)[0]
+        if source >= 0 and infos[source] and infos[result] and \
+                infos[source][0] == infos[result][0]:
+            shared[result] = shared.get(source, source)
+    return shared
+
+
+def lowest_offset(infos, offsets, placed, i):
+    """Lowest offset where tensor i does not overlap placed tensors that
+    are live at the same time."""
+    size, first, last = infos[i]
+    live = sorted((offsets[j], infos[j][0]) for j in placed
+                  if infos[j][1] <= last and first <= infos[j][2])
+    offset = 0
+    for start, length in live:
+        if offset + size <= start:
+            break
+        offset = max(offset, start + length)
+    return offset
+
+
+def search(infos, order, offsets, head, nodes):
+    """Branch and bound over placement orders, offsets and head of the
+    greedy plan are the first bound. Returns offsets, head and whether
+    the head is proven smallest."""
+    bound = 0
+    for t in range(max(infos[i][2] for i in order) + 1):
+        bound = max(bound, sum(infos[i][0] for i in order
+                               if infos[i][1] <= t <= infos[i][2]))
+    best = [list(offsets), head]
+    budget = [nodes]
+    current = list(offsets)
+
+    def visit(placed, rest, top):
+        if best[1] == bound:
+            return True
+        if not rest:
+            best[0], best[1] = list(current), top
+            return True
+        tried = set()
+        for i in rest:
+            # Tensors of the same size and lifetime are interchangeable
+            if tuple(infos[i]) in tried:
+                continue
+            tried.add(tuple(infos[i]))
+            offset = lowest_offset(infos, current, placed, i)
+            end = max(top, offset + infos[i][0])
+            if end >= best[1]:
+                continue
+            if budget[0] == 0:
+                return False
+            budget[0] -= 1
+            current[i] = offset
+            placed.append(i)
+            done = visit(placed, [j for j in rest if j != i], end)
+            placed.pop()
+            if not done:
+                return False
+        return True
+
+    finished = visit([], list(order), 0)
+    return best[0], best[1], finished or best[1] == bound
+
+
+def plan(infos, shared=None, nodes=0):
+    """Greedy placement, largest tensors first at lowest free offset, with
+    nodes > 0 orders are searched for a smaller head. Tensors of shared
+    are placed at the offset of their input. Returns offsets, head and
+    whether search proved the head smallest."""
+    shared = shared or {}
+    infos = [list(info) if info else None for info in infos]
+    for result, source in shared.items():
+        infos[source][1] = min(infos[source][1], infos[result][1])
+        infos[source][2] = max(infos[source][2], infos[result][2])
+
+    offsets = [-1] * len(infos)
+    placed = []
+    order = sorted((i for i, info in enumerate(infos)
+                    if info and i not in shared),
+                   key=lambda i: (-infos[i][0], i))
+    for i in order:
+        offsets[i] = lowest_offset(infos, offsets, placed, i)
+        placed.append(i)
+    optimal = False
+    if nodes > 0 and order:
+        head = max(offsets[i] + infos[i][0] for i in order)
+        offsets, head, optimal = search(infos, order, offsets, head, nodes)
+    for result, source in shared.items():
+        offsets[result] = offsets[source]
+
+    for i in placed:
+        for j in placed:
+            if i < j and infos[i][1] <= infos[j][2] and \
+                    infos[j][1] <= infos[i][2] and \
+                    offsets[i] < offsets[j] + infos[j][0] and \
+                    offsets[j] < offsets[i] + infos[i][0]:
+                raise ValueError("tensors %d and %d overlap" % (i, j))
+
+    head = max([offsets[i] + infos[i][0] for i in placed] or [0])
+    return offsets, head, optimal
+
+
+def append(buf, data, alignment=4):
+    while len(buf) % alignment:
+        buf.append(0)
+    pos = len(buf)
+    buf.extend(data)
+    return pos
+
+
+def store_plan(buf, model, offsets):
+    metadata = None
+    for table in ops.vector_tables(buf, model, MODEL_METADATA):
+        name_pos = ops.field_pos(buf, table, METADATA_NAME_FIELD)
+        name = string_at(buf, name_pos)
+        if name == METADATA_NAME:
+            raise ValueError("model already has a memory plan")
+        if name == REPLACED_METADATA:
+            metadata = table
+    if metadata is None:
+        raise ValueError("model has no %s metadata to replace"
+                         % REPLACED_METADATA.decode())
+
+    buffers = ops.vector_tables(buf, model, MODEL_BUFFERS)
+    data_pos = ops.field_pos(buf, buffers[scalar(buf, metadata,
+                                                 METADATA_BUFFER, "<I")],
+                             BUFFER_DATA)
+    if data_pos is None:
+        raise ValueError("metadata buffer has no data field")
+
+    # Version 1, subgraph 0, number of tensors, offset of each, -1 is
+    # planned on target
+    words = [1, 0, len(offsets)] + offsets
+    data = struct.pack("<%di" % len(words), *words)
+    vector = append(buf, struct.pack("<I", len(data)) + data)
+    struct.pack_into("<I", buf, data_pos, vector - data_pos)
+
+    string = append(buf, struct.pack("<I", len(METADATA_NAME)) +
+                    METADATA_NAME + b"\0")
+    name_pos = ops.field_pos(buf, metadata, METADATA_NAME_FIELD)
+    struct.pack_into("<I", buf, name_pos, string - name_pos)
+
+    while len(buf) % BUFFER_ALIGNMENT:
+        buf.append(0)
+
+
+def main():
+    args = sys.argv[1:]
+    nodes = 0
+    if len(args) == 4 and args[0] == "--search":
+        nodes = int(args[1])
+        args = args[2:]
+    if len(args) != 2:
+        print("Usage:\ngen_memory_plan.py [--search NODES] MODEL OUTPUT")
+        return 1
+
+    model_path, output_path = args
+    if model_path.endswith(".cc") != output_path.endswith(".cc"):
+        print("MODEL and OUTPUT have to be in the same format")
+        return 1
+
+    try:
+        buf = bytearray(ops.read_model(model_path))
+        if buf[4:8] != b"TFL3":
+            raise ValueError("not a TFLite flatbuffer")
+        model = ops.u32(buf, 0)
+        subgraphs = ops.vector_tables(buf, model, ops.MODEL_SUBGRAPHS)
+        if len(subgraphs) != 1:
+            raise ValueError("only models with one subgraph are supported")
+
+        infos = arena_tensors(buf, model, subgraphs[0])
+        shared = aliases(buf, model, subgraphs[0], infos)
+        offsets, head, optimal = plan(infos, shared, nodes)
+        store_plan(buf, model, offsets)
+    except (ValueError, struct.error, IndexError) as e:
+        print("%s: %s" % (model_path, e))
+        return 1
+
+    ops.write_model(output_path, model_path, buf)
+    print("Planned %d tensors, %d of them aliased, head %d bytes"
+          % (sum(1 for o in offsets if o >= 0), len(shared), head))
+    if nodes:
+        print("Head is %s" % ("smallest possible" if optimal else
+                              "best found, search ran out of nodes"))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
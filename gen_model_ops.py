@@ -0,0 +1,282 @@
+#!/usr/bin/env python3
+"""Generates header with operators that a TFLite model needs.
+
+Usage:
+    gen_model_ops.py MODEL [MODEL ...] OUTPUT_HEADER
+    gen_model_ops.py --list MODEL [MODEL ...]
+
+MODEL is either a .tflite flatbuffer or a .cc file with the model as C
+array (output of xxd -i). Header contains number of operators, function
+that registers exactly those operators on MicroMutableOpResolver and list
+of engine_ops tags for InferenceEngine, see shared/inference_engine.h.
+With several models the header has union of their operators, so one
+resolver can run any of them, for example when models are swapped at
+runtime.
+
+With --list only operator names are printed, separated by spaces, so
+archive_makefile can compile just the kernels of the model.
+
+Only operator codes that some operator of the model uses are listed, so
+codes left behind by strip_dequantize.py do not link their kernels.
+
+Custom operators are refused, except the ones of SHARED_CUSTOM_OPS, which
+a resolver in shared/ provides without MicroMutableOpResolver, they are
+left out.
+
+Flatbuffer is parsed directly, so no tensorflow or flatbuffers package is
+needed on the host.
+"""
+
+import re
+import struct
+import sys
+
+# BuiltinOperator value from schema.fbs and MicroMutableOpResolver function
+BUILTIN_OPS = {
+    0: "Add",
+    1: "AveragePool2D",
+    2: "Concatenation",
+    3: "Conv2D",
+    4: "DepthwiseConv2D",
+    6: "Dequantize",
+    8: "Floor",
+    9: "FullyConnected",
+    11: "L2Normalization",
+    14: "Logistic",
+    17: "MaxPool2D",
+    18: "Mul",
+    19: "Relu",
+    21: "Relu6",
+    22: "Reshape",
+    25: "Softmax",
+    27: "Svdf",
+    28: "Tanh",
+    34: "Pad",
+    40: "Mean",
+    41: "Sub",
+    45: "StridedSlice",
+    49: "Split",
+    54: "Prelu",
+    55: "Maximum",
+    56: "ArgMax",
+    57: "Minimum",
+    58: "Less",
+    59: "Neg",
+    60: "PadV2",
+    61: "Greater",
+    62: "GreaterEqual",
+    63: "LessEqual",
+    66: "Sin",
+    71: "Equal",
+    72: "NotEqual",
+    73: "Log",
+    75: "Sqrt",
+    76: "Rsqrt",
+    77: "Shape",
+    79: "ArgMin",
+    82: "ReduceMax",
+    83: "Pack",
+    84: "LogicalOr",
+    86: "LogicalAnd",
+    87: "LogicalNot",
+    88: "Unpack",
+    92: "Square",
+    97: "ResizeNearestNeighbor",
+    101: "Abs",
+    102: "SplitV",
+    104: "Ceil",
+    108: "Cos",
+    114: "Quantize",
+    116: "Round",
+    117: "HardSwish",
+}
+
+# Custom operators that are not registered, shared resolver has the kernel
+SHARED_CUSTOM_OPS = {
+    "TFLite_Detection_PostProcess": "shared/detection_postprocess.h",
+}
+
+# Schema field indices
+MODEL_OPERATOR_CODES = 1
+MODEL_SUBGRAPHS = 2
+SUBGRAPH_OPERATORS = 3
+OPERATOR_OPCODE_INDEX = 0
+OPCODE_DEPRECATED_BUILTIN_CODE = 0
+OPCODE_CUSTOM_CODE = 1
+OPCODE_BUILTIN_CODE = 3
+
+
+def read_model(path):
+    if not path.endswith(".cc"):
+        with open(path, "rb") as f:
+            return f.read()
+
+    # C array, take only bytes between first { and matching };
+    with open(path) as f:
+        text = f.read()
+    start = text.index("{")
+    end = text.index("};", start)
+    values = re.findall(r"0x([0-9a-fA-F]{1,2})", text[start:end])
+    return bytes(int(v, 16) for v in values)
+
+
+def write_model(path, source_path, buf):
+    """Writes model in the format of path, .cc keeps text of source_path
+    around the array and gets new length."""
+    if not path.endswith(".cc"):
+        with open(path, "wb") as f:
+            f.write(buf)
+        return
+
+    with open(source_path) as f:
+        text = f.read()
+    start = text.index("{")
+    end = text.index("};", start)
+
+    lines = []
+    for i in range(0, len(buf), 12):
+        lines.append("  " + ", ".join("0x%02x" % b for b in buf[i:i + 12]))
+    array = "{\n" + ",\n".join(lines) + "\n"
+
+    tail = re.sub(r"_len = \d+;", "_len = %d;" % len(buf), text[end:], 1)
+    with open(path, "w") as f:
+        f.write(text[:start] + array + tail)
+
+
+def u32(buf, pos):
+    return struct.unpack_from("<I", buf, pos)[0]
+
+
+def field_pos(buf, table, index):
+    """Returns absolute position of table field or None if not present."""
+    vtable = table - struct.unpack_from("<i", buf, table)[0]
+    vtable_size = struct.unpack_from("<H", buf, vtable)[0]
+    entry = 4 + 2 * index
+    if entry >= vtable_size:
+        return None
+    offset = struct.unpack_from("<H", buf, vtable + entry)[0]
+    return table + offset if offset else None
+
+
+def string_field(buf, table, index):
+    """Returns string of table field or None if not present."""
+    pos = field_pos(buf, table, index)
+    if pos is None:
+        return None
+    string = pos + u32(buf, pos)
+    return buf[string + 4:string + 4 + u32(buf, string)].decode("utf-8")
+
+
+def vector_pos(buf, table, index):
+    """Returns position of vector length or None if field is not present."""
+    pos = field_pos(buf, table, index)
+    return None if pos is None else pos + u32(buf, pos)
+
+
+def int_vector(buf, table, index):
+    vector = vector_pos(buf, table, index)
+    if vector is None:
+        return []
+    return [struct.unpack_from("<i", buf, vector + 4 + 4 * i)[0]
+            for i in range(u32(buf, vector))]
+
+
+def vector_tables(buf, table, index):
+    pos = field_pos(buf, table, index)
+    if pos is None:
+        return []
+    vector = pos + u32(buf, pos)
+    length = u32(buf, vector)
+    tables = []
+    for i in range(length):
+        element = vector + 4 + 4 * i
+        tables.append(element + u32(buf, element))
+    return tables
+
+
+def operator_names(buf):
+    if buf[4:8] != b"TFL3":
+        raise ValueError("not a TFLite flatbuffer")
+
+    model = u32(buf, 0)
+    used = set()
+    for subgraph in vector_tables(buf, model, MODEL_SUBGRAPHS):
+        for operator in vector_tables(buf, subgraph, SUBGRAPH_OPERATORS):
+            pos = field_pos(buf, operator, OPERATOR_OPCODE_INDEX)
+            used.add(u32(buf, pos) if pos is not None else 0)
+
+    names = []
+    for index, opcode in enumerate(vector_tables(buf, model,
+                                                 MODEL_OPERATOR_CODES)):
+        if index not in used:
+            continue
+        custom = string_field(buf, opcode, OPCODE_CUSTOM_CODE)
+        if custom in SHARED_CUSTOM_OPS:
+            continue
+        if custom is not None:
+            raise ValueError("custom operator %s is not supported" % custom)
+
+        # Newer schema stores code in int32 field, older in int8 one,
+        # TFLite takes the larger of the two.
+        code = 0
+        pos = field_pos(buf, opcode, OPCODE_DEPRECATED_BUILTIN_CODE)
+        if pos is not None:
+            code = struct.unpack_from("<b", buf, pos)[0]
+        pos = field_pos(buf, opcode, OPCODE_BUILTIN_CODE)
+        if pos is not None:
+            code = max(code, struct.unpack_from("<i", buf, pos)[0])
+
+        if code not in BUILTIN_OPS:
+            raise ValueError("builtin operator %d has no Add function in "
+                             "MicroMutableOpResolver" % code)
+        if BUILTIN_OPS[code] not in names:
+            names.append(BUILTIN_OPS[code])
+    return names
+
+
+def write_header(path, model_paths, names):
+    with open(path, "w") as f:
+        f.write("// Generated by gen_model_ops.py from %s, do not edit\n"
+                % ", ".join(model_paths))
+        f.write("#ifndef MODEL_OPS_H\n#define MODEL_OPS_H\n\n")
+        f.write("#include \"tensorflow/lite/c/common.h\"\n\n")
+        f.write("constexpr int kModelOpsCount = %d;\n\n" % len(names))
+        f.write("template <typename Resolver>\n")
+        f.write("inline TfLiteStatus RegisterModelOps(Resolver& resolver) {\n")
+        for name in names:
+            f.write("  if (resolver.Add%s() != kTfLiteOk) return kTfLiteError;\n"
+                    % name)
+        f.write("  return kTfLiteOk;\n}\n\n")
+        f.write("// Operator tags for InferenceEngine template\n")
+        f.write("#define MODEL_ENGINE_OPS %s\n\n"
+                % ", ".join("engine_ops::%s" % n for n in names))
+        f.write("#endif  // MODEL_OPS_H\n")
+
+
+def main():
+    list_only = len(sys.argv) > 1 and sys.argv[1] == "--list"
+    if len(sys.argv) < 3:
+        print("Usage:\ngen_model_ops.py MODEL [MODEL ...] OUTPUT_HEADER\n"
+              "gen_model_ops.py --list MODEL [MODEL ...]")
+        return 1
+
+    model_paths = sys.argv[2:] if list_only else sys.argv[1:-1]
+    names = []
+    for model_path in model_paths:
+        try:
+            model_names = operator_names(read_model(model_path))
+        except (ValueError, struct.error) as e:
+            # Not on stdout, make reads names from it
+            print("%s: %s" % (model_path, e), file=sys.stderr)
+            return 1
+        names += [n for n in model_names if n not in names]
+
+    if list_only:
+        print(" ".join(names))
+    else:
+        write_header(sys.argv[-1], model_paths, names)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,763 @@
+#!/usr/bin/env python3
+"""Generates C++ code that runs a TFLite model without the interpreter.
+
+Usage:
+    gen_static_model.py MODEL OUTPUT_CC
+
+MODEL is either a .tflite flatbuffer or a .cc file with the model as C
+array. OUTPUT_CC and the header next to it, OUTPUT with .h, have one
+function that calls CMSIS-NN kernels of each operator in order. Shapes,
+quantization multipliers, activation ranges and arena offsets of the
+memory plan are constexpr, so there is no flatbuffer parsing, no
+AllocateTensors() and no dispatch through registrations at runtime, and
+with LTO the compiler sees the whole model at once. Functions are named
+after OUTPUT, static_model.cc gives:
+
+    constexpr size_t kStaticModelArenaSize;
+    bool static_model_matches(size_t model_len, uint32_t model_crc32);
+    bool static_model_setup();
+    bool static_model_invoke(const uint8_t* model, uint8_t* arena);
+    int8_t* static_model_input(uint8_t* arena);
+    float* static_model_output(uint8_t* arena);
+
+Weights and biases stay in the model, generated code reads them at their
+offset in the flatbuffer, so the model has to be linked as well, like
+BLOBS of project.mk do. static_model_matches() compares length and CRC-32
+of gen_blob.py with the model the code was generated from.
+
+Tensors are placed by the same greedy plan as gen_memory_plan.py, strip
+of fused Conv2D and im2col buffer of CMSIS-NN come after them. Quantized
+parameters are computed the way TFLite Micro kernels compute them in
+Prepare(), so results match the interpreter with CMSIS-NN kernels.
+static_model_setup() checks that im2col buffers that kernels of the
+linked CMSIS-NN ask for fit the reserved space.
+
+Supported are int8 Conv2D, also fused with MaxPool2D by fuse_conv_pool.py,
+FullyConnected, Softmax, Reshape and Dequantize of the output, which is
+what our CIFAR model has. Any other operator or type is an error, run
+such models with the interpreter.
+"""
+
+import math
+import os
+import re
+import struct
+import sys
+import zlib
+
+import gen_memory_plan as plan
+import gen_model_ops as ops
+from fuse_conv_pool import opcode_codes, quantization, scalar
+
+CONV_2D = 3
+DEQUANTIZE = 6
+FULLY_CONNECTED = 9
+RESHAPE = 22
+SOFTMAX = 25
+
+INT8 = 9
+FLOAT32 = 0
+
+# Schema field indices, rest of them are in gen_model_ops.py
+SUBGRAPH_TENSORS = 0
+SUBGRAPH_INPUTS = 1
+SUBGRAPH_OUTPUTS = 2
+OPERATOR_OPCODE_INDEX = 0
+OPERATOR_INPUTS = 1
+OPERATOR_OUTPUTS = 2
+OPERATOR_BUILTIN_OPTIONS = 4
+TENSOR_SHAPE = 0
+TENSOR_TYPE = 1
+TENSOR_BUFFER = 2
+MODEL_BUFFERS = 4
+BUFFER_DATA = 0
+CONV_PADDING = 0
+CONV_STRIDE_W = 1
+CONV_STRIDE_H = 2
+CONV_ACTIVATION = 3
+CONV_DILATION_W = 4
+CONV_DILATION_H = 5
+FC_ACTIVATION = 0
+SOFTMAX_BETA = 0
+PADDING_SAME = 0
+
+ACTIVATION_NONE = 0
+ACTIVATION_RELU = 1
+ACTIVATION_RELU_N1_TO_1 = 2
+ACTIVATION_RELU6 = 3
+
+# Softmax input is scaled to Q5.26, kScaledDiffIntegerBits of softmax.cc
+SOFTMAX_INTEGER_BITS = 5
+
+
+def f32(value):
+    """Rounds double to float, as C++ float arithmetic does."""
+    return struct.unpack("<f", struct.pack("<f", value))[0]
+
+
+def tflite_round(value):
+    """std::round, halves away from zero."""
+    return math.floor(value + 0.5) if value >= 0 else -math.floor(0.5 - value)
+
+
+def quantize_multiplier(real):
+    """QuantizeMultiplier() of quantization_util.cc, (multiplier, shift)
+    with shift to the left positive, as CMSIS-NN takes it."""
+    if real == 0.0:
+        return 0, 0
+    fraction, shift = math.frexp(real)
+    multiplier = tflite_round(fraction * (1 << 31))
+    if multiplier == 1 << 31:
+        multiplier //= 2
+        shift += 1
+    if shift < -31:
+        return 0, 0
+    return multiplier, shift
+
+
+def activation_range(activation, scale, zero_point):
+    """CalculateActivationRangeQuantized() for int8 output."""
+    def quantize(value):
+        return zero_point + int(tflite_round(f32(value / scale)))
+
+    if activation == ACTIVATION_NONE:
+        return -128, 127
+    if activation == ACTIVATION_RELU:
+        return max(-128, quantize(0.0)), 127
+    if activation == ACTIVATION_RELU6:
+        return max(-128, quantize(0.0)), min(127, quantize(6.0))
+    if activation == ACTIVATION_RELU_N1_TO_1:
+        return max(-128, quantize(-1.0)), min(127, quantize(1.0))
+    raise ValueError("activation %d is not supported" % activation)
+
+
+def out_size(padding, size, filter_size, stride, dilation):
+    """ComputeOutSize() of padding.h."""
+    effective = (filter_size - 1) * dilation + 1
+    if padding == PADDING_SAME:
+        return (size + stride - 1) // stride
+    return (size + stride - effective) // stride
+
+
+def pad_size(padding, size, filter_size, stride, dilation):
+    """Padding before the first row or column, ComputePadding()."""
+    effective = (filter_size - 1) * dilation + 1
+    out = out_size(padding, size, filter_size, stride, dilation)
+    return max(((out - 1) * stride + effective - size) // 2, 0)
+
+
+def align(value):
+    return (value + plan.BUFFER_ALIGNMENT - 1) & ~(plan.BUFFER_ALIGNMENT - 1)
+
+
+def c_name(path):
+    """static_model.cc -> ("static_model", "StaticModel")."""
+    name = re.sub(r"[^A-Za-z0-9_]", "_",
+                  os.path.splitext(os.path.basename(path))[0])
+    return name, "".join(part.capitalize() for part in name.split("_"))
+
+
+def int_list(values):
+    lines = []
+    for i in range(0, len(values), 6):
+        lines.append("    " + ", ".join("%d" % v for v in values[i:i + 6]))
+    return "{\n" + ",\n".join(lines) + ",\n}"
+
+
+class Model:
+    """Tensors, constant buffers and arena plan of the only subgraph."""
+
+    def __init__(self, buf):
+        if buf[4:8] != b"TFL3":
+            raise ValueError("not a TFLite flatbuffer")
+        self.buf = buf
+        model = ops.u32(buf, 0)
+        subgraphs = ops.vector_tables(buf, model, ops.MODEL_SUBGRAPHS)
+        if len(subgraphs) != 1:
+            raise ValueError("only models with one subgraph are supported")
+        subgraph = subgraphs[0]
+
+        self.codes = opcode_codes(buf, model)
+        self.buffers = ops.vector_tables(buf, model, MODEL_BUFFERS)
+        self.tensors = ops.vector_tables(buf, subgraph, SUBGRAPH_TENSORS)
+        self.operators = ops.vector_tables(buf, subgraph,
+                                           ops.SUBGRAPH_OPERATORS)
+        self.inputs = ops.int_vector(buf, subgraph, SUBGRAPH_INPUTS)
+        self.outputs = ops.int_vector(buf, subgraph, SUBGRAPH_OUTPUTS)
+        if len(self.inputs) != 1 or len(self.outputs) != 1:
+            raise ValueError("only models with one input and one output "
+                             "are supported")
+
+        self.infos = plan.arena_tensors(buf, model, subgraph)
+        self.offsets, self.head, _ = plan.plan(
+            self.infos, plan.aliases(buf, model, subgraph, self.infos))
+
+    def shape(self, tensor):
+        return ops.int_vector(self.buf, self.tensors[tensor], TENSOR_SHAPE)
+
+    def type(self, tensor):
+        return scalar(self.buf, self.tensors[tensor], TENSOR_TYPE, "<b")
+
+    def elements(self, tensor):
+        return math.prod(self.shape(tensor))
+
+    def quant(self, tensor):
+        """Returns ([scales], [zero points])."""
+        q = quantization(self.buf, self.tensors[tensor])
+        if q is None or not q[0]:
+            raise ValueError("tensor %d is not quantized" % tensor)
+        return (list(struct.unpack("<%df" % (len(q[0]) // 4), q[0])),
+                list(struct.unpack("<%dq" % (len(q[1]) // 8), q[1])))
+
+    def activation(self, tensor, type_code=INT8):
+        """Arena offset of a planned tensor of type_code."""
+        if self.type(tensor) != type_code:
+            raise ValueError("tensor %d has type %d"
+                             % (tensor, self.type(tensor)))
+        if self.offsets[tensor] < 0:
+            raise ValueError("tensor %d is not in the arena" % tensor)
+        return self.offsets[tensor]
+
+    def constant(self, tensor, type_code, size):
+        """Offset of data of a constant tensor in the flatbuffer."""
+        if self.type(tensor) != type_code:
+            raise ValueError("tensor %d has type %d"
+                             % (tensor, self.type(tensor)))
+        index = scalar(self.buf, self.tensors[tensor], TENSOR_BUFFER, "<I")
+        data = ops.vector_pos(self.buf, self.buffers[index], BUFFER_DATA)
+        if data is None or ops.u32(self.buf, data) != \
+                size * self.elements(tensor):
+            raise ValueError("tensor %d is not constant" % tensor)
+        if (data + 4) % size:
+            raise ValueError("data of tensor %d is not aligned" % tensor)
+        return data + 4
+
+    def options(self, operator):
+        pos = ops.field_pos(self.buf, operator, OPERATOR_BUILTIN_OPTIONS)
+        return None if pos is None else pos + ops.u32(self.buf, pos)
+
+    def option(self, options, index, fmt, default=0):
+        if options is None:
+            return default
+        return scalar(self.buf, options, index, fmt, default)
+
+
+class Generator:
+    """Collects constants and calls of each operator."""
+
+    def __init__(self, model, prefix):
+        self.model = model
+        self.prefix = prefix
+        self.constants = []
+        self.calls = []
+        self.checks = []
+        self.strip_size = 0
+        self.im2col_size = 0
+
+    def conv(self, index, operator, inputs, outputs):
+        m = self.model
+        source, weights = inputs[0], inputs[1]
+        bias = inputs[2] if len(inputs) > 2 else -1
+        result = outputs[0]
+        in_shape, f_shape, out_shape = (m.shape(source), m.shape(weights),
+                                        m.shape(result))
+        if len(in_shape) != 4 or len(f_shape) != 4 or len(out_shape) != 4 \
+                or in_shape[0] != 1:
+            raise ValueError("Conv2D %d needs one NHWC image" % index)
+
+        options = m.options(operator)
+        padding = m.option(options, CONV_PADDING, "<b")
+        stride_w = m.option(options, CONV_STRIDE_W, "<i")
+        stride_h = m.option(options, CONV_STRIDE_H, "<i")
+        dilation_w = m.option(options, CONV_DILATION_W, "<i", 1)
+        dilation_h = m.option(options, CONV_DILATION_H, "<i", 1)
+        activation = m.option(options, CONV_ACTIVATION, "<b")
+
+        rows = out_size(padding, in_shape[1], f_shape[1], stride_h,
+                        dilation_h)
+        cols = out_size(padding, in_shape[2], f_shape[2], stride_w,
+                        dilation_w)
+        # Same K as Conv2DPoolResolver::PoolFactor()
+        pool = next((k for k in range(1, rows + 1)
+                     if rows // k == out_shape[1] and
+                     cols // k == out_shape[2]), 0)
+        if pool == 0:
+            raise ValueError("Conv2D %d output fits no fused pool" % index)
+        strip_rows = pool if pool > 1 else rows
+        pad_h = pad_size(padding, in_shape[1], f_shape[1], stride_h,
+                         dilation_h)
+        pad_w = pad_size(padding, in_shape[2], f_shape[2], stride_w,
+                         dilation_w)
+
+        in_scale, in_zero = m.quant(source)
+        f_scales, _ = m.quant(weights)
+        out_scale, out_zero = m.quant(result)
+        channels = f_shape[0]
+        if len(f_scales) == 1:
+            f_scales = f_scales * channels
+        multipliers = []
+        shifts = []
+        for scale in f_scales:
+            multiplier, shift = quantize_multiplier(
+                in_scale[0] * scale / out_scale[0])
+            multipliers.append(multiplier)
+            shifts.append(shift)
+        act_min, act_max = activation_range(activation, out_scale[0],
+                                            out_zero[0])
+
+        # Input rows of one strip, StripInput() of conv_pool_fused.h
+        span = (strip_rows - 1) * stride_h + (f_shape[1] - 1) * dilation_h + 1
+        first_count = min(span - pad_h, in_shape[1])
+
+        name = "kConv%d" % index
+        self.constants.append(
+            "// Operator %d, Conv2D %dx%d of %d channels%s\n"
+            "constexpr int32_t %sMultiplier[%d] = %s;\n"
+            "constexpr int32_t %sShift[%d] = %s;\n"
+            "constexpr ConvLayer %s = {\n"
+            "    {%d, %d, {%d, %d}, {%d, %d}, {%d, %d}, {%d, %d}},\n"
+            "    {1, %d, %d, %d},\n"
+            "    {%d, %d, %d, %d},\n"
+            "    {1, 1, 1, %d},\n"
+            "    {1, %d, %d, %d},\n"
+            "    %sMultiplier, %sShift, %d, %d, %d, %d, %d, %d,\n"
+            "};\n"
+            % (index, f_shape[1], f_shape[2], channels,
+               ", %dx%d max pool" % (pool, pool) if pool > 1 else "",
+               name, channels, int_list(multipliers),
+               name, channels, int_list(shifts),
+               name,
+               -in_zero[0], out_zero[0], stride_w, stride_h, pad_w, pad_h,
+               dilation_w, dilation_h, act_min, act_max,
+               first_count, in_shape[2], in_shape[3],
+               channels, f_shape[1], f_shape[2], f_shape[3],
+               channels,
+               strip_rows, cols, channels,
+               name, name, m.constant(weights, INT8, 1),
+               m.constant(bias, 2, 4) if bias >= 0 else 0,
+               1 if bias >= 0 else 0, in_shape[1], pad_h, span))
+
+        if pool > 1:
+            self.strip_size = max(self.strip_size,
+                                  align(pool * cols * channels))
+            self.calls.append(
+                "  // Operator %d, Conv2D and %dx%d max pool\n"
+                "  for (int32_t row = 0; row < %d; row++) {\n"
+                "    if (!ConvStrip(%s, model, arena + %d, row * %d, im2col,\n"
+                "                   strip)) {\n"
+                "      return false;\n"
+                "    }\n"
+                "    PoolStrip(strip, %d, %d, %d, %d,\n"
+                "              arena + %d + row * %d);\n"
+                "  }\n"
+                % (index, pool, pool, out_shape[1], name,
+                   m.activation(source), pool, pool, cols, channels,
+                   out_shape[2], m.activation(result),
+                   out_shape[2] * channels))
+        else:
+            self.calls.append(
+                "  // Operator %d, Conv2D\n"
+                "  if (!ConvStrip(%s, model, arena + %d, 0, im2col,\n"
+                "                 arena + %d)) {\n"
+                "    return false;\n"
+                "  }\n"
+                % (index, name, m.activation(source), m.activation(result)))
+
+        # Formula of arm_convolve_s8_get_buffer_size(), largest of the
+        # wrapper's kernels, setup checks the linked one
+        self.im2col_size = max(self.im2col_size,
+                               align(4 * f_shape[1] * f_shape[2] *
+                                     f_shape[3]))
+        self.checks.append(
+            "  if (arm_convolve_wrapper_s8_get_buffer_size(\n"
+            "          &%s.params, &%s.input_dims, &%s.filter_dims,\n"
+            "          &%s.strip_dims) > kIm2colSize) {\n"
+            "    return false;\n"
+            "  }\n" % (name, name, name, name))
+
+    def fully_connected(self, index, operator, inputs, outputs):
+        m = self.model
+        source, weights = inputs[0], inputs[1]
+        bias = inputs[2] if len(inputs) > 2 else -1
+        result = outputs[0]
+        f_shape = m.shape(weights)
+        if len(f_shape) != 2:
+            raise ValueError("FullyConnected %d needs 2D weights" % index)
+        depth, accum = f_shape
+        batches = m.elements(source) // accum
+
+        in_scale, in_zero = m.quant(source)
+        f_scale, f_zero = m.quant(weights)
+        out_scale, out_zero = m.quant(result)
+        if len(f_scale) != 1:
+            raise ValueError("FullyConnected %d has per channel weights"
+                             % index)
+        # Product is float in GetQuantizedConvolutionMultipler()
+        multiplier, shift = quantize_multiplier(
+            f32(in_scale[0] * f_scale[0]) / out_scale[0])
+        act_min, act_max = activation_range(
+            m.option(m.options(operator), FC_ACTIVATION, "<b"),
+            out_scale[0], out_zero[0])
+
+        name = "kFullyConnected%d" % index
+        self.constants.append(
+            "// Operator %d, FullyConnected %d -> %d\n"
+            "constexpr FullyConnectedLayer %s = {\n"
+            "    {%d, %d, %d, {%d, %d}},\n"
+            "    {%d, %d},\n"
+            "    {%d, 1, 1, %d},\n"
+            "    {%d, 1, 1, %d},\n"
+            "    {1, 1, 1, %d},\n"
+            "    {%d, 1, 1, %d},\n"
+            "    %d, %d, %d,\n"
+            "};\n"
+            % (index, accum, depth, name,
+               -in_zero[0], -f_zero[0], out_zero[0], act_min, act_max,
+               multiplier, shift,
+               batches, accum, accum, depth, depth, batches, depth,
+               m.constant(weights, INT8, 1),
+               m.constant(bias, 2, 4) if bias >= 0 else 0,
+               1 if bias >= 0 else 0))
+        self.calls.append(
+            "  // Operator %d, FullyConnected\n"
+            "  if (!FullyConnected(%s, model, arena + %d, arena + %d)) {\n"
+            "    return false;\n"
+            "  }\n"
+            % (index, name, m.activation(source), m.activation(result)))
+        self.checks.append(
+            "  if (arm_fully_connected_s8_get_buffer_size(\n"
+            "          &%s.filter_dims) > kIm2colSize) {\n"
+            "    return false;\n"
+            "  }\n" % name)
+
+    def softmax(self, index, operator, inputs, outputs):
+        m = self.model
+        source, result = inputs[0], outputs[0]
+        shape = m.shape(source)
+        depth = shape[-1]
+        rows = m.elements(source) // depth
+        in_scale, _ = m.quant(source)
+        beta = m.option(m.options(operator), SOFTMAX_BETA, "<f")
+
+        # PreprocessSoftmaxScaling() and CalculateInputRadius()
+        real = min(beta * in_scale[0] *
+                   (1 << (31 - SOFTMAX_INTEGER_BITS)), (1 << 31) - 1.0)
+        multiplier, shift = quantize_multiplier(real)
+        if shift < 0:
+            raise ValueError("Softmax %d input scale is too small" % index)
+        radius = math.floor(((1 << SOFTMAX_INTEGER_BITS) - 1) *
+                            (1 << (31 - SOFTMAX_INTEGER_BITS)) /
+                            (1 << shift))
+
+        m.activation(result)
+        self.calls.append(
+            "  // Operator %d, Softmax of %d rows of %d\n"
+            "  arm_softmax_s8(reinterpret_cast<const int8_t*>(arena + %d), "
+            "%d, %d,\n"
+            "                 %d, %d, %d,\n"
+            "                 reinterpret_cast<int8_t*>(arena + %d));\n"
+            % (index, rows, depth, m.activation(source), rows, depth,
+               multiplier, shift, -radius, m.activation(result)))
+
+    def reshape(self, index, operator, inputs, outputs):
+        m = self.model
+        source, result = inputs[0], outputs[0]
+        if m.offsets[source] == m.offsets[result]:
+            return
+        self.calls.append(
+            "  // Operator %d, Reshape\n"
+            "  memcpy(arena + %d, arena + %d, %d);\n"
+            % (index, m.activation(result, m.type(source)),
+               m.activation(source, m.type(source)),
+               m.elements(source) * plan.TYPE_SIZES[m.type(source)]))
+
+    def dequantize(self, index, operator, inputs, outputs):
+        m = self.model
+        source, result = inputs[0], outputs[0]
+        scale, zero = m.quant(source)
+        self.calls.append(
+            "  // Operator %d, Dequantize\n"
+            "  Dequantize(reinterpret_cast<const int8_t*>(arena + %d), %d,\n"
+            "             %.17g, %d,\n"
+            "             reinterpret_cast<float*>(arena + %d));\n"
+            % (index, m.activation(source), m.elements(source), scale[0],
+               zero[0], m.activation(result, FLOAT32)))
+
+    def run(self):
+        m = self.model
+        handlers = {
+            CONV_2D: self.conv,
+            FULLY_CONNECTED: self.fully_connected,
+            SOFTMAX: self.softmax,
+            RESHAPE: self.reshape,
+            DEQUANTIZE: self.dequantize,
+        }
+        for index, operator in enumerate(m.operators):
+            code = m.codes[scalar(m.buf, operator, OPERATOR_OPCODE_INDEX,
+                                  "<I")]
+            if code not in handlers:
+                raise ValueError("operator %d, %s, is not supported"
+                                 % (index, ops.BUILTIN_OPS.get(code, code)))
+            inputs = ops.int_vector(m.buf, operator, OPERATOR_INPUTS)
+            outputs = ops.int_vector(m.buf, operator, OPERATOR_OUTPUTS)
+            handlers[code](index, operator, inputs, outputs)
+
+        output = m.outputs[0]
+        if m.type(output) not in (INT8, FLOAT32):
+            raise ValueError("output type %d is not supported"
+                             % m.type(output))
+
+
+SOURCE = """\
+// Generated by gen_static_model.py from %(model)s, do not edit
+#include "%(header)s"
+
+#include <string.h>
+
+#include "arm_nnfunctions.h"
+
+namespace {
+
+constexpr size_t kModelLength = %(length)d;
+constexpr uint32_t kModelCrc32 = 0x%(crc)08xu;
+
+// Arena: planned tensors, then strip of fused Conv2D, then im2col
+constexpr size_t kStripOffset = %(strip_offset)d;
+constexpr size_t kIm2colOffset = %(im2col_offset)d;
+constexpr int32_t kIm2colSize = %(im2col_size)d;
+
+struct ConvLayer {
+  cmsis_nn_conv_params params;  // Top padding of the first strip
+  cmsis_nn_dims input_dims;     // Input rows of the first strip
+  cmsis_nn_dims filter_dims;
+  cmsis_nn_dims bias_dims;
+  cmsis_nn_dims strip_dims;
+  const int32_t* multiplier;
+  const int32_t* shift;
+  uint32_t filter;              // Offsets in the model
+  uint32_t bias;
+  int32_t has_bias;
+  int32_t input_rows;
+  int32_t pad_top;              // Padding above the whole input
+  int32_t span;                 // Rows one strip reads, with padding
+};
+
+struct FullyConnectedLayer {
+  cmsis_nn_fc_params params;
+  cmsis_nn_per_tensor_quant_params quant;
+  cmsis_nn_dims input_dims;
+  cmsis_nn_dims filter_dims;
+  cmsis_nn_dims bias_dims;
+  cmsis_nn_dims output_dims;
+  uint32_t filter;
+  uint32_t bias;
+  int32_t has_bias;
+};
+
+%(constants)s
+// Convolution rows from first_row, rows above the input are top padding
+// of the strip, the same as StripInput() of conv_pool_fused.h
+inline bool ConvStrip(const ConvLayer& layer, const uint8_t* model,
+                      const uint8_t* input, int32_t first_row, void* im2col,
+                      uint8_t* strip) {
+  const int32_t top = first_row * layer.params.stride.h - layer.pad_top;
+  const int32_t pad_top = top < 0 ? -top : 0;
+  const int32_t start = top < 0 ? 0 : top;
+  int32_t count = layer.span - pad_top;
+  if (count > layer.input_rows - start) count = layer.input_rows - start;
+
+  cmsis_nn_conv_params params = layer.params;
+  cmsis_nn_dims input_dims = layer.input_dims;
+  params.padding.h = pad_top;
+  input_dims.h = count;
+  cmsis_nn_per_channel_quant_params quant = {
+      const_cast<int32_t*>(layer.multiplier),
+      const_cast<int32_t*>(layer.shift)};
+  cmsis_nn_context ctx = {im2col, kIm2colSize};
+  return arm_convolve_wrapper_s8(
+             &ctx, &params, &quant, &input_dims,
+             reinterpret_cast<const int8_t*>(input) +
+                 start * input_dims.w * input_dims.c,
+             &layer.filter_dims,
+             reinterpret_cast<const int8_t*>(model + layer.filter),
+             &layer.bias_dims,
+             layer.has_bias
+                 ? reinterpret_cast<const int32_t*>(model + layer.bias)
+                 : nullptr,
+             &layer.strip_dims, reinterpret_cast<int8_t*>(strip)) ==
+         ARM_MATH_SUCCESS;
+}
+
+// KxK maximum of the strip, rows and columns that do not fill a window
+// are dropped, the same as VALID MaxPool2D does
+inline void PoolStrip(const uint8_t* strip, int32_t pool, int32_t cols,
+                      int32_t channels, int32_t out_cols, uint8_t* output) {
+  const int8_t* in = reinterpret_cast<const int8_t*>(strip);
+  int8_t* out = reinterpret_cast<int8_t*>(output);
+  for (int32_t px = 0; px < out_cols; px++) {
+    for (int32_t c = 0; c < channels; c++) {
+      int8_t max = in[px * pool * channels + c];
+      for (int32_t i = 0; i < pool; i++) {
+        const int8_t* src = in + (i * cols + px * pool) * channels + c;
+        for (int32_t j = 0; j < pool; j++) {
+          if (src[j * channels] > max) max = src[j * channels];
+        }
+      }
+      *out++ = max;
+    }
+  }
+}
+
+inline bool FullyConnected(const FullyConnectedLayer& layer,
+                           const uint8_t* model, const uint8_t* input,
+                           uint8_t* output) {
+  cmsis_nn_context ctx = {nullptr, 0};
+  return arm_fully_connected_s8(
+             &ctx, &layer.params, &layer.quant, &layer.input_dims,
+             reinterpret_cast<const int8_t*>(input), &layer.filter_dims,
+             reinterpret_cast<const int8_t*>(model + layer.filter),
+             &layer.bias_dims,
+             layer.has_bias
+                 ? reinterpret_cast<const int32_t*>(model + layer.bias)
+                 : nullptr,
+             &layer.output_dims, reinterpret_cast<int8_t*>(output)) ==
+         ARM_MATH_SUCCESS;
+}
+
+// Same arithmetic as reference Dequantize, scale is double there
+inline void Dequantize(const int8_t* input, int32_t count, double scale,
+                       int32_t zero_point, float* output) {
+  for (int32_t i = 0; i < count; i++) {
+    output[i] = static_cast<float>(scale * (input[i] - zero_point));
+  }
+}
+
+}  // namespace
+
+bool %(prefix)s_matches(size_t model_len, uint32_t model_crc32) {
+  return model_len == kModelLength && model_crc32 == kModelCrc32;
+}
+
+bool %(prefix)s_setup() {
+%(checks)s  return true;
+}
+
+bool %(prefix)s_invoke(const uint8_t* model, uint8_t* arena) {
+  uint8_t* strip = arena + kStripOffset;
+  void* im2col = arena + kIm2colOffset;
+  (void) strip;
+  (void) im2col;
+
+%(calls)s  return true;
+}
+
+%(input_type)s* %(prefix)s_input(uint8_t* arena) {
+  return reinterpret_cast<%(input_type)s*>(arena + %(input_offset)d);
+}
+
+%(output_type)s* %(prefix)s_output(uint8_t* arena) {
+  return reinterpret_cast<%(output_type)s*>(arena + %(output_offset)d);
+}
+"""
+
+HEADER = """\
+// Generated by gen_static_model.py from %(model)s, do not edit
+#ifndef %(guard)s
+#define %(guard)s
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Runs the model without the interpreter, see gen_static_model.py.
+// Arena is not shared with anything, keep it on a 16 byte boundary.
+//
+// Usage example:
+// alignas(16) static uint8_t arena[k%(camel)sArenaSize];
+// if (!%(prefix)s_matches(model_len, model_crc32) || !%(prefix)s_setup()) {
+//   return;
+// }
+// memcpy(%(prefix)s_input(arena), image, k%(camel)sInputSize);
+// %(prefix)s_invoke(model, arena);
+
+constexpr size_t k%(camel)sArenaSize = %(arena_size)d;
+constexpr size_t k%(camel)sInputSize = %(input_size)d;   // Bytes
+constexpr int k%(camel)sOutputCount = %(output_count)d;
+
+// Length and CRC-32 of gen_blob.py of the model code was generated from
+bool %(prefix)s_matches(size_t model_len, uint32_t model_crc32);
+// False if CMSIS-NN kernels need more im2col buffer than is reserved
+bool %(prefix)s_setup();
+// Model is the flatbuffer, weights are read from it
+bool %(prefix)s_invoke(const uint8_t* model, uint8_t* arena);
+
+%(input_type)s* %(prefix)s_input(uint8_t* arena);
+%(output_type)s* %(prefix)s_output(uint8_t* arena);
+
+#endif  // %(guard)s
+"""
+
+C_TYPES = {INT8: "int8_t", FLOAT32: "float"}
+
+
+def generate(model_path, output_path):
+    buf = bytearray(ops.read_model(model_path))
+    model = Model(buf)
+    prefix, camel = c_name(output_path)
+    generator = Generator(model, prefix)
+    generator.run()
+
+    source, output = model.inputs[0], model.outputs[0]
+    if model.type(source) != INT8:
+        raise ValueError("input type %d is not supported"
+                         % model.type(source))
+    strip_offset = align(model.head)
+    im2col_offset = strip_offset + generator.strip_size
+    header_path = os.path.splitext(output_path)[0] + ".h"
+    values = {
+        "model": os.path.basename(model_path),
+        "header": os.path.basename(header_path),
+        "guard": prefix.upper() + "_H",
+        "prefix": prefix,
+        "camel": camel,
+        "length": len(buf),
+        "crc": zlib.crc32(bytes(buf)) & 0xffffffff,
+        "strip_offset": strip_offset,
+        "im2col_offset": im2col_offset,
+        "im2col_size": generator.im2col_size,
+        "arena_size": im2col_offset + generator.im2col_size,
+        "constants": "\n".join(generator.constants),
+        "checks": "".join(generator.checks),
+        "calls": "\n".join(generator.calls),
+        "input_type": C_TYPES[model.type(source)],
+        "input_offset": model.activation(source),
+        "input_size": model.elements(source),
+        "output_type": C_TYPES[model.type(output)],
+        "output_offset": model.activation(output, model.type(output)),
+        "output_count": model.elements(output),
+    }
+
+    with open(output_path, "w") as f:
+        f.write(SOURCE % values)
+    with open(header_path, "w") as f:
+        f.write(HEADER % values)
+    return len(model.operators), values["arena_size"]
+
+
+def main():
+    if len(sys.argv) != 3 or not sys.argv[2].endswith(".cc"):
+        print("Usage:\ngen_static_model.py MODEL OUTPUT_CC")
+        return 1
+
+    model_path, output_path = sys.argv[1:]
+    try:
+        count, arena_size = generate(model_path, output_path)
+    except (ValueError, struct.error, IndexError) as e:
+        print("%s: %s" % (model_path, e))
+        return 1
+
+    print("Generated %d operators, arena %d bytes" % (count, arena_size))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
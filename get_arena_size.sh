@@ -0,0 +1,29 @@
+#!/bin/bash
+
+if [  $# -le 1 ]
+then
+    echo "This script requires 2 arguments."
+    echo -e "\nUsage:\nget_arena_size LOG_FILE OUTPUT_HEADER \n"
+    echo "LOG_FILE is serial output of firmware built with ARENA_REPORT=1"
+    exit 1
+fi
+
+log=$1
+header=$2
+
+# Take the last report in the log, carriage returns come from serial line
+report=$(tr -d '\r' < $log | \
+         awk '/----- arena_size.h begin -----/ {block=""; inside=1; next}
+              /----- arena_size.h end -----/ {inside=0; last=block; next}
+              inside {block=block $0 "\n"}
+              END {printf "%s", last}')
+
+if [ -z "$report" ]
+then
+    echo "No arena report found in $log"
+    exit 1
+fi
+
+echo "$report" > $header
+echo "Written $header:"
+grep ARENA_SIZE_BYTES $header
@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""Puts constant buffers of a TFLite model in execution order.
+
+Usage:
+    layout_weights.py [--align=N] MODEL OUTPUT
+
+MODEL is either a .tflite flatbuffer or a .cc file with the model as C
+array, OUTPUT is written in the same format. Converter writes buffers in
+the order of tensors, which is not the order in which layers read them,
+so weights and bias of one layer can be far apart and every layer starts
+somewhere else. For a model that runs in place from QSPI flash in memory
+mapped mode, see qspi_flash.c of power_test, each jump costs a new read
+command, while a read that goes on where the previous one ended is
+served by the prefetch of the controller.
+
+Constant inputs of every operator, weights first, then bias, are moved
+to the end of the flatbuffer in the order of operators, each one on an N
+byte boundary, 32 by default, which is a cache line of Cortex-M7, so the
+whole model is read front to back once per inference. Buffers used by
+several operators stay where the first one needs them. Old copies are
+removed the same way as in palettize_weights.py, in whole units of N, so
+moved buffers keep their alignment. Run it after the other conversions,
+their removals only keep 16 byte alignment. Nothing but the place of the
+data changes.
+"""
+
+import struct
+import sys
+
+import gen_model_ops as ops
+import palettize_weights as palette
+
+
+def layout(buf, align):
+    """Returns number of moved buffers and their bytes, buf is a
+    bytearray."""
+    if buf[4:8] != b"TFL3":
+        raise ValueError("not a TFLite flatbuffer")
+
+    model = ops.u32(buf, 0)
+    subgraphs = ops.vector_tables(buf, model, ops.MODEL_SUBGRAPHS)
+    if len(subgraphs) != 1:
+        raise ValueError("only models with one subgraph are supported")
+
+    # Buffer indices in the order of the first operator that reads them
+    order = []
+    tensors = ops.vector_tables(buf, subgraphs[0], palette.SUBGRAPH_TENSORS)
+    for operator in ops.vector_tables(buf, subgraphs[0],
+                                      ops.SUBGRAPH_OPERATORS):
+        for index in ops.int_vector(buf, operator, palette.OPERATOR_INPUTS):
+            # -1 is an optional input that is left out
+            if index < 0:
+                continue
+            pos = ops.field_pos(buf, tensors[index], palette.TENSOR_BUFFER)
+            buffer = ops.u32(buf, pos) if pos is not None else 0
+            if buffer and buffer not in order:
+                order.append(buffer)
+
+    count = 0
+    moved = 0
+    for index in order:
+        # Positions move after each removal, so everything is found again
+        model = ops.u32(buf, 0)
+        buffer = ops.vector_tables(buf, model, palette.MODEL_BUFFERS)[index]
+        data = ops.vector_pos(buf, buffer, palette.BUFFER_DATA)
+        if data is None or ops.u32(buf, data) == 0:
+            continue
+        length = ops.u32(buf, data)
+        slots = palette.offset_slots(buf)
+
+        # Copy at the end, nothing points behind it, so no offset changes
+        buf += bytes(-(len(buf) + 4) % align)
+        copy = len(buf)
+        buf += buf[data:data + 4 + length]
+        field = ops.field_pos(buf, buffer, palette.BUFFER_DATA)
+        struct.pack_into("<I", buf, field, copy - field)
+
+        # Old copy is not referenced any more, whole units go, the rest of
+        # it stays as padding
+        end = data + (4 + length) // align * align
+        palette.remove(buf, data, end, slots)
+        count += 1
+        moved += length
+    return count, moved
+
+
+def main():
+    args = []
+    align = 32
+    for arg in sys.argv[1:]:
+        if arg.startswith("--align="):
+            align = int(arg[len("--align="):], 0)
+        else:
+            args.append(arg)
+    if len(args) != 2 or align % palette.ALIGNMENT:
+        print("Usage:\nlayout_weights.py [--align=N] MODEL OUTPUT\n"
+              "N is a multiple of %d" % palette.ALIGNMENT)
+        return 1
+
+    model_path, output_path = args
+    if model_path.endswith(".cc") != output_path.endswith(".cc"):
+        print("MODEL and OUTPUT have to be in the same format")
+        return 1
+
+    try:
+        buf = bytearray(ops.read_model(model_path))
+        count, moved = layout(buf, align)
+    except (ValueError, struct.error, IndexError) as e:
+        print("%s: %s" % (model_path, e))
+        return 1
+
+    if not count:
+        print("%s: no constant buffers" % model_path)
+        return 1
+
+    ops.write_model(output_path, model_path, buf)
+    print("Moved %d buffer(s), %d bytes in execution order, model is %d "
+          "bytes" % (count, moved, len(buf)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
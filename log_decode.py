@@ -0,0 +1,252 @@
+#!/usr/bin/env python3
+"""Prints binary logs of a LOG_BINARY build as text.
+
+Usage:
+    log_decode.py ELF [CAPTURE]
+
+ELF is firmware.elf of the build that sent the logs, CAPTURE is raw
+bytes of the serial port, for example what "cat /dev/ttyACM0 > log.bin"
+writes, standard input if it is not given.
+
+With LOG_BINARY shared/log.h sends TELEMETRY_LOG messages of
+shared/telemetry.h: id of the format, which is its address in section
+.log_fmt of the ELF, and 32 bit arguments. TELEMETRY_LOG_REPORT messages
+of log_reporter.h carry address of the format in flash instead and
+arguments in format order, strings inline. Formats are read from the ELF
+and applied here, %s words of TELEMETRY_LOG are looked up in its loaded
+sections, strings outside of them print as their address.
+
+Text between messages, of printf and DebugLog, is printed as it is.
+Messages with bad CRC and other telemetry are skipped. Decode with the
+same ELF that is flashed, ids move with every build.
+"""
+
+import re
+import struct
+import sys
+
+TELEMETRY_LOG = 0x07
+TELEMETRY_LOG_REPORT = 0x08
+LOG_SECTION = b".log_fmt"
+
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+CONVERSION = re.compile(
+    rb"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d+))?(hh|h|ll|l|j|z|t|L)?([diouxXcsfFeEgGaApn%])")
+
+
+def read_sections(elf):
+    """Returns [(name, address, data, allocated)] of sections with
+    contents."""
+    if elf[:4] != b"\x7fELF":
+        raise ValueError("not an ELF file")
+    wide = elf[4] == 2
+    endian = "<" if elf[5] == 1 else ">"
+    if wide:
+        shoff, = struct.unpack_from(endian + "Q", elf, 0x28)
+        entsize, count, names = struct.unpack_from(endian + "HHH", elf, 0x3A)
+        header = endian + "IIQQQQ"
+    else:
+        shoff, = struct.unpack_from(endian + "I", elf, 0x20)
+        entsize, count, names = struct.unpack_from(endian + "HHH", elf, 0x2E)
+        header = endian + "IIIIII"
+
+    headers = [struct.unpack_from(header, elf, shoff + i * entsize)
+               for i in range(count)]
+    strings = headers[names][4]
+    sections = []
+    for name, kind, flags, address, offset, size in headers:
+        if kind == SHT_NOBITS or not size:
+            continue
+        end = elf.index(b"\0", strings + name)
+        sections.append((elf[strings + name:end], address,
+                         elf[offset:offset + size], bool(flags & SHF_ALLOC)))
+    return sections
+
+
+class Strings:
+    """C strings of the ELF by id of .log_fmt or by address."""
+
+    def __init__(self, elf):
+        self.sections = read_sections(elf)
+        self.log = next((s for s in self.sections if s[0] == LOG_SECTION),
+                        None)
+        if self.log is None:
+            raise ValueError("ELF has no %s section, build with LOG_BINARY=1"
+                             % LOG_SECTION.decode())
+
+    @staticmethod
+    def at(data, offset):
+        if not 0 <= offset < len(data):
+            return None
+        end = data.find(b"\0", offset)
+        return data[offset:end if end >= 0 else len(data)]
+
+    def format(self, id):
+        return self.at(self.log[2], id - self.log[1])
+
+    def address(self, address):
+        for name, start, data, allocated in self.sections:
+            if allocated and name != LOG_SECTION and \
+                    start <= address < start + len(data):
+                return self.at(data, address - start)
+        return None
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data) + 1:
+            raise ValueError("bad COBS block")
+        out += data[i + 1:i + code]
+        i += code
+        if code != 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def crc16(data):
+    # CRC-16/CCITT-FALSE
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def apply(fmt, take):
+    """Formats C printf format, take(length, conversion) returns the next
+    argument as Python value."""
+    out = []
+    pos = 0
+    for match in CONVERSION.finditer(fmt):
+        out.append(fmt[pos:match.start()].decode("ascii", "replace"))
+        pos = match.end()
+        flags, width, precision, length, conversion = match.groups()
+        kind = conversion.decode()
+        if kind == "%":
+            out.append("%")
+            continue
+        if width == b"*":
+            width = str(take(None, "d")).encode()
+        if precision == b"*":
+            precision = str(take(None, "d")).encode()
+        value = take(length, kind)
+        if kind in "ui":
+            kind = "d"
+        elif kind in "pn":
+            kind, flags = "x", b"#"
+        elif kind in "aA":
+            kind = "e"
+        spec = "%" + flags.decode() + (width or b"").decode()
+        if precision is not None:
+            spec += "." + precision.decode()
+        out.append((spec + kind) % value)
+    out.append(fmt[pos:].decode("ascii", "replace"))
+    return "".join(out)
+
+
+def decode_log(payload, strings):
+    id, count = struct.unpack_from("<IB", payload)
+    words = list(struct.unpack_from("<%dI" % count, payload, 5))
+    fmt = strings.format(id)
+    if fmt is None:
+        return "<log id 0x%x of another build>" % id
+
+    def take(length, kind):
+        word = words.pop(0) if words else 0
+        if kind in "di":
+            return word - (1 << 32) if word & 0x80000000 else word
+        if kind == "c":
+            return chr(word & 0xFF)
+        if kind == "s":
+            text = strings.address(word)
+            return "<0x%08x>" % word if text is None else \
+                text.decode("ascii", "replace")
+        if kind in "fFeEgGaA":
+            return float("nan")
+        return word
+    return apply(fmt, take)
+
+
+def decode_report(payload, strings):
+    address, = struct.unpack_from("<I", payload)
+    fmt = strings.address(address)
+    if fmt is None:
+        return "<report format 0x%08x of another build>" % address
+    pos = [4]
+
+    def take(length, kind):
+        if kind == "s":
+            end = payload.index(b"\0", pos[0])
+            text = payload[pos[0]:end].decode("ascii", "replace")
+            pos[0] = end + 1
+            return text
+        # Floating point arguments are passed as double
+        size = 8 if length == b"ll" or kind in "fFeEgGaA" else 4
+        raw = payload[pos[0]:pos[0] + size]
+        pos[0] += size
+        if kind in "fFeEgGaA":
+            return struct.unpack("<d", raw)[0]
+        value = int.from_bytes(raw, "little")
+        if kind in "di" and value >> (8 * size - 1):
+            value -= 1 << (8 * size)
+        if kind == "c":
+            return chr(value & 0xFF)
+        return value
+    return apply(fmt, take) + "\n"
+
+
+def decode(capture, strings, write):
+    """Writes text of every log message and of text between them."""
+    for chunk in capture.split(b"\0"):
+        # Text lines end with 0x00 too, a message may follow a partial one
+        text, newline, chunk = chunk.rpartition(b"\n")
+        write((text + newline).decode("ascii", "replace"))
+        packet = b""
+        try:
+            packet = cobs_decode(chunk)
+        except ValueError:
+            pass
+        if len(packet) >= 4 and crc16(packet[:-2]) == \
+                struct.unpack("<H", packet[-2:])[0]:
+            kind, payload = packet[0], packet[2:-2]
+            try:
+                if kind == TELEMETRY_LOG:
+                    write(decode_log(payload, strings))
+                elif kind == TELEMETRY_LOG_REPORT:
+                    write(decode_report(payload, strings))
+            except (struct.error, ValueError, TypeError, IndexError) as e:
+                write("<bad log message: %s>\n" % e)
+            continue
+        write(chunk.decode("ascii", "replace"))
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        print("Usage:\nlog_decode.py ELF [CAPTURE]")
+        return 1
+
+    try:
+        with open(sys.argv[1], "rb") as f:
+            strings = Strings(f.read())
+    except (OSError, ValueError, struct.error) as e:
+        print("%s: %s" % (sys.argv[1], e))
+        return 1
+
+    if len(sys.argv) == 3:
+        with open(sys.argv[2], "rb") as f:
+            capture = f.read()
+    else:
+        capture = sys.stdin.buffer.read()
+    decode(capture, strings, sys.stdout.write)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
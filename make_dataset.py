@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+"""Packs quantized samples and labels into a dataset container.
+
+Usage:
+    make_dataset.py OUTPUT INPUT... [--labels=FILE|LIST] [--scale=S]
+                    [--zero-point=Z] [--shape=D,D,..]
+
+OUTPUT is the container of shared/dataset_file.h, one 512 byte block of
+header, a block aligned table of uint16 labels and samples that each
+start on a block boundary. It is memory mapped by host_eval.h, linked
+with BLOBS of project.mk, flashed to ASSET_ADDRESS with make assets_flash
+or copied to SD card or QSPI flash, and read there without parsing.
+
+INPUT is a .npy array of int8 or uint8 samples, one per row of the first
+axis, or a C source with samples as arrays, like images.cc, where every
+array of at least 16 values is one sample, in order. Several inputs are
+appended. Samples have to be quantized already, --scale and --zero-point
+are only recorded in the header, --shape too, which is otherwise taken
+from the .npy array.
+
+--labels is a .npy array of class indexes or a comma separated list,
+one label per sample.
+"""
+
+import ast
+import re
+import struct
+import sys
+import zlib
+
+MAGIC = 0x53444C4D
+VERSION = 1
+BLOCK = 512
+TYPE_INT8 = 0
+TYPE_UINT8 = 1
+HEADER = struct.Struct("<IHHIIIIII4IfiII")
+
+NPY_TYPES = {"|i1": ("b", 1), "|u1": ("B", 1), "<i2": ("h", 2),
+             "<u2": ("H", 2), "<i4": ("i", 4), "<u4": ("I", 4),
+             "<i8": ("q", 8), "<u8": ("Q", 8)}
+
+
+def read_npy(path):
+    """Returns (descr, shape, data bytes) of a C ordered .npy file."""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:6] != b"\x93NUMPY":
+        raise ValueError("not a .npy file")
+    # Version 1 has 2 byte header length, later ones 4 byte
+    if data[6] == 1:
+        start = 10 + struct.unpack_from("<H", data, 8)[0]
+        header = data[10:start]
+    else:
+        start = 12 + struct.unpack_from("<I", data, 8)[0]
+        header = data[12:start]
+    info = ast.literal_eval(header.decode("latin1"))
+    if info["fortran_order"]:
+        raise ValueError("array is in Fortran order")
+    return info["descr"], tuple(info["shape"]), data[start:]
+
+
+def read_samples(path):
+    """Returns (type, shape of one sample, list of sample bytes)."""
+    if path.endswith(".npy"):
+        descr, shape, data = read_npy(path)
+        if descr not in ("|i1", "|u1") or not shape:
+            raise ValueError("samples have to be an int8 or uint8 array, "
+                             "not %s" % descr)
+        size = 1
+        for dim in shape[1:]:
+            size *= dim
+        samples = [data[i * size:(i + 1) * size] for i in range(shape[0])]
+        kind = TYPE_INT8 if descr == "|i1" else TYPE_UINT8
+        return kind, shape[1:], samples
+
+    # C arrays, signed char ones are int8, everything else uint8
+    with open(path) as f:
+        source = re.sub(r"//.*|/\*.*?\*/", "", f.read(), flags=re.S)
+    kind = TYPE_UINT8
+    samples = []
+    for match in re.finditer(r"([\w ]+?)\s*\w+\s*\[\s*\w*\s*\]\s*=\s*\{"
+                             r"([^}]*)\}", source):
+        values = [int(v, 0) for v in match.group(2).replace(",", " ").split()]
+        if len(values) < 16:
+            continue
+        if "signed char" in match.group(1) and \
+                "unsigned" not in match.group(1):
+            kind = TYPE_INT8
+        samples.append(bytes(v & 0xFF for v in values))
+    if not samples:
+        raise ValueError("no arrays found")
+    return kind, (len(samples[0]),), samples
+
+
+def read_labels(arg):
+    if arg.endswith(".npy"):
+        descr, shape, data = read_npy(arg)
+        if descr not in NPY_TYPES or len(shape) != 1:
+            raise ValueError("labels have to be a 1D integer array")
+        code, size = NPY_TYPES[descr]
+        return list(struct.unpack("<%d%s" % (shape[0], code), data))
+    return [int(v) for v in arg.split(",")]
+
+
+def pad(data):
+    return data + bytes(-len(data) % BLOCK)
+
+
+def main():
+    args = sys.argv[1:]
+    files = [arg for arg in args if not arg.startswith("--")]
+    if len(files) < 2:
+        print(__doc__.split("\n\n")[1])
+        return 1
+
+    labels = None
+    scale = 0.0
+    zero_point = 0
+    shape = None
+    for arg in args:
+        name, _, value = arg.partition("=")
+        if not arg.startswith("--"):
+            continue
+        if name == "--labels":
+            labels = value
+        elif name == "--scale":
+            scale = float(value)
+        elif name == "--zero-point":
+            zero_point = int(value)
+        elif name == "--shape":
+            shape = tuple(int(v) for v in value.split(","))
+        else:
+            print("Unknown argument %s" % arg)
+            return 1
+
+    output, inputs = files[0], files[1:]
+    kind = None
+    samples = []
+    current = None
+    try:
+        for current in inputs:
+            path_kind, path_shape, path_samples = read_samples(current)
+            if kind is not None and path_kind != kind:
+                raise ValueError("signedness differs from earlier inputs")
+            kind = path_kind
+            shape = shape or path_shape
+            samples += path_samples
+        if labels is not None:
+            current = labels
+            labels = read_labels(labels)
+    except (OSError, ValueError, SyntaxError, KeyError) as e:
+        print("%s: %s" % (current, e))
+        return 1
+
+    size = len(samples[0])
+    if any(len(s) != size for s in samples):
+        print("Samples are not all %d bytes" % size)
+        return 1
+    if labels is not None and len(labels) != len(samples):
+        print("%d labels for %d samples" % (len(labels), len(samples)))
+        return 1
+    if labels is not None and not all(0 <= l < 0xFFFF for l in labels):
+        print("Labels have to be between 0 and 65534")
+        return 1
+    dims = list(shape[:4]) + [1] * (4 - len(shape[:4]))
+
+    table = b""
+    if labels is not None:
+        table = pad(struct.pack("<%dH" % len(labels), *labels))
+    stride = size + (-size % BLOCK)
+    body = table + b"".join(pad(s) for s in samples)
+
+    header = HEADER.pack(MAGIC, VERSION, kind, len(samples), size, stride,
+                         BLOCK if labels is not None else 0,
+                         BLOCK + len(table), BLOCK + len(body), *dims,
+                         scale, zero_point,
+                         zlib.crc32(body) & 0xFFFFFFFF, 0)
+    with open(output, "wb") as f:
+        f.write(pad(header) + body)
+
+    print("%s: %d samples of %d bytes, %d byte stride, %s" %
+          (output, len(samples), size, stride,
+           "%d labels" % len(labels) if labels is not None else "no labels"))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
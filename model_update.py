@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+"""Sends a new model to power_test, which switches to it without reset.
+
+Usage:
+    model_update.py PORT MODEL [--baud=N] [--retries=N]
+
+PORT is the console of power_test, USART2 or the USB CDC port of
+USB_CONSOLE, baud rate is ignored by the latter. MODEL is a .tflite file,
+it has to take the same input and give the same classes as the built-in
+model, firmware refuses it otherwise and keeps the old one.
+
+Script sends "UPDATE <bytes>", board erases its model slot in flash bank
+2 in the background. Then every "UPLOAD" command brings one chunk, board
+answers "UPLOAD SEND offset bytes" and script sends the chunk with its
+CRC-32, like tensors of eval_stream.py. A damaged or late chunk is sent
+again. Programming of a chunk overlaps with transfer of the next one and
+other commands can run between UPLOADs, the current model keeps
+classifying. "COMMIT <crc>" checks the whole model, writes the slot
+header and sets the model up between two inferences, look at
+model_slot.c.
+"""
+
+import re
+import struct
+import sys
+import zlib
+
+import serial
+
+# First UPLOAD waits for erase of the slot, MODEL_SLOT_ERASE_TIMEOUT
+TIMEOUT = 25
+UPDATE_OK = re.compile(r"UPDATE: OK (\d+)")
+SEND = re.compile(r"UPLOAD SEND (\d+) (\d+)")
+UPLOAD_OK = re.compile(r"UPLOAD: OK (\d+)")
+UPLOAD_FAIL = re.compile(r"UPLOAD (\d+) (CRC|TIMEOUT|FLASH)")
+COMMIT_OK = re.compile(r"COMMIT: OK (\S+)")
+
+
+def command(port, text, *patterns):
+    """Sends a command, returns the first match of patterns or None if the
+    board answered NOT OK."""
+    port.write(text.encode("ascii") + b"\n")
+    while True:
+        line = port.readline().decode("ascii", "replace").strip()
+        if not line:
+            raise RuntimeError("board does not answer %s" % text.split()[0])
+        if "NOT OK" in line:
+            return None
+        for pattern in patterns:
+            match = pattern.search(line)
+            if match:
+                return match
+
+
+def upload(port, model, retries):
+    """Sends chunks until the board has all of model."""
+    offset = 0
+    failures = 0
+    while offset < len(model):
+        port.write(b"UPLOAD\n")
+        result = None
+        while result is None:
+            line = port.readline().decode("ascii", "replace").strip()
+            if not line:
+                raise RuntimeError("board stopped at %d bytes" % offset)
+            match = SEND.search(line)
+            if match:
+                start, size = int(match.group(1)), int(match.group(2))
+                data = model[start:start + size]
+                port.write(data + struct.pack("<I", zlib.crc32(data)))
+                continue
+            match = UPLOAD_FAIL.search(line)
+            if match and match.group(2) == "FLASH":
+                raise RuntimeError("flash failed at %s" % match.group(1))
+            if match or "NOT OK" in line:
+                result = False
+                continue
+            match = UPLOAD_OK.search(line)
+            if match:
+                result = True
+                offset = int(match.group(1))
+        if not result:
+            failures += 1
+            if failures > retries:
+                raise RuntimeError("chunk at %d failed %d times"
+                                   % (offset, failures))
+        print("\r%d of %d bytes" % (offset, len(model)), end="", flush=True)
+    print()
+
+
+def main():
+    args = sys.argv[1:]
+    if len(args) < 2 or args[0].startswith("-"):
+        print(__doc__.split("\n\n")[1])
+        return 1
+
+    baud = 115200
+    retries = 3
+    files = []
+    for arg in args:
+        name, _, value = arg.partition("=")
+        if name == "--baud":
+            baud = int(value)
+        elif name == "--retries":
+            retries = int(value)
+        elif arg.startswith("-"):
+            print("Unknown argument %s" % arg)
+            return 1
+        else:
+            files.append(arg)
+
+    with open(files[1], "rb") as f:
+        model = f.read()
+    crc = zlib.crc32(model)
+
+    with serial.Serial(files[0], baud, timeout=TIMEOUT) as port:
+        port.reset_input_buffer()
+        try:
+            if command(port, "UPDATE %d" % len(model), UPDATE_OK) is None:
+                print("%s: board refused %d bytes" % (files[0], len(model)))
+                return 1
+            upload(port, model, retries)
+            match = command(port, "COMMIT %d" % crc, COMMIT_OK)
+        except RuntimeError as e:
+            print("%s: %s" % (files[0], e))
+            return 1
+
+    if match is None or match.group(1) != "update":
+        print("Model %08X was not taken, board kept %s"
+              % (crc, match.group(1) if match else "the old one"))
+        return 1
+    print("Model %08X of %d bytes is in use" % (crc, len(model)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
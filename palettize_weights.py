@@ -0,0 +1,352 @@
+#!/usr/bin/env python3
+"""Stores FullyConnected weights of a TFLite model as 4 bit palette indices.
+
+Usage:
+    palettize_weights.py [--min-bytes N] MODEL OUTPUT
+
+MODEL is either a .tflite flatbuffer or a .cc file with the model as C
+array, OUTPUT is written in the same format. Large FullyConnected layers
+are limited by flash bandwidth, every weight is read once per inference.
+Each output row of int8 weights is clustered to 16 int8 values with
+Lloyd's algorithm and stored as nibbles, packed weights are half the
+size. FullyConnectedPaletteResolver in fc_palette.h decodes rows into
+a scratch buffer right before the multiply accumulate loop, original
+FullyConnected kernel can not run such a model.
+
+Weights buffer then holds:
+    "PLT4", version byte, 3 zero bytes, 16 int8 values of each row,
+    rows of (depth + 1) / 2 bytes, low nibble first
+The header is only recognised at the start of a buffer that is not
+rows * depth bytes long, so plain weights that start with the same bytes
+are palettized as usual. A palettized buffer of another version or size
+is an error.
+Quantization of the tensor stays the same, decoded weights are plain
+int8, so only clustering changes the results. Printed error is in units
+of the weight scale, check accuracy of the model afterwards.
+
+Only weights of at least --min-bytes bytes are palettized, 4096 by
+default. Freed part of the buffer is removed from the flatbuffer and
+every offset that jumps over it is corrected, which needs the schema, so
+models with tables this script does not know are refused.
+"""
+
+import struct
+import sys
+
+import gen_model_ops as ops
+
+FULLY_CONNECTED = 9
+MAGIC = b"PLT4"
+VERSION = 1
+HEADER = MAGIC + bytes([VERSION, 0, 0, 0])
+PALETTE_SIZE = 16
+ALIGNMENT = 16
+LLOYD_ITERATIONS = 50
+
+# Schema field indices, rest of them are in gen_model_ops.py
+MODEL_BUFFERS = 4
+SUBGRAPH_TENSORS = 0
+OPERATOR_INPUTS = 1
+TENSOR_SHAPE = 0
+TENSOR_TYPE = 1
+TENSOR_BUFFER = 2
+BUFFER_DATA = 0
+TYPE_INT8 = 9
+
+# Offset fields of tables in schema.fbs, by field index. "table:X" and
+# "tables:X" point to table X and vector of them, "union" is table of
+# builtin options, its type is the previous field.
+SCHEMA = {
+    "Model": {1: "tables:OperatorCode", 2: "tables:SubGraph",
+              3: "string", 4: "tables:Buffer", 5: "vector",
+              6: "tables:Metadata"},
+    "OperatorCode": {1: "string"},
+    "SubGraph": {0: "tables:Tensor", 1: "vector", 2: "vector",
+                 3: "tables:Operator", 4: "string"},
+    "Tensor": {0: "vector", 3: "string", 4: "table:Quantization",
+               7: "vector"},
+    "Quantization": {0: "vector", 1: "vector", 2: "vector", 3: "vector"},
+    "Operator": {1: "vector", 2: "vector", 4: "union", 5: "vector",
+                 7: "vector", 8: "vector"},
+    "Buffer": {0: "vector"},
+    "Metadata": {0: "string"},
+}
+
+# Fields of each table that are known, others must be absent, the same
+# for tables in UNSUPPORTED
+FIELD_COUNTS = {"Model": 7, "OperatorCode": 4, "SubGraph": 5, "Tensor": 9,
+                "Quantization": 7, "Operator": 9, "Buffer": 3,
+                "Metadata": 2}
+UNSUPPORTED = {"Tensor": [6], "Quantization": [5]}
+
+# Builtin options tables without offsets, ReshapeOptions has new_shape
+SCALAR_OPTIONS = {1, 2, 5, 8, 9, 10, 11, 21, 28, 29, 38}
+RESHAPE_OPTIONS = 17
+
+
+def offset_slots(buf):
+    """Returns offsets of the model, (position, True) for uoffset_t to a
+    later position, (position, False) for table reference to its vtable."""
+    slots = set()
+
+    def field_count(table):
+        vtable = table - struct.unpack_from("<i", buf, table)[0]
+        return (struct.unpack_from("<H", buf, vtable)[0] - 4) // 2
+
+    def visit(table, name):
+        slots.add((table, False))
+        if name is None:
+            return
+        fields = SCHEMA[name]
+        unknown = list(range(FIELD_COUNTS[name], field_count(table)))
+        for index in unknown + UNSUPPORTED.get(name, []):
+            if ops.field_pos(buf, table, index) is not None:
+                raise ValueError("%s field %d is not supported"
+                                 % (name, index))
+        for index, kind in fields.items():
+            pos = ops.field_pos(buf, table, index)
+            if pos is None:
+                continue
+            slots.add((pos, True))
+            target = pos + ops.u32(buf, pos)
+            if kind.startswith("tables:"):
+                for i in range(ops.u32(buf, target)):
+                    element = target + 4 + 4 * i
+                    slots.add((element, True))
+                    visit(element + ops.u32(buf, element), kind[7:])
+            elif kind.startswith("table:"):
+                visit(target, kind[6:])
+            elif kind == "union":
+                option = struct.unpack_from(
+                    "<B", buf, ops.field_pos(buf, table, index - 1))[0]
+                if option == RESHAPE_OPTIONS:
+                    visit_reshape(target)
+                elif option in SCALAR_OPTIONS:
+                    visit(target, None)
+                else:
+                    raise ValueError("builtin options %d are not supported"
+                                     % option)
+
+    def visit_reshape(table):
+        slots.add((table, False))
+        pos = ops.field_pos(buf, table, 0)
+        if pos is not None:
+            slots.add((pos, True))
+
+    slots.add((0, True))
+    visit(ops.u32(buf, 0), "Model")
+    return slots
+
+
+def remove(buf, start, end, slots):
+    """Removes bytes start..end, no object may begin inside of them."""
+    length = end - start
+
+    def moved(pos):
+        return pos if pos < start else pos - length
+
+    values = []
+    for pos, forward in slots:
+        if forward:
+            target = pos + ops.u32(buf, pos)
+            values.append((moved(pos), "<I", moved(target) - moved(pos)))
+        else:
+            vtable = pos - struct.unpack_from("<i", buf, pos)[0]
+            values.append((moved(pos), "<i", moved(pos) - moved(vtable)))
+
+    del buf[start:end]
+    for pos, fmt, value in values:
+        struct.pack_into(fmt, buf, pos, value)
+
+
+def insert(buf, start, length, slots):
+    """Inserts length zero bytes at start, the inverse of remove(). Length
+    has to be a multiple of ALIGNMENT, so later objects stay aligned."""
+    def moved(pos):
+        return pos if pos < start else pos + length
+
+    values = []
+    for pos, forward in slots:
+        if forward:
+            target = pos + ops.u32(buf, pos)
+            values.append((moved(pos), "<I", moved(target) - moved(pos)))
+        else:
+            vtable = pos - struct.unpack_from("<i", buf, pos)[0]
+            values.append((moved(pos), "<i", moved(pos) - moved(vtable)))
+
+    buf[start:start] = bytes(length)
+    for pos, fmt, value in values:
+        struct.pack_into(fmt, buf, pos, value)
+
+
+def nearest(levels):
+    """Returns index of the closest level for each of 256 int8 values."""
+    return [min(range(PALETTE_SIZE), key=lambda i: abs(v - levels[i]))
+            for v in range(-128, 128)]
+
+
+def cluster(row):
+    """Returns 16 int8 levels and index of the level of each weight.
+    Lloyd's algorithm works on histogram of the row, there are only 256
+    different values. Levels start evenly spread over range of the row,
+    so the largest weights, which matter most, keep levels close to them."""
+    histogram = [0] * 256
+    for w in row:
+        histogram[w + 128] += 1
+    low = min(row)
+    high = max(row)
+    levels = [int(round(low + (high - low) * i / (PALETTE_SIZE - 1)))
+              for i in range(PALETTE_SIZE)]
+    for _ in range(LLOYD_ITERATIONS):
+        table = nearest(levels)
+        sums = [0] * PALETTE_SIZE
+        counts = [0] * PALETTE_SIZE
+        for v in range(256):
+            sums[table[v]] += histogram[v] * (v - 128)
+            counts[table[v]] += histogram[v]
+        new = [int(round(sums[i] / counts[i])) if counts[i] else levels[i]
+               for i in range(PALETTE_SIZE)]
+        if new == levels:
+            break
+        levels = new
+    table = nearest(levels)
+    return levels, [table[w + 128] for w in row]
+
+
+def pack(weights, rows, depth):
+    """Returns packed buffer, largest and mean squared error."""
+    data = bytearray(HEADER)
+    packed = bytearray()
+    worst = 0
+    squares = 0
+    for r in range(rows):
+        row = weights[r * depth:(r + 1) * depth]
+        levels, indices = cluster(row)
+        data += struct.pack("<16b", *levels)
+        for w, i in zip(row, indices):
+            worst = max(worst, abs(w - levels[i]))
+            squares += (w - levels[i]) ** 2
+        if depth % 2:
+            indices.append(0)
+        packed += bytes(indices[i] | indices[i + 1] << 4
+                        for i in range(0, depth, 2))
+    return data + packed, worst, squares / (rows * depth)
+
+
+def palettize(buf, min_bytes):
+    """Returns number of palettized tensors, buf is a bytearray."""
+    if buf[4:8] != b"TFL3":
+        raise ValueError("not a TFLite flatbuffer")
+
+    model = ops.u32(buf, 0)
+    subgraphs = ops.vector_tables(buf, model, ops.MODEL_SUBGRAPHS)
+    if len(subgraphs) != 1:
+        raise ValueError("only models with one subgraph are supported")
+
+    codes = []
+    for opcode in ops.vector_tables(buf, model, ops.MODEL_OPERATOR_CODES):
+        code = 0
+        pos = ops.field_pos(buf, opcode, ops.OPCODE_DEPRECATED_BUILTIN_CODE)
+        if pos is not None:
+            code = struct.unpack_from("<b", buf, pos)[0]
+        pos = ops.field_pos(buf, opcode, ops.OPCODE_BUILTIN_CODE)
+        if pos is not None:
+            code = max(code, struct.unpack_from("<i", buf, pos)[0])
+        codes.append(code)
+
+    weights = []
+    tensors = ops.vector_tables(buf, subgraphs[0], SUBGRAPH_TENSORS)
+    for operator in ops.vector_tables(buf, subgraphs[0],
+                                      ops.SUBGRAPH_OPERATORS):
+        pos = ops.field_pos(buf, operator, ops.OPERATOR_OPCODE_INDEX)
+        if codes[ops.u32(buf, pos) if pos is not None else 0] == \
+                FULLY_CONNECTED:
+            weights.append(ops.int_vector(buf, operator, OPERATOR_INPUTS)[1])
+
+    count = 0
+    for index in sorted(set(weights)):
+        # Positions move after each removal, so everything is found again
+        model = ops.u32(buf, 0)
+        subgraph = ops.vector_tables(buf, model, ops.MODEL_SUBGRAPHS)[0]
+        tensor = ops.vector_tables(buf, subgraph, SUBGRAPH_TENSORS)[index]
+        shape = ops.int_vector(buf, tensor, TENSOR_SHAPE)
+        tensor_type = struct.unpack_from(
+            "<b", buf, ops.field_pos(buf, tensor, TENSOR_TYPE))[0]
+        pos = ops.field_pos(buf, tensor, TENSOR_BUFFER)
+        buffer = ops.vector_tables(buf, model, MODEL_BUFFERS)[
+            ops.u32(buf, pos) if pos is not None else 0]
+        data = ops.vector_pos(buf, buffer, BUFFER_DATA)
+        if tensor_type != TYPE_INT8 or len(shape) != 2 or data is None:
+            continue
+        length = ops.u32(buf, data)
+        if length != shape[0] * shape[1]:
+            # Only palettized weights start with the magic, at offset 0
+            if bytes(buf[data + 4:data + 8]) != MAGIC:
+                continue
+            expected = len(HEADER) + shape[0] * (PALETTE_SIZE +
+                                                 (shape[1] + 1) // 2)
+            if buf[data + 8] != VERSION or length != expected:
+                raise ValueError("tensor %d has palette version %d of %d "
+                                 "bytes, expected version %d of %d bytes"
+                                 % (index, buf[data + 8], length, VERSION,
+                                    expected))
+            raise ValueError("tensor %d is already palettized" % index)
+        if length < min_bytes:
+            continue
+
+        rows, depth = shape
+        values = struct.unpack_from("<%db" % (rows * depth), buf, data + 4)
+        packed, worst, mse = pack(values, rows, depth)
+
+        old_length = ops.u32(buf, data)
+        slots = offset_slots(buf)
+        struct.pack_into("<I", buf, data, len(packed))
+        buf[data + 4:data + 4 + len(packed)] = packed
+
+        # Whole alignment units are removed, the rest stays as padding
+        start = data + 4 + len(packed)
+        start += -start % ALIGNMENT
+        end = start + (data + 4 + old_length - start) // ALIGNMENT * \
+            ALIGNMENT
+        remove(buf, start, end, slots)
+
+        print("Tensor %d %dx%d: %d -> %d bytes, error max %d, rms %.2f"
+              % (index, rows, depth, old_length, len(packed), worst,
+                 mse ** 0.5))
+        count += 1
+    return count
+
+
+def main():
+    args = sys.argv[1:]
+    min_bytes = 4096
+    if len(args) == 4 and args[0] == "--min-bytes":
+        min_bytes = int(args[1])
+        args = args[2:]
+    if len(args) != 2:
+        print("Usage:\npalettize_weights.py [--min-bytes N] MODEL OUTPUT")
+        return 1
+
+    model_path, output_path = args
+    if model_path.endswith(".cc") != output_path.endswith(".cc"):
+        print("MODEL and OUTPUT have to be in the same format")
+        return 1
+
+    try:
+        buf = bytearray(ops.read_model(model_path))
+        count = palettize(buf, min_bytes)
+    except (ValueError, struct.error, IndexError) as e:
+        print("%s: %s" % (model_path, e))
+        return 1
+
+    if not count:
+        print("%s: no FullyConnected weights to palettize" % model_path)
+        return 1
+
+    ops.write_model(output_path, model_path, buf)
+    print("Palettized %d tensor(s), model is %d bytes" % (count, len(buf)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
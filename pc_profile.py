@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+"""Prints flat profile of firmware from PCPROF dumps of the console.
+
+Usage:
+    pc_profile.py ELF LOG [--top=N] [--lines] [--prefix=arm-none-eabi-]
+
+LOG is console output of PCPROF, saved by the terminal or by a script
+that reads the port, other lines are skipped. Every dump is a header line
+with samples, dropped samples and rate, "PCPROF <pc> <count>" for each
+bucket of code, and an end line, more dumps of a session are summed.
+Firmware samples the interrupted PC from TIM7, look at pc_sample.c.
+
+ELF is firmware.elf of the same build, its function symbols are read with
+nm, a bucket counts to the function that covers its address. Functions in
+ITCM are linked at their ITCM address, so they resolve as others do.
+Buckets outside every function, veneers and library code without sizes,
+are listed as "?". --lines also prints the hottest buckets with file and
+line from addr2line, that needs debug information in ELF.
+
+Profile is statistical, a function with n samples has an error of about
+sqrt(n) of them, functions with a few samples tell little.
+"""
+
+import bisect
+import math
+import re
+import subprocess
+import sys
+
+TOP_COUNT = 20
+LINE_COUNT = 10
+
+HEADER = re.compile(r"PCPROF: (\d+) samples, (\d+) dropped, (\d+) Hz")
+BUCKET = re.compile(r"PCPROF ([0-9a-fA-F]{8}) (\d+)")
+
+
+def read_buckets(path):
+    """Returns ({pc: count}, samples, dropped) of all dumps in log."""
+    buckets = {}
+    samples = 0
+    dropped = 0
+    with open(path, errors="replace") as log:
+        for line in log:
+            match = HEADER.search(line)
+            if match:
+                samples += int(match.group(1))
+                dropped += int(match.group(2))
+                continue
+            match = BUCKET.search(line)
+            if match:
+                pc = int(match.group(1), 16)
+                buckets[pc] = buckets.get(pc, 0) + int(match.group(2))
+    return buckets, samples, dropped
+
+
+def read_functions(elf, prefix):
+    """Returns sorted [(address, size, name)] of code symbols."""
+    output = subprocess.run(
+        [prefix + "nm", "-S", "-n", "-C", "--defined-only", elf],
+        check=True, capture_output=True, text=True).stdout
+    functions = []
+    for line in output.splitlines():
+        fields = line.split(None, 3)
+        if len(fields) != 4 or fields[2] not in "TtWw":
+            continue
+        address = int(fields[0], 16) & ~1
+        functions.append((address, int(fields[1], 16), fields[3]))
+    functions.sort()
+    return functions
+
+
+class SymbolTable:
+    """Finds function of an address."""
+
+    def __init__(self, functions):
+        self.functions = functions
+        self.starts = [function[0] for function in functions]
+
+    def name(self, pc):
+        index = bisect.bisect_right(self.starts, pc) - 1
+        if index < 0:
+            return "?"
+        address, size, name = self.functions[index]
+        if pc >= address + size:
+            return "?"
+        return name
+
+
+def source_lines(elf, prefix, pcs):
+    """Returns [file:line] of addresses, from addr2line."""
+    output = subprocess.run(
+        [prefix + "addr2line", "-e", elf] + ["%x" % pc for pc in pcs],
+        check=True, capture_output=True, text=True).stdout
+    return output.splitlines()
+
+
+def main():
+    args = [arg for arg in sys.argv[1:] if not arg.startswith("--")]
+    options = dict(arg[2:].split("=", 1) if "=" in arg else (arg[2:], "")
+                   for arg in sys.argv[1:] if arg.startswith("--"))
+    if len(args) != 2:
+        print(__doc__)
+        sys.exit(2)
+    elf, log = args
+    top = int(options.get("top", TOP_COUNT))
+    prefix = options.get("prefix", "arm-none-eabi-")
+
+    buckets, samples, dropped = read_buckets(log)
+    counted = sum(buckets.values())
+    if not counted:
+        print("No PCPROF samples in %s" % log)
+        sys.exit(1)
+
+    table = SymbolTable(read_functions(elf, prefix))
+    per_function = {}
+    for pc, count in buckets.items():
+        name = table.name(pc)
+        per_function[name] = per_function.get(name, 0) + count
+
+    print("%d samples, %d dropped, %d buckets, %d functions" %
+          (samples, dropped, len(buckets), len(per_function)))
+    print("%8s %7s %6s  %s" % ("samples", "percent", "error", "function"))
+    ranked = sorted(per_function.items(), key=lambda item: -item[1])
+    for name, count in ranked[:top]:
+        print("%8d %6.2f%% %5.2f%%  %s" %
+              (count, 100.0 * count / counted,
+               100.0 * math.sqrt(count) / counted, name))
+    rest = sum(count for _, count in ranked[top:])
+    if rest:
+        print("%8d %6.2f%%         %d other functions" %
+              (rest, 100.0 * rest / counted, len(ranked) - top))
+
+    if "lines" in options:
+        hottest = sorted(buckets.items(), key=lambda item: -item[1])
+        hottest = hottest[:LINE_COUNT]
+        lines = source_lines(elf, prefix, [pc for pc, _ in hottest])
+        print()
+        print("%8s %7s  %-10s %s" % ("samples", "percent", "pc", "line"))
+        for (pc, count), line in zip(hottest, lines):
+            print("%8d %6.2f%%  0x%08x %s  %s" %
+                  (count, 100.0 * count / counted, pc, line, table.name(pc)))
+
+
+if __name__ == "__main__":
+    main()
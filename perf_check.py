@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""Compares latency, arena and firmware size with a committed baseline.
+
+Usage:
+    perf_check.py BASELINE [--host=JSON] [--target=LOG] [--size=TXT]
+                  [--threshold=PERCENT] [--size-threshold=PERCENT] [--update]
+
+BASELINE is a JSON file with one number per metric, rules.mk keeps it as
+perf_baseline.json in the project folder. Metrics are read from:
+
+    --host      Output of host_bench, shared/host_bench.h: median and p99
+                latency in us and arena used bytes.
+    --target    UART log with the JSON of target_bench_run() between
+                "BENCH BEGIN" and "BENCH END" lines: median and p99 cycles
+                of every cache variant and arena used bytes.
+    --size      Output of "size -A firmware.elf": bytes of every section,
+                for example size.text.
+
+Every metric is better when lower. Latencies may grow by --threshold
+percent (default 5), host timing is noisy. Arena and sizes may grow by
+--size-threshold percent (default 0), they are exact. Metrics that are
+new or gone are listed but do not fail. Exit status is 1 on any
+regression, so make stops.
+
+--update writes current metrics into BASELINE instead of comparing, commit
+it together with the change that is expected to move them.
+"""
+
+import json
+import sys
+
+# Sections of size -A that are not placed in memory of the target
+SKIPPED_SECTIONS = (".debug", ".comment", ".ARM.attributes", ".stab",
+                    ".gnu.attributes", "Total")
+
+
+def read_json(text):
+    """Returns the first JSON object in text, lines around it are ignored."""
+    start = text.find("{")
+    if start < 0:
+        raise ValueError("no JSON object")
+    obj, _ = json.JSONDecoder().raw_decode(text[start:])
+    return obj
+
+
+def host_metrics(path):
+    with open(path) as f:
+        bench = read_json(f.read())
+    metrics = {
+        "host.median_us": bench["latency_us"]["median"],
+        "host.p99_us": bench["latency_us"]["p99"],
+    }
+    if "arena_used" in bench:
+        metrics["host.arena_used"] = bench["arena_used"]
+    return metrics
+
+
+def target_metrics(path):
+    # Terminal logs end lines with \r\n
+    with open(path) as f:
+        lines = [line.strip() for line in f.read().splitlines()]
+    try:
+        begin = lines.index("BENCH BEGIN")
+        end = lines.index("BENCH END", begin)
+    except ValueError:
+        raise ValueError("%s has no BENCH BEGIN and BENCH END lines" % path)
+    bench = read_json("\n".join(lines[begin + 1:end]))
+
+    metrics = {}
+    if "arena_used" in bench:
+        metrics["target.arena_used"] = bench["arena_used"]
+    for variant in bench["variants"]:
+        prefix = "target.%s." % variant["cache"]
+        metrics[prefix + "median_cycles"] = variant["cycles"]["median"]
+        metrics[prefix + "p99_cycles"] = variant["cycles"]["p99"]
+    return metrics
+
+
+def size_metrics(path):
+    with open(path) as f:
+        lines = f.read().splitlines()
+    metrics = {}
+    for line in lines:
+        fields = line.split()
+        if (len(fields) < 2 or not fields[1].isdigit() or
+                fields[0].startswith(SKIPPED_SECTIONS)):
+            continue
+        metrics["size" + fields[0]] = int(fields[1])
+    return metrics
+
+
+def is_latency(name):
+    return name.endswith(("_us", "_cycles"))
+
+
+def main():
+    args = sys.argv[1:]
+    if not args or args[0].startswith("-"):
+        print(__doc__.split("\n\n")[1])
+        return 1
+
+    threshold = 5.0
+    size_threshold = 0.0
+    update = False
+    current = {}
+    for arg in args[1:]:
+        name, _, value = arg.partition("=")
+        if name == "--host":
+            current.update(host_metrics(value))
+        elif name == "--target":
+            current.update(target_metrics(value))
+        elif name == "--size":
+            current.update(size_metrics(value))
+        elif name == "--threshold":
+            threshold = float(value)
+        elif name == "--size-threshold":
+            size_threshold = float(value)
+        elif name == "--update":
+            update = True
+        else:
+            print("Unknown argument %s" % arg)
+            return 1
+
+    if not current:
+        print("Nothing to compare, give --host, --target or --size")
+        return 1
+
+    if update:
+        with open(args[0], "w") as f:
+            json.dump(current, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print("Baseline %s updated with %d metrics" % (args[0],
+                                                       len(current)))
+        return 0
+
+    try:
+        with open(args[0]) as f:
+            baseline = json.load(f)
+    except FileNotFoundError:
+        print("No baseline %s, create it with --update" % args[0])
+        return 1
+
+    failed = False
+    print("%-28s %12s %12s %8s" % ("Metric", "Baseline", "Current",
+                                   "Change"))
+    for name in sorted(set(baseline) | set(current)):
+        if name not in current:
+            print("%-28s %12g %12s %8s  GONE" % (name, baseline[name], "-",
+                                                 ""))
+            continue
+        if name not in baseline:
+            print("%-28s %12s %12g %8s  NEW" % (name, "-", current[name],
+                                                ""))
+            continue
+
+        old, new = baseline[name], current[name]
+        change = (new - old) * 100.0 / old if old else (100.0 if new else 0)
+        limit = threshold if is_latency(name) else size_threshold
+        over = change > limit
+        failed |= over
+        print("%-28s %12g %12g %+7.1f%%%s" % (name, old, new, change,
+                                               "  REGRESSION" if over else ""))
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
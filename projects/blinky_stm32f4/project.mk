@@ -16,5 +16,8 @@ CXXFILES = $(wildcard *.cpp)
 CXXFILES += $(wildcard *.cc)
 AFILES = $(wildcard *.s)
 
+# Header only code shared between projects, board.h is from here
+SHARED_DIR := ../../shared
+
 # If you add new folders do not forget to update the INCLUDES!
 INCLUDES += $(patsubst %,-I%, . $(SHARED_DIR))
@@ -1,5 +1,8 @@
 #include "flir.h"
 #include "utility.h"
+
+#define LOG_TAG "FLIR"
+#include "log.h"
 #include <stdarg.h>
 #include <stdio.h>
 
@@ -33,34 +36,6 @@ static uint32_t flir_millis();
 static const char * shutter_position_str(LEP_SYS_SHUTTER_POSITION position);
 
 
-/*!
- * @brief     Debug output wrapper
- *
- * @param[in] string  
- * @param[in] variable number of arguments  
- */
-void flir_debug(char* fmt, ...)
-{
-#ifdef FLIR_DEBUG
-    va_list args;
-    va_start(args, fmt);
-    printf("FLIR_DEBUG: ");
-    vprintf(fmt, args);
-    va_end(args);
-#endif 
-}
-
-void flir_print(char* fmt, ...)
-{
-#ifdef FLIR_PRINT
-    va_list args;
-    va_start(args, fmt);
-    printf("FLIR_PRINT: ");
-    vprintf(fmt, args);
-    va_end(args);
-#endif 
-}
-
 /*!
  * @brief           Display FLIR serial number
  *
@@ -74,7 +49,7 @@ void display_flir_serial()
                                      LEP_I2C_COMMAND_TYPE_GET), 
                                      serial_num, 4))
     {
-        flir_print("SYS Flir Serial Number: %04X%04X%04X%04X\n", 
+        LOG_INFO("SYS Flir Serial Number: %04X%04X%04X%04X\n", 
                                               serial_num[3],
                                               serial_num[2],
                                               serial_num[1],
@@ -82,7 +57,7 @@ void display_flir_serial()
     }
     else
     {
-        flir_print("SYS Flir Serial Number: Fail\n");
+        LOG_ERROR("SYS Flir Serial Number: Fail\n");
     }
 }
 
@@ -102,12 +77,12 @@ LEP_SYS_SHUTTER_POSITION get_flir_shutter_position()
                                        &position))
     {
         
-        flir_print("Shutter position: %s\n", 
+        LOG_INFO("Shutter position: %s\n", 
                 shutter_position_str((LEP_SYS_SHUTTER_POSITION) position));
     }
     else
     {
-        flir_print("Shutter position: function failed!\n");
+        LOG_ERROR("Shutter position: function failed!\n");
     }
     
     return (LEP_SYS_SHUTTER_POSITION) position;
@@ -123,7 +98,7 @@ void set_flir_shutter_position(LEP_SYS_SHUTTER_POSITION position)
     if(!set_flir_command32(command_code(LEP_CID_SYS_SHUTTER_POSITION, 
                     LEP_I2C_COMMAND_TYPE_SET), (uint32_t) position))
     {
-        flir_print("Set shutter position : function failed!\n");
+        LOG_ERROR("Set shutter position : function failed!\n");
     }
 }
 
@@ -140,7 +115,7 @@ void set_flir_agc(bool enable)
                                         LEP_I2C_COMMAND_TYPE_SET), 
                                         (uint32_t) enable))
     {
-        flir_print("AGC mode: function failed!\n");
+        LOG_ERROR("AGC mode: function failed!\n");
     }
 }
 
@@ -158,11 +133,11 @@ bool get_flir_agc()
                                        LEP_I2C_COMMAND_TYPE_GET), 
                                        &agc_state))
     {
-        flir_print("AGC mode: %s\n", agc_state ? "On" : "Off"); 
+        LOG_INFO("AGC mode: %s\n", agc_state ? "On" : "Off"); 
     }
     else
     {
-        flir_print("AGC mode: function failed!\n");
+        LOG_ERROR("AGC mode: function failed!\n");
     }
     return (bool) agc_state;
 }
@@ -181,7 +156,7 @@ void set_flir_telemetry(bool enable)
                                         LEP_I2C_COMMAND_TYPE_SET), 
                                         (uint32_t) enable))
     {
-        flir_print("Set Telemetry : function failed!\n");
+        LOG_ERROR("Set Telemetry : function failed!\n");
     }
 }
 
@@ -199,19 +174,29 @@ bool get_flir_telemetry()
                                        LEP_I2C_COMMAND_TYPE_GET), 
                                        &telemetry_state))
     {
-        flir_print("Telemetry: %s\n", telemetry_state ? "On" : "Off"); 
+        LOG_INFO("Telemetry: %s\n", telemetry_state ? "On" : "Off"); 
     }
     else
     {
-        flir_print("Telemetry: function failed!\n");
+        LOG_ERROR("Telemetry: function failed!\n");
     }
     return (bool) telemetry_state ;
 }
 
 // Frame commands
-bool get_picture(uint16_t frame[60][82])
+static bool synced = false;
+
+/*!
+ * @brief               Reads one frame over VoSPI
+ *
+ * @param[out] frame    60 packets of ID, CRC and 80 pixels
+ * @param[in] state     INIT resynchronizes first, OUT_OF_SYNC waits for
+ *                      the next frame of a camera that is still in sync
+ *
+ * @return              True if whole frame was read
+ */
+static bool read_picture(uint16_t frame[60][82], state_e state)
 {
-    state_e state = INIT;
     uint8_t frame_row = 0;
 
     while(1)
@@ -231,7 +216,7 @@ bool get_picture(uint16_t frame[60][82])
 
                 if ((frame[frame_row][0] & 0x0F00) == 0x0f00)
                 {
-                    //flir_print("Discard packet detected\n");
+                    //LOG_DEBUG("Discard packet detected\n");
                     //Do nothing for now, you can add later some kind of timeout
                 } 
                 else
@@ -252,7 +237,7 @@ bool get_picture(uint16_t frame[60][82])
                 // We should read ID field of each packet to be sure that it is the packet that we want
                 if((frame[frame_row][0] & 0x00FF) == frame_row)
                 {
-                    //flir_print("Match");
+                    //LOG_DEBUG("Match");
                     frame_row++;
 
                     if (frame_row == 60)
@@ -265,10 +250,11 @@ bool get_picture(uint16_t frame[60][82])
                 else
                 {
                     //Error getting correct packet ID, this will have to be handeled somehow later
-                    flir_print("ID error\n");
-                    flir_print("Expected frame_row: %d\n", frame_row);
-                    flir_print("What we got:        %d\n", (frame[frame_row][0] & 0x00FF));
+                    LOG_WARN("ID error\n");
+                    LOG_WARN("Expected frame_row: %d\n", frame_row);
+                    LOG_WARN("What we got:        %d\n", (frame[frame_row][0] & 0x00FF));
                     disable_flir_cs();
+                    synced = false;
                     return false;
                     delay(10);
                     frame_row = 0;
@@ -277,13 +263,53 @@ bool get_picture(uint16_t frame[60][82])
                 break;
 
             case DONE:
-                flir_print("DONE!\n");
+                LOG_DEBUG("DONE!\n");
+                synced = true;
                 return true;
                 break;
         }
     }
 }
 
+/*!
+ * @brief               Reads one frame, camera is synchronized first
+ *
+ * @param[out] frame    60 packets of ID, CRC and 80 pixels
+ *
+ * @return              True if whole frame was read
+ *
+ * @note                Synchronization keeps chip select high for 185 ms,
+ *                      so every call takes longer than that.
+ */
+bool get_picture(uint16_t frame[60][82])
+{
+    return read_picture(frame, INIT);
+}
+
+/*!
+ * @brief               Reads the next frame, for streaming
+ *
+ * @param[out] frame    60 packets of ID, CRC and 80 pixels
+ *
+ * @return              True if whole frame was read
+ *
+ * @note                After a complete frame camera stays in sync, chip
+ *                      select is only pulled low again and discard packets
+ *                      are read until the next frame starts, so frames come
+ *                      at the 27 Hz rate of VoSPI. Lepton repeats every
+ *                      frame three times, 9 Hz of them are new. Only after
+ *                      a failed frame it is synchronized again.
+ */
+bool get_next_picture(uint16_t frame[60][82])
+{
+    if (!synced)
+    {
+        return read_picture(frame, INIT);
+    }
+    enable_flir_cs();
+    return read_picture(frame, OUT_OF_SYNC);
+}
+
 
 /*!
  * @brief                   Sends get command to FLIR module
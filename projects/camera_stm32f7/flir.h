@@ -21,13 +21,9 @@ typedef enum
 }state_e;
 
 
-// Debug options
-// FLIR_DEBUG macro is used for debugging purposes, tracing path of functions
-// and other problems. It is normally undefined
-// FLIR_PRINT is used to display some data about FLIR, like serial number,
-// current settings, etc. It is normally defined
-#define FLIR_DEBUG
-#define FLIR_PRINT
+// Debug output goes through shared/log.h with "FLIR" tag. Settings, like
+// serial number, are LOG_INFO, failures LOG_ERROR, per frame messages
+// LOG_DEBUG, so they are not compiled in unless LOG_LEVEL=4.
 
 //General settings, set and get functions
 void display_flir_serial();
@@ -43,6 +39,7 @@ bool get_flir_telemetry();
 
 //Frame commands
 bool get_picture(uint16_t frame[60][82]);
+bool get_next_picture(uint16_t frame[60][82]);
 
 
 // Low level commands
@@ -1,47 +1,205 @@
+import io
+import struct
+import time
+
 import matplotlib.pyplot as plt
 import matplotlib.animation as animation
 import numpy as np
 import serial
+from PIL import Image
+
+# Packet types, see shared/telemetry.h
+TELEMETRY_FRAME = 0x01
+TELEMETRY_SCORES_F32 = 0x02
+TELEMETRY_SCORES_I8 = 0x03
+TELEMETRY_LATENCY = 0x04
+TELEMETRY_FRAME_CODED = 0x05
+TELEMETRY_FRAME_JPEG = 0x06
+# Binary logs have a sequence of their own, log_decode.py prints them
+TELEMETRY_LOG = 0x07
+TELEMETRY_LOG_REPORT = 0x08
+
+FRAME_CODEC_ESCAPE = 0xE0
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data) + 1:
+            raise ValueError("bad COBS block")
+        out += data[i + 1:i + code]
+        i += code
+        if code != 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def crc16(data):
+    # CRC-16/CCITT-FALSE
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def frame_predict(a, b, c):
+    # Median edge detector, a is left, b above and c above left
+    if c >= max(a, b):
+        return min(a, b)
+    if c <= min(a, b):
+        return max(a, b)
+    return (a + b - c) & 0xFF
+
+
+def frame_decode(data, cols, rows):
+    """Decodes frame coded with shared/frame_codec.h."""
+    residuals = []
+    i = 0
+    while i < len(data):
+        token = data[i]
+        i += 1
+        if token < 0x80:
+            residuals += [0] * (token + 1)
+        elif token < 0xC0:
+            residuals += [((token >> 3) & 0x7) - 4, (token & 0x7) - 4]
+        elif token < FRAME_CODEC_ESCAPE:
+            residuals.append((token & 0x1F) - 16)
+        elif token == FRAME_CODEC_ESCAPE and i < len(data):
+            residuals.append(data[i])
+            i += 1
+        else:
+            raise ValueError("bad frame token")
+    if len(residuals) != cols * rows:
+        raise ValueError("bad frame length")
+
+    p = [[0] * cols for _ in range(rows)]
+    for row in range(rows):
+        for col in range(cols):
+            if row == 0:
+                pred = p[0][col - 1] if col else 0
+            elif col == 0:
+                pred = p[row - 1][0]
+            else:
+                pred = frame_predict(p[row][col - 1], p[row - 1][col],
+                                     p[row - 1][col - 1])
+            p[row][col] = (pred + residuals[row * cols + col]) & 0xFF
+    return np.array(p, dtype=np.uint8)
+
+
+def read_packet(ser):
+    """Returns (type, sequence, payload) of next valid packet or None."""
+    encoded = ser.read_until(b'\x00')[:-1]
+    try:
+        packet = cobs_decode(encoded)
+    except ValueError:
+        packet = b''
+    if len(packet) >= 4:
+        body, crc = packet[:-2], struct.unpack('<H', packet[-2:])[0]
+        if crc16(body) == crc:
+            return body[0], body[1], body[2:]
+    # Firmware ends every printf line with 0x00 as well
+    text = encoded.decode('ascii', errors='replace').strip()
+    if text and all(32 <= b < 127 or b in (9, 10, 13) for b in encoded):
+        print("Firmware:", text)
+    return None
+
+
+class SequenceCounter:
+    """Counts messages lost on the link from gaps in 8-bit sequence."""
+
+    def __init__(self):
+        self.expected = None
+        self.received = 0
+        self.lost = 0
+
+    def update(self, sequence):
+        if self.expected is not None and sequence != self.expected:
+            gap = (sequence - self.expected) & 0xFF
+            self.lost += gap
+            print("Lost %d message(s) before sequence %d, %d in total"
+                  % (gap, sequence, self.lost))
+        self.expected = (sequence + 1) & 0xFF
+        self.received += 1
 
 
 # Setup image plot
 fig, ax = plt.subplots(1,1)
 ax.set_title('Camera output')
 
-#data = np.random.rand(3,3)
 data = np.zeros((60, 80))
 data[0][0] = 255
 im = plt.imshow(data, animated=True, cmap='plasma')
 cbar = fig.colorbar(im)
 
 
-# Open serial port
-ser = serial.Serial(port='COM4', baudrate=921600)
-rows = 60
+# Open serial port, timeout keeps the plot responsive without frames
+ser = serial.Serial(port='COM4', baudrate=921600, timeout=0.05)
+sequence = SequenceCounter()
+frame_times = []
+
+
+def handle_packet(kind, payload):
+    """Returns True if packet was a frame and image was updated."""
+    if kind == TELEMETRY_FRAME:
+        cols, rows = payload[0], payload[1]
+        pixels = np.frombuffer(payload[2:2 + cols * rows], dtype=np.uint8)
+        im.set_array(pixels.reshape(rows, cols))
+        return True
+    if kind == TELEMETRY_FRAME_CODED:
+        cols, rows = payload[0], payload[1]
+        length = struct.unpack_from('<H', payload, 2)[0]
+        im.set_array(frame_decode(payload[4:4 + length], cols, rows))
+        return True
+    if kind == TELEMETRY_FRAME_JPEG:
+        length = struct.unpack_from('<H', payload, 2)[0]
+        jpeg = Image.open(io.BytesIO(payload[4:4 + length]))
+        im.set_array(np.asarray(jpeg.convert('L')))
+        return True
+    if kind == TELEMETRY_SCORES_F32:
+        count = payload[0]
+        print("Scores:", struct.unpack_from('<%df' % count, payload, 1))
+    elif kind == TELEMETRY_SCORES_I8:
+        count = payload[0]
+        scale, zero_point = struct.unpack_from('<fi', payload, 1)
+        scores = struct.unpack_from('<%db' % count, payload, 9)
+        print("Scores:", [(s - zero_point) * scale for s in scores])
+    elif kind == TELEMETRY_LATENCY:
+        capture, inference, total = struct.unpack_from('<III', payload)
+        print("Capture %d us, inference %d us, total %d us"
+              % (capture, inference, total))
+    return False
+
+
 def updatefig(*args):
+    # Everything that arrived since the last redraw is decoded, only the
+    # newest frame is shown, so display does not fall behind the stream
     try:
-        ser_bytes = ser.readline().strip().decode('utf-8')
-        # print(ser_bytes)
-        if ser_bytes == 'We are done':
-            #print("START")
-            #data = np.zeros((3, 3))
-            row = 0
-            while(True):
-                ser_bytes = ser.readline().strip().decode('utf-8')
-                nums = [int(n) for n in ser_bytes.split()]
-                data[row] = nums
-                row += 1
-                if(row == rows):
-                    im.set_array(data)
-                    #im.set_clim(np.amin(data), np.amax(data))
-                    return im,
+        while True:
+            packet = read_packet(ser)
+            if packet is not None:
+                kind, number, payload = packet
+                if kind not in (TELEMETRY_LOG, TELEMETRY_LOG_REPORT):
+                    sequence.update(number)
+                if handle_packet(kind, payload):
+                    frame_times.append(time.monotonic())
+                    del frame_times[:-20]
+            if ser.in_waiting == 0:
+                break
 
+        if len(frame_times) > 1:
+            fps = (len(frame_times) - 1) / (frame_times[-1] - frame_times[0])
+            ax.set_title('Camera output, %.1f fps, %d lost'
+                         % (fps, sequence.lost))
         return im,
 
     except Exception as e:
         print("Error" +str(e))
         return im,
 
-ani = animation.FuncAnimation(fig, updatefig, interval=1, blit=True)
+ani = animation.FuncAnimation(fig, updatefig, interval=1, blit=False)
 plt.show()
-
@@ -0,0 +1,476 @@
+#include <string.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/dma.h>
+#include "jpeg_hw.h"
+#include "utility.h"
+
+/* Explanation: hardware JPEG codec of STM32F767 encodes 8-bit grayscale
+ * frames, baseline JPEG with one component and the standard luminance
+ * tables of Annex K, so the host opens them with any decoder.
+ *
+ * Codec takes pixels in 8x8 blocks, not in rows. CPU puts the frame into
+ * block order first, a copy of 8 bytes per block row, and repeats the
+ * last column and row where the frame is not a multiple of 8. DCT,
+ * quantization, Huffman coding and byte stuffing are done by the codec,
+ * blocks go in by DMA2 stream 3 and the scan comes out by DMA2 stream 4,
+ * both on channel 9, in bursts of 4 words at FIFO thresholds. Whatever
+ * stays below the output threshold at the end is read by CPU.
+ *
+ * Header generation of the codec is off, header is written by CPU from
+ * the same tables that are programmed into the codec, its length is a
+ * multiple of 4, so scan lands word aligned right behind it. CPU adds EOI
+ * after the scan. Last word of the scan may carry a few fill bytes before
+ * EOI, decoders skip them.
+ *
+ * Encoder Huffman memory holds code length - 1 and the lowest 8 bits of
+ * every code, codec derives upper bits, which only works for tables whose
+ * long codes start with ones, like the standard ones. Last words of each
+ * table are fixed values that codec uses internally.
+ *
+ * D-cache is not enabled in this project, so DMA buffers need no cache
+ * maintenance.
+ * */
+
+#ifndef JPEG_BASE
+#define JPEG_BASE               0x50051000U
+#endif
+
+#define JPEG_HW_CONFR0          MMIO32(JPEG_BASE + 0x000)
+#define JPEG_HW_CONFR1          MMIO32(JPEG_BASE + 0x004)
+#define JPEG_HW_CONFR2          MMIO32(JPEG_BASE + 0x008)
+#define JPEG_HW_CONFR3          MMIO32(JPEG_BASE + 0x00C)
+#define JPEG_HW_CONFR4          MMIO32(JPEG_BASE + 0x010)
+#define JPEG_HW_CR              MMIO32(JPEG_BASE + 0x030)
+#define JPEG_HW_SR              MMIO32(JPEG_BASE + 0x034)
+#define JPEG_HW_CFR             MMIO32(JPEG_BASE + 0x038)
+#define JPEG_HW_DIR             MMIO32(JPEG_BASE + 0x040)
+#define JPEG_HW_DOR             MMIO32(JPEG_BASE + 0x044)
+#define JPEG_HW_QMEM0           (&MMIO32(JPEG_BASE + 0x050))
+#define JPEG_HW_HUFFENC_AC0     (&MMIO32(JPEG_BASE + 0x500))
+#define JPEG_HW_HUFFENC_DC0     (&MMIO32(JPEG_BASE + 0x7C0))
+
+#define JPEG_HW_RCC_EN          (1 << 1)    // JPEGEN of RCC_AHB2ENR
+
+#define JPEG_HW_CONFR0_START    (1 << 0)
+#define JPEG_HW_CONFR1_YSIZE(n) ((uint32_t) (n) << 16)
+#define JPEG_HW_CONFR3_XSIZE(n) ((uint32_t) (n) << 16)
+#define JPEG_HW_CONFR4_VSF(n)   ((uint32_t) (n) << 8)
+#define JPEG_HW_CONFR4_HSF(n)   ((uint32_t) (n) << 12)
+#define JPEG_HW_CR_JCEN         (1 << 0)
+#define JPEG_HW_CR_IDMAEN       (1 << 11)
+#define JPEG_HW_CR_ODMAEN       (1 << 12)
+#define JPEG_HW_CR_IFF          (1 << 13)
+#define JPEG_HW_CR_OFF          (1 << 14)
+#define JPEG_HW_SR_OFNEF        (1 << 4)
+#define JPEG_HW_SR_EOCF         (1 << 5)
+#define JPEG_HW_CFR_ALL         ((1 << 5) | (1 << 6))
+
+#define JPEG_HW_DMA             DMA2
+#define JPEG_HW_DMA_IN          DMA_STREAM3
+#define JPEG_HW_DMA_OUT         DMA_STREAM4
+#define JPEG_HW_DMA_CHANNEL     (9U << DMA_SxCR_CHSEL_SHIFT)
+#define JPEG_HW_DMA_FLAGS       (DMA_TCIF | DMA_HTIF | DMA_TEIF | \
+                                 DMA_DMEIF | DMA_FEIF)
+
+#define JPEG_HW_AC_CODES        162     // Run and size pairs, EOB, ZRL
+#define JPEG_HW_DC_CODES        12
+#define JPEG_HW_AC_EOB          160
+#define JPEG_HW_AC_ZRL          161
+
+#define JPEG_HW_BLOCKS          (((JPEG_HW_MAX_COLS + 7) / 8) * \
+                                 ((JPEG_HW_MAX_ROWS + 7) / 8))
+
+// Standard tables of ITU T.81 Annex K
+static const uint8_t luma_quant[64] =
+{
+    16,  11,  10,  16,  24,  40,  51,  61,
+    12,  12,  14,  19,  26,  58,  60,  55,
+    14,  13,  16,  24,  40,  57,  69,  56,
+    14,  17,  22,  29,  51,  87,  80,  62,
+    18,  22,  37,  56,  68, 109, 103,  77,
+    24,  35,  55,  64,  81, 104, 113,  92,
+    49,  64,  78,  87, 103, 121, 120, 101,
+    72,  92,  95,  98, 112, 100, 103,  99,
+};
+
+// Position in the block of each coefficient in zigzag order
+static const uint8_t zigzag[64] =
+{
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+static const uint8_t dc_bits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1};
+static const uint8_t dc_vals[JPEG_HW_DC_CODES] =
+{
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+};
+
+static const uint8_t ac_bits[16] =
+{
+    0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D,
+};
+static const uint8_t ac_vals[JPEG_HW_AC_CODES] =
+{
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+    0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08,
+    0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16,
+    0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+    0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+    0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+    0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+    0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+    0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6,
+    0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+    0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4,
+    0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+    0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA,
+    0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+    0xF9, 0xFA,
+};
+
+// Fixed words at the end of encoder tables
+static const uint32_t ac_tail[7] =
+{
+    0x0FFF0FFF, 0x0FFF0FFF, 0x0FFF0FFF,
+    0x0FD10FD0, 0x0FD30FD2, 0x0FD50FD4, 0x0FD70FD6,
+};
+static const uint32_t dc_tail[2] = {0x0FFF0FFF, 0x0FFF0FFF};
+
+// Quantization table of the header and the codec, in zigzag order
+static uint8_t quant[64] __attribute__((aligned(4)));
+static uint8_t blocks[JPEG_HW_BLOCKS * 64] __attribute__((aligned(4)));
+
+static uint8_t * header_write(uint8_t * out, uint16_t cols, uint16_t rows);
+static void blocks_fill(const uint8_t * pixels, uint16_t cols, uint16_t rows,
+                        uint32_t stride);
+static void huff_write(volatile uint32_t * table, const uint8_t bits[16],
+                       const uint8_t * vals, uint16_t count, bool ac);
+
+/*!
+ * @brief   Index of a symbol in AC encoder table
+ */
+static inline uint16_t ac_index(uint8_t symbol)
+{
+    if (symbol == 0x00)
+    {
+        return JPEG_HW_AC_EOB;
+    }
+    if (symbol == 0xF0)
+    {
+        return JPEG_HW_AC_ZRL;
+    }
+    return (symbol >> 4) * 10 + (symbol & 0x0F) - 1;
+}
+
+/*!
+ * @brief               Enables codec and its DMA streams, programs tables
+ *
+ * @param[in] quality   1 to 100, scales the standard quantization table
+ *                      the same way as IJG libjpeg
+ */
+void jpeg_hw_setup(uint8_t quality)
+{
+    RCC_AHB2ENR |= JPEG_HW_RCC_EN;
+    rcc_periph_clock_enable(RCC_DMA2);
+
+    // Tables can only be written while codec is enabled
+    JPEG_HW_CR = JPEG_HW_CR_JCEN;
+    JPEG_HW_CONFR0 = 0;
+
+    quality = quality < 1 ? 1 : (quality > 100 ? 100 : quality);
+    uint32_t scale = quality < 50 ? 5000 / quality : 200 - 2 * quality;
+    for (uint8_t i = 0; i < 64; i++)
+    {
+        uint32_t value = (luma_quant[zigzag[i]] * scale + 50) / 100;
+        quant[i] = value < 1 ? 1 : (value > 255 ? 255 : value);
+    }
+    for (uint8_t i = 0; i < 16; i++)
+    {
+        uint32_t word;
+        memcpy(&word, &quant[i * 4], 4);
+        JPEG_HW_QMEM0[i] = word;
+    }
+
+    huff_write(JPEG_HW_HUFFENC_DC0, dc_bits, dc_vals, JPEG_HW_DC_CODES, false);
+    huff_write(JPEG_HW_HUFFENC_AC0, ac_bits, ac_vals, JPEG_HW_AC_CODES, true);
+
+    uint32_t in = JPEG_HW_DMA_IN;
+    uint32_t out = JPEG_HW_DMA_OUT;
+    dma_stream_reset(JPEG_HW_DMA, in);
+    DMA_SCR(JPEG_HW_DMA, in) |= JPEG_HW_DMA_CHANNEL;
+    dma_set_transfer_mode(JPEG_HW_DMA, in, DMA_SxCR_DIR_MEM_TO_PERIPHERAL);
+    dma_set_peripheral_address(JPEG_HW_DMA, in, (uint32_t) &JPEG_HW_DIR);
+    dma_set_peripheral_size(JPEG_HW_DMA, in, DMA_SxCR_PSIZE_32BIT);
+    dma_set_memory_size(JPEG_HW_DMA, in, DMA_SxCR_MSIZE_32BIT);
+    dma_enable_memory_increment_mode(JPEG_HW_DMA, in);
+    dma_set_peripheral_burst(JPEG_HW_DMA, in, DMA_SxCR_PBURST_INCR4);
+    dma_enable_fifo_mode(JPEG_HW_DMA, in);
+    dma_set_fifo_threshold(JPEG_HW_DMA, in, DMA_SxFCR_FTH_4_4_FULL);
+    dma_set_priority(JPEG_HW_DMA, in, DMA_SxCR_PL_HIGH);
+
+    dma_stream_reset(JPEG_HW_DMA, out);
+    DMA_SCR(JPEG_HW_DMA, out) |= JPEG_HW_DMA_CHANNEL;
+    dma_set_transfer_mode(JPEG_HW_DMA, out, DMA_SxCR_DIR_PERIPHERAL_TO_MEM);
+    dma_set_peripheral_address(JPEG_HW_DMA, out, (uint32_t) &JPEG_HW_DOR);
+    dma_set_peripheral_size(JPEG_HW_DMA, out, DMA_SxCR_PSIZE_32BIT);
+    dma_set_memory_size(JPEG_HW_DMA, out, DMA_SxCR_MSIZE_32BIT);
+    dma_enable_memory_increment_mode(JPEG_HW_DMA, out);
+    dma_set_peripheral_burst(JPEG_HW_DMA, out, DMA_SxCR_PBURST_INCR4);
+    dma_enable_fifo_mode(JPEG_HW_DMA, out);
+    dma_set_fifo_threshold(JPEG_HW_DMA, out, DMA_SxFCR_FTH_4_4_FULL);
+    dma_set_priority(JPEG_HW_DMA, out, DMA_SxCR_PL_HIGH);
+}
+
+/*!
+ * @brief               Encodes 8-bit grayscale frame into JPEG file
+ *
+ * @param[in] pixels    Row major pixels, for example AGC frame
+ * @param[in] cols      Up to JPEG_HW_MAX_COLS
+ * @param[in] rows      Up to JPEG_HW_MAX_ROWS
+ * @param[in] stride    Distance between rows in pixels
+ * @param[out] out      Word aligned, whole file goes here
+ * @param[in] out_len
+ *
+ * @return              Length of the file, 0 if frame is too large, did
+ *                      not fit into out or codec did not finish in
+ *                      JPEG_HW_TIMEOUT
+ *
+ * @note                Blocks until the file is done, CPU only waits for
+ *                      the codec after the block reorder.
+ */
+uint32_t jpeg_hw_encode_u8(const uint8_t * pixels, uint16_t cols,
+                           uint16_t rows, uint32_t stride,
+                           uint8_t * out, uint32_t out_len)
+{
+    if (!cols || !rows || cols > JPEG_HW_MAX_COLS ||
+        rows > JPEG_HW_MAX_ROWS || ((uint32_t) out & 3) ||
+        out_len < JPEG_HW_HEADER_LEN + 2 + 16)
+    {
+        return 0;
+    }
+
+    uint8_t * scan = header_write(out, cols, rows);
+    blocks_fill(pixels, cols, rows, stride);
+
+    uint32_t mcus = ((cols + 7) / 8) * ((rows + 7) / 8);
+    // Scan words, bursts of 4, EOI has to fit after
+    uint32_t scan_words = ((out_len - JPEG_HW_HEADER_LEN - 2) / 4) & ~3U;
+
+    JPEG_HW_CONFR0 = 0;
+    JPEG_HW_CR = JPEG_HW_CR_JCEN | JPEG_HW_CR_IFF | JPEG_HW_CR_OFF;
+    JPEG_HW_CFR = JPEG_HW_CFR_ALL;
+
+    // One grayscale component, encode, no header generation
+    JPEG_HW_CONFR1 = JPEG_HW_CONFR1_YSIZE(rows);
+    JPEG_HW_CONFR2 = mcus - 1;
+    JPEG_HW_CONFR3 = JPEG_HW_CONFR3_XSIZE(cols);
+    JPEG_HW_CONFR4 = JPEG_HW_CONFR4_HSF(1) | JPEG_HW_CONFR4_VSF(1);
+
+    dma_clear_interrupt_flags(JPEG_HW_DMA, JPEG_HW_DMA_IN, JPEG_HW_DMA_FLAGS);
+    dma_set_memory_address(JPEG_HW_DMA, JPEG_HW_DMA_IN, (uint32_t) blocks);
+    dma_set_number_of_data(JPEG_HW_DMA, JPEG_HW_DMA_IN, mcus * 64 / 4);
+    dma_enable_stream(JPEG_HW_DMA, JPEG_HW_DMA_IN);
+
+    dma_clear_interrupt_flags(JPEG_HW_DMA, JPEG_HW_DMA_OUT,
+                              JPEG_HW_DMA_FLAGS);
+    dma_set_memory_address(JPEG_HW_DMA, JPEG_HW_DMA_OUT, (uint32_t) scan);
+    dma_set_number_of_data(JPEG_HW_DMA, JPEG_HW_DMA_OUT, scan_words);
+    dma_enable_stream(JPEG_HW_DMA, JPEG_HW_DMA_OUT);
+
+    JPEG_HW_CR = JPEG_HW_CR_JCEN | JPEG_HW_CR_IDMAEN | JPEG_HW_CR_ODMAEN;
+    JPEG_HW_CONFR0 = JPEG_HW_CONFR0_START;
+
+    uint64_t start = millis();
+    while (!(JPEG_HW_SR & JPEG_HW_SR_EOCF) &&
+           millis() - start < JPEG_HW_TIMEOUT);
+    bool done = (JPEG_HW_SR & JPEG_HW_SR_EOCF) != 0;
+
+    // Disabled stream writes what is left in its FIFO to memory first
+    JPEG_HW_CR = JPEG_HW_CR_JCEN;
+    dma_disable_stream(JPEG_HW_DMA, JPEG_HW_DMA_IN);
+    dma_disable_stream(JPEG_HW_DMA, JPEG_HW_DMA_OUT);
+    while (DMA_SCR(JPEG_HW_DMA, JPEG_HW_DMA_IN) & DMA_SxCR_EN);
+    while (DMA_SCR(JPEG_HW_DMA, JPEG_HW_DMA_OUT) & DMA_SxCR_EN);
+
+    uint32_t words = scan_words - DMA_SNDTR(JPEG_HW_DMA, JPEG_HW_DMA_OUT);
+    while (done && (JPEG_HW_SR & JPEG_HW_SR_OFNEF))
+    {
+        uint32_t word = JPEG_HW_DOR;
+        if (words >= scan_words)
+        {
+            done = false;
+            break;
+        }
+        memcpy(scan + words * 4, &word, 4);
+        words++;
+    }
+
+    JPEG_HW_CONFR0 = 0;
+    JPEG_HW_CR = JPEG_HW_CR_JCEN | JPEG_HW_CR_IFF | JPEG_HW_CR_OFF;
+    JPEG_HW_CFR = JPEG_HW_CFR_ALL;
+    if (!done)
+    {
+        return 0;
+    }
+
+    uint8_t * end = scan + words * 4;
+    *end++ = 0xFF;
+    *end++ = 0xD9;
+    return (uint32_t) (end - out);
+}
+
+/*!
+ * @brief   Writes marker segment header, big endian length includes itself
+ */
+static inline uint8_t * marker_write(uint8_t * out, uint8_t marker,
+                                     uint16_t len)
+{
+    *out++ = 0xFF;
+    *out++ = marker;
+    *out++ = (uint8_t) (len >> 8);
+    *out++ = (uint8_t) len;
+    return out;
+}
+
+/*!
+ * @brief   Writes JFIF header of JPEG_HW_HEADER_LEN bytes
+ *
+ * @return  First byte after it, where scan starts
+ */
+static uint8_t * header_write(uint8_t * out, uint16_t cols, uint16_t rows)
+{
+    static const uint8_t jfif[14] =
+    {
+        'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0,
+    };
+
+    *out++ = 0xFF;
+    *out++ = 0xD8;
+
+    out = marker_write(out, 0xE0, 2 + sizeof(jfif));
+    memcpy(out, jfif, sizeof(jfif));
+    out += sizeof(jfif);
+
+    out = marker_write(out, 0xDB, 2 + 1 + 64);
+    *out++ = 0x00;
+    memcpy(out, quant, 64);
+    out += 64;
+
+    out = marker_write(out, 0xC0, 2 + 6 + 3);
+    *out++ = 8;
+    *out++ = (uint8_t) (rows >> 8);
+    *out++ = (uint8_t) rows;
+    *out++ = (uint8_t) (cols >> 8);
+    *out++ = (uint8_t) cols;
+    *out++ = 1;
+    *out++ = 1;
+    *out++ = 0x11;
+    *out++ = 0;
+
+    out = marker_write(out, 0xC4, 2 + 17 + JPEG_HW_DC_CODES +
+                                  17 + JPEG_HW_AC_CODES);
+    *out++ = 0x00;
+    memcpy(out, dc_bits, 16);
+    memcpy(out + 16, dc_vals, JPEG_HW_DC_CODES);
+    out += 16 + JPEG_HW_DC_CODES;
+    *out++ = 0x10;
+    memcpy(out, ac_bits, 16);
+    memcpy(out + 16, ac_vals, JPEG_HW_AC_CODES);
+    out += 16 + JPEG_HW_AC_CODES;
+
+    out = marker_write(out, 0xDA, 2 + 1 + 2 + 3);
+    *out++ = 1;
+    *out++ = 1;
+    *out++ = 0x00;
+    *out++ = 0;
+    *out++ = 63;
+    *out++ = 0;
+    return out;
+}
+
+/*!
+ * @brief   Copies frame into 8x8 blocks, row by row of blocks, edge
+ *          pixels are repeated into the padding
+ */
+static void blocks_fill(const uint8_t * pixels, uint16_t cols, uint16_t rows,
+                        uint32_t stride)
+{
+    uint8_t * dst = blocks;
+
+    for (uint16_t by = 0; by < rows; by += 8)
+    {
+        for (uint16_t bx = 0; bx < cols; bx += 8)
+        {
+            for (uint16_t y = by; y < by + 8; y++)
+            {
+                const uint8_t * src = pixels +
+                                      (y < rows ? y : rows - 1) * stride;
+                if (bx + 8 <= cols)
+                {
+                    memcpy(dst, src + bx, 8);
+                }
+                else
+                {
+                    for (uint16_t x = 0; x < 8; x++)
+                    {
+                        dst[x] = src[bx + x < cols ? bx + x : cols - 1];
+                    }
+                }
+                dst += 8;
+            }
+        }
+    }
+}
+
+/*!
+ * @brief               Programs encoder Huffman table from the BITS and
+ *                      HUFFVAL lists of the DHT segment
+ *
+ * @param[in] table     HUFFENC memory of the table
+ * @param[in] ac        AC symbols are run and size pairs, DC symbols are
+ *                      sizes
+ */
+static void huff_write(volatile uint32_t * table, const uint8_t bits[16],
+                       const uint8_t * vals, uint16_t count, bool ac)
+{
+    uint16_t entries[JPEG_HW_AC_CODES] = {0};
+    uint16_t code = 0;
+    uint16_t k = 0;
+
+    // Canonical codes, each length continues where the previous ended
+    for (uint8_t len = 1; len <= 16; len++)
+    {
+        for (uint8_t i = 0; i < bits[len - 1] && k < count; i++, k++)
+        {
+            uint16_t index = ac ? ac_index(vals[k]) : vals[k];
+            if (index < count)
+            {
+                entries[index] = ((len - 1) << 8) | (code & 0xFF);
+            }
+            code++;
+        }
+        code <<= 1;
+    }
+
+    for (uint16_t i = 0; i < count / 2; i++)
+    {
+        table[i] = entries[2 * i] | ((uint32_t) entries[2 * i + 1] << 16);
+    }
+
+    const uint32_t * tail = ac ? ac_tail : dc_tail;
+    uint8_t tail_words = ac ? sizeof(ac_tail) / 4 : sizeof(dc_tail) / 4;
+    for (uint8_t i = 0; i < tail_words; i++)
+    {
+        table[count / 2 + i] = tail[i];
+    }
+}
+/*** end of file ***/
@@ -0,0 +1,32 @@
+#ifndef JPEG_HW_H
+#define JPEG_HW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Largest frame, block buffer is sized for it, rows and columns are
+// padded to 8 inside
+#define JPEG_HW_MAX_COLS        80
+#define JPEG_HW_MAX_ROWS        60
+
+#define JPEG_HW_QUALITY         75      // 1 to 100, like IJG libjpeg
+#define JPEG_HW_TIMEOUT         (5)     // In ms, a whole frame takes ~0.1 ms
+
+// Bytes that go before the scan, SOI, APP0, DQT, SOF0, DHT and SOS
+#define JPEG_HW_HEADER_LEN      324
+
+void jpeg_hw_setup(uint8_t quality);
+uint32_t jpeg_hw_encode_u8(const uint8_t * pixels, uint16_t cols,
+                           uint16_t rows, uint32_t stride,
+                           uint8_t * out, uint32_t out_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JPEG_HW_H */
+/*** end of file ***/
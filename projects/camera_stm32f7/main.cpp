@@ -2,15 +2,36 @@
 #include "sys_init.h"
 #include "utility.h"
 #include "flir.h"
+#include "telemetry.h"
+#include "frame_convert.h"
+#include "uart_dma.h"
+#include "jpeg_hw.h"
+
+// Streams every new frame of the camera, 9 Hz of Lepton, camera stays in
+// sync between frames. Comment out to send one frame per second, each
+// with full synchronization.
+#define LIVE_STREAM
+
+// 2 or 4 sends 40x30 or 20x15 box filtered preview instead of the whole
+// 80x60 frame, a quarter or a sixteenth of the data on the link
+#define PREVIEW_SCALE       1
+
+// Frames are sent as JPEG of the hardware codec, around a tenth of the raw
+// frame. Comment out to send them lossless with frame_codec.h.
+#define JPEG_STREAM
 
 int main() 
 {
     clock_setup();
     systick_setup();
     usart_setup();
+    uart_dma_setup();
     gpio_setup();
     i2c_setup();
     spi_setup();
+#ifdef JPEG_STREAM
+    jpeg_hw_setup(JPEG_HW_QUALITY);
+#endif
 
     printf("System setup done!\n");
 
@@ -30,23 +51,86 @@ int main()
 
     printf("FLIR setup done!\n");
 
+    // Frames are streamed as binary packets, flir_image.py shows them and
+    // counts messages that were lost from their sequence numbers. DMA
+    // sends one frame while the next one is read.
+    static telemetry_t telemetry;
+    telemetry_init(&telemetry, uart_dma_write);
+
+    // Coded frame, it is sent raw if it does not fit, JPEG goes here too
+    static uint8_t coded[80 * 60] __attribute__((aligned(4)));
+#ifdef LIVE_STREAM
+    // VoSPI gives every frame three times, only new ones are sent
+    static uint16_t last[60][82];
+#endif
+
     while(1)
     {
-        if(get_picture(frame))
+        uint64_t start = micros();
+#ifdef LIVE_STREAM
+        if (!get_next_picture(frame) ||
+            0 == memcmp(frame, last, sizeof(last)))
+        {
+            continue;
+        }
+        memcpy(last, frame, sizeof(last));
+#else
+        delay(1000);
+        start = micros();
+        if (!get_picture(frame))
+        {
+            continue;
+        }
+#endif
+        // First two words of each row are ID and CRC of VoSPI packet
+        uint32_t capture = (uint32_t) (micros() - start);
+#ifdef JPEG_STREAM
+        static uint8_t agc[60][80];
+        for (int row = 0; row < 60; row++)
+        {
+            frame_pack_u16(&frame[row][2], agc[row], 80);
+        }
+#if PREVIEW_SCALE > 1
+        static uint8_t preview[(60 / PREVIEW_SCALE) * (80 / PREVIEW_SCALE)];
+        frame_downscale_u8(&agc[0][0], 80, 80, 60, PREVIEW_SCALE, preview);
+        const uint8_t * pixels = preview;
+#else
+        const uint8_t * pixels = &agc[0][0];
+#endif
+        uint8_t cols = 80 / PREVIEW_SCALE;
+        uint8_t rows = 60 / PREVIEW_SCALE;
+        uint32_t len = jpeg_hw_encode_u8(pixels, cols, rows, cols,
+                                         coded, sizeof(coded));
+        if (len)
+        {
+            telemetry_send_frame_jpeg(&telemetry, cols, rows, coded, len);
+        }
+        else
+        {
+            telemetry_send_frame_u8(&telemetry, pixels, cols, rows, cols);
+        }
+#elif PREVIEW_SCALE > 1
+        static uint8_t agc[60][80];
+        static uint8_t preview[(60 / PREVIEW_SCALE) * (80 / PREVIEW_SCALE)];
+        for (int row = 0; row < 60; row++)
         {
-            printf("We made a image\n");
-            //for(uint8_t row = 0; row < 60; row++)
-            //{
-            //    for(uint8_t col = 2; col < 82; col++)
-            //    {
-            //        printf("%hhu ", (uint8_t)frame[row][col]);
-            //    }
-            //    printf("\n");
-            //}
-            delay(1000);
+            frame_pack_u16(&frame[row][2], agc[row], 80);
         }
+        frame_downscale_u8(&agc[0][0], 80, 80, 60, PREVIEW_SCALE, preview);
+        telemetry_send_frame_coded_u8(&telemetry, preview,
+                                      80 / PREVIEW_SCALE, 60 / PREVIEW_SCALE,
+                                      80 / PREVIEW_SCALE,
+                                      coded, sizeof(coded));
+#else
+        telemetry_send_frame_coded_u16(&telemetry, &frame[0][2], 80, 60, 82,
+                                       coded, sizeof(coded));
+#endif
+        telemetry_send_latency(&telemetry,
+                               capture,
+                               0,
+                               (uint32_t) (micros() - start));
+        uart_dma_flush();
     }
 
     return 0;
 }
-
@@ -1,8 +1,10 @@
 #include "sys_init.h"
+#include "uart_dma.h"
 
+// Text goes out between telemetry messages, see uart_dma.c
 void _putchar(char character)
 {
-    usart_send_blocking(USART3, character); /* USART3: Send byte. */
+    uart_dma_putc(character);
 }
 
 // Our clock frequency in MHz, it has to be set manually by programmer in clock setup
@@ -136,7 +138,7 @@ void usart_setup(void)
 	gpio_set_af(GPIOD, GPIO_AF7, GPIO8);
 
 	/* Setup USART3 parameters. */
-	usart_set_baudrate(USART3, 115200);
+	usart_set_baudrate(USART3, 921600);
 	usart_set_databits(USART3, 8);
 	usart_set_stopbits(USART3, USART_STOPBITS_1);
 	usart_set_mode(USART3, USART_MODE_TX);
@@ -0,0 +1,130 @@
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/dma.h>
+#include "uart_dma.h"
+
+/* Explanation: USART3 sends from two buffers by DMA1 stream 3, channel 4.
+ * Writes are copied into the fill buffer, uart_dma_flush() hands it to
+ * DMA and continues with the other one, so the next frame is read from
+ * the camera while the previous one is still on the line. Flush waits only
+ * if DMA is still sending the other buffer, that is when the link is
+ * slower than frames. Buffer that fills up is flushed by the write itself,
+ * so messages of any length can be written.
+ *
+ * End of a transfer is seen on EN bit of the stream, which DMA clears
+ * itself, so there is no interrupt. D-cache is not enabled in this
+ * project, buffers need no cache maintenance.
+ *
+ * printf() output goes through here too, so it never lands in the middle
+ * of a DMA transfer. Every text line is followed by 0x00, the delimiter
+ * of shared/telemetry.h, so it does not corrupt the next message, and
+ * flir_image.py prints it as firmware log.
+ * */
+
+#define UART_DMA            DMA1
+#define UART_DMA_STREAM     DMA_STREAM3
+#define UART_DMA_CHANNEL    DMA_SxCR_CHSEL_4
+
+static uint8_t buffers[2][UART_DMA_BUF_LEN];
+static uint8_t fill_index = 0;
+static uint32_t fill_len = 0;
+
+/*!
+ * @brief   Sets up DMA stream of USART3 transmit
+ *
+ * @note    Call after usart_setup().
+ */
+void uart_dma_setup()
+{
+    rcc_periph_clock_enable(RCC_DMA1);
+
+    dma_stream_reset(UART_DMA, UART_DMA_STREAM);
+    dma_channel_select(UART_DMA, UART_DMA_STREAM, UART_DMA_CHANNEL);
+    dma_set_transfer_mode(UART_DMA, UART_DMA_STREAM,
+                          DMA_SxCR_DIR_MEM_TO_PERIPHERAL);
+    dma_set_peripheral_address(UART_DMA, UART_DMA_STREAM,
+                               (uint32_t) &USART3_TDR);
+    dma_set_peripheral_size(UART_DMA, UART_DMA_STREAM, DMA_SxCR_PSIZE_8BIT);
+    dma_set_memory_size(UART_DMA, UART_DMA_STREAM, DMA_SxCR_MSIZE_8BIT);
+    dma_enable_memory_increment_mode(UART_DMA, UART_DMA_STREAM);
+    dma_set_priority(UART_DMA, UART_DMA_STREAM, DMA_SxCR_PL_LOW);
+
+    usart_enable_tx_dma(USART3);
+}
+
+/*!
+ * @brief   Returns true while DMA is sending a buffer
+ */
+bool uart_dma_busy()
+{
+    return (DMA_SCR(UART_DMA, UART_DMA_STREAM) & DMA_SxCR_EN) != 0;
+}
+
+/*!
+ * @brief   Starts sending what was written so far
+ *
+ * @note    Blocks only until previous buffer is sent, returns as soon as
+ *          DMA takes this one.
+ */
+void uart_dma_flush()
+{
+    if (fill_len == 0)
+    {
+        return;
+    }
+
+    while (uart_dma_busy());
+
+    dma_clear_interrupt_flags(UART_DMA, UART_DMA_STREAM,
+                              DMA_TCIF | DMA_HTIF | DMA_TEIF | DMA_DMEIF |
+                              DMA_FEIF);
+    // Transfer complete of USART has to be cleared before DMA starts
+    USART3_ICR = USART_ICR_TCCF;
+    dma_set_memory_address(UART_DMA, UART_DMA_STREAM,
+                           (uint32_t) buffers[fill_index]);
+    dma_set_number_of_data(UART_DMA, UART_DMA_STREAM, fill_len);
+    dma_enable_stream(UART_DMA, UART_DMA_STREAM);
+
+    fill_index ^= 1;
+    fill_len = 0;
+}
+
+/*!
+ * @brief               Copies bytes into fill buffer
+ *
+ * @param[in] data
+ * @param[in] len
+ *
+ * @note                Matches write function of telemetry_init().
+ */
+void uart_dma_write(const uint8_t * data, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++)
+    {
+        if (fill_len == UART_DMA_BUF_LEN)
+        {
+            uart_dma_flush();
+        }
+        buffers[fill_index][fill_len++] = data[i];
+    }
+}
+
+/*!
+ * @brief               Writes one character of text, line is sent once it
+ *                      is complete
+ *
+ * @param[in] c
+ */
+void uart_dma_putc(char c)
+{
+    uint8_t byte = (uint8_t) c;
+    uart_dma_write(&byte, 1);
+
+    if (c == '\n')
+    {
+        uint8_t delimiter = 0;
+        uart_dma_write(&delimiter, 1);
+        uart_dma_flush();
+    }
+}
+/*** end of file ***/
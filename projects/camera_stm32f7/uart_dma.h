@@ -0,0 +1,27 @@
+#ifndef UART_DMA_H
+#define UART_DMA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Size of each of the two transmit buffers, one coded frame with its
+// latency message fits into one. At 921600 baud it takes about 55 ms to
+// send a whole buffer.
+#define UART_DMA_BUF_LEN    5120
+
+void uart_dma_setup();
+void uart_dma_write(const uint8_t * data, uint32_t len);
+void uart_dma_putc(char c);
+void uart_dma_flush();
+bool uart_dma_busy();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UART_DMA_H */
+/*** end of file ***/
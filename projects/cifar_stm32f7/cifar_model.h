@@ -1,7 +1,10 @@
 #ifndef CIFAR_MODEL_H
 #define CIFAR_MODEL_H
 
+// Linked from cifar.tflite, see BLOBS in project.mk
+
 extern const unsigned char cifar_tflite[];
 extern const unsigned int cifar_tflite_len;
+extern const unsigned int cifar_tflite_crc32;
 
 #endif  // CIFAR_MODEL_H
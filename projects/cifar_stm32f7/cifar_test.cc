@@ -29,6 +29,7 @@ limitations under the License.
 #include "cifar_model.h"
 #include "pictures/pictures.h"
 #include "model_settings.h"
+#include "conv_pool_fused.h"
 
 constexpr int tensor_arena_size = 50 * 1024;
 uint8_t tensor_arena[tensor_arena_size];
@@ -97,9 +98,12 @@ TF_LITE_MICRO_TEST(TestInvoke) {
     micro_op_resolver.AddSoftmax();
     micro_op_resolver.AddDequantize();
 
+    // MaxPool2D layers are fused into Conv2D, see fuse_conv_pool.py
+    static Conv2DPoolResolver pool_resolver(micro_op_resolver);
+
     // Build an interpreter to run the model with.
     tflite::MicroInterpreter interpreter(model, 
-                                        micro_op_resolver, 
+                                        pool_resolver, 
                                         tensor_arena,
                                         tensor_arena_size, 
                                         error_reporter);
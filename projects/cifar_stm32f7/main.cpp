@@ -1,156 +1,187 @@
 
 // Includes connected with Tensorflow 
 #include "tensorflow/lite/c/common.h"
-#include "tensorflow/lite/micro/all_ops_resolver.h"
 #include "tensorflow/lite/micro/micro_error_reporter.h"
-#include "tensorflow/lite/micro/micro_interpreter.h"
-#include "tensorflow/lite/micro/testing/micro_test.h"
-#include "tensorflow/lite/schema/schema_generated.h"
-#include "tensorflow/lite/version.h"
-
-#include "tensorflow/lite/micro/micro_mutable_op_resolver.h"
-#include "tensorflow/lite/micro/kernels/micro_ops.h"
 
 // Includes connected with micro
-#include "sys_init.h"
-#include "utility.h"
+#define BOARD_IMPLEMENTATION
+#include "board.h"
+#include "printf.h"
 #include "cifar_model.h"
 #include "pictures/pictures.h"
 #include "model_settings.h"
+#include "cycle_profiler.h"
+#include "inference_engine.h"
+#include "model_ops.h"
+#include "conv_pool_fused.h"
+#include "conv_winograd.h"
+#include "lut_activations.h"
+#include "output_scores.h"
+#include "target_bench.h"
+
+#ifdef STATIC_MODEL
+#include <string.h>
+#include "static_model.h"
+#endif
+
+// Exact size measured with ARENA_REPORT=1 build, see shared/arena_report.h
+#if !defined(ARENA_REPORT) && __has_include("arena_size.h")
+#include "arena_size.h"
+#endif
+
+
+#ifdef ARENA_SIZE_BYTES
+constexpr int tensor_arena_size = ARENA_SIZE_BYTES;
+#else
+constexpr int tensor_arena_size = 24 * 1024;
+#endif
+
+#ifdef STATIC_MODEL
+// Tensors, conv strip and im2col of the generated graph, the interpreter
+// is not linked at all
+alignas(16) static uint8_t static_arena[kStaticModelArenaSize];
+#else
+// Only kernels of the model are linked in, list is generated from cifar.tflite
+InferenceEngine<tensor_arena_size, MODEL_ENGINE_OPS> engine;
+#endif
+
+// Test pictures, main() and benchmark go over all of them. Classes of the
+// bundled pictures are not recorded, put index of kCategoryLabels into
+// label to have them counted in accuracy.
+const TargetBenchImage pictures[] = {
+    {"Picture 0", picture0, kTargetBenchNoLabel},
+    {"Picture 1", picture1, kTargetBenchNoLabel},
+    {"Picture 2", picture2, kTargetBenchNoLabel},
+    {"Picture 3", picture3, kTargetBenchNoLabel},
+    {"Picture 4", picture4, kTargetBenchNoLabel},
+    {"Picture 5", picture5, kTargetBenchNoLabel},
+};
+constexpr int picture_count = sizeof(pictures) / sizeof(pictures[0]);
+// Invokes of each picture, first one is reported on its own
+constexpr int kBenchRuns = 5;
+
+#ifdef STATIC_MODEL
+// Same pictures through static_model.cc that gen_static_model.py generates
+// from cifar.tflite, output is float as the model ends with Dequantize
+int main()
+{
+    board_init();
 
+    printf("System setup done on %s at %lu MHz!\n", BOARD_NAME,
+           rcc_ahb_frequency / 1000000);
 
-constexpr int tensor_arena_size = 45 * 1024;
-uint8_t tensor_arena[tensor_arena_size];
+    if (!static_model_matches(cifar_tflite_len, cifar_tflite_crc32) ||
+        !static_model_setup())
+    {
+        printf("static_model.cc is not generated from this cifar.tflite\n");
+        while(1);
+    }
 
-void load_data(const signed char * data, TfLiteTensor * input)
-{
-    for (int i = 0; i < input->bytes; ++i)
+    for (int i = 0; i < picture_count; i++)
+    {
+        memcpy(static_model_input(static_arena), pictures[i].data,
+               kStaticModelInputSize);
+        uint32_t start = millis();
+        bool ok = static_model_invoke(cifar_tflite, static_arena);
+        uint32_t end = millis();
+
+        int32_t milli[kStaticModelOutputCount];
+        const float * output = static_model_output(static_arena);
+        for (int c = 0; c < kStaticModelOutputCount; c++)
+        {
+            milli[c] = static_cast<int32_t>(output[c] * 1000.0f);
+        }
+        char line[64];
+        OutputScores::FormatMilli(line, sizeof(line), milli,
+                                  kStaticModelOutputCount);
+        printf("\n%s\n", pictures[i].name);
+        printf("[[%s]]%s\n", line, ok ? "" : " failed");
+        printf("Inference time: %d ms", end - start);
+    }
+    printf("\n");
+
+    while(1)
     {
-        input->data.int8[i] = data[i];
     }
+
+    return 0;
+}
+#else
+// Images in flash are used in place, nothing is copied per run
+void load_data(const signed char * data, TfLiteTensor * input)
+{
+    engine.LoadInput(data, input->bytes);
 }
 
 void print_result(const char * title, TfLiteTensor * output, uint32_t duration)
 {
+    // Works for int8 output of stripped model and float one
+    OutputScores scores;
+    char line[64];
+
+    scores.Bind(output);
+    scores.Format(line, sizeof(line), kCategoryCount);
     printf("\n%s\n", title);
-    printf("[[%f %f %f]]\n", output->data.f[0],
-                             output->data.f[1],
-                             output->data.f[2]);
+    printf("[[%s]]\n", line);
     printf("Inference time: %d ms", duration);
 }
 
 int main() 
 {
-    clock_setup();
-    systick_setup();
-    usart_setup();
-    gpio_setup();
-    //i2c_setup();
-    //spi_setup();
+    board_init();
 
-    printf("System setup done!\n");
+    printf("System setup done on %s at %lu MHz!\n", BOARD_NAME,
+           rcc_ahb_frequency / 1000000);
 
     tflite::MicroErrorReporter micro_error_reporter;
     tflite::ErrorReporter* error_reporter = &micro_error_reporter;
 
-    // Map the model into a usable data structure. This doesn't involve any
-    // copying or parsing, it's a very lightweight operation.
-    const tflite::Model* model = ::tflite::GetModel(cifar_tflite);
-    if (model->version() != TFLITE_SCHEMA_VERSION) {
-        printf("Model provided is schema version %d not equal "
-               "to supported version %d.\n",
-               model->version(), TFLITE_SCHEMA_VERSION);
+    // Measures cycles of each operator
+    static CycleProfiler profiler(error_reporter);
+
+    // MaxPool2D layers are fused into Conv2D, see fuse_conv_pool.py, 3x3
+    // layers from winograd_weights.py run in Winograd domain, Softmax is
+    // a table lookup
+    static LutActivationResolver lut_resolver(engine.resolver());
+    static Conv2DPoolResolver pool_resolver(lut_resolver);
+    static Conv2DWinogradResolver winograd_resolver(pool_resolver);
+    engine.SetResolver(&winograd_resolver);
+
+    if (!engine.Setup(cifar_tflite, error_reporter, &profiler))
+    {
+        while(1);
+    }
+    engine.PrintInfo();
+
+    TfLiteTensor* input = engine.input();
+    TfLiteTensor* output = engine.output();
+
+#ifdef TARGET_BENCH
+    // Benchmark firmware, built with make bench
+    TargetBenchConfig config = {20, 2, TARGET_BENCH_SWEEP};
+    target_bench_run("cifar", engine.interpreter(), &profiler, pictures,
+                     picture_count, config, error_reporter);
+    while(1)
+    {
     }
-    static tflite::MicroMutableOpResolver<6> micro_op_resolver;
-    micro_op_resolver.AddConv2D();
-    micro_op_resolver.AddMaxPool2D();
-    micro_op_resolver.AddReshape();
-    micro_op_resolver.AddFullyConnected();
-    micro_op_resolver.AddSoftmax();
-    micro_op_resolver.AddDequantize();
-
-    // Build an interpreter to run the model with.
-    tflite::MicroInterpreter interpreter(model, 
-                                        micro_op_resolver, 
-                                        tensor_arena,
-                                        tensor_arena_size, 
-                                        error_reporter);
-    interpreter.AllocateTensors();
-
-    // Get information about the memory area to use for the model's input.
-    TfLiteTensor* input = interpreter.input(0);
-
-    printf("Input:\n");
-    printf("Dimension: %d\n", input->dims->size);
-    printf("First Dimension: %d\n", input->dims->data[0]);
-    printf("Rows: %d\n", input->dims->data[1]);
-    printf("Columns: %d\n", input->dims->data[2]);
-    printf("Channels: %d\n", input->dims->data[3]);
-    printf("Input type: %d\n", input->type);
-
-    load_data(picture0, input);
-
-    uint32_t start = millis();
-    // Run the model on this input and make sure it succeeds.
-    TfLiteStatus invoke_status = interpreter.Invoke();
-    if (invoke_status != kTfLiteOk)
+#endif
+
+    // Result of every picture, then latency of every picture
+    for (int i = 0; i < picture_count; i++)
     {
-        printf("Invoke failed\n");
+        load_data(pictures[i].data, input);
+        uint32_t start = millis();
+        // Run the model on this input and make sure it succeeds.
+        engine.Invoke();
+        uint32_t end = millis();
+        print_result(pictures[i].name, output, end-start);
     }
-    uint32_t end = millis();
-
-    // Get the output from the model, and make sure it's the expected size and
-    // type.
-    TfLiteTensor* output = interpreter.output(0);
-
-    printf("\nOutput:\n");
-    printf("Dimension size: %d\n",  output->dims->size);
-    printf("First Dimension: %d\n", output->dims->data[0]);
-    printf("Rows: %d\n",            output->dims->data[1]);
-    printf("Output type: %d\n",     output->type);
-
-    print_result("Picture 0", output, end-start);
-
-    // Picture 1
-    load_data(picture1, input);
-    start = millis();
-    interpreter.Invoke();
-    end = millis();
-    output = interpreter.output(0);
-    print_result("Picture 1", output, end-start);
-
-    // Picture 2
-    load_data(picture2, input);
-    start = millis();
-    interpreter.Invoke();
-    end = millis();
-    output = interpreter.output(0);
-    print_result("Picture 2", output, end-start);
-
-    // Picture 3
-    load_data(picture3, input);
-    start = millis();
-    interpreter.Invoke();
-    end = millis();
-    output = interpreter.output(0);
-    print_result("Picture 3", output, end-start);
-
-    // Picture 4
-    load_data(picture4, input);
-    start = millis();
-    interpreter.Invoke();
-    end = millis();
-    output = interpreter.output(0);
-    print_result("Picture 4", output, end-start);
-
-    // Picture 5
-    
-    load_data(picture5, input);
-    start = millis();
-    interpreter.Invoke();
-    end = millis();
-    output = interpreter.output(0);
-    print_result("Picture 5", output, end-start);
+    printf("\n");
+    target_bench_images(&engine, pictures, picture_count, kBenchRuns,
+                        error_reporter);
+
+    // Average over all runs
+    profiler.PrintTable();
 
 
     while(1)
@@ -159,4 +190,4 @@ int main()
     
     return 0;
 }
-
+#endif
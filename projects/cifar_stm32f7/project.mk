@@ -13,10 +13,13 @@ DEBUG = -g
 # Explicitly define files used. For now only .cc files are supported 
 # Test routine is invoked with make test in project directory
 # Make sure to fiter out test files that will not be used in real application
-TESTFILES =  cifar_test.cc cifar_model.cc model_settings.cc \
+TESTFILES =  cifar_test.cc model_settings.cc \
 $(wildcard pictures/*.cc)
 TEST_LDLIBS = testlite_build/testlite.a
 
+# Host benchmark, invoked with make host_bench, see shared/host_bench.h
+BENCHFILES = $(wildcard bench/*.cc) $(wildcard pictures/*.cc)
+
 # Source files are added here, wildcard function adds them automatically,
 # if you are going to create seperate folders you have to add them by yourself.
 # example: driver/motor.c -> $(wildcard driver/*.c)
@@ -25,9 +28,25 @@ CXXFILES = $(wildcard *.cpp)
 CCFILES = $(filter-out cifar_test.cc,$(wildcard *.cc)) $(wildcard pictures/*.cc) # Needed to filter out testfiles
 AFILES = $(wildcard *.s)
 
+# Model is linked from the flatbuffer itself as cifar_tflite array, on 
+# cache line boundary, see BLOBS in rules.mk
+BLOBS := cifar.tflite
+
 # It is needed to add archived microlite library
 LIBDEPS := microlite_build/microlite.a
 
+# Model from which model_ops.h with needed operators is generated
+MODEL_SRC := cifar.tflite
+# Runs the model as generated CMSIS-NN calls instead of the interpreter,
+# see gen_static_model.py, 'make clean' first
+#STATIC_MODEL_SRC := cifar.tflite
+
+
+# Header only code shared between projects
+SHARED_DIR := ../../shared
+
+# Sources from shared folder that are compiled into the project
+SHARED_CFILES := printf.c
 
 # If you add new folders do not forget to update the INCLUDES!
 INCLUDES += $(patsubst %,-I%, . $(SHARED_DIR))
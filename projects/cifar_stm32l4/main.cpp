@@ -0,0 +1,185 @@
+
+// Includes connected with Tensorflow
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/micro/micro_error_reporter.h"
+
+// Includes connected with micro
+#define BOARD_IMPLEMENTATION
+#include "board.h"
+#include <libopencm3/cm3/dwt.h>
+#include "printf.h"
+#include "cifar_model.h"
+#include "pictures/pictures.h"
+#include "model_settings.h"
+#include "cycle_profiler.h"
+#include "inference_engine.h"
+#include "model_ops.h"
+#include "conv_pool_fused.h"
+#include "lut_activations.h"
+#include "output_scores.h"
+#include "target_bench.h"
+#include "power_profile.h"
+
+// Exact size measured with ARENA_REPORT=1 build, see shared/arena_report.h
+#if !defined(ARENA_REPORT) && __has_include("arena_size.h")
+#include "arena_size.h"
+#endif
+
+#ifdef ARENA_SIZE_BYTES
+constexpr int tensor_arena_size = ARENA_SIZE_BYTES;
+#else
+constexpr int tensor_arena_size = 24 * 1024;
+#endif
+
+// Same model as cifar_stm32f7. Engine with its arena is in SRAM2 of
+// STM32L4 (32 KB), SRAM1 is left to stack, .data and .bss.
+InferenceEngine<tensor_arena_size, MODEL_ENGINE_OPS> engine SRAM2_BSS;
+
+const TargetBenchImage pictures[] = {
+    {"Picture 0", picture0, kTargetBenchNoLabel},
+    {"Picture 1", picture1, kTargetBenchNoLabel},
+    {"Picture 2", picture2, kTargetBenchNoLabel},
+    {"Picture 3", picture3, kTargetBenchNoLabel},
+    {"Picture 4", picture4, kTargetBenchNoLabel},
+    {"Picture 5", picture5, kTargetBenchNoLabel},
+};
+constexpr int picture_count = sizeof(pictures) / sizeof(pictures[0]);
+// Invokes of each picture per profile
+constexpr int kBenchRuns = 5;
+
+// Sites classify a couple of times per minute and sleep in between,
+// average current and battery life of the report are for this rate
+constexpr uint32_t kClassificationsPerMinute = 2;
+constexpr uint32_t kBatteryMah = 2000;
+
+/*!
+ * @brief   Prints class of every picture
+ */
+static void print_results(TfLiteTensor * output)
+{
+    OutputScores scores;
+    char line[64];
+
+    for (int i = 0; i < picture_count; i++)
+    {
+        engine.LoadInput(pictures[i].data, engine.input()->bytes);
+        engine.Invoke();
+        scores.Bind(output);
+        scores.Format(line, sizeof(line), kCategoryCount);
+        printf("%s [[%s]]\n", pictures[i].name, line);
+    }
+}
+
+/*!
+ * @brief   Runs every picture kBenchRuns times in every power profile and
+ *          prints time and estimated energy of one classification
+ *
+ * @note    Energy comes from typical currents of power_profile.c, times
+ *          are measured. Build for stm32f767zi ('make matrix-stm32f767zi')
+ *          prints the same line for Nucleo-F767ZI, compare the two.
+ */
+static void energy_benchmark()
+{
+    TfLiteTensor * input = engine.input();
+    printf("\nENERGY BEGIN\n");
+
+    for (int p = 0; p < POWER_PROFILE_END; p++)
+    {
+        const power_profile_info_t * info =
+            power_profile_info(static_cast<power_profile_t>(p));
+        power_profile_set(static_cast<power_profile_t>(p));
+
+        // First run fills flash caches, it is not counted
+        engine.LoadInput(pictures[0].data, input->bytes);
+        engine.Invoke();
+
+        uint64_t cycles = 0;
+        for (int i = 0; i < picture_count; i++)
+        {
+            engine.LoadInput(pictures[i].data, input->bytes);
+            for (int r = 0; r < kBenchRuns; r++)
+            {
+                uint32_t start = dwt_read_cycle_counter();
+                engine.Invoke();
+                cycles += dwt_read_cycle_counter() - start;
+            }
+        }
+        cycles /= picture_count * kBenchRuns;
+
+        uint32_t mhz = rcc_ahb_frequency / 1000000;
+        uint32_t run_us = static_cast<uint32_t>(cycles / mhz);
+        // uA * mV * us is in fJ
+        uint32_t run_uj = static_cast<uint32_t>(
+            static_cast<uint64_t>(info->run_ua) * POWER_SUPPLY_MV * run_us /
+            1000000000ULL);
+
+        // Average of one period, in tenths of uA
+        uint64_t period_us = 60000000ULL / kClassificationsPerMinute;
+        uint64_t sleep_us = period_us > run_us ? period_us - run_us : 0;
+        uint32_t average_dua = static_cast<uint32_t>(
+            (static_cast<uint64_t>(info->run_ua) * run_us +
+             static_cast<uint64_t>(info->sleep_ua) * sleep_us) * 10 /
+            period_us);
+        uint32_t battery_days = average_dua > 0 ?
+            static_cast<uint32_t>(kBatteryMah * 10000ULL / average_dua / 24) :
+            0;
+
+        printf("%s: %lu MHz, %lu cycles, %lu us, %lu uJ per inference, "
+               "%lu.%lu uA at %lu/min, %lu days on %lu mAh\n",
+               info->name, mhz, static_cast<uint32_t>(cycles), run_us,
+               run_uj, average_dua / 10, average_dua % 10,
+               kClassificationsPerMinute, battery_days, kBatteryMah);
+    }
+
+    printf("ENERGY END\n");
+    // Back to the fastest profile
+    power_profile_set(static_cast<power_profile_t>(0));
+}
+
+int main()
+{
+    board_init();
+
+    printf("System setup done on %s at %lu MHz!\n", BOARD_NAME,
+           rcc_ahb_frequency / 1000000);
+
+    tflite::MicroErrorReporter micro_error_reporter;
+    tflite::ErrorReporter* error_reporter = &micro_error_reporter;
+
+    // Measures cycles of each operator, also starts DWT cycle counter
+    static CycleProfiler profiler(error_reporter);
+
+    // MaxPool2D layers are fused into Conv2D, see fuse_conv_pool.py,
+    // Softmax is a table lookup
+    static LutActivationResolver lut_resolver(engine.resolver());
+    static Conv2DPoolResolver pool_resolver(lut_resolver);
+    engine.SetResolver(&pool_resolver);
+
+    if (!engine.Setup(cifar_tflite, error_reporter, &profiler))
+    {
+        while(1);
+    }
+    engine.PrintInfo();
+
+#ifdef TARGET_BENCH
+    // Benchmark firmware, built with make bench
+    TargetBenchConfig config = {20, 2, TARGET_BENCH_SWEEP};
+    target_bench_run("cifar", engine.interpreter(), &profiler, pictures,
+                     picture_count, config, error_reporter);
+    while(1)
+    {
+    }
+#endif
+
+    print_results(engine.output());
+    energy_benchmark();
+
+    // Average over all runs
+    profiler.PrintTable();
+
+    while(1)
+    {
+    }
+
+    return 0;
+}
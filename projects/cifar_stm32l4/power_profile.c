@@ -0,0 +1,183 @@
+#include <stddef.h>
+#include <stdbool.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/flash.h>
+#include <libopencm3/stm32/usart.h>
+#if defined(STM32L4)
+#include <libopencm3/stm32/pwr.h>
+#endif
+#include <libopencm3/cm3/cortex.h>
+#include "board.h"
+#include "power_profile.h"
+
+/* Explanation: on STM32L4 profiles differ in voltage range of the core
+ * regulator, system clock source, flash wait states and flash prefetch.
+ * Range 1 allows up to 80 MHz, range 2 only 26 MHz, but lowers both
+ * dynamic and leakage current. Wait states are the smallest ones of
+ * RM0351 for the clock and range: range 1 needs 4 at 80 MHz, range 2 2 at
+ * 26 MHz and 1 at 16 MHz.
+ *
+ * Flash I-cache and D-cache stay on in every profile, they save both
+ * cycles and flash reads. Prefetch reads the next flash line on every
+ * sequential fetch, that pays for itself only with many wait states, so
+ * it is on in range 1 and off in range 2, where a miss costs 1 or 2
+ * cycles. On this family there is no ART accelerator of STM32F7, caches
+ * of the flash interface are the L4 counterpart.
+ *
+ * Switch goes through HSI16, which runs in both ranges with 1 wait state:
+ * PLL can not be reconfigured while it drives SYSCLK, range 1 has to be
+ * set before clock goes above 26 MHz and range 2 only after it is below.
+ * HSI16 stays on in every profile, it is the kernel clock of LPUART1 and
+ * the PLL input.
+ *
+ * rcc_*_frequency are set, SysTick reload and USART baud rate are set up
+ * again by board.h functions afterwards. LPUART1 runs from HSI16 and is
+ * not affected, USART2 is.
+ *
+ * On other families there is one profile, clock of board_clock_setup(),
+ * so the same benchmark gives the reference on Nucleo-F767ZI.
+ * */
+
+typedef struct
+{
+    power_profile_info_t info;
+#if defined(STM32L4)
+    bool range1;
+    bool pll;               // PLL from HSI16 / 4, otherwise HSI16 itself
+    uint32_t plln;
+    uint32_t pllr;          // RCC_PLLCFGR_PLLR_DIVx
+    uint32_t wait_states;
+    bool prefetch;
+#endif
+} profile_config_t;
+
+static const profile_config_t profiles[POWER_PROFILE_END] =
+{
+#if defined(STM32L4)
+    // 16 MHz / 4 * 40 = 160 MHz VCO, / 2
+    [POWER_PROFILE_RANGE1_80MHZ] =
+    {
+        {"range1_80mhz", 80000000, 10200, 2}, true, true, 40,
+        RCC_PLLCFGR_PLLR_DIV2, 4, true,
+    },
+    // 16 MHz / 4 * 26 = 104 MHz VCO, / 4
+    [POWER_PROFILE_RANGE2_26MHZ] =
+    {
+        {"range2_26mhz", 26000000, 2800, 2}, false, true, 26,
+        RCC_PLLCFGR_PLLR_DIV4, 2, false,
+    },
+    [POWER_PROFILE_RANGE2_16MHZ] =
+    {
+        {"range2_16mhz", 16000000, 1900, 2}, false, false, 0, 0, 1, false,
+    },
+#elif defined(STM32F7)
+    [POWER_PROFILE_BOARD] = {{"f767_216mhz", 216000000, 100000, 150}},
+#else
+    [POWER_PROFILE_BOARD] = {{"board", 0, 0, 0}},
+#endif
+};
+
+#if defined(STM32L4)
+/*!
+ * @brief   Sets voltage range of the core regulator and waits for it
+ */
+static void voltage_range_set(bool range1)
+{
+    rcc_periph_clock_enable(RCC_PWR);
+    pwr_set_vos_scale(range1 ? PWR_SCALE1 : PWR_SCALE2);
+    while (PWR_SR2 & PWR_SR2_VOSF);
+}
+
+/*!
+ * @brief   Configures regulator, clock and flash for the profile
+ *
+ * @note    Call with interrupts masked.
+ */
+static void clock_switch(const profile_config_t * config)
+{
+    rcc_osc_on(RCC_HSI16);
+    rcc_wait_for_osc_ready(RCC_HSI16);
+    // Wait states of the old profile are enough for 16 MHz
+    rcc_set_sysclk_source(RCC_CFGR_SW_HSI16);
+    rcc_wait_for_sysclk_status(RCC_HSI16);
+    rcc_osc_off(RCC_PLL);
+
+    // Every profile needs at least 1 wait state, that is also the one of
+    // HSI16, so they can be set before the range in both directions
+    flash_set_ws(config->wait_states);
+    voltage_range_set(config->range1);
+
+    if (config->pll)
+    {
+        rcc_set_main_pll(RCC_PLLCFGR_PLLSRC_HSI16, 4, config->plln,
+                         0, 0, config->pllr);
+        rcc_osc_on(RCC_PLL);
+        rcc_wait_for_osc_ready(RCC_PLL);
+        rcc_set_sysclk_source(RCC_CFGR_SW_PLL);
+        rcc_wait_for_sysclk_status(RCC_PLL);
+    }
+
+    if (config->prefetch)
+    {
+        flash_prefetch_enable();
+    }
+    else
+    {
+        flash_prefetch_disable();
+    }
+    flash_icache_enable();
+    flash_dcache_enable();
+
+    // AHB and APB are not divided
+    rcc_ahb_frequency = config->info.hz;
+    rcc_apb1_frequency = config->info.hz;
+    rcc_apb2_frequency = config->info.hz;
+}
+#endif
+
+/*!
+ * @brief               Switches core clock, regulator and flash to profile
+ *
+ * @param[in] profile
+ *
+ * @note                Blocks until character that UART is sending is out.
+ *                      SysTick and UART are set up again, millis() keeps
+ *                      counting.
+ */
+void power_profile_set(power_profile_t profile)
+{
+    if (profile >= POWER_PROFILE_END)
+    {
+        return;
+    }
+
+#if defined(STM32L4)
+    bool masked = cm_mask_interrupts(true);
+    while (!usart_get_flag(BOARD_UART, USART_ISR_TC));
+
+    clock_switch(&profiles[profile]);
+
+    // BRR can only be written while USART is disabled
+    usart_disable(BOARD_UART);
+    board_uart_setup();
+    board_systick_setup();
+    cm_mask_interrupts(masked);
+#endif
+}
+
+/*!
+ * @brief               Returns name, clock and current estimates of profile
+ *
+ * @param[in] profile
+ *
+ * @return              NULL for profile that does not exist
+ */
+const power_profile_info_t * power_profile_info(power_profile_t profile)
+{
+    if (profile >= POWER_PROFILE_END)
+    {
+        return NULL;
+    }
+    return &profiles[profile].info;
+}
+/*** end of file ***/
@@ -0,0 +1,53 @@
+#ifndef POWER_PROFILE_H
+#define POWER_PROFILE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Variables that are placed into SRAM2, look at memory_sections.ld. On
+// other families than STM32L4 they stay in .bss.
+#if defined(STM32L4)
+#define SRAM2_BSS __attribute__((section(".sram2_bss")))
+#else
+#define SRAM2_BSS
+#endif
+
+// Supply voltage of the current estimates, in mV
+#define POWER_SUPPLY_MV     3300
+
+typedef enum
+{
+#if defined(STM32L4)
+    POWER_PROFILE_RANGE1_80MHZ,     // PLL from HSI16, range 1, 4 WS
+    POWER_PROFILE_RANGE2_26MHZ,     // PLL from HSI16, range 2, 2 WS
+    POWER_PROFILE_RANGE2_16MHZ,     // HSI16 without PLL, range 2, 1 WS
+#else
+    POWER_PROFILE_BOARD,            // Clock of board_clock_setup()
+#endif
+    POWER_PROFILE_END,
+} power_profile_t;
+
+// Typical currents of the datasheet for a profile, at POWER_SUPPLY_MV and
+// 25 C, rounded. They are estimates, replace them with measured ones, IDD
+// jumper is JP6 on Nucleo-L476RG and JP5 on Nucleo-F767ZI.
+typedef struct
+{
+    const char * name;
+    uint32_t hz;            // Core clock
+    uint32_t run_ua;        // Run from flash with caches on
+    uint32_t sleep_ua;      // Between classifications, lowest Stop mode
+                            // that keeps SRAM
+} power_profile_info_t;
+
+void power_profile_set(power_profile_t profile);
+const power_profile_info_t * power_profile_info(power_profile_t profile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* POWER_PROFILE_H */
+/*** end of file ***/
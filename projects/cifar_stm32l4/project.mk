@@ -0,0 +1,53 @@
+######################################
+# Project settings
+######################################
+# Name of the MCU, use exact name, for example stm32f405vg, this is needed by libopencm3
+DEVICE = stm32l476rg
+
+# General settings
+OPT = -O3
+DEBUG = -g
+
+# Model, pictures and model settings are the ones of cifar_stm32f7, they
+# are built from there, only main.cpp and power profiles are our own
+CIFAR_DIR := ../cifar_stm32f7
+vpath %.cc $(CIFAR_DIR)
+vpath %.tflite $(CIFAR_DIR)
+
+# Source files are added here, wildcard function adds them automatically,
+# if you are going to create seperate folders you have to add them by yourself.
+# example: driver/motor.c -> $(wildcard driver/*.c)
+CFILES = $(wildcard *.c)
+CXXFILES = $(wildcard *.cpp)
+CCFILES = debug_log.cc model_settings.cc \
+$(patsubst $(CIFAR_DIR)/%,%,$(wildcard $(CIFAR_DIR)/pictures/*.cc))
+AFILES = $(wildcard *.s)
+
+# Model is linked from the flatbuffer itself as cifar_tflite array, see
+# BLOBS in rules.mk
+BLOBS := cifar.tflite
+
+# It is needed to add archived microlite library
+LIBDEPS := microlite_build/microlite.a
+
+# Model from which model_ops.h with needed operators is generated
+MODEL_SRC := $(CIFAR_DIR)/cifar.tflite
+
+# Reports go over LPUART1 on PC1 instead of USART2 of ST-LINK, see board.h
+CPPFLAGS += -DBOARD_LPUART
+
+# Engine with its arena is placed into SRAM2, look at main.cpp. Same
+# project also builds for stm32f767zi with 'make matrix-stm32f767zi' as
+# the reference of the energy benchmark, there is no SRAM2 fragment there.
+ifneq ($(filter stm32l4%,$(DEVICE)),)
+LDFRAGMENTS := memory_sections.ld
+endif
+
+# Header only code shared between projects
+SHARED_DIR := ../../shared
+
+# Sources from shared folder that are compiled into the project
+SHARED_CFILES := printf.c
+
+# If you add new folders do not forget to update the INCLUDES!
+INCLUDES += $(patsubst %,-I%, . $(CIFAR_DIR) $(SHARED_DIR))
@@ -93,8 +93,9 @@ static void gpio_setup()
 
 uint32_t cycles_to_ms(uint32_t cycles)
 {
-    // 48 represents the clock frequency in MHz
-    return cycles * (1.0f/(48*1000.0f)) ;
+    // 48 represents the clock frequency in MHz. Integer division is one
+    // UDIV instruction on Cortex-M7, float needed a conversion both ways.
+    return cycles / (48 * 1000U);
 }
 
 int main() 
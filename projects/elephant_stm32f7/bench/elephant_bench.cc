@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "tensorflow/lite/micro/micro_error_reporter.h"
+#include "tensorflow/lite/micro/micro_interpreter.h"
+#include "tensorflow/lite/micro/micro_mutable_op_resolver.h"
+#include "tensorflow/lite/schema/schema_generated.h"
+#include "tensorflow/lite/version.h"
+
+#include "src/model/full_quant_model.h"
+#include "src/images/images.h"
+#include "host_bench.h"
+#include "model_ops.h"
+#include "conv_pool_fused.h"
+#include "fc_sparse.h"
+#include "mem_model.h"
+
+// Host benchmark of the elephant model over all bundled images, run it with
+// make host_bench, see shared/host_bench.h
+namespace {
+    constexpr int kTensorArenaSize = 200 * 1024;
+    uint8_t tensor_arena[kTensorArenaSize];
+}
+
+int main(int argc, char** argv)
+{
+    tflite::MicroErrorReporter micro_error_reporter;
+    tflite::ErrorReporter* error_reporter = &micro_error_reporter;
+    HostBenchConfig config = host_bench_parse_args(argc, argv);
+
+    const tflite::Model* model = tflite::GetModel(full_quant_tflite);
+    if (model->version() != TFLITE_SCHEMA_VERSION)
+    {
+        fprintf(stderr, "Model schema version %d is not supported\n",
+                model->version());
+        return 1;
+    }
+
+    // Same operators as firmware, list is generated from MODEL_SRC
+    static tflite::MicroMutableOpResolver<kModelOpsCount> resolver;
+    if (RegisterModelOps(resolver) != kTfLiteOk)
+    {
+        return 1;
+    }
+
+    // MaxPool2D layers are fused into Conv2D, see fuse_conv_pool.py,
+    // dense weights may be block sparse, see sparsify_weights.py
+    static FullyConnectedSparseResolver sparse_resolver(resolver);
+    static Conv2DPoolResolver pool_resolver(sparse_resolver);
+
+    // Outermost, so -m sees the kernels that really run
+    static MemModelResolver mem_resolver(pool_resolver);
+
+    static HostOpProfiler profiler;
+    static tflite::MicroInterpreter interpreter(model, mem_resolver,
+                                                tensor_arena,
+                                                kTensorArenaSize,
+                                                error_reporter, &profiler);
+    if (interpreter.AllocateTensors() != kTfLiteOk)
+    {
+        fprintf(stderr, "AllocateTensors() failed\n");
+        return 1;
+    }
+
+    const HostBenchImage images[] = {
+        {"image0", image0},
+        {"image1", image1},
+        {"image2", image2},
+        {"image3", image3},
+        {"image4", image4},
+    };
+
+    if (!host_bench_run("elephant", &interpreter, &profiler, images,
+                        sizeof(images) / sizeof(images[0]), config))
+    {
+        return 1;
+    }
+
+    // One more inference of the first image, after the JSON
+    if (config.mem_model)
+    {
+        TfLiteTensor* input = interpreter.input(0);
+        memcpy(input->data.raw, images[0].data, input->bytes);
+        mem_resolver.Begin(tensor_arena, kTensorArenaSize);
+        TfLiteStatus status = interpreter.Invoke();
+        mem_resolver.Report();
+        if (status != kTfLiteOk)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include <stdio.h>
+
+#include <memory>
+
+#include "tensorflow/lite/micro/micro_error_reporter.h"
+#include "tensorflow/lite/micro/micro_interpreter.h"
+#include "tensorflow/lite/micro/micro_mutable_op_resolver.h"
+#include "tensorflow/lite/schema/schema_generated.h"
+#include "tensorflow/lite/version.h"
+
+#include "src/model/full_quant_model.h"
+#include "host_eval.h"
+#include "model_ops.h"
+#include "conv_pool_fused.h"
+#include "fc_sparse.h"
+
+// Accuracy and throughput of the elephant model over a dataset, one
+// interpreter per core, run it with make host_eval, see shared/host_eval.h
+namespace {
+    constexpr int kTensorArenaSize = 200 * 1024;
+}
+
+int main(int argc, char** argv)
+{
+    HostEvalConfig config;
+    if (!host_eval_parse_args(argc, argv, &config))
+    {
+        return 1;
+    }
+
+    static tflite::MicroErrorReporter micro_error_reporter;
+    const tflite::Model* model = tflite::GetModel(full_quant_tflite);
+    if (model->version() != TFLITE_SCHEMA_VERSION)
+    {
+        fprintf(stderr, "Model schema version %d is not supported\n",
+                model->version());
+        return 1;
+    }
+
+    // Same operators as firmware, shared by all interpreters, resolvers
+    // are not changed after they are created
+    static tflite::MicroMutableOpResolver<kModelOpsCount> resolver;
+    if (RegisterModelOps(resolver) != kTfLiteOk)
+    {
+        return 1;
+    }
+    static FullyConnectedSparseResolver sparse_resolver(resolver);
+    static Conv2DPoolResolver pool_resolver(sparse_resolver);
+
+    auto factory = [&](uint8_t* arena, size_t arena_size)
+    {
+        return std::unique_ptr<tflite::MicroInterpreter>(
+            new tflite::MicroInterpreter(model, pool_resolver, arena,
+                                         arena_size, &micro_error_reporter));
+    };
+    return host_eval_run("elephant", factory, kTensorArenaSize, config) ? 0 : 1;
+}
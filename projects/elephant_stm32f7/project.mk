@@ -29,10 +29,27 @@ CCFILES  += $(wildcard src/model/*.cc)
 TEST_LDLIBS	:= testlite_build/testlite.a
 TESTFILES 	:= $(wildcard test/*.cc)
 
+# Host benchmark, invoked with make host_bench, see shared/host_bench.h
+BENCHFILES	:= $(wildcard bench/*.cc) src/model/full_quant_model.cc \
+			   $(wildcard src/images/*.cc)
+
+# Host evaluation over a .npy dataset, invoked with make host_eval, see
+# shared/host_eval.h
+EVALFILES	:= $(wildcard eval/*.cc) src/model/full_quant_model.cc
+
 
 # It is needed to add archived microlite library
 LIBDEPS := microlite_build/microlite.a
 
+# Model from which model_ops.h with needed operators is generated
+MODEL_SRC := src/model/full_quant_model.cc
+
+
+# Header only code shared between projects
+SHARED_DIR := ../../shared
+
+# Sources from shared folder that are compiled into the project
+SHARED_CFILES := printf.c
 
 # If you add new folders do not forget to update the INCLUDES!
 INCLUDES += $(patsubst %,-I%, . $(SHARED_DIR))
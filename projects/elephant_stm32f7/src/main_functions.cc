@@ -1,12 +1,5 @@
 // Includes connected with Tensorflow 
-#include "tensorflow/lite/micro/all_ops_resolver.h"
-#include "tensorflow/lite/micro/testing/micro_test.h"
-#include "tensorflow/lite/micro/kernels/micro_ops.h"
 #include "tensorflow/lite/micro/micro_error_reporter.h"
-#include "tensorflow/lite/micro/micro_interpreter.h"
-#include "tensorflow/lite/micro/micro_mutable_op_resolver.h"
-#include "tensorflow/lite/schema/schema_generated.h"
-#include "tensorflow/lite/version.h"
 #include "tensorflow/lite/c/common.h"
 
 // Includes connected with micro
@@ -15,28 +8,59 @@
 #include "model/model_settings.h"
 #include "printf.h"
 #include "utility.h"
+#include "cycle_profiler.h"
+#include "inference_engine.h"
+#include "model_ops.h"
+#include "conv_pool_fused.h"
+#include "conv_specialised.h"
+#include "conv_winograd.h"
+#include "fc_sparse.h"
+#include "lut_activations.h"
+#include "output_scores.h"
+#include "target_bench.h"
 #include "main_functions.h"
 
+// Exact size measured with ARENA_REPORT=1 build, see shared/arena_report.h
+#if !defined(ARENA_REPORT) && __has_include("arena_size.h")
+#include "arena_size.h"
+#endif
+
 // Globals, used for compatibility with Arduino-style sketches.
 namespace {
     tflite::ErrorReporter* error_reporter = nullptr;
-    const tflite::Model* model = nullptr;
-    tflite::MicroInterpreter* interpreter = nullptr;
     TfLiteTensor* input = nullptr;
     TfLiteTensor* output = nullptr;
+    CycleProfiler* profiler = nullptr;
 
     // An area of memory to use for input, output, and intermediate arrays.
-    const int kTensorArenaSize = 46400;
-
-    alignas(16) uint8_t tensor_arena[kTensorArenaSize];
+#ifdef ARENA_SIZE_BYTES
+    const int kTensorArenaSize = ARENA_SIZE_BYTES;
+#else
+    const int kTensorArenaSize = 24000;
+#endif
+
+    // Only kernels of the model are linked in, list is generated
+    InferenceEngine<kTensorArenaSize, MODEL_ENGINE_OPS> engine;
+
+    // Test images, loop() and benchmark go over all of them. Classes of
+    // the bundled images are not recorded, put index of kCategoryLabels
+    // into label to have them counted in accuracy.
+    const TargetBenchImage images[] = {
+        {"Image 0", image0, kTargetBenchNoLabel},
+        {"Image 1", image1, kTargetBenchNoLabel},
+        {"Image 2", image2, kTargetBenchNoLabel},
+        {"Image 3", image3, kTargetBenchNoLabel},
+        {"Image 4", image4, kTargetBenchNoLabel},
+    };
+    const int kImageCount = sizeof(images) / sizeof(images[0]);
+    // Invokes of each image, first one is reported on its own
+    const int kBenchRuns = 5;
 }
 
+// Images in flash are used in place, nothing is copied per run
 void load_data(const signed char * data, TfLiteTensor * input)
 {
-    for (int i = 0; i < input->bytes; ++i)
-    {
-        input->data.int8[i] = data[i];
-    }
+    engine.LoadInput(data, input->bytes);
 }
 
 void print_result(tflite::ErrorReporter* error_reporter, 
@@ -44,11 +68,14 @@ void print_result(tflite::ErrorReporter* error_reporter,
                   TfLiteTensor * output, 
                   uint32_t duration)
 {
+    // Works for int8 output of stripped model and float one
+    OutputScores scores;
+    char line[64];
+
+    scores.Bind(output);
+    scores.Format(line, sizeof(line), kCategoryCount);
     printf("\n%s\n", title);
-    printf("[[%f %f %f %f]]\n", output->data.f[0],
-                                output->data.f[1],
-                                output->data.f[2],
-                                output->data.f[3]);
+    printf("[[%s]]\n", line);
     printf("Inference time: %d ms\n", duration);
 }
 
@@ -61,100 +88,60 @@ void setup()
     static tflite::MicroErrorReporter micro_error_reporter;
     error_reporter = &micro_error_reporter;
 
-    // Map the model into a usable data structure. This doesn't involve any
-    // copying or parsing, it's a very lightweight operation.
-    model = tflite::GetModel(full_quant_tflite);
-    if (model->version() != TFLITE_SCHEMA_VERSION) 
+    // Measures cycles of each operator
+    static CycleProfiler cycle_profiler(error_reporter);
+    profiler = &cycle_profiler;
+
+    // MaxPool2D layers are fused into Conv2D, see fuse_conv_pool.py, the
+    // first layer is convolved with kernel specialised for frame size.
+    // 3x3 layers from winograd_weights.py run in Winograd domain. Dense
+    // layer skips zero blocks of weights from sparsify_weights.py,
+    // Softmax is a table lookup.
+    static LutActivationResolver lut_resolver(engine.resolver());
+    static FullyConnectedSparseResolver sparse_resolver(lut_resolver);
+    static Conv2DPoolResolver pool_resolver(sparse_resolver);
+    static Conv2DWinogradResolver winograd_resolver(pool_resolver);
+    static Conv2DSpecialisedResolver<kNumRows, kNumCols, 3, 4> 
+        conv_resolver(winograd_resolver);
+    engine.SetResolver(&conv_resolver);
+
+    if (!engine.Setup(full_quant_tflite, error_reporter, profiler))
     {
-        TF_LITE_REPORT_ERROR(error_reporter, 
-            "Model provided is schema version %d not equal to supported version %d.",
-            model->version(), TFLITE_SCHEMA_VERSION);
+        return;
     }
+    engine.PrintInfo();
 
-    static tflite::MicroMutableOpResolver<8> micro_op_resolver;
-    micro_op_resolver.AddConv2D();
-    micro_op_resolver.AddMaxPool2D();
-    micro_op_resolver.AddReshape();
-    micro_op_resolver.AddFullyConnected();
-    micro_op_resolver.AddSoftmax();
-    micro_op_resolver.AddDequantize();
-    micro_op_resolver.AddMul();
-    micro_op_resolver.AddAdd();
-
-    // Build an interpreter to run the model with.
-    static tflite::MicroInterpreter static_interpreter(model, 
-                                                       micro_op_resolver, 
-                                                       tensor_arena,
-                                                       kTensorArenaSize, 
-                                                       error_reporter);
-
-    interpreter = &static_interpreter;
-
-    // Allocate memory from the tensor_arena for the model's tensors.
-    TfLiteStatus allocate_status = interpreter->AllocateTensors();
-    if (allocate_status != kTfLiteOk) 
+    input = engine.input();
+    output = engine.output();
+
+#ifdef TARGET_BENCH
+    // Benchmark firmware, built with make bench, loop() is never reached
+    TargetBenchConfig config = {20, 2, TARGET_BENCH_SWEEP};
+    target_bench_run("elephant", engine.interpreter(), profiler, images,
+                     kImageCount, config, error_reporter);
+    while(1)
     {
-        TF_LITE_REPORT_ERROR(error_reporter, "AllocateTensors() failed");
     }
-    printf("Size of the used memory in bytes: %d\n", interpreter->arena_used_bytes());
-    // Get information about the memory area to use for the model's input.
-    input = interpreter->input(0);
-
-    TF_LITE_REPORT_ERROR(error_reporter, "Input:\n");
-    TF_LITE_REPORT_ERROR(error_reporter, "Dimension:        %d", input->dims->size);
-    TF_LITE_REPORT_ERROR(error_reporter, "First Dimension:  %d", input->dims->data[0]);
-    TF_LITE_REPORT_ERROR(error_reporter, "Rows:             %d", input->dims->data[1]);
-    TF_LITE_REPORT_ERROR(error_reporter, "Columns:          %d", input->dims->data[2]);
-    TF_LITE_REPORT_ERROR(error_reporter, "Channels:         %d", input->dims->data[3]);
-    TF_LITE_REPORT_ERROR(error_reporter, "Input type:       %d", input->type);
-
-    // Get the output from the model, and make sure it's the expected size and
-    // type.
-    output = interpreter->output(0);
-
-    TF_LITE_REPORT_ERROR(error_reporter, "\nOutput:");
-    TF_LITE_REPORT_ERROR(error_reporter, "Dimension size:   %d", output->dims->size);
-    TF_LITE_REPORT_ERROR(error_reporter, "First Dimension:  %d", output->dims->data[0]);
-    TF_LITE_REPORT_ERROR(error_reporter, "Rows:             %d", output->dims->data[1]);
-    TF_LITE_REPORT_ERROR(error_reporter, "Output type:      %d", output->type);
+#endif
 }
 
 void loop()
 {
-    load_data(image0, input);
-    uint32_t start = millis();
-    interpreter->Invoke();
-    uint32_t end = millis();
-    //output = interpreter->output(0);
-    print_result(error_reporter, "Image 1", interpreter->output(0), end-start);
-
-    load_data(image1, input);
-    start = millis();
-    interpreter->Invoke();
-    end = millis();
-    //output = interpreter->output(0);
-    print_result(error_reporter, "Image 2", interpreter->output(0), end-start);
-
-    load_data(image2, input);
-    start = millis();
-    interpreter->Invoke();
-    end = millis();
-    //output = interpreter->output(0);
-    print_result(error_reporter, "Image 2", interpreter->output(0), end-start);
-
-    load_data(image3, input);
-    start = millis();
-    interpreter->Invoke();
-    end = millis();
-    //output = interpreter->output(0);
-    print_result(error_reporter, "Image 2", interpreter->output(0), end-start);
-
-    load_data(image4, input);
-    start = millis();
-    interpreter->Invoke();
-    end = millis();
-    //output = interpreter->output(0);
-    print_result(error_reporter, "Image 2", interpreter->output(0), end-start);
+    // Result of every image, then latency of every image
+    for (int i = 0; i < kImageCount; i++)
+    {
+        load_data(images[i].data, input);
+        uint32_t start = millis();
+        engine.Invoke();
+        uint32_t end = millis();
+        print_result(error_reporter, images[i].name, output, end-start);
+    }
+    printf("\n");
+    target_bench_images(&engine, images, kImageCount, kBenchRuns,
+                        error_reporter);
+
+    // Average over all runs
+    profiler->PrintTable();
 
     while(1);
 }
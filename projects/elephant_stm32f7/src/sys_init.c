@@ -43,6 +43,7 @@ void clock_setup()
 
     g_clock_mhz = 216;     // Has to be the same as our clock in Mhz
 
+#ifdef CLOCK_MCO_OUTPUT
     // Turn on MCO1 and MCO2 pins which show you internal frequencies
     // Both will have prescaler division of 4
 
@@ -57,6 +58,7 @@ void clock_setup()
     gpio_mode_setup(GPIOC, GPIO_MODE_AF, GPIO_PUPD_NONE, GPIO9);
 	gpio_set_af(GPIOC, GPIO_AF0, GPIO9);
     RCC_CFGR |= (RCC_CFGR_MCOPRE_DIV_4 << RCC_CFGR_MCO2PRE_SHIFT);
+#endif
 }
 
 void i2c_setup(void)
@@ -9,6 +9,10 @@ extern "C" {
 
 extern volatile uint8_t g_clock_mhz; //defined in sys_init.c
 
+// Drives HSI / 4 on PA8 (MCO1) and SYSCLK / 4 on PC9 (MCO2) for a scope,
+// both pins toggle all the time and cost power, leave it off otherwise
+//#define CLOCK_MCO_OUTPUT
+
 void clock_setup();
 void i2c_setup();
 void spi_setup();
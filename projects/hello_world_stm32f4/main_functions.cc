@@ -18,12 +18,29 @@ limitations under the License.
 #include "constants.h"
 #include "output_handler.h"
 #include "sine_model_data.h"
-#include "tensorflow/lite/micro/all_ops_resolver.h"
+#include "tensorflow/lite/micro/micro_mutable_op_resolver.h"
 #include "tensorflow/lite/micro/micro_error_reporter.h"
 #include "tensorflow/lite/micro/micro_interpreter.h"
 #include "tensorflow/lite/schema/schema_generated.h"
 #include "tensorflow/lite/version.h"
 #include "printf.h"
+#include "cycle_profiler.h"
+#include "target_bench.h"
+#include "model_ops.h"
+#include "arena_report.h"
+
+// Exact size measured with ARENA_REPORT=1 build, see shared/arena_report.h
+#if !defined(ARENA_REPORT) && __has_include("arena_size.h")
+#include "arena_size.h"
+#endif
+
+// Arena is in CCM RAM of STM32F4 with CCM=1 of project.mk, core reaches
+// it with zero wait states and nothing else uses the bus
+#ifdef CCM_PLACEMENT
+#define CCM_BSS __attribute__((section(".ccm_bss")))
+#else
+#define CCM_BSS
+#endif
 
 // Globals, used for compatibility with Arduino-style sketches.
 namespace {
@@ -33,11 +50,16 @@ tflite::MicroInterpreter* interpreter = nullptr;
 TfLiteTensor* input = nullptr;
 TfLiteTensor* output = nullptr;
 int inference_count = 0;
+CycleProfiler* profiler = nullptr;
 
 // Create an area of memory to use for input, output, and intermediate arrays.
 // Finding the minimum value for your model may require some trial and error.
+#ifdef ARENA_SIZE_BYTES
+constexpr int kTensorArenaSize = ARENA_SIZE_BYTES;
+#else
 constexpr int kTensorArenaSize = 2 * 1024;
-uint8_t tensor_arena[kTensorArenaSize];
+#endif
+uint8_t tensor_arena[kTensorArenaSize] CCM_BSS;
 }  // namespace
 
 // The name of this function is important for Arduino compatibility.
@@ -59,13 +81,25 @@ void setup() {
     return;
   }
 
-  // This pulls in all the operation implementations we need.
+  // This pulls in only the operation implementations model needs, list is
+  // generated from the model at build time.
   // NOLINTNEXTLINE(runtime-global-variables)
-  static tflite::AllOpsResolver resolver;
+  static tflite::MicroMutableOpResolver<kModelOpsCount> resolver;
+  if (RegisterModelOps(resolver) != kTfLiteOk) {
+    error_reporter->Report("Registering operators failed");
+    return;
+  }
+
+  // Measures cycles of each operator, table is printed after each cycle
+  static CycleProfiler cycle_profiler(error_reporter);
+  profiler = &cycle_profiler;
+
+  tflite::MicroAllocator* allocator =
+      arena_allocator(tensor_arena, kTensorArenaSize, error_reporter);
 
   // Build an interpreter to run the model with.
   static tflite::MicroInterpreter static_interpreter(
-      model, resolver, tensor_arena, kTensorArenaSize, error_reporter);
+      model, resolver, allocator, error_reporter, profiler);
   interpreter = &static_interpreter;
 
   // Allocate memory from the tensor_arena for the model's tensors.
@@ -74,6 +108,7 @@ void setup() {
     error_reporter->Report("AllocateTensors() failed");
     return;
   }
+  arena_report(error_reporter, model, allocator);
 
   // Obtain pointers to the model's input and output tensors.
   input = interpreter->input(0);
@@ -81,6 +116,28 @@ void setup() {
 
   // Keep track of how many inferences we have performed.
   inference_count = 0;
+
+#ifdef TARGET_BENCH
+  // Benchmark firmware, built with make bench, loop() is never reached.
+  // Input is one float, the bench copies input->bytes of each "image".
+  static const float bench_x[] = {0.0f, kXrange / 4, kXrange / 2,
+                                  kXrange * 3 / 4};
+  const TargetBenchImage images[] = {
+      {"x0", reinterpret_cast<const signed char*>(&bench_x[0]),
+       kTargetBenchNoLabel},
+      {"x1", reinterpret_cast<const signed char*>(&bench_x[1]),
+       kTargetBenchNoLabel},
+      {"x2", reinterpret_cast<const signed char*>(&bench_x[2]),
+       kTargetBenchNoLabel},
+      {"x3", reinterpret_cast<const signed char*>(&bench_x[3]),
+       kTargetBenchNoLabel},
+  };
+  TargetBenchConfig config = {20, 2, TARGET_BENCH_SWEEP};
+  target_bench_run("hello_world", interpreter, profiler, images, 4, config,
+                   error_reporter);
+  while (1) {
+  }
+#endif
 }
 
 // The name of this function is important for Arduino compatibility.
@@ -115,5 +172,9 @@ void loop() {
   // Increment the inference_counter, and reset it if we have reached
   // the total number per cycle
   inference_count += 1;
-  if (inference_count >= kInferencesPerCycle) inference_count = 0;
+  if (inference_count >= kInferencesPerCycle) {
+    inference_count = 0;
+    profiler->PrintTable();
+    profiler->Reset();
+  }
 }
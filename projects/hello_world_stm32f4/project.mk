@@ -19,5 +19,26 @@ AFILES = $(wildcard *.s)
 # It is needed to add archived microlite library
 LIBDEPS := microlite_build/microlite.a
 
+# Model from which model_ops.h with needed operators is generated
+MODEL_SRC := sine_model_data.cc
+
+# Tensor arena and stack are placed into 64 KB CCM RAM, see
+# memory_sections.ld. 'make CCM=0' keeps them in SRAM, to compare the
+# two, do 'make clean' when switching. Other families of 'make matrix'
+# have no CCM RAM.
+CCM ?= 1
+ifeq ($(CCM),1)
+ifneq ($(filter stm32f4%,$(DEVICE)),)
+LDFRAGMENTS := memory_sections.ld
+CPPFLAGS += -DCCM_PLACEMENT
+endif
+endif
+
+# Header only code shared between projects
+SHARED_DIR := ../../shared
+
+# Sources from shared folder that are compiled into the project
+SHARED_CFILES := printf.c
+
 # If you add new folders do not forget to update the INCLUDES!
 INCLUDES += $(patsubst %,-I%, . $(SHARED_DIR))
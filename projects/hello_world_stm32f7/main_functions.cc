@@ -13,8 +13,10 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
+#include <math.h>
+
 #include "main_functions.h"
-#include "tensorflow/lite/micro/all_ops_resolver.h"
+#include "tensorflow/lite/micro/micro_mutable_op_resolver.h"
 #include "constants.h"
 #include "model.h"
 #include "output_handler.h"
@@ -22,6 +24,25 @@ limitations under the License.
 #include "tensorflow/lite/micro/micro_interpreter.h"
 #include "tensorflow/lite/schema/schema_generated.h"
 #include "tensorflow/lite/version.h"
+#include "cycle_profiler.h"
+#include "model_ops.h"
+#include "arena_report.h"
+#include "inference_engine.h"
+#include "target_bench.h"
+
+// Exact size measured with ARENA_REPORT=1 build, see shared/arena_report.h
+#if !defined(ARENA_REPORT) && __has_include("arena_size.h")
+#include "arena_size.h"
+#endif
+
+// Define to run BATCH_SIZE inferences over one period of the sine in each
+// loop() and report them once, instead of one inference and a UART line
+// per loop(). Model is three small FullyConnected layers, so cycles of
+// Invoke() that are not in operators are the overhead of the interpreter
+// and kernel dispatch. Inputs and expected outputs are computed in setup().
+// Batch is run again over FrozenGraph of shared/inference_engine.h, the
+// difference is what the frozen graph saves.
+//#define BATCH_SIZE 1000
 
 // Globals, used for compatibility with Arduino-style sketches.
 namespace {
@@ -31,6 +52,7 @@ tflite::MicroInterpreter* interpreter = nullptr;
 TfLiteTensor* input = nullptr;
 TfLiteTensor* output = nullptr;
 int inference_count = 0;
+CycleProfiler* profiler = nullptr;
 
 // Create an area of memory to use for input, output, and intermediate arrays.
 // Minimum arena size, at the time of writing. After allocating tensors
@@ -38,8 +60,18 @@ int inference_count = 0;
 const int kModelArenaSize = 2468;
 // Extra headroom for model + alignment + future interpreter changes.
 const int kExtraArenaSize = 560 + 16 + 100;
+#ifdef ARENA_SIZE_BYTES
+const int kTensorArenaSize = ARENA_SIZE_BYTES;
+#else
 const int kTensorArenaSize = kModelArenaSize + kExtraArenaSize;
+#endif
 uint8_t tensor_arena[kTensorArenaSize];
+
+#ifdef BATCH_SIZE
+float batch_x[BATCH_SIZE];
+float batch_y[BATCH_SIZE];
+FrozenGraph<8> frozen;
+#endif
 }  // namespace
 
 // The name of this function is important for Arduino compatibility.
@@ -63,13 +95,25 @@ void setup() {
     return;
   }
 
-  // This pulls in all the operation implementations we need.
+  // This pulls in only the operation implementations model needs, list is
+  // generated from the model at build time.
   // NOLINTNEXTLINE(runtime-global-variables)
-  static tflite::AllOpsResolver resolver;
+  static tflite::MicroMutableOpResolver<kModelOpsCount> resolver;
+  if (RegisterModelOps(resolver) != kTfLiteOk) {
+    TF_LITE_REPORT_ERROR(error_reporter, "Registering operators failed");
+    return;
+  }
+
+  // Measures cycles of each operator, table is printed after each cycle
+  static CycleProfiler cycle_profiler(error_reporter);
+  profiler = &cycle_profiler;
+
+  tflite::MicroAllocator* allocator =
+      arena_allocator(tensor_arena, kTensorArenaSize, error_reporter);
 
   // Build an interpreter to run the model with.
   static tflite::MicroInterpreter static_interpreter(
-      model, resolver, tensor_arena, kTensorArenaSize, error_reporter);
+      model, resolver, allocator, error_reporter, profiler);
   interpreter = &static_interpreter;
 
   // Allocate memory from the tensor_arena for the model's tensors.
@@ -78,6 +122,7 @@ void setup() {
     TF_LITE_REPORT_ERROR(error_reporter, "AllocateTensors() failed");
     return;
   }
+  arena_report(error_reporter, model, allocator);
 
   // Obtain pointers to the model's input and output tensors.
   input = interpreter->input(0);
@@ -85,8 +130,95 @@ void setup() {
 
   // Keep track of how many inferences we have performed.
   inference_count = 0;
+
+#ifdef BATCH_SIZE
+  for (int i = 0; i < BATCH_SIZE; i++) {
+    batch_x[i] = static_cast<float>(i) * kXrange /
+                 static_cast<float>(BATCH_SIZE);
+    batch_y[i] = sinf(batch_x[i]);
+  }
+  if (!frozen.Build(interpreter)) {
+    TF_LITE_REPORT_ERROR(error_reporter, "Graph can not be frozen");
+  }
+#endif
+#ifdef TARGET_BENCH
+  // Benchmark firmware, built with make bench, loop() is never reached.
+  // Input is one float, the bench copies input->bytes of each "image".
+  static const float bench_x[] = {0.0f, kXrange / 4, kXrange / 2,
+                                  kXrange * 3 / 4};
+  const TargetBenchImage images[] = {
+      {"x0", reinterpret_cast<const signed char*>(&bench_x[0]),
+       kTargetBenchNoLabel},
+      {"x1", reinterpret_cast<const signed char*>(&bench_x[1]),
+       kTargetBenchNoLabel},
+      {"x2", reinterpret_cast<const signed char*>(&bench_x[2]),
+       kTargetBenchNoLabel},
+      {"x3", reinterpret_cast<const signed char*>(&bench_x[3]),
+       kTargetBenchNoLabel},
+  };
+  TargetBenchConfig config = {20, 2, TARGET_BENCH_SWEEP};
+  target_bench_run("hello_world", interpreter, profiler, images, 4, config,
+                   error_reporter);
+  while (1) {
+  }
+#endif
+}
+
+#ifdef BATCH_SIZE
+// Runs the whole batch, returns cycles per inference and the worst error
+// against sinf(), or false if an inference failed
+static bool RunBatch(bool frozen_graph, uint32_t* cycles, float* max_error) {
+  *max_error = 0.0f;
+
+  uint32_t start = DWT_CYCCNT;
+  for (int i = 0; i < BATCH_SIZE; i++) {
+    input->data.f[0] = batch_x[i];
+    TfLiteStatus status =
+        frozen_graph ? frozen.Invoke() : interpreter->Invoke();
+    if (status != kTfLiteOk) {
+      TF_LITE_REPORT_ERROR(error_reporter, "Invoke failed on x_val: %f\n",
+                           static_cast<double>(batch_x[i]));
+      return false;
+    }
+    float error = fabsf(output->data.f[0] - batch_y[i]);
+    if (error > *max_error) {
+      *max_error = error;
+    }
+  }
+  *cycles = (DWT_CYCCNT - start) / BATCH_SIZE;
+  return true;
 }
 
+// Prints cycles per inference, how many of them were spent outside of
+// operators, then the same for the frozen graph
+void loop() {
+  uint32_t cycles;
+  float max_error;
+  if (!RunBatch(false, &cycles, &max_error)) {
+    return;
+  }
+
+  // Loop, copy of the input and the error are a few tens of cycles, hooks
+  // of the profiler around each operator count as overhead as well
+  uint32_t op_cycles = profiler->TotalCycles();
+  TF_LITE_REPORT_ERROR(error_reporter,
+                       "Batch of %d: %u cycles per inference, %u in "
+                       "operators, %u overhead, max error %f",
+                       BATCH_SIZE, cycles, op_cycles,
+                       cycles > op_cycles ? cycles - op_cycles : 0,
+                       static_cast<double>(max_error));
+  profiler->PrintTable();
+  profiler->Reset();
+
+  if (frozen.built() && RunBatch(true, &cycles, &max_error)) {
+    TF_LITE_REPORT_ERROR(error_reporter,
+                         "Frozen graph: %u cycles per inference, "
+                         "max error %f",
+                         cycles, static_cast<double>(max_error));
+  }
+}
+#else
+
 // The name of this function is important for Arduino compatibility.
 void loop() {
   // Calculate an x value to feed into the model. We compare the current
@@ -118,5 +250,10 @@ void loop() {
   // Increment the inference_counter, and reset it if we have reached
   // the total number per cycle
   inference_count += 1;
-  if (inference_count >= kInferencesPerCycle) inference_count = 0;
+  if (inference_count >= kInferencesPerCycle) {
+    inference_count = 0;
+    profiler->PrintTable();
+    profiler->Reset();
+  }
 }
+#endif
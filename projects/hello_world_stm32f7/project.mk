@@ -26,5 +26,14 @@ AFILES = $(wildcard *.s)
 # It is needed to add archived microlite library
 LIBDEPS := microlite_build/microlite.a
 
+# Model from which model_ops.h with needed operators is generated
+MODEL_SRC := model.cc
+
+# Header only code shared between projects
+SHARED_DIR := ../../shared
+
+# Sources from shared folder that are compiled into the project
+SHARED_CFILES := printf.c
+
 # If you add new folders do not forget to update the INCLUDES!
 INCLUDES += $(patsubst %,-I%, . $(SHARED_DIR))
@@ -8,6 +8,15 @@ DEVICE = stm32f767zi
 OPT = -Og
 DEBUG = -g
 
+# Sources in HOT_FILES and LIB_HOT_SRC of archive_makefile are built with
+# -O3 -funroll-loops, all others with -Os instead of OPT, see rules.mk.
+# Comment out to debug everything with OPT.
+OPT_POLICY := 1
+# Capture path and conversion of images to the input tensor
+HOT_FILES := src/flir/flir.c
+HOT_FILES += src/system_setup/spi_bus.c
+HOT_FILES += src/inference/inference.cc
+
 # Source files are added here, wildcard function adds them automaticaly,
 # if you are going to create seperate folders you have to add them by yourself.
 # example: driver/motor.c -> $(wildcard driver/*.c)
@@ -20,11 +29,60 @@ CXXFILES := $(wildcard src/*.cpp)
 
 CCFILES  := $(wildcard src/*.cc)
 CCFILES  += $(wildcard src/test_images/*.cc)
+# With TEST_DATASET in inference/inference.h test images come from a
+# container of make_dataset.py instead, images.cc is not needed then:
+# make_dataset.py src/test_images/test_images.mlds src/test_images/images.cc
+#CCFILES := $(filter-out src/test_images/%,$(CCFILES))
+#BLOBS    := src/test_images/test_images.mlds
+# With BENCH_ASSETS the container is flashed apart from firmware instead,
+# into the last 256 KB of bank 1 with make assets_flash, and images.cc is
+# left out the same way. Firmware has to end below ASSET_ADDRESS then.
+#ASSET_ADDRESS := 0x080C0000
+#ASSET_FILE := src/test_images/test_images.mlds
 CCFILES  += $(wildcard src/model/*.cc)
+# With QSPI_MODEL in system_setup/qspi_flash.h a model too large for
+# internal flash is linked into QSPI flash and run in place, weights of
+# each layer in execution order for sequential reads:
+# layout_weights.py big_model.tflite src/model/qspi_model.tflite
+#BLOBS    += src/model/qspi_model.tflite
+#BLOB_SECTION_qspi_model_tflite := .qspi_rodata
+#EXTERNAL_SECTIONS := .qspi_rodata
 CCFILES  += $(wildcard src/system_setup/*.cc)
 CCFILES  += $(wildcard src/inference/*.cc)
 
+# Code shared between projects
+SHARED_DIR := ../../shared
+
+# Sources from shared folder that are compiled into the project
+SHARED_CFILES := printf.c
+
 # If you add new folders do not forget to update the INCLUDES!
 INCLUDES += $(patsubst %,-I%, . src $(SHARED_DIR))
 
 LIBDEPS := microlite_build/microlite.a
+
+# FLIR and other logs are only queued where they happen and printed from
+# event_wait(), so they do not stretch capture, see shared/log.h
+LOG_DEFERRED := 1
+# Logs and error reports are sent as format id and arguments, a fraction of
+# the bytes and no formatting on target, read them with
+# 'log_decode.py firmware.elf log.bin'
+#LOG_BINARY := 1
+
+# Model from which model_ops.h with needed operators is generated
+MODEL_SRC := src/model/full_quant_model.cc
+# With CASCADE in inference.h gate model is needed too
+#MODEL_SRC += src/model/gate_model.cc
+# With KEYWORD_TRIGGER in inference/keyword.h keyword model is needed too
+#MODEL_SRC += src/model/keyword_model.cc
+# With QSPI_MODEL operators of the QSPI model are needed too
+#MODEL_SRC += src/model/qspi_model.tflite
+
+# Linker script fragments, they are added after linker script generated by
+# libopencm3 and place sections with INSERT command
+LDFRAGMENTS := memory_sections.ld
+
+# Hot kernels of microlite.a that run from 16 KB ITCM RAM, see rules.mk.
+# Check size of .itcm_text in firmware.map when adding more.
+ITCM_FUNCTIONS := arm_nn_mat_mult_kernel_s8_s16
+ITCM_FUNCTIONS += arm_convolve_s8
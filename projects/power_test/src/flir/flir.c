@@ -1,12 +1,205 @@
 #include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include "system_setup/utility.h"
-#include "system_setup/printf.h"
+#include "system_setup/sys_init.h"
+#include "printf.h"
+#include "system_setup/dma_buf.h"
+#include "system_setup/events.h"
+#include "system_setup/i2c_async.h"
+#include "system_setup/i2c_timing.h"
+#include "system_setup/crc_hw.h"
+#include "system_setup/trace.h"
+#include "system_setup/counters.h"
+#include "system_setup/cycle_budget.h"
+#include "system_setup/config_store.h"
+#include "frame_convert.h"
+#include "frame_flatfield.h"
 #include "flir.h"
 
+#define LOG_TAG "FLIR"
+#include "log.h"
+#include "system_setup/periph_clock.h"
+
 static uint8_t last_flir_error = LEP_OK;
 
+// Non-blocking CCI engine, steps are chained from I2C1 interrupt, look at 
+// flir_cci_submit()
+typedef enum
+{
+    CCI_IDLE,
+    CCI_WAIT_READY,
+    CCI_DATA_LENGTH,
+    CCI_DATA,
+    CCI_COMMAND,
+    CCI_WAIT_DONE,
+    CCI_READ_DATA,
+}cci_state_e;
+
+static volatile cci_state_e cci_state = CCI_IDLE;
+static flir_cci_cmd_t * volatile cci_head = NULL;
+static flir_cci_cmd_t * cci_tail = NULL;
+static uint64_t cci_deadline = 0;
+static i2c_xfer_t cci_xfer;
+static uint8_t cci_tx[2 + 2 * FLIR_CCI_MAX_WORDS];
+static uint8_t cci_rx[2 * FLIR_CCI_MAX_WORDS];
+static flir_cci_cmd_t ffc_cmd;
+
+// Shadow of camera settings, so gets and sets of a value that the camera 
+// already has need no CCI. Slot is valid from its last get or set until 
+// the setting may change without the shadow: failed command, FFC or 
+// camera boot. Queued commands update it when they finish, from interrupt.
+typedef enum
+{
+    SHADOW_AGC,
+    SHADOW_TELEMETRY,
+    SHADOW_TELEMETRY_LOCATION,
+    SHADOW_GPIO_MODE,
+    SHADOW_SHUTTER,
+    SHADOW_FFC_PERIOD,          // desiredFFCPeriod of FFC shutter mode
+    SHADOW_END,
+}shadow_slot_e;
+
+static const uint16_t shadow_ids[SHADOW_END] = {
+    [SHADOW_AGC] = LEP_CID_AGC_ENABLE_STATE,
+    [SHADOW_TELEMETRY] = LEP_CID_SYS_TELEMETRY_ENABLE_STATE,
+    [SHADOW_TELEMETRY_LOCATION] = LEP_CID_SYS_TELEMETRY_LOCATION,
+    [SHADOW_GPIO_MODE] = LEP_CID_OEM_GPIO_MODE_SELECT,
+    [SHADOW_SHUTTER] = LEP_CID_SYS_SHUTTER_POSITION,
+    [SHADOW_FFC_PERIOD] = LEP_CID_SYS_FFC_SHUTTER_MODE,
+};
+static volatile uint32_t shadow_values[SHADOW_END];
+static volatile uint32_t shadow_valid = 0;     // Bit of each known slot
+
+// Power state and boot, look at flir_wait_ready()
+static flir_power_e power_state = FLIR_POWER_DOWN;
+static uint64_t boot_start = 0;
+static bool boot_cold = false;          // Camera was held in power down
+static i2c_xfer_t boot_xfer;
+static uint8_t boot_rx[DMA_BUF_ALIGN] DMA_BUFFER;
+static volatile uint16_t boot_status = 0;
+static volatile bool boot_read_done = false;
+
+// DMA capture engine, state is shared with capture_packet_done(), which
+// runs in interrupt context
+static volatile state_e capture_state = DONE;
+static uint16_t (* volatile capture_frame)[FLIR_PACKET_WORDS] = NULL;
+// Packet of the frame, counted over segments, a row of Lepton 2.x
+static volatile uint8_t capture_row = 0;
+static volatile bool capture_id_error = false;
+static volatile bool capture_in_sync = false;
+static volatile uint64_t capture_resync_start = 0;
+static volatile uint16_t capture_discards = 0;
+static volatile uint8_t capture_soft_resyncs = 0;
+static volatile flir_capture_stats_t capture_stats;
+// Frames start on VSYNC interrupt, look at set_flir_vsync()
+static volatile bool capture_vsync = false;
+static volatile uint64_t capture_vsync_start = 0;
+
+// Telemetry row A is read after the last frame row, look at flir_setup()
+static bool capture_telemetry_enabled = false;
+static uint16_t * capture_telemetry = NULL;
+static volatile flir_telemetry_t telemetry;
+static volatile flir_timestamp_t capture_time;
+// Pixel statistics of the frame being read, rows are added in 
+// capture_packet_done() before they are converted, look at 
+// flir_get_frame_stats()
+static frame_stats_t pixel_stats;
+static uint32_t last_frame_counter = 0;
+static bool last_frame_counter_valid = false;
+
+
+// Used only when capturing straight into int8 image or 8 bit frame
+static int8_t * volatile capture_image = NULL;
+// Image rows converted so far, round is counted up whenever conversion 
+// starts over, look at flir_capture_image_rows()
+static volatile uint8_t capture_image_rows = 0;
+static volatile uint32_t capture_image_round = 0;
+static uint8_t (* volatile capture_frame8)[FLIR_IMAGE_COLS] = NULL;
+// Packet buffers and telemetry come from dma_buf_alloc() in flir_setup(),
+// each of them is padded to whole cache lines
+#define CAPTURE_SLOT_WORDS  (DMA_BUF_ROUND(FLIR_PACKET_WORDS * 2) / 2)
+static uint16_t (*capture_packets)[CAPTURE_SLOT_WORDS] = NULL;
+static volatile uint8_t capture_slot = 0;
+static frame_quant_t capture_quant = {FRAME_QUANT_ONE, 
+                                      -128 * FRAME_QUANT_ONE + FRAME_QUANT_ONE / 2};
+
+#ifdef FLIR_FLAT_FIELD
+// Flat field table of image captures, look at flir_flat_calibrate(). After 
+// it is started, phase is moved only by capture_packet_done() and by the 
+// callback of the shutter command, both in interrupt context.
+typedef enum
+{
+    FLAT_IDLE,
+    FLAT_CLOSING,           // Shutter command is queued
+    FLAT_SETTLE_CLOSED,
+    FLAT_LEARNING,
+    FLAT_OPENING,
+    FLAT_SETTLE_OPEN,
+}flat_phase_e;
+
+// Filled by frame_flat_init() before use
+static int16_t flat_bias[FLIR_FRAME_ROWS * FLIR_IMAGE_COLS] NOINIT_BSS;
+static uint16_t flat_gain[FLIR_FRAME_ROWS * FLIR_IMAGE_COLS] NOINIT_BSS;
+static frame_flat_t capture_flat;
+static volatile flat_phase_e flat_phase = FLAT_IDLE;
+static volatile uint8_t flat_frames = 0;
+static flir_cci_cmd_t flat_cmd;
+#endif
+
+// Continuous capture, frames are queued from capture_packet_done(). Only 
+// interrupt moves stream_head and only main context moves stream_tail, so 
+// the queue needs no locking. Both count up to twice the depth, so full 
+// queue differs from empty one. Frame at stream_tail is the one that 
+// consumer is using, it is given back by flir_stream_release().
+static uint8_t * stream_frames = NULL;
+static uint32_t stream_frame_size = 0;
+static flir_frame_format_e stream_format = FLIR_FRAME_RAW16;
+static uint8_t stream_depth = 0;
+static bool stream_usable_only = false;
+static volatile bool stream_on = false;
+static volatile uint8_t stream_head = 0;
+static volatile uint8_t stream_tail = 0;
+static uint8_t stream_skipped = 0;
+static flir_telemetry_t stream_telemetry[FLIR_STREAM_MAX_DEPTH];
+static flir_timestamp_t stream_times[FLIR_STREAM_MAX_DEPTH];
+static frame_stats_t stream_stats[FLIR_STREAM_MAX_DEPTH];
+
+static void capture_packet_done(bool status);
+static void capture_begin();
+static void capture_read_first();
+static void capture_resync();
+static uint16_t * capture_buffer();
+static void capture_convert_packet(const uint16_t * packet, uint8_t row);
+static void capture_image_restart();
+static void capture_pack_packet(const uint16_t * packet, uint8_t row);
+static void capture_measure_packet(const uint16_t * packet, uint8_t row);
+static void capture_soft_resync();
+static void capture_wait_first();
+static void capture_vsync_timeout();
+static void stream_select();
+static void stream_push();
+static uint8_t stream_next(uint8_t index);
+static bool telemetry_usable(const flir_telemetry_t * data);
+static uint8_t capture_rows();
+static void capture_parse_telemetry(const uint16_t * packet);
+#ifdef FLIR_FLAT_FIELD
+static void flat_frame_done();
+static void flat_shutter_done(flir_cci_cmd_t * cmd);
+#endif
+static bool packet_crc_ok(const uint16_t * packet);
+
+// Non-blocking CCI engine
+static void cci_start(flir_cci_cmd_t * cmd);
+static void cci_finish(bool status);
+static void cci_write_reg(uint16_t reg, const uint16_t * words, uint8_t num_words);
+static void cci_read_reg(uint16_t reg, uint8_t num_words);
+static void cci_xfer_done(i2c_xfer_t * xfer, bool status);
+
 // Low level commands
 static bool wait_busy_bit(uint16_t timeout);
 static bool get_flir_command(uint16_t cmd_code, 
@@ -18,6 +211,17 @@ static bool set_flir_command32(uint16_t cmd_code,
                                uint32_t data_long_word);
 static uint16_t command_code(uint16_t cmd_id, uint16_t cmd_type);
 
+// Shadow of camera settings
+static int8_t shadow_slot(uint16_t cmd_code);
+static bool shadow_known(shadow_slot_e slot, uint32_t * value);
+static void shadow_store(shadow_slot_e slot, uint32_t value);
+static void shadow_forget(uint32_t slots);
+static void shadow_reset(bool defaults);
+static void shadow_from_cmd(const flir_cci_cmd_t * cmd);
+static bool shadow_get32(shadow_slot_e slot, uint32_t * value);
+static bool shadow_set32(shadow_slot_e slot, uint32_t value);
+static bool camera_fresh();
+
 //I2C commands, i2c peripheral should be initialized before using flir.h
 static bool write_register(uint16_t reg_address, uint16_t value);
 static bool read_register(uint16_t reg_address, uint16_t * value);
@@ -35,384 +239,2443 @@ static const char * shutter_position_str(LEP_SYS_SHUTTER_POSITION position);
 
 
 /*!
- * @brief     Debug output wrapper
- *
- * @param[in] string  
- * @param[in] variable number of arguments  
+ * @brief           Display FLIR serial number
+ *
+ * @note            Function prints fail, if something went wrong
+ */
+void display_flir_serial()
+{
+    uint16_t serial_num[4] = {0,0,0,0};
+
+    if(get_flir_command(command_code(LEP_CID_SYS_FLIR_SERIAL_NUMBER, 
+                                     LEP_I2C_COMMAND_TYPE_GET), 
+                                     serial_num, 4))
+    {
+        LOG_INFO("SYS Flir Serial Number: %04X%04X%04X%04X\n", 
+                                              serial_num[3],
+                                              serial_num[2],
+                                              serial_num[1],
+                                              serial_num[0]);
+    }
+    else
+    {
+        LOG_ERROR("SYS Flir Serial Number: Fail\n");
+    }
+}
+
+/*!
+ * @brief                              Function gets current position of shutter
+ *
+ * @return LEP_SYS_SHUTTER_POSITION    enum defined in flir_defines.h file
+ *
+ * @note            Function prints fail, if something went wrong
+ */
+LEP_SYS_SHUTTER_POSITION get_flir_shutter_position()
+{
+    uint32_t position = 0;
+
+    if(shadow_get32(SHADOW_SHUTTER, &position))
+    {
+        
+        LOG_INFO("Shutter position: %s\n", 
+                shutter_position_str((LEP_SYS_SHUTTER_POSITION) position));
+    }
+    else
+    {
+        LOG_ERROR("Shutter position: function failed!\n");
+    }
+    
+    return (LEP_SYS_SHUTTER_POSITION) position;
+}
+
+/*!
+ * @brief               Function sets position of shutter
+ *
+ * @param[in] position  
+ */
+void set_flir_shutter_position(LEP_SYS_SHUTTER_POSITION position)
+{ 
+    if(!shadow_set32(SHADOW_SHUTTER, (uint32_t) position))
+    {
+        LOG_ERROR("Set shutter position : function failed!\n");
+    }
+}
+
+/*!
+ * @brief               Sets period of automatic FFC, other FFC and shutter 
+ *                      settings are kept
+ *
+ * @param[in] period_ms Lepton also runs FFC when its temperature drifts
+ *
+ * @return              False if command failed
+ */
+bool set_flir_ffc_period(uint32_t period_ms)
+{
+    LEP_SYS_FFC_SHUTTER_MODE mode;
+    uint16_t num_words = sizeof(mode) / 2;
+    uint32_t known;
+
+    if (shadow_known(SHADOW_FFC_PERIOD, &known) && known == period_ms)
+    {
+        counter_add(COUNTER_CCI_CACHED, 1);
+        return true;
+    }
+    shadow_forget(1U << SHADOW_FFC_PERIOD);
+    if (!get_flir_command(command_code(LEP_CID_SYS_FFC_SHUTTER_MODE, 
+                                       LEP_I2C_COMMAND_TYPE_GET), 
+                          (uint16_t *) &mode, num_words))
+    {
+        LOG_ERROR("FFC period: function failed!\n");
+        return false;
+    }
+
+    // Same sequence as set_flir_command32(), with the whole structure
+    mode.desiredFFCPeriod = period_ms;
+    if (!wait_busy_bit(FLIR_BUSY_TIMEOUT) || 
+        !write_command_register(command_code(LEP_CID_SYS_FFC_SHUTTER_MODE, 
+                                             LEP_I2C_COMMAND_TYPE_SET), 
+                                (uint16_t *) &mode, num_words) || 
+        !wait_busy_bit(FLIR_BUSY_TIMEOUT))
+    {
+        LOG_ERROR("FFC period: function failed!\n");
+        return false;
+    }
+    shadow_store(SHADOW_FFC_PERIOD, period_ms);
+    LOG_INFO("FFC period: %lu ms\n", period_ms);
+    return true;
+}
+
+/*!
+ * @brief               Enable or disable AGC processing
+ *
+ * @param[in] position  If true AGC will be enabled
+ *
+ * @note                Function prints fail, if something went wrong
+ */
+void set_flir_agc(bool enable)
+{
+    if(!shadow_set32(SHADOW_AGC, (uint32_t) enable))
+    {
+        LOG_ERROR("AGC mode: function failed!\n");
+    }
+}
+
+/*!
+ * @brief   Get current state of AGC mode
+ *
+ * @return  True if AGC mode is enabled, otherwise false
+ *
+ * @note    Function prints fail, if something went wrong
+ */
+bool get_flir_agc()
+{
+    uint32_t agc_state = 0;
+    if(shadow_get32(SHADOW_AGC, &agc_state))
+    {
+        LOG_INFO("AGC mode: %s\n", agc_state ? "On" : "Off"); 
+    }
+    else
+    {
+        LOG_ERROR("AGC mode: function failed!\n");
+    }
+    return (bool) agc_state;
+}
+
+
+/*!
+ * @brief               Enable or disable AGC processing
+ *
+ * @param[in] position  If true AGC will be enabled
+ *
+ * @note                Function prints fail, if something went wrong
+ */
+void set_flir_telemetry(bool enable)
+{
+    if(!shadow_set32(SHADOW_TELEMETRY, (uint32_t) enable))
+    {
+        LOG_ERROR("Set Telemetry : function failed!\n");
+        return;
+    }
+    capture_telemetry_enabled = enable;
+}
+
+/*!
+ * @brief               Sets where telemetry rows are sent in the frame
+ *
+ * @param[in] location  Capture engine expects LEP_TELEMETRY_LOCATION_FOOTER
+ *
+ * @note                Function prints fail, if something went wrong
+ */
+void set_flir_telemetry_location(LEP_SYS_TELEMETRY_LOCATION location)
+{
+    if(!shadow_set32(SHADOW_TELEMETRY_LOCATION, (uint32_t) location))
+    {
+        LOG_ERROR("Set Telemetry location: function failed!\n");
+        capture_telemetry_enabled = false;
+    }
+}
+
+/*!
+ * @brief               Switches Lepton GPIO3 to VSYNC output, captures then 
+ *                      start reading on its pulse
+ *
+ * @param[in] enable    If false GPIO3 is plain GPIO again and frames are 
+ *                      found by reading discard packets
+ *
+ * @return              False if command failed, capture does not use VSYNC
+ *
+ * @note                Pulse comes when a new frame is ready, it is an 
+ *                      EXTI interrupt on FLIR_VSYNC_PIN. SPI sits idle 
+ *                      between frames, instead of clocking hundreds of 
+ *                      discard packets. If pulses stop, capture goes back 
+ *                      to reading discard packets after FLIR_VSYNC_TIMEOUT. 
+ *                      Call it while no capture is running.
+ */
+bool set_flir_vsync(bool enable)
+{
+    capture_vsync = false;
+    exti_disable_request(FLIR_VSYNC_EXTI);
+
+    LEP_OEM_GPIO_MODE mode = enable ? LEP_OEM_GPIO_MODE_VSYNC : 
+                                      LEP_OEM_GPIO_MODE_GPIO;
+    if (!shadow_set32(SHADOW_GPIO_MODE, (uint32_t) mode))
+    {
+        LOG_ERROR("VSYNC mode: function failed!\n");
+        return false;
+    }
+    if (!enable)
+    {
+        return true;
+    }
+
+    rcc_periph_clock_enable(FLIR_VSYNC_PORT_RCC);
+    gpio_mode_setup(FLIR_VSYNC_PORT, GPIO_MODE_INPUT, GPIO_PUPD_PULLDOWN, 
+                    FLIR_VSYNC_PIN);
+
+    periph_clock_acquire(RCC_SYSCFG);
+    exti_select_source(FLIR_VSYNC_EXTI, FLIR_VSYNC_PORT);
+    exti_set_trigger(FLIR_VSYNC_EXTI, EXTI_TRIGGER_RISING);
+    exti_reset_request(FLIR_VSYNC_EXTI);
+    exti_enable_request(FLIR_VSYNC_EXTI);
+    nvic_enable_irq(FLIR_VSYNC_IRQ);
+
+    capture_vsync = true;
+    LOG_INFO("VSYNC on GPIO3\n");
+    return true;
+}
+
+/*!
+ * @brief   Get current state of AGC mode
+ *
+ * @return  True if AGC mode is enabled, otherwise false
+ *
+ * @note    Function prints fail, if something went wrong
+ */
+bool get_flir_telemetry()
+{
+    uint32_t telemetry_state = 0;
+    if(shadow_get32(SHADOW_TELEMETRY, &telemetry_state))
+    {
+        LOG_INFO("Telemetry: %s\n", telemetry_state ? "On" : "Off"); 
+    }
+    else
+    {
+        LOG_ERROR("Telemetry: function failed!\n");
+    }
+    return (bool) telemetry_state ;
+}
+
+// Frame commands
+
+/*!
+ * @brief           Blocking function, gets one full frame from FLIR
+ *
+ * @param[in] frame Copy by reference, frame will be copied into it
+ *
+ * @return          True when frame was received
+ *
+ * @note            Frame is received by DMA, look at flir_capture_start(). 
+ *                  Frame should be a DMA_BUFFER, look at dma_buf.h.
+ */
+bool get_flir_image(uint16_t frame[FLIR_FRAME_PACKETS][FLIR_PACKET_WORDS])
+{
+    TRACE(TRACE_CAPTURE_BEGIN, 0);
+    flir_capture_start(frame);
+
+    flir_capture_wait();
+    TRACE(TRACE_CAPTURE_END, 1);
+
+    LOG_DEBUG("DONE!\n");
+    return true;
+}
+
+/*!
+ * @brief           Starts non-blocking capture of one frame 
+ *
+ * @param[in] frame Copy by reference, DMA will write packets into it
+ *
+ * @return          False if another capture is already running
+ *
+ * @note            First capture starts with resynchronisation, CS is held 
+ *                  high for FLIR_RESYNC_DELAY. Each packet is received into 
+ *                  its place in the frame, discard packets and packets before 
+ *                  the first one are overwriting row 0 until we get in sync.
+ *                  If previous capture finished without error, packet 
+ *                  boundaries are still aligned, as clock stops only between 
+ *                  packets, so we skip resynchronisation and start reading 
+ *                  immediately. In that case the whole capture runs from 
+ *                  interrupt and does not need flir_capture_poll() calls.
+ *                  Call flir_capture_poll() until it returns true, frame 
+ *                  should not be touched before that. 
+ */
+bool flir_capture_start(uint16_t frame[FLIR_FRAME_PACKETS][FLIR_PACKET_WORDS])
+{
+    if (capture_state != DONE || !capture_telemetry)
+    {
+        return false;
+    }
+
+    // Make sure that no dirty line gets written back over DMA data
+    dma_buf_invalidate(frame, FLIR_FRAME_PACKETS * FLIR_PACKET_WORDS * 2);
+    capture_frame = frame;
+    capture_frame8 = NULL;
+    capture_image = NULL;
+    capture_begin();
+    return true;
+}
+
+/*!
+ * @brief           Starts non-blocking capture of one AGC frame into 8 bit 
+ *                  pixels, without ID and CRC words
+ *
+ * @param[in] frame Copy by reference, pixels will be written into it
+ *
+ * @return          False if another capture is already running
+ *
+ * @note            With AGC on Lepton sends 8 bit values in 16 bit words, 
+ *                  so frame takes half of the memory of flir_capture_start(). 
+ *                  SPI DMA can not drop upper bytes, so packets are received 
+ *                  into packet buffers and packed by CPU while next one is 
+ *                  being received, as in flir_capture_image_start(). Frame 
+ *                  is written only by CPU and does not need cache alignment.
+ */
+bool flir_capture_frame8_start(uint8_t frame[FLIR_FRAME_ROWS][FLIR_IMAGE_COLS])
+{
+    if (capture_state != DONE || !capture_packets || !capture_telemetry)
+    {
+        return false;
+    }
+
+    dma_buf_invalidate(capture_packets, 2 * CAPTURE_SLOT_WORDS * 2);
+    capture_frame = NULL;
+    capture_frame8 = frame;
+    capture_image = NULL;
+    capture_begin();
+    return true;
+}
+
+/*!
+ * @brief           Starts non-blocking capture of one frame straight into 
+ *                  int8 image, for example input tensor of the model
+ *
+ * @param[in] image Copy by reference, FLIR_FRAME_ROWS * FLIR_IMAGE_COLS 
+ *                  pixels will be written into it
+ *
+ * @return          False if another capture is already running
+ *
+ * @note            Packets are received by DMA into two packet buffers in 
+ *                  turns. While next packet is being received, ID and CRC 
+ *                  words of the previous one are stripped and its pixels 
+ *                  are converted from AGC 8 bit value into int8, by 
+ *                  subtracting 128. That way no frame buffer and no 
+ *                  separate copy pass is needed. Image is written only by 
+ *                  CPU, so it does not need any cache alignment. 
+ *                  With FLIR_FLAT_FIELD fixed pattern noise is corrected 
+ *                  in the same pass, look at flir_flat_calibrate(). 
+ *                  Otherwise it behaves as flir_capture_start().
+ */
+bool flir_capture_image_start(int8_t * image)
+{
+    if (capture_state != DONE || !capture_packets)
+    {
+        return false;
+    }
+
+    dma_buf_invalidate(capture_packets, 2 * CAPTURE_SLOT_WORDS * 2);
+    capture_frame = NULL;
+    capture_frame8 = NULL;
+    capture_image = image;
+    capture_begin();
+    return true;
+}
+
+/*!
+ * @brief           Services running capture, it has to be called 
+ *                  periodically from main context
+ *
+ * @return          True if frame, that was given in flir_capture_start()
+ *                  or flir_capture_image_start(), is complete
+ *
+ * @note            Only resynchronisation is handled here, as we can not 
+ *                  wait in interrupt, packets are handled in 
+ *                  capture_packet_done().
+ */
+bool flir_capture_poll()
+{
+    if (capture_state == WAIT_VSYNC && flir_capture_poll_delay() == 0)
+    {
+        capture_vsync_timeout();
+    }
+
+    if (capture_state == INIT)
+    {
+        if (flir_capture_poll_delay() == 0)
+        {
+            if (capture_id_error)
+            {
+                LOG_WARN("ID error\n");
+                capture_id_error = false;
+            }
+            capture_read_first();
+        }
+    }
+
+    return capture_state == DONE;
+}
+
+/*!
+ * @brief           Tells if capture is waiting for resynchronisation or 
+ *                  VSYNC, whose timeouts only progress while 
+ *                  flir_capture_poll() is called
+ *
+ * @return          True if core should not sleep and wait for interrupt
+ */
+bool flir_capture_needs_poll()
+{
+    return capture_state == INIT || capture_state == WAIT_VSYNC;
+}
+
+/*!
+ * @brief           Tells how long main context can sleep before 
+ *                  resynchronisation has to continue or VSYNC times out
+ *
+ * @return          Time in ms, 0 if flir_capture_poll() should be called 
+ *                  now or capture is not waiting
+ */
+uint32_t flir_capture_poll_delay()
+{
+    uint64_t elapsed;
+    uint32_t delay;
+
+    if (capture_state == INIT)
+    {
+        elapsed = millis() - capture_resync_start;
+        delay = FLIR_RESYNC_DELAY;
+    }
+    else if (capture_state == WAIT_VSYNC)
+    {
+        elapsed = millis() - capture_vsync_start;
+        delay = FLIR_VSYNC_TIMEOUT;
+    }
+    else
+    {
+        return 0;
+    }
+    return elapsed >= delay ? 0 : delay - elapsed;
+}
+
+/*!
+ * @brief           Sleeps until the running capture is done
+ *
+ * @return          True when frame is complete
+ *
+ * @note            Core wakes up on capture events and when
+ *                  resynchronisation delay is over, instead of spinning 
+ *                  on flir_capture_poll().
+ */
+bool flir_capture_wait()
+{
+    while (!flir_capture_poll())
+    {
+        uint32_t timeout = flir_capture_needs_poll() ? 
+                           flir_capture_poll_delay() : EVENT_FOREVER;
+        if (timeout || !flir_capture_needs_poll())
+        {
+            event_wait(EVENT_CAPTURE, timeout);
+        }
+    }
+    return true;
+}
+
+/*!
+ * @brief               Tells how far image of flir_capture_image_start() 
+ *                      is converted, while capture is still running
+ *
+ * @param[out] round    Changes whenever capture drops the rows and starts 
+ *                      over with the next frame
+ *
+ * @return              Number of complete image rows from the top, 
+ *                      FLIR_FRAME_ROWS once frame is done
+ *
+ * @note                Lets main context work on the top of the image 
+ *                      while bottom is being received, look at 
+ *                      ConvRowStream of conv_specialised.h. Rows of a new 
+ *                      round overwrite those of the old one, so check 
+ *                      round again after using them.
+ */
+uint8_t flir_capture_image_rows(uint32_t * round)
+{
+    bool masked = cm_mask_interrupts(true);
+    uint8_t rows = capture_image_rows;
+    *round = capture_image_round;
+    cm_mask_interrupts(masked);
+    return rows;
+}
+
+/*!
+ * @brief           Common part of both capture start functions
+ */
+static void capture_begin()
+{
+    sys_require(SYS_PERIPH_SPI);
+    capture_id_error = false;
+    telemetry.valid = false;
+    dma_buf_invalidate(capture_telemetry, CAPTURE_SLOT_WORDS * 2);
+
+    if (capture_in_sync)
+    {
+        capture_read_first();
+    }
+    else
+    {
+        capture_resync();
+    }
+}
+
+/*!
+ * @brief           Selects FLIR and requests first packet of a frame
+ */
+static void capture_read_first()
+{
+    enable_flir_cs();
+    capture_wait_first();
+}
+
+/*!
+ * @brief           Reads packets until the first packet of a frame comes
+ *
+ * @note            FLIR has to be selected already. With VSYNC reading 
+ *                  starts from exti isr, when the frame is ready.
+ */
+static void capture_wait_first()
+{
+    capture_image_restart();
+    capture_row = 0;
+    capture_slot = 0;
+    capture_discards = 0;
+    if (capture_vsync)
+    {
+        capture_vsync_start = millis();
+        capture_state = WAIT_VSYNC;
+        return;
+    }
+    capture_state = OUT_OF_SYNC;
+    spi_dma_read16(capture_buffer(), FLIR_PACKET_WORDS);
+}
+
+/*!
+ * @brief           Starts reading of the frame on VSYNC pulse
+ */
+void exti3_isr(void)
+{
+    CYCLE_BUDGET(BUDGET_VSYNC_ISR, BUDGET_VSYNC_ISR_CYCLES);
+    exti_reset_request(FLIR_VSYNC_EXTI);
+
+    if (capture_state != WAIT_VSYNC)
+    {
+        return;
+    }
+    capture_state = OUT_OF_SYNC;
+    spi_dma_read16(capture_buffer(), FLIR_PACKET_WORDS);
+    event_post(EVENT_CAPTURE);
+}
+
+/*!
+ * @brief           Gives up on VSYNC and reads packets until the first 
+ *                  one, as without VSYNC
+ *
+ * @note            Pulse can arrive meanwhile, so it runs with interrupts 
+ *                  masked.
+ */
+static void capture_vsync_timeout()
+{
+    bool masked = cm_mask_interrupts(true);
+    bool timed_out = capture_state == WAIT_VSYNC;
+    if (timed_out)
+    {
+        capture_vsync = false;
+        capture_stats.vsync_timeouts++;
+        capture_state = OUT_OF_SYNC;
+        spi_dma_read16(capture_buffer(), FLIR_PACKET_WORDS);
+    }
+    cm_mask_interrupts(masked);
+
+    if (timed_out)
+    {
+        LOG_WARN("No VSYNC, reading discard packets\n");
+    }
+}
+
+/*!
+ * @brief           Deselects FLIR and starts resynchronisation period
+ *
+ * @note            Can be called from interrupt
+ */
+static void capture_resync()
+{
+    disable_flir_cs();
+    capture_in_sync = false;
+    capture_image_restart();
+    capture_row = 0;
+    capture_soft_resyncs = 0;
+    capture_stats.hard_resyncs++;
+    counter_add(COUNTER_RESYNCS, 1);
+    capture_resync_start = millis();
+    capture_state = INIT;
+    event_post(EVENT_CAPTURE);
+}
+
+/*!
+ * @brief           Drops frame that is being read and waits for the first 
+ *                  packet of the next one, without deselecting FLIR
+ *
+ * @note            Called from interrupt. Packet boundaries are still 
+ *                  aligned, clock only stops between packets, so a bad 
+ *                  packet costs one frame instead of FLIR_RESYNC_DELAY. 
+ *                  After FLIR_MAX_SOFT_RESYNCS failed frames in a row we 
+ *                  give up and do full resynchronisation.
+ */
+static void capture_soft_resync()
+{
+    if (++capture_soft_resyncs > FLIR_MAX_SOFT_RESYNCS)
+    {
+        capture_resync();
+        return;
+    }
+
+    capture_stats.soft_resyncs++;
+    counter_add(COUNTER_RESYNCS, 1);
+    capture_wait_first();
+}
+
+/*!
+ * @brief           Returns buffer that next packet should be received into
+ *
+ * @return          Packet of the frame in frame mode or one of packet 
+ *                  buffers in image and 8 bit mode and for frame that 
+ *                  stream drops, telemetry buffer for telemetry row A. 
+ *                  Telemetry packets after row A go into packet buffers.
+ */
+static uint16_t * capture_buffer()
+{
+    if (capture_row == FLIR_FRAME_PACKETS)
+    {
+        return capture_telemetry;
+    }
+    if (!capture_frame || capture_row > FLIR_FRAME_PACKETS)
+    {
+        return capture_packets[capture_slot];
+    }
+    return capture_frame[capture_row];
+}
+
+/*!
+ * @brief           Strips ID and CRC words of the packet and writes its 
+ *                  pixels into image row as int8 values
+ *
+ * @param[in] packet    Received packet
+ * @param[in] row       Packet of the frame, a row of Lepton 2.x
+ */
+static void capture_convert_packet(const uint16_t * packet, uint8_t row)
+{
+    const uint16_t * pixels = packet + (FLIR_PACKET_WORDS - FLIR_PACKET_PIXELS);
+    uint32_t first = row * FLIR_PACKET_PIXELS;
+
+#ifdef FLIR_FLAT_FIELD
+    // Table is learnt from pixels before correction
+    if (flat_phase == FLAT_LEARNING)
+    {
+        frame_flat_learn_u16(pixels, first, FLIR_PACKET_PIXELS, &capture_flat);
+    }
+    frame_flat_convert_u16(pixels, 
+                           capture_image + first, 
+                           first, 
+                           FLIR_PACKET_PIXELS, 
+                           &capture_flat, 
+                           &capture_quant);
+    frame_flat_fix_dead(capture_image + first, first, FLIR_PACKET_PIXELS, 
+                        &capture_flat);
+#else
+    frame_convert_u16(pixels, 
+                      capture_image + first, 
+                      FLIR_PACKET_PIXELS, 
+                      &capture_quant);
+#endif
+}
+
+/*!
+ * @brief           Forgets converted rows of the image, frame is read 
+ *                  again from the first packet
+ *
+ * @note            Can be called from interrupt
+ */
+static void capture_image_restart()
+{
+    capture_image_rows = 0;
+    capture_image_round++;
+}
+
+/*!
+ * @brief           Adds pixels of the packet to statistics of the frame
+ *
+ * @param[in] packet    Received packet
+ * @param[in] row       Packet of the frame, a row of Lepton 2.x
+ *
+ * @note            Called from interrupt for every packet in every capture 
+ *                  mode. Packet was just invalidated, so this is the pass 
+ *                  that brings it into cache, conversion then reads it 
+ *                  from there. First row starts a new frame, rows of a 
+ *                  frame that was dropped on resync are forgotten then.
+ */
+static void capture_measure_packet(const uint16_t * packet, uint8_t row)
+{
+    if (row == 0)
+    {
+        frame_stats_begin(&pixel_stats);
+    }
+    frame_stats_row_u16(&pixel_stats, 
+                        packet + (FLIR_PACKET_WORDS - FLIR_PACKET_PIXELS), 
+                        FLIR_PACKET_PIXELS);
+}
+
+/*!
+ * @brief           Strips ID and CRC words of the packet and writes its 
+ *                  pixels into 8 bit frame row
+ *
+ * @param[in] packet    Received packet
+ * @param[in] row       Packet of the frame, a row of Lepton 2.x
+ */
+static void capture_pack_packet(const uint16_t * packet, uint8_t row)
+{
+    frame_pack_u16(packet + (FLIR_PACKET_WORDS - FLIR_PACKET_PIXELS), 
+                   &capture_frame8[0][0] + row * FLIR_PACKET_PIXELS, 
+                   FLIR_PACKET_PIXELS);
+}
+
+/*!
+ * @brief           Called from DMA interrupt after each received packet
+ *
+ * @param[in] status    False if DMA reported transfer error
+ *
+ * @note            We should read ID field of each packet to be sure 
+ *                  that it is the packet that we want. Next packet is 
+ *                  requested immediately, so Lepton does not lose sync, 
+ *                  in image mode conversion of the current packet is done 
+ *                  while next one is being received.
+ */
+static void capture_packet_done(bool status)
+{
+    CYCLE_BUDGET(BUDGET_VOSPI_PACKET, BUDGET_VOSPI_PACKET_CYCLES);
+    uint16_t * packet = capture_buffer();
+    uint8_t row = capture_row;
+    bool done = false;
+
+    dma_buf_invalidate(packet, FLIR_PACKET_WORDS * 2);
+
+    if (!status)
+    {
+        capture_resync();
+        return;
+    }
+
+    bool discard = (packet[0] & FLIR_DISCARD_MASK) == FLIR_DISCARD_MASK;
+    uint16_t number = packet[0] & FLIR_PACKET_NUMBER_MASK;
+#if FLIR_SEGMENTS > 1
+    // Packet numbers start again in each segment
+    uint8_t segment_packets = capture_rows() / FLIR_SEGMENTS;
+    uint8_t segment = row / segment_packets;
+    uint16_t expected = row - segment * segment_packets;
+#else
+    uint16_t expected = row;
+#endif
+
+    switch (capture_state)
+    {
+        case OUT_OF_SYNC:
+            // Discard packets and tail of previous frame, including 
+            // telemetry rows, come before the first packet
+            if (discard || number != 0)
+            {
+                if (discard)
+                {
+                    counter_add(COUNTER_DISCARDS, 1);
+                }
+                // Number outside of frame means that we are not on packet 
+                // boundary anymore
+                if ((!discard && number >= FLIR_MAX_PACKETS) || 
+                    ++capture_discards > FLIR_MAX_DISCARDS)
+                {
+                    capture_id_error = true;
+                    capture_resync();
+                    return;
+                }
+                spi_dma_read16(packet, FLIR_PACKET_WORDS);
+                return;
+            }
+            if (!packet_crc_ok(packet))
+            {
+                capture_stats.crc_errors++;
+                spi_dma_read16(packet, FLIR_PACKET_WORDS);
+                return;
+            }
+            //Start detected, next packets go into frame array
+            capture_time.first_us = micros();
+            capture_state = READING_FRAME;
+            break;
+
+        case READING_FRAME:
+            if (discard || number != expected)
+            {
+                //Error getting correct packet ID, wait for next frame
+                capture_stats.id_errors++;
+                counter_add(COUNTER_ID_ERRORS, 1);
+                capture_soft_resync();
+                return;
+            }
+            if (!packet_crc_ok(packet))
+            {
+                capture_stats.crc_errors++;
+                capture_soft_resync();
+                return;
+            }
+            break;
+
+        default:
+            return;
+    }
+
+#if FLIR_SEGMENTS > 1
+    // Only packet 20 has the segment number, segment 0 is a frame that 
+    // Lepton does not update, frame has to start with segment 1
+    if (expected == FLIR_SEGMENT_ID_PACKET && 
+        ((packet[0] >> 12) & 0x7) != segment + 1)
+    {
+        if (segment != 0)
+        {
+            capture_stats.id_errors++;
+            counter_add(COUNTER_ID_ERRORS, 1);
+            capture_soft_resync();
+            return;
+        }
+        uint16_t discards = capture_discards;
+        capture_wait_first();
+        capture_discards = discards + 1;
+        return;
+    }
+#endif
+
+    capture_row++;
+
+    if (capture_row == capture_rows())
+    {
+        //We got full frame, stream keeps FLIR selected for the next one
+        if (!stream_on)
+        {
+            disable_flir_cs();
+        }
+        capture_in_sync = true;
+        capture_soft_resyncs = 0;
+        capture_stats.frames++;
+        counter_add(COUNTER_FRAMES, 1);
+        boot_mark(BOOT_FIRST_FRAME);
+        capture_time.complete_us = micros();
+        done = true;
+    }
+    else
+    {
+        capture_slot ^= 1;
+        spi_dma_read16(capture_buffer(), FLIR_PACKET_WORDS);
+    }
+
+    if (row < FLIR_FRAME_PACKETS)
+    {
+        capture_measure_packet(packet, row);
+    }
+
+    if (row >= FLIR_FRAME_PACKETS)
+    {
+        // Row A is the first telemetry packet, Lepton 3.x sends three more
+        if (row == FLIR_FRAME_PACKETS)
+        {
+            capture_parse_telemetry(packet);
+        }
+    }
+    else if (capture_image)
+    {
+        capture_convert_packet(packet, row);
+        capture_image_rows = (row + 1) * FLIR_PACKET_PIXELS / FLIR_IMAGE_COLS;
+        event_post(EVENT_CAPTURE_ROW);
+    }
+    else if (capture_frame8)
+    {
+        capture_pack_packet(packet, row);
+    }
+
+#ifdef FLIR_FLAT_FIELD
+    if (done)
+    {
+        flat_frame_done();
+    }
+#endif
+
+    if (done && stream_on)
+    {
+        stream_push();
+        stream_select();
+        telemetry.valid = false;
+        dma_buf_invalidate(capture_telemetry, CAPTURE_SLOT_WORDS * 2);
+        capture_wait_first();
+        event_post(EVENT_CAPTURE);
+    }
+    else if (done)
+    {
+        capture_state = DONE;
+        event_post(EVENT_CAPTURE);
+    }
+}
+
+/*!
+ * @brief           Returns number of packets that are read for one frame
+ */
+static uint8_t capture_rows()
+{
+    return capture_telemetry_enabled ? 
+           FLIR_FRAME_PACKETS + FLIR_TELEMETRY_PACKETS : FLIR_FRAME_PACKETS;
+}
+
+/*!
+ * @brief           Decodes telemetry row A of the frame that was just read
+ *
+ * @param[in] packet    Packet with ID and CRC words
+ *
+ * @note            Called from interrupt. Words of 32 bit values are sent 
+ *                  least significant word first.
+ */
+static void capture_parse_telemetry(const uint16_t * packet)
+{
+    const uint16_t * row = packet + (FLIR_PACKET_WORDS - FLIR_PACKET_PIXELS);
+
+    telemetry.time_ms = row[1] | ((uint32_t) row[2] << 16);
+    telemetry.status = row[3] | ((uint32_t) row[4] << 16);
+    telemetry.frame_counter = row[20] | ((uint32_t) row[21] << 16);
+    telemetry.frame_mean = row[22];
+    telemetry.fpa_temp_k100 = row[24];
+    telemetry.housing_temp_k100 = row[26];
+    telemetry.ffc_state = (flir_ffc_state_e) ((telemetry.status >> 4) & 0x3);
+    telemetry.ffc_desired = (telemetry.status >> 3) & 0x1;
+    if (telemetry.ffc_state == FLIR_FFC_IMMINENT || 
+        telemetry.ffc_state == FLIR_FFC_IN_PROGRESS)
+    {
+        // Automatic FFC moves the shutter
+        shadow_forget(1U << SHADOW_SHUTTER);
+    }
+#ifdef FLIR_FLAT_FIELD
+    telemetry.flat_calibration = flat_phase != FLAT_IDLE;
+#else
+    telemetry.flat_calibration = false;
+#endif
+    telemetry.valid = true;
+}
+
+/*!
+ * @brief           Copies telemetry of the last captured frame
+ *
+ * @param[out] data
+ *
+ * @return          False if telemetry is disabled or frame is not 
+ *                  complete yet
+ */
+bool flir_get_frame_telemetry(flir_telemetry_t * data)
+{
+    if (capture_state != DONE || !telemetry.valid)
+    {
+        return false;
+    }
+    *data = *(const flir_telemetry_t *) &telemetry;
+    return true;
+}
+
+/*!
+ * @brief           Copies arrival times of the last captured frame
+ *
+ * @param[out] stamp
+ *
+ * @return          False if frame is not complete yet
+ */
+bool flir_get_frame_timestamp(flir_timestamp_t * stamp)
+{
+    if (capture_state != DONE)
+    {
+        return false;
+    }
+    *stamp = *(const flir_timestamp_t *) &capture_time;
+    return true;
+}
+
+/*!
+ * @brief           Returns pixel statistics of the last captured frame
+ *
+ * @return          NULL if frame is not complete yet
+ *
+ * @note            Minimum, maximum, sum and histogram are gathered while 
+ *                  packets arrive, look at shared/frame_stats.h, so no 
+ *                  stage needs another pass over the frame. Pointer is 
+ *                  valid until the next capture is started. Frames of 
+ *                  the stream have their own, look at flir_stream_stats().
+ */
+const frame_stats_t * flir_get_frame_stats()
+{
+    if (capture_state != DONE || !pixel_stats.hist.count)
+    {
+        return NULL;
+    }
+    return &pixel_stats;
+}
+
+/*!
+ * @brief           Tells if the last captured frame should be classified
+ *
+ * @return          False if frame is repeated or was captured while flat 
+ *                  field correction was imminent or running, or while 
+ *                  flir_flat_calibrate() moved the shutter
+ *
+ * @note            Lepton sends frames at 27 Hz, but only every third one 
+ *                  is new, repeated frames keep frame counter of the 
+ *                  original. Counter of an accepted frame is remembered, 
+ *                  so call it once per frame. Without telemetry every 
+ *                  frame is accepted.
+ */
+bool flir_frame_usable()
+{
+    flir_telemetry_t data;
+    if (!flir_get_frame_telemetry(&data))
+    {
+        return true;
+    }
+    return telemetry_usable(&data);
+}
+
+/*!
+ * @brief           Common part of flir_frame_usable() and stream_push()
+ *
+ * @param[in] data  Telemetry of the frame
+ */
+static bool telemetry_usable(const flir_telemetry_t * data)
+{
+    if (data->flat_calibration)
+    {
+        capture_stats.flat_frames++;
+        return false;
+    }
+
+    if (data->ffc_state == FLIR_FFC_IMMINENT || 
+        data->ffc_state == FLIR_FFC_IN_PROGRESS)
+    {
+        capture_stats.ffc_frames++;
+        return false;
+    }
+
+    if (last_frame_counter_valid && data->frame_counter == last_frame_counter)
+    {
+        capture_stats.duplicates++;
+        return false;
+    }
+
+    last_frame_counter = data->frame_counter;
+    last_frame_counter_valid = true;
+    return true;
+}
+
+/*!
+ * @brief           Starts continuous capture, every frame that Lepton sends 
+ *                  is read and queued until it is stopped
+ *
+ * @param[in] frames        Array of depth frame buffers, DMA_BUFFER for 
+ *                          FLIR_FRAME_RAW16
+ * @param[in] depth         Number of frames, up to FLIR_STREAM_MAX_DEPTH
+ * @param[in] format        Layout of frames, FLIR_FRAME_AGC8 halves memory 
+ *                          and is packed as in flir_capture_frame8_start()
+ * @param[in] usable_only   Repeated and FFC frames are not queued, as in 
+ *                          flir_frame_usable()
+ *
+ * @return          False if another capture is already running
+ *
+ * @note            Next frame is requested straight from interrupt after 
+ *                  the last packet, FLIR stays selected and in sync, so 
+ *                  all 27 frames per second come through. Frames are 
+ *                  taken with flir_stream_peek() or flir_stream_wait() 
+ *                  and given back with flir_stream_release(), at the pace 
+ *                  of consumer. When all buffers are queued or used, next 
+ *                  frames are still read, into packet buffers, and 
+ *                  counted as dropped in flir_capture_get_stats().
+ *                  Resynchronisation still needs flir_capture_poll().
+ */
+bool flir_stream_start(void * frames, 
+                       uint8_t depth, 
+                       flir_frame_format_e format, 
+                       bool usable_only)
+{
+    if (capture_state != DONE || !capture_packets || !capture_telemetry || 
+        depth == 0 || depth > FLIR_STREAM_MAX_DEPTH)
+    {
+        return false;
+    }
+
+    stream_frames = frames;
+    stream_format = format;
+    stream_frame_size = format == FLIR_FRAME_AGC8 ? 
+                        FLIR_FRAME_ROWS * FLIR_IMAGE_COLS : 
+                        FLIR_FRAME_PACKETS * FLIR_PACKET_WORDS * 2;
+    stream_depth = depth;
+    stream_usable_only = usable_only;
+    stream_head = 0;
+    stream_tail = 0;
+    stream_skipped = 0;
+    stream_on = true;
+
+    dma_buf_invalidate(capture_packets, 2 * CAPTURE_SLOT_WORDS * 2);
+    capture_image = NULL;
+    stream_select();
+    capture_begin();
+    return true;
+}
+
+/*!
+ * @brief           Stops continuous capture after the frame that is being
+ *                  read
+ *
+ * @note            Frames that are still queued can be taken. Buffers can 
+ *                  be used for something else once flir_capture_poll() 
+ *                  returns true.
+ */
+void flir_stream_stop()
+{
+    bool masked = cm_mask_interrupts(true);
+    stream_on = false;
+    // Nothing is read while resynchronising or waiting for VSYNC
+    if (capture_state == INIT || capture_state == WAIT_VSYNC)
+    {
+        disable_flir_cs();
+        capture_state = DONE;
+    }
+    cm_mask_interrupts(masked);
+}
+
+/*!
+ * @brief           Tells if continuous capture was started and not stopped
+ */
+bool flir_stream_running()
+{
+    return stream_on;
+}
+
+/*!
+ * @brief           Returns number of queued frames, including the one that 
+ *                  consumer is using
+ */
+uint8_t flir_stream_pending()
+{
+    uint8_t head = stream_head;
+    uint8_t tail = stream_tail;
+    return head >= tail ? head - tail : head + 2 * stream_depth - tail;
+}
+
+/*!
+ * @brief           Returns the oldest queued frame, without removing it
+ *
+ * @param[out] data Telemetry of the frame, can be NULL
+ *
+ * @return          Frame in format of flir_stream_start(), NULL if queue 
+ *                  is empty
+ *
+ * @note            Frame is not written until flir_stream_release().
+ */
+void * flir_stream_peek(flir_telemetry_t * data)
+{
+    uint8_t tail = stream_tail;
+    if (stream_head == tail)
+    {
+        return NULL;
+    }
+
+    if (data)
+    {
+        *data = stream_telemetry[tail % stream_depth];
+    }
+    return stream_frames + (tail % stream_depth) * stream_frame_size;
+}
+
+/*!
+ * @brief           Sleeps until a frame is queued and returns it, as 
+ *                  flir_stream_peek()
+ *
+ * @return          Frame, NULL if stream is stopped and queue is empty
+ */
+void * flir_stream_wait(flir_telemetry_t * data)
+{
+    void * frame;
+
+    while (!(frame = flir_stream_peek(data)))
+    {
+        if (flir_capture_poll())
+        {
+            return NULL;
+        }
+        uint32_t timeout = flir_capture_needs_poll() ? 
+                           flir_capture_poll_delay() : EVENT_FOREVER;
+        if (timeout || !flir_capture_needs_poll())
+        {
+            event_wait(EVENT_CAPTURE, timeout);
+        }
+    }
+    return frame;
+}
+
+/*!
+ * @brief           Copies arrival times of the oldest queued frame, the 
+ *                  one flir_stream_peek() returns
+ *
+ * @param[out] stamp
+ *
+ * @return          False if queue is empty
+ */
+bool flir_stream_timestamp(flir_timestamp_t * stamp)
+{
+    uint8_t tail = stream_tail;
+    if (stream_head == tail)
+    {
+        return false;
+    }
+    *stamp = stream_times[tail % stream_depth];
+    return true;
+}
+
+/*!
+ * @brief           Returns pixel statistics of the oldest queued frame, 
+ *                  the one flir_stream_peek() returns
+ *
+ * @return          NULL if queue is empty
+ *
+ * @note            Statistics are kept with the frame until 
+ *                  flir_stream_release(), as in flir_get_frame_stats().
+ */
+const frame_stats_t * flir_stream_stats()
+{
+    uint8_t tail = stream_tail;
+    if (stream_head == tail)
+    {
+        return NULL;
+    }
+    return &stream_stats[tail % stream_depth];
+}
+
+/*!
+ * @brief           Gives the oldest queued frame back to the stream
+ */
+void flir_stream_release()
+{
+    if (stream_head != stream_tail)
+    {
+        stream_tail = stream_next(stream_tail);
+    }
+}
+
+/*!
+ * @brief           Returns the next value of stream_head or stream_tail
+ */
+static uint8_t stream_next(uint8_t index)
+{
+    return index + 1 == 2 * stream_depth ? 0 : index + 1;
+}
+
+/*!
+ * @brief           Selects buffer for the next frame of the stream
+ *
+ * @note            Called from interrupt. Without free buffer frame is read 
+ *                  into packet buffers and dropped.
+ */
+static void stream_select()
+{
+    capture_frame = NULL;
+    capture_frame8 = NULL;
+    if (flir_stream_pending() >= stream_depth)
+    {
+        return;
+    }
+
+    void * frame = stream_frames + (stream_head % stream_depth) * stream_frame_size;
+    if (stream_format == FLIR_FRAME_AGC8)
+    {
+        capture_frame8 = frame;
+        return;
+    }
+
+    // Consumer could have left dirty lines in it
+    dma_buf_invalidate(frame, stream_frame_size);
+    capture_frame = frame;
+}
+
+/*!
+ * @brief           Queues frame that was just read
+ *
+ * @note            Called from interrupt. Skipped frames stay in their 
+ *                  buffer and get overwritten by the next one. As in 
+ *                  the consumer loops, after FLIR_MAX_SKIPPED_FRAMES in a 
+ *                  row a frame is queued anyway.
+ */
+static void stream_push()
+{
+    if (!capture_frame && !capture_frame8)
+    {
+        capture_stats.dropped++;
+        return;
+    }
+
+    flir_telemetry_t data = *(const flir_telemetry_t *) &telemetry;
+    if (stream_usable_only && data.valid && 
+        stream_skipped < FLIR_MAX_SKIPPED_FRAMES && !telemetry_usable(&data))
+    {
+        stream_skipped++;
+        return;
+    }
+
+    stream_skipped = 0;
+    stream_telemetry[stream_head % stream_depth] = data;
+    stream_times[stream_head % stream_depth] = 
+        *(const flir_timestamp_t *) &capture_time;
+    stream_stats[stream_head % stream_depth] = pixel_stats;
+    // Frame and telemetry have to be in place before consumer sees head
+    __asm__ volatile ("" ::: "memory");
+    stream_head = stream_next(stream_head);
+}
+
+/*!
+ * @brief           Checks CRC of VoSPI packet
+ *
+ * @param[in] packet    Received packet, words as they came over SPI
+ *
+ * @return          True if CRC matches or checking is disabled
+ *
+ * @note            CRC is calculated over whole packet with four upper 
+ *                  bits of ID and CRC word set to zero, most significant 
+ *                  byte of each word first.
+ */
+static bool packet_crc_ok(const uint16_t * packet)
+{
+#ifdef FLIR_CHECK_CRC
+    const uint16_t head[2] = {packet[0] & 0x0FFF, 0};
+    uint16_t crc = crc_hw_ccitt16_words(0, head, 2);
+    crc = crc_hw_ccitt16_words(crc, packet + 2, FLIR_PACKET_WORDS - 2);
+    return crc == packet[1];
+#else
+    (void) packet;
+    return true;
+#endif
+}
+
+/*!
+ * @brief           Returns counters of the capture engine since boot
+ */
+const flir_capture_stats_t * flir_capture_get_stats()
+{
+    return (const flir_capture_stats_t *) &capture_stats;
+}
+
+/*!
+ * @brief           Sends settings that flir_setup() makes, camera forgets
+ *                  them on power down
+ *
+ * @note            32 bit settings go in one batch and values that the 
+ *                  camera has already are skipped by the shadow, like AGC 
+ *                  off and GPIO mode after power up, look at 
+ *                  shadow_reset(). Setters that follow find their values in 
+ *                  the shadow, they only set up the MCU side. FFC period 
+ *                  of SET command is used if there is one, look at 
+ *                  config_store.h.
+ */
+static void flir_configure()
+{
+    const flir_set32_t settings[] = {
+#ifdef FLIR_RADIOMETRIC
+        {LEP_CID_AGC_ENABLE_STATE, 0},
+#else
+        {LEP_CID_AGC_ENABLE_STATE, 1},
+#endif
+        {LEP_CID_SYS_TELEMETRY_ENABLE_STATE, 1},
+        {LEP_CID_SYS_TELEMETRY_LOCATION, LEP_TELEMETRY_LOCATION_FOOTER},
+#ifdef FLIR_VSYNC
+        {LEP_CID_OEM_GPIO_MODE_SELECT, LEP_OEM_GPIO_MODE_VSYNC},
+#else
+        {LEP_CID_OEM_GPIO_MODE_SELECT, LEP_OEM_GPIO_MODE_GPIO},
+#endif
+    };
+    if (!flir_set32_batch(settings, sizeof(settings) / sizeof(settings[0])))
+    {
+        LOG_ERROR("Settings: function failed!\n");
+    }
+
+    set_flir_telemetry(1);
+    set_flir_telemetry_location(LEP_TELEMETRY_LOCATION_FOOTER);
+#ifdef FLIR_VSYNC
+    set_flir_vsync(1);
+#endif
+#ifdef FLIR_FLAT_FIELD
+    set_flir_ffc_period(config_store_value(CONFIG_FFC_PERIOD, 
+                                           FLIR_FLAT_FFC_PERIOD));
+#else
+    set_flir_ffc_period(config_store_value(CONFIG_FFC_PERIOD, 
+                                           FLIR_DEFAULT_FFC_PERIOD));
+#endif
+}
+
+/*!
+ * @brief           Prepares FLIR for communication
+ *
+ * @note            Does not wait for the boot, camera boots since power up
+ *                  of the board, call flir_wait_ready() before the first
+ *                  capture or command. Work in between, like 
+ *                  inference_setup(), hides the boot time.
+ */
+void flir_setup()
+{
+    // Telemetry row is a packet too, captures fail without buffers
+    capture_packets = dma_buf_alloc(2 * CAPTURE_SLOT_WORDS * 2);
+    capture_telemetry = dma_buf_alloc(CAPTURE_SLOT_WORDS * 2);
+    if (!capture_packets || !capture_telemetry)
+    {
+        LOG_ERROR("Out of DMA buffers\n");
+    }
+#ifdef FLIR_FLAT_FIELD
+    frame_flat_init(&capture_flat, flat_bias, flat_gain, 
+                    FLIR_FRAME_ROWS * FLIR_IMAGE_COLS);
+#endif
+#ifdef FLIR_RADIOMETRIC
+    frame_stats_init(&pixel_stats, 0x3FFF);
+#else
+    frame_stats_init(&pixel_stats, 0xFF);
+#endif
+    spi_dma_set_callback(capture_packet_done);
+    i2c_timing_set_device(LEP_I2C_DEVICE_ADDRESS, FLIR_I2C_SPEED);
+
+    rcc_periph_clock_enable(FLIR_PWR_DWN_PORT_RCC);
+    gpio_set(FLIR_PWR_DWN_PORT, FLIR_PWR_DWN_PIN);
+    gpio_mode_setup(FLIR_PWR_DWN_PORT, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE,
+                    FLIR_PWR_DWN_PIN);
+
+    // Pin was pulled up by the breakout since reset
+    power_state = FLIR_POWER_BOOTING;
+    boot_start = 0;
+}
+
+/*!
+ * @brief           Puts camera into standby, first with OEM Power Down 
+ *                  command, so that it shuts down in order, then by 
+ *                  holding PWR_DWN_L low
+ *
+ * @note            Stream has to be stopped and capture finished, CCI
+ *                  commands that are queued are finished first. Lepton
+ *                  then draws around 5 mW instead of 150 mW. Settings of
+ *                  flir_setup() are lost, flir_wait_ready() sends them 
+ *                  again.
+ */
+void flir_power_down()
+{
+    if (power_state == FLIR_POWER_DOWN)
+    {
+        return;
+    }
+
+    sys_require(SYS_PERIPH_I2C | SYS_PERIPH_SPI);
+    while (flir_cci_busy());
+    disable_flir_cs();
+    if (power_state == FLIR_POWER_ON && wait_busy_bit(FLIR_BUSY_TIMEOUT))
+    {
+        // Camera does not answer any more, so BUSY is not waited for
+        write_command_register(command_code(LEP_CID_OEM_POWER_DOWN, 
+                                            LEP_I2C_COMMAND_TYPE_RUN), 
+                               NULL, 0);
+    }
+    gpio_clear(FLIR_PWR_DWN_PORT, FLIR_PWR_DWN_PIN);
+    capture_in_sync = false;
+    boot_cold = true;
+#ifdef FLIR_FLAT_FIELD
+    // Shutter is open again after boot
+    flat_phase = FLAT_IDLE;
+#endif
+    power_state = FLIR_POWER_DOWN;
+}
+
+/*!
+ * @brief           Releases PWR_DWN_L and returns while camera boots
+ *
+ * @note            Call flir_wait_ready() before the camera is used, 
+ *                  compute or other I/O can run in between.
+ */
+void flir_power_up_start()
+{
+    if (power_state != FLIR_POWER_DOWN)
+    {
+        return;
+    }
+
+    gpio_set(FLIR_PWR_DWN_PORT, FLIR_PWR_DWN_PIN);
+    power_state = FLIR_POWER_BOOTING;
+    boot_start = millis();
+}
+
+/*!
+ * @brief           Called when status register was read during boot
+ */
+static void boot_status_done(i2c_xfer_t * xfer, bool status)
+{
+    (void) xfer;
+    boot_status = status ? (uint16_t) ((boot_rx[0] << 8) | boot_rx[1]) : 0;
+    boot_read_done = true;
+}
+
+/*!
+ * @brief           Reads status register with i2c_async.c, camera that 
+ *                  is still booting does not acknowledge, that fails 
+ *                  right away instead of after I2C_TIMEOUT
+ *
+ * @return          True if boot status bit is set and camera is not busy
+ */
+static bool boot_finished()
+{
+    static const uint8_t status_reg[2] = {LEP_I2C_STATUS_REG >> 8, 
+                                          LEP_I2C_STATUS_REG & 0xFF};
+
+    boot_read_done = false;
+    boot_xfer.addr = LEP_I2C_DEVICE_ADDRESS;
+    boot_xfer.tx = status_reg;
+    boot_xfer.tx_len = sizeof(status_reg);
+    boot_xfer.rx = boot_rx;
+    boot_xfer.rx_len = 2;
+    boot_xfer.callback = boot_status_done;
+    boot_xfer.context = NULL;
+    if (!i2c_async_submit(&boot_xfer))
+    {
+        return false;
+    }
+    while (!boot_read_done);
+
+    return (boot_status & LEP_I2C_STATUS_BOOT_STATUS_BIT_MASK) &&
+           !(boot_status & LEP_I2C_STATUS_BUSY_BIT_MASK);
+}
+
+/*!
+ * @brief           Waits until camera has booted and sends settings of 
+ *                  flir_setup() to it
+ *
+ * @return          False if camera did not boot in FLIR_BOOT_TIMEOUT
+ *
+ * @note            Core sleeps between reads of the status register, 
+ *                  boot usually takes 600-900 ms, only the part that was
+ *                  not spent elsewhere since flir_power_up_start() is 
+ *                  waited here. First capture resynchronises.
+ */
+bool flir_wait_ready()
+{
+    if (power_state == FLIR_POWER_ON)
+    {
+        return true;
+    }
+    if (power_state == FLIR_POWER_DOWN)
+    {
+        return false;
+    }
+
+    // First user of I2C1, set up while camera boots
+    sys_require(SYS_PERIPH_I2C);
+    while (1)
+    {
+        uint32_t elapsed = (uint32_t) (millis() - boot_start);
+        if (elapsed < FLIR_BOOT_MIN_MS)
+        {
+            event_sleep(FLIR_BOOT_MIN_MS - elapsed);
+            continue;
+        }
+        if (boot_finished())
+        {
+            break;
+        }
+        if (elapsed >= FLIR_BOOT_TIMEOUT)
+        {
+            LOG_ERROR("Camera did not boot\n");
+            return false;
+        }
+        event_sleep(FLIR_BOOT_POLL_MS);
+    }
+
+    power_state = FLIR_POWER_ON;
+    boot_mark(BOOT_CAMERA);
+    counter_add(COUNTER_FLIR_BOOTS, 1);
+    counter_max(COUNTER_FLIR_BOOT_MAX_MS, (uint32_t) (millis() - boot_start));
+    // Reset of the MCU alone leaves settings of the previous run in camera
+    shadow_reset(boot_cold || camera_fresh());
+    boot_cold = false;
+    flir_configure();
+    return true;
+}
+
+/*!
+ * @brief           Powers camera up again and waits until it is ready
+ *
+ * @return          False if camera did not boot
+ */
+bool flir_power_up()
+{
+    flir_power_up_start();
+    return flir_wait_ready();
+}
+
+/*!
+ * @brief           Returns power state of the camera
+ */
+flir_power_e flir_power_state()
+{
+    return power_state;
+}
+
+
+/*!
+ * @brief                   Sends get command to FLIR module
+ *
+ * @param[in] cmd_code      Command code to be send, use ones 
+ *                          defined in flir_defines.h
+ * @param[in] data_words    Copy by reference, result will be copied into it
+ * @param[in] num_words     Num of words that will be read
+ *
+ * @return                  True if everything is ok, otherwise false
+ *
+ * @note    Procedure implemented as written in Lepton Software Interface 
+ *          Description Document rev200.pdf, page 11
+ */
+static bool get_flir_command(uint16_t cmd_code, uint16_t * data_words, uint8_t num_words)
+{
+    // Blocking commands share I2C1 with the non-blocking engine
+    while (flir_cci_busy());
+    counter_add(COUNTER_CCI_COMMANDS, 1);
+
+    // Read command status register
+    // If not BUSY, write number of data words to read into DATA length reg.
+    if(wait_busy_bit(FLIR_BUSY_TIMEOUT))
+    {
+        // write command ID to command reg
+        // Read command status register
+        if (write_register(LEP_I2C_COMMAND_REG, cmd_code)) 
+        {
+            // Successful wait for Flir to process this
+            if(wait_busy_bit(FLIR_BUSY_TIMEOUT))
+            {
+                // If no timeout, read DATA from DATA regs
+                if(read_data_register(data_words, num_words))
+                {
+                    return true; 
+                }
+            }
+        }
+    }
+    // Something failed
+    return false;
+}
+
+/*!
+ * @brief                   Sends get command to FLIR module
+ *
+ * @param[in] cmd_code      Command code to be send, use ones 
+ *                          defined in flir_defines.h
+ * @param[in] data_words    Copy by reference, result will be copied into it
+ * @param[in] num_words     Num of words that will be read
+ *
+ * @return                  True if everything is ok, otherwise false
+ *
+ * @note    Procedure implemented as written in Lepton Software Interface 
+ *          Description Document rev200.pdf, page 11
+ *          This seems like unnecessary duplicate of the other set function,
+ *          but it will make high level use easier
+ */
+static bool get_flir_command32(uint16_t cmd_code, uint32_t * data_long_word)
+{
+    // Blocking commands share I2C1 with the non-blocking engine
+    while (flir_cci_busy());
+    counter_add(COUNTER_CCI_COMMANDS, 1);
+
+    // Read command status register
+    // If not BUSY, write number of data words to read into DATA length reg.
+    if(wait_busy_bit(FLIR_BUSY_TIMEOUT))
+    {
+        // write command ID to command reg
+        // Read command status register
+        if (write_register(LEP_I2C_COMMAND_REG, cmd_code)) 
+        {
+            // Successful wait for Flir to process this
+            if(wait_busy_bit(FLIR_BUSY_TIMEOUT))
+            {
+                // If no timeout, read DATA from DATA regs
+                if(read_data_register((uint16_t * ) data_long_word, 2))
+                {
+                    return true; 
+                }
+            }
+        }
+    }
+    // Something failed
+    return false;
+}
+
+
+/*!
+ * @brief                       Sends set command to FLIR module
+ *
+ * @param[in] cmd_code          Command code to be send, use the ones 
+ *                              defined in flir_defines.h
+ * @param[in] data_long_word    Copy by value
+ * @param[in] num_words         Num of words that will be read
+ *
+ * @return                      True if everything is ok, otherwise false
+ *
+ * @note    Procedure implemented as written in Lepton Software Interface 
+ *          Description Document rev200.pdf, page 12
+ *          This seems like unnecessary duplicate of the other set function,
+ *          but it will make high level use easier
+ */
+static bool set_flir_command32(uint16_t cmd_code, uint32_t data_long_word)
+{
+    // Blocking commands share I2C1 with the non-blocking engine
+    while (flir_cci_busy());
+    counter_add(COUNTER_CCI_COMMANDS, 1);
+
+    // Read command status register
+    // If not BUSY, write number of data words to read into DATA length reg.
+    if (wait_busy_bit(FLIR_BUSY_TIMEOUT))
+    {
+        // write command ID to command reg
+        // Read command status register
+        if (write_command_register(cmd_code, (uint16_t *) &data_long_word, 2))
+        {
+            // Successful wait for Flir to process this
+            if (wait_busy_bit(FLIR_BUSY_TIMEOUT))
+            {
+                return true; 
+            }
+        }
+    }
+
+    // Something failed
+    return false;
+}
+
+/*!
+ * @brief                   Blocking function, sends several set commands 
+ *                          with 32 bit values one after another
+ *
+ * @param[in] sets          Commands, they are sent in this order
+ * @param[in] count
+ *
+ * @return                  True if camera has all the values
+ *
+ * @note                    BUSY bit is polled once after each command and 
+ *                          that poll is the wait before the next one too, 
+ *                          so N commands wait N + 1 times instead of 2N. 
+ *                          Values that camera has already by the shadow 
+ *                          are not sent. Failed command does not stop the 
+ *                          others.
+ */
+bool flir_set32_batch(const flir_set32_t * sets, uint8_t count)
+{
+    bool all_ok = true;
+    bool ready = false;
+
+    // Blocking commands share I2C1 with the non-blocking engine
+    while (flir_cci_busy());
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        uint16_t cmd_code = command_code(sets[i].cmd_id, 
+                                         LEP_I2C_COMMAND_TYPE_SET);
+        int8_t slot = shadow_slot(cmd_code);
+        uint32_t value = sets[i].value;
+        uint32_t known;
+
+        if (slot >= 0 && shadow_known((shadow_slot_e) slot, &known) && 
+            known == value)
+        {
+            counter_add(COUNTER_CCI_CACHED, 1);
+            continue;
+        }
+
+        counter_add(COUNTER_CCI_COMMANDS, 1);
+        ready = (ready || wait_busy_bit(FLIR_BUSY_TIMEOUT)) && 
+                write_command_register(cmd_code, (uint16_t *) &value, 2) && 
+                wait_busy_bit(FLIR_BUSY_TIMEOUT);
+        bool ok = ready && last_flir_error == LEP_OK;
+
+        if (slot >= 0 && ok)
+        {
+            shadow_store((shadow_slot_e) slot, value);
+        }
+        else if (slot >= 0)
+        {
+            shadow_forget(1U << slot);
+        }
+        all_ok &= ok;
+    }
+    return all_ok;
+}
+
+/*!
+ * @brief                   Queues CCI command, which runs from interrupts 
+ *                          while frames and inference keep going
+ *
+ * @param[in] cmd           Command, fill cmd_code, data, num_words and 
+ *                          callback, it has to stay valid until callback
+ *
+ * @return                  False if command has too many data words
+ *
+ * @note                    Sequence is the same as in blocking functions: 
+ *                          wait for BUSY bit to clear, write DATA length 
+ *                          and DATA registers, write COMMAND register, wait 
+ *                          for BUSY again and read DATA for get commands. 
+ *                          BUSY bit is polled back-to-back, each read is 
+ *                          paced by I2C itself. Callback is called from 
+ *                          interrupt, keep it short.
+ */
+bool flir_cci_submit(flir_cci_cmd_t * cmd)
+{
+    if (!cmd || cmd->num_words > FLIR_CCI_MAX_WORDS)
+    {
+        return false;
+    }
+
+    cmd->next = NULL;
+    cmd->ok = false;
+    cmd->result = LEP_OK;
+
+    bool masked = cm_mask_interrupts(true);
+    bool idle = cci_head == NULL;
+    if (idle)
+    {
+        cci_head = cmd;
+    }
+    else
+    {
+        cci_tail->next = cmd;
+    }
+    cci_tail = cmd;
+
+    if (idle)
+    {
+        cci_start(cmd);
+    }
+    cm_mask_interrupts(masked);
+    return true;
+}
+
+/*!
+ * @brief                   Returns true while any CCI command is queued
+ */
+bool flir_cci_busy()
+{
+    return cci_head != NULL;
+}
+
+/*!
+ * @brief                   Queues set command with 32 bit value
+ *
+ * @param[in] cmd           Storage of the command
+ * @param[in] cmd_id        Like LEP_CID_AGC_ENABLE_STATE
+ * @param[in] value
+ * @param[in] callback      Can be NULL
+ *
+ * @return                  True if command was queued
+ */
+bool flir_cci_set32_async(flir_cci_cmd_t * cmd, 
+                          uint16_t cmd_id, 
+                          uint32_t value, 
+                          flir_cci_callback callback)
+{
+    cmd->cmd_code = command_code(cmd_id, LEP_I2C_COMMAND_TYPE_SET);
+    cmd->data[0] = (uint16_t) value;
+    cmd->data[1] = (uint16_t) (value >> 16);
+    cmd->num_words = 2;
+    cmd->callback = callback;
+    return flir_cci_submit(cmd);
+}
+
+/*!
+ * @brief                   Queues get command with 32 bit result, read it 
+ *                          with flir_cci_value32() in callback
+ *
+ * @param[in] cmd           Storage of the command
+ * @param[in] cmd_id        Like LEP_CID_AGC_ENABLE_STATE
+ * @param[in] callback      Can be NULL
+ *
+ * @return                  True if command was queued
+ */
+bool flir_cci_get32_async(flir_cci_cmd_t * cmd, 
+                          uint16_t cmd_id, 
+                          flir_cci_callback callback)
+{
+    cmd->cmd_code = command_code(cmd_id, LEP_I2C_COMMAND_TYPE_GET);
+    cmd->num_words = 2;
+    cmd->callback = callback;
+    return flir_cci_submit(cmd);
+}
+
+/*!
+ * @brief                   Queues run command, which has no data
+ *
+ * @param[in] cmd           Storage of the command
+ * @param[in] cmd_id        Like LEP_CID_SYS_RUN_FFC
+ * @param[in] callback      Can be NULL
+ *
+ * @return                  True if command was queued
+ */
+bool flir_cci_run_async(flir_cci_cmd_t * cmd, 
+                        uint16_t cmd_id, 
+                        flir_cci_callback callback)
+{
+    cmd->cmd_code = command_code(cmd_id, LEP_I2C_COMMAND_TYPE_RUN);
+    cmd->num_words = 0;
+    cmd->callback = callback;
+    return flir_cci_submit(cmd);
+}
+
+/*!
+ * @brief                   Returns 32 bit value of finished get command
+ */
+uint32_t flir_cci_value32(const flir_cci_cmd_t * cmd)
+{
+    return cmd->data[0] | ((uint32_t) cmd->data[1] << 16);
+}
+
+/*!
+ * @brief                   Starts flat field correction without blocking
+ *
+ * @param[in] callback      Called when FLIR accepted the command, can be 
+ *                          NULL
+ *
+ * @return                  False if previous FFC request is still running
+ *
+ * @note                    Frames captured during FFC are reported by 
+ *                          telemetry, look at flir_frame_usable().
+ */
+bool flir_run_ffc_async(flir_cci_callback callback)
+{
+    bool masked = cm_mask_interrupts(true);
+    bool queued = false;
+    for (flir_cci_cmd_t * cmd = cci_head; cmd; cmd = cmd->next)
+    {
+        queued |= cmd == &ffc_cmd;
+    }
+    cm_mask_interrupts(masked);
+
+    if (queued)
+    {
+        return false;
+    }
+    return flir_cci_run_async(&ffc_cmd, LEP_CID_SYS_RUN_FFC, callback);
+}
+
+/*!
+ * @brief                   Starts learning flat field table of image 
+ *                          captures from frames with closed shutter, 
+ *                          without blocking
+ *
+ * @return                  False if camera is not on, calibration is 
+ *                          already running or FLIR_FLAT_FIELD is not defined
+ *
+ * @note                    Shutter is closed by a queued CCI command. After 
+ *                          FLIR_FLAT_SETTLE_FRAMES frames, the next 
+ *                          FLIR_FLAT_LEARN_FRAMES frames of 
+ *                          flir_capture_image_start() update the table, 
+ *                          pixels that need more correction than 
+ *                          FLIR_FLAT_DEAD_THRESHOLD are marked dead and 
+ *                          shutter is opened again. Frames only count 
+ *                          while captures run. Frames from the command 
+ *                          until FLIR_FLAT_SETTLE_FRAMES after opening are 
+ *                          not usable, look at flir_frame_usable(), that 
+ *                          is around half a second, FFC with its imminent 
+ *                          frames takes a few seconds.
+ */
+bool flir_flat_calibrate()
+{
+#ifdef FLIR_FLAT_FIELD
+    if (power_state != FLIR_POWER_ON || flat_phase != FLAT_IDLE)
+    {
+        return false;
+    }
+
+    flat_phase = FLAT_CLOSING;
+    if (!flir_cci_set32_async(&flat_cmd, 
+                              LEP_CID_SYS_SHUTTER_POSITION, 
+                              LEP_SYS_SHUTTER_POSITION_CLOSED, 
+                              flat_shutter_done))
+    {
+        flat_phase = FLAT_IDLE;
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*!
+ * @brief                   Returns true while flir_flat_calibrate() runs
+ */
+bool flir_flat_calibrating()
+{
+#ifdef FLIR_FLAT_FIELD
+    return flat_phase != FLAT_IDLE;
+#else
+    return false;
+#endif
+}
+
+/*!
+ * @brief                   Sets flat field table back to no correction
+ *
+ * @note                    Call it while no capture is running.
+ */
+void flir_flat_reset()
+{
+#ifdef FLIR_FLAT_FIELD
+    frame_flat_init(&capture_flat, flat_bias, flat_gain, 
+                    FLIR_FRAME_ROWS * FLIR_IMAGE_COLS);
+#endif
+}
+
+#ifdef FLIR_FLAT_FIELD
+/*!
+ * @brief                   Moves calibration on after each frame
+ *
+ * @note                    Called from interrupt after the last packet.
+ *                          Shutter image is a new scene, so reference 
+ *                          mean is dropped before learning.
+ */
+static void flat_frame_done()
+{
+    switch (flat_phase)
+    {
+        case FLAT_SETTLE_CLOSED:
+            if (--flat_frames == 0)
+            {
+                capture_flat.learn_sum = 0;
+                capture_flat.learn_mean = -1;
+                flat_frames = FLIR_FLAT_LEARN_FRAMES;
+                flat_phase = FLAT_LEARNING;
+            }
+            break;
+
+        case FLAT_LEARNING:
+            // Only image captures go through capture_convert_packet()
+            if (!capture_image)
+            {
+                break;
+            }
+            frame_flat_learn_end(&capture_flat);
+            if (--flat_frames == 0)
+            {
+                frame_flat_find_dead(&capture_flat, FLIR_FLAT_DEAD_THRESHOLD);
+                flat_phase = FLAT_OPENING;
+                if (!flir_cci_set32_async(&flat_cmd, 
+                                          LEP_CID_SYS_SHUTTER_POSITION, 
+                                          LEP_SYS_SHUTTER_POSITION_OPEN, 
+                                          flat_shutter_done))
+                {
+                    flat_phase = FLAT_IDLE;
+                }
+            }
+            break;
+
+        case FLAT_SETTLE_OPEN:
+            if (--flat_frames == 0)
+            {
+                flat_phase = FLAT_IDLE;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*!
+ * @brief                   Called from interrupt when shutter command of 
+ *                          calibration is done
+ */
+static void flat_shutter_done(flir_cci_cmd_t * cmd)
+{
+    if (!cmd->ok)
+    {
+        LOG_ERROR("Flat field: shutter command failed\n");
+        flat_phase = FLAT_IDLE;
+        return;
+    }
+
+    flat_frames = FLIR_FLAT_SETTLE_FRAMES;
+    flat_phase = flat_phase == FLAT_CLOSING ? FLAT_SETTLE_CLOSED : 
+                                              FLAT_SETTLE_OPEN;
+}
+#endif
+
+/*!
+ * @brief                   Starts command at the head of the queue
+ */
+static void cci_start(flir_cci_cmd_t * cmd)
+{
+    (void) cmd;
+    cci_state = CCI_WAIT_READY;
+    cci_deadline = millis() + FLIR_BUSY_TIMEOUT;
+    cci_read_reg(LEP_I2C_STATUS_REG, 1);
+}
+
+/*!
+ * @brief                   Ends command at the head of the queue, starts 
+ *                          next one and calls callback
+ */
+static void cci_finish(bool status)
+{
+    flir_cci_cmd_t * cmd = cci_head;
+
+    cmd->ok = status && cmd->result == LEP_OK;
+    shadow_from_cmd(cmd);
+    cci_head = cmd->next;
+    cci_state = CCI_IDLE;
+    if (cci_head)
+    {
+        cci_start(cci_head);
+    }
+
+    if (cmd->callback)
+    {
+        cmd->callback(cmd);
+    }
+}
+
+/*!
+ * @brief                   Writes words into consecutive FLIR registers
  */
-void flir_debug(char* fmt, ...)
+static void cci_write_reg(uint16_t reg, const uint16_t * words, uint8_t num_words)
 {
-#ifdef FLIR_DEBUG
-    va_list args;
-    va_start(args, fmt);
-    printf("FLIR_DEBUG: ");
-    vprintf(fmt, args);
-    va_end(args);
-#endif 
+    cci_tx[0] = reg >> 8;
+    cci_tx[1] = reg & 0xFF;
+    for (uint8_t i = 0; i < num_words; i++)
+    {
+        cci_tx[2 + 2 * i] = words[i] >> 8;
+        cci_tx[3 + 2 * i] = words[i] & 0xFF;
+    }
+
+    cci_xfer.addr = LEP_I2C_DEVICE_ADDRESS;
+    cci_xfer.tx = cci_tx;
+    cci_xfer.tx_len = 2 + 2 * num_words;
+    cci_xfer.rx = NULL;
+    cci_xfer.rx_len = 0;
+    cci_xfer.callback = cci_xfer_done;
+    i2c_async_submit(&cci_xfer);
 }
 
-void flir_print(char* fmt, ...)
+/*!
+ * @brief                   Reads words from consecutive FLIR registers 
+ *                          into cci_rx
+ */
+static void cci_read_reg(uint16_t reg, uint8_t num_words)
 {
-#ifdef FLIR_PRINT
-    va_list args;
-    va_start(args, fmt);
-    printf("FLIR_PRINT: ");
-    vprintf(fmt, args);
-    va_end(args);
-#endif 
+    cci_tx[0] = reg >> 8;
+    cci_tx[1] = reg & 0xFF;
+
+    cci_xfer.addr = LEP_I2C_DEVICE_ADDRESS;
+    cci_xfer.tx = cci_tx;
+    cci_xfer.tx_len = 2;
+    cci_xfer.rx = cci_rx;
+    cci_xfer.rx_len = 2 * num_words;
+    cci_xfer.callback = cci_xfer_done;
+    i2c_async_submit(&cci_xfer);
 }
 
 /*!
- * @brief           Display FLIR serial number
+ * @brief                   Moves CCI state machine after each I2C transfer
  *
- * @note            Function prints fail, if something went wrong
+ * @note                    Called from I2C1 interrupt
  */
-void display_flir_serial()
+static void cci_xfer_done(i2c_xfer_t * xfer, bool status)
 {
-    uint16_t serial_num[4] = {0,0,0,0};
+    (void) xfer;
+    flir_cci_cmd_t * cmd = cci_head;
+    uint16_t type = cmd->cmd_code & LEP_I2C_COMMAND_TYPE_BIT_MASK;
+    uint16_t status_reg = (cci_rx[0] << 8) | cci_rx[1];
 
-    if(get_flir_command(command_code(LEP_CID_SYS_FLIR_SERIAL_NUMBER, 
-                                     LEP_I2C_COMMAND_TYPE_GET), 
-                                     serial_num, 4))
+    if (!status)
     {
-        flir_print("SYS Flir Serial Number: %04X%04X%04X%04X\n", 
-                                              serial_num[3],
-                                              serial_num[2],
-                                              serial_num[1],
-                                              serial_num[0]);
+        cci_finish(false);
+        return;
     }
-    else
+
+    switch (cci_state)
     {
-        flir_print("SYS Flir Serial Number: Fail\n");
+        case CCI_WAIT_READY:
+        case CCI_WAIT_DONE:
+            if (status_reg & LEP_I2C_STATUS_BUSY_BIT_MASK)
+            {
+                if (millis() > cci_deadline)
+                {
+                    cci_finish(false);
+                    return;
+                }
+                cci_read_reg(LEP_I2C_STATUS_REG, 1);
+                return;
+            }
+
+            if (cci_state == CCI_WAIT_DONE)
+            {
+                cmd->result = (LEP_RESULT) (int8_t)
+                              ((status_reg & LEP_I2C_STATUS_ERROR_CODE_BIT_MASK) >>
+                                             LEP_I2C_STATUS_ERROR_CODE_BIT_SHIFT);
+                if (type == LEP_I2C_COMMAND_TYPE_GET && cmd->num_words && 
+                    cmd->result == LEP_OK)
+                {
+                    cci_state = CCI_READ_DATA;
+                    cci_read_reg(LEP_I2C_DATA_0_REG, cmd->num_words);
+                    return;
+                }
+                cci_finish(true);
+                return;
+            }
+
+            if (cmd->num_words && type != LEP_I2C_COMMAND_TYPE_RUN)
+            {
+                uint16_t length = cmd->num_words;
+                cci_state = CCI_DATA_LENGTH;
+                cci_write_reg(LEP_I2C_DATA_LENGTH_REG, &length, 1);
+                return;
+            }
+            cci_state = CCI_COMMAND;
+            cci_write_reg(LEP_I2C_COMMAND_REG, &cmd->cmd_code, 1);
+            return;
+
+        case CCI_DATA_LENGTH:
+            if (type == LEP_I2C_COMMAND_TYPE_SET)
+            {
+                cci_state = CCI_DATA;
+                cci_write_reg(LEP_I2C_DATA_0_REG, cmd->data, cmd->num_words);
+                return;
+            }
+            cci_state = CCI_COMMAND;
+            cci_write_reg(LEP_I2C_COMMAND_REG, &cmd->cmd_code, 1);
+            return;
+
+        case CCI_DATA:
+            cci_state = CCI_COMMAND;
+            cci_write_reg(LEP_I2C_COMMAND_REG, &cmd->cmd_code, 1);
+            return;
+
+        case CCI_COMMAND:
+            cci_state = CCI_WAIT_DONE;
+            cci_deadline = millis() + FLIR_BUSY_TIMEOUT;
+            cci_read_reg(LEP_I2C_STATUS_REG, 1);
+            return;
+
+        case CCI_READ_DATA:
+            for (uint8_t i = 0; i < cmd->num_words; i++)
+            {
+                cmd->data[i] = (cci_rx[2 * i] << 8) | cci_rx[2 * i + 1];
+            }
+            cci_finish(true);
+            return;
+
+        default:
+            return;
     }
 }
 
 /*!
- * @brief                              Function gets current position of shutter
- *
- * @return LEP_SYS_SHUTTER_POSITION    enum defined in flir_defines.h file
- *
- * @note            Function prints fail, if something went wrong
+ * @brief                   Returns shadow slot of the command, -1 if its
+ *                          setting is not kept
  */
-LEP_SYS_SHUTTER_POSITION get_flir_shutter_position()
+static int8_t shadow_slot(uint16_t cmd_code)
 {
-    uint32_t position = 0;
-
-    if(get_flir_command32(command_code(LEP_CID_SYS_SHUTTER_POSITION, 
-                                       LEP_I2C_COMMAND_TYPE_GET), 
-                                       &position))
+    uint16_t id = cmd_code & ~LEP_I2C_COMMAND_TYPE_BIT_MASK;
+    for (int8_t slot = 0; slot < SHADOW_END; slot++)
     {
-        
-        flir_print("Shutter position: %s\n", 
-                shutter_position_str((LEP_SYS_SHUTTER_POSITION) position));
-    }
-    else
-    {
-        flir_print("Shutter position: function failed!\n");
+        if (command_code(shadow_ids[slot], 0) == id)
+        {
+            return slot;
+        }
     }
-    
-    return (LEP_SYS_SHUTTER_POSITION) position;
+    return -1;
 }
 
 /*!
- * @brief               Function sets position of shutter
- *
- * @param[in] position  
+ * @brief                   Returns true and the value if slot is valid
  */
-void set_flir_shutter_position(LEP_SYS_SHUTTER_POSITION position)
-{ 
-    if(!set_flir_command32(command_code(LEP_CID_SYS_SHUTTER_POSITION, 
-                    LEP_I2C_COMMAND_TYPE_SET), (uint32_t) position))
+static bool shadow_known(shadow_slot_e slot, uint32_t * value)
+{
+    bool masked = cm_mask_interrupts(true);
+    bool known = shadow_valid & (1U << slot);
+    if (known)
     {
-        flir_print("Set shutter position : function failed!\n");
+        *value = shadow_values[slot];
     }
+    cm_mask_interrupts(masked);
+    return known;
 }
 
 /*!
- * @brief               Enable or disable AGC processing
- *
- * @param[in] position  If true AGC will be enabled
- *
- * @note                Function prints fail, if something went wrong
+ * @brief                   Sets value of slot, can be called from interrupt
  */
-void set_flir_agc(bool enable)
+static void shadow_store(shadow_slot_e slot, uint32_t value)
 {
-    if(!set_flir_command32(command_code(LEP_CID_AGC_ENABLE_STATE, 
-                                        LEP_I2C_COMMAND_TYPE_SET), 
-                                        (uint32_t) enable))
-    {
-        flir_print("AGC mode: function failed!\n");
-    }
+    bool masked = cm_mask_interrupts(true);
+    shadow_values[slot] = value;
+    shadow_valid |= 1U << slot;
+    cm_mask_interrupts(masked);
 }
 
 /*!
- * @brief   Get current state of AGC mode
+ * @brief                   Invalidates slots, can be called from interrupt
  *
- * @return  True if AGC mode is enabled, otherwise false
- *
- * @note    Function prints fail, if something went wrong
+ * @param[in] slots         Bit of each slot
  */
-bool get_flir_agc()
+static void shadow_forget(uint32_t slots)
 {
-    uint32_t agc_state = 0;
-    if(get_flir_command32(command_code(LEP_CID_AGC_ENABLE_STATE, 
-                                       LEP_I2C_COMMAND_TYPE_GET), 
-                                       &agc_state))
-    {
-        flir_print("AGC mode: %s\n", agc_state ? "On" : "Off"); 
-    }
-    else
-    {
-        flir_print("AGC mode: function failed!\n");
-    }
-    return (bool) agc_state;
+    bool masked = cm_mask_interrupts(true);
+    shadow_valid &= ~slots;
+    cm_mask_interrupts(masked);
 }
 
-
 /*!
- * @brief               Enable or disable AGC processing
- *
- * @param[in] position  If true AGC will be enabled
+ * @brief                   Invalidates all slots after camera boot
  *
- * @note                Function prints fail, if something went wrong
+ * @param[in] defaults      Camera was powered up, settings that it is 
+ *                          known to boot with are valid then
  */
-void set_flir_telemetry(bool enable)
+static void shadow_reset(bool defaults)
 {
-    if(!set_flir_command32(command_code(LEP_CID_SYS_TELEMETRY_ENABLE_STATE, 
-                                        LEP_I2C_COMMAND_TYPE_SET), 
-                                        (uint32_t) enable))
+    shadow_forget((1U << SHADOW_END) - 1);
+    if (!defaults)
     {
-        flir_print("Set Telemetry : function failed!\n");
+        return;
     }
+    shadow_store(SHADOW_AGC, 0);
+    shadow_store(SHADOW_TELEMETRY, 0);
+    shadow_store(SHADOW_GPIO_MODE, LEP_OEM_GPIO_MODE_GPIO);
+    shadow_store(SHADOW_FFC_PERIOD, FLIR_DEFAULT_FFC_PERIOD);
 }
 
 /*!
- * @brief   Get current state of AGC mode
- *
- * @return  True if AGC mode is enabled, otherwise false
+ * @brief                   Updates shadow by command of the queue that 
+ *                          finished, called from interrupt
  *
- * @note    Function prints fail, if something went wrong
+ * @note                    Structures longer than 32 bits are not decoded, 
+ *                          their slots are invalidated. FFC moves shutter.
  */
-bool get_flir_telemetry()
+static void shadow_from_cmd(const flir_cci_cmd_t * cmd)
 {
-    uint32_t telemetry_state = 0;
-    if(get_flir_command32(command_code(LEP_CID_SYS_TELEMETRY_ENABLE_STATE, 
-                                       LEP_I2C_COMMAND_TYPE_GET), 
-                                       &telemetry_state))
+    uint16_t type = cmd->cmd_code & LEP_I2C_COMMAND_TYPE_BIT_MASK;
+    int8_t slot = shadow_slot(cmd->cmd_code);
+
+    if (cmd->cmd_code == command_code(LEP_CID_SYS_RUN_FFC, 
+                                      LEP_I2C_COMMAND_TYPE_RUN))
     {
-        flir_print("Telemetry: %s\n", telemetry_state ? "On" : "Off"); 
+        shadow_forget(1U << SHADOW_SHUTTER);
     }
-    else
+    if (slot < 0 || type == LEP_I2C_COMMAND_TYPE_RUN)
     {
-        flir_print("Telemetry: function failed!\n");
+        return;
     }
-    return (bool) telemetry_state ;
-}
-
-// Frame commands
-bool get_flir_image(uint16_t frame[60][82])
-{
-    state_e state = INIT;
-    uint8_t frame_row = 0;
-    volatile const uint64_t init_delay = 185;  
-    while(1)
+    if (cmd->ok && cmd->num_words == 2 && slot != SHADOW_FFC_PERIOD)
     {
-        switch(state)
-        {
-            case INIT:
-                enable_flir_cs();
-                disable_flir_cs();
-                delay(init_delay);
-                enable_flir_cs();
-                state = OUT_OF_SYNC;
-                break;
-
-            case OUT_OF_SYNC:
-                spi_read16(frame[frame_row], 82);
-
-                if ((frame[frame_row][0] & 0x0F00) == 0x0f00)
-                {
-                    //flir_print("Discard packet detected\n");
-                    //Do nothing for now, you can add later some kind of timeout
-                } 
-                else
-                {
-                    //Not a discard packet
-                    if ((frame[frame_row][0] & 0x00FF) == 0x0)
-                    {
-                        //Start detected, change state so we can start moving this into frame array
-                        frame_row++;
-                        state = READING_FRAME;
-                    }
-                }
-                break;
-
-            case READING_FRAME:
-                spi_read16(frame[frame_row], 82);
-
-                // We should read ID field of each packet to be sure that it is the packet that we want
-                if((frame[frame_row][0] & 0x00FF) == frame_row)
-                {
-                    //flir_print("Match");
-                    frame_row++;
-
-                    if (frame_row == 60)
-                    {
-                        //We got full frame, go to DONE
-                        disable_flir_cs();
-                        state = DONE;
-                    }
-                }
-                else
-                {
-                    //Error getting correct packet ID, this will have to be handeled somehow later
-                    flir_print("ID error\n");
-                    flir_print("Expected frame_row: %d\n", frame_row);
-                    flir_print("What we got:        %d\n", (frame[frame_row][0] & 0x00FF));
-                    disable_flir_cs();
-                    delay(10);
-                    frame_row = 0;
-                    state = INIT;
-                }
-                break;
-
-            case DONE:
-                flir_print("DONE!\n");
-                return true;
-                break;
-        }
+        shadow_store((shadow_slot_e) slot, flir_cci_value32(cmd));
+    }
+    else if (type == LEP_I2C_COMMAND_TYPE_SET)
+    {
+        shadow_forget(1U << slot);
     }
 }
 
 /*!
- * @brief           Prepares FLIR for communication
- *
- *
- * @note            Camera needs atleast 700 ms to boot up after power up.
- */
-void flir_setup()
-{
-    delay(750);
-    set_flir_agc(1);
-    set_flir_telemetry(1);
-
-}
-
-
-/*!
- * @brief                   Sends get command to FLIR module
- *
- * @param[in] cmd_code      Command code to be send, use ones 
- *                          defined in flir_defines.h
- * @param[in] data_words    Copy by reference, result will be copied into it
- * @param[in] num_words     Num of words that will be read
- *
- * @return                  True if everything is ok, otherwise false
+ * @brief                   Blocking get of 32 bit setting, through shadow
  *
- * @note    Procedure implemented as written in Lepton Software Interface 
- *          Description Document rev200.pdf, page 11
+ * @return                  False if command failed
  */
-static bool get_flir_command(uint16_t cmd_code, uint16_t * data_words, uint8_t num_words)
+static bool shadow_get32(shadow_slot_e slot, uint32_t * value)
 {
-    // Read command status register
-    // If not BUSY, write number of data words to read into DATA length reg.
-    if(wait_busy_bit(FLIR_BUSY_TIMEOUT))
+    if (shadow_known(slot, value))
     {
-        // write command ID to command reg
-        // Read command status register
-        if (write_register(LEP_I2C_COMMAND_REG, cmd_code)) 
-        {
-            // Successful wait for Flir to process this
-            if(wait_busy_bit(FLIR_BUSY_TIMEOUT))
-            {
-                // If no timeout, read DATA from DATA regs
-                if(read_data_register(data_words, num_words))
-                {
-                    return true; 
-                }
-            }
-        }
+        counter_add(COUNTER_CCI_CACHED, 1);
+        return true;
     }
-    // Something failed
-    return false;
+    if (!get_flir_command32(command_code(shadow_ids[slot], 
+                                         LEP_I2C_COMMAND_TYPE_GET), value))
+    {
+        return false;
+    }
+    shadow_store(slot, *value);
+    return true;
 }
 
 /*!
- * @brief                   Sends get command to FLIR module
- *
- * @param[in] cmd_code      Command code to be send, use ones 
- *                          defined in flir_defines.h
- * @param[in] data_words    Copy by reference, result will be copied into it
- * @param[in] num_words     Num of words that will be read
- *
- * @return                  True if everything is ok, otherwise false
+ * @brief                   Blocking set of 32 bit setting, it is not sent 
+ *                          if camera has the value already
  *
- * @note    Procedure implemented as written in Lepton Software Interface 
- *          Description Document rev200.pdf, page 11
- *          This seems like unnecessary duplicate of the other set function,
- *          but it will make high level use easier
+ * @return                  False if command failed, slot is unknown then
  */
-static bool get_flir_command32(uint16_t cmd_code, uint32_t * data_long_word)
+static bool shadow_set32(shadow_slot_e slot, uint32_t value)
 {
-    // Read command status register
-    // If not BUSY, write number of data words to read into DATA length reg.
-    if(wait_busy_bit(FLIR_BUSY_TIMEOUT))
+    uint32_t known;
+    if (shadow_known(slot, &known) && known == value)
     {
-        // write command ID to command reg
-        // Read command status register
-        if (write_register(LEP_I2C_COMMAND_REG, cmd_code)) 
-        {
-            // Successful wait for Flir to process this
-            if(wait_busy_bit(FLIR_BUSY_TIMEOUT))
-            {
-                // If no timeout, read DATA from DATA regs
-                if(read_data_register((uint16_t * ) data_long_word, 2))
-                {
-                    return true; 
-                }
-            }
-        }
+        counter_add(COUNTER_CCI_CACHED, 1);
+        return true;
     }
-    // Something failed
-    return false;
+    if (!set_flir_command32(command_code(shadow_ids[slot], 
+                                         LEP_I2C_COMMAND_TYPE_SET), value) || 
+        last_flir_error != LEP_OK)
+    {
+        shadow_forget(1U << slot);
+        return false;
+    }
+    shadow_store(slot, value);
+    return true;
 }
 
-
 /*!
- * @brief                       Sends set command to FLIR module
- *
- * @param[in] cmd_code          Command code to be send, use the ones 
- *                              defined in flir_defines.h
- * @param[in] data_long_word    Copy by value
- * @param[in] num_words         Num of words that will be read
- *
- * @return                      True if everything is ok, otherwise false
+ * @brief                   Returns true if camera was powered up with the 
+ *                          board, so it has the defaults of power up
  *
- * @note    Procedure implemented as written in Lepton Software Interface 
- *          Description Document rev200.pdf, page 12
- *          This seems like unnecessary duplicate of the other set function,
- *          but it will make high level use easier
+ * @note                    PWR_DWN_L is pulled up since reset, reset of the 
+ *                          MCU alone does not reboot the camera. Camera 
+ *                          uptime is then longer than the one of the MCU.
  */
-static bool set_flir_command32(uint16_t cmd_code, uint32_t data_long_word)
+static bool camera_fresh()
 {
-    // Read command status register
-    // If not BUSY, write number of data words to read into DATA length reg.
-    if (wait_busy_bit(FLIR_BUSY_TIMEOUT))
-    {
-        // write command ID to command reg
-        // Read command status register
-        if (write_command_register(cmd_code, (uint16_t *) &data_long_word, 2))
-        {
-            // Successful wait for Flir to process this
-            if (wait_busy_bit(FLIR_BUSY_TIMEOUT))
-            {
-                return true; 
-            }
-        }
-    }
-
-    // Something failed
-    return false;
+    uint32_t uptime_ms = 0;
+    return get_flir_command32(command_code(LEP_CID_SYS_CAM_UPTIME, 
+                                           LEP_I2C_COMMAND_TYPE_GET), 
+                              &uptime_ms) && 
+           uptime_ms <= millis();
 }
 
 /*!
@@ -429,7 +2692,8 @@ static bool set_flir_command32(uint16_t cmd_code, uint32_t data_long_word)
  */
 static uint16_t command_code(uint16_t cmd_id, uint16_t cmd_type) 
 {
-    return (cmd_id & LEP_I2C_COMMAND_MODULE_ID_BIT_MASK) | 
+    return (cmd_id & LEP_I2C_COMMAND_PROTECTION_BIT_MASK) | 
+           (cmd_id & LEP_I2C_COMMAND_MODULE_ID_BIT_MASK) | 
            (cmd_id & LEP_I2C_COMMAND_ID_BIT_MASK) | 
            (cmd_type & LEP_I2C_COMMAND_TYPE_BIT_MASK);
 }
@@ -537,12 +2801,8 @@ static bool write_register(uint16_t reg_address, uint16_t value)
  */
 static bool read_register(uint16_t reg_address, uint16_t * value)
 {
-    if (!i2c_write16(LEP_I2C_DEVICE_ADDRESS, reg_address))
-    {
-        return false;
-    }
-
-    return i2c_read16(LEP_I2C_DEVICE_ADDRESS, value);
+    // Address and value in one transaction, with repeated start
+    return i2c_read16_reg(LEP_I2C_DEVICE_ADDRESS, reg_address, value, 1);
 }
 
 /*!
@@ -615,8 +2875,16 @@ static bool write_command_register(uint16_t cmd_code,
  */
 static bool read_data_register(uint16_t * read_words, uint8_t max_length)
 {
-    // Point to data length reg
-    if(!i2c_write16(LEP_I2C_DEVICE_ADDRESS, LEP_I2C_DATA_LENGTH_REG))
+    // DATA length register is right before DATA 0, one transaction reads
+    // both, register address auto increments
+    uint16_t words[1 + FLIR_CCI_MAX_WORDS];
+    if (max_length > FLIR_CCI_MAX_WORDS)
+    {
+        return false;
+    }
+
+    if (!i2c_read16_reg(LEP_I2C_DEVICE_ADDRESS, LEP_I2C_DATA_LENGTH_REG, 
+                        words, 1 + max_length))
     {
         // Something went wrong
         return false;
@@ -630,12 +2898,7 @@ static bool read_data_register(uint16_t * read_words, uint8_t max_length)
     // Serial number we are expecting DATA length to throw us number 16 as 
     // per datasheet, BUT we get 32. So it seems that we will be using number 
     // of bytes instead.  
-    uint16_t num_bytes = 0;
-    if (!i2c_read16(LEP_I2C_DEVICE_ADDRESS, &num_bytes))
-    {
-        // Something went wrong
-        return false;
-    }
+    uint16_t num_bytes = words[0];
     
     // Error handling
     if (0 == num_bytes)
@@ -649,12 +2912,10 @@ static bool read_data_register(uint16_t * read_words, uint8_t max_length)
         return false;
     }
 
-
-    if (!i2c_read16_array(LEP_I2C_DEVICE_ADDRESS, read_words, max_length))
+    for (uint8_t i = 0; i < max_length; i++)
     {
-        return false;
+        read_words[i] = words[1 + i];
     }
-
     return true;
 }
 
@@ -710,10 +2971,13 @@ static const char * shutter_position_str(LEP_SYS_SHUTTER_POSITION position)
 
 /*!
  * @brief               Enables chip select line for FLIR, pulls it down
+ *
+ * @note                Waits for a transfer of another device on SPI1,
+ *                      see spi_bus.c
  */
 void enable_flir_cs()
 {
-    gpio_clear(GPIOB, GPIO4);
+    spi_bus_acquire(&spi_flir);
 }
 
 /*!
@@ -721,5 +2985,5 @@ void enable_flir_cs()
  */
 void disable_flir_cs()
 {
-    gpio_set(GPIOB, GPIO4);
+    spi_bus_release(&spi_flir);
 }
@@ -7,41 +7,302 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "flir_defines.h"
+#include "frame_stats.h"
+#include "system_setup/sdram.h"
 
 #define FLIR_BUSY_TIMEOUT (5000)
 
+// CCI clock, Lepton takes up to 1 MHz, other slaves of I2C1 keep 
+// I2C_DEFAULT_SPEED, look at system_setup/i2c_timing.h
+#define FLIR_I2C_SPEED      I2C_SPEED_FAST_PLUS
+
+// Define for Lepton 3.x, 160x120 frames come in four segments of VoSPI 
+// packets, Lepton 2.x sends 80x60 frames in one segment. Geometry is fixed 
+// at compile time, capture has the same code and constant bounds for both.
+//#define FLIR_LEPTON3
+
+// VoSPI frame geometry, one packet is ID word, CRC word and 80 pixels, a 
+// row of Lepton 2.x or half a row of Lepton 3.x. Packets of a frame are 
+// numbered across segments, pixels of packet p start at p * 80 in the 
+// frame for both sensors.
+#define FLIR_PACKET_WORDS   (82)
+#define FLIR_PACKET_PIXELS  (80)
+#ifdef FLIR_LEPTON3
+#define FLIR_SEGMENTS       (4)
+#define FLIR_FRAME_ROWS     (120)
+#define FLIR_IMAGE_COLS     (160)
+// Telemetry adds two lines of 160 words to the frame, row A comes first
+#define FLIR_TELEMETRY_PACKETS  (4)
+#else
+#define FLIR_SEGMENTS       (1)
+#define FLIR_FRAME_ROWS     (60)
+#define FLIR_IMAGE_COLS     (80)
+// Only row A is read, rows B and C are passed over as tail of the frame
+#define FLIR_TELEMETRY_PACKETS  (1)
+#endif
+#define FLIR_FRAME_PACKETS  (FLIR_FRAME_ROWS * FLIR_IMAGE_COLS / FLIR_PACKET_PIXELS)
+#define FLIR_SEGMENT_PACKETS    (FLIR_FRAME_PACKETS / FLIR_SEGMENTS)
+// Packet of a segment whose ID has the segment number in bits 14:12
+#define FLIR_SEGMENT_ID_PACKET  (20)
+
+// How long CS has to be kept high for Lepton to resynchronise, in ms
+#define FLIR_RESYNC_DELAY   (185)
+
+// VoSPI packet ID, discard packets have xFxx ID
+#define FLIR_DISCARD_MASK       (0x0F00)
+#define FLIR_PACKET_NUMBER_MASK (0x0FFF)
+// Packets of a segment and up to three telemetry rows
+#define FLIR_MAX_PACKETS        (FLIR_SEGMENT_PACKETS + 3)
+
+// Packets that can be skipped while waiting for first packet of a frame,
+// Lepton sends discard packets between frames, this is a few frame 
+// periods at 13.5 MHz SPI clock. After that CS is deasserted for 
+// FLIR_RESYNC_DELAY.
+#define FLIR_MAX_DISCARDS       (1500)
+
+// Frames that can fail in a row on a bad packet, before CS is deasserted
+#define FLIR_MAX_SOFT_RESYNCS   (3)
+
+// Define to check CRC of every packet, bad frame is dropped
+#define FLIR_CHECK_CRC
+
+// Define to turn AGC off in flir_setup(), pixels are then raw 14 bit 
+// values that keep absolute temperature, use FLIR_FRAME_RAW16 frames and 
+// normalise them, look at shared/frame_normalize.h
+//#define FLIR_RADIOMETRIC
+
+// Define to correct fixed pattern noise of flir_capture_image_start() 
+// frames with the per pixel table of shared/frame_flatfield.h, in the same 
+// pass as the int8 conversion. Table is learnt from a few frames with the 
+// shutter closed, look at flir_flat_calibrate(), which costs fewer frames 
+// than FFC, so automatic FFC of Lepton runs only every FLIR_FLAT_FFC_PERIOD.
+#define FLIR_FLAT_FIELD
+// Frames after each shutter move that are not used
+#define FLIR_FLAT_SETTLE_FRAMES     (3)
+// Frames that are learnt, Lepton sends each new frame three times
+#define FLIR_FLAT_LEARN_FRAMES      (9)
+// Pixel is dead if its bias is further from no correction, in 8 bit counts
+#define FLIR_FLAT_DEAD_THRESHOLD    (48)
+// Automatic FFC period while table is used
+#define FLIR_FLAT_FFC_PERIOD        (900000)
+// Automatic FFC period of Lepton after power up, 5 minutes
+#define FLIR_DEFAULT_FFC_PERIOD     (300000)
+
+#if defined(FLIR_FLAT_FIELD) && defined(FLIR_RADIOMETRIC)
+#error "FLIR_FLAT_FIELD corrects AGC frames, it can not be used with FLIR_RADIOMETRIC"
+#endif
+
+// Define to start reading each frame on VSYNC pulse of Lepton GPIO3, 
+// instead of reading discard packets until the first packet comes. 
+// GPIO3 has to be wired to FLIR_VSYNC_PORT/PIN, look at set_flir_vsync().
+//#define FLIR_VSYNC
+#define FLIR_VSYNC_PORT         GPIOC
+#define FLIR_VSYNC_PORT_RCC     RCC_GPIOC
+#define FLIR_VSYNC_PIN          GPIO3   // A2 on Arduino header of Nucleo
+#define FLIR_VSYNC_EXTI         EXTI3
+#define FLIR_VSYNC_IRQ          NVIC_EXTI3_IRQ
+// Missing pulses for this long turn VSYNC off, about three frames, in ms
+#define FLIR_VSYNC_TIMEOUT      (120)
+
+// PWR_DWN_L of the Lepton breakout, low powers the camera down, look at
+// flir_power_down(). Without the wire camera just keeps running. PC0 is
+// SDNWE with EXT_SDRAM of sdram.h, carrier board wires it to PA3 then.
+#ifdef EXT_SDRAM
+#define FLIR_PWR_DWN_PORT       GPIOA
+#define FLIR_PWR_DWN_PORT_RCC   RCC_GPIOA
+#define FLIR_PWR_DWN_PIN        GPIO3   // A0 on Arduino header of Nucleo
+#else
+#define FLIR_PWR_DWN_PORT       GPIOC
+#define FLIR_PWR_DWN_PORT_RCC   RCC_GPIOC
+#define FLIR_PWR_DWN_PIN        GPIO0   // A1 on Arduino header of Nucleo
+#endif
+// Boot after power up, look at flir_wait_ready(). Status register is not
+// read before FLIR_BOOT_MIN_MS, camera does not answer CCI that early.
+#define FLIR_BOOT_MIN_MS        (300)
+#define FLIR_BOOT_POLL_MS       (10)
+#define FLIR_BOOT_TIMEOUT       (2000)
+
+typedef enum
+{
+    FLIR_POWER_DOWN,        // Standby, PWR_DWN_L is held low
+    FLIR_POWER_BOOTING,     // Released, flir_wait_ready() not done yet
+    FLIR_POWER_ON,          // Booted and configured
+} flir_power_e;
+
 typedef enum 
 {
     INIT,
+    WAIT_VSYNC,
     OUT_OF_SYNC,
     READING_FRAME,
     DONE
 }state_e;
 
+// Counters of the capture engine, look at capture_packet_done()
+typedef struct
+{
+    uint32_t frames;
+    uint32_t crc_errors;
+    uint32_t id_errors;
+    uint32_t soft_resyncs;
+    uint32_t hard_resyncs;
+    uint32_t duplicates;        // Repeated frames, look at flir_frame_usable()
+    uint32_t ffc_frames;        // Frames during flat field correction
+    uint32_t flat_frames;       // Frames of flir_flat_calibrate()
+    uint32_t dropped;           // Stream frames lost on full queue
+    uint32_t vsync_timeouts;    // VSYNC did not come, look at set_flir_vsync()
+}flir_capture_stats_t;
+
+// FFC state from telemetry status bits
+typedef enum
+{
+    FLIR_FFC_NEVER,
+    FLIR_FFC_IMMINENT,
+    FLIR_FFC_IN_PROGRESS,
+    FLIR_FFC_DONE,
+}flir_ffc_state_e;
+
+// Decoded telemetry row A of a frame
+typedef struct
+{
+    bool valid;
+    uint32_t time_ms;           // Camera uptime
+    uint32_t status;            // Raw status bits
+    uint32_t frame_counter;
+    uint16_t frame_mean;
+    uint16_t fpa_temp_k100;     // FPA temperature in 0.01 K
+    uint16_t housing_temp_k100; // Housing temperature in 0.01 K
+    flir_ffc_state_e ffc_state;
+    bool ffc_desired;
+    bool flat_calibration;      // Shutter was moved by flir_flat_calibrate()
+}flir_telemetry_t;
+
+// Time of a frame in micros(), DWT based and continuous across clock 
+// changes, taken in the capture interrupt
+typedef struct
+{
+    uint64_t first_us;          // First packet of the frame arrived
+    uint64_t complete_us;       // Last packet of the frame arrived
+}flir_timestamp_t;
+
+// Non-blocking CCI command, look at flir_cci_submit()
+#define FLIR_CCI_MAX_WORDS      (16)    // Only DATA 0-15 registers are used
+
+typedef struct flir_cci_cmd flir_cci_cmd_t;
+typedef void (*flir_cci_callback)(flir_cci_cmd_t * cmd);
+
+struct flir_cci_cmd
+{
+    uint16_t cmd_code;          // Command ID with type, use command types
+    uint16_t data[FLIR_CCI_MAX_WORDS];  // Written for set, read for get
+    uint8_t num_words;
+    flir_cci_callback callback; // Called from interrupt, can be NULL
+
+    // Filled by the engine
+    bool ok;                    // I2C succeeded and FLIR returned LEP_OK
+    LEP_RESULT result;
+    flir_cci_cmd_t * next;
+};
 
-// Debug options
-// FLIR_DEBUG macro is used for debugging purposes, tracing path of functions
-// and other problems. It is normally undefined
-// FLIR_PRINT is used to display some data about FLIR, like serial number,
-// current settings, etc. It is normally defined
-#define FLIR_DEBUG
-#define FLIR_PRINT
+// One setting of flir_set32_batch()
+typedef struct
+{
+    uint16_t cmd_id;            // Like LEP_CID_AGC_ENABLE_STATE
+    uint32_t value;
+}flir_set32_t;
+
+// Repeated or FFC frames that can be skipped in a row, before a frame is 
+// used anyway, around one second
+#define FLIR_MAX_SKIPPED_FRAMES (27)
+
+// Most frame buffers of continuous capture, look at flir_stream_start()
+#define FLIR_STREAM_MAX_DEPTH   (4)
+
+// Frame buffer formats
+typedef enum
+{
+    FLIR_FRAME_RAW16,   // uint16_t [FLIR_FRAME_PACKETS][FLIR_PACKET_WORDS]
+    FLIR_FRAME_AGC8,    // uint8_t [FLIR_FRAME_ROWS][FLIR_IMAGE_COLS], AGC on
+}flir_frame_format_e;
+
+
+// Debug output goes through shared/log.h with "FLIR" tag. Settings, like
+// serial number, are LOG_INFO, failures LOG_ERROR, per frame messages
+// LOG_DEBUG, so they are not compiled in unless LOG_LEVEL=4.
 
 //Frame commands
 void flir_setup();
-bool get_flir_image(uint16_t frame[60][82]);
+void flir_power_down();
+void flir_power_up_start();
+bool flir_wait_ready();
+bool flir_power_up();
+flir_power_e flir_power_state();
+bool get_flir_image(uint16_t frame[FLIR_FRAME_PACKETS][FLIR_PACKET_WORDS]);
+bool flir_capture_start(uint16_t frame[FLIR_FRAME_PACKETS][FLIR_PACKET_WORDS]);
+bool flir_capture_frame8_start(uint8_t frame[FLIR_FRAME_ROWS][FLIR_IMAGE_COLS]);
+bool flir_capture_image_start(int8_t * image);
+bool flir_capture_poll();
+bool flir_capture_needs_poll();
+uint32_t flir_capture_poll_delay();
+bool flir_capture_wait();
+uint8_t flir_capture_image_rows(uint32_t * round);
+const flir_capture_stats_t * flir_capture_get_stats();
+bool flir_get_frame_telemetry(flir_telemetry_t * data);
+bool flir_get_frame_timestamp(flir_timestamp_t * stamp);
+bool flir_frame_usable();
+const frame_stats_t * flir_get_frame_stats();
+
+// Continuous capture into a queue of frames
+bool flir_stream_start(void * frames, 
+                       uint8_t depth, 
+                       flir_frame_format_e format, 
+                       bool usable_only);
+void flir_stream_stop();
+bool flir_stream_running();
+uint8_t flir_stream_pending();
+void * flir_stream_peek(flir_telemetry_t * data);
+void * flir_stream_wait(flir_telemetry_t * data);
+bool flir_stream_timestamp(flir_timestamp_t * stamp);
+const frame_stats_t * flir_stream_stats();
+void flir_stream_release();
+
+// Non-blocking command and control interface
+bool flir_cci_submit(flir_cci_cmd_t * cmd);
+bool flir_cci_busy();
+bool flir_cci_set32_async(flir_cci_cmd_t * cmd, 
+                          uint16_t cmd_id, 
+                          uint32_t value, 
+                          flir_cci_callback callback);
+bool flir_cci_get32_async(flir_cci_cmd_t * cmd, 
+                          uint16_t cmd_id, 
+                          flir_cci_callback callback);
+bool flir_cci_run_async(flir_cci_cmd_t * cmd, 
+                        uint16_t cmd_id, 
+                        flir_cci_callback callback);
+uint32_t flir_cci_value32(const flir_cci_cmd_t * cmd);
+bool flir_run_ffc_async(flir_cci_callback callback);
+bool flir_set32_batch(const flir_set32_t * sets, uint8_t count);
+
+// Flat field correction table of image captures, look at FLIR_FLAT_FIELD
+bool flir_flat_calibrate();
+bool flir_flat_calibrating();
+void flir_flat_reset();
 
 //General settings, set and get functions
 void display_flir_serial();
 
 LEP_SYS_SHUTTER_POSITION get_flir_shutter_position();
 void set_flir_shutter_position(LEP_SYS_SHUTTER_POSITION position);
+bool set_flir_ffc_period(uint32_t period_ms);
 
 void set_flir_agc(bool enable);
 bool get_flir_agc();
 
 void set_flir_telemetry(bool enable);
+void set_flir_telemetry_location(LEP_SYS_TELEMETRY_LOCATION location);
+bool set_flir_vsync(bool enable);
 bool get_flir_telemetry();
 
 // Low level commands
@@ -64,6 +64,7 @@ extern "C" {
 #define LEP_I2C_DEVICE_ADDRESS                  (uint8_t)0x2A
 
 #define LEP_I2C_COMMAND_MODULE_ID_BIT_MASK      (uint16_t)0x0F00
+#define LEP_I2C_COMMAND_PROTECTION_BIT_MASK     (uint16_t)0x4000
 #define LEP_I2C_COMMAND_ID_BIT_MASK             (uint16_t)0x00FC
 #define LEP_I2C_COMMAND_TYPE_BIT_MASK           (uint16_t)0x0003
 
@@ -254,6 +255,21 @@ typedef enum {
 } LEP_SYS_FFC_STATUS;
 
 
+#define LEP_OEM_MODULE_BASE                     (uint16_t)0x4800
+#define LEP_CID_OEM_POWER_DOWN                  (uint16_t)(LEP_OEM_MODULE_BASE + 0x0000)
+#define LEP_CID_OEM_GPIO_MODE_SELECT            (uint16_t)(LEP_OEM_MODULE_BASE + 0x0054)
+#define LEP_CID_OEM_GPIO_VSYNC_PHASE_DELAY      (uint16_t)(LEP_OEM_MODULE_BASE + 0x0058)
+
+typedef enum {
+    LEP_OEM_GPIO_MODE_GPIO = 0,
+    LEP_OEM_GPIO_MODE_I2C_MASTER = 1,
+    LEP_OEM_GPIO_MODE_SPI_MASTER_VLB_DATA = 2,
+    LEP_OEM_GPIO_MODE_SPIO_MASTER_REG_DATA = 3,
+    LEP_OEM_GPIO_MODE_SPI_SLAVE_VLB_DATA = 4,
+    LEP_OEM_GPIO_MODE_VSYNC = 5
+} LEP_OEM_GPIO_MODE;
+
+
 #define LEP_VID_MODULE_BASE                     (uint16_t)0x0300
 #define LEP_CID_VID_POLARITY_SELECT             (uint16_t)(LEP_VID_MODULE_BASE + 0x0000)
 #define LEP_CID_VID_LUT_SELECT                  (uint16_t)(LEP_VID_MODULE_BASE + 0x0004)
@@ -0,0 +1,631 @@
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/spi.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
+#include "system_setup/utility.h"
+#include "system_setup/sys_init.h"
+#include "system_setup/dma_buf.h"
+#include "system_setup/events.h"
+#include "system_setup/crc_hw.h"
+#include "system_setup/periph_clock.h"
+#include "printf.h"
+#include "flir_port.h"
+
+#ifdef FLIR_SECOND
+
+#ifndef FLIR_RADIOMETRIC
+#error "FLIR_SECOND sends raw frames, it needs FLIR_RADIOMETRIC"
+#endif
+#ifdef FLIR_LEPTON3
+#error "FLIR_SECOND reads one segment frames of Lepton 2.x"
+#endif
+#ifdef DCMI_CAMERA
+#error "FLIR_SECOND takes PC11, D4 of DCMI_CAMERA"
+#endif
+
+/* Explanation: every Lepton on a port has its own SPI and its own pair of
+ * DMA streams, so frames of all of them are read at the same time and
+ * none waits for the bus of another. The port is the same engine as
+ * capture of flir.c without CCI: RX stream interrupt checks the packet
+ * that just arrived, starts the next one straight into the next row of
+ * the frame buffer and adds the row to the pixel statistics, so the core
+ * runs one short interrupt per packet for each camera. TX stream only
+ * clocks out dummy words, clock stops by itself after the last one.
+ *
+ * Packet 0 after discard packets starts a frame, a wrong number or a bad
+ * CRC drops it and waits for the next packet 0 without deselecting, too
+ * many discard packets or a DMA error deselect the camera for
+ * FLIR_RESYNC_DELAY on a soft timer. Without telemetry repeated frames
+ * of Lepton 2.x are found by the pixel statistics, a frame with the same
+ * sum, minimum and maximum as the last queued one is read again into the
+ * same buffer, as frames of the stream of flir.c during FFC.
+ *
+ * Queue works as the one of flir_stream_start(), head is moved only by
+ * the interrupt and tail only by the consumer. When all buffers are queued
+ * the frame is read into scratch and counted as dropped, camera stays in
+ * sync. RX interrupt of every port is on IRQ_PRIO_CAPTURE next to SPI1,
+ * they do not preempt each other, so CRC unit is never used twice. SPI3
+ * is on APB1, SCK is the fastest under SPI1_MAX_HZ of the current APB1
+ * clock, taken before each packet.
+ *
+ * Second camera is SPI3 with DMA1 stream 2 (RX) and stream 7 (TX), both
+ * channel 0. SPI2 has I2S of mic_i2s.c and its only RX stream, DMA1
+ * stream 3. Stop the stream before STOP, as the one of the Lepton.
+ * */
+
+#define FLIR_PORT_FRAME_BYTES   (FLIR_FRAME_PACKETS * FLIR_PACKET_WORDS * 2)
+#define FLIR_PORT_DMA_FLAGS     (DMA_TCIF | DMA_HTIF | DMA_TEIF | DMA_DMEIF | \
+                                 DMA_FEIF)
+#define SPI_CR1_BR_SHIFT        3
+#define SPI_CR1_BR_MASK         (0x7 << SPI_CR1_BR_SHIFT)
+
+static const flir_port_config_t second_config =
+{
+    .name = "FLIR2",
+    .spi = SPI3,
+    .spi_rcc = RCC_SPI3,
+    .spi_rst = RST_SPI3,
+    .dma = DMA1,
+    .dma_rcc = RCC_DMA1,
+    .rx_stream = DMA_STREAM2,
+    .tx_stream = DMA_STREAM7,
+    .dma_channel = DMA_SxCR_CHSEL_0,
+    .rx_irq = NVIC_DMA1_STREAM2_IRQ,
+    .pins_port = FLIR_SECOND_PINS_PORT,
+    .pins_rcc = FLIR_SECOND_PINS_RCC,
+    .sck_pin = FLIR_SECOND_SCK_PIN,
+    .miso_pin = FLIR_SECOND_MISO_PIN,
+    .af = GPIO_AF6,
+    .cs_port = FLIR_SECOND_CS_PORT,
+    .cs_rcc = FLIR_SECOND_CS_RCC,
+    .cs_pin = FLIR_SECOND_CS_PIN,
+};
+
+// Packets of frames that the stream drops
+static uint16_t second_scratch[DMA_BUF_ROUND(FLIR_PACKET_WORDS * 2) / 2]
+    DMA_BUFFER;
+
+flir_port_t flir_second =
+{
+    .config = &second_config,
+    .scratch = second_scratch,
+};
+
+static void port_read(flir_port_t * port);
+static void port_wait_first(flir_port_t * port);
+static void port_deselect(flir_port_t * port);
+static void port_resync(flir_port_t * port);
+static void port_resync_done(soft_timer_t * timer);
+static void port_select(flir_port_t * port);
+static void port_push(flir_port_t * port);
+static uint8_t port_next(const flir_port_t * port, uint8_t index);
+
+/*!
+ * @brief           Sets up pins of the port and deselects the camera
+ *
+ * @note            Call before flir_setup(), Lepton boots with CS high,
+ *                  like the SS pin of SPI1 in gpio_setup().
+ */
+void flir_port_setup(flir_port_t * port)
+{
+    const flir_port_config_t * config = port->config;
+
+    rcc_periph_clock_enable(config->cs_rcc);
+    gpio_set(config->cs_port, config->cs_pin);
+    gpio_mode_setup(config->cs_port, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE,
+                    config->cs_pin);
+    gpio_set_output_options(config->cs_port, GPIO_OTYPE_PP,
+                            GPIO_OSPEED_25MHZ, config->cs_pin);
+
+    rcc_periph_clock_enable(config->pins_rcc);
+    gpio_set_af(config->pins_port, config->af,
+                config->sck_pin | config->miso_pin);
+    gpio_mode_setup(config->pins_port, GPIO_MODE_AF, GPIO_PUPD_NONE,
+                    config->sck_pin | config->miso_pin);
+    gpio_set_output_options(config->pins_port, GPIO_OTYPE_PP,
+                            GPIO_OSPEED_25MHZ, config->sck_pin);
+
+    port->state = FLIR_PORT_IDLE;
+    port->timer.callback = port_resync_done;
+    port->timer.context = port;
+}
+
+/*!
+ * @brief   Returns SPI_CR1 BR value of the fastest SCK the Lepton takes
+ *
+ * @note    BR value n divides APB1 clock by 2^(n + 1)
+ */
+static uint8_t port_prescaler()
+{
+    uint8_t prescaler = 0;
+    while (prescaler < 7 &&
+           rcc_apb1_frequency / (2U << prescaler) > SPI1_MAX_HZ)
+    {
+        prescaler++;
+    }
+    return prescaler;
+}
+
+/*!
+ * @brief           Sets up SPI and DMA streams of the port and starts
+ *                  continuous capture
+ *
+ * @param[in] frames    depth buffers of FLIR_FRAME_RAW16 frames, aligned
+ *                      and padded as DMA_BUFFER
+ * @param[in] depth     Number of frames, 2 up to FLIR_PORT_STREAM_MAX_DEPTH
+ *
+ * @return          False if the stream already runs
+ *
+ * @note            Camera is deselected for FLIR_RESYNC_DELAY first, its
+ *                  state after boot is not known. Frames are taken with
+ *                  flir_port_stream_peek() and given back with
+ *                  flir_port_stream_release().
+ */
+bool flir_port_stream_start(flir_port_t * port, void * frames, uint8_t depth)
+{
+    const flir_port_config_t * config = port->config;
+    if (port->on || depth < 2 || depth > FLIR_PORT_STREAM_MAX_DEPTH)
+    {
+        return false;
+    }
+
+    periph_clock_acquire(config->spi_rcc);
+    periph_clock_acquire(config->dma_rcc);
+    rcc_periph_reset_pulse(config->spi_rst);
+
+    // Same mode as SPI1, CPOL = 1, CPHA = 1, 16 bit frames
+    spi_init_master(config->spi,
+                    SPI_CR1_BAUDRATE_FPCLK_DIV_8,
+                    SPI_CR1_CPOL_CLK_TO_1_WHEN_IDLE,
+                    SPI_CR1_CPHA_CLK_TRANSITION_2,
+                    SPI_CR1_MSBFIRST);
+    spi_enable_software_slave_management(config->spi);
+    spi_set_nss_high(config->spi);
+    spi_set_data_size(config->spi, SPI_CR2_DS_16BIT);
+    spi_set_baudrate_prescaler(config->spi, port_prescaler());
+    spi_enable(config->spi);
+
+    uint32_t dma = config->dma;
+    dma_stream_reset(dma, config->rx_stream);
+    dma_channel_select(dma, config->rx_stream, config->dma_channel);
+    dma_set_priority(dma, config->rx_stream, DMA_SxCR_PL_VERY_HIGH);
+    dma_set_transfer_mode(dma, config->rx_stream,
+                          DMA_SxCR_DIR_PERIPHERAL_TO_MEM);
+    dma_set_peripheral_address(dma, config->rx_stream,
+                               (uint32_t) &SPI_DR(config->spi));
+    dma_set_peripheral_size(dma, config->rx_stream, DMA_SxCR_PSIZE_16BIT);
+    dma_set_memory_size(dma, config->rx_stream, DMA_SxCR_MSIZE_16BIT);
+    dma_enable_memory_increment_mode(dma, config->rx_stream);
+    dma_enable_transfer_complete_interrupt(dma, config->rx_stream);
+    dma_enable_transfer_error_interrupt(dma, config->rx_stream);
+
+    dma_stream_reset(dma, config->tx_stream);
+    dma_channel_select(dma, config->tx_stream, config->dma_channel);
+    dma_set_priority(dma, config->tx_stream, DMA_SxCR_PL_HIGH);
+    dma_set_transfer_mode(dma, config->tx_stream,
+                          DMA_SxCR_DIR_MEM_TO_PERIPHERAL);
+    dma_set_peripheral_address(dma, config->tx_stream,
+                               (uint32_t) &SPI_DR(config->spi));
+    dma_set_peripheral_size(dma, config->tx_stream, DMA_SxCR_PSIZE_16BIT);
+    dma_set_memory_size(dma, config->tx_stream, DMA_SxCR_MSIZE_16BIT);
+    dma_disable_memory_increment_mode(dma, config->tx_stream);
+    dma_set_memory_address(dma, config->tx_stream,
+                           (uint32_t) &port->tx_fill);
+
+    port->frames = frames;
+    port->depth = depth;
+    port->head = 0;
+    port->tail = 0;
+    port->duplicates = 0;
+    port->last_sum = 0;
+    port->last_min = 0;
+    port->last_max = 0;
+    port->tx_fill = 0;
+    frame_stats_init(&port->pixel_stats, 16383);
+
+    bool masked = cm_mask_interrupts(true);
+    port->on = true;
+    port_select(port);
+    nvic_enable_irq(config->rx_irq);
+    port_deselect(port);
+    cm_mask_interrupts(masked);
+    return true;
+}
+
+/*!
+ * @brief           Stops continuous capture at once, frame that is being
+ *                  read is lost
+ *
+ * @note            Frames that are still queued can be taken. Buffers can
+ *                  be used for something else once it returns.
+ */
+void flir_port_stream_stop(flir_port_t * port)
+{
+    const flir_port_config_t * config = port->config;
+    if (!port->on)
+    {
+        return;
+    }
+
+    bool masked = cm_mask_interrupts(true);
+    port->on = false;
+    port->state = FLIR_PORT_IDLE;
+    soft_timer_stop(&port->timer);
+    nvic_disable_irq(config->rx_irq);
+    dma_disable_stream(config->dma, config->rx_stream);
+    dma_disable_stream(config->dma, config->tx_stream);
+    while ((DMA_SCR(config->dma, config->rx_stream) & DMA_SxCR_EN) ||
+           (DMA_SCR(config->dma, config->tx_stream) & DMA_SxCR_EN));
+    spi_disable_tx_dma(config->spi);
+    spi_disable_rx_dma(config->spi);
+    gpio_set(config->cs_port, config->cs_pin);
+    cm_mask_interrupts(masked);
+
+    periph_clock_release(config->dma_rcc);
+    periph_clock_release(config->spi_rcc);
+}
+
+/*!
+ * @brief           Returns number of queued frames, including the one that
+ *                  consumer is using
+ */
+uint8_t flir_port_stream_pending(const flir_port_t * port)
+{
+    uint8_t head = port->head;
+    uint8_t tail = port->tail;
+    return head >= tail ? head - tail : head + 2 * port->depth - tail;
+}
+
+/*!
+ * @brief           Returns the oldest queued frame, without removing it
+ *
+ * @return          FLIR_FRAME_RAW16 frame, NULL if queue is empty
+ *
+ * @note            Frame is not written until flir_port_stream_release().
+ */
+void * flir_port_stream_peek(const flir_port_t * port)
+{
+    uint8_t tail = port->tail;
+    if (port->head == tail)
+    {
+        return NULL;
+    }
+    return port->frames + (tail % port->depth) * FLIR_PORT_FRAME_BYTES;
+}
+
+/*!
+ * @brief           Copies arrival times of the oldest queued frame
+ *
+ * @return          False if queue is empty
+ */
+bool flir_port_stream_timestamp(const flir_port_t * port,
+                                flir_timestamp_t * stamp)
+{
+    uint8_t tail = port->tail;
+    if (port->head == tail)
+    {
+        return false;
+    }
+    *stamp = port->times[tail % port->depth];
+    return true;
+}
+
+/*!
+ * @brief           Returns pixel statistics of the oldest queued frame,
+ *                  as flir_stream_stats()
+ *
+ * @return          NULL if queue is empty
+ */
+const frame_stats_t * flir_port_stream_stats(const flir_port_t * port)
+{
+    uint8_t tail = port->tail;
+    if (port->head == tail)
+    {
+        return NULL;
+    }
+    return &port->frame_stats[tail % port->depth];
+}
+
+/*!
+ * @brief           Gives the oldest queued frame back to the stream
+ */
+void flir_port_stream_release(flir_port_t * port)
+{
+    if (port->head != port->tail)
+    {
+        port->tail = port_next(port, port->tail);
+    }
+}
+
+/*!
+ * @brief   Prints counters of the port, part of STATS
+ */
+void flir_port_report(const flir_port_t * port)
+{
+    const flir_port_stats_t * stats = &port->stats;
+    printf("%s: %lu frames, %lu repeated, %lu dropped, %lu CRC errors, "
+           "%lu ID errors, %lu resyncs, %lu DMA errors\n",
+           port->config->name, stats->frames, stats->duplicates,
+           stats->dropped, stats->crc_errors, stats->id_errors,
+           stats->resyncs, stats->dma_errors);
+}
+
+/*!
+ * @brief           Returns the next value of head or tail
+ */
+static uint8_t port_next(const flir_port_t * port, uint8_t index)
+{
+    return index + 1 == 2 * port->depth ? 0 : index + 1;
+}
+
+/*!
+ * @brief           Returns buffer that the next packet goes into, row of
+ *                  the frame or scratch for frames that are dropped
+ */
+static uint16_t * port_buffer(flir_port_t * port)
+{
+    return port->frame ? port->frame[port->row] : port->scratch;
+}
+
+/*!
+ * @brief           Starts DMA of the next packet
+ *
+ * @note            Called with the RX interrupt masked or from it, both
+ *                  streams are off.
+ */
+static void port_read(flir_port_t * port)
+{
+    const flir_port_config_t * config = port->config;
+    uint32_t dma = config->dma;
+
+    dma_clear_interrupt_flags(dma, config->rx_stream, FLIR_PORT_DMA_FLAGS);
+    dma_clear_interrupt_flags(dma, config->tx_stream, FLIR_PORT_DMA_FLAGS);
+    dma_set_memory_address(dma, config->rx_stream,
+                           (uint32_t) port_buffer(port));
+    dma_set_number_of_data(dma, config->rx_stream, FLIR_PACKET_WORDS);
+    dma_set_number_of_data(dma, config->tx_stream, FLIR_PACKET_WORDS);
+
+    // SPI is idle between packets, clock switch might have changed APB1
+    SPI_CR1(config->spi) = (SPI_CR1(config->spi) & ~SPI_CR1_BR_MASK) |
+                           (port_prescaler() << SPI_CR1_BR_SHIFT);
+
+    // Receive side has to be ready before first word is clocked out
+    spi_enable_rx_dma(config->spi);
+    dma_enable_stream(dma, config->rx_stream);
+    dma_enable_stream(dma, config->tx_stream);
+    spi_enable_tx_dma(config->spi);
+}
+
+/*!
+ * @brief           Reads packets until the first packet of a frame comes,
+ *                  camera stays selected
+ */
+static void port_wait_first(flir_port_t * port)
+{
+    port->row = 0;
+    port->discards = 0;
+    port->state = FLIR_PORT_WAIT_FIRST;
+    port_read(port);
+}
+
+/*!
+ * @brief           Deselects camera for FLIR_RESYNC_DELAY
+ *
+ * @note            Called from the RX interrupt or with it masked
+ */
+static void port_deselect(flir_port_t * port)
+{
+    const flir_port_config_t * config = port->config;
+    while (SPI_SR(config->spi) & SPI_SR_BSY);
+    gpio_set(config->cs_port, config->cs_pin);
+    port->row = 0;
+    port->state = FLIR_PORT_RESYNC;
+    soft_timer_start(&port->timer, FLIR_RESYNC_DELAY * 1000);
+}
+
+/*!
+ * @brief           Gives up on the frame and deselects camera, as
+ *                  capture_resync() of flir.c
+ */
+static void port_resync(flir_port_t * port)
+{
+    port->stats.resyncs++;
+    port_deselect(port);
+}
+
+/*!
+ * @brief           Selects camera again after the resync delay
+ *
+ * @note            Called from TIM5 interrupt, no DMA of the port runs
+ */
+static void port_resync_done(soft_timer_t * timer)
+{
+    flir_port_t * port = (flir_port_t *) timer->context;
+    bool masked = cm_mask_interrupts(true);
+    if (port->on && port->state == FLIR_PORT_RESYNC)
+    {
+        gpio_clear(port->config->cs_port, port->config->cs_pin);
+        port_wait_first(port);
+    }
+    cm_mask_interrupts(masked);
+}
+
+/*!
+ * @brief           Selects buffer for the next frame of the stream
+ *
+ * @note            Called from interrupt. Without free buffer frame is
+ *                  read into scratch and dropped.
+ */
+static void port_select(flir_port_t * port)
+{
+    port->frame = NULL;
+    if (flir_port_stream_pending(port) >= port->depth)
+    {
+        return;
+    }
+
+    void * frame = port->frames +
+                   (port->head % port->depth) * FLIR_PORT_FRAME_BYTES;
+    // Consumer could have left dirty lines in it
+    dma_buf_invalidate(frame, FLIR_PORT_FRAME_BYTES);
+    port->frame = frame;
+}
+
+/*!
+ * @brief           Queues frame that was just read, unless it repeats the
+ *                  last one
+ *
+ * @note            Called from interrupt
+ */
+static void port_push(flir_port_t * port)
+{
+    if (!port->frame)
+    {
+        port->stats.dropped++;
+        return;
+    }
+
+    const frame_stats_t * pixels = &port->pixel_stats;
+    if (pixels->sum == port->last_sum && pixels->min == port->last_min &&
+        pixels->max == port->last_max &&
+        port->duplicates < FLIR_PORT_MAX_DUPLICATES)
+    {
+        port->duplicates++;
+        port->stats.duplicates++;
+        return;
+    }
+
+    port->duplicates = 0;
+    port->last_sum = pixels->sum;
+    port->last_min = pixels->min;
+    port->last_max = pixels->max;
+
+    uint8_t slot = port->head % port->depth;
+    port->times[slot].first_us = port->first_us;
+    port->times[slot].complete_us = micros();
+    port->frame_stats[slot] = *pixels;
+    // Frame and statistics have to be in place before consumer sees head
+    __asm__ volatile ("" ::: "memory");
+    port->head = port_next(port, port->head);
+    port->stats.frames++;
+    event_post(EVENT_CAPTURE);
+}
+
+/*!
+ * @brief           Checks CRC of VoSPI packet, as packet_crc_ok() of
+ *                  flir.c
+ */
+static bool port_crc_ok(const uint16_t * packet)
+{
+#ifdef FLIR_CHECK_CRC
+    const uint16_t head[2] = {packet[0] & 0x0FFF, 0};
+    uint16_t crc = crc_hw_ccitt16_words(0, head, 2);
+    crc = crc_hw_ccitt16_words(crc, packet + 2, FLIR_PACKET_WORDS - 2);
+    return crc == packet[1];
+#else
+    (void) packet;
+    return true;
+#endif
+}
+
+/*!
+ * @brief           Handles packet that RX stream of the port received
+ *
+ * @note            Call from the interrupt of the RX stream. Next packet
+ *                  is requested before the interrupt returns, so the
+ *                  camera does not lose sync.
+ */
+void flir_port_dma_isr(flir_port_t * port)
+{
+    const flir_port_config_t * config = port->config;
+    bool status = !dma_get_interrupt_flag(config->dma, config->rx_stream,
+                                          DMA_TEIF);
+    dma_clear_interrupt_flags(config->dma, config->rx_stream,
+                              DMA_TCIF | DMA_TEIF);
+    spi_disable_tx_dma(config->spi);
+    spi_disable_rx_dma(config->spi);
+
+    if (!port->on || port->state < FLIR_PORT_WAIT_FIRST)
+    {
+        return;
+    }
+    if (!status)
+    {
+        port->stats.dma_errors++;
+        port_resync(port);
+        return;
+    }
+
+    uint16_t * packet = port_buffer(port);
+    dma_buf_invalidate(packet, FLIR_PACKET_WORDS * 2);
+    bool discard = (packet[0] & FLIR_DISCARD_MASK) == FLIR_DISCARD_MASK;
+    uint16_t number = packet[0] & FLIR_PACKET_NUMBER_MASK;
+
+    if (port->state == FLIR_PORT_WAIT_FIRST)
+    {
+        // Discard packets and tail of previous frame come before packet 0
+        if (discard || number != 0)
+        {
+            if ((!discard && number >= FLIR_MAX_PACKETS) ||
+                ++port->discards > FLIR_MAX_DISCARDS)
+            {
+                port->stats.id_errors++;
+                port_resync(port);
+                return;
+            }
+            port_read(port);
+            return;
+        }
+        if (!port_crc_ok(packet))
+        {
+            port->stats.crc_errors++;
+            port_read(port);
+            return;
+        }
+        port->first_us = micros();
+        port->state = FLIR_PORT_READING;
+    }
+    else if (discard || number != port->row)
+    {
+        port->stats.id_errors++;
+        port_wait_first(port);
+        return;
+    }
+    else if (!port_crc_ok(packet))
+    {
+        port->stats.crc_errors++;
+        port_wait_first(port);
+        return;
+    }
+
+    if (port->row == 0)
+    {
+        frame_stats_begin(&port->pixel_stats);
+    }
+    frame_stats_row_u16(&port->pixel_stats,
+                        packet + (FLIR_PACKET_WORDS - FLIR_PACKET_PIXELS),
+                        FLIR_PACKET_PIXELS);
+
+    if (++port->row < FLIR_FRAME_PACKETS)
+    {
+        port_read(port);
+        return;
+    }
+
+    port_push(port);
+    port_select(port);
+    port_wait_first(port);
+}
+
+/*!
+ * @brief   RX stream of the second camera, SPI3
+ */
+void dma1_stream2_isr()
+{
+    flir_port_dma_isr(&flir_second);
+}
+
+#endif
+/*** end of file ***/
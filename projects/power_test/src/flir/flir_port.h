@@ -0,0 +1,134 @@
+#ifndef FLIR_PORT_H
+#define FLIR_PORT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "flir.h"
+#include "system_setup/soft_timer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Define on units with a second Lepton 2.x, its VoSPI is read on SPI3 by
+// its own DMA streams next to the first one on SPI1, look at
+// flir_port.c. Pipeline of inference.cc takes frames of both cameras in
+// turn. Lepton has one fixed CCI address, so the second module has no
+// CCI and runs with defaults, raw 14 bit pixels without telemetry, which
+// needs FLIR_RADIOMETRIC. PWR_DWN_L and RESET_L of both modules go to the
+// pins of flir.h, the second one boots with the first.
+//#define FLIR_SECOND
+
+// Most frame buffers of the stream of a port
+#define FLIR_PORT_STREAM_MAX_DEPTH  (4)
+// Frames in a row that are the same as the last queued one are dropped,
+// after this many one is queued anyway, as FLIR_MAX_SKIPPED_FRAMES
+#define FLIR_PORT_MAX_DUPLICATES    (4)
+
+// Wiring of the second module, all AF6. PC11 is D4 of DCMI_CAMERA.
+// - SCK PC10, MISO PC11, CS PA15 as GPIO
+#define FLIR_SECOND_PINS_PORT   GPIOC
+#define FLIR_SECOND_PINS_RCC    RCC_GPIOC
+#define FLIR_SECOND_SCK_PIN     GPIO10
+#define FLIR_SECOND_MISO_PIN    GPIO11
+#define FLIR_SECOND_CS_PORT     GPIOA
+#define FLIR_SECOND_CS_RCC      RCC_GPIOA
+#define FLIR_SECOND_CS_PIN      GPIO15
+
+// Hardware of one camera, SPI in master receive with DMA streams of its
+// RX and TX requests, both on the same DMA channel
+typedef struct
+{
+    const char * name;
+    uint32_t spi;
+    uint32_t spi_rcc;
+    uint32_t spi_rst;
+    uint32_t dma;
+    uint32_t dma_rcc;
+    uint8_t rx_stream;
+    uint8_t tx_stream;
+    uint32_t dma_channel;               // DMA_SxCR_CHSEL_x
+    uint8_t rx_irq;
+    uint32_t pins_port;                 // SCK and MISO
+    uint32_t pins_rcc;
+    uint16_t sck_pin;
+    uint16_t miso_pin;
+    uint8_t af;
+    uint32_t cs_port;
+    uint32_t cs_rcc;
+    uint16_t cs_pin;
+}flir_port_config_t;
+
+// Capture state of a camera, owned by flir_port.c
+typedef enum
+{
+    FLIR_PORT_IDLE,
+    FLIR_PORT_RESYNC,                   // Deselected for FLIR_RESYNC_DELAY
+    FLIR_PORT_WAIT_FIRST,               // Discard packets until packet 0
+    FLIR_PORT_READING,
+}flir_port_state_e;
+
+// Counters of a port, look at flir_port_dma_isr()
+typedef struct
+{
+    uint32_t frames;
+    uint32_t duplicates;                // Same pixels as the last frame
+    uint32_t dropped;                   // Queue was full
+    uint32_t crc_errors;
+    uint32_t id_errors;
+    uint32_t resyncs;
+    uint32_t dma_errors;
+}flir_port_stats_t;
+
+typedef struct
+{
+    const flir_port_config_t * config;
+
+    // Stream, head and tail run over twice the depth, as in flir.c
+    uint8_t * frames;
+    uint8_t depth;
+    volatile bool on;
+    volatile uint8_t head;
+    volatile uint8_t tail;
+    flir_timestamp_t times[FLIR_PORT_STREAM_MAX_DEPTH];
+    frame_stats_t frame_stats[FLIR_PORT_STREAM_MAX_DEPTH];
+
+    // Capture, moved by the DMA interrupt and the resync timer
+    volatile flir_port_state_e state;
+    uint16_t (*frame)[FLIR_PACKET_WORDS];   // NULL reads into scratch
+    uint16_t * scratch;
+    uint8_t row;
+    uint16_t discards;
+    uint8_t duplicates;
+    uint64_t first_us;
+    frame_stats_t pixel_stats;
+    uint32_t last_sum;
+    uint16_t last_min;
+    uint16_t last_max;
+    uint16_t tx_fill;
+    soft_timer_t timer;
+    flir_port_stats_t stats;
+}flir_port_t;
+
+#ifdef FLIR_SECOND
+extern flir_port_t flir_second;
+
+void flir_port_setup(flir_port_t * port);
+bool flir_port_stream_start(flir_port_t * port, void * frames, uint8_t depth);
+void flir_port_stream_stop(flir_port_t * port);
+uint8_t flir_port_stream_pending(const flir_port_t * port);
+void * flir_port_stream_peek(const flir_port_t * port);
+bool flir_port_stream_timestamp(const flir_port_t * port,
+                                flir_timestamp_t * stamp);
+const frame_stats_t * flir_port_stream_stats(const flir_port_t * port);
+void flir_port_stream_release(flir_port_t * port);
+void flir_port_report(const flir_port_t * port);
+void flir_port_dma_isr(flir_port_t * port);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FLIR_PORT_H */
+/*** end of file ***/
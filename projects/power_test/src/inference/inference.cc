@@ -1,39 +1,671 @@
+#include <string.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/cm3/dwt.h>
+
 // Includes connected with Tensorflow 
-#include "tensorflow/lite/micro/all_ops_resolver.h"
-#include "tensorflow/lite/micro/testing/micro_test.h"
-#include "tensorflow/lite/micro/kernels/micro_ops.h"
-#include "tensorflow/lite/micro/micro_error_reporter.h"
-#include "tensorflow/lite/micro/micro_interpreter.h"
-#include "tensorflow/lite/micro/micro_mutable_op_resolver.h"
-#include "tensorflow/lite/schema/schema_generated.h"
-#include "tensorflow/lite/version.h"
 #include "tensorflow/lite/c/common.h"
 
 // Includes connected with micro
 #include "model/full_quant_model.h"
+#ifdef CASCADE
+#include "model/gate_model.h"
+#endif
 #include "model/model_settings.h"
+#ifdef TEST_DATASET
+#include "dataset_file.h"
+
+// Linked from src/test_images/test_images.mlds, see BLOBS in project.mk
+extern const unsigned char test_images_mlds[];
+extern const unsigned int test_images_mlds_len;
+#elif defined(BENCH_ASSETS)
+#include "dataset_file.h"
+
+// Start of the asset region, ASSET_ADDRESS of project.mk, see rules.mk
+extern "C" const unsigned char _bench_assets[];
+#else
 #include "test_images/images.h"
+#endif
 #include "system_setup/utility.h"
-#include "system_setup/printf.h"
+#include "printf.h"
+#include "system_setup/sys_init.h"
+#include "system_setup/fastflash.h"
+#include "system_setup/dma_buf.h"
+#include "system_setup/dma2d.h"
+#include "system_setup/events.h"
+#include "system_setup/uart_tx.h"
+#include "system_setup/clock_profile.h"
+#include "system_setup/trace.h"
+#include "system_setup/counters.h"
+#include "system_setup/cycle_budget.h"
+#include "system_setup/remote_link.h"
+#include "system_setup/crc_hw.h"
+#include "system_setup/flash_store.h"
+#include "system_setup/config_store.h"
+#include "system_setup/background.h"
+#include "system_setup/model_slot.h"
+#include "system_setup/qspi_flash.h"
+#include "system_setup/dcmi_cam.h"
+#include "system_setup/eth_udp.h"
+#include "system_setup/weight_dma.h"
+#ifdef QSPI_MODEL
+// Linked into QSPI flash from src/model/qspi_model.tflite, see BLOBS in
+// project.mk. Length and CRC-32 are there too, read them only once
+// qspi_flash_ready() says the region is mapped.
+extern const unsigned char qspi_model_tflite[];
+extern const unsigned int qspi_model_tflite_len;
+extern const unsigned int qspi_model_tflite_crc32;
+#endif
+#include "simple_shell/simple_shell.h"
+#include "simple_shell/uart_ctrl.h"
+#include "simple_shell/usb_cdc.h"
+#include "flir/flir.h"
+#include "flir/flir_port.h"
+#include "frame_convert.h"
+#include "frame_normalize.h"
+#include "frame_stack.h"
+#include "cycle_profiler.h"
+#include "inference_engine.h"
+#include "shared_arena.h"
+#include "model_ops.h"
+#include "conv_pool_fused.h"
+#include "conv_tuning.h"
+#include "conv_specialised.h"
+#include "conv_frame_stack.h"
+#include "fast_scratch.h"
+#include "fc_palette.h"
+#include "fc_int4.h"
+#include "fc_batch.h"
+#include "weight_stream.h"
+#include "lut_activations.h"
+#include "telemetry.h"
+#include "log_reporter.h"
+#include "motion_gate.h"
+#include "result_filter.h"
+#include "blob_tracker.h"
+#include "result_bus.h"
+#include "latency_hist.h"
+#include "frame_augment.h"
+#include "output_scores.h"
+#include "early_exit.h"
+#ifdef KERNEL_BENCH
+#include "kernel_bench.h"
+#endif
+#ifdef TARGET_BENCH
+#include "target_bench.h"
+#endif
+
+#if defined(ETH_UDP) && !defined(RESULT_BUS)
+#error "ETH_UDP sends results from RESULT_BUS"
+#endif
+
+// Exact size measured with ARENA_REPORT=1 build, see shared/arena_report.h
+#if !defined(ARENA_REPORT) && __has_include("arena_size.h")
+#include "arena_size.h"
+#endif
 
 #include "inference.h"
 
+#if defined(FLIR_RADIOMETRIC) && defined(ZERO_COPY_CAPTURE)
+#error "FLIR_RADIOMETRIC frames have to be normalised, ZERO_COPY_CAPTURE assumes AGC"
+#endif
+
+#if defined(VISIBLE_CLASSIFIER) && !defined(DCMI_CAMERA)
+#error "VISIBLE_CLASSIFIER takes its frames from DCMI_CAMERA"
+#endif
+
+#if defined(FLIR_SECOND) && (defined(ZERO_COPY_CAPTURE) || \
+    defined(FRAME_STACK) || defined(MOTION_GATE) || defined(BLOB_TRACKER))
+#error "FLIR_SECOND interleaves two views, frames do not follow each other"
+#endif
+
 namespace {
+    // Operators also land in the trace, next to the cycle table, and the
+    // longest one is kept against BUDGET_OP_EVAL
+    class OpProfiler : public CycleProfiler {
+     public:
+      explicit OpProfiler(tflite::ErrorReporter* reporter)
+          : CycleProfiler(reporter) {}
+
+      using CycleProfiler::BeginEvent;
+      using CycleProfiler::EndEvent;
+
+      uint32_t BeginEvent(const char* tag, EventType event_type,
+                          int64_t event_metadata1,
+                          int64_t event_metadata2) override {
+        TRACE(TRACE_OP_BEGIN, event_metadata1);
+        op_start_ = DWT_CYCCNT;
+        return CycleProfiler::BeginEvent(tag, event_type, event_metadata1,
+                                         event_metadata2);
+      }
+
+      void EndEvent(uint32_t event_handle) override {
+        cycle_budget_record(BUDGET_OP_EVAL, DWT_CYCCNT - op_start_,
+                            BUDGET_OP_EVAL_CYCLES);
+        CycleProfiler::EndEvent(event_handle);
+        TRACE(TRACE_OP_END, event_handle);
+      }
+
+     private:
+      uint32_t op_start_ = 0;
+    };
+
     tflite::ErrorReporter* error_reporter = nullptr;
-    const tflite::Model* model = nullptr;
-    tflite::MicroInterpreter* interpreter = nullptr;
     TfLiteTensor* input = nullptr;
     TfLiteTensor* output = nullptr;
+    CycleProfiler* profiler = nullptr;
+
+    // Scores of int8 output, or float one of models with Dequantize
+    OutputScores scores;
 
     // An area of memory to use for input, output, and intermediate arrays.
-    const int kTensorArenaSize = 271000;
-    alignas(16) uint8_t tensor_arena[kTensorArenaSize];
+    // Memory planner puts activations at the beginning of the arena and 
+    // persistent buffers at its end, so the hot part lands in DTCM.
+    // Conv2D and MaxPool2D layers of the model are fused, look at
+    // fuse_conv_pool.py, 60x80x44 conv output is never stored and peak
+    // of activations is 59 KB instead of 264 KB.
+#ifdef ARENA_SIZE_BYTES
+    const int kTensorArenaSize = ARENA_SIZE_BYTES;
+#else
+    const int kTensorArenaSize = 70000;
+#endif
+
+#ifdef CASCADE
+    // Classifier and gate share one arena, gate only adds its persistent 
+    // part, its activations reuse scratch of the classifier
+    const int kGateTailSize = 4 * 1024;
+    SharedArena<kTensorArenaSize + kGateTailSize> shared_arena DTCM_BSS;
+    InferenceEngine<0, MODEL_ENGINE_OPS> engine;
+#else
+    // Only kernels of the model are linked in, list is generated, arena is a member of engine
+    InferenceEngine<kTensorArenaSize, MODEL_ENGINE_OPS> engine DTCM_BSS;
+#endif
+
+    // Scratch of kernels, im2col and conv strips, is not in the arena but 
+    // here, at the start of DTCM, see shared/fast_scratch.h. The first 
+    // layer needs the most, 7 KB strip and its padded input rows.
+    const int kFastScratchSize = 8 * 1024;
+    alignas(16) uint8_t fast_scratch[kFastScratchSize] DTCM_FAST_BSS;
+    FastScratchResolver* scratch_resolver = nullptr;
+
+#ifdef WEIGHT_PREFETCH
+    // Weights stay in the model, so only Copy() is used, DMA2 does it
+    class DmaWeightSource : public WeightSource {
+     public:
+      bool Start(uint32_t offset, void* dst, uint32_t len) override {
+        (void) offset;
+        (void) dst;
+        (void) len;
+        return false;
+      }
+
+      bool Wait() override { return weight_dma_wait(); }
+
+      bool Copy(const void* src, void* dst, uint32_t len) override {
+        return weight_dma_start(dst, src, len);
+      }
+    };
+
+    // Two halves, weights of the next FullyConnected arrive in one while
+    // the kernel reads the other, before the arena so they stay in DTCM
+    alignas(16) uint8_t weight_prefetch[WEIGHT_PREFETCH_SIZE] DTCM_FAST_BSS;
+    WeightStreamResolver* prefetch_resolver = nullptr;
+#endif
+
+#ifdef KERNEL_BENCH
+    // Second memory of inference_kernel_bench(), plain .bss comes after 
+    // all of DTCM_BSS, so it is in SRAM1 unless the arena got small
+    alignas(16) int8_t kbench_ram[96 * 1024] NOINIT_BSS;
+#ifdef EXT_SDRAM
+    // Same in external SDRAM, what a second arena there would cost
+    alignas(16) int8_t kbench_sdram[96 * 1024] SDRAM_BSS;
+#endif
+#endif
+
+#ifndef MINICOM_SHELL
+    // Next tensor of EVAL arrives here while the current one is invoked,
+    // CRC-32 of the host follows the input bytes
+    uint8_t eval_block[DMA_BUF_ROUND(kMaxImageSize + 4)] DMA_BUFFER NOINIT_BSS;
+#endif
+
     uint32_t duration = 0;
+    uint32_t capture_duration = 0;
+
+    // Conversion from raw FLIR pixel into model input
+    frame_quant_t input_quant;
+    // Same with INPUT_GAMMA, used by load_data() unless quant is an offset
+    frame_lut_t input_lut;
+    bool input_lut_used = false;
+#ifdef FRAME_STACK
+    // Input tensor as ring of the last kNumChannels frames
+    frame_stack_t frame_stack;
+    typedef Conv2DStackResolver<kNumRows, kNumCols, kNumChannels> 
+        StackResolver;
+#endif
+
+#ifdef CASCADE
+    // Presence detector in front of the classifier, its operators come 
+    // from the same generated list, so MODEL_SRC has to include the gate
+    InferenceEngine<0, MODEL_ENGINE_OPS> gate_engine;
+    TfLiteTensor* gate_input = nullptr;
+    OutputScores gate_scores;
+    frame_quant_t gate_quant;
+    uint16_t gate_cols = 0;
+    uint16_t gate_rows = 0;
+#endif
+
+#ifdef MOTION_GATE
+    motion_gate_t motion_gate;
+#endif
+#ifdef EARLY_EXIT
+    // Heads of the classifier, scores are taken from the exit of a frame
+    EarlyExit<decltype(engine)> early_exit;
+#endif
+    // Last frame did not reach the interpreter
+    bool frame_idle = false;
+
+#ifdef RESULT_FILTER
+    result_filter_t result_filter;
+    // Last frame was skipped, result of earlier frames stands
+    bool frame_skipped = false;
+#endif
+
+#ifdef BLOB_TRACKER
+    blob_tracker_t blob_tracker;
+    // Mean pixel of a hot block in the frame of pipeline_next_frame(), 
+    // nothing is hot until capture made a histogram
+    uint8_t blob_hot = 255;
+    // Last frame kept the result of its tracks, without Invoke()
+    bool frame_tracked = false;
+#endif
+
+#ifndef ZERO_COPY_CAPTURE
+#ifdef FLIR_RADIOMETRIC
+    // Raw frames are queued by DMA and remapped into 8 bit frame, which 
+    // pipeline then uses as AGC frame
+    uint16_t raw_frames[2][FLIR_FRAME_PACKETS][FLIR_PACKET_WORDS]
+        DMA_BUFFER NOINIT_BSS;
+    static_assert(sizeof(raw_frames) % DMA_BUF_ALIGN == 0, 
+                  "Frame buffers share a cache line");
+    uint8_t normalized_frame[60][80] NOINIT_BSS;
+    frame_remap_t remap;
+#ifdef FLIR_SECOND
+    // Queue of the second Lepton, the pipeline takes frames of both
+    // cameras in turn, look at pipeline_next_frame()
+    uint16_t second_frames[2][FLIR_FRAME_PACKETS][FLIR_PACKET_WORDS]
+        DMA_BUFFER NOINIT_BSS;
+    bool second_turn = false;
+#endif
+#else
+    // Frame queue of the stream, one is filled while the other one is used
+    // by interpreter. AGC frames are packed by CPU, so they need no D-cache
+    // alignment and take half of the raw VoSPI frames.
+    uint8_t frames[2][60][80] NOINIT_BSS;
+#endif
+    bool pipeline_running = false;
+    // Frame of the last inference is still taken from the stream
+    bool frame_held = false;
+    // Arrival of the frame that pipeline_next_frame() returned
+    flir_timestamp_t pipeline_time;
+#ifdef VISIBLE_CLASSIFIER
+    // Queue of the visible camera, DMA writes it like raw VoSPI frames. 
+    // One frame is held by the classifier, one is queued and one is 
+    // being received, all of it without the core.
+    uint8_t visible_frames[3][DCMI_CAM_ROWS][DCMI_CAM_COLS] 
+        DMA_BUFFER NOINIT_BSS;
+    static_assert(DCMI_CAM_ROWS == 60 && DCMI_CAM_COLS == 80,
+                  "Visible frames have to be in the shape of AGC frames");
+    static_assert(sizeof(visible_frames[0]) % DMA_BUF_ALIGN == 0, 
+                  "Frame buffers share a cache line");
+    bool visible_held = false;
+#endif
+#endif
+
+    // Stages of a frame from its first packet until its result is
+    // formatted, look at inference_stats_report()
+    enum latency_stage
+    {
+        LATENCY_CAPTURE,        // First packet to last packet
+        LATENCY_PREPROCESS,     // Last packet to Invoke(), queue included
+        LATENCY_INVOKE,
+        LATENCY_REPORT,         // Invoke() to formatted result
+        LATENCY_TOTAL,          // First packet to formatted result
+        LATENCY_STAGES,
+    };
+
+    const char * const latency_names[LATENCY_STAGES] = {
+        "capture", "preprocess", "invoke", "report", "total",
+    };
+
+    latency_hist_t latency[LATENCY_STAGES];
+    // Times of the last invoked frame, result is not reported yet
+    flir_timestamp_t result_time;
+    uint64_t invoke_start_us = 0;
+    uint64_t invoke_end_us = 0;
+    bool latency_pending = false;
+
+#ifdef RESULT_BUS
+    // Result of each frame for subscribers, published once it is reported
+    result_bus_t result_bus;
+    // Invoke() of the scores in the output tensor, stamped or not
+    uint32_t last_invoke_us = 0;
+#endif
+
+#ifdef ETH_UDP
+    // Records go out as datagrams straight from the bus, frames straight
+    // from the pipeline
+    result_sub_t eth_sub;
+    uint8_t eth_sequence = 0;
+    uint16_t eth_frame = 0;
+#endif
+
+#ifdef ROI_INFERENCE
+    // Crops of the last frame and their scores, in order of region size
+    frame_roi_t rois[INFERENCE_MAX_ROIS];
+    int32_t roi_scores[INFERENCE_MAX_ROIS][kCategoryCount];     // Per mille
+    uint8_t roi_count = 0;
+#endif
+
+#ifdef BINARY_TELEMETRY
+    telemetry_t telemetry;
+#endif
+
+    // Models that can be selected with MODEL command. List their sources 
+    // in MODEL_SRC of project.mk too, so that their operators are linked.
+    // Array, its length and CRC-32 are what gen_blob.py emits, check is
+    // done before every load, look at model_check().
+    struct model_entry
+    {
+        const char * name;
+        const unsigned char * data;
+        const unsigned int * len;
+        const unsigned int * crc32;
+    };
+
+#ifdef MODEL_UPDATE
+    // Model of the flash slot is the last entry, its length and CRC-32 are
+    // read from the slot header, length is 0 while the slot is empty
+    unsigned int slot_len = 0;
+    unsigned int slot_crc32 = 0;
+#endif
+#ifdef QSPI_MODEL
+    // Length of the QSPI model, 0 until the flash is mapped
+    unsigned int qspi_len = 0;
+#endif
+
+    const model_entry models[] = {
+        {"full_quant", full_quant_tflite, &full_quant_tflite_len, 
+         &full_quant_tflite_crc32},
+#ifdef QSPI_MODEL
+        {"qspi", qspi_model_tflite, &qspi_len, &qspi_model_tflite_crc32},
+#endif
+#ifdef MODEL_UPDATE
+        {"update", model_slot_data(), &slot_len, &slot_crc32},
+#endif
+    };
+    const uint32_t kModelCount = sizeof(models) / sizeof(models[0]);
+    const model_entry * current_model = &models[0];
+
+#if defined(MODEL_UPDATE) && !defined(MINICOM_SHELL)
+    const model_entry * const slot_model = &models[kModelCount - 1];
+    // Chunk of UPLOAD is received into one while the other is programmed
+    uint8_t update_blocks[2][DMA_BUF_ROUND(MODEL_SLOT_CHUNK + 4)] 
+        DMA_BUFFER NOINIT_BSS;
+    uint32_t update_block = 0;
+    uint32_t update_len = 0;
+#endif
+
+    // Phases of inference_benchmark(), in order in which they run
+    enum bench_phase
+    {
+        BENCH_CAPTURE,
+        BENCH_PREPROCESS,
+        BENCH_INVOKE,
+        BENCH_REPORT,
+        BENCH_PHASES,
+    };
+
+    struct bench_phase_info
+    {
+        const char * name;
+        uint16_t marker;
+    };
+
+    const bench_phase_info bench_phases[BENCH_PHASES] = {
+        {"capture",     MARKER_CAPTURE},
+        {"preprocess",  MARKER_PREPROCESS},
+        {"invoke",      MARKER_INVOKE},
+        {"report",      MARKER_REPORT},
+    };
+
+    // Test set of the benchmark, pointers into the dataset with
+    // TEST_DATASET or BENCH_ASSETS, they are set when the model is bound.
+    // NULL while asset region holds no images of the model.
+#if defined(TEST_DATASET) || defined(BENCH_ASSETS)
+    const signed char * bench_images[5];
+#else
+    const signed char * const bench_images[] = {
+        image0, image1, image2, image3, image4,
+    };
+#endif
+
+    // Benchmark frame is separate, pipeline can keep its frames
+    alignas(32) uint8_t bench_frame[60][80];
+
+    // Variants of the test set in inference_soak(), shift in pixels, gain 
+    // as change of Q8 256, offset and noise in AGC counts
+    const frame_augment_t soak_limits = {4, 4, 38, 24, 6};
+    alignas(32) uint8_t soak_frame[60][80];
+    latency_hist_t soak_latency;
+
+    // State of the interpreter when the core went to STOP, look at 
+    // inference_resume()
+    uint32_t suspend_checksum = 0;
 }
 
 
+static bool bind_model();
+static bool engine_setup(const void * model_data);
+static void tuning_load(const model_entry * entry);
+static uint32_t tuning_cycles();
+static bool engine_boot(const void * model_data);
+static bool model_check(const model_entry * entry);
+static uint32_t engine_checksum();
+static bool frame_has_motion();
+#ifdef STREAM_FIRST_LAYER
+static bool stream_capture_exe();
+#endif
+#ifdef CASCADE
+static bool bind_gate();
+#endif
+static bool frame_has_presence(uint8_t frame[60][80]);
+static bool frame_can_skip();
+static bool frame_is_tracked(uint8_t frame[60][80]);
+static void frame_classified();
+static const char * tracked_suffix();
+static void result_update();
+static void latency_invoked(const flir_timestamp_t * stamp, 
+                            uint64_t start_us, 
+                            uint64_t end_us);
+static bool latency_reported(uint32_t * total_us);
+#ifdef RESULT_BUS
+static void result_publish(bool stamped, uint32_t latency_us);
+static void result_bus_report();
+#endif
+#ifdef ETH_UDP
+static bool eth_result_notify(result_sub_t * sub, 
+                              const result_record_t * record);
+static void eth_send_frame(uint8_t frame[60][80]);
+#endif
+#ifndef ZERO_COPY_CAPTURE
+static uint8_t (*pipeline_next_frame())[80];
+#ifdef VISIBLE_CLASSIFIER
+static uint8_t (*visible_next_frame())[80];
+#endif
+#ifdef FLIR_RADIOMETRIC
+static void normalize_frame(uint16_t raw[][FLIR_PACKET_WORDS], 
+                            uint8_t frame[60][80],
+                            const frame_stats_t * stats);
+#endif
+#ifdef BLOB_TRACKER
+static void blob_threshold_update(const frame_stats_t * stats);
+#endif
+#endif
+#ifdef ROI_INFERENCE
+static void roi_fit(frame_roi_t * roi);
+#endif
+static void bench_capture(const signed char * image);
+static bool soak_invoke(uint32_t run, uint32_t * us);
+static uint8_t soak_top_class();
+static bool bench_images_ready();
+#if defined(TEST_DATASET) || defined(BENCH_ASSETS)
+static bool bind_test_dataset();
+#endif
+/*!
+ * @brief   Fills benchmark frame with test image as AGC FLIR pixels 
+ *
+ * @note    Test images are already quantized, zero point is removed, 
+ *          so load_data() gives the same input back for models with 
+ *          scale 1.0.
+ */
+static void bench_capture(const signed char * image)
+{
+    int32_t zero_point = input->params.zero_point;
+    uint8_t * pixels = &bench_frame[0][0];
+
+    for (uint32_t i = 0; i < 60 * 80; i++) 
+    {
+        int32_t value = image[i] - zero_point;
+        pixels[i] = value < 0 ? 0 : (value > 255 ? 255 : value);
+    }
+}
+
 static void load_test_data(TfLiteTensor * input, const signed char * data);
-static void load_data(TfLiteTensor * input, uint16_t frame[60][82]);
+static void load_data(TfLiteTensor * input, uint8_t frame[60][80]);
+
+/*!
+ * @brief   Invoke() of any engine, marked in trace
+ *
+ * @param[in] model     Trace argument, 0 classifier, 1 gate
+ *
+ * @note    With STEPPED_INVOKE capture that waits for resynchronisation
+ *          or VSYNC is polled between operators, so camera does not lose
+ *          sync while a long model runs. Poll is in the cycles counted.
+ *          BACKGROUND_INVOKE of background.h takes precedence, Invoke()
+ *          then runs as the background job and main context polls
+ *          capture and drains logs whenever it has to, cycles include
+ *          that as well.
+ */
+static void invoke_counted(uint32_t cycles)
+{
+    counter_add(COUNTER_INVOKES, 1);
+    counter_add(COUNTER_WINDOW_INVOKES, 1);
+    counter_add(COUNTER_INVOKE_KCYCLES, (cycles + 500) / 1000);
+    counter_max(COUNTER_INVOKE_MAX_CYCLES, cycles);
+}
+
+#ifdef BACKGROUND_INVOKE
+template <typename Engine>
+struct InvokeJob
+{
+    Engine * engine;
+    bool invoked;
+};
+
+template <typename Engine>
+static void invoke_job(void * arg)
+{
+    InvokeJob<Engine> * job = static_cast<InvokeJob<Engine> *>(arg);
+    job->invoked = job->engine->Invoke();
+}
+#endif
+
+template <typename Engine>
+static bool engine_invoke(Engine & model_engine, uint16_t model)
+{
+    TRACE(TRACE_INVOKE_BEGIN, model);
+    uint32_t start = dwt_read_cycle_counter();
+#if defined(BACKGROUND_INVOKE)
+    InvokeJob<Engine> job = {&model_engine, false};
+    bool invoked = background_start(invoke_job<Engine>, &job);
+    while (invoked && background_busy())
+    {
+        if (flir_capture_needs_poll() && flir_capture_poll_delay() == 0)
+        {
+            flir_capture_poll();
+        }
+        // Job runs while this waits
+        event_wait(EVENT_BACKGROUND | EVENT_CAPTURE,
+                   flir_capture_needs_poll() ? flir_capture_poll_delay() :
+                                               EVENT_FOREVER);
+    }
+    invoked = invoked && job.invoked;
+#elif defined(STEPPED_INVOKE)
+    bool invoked;
+    do
+    {
+        invoked = model_engine.InvokeStep(INVOKE_STEP_OPS);
+        if (flir_capture_needs_poll() && flir_capture_poll_delay() == 0)
+        {
+            flir_capture_poll();
+        }
+    } while (invoked && model_engine.InvokeInProgress());
+#else
+    bool invoked = model_engine.Invoke();
+#endif
+    uint32_t cycles = dwt_read_cycle_counter() - start;
+    TRACE(TRACE_INVOKE_END, invoked);
+
+    invoke_counted(cycles);
+    return invoked;
+}
+
+/*!
+ * @brief   Invoke() of the classifier for a frame of the pipeline
+ *
+ * @note    With EARLY_EXIT it stops at an exit of the model and scores 
+ *          are taken from that head. Deadline is in cycles of the clock 
+ *          that runs now. Capture is not polled between operators then.
+ *          With REMOTE_INFERENCE companion runs it, core sleeps meanwhile
+ *          and capture keeps going from interrupts.
+ */
+static bool classifier_invoke()
+{
+#ifdef EARLY_EXIT
+    TRACE(TRACE_INVOKE_BEGIN, 0);
+    bool invoked = early_exit.Invoke(EARLY_EXIT_DEADLINE_US * g_clock_mhz, 
+                                     EARLY_EXIT_THRESHOLD_PM);
+    TRACE(TRACE_INVOKE_END, invoked);
+
+    invoke_counted(early_exit.cycles());
+    if (invoked)
+    {
+        scores = early_exit.scores();
+        if (early_exit.exit() < early_exit.exits() - 1)
+        {
+            counter_add(COUNTER_EARLY_EXITS, 1);
+        }
+    }
+    return invoked;
+#elif defined(REMOTE_INFERENCE)
+    TRACE(TRACE_INVOKE_BEGIN, 0);
+    uint32_t start = dwt_read_cycle_counter();
+    bool invoked = remote_infer_start(input->data.int8, input->bytes, 
+                                      output->data.raw, output->bytes) &&
+                   remote_infer_wait(REMOTE_TIMEOUT);
+    uint32_t cycles = dwt_read_cycle_counter() - start;
+    TRACE(TRACE_INVOKE_END, invoked);
+
+    invoke_counted(cycles);
+    return invoked;
+#else
+    return engine_invoke(engine, 0);
+#endif
+}
+
+#ifdef BINARY_TELEMETRY
+static void telemetry_write(const uint8_t * data, uint32_t len);
+static void send_telemetry();
+#endif
 
 static void print_result(tflite::ErrorReporter* error_reporter,
                          const char * title,
@@ -42,133 +674,2623 @@ static void print_result(tflite::ErrorReporter* error_reporter,
 
 bool inference_setup()
 {
-    static tflite::MicroErrorReporter micro_error_reporter;
-    error_reporter = &micro_error_reporter;
+#ifdef RESULT_BUS
+    // Before anything can subscribe, even if the model is not set up
+    result_bus_init(&result_bus);
+#endif
+#ifdef ETH_UDP
+    // Datagrams are dropped until eth_udp_setup() found a link
+    result_bus_subscribe(&result_bus, &eth_sub, "eth", eth_result_notify, 
+                         NULL);
+#endif
+
+    // Binary log with LOG_BINARY, MicroErrorReporter text otherwise
+    static LogErrorReporter log_error_reporter;
+    error_reporter = &log_error_reporter;
+
+    // Measures cycles of each operator, look at inference_profile_report()
+    static OpProfiler cycle_profiler(error_reporter);
+    profiler = &cycle_profiler;
+
+    // MaxPool2D layers are fused into Conv2D, the first layer is 
+    // convolved with kernel specialised for frame size. Dense weights 
+    // made by palettize_weights.py are decoded tile by tile, int4 ones 
+    // of quantize_int4.py are multiplied packed, other models pass 
+    // through. Plain dense weights of a model with batch 2, see 
+    // batch_model.py, are read once for both frames. Softmax is a table 
+    // lookup.
+    static LutActivationResolver lut_resolver(engine.resolver());
+    static FullyConnectedBatchResolver batch_resolver(lut_resolver);
+    static FullyConnectedPaletteResolver palette_resolver(batch_resolver);
+    static FullyConnectedInt4Resolver int4_resolver(palette_resolver);
+#ifdef WEIGHT_PREFETCH
+    // Outside of the FullyConnected ones, batch kernel reads the copy too
+    weight_dma_setup();
+    static DmaWeightSource weight_source;
+    static WeightStreamResolver weight_resolver(int4_resolver, 
+                                                &weight_source, 
+                                                weight_prefetch, 
+                                                sizeof(weight_prefetch));
+    weight_resolver.PrefetchResident(WEIGHT_PREFETCH_MIN);
+    prefetch_resolver = &weight_resolver;
+    static Conv2DPoolResolver pool_resolver(weight_resolver);
+#else
+    static Conv2DPoolResolver pool_resolver(int4_resolver);
+#endif
+    static Conv2DSpecialisedResolver<kNumRows, kNumCols, 3, 4> 
+        conv_resolver(pool_resolver);
+#ifdef FRAME_STACK
+    // First layer reads channels of the frame ring rotated
+    static StackResolver stack_resolver(conv_resolver);
+    static FastScratchResolver fast_resolver(stack_resolver, fast_scratch, 
+                                             kFastScratchSize);
+#else
+    static FastScratchResolver fast_resolver(conv_resolver, fast_scratch, 
+                                             kFastScratchSize);
+#endif
+    scratch_resolver = &fast_resolver;
+    engine.SetResolver(&fast_resolver);
+
+    // Model that was selected with MODEL before reset, CRC-32 is stored, 
+    // so a rebuilt list or renamed model does not pick a wrong one
+#ifdef MODEL_UPDATE
+    uint32_t len;
+    uint32_t crc32;
+    if (model_slot_read(&len, &crc32))
+    {
+        slot_len = len;
+        slot_crc32 = crc32;
+    }
+#endif
+#ifdef QSPI_MODEL
+    if (qspi_flash_ready())
+    {
+        qspi_len = qspi_model_tflite_len;
+    }
+#endif
+    uint32_t model_id;
+    if (config_store_get(CONFIG_MODEL, &model_id))
+    {
+        for (uint32_t i = 0; i < kModelCount; i++)
+        {
+            if (*models[i].len && *models[i].crc32 == model_id)
+            {
+                current_model = &models[i];
+            }
+        }
+    }
+
+    // Weights are read over ITCM flash interface through ART accelerator, 
+    // flatbuffer is position independent, so alias can be used directly.
+    tuning_load(current_model);
+    if (!model_check(current_model) || 
+        !engine_boot(flash_itcm_alias(current_model->data)))
+    {
+        return false;
+    }
+    engine.PrintInfo();
+    printf("Fast scratch: %u of %u bytes\n", 
+           (unsigned) scratch_resolver->peak(), 
+           (unsigned) scratch_resolver->size());
+#ifdef WEIGHT_PREFETCH
+    printf("Weight prefetch: %d layers into %u bytes\n", 
+           prefetch_resolver->layers(), (unsigned) sizeof(weight_prefetch));
+#endif
+#ifdef CASCADE
+    gate_engine.PrintInfo();
+#endif
 
-    model = tflite::GetModel(full_quant_tflite);
-    if (model->version() != TFLITE_SCHEMA_VERSION) 
+    if (!bind_model())
+    {
+        return false;
+    }
+#ifdef TEST_DATASET
+    if (!bind_test_dataset())
+    {
+        return false;
+    }
+#elif defined(BENCH_ASSETS)
+    // Production units have no assets, only benchmarks need them
+    if (!bind_test_dataset())
     {
-        TF_LITE_REPORT_ERROR(error_reporter, 
-            "Model provided is schema version %d not equal to supported version %d.",
-            model->version(), TFLITE_SCHEMA_VERSION);
+        printf("No benchmark assets, benchmarks are off\n");
     }
+#endif
+
+#ifdef BINARY_TELEMETRY
+    telemetry_init(&telemetry, telemetry_write);
+#endif
+#ifdef REMOTE_INFERENCE
+    remote_link_setup();
+#endif
+
+#ifdef MOTION_GATE
+    motion_config_t motion_config = motion_gate_default_config();
+    motion_config.block_threshold = config_store_value(
+        CONFIG_MOTION_THRESHOLD, motion_config.block_threshold);
+    motion_config.min_blocks = config_store_value(
+        CONFIG_MOTION_BLOCKS, motion_config.min_blocks);
+    motion_gate_init(&motion_gate, kNumCols, kNumRows, &motion_config);
+#endif
+
+#ifdef RESULT_FILTER
+    result_config_t result_config = result_filter_default_config();
+    result_filter_init(&result_filter, kCategoryCount, &result_config);
+#endif
 
-    static tflite::MicroMutableOpResolver<8> micro_op_resolver;
-    micro_op_resolver.AddConv2D();
-    micro_op_resolver.AddMaxPool2D();
-    micro_op_resolver.AddReshape();
-    micro_op_resolver.AddFullyConnected();
-    micro_op_resolver.AddSoftmax();
-    micro_op_resolver.AddDequantize();
-    micro_op_resolver.AddMul();
-    micro_op_resolver.AddAdd();
+#ifdef BLOB_TRACKER
+    blob_config_t blob_config = blob_tracker_default_config();
+    blob_config.refresh_frames = BLOB_REFRESH_FRAMES;
+    blob_tracker_init(&blob_tracker, 80, 60, &blob_config);
+#endif
+    return true;
+}
 
-    static tflite::MicroInterpreter static_interpreter(model, 
-                                                       micro_op_resolver, 
-                                                       tensor_arena, 
-                                                       kTensorArenaSize, 
-                                                       error_reporter);
-    interpreter = &static_interpreter;
+/*!
+ * @brief           Replaces running model with another built-in one, 
+ *                  without reset and new FLIR setup
+ *
+ * @param[in] name  Name from models table
+ *
+ * @return          True if new model is ready
+ *
+ * @note            Interpreter is created again over the same arena. If 
+ *                  new model fails to load or does not fit the frame, 
+ *                  previous model is loaded back. Capture that is already 
+ *                  running is not affected, frames do not live in arena.
+ */
+bool inference_load_model(const char * name)
+{
+    const model_entry * entry = nullptr;
+    for (uint32_t i = 0; i < kModelCount; i++)
+    {
+        // Empty flash slot has no model
+        if (*models[i].len && 0 == strcmp(models[i].name, name))
+        {
+            entry = &models[i];
+        }
+    }
 
-    // Allocate memory from the tensor_arena for the model's tensors.
-    TfLiteStatus allocate_status = interpreter->AllocateTensors();
-    if (allocate_status != kTfLiteOk) 
+    if (entry == nullptr)
     {
-        TF_LITE_REPORT_ERROR(error_reporter, "AllocateTensors() failed");
+        printf("Unknown model %s\n", name);
         return false;
     }
-    TF_LITE_REPORT_ERROR(error_reporter, "Size of the used memory in bytes: %d\n", 
-                                         interpreter->arena_used_bytes());
 
+    uint32_t start = millis();
+    tuning_load(entry);
+    if (model_check(entry) && engine_setup(flash_itcm_alias(entry->data)) && 
+        bind_model())
+    {
+        current_model = entry;
+        profiler->Reset();
+        uint32_t duration_load = millis() - start;
+        printf("Model %s loaded in %ld ms\n", name, duration_load);
+        engine.PrintInfo();
+        return true;
+    }
+
+    printf("Loading %s failed, back to %s\n", name, current_model->name);
+    tuning_load(current_model);
+    if (!engine_setup(flash_itcm_alias(current_model->data)) || 
+        !bind_model())
+    {
+        printf("Previous model failed too\n");
+    }
+    return false;
+}
+
+/*!
+ * @brief   Remembers checksum of the interpreter state, call before the
+ *          core goes to STOP
+ */
+void inference_suspend()
+{
+    suspend_checksum = engine_checksum();
+}
+
+/*!
+ * @brief   Checks that interpreter survived in retained RAM since 
+ *          inference_suspend(), so Invoke() can follow right away, 
+ *          otherwise sets up current model again
+ *
+ * @return  False if model could not be set up again
+ *
+ * @note    Warm start costs only the checksum of persistent arena tail 
+ *          and interpreter object, around 0.1 ms, instead of GetModel(),
+ *          interpreter construction and AllocateTensors(). Activations 
+ *          are not checked, every Invoke() writes them again.
+ */
+bool inference_resume()
+{
+    if (engine_checksum() == suspend_checksum)
+    {
+        counter_add(COUNTER_WARM_STARTS, 1);
+        return true;
+    }
+
+    printf("Interpreter state lost, setting up %s again\n", 
+           current_model->name);
+    counter_add(COUNTER_COLD_STARTS, 1);
+    tuning_load(current_model);
+    return engine_setup(flash_itcm_alias(current_model->data)) && 
+           bind_model();
+}
 
-    input = interpreter->input(0);
+/*!
+ * @brief   Lends the arena below its persistent tail between inferences, 
+ *          for example as frame buffer or compression scratch of the 
+ *          capture side
+ *
+ * @param[out] bytes    Size of the buffer, 0 if it is not lent
+ *
+ * @return  16 byte aligned buffer, NULL if an inference is in progress, 
+ *          the arena is lent already or shared with the gate of CASCADE
+ *
+ * @note    Inference fails until inference_return_arena(), input and 
+ *          output tensors are overwritten. Read results before and do not 
+ *          borrow while ZERO_COPY_CAPTURE DMA writes into the input 
+ *          tensor. Safe to call from an interrupt.
+ */
+uint8_t * inference_borrow_arena(size_t * bytes)
+{
+    return engine.BorrowArena(bytes);
+}
 
-    TF_LITE_REPORT_ERROR(error_reporter, "Input:\n");
-    TF_LITE_REPORT_ERROR(error_reporter, "Dimension:        %d", input->dims->size);
-    TF_LITE_REPORT_ERROR(error_reporter, "First Dimension:  %d", input->dims->data[0]);
-    TF_LITE_REPORT_ERROR(error_reporter, "Rows:             %d", input->dims->data[1]);
-    TF_LITE_REPORT_ERROR(error_reporter, "Columns:          %d", input->dims->data[2]);
-    TF_LITE_REPORT_ERROR(error_reporter, "Channels:         %d", input->dims->data[3]);
-    TF_LITE_REPORT_ERROR(error_reporter, "Input type:       %d", input->type);
+/*!
+ * @brief   Ends inference_borrow_arena()
+ */
+void inference_return_arena()
+{
+    engine.ReturnArena();
+}
 
-    output = interpreter->output(0);
-    
-    TF_LITE_REPORT_ERROR(error_reporter, "\nOutput:");
-    TF_LITE_REPORT_ERROR(error_reporter, "Dimension size:   %d", output->dims->size);
-    TF_LITE_REPORT_ERROR(error_reporter, "First Dimension:  %d", output->dims->data[0]);
-    TF_LITE_REPORT_ERROR(error_reporter, "Rows:             %d", output->dims->data[1]);
-    TF_LITE_REPORT_ERROR(error_reporter, "Output type:      %d", output->type);
+/*!
+ * @brief   Returns name of the model that is used for inference
+ */
+const char * inference_model_name()
+{
+    return current_model->name;
+}
 
-    return true;
+/*!
+ * @brief   Returns CRC-32 of the model that is used for inference, it 
+ *          identifies the model in config_store.h
+ */
+uint32_t inference_model_id()
+{
+    return *current_model->crc32;
 }
 
-bool inference_exe(uint16_t frame[60][82])
+/*!
+ * @brief   Runs inference on a frame
+ *
+ * @param[in] frame     AGC pixels
+ * @param[in] stamp     Arrival of the frame, stages of its latency are 
+ *                      recorded once its result is reported, can be NULL
+ *
+ * @return  True if inference was successful
+ */
+bool inference_exe(uint8_t frame[60][80], const flir_timestamp_t * stamp)
 {
+#ifdef ETH_UDP
+    // Every frame, also the ones the model does not see
+    eth_send_frame(frame);
+#endif
+    if (frame_can_skip() || frame_is_tracked(frame))
+    {
+        return true;
+    }
+
     printf("\nExecuting ML\n");
     //load_test_data(input, image0);
     load_data(input, frame);
 
-    uint32_t start = millis();
-    TfLiteStatus invoke_status = interpreter->Invoke();
-    if (invoke_status != kTfLiteOk) {
-        TF_LITE_REPORT_ERROR(error_reporter, "Invoke failed");
+    // Motion gate is much cheaper, so gate model only sees frames with motion
+    frame_idle = !frame_has_motion() || !frame_has_presence(frame);
+    if (frame_idle)
+    {
+        frame_classified();
+        return true;
+    }
+
+#ifdef VISIBLE_CLASSIFIER
+    // Gate found something in the thermal frame, classifier looks at the 
+    // same scene through the visible camera
+    uint8_t (*visible)[80] = visible_next_frame();
+    if (!visible)
+    {
+        frame_idle = true;
+        frame_classified();
+        return true;
+    }
+    load_data(input, visible);
+#elif defined(CASCADE)
+    // Gate activations share scratch with classifier input, load it again
+    load_data(input, frame);
+#endif
+
+    clock_boost_begin();
+    uint64_t start_us = micros();
+    bool invoked = classifier_invoke();
+    uint64_t end_us = micros();
+    clock_boost_end();
+    if (!invoked) 
+    {
         return false;
     }
-    uint32_t end = millis();
-    output = interpreter->output(0);
 
-    duration = end - start;
+    duration = (end_us - start_us) / 1000;
+    latency_invoked(stamp, start_us, end_us);
+    result_update();
+    frame_classified();
+#ifdef BINARY_TELEMETRY
+    send_telemetry();
+#endif
     return true;
 }
 
-void get_inference_results(char * buf, uint16_t max_len)
+/*!
+ * @brief   Captures frame straight into the input tensor, without 
+ *          intermediate frame buffer, and runs inference on it
+ *
+ * @return  True if inference was successful
+ *
+ * @note    Offset conversion is done by flir module while packets 
+ *          are arriving, so load_data() is not needed here.
+ *          Results are read with get_inference_results().
+ */
+bool inference_capture_exe()
+{
+    // Frame is not even captured, FLIR keeps sending on its own
+    if (frame_can_skip())
+    {
+        return true;
+    }
+
+#ifdef STREAM_FIRST_LAYER
+    return stream_capture_exe();
+#else
+    uint32_t capture_start = millis();
+    TRACE(TRACE_CAPTURE_BEGIN, 0);
+    if (!flir_capture_image_start(input->data.int8))
+    {
+        TRACE(TRACE_CAPTURE_END, 0);
+        return false;
+    }
+
+    flir_capture_wait();
+    for (uint8_t skipped = 0; 
+         skipped < FLIR_MAX_SKIPPED_FRAMES && !flir_frame_usable(); 
+         skipped++)
+    {
+        flir_capture_image_start(input->data.int8);
+        flir_capture_wait();
+    }
+    TRACE(TRACE_CAPTURE_END, 1);
+    capture_duration = millis() - capture_start;
+    flir_timestamp_t stamp;
+    bool stamped = flir_get_frame_timestamp(&stamp);
+
+    frame_idle = !frame_has_motion();
+    if (frame_idle)
+    {
+        return true;
+    }
+
+    printf("\nExecuting ML\n");
+
+    clock_boost_begin();
+    uint64_t start_us = micros();
+    bool invoked = classifier_invoke();
+    uint64_t end_us = micros();
+    clock_boost_end();
+    if (!invoked) 
+    {
+        return false;
+    }
+
+    duration = (end_us - start_us) / 1000;
+    latency_invoked(stamped ? &stamp : NULL, start_us, end_us);
+    result_update();
+#ifdef BINARY_TELEMETRY
+    send_telemetry();
+#endif
+    return true;
+#endif
+}
+
+#ifdef STREAM_FIRST_LAYER
+/*!
+ * @brief   Image rows that capture converted into the input tensor, 
+ *          ready callback of ConvRowStream
+ *
+ * @note    Resynchronisation is served here, first layer waits for it.
+ */
+static int stream_rows_ready(uint32_t * frame)
 {
-    snprintf(buf, max_len, "ML: %f %f %f %f %ld\n", output->data.f[0],
-                                                    output->data.f[1],
-                                                    output->data.f[2],
-                                                    output->data.f[3],
-                                                    duration);
+    flir_capture_poll();
+    return flir_capture_image_rows(frame);
 }
 
-static void load_test_data(TfLiteTensor * input, const signed char * data)
+/*!
+ * @brief   Sleeps until next row is converted or capture has to be polled
+ */
+static void stream_rows_wait()
+{
+    uint32_t timeout = flir_capture_needs_poll() ? 
+                       flir_capture_poll_delay() : EVENT_FOREVER;
+    if (timeout)
+    {
+        event_wait(EVENT_CAPTURE | EVENT_CAPTURE_ROW, timeout);
+    }
+}
+
+static ConvRowSource stream_source = {nullptr, 
+                                      stream_rows_ready, 
+                                      stream_rows_wait};
+
+/*!
+ * @brief   Captures frame into the input tensor and runs Invoke() while 
+ *          its packets arrive
+ *
+ * @param[out] whole    True if first layer convolved exactly the frame 
+ *                      that capture completed
+ * @param[out] start_us When Invoke() started, together with capture
+ * @param[out] end_us
+ *
+ * @return  False if capture did not start or Invoke() failed
+ */
+static bool stream_invoke(bool * whole, uint64_t * start_us, uint64_t * end_us)
 {
-    for (int i = 0; i < input->bytes; ++i)
+    *whole = false;
+    if (!flir_capture_image_start(input->data.int8))
     {
-        input->data.int8[i] = data[i];
+        return false;
     }
+
+    stream_source.data = input->data.int8;
+    ConvRowStream::Set(&stream_source);
+    *start_us = micros();
+    bool invoked = classifier_invoke();
+    *end_us = micros();
+    uint32_t streamed_frame;
+    bool streamed = ConvRowStream::streamed(&streamed_frame);
+    ConvRowStream::Set(nullptr);
+
+    // Model whose first node is not the specialised Conv2D ran on a 
+    // partial frame, as did Invoke() that failed
+    flir_capture_wait();
+    uint32_t frame;
+    *whole = streamed && 
+             flir_capture_image_rows(&frame) == FLIR_FRAME_ROWS && 
+             frame == streamed_frame;
+    return invoked;
 }
 
-static void load_data(TfLiteTensor * input, uint16_t frame[60][82])
+/*!
+ * @brief   inference_capture_exe() with first layer streamed, look at 
+ *          STREAM_FIRST_LAYER
+ *
+ * @note    Frame is known to be usable only once it is complete, so an 
+ *          unusable frame costs the whole Invoke(). When no attempt 
+ *          convolved the frame it completed, last frame is invoked again 
+ *          from the tensor. Invoke latency is counted from the last 
+ *          packet, which is what streaming shortens.
+ */
+static bool stream_capture_exe()
 {
+    uint32_t capture_start = millis();
+    bool whole = false;
+    uint64_t start_us;
+    uint64_t end_us;
 
-    /* Explanation: frame is pointer of pointers, to make pointer arithmetic 
-     * work on element to element basis we cast it to uint16_t*, then we can
-     * move around this array simply by changing i.
-     * We then difference the pointer to get the actual value and then cast it to
-     * int16_t, subtract the mean, and cast again, this time to int8_t, as this 
-     * is expected by interpreter.
-     * */
-    for(uint8_t row = 0; row < 60; row++) {
-        for(uint8_t col = 2; col < 80; col++)
+    printf("\nExecuting ML\n");
+
+    clock_boost_begin();
+    for (uint8_t skipped = 0; ; skipped++)
+    {
+        if (!stream_invoke(&whole, &start_us, &end_us))
+        {
+            clock_boost_end();
+            return false;
+        }
+        // Called once for each frame, it remembers the frame counter
+        bool usable = flir_frame_usable();
+        if ((usable && whole) || skipped >= FLIR_MAX_SKIPPED_FRAMES)
         {
-            input->data.int8[row * 80 + col - 2] = (int8_t)(((int16_t)frame[row][col]) - 128);
+            break;
         }
     }
-    //for (int i = 0; i < input->bytes; ++i)
-    //{
-    //    input->data.int8[i] = (int8_t)(((int16_t)*((uint16_t *)frame + i)) - 128);
-    //}
+    capture_duration = millis() - capture_start;
+
+    // Tensor holds the last frame complete, only Invoke() missed it
+    bool invoked = true;
+    if (!whole)
+    {
+        start_us = micros();
+        invoked = classifier_invoke();
+        end_us = micros();
+    }
+    clock_boost_end();
+    if (!invoked)
+    {
+        return false;
+    }
+
+    flir_timestamp_t stamp;
+    bool stamped = flir_get_frame_timestamp(&stamp);
+    if (whole && stamped && stamp.complete_us < end_us)
+    {
+        start_us = stamp.complete_us;
+    }
+
+    frame_idle = !frame_has_motion();
+    if (frame_idle)
+    {
+        return true;
+    }
+
+    duration = (end_us - start_us) / 1000;
+    latency_invoked(stamped ? &stamp : NULL, start_us, end_us);
+    result_update();
+#ifdef BINARY_TELEMETRY
+    send_telemetry();
+#endif
+    return true;
+}
+#endif
+
+#ifndef ZERO_COPY_CAPTURE
+/*!
+ * @brief   Starts continuous capture of the pipeline 
+ *
+ * @return  True if capture was started
+ *
+ * @note    Call inference_setup() and flir_setup() before. Repeated frames
+ *          and frames during FFC are not queued by the stream.
+ */
+bool inference_pipeline_start()
+{
+    frame_held = false;
+#ifdef FRAME_STACK
+    // Frames before the stop are not followed by the next one
+    frame_stack_reset(&frame_stack);
+#endif
+#ifdef FLIR_RADIOMETRIC
+#if RADIOMETRIC_REMAP == RADIOMETRIC_FIXED
+    frame_remap_linear(&remap, RADIOMETRIC_LOW, RADIOMETRIC_HIGH);
+#endif
+    pipeline_running = flir_stream_start(raw_frames, 2, FLIR_FRAME_RAW16, true);
+#ifdef FLIR_SECOND
+    second_turn = false;
+    if (pipeline_running && 
+        !flir_port_stream_start(&flir_second, second_frames, 2))
+    {
+        printf("Second FLIR not streaming\n");
+    }
+#endif
+#else
+    pipeline_running = flir_stream_start(frames, 2, FLIR_FRAME_AGC8, true);
+#endif
+#ifdef VISIBLE_CLASSIFIER
+    visible_held = false;
+    // Missing camera only leaves positives of the gate without a frame
+    if (pipeline_running && !dcmi_cam_stream_start(visible_frames, 3))
+    {
+        printf("Visible camera not streaming\n");
+    }
+#endif
+    return pipeline_running;
 }
 
-static void print_result(tflite::ErrorReporter* error_reporter, 
-                         const char * title, 
-                         TfLiteTensor * output, 
-                         uint32_t duration)
+/*!
+ * @brief   Stops continuous capture of the pipeline and waits until the
+ *          frame that is being read is done
+ *
+ * @note    Next inference_pipeline_exe() starts it again. Call before
+ *          the camera is powered down.
+ */
+void inference_pipeline_stop()
+{
+    if (!pipeline_running)
+    {
+        return;
+    }
+    flir_stream_stop();
+    flir_capture_wait();
+#ifdef FLIR_SECOND
+    flir_port_stream_stop(&flir_second);
+#endif
+#ifdef VISIBLE_CLASSIFIER
+    dcmi_cam_stream_stop();
+    visible_held = false;
+#endif
+    pipeline_running = false;
+    frame_held = false;
+}
+
+/*!
+ * @brief   Takes next frame of the stream, while the other buffer is 
+ *          being filled, and runs inference on it
+ *
+ * @return  True if inference was successful
+ *
+ * @note    Capture of next frame continues over DMA while Invoke() runs, 
+ *          so capture time is hidden behind compute. Pipeline is started 
+ *          if it was not already. Repeated frames and frames captured 
+ *          during FFC are skipped, see flir_stream_start(). Results are 
+ *          read with get_inference_results().
+ */
+bool inference_pipeline_exe()
+{
+    uint8_t (*frame)[80] = pipeline_next_frame();
+    if (!frame)
+    {
+        return false;
+    }
+
+    return inference_exe(frame, &pipeline_time);
+}
+
+/*!
+ * @brief   Gives frame of the last inference back to the stream and waits 
+ *          for the next one
+ *
+ * @return  Received frame, NULL if pipeline could not be started
+ *
+ * @note    Frames that arrive while both buffers are taken are dropped 
+ *          by the stream, Lepton stays in sync.
+ */
+static uint8_t (*pipeline_next_frame())[80]
+{
+    if (!pipeline_running && !inference_pipeline_start())
+    {
+        return NULL;
+    }
+
+    if (frame_held)
+    {
+        flir_stream_release();
+    }
+
+#ifdef FLIR_SECOND
+    // After a frame of the first camera comes one of the second, if it
+    // has one queued, both are read meanwhile without the core
+    if (second_turn)
+    {
+        second_turn = false;
+        uint16_t (*second)[82] = 
+            (uint16_t (*)[82]) flir_port_stream_peek(&flir_second);
+        if (second)
+        {
+            capture_duration = 0;
+            flir_port_stream_timestamp(&flir_second, &pipeline_time);
+            normalize_frame(second, normalized_frame, 
+                            flir_port_stream_stats(&flir_second));
+            flir_port_stream_release(&flir_second);
+            return normalized_frame;
+        }
+    }
+#endif
+
+    // Only the part of capture that was not hidden behind last inference
+    uint32_t capture_start = millis();
+#ifdef FLIR_RADIOMETRIC
+    TRACE(TRACE_CAPTURE_BEGIN, 1);
+    uint16_t (*raw)[82] = (uint16_t (*)[82]) flir_stream_wait(NULL);
+    TRACE(TRACE_CAPTURE_END, raw != NULL);
+    capture_duration = millis() - capture_start;
+    if (!raw)
+    {
+        frame_held = false;
+        return NULL;
+    }
+    flir_stream_timestamp(&pipeline_time);
+
+    // Raw frame goes back to the stream as soon as it is remapped
+    normalize_frame(raw, normalized_frame, flir_stream_stats());
+#ifdef BLOB_TRACKER
+    blob_threshold_update(flir_stream_stats());
+#endif
+    flir_stream_release();
+    frame_held = false;
+#ifdef FLIR_SECOND
+    second_turn = true;
+#endif
+    return normalized_frame;
+#else
+    TRACE(TRACE_CAPTURE_BEGIN, 1);
+    uint8_t (*frame)[80] = (uint8_t (*)[80]) flir_stream_wait(NULL);
+    TRACE(TRACE_CAPTURE_END, frame != NULL);
+    capture_duration = millis() - capture_start;
+
+    frame_held = frame != NULL;
+    if (frame_held)
+    {
+        flir_stream_timestamp(&pipeline_time);
+#ifdef BLOB_TRACKER
+        blob_threshold_update(flir_stream_stats());
+#endif
+    }
+    return frame;
+#endif
+}
+
+#ifdef VISIBLE_CLASSIFIER
+/*!
+ * @brief   Gives visible frame of the last classifier run back and takes 
+ *          the newest one of the camera
+ *
+ * @return  Frame, NULL if camera sent none for DCMI_CAM_FRAME_TIMEOUT
+ *
+ * @note    Only positives of the gate get here, frames that queued up 
+ *          meanwhile are older than the thermal frame and go back unseen.
+ */
+static uint8_t (*visible_next_frame())[80]
 {
+    if (visible_held)
+    {
+        dcmi_cam_stream_release();
+    }
+    while (dcmi_cam_stream_pending() > 1)
+    {
+        dcmi_cam_stream_release();
+    }
+
+    uint8_t (*frame)[80] = (uint8_t (*)[80]) dcmi_cam_stream_wait();
+    visible_held = frame != NULL;
+    return frame;
+}
+#endif
+
+#ifdef FLIR_RADIOMETRIC
+/*!
+ * @brief   Remaps raw 14 bit frame into 8 bit pixels, as selected by 
+ *          RADIOMETRIC_REMAP in inference.h
+ *
+ * @param[in] raw       Frame with ID and CRC words
+ * @param[out] frame    Pixels that load_data() and motion gate use
+ * @param[in] stats     Of the raw frame, NULL keeps the last window
+ *
+ * @note    Auto window and equalisation use histogram that the capture 
+ *          interrupt made while packets arrived, look at 
+ *          flir_stream_stats(), so the only pass over the frame here is 
+ *          the remap, one table lookup per pixel. Bins of the histogram 
+ *          are over the range of the previous frame, as narrow as the 
+ *          scene.
+ */
+static void normalize_frame(uint16_t raw[][FLIR_PACKET_WORDS], 
+                            uint8_t frame[60][80],
+                            const frame_stats_t * stats)
+{
+    TRACE(TRACE_LOAD_BEGIN, 1);
+    const uint16_t * pixels = &raw[0][2];
+
+#if RADIOMETRIC_REMAP != RADIOMETRIC_FIXED
+    if (stats)
+    {
+#if RADIOMETRIC_REMAP == RADIOMETRIC_AUTO
+        frame_remap_linear(&remap, 
+                           frame_stats_percentile(stats, RADIOMETRIC_LOW_PM),
+                           frame_stats_percentile(stats, RADIOMETRIC_HIGH_PM));
+#else
+        frame_stats_remap(stats, &remap);
+        frame_remap_equalize(&remap, &stats->hist, RADIOMETRIC_CLIP);
+#endif
+    }
+#else
+    (void) stats;
+#endif
+
+    frame_remap_u16(&remap, pixels, 82, &frame[0][0], 80, 60);
+    TRACE(TRACE_LOAD_END, 1);
+}
+#endif
+
+#ifdef BLOB_TRACKER
+/*!
+ * @brief   Sets hot block threshold of the tracker from the histogram 
+ *          that capture made, above BLOB_HOT_PM of the pixels and at least
+ *          BLOB_MIN_CONTRAST above their mean
+ *
+ * @param[in] stats     Of the frame that pipeline_next_frame() returns, 
+ *                      NULL keeps the threshold of the previous frame
+ *
+ * @note    Radiometric statistics are in raw counts, they are taken 
+ *          through the remap of normalize_frame() to the 8 bit pixels 
+ *          that the tracker sees.
+ */
+static void blob_threshold_update(const frame_stats_t * stats)
+{
+    if (!stats)
+    {
+        return;
+    }
+
+    uint32_t hot = frame_stats_percentile(stats, BLOB_HOT_PM);
+    uint32_t mean = frame_stats_mean(stats);
+#ifdef FLIR_RADIOMETRIC
+    hot = remap.lut[frame_remap_bin(&remap, hot)];
+    mean = remap.lut[frame_remap_bin(&remap, mean)];
+#endif
+    mean += BLOB_MIN_CONTRAST;
+    hot = hot > mean ? hot : mean;
+    blob_hot = hot < 255 ? hot : 255;
+}
+#endif
+#endif
+
+#ifdef ROI_INFERENCE
+/*!
+ * @brief   Takes next frame of the pipeline, finds regions with motion in 
+ *          it and classifies each of them on its own
+ *
+ * @return  True if all inferences were successful
+ *
+ * @note    Whole frame is loaded first, motion gate works on the input
+ *          tensor. Each region is then cropped from the raw frame, which
+ *          keeps full resolution of small regions, and resized into the
+ *          input tensor. Invokes run back-to-back on the same arena, so
+ *          regions cost no memory besides their scores. Results are read
+ *          with get_roi_results().
+ */
+bool inference_roi_exe()
+{
+    uint8_t (*frame)[80] = pipeline_next_frame();
+    if (!frame)
+    {
+        return false;
+    }
+
+    load_data(input, frame);
+    roi_count = 0;
+    frame_idle = !frame_has_motion();
+    if (frame_idle)
+    {
+        return true;
+    }
+
+    roi_count = motion_gate_regions(&motion_gate, rois, INFERENCE_MAX_ROIS, 
+                                    ROI_MIN_BLOCKS);
+
+    clock_boost_begin();
+    uint32_t start = millis();
+    bool status = true;
+    for (uint8_t i = 0; i < roi_count && status; i++)
+    {
+        roi_fit(&rois[i]);
+        frame_crop_resize_u8(&frame[0][0], 80, &rois[i], input->data.int8,
+                             kNumCols, kNumRows, &input_quant);
+        status = engine_invoke(engine, 0);
+        for (uint8_t k = 0; k < kCategoryCount; k++)
+        {
+            roi_scores[i][k] = scores.Milli(k);
+        }
+    }
+    duration = millis() - start;
+    clock_boost_end();
+
+    return status;
+}
+
+/*!
+ * @brief   Grows region by one block on each side and to the aspect ratio 
+ *          of model input, so that crop is not stretched, and keeps it 
+ *          inside the frame
+ */
+static void roi_fit(frame_roi_t * roi)
+{
+    int32_t w = roi->w + 2 * MOTION_BLOCK;
+    int32_t h = roi->h + 2 * MOTION_BLOCK;
+    int32_t cx = roi->x + roi->w / 2;
+    int32_t cy = roi->y + roi->h / 2;
+
+    if (w * kNumRows < h * kNumCols)
+    {
+        w = h * kNumCols / kNumRows;
+    }
+    h = w * kNumRows / kNumCols;
+
+    // Upscaling more than 4 times only enlarges noise
+    if (w < kNumCols / 4)
+    {
+        w = kNumCols / 4;
+        h = kNumRows / 4;
+    }
+    if (w > kNumCols)
+    {
+        w = kNumCols;
+        h = kNumRows;
+    }
+
+    int32_t x = cx - w / 2;
+    int32_t y = cy - h / 2;
+    x = x < 0 ? 0 : (x + w > kNumCols ? kNumCols - w : x);
+    y = y < 0 ? 0 : (y + h > kNumRows ? kNumRows - h : y);
+
+    roi->x = x;
+    roi->y = y;
+    roi->w = w;
+    roi->h = h;
+}
+
+/*!
+ * @brief   Writes number of regions and one line per region with its crop
+ *          and scores, duration covers all regions
+ */
+void get_roi_results(char * buf, uint16_t max_len)
+{
+    int len = snprintf(buf, max_len, "ROI: %d %ld\n", roi_count, duration);
+
+    for (uint8_t i = 0; i < roi_count && len > 0 && len < max_len; i++)
+    {
+        len += snprintf(&buf[len], max_len - len, "ROI: %d %d %d %d ", 
+                        rois[i].x, rois[i].y, rois[i].w, rois[i].h);
+        if (len >= max_len)
+        {
+            break;
+        }
+        len += OutputScores::FormatMilli(&buf[len], max_len - len, 
+                                         roi_scores[i], kCategoryCount);
+        len += snprintf(&buf[len], max_len - len, "\n");
+    }
+}
+#endif
+
+/*!
+ * @brief           Runs back-to-back inferences on the test images and 
+ *                  prints cycles and time spent in each phase 
+ *
+ * @param[in] runs  Number of inferences, images are used in turn
+ *
+ * @return          True if all inferences were successful
+ *
+ * @note            Marker pin of each phase is high while the phase runs,
+ *                  so current measured on a scope can be split by phase 
+ *                  and integrated into energy per inference. Capture 
+ *                  only builds a frame from the test image, the way FLIR
+ *                  would send it, so the FLIR itself is not needed.
+ *                  Clock policy is applied as in normal operation.
+ */
+bool inference_benchmark(uint32_t runs)
+{
+    uint64_t cycles[BENCH_PHASES] = {0};
+    uint64_t us[BENCH_PHASES] = {0};
+    char buf[128];
+    bool status = bench_images_ready();
+
+    // Benchmark always invokes, results of every run are reported
+    frame_idle = false;
+
+    printf("\nBenchmark: %ld runs, model %s, clock %s\n", 
+           runs, current_model->name, clock_policy_name());
+
+    for (uint32_t run = 0; run < runs && status; run++)
+    {
+        for (uint32_t phase = 0; phase < BENCH_PHASES; phase++)
+        {
+            gpio_set(MARKER_PORT, bench_phases[phase].marker);
+            uint32_t start_cycles = dwt_read_cycle_counter();
+            uint64_t start_us = micros();
+
+            switch (phase)
+            {
+                case BENCH_CAPTURE:
+                    bench_capture(bench_images[run % 5]);
+                break;
+
+                case BENCH_PREPROCESS:
+                    load_data(input, bench_frame);
+                break;
+
+                case BENCH_INVOKE:
+                    clock_boost_begin();
+                    status = engine_invoke(engine, 0);
+                    clock_boost_end();
+                break;
+
+                case BENCH_REPORT:
+                    get_inference_results(buf, sizeof(buf));
+                    uart_tx_write(buf, strlen(buf));
+                break;
+            }
+
+            // Cycles are counted with the clock of the phase itself
+            cycles[phase] += dwt_read_cycle_counter() - start_cycles;
+            us[phase] += micros() - start_us;
+            gpio_clear(MARKER_PORT, bench_phases[phase].marker);
+
+            if (!status)
+            {
+                break;
+            }
+        }
+    }
+
+    if (!status || runs == 0)
+    {
+        return false;
+    }
+
+    printf("phase        cycles/run   us/run\n");
+    for (uint32_t phase = 0; phase < BENCH_PHASES; phase++)
+    {
+        printf("%-12s %10lu %8lu\n", 
+               bench_phases[phase].name, 
+               (uint32_t)(cycles[phase] / runs), 
+               (uint32_t)(us[phase] / runs));
+    }
+    return true;
+}
+
+/*!
+ * @brief           Measures Invoke() with every combination of I-cache, 
+ *                  D-cache, ART and flash prefetch
+ *
+ * @param[in] runs  Measured inferences per combination, test images are 
+ *                  used in turn
+ *
+ * @return          True if all inferences were successful
+ *
+ * @note            Each combination first runs one inference that is not 
+ *                  measured, so caches are warm as in normal operation. 
+ *                  Invoke marker pin is high during measured inferences
+ *                  and report marker while the result line is printed, so
+ *                  current of each combination can be read off the scope
+ *                  or averaged by power analyzer over invoke marker. 
+ *                  Setting from before the sweep is restored.
+ */
+bool inference_cache_sweep(uint32_t runs)
+{
+    uint8_t previous = fastflash_get();
+    bool status = runs > 0 && bench_images_ready();
+
+    frame_idle = false;
+
+    printf("\nCache sweep: %ld runs, model %s, clock %s\n", 
+           runs, current_model->name, clock_policy_name());
+    printf("icache dcache art prefetch   cycles/run   us/run\n");
+
+    for (uint8_t config = 0; config < FASTFLASH_COMBINATIONS && status; 
+         config++)
+    {
+        fastflash_set(config);
+        bench_capture(bench_images[0]);
+        load_data(input, bench_frame);
+        status = engine_invoke(engine, 0);
+
+        uint64_t cycles = 0;
+        uint64_t us = 0;
+        for (uint32_t run = 0; run < runs && status; run++)
+        {
+            bench_capture(bench_images[run % 5]);
+            load_data(input, bench_frame);
+
+            gpio_set(MARKER_PORT, MARKER_INVOKE);
+            uint32_t start_cycles = dwt_read_cycle_counter();
+            uint64_t start_us = micros();
+            clock_boost_begin();
+            status = engine_invoke(engine, 0);
+            clock_boost_end();
+            cycles += dwt_read_cycle_counter() - start_cycles;
+            us += micros() - start_us;
+            gpio_clear(MARKER_PORT, MARKER_INVOKE);
+        }
+
+        if (status)
+        {
+            gpio_set(MARKER_PORT, MARKER_REPORT);
+            printf("%6d %6d %3d %8d %12lu %8lu\n", 
+                   (config & FASTFLASH_ICACHE) != 0, 
+                   (config & FASTFLASH_DCACHE) != 0, 
+                   (config & FASTFLASH_ART) != 0, 
+                   (config & FASTFLASH_PREFETCH) != 0, 
+                   (uint32_t)(cycles / runs), (uint32_t)(us / runs));
+            // Printing runs with the setting under test, so it goes out here
+            uart_tx_flush(100);
+            gpio_clear(MARKER_PORT, MARKER_REPORT);
+        }
+    }
+
+    fastflash_set(previous);
+    return status;
+}
+
+/*!
+ * @brief           Measures Invoke() right after caches were emptied and 
+ *                  once more on the same input with caches warm
+ *
+ * @param[in] runs  Cold and warm pairs, test images are used in turn
+ *
+ * @return          True if all inferences were successful
+ *
+ * @note            Duty cycled deployment wakes up, classifies a frame or 
+ *                  two and sleeps, so it only ever sees the cold case, 
+ *                  weights and code come from flash again after STOP. 
+ *                  fastflash_flush() empties I-cache, D-cache and ART 
+ *                  before each cold run and keeps them enabled, so the
+ *                  difference to the warm run is the cost of refilling
+ *                  them. Invoke marker pin is high during cold runs only.
+ */
+bool inference_cold_bench(uint32_t runs)
+{
+    uint32_t cold_min = UINT32_MAX, cold_max = 0;
+    uint32_t warm_min = UINT32_MAX, warm_max = 0;
+    uint64_t cold_total = 0, cold_us = 0;
+    uint64_t warm_total = 0, warm_us = 0;
+    bool status = runs > 0 && bench_images_ready();
+
+    frame_idle = false;
+
+    printf("\nCold and warm: %ld runs, model %s, clock %s, caches %x\n", 
+           runs, current_model->name, clock_policy_name(), fastflash_get());
+
+    for (uint32_t run = 0; run < runs && status; run++)
+    {
+        bench_capture(bench_images[run % 5]);
+        load_data(input, bench_frame);
+
+        for (uint32_t warm = 0; warm < 2 && status; warm++)
+        {
+            if (!warm)
+            {
+                fastflash_flush();
+                gpio_set(MARKER_PORT, MARKER_INVOKE);
+            }
+            uint32_t start_cycles = dwt_read_cycle_counter();
+            uint64_t start_us = micros();
+            clock_boost_begin();
+            status = engine_invoke(engine, 0);
+            clock_boost_end();
+            uint32_t cycles = dwt_read_cycle_counter() - start_cycles;
+            uint64_t us = micros() - start_us;
+            gpio_clear(MARKER_PORT, MARKER_INVOKE);
+
+            if (!warm)
+            {
+                cold_total += cycles;
+                cold_us += us;
+                cold_min = cycles < cold_min ? cycles : cold_min;
+                cold_max = cycles > cold_max ? cycles : cold_max;
+            }
+            else
+            {
+                warm_total += cycles;
+                warm_us += us;
+                warm_min = cycles < warm_min ? cycles : warm_min;
+                warm_max = cycles > warm_max ? cycles : warm_max;
+            }
+        }
+    }
+
+    if (!status || warm_total == 0)
+    {
+        return false;
+    }
+
+    uint32_t cold_mean = (uint32_t)(cold_total / runs);
+    uint32_t warm_mean = (uint32_t)(warm_total / runs);
+    printf("        min cycles  mean cycles   max cycles  mean us\n");
+    printf("cold  %12lu %12lu %12lu %8lu\n", cold_min, cold_mean, cold_max,
+           (uint32_t)(cold_us / runs));
+    printf("warm  %12lu %12lu %12lu %8lu\n", warm_min, warm_mean, warm_max,
+           (uint32_t)(warm_us / runs));
+    printf("cold/warm %lu.%02lu\n", cold_mean / warm_mean, 
+           cold_mean % warm_mean * 100 / warm_mean);
+    return true;
+}
+
+#ifdef TARGET_BENCH
+/*!
+ * @brief   Measures Invoke() and its operators with caches off and on, 
+ *          firmware of make bench, see shared/target_bench.h
+ *
+ * @return  True if all inferences ran
+ *
+ * @note    Test images are the ones of BENCH, they are copied into the 
+ *          input as they are, without capture and load_data(). Call it 
+ *          after inference_setup() and before capture starts.
+ */
+bool inference_target_bench()
+{
+    if (!bench_images_ready())
+    {
+        return false;
+    }
+
+    static const char * const names[] = {
+        "image0", "image1", "image2", "image3", "image4",
+    };
+    TargetBenchImage images[5];
+    for (uint32_t i = 0; i < 5; i++)
+    {
+        images[i] = {names[i], bench_images[i], kTargetBenchNoLabel};
+    }
+    TargetBenchConfig config = {20, 2, TARGET_BENCH_SWEEP};
+    return target_bench_run(current_model->name, engine.interpreter(), 
+                            profiler, images, 5, config, error_reporter);
+}
+#endif
+
+#ifdef KERNEL_BENCH
+/*!
+ * @brief   Name of RAM that a buffer starts in, on stm32f767zi
+ */
+static const char * kbench_ram_name(const void * data)
+{
+#ifdef EXT_SDRAM
+    if ((uint32_t) data >= SDRAM_ADDRESS)
+    {
+        return "sdram";
+    }
+#endif
+    return (uint32_t) data < 0x20020000 ? "dtcm" : "sram1";
+}
+
+/*!
+ * @brief   Measures single CMSIS-NN kernels, firmware of make kbench, 
+ *          see shared/kernel_bench.h
+ *
+ * @return  True if all kernels ran
+ *
+ * @note    Operands go to the arena, which is borrowed and starts in 
+ *          DTCM, to kbench_ram and, weights only, to the model in flash 
+ *          through AXIM and through ITCM interface. With EXT_SDRAM 
+ *          SDRAM is measured too, a model in QSPI flash replaces both 
+ *          flash interfaces. Call it after inference_setup() and before 
+ *          capture starts.
+ */
+bool inference_kernel_bench()
+{
+    size_t arena_bytes;
+    int8_t * arena = (int8_t *) inference_borrow_arena(&arena_bytes);
+
+    KernelBenchMemory memories[5];
+    int count = 0;
+    if (arena)
+    {
+        memories[count++] = {kbench_ram_name(arena), arena, arena_bytes, 
+                             true};
+    }
+    memories[count++] = {kbench_ram_name(kbench_ram), kbench_ram, 
+                         sizeof(kbench_ram), true};
+#ifdef EXT_SDRAM
+    if (sdram_ready())
+    {
+        memories[count++] = {kbench_ram_name(kbench_sdram), kbench_sdram,
+                             sizeof(kbench_sdram), true};
+    }
+#endif
+#ifdef QSPI_MODEL
+    // Model in QSPI flash has no ITCM alias
+    if ((uint32_t) current_model->data >= QSPI_FLASH_ADDRESS)
+    {
+        memories[count++] = {"qspi", (const int8_t *) current_model->data,
+                             *current_model->len, false};
+    }
+    else
+#endif
+    {
+        memories[count++] = {"flash_axim", 
+                             (const int8_t *) current_model->data,
+                             *current_model->len, false};
+        memories[count++] = {"flash_itcm", (const int8_t *) 
+                             flash_itcm_alias(current_model->data), 
+                             *current_model->len, false};
+    }
+
+    KernelBenchConfig config = {10, 2};
+    bool status = kernel_bench_run(memories, count, config, error_reporter);
+    if (arena)
+    {
+        inference_return_arena();
+    }
+    return status;
+}
+#endif
+
+/*!
+ * @brief           Runs the interpreter on variants of the test set for a 
+ *                  long time and checks that results and latency hold
+ *
+ * @param[in] runs  Inferences, 0 runs until stop returns true
+ * @param[in] stop  Checked after every inference, can be NULL
+ *
+ * @return          True if all inferences were successful
+ *
+ * @note            Variant of each run is generated from its number, with
+ *                  shift, brightness and noise of frame_augment.h, so a
+ *                  soak can be repeated exactly. Class of each variant is 
+ *                  compared with the class of its clean test image, runs 
+ *                  that differ are unstable, their share tells how robust 
+ *                  the model is. Every SOAK_REPLAY_RUNS a variant is run a 
+ *                  second time and its output has to be identical, which 
+ *                  catches arena corruption or memory faults. Invoke() 
+ *                  latency goes into a histogram, its p99 against p50 
+ *                  shows jitter of throttling, caches and interrupts. 
+ *                  Report is printed every SOAK_REPORT_RUNS and at the end.
+ */
+bool inference_soak(uint32_t runs, bool (*stop)())
+{
+    uint8_t reference[5];
+    uint8_t replay[64];
+    uint32_t replay_bytes = output->bytes < sizeof(replay) ? output->bytes : 
+                                                             sizeof(replay);
+    uint32_t unstable = 0;
+    uint32_t mismatches = 0;
+    uint32_t us;
+    uint32_t run = 0;
+    bool status = bench_images_ready();
+
+    frame_idle = false;
+    latency_hist_reset(&soak_latency);
+
+    printf("\nSoak: %ld runs, model %s, clock %s\n", 
+           runs, current_model->name, clock_policy_name());
+
+    // Classes of the clean test images
+    for (uint32_t image = 0; image < 5 && status; image++)
+    {
+        bench_capture(bench_images[image]);
+        load_data(input, bench_frame);
+        status = engine_invoke(engine, 0);
+        reference[image] = soak_top_class();
+    }
+
+    while (status && (runs == 0 || run < runs))
+    {
+        status = soak_invoke(run, &us);
+        if (!status)
+        {
+            break;
+        }
+        latency_hist_add(&soak_latency, us);
+        if (soak_top_class() != reference[run % 5])
+        {
+            unstable++;
+        }
+
+        if (run % SOAK_REPLAY_RUNS == 0)
+        {
+            memcpy(replay, output->data.raw, replay_bytes);
+            status = soak_invoke(run, &us);
+            if (status && 0 != memcmp(replay, output->data.raw, replay_bytes))
+            {
+                mismatches++;
+            }
+        }
+
+        run++;
+        bool last = (runs && run >= runs) || (stop && stop());
+        if (last || run % SOAK_REPORT_RUNS == 0)
+        {
+            uint32_t p50 = latency_hist_percentile(&soak_latency, 500);
+            uint32_t p99 = latency_hist_percentile(&soak_latency, 990);
+            printf("Soak: %lu runs, %lu unstable, %lu mismatches, "
+                   "invoke p50 %lu p99 %lu max %lu us, jitter %lu us\n", 
+                   run, unstable, mismatches, p50, p99, 
+                   soak_latency.max, p99 - p50);
+        }
+        if (last)
+        {
+            break;
+        }
+    }
+
+    return status && mismatches == 0;
+}
+
+/*!
+ * @brief           Builds variant of a run and invokes the model on it
+ *
+ * @param[in] run   Number of the run, selects test image and variant
+ * @param[out] us   Duration of Invoke()
+ */
+static bool soak_invoke(uint32_t run, uint32_t * us)
+{
+    uint32_t state = frame_rng_seed(run);
+    frame_augment_t augment = frame_augment_random(&state, &soak_limits);
+
+    bench_capture(bench_images[run % 5]);
+    frame_augment_u8(&bench_frame[0][0], &soak_frame[0][0], 80, 60, 
+                     &augment, &state);
+    load_data(input, soak_frame);
+
+    clock_boost_begin();
+    uint64_t start_us = micros();
+    bool status = engine_invoke(engine, 0);
+    *us = micros() - start_us;
+    clock_boost_end();
+    return status;
+}
+
+/*!
+ * @brief           Returns class with the highest score of the last Invoke()
+ */
+static uint8_t soak_top_class()
+{
+    uint8_t top = 0;
+    for (uint8_t i = 1; i < kCategoryCount; i++)
+    {
+        if (scores.Milli(i) > scores.Milli(top))
+        {
+            top = i;
+        }
+    }
+    return top;
+}
+
+#ifndef MINICOM_SHELL
+/*!
+ * @brief           Classifies input tensors that host streams over the
+ *                  console, look at eval_stream.py in root directory
+ *
+ * @param[in] count Number of tensors
+ *
+ * @return          False if host stopped sending or Invoke() failed
+ *
+ * @note            Line "EVAL SEND n" asks for tensor n, host answers with
+ *                  quantized input bytes and their CRC-32, DMA puts them
+ *                  into eval_block. Tensor n + 1 is asked for as soon as
+ *                  n is copied into the input, so it comes in while n is
+ *                  invoked. Each tensor is answered with "EVAL n cycles us
+ *                  o0 o1 ..." with raw int8 outputs, or with "EVAL n CRC"
+ *                  if it was damaged on the way, it is not invoked then.
+ *                  Capture, normalisation, gates and filters are left
+ *                  out, tensor goes to the classifier as it is.
+ */
+bool inference_eval(uint32_t count)
+{
+    const uint32_t len = input->bytes;
+    bool status = true;
+
+    if (output->type != kTfLiteInt8)
+    {
+        printf("EVAL needs int8 output\n");
+        return false;
+    }
+    if (count == 0 || !console_raw_start(eval_block, len + 4))
+    {
+        return false;
+    }
+    frame_idle = false;
+
+    put_line("EVAL READY %lu %lu", len, (uint32_t) output->bytes);
+    put_line("EVAL SEND 0");
+    for (uint32_t n = 0; n < count; n++)
+    {
+        if (!console_raw_wait(len + 4, EVAL_TIMEOUT))
+        {
+            put_line("EVAL %lu TIMEOUT", n);
+            status = false;
+            break;
+        }
+        dma_buf_invalidate(eval_block, len + 4);
+        uint32_t crc;
+        memcpy(&crc, eval_block + len, sizeof(crc));
+        bool intact = crc_hw_crc32(0, eval_block, len) == crc;
+        if (intact)
+        {
+            memcpy(input->data.int8, eval_block, len);
+        }
+
+        // Next tensor is on the way while this one is invoked
+        if (n + 1 < count)
+        {
+            console_raw_start(eval_block, len + 4);
+            put_line("EVAL SEND %lu", n + 1);
+        }
+        if (!intact)
+        {
+            put_line("EVAL %lu CRC", n);
+            continue;
+        }
+
+        uint32_t start_cycles = dwt_read_cycle_counter();
+        uint64_t start_us = micros();
+        clock_boost_begin();
+        bool invoked = engine_invoke(engine, 0);
+        clock_boost_end();
+        uint32_t cycles = dwt_read_cycle_counter() - start_cycles;
+        uint32_t us = (uint32_t) (micros() - start_us);
+        if (!invoked)
+        {
+            put_line("EVAL %lu FAILED", n);
+            status = false;
+            break;
+        }
+
+        char line[160];
+        int pos = snprintf(line, sizeof(line), "EVAL %lu %lu %lu",
+                           n, cycles, us);
+        for (size_t i = 0; i < output->bytes && pos < (int) sizeof(line);
+             i++)
+        {
+            pos += snprintf(line + pos, sizeof(line) - pos, " %d",
+                            output->data.int8[i]);
+        }
+        put_line("%s", line);
+    }
+
+    console_raw_stop();
+    return status;
+}
+#endif
+
+#if defined(MODEL_UPDATE) && !defined(MINICOM_SHELL)
+/*!
+ * @brief           Starts update of the flash slot with a model of len 
+ *                  bytes, UPLOAD commands bring it and COMMIT switches
+ *
+ * @return          False if model does not fit or flash is busy
+ *
+ * @note            Slot is erased in the background. Model of the slot 
+ *                  is replaced by the first built-in one first if it is
+ *                  in use, classification goes on with that one.
+ */
+bool inference_update_begin(uint32_t len)
+{
+    if (current_model == slot_model && 
+        !inference_load_model(models[0].name))
+    {
+        return false;
+    }
+    if (!model_slot_begin(len))
+    {
+        printf("Update of %lu bytes refused, slot has %u\n", len, 
+               MODEL_SLOT_SIZE - MODEL_SLOT_HEADER);
+        return false;
+    }
+    slot_len = 0;
+    update_len = len;
+    update_block = 0;
+    if (!flash_dual_bank())
+    {
+        printf("Flash is single bank, capture stalls while it is written\n");
+    }
+    return true;
+}
+
+/*!
+ * @brief           Receives the next chunk of the update and starts its
+ *                  programming, like a tensor of EVAL with CRC-32 behind it
+ *
+ * @return          False if update is complete, chunk did not arrive in
+ *                  time, was damaged or flash failed, host sends the same
+ *                  offset again then
+ *
+ * @note            Programming goes on after return, the next chunk is 
+ *                  received into the other buffer meanwhile. Erase of 
+ *                  the slot has to be over before the first chunk is
+ *                  programmed, host waits up to MODEL_SLOT_ERASE_TIMEOUT.
+ */
+bool inference_update_upload()
+{
+    uint32_t offset = model_slot_received();
+    uint32_t bytes = update_len - offset;
+    if (bytes > MODEL_SLOT_CHUNK)
+    {
+        bytes = MODEL_SLOT_CHUNK;
+    }
+    uint8_t * block = update_blocks[update_block];
+    if (bytes == 0 || !console_raw_start(block, bytes + 4))
+    {
+        return false;
+    }
+
+    put_line("UPLOAD SEND %lu %lu", offset, bytes);
+    bool received = console_raw_wait(bytes + 4, MODEL_SLOT_TIMEOUT);
+    console_raw_stop();
+    if (!received)
+    {
+        put_line("UPLOAD %lu TIMEOUT", offset);
+        return false;
+    }
+
+    dma_buf_invalidate(block, bytes + 4);
+    uint32_t crc;
+    memcpy(&crc, block + bytes, sizeof(crc));
+    if (crc_hw_crc32(0, block, bytes) != crc)
+    {
+        put_line("UPLOAD %lu CRC", offset);
+        return false;
+    }
+    if (!model_slot_write(block, bytes))
+    {
+        put_line("UPLOAD %lu FLASH", offset);
+        return false;
+    }
+    update_block ^= 1;
+    return true;
+}
+
+/*!
+ * @brief           Checks the update, commits it and switches to it
+ *
+ * @param[in] crc32 CRC-32 of the whole model, from host
+ *
+ * @return          False if slot model differs or can not be set up, the
+ *                  model that was in use stays then
+ *
+ * @note            Interpreter is set up again between two inferences, 
+ *                  as with MODEL command, frames keep arriving.
+ */
+bool inference_update_commit(uint32_t crc32)
+{
+    uint32_t len;
+    if (!model_slot_commit(crc32) || !model_slot_read(&len, &crc32))
+    {
+        return false;
+    }
+    slot_len = len;
+    slot_crc32 = crc32;
+    update_len = 0;
+    return inference_load_model(slot_model->name);
+}
+#endif
+
+/*!
+ * @brief   Times every CMSIS-NN kernel each Conv2D layer of the current
+ *          model is eligible for and keeps the fastest ones
+ *
+ * @return  True if layers were tuned and model is set up with them
+ *
+ * @note    Calibration Setup() requests scratch for every candidate and 
+ *          one Invoke() on a test image times them, see conv_tuning.h, 
+ *          then the model is set up again with only the chosen kernels. 
+ *          Choices are stored in config_store.h for this model, later 
+ *          setups apply them. Timing belongs to the clock and caches it 
+ *          ran with, TUNE again after CLOCK. With PREPARED_STATE stored 
+ *          state is erased, next boot prepares and stores it again.
+ */
+bool inference_tune()
+{
+    if (!bench_images_ready())
+    {
+        return false;
+    }
+    frame_idle = false;
+    printf("\nTune: model %s, clock %s, caches %x\n", 
+           current_model->name, clock_policy_name(), fastflash_get());
+
+    ConvTuning::Calibrate(tuning_cycles);
+    bool tuned = engine_setup(flash_itcm_alias(current_model->data)) && 
+                 bind_model();
+    if (tuned)
+    {
+        load_test_data(input, bench_images[0]);
+        tuned = engine_invoke(engine, 0);
+    }
+    ConvTuning::Calibrate(nullptr);
+
+    if (tuned)
+    {
+        printf("layer  kernel       wrapper    generic   1x1_fast        1xN\n");
+        for (int slot = 0; slot < ConvTuning::slots(); slot++)
+        {
+            printf("%5d  %-8s", slot, 
+                   ConvTuning::Name(ConvTuning::chosen(slot)));
+            for (int k = 0; k < ConvTuning::kKernels; k++)
+            {
+                printf(" %10lu", ConvTuning::measured(
+                    slot, static_cast<ConvTuning::Kernel>(k)));
+            }
+            printf("\n");
+        }
+        tuned = config_store_set(CONFIG_CONV_KERNELS, 
+                                 ConvTuning::Packed()) &&
+                config_store_set(CONFIG_CONV_KERNELS_MODEL, 
+                                 inference_model_id());
+    }
+
+    tuning_load(current_model);
+    bool ready = engine_setup(flash_itcm_alias(current_model->data)) && 
+                 bind_model();
+#if defined(PREPARED_STATE) && !defined(CASCADE)
+    if (ready && tuned)
+    {
+        flash_store_erase();
+    }
+#endif
+    profiler->Reset();
+    return tuned && ready;
+}
+
+/*!
+ * @brief   Prints per operator table of average cycles and percentage
+ *          over all inferences since last report 
+ *
+ * @note    Table is printed with error reporter, cycles are reset after.
+ *          Counters of the capture engine since boot follow, dropped 
+ *          frames show how much the stream outruns inference.
+ */
+void inference_profile_report()
+{
+    profiler->PrintTable();
+    profiler->Reset();
+
+    const flir_capture_stats_t * stats = flir_capture_get_stats();
+    printf("Capture: %lu frames, %lu dropped, %lu repeated, %lu FFC, "
+           "%lu flat, %lu/%lu resyncs\n", stats->frames, stats->dropped, 
+           stats->duplicates, stats->ffc_frames, stats->flat_frames, 
+           stats->soft_resyncs, stats->hard_resyncs);
+}
+
+/*!
+ * @brief   Prints latency of each stage since boot, p50, p99 and the 
+ *          largest one in us
+ *
+ * @note    Only frames that reached Invoke() and were reported with 
+ *          get_inference_results() are counted, benchmark runs are not.
+ */
+void inference_stats_report()
+{
+    printf("Latency of %lu frames in us\n", latency[LATENCY_TOTAL].count);
+    printf("%-12s %8s %8s %8s %8s\n", "stage", "mean", "p50", "p99", "max");
+    for (uint32_t stage = 0; stage < LATENCY_STAGES; stage++)
+    {
+        const latency_hist_t * hist = &latency[stage];
+        printf("%-12s %8lu %8lu %8lu %8lu\n", latency_names[stage], 
+               latency_hist_mean(hist), latency_hist_percentile(hist, 500), 
+               latency_hist_percentile(hist, 990), hist->max);
+    }
+#ifdef BLOB_TRACKER
+    printf("Tracker: %lu frames, %lu classified, %lu tracks, %u live\n",
+           blob_tracker.frames, blob_tracker.wanted, blob_tracker.started,
+           blob_tracker.count);
+#endif
+#ifdef RESULT_BUS
+    result_bus_report();
+#endif
+}
+
+void get_inference_results(char * buf, uint16_t max_len)
+{
+    uint32_t latency_us = 0;
+    bool stamped = latency_reported(&latency_us);
+#ifdef RESULT_BUS
+    result_publish(stamped, latency_us);
+#else
+    (void) stamped;
+#endif
+    if (frame_idle)
+    {
+        snprintf(buf, max_len, "ML: IDLE\n");
+        return;
+    }
+
+#ifdef RESULT_FILTER
+    // Class label, averaged scores in percent, duration of last Invoke()
+    uint8_t confirmed = result_filter_class(&result_filter);
+    int len = snprintf(buf, max_len, "ML: %s", 
+                       confirmed == RESULT_NONE ? "NONE" : 
+                                                  kCategoryLabels[confirmed]);
+    for (uint8_t i = 0; i < kCategoryCount && len > 0 && len < max_len; i++)
+    {
+        uint32_t score = result_filter_score(&result_filter, i);
+        len += snprintf(&buf[len], max_len - len, " %ld", 
+                        (score * 100 + 128) >> 8);
+    }
+    if (len > 0 && len < max_len)
+    {
+        snprintf(&buf[len], max_len - len, " %ld%s\n", duration, 
+                 frame_skipped ? " SKIP" : tracked_suffix());
+    }
+    return;
+#endif
+
+    // Scores are formatted in fixed point, without float printf
+    int len = snprintf(buf, max_len, "ML: ");
+    len += scores.Format(&buf[len], max_len - len, kCategoryCount);
+#ifdef EARLY_EXIT
+    if (len < max_len)
+    {
+        snprintf(&buf[len], max_len - len, " %ld E%d%s\n", duration, 
+                 early_exit.exit(), tracked_suffix());
+    }
+#else
+    if (len < max_len)
+    {
+        snprintf(&buf[len], max_len - len, " %ld%s\n", duration, 
+                 tracked_suffix());
+    }
+#endif
+}
+
+/*!
+ * @brief   Returns true if the last frame had something in it, motion or
+ *          presence of the gates or a live track, for the rate governor
+ *          of system_setup/rate_gov.h
+ *
+ * @note    Without MOTION_GATE, CASCADE and BLOB_TRACKER nothing tells,
+ *          so every frame is active.
+ */
+bool inference_activity()
+{
+    bool gated = false;
+    bool active = false;
+#if defined(MOTION_GATE) || defined(CASCADE)
+    gated = true;
+    active = !frame_idle;
+#endif
+#ifdef BLOB_TRACKER
+    gated = true;
+    active = active || blob_tracker.count > 0;
+#endif
+    return active || !gated;
+}
+
+#ifdef BINARY_TELEMETRY
+static void telemetry_write(const uint8_t * data, uint32_t len)
+{
+#ifdef USB_CONSOLE
+    usb_cdc_write(data, len);
+#else
+    uart_tx_write((const char *) data, len);
+#endif
+}
+
+/*!
+ * @brief   Sends input frame, scores and latency as binary telemetry 
+ *
+ * @note    Frame is taken from the input tensor, so it is exactly what 
+ *          model saw. Zero point is removed again to get 8-bit pixels,
+ *          TELEMETRY_PREVIEW of uart_tx.h sends it downscaled.
+ *          Packets go through transmit ring, so only the part that does
+ *          not fit into it blocks.
+ */
+static void send_telemetry()
+{
+    int32_t zero_point = input->params.zero_point;
+
+#if TELEMETRY_PREVIEW > 1
+    // Preview is built from strips of TELEMETRY_PREVIEW rows, input tensor
+    // itself is not changed
+    constexpr int kPreviewCols = kNumCols / TELEMETRY_PREVIEW;
+    constexpr int kPreviewRows = kNumRows / TELEMETRY_PREVIEW;
+    uint8_t strip[TELEMETRY_PREVIEW][kNumCols] __attribute__((aligned(4)));
+    uint8_t preview[kPreviewCols * kPreviewRows];
+
+    for (int y = 0; y < kPreviewRows; y++)
+    {
+        const int8_t * rows = input->data.int8 + 
+                              y * TELEMETRY_PREVIEW * kNumCols;
+        for (int i = 0; i < TELEMETRY_PREVIEW * kNumCols; i++)
+        {
+            strip[0][i] = (uint8_t)(rows[i] - zero_point);
+        }
+        frame_downscale_u8(&strip[0][0], kNumCols, kNumCols, 
+                           TELEMETRY_PREVIEW, TELEMETRY_PREVIEW, 
+                           preview + y * kPreviewCols);
+    }
+    telemetry_send_frame_u8(&telemetry, preview, kPreviewCols, kPreviewRows,
+                            kPreviewCols);
+#else
+    telemetry_begin(&telemetry, TELEMETRY_FRAME);
+    telemetry_put_u8(&telemetry, kNumCols);
+    telemetry_put_u8(&telemetry, kNumRows);
+    for (int i = 0; i < kNumCols * kNumRows; i++)
+    {
+        telemetry_put_u8(&telemetry, 
+                         (uint8_t)(input->data.int8[i] - zero_point));
+    }
+    telemetry_end(&telemetry);
+#endif
+
+    if (scores.quantized())
+    {
+        telemetry_send_scores_i8(&telemetry, 
+                                 output->data.int8, 
+                                 scores.count(), 
+                                 output->params.scale, 
+                                 output->params.zero_point);
+    }
+    else
+    {
+        telemetry_send_scores_f32(&telemetry, 
+                                  output->data.f, 
+                                  scores.count());
+    }
+    telemetry_send_latency(&telemetry, 
+                           capture_duration * 1000, 
+                           duration * 1000, 
+                           (capture_duration + duration) * 1000);
+}
+#endif
+
+/*!
+ * @brief   Checks CRC-32 of the model in flash, so a bad flash write or 
+ *          a model of another build is not given to the interpreter
+ *
+ * @note    Words are fed to CRC unit by DMA while CPU sleeps, 300 KB take
+ *          around a millisecond. CPU feeds them when DMA is not 
+ *          available.
+ */
+static bool model_check(const model_entry * entry)
+{
+    uint32_t crc = 0;
+    if (!crc_hw_crc32_dma(entry->data, *entry->len, &crc))
+    {
+        crc = crc_hw_crc32(0, entry->data, *entry->len);
+    }
+
+    if (crc != *entry->crc32)
+    {
+        printf("Model %s is corrupted, CRC-32 %08lX instead of %08lX\n", 
+               entry->name, (unsigned long) crc, 
+               (unsigned long) *entry->crc32);
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief   Creates interpreter of the classifier, with CASCADE gate model 
+ *          is set up again too, it shares the arena with the classifier
+ */
+static bool engine_setup(const void * model_data)
+{
+    scratch_resolver->Reset();
+#ifdef WEIGHT_PREFETCH
+    prefetch_resolver->Reset();
+#endif
+#ifdef CASCADE
+    // Slots of shared arena are stacked, so both models are set up in order
+    shared_arena.Reset();
+    if (!engine.Setup(model_data, shared_arena.Allocator(error_reporter), 
+                      error_reporter, profiler) ||
+        !shared_arena.Commit(error_reporter))
+    {
+        return false;
+    }
+
+    // Gate is not profiled, table shows only the classifier
+    return gate_engine.Setup(flash_itcm_alias(gate_tflite), 
+                             shared_arena.Allocator(error_reporter), 
+                             error_reporter) &&
+           shared_arena.Commit(error_reporter) &&
+           bind_gate();
+#else
+    return engine.Setup(model_data, error_reporter, profiler);
+#endif
+}
+
+/*!
+ * @brief   Applies kernels of TUNE to the next setup, if they were tuned
+ *          for this model, otherwise CMSIS-NN wrapper picks them
+ */
+static void tuning_load(const model_entry * entry)
+{
+    uint32_t model_id;
+    uint32_t packed = 0;
+    if (config_store_get(CONFIG_CONV_KERNELS_MODEL, &model_id) && 
+        model_id == *entry->crc32)
+    {
+        packed = config_store_value(CONFIG_CONV_KERNELS, 0);
+    }
+    ConvTuning::Load(packed);
+}
+
+/*!
+ * @brief   Clock of kernel calibration, CycleProfiler enabled the counter
+ */
+static uint32_t tuning_cycles()
+{
+    return dwt_read_cycle_counter();
+}
+
+#if defined(PREPARED_STATE) && !defined(CASCADE)
+/*!
+ * @brief   Writes part of engine state into flash store, for SaveState()
+ */
+static bool state_write(void * context, size_t offset, const void * data, 
+                        size_t bytes)
+{
+    (void) context;
+    return flash_store_write(offset, data, bytes);
+}
+#endif
+
+/*!
+ * @brief   Sets up the boot model, with PREPARED_STATE from the state that
+ *          the first boot of this firmware left in flash
+ *
+ * @note    Restore is the checksum of the image and of the state, under a
+ *          ms, instead of AllocateTensors(). State that is missing, from 
+ *          other firmware or damaged is written again after Setup(), 
+ *          which costs one sector erase. Model loaded later with 
+ *          inference_load_model() is always set up.
+ */
+static bool engine_boot(const void * model_data)
+{
+#if defined(PREPARED_STATE) && !defined(CASCADE)
+    // Scratch offsets of FastScratchResolver are not in the arena
+    engine_internal::StateRegion regions[] = {
+        {scratch_resolver->state(), scratch_resolver->state_size()},
+#ifdef WEIGHT_PREFETCH
+        // Layers to prefetch are found in Prepare() as well
+        {prefetch_resolver->state(), prefetch_resolver->state_size()},
+#endif
+    };
+    const size_t num_regions = sizeof(regions) / sizeof(regions[0]);
+
+    uint64_t start_us = micros();
+    uint32_t build_id = flash_store_image_crc();
+    if (engine.RestoreState(flash_store_data(), model_data, build_id, 
+                            regions, num_regions))
+    {
+        printf("Interpreter state restored from flash in %lu us\n", 
+               (uint32_t) (micros() - start_us));
+        return true;
+    }
+
+    if (!engine_setup(model_data))
+    {
+        return false;
+    }
+    size_t size = engine.StateSize(regions, num_regions);
+    if (size == 0 || size > FLASH_STORE_SIZE || !flash_store_erase() ||
+        !engine.SaveState(state_write, NULL, build_id, regions, 
+                          num_regions))
+    {
+        printf("Interpreter state was not stored\n");
+    }
+    else
+    {
+        printf("Interpreter state stored, %u bytes\n", (unsigned) size);
+    }
+    return true;
+#else
+    return engine_setup(model_data);
+#endif
+}
+
+/*!
+ * @brief   Checksum of everything AllocateTensors() left for Invoke()
+ */
+static uint32_t engine_checksum()
+{
+#ifdef CASCADE
+    uint32_t hash = engine.StateChecksum();
+    hash = gate_engine.StateChecksum(hash);
+    return shared_arena.TailChecksum(hash);
+#else
+    return engine.StateChecksum();
+#endif
+}
+
+/*!
+ * @brief   Fetches tensors of the loaded model and checks that they match 
+ *          the frame and results we work with
+ */
+/*!
+ * @brief   Tells if test images are there for benchmarks, says so if not
+ */
+static bool bench_images_ready()
+{
+    if (bench_images[0])
+    {
+        return true;
+    }
+    printf("No test images, flash them with make assets_flash\n");
+    return false;
+}
+
+#if defined(TEST_DATASET) || defined(BENCH_ASSETS)
+/*!
+ * @brief   Points test images into the linked dataset or the asset region,
+ *          samples are used in place, they are as aligned as images.cc 
+ *          arrays
+ *
+ * @return  False if there is no dataset of int8 frames of the model, 
+ *          bench_images[] are NULL then
+ *
+ * @note    Asset region is flashed apart from firmware, an erased or cut
+ *          one fails the header check or CRC-32 of its samples, which 
+ *          crc_hw.c takes over 25 KB of five frames in about 30 us.
+ */
+static bool bind_test_dataset()
+{
+    for (uint32_t i = 0; i < 5; i++)
+    {
+        bench_images[i] = nullptr;
+    }
+
+#ifdef TEST_DATASET
+    const dataset_header_t * dataset =
+        (const dataset_header_t *) test_images_mlds;
+    uint32_t size = test_images_mlds_len;
+#else
+    const dataset_header_t * dataset = 
+        (const dataset_header_t *) _bench_assets;
+    uint32_t size = BENCH_ASSET_SIZE;
+    if (!dataset_check(dataset, size) ||
+        crc_hw_crc32(0, (const uint8_t *) dataset + DATASET_BLOCK, 
+                     dataset->file_bytes - DATASET_BLOCK) != 
+        dataset->data_crc32)
+    {
+        return false;
+    }
+#endif
+    if (!dataset_check(dataset, size) || 
+        dataset->count == 0 ||
+        dataset->type != DATASET_TYPE_INT8 || 
+        dataset->sample_bytes != kMaxImageSize)
+    {
+        printf("Test dataset has to be %d byte int8 frames\n", 
+               kMaxImageSize);
+        return false;
+    }
+    for (uint32_t i = 0; i < 5; i++)
+    {
+        bench_images[i] = (const signed char *) 
+            dataset_sample(dataset, i % dataset->count);
+    }
+    return true;
+}
+#endif
+
+static bool bind_model()
+{
+    input = engine.input();
+    output = engine.output();
+    counter_set(COUNTER_ARENA_USED, engine.interpreter()->arena_used_bytes());
+
+    if (input->type != kTfLiteInt8 || input->bytes != kMaxImageSize)
+    {
+        printf("Model input has to be %d int8 pixels\n", kMaxImageSize);
+        return false;
+    }
+
+    // Models without trailing Dequantize give int8 scores, see 
+    // strip_dequantize.py, older ones float scores
+    if (!scores.Bind(output) || scores.count() < kCategoryCount)
+    {
+        printf("Model output has to be %d int8 or float scores\n", 
+               kCategoryCount);
+        return false;
+    }
+#ifdef EARLY_EXIT
+    if (!early_exit.Bind(&engine))
+    {
+        printf("Model needs 1 to %d score outputs and %d operators at most\n",
+               EarlyExit<decltype(engine)>::kMaxExits, 
+               EarlyExit<decltype(engine)>::kMaxOps);
+        return false;
+    }
+#endif
+
+    // Params of the model decide conversion, offset of -128 is only the
+    // usual case. Gamma has no linear form, ROI resize ignores it.
+    int32_t input_offset;
+    frame_quant_init(&input_quant, INPUT_MEAN, INPUT_STD, 
+                     input->params.scale, input->params.zero_point);
+    frame_lut_init(&input_lut, INPUT_GAMMA, INPUT_MEAN, INPUT_STD, 
+                   input->params.scale, input->params.zero_point);
+    input_lut_used = INPUT_GAMMA != 1.0f || 
+                     !frame_quant_is_offset(&input_quant, &input_offset);
+
+#ifdef FRAME_STACK
+    // Tensor of another model starts an empty ring
+    if (!frame_stack_init(&frame_stack, input->data.int8, 
+                          kNumRows * kNumCols, kNumChannels))
+    {
+        printf("Frame stack takes 2 to %d frames\n", FRAME_STACK_MAX_DEPTH);
+        return false;
+    }
+    StackResolver::Bind(&frame_stack);
+#endif
+
+#ifdef RESULT_FILTER
+    // Scores of another model do not continue the old ones
+    result_filter_reset(&result_filter);
+#endif
+#ifdef BLOB_TRACKER
+    // Tracks were classified by the old model
+    blob_tracker_reset(&blob_tracker);
+#endif
+    return true;
+}
+
+/*!
+ * @brief   Decides if frame in the input tensor goes to the interpreter
+ *
+ * @return  Always true without MOTION_GATE
+ */
+static bool frame_has_motion()
+{
+#ifdef MOTION_GATE
+    return motion_gate_check(&motion_gate, input->data.int8);
+#else
+    return true;
+#endif
+}
+
+/*!
+ * @brief   Decides if frame can be skipped because last results were very 
+ *          sure, then earlier result stands
+ *
+ * @return  Always false without RESULT_FILTER
+ */
+static bool frame_can_skip()
+{
+#ifdef RESULT_FILTER
+    frame_skipped = result_filter_skip_next(&result_filter);
+    if (frame_skipped)
+    {
+        frame_idle = false;
+    }
+    return frame_skipped;
+#else
+    return false;
+#endif
+}
+
+/*!
+ * @brief   Decides if all objects of the frame are tracked ones that were
+ *          classified already, then their result stands
+ *
+ * @return  Always false without BLOB_TRACKER
+ */
+static bool frame_is_tracked(uint8_t frame[60][80])
+{
+#ifdef BLOB_TRACKER
+    frame_tracked = !blob_tracker_update(&blob_tracker, &frame[0][0], 80, 
+                                         blob_hot);
+    return frame_tracked;
+#else
+    (void) frame;
+    return false;
+#endif
+}
+
+/*!
+ * @brief   Tells tracker that the result of the frame is known, idle or 
+ *          from Invoke(), its tracks keep it
+ */
+static void frame_classified()
+{
+#ifdef BLOB_TRACKER
+    blob_tracker_classified(&blob_tracker);
+#endif
+}
+
+/*!
+ * @brief   Returns " TRACK" for ML response of a frame that kept the 
+ *          result of its tracks
+ */
+static const char * tracked_suffix()
+{
+#ifdef BLOB_TRACKER
+    return frame_tracked ? " TRACK" : "";
+#else
+    return "";
+#endif
+}
+
+/*!
+ * @brief   Keeps times of the frame that was just invoked, until its 
+ *          result is reported
+ *
+ * @param[in] stamp     Arrival of the frame, NULL if it is not known
+ * @param[in] start_us  micros() before Invoke()
+ * @param[in] end_us    micros() after Invoke()
+ */
+static void latency_invoked(const flir_timestamp_t * stamp, 
+                            uint64_t start_us, 
+                            uint64_t end_us)
+{
+#ifdef RESULT_BUS
+    last_invoke_us = (uint32_t) (end_us - start_us);
+#endif
+    latency_pending = stamp != NULL;
+    if (stamp)
+    {
+        result_time = *stamp;
+        invoke_start_us = start_us;
+        invoke_end_us = end_us;
+    }
+}
+
+/*!
+ * @brief               Records all stages of the invoked frame, once
+ *
+ * @param[out] total_us First packet of the frame until now
+ *
+ * @return              False if there was no stamped frame to record
+ *
+ * @note                Result is formatted after Invoke(), so report stage
+ *                      ends here, UART sends it from interrupt afterwards.
+ */
+static bool latency_reported(uint32_t * total_us)
+{
+    if (!latency_pending)
+    {
+        return false;
+    }
+    latency_pending = false;
+
+    uint64_t now = micros();
+    latency_hist_add(&latency[LATENCY_CAPTURE], 
+                     result_time.complete_us - result_time.first_us);
+    latency_hist_add(&latency[LATENCY_PREPROCESS], 
+                     invoke_start_us - result_time.complete_us);
+    latency_hist_add(&latency[LATENCY_INVOKE], invoke_end_us - invoke_start_us);
+    latency_hist_add(&latency[LATENCY_REPORT], now - invoke_end_us);
+    latency_hist_add(&latency[LATENCY_TOTAL], now - result_time.first_us);
+    *total_us = (uint32_t) (now - result_time.first_us);
+    return true;
+}
+
+#ifdef RESULT_BUS
+/*!
+ * @brief               Publishes result of the frame that is reported to
+ *                      subscribers of inference_result_bus()
+ *
+ * @param[in] stamped   Frame had a timestamp, latency_us is valid
+ * @param[in] latency_us
+ *
+ * @note                Raw int8 scores are copied once into the ring, 
+ *                      nothing is formatted, subscribers read them there.
+ *                      Frames that kept an earlier result carry its scores.
+ */
+static void result_publish(bool stamped, uint32_t latency_us)
+{
+    result_record_t * record = result_bus_claim(&result_bus);
+    record->timestamp_us = micros();
+    record->latency_us = stamped ? latency_us : 0;
+    record->flags = stamped ? RESULT_FLAG_LATENCY : 0;
+    record->invoke_us = 0;
+    record->top_class = RESULT_BUS_NO_CLASS;
+    record->count = 0;
+    record->zero_point = 0;
+
+    if (frame_idle)
+    {
+        record->flags |= RESULT_FLAG_IDLE;
+        result_bus_publish(&result_bus);
+        return;
+    }
+
+    bool kept = false;
+#ifdef RESULT_FILTER
+    if (frame_skipped)
+    {
+        record->flags |= RESULT_FLAG_SKIPPED;
+        kept = true;
+    }
+#endif
+#ifdef BLOB_TRACKER
+    if (frame_tracked)
+    {
+        record->flags |= RESULT_FLAG_TRACKED;
+        kept = true;
+    }
+#endif
+    record->invoke_us = kept ? 0 : last_invoke_us;
+
+    uint8_t count = kCategoryCount < RESULT_BUS_MAX_SCORES ? 
+                    kCategoryCount : RESULT_BUS_MAX_SCORES;
+    if (scores.quantized())
+    {
+        record->count = count;
+        record->zero_point = (int8_t) output->params.zero_point;
+        memcpy(record->scores, output->data.int8, count);
+    }
+
+#ifdef RESULT_FILTER
+    // Same class as the ML response, confirmed one or none
+    uint8_t confirmed = result_filter_class(&result_filter);
+    record->top_class = confirmed == RESULT_NONE ? RESULT_BUS_NO_CLASS : 
+                                                   confirmed;
+#else
+    int32_t top = INT32_MIN;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        int32_t milli = scores.Milli(i);
+        if (milli > top)
+        {
+            top = milli;
+            record->top_class = i;
+        }
+    }
+#endif
+    result_bus_publish(&result_bus);
+}
+
+result_bus_t * inference_result_bus()
+{
+    return &result_bus;
+}
+
+#ifdef ETH_UDP
+/*!
+ * @brief   Sends the record as TELEMETRY_RESULT datagram, DMA reads it 
+ *          from its slot of the ring
+ *
+ * @note    Slot is written again RESULT_BUS_DEPTH frames later, DMA took 
+ *          it long before.
+ */
+static bool eth_result_notify(result_sub_t * sub, 
+                              const result_record_t * record)
+{
+    (void) sub;
+    uint8_t head[2] = {TELEMETRY_RESULT, eth_sequence++};
+    eth_udp_send(head, sizeof(head), record, sizeof(*record));
+    return true;
+}
+
+/*!
+ * @brief   Sends the frame as TELEMETRY_FRAME_ROWS datagrams, rows are 
+ *          read by DMA from the frame buffer
+ *
+ * @note    Pipeline holds the frame until the next one is taken, DMA 
+ *          needs around 0.5 ms for all of it.
+ */
+static void eth_send_frame(uint8_t frame[60][80])
+{
+    for (uint8_t first = 0; first < 60; first += ETH_UDP_FRAME_ROWS)
+    {
+        uint8_t rows = 60 - first < ETH_UDP_FRAME_ROWS ? 60 - first : 
+                                                         ETH_UDP_FRAME_ROWS;
+        uint8_t head[8] = {
+            TELEMETRY_FRAME_ROWS, eth_sequence++, 
+            (uint8_t) eth_frame, (uint8_t) (eth_frame >> 8), 
+            80, 60, first, rows,
+        };
+        eth_udp_send(head, sizeof(head), frame[first], rows * 80);
+    }
+    eth_frame++;
+}
+#endif
+
+/*!
+ * @brief   Prints what each subscriber of the result bus got, part of STATS
+ */
+static void result_bus_report()
+{
+    printf("Result bus: %lu records\n", result_bus.head);
+    for (uint8_t i = 0; i < result_bus.sub_count; i++)
+    {
+        const result_sub_t * sub = result_bus.subs[i];
+        printf("  %-8s %8lu received %8lu dropped %2lu pending\n", sub->name,
+               sub->received, sub->dropped, 
+               result_bus_pending(&result_bus, sub));
+    }
+}
+#endif
+
+/*!
+ * @brief   Adds output of the last Invoke() to the smoothed results
+ */
+static void result_update()
+{
+#ifdef RESULT_FILTER
+    if (scores.quantized())
+    {
+        result_filter_update_int8(&result_filter, output->data.int8, 
+                                  output->params.zero_point);
+    }
+    else
+    {
+        result_filter_update_f32(&result_filter, output->data.f);
+    }
+#endif
+}
+
+#ifdef CASCADE
+/*!
+ * @brief   Checks tensors of the gate model, input has to be one channel 
+ *          int8 image, last output score tells presence
+ */
+static bool bind_gate()
+{
+    gate_input = gate_engine.input();
+
+    if (gate_input->type != kTfLiteInt8 || gate_input->dims->size != 4 ||
+        gate_input->dims->data[3] != 1 ||
+        gate_input->dims->data[2] > FRAME_RESIZE_MAX_COLS)
+    {
+        printf("Gate input has to be one channel int8 image\n");
+        return false;
+    }
+    gate_rows = gate_input->dims->data[1];
+    gate_cols = gate_input->dims->data[2];
+
+    if (!gate_scores.Bind(gate_engine.output()))
+    {
+        printf("Gate output has to be int8 or float scores\n");
+        return false;
+    }
+
+    frame_quant_init(&gate_quant, 0.0f, 1.0f, 
+                     gate_input->params.scale, gate_input->params.zero_point);
+    return true;
+}
+#endif
+
+/*!
+ * @brief   Runs gate model on the frame, it is resized to gate input 
+ *          straight from the raw frame
+ *
+ * @return  True if gate found something to classify, always true without 
+ *          CASCADE
+ */
+static bool frame_has_presence(uint8_t frame[60][80])
+{
+#ifdef CASCADE
+    const frame_roi_t whole = {0, 0, kNumCols, kNumRows};
+
+    frame_crop_resize_u8(&frame[0][0], 80, &whole, gate_input->data.int8,
+                         gate_cols, gate_rows, &gate_quant);
+    if (!engine_invoke(gate_engine, 1))
+    {
+        // Broken gate should not hide frames from the classifier
+        return true;
+    }
+    return gate_scores.Milli(gate_scores.count() - 1) >= CASCADE_THRESHOLD;
+#else
+    (void) frame;
+    return true;
+#endif
+}
+
+/*!
+ * @brief   Copies pre-quantized test image into the input tensor
+ *
+ * @note    Capture and load_data() write into the input tensor, so it is
+ *          never bound to flash with InferenceEngine::LoadInput() here.
+ */
+static void load_test_data(TfLiteTensor * input, const signed char * data)
+{
+    // Test image is one long row, DMA2D copies it while CPU sleeps
+    dma2d_copy(data, input->bytes, input->data.int8, input->bytes, 
+               input->bytes, 1);
+}
+
+static void load_data(TfLiteTensor * input, uint8_t frame[60][80])
+{
+    CYCLE_BUDGET(BUDGET_LOAD_DATA, BUDGET_LOAD_DATA_CYCLES);
+    TRACE(TRACE_LOAD_BEGIN, 0);
+
+    /* Explanation: AGC frame has only pixels, so it is converted in one 
+     * go with quantization params of the model. For model with scale 1.0 
+     * and zero point -128 this is XOR of four pixels at once with 0x80,
+     * other offsets are saturated byte adds. Any other scale, mean, std or
+     * gamma goes through the lookup table, which is four byte loads per 
+     * word instead of a multiply per pixel.
+     * */
+#ifdef FRAME_STACK
+    // Only the newest frame is written, look at frame_stack.h
+    frame_stack_push_u8(&frame_stack, &frame[0][0], 
+                        input_lut_used ? &input_lut : NULL, &input_quant);
+#else
+    if (input_lut_used)
+    {
+        frame_convert_lut(&frame[0][0], input->data.int8, 60 * 80, 
+                          &input_lut);
+    }
+    else
+    {
+        frame_convert_u8(&frame[0][0], input->data.int8, 60 * 80, 
+                         &input_quant);
+    }
+#endif
+    TRACE(TRACE_LOAD_END, 0);
+}
+
+static void print_result(tflite::ErrorReporter* error_reporter, 
+                         const char * title, 
+                         TfLiteTensor * output, 
+                         uint32_t duration)
+{
+    OutputScores result;
+    char line[64];
+
+    result.Bind(output);
+    result.Format(line, sizeof(line), kCategoryCount);
     printf("\n%s\n", title);
-    printf("[[%f %f %f %f]]\n", output->data.f[0],
-                                output->data.f[1],
-                                output->data.f[2],
-                                output->data.f[3]);
+    printf("[[%s]]\n", line);
     printf("Inference time: %ld ms\n", duration);
 }
@@ -4,11 +4,247 @@
 #ifdef __cplusplus
 extern "C" {
 #endif
+#include <stddef.h>
 #include <stdint.h>
+#include "flir/flir.h"
+#include "result_bus.h"
+
+// Define to capture FLIR packets straight into the input tensor, this saves 
+// both frame buffers and the copy in load_data, but capture can not overlap
+// with inference. Leave it undefined to use double buffered pipeline.
+//#define ZERO_COPY_CAPTURE
+
+// Define to convolve first layer while the frame is still arriving, with 
+// ZERO_COPY_CAPTURE. Invoke() starts together with capture, first Conv2D 
+// waits only for rows under its filter, so after the last packet just the 
+// remaining layers run, look at ConvRowStream in shared/conv_specialised.h.
+// MOTION_GATE then looks at the frame after Invoke().
+//#define STREAM_FIRST_LAYER
+
+// Define for models that take the last kNumChannels frames as channels of
+// the input, look at shared/frame_stack.h. load_data() converts only the 
+// newest frame into its channel, first Conv2D reads the rotated channels.
+// Gate and ROI inputs are single frames, so only the plain pipeline.
+//#define FRAME_STACK
+
+#if defined(FRAME_STACK) && \
+    (defined(ZERO_COPY_CAPTURE) || defined(MOTION_GATE) || \
+     defined(CASCADE) || defined(ROI_INFERENCE))
+#error "FRAME_STACK needs double buffered pipeline without gates or ROI"
+#endif
+
+// Define to classify only frames with motion, look at shared/motion_gate.h.
+// For idle frames ML command responds with "ML: IDLE".
+//#define MOTION_GATE
+
+// Define to smooth results over frames, look at shared/result_filter.h. 
+// ML command then responds with confirmed class and averaged scores in 
+// percent, frames after a very sure result are skipped without Invoke().
+//#define RESULT_FILTER
+
+// Define to run tiny presence model from src/model/gate_model.h in front 
+// of the classifier, which then only runs on frames that gate finds 
+// something in, other frames respond with "ML: IDLE". Add gate model to 
+// MODEL_SRC in project.mk too, so that its operators are linked. Gate 
+// input is resized from raw frame, so double buffered pipeline is needed.
+//#define CASCADE
+#define CASCADE_THRESHOLD   500 // Per mille of last gate score for presence
+
+#if defined(CASCADE) && defined(ZERO_COPY_CAPTURE)
+#error "CASCADE needs double buffered pipeline"
+#endif
+
+// Define with CASCADE on units with the visible light camera of 
+// DCMI_CAMERA in system_setup/dcmi_cam.h. Pipeline streams both sensors, 
+// gate still looks at the thermal frame and the classifier then runs on 
+// the newest visible frame, so it has to be trained on 80x60 grayscale.
+// Without a visible frame the thermal one is idle.
+//#define VISIBLE_CLASSIFIER
+
+#if defined(VISIBLE_CLASSIFIER) && !defined(CASCADE)
+#error "VISIBLE_CLASSIFIER runs behind the thermal gate of CASCADE"
+#endif
+
+// Define to follow warm objects over frames, look at shared/blob_tracker.h.
+// Classifier runs when an object enters or leaves and every
+// BLOB_REFRESH_FRAMES frames, frames in between keep the last result and
+// ML command ends with " TRACK". Hot blocks are above BLOB_HOT_PM of the
+// histogram of capture and BLOB_MIN_CONTRAST above mean of the frame.
+//#define BLOB_TRACKER
+#define BLOB_HOT_PM             970     // Per mille of the frame histogram
+#define BLOB_MIN_CONTRAST       24      // On 0..255 scale of the model input
+#define BLOB_REFRESH_FRAMES     30
+
+#if defined(BLOB_TRACKER) && defined(ZERO_COPY_CAPTURE)
+#error "BLOB_TRACKER needs double buffered pipeline"
+#endif
+
+// Define to publish the result of each frame on shared/result_bus.h, when
+// it is reported. Subscribers of inference_result_bus() read raw records
+// in place, the shell lights LD3 while RESULT_ALARM_CLASS is on top with
+// at least RESULT_ALARM_SCORE, look at alarm_notify() of simple_shell.c.
+#define RESULT_BUS
+#define RESULT_ALARM_CLASS      1       // Index in kCategoryLabels
+#define RESULT_ALARM_SCORE      192     // Q8 above zero point, 256 is 1.0
+
+// ETH_UDP of system_setup/eth_udp.h subscribes to the bus as well and 
+// sends each frame of ML as TELEMETRY_FRAME_ROWS datagrams.
+
+// Define to classify each region with motion on its own, ROI command crops
+// regions found by the motion gate, resizes them to model input and runs
+// them back-to-back. Needs MOTION_GATE and double buffered pipeline.
+//#define ROI_INFERENCE
+#define INFERENCE_MAX_ROIS  4   // Regions classified per frame
+#define ROI_MIN_BLOCKS      2   // Smaller regions of changed blocks are noise
+
+// Normalisation of raw frames when FLIR_RADIOMETRIC is defined in 
+// flir/flir.h, each frame is remapped into 0..255 like AGC output before 
+// quantization of the model. Fixed window keeps absolute temperature, for 
+// models trained on it, auto window stretches each frame between two 
+// percentiles, equalize is histogram equalisation with clip limit.
+#define RADIOMETRIC_FIXED       0
+#define RADIOMETRIC_AUTO        1
+#define RADIOMETRIC_EQUALIZE    2
+#define RADIOMETRIC_REMAP       RADIOMETRIC_AUTO
+#define RADIOMETRIC_LOW         7000    // Raw window of RADIOMETRIC_FIXED
+#define RADIOMETRIC_HIGH        9000
+#define RADIOMETRIC_LOW_PM      10      // Per mille of RADIOMETRIC_AUTO
+#define RADIOMETRIC_HIGH_PM     990
+#define RADIOMETRIC_CLIP        (4 * 256)   // Q8 of average bin, EQUALIZE
+
+// Preprocessing of 8 bit frames in front of input quantization of the
+// model, for models trained on normalised or gamma corrected images. All
+// of it is folded into a lookup table when the model is bound, defaults
+// use pixels as they are.
+#define INPUT_GAMMA             1.0f    // Pixel is 255 * (p / 255)^gamma
+#define INPUT_MEAN              0.0f    // Then (p - mean) / std
+#define INPUT_STD               1.0f
+
+// Define to keep interpreter state of the boot model in the last flash 
+// sector, look at flash_store.h. The first boot of a new firmware sets 
+// the model up and writes its state, later ones copy it back instead of 
+// AllocateTensors(). Only for the classifier alone, not with CASCADE.
+#define PREPARED_STATE
+
+// Define to run Invoke() a few operators at a time, capture resync and 
+// VSYNC timeouts are served between them, look at engine_invoke(). Whole
+// Invoke() of the classifier is longer than FLIR_RESYNC_DELAY.
+// BACKGROUND_INVOKE of system_setup/background.h replaces it.
+#define STEPPED_INVOKE
+#define INVOKE_STEP_OPS         1       // Operators between two polls
+
+// Define for models with intermediate classifier heads, look at 
+// shared/early_exit.h. Frames of the pipeline stop at the first head that
+// is sure enough or at the last one that fits into the deadline, ML 
+// response then ends with the exit taken, "E0" is the earliest head.
+//#define EARLY_EXIT
+#define EARLY_EXIT_DEADLINE_US  80000   // 0 for no deadline
+#define EARLY_EXIT_THRESHOLD_PM 900     // Top score that is sure enough
+
+// Define to run the classifier on a companion MCU, look at 
+// shared/remote_infer.h and system_setup/remote_link.c. Frames are still
+// captured and quantized here, input tensor goes out over SPI1 and scores
+// come back into the output tensor, so the same model has to be loaded
+// on both boards. Benchmarks keep running the local interpreter.
+//#define REMOTE_INFERENCE
+
+#if defined(REMOTE_INFERENCE) && defined(EARLY_EXIT)
+#error "EARLY_EXIT runs the local interpreter, not REMOTE_INFERENCE"
+#endif
+
+#if defined(STREAM_FIRST_LAYER) && \
+    (!defined(ZERO_COPY_CAPTURE) || defined(REMOTE_INFERENCE))
+#error "STREAM_FIRST_LAYER needs ZERO_COPY_CAPTURE and local interpreter"
+#endif
+
+// Soak test of SOAK command, look at inference_soak()
+#define SOAK_REPLAY_RUNS        64      // Variant is run twice this often
+#define SOAK_REPORT_RUNS        1000    // Progress lines, around a minute
+
+// Longest wait for a tensor of EVAL, look at inference_eval()
+#define EVAL_TIMEOUT            5000    // In ms
+
+// Define to take test images of benchmarks, soak and tuning from
+// src/test_images/test_images.mlds, a container of make_dataset.py that is
+// linked with BLOBS of project.mk, instead of C arrays of images.cc, which
+// can then be left out of CCFILES. The first five samples are used, look
+// at shared/dataset_file.h.
+//#define TEST_DATASET
+
+// Define to take the same container from the asset region instead, flash
+// sectors at ASSET_ADDRESS of project.mk that make assets_flash programs
+// on their own. Firmware finds the header there at boot, so test images
+// change without a new build and production firmware links none of them.
+// Without assets BENCH, SOAK, TUNE and the other benchmarks answer NOT OK,
+// ML runs as usual.
+//#define BENCH_ASSETS
+#define BENCH_ASSET_SIZE        (256 * 1024)   // Sector 7, or 6 and 7
+
+#if defined(TEST_DATASET) && defined(BENCH_ASSETS)
+#error "Test images come either from TEST_DATASET or from BENCH_ASSETS"
+#endif
+
+#if defined(ROI_INFERENCE) && \
+    (!defined(MOTION_GATE) || defined(ZERO_COPY_CAPTURE))
+#error "ROI_INFERENCE needs MOTION_GATE without ZERO_COPY_CAPTURE"
+#endif
+
+// Frames go to the model as they are captured, look at kNumRows
+#if FLIR_FRAME_ROWS != 60 || FLIR_IMAGE_COLS != 80
+#error "Pipeline takes 80x60 frames, FLIR_LEPTON3 frames need a downscale"
+#endif
 
 bool inference_setup();
-bool inference_exe(uint16_t frame[60][82]);
+bool inference_exe(uint8_t frame[60][80], const flir_timestamp_t * stamp);
 void get_inference_results(char * buf, uint16_t max_len);
+bool inference_activity();
+void inference_profile_report();
+void inference_stats_report();
+bool inference_load_model(const char * name);
+const char * inference_model_name();
+uint32_t inference_model_id();
+bool inference_benchmark(uint32_t runs);
+bool inference_cache_sweep(uint32_t runs);
+bool inference_cold_bench(uint32_t runs);
+#ifdef KERNEL_BENCH
+bool inference_kernel_bench();
+#endif
+#ifdef TARGET_BENCH
+bool inference_target_bench();
+#endif
+bool inference_soak(uint32_t runs, bool (*stop)());
+bool inference_eval(uint32_t count);
+bool inference_update_begin(uint32_t len);
+bool inference_update_upload();
+bool inference_update_commit(uint32_t crc32);
+bool inference_tune();
+void inference_suspend();
+bool inference_resume();
+
+#ifdef RESULT_BUS
+// Records of reported frames, subscribe from main context
+result_bus_t * inference_result_bus();
+#endif
+
+// Arena below its persistent tail, lent between inferences
+uint8_t * inference_borrow_arena(size_t * bytes);
+void inference_return_arena();
+
+// Capture straight into input tensor and inference
+bool inference_capture_exe();
+
+// Double buffered capture and inference
+#ifndef ZERO_COPY_CAPTURE
+bool inference_pipeline_start();
+void inference_pipeline_stop();
+bool inference_pipeline_exe();
+#endif
+
+// Classification of regions with motion, one result per region
+#ifdef ROI_INFERENCE
+bool inference_roi_exe();
+void get_roi_results(char * buf, uint16_t max_len);
+#endif
 
 #ifdef __cplusplus
 }
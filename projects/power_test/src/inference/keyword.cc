@@ -0,0 +1,183 @@
+#include "keyword.h"
+
+#ifdef KEYWORD_TRIGGER
+#include <libopencm3/cm3/dwt.h>
+
+// Includes connected with Tensorflow
+#include "tensorflow/lite/c/common.h"
+
+// Includes connected with micro
+#include "model/keyword_model.h"
+#include "system_setup/fastflash.h"
+#include "system_setup/mic_i2s.h"
+#include "printf.h"
+#include "audio_features.h"
+#include "inference_engine.h"
+#include "model_ops.h"
+#include "output_scores.h"
+#include "log_reporter.h"
+
+namespace {
+    // Keyword models are small, arena stays in SRAM1, DTCM is left to the
+    // classifier. Operators come from the generated list, so MODEL_SRC
+    // has to include the keyword model.
+    const int kKeywordArenaSize = 24 * 1024;
+    InferenceEngine<kKeywordArenaSize, MODEL_ENGINE_OPS> keyword_engine;
+    OutputScores keyword_scores;
+
+    // Spectrogram ring, each hop only adds its newest row
+    audio_features_t features;
+    int16_t hop[MIC_HOP_SAMPLES];
+
+    uint32_t hops_since_invoke = 0;
+    uint32_t holdoff = 0;
+    uint32_t hits = 0;
+
+    uint32_t hops = 0;
+    uint32_t invokes = 0;
+    uint32_t triggers = 0;
+    uint32_t features_max_cycles = 0;
+    uint32_t invoke_max_cycles = 0;
+}
+
+/*!
+ * @brief   Creates interpreter of the keyword model and prepares feature
+ *          extractor and microphone for its input
+ *
+ * @return  False if model does not take AUDIO_FRAMES x AUDIO_MEL_BANDS
+ *          int8 features or has no KEYWORD_CLASS score
+ */
+bool keyword_setup()
+{
+    static LogErrorReporter log_error_reporter;
+
+    // Flatbuffer is position independent, weights go through ART
+    if (!keyword_engine.Setup(flash_itcm_alias(keyword_tflite),
+                              &log_error_reporter))
+    {
+        return false;
+    }
+    keyword_engine.PrintInfo();
+
+    TfLiteTensor * input = keyword_engine.input();
+    if (input->type != kTfLiteInt8 ||
+        input->bytes != AUDIO_FRAMES * AUDIO_MEL_BANDS)
+    {
+        printf("Keyword input has to be %dx%d int8 features\n",
+               AUDIO_FRAMES, AUDIO_MEL_BANDS);
+        return false;
+    }
+    if (!keyword_scores.Bind(keyword_engine.output()) ||
+        keyword_scores.count() <= KEYWORD_CLASS)
+    {
+        printf("Keyword output has to be scores up to class %d\n",
+               KEYWORD_CLASS);
+        return false;
+    }
+    if (!audio_features_init(&features, input->params.scale,
+                             input->params.zero_point))
+    {
+        return false;
+    }
+
+    mic_i2s_setup();
+    return true;
+}
+
+/*!
+ * @brief   Starts listening, first invoke is when the whole spectrogram
+ *          was heard, one second later
+ */
+void keyword_start()
+{
+    audio_features_reset(&features);
+    hops_since_invoke = 0;
+    holdoff = 0;
+    hits = 0;
+    mic_i2s_start();
+}
+
+/*!
+ * @brief   Stops listening, for example before stop mode
+ */
+void keyword_stop()
+{
+    mic_i2s_stop();
+}
+
+/*!
+ * @brief   Adds received hops to the spectrogram and runs the model on
+ *          every KEYWORD_INVOKE_HOPS of them
+ *
+ * @return  True if the keyword was heard, KEYWORD_HITS invokes in a row
+ *          above KEYWORD_THRESHOLD
+ *
+ * @note    Call it on EVENT_AUDIO, from main context.
+ */
+bool keyword_poll()
+{
+    bool heard = false;
+
+    while (mic_i2s_read(hop))
+    {
+        uint32_t start = dwt_read_cycle_counter();
+        audio_features_push(&features, hop);
+        uint32_t cycles = dwt_read_cycle_counter() - start;
+        if (cycles > features_max_cycles)
+        {
+            features_max_cycles = cycles;
+        }
+        hops++;
+
+        // The same word should not trigger twice
+        if (holdoff)
+        {
+            holdoff--;
+            continue;
+        }
+        if (++hops_since_invoke < KEYWORD_INVOKE_HOPS ||
+            !audio_features_ready(&features))
+        {
+            continue;
+        }
+        hops_since_invoke = 0;
+
+        start = dwt_read_cycle_counter();
+        audio_features_copy(&features, keyword_engine.input()->data.int8);
+        bool invoked = keyword_engine.Invoke();
+        cycles = dwt_read_cycle_counter() - start;
+        if (cycles > invoke_max_cycles)
+        {
+            invoke_max_cycles = cycles;
+        }
+        invokes++;
+
+        if (!invoked ||
+            keyword_scores.Milli(KEYWORD_CLASS) < KEYWORD_THRESHOLD)
+        {
+            hits = 0;
+            continue;
+        }
+        if (++hits < KEYWORD_HITS)
+        {
+            continue;
+        }
+        hits = 0;
+        holdoff = KEYWORD_HOLDOFF_HOPS;
+        triggers++;
+        heard = true;
+    }
+    return heard;
+}
+
+/*!
+ * @brief   Prints hops, invokes and their longest cycles, part of STATS
+ */
+void keyword_report()
+{
+    printf("Keyword: %lu hops, %lu lost, %lu invokes, %lu triggers\n",
+           hops, mic_i2s_overruns(), invokes, triggers);
+    printf("Keyword: features %lu cycles, invoke %lu cycles at most\n",
+           features_max_cycles, invoke_max_cycles);
+}
+#endif
@@ -0,0 +1,37 @@
+#ifndef KEYWORD_H
+#define KEYWORD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <stdbool.h>
+
+// Define to listen for a keyword on the I2S microphone, look at
+// system_setup/mic_i2s.c and shared/audio_features.h. Keyword model comes
+// from src/model/keyword_model.h, add it to MODEL_SRC in project.mk too,
+// so that its operators are linked. Its input is AUDIO_FRAMES x
+// AUDIO_MEL_BANDS int8 log-mel features. When the keyword is heard the
+// shell runs ML once, so capture and classification follow the sound.
+// Microphone needs running clocks, it listens between commands, not in
+// stop mode of TRAP.
+//#define KEYWORD_TRIGGER
+
+#define KEYWORD_CLASS           2       // Output index of the keyword
+#define KEYWORD_THRESHOLD       800     // Per mille of KEYWORD_CLASS score
+#define KEYWORD_HITS            2       // Invokes in a row above threshold
+#define KEYWORD_INVOKE_HOPS     4       // Hops between invokes, 80 ms
+#define KEYWORD_HOLDOFF_HOPS    50      // Hops ignored after a trigger, 1 s
+
+bool keyword_setup();
+void keyword_start();
+void keyword_stop();
+bool keyword_poll();
+void keyword_report();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KEYWORD_H */
+/*** end of file ***/
@@ -3,18 +3,105 @@
 #include <string.h>
 #include "system_setup/sys_init.h"
 #include "system_setup/utility.h"
-#include "system_setup/printf.h"
+#include "system_setup/sensors.h"
+#include "system_setup/config_store.h"
+#include "system_setup/clock_profile.h"
+#include "system_setup/dcmi_cam.h"
+#include "system_setup/thermal_gov.h"
+#include "system_setup/rate_gov.h"
+#include "system_setup/eth_udp.h"
+#include "system_setup/power_meter.h"
+#include "printf.h"
 #include "simple_shell/simple_shell.h"
 #include "inference/inference.h"
+#include "inference/keyword.h"
 #include "flir/flir.h"
+#include "flir/flir_port.h"
 
 
-uint16_t imagex[60][82];
 int main(void)
 {
     system_setup();
+    // Settings of the shell from before reset, modules read them in setup
+    config_store_load();
+    uint32_t policy;
+    if (config_store_get(CONFIG_CLOCK_POLICY, &policy) && 
+        policy < CLOCK_POLICY_END)
+    {
+        clock_policy_set((clock_policy_t) policy);
+    }
+#ifdef RATE_GOVERNOR
+    if (config_store_get(CONFIG_RATE_POLICY, &policy) &&
+        policy < RATE_POLICY_END)
+    {
+        rate_gov_policy_set((rate_policy_t) policy);
+    }
+#endif
+#ifdef KERNEL_BENCH
+    // Benchmark firmware of single kernels, built with make kbench, it 
+    // only needs the arena and the model, camera is not started
+    inference_setup();
+    inference_kernel_bench();
+    while (1)
+    {
+    }
+#endif
+#ifdef TARGET_BENCH
+    // Benchmark firmware of the whole model, built with make bench, 
+    // camera is not started either
     inference_setup();
+    inference_target_bench();
+    while (1)
+    {
+    }
+#endif
+#ifdef FLIR_SECOND
+    // Second Lepton boots with the first one, deselected
+    flir_port_setup(&flir_second);
+#endif
+    // Lepton boots meanwhile, AllocateTensors() hides most of it
     flir_setup();
+    inference_setup();
+    boot_mark(BOOT_INFERENCE);
+#ifdef ETH_UDP
+    // Auto-negotiation takes seconds too, it also runs while Lepton boots
+    eth_udp_setup();
+#endif
+    if (!flir_wait_ready())
+    {
+        printf("FLIR not ready\n");
+    }
+#ifdef DCMI_CAMERA
+    // Shares I2C1 with the CCI, so only once the Lepton is configured
+    if (!dcmi_cam_setup())
+    {
+        printf("Camera not found\n");
+    }
+#endif
+    // Auxiliary sensors are read in the background from now on
+    sensors_start(SENSORS_RATE_HZ);
+#ifdef THERMAL_GOVERNOR
+    // Die temperature too, clock profile is limited once it gets hot
+    thermal_gov_start();
+#endif
+#ifdef POWER_METER
+    // Supply of the board as well, energy goes to phases of the pipeline
+    if (!power_meter_start())
+    {
+        printf("Power meter not found\n");
+    }
+#endif
+#ifdef KEYWORD_TRIGGER
+    // Microphone is heard between commands, look at keyword_task_run()
+    if (keyword_setup())
+    {
+        keyword_start();
+    }
+    else
+    {
+        printf("Keyword trigger not set up\n");
+    }
+#endif
 
     printf("Setup done\n");
 
@@ -23,29 +110,6 @@ int main(void)
 	 */
     simple_shell();
 
-    int i = 0;
-    while (1)
-    {
-      if (get_flir_image(imagex)){
-          printf("GOOD, %d\n", i++);
-
-          for(uint8_t row = 0; row < 20; row++)
-          {
-              for(uint8_t col = 2; col < 20; col++)
-              {
-                  printf("%d ", (uint8_t)imagex[row][col]);
-              }
-              printf("\n");
-          }
-          delay(1000);
-      }
-      else
-      {
-          printf("BAD\n");
-      }
-    }
-
-
     while (1)
     {
         gpio_set(GPIOB, GPIO0);
@@ -3,5 +3,7 @@
 
 extern const unsigned char full_quant_tflite[];
 extern const unsigned int full_quant_tflite_len;
+// CRC-32 of zlib over the array, binascii.crc32() of the .tflite file
+extern const unsigned int full_quant_tflite_crc32;
 
 #endif  // full_quant_MODEL_H
@@ -1,21 +1,151 @@
 #include <string.h>
+#include <stdlib.h>
 #include <libopencm3/stm32/gpio.h>
 #include "system_setup/utility.h"
-#include "system_setup/printf.h"
+#include "printf.h"
+#include "system_setup/events.h"
+#include "system_setup/scheduler.h"
+#include "system_setup/sys_init.h"
+#include "system_setup/clock_profile.h"
+#include "system_setup/counters.h"
+#include "system_setup/cycle_budget.h"
+#include "system_setup/sensors.h"
+#include "system_setup/stop_mode.h"
+#include "system_setup/i2c_async.h"
+#include "system_setup/config_store.h"
+#include "system_setup/periph_clock.h"
+#include "system_setup/irq_prio.h"
+#include "system_setup/background.h"
+#include "system_setup/pc_sample.h"
+#include "system_setup/model_slot.h"
+#include "system_setup/qspi_flash.h"
+#include "system_setup/sdram.h"
+#include "system_setup/dcmi_cam.h"
+#include "system_setup/thermal_gov.h"
+#include "system_setup/rate_gov.h"
+#include "system_setup/eth_udp.h"
+#include "system_setup/power_meter.h"
 #include "uart_ctrl.h"
 #include "simple_shell.h"
 #include "inference/inference.h"
+#include "inference/keyword.h"
 #include "flir/flir.h"
+#include "flir/flir_port.h"
+
+#ifndef MINICOM_SHELL
+static void shell_task_run(uint32_t events);
+static void capture_task_run(uint32_t events);
+
+// Capture resync and VSYNC timeouts go first, they have hardware deadlines
+static sched_task_t capture_task = {
+    .name = "capture",
+    .handler = capture_task_run,
+    .events = EVENT_CAPTURE,
+    .prio = SCHED_PRIO_HIGH,
+};
+
+static sched_task_t shell_task = {
+    .name = "shell",
+    .handler = shell_task_run,
+    .events = EVENT_CONSOLE_LINE,
+    .prio = SCHED_PRIO_NORMAL,
+};
+
+#ifdef KEYWORD_TRIGGER
+static void keyword_task_run(uint32_t events);
+
+// Hop of the microphone has to be taken within 20 ms, commands like ML
+// block longer and cost a few hops, they are counted in STATS
+static sched_task_t keyword_task = {
+    .name = "keyword",
+    .handler = keyword_task_run,
+    .events = EVENT_AUDIO,
+    .prio = SCHED_PRIO_NORMAL,
+};
+#endif
+#endif
+
+// Argument of the last parsed command, for example model name
+static char shell_arg[SHELL_ARG_LEN];
+
+// Argument that a command takes after a space
+typedef enum
+{
+    ARG_NONE,
+    ARG_NUMBER,     // Optional decimal number, "BENCH" or "BENCH 100"
+    ARG_NAME,       // Required word, "MODEL full_quant"
+} shell_arg_type;
+
+typedef struct
+{
+    const char * name;
+    uint8_t len;
+    shell_cmd cmd;
+    shell_arg_type arg;
+} shell_entry;
+
+#define SHELL_ENTRY(name, cmd, arg)     {name, sizeof(name) - 1, cmd, arg}
+
+// Commands are matched on the whole word, so "B" is not BLINK
+static const shell_entry shell_commands[] = {
+    SHELL_ENTRY("ML",       ML,         ARG_NUMBER),
+    SHELL_ENTRY("STATS",    STATS,      ARG_NONE),
+    SHELL_ENTRY("PROFILE",  PROFILE,    ARG_NONE),
+    SHELL_ENTRY("BLINK",    BLINK,      ARG_NONE),
+    SHELL_ENTRY("FFC",      FFC,        ARG_NONE),
+    SHELL_ENTRY("FLAT",     FLAT,       ARG_NONE),
+#ifdef ROI_INFERENCE
+    SHELL_ENTRY("ROI",      ROI,        ARG_NONE),
+#endif
+    SHELL_ENTRY("MODEL",    MODEL,      ARG_NAME),
+    SHELL_ENTRY("CLOCK",    CLOCK,      ARG_NAME),
+#ifdef RATE_GOVERNOR
+    SHELL_ENTRY("RATE",     RATE,       ARG_NAME),
+#endif
+    SHELL_ENTRY("SET",      SET,        ARG_NAME),
+    SHELL_ENTRY("BENCH",    BENCH,      ARG_NUMBER),
+    SHELL_ENTRY("SWEEP",    SWEEP,      ARG_NUMBER),
+    SHELL_ENTRY("COLD",     COLD,       ARG_NUMBER),
+    SHELL_ENTRY("SOAK",     SOAK,       ARG_NUMBER),
+#ifndef MINICOM_SHELL
+    SHELL_ENTRY("EVAL",     EVAL,       ARG_NUMBER),
+#endif
+    SHELL_ENTRY("TUNE",     TUNE,       ARG_NONE),
+    SHELL_ENTRY("SENSORS",  SENSORS,    ARG_NUMBER),
+    SHELL_ENTRY("TRAP",     TRAP,       ARG_NUMBER),
+#ifdef PC_SAMPLER
+    SHELL_ENTRY("PCPROF",   PCPROF,     ARG_NUMBER),
+#endif
+#if defined(MODEL_UPDATE) && !defined(MINICOM_SHELL)
+    SHELL_ENTRY("UPDATE",   UPDATE,     ARG_NUMBER),
+    SHELL_ENTRY("UPLOAD",   UPLOAD,     ARG_NONE),
+    SHELL_ENTRY("COMMIT",   COMMIT,     ARG_NUMBER),
+#endif
+};
+
+#define SHELL_COMMANDS  (sizeof(shell_commands) / sizeof(shell_commands[0]))
 
 static shell_cmd parse_command(char * buf, uint16_t len);
+static bool shell_arg_ok(shell_arg_type type, const char * arg, uint16_t len);
 static bool execute_command(shell_cmd cmd);
 static void get_command_response(shell_cmd, char * buf, uint16_t max_len);
 static bool deliver_cmd(shell_cmd cmd, char * buf, uint16_t max_len);
+static bool ml_exe(uint32_t runs);
+#ifdef RATE_GOVERNOR
+static bool rate_pace();
+#endif
+static bool trap_exe(uint32_t frames);
+static bool set_exe(char * arg);
 static bool blink_exe();
 static void blink_response(char * buf, uint16_t max_len);
 static void invalid_cmd(char * buf, uint16_t max_len);
+static void shell_line(char * buf, uint16_t len);
+#ifdef RESULT_BUS
+static bool alarm_notify(result_sub_t * sub, const result_record_t * record);
 
-uint16_t image[60][82];
+// LD3 follows the newest result, straight from the bus
+static result_sub_t alarm_sub;
+#endif
 
 
 /*!
@@ -25,43 +155,187 @@ uint16_t image[60][82];
  */
 void simple_shell()
 {
+#ifdef RESULT_BUS
+    result_bus_subscribe(inference_result_bus(), &alarm_sub, "alarm", 
+                         alarm_notify, NULL);
+#endif
+#ifdef MINICOM_SHELL
     char buf[SHELL_BUF_LEN];
     uint16_t len;
-    shell_cmd cmd;
-    bool status;
 
     put_line("$");
     while (1) {
         len = get_line(buf, SHELL_BUF_LEN);
         if (len) {
-            cmd = parse_command(buf, len);
+            shell_line(buf, len);
+        }
+    }
+#else
+    console_setup();
+    put_line("$");
 
-            //printf("Buf is %s\n", buf);
-            //printf("Command is %d\n", cmd);
-            //printf("LEN is %d\n", len);
+    sched_add(&capture_task);
+    sched_add(&shell_task);
+#ifdef KEYWORD_TRIGGER
+    sched_add(&keyword_task);
+#endif
+    // Line could have arrived before the task was added
+    sched_ready(&shell_task);
+    sched_run();
+#endif
+}
 
-            status = execute_command(cmd);
-            if (status) {
-                get_command_response(cmd, buf, SHELL_BUF_LEN);
-                //put_line("\n$ ");
-                put_line(buf);
-            }
-            else {
-                //put_line("\n$ ");
-                put_line("\nNOT OK\n");
-            }
+/*!
+ * @brief       Parses and executes one line, prints the response
+ */
+static void shell_line(char * buf, uint16_t len)
+{
+    shell_cmd cmd = parse_command(buf, len);
+
+    //printf("Buf is %s\n", buf);
+    //printf("Command is %d\n", cmd);
+    //printf("LEN is %d\n", len);
+
+    bool status = execute_command(cmd);
+    if (status) {
+        get_command_response(cmd, buf, SHELL_BUF_LEN);
+        //put_line("\n$ ");
+        put_line(buf);
+    }
+    else {
+        //put_line("\n$ ");
+        put_line("\nNOT OK\n");
+    }
+}
+
+#ifndef MINICOM_SHELL
+/*!
+ * @brief       Shell task, executes one queued console line per run
+ *
+ * @note        Command itself may block, for example ML, it waits for
+ *              capture inside and nothing else runs meanwhile.
+ */
+static void shell_task_run(uint32_t events)
+{
+    (void) events;
+    char buf[SHELL_BUF_LEN];
+
+    if (console_line_ready()) {
+        // Empty line is taken out of the queue and does nothing
+        int len = console_read_line(buf, SHELL_BUF_LEN);
+        if (len > 0) {
+            shell_line(buf, len);
         }
     }
+
+    // Rest of the lines after higher priority work
+    if (console_line_ready()) {
+        sched_ready(&shell_task);
+    }
+    // Command could have left capture waiting for resynchronisation
+    sched_ready(&capture_task);
+}
+
+#ifdef KEYWORD_TRIGGER
+/*!
+ * @brief       Keyword task, feeds microphone hops to the keyword model
+ *              and runs ML once when the keyword is heard
+ */
+static void keyword_task_run(uint32_t events)
+{
+    (void) events;
+    char buf[SHELL_BUF_LEN];
+
+    if (!keyword_poll()) {
+        return;
+    }
+    put_line("KEYWORD\n");
+    if (!ml_exe(1)) {
+        put_line("\nNOT OK\n");
+        return;
+    }
+    get_inference_results(buf, SHELL_BUF_LEN);
+    put_line(buf);
+}
+#endif
+
+/*!
+ * @brief       Capture task, keeps resynchronisation and VSYNC timeouts
+ *              going between commands
+ */
+static void capture_task_run(uint32_t events)
+{
+    (void) events;
+
+    if (!flir_capture_needs_poll()) {
+        return;
+    }
+    flir_capture_poll();
+    if (flir_capture_needs_poll()) {
+        sched_delay(&capture_task, flir_capture_poll_delay());
+    }
 }
+#endif
 
 static shell_cmd parse_command(char * buf, uint16_t len)
 {
-    if (0 == strncmp("BLINK", buf, len)) return BLINK;
-    if (0 == strncmp("ML", buf, len))    return ML;
+    // Command word ends at the first space, argument is the rest
+    uint16_t word = 0;
+    while (word < len && buf[word] != ' ') {
+        word++;
+    }
+    const char * arg = word < len ? &buf[word + 1] : "";
+    uint16_t arg_len = word < len ? len - word - 1 : 0;
+
+    for (uint32_t i = 0; i < SHELL_COMMANDS; i++) {
+        const shell_entry * entry = &shell_commands[i];
+        // Length first, it rejects most entries and all prefixes
+        if (entry->len != word || 0 != memcmp(entry->name, buf, word)) {
+            continue;
+        }
+        if (!shell_arg_ok(entry->arg, arg, arg_len)) {
+            return INVALID_CMD;
+        }
+        strncpy(shell_arg, arg, SHELL_ARG_LEN - 1);
+        shell_arg[SHELL_ARG_LEN - 1] = '\0';
+        return entry->cmd;
+    }
 
     return INVALID_CMD;
 }
 
+/*!
+ * @brief           Checks argument of a command against its table entry
+ *
+ * @param[in] type  Argument the command takes
+ * @param[in] arg   Text after the space, not NUL terminated
+ * @param[in] len   Length of the text
+ */
+static bool shell_arg_ok(shell_arg_type type, const char * arg, uint16_t len)
+{
+    if (len >= SHELL_ARG_LEN) {
+        return false;
+    }
+
+    switch (type)
+    {
+        case ARG_NONE:
+            return len == 0;
+
+        case ARG_NAME:
+            return len > 0;
+
+        case ARG_NUMBER:
+            for (uint16_t i = 0; i < len; i++) {
+                if (arg[i] < '0' || arg[i] > '9') {
+                    return false;
+                }
+            }
+            return true;
+    }
+    return false;
+}
+
 
 static bool execute_command(shell_cmd cmd)
 {
@@ -88,20 +362,355 @@ static bool deliver_cmd(shell_cmd cmd, char * buf, uint16_t max_len)
 
         case ML:
             if (!max_len) {
-                if (get_flir_image(image)){
+                uint32_t runs = shell_arg[0] ? strtoul(shell_arg, NULL, 10) :
+                                               1;
+                ml_exe(runs);
+            }
+            else {
+                get_inference_results(buf, max_len);
+            }
+        break;
+
+        case PROFILE:
+            if (!max_len) {
+                inference_profile_report();
+            }
+            else {
+                snprintf(buf, max_len, "PROFILE: OK\n");
+            }
+        break;
+
+        case STATS:
+            if (!max_len) {
+                counters_print();
+                cycle_budget_print();
+                irq_report();
+#ifdef BACKGROUND_INVOKE
+                background_report();
+#endif
+                inference_stats_report();
+#ifdef KEYWORD_TRIGGER
+                keyword_report();
+#endif
+                boot_report();
+                periph_clock_report();
+#ifdef MODEL_UPDATE
+                model_slot_report();
+#endif
+#ifdef QSPI_MODEL
+                qspi_flash_report();
+#endif
+#ifdef EXT_SDRAM
+                sdram_report();
+#endif
+#ifdef FLIR_SECOND
+                flir_port_report(&flir_second);
+#endif
+#ifdef DCMI_CAMERA
+                dcmi_cam_report();
+#endif
+#ifdef THERMAL_GOVERNOR
+                thermal_gov_report();
+#endif
+#ifdef RATE_GOVERNOR
+                rate_gov_report();
+#endif
+#ifdef ETH_UDP
+                eth_udp_report();
+#endif
+#ifdef POWER_METER
+                power_meter_report();
+#endif
+#ifndef MINICOM_SHELL
+                sched_report();
+#endif
+            }
+            else {
+                snprintf(buf, max_len, "STATS: OK\n");
+            }
+        break;
+
+        case MODEL:
+            if (!max_len) {
+                // Interpreter is rebuilt, FLIR and the rest keep running
+                if (!inference_load_model(shell_arg)) {
+                    return false;
+                }
+                // Model is loaded again after reset
+                config_store_set(CONFIG_MODEL, inference_model_id());
+            }
+            else {
+                snprintf(buf, max_len, "MODEL: OK %s\n", 
+                         inference_model_name());
+            }
+        break;
 
-                    printf("Doing inference");
-                    inference_exe(image); 
+        case CLOCK:
+            if (!max_len) {
+                if (!clock_policy_set_name(shell_arg)) {
+                    return false;
                 }
-                else{
-                    printf("Getting flir image failed");
+                config_store_set(CONFIG_CLOCK_POLICY, clock_policy_get());
+            }
+            else {
+                snprintf(buf, max_len, "CLOCK: OK %s %d\n", 
+                         clock_policy_name(), g_clock_mhz);
+            }
+        break;
+
+#ifdef RATE_GOVERNOR
+        case RATE:
+            if (!max_len) {
+                // "RATE STANDBY", ML loops are paced by it from now on
+                if (!rate_gov_policy_set_name(shell_arg)) {
+                    return false;
                 }
+                config_store_set(CONFIG_RATE_POLICY, rate_gov_policy_get());
             }
             else {
-                get_inference_results(buf, max_len);
+                snprintf(buf, max_len, "RATE: OK %s %lu\n",
+                         rate_gov_policy_name(), rate_gov_interval());
+            }
+        break;
+#endif
+
+        case SET:
+            if (!max_len) {
+                // "SET motion_threshold 12", used from the next boot on
+                if (!set_exe(shell_arg)) {
+                    return false;
+                }
+            }
+            else {
+                snprintf(buf, max_len, "SET: OK\n");
+            }
+        break;
+
+        case BENCH:
+            if (!max_len) {
+                uint32_t runs = shell_arg[0] ? strtoul(shell_arg, NULL, 10) :
+                                               BENCH_DEFAULT_RUNS;
+                if (!inference_benchmark(runs)) {
+                    return false;
+                }
+            }
+            else {
+                snprintf(buf, max_len, "BENCH: OK\n");
+            }
+        break;
+
+        case SWEEP:
+            if (!max_len) {
+                uint32_t runs = shell_arg[0] ? strtoul(shell_arg, NULL, 10) :
+                                               SWEEP_DEFAULT_RUNS;
+                if (!inference_cache_sweep(runs)) {
+                    return false;
+                }
+            }
+            else {
+                snprintf(buf, max_len, "SWEEP: OK\n");
+            }
+        break;
+
+        case COLD:
+            if (!max_len) {
+                uint32_t runs = shell_arg[0] ? strtoul(shell_arg, NULL, 10) :
+                                               COLD_DEFAULT_RUNS;
+                if (!inference_cold_bench(runs)) {
+                    return false;
+                }
+            }
+            else {
+                snprintf(buf, max_len, "COLD: OK\n");
+            }
+        break;
+
+        case TUNE:
+            if (!max_len) {
+                // Layer kernels of the current model, kept across resets
+                if (!inference_tune()) {
+                    return false;
+                }
+            }
+            else {
+                snprintf(buf, max_len, "TUNE: OK\n");
             }
         break;
 
+        case SOAK:
+            if (!max_len) {
+                // Without argument soak runs until the next command
+                uint32_t runs = shell_arg[0] ? strtoul(shell_arg, NULL, 10) :
+                                               0;
+#ifdef MINICOM_SHELL
+                if (!inference_soak(runs ? runs : SOAK_DEFAULT_RUNS, NULL)) {
+#else
+                if (!inference_soak(runs, console_line_ready)) {
+#endif
+                    return false;
+                }
+            }
+            else {
+                snprintf(buf, max_len, "SOAK: OK\n");
+            }
+        break;
+
+#ifndef MINICOM_SHELL
+        case EVAL:
+            if (!max_len) {
+                // Host streams the tensors, look at eval_stream.py
+                uint32_t count = strtoul(shell_arg, NULL, 10);
+                if (!inference_eval(count)) {
+                    return false;
+                }
+            }
+            else {
+                snprintf(buf, max_len, "EVAL: OK\n");
+            }
+        break;
+#endif
+
+        case SENSORS:
+            if (!max_len) {
+                // "SENSORS 0" stops sampling, other rates restart it
+                if (shell_arg[0]) {
+                    uint32_t rate = strtoul(shell_arg, NULL, 10);
+                    if (rate) {
+                        sensors_start(rate);
+                    }
+                    else {
+                        sensors_stop();
+                    }
+                }
+                sensors_report();
+            }
+            else {
+                snprintf(buf, max_len, "SENSORS: OK\n");
+            }
+        break;
+
+#if defined(MODEL_UPDATE) && !defined(MINICOM_SHELL)
+        case UPDATE:
+            if (!max_len) {
+                // Slot is erased in the background, look at model_update.py
+                if (!inference_update_begin(strtoul(shell_arg, NULL, 10))) {
+                    return false;
+                }
+            }
+            else {
+                snprintf(buf, max_len, "UPDATE: OK %u\n", MODEL_SLOT_CHUNK);
+            }
+        break;
+
+        case UPLOAD:
+            if (!max_len) {
+                if (!inference_update_upload()) {
+                    return false;
+                }
+            }
+            else {
+                snprintf(buf, max_len, "UPLOAD: OK %lu\n", 
+                         model_slot_received());
+            }
+        break;
+
+        case COMMIT:
+            if (!max_len) {
+                // Argument is CRC-32 of the model, in decimal
+                if (!inference_update_commit(strtoul(shell_arg, NULL, 10))) {
+                    return false;
+                }
+                // Slot model is loaded again after reset
+                config_store_set(CONFIG_MODEL, inference_model_id());
+            }
+            else {
+                snprintf(buf, max_len, "COMMIT: OK %s\n", 
+                         inference_model_name());
+            }
+        break;
+#endif
+
+#ifdef PC_SAMPLER
+        case PCPROF:
+            if (!max_len) {
+                // "PCPROF 0" stops and prints, other rates restart, without
+                // argument it prints or starts, look at pc_profile.py
+                if (shell_arg[0]) {
+                    uint32_t rate = strtoul(shell_arg, NULL, 10);
+                    if (rate) {
+                        pc_sample_start(rate);
+                        if (!pc_sample_rate()) {
+                            return false;
+                        }
+                    }
+                    else {
+                        pc_sample_stop();
+                        pc_sample_dump();
+                    }
+                }
+                else if (pc_sample_rate()) {
+                    pc_sample_dump();
+                }
+                else {
+                    pc_sample_start(PC_SAMPLE_DEFAULT_HZ);
+                }
+            }
+            else {
+                snprintf(buf, max_len, "PCPROF: OK\n");
+            }
+        break;
+#endif
+
+        case TRAP:
+            if (!max_len) {
+                uint32_t frames = shell_arg[0] ? strtoul(shell_arg, NULL, 10) :
+                                                 TRAP_DEFAULT_FRAMES;
+                if (!trap_exe(frames ? frames : 1)) {
+                    return false;
+                }
+            }
+            else {
+                snprintf(buf, max_len, "TRAP: OK\n");
+            }
+        break;
+
+        case FFC:
+            if (!max_len) {
+                // Runs from interrupts, capture and inference continue
+                if (!flir_run_ffc_async(NULL)) {
+                    return false;
+                }
+            }
+            else {
+                snprintf(buf, max_len, "FFC: OK\n");
+            }
+        break;
+
+        case FLAT:
+            if (!max_len) {
+                // Learnt by the next image captures, look at FLIR_FLAT_FIELD
+                if (!flir_flat_calibrate()) {
+                    return false;
+                }
+            }
+            else {
+                snprintf(buf, max_len, "FLAT: OK\n");
+            }
+        break;
+
+#ifdef ROI_INFERENCE
+        case ROI:
+            if (!max_len) {
+                if (!inference_roi_exe()) {
+                    printf("Inference failed");
+                }
+            }
+            else {
+                get_roi_results(buf, max_len);
+            }
+        break;
+#endif
+
         case INVALID_CMD: invalid_cmd(buf, max_len);
             return false;
 
@@ -115,6 +724,217 @@ static bool deliver_cmd(shell_cmd cmd, char * buf, uint16_t max_len)
 }
 
 
+/*!
+ * @brief           Runs inference on consecutive frames and sends result 
+ *                  of each one as soon as it is ready
+ *
+ * @param[in] runs  Number of inferences, 0 runs until the next command 
+ *                  line arrives
+ *
+ * @return          False if an inference failed, batch stops there
+ *
+ * @note            Result of the last inference is left for 
+ *                  get_command_response(), so "ML" alone answers as 
+ *                  before and a batch ends with the usual response. Host 
+ *                  can queue further commands meanwhile, console receives 
+ *                  them over DMA. Pipeline keeps capturing while results 
+ *                  are sent, only a full frame queue drops frames.
+ */
+static bool ml_exe(uint32_t runs)
+{
+    char buf[SHELL_BUF_LEN];
+
+#ifdef MINICOM_SHELL
+    // Lines are not queued, nothing could stop the stream
+    if (runs == 0) {
+        runs = 1;
+    }
+#endif
+
+    for (uint32_t run = 1; ; run++)
+    {
+        // Hot die slows the loop down, look at thermal_gov.c
+        thermal_gov_pace();
+#ifdef RATE_GOVERNOR
+        // So does a quiet scene, from the second frame of the loop on
+        if (run > 1 && !rate_pace()) {
+            printf("FLIR not ready");
+            return false;
+        }
+#endif
+#ifdef ZERO_COPY_CAPTURE
+        if (!inference_capture_exe()) {
+#else
+        // Next frame is already being captured while this one 
+        // is processed
+        if (!inference_pipeline_exe()) {
+#endif
+            printf("Inference failed");
+            return false;
+        }
+#ifdef RATE_GOVERNOR
+        rate_gov_update(inference_activity());
+#endif
+
+#ifdef MINICOM_SHELL
+        bool last = run >= runs;
+#else
+        bool last = runs ? run >= runs : console_line_ready();
+#endif
+        if (last) {
+            return true;
+        }
+        get_inference_results(buf, sizeof(buf));
+        put_line(buf);
+    }
+}
+
+#ifdef RATE_GOVERNOR
+/*!
+ * @brief           Waits until the rate governor lets the next frame of
+ *                  the ML loop start, with the Lepton in standby if the
+ *                  wait is long enough for a boot
+ *
+ * @return          False if the camera did not boot again
+ *
+ * @note            Boot starts RATE_BOOT_LEAD_MS before the frame is due,
+ *                  the part that is not over by then is waited for in
+ *                  flir_wait_ready(). Command line ends the wait early.
+ */
+static bool rate_pace()
+{
+    uint32_t hold = rate_gov_hold();
+    if (!rate_gov_standby(hold)) {
+        rate_gov_wait(hold, false);
+        return true;
+    }
+
+    // As in trap_exe(), capture has to be finished first
+#ifndef ZERO_COPY_CAPTURE
+    inference_pipeline_stop();
+#endif
+    flir_power_down();
+    rate_gov_wait(hold - RATE_BOOT_LEAD_MS, true);
+    flir_power_up_start();
+    return flir_wait_ready();
+}
+#endif
+
+/*!
+ * @brief           Camera trap duty cycle, board waits in STOP with the
+ *                  Lepton powered down, wake pin starts classification of
+ *                  a few frames, then it goes back to STOP
+ *
+ * @param[in] frames    Frames classified per wake up
+ *
+ * @return          False if inference failed
+ *
+ * @note            Look at stop_mode.h for the wake pin. Any character on
+ *                  the console ends it, press Enter, it may be lost while
+ *                  the clock is restored. Latency of the first result is
+ *                  measured from the restored clock, it includes boot of
+ *                  the Lepton, look at flir_wait_ready().
+ */
+static bool trap_exe(uint32_t frames)
+{
+    char buf[SHELL_BUF_LEN];
+    uint32_t rate = sensors_rate();
+    uint32_t wakes = 0;
+
+    printf("Trap: %lu frames per wake up, console ends it\n", frames);
+    while (1)
+    {
+        // Nothing may be running on the buses while clocks are stopped
+#ifndef ZERO_COPY_CAPTURE
+        inference_pipeline_stop();
+#endif
+        sensors_stop();
+#ifdef KEYWORD_TRIGGER
+        keyword_stop();
+#endif
+        flir_power_down();
+        while (i2c_async_busy());
+        inference_suspend();
+
+        stop_wake_t wake = stop_mode_enter();
+        if (wake == STOP_WAKE_CONSOLE) {
+            break;
+        }
+        if (wake == STOP_WAKE_NONE) {
+            continue;
+        }
+
+        // Interpreter and sensors are checked while the camera boots
+        flir_power_up_start();
+        if (!inference_resume()) {
+            return false;
+        }
+        if (rate) {
+            sensors_start(rate);
+        }
+        if (!flir_wait_ready()) {
+            return false;
+        }
+        uint32_t first_ms = 0;
+        for (uint32_t run = 0; run < frames; run++)
+        {
+#ifdef ZERO_COPY_CAPTURE
+            if (!inference_capture_exe()) {
+#else
+            if (!inference_pipeline_exe()) {
+#endif
+                printf("Inference failed");
+                return false;
+            }
+            if (run == 0) {
+                first_ms = (micros() - stop_mode_wake_time()) / 1000;
+            }
+            get_inference_results(buf, sizeof(buf));
+            put_line(buf);
+        }
+        printf("Trap: wake up %lu, first result after %lu ms\n", 
+               ++wakes, first_ms);
+    }
+
+    flir_power_up();
+    if (rate) {
+        sensors_start(rate);
+    }
+#ifdef KEYWORD_TRIGGER
+    keyword_start();
+#endif
+    printf("Trap: %lu wake ups\n", wakes);
+    return true;
+}
+
+/*!
+ * @brief           Writes setting of config_store.h
+ *
+ * @param[in] arg   Name and decimal value, "motion_threshold 12"
+ *
+ * @return          False if name is unknown, value is missing or flash 
+ *                  reported an error
+ */
+static bool set_exe(char * arg)
+{
+    char * value = strchr(arg, ' ');
+    if (value == NULL || value[1] < '0' || value[1] > '9') {
+        printf("Settings:");
+        for (uint32_t key = 0; key < CONFIG_KEY_END; key++) {
+            printf(" %s", config_store_key_name((config_key_e) key));
+        }
+        printf("\n");
+        return false;
+    }
+    *value++ = '\0';
+
+    if (!config_store_set_name(arg, strtoul(value, NULL, 10))) {
+        printf("Setting %s not stored\n", arg);
+        return false;
+    }
+    return true;
+}
+
 static bool blink_exe()
 {
     for (int i = 0; i < 2; i++)
@@ -136,6 +956,33 @@ static void blink_response(char * buf, uint16_t max_len)
     snprintf(buf, max_len, "BLINK: OK\n");
 }
 
+#ifdef RESULT_BUS
+/*!
+ * @brief   Sets LD3 while the alarm class is on top and sure enough, 
+ *          clears it for any other result
+ *
+ * @note    Called by result_bus_publish() before the ML response is sent,
+ *          it is done with the record right away.
+ */
+static bool alarm_notify(result_sub_t * sub, const result_record_t * record)
+{
+    (void) sub;
+    bool alarm = record->top_class == RESULT_ALARM_CLASS && 
+                 record->count > RESULT_ALARM_CLASS &&
+                 record->scores[RESULT_ALARM_CLASS] - record->zero_point >= 
+                 RESULT_ALARM_SCORE;
+    if (alarm)
+    {
+        gpio_set(GPIOB, GPIO14);
+    }
+    else
+    {
+        gpio_clear(GPIOB, GPIO14);
+    }
+    return true;
+}
+#endif
+
 static void invalid_cmd(char * buf, uint16_t max_len)
 {
     snprintf(buf, max_len, "INVALID COMMAND\n");
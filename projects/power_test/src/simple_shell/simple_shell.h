@@ -15,8 +15,36 @@ typedef enum
     INVALID_CMD,
     BLINK,
     ML,
+    PROFILE,
+    MODEL,
+    CLOCK,
+    SET,
+    BENCH,
+    FFC,
+    FLAT,
+    ROI,
+    SWEEP,
+    STATS,
+    SOAK,
+    SENSORS,
+    TRAP,
+    COLD,
+    TUNE,
+    EVAL,
+    PCPROF,
+    UPDATE,
+    UPLOAD,
+    COMMIT,
+    RATE,
 } shell_cmd; 
 
+#define SHELL_ARG_LEN 32    // Longest argument of a command, with '\0'
+#define BENCH_DEFAULT_RUNS 50   // Inferences of BENCH without argument
+#define SWEEP_DEFAULT_RUNS 10   // Inferences per setting of SWEEP
+#define COLD_DEFAULT_RUNS 20    // Cold and warm pairs of COLD
+#define SOAK_DEFAULT_RUNS 100000    // SOAK without argument and line queue
+#define TRAP_DEFAULT_FRAMES 3   // Frames classified per wake up of TRAP
+
 void simple_shell();
 
 #ifdef __cplusplus
@@ -1,11 +1,25 @@
 #include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/nvic.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "uart_ctrl.h"
 #include "simple_shell.h"
-#include "system_setup/printf.h"
+#include "usb_cdc.h"
+#include "printf.h"
+#include "system_setup/uart_tx.h"
+#include "system_setup/utility.h"
+#include "system_setup/dma_buf.h"
+#include "system_setup/events.h"
+#include "system_setup/trace.h"
+#include "system_setup/counters.h"
+#include "system_setup/cycle_budget.h"
+#include "lockfree.h"
+#include "system_setup/periph_clock.h"
 
 #ifdef MINICOM_SHELL
 #define CONSOLE_UART	USART3
@@ -13,15 +27,61 @@
 #define CONSOLE_UART	USART2
 #endif
 
+#if !defined(MINICOM_SHELL) && !defined(USB_CONSOLE)
+/* Explanation: USART2 RX is received by DMA1 stream 5, channel 4 into 
+ * circular buffer, CPU is not involved per character. When the line goes 
+ * idle (or DMA is half/fully through the buffer) interrupt scans new 
+ * characters and every '\n' terminated line is put into line queue, which
+ * is consumed by console_read_line() in main context. Interrupt is the 
+ * only producer of the queue and main context the only consumer, so it is
+ * a spsc_ring_t of lockfree.h.
+ *
+ * console_raw_start() points the same stream at a buffer of the caller
+ * in normal mode, for binary blocks like input tensors of EVAL, transfer
+ * complete interrupt posts EVENT_CONSOLE_RAW. console_raw_stop() puts
+ * the stream back on rx_buf in circular mode.
+ * */
+typedef struct
+{
+    uint16_t start;
+    uint16_t len;
+}console_line_t;
+
+static char rx_buf[DMA_BUF_ROUND(CONSOLE_RX_BUF_LEN)] DMA_BUFFER;
+static uint16_t rx_scan = 0;          // Next character to check
+static uint16_t rx_line_start = 0;    // Start of line being received
+
+static LOCKFREE_STORAGE(line_slots, sizeof(console_line_t),
+                        CONSOLE_LINE_QUEUE_LEN);
+static spsc_ring_t line_queue;
+
+// Stream receives a block of console_raw_start() instead of lines
+static volatile bool raw_mode = false;
+static uint32_t raw_len = 0;
+
+#define CONSOLE_DMA_FLAGS   (DMA_TCIF | DMA_HTIF | DMA_TEIF | DMA_DMEIF | \
+                             DMA_FEIF)
+
+static void console_rx_scan();
+static void console_rx_stream(void * buf, uint32_t len, bool circular);
+#endif
+
 /*
  * put_char(char c)
  *
  * Send the character 'c' to the USART, wait for the USART
- * transmit buffer to be empty first.
+ * transmit buffer to be empty first. USART3 is shared with printf, so 
+ * it has to go through the same transmit buffer to keep the order.
  */
 static void put_char(char c)
 {
+#ifdef MINICOM_SHELL
+    uart_tx_putc(c);
+#elif defined(USB_CONSOLE)
+    usb_cdc_write(&c, 1);
+#else
     usart_send_blocking(CONSOLE_UART, c); /* USART6: Send byte. */
+#endif
 }
 
 /*
@@ -40,14 +100,370 @@ static char get_char(int wait)
 	return (reg & USART_ISR_RXNE) ? usart_recv_blocking(CONSOLE_UART) : '\000';
 }
 
+#if !defined(MINICOM_SHELL) && defined(USB_CONSOLE)
+/*!
+ * @brief   Starts USB device, host enumerates it as a serial port
+ *
+ * @note    Call it once, after clock_setup()
+ */
+void console_setup()
+{
+    usb_cdc_setup();
+}
+
+/*!
+ * @brief           Takes next received line, as console_read_line() of 
+ *                  USART2, line is echoed back
+ */
+int console_read_line(char *s, int len)
+{
+    int n = usb_cdc_read_line(s, len);
+    if (n == USB_CDC_NO_LINE)
+    {
+        return CONSOLE_NO_LINE;
+    }
+    usb_cdc_write(s, n);
+    return n;
+}
+
+/*!
+ * @brief   Tells if there is a received line waiting in line queue
+ */
+bool console_line_ready()
+{
+    return usb_cdc_line_ready();
+}
+
+/*!
+ * @brief           Receives the next len bytes from host into buf, as
+ *                  console_raw_start() of USART2
+ */
+bool console_raw_start(void * buf, uint32_t len)
+{
+    event_take(EVENT_CONSOLE_RAW);
+    usb_cdc_raw_start(buf, len);
+    return true;
+}
+
+/*!
+ * @brief   Returns number of bytes of the block that are received
+ */
+uint32_t console_raw_received()
+{
+    return usb_cdc_raw_received();
+}
+
+/*!
+ * @brief   Receives lines again
+ */
+void console_raw_stop()
+{
+    usb_cdc_raw_stop();
+}
+#elif !defined(MINICOM_SHELL)
+/*!
+ * @brief   Starts circular DMA reception on USART2 and enables idle line
+ *          interrupt
+ *
+ * @note    Call it once, after usart_setup()
+ */
+void console_setup()
+{
+    periph_clock_acquire(RCC_DMA1);
+
+    dma_stream_reset(DMA1, DMA_STREAM5);
+    dma_channel_select(DMA1, DMA_STREAM5, DMA_SxCR_CHSEL_4);
+    dma_set_priority(DMA1, DMA_STREAM5, DMA_SxCR_PL_MEDIUM);
+    dma_set_transfer_mode(DMA1, DMA_STREAM5, DMA_SxCR_DIR_PERIPHERAL_TO_MEM);
+    dma_set_peripheral_address(DMA1, DMA_STREAM5, (uint32_t) &USART_RDR(USART2));
+    dma_set_peripheral_size(DMA1, DMA_STREAM5, DMA_SxCR_PSIZE_8BIT);
+    dma_set_memory_size(DMA1, DMA_STREAM5, DMA_SxCR_MSIZE_8BIT);
+    dma_enable_memory_increment_mode(DMA1, DMA_STREAM5);
+    dma_enable_transfer_complete_interrupt(DMA1, DMA_STREAM5);
+
+    spsc_init(&line_queue, line_slots, sizeof(console_line_t),
+              CONSOLE_LINE_QUEUE_LEN);
+    console_rx_stream(rx_buf, CONSOLE_RX_BUF_LEN, true);
+    usart_enable_rx_dma(USART2);
+
+    USART_ICR(USART2) = USART_ICR_IDLECF;
+    USART_CR1(USART2) |= USART_CR1_IDLEIE;
+
+    nvic_enable_irq(NVIC_DMA1_STREAM5_IRQ);
+    nvic_enable_irq(NVIC_USART2_IRQ);
+}
+
+/*!
+ * @brief           Takes next received line out of line queue
+ *
+ * @param[out] s    Buffer for the line, it is NUL terminated, 
+ *                  '\n' is not included
+ * @param[in] len   Size of the buffer
+ *
+ * @return          Length of the line, zero for an empty line,
+ *                  CONSOLE_NO_LINE if no line was received
+ *
+ * @note            Does not block. Line is echoed back, like in get_line().
+ */
+int console_read_line(char *s, int len)
+{
+    const console_line_t * line = spsc_read_slot(&line_queue);
+    if (!line)
+    {
+        return CONSOLE_NO_LINE;
+    }
+
+    int n = 0;
+    while (n < line->len && n < len - 1)
+    {
+        s[n] = rx_buf[(line->start + n) % CONSOLE_RX_BUF_LEN];
+        put_char(s[n]);
+        n++;
+    }
+    s[n] = '\000';
+
+    // Slot can only be reused after line is copied out
+    spsc_release(&line_queue);
+
+    return n;
+}
+
+/*!
+ * @brief   Tells if there is a received line waiting in line queue
+ */
+bool console_line_ready()
+{
+    return !spsc_empty(&line_queue);
+}
+
+/*!
+ * @brief               Restarts DMA1 stream 5 on a buffer
+ *
+ * @param[in] circular  True for lines in rx_buf, false for a raw block
+ */
+static void console_rx_stream(void * buf, uint32_t len, bool circular)
+{
+    dma_disable_stream(DMA1, DMA_STREAM5);
+    while (DMA_SCR(DMA1, DMA_STREAM5) & DMA_SxCR_EN);
+    dma_clear_interrupt_flags(DMA1, DMA_STREAM5, CONSOLE_DMA_FLAGS);
+
+    // Buffer is only written by DMA, so stale data can be invalidated
+    dma_buf_invalidate(buf, len);
+    dma_set_memory_address(DMA1, DMA_STREAM5, (uint32_t) buf);
+    dma_set_number_of_data(DMA1, DMA_STREAM5, len);
+    if (circular)
+    {
+        // Long lines without pause are scanned in halves
+        dma_enable_circular_mode(DMA1, DMA_STREAM5);
+        dma_enable_half_transfer_interrupt(DMA1, DMA_STREAM5);
+        rx_scan = 0;
+        rx_line_start = 0;
+    }
+    else
+    {
+        DMA_SCR(DMA1, DMA_STREAM5) &= ~DMA_SxCR_CIRC;
+        dma_disable_half_transfer_interrupt(DMA1, DMA_STREAM5);
+    }
+    raw_mode = !circular;
+    dma_enable_stream(DMA1, DMA_STREAM5);
+}
+
+/*!
+ * @brief           Receives the next len bytes from host straight into buf,
+ *                  EVENT_CONSOLE_RAW is posted when all of them are there
+ *
+ * @return          False if block is longer than one DMA transfer
+ *
+ * @note            Lines that were not scanned yet are queued first, a
+ *                  partial line is lost. Host has to send the block only
+ *                  after it was asked for, bytes before are dropped. Read
+ *                  buf after dma_buf_invalidate(), call console_raw_stop()
+ *                  to receive lines again.
+ */
+bool console_raw_start(void * buf, uint32_t len)
+{
+    if (len == 0 || len > UINT16_MAX)
+    {
+        return false;
+    }
+
+    nvic_disable_irq(NVIC_USART2_IRQ);
+    nvic_disable_irq(NVIC_DMA1_STREAM5_IRQ);
+    if (!raw_mode)
+    {
+        console_rx_scan();
+    }
+    raw_len = len;
+    event_take(EVENT_CONSOLE_RAW);
+    console_rx_stream(buf, len, false);
+    nvic_enable_irq(NVIC_DMA1_STREAM5_IRQ);
+    nvic_enable_irq(NVIC_USART2_IRQ);
+    return true;
+}
+
+/*!
+ * @brief   Returns number of bytes of the block that are received
+ */
+uint32_t console_raw_received()
+{
+    return raw_mode ? raw_len - DMA_SNDTR(DMA1, DMA_STREAM5) : 0;
+}
+
+/*!
+ * @brief   Receives lines into rx_buf again
+ */
+void console_raw_stop()
+{
+    if (!raw_mode)
+    {
+        return;
+    }
+    nvic_disable_irq(NVIC_DMA1_STREAM5_IRQ);
+    console_rx_stream(rx_buf, CONSOLE_RX_BUF_LEN, true);
+    nvic_enable_irq(NVIC_DMA1_STREAM5_IRQ);
+}
+#endif
+
+#ifndef MINICOM_SHELL
+/*!
+ * @brief               Sleeps until the block of console_raw_start() is
+ *                      received
+ *
+ * @param[in] len       Length given to console_raw_start()
+ * @param[in] timeout   In ms
+ *
+ * @return              False if host did not send all of it in time
+ */
+bool console_raw_wait(uint32_t len, uint32_t timeout)
+{
+    uint64_t start = millis();
+
+    while (console_raw_received() < len)
+    {
+        uint32_t elapsed = (uint32_t) (millis() - start);
+        if (elapsed >= timeout)
+        {
+            return false;
+        }
+        event_wait(EVENT_CONSOLE_RAW, timeout - elapsed);
+    }
+    return true;
+}
+
+/*!
+ * @brief   Sleeps until a line is received
+ *
+ * @note    Line that arrives between the check and the sleep is not 
+ *          lost, it is left pending as EVENT_CONSOLE_LINE.
+ */
+void console_wait_line()
+{
+    while (!console_line_ready())
+    {
+        event_wait(EVENT_CONSOLE_LINE, EVENT_FOREVER);
+    }
+}
+#endif
+
+#if !defined(MINICOM_SHELL) && !defined(USB_CONSOLE)
+/*!
+ * @brief   Finds complete lines among characters that DMA received 
+ *          since the last call
+ *
+ * @note    Called from USART2 and DMA1 stream 5 interrupts, which have 
+ *          the same priority, so they do not preempt each other. If more 
+ *          than CONSOLE_RX_BUF_LEN characters arrive before main context 
+ *          reads the line, it gets overwritten.
+ */
+static void console_rx_scan()
+{
+    uint16_t write = CONSOLE_RX_BUF_LEN - DMA_SNDTR(DMA1, DMA_STREAM5);
+    if (write >= CONSOLE_RX_BUF_LEN)
+    {
+        write = 0;
+    }
+
+    dma_buf_invalidate(rx_buf, sizeof(rx_buf));
+
+    while (rx_scan != write)
+    {
+        char c = rx_buf[rx_scan];
+        if (c == '\n')
+        {
+            uint16_t len = (rx_scan + CONSOLE_RX_BUF_LEN - rx_line_start) % 
+                           CONSOLE_RX_BUF_LEN;
+
+            // Line is dropped if main context does not keep up
+            console_line_t * line = spsc_write_slot(&line_queue);
+            if (line)
+            {
+                line->start = rx_line_start;
+                line->len = len;
+                spsc_commit(&line_queue);
+                event_post(EVENT_CONSOLE_LINE);
+            }
+            else
+            {
+                counter_add(COUNTER_UART_DROPPED, len + 1);
+            }
+            rx_line_start = (rx_scan + 1) % CONSOLE_RX_BUF_LEN;
+        }
+        rx_scan = (rx_scan + 1) % CONSOLE_RX_BUF_LEN;
+    }
+}
+
+void usart2_isr()
+{
+    CYCLE_BUDGET(BUDGET_CONSOLE_RX_ISR, BUDGET_CONSOLE_RX_ISR_CYCLES);
+    if (USART_ISR(USART2) & USART_ISR_IDLE)
+    {
+        USART_ICR(USART2) = USART_ICR_IDLECF;
+        TRACE(TRACE_CONSOLE_RX_ISR, 0);
+        if (!raw_mode)
+        {
+            console_rx_scan();
+        }
+    }
+
+    // Overrun would stop reception
+    if (USART_ISR(USART2) & USART_ISR_ORE)
+    {
+        USART_ICR(USART2) = USART_ICR_ORECF;
+        counter_add(COUNTER_UART_DROPPED, 1);
+    }
+}
+
+void dma1_stream5_isr()
+{
+    CYCLE_BUDGET(BUDGET_CONSOLE_RX_ISR, BUDGET_CONSOLE_RX_ISR_CYCLES);
+    if (dma_get_interrupt_flag(DMA1, DMA_STREAM5, DMA_HTIF))
+    {
+        dma_clear_interrupt_flags(DMA1, DMA_STREAM5, DMA_HTIF);
+    }
+    if (dma_get_interrupt_flag(DMA1, DMA_STREAM5, DMA_TCIF))
+    {
+        dma_clear_interrupt_flags(DMA1, DMA_STREAM5, DMA_TCIF);
+        if (raw_mode)
+        {
+            event_post(EVENT_CONSOLE_RAW);
+        }
+    }
+    TRACE(TRACE_CONSOLE_RX_ISR, 1);
+    if (!raw_mode)
+    {
+        console_rx_scan();
+    }
+}
+#endif
+
 /*
- * void put_line(char *s)
+ * void put_line(const char *s)
  *
  * Send a string to the console, one character at a time, return
  * after the last character, as indicated by a NUL character, is
  * reached.
  */
-void put_line(char *fmt, ...)
+void put_line(const char *fmt, ...)
 {
     char buf[512];
 
@@ -76,12 +492,12 @@ void put_line(char *fmt, ...)
  */
 int get_line(char *s, int len)
 {
+#ifdef MINICOM_SHELL
     char *t = s;
     char c;
 
     *t = '\000';
     /* read until a <CR> is received */
-#ifdef MINICOM_SHELL
     while ((c = get_char(1)) != '\r') {
         if ((c == '\010') || (c == '\127')) {
             if (t > s) {
@@ -100,16 +516,14 @@ int get_line(char *s, int len)
     }
     return t - s;
 #else
-    while ((c = get_char(1)) != '\n') {
-        *t = c;
-        put_char(c);
-        if ((t - s) < len) {
-            t++;
-        }
-        *t = '\000';
+    /* lines are received by DMA, sleep until one arrives, empty line
+     * gives 0 like the loop above */
+    int n = CONSOLE_NO_LINE;
+    while (n == CONSOLE_NO_LINE) {
+        console_wait_line();
+        n = console_read_line(s, len);
     }
-
-    return t - s;
+    return n;
 #endif
         /* update end of string with NUL */
 }
@@ -7,9 +7,35 @@ extern "C" {
 
 
 
-void put_line(char *fmt, ...);
+#include <stdint.h>
+#include <stdbool.h>
+
+// Define to run console over USB CDC-ACM on the user USB connector instead 
+// of USART2, look at usb_cdc.c. Binary telemetry goes there too, so frames 
+// are streamed at full rate.
+//#define USB_CONSOLE
+
+// Console RX over DMA, used when MINICOM_SHELL is not defined
+#define CONSOLE_RX_BUF_LEN      256
+#define CONSOLE_LINE_QUEUE_LEN  8       // Power of two, spsc_ring_t
+
+// console_read_line() when no line is queued, an empty line is 0
+#define CONSOLE_NO_LINE         (-1)
+
+void put_line(const char *fmt, ...);
 int get_line(char *s, int len);
 
+void console_setup();
+int console_read_line(char *s, int len);
+bool console_line_ready();
+void console_wait_line();
+bool console_raw_start(void * buf, uint32_t len);
+uint32_t console_raw_received();
+bool console_raw_wait(uint32_t len, uint32_t timeout);
+void console_raw_stop();
+void usart2_isr();
+void dma1_stream5_isr();
+
 #ifdef __cplusplus
 }
 #endif
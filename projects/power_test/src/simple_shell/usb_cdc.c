@@ -0,0 +1,635 @@
+#include <stdlib.h>
+#include <string.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/usb/usbd.h>
+#include <libopencm3/usb/cdc.h>
+#include "usb_cdc.h"
+#include "system_setup/events.h"
+#include "system_setup/counters.h"
+#include "system_setup/periph_clock.h"
+#include "system_setup/irq_prio.h"
+
+/* Explanation: CDC-ACM device on OTG FS, host sees it as a serial port,
+ * baud rate it sets is ignored, data moves at USB speed, around 1 MB/s
+ * of bulk transfers, which is the whole 60x80 frame stream with room to
+ * spare. OTG FS has no ping-pong buffers for bulk endpoints, so buffering
+ * is done around its FIFO: while one IN packet waits in the FIFO for the
+ * host, the next one is filled in the transmit ring, and the transfer
+ * complete interrupt moves it into the FIFO right away. OUT packets are
+ * copied out of the FIFO in the interrupt, so endpoint is free for the
+ * next one while main context still works on the line.
+ *
+ * Both rings have single producer and single consumer, like uart_tx.c:
+ * main context writes tx_head and reads lines, OTG interrupt writes
+ * tx_tail and rx side. Everything of the stack runs from otg_fs_isr().
+ *
+ * USB needs 48 MHz, which comes from PLLSAI, so it keeps running while
+ * main PLL is switched between clock profiles, see clock_profile.c. PLLSAI
+ * shares PLLM input divider with main PLL, both profiles keep it at 1 MHz.
+ * Until the host opens the port (sets DTR) output is dropped, so shell
+ * does not block on a closed port, dropped bytes are counted in
+ * COUNTER_UART_DROPPED.
+ *
+ * A bulk transfer ends with a packet shorter than 64 bytes, so when the
+ * ring runs empty right after a full packet a zero length packet goes
+ * out, otherwise host keeps the last bytes until more data comes. Line
+ * coding host sets is kept and given back on GET_LINE_CODING, terminal
+ * programs read it after they set it.
+ *
+ * usb_cdc_raw_start() sends the next OUT bytes into a buffer of the
+ * caller instead of the line ring, for binary blocks like input tensors
+ * of EVAL. Host sends a block only when it was asked for, so line and
+ * raw bytes do not mix within a packet.
+ * */
+
+#define USB_CDC_EP_OUT      0x01
+#define USB_CDC_EP_IN       0x82
+#define USB_CDC_EP_NOTIFY   0x83
+
+#define USB_CDC_TX_MASK     (USB_CDC_TX_BUF_LEN - 1)
+#define USB_CDC_RX_MASK     (USB_CDC_RX_BUF_LEN - 1)
+
+// PLLSAI from 1 MHz input, VCO 192 MHz, P output 48 MHz for CK48
+#define USB_PLLSAI_N        192
+#define USB_PLLSAI_P        1       // Divider 4
+#define USB_PLLSAI_Q        4       // Not used, valid dividers only
+#define USB_PLLSAI_R        2
+
+static const struct usb_device_descriptor dev_descriptor = {
+    .bLength = USB_DT_DEVICE_SIZE,
+    .bDescriptorType = USB_DT_DEVICE,
+    .bcdUSB = 0x0200,
+    .bDeviceClass = USB_CLASS_CDC,
+    .bDeviceSubClass = 0,
+    .bDeviceProtocol = 0,
+    .bMaxPacketSize0 = 64,
+    .idVendor = 0x0483,         // ST Virtual COM Port, no driver needed
+    .idProduct = 0x5740,
+    .bcdDevice = 0x0200,
+    .iManufacturer = 1,
+    .iProduct = 2,
+    .iSerialNumber = 3,
+    .bNumConfigurations = 1,
+};
+
+// Notifications are never sent, endpoint only has to exist
+static const struct usb_endpoint_descriptor comm_endpoints[] = {{
+    .bLength = USB_DT_ENDPOINT_SIZE,
+    .bDescriptorType = USB_DT_ENDPOINT,
+    .bEndpointAddress = USB_CDC_EP_NOTIFY,
+    .bmAttributes = USB_ENDPOINT_ATTR_INTERRUPT,
+    .wMaxPacketSize = 16,
+    .bInterval = 255,
+}};
+
+static const struct usb_endpoint_descriptor data_endpoints[] = {{
+    .bLength = USB_DT_ENDPOINT_SIZE,
+    .bDescriptorType = USB_DT_ENDPOINT,
+    .bEndpointAddress = USB_CDC_EP_OUT,
+    .bmAttributes = USB_ENDPOINT_ATTR_BULK,
+    .wMaxPacketSize = USB_CDC_PACKET_LEN,
+    .bInterval = 1,
+}, {
+    .bLength = USB_DT_ENDPOINT_SIZE,
+    .bDescriptorType = USB_DT_ENDPOINT,
+    .bEndpointAddress = USB_CDC_EP_IN,
+    .bmAttributes = USB_ENDPOINT_ATTR_BULK,
+    .wMaxPacketSize = USB_CDC_PACKET_LEN,
+    .bInterval = 1,
+}};
+
+static const struct {
+    struct usb_cdc_header_descriptor header;
+    struct usb_cdc_call_management_descriptor call_mgmt;
+    struct usb_cdc_acm_descriptor acm;
+    struct usb_cdc_union_descriptor cdc_union;
+} __attribute__((packed)) cdc_functional_descriptors = {
+    .header = {
+        .bFunctionLength = sizeof(struct usb_cdc_header_descriptor),
+        .bDescriptorType = CS_INTERFACE,
+        .bDescriptorSubtype = USB_CDC_TYPE_HEADER,
+        .bcdCDC = 0x0110,
+    },
+    .call_mgmt = {
+        .bFunctionLength = sizeof(struct usb_cdc_call_management_descriptor),
+        .bDescriptorType = CS_INTERFACE,
+        .bDescriptorSubtype = USB_CDC_TYPE_CALL_MANAGEMENT,
+        .bmCapabilities = 0,
+        .bDataInterface = 1,
+    },
+    .acm = {
+        .bFunctionLength = sizeof(struct usb_cdc_acm_descriptor),
+        .bDescriptorType = CS_INTERFACE,
+        .bDescriptorSubtype = USB_CDC_TYPE_ACM,
+        .bmCapabilities = 0,
+    },
+    .cdc_union = {
+        .bFunctionLength = sizeof(struct usb_cdc_union_descriptor),
+        .bDescriptorType = CS_INTERFACE,
+        .bDescriptorSubtype = USB_CDC_TYPE_UNION,
+        .bControlInterface = 0,
+        .bSubordinateInterface0 = 1,
+    },
+};
+
+static const struct usb_interface_descriptor comm_interface[] = {{
+    .bLength = USB_DT_INTERFACE_SIZE,
+    .bDescriptorType = USB_DT_INTERFACE,
+    .bInterfaceNumber = 0,
+    .bAlternateSetting = 0,
+    .bNumEndpoints = 1,
+    .bInterfaceClass = USB_CLASS_CDC,
+    .bInterfaceSubClass = USB_CDC_SUBCLASS_ACM,
+    .bInterfaceProtocol = USB_CDC_PROTOCOL_AT,
+    .iInterface = 0,
+    .endpoint = comm_endpoints,
+    .extra = &cdc_functional_descriptors,
+    .extralen = sizeof(cdc_functional_descriptors),
+}};
+
+static const struct usb_interface_descriptor data_interface[] = {{
+    .bLength = USB_DT_INTERFACE_SIZE,
+    .bDescriptorType = USB_DT_INTERFACE,
+    .bInterfaceNumber = 1,
+    .bAlternateSetting = 0,
+    .bNumEndpoints = 2,
+    .bInterfaceClass = USB_CLASS_DATA,
+    .bInterfaceSubClass = 0,
+    .bInterfaceProtocol = 0,
+    .iInterface = 0,
+    .endpoint = data_endpoints,
+}};
+
+static const struct usb_interface interfaces[] = {{
+    .num_altsetting = 1,
+    .altsetting = comm_interface,
+}, {
+    .num_altsetting = 1,
+    .altsetting = data_interface,
+}};
+
+static const struct usb_config_descriptor config_descriptor = {
+    .bLength = USB_DT_CONFIGURATION_SIZE,
+    .bDescriptorType = USB_DT_CONFIGURATION,
+    .wTotalLength = 0,
+    .bNumInterfaces = 2,
+    .bConfigurationValue = 1,
+    .iConfiguration = 0,
+    .bmAttributes = 0x80,
+    .bMaxPower = 0x32,          // 100 mA
+    .interface = interfaces,
+};
+
+static const char * usb_strings[] = {
+    "MicroML",
+    "power_test console",
+    "0001",
+};
+
+typedef struct
+{
+    uint16_t start;
+    uint16_t len;
+}usb_cdc_line_t;
+
+static usbd_device * usbd = NULL;
+static uint8_t usbd_control_buffer[128];
+static volatile bool port_open = false;
+
+static uint8_t tx_buf[USB_CDC_TX_BUF_LEN];
+static volatile uint32_t tx_head = 0;
+static volatile uint32_t tx_tail = 0;
+static volatile bool tx_busy = false;
+static bool tx_zlp = false;             // Last packet was full, IN side
+
+// Only for GET_LINE_CODING, has no meaning over USB
+static struct usb_cdc_line_coding line_coding = {
+    .dwDTERate = 115200,
+    .bCharFormat = USB_CDC_1_STOP_BITS,
+    .bParityType = USB_CDC_NO_PARITY,
+    .bDataBits = 8,
+};
+
+static char rx_buf[USB_CDC_RX_BUF_LEN];
+static uint32_t rx_head = 0;            // Next character from host
+static uint32_t rx_line_start = 0;      // Start of line being received
+static usb_cdc_line_t line_queue[USB_CDC_LINE_QUEUE_LEN];
+static volatile uint8_t line_head = 0;
+static volatile uint8_t line_tail = 0;
+
+// Block of usb_cdc_raw_start(), NULL while lines are received
+static uint8_t * volatile raw_buf = NULL;
+static uint32_t raw_len = 0;
+static volatile uint32_t raw_pos = 0;
+
+static void usb_clock_setup();
+static void tx_start();
+static void set_config(usbd_device * dev, uint16_t value);
+static void data_rx(usbd_device * dev, uint8_t ep);
+static void data_tx(usbd_device * dev, uint8_t ep);
+static enum usbd_request_return_codes control_request(
+    usbd_device * dev,
+    struct usb_setup_data * req,
+    uint8_t ** buf,
+    uint16_t * len,
+    void (**complete)(usbd_device * dev, struct usb_setup_data * req));
+
+/*!
+ * @brief   Starts 48 MHz clock, pins and USB device, host can enumerate
+ *          it from now on
+ *
+ * @note    Call it once, after clock_setup().
+ */
+void usb_cdc_setup()
+{
+    usb_clock_setup();
+
+    rcc_periph_clock_enable(RCC_GPIOA);
+    periph_clock_acquire(RCC_OTGFS);
+    gpio_mode_setup(GPIOA, GPIO_MODE_AF, GPIO_PUPD_NONE, GPIO11 | GPIO12);
+    gpio_set_output_options(GPIOA, GPIO_OTYPE_PP, GPIO_OSPEED_100MHZ,
+                            GPIO11 | GPIO12);
+    gpio_set_af(GPIOA, GPIO_AF10, GPIO11 | GPIO12);
+
+    tx_head = 0;
+    tx_tail = 0;
+    tx_busy = false;
+    tx_zlp = false;
+    rx_head = 0;
+    rx_line_start = 0;
+    line_head = 0;
+    line_tail = 0;
+
+    usbd = usbd_init(&otgfs_usb_driver, &dev_descriptor, &config_descriptor,
+                     usb_strings, 3,
+                     usbd_control_buffer, sizeof(usbd_control_buffer));
+    usbd_register_set_config_callback(usbd, set_config);
+
+    nvic_enable_irq(NVIC_OTG_FS_IRQ);
+}
+
+/*!
+ * @brief   Tells if host has the port open
+ */
+bool usb_cdc_connected()
+{
+    return port_open;
+}
+
+/*!
+ * @brief           Puts bytes into transmit ring, they are sent from
+ *                  interrupt
+ *
+ * @param[in] data
+ * @param[in] len
+ *
+ * @note            Call it from main context only. Waits for space if
+ *                  ring is full, unless port is closed, then bytes are
+ *                  dropped.
+ */
+void usb_cdc_write(const void * data, uint32_t len)
+{
+    const uint8_t * bytes = data;
+
+    for (uint32_t i = 0; i < len; i++)
+    {
+        while ((tx_head - tx_tail) >= USB_CDC_TX_BUF_LEN)
+        {
+            if (!port_open || cm_is_masked_interrupts())
+            {
+                counter_add(COUNTER_UART_DROPPED, len - i);
+                return;
+            }
+        }
+        if (!port_open)
+        {
+            counter_add(COUNTER_UART_DROPPED, len - i);
+            return;
+        }
+        tx_buf[tx_head & USB_CDC_TX_MASK] = bytes[i];
+
+        // Byte has to be in ring before interrupt can see new head
+        __asm__ volatile ("" ::: "memory");
+        tx_head++;
+    }
+
+    if (!tx_busy)
+    {
+        uint32_t masked = irq_lock(IRQ_PRIO_USB);
+        tx_start();
+        irq_unlock(masked);
+    }
+}
+
+/*!
+ * @brief   Returns number of bytes that wait to be sent
+ */
+uint32_t usb_cdc_pending()
+{
+    return tx_head - tx_tail;
+}
+
+/*!
+ * @brief           Takes next received line out of line queue
+ *
+ * @param[out] s    Buffer for the line, it is NUL terminated,
+ *                  '\n' and '\r' are not included
+ * @param[in] len   Size of the buffer
+ *
+ * @return          Length of the line, zero for an empty line,
+ *                  USB_CDC_NO_LINE if no line was received
+ */
+int usb_cdc_read_line(char * s, int len)
+{
+    if (line_head == line_tail)
+    {
+        return USB_CDC_NO_LINE;
+    }
+
+    usb_cdc_line_t line = line_queue[line_tail % USB_CDC_LINE_QUEUE_LEN];
+
+    int n = 0;
+    while (n < line.len && n < len - 1)
+    {
+        s[n] = rx_buf[(line.start + n) & USB_CDC_RX_MASK];
+        n++;
+    }
+    s[n] = '\000';
+
+    // Slot can only be reused after line is copied out
+    __asm__ volatile ("" ::: "memory");
+    line_tail++;
+
+    return n;
+}
+
+/*!
+ * @brief   Tells if there is a received line waiting in line queue
+ */
+bool usb_cdc_line_ready()
+{
+    return line_head != line_tail;
+}
+
+/*!
+ * @brief           Receives the next len bytes into buf, EVENT_CONSOLE_RAW
+ *                  is posted when all of them are there
+ *
+ * @note            Call usb_cdc_raw_stop() afterwards, also before the next
+ *                  block, lines arrive in line queue again then.
+ */
+void usb_cdc_raw_start(void * buf, uint32_t len)
+{
+    uint32_t masked = irq_lock(IRQ_PRIO_USB);
+    raw_len = len;
+    raw_pos = 0;
+    raw_buf = buf;
+    irq_unlock(masked);
+}
+
+/*!
+ * @brief   Returns number of bytes in the block of usb_cdc_raw_start()
+ */
+uint32_t usb_cdc_raw_received()
+{
+    return raw_pos;
+}
+
+/*!
+ * @brief   Ends reception of the block, rest of it is not received
+ */
+void usb_cdc_raw_stop()
+{
+    raw_buf = NULL;
+}
+
+/*!
+ * @brief   Runs USB stack, endpoint callbacks are called from here
+ */
+void otg_fs_isr()
+{
+    usbd_poll(usbd);
+}
+
+/*!
+ * @brief   Starts PLLSAI and selects its P output as 48 MHz clock
+ */
+static void usb_clock_setup()
+{
+    RCC_CR &= ~RCC_CR_PLLSAION;
+    while (RCC_CR & RCC_CR_PLLSAIRDY);
+
+    RCC_PLLSAICFGR = (USB_PLLSAI_N << 6) | (USB_PLLSAI_P << 16) |
+                     (USB_PLLSAI_Q << 24) | (USB_PLLSAI_R << 28);
+    RCC_CR |= RCC_CR_PLLSAION;
+    while (!(RCC_CR & RCC_CR_PLLSAIRDY));
+
+    RCC_DCKCFGR2 |= RCC_DCKCFGR2_CK48MSEL;
+}
+
+/*!
+ * @brief   Moves next part of transmit ring into IN endpoint FIFO
+ *
+ * @note    Called from interrupt or with interrupts masked. Packet never
+ *          wraps around the ring, a wrapped part goes in the next packet.
+ *          Empty ring after a full packet sends a zero length packet.
+ */
+static void tx_start()
+{
+    uint32_t tail = tx_tail;
+    uint32_t len = tx_head - tail;
+
+    if (!port_open)
+    {
+        tx_busy = false;
+        return;
+    }
+    if (len == 0)
+    {
+        // Called when FIFO is free, its transfer complete starts it again
+        tx_busy = tx_zlp;
+        if (tx_zlp)
+        {
+            usbd_ep_write_packet(usbd, USB_CDC_EP_IN, NULL, 0);
+            tx_zlp = false;
+        }
+        return;
+    }
+
+    uint32_t start = tail & USB_CDC_TX_MASK;
+    if (len > USB_CDC_PACKET_LEN)
+    {
+        len = USB_CDC_PACKET_LEN;
+    }
+    if (start + len > USB_CDC_TX_BUF_LEN)
+    {
+        len = USB_CDC_TX_BUF_LEN - start;
+    }
+
+    // Zero means FIFO is still busy, transfer complete starts it again
+    if (usbd_ep_write_packet(usbd, USB_CDC_EP_IN, &tx_buf[start], len))
+    {
+        tx_tail = tail + len;
+        tx_zlp = len == USB_CDC_PACKET_LEN;
+    }
+    tx_busy = true;
+}
+
+/*!
+ * @brief   IN packet was taken by host, sends the next one
+ */
+static void data_tx(usbd_device * dev, uint8_t ep)
+{
+    (void) dev;
+    (void) ep;
+    tx_start();
+}
+
+/*!
+ * @brief   Copies OUT packet into receive ring and queues complete lines
+ *
+ * @note    Lines end with '\n', '\r' before it is dropped, so terminals
+ *          that send "\r\n" work too. New bytes that would overwrite a
+ *          queued line are dropped.
+ */
+static void data_rx(usbd_device * dev, uint8_t ep)
+{
+    char packet[USB_CDC_PACKET_LEN];
+    int len = usbd_ep_read_packet(dev, ep, packet, sizeof(packet));
+    int i = 0;
+
+    if (raw_buf && raw_pos < raw_len)
+    {
+        uint32_t n = raw_len - raw_pos;
+        if (n > (uint32_t) len)
+        {
+            n = len;
+        }
+        memcpy(raw_buf + raw_pos, packet, n);
+        raw_pos += n;
+        if (raw_pos == raw_len)
+        {
+            event_post(EVENT_CONSOLE_RAW);
+        }
+        i = n;
+    }
+
+    for (; i < len; i++)
+    {
+        char c = packet[i];
+        uint32_t oldest = line_head != line_tail ?
+                          line_queue[line_tail % USB_CDC_LINE_QUEUE_LEN].start :
+                          rx_line_start;
+        if (rx_head - oldest >= USB_CDC_RX_BUF_LEN)
+        {
+            counter_add(COUNTER_UART_DROPPED, 1);
+            continue;
+        }
+
+        if (c != '\n')
+        {
+            rx_buf[rx_head & USB_CDC_RX_MASK] = c;
+            rx_head++;
+            continue;
+        }
+
+        uint32_t line_len = rx_head - rx_line_start;
+        if (line_len && rx_buf[(rx_head - 1) & USB_CDC_RX_MASK] == '\r')
+        {
+            line_len--;
+        }
+
+        // Line is dropped if main context does not keep up
+        if ((uint8_t) (line_head - line_tail) < USB_CDC_LINE_QUEUE_LEN)
+        {
+            line_queue[line_head % USB_CDC_LINE_QUEUE_LEN].start = rx_line_start;
+            line_queue[line_head % USB_CDC_LINE_QUEUE_LEN].len = line_len;
+            __asm__ volatile ("" ::: "memory");
+            line_head++;
+            event_post(EVENT_CONSOLE_LINE);
+        }
+        else
+        {
+            counter_add(COUNTER_UART_DROPPED, line_len + 1);
+        }
+        rx_line_start = rx_head;
+    }
+}
+
+/*!
+ * @brief   Host picked configuration, endpoints are created
+ */
+static void set_config(usbd_device * dev, uint16_t value)
+{
+    (void) value;
+
+    usbd_ep_setup(dev, USB_CDC_EP_OUT, USB_ENDPOINT_ATTR_BULK,
+                  USB_CDC_PACKET_LEN, data_rx);
+    usbd_ep_setup(dev, USB_CDC_EP_IN, USB_ENDPOINT_ATTR_BULK,
+                  USB_CDC_PACKET_LEN, data_tx);
+    usbd_ep_setup(dev, USB_CDC_EP_NOTIFY, USB_ENDPOINT_ATTR_INTERRUPT,
+                  16, NULL);
+
+    usbd_register_control_callback(dev,
+                                   USB_REQ_TYPE_CLASS | USB_REQ_TYPE_INTERFACE,
+                                   USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT,
+                                   control_request);
+    port_open = false;
+    tx_busy = false;
+    tx_zlp = false;
+}
+
+/*!
+ * @brief   Handles CDC class requests, DTR of control line state tells
+ *          if host has the port open
+ */
+static enum usbd_request_return_codes control_request(
+    usbd_device * dev,
+    struct usb_setup_data * req,
+    uint8_t ** buf,
+    uint16_t * len,
+    void (**complete)(usbd_device * dev, struct usb_setup_data * req))
+{
+    (void) dev;
+    (void) complete;
+
+    switch (req->bRequest)
+    {
+        case USB_CDC_REQ_SET_CONTROL_LINE_STATE:
+            port_open = (req->wValue & 0x0001) != 0;
+            if (port_open)
+            {
+                tx_start();
+            }
+            else
+            {
+                // Whatever was not sent belongs to the closed session
+                tx_tail = tx_head;
+                tx_busy = false;
+                tx_zlp = false;
+            }
+            return USBD_REQ_HANDLED;
+
+        case USB_CDC_REQ_SET_LINE_CODING:
+            // Baud rate has no meaning over USB, it is only kept
+            if (*len < sizeof(struct usb_cdc_line_coding))
+            {
+                return USBD_REQ_NOTSUPP;
+            }
+            memcpy(&line_coding, *buf, sizeof(line_coding));
+            return USBD_REQ_HANDLED;
+
+        case USB_CDC_REQ_GET_LINE_CODING:
+            *buf = (uint8_t *) &line_coding;
+            if (*len > sizeof(line_coding))
+            {
+                *len = sizeof(line_coding);
+            }
+            return USBD_REQ_HANDLED;
+    }
+    return USBD_REQ_NOTSUPP;
+}
+/*** end of file ***/
@@ -0,0 +1,35 @@
+#ifndef USB_CDC_H
+#define USB_CDC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// USB OTG FS CDC-ACM link on the user USB connector, PA11 and PA12, used
+// as console with USB_CONSOLE in uart_ctrl.h
+#define USB_CDC_PACKET_LEN      64      // Bulk packet of full speed
+#define USB_CDC_TX_BUF_LEN      4096    // Power of two, one frame and more
+#define USB_CDC_RX_BUF_LEN      256     // Power of two
+#define USB_CDC_LINE_QUEUE_LEN  8
+#define USB_CDC_NO_LINE         (-1)    // Of usb_cdc_read_line()
+
+void usb_cdc_setup();
+bool usb_cdc_connected();
+void usb_cdc_write(const void * data, uint32_t len);
+uint32_t usb_cdc_pending();
+int usb_cdc_read_line(char * s, int len);
+bool usb_cdc_line_ready();
+void usb_cdc_raw_start(void * buf, uint32_t len);
+uint32_t usb_cdc_raw_received();
+void usb_cdc_raw_stop();
+void otg_fs_isr();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* USB_CDC_H */
+/*** end of file ***/
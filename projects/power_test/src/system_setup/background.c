@@ -0,0 +1,250 @@
+#include <stddef.h>
+#include <libopencm3/cm3/scb.h>
+#include <libopencm3/cm3/cortex.h>
+#include "background.h"
+#include "events.h"
+#include "soft_timer.h"
+#include "printf.h"
+
+#ifdef BACKGROUND_INVOKE
+
+/* Explanation: an exception handler can only be preempted by a more
+ * urgent exception, never by thread mode, so Invoke() inside PendSV
+ * would stop main context for as long as it runs. Job runs in thread
+ * mode instead, on its own stack with PSP, and PendSV, the least urgent
+ * exception, switches between it and main context, which stays on MSP.
+ * Main context always wins:
+ * - event_wait() of main context calls background_yield() instead of
+ *   sleeping, job then runs until an event of the mask is posted or the
+ *   sleep is over, event_post() and a soft timer switch back.
+ * - Job is never chosen while main context has something to do, it only
+ *   borrows the time main context would have slept.
+ * Interrupts preempt both, as before. Job itself still waits in
+ * event_wait() and sleeps there, for example for DMA2D.
+ *
+ * PendSV saves r3 to r11 and EXC_RETURN on the stack it came from, r3
+ * only keeps 8 byte alignment, and s16 to s31 when the context used FPU,
+ * the rest is in the hardware frame. MSP of main context then points at
+ * its saved registers while job runs, interrupts stack below them.
+ * Switch is decided in background_switch(), which returns stack of the
+ * context to resume, the same one if nothing changes.
+ *
+ * Sections of cm_mask_interrupts() and irq_lock() mask PendSV, a context
+ * is never switched inside one. Job that returns ends in
+ * background_exit(), which posts EVENT_BACKGROUND and waits for PendSV.
+ * Stack is filled with BACKGROUND_STACK_FILL at start, so STATS can tell
+ * how much of it the deepest job took, there is no MPU guard below it.
+ * */
+
+#define BACKGROUND_EXC_RETURN   0xFFFFFFFDU // Thread mode, PSP, no FPU
+#define BACKGROUND_XPSR         0x01000000U // Thumb bit
+
+static uint32_t stack[BACKGROUND_STACK_SIZE / 4] __attribute__((aligned(8)));
+
+static volatile bool alive = false;         // Job started, not returned
+static volatile bool wanted = false;        // Main context yields to it
+static volatile bool in_background = false;
+static volatile uint32_t wake_mask = 0;
+static uint32_t main_sp;
+static uint32_t job_sp;
+static soft_timer_t yield_timer;
+
+uint32_t background_switch(uint32_t sp) __attribute__((used));
+
+static inline void pend_switch()
+{
+    SCB_ICSR = SCB_ICSR_PENDSVSET;
+}
+
+/*!
+ * @brief   Return address of the job, it is switched away from for good
+ */
+static void background_exit()
+{
+    alive = false;
+    event_post(EVENT_BACKGROUND);
+    pend_switch();
+    while (1);
+}
+
+static void yield_expired(soft_timer_t * timer)
+{
+    (void) timer;
+    wanted = false;
+    pend_switch();
+}
+
+/*!
+ * @brief               Prepares job, it runs the next time main context
+ *                      waits
+ *
+ * @return              False if the previous job did not return yet
+ *
+ * @note                Call from main context only. EVENT_BACKGROUND is
+ *                      posted when job returns.
+ */
+bool background_start(background_job_t job, void * arg)
+{
+    if (alive)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < BACKGROUND_STACK_SIZE / 4; i++)
+    {
+        stack[i] = BACKGROUND_STACK_FILL;
+    }
+
+    // Hardware frame r0-r3, r12, lr, pc, xPSR, below it what PendSV saves
+    uint32_t * sp = &stack[BACKGROUND_STACK_SIZE / 4 - 8];
+    sp[0] = (uint32_t) arg;
+    sp[5] = (uint32_t) background_exit;
+    sp[6] = (uint32_t) job & ~1U;
+    sp[7] = BACKGROUND_XPSR;
+    sp -= 10;
+    sp[9] = BACKGROUND_EXC_RETURN;
+    job_sp = (uint32_t) sp;
+
+    yield_timer.callback = yield_expired;
+    event_take(EVENT_BACKGROUND);
+    alive = true;
+    return true;
+}
+
+/*!
+ * @brief   Tells if job was started and did not return yet
+ */
+bool background_busy()
+{
+    return alive;
+}
+
+/*!
+ * @brief   Tells if caller runs in the job, not in main context
+ */
+bool background_active()
+{
+    return in_background;
+}
+
+/*!
+ * @brief               Lets job run instead of sleeping
+ *
+ * @param[in] mask      EVENT_* flags that end it
+ * @param[in] max_us    Longest time until main context runs again
+ *
+ * @return              False if there is no job or caller is the job,
+ *                      sleep then
+ *
+ * @note                Call with interrupts masked, from event_wait().
+ *                      Switch happens when caller unmasks them.
+ */
+bool background_yield(uint32_t mask, uint32_t max_us)
+{
+    if (!alive || in_background)
+    {
+        return false;
+    }
+    wake_mask = mask;
+    wanted = true;
+    soft_timer_start(&yield_timer, max_us);
+    pend_switch();
+    return true;
+}
+
+/*!
+ * @brief               Switches back to main context if it waits for
+ *                      one of events
+ *
+ * @note                Called by event_post() with interrupts masked.
+ */
+void background_wake(uint32_t events)
+{
+    if (wanted && (events & wake_mask))
+    {
+        wanted = false;
+        pend_switch();
+    }
+}
+
+/*!
+ * @brief               Chooses context that PendSV resumes
+ *
+ * @param[in] sp        Stack of the one that was interrupted, with its
+ *                      registers saved
+ *
+ * @return              Stack to restore registers from
+ */
+uint32_t background_switch(uint32_t sp)
+{
+    bool run_job = wanted && alive;
+    if (run_job == in_background)
+    {
+        return sp;
+    }
+
+    if (run_job)
+    {
+        main_sp = sp;
+        in_background = true;
+        return job_sp;
+    }
+    job_sp = sp;
+    in_background = false;
+    soft_timer_stop(&yield_timer);
+    return main_sp;
+}
+
+/*!
+ * @brief   Saves context that runs, restores the one chosen by
+ *          background_switch()
+ *
+ * @note    Function name is important, it is defined in
+ *          libopencm3/include/libopencm3/cm3/vector.h . Priority is the
+ *          lowest one, look at irq_prio.c.
+ */
+__attribute__((naked)) void pend_sv_handler(void)
+{
+    __asm__ volatile (
+        "tst     lr, #4\n"
+        "ite     eq\n"
+        "mrseq   r0, msp\n"
+        "mrsne   r0, psp\n"
+        "tst     lr, #0x10\n"
+        "it      eq\n"
+        "vstmdbeq r0!, {s16-s31}\n"
+        "stmdb   r0!, {r3-r11, lr}\n"
+        "tst     lr, #4\n"
+        "ite     eq\n"
+        "msreq   msp, r0\n"
+        "msrne   psp, r0\n"
+        "bl      background_switch\n"
+        "ldmia   r0!, {r3-r11, lr}\n"
+        "tst     lr, #0x10\n"
+        "it      eq\n"
+        "vldmiaeq r0!, {s16-s31}\n"
+        "tst     lr, #4\n"
+        "ite     eq\n"
+        "msreq   msp, r0\n"
+        "msrne   psp, r0\n"
+        "bx      lr\n"
+    );
+}
+
+/*!
+ * @brief   Prints deepest use of job stack, part of STATS
+ */
+void background_report()
+{
+    uint32_t unused = 0;
+    while (unused < BACKGROUND_STACK_SIZE / 4 &&
+           stack[unused] == BACKGROUND_STACK_FILL)
+    {
+        unused++;
+    }
+    printf("Background: %s, stack %lu of %u bytes used\n",
+           alive ? "running" : "idle",
+           BACKGROUND_STACK_SIZE - unused * 4, BACKGROUND_STACK_SIZE);
+}
+#endif
+/*** end of file ***/
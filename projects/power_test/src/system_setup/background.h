@@ -0,0 +1,35 @@
+#ifndef BACKGROUND_H
+#define BACKGROUND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// One job that runs on its own stack whenever main context is idle, look
+// at background.c. Define to run Invoke() of the classifier as that job,
+// instead of STEPPED_INVOKE of inference.h, main context then serves
+// capture and deferred logs while it runs.
+//#define BACKGROUND_INVOKE
+
+#define BACKGROUND_STACK_SIZE   (8 * 1024)  // Bytes, Invoke() of TFLM
+#define BACKGROUND_STACK_FILL   0xA5A5A5A5U // Unused stack, for the report
+
+typedef void (*background_job_t)(void * arg);
+
+bool background_start(background_job_t job, void * arg);
+bool background_busy();
+bool background_active();
+bool background_yield(uint32_t mask, uint32_t max_us);
+void background_wake(uint32_t events);
+void background_report();
+void pend_sv_handler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BACKGROUND_H */
+/*** end of file ***/
@@ -0,0 +1,326 @@
+#include <string.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/pwr.h>
+#include <libopencm3/stm32/flash.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/spi.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/systick.h>
+#include "clock_profile.h"
+#include "sys_init.h"
+#include "uart_tx.h"
+#include "utility.h"
+#include "trace.h"
+#include "sensors.h"
+#include "soft_timer.h"
+#include "pc_sample.h"
+#include "sdram.h"
+
+/* Explanation: core runs from PLL fed by HSI, or HSE with CLOCK_HSE, 
+ * profiles only differ in PLL output, bus prescalers, flash wait states, 
+ * voltage scale and over-drive. Both inputs are divided to 1 MHz VCO
+ * input, so PLL multipliers of profiles are the same for both.
+ * 216 MHz needs voltage scale 1 and over-drive, 48 MHz runs on scale 3
+ * without it, which lowers both dynamic and leakage current.
+ *
+ * Switch goes through HSI: PLL can not be reconfigured while it drives
+ * SYSCLK and over-drive can only be turned off while it does not. For the
+ * time of the switch interrupts are masked and core runs at 16 MHz, this
+ * takes around 200 us, mostly waiting for PLL lock.
+ *
+ * Peripherals that depend on bus clocks are updated after the switch:
+ * - USART2 and USART3 baud rates are recalculated from new APB1 clock,
+ *   character that is being received at that moment can be lost,
+ * - SysTick reload, if it is used as ms timer,
+ * - TIM6 prescaler of background sensor sampling, look at sensors.c,
+ * - TIM5 prescaler of software timers, look at soft_timer.c,
+ * - refresh counter of SDRAM with EXT_SDRAM, look at sdram.c,
+ * - SPI1 prescaler is chosen again, as the smallest one that keeps SCK 
+ *   under SPI1_MAX_HZ of the Lepton, that is 13.5 MHz in RUN (APB2 at
+ *   108 MHz, divider 8) and 12 MHz in IDLE (APB2 at 48 MHz, divider 4).
+ *   It is applied by spi_dma_read16() before the next packet, as switch
+ *   can happen while FLIR DMA is running.
+ * I2C1 kernel clock is selected by I2C1SEL of RCC_DCKCFGR2, i2c_setup()
+ * sets it to HSI, CLOCK_I2C1_MHZ in every profile instead of APB1. So it
+ * is not affected, TIMINGR of i2c_timing.c is computed once for it.
+ *
+ * Wake up from STOP leaves core on HSI, clock_profile_resume() switches
+ * back to the profile that was used before and updates the same
+ * peripherals.
+ *
+ * Time is rescaled on every switch, see time_rescale() in utility.c. Cycle
+ * counts, for example from CycleProfiler, stay in core cycles, convert them
+ * with the clock that was used while they were counted.
+ * */
+
+static struct rcc_clock_scale profiles[CLOCK_PROFILE_END];
+static clock_profile_t current_profile = CLOCK_PROFILE_RUN;
+static uint8_t spi1_prescaler = 2;      // SPI_CR1 BR value, divider 8
+static clock_policy_t current_policy = CLOCK_POLICY_RACE;
+// Fastest profile that may be set, thermal_gov.c lowers it
+static clock_profile_t profile_limit = CLOCK_PROFILE_RUN;
+
+static const char * policy_names[CLOCK_POLICY_END] =
+{
+    [CLOCK_POLICY_RACE] = "RACE",
+    [CLOCK_POLICY_DVFS] = "DVFS",
+    [CLOCK_POLICY_SLOW] = "SLOW",
+};
+
+/*!
+ * @brief   Configures PLL and power for the profile
+ *
+ * @note    Call with interrupts masked.
+ */
+static void clock_switch(clock_profile_t profile)
+{
+    const struct rcc_clock_scale * scale = &profiles[profile];
+
+    rcc_osc_on(RCC_HSI);
+    rcc_wait_for_osc_ready(RCC_HSI);
+    rcc_set_sysclk_source(RCC_CFGR_SW_HSI);
+    rcc_wait_for_sysclk_status(RCC_HSI);
+    rcc_osc_off(RCC_PLL);
+
+    if (!scale->overdrive)
+    {
+        pwr_disable_overdrive();
+    }
+
+    // Goes through HSI again, sets voltage scale, over-drive if needed,
+    // wait states and bus prescalers, and updates rcc_*_frequency
+#ifdef CLOCK_HSE
+    rcc_osc_bypass_enable(RCC_HSE);
+    rcc_clock_setup_hse(scale, CLOCK_HSE_MHZ);
+#else
+    rcc_clock_setup_hsi(scale);
+#endif
+
+    current_profile = profile;
+
+    // BR value n divides APB2 clock by 2^(n + 1)
+    spi1_prescaler = 0;
+    while (spi1_prescaler < 7 && 
+           rcc_apb2_frequency / (2U << spi1_prescaler) > SPI1_MAX_HZ)
+    {
+        spi1_prescaler++;
+    }
+}
+
+/*!
+ * @brief   Updates peripherals that depend on bus clocks, after the switch
+ *
+ * @note    Call with interrupts masked, USARTs have to be idle.
+ */
+static void peripherals_update()
+{
+    // BRR can only be written while USART is disabled
+    usart_disable(USART3);
+    usart_set_baudrate(USART3, UART_TX_BAUDRATE);
+    usart_enable(USART3);
+
+    usart_disable(USART2);
+    usart_set_baudrate(USART2, CONSOLE_BAUDRATE);
+    usart_enable(USART2);
+
+#ifdef SYSTICK_TIMER
+    systick_set_reload(rcc_ahb_frequency / 1000 - 1);
+#endif
+    sensors_clock_changed();
+    soft_timer_clock_changed();
+    pc_sample_clock_changed();
+    sdram_clock_changed();
+    trace_clock_changed(rcc_ahb_frequency / 1000000);
+}
+
+/*!
+ * @brief   Prepares profiles and sets RUN profile
+ *
+ * @note    Called from clock_setup(), before any peripheral is set up.
+ */
+void clock_profile_init()
+{
+    profiles[CLOCK_PROFILE_RUN] = rcc_3v3[RCC_CLOCK_3V3_216MHZ];
+
+    // Same PLL input divider as 216 MHz, VCO runs at 192 MHz
+    struct rcc_clock_scale * idle = &profiles[CLOCK_PROFILE_IDLE];
+    *idle = rcc_3v3[RCC_CLOCK_3V3_216MHZ];
+    idle->plln = 192;
+    idle->pllp = 4;
+    idle->pllq = 4;
+    idle->hpre = RCC_CFGR_HPRE_DIV_NONE;
+    idle->ppre1 = RCC_CFGR_PPRE_DIV_NONE;
+    idle->ppre2 = RCC_CFGR_PPRE_DIV_NONE;
+    idle->vos_scale = PWR_SCALE3;
+    idle->overdrive = 0;
+    idle->flash_waitstates = FLASH_ACR_LATENCY_1WS;
+    idle->ahb_frequency = 48000000;
+    idle->apb1_frequency = 48000000;
+    idle->apb2_frequency = 48000000;
+
+    // DWT already counts, time until now is counted with HSI
+    time_rescale(profiles[CLOCK_PROFILE_RUN].ahb_frequency / 1000000);
+    clock_switch(CLOCK_PROFILE_RUN);
+}
+
+/*!
+ * @brief               Switches core and bus clocks to the profile
+ *
+ * @param[in] profile
+ *
+ * @note                Blocks until character that USART3 is sending is
+ *                      out, rest of the log buffer is sent afterwards at
+ *                      the same baud rate.
+ */
+void clock_profile_set(clock_profile_t profile)
+{
+    if (profile > profile_limit)
+    {
+        profile = profile_limit;
+    }
+    if (profile >= CLOCK_PROFILE_END || profile == current_profile)
+    {
+        return;
+    }
+
+    bool masked = cm_mask_interrupts(true);
+
+    // Interrupts are masked, so TX interrupt can not load next character
+    while (!usart_get_flag(USART3, USART_ISR_TC));
+    while (!usart_get_flag(USART2, USART_ISR_TC));
+
+    // Time until now is counted with the old clock
+    time_rescale(profiles[profile].ahb_frequency / 1000000);
+    clock_switch(profile);
+    peripherals_update();
+
+    cm_mask_interrupts(masked);
+}
+
+/*!
+ * @brief   Restores PLL of the current profile after wake up from STOP,
+ *          core then runs from HSI at 16 MHz, look at stop_mode.c
+ *
+ * @note    Call with interrupts masked, before anything else runs. Time 
+ *          is not rescaled, the few HSI cycles since wake up are counted
+ *          as profile cycles.
+ */
+void clock_profile_resume()
+{
+    clock_switch(current_profile);
+    peripherals_update();
+}
+
+/*!
+ * @brief               Sets the fastest profile that may be used, policy
+ *                      keeps choosing profiles below it
+ *
+ * @param[in] limit     CLOCK_PROFILE_RUN for no limit
+ *
+ * @note                Switches right away if the current profile is
+ *                      faster, or back to the profile of the policy.
+ */
+void clock_profile_limit(clock_profile_t limit)
+{
+    if (limit >= CLOCK_PROFILE_END)
+    {
+        return;
+    }
+
+    profile_limit = limit;
+    clock_policy_set(current_policy);
+}
+
+/*!
+ * @brief   Returns SPI1 baud rate prescaler for the current APB2 clock, 
+ *          as value for spi_set_baudrate_prescaler()
+ */
+uint8_t clock_spi1_prescaler()
+{
+    return spi1_prescaler;
+}
+
+/*!
+ * @brief   Returns profile that is currently used
+ */
+clock_profile_t clock_profile_get()
+{
+    return current_profile;
+}
+
+/*!
+ * @brief               Sets when profiles are used and switches to the
+ *                      profile for time outside of Invoke()
+ *
+ * @param[in] policy
+ */
+void clock_policy_set(clock_policy_t policy)
+{
+    if (policy >= CLOCK_POLICY_END)
+    {
+        return;
+    }
+
+    current_policy = policy;
+    clock_profile_set(policy == CLOCK_POLICY_RACE ? CLOCK_PROFILE_RUN :
+                                                    CLOCK_PROFILE_IDLE);
+}
+
+/*!
+ * @brief               Sets policy by its name, for example "DVFS"
+ *
+ * @param[in] name
+ *
+ * @return              False if there is no policy with such name
+ */
+bool clock_policy_set_name(const char * name)
+{
+    for (uint8_t i = 0; i < CLOCK_POLICY_END; i++)
+    {
+        if (0 == strcmp(policy_names[i], name))
+        {
+            clock_policy_set((clock_policy_t) i);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief   Returns the current policy
+ */
+clock_policy_t clock_policy_get()
+{
+    return current_policy;
+}
+
+/*!
+ * @brief   Returns name of the current policy
+ */
+const char * clock_policy_name()
+{
+    return policy_names[current_policy];
+}
+
+/*!
+ * @brief   Call before compute heavy part, like Invoke()
+ */
+void clock_boost_begin()
+{
+    if (current_policy == CLOCK_POLICY_DVFS)
+    {
+        clock_profile_set(CLOCK_PROFILE_RUN);
+    }
+}
+
+/*!
+ * @brief   Call after compute heavy part, returns to IDLE profile
+ */
+void clock_boost_end()
+{
+    if (current_policy == CLOCK_POLICY_DVFS)
+    {
+        clock_profile_set(CLOCK_PROFILE_IDLE);
+    }
+}
+/*** end of file ***/
@@ -0,0 +1,58 @@
+#ifndef CLOCK_PROFILE_H
+#define CLOCK_PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Define to feed PLL from HSE instead of HSI. On Nucleo-144 HSE is 8 MHz
+// MCO output of ST-LINK, so oscillator is bypassed, crystal is not fitted.
+// Frequency is more accurate, but ST-LINK has to be powered.
+//#define CLOCK_HSE
+#define CLOCK_HSE_MHZ       8
+
+// Kernel clock of I2C1, it does not follow profiles
+#define CLOCK_I2C1_MHZ      16
+
+typedef enum
+{
+    CLOCK_PROFILE_IDLE,     // 48 MHz, voltage scale 3, no over-drive
+    CLOCK_PROFILE_RUN,      // 216 MHz, voltage scale 1 with over-drive
+    CLOCK_PROFILE_END,
+} clock_profile_t;
+
+// When each profile is used, so that race-to-idle and slow-and-steady
+// can be compared on the board without reflashing
+typedef enum
+{
+    CLOCK_POLICY_RACE,      // Always RUN, core sleeps between frames
+    CLOCK_POLICY_DVFS,      // IDLE between frames, RUN around Invoke()
+    CLOCK_POLICY_SLOW,      // Always IDLE
+    CLOCK_POLICY_END,
+} clock_policy_t;
+
+void clock_profile_init();
+void clock_profile_set(clock_profile_t profile);
+void clock_profile_resume();
+clock_profile_t clock_profile_get();
+void clock_profile_limit(clock_profile_t limit);
+
+bool clock_policy_set_name(const char * name);
+void clock_policy_set(clock_policy_t policy);
+clock_policy_t clock_policy_get();
+const char * clock_policy_name();
+
+void clock_boost_begin();
+void clock_boost_end();
+
+uint8_t clock_spi1_prescaler();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CLOCK_PROFILE_H */
+/*** end of file ***/
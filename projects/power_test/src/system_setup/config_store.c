@@ -0,0 +1,227 @@
+#include <string.h>
+#include "config_store.h"
+#include "flash_store.h"
+#include "printf.h"
+
+/* Explanation: settings are a log of 8 byte records at
+ * CONFIG_STORE_ADDRESS, every write appends a record and the last record of
+ * a key wins. Sector is erased only when it is full, after 32768 writes,
+ * and the values are written back in first records, so wear is spread
+ * over the whole sector instead of erasing it on every change.
+ *
+ * config_store_load() reads the log once, straight through its AXIM
+ * address, and keeps values in RAM, that is at most 256 KB of sequential
+ * reads and usually a few records. Log ends at the first record that is
+ * still erased.
+ *
+ * Value word of a record is programmed first and key word with check
+ * last, so a record that was cut by reset has no valid check and is
+ * skipped. Writing the same value again does not append anything.
+ *
+ * Programming a record stalls the core for around 30 us, erase for one to
+ * two seconds, see flash_store.c, capture then has to resynchronise. Reset
+ * during the erase loses all settings, they go back to firmware defaults.
+ * */
+
+#define CONFIG_RECORD_FREE      0xFFFFFFFFU
+#define CONFIG_RECORDS          (CONFIG_STORE_SIZE / sizeof(config_record_t))
+
+typedef struct
+{
+    uint32_t value;
+    uint16_t key;
+    uint16_t check;
+}config_record_t;
+
+static const char * key_names[CONFIG_KEY_END] =
+{
+    [CONFIG_CLOCK_POLICY] = "clock",
+    [CONFIG_MODEL] = "model",
+    [CONFIG_MOTION_THRESHOLD] = "motion_threshold",
+    [CONFIG_MOTION_BLOCKS] = "motion_blocks",
+    [CONFIG_FFC_PERIOD] = "ffc_period",
+    [CONFIG_CONV_KERNELS] = "conv_kernels",
+    [CONFIG_CONV_KERNELS_MODEL] = "conv_kernels_model",
+    [CONFIG_ETH_IP] = "eth_ip",
+    [CONFIG_ETH_COLLECTOR] = "eth_collector",
+    [CONFIG_RATE_POLICY] = "rate",
+};
+
+static uint32_t values[CONFIG_KEY_END];
+static uint32_t present = 0;            // Bit of each key that was loaded
+static uint32_t next_record = 0;
+
+static uint16_t record_check(uint16_t key, uint32_t value);
+static bool record_append(config_key_e key, uint32_t value);
+static bool compact();
+
+/*!
+ * @brief   Reads settings from flash, call it once at boot before modules
+ *          ask for them
+ */
+void config_store_load()
+{
+    const config_record_t * records =
+        (const config_record_t *) CONFIG_STORE_ADDRESS;
+    uint32_t i = 0;
+
+    present = 0;
+    for (; i < CONFIG_RECORDS; i++)
+    {
+        const config_record_t * record = &records[i];
+        if (record->value == CONFIG_RECORD_FREE &&
+            record->key == 0xFFFF && record->check == 0xFFFF)
+        {
+            break;
+        }
+        if (record->key < CONFIG_KEY_END &&
+            record->check == record_check(record->key, record->value))
+        {
+            values[record->key] = record->value;
+            present |= 1U << record->key;
+        }
+    }
+    next_record = i;
+
+    for (uint32_t key = 0; key < CONFIG_KEY_END; key++)
+    {
+        if (present & (1U << key))
+        {
+            printf("Config %s = %lu\n", key_names[key], values[key]);
+        }
+    }
+}
+
+/*!
+ * @brief               Returns setting if it was ever written
+ *
+ * @param[in] key
+ * @param[out] value    Not touched if there is no setting
+ *
+ * @return              False if firmware default should be used
+ */
+bool config_store_get(config_key_e key, uint32_t * value)
+{
+    if (key >= CONFIG_KEY_END || !(present & (1U << key)))
+    {
+        return false;
+    }
+    *value = values[key];
+    return true;
+}
+
+/*!
+ * @brief               Returns setting or fallback if it was never written
+ */
+uint32_t config_store_value(config_key_e key, uint32_t fallback)
+{
+    uint32_t value = fallback;
+    config_store_get(key, &value);
+    return value;
+}
+
+/*!
+ * @brief               Writes setting, it is used from the next boot on
+ *
+ * @param[in] key
+ * @param[in] value
+ *
+ * @return              False if flash reported an error
+ *
+ * @note                Modules do not see the new value until the next
+ *                      boot, commands that apply it right away, like
+ *                      CLOCK, do that themselves.
+ */
+bool config_store_set(config_key_e key, uint32_t value)
+{
+    if (key >= CONFIG_KEY_END)
+    {
+        return false;
+    }
+    if ((present & (1U << key)) && values[key] == value)
+    {
+        return true;
+    }
+
+    values[key] = value;
+    present |= 1U << key;
+    if (next_record >= CONFIG_RECORDS)
+    {
+        return compact();
+    }
+    return record_append(key, value);
+}
+
+/*!
+ * @brief               Writes setting by its name, for example
+ *                      "motion_threshold"
+ *
+ * @return              False if there is no such setting
+ */
+bool config_store_set_name(const char * name, uint32_t value)
+{
+    for (uint32_t key = 0; key < CONFIG_KEY_END; key++)
+    {
+        if (0 == strcmp(key_names[key], name))
+        {
+            return config_store_set((config_key_e) key, value);
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief               Returns name of the setting, as SET command takes it
+ */
+const char * config_store_key_name(config_key_e key)
+{
+    return key < CONFIG_KEY_END ? key_names[key] : "";
+}
+
+/*!
+ * @brief   Check word of a record, key and value halves are mixed with a
+ *          constant and inverted, so erased and zeroed records do not pass
+ */
+static uint16_t record_check(uint16_t key, uint32_t value)
+{
+    return (uint16_t) ~(key ^ (uint16_t) value ^ (uint16_t) (value >> 16) ^
+                        0x5A5A);
+}
+
+/*!
+ * @brief   Programs the next free record, value word before the key word
+ */
+static bool record_append(config_key_e key, uint32_t value)
+{
+    config_record_t record = {value, (uint16_t) key,
+                              record_check((uint16_t) key, value)};
+    uint32_t address = CONFIG_STORE_ADDRESS +
+                       next_record * sizeof(config_record_t);
+    next_record++;
+
+    return flash_program(address, &record.value, 4) &&
+           flash_program(address + 4, &record.key, 4);
+}
+
+/*!
+ * @brief   Erases full sector and writes one record of every setting
+ */
+static bool compact()
+{
+    if (!flash_erase(CONFIG_STORE_ADDRESS, CONFIG_STORE_SIZE))
+    {
+        return false;
+    }
+
+    next_record = 0;
+    for (uint32_t key = 0; key < CONFIG_KEY_END; key++)
+    {
+        if ((present & (1U << key)) &&
+            !record_append((config_key_e) key, values[key]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+/*** end of file ***/
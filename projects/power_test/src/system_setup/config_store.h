@@ -0,0 +1,46 @@
+#ifndef CONFIG_STORE_H
+#define CONFIG_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 256 KB before the area of flash_store.h, firmware must not reach it,
+// see memory_sections.ld
+#define CONFIG_STORE_ADDRESS    0x08180000U
+#define CONFIG_STORE_SIZE       (256 * 1024)
+
+// Settings that survive reset, set with SET, MODEL and CLOCK commands of
+// the shell. Modules read them during their setup, a setting that was
+// never written keeps the default of the firmware.
+typedef enum
+{
+    CONFIG_CLOCK_POLICY,        // clock_policy_t
+    CONFIG_MODEL,               // CRC-32 of the model, see inference_model_id()
+    CONFIG_MOTION_THRESHOLD,    // block_threshold of motion_config_t
+    CONFIG_MOTION_BLOCKS,       // min_blocks of motion_config_t
+    CONFIG_FFC_PERIOD,          // Automatic FFC of Lepton, in ms
+    CONFIG_CONV_KERNELS,        // ConvTuning::Packed() of TUNE command
+    CONFIG_CONV_KERNELS_MODEL,  // Model CONFIG_CONV_KERNELS was tuned for
+    CONFIG_ETH_IP,              // IPv4 address of ETH_UDP, see eth_udp.h
+    CONFIG_ETH_COLLECTOR,       // Where its datagrams go
+    CONFIG_RATE_POLICY,         // rate_policy_t of rate_gov.h
+    CONFIG_KEY_END,
+}config_key_e;
+
+void config_store_load();
+bool config_store_get(config_key_e key, uint32_t * value);
+uint32_t config_store_value(config_key_e key, uint32_t fallback);
+bool config_store_set(config_key_e key, uint32_t value);
+bool config_store_set_name(const char * name, uint32_t value);
+const char * config_store_key_name(config_key_e key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONFIG_STORE_H */
+/*** end of file ***/
@@ -0,0 +1,77 @@
+#include "counters.h"
+#include "printf.h"
+
+/* Explanation: every counter is one word, updated where the thing
+ * happens, which is often an interrupt. Updates are relaxed atomics, so
+ * counters never mask interrupts and cost a few cycles, but they are not
+ * ordered against each other. A print taken while capture runs can show
+ * a frame counted and its resync not yet, which is fine for field
+ * diagnostics. Counters wrap, invoke window is restarted by each print.
+ * */
+volatile uint32_t counters[COUNTERS];
+
+static const char * const counter_names[COUNTERS] = {
+    "frames",
+    "resyncs",
+    "id_errors",
+    "discards",
+    "invokes",
+    "window_invokes",
+    "invoke_kcycles",
+    "invoke_max_cycles",
+    "uart_dropped",
+    "arena_used",
+    "sensor_samples",
+    "sensor_errors",
+    "sensor_overruns",
+    "stop_wakeups",
+    "flir_boots",
+    "flir_boot_max_ms",
+    "warm_starts",
+    "cold_starts",
+    "early_exits",
+    "remote_errors",
+    "budget_overruns",
+    "cci_commands",
+    "cci_cached",
+    "thermal_steps",
+    "thermal_hold_ms",
+    "eth_datagrams",
+    "eth_dropped",
+    "eth_errors",
+    "rate_steps",
+    "rate_hold_ms",
+    "rate_standbys",
+};
+
+/*!
+ * @brief   Prints all counters, then average and the longest Invoke()
+ *          since the last print
+ *
+ * @note    Call it from main context only, invoke window is taken out
+ *          of the counters and starts again.
+ */
+void counters_print()
+{
+    uint32_t invokes = counter_take(COUNTER_WINDOW_INVOKES);
+    uint32_t kcycles = counter_take(COUNTER_INVOKE_KCYCLES);
+    uint32_t max_cycles = counter_take(COUNTER_INVOKE_MAX_CYCLES);
+
+    for (uint32_t id = 0; id < COUNTERS; id++)
+    {
+        uint32_t value;
+        switch (id)
+        {
+            case COUNTER_WINDOW_INVOKES:    value = invokes;    break;
+            case COUNTER_INVOKE_KCYCLES:    value = kcycles;    break;
+            case COUNTER_INVOKE_MAX_CYCLES: value = max_cycles; break;
+            default:                        value = counters[id]; break;
+        }
+        printf("%-18s %lu\n", counter_names[id], value);
+    }
+
+    uint64_t average = invokes ? (uint64_t) kcycles * 1000 / invokes : 0;
+    printf("Invoke: %lu cycles average, %lu max over %lu calls\n",
+           (uint32_t) average, max_cycles, invokes);
+}
+/*** end of file ***/
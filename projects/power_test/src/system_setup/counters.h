@@ -0,0 +1,104 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Runtime counters that STATS shell command prints, look at counters.c.
+// Names are in counter_names[], keep both lists in the same order.
+typedef enum
+{
+    COUNTER_FRAMES,             // FLIR frames captured
+    COUNTER_RESYNCS,            // Soft and hard FLIR resynchronisations
+    COUNTER_ID_ERRORS,          // VoSPI packets with unexpected number
+    COUNTER_DISCARDS,           // VoSPI discard packets
+    COUNTER_INVOKES,            // Invoke() calls since boot
+    COUNTER_WINDOW_INVOKES,     // Invoke() calls since last counters_print()
+    COUNTER_INVOKE_KCYCLES,     // Their cycles in thousands
+    COUNTER_INVOKE_MAX_CYCLES,  // The longest of them
+    COUNTER_UART_DROPPED,       // Console bytes lost to overrun or full queue
+    COUNTER_ARENA_USED,         // Arena bytes of the loaded model
+    COUNTER_SENSOR_SAMPLES,     // Background sensor reads, look at sensors.c
+    COUNTER_SENSOR_ERRORS,      // Of them failed on the bus
+    COUNTER_SENSOR_OVERRUNS,    // Ticks a sensor read was still queued
+    COUNTER_STOP_WAKEUPS,       // Wake ups from STOP, look at stop_mode.c
+    COUNTER_FLIR_BOOTS,         // Lepton boots, look at flir_wait_ready()
+    COUNTER_FLIR_BOOT_MAX_MS,   // The longest of them, from power up
+    COUNTER_WARM_STARTS,        // Wake ups that kept the interpreter
+    COUNTER_COLD_STARTS,        // Wake ups that had to set it up again
+    COUNTER_EARLY_EXITS,        // Inferences that stopped before the end
+    COUNTER_REMOTE_ERRORS,      // Exchanges with companion that failed
+    COUNTER_BUDGET_OVERRUNS,    // Regions over budget, look at cycle_budget.c
+    COUNTER_CCI_COMMANDS,       // Blocking Lepton commands sent over CCI
+    COUNTER_CCI_CACHED,         // Gets and sets the shadow of flir.c saved
+    COUNTER_THERMAL_STEPS,      // Level changes, look at thermal_gov.c
+    COUNTER_THERMAL_HOLD_MS,    // Time frames waited while die was hot
+    COUNTER_ETH_DATAGRAMS,      // Queued by eth_udp.c
+    COUNTER_ETH_DROPPED,        // Without link or with full ring
+    COUNTER_ETH_ERRORS,         // Sent with an error of the MAC
+    COUNTER_RATE_STEPS,         // Interval changes, look at rate_gov.c
+    COUNTER_RATE_HOLD_MS,       // Time frames waited while scene was quiet
+    COUNTER_RATE_STANDBYS,      // Of those waits with the Lepton powered down
+    COUNTERS,
+} counter_id_t;
+
+extern volatile uint32_t counters[COUNTERS];
+
+/*!
+ * @brief           Adds to a counter
+ *
+ * @param[in] id    counter_id_t
+ * @param[in] value
+ *
+ * @note            Can be called from interrupts. Relaxed atomic add is
+ *                  LDREX/STREX on Cortex-M7, interrupts stay enabled and
+ *                  no update is lost to preemption.
+ */
+static inline void counter_add(counter_id_t id, uint32_t value)
+{
+    __atomic_fetch_add(&counters[id], value, __ATOMIC_RELAXED);
+}
+
+/*!
+ * @brief           Raises a counter to value, if it is lower
+ *
+ * @note            Can be called from interrupts.
+ */
+static inline void counter_max(counter_id_t id, uint32_t value)
+{
+    uint32_t old = __atomic_load_n(&counters[id], __ATOMIC_RELAXED);
+    while (value > old &&
+           !__atomic_compare_exchange_n(&counters[id], &old, value, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+/*!
+ * @brief           Overwrites a counter, for levels like arena usage
+ */
+static inline void counter_set(counter_id_t id, uint32_t value)
+{
+    __atomic_store_n(&counters[id], value, __ATOMIC_RELAXED);
+}
+
+/*!
+ * @brief           Returns a counter and sets it to zero, as one operation
+ */
+static inline uint32_t counter_take(counter_id_t id)
+{
+    return __atomic_exchange_n(&counters[id], 0, __ATOMIC_RELAXED);
+}
+
+void counters_print();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COUNTERS_H */
+/*** end of file ***/
@@ -0,0 +1,415 @@
+#include <stddef.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/crc.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
+#include "crc_hw.h"
+#include "dma_buf.h"
+#include "events.h"
+#include "utility.h"
+#include "periph_clock.h"
+
+/* Explanation: CRC unit of STM32F7 with programmable polynomial does both
+ * checksums that firmware uses:
+ * - CRC-16 with polynomial 0x1021, initial value of the caller, no
+ *   reflection. That is the VoSPI packet CRC (initial 0) and the
+ *   CRC-16/CCITT-FALSE of telemetry.h and remote_infer.h (initial
+ *   0xFFFF). Bytes are written as big endian words, so a word takes
+ *   one write instead of 32 table steps.
+ * - CRC-32 of zlib and Ethernet, input reversed by word and output
+ *   reversed, so it matches binascii.crc32() of the host. It is used for
+ *   blobs like .tflite models, gen_blob.py emits the expected value.
+ * Every call continues from crc of the previous call, calls can be
+ * split however it suits the caller.
+ *
+ * Unit has one state, so it is taken for the whole call. Interrupt that
+ * finds it taken, for example FLIR capture during crc_hw_crc32_dma(),
+ * computes in software instead of waiting, result is the same, only
+ * slower. Software CRC-16 is table driven, the table is built in
+ * crc_hw_setup().
+ *
+ * crc_hw_crc32_dma() feeds aligned words with DMA2 stream 1 in memory
+ * to memory mode, CPU sleeps in event_wait() meanwhile. Stream 1 is free,
+ * SPI1 has 0 and 3. DMA can not read ITCM, flash behind ITCM alias is
+ * read over AXIM instead.
+ *
+ * CRC clock is on only while the unit is taken, DMA2 only while
+ * crc_hw_crc32_dma() runs, unless SPI1 holds it, look at periph_clock.c.
+ * Stream 1 is configured once in crc_hw_setup(), it keeps its registers
+ * while DMA2 is gated.
+ * */
+
+#ifndef CRC_INIT
+#define CRC_INIT                MMIO32(CRC_BASE + 0x10)
+#endif
+#ifndef CRC_POL
+#define CRC_POL                 MMIO32(CRC_BASE + 0x14)
+#endif
+#define CRC_DR8                 MMIO8(CRC_BASE)
+#define CRC_DR16                MMIO16(CRC_BASE)
+
+#define CRC_HW_CR_RESET         (1 << 0)
+#define CRC_HW_CR_POLYSIZE_16   (1 << 3)
+#define CRC_HW_CR_REV_IN_WORD   (3 << 5)
+#define CRC_HW_CR_REV_OUT       (1 << 7)
+
+#define CRC_HW_POLY16           0x1021
+#define CRC_HW_POLY32           0x04C11DB7U
+#define CRC_HW_POLY32_REFLECTED 0xEDB88320U
+
+#define CRC_HW_DMA_FLAGS        (DMA_TCIF | DMA_HTIF | DMA_TEIF | \
+                                 DMA_DMEIF | DMA_FEIF)
+#define CRC_HW_DMA_MAX_WORDS    (65535)
+
+// Flash alias on ITCM interface, look at fastflash.h
+#define CRC_HW_ITCM_FLASH_BASE  0x00200000U
+#define CRC_HW_ITCM_FLASH_END   0x00400000U
+#define CRC_HW_AXIM_FLASH_BASE  0x08000000U
+
+static uint16_t ccitt_table[256];
+static volatile bool owned = false;
+
+static const uint32_t * dma_next;
+static volatile uint32_t dma_left = 0;
+static volatile bool dma_done = false;
+static volatile bool dma_failed = false;
+
+static bool crc_acquire();
+static void crc_release();
+static void crc_start(uint32_t cr, uint32_t poly, uint32_t init);
+static void dma_start_chunk();
+
+static inline uint32_t bit_reverse(uint32_t value)
+{
+    uint32_t result;
+    __asm__ ("rbit %0, %1" : "=r" (result) : "r" (value));
+    return result;
+}
+
+/*!
+ * @brief   Configures DMA2 stream 1 for the CRC unit, builds software
+ *          table
+ *
+ * @note    Call before the first FLIR capture, table is used from its
+ *          interrupt.
+ */
+void crc_hw_setup()
+{
+    for (uint16_t i = 0; i < 256; i++)
+    {
+        uint16_t crc = i << 8;
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ CRC_HW_POLY16 : crc << 1;
+        }
+        ccitt_table[i] = crc;
+    }
+
+    periph_clock_acquire(RCC_DMA2);
+
+    dma_stream_reset(DMA2, DMA_STREAM1);
+    dma_set_priority(DMA2, DMA_STREAM1, DMA_SxCR_PL_LOW);
+    dma_set_transfer_mode(DMA2, DMA_STREAM1, DMA_SxCR_DIR_MEM_TO_MEM);
+    dma_set_memory_address(DMA2, DMA_STREAM1, (uint32_t) &CRC_DR);
+    dma_disable_memory_increment_mode(DMA2, DMA_STREAM1);
+    dma_enable_peripheral_increment_mode(DMA2, DMA_STREAM1);
+    dma_set_peripheral_size(DMA2, DMA_STREAM1, DMA_SxCR_PSIZE_32BIT);
+    dma_set_memory_size(DMA2, DMA_STREAM1, DMA_SxCR_MSIZE_32BIT);
+    // Memory to memory needs the FIFO
+    dma_enable_fifo_mode(DMA2, DMA_STREAM1);
+    dma_set_fifo_threshold(DMA2, DMA_STREAM1, DMA_SxFCR_FTH_4_4_FULL);
+    dma_enable_transfer_complete_interrupt(DMA2, DMA_STREAM1);
+    dma_enable_transfer_error_interrupt(DMA2, DMA_STREAM1);
+    nvic_enable_irq(NVIC_DMA2_STREAM1_IRQ);
+    periph_clock_release(RCC_DMA2);
+}
+
+/*!
+ * @brief               CRC-16 with polynomial 0x1021 over bytes
+ *
+ * @param[in] crc       0xFFFF for CCITT-FALSE, or result of previous call
+ *
+ * @return              Updated CRC
+ *
+ * @note                Can be called from interrupts.
+ */
+uint16_t crc_hw_ccitt16(uint16_t crc, const void * data, uint32_t len)
+{
+    const uint8_t * bytes = (const uint8_t *) data;
+
+    if (len < 4 || !crc_acquire())
+    {
+        for (uint32_t i = 0; i < len; i++)
+        {
+            crc = (crc << 8) ^ ccitt_table[(crc >> 8) ^ bytes[i]];
+        }
+        return crc;
+    }
+
+    crc_start(CRC_HW_CR_POLYSIZE_16, CRC_HW_POLY16, crc);
+    while (len && ((uint32_t) bytes & 3))
+    {
+        CRC_DR8 = *bytes++;
+        len--;
+    }
+    // Unit takes most significant byte first, memory is little endian
+    const uint32_t * words = (const uint32_t *) bytes;
+    for (uint32_t i = 0; i < len / 4; i++)
+    {
+        CRC_DR = __builtin_bswap32(words[i]);
+    }
+    bytes += len & ~3U;
+    for (uint32_t i = 0; i < (len & 3); i++)
+    {
+        CRC_DR8 = bytes[i];
+    }
+
+    crc = (uint16_t) CRC_DR;
+    crc_release();
+    return crc;
+}
+
+/*!
+ * @brief               CRC-16 with polynomial 0x1021 over 16 bit values,
+ *                      most significant byte first
+ *
+ * @param[in] crc       0 for VoSPI packets, or result of previous call
+ *
+ * @return              Updated CRC
+ *
+ * @note                Words as SPI received them in 16 bit frames, no
+ *                      byte swap is needed. Can be called from interrupts.
+ */
+uint16_t crc_hw_ccitt16_words(uint16_t crc, const uint16_t * words,
+                              uint32_t num_words)
+{
+    if (!crc_acquire())
+    {
+        for (uint32_t i = 0; i < num_words; i++)
+        {
+            uint16_t word = words[i];
+            crc = (crc << 8) ^ ccitt_table[(crc >> 8) ^ (word >> 8)];
+            crc = (crc << 8) ^ ccitt_table[(crc >> 8) ^ (word & 0xFF)];
+        }
+        return crc;
+    }
+
+    crc_start(CRC_HW_CR_POLYSIZE_16, CRC_HW_POLY16, crc);
+    for (uint32_t i = 0; i < num_words; i++)
+    {
+        CRC_DR16 = words[i];
+    }
+    crc = (uint16_t) CRC_DR;
+    crc_release();
+    return crc;
+}
+
+/*!
+ * @brief   CRC-32 of bytes in software, zlib convention
+ */
+static uint32_t crc32_soft(uint32_t crc, const uint8_t * bytes, uint32_t len)
+{
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        crc ^= bytes[i];
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC_HW_POLY32_REFLECTED : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+/*!
+ * @brief   Loads unit with CRC-32 state of zlib value crc
+ */
+static void crc32_start(uint32_t crc)
+{
+    // Unit keeps the state not reflected and without final inversion
+    crc_start(CRC_HW_CR_REV_IN_WORD | CRC_HW_CR_REV_OUT, CRC_HW_POLY32,
+              bit_reverse(~crc));
+}
+
+/*!
+ * @brief               CRC-32 of zlib, written by CPU
+ *
+ * @param[in] crc       0, or result of previous call
+ *
+ * @return              Updated CRC, equals binascii.crc32()
+ *
+ * @note                Use crc_hw_crc32_dma() for long blocks, this one
+ *                      keeps CPU busy, one word per write.
+ */
+uint32_t crc_hw_crc32(uint32_t crc, const void * data, uint32_t len)
+{
+    const uint8_t * bytes = (const uint8_t *) data;
+    uint32_t head = (4 - ((uint32_t) bytes & 3)) & 3;
+
+    if (len < head + 4 || !crc_acquire())
+    {
+        return crc32_soft(crc, bytes, len);
+    }
+
+    // Unaligned ends are only a few bytes, software keeps unit on words
+    crc = crc32_soft(crc, bytes, head);
+    bytes += head;
+    len -= head;
+
+    crc32_start(crc);
+    const uint32_t * words = (const uint32_t *) bytes;
+    for (uint32_t i = 0; i < len / 4; i++)
+    {
+        CRC_DR = words[i];
+    }
+    crc = ~CRC_DR;
+    crc_release();
+
+    return crc32_soft(crc, bytes + (len & ~3U), len & 3);
+}
+
+/*!
+ * @brief               CRC-32 of zlib, with words fed by DMA while CPU
+ *                      sleeps
+ *
+ * @param[in] data      Block in flash, SRAM or DTCM
+ * @param[out] crc      Result, equals binascii.crc32()
+ *
+ * @return              False if unit is taken, DMA failed or took longer
+ *                      than CRC_HW_DMA_TIMEOUT, crc is not written then
+ *
+ * @note                Call from main context only. Fall back to
+ *                      crc_hw_crc32() when it fails.
+ */
+bool crc_hw_crc32_dma(const void * data, uint32_t len, uint32_t * crc)
+{
+    const uint8_t * bytes = (const uint8_t *) data;
+    uint32_t head = (4 - ((uint32_t) bytes & 3)) & 3;
+
+    if (len < head + 4 || !crc_acquire())
+    {
+        return false;
+    }
+
+    uint32_t result = crc32_soft(0, bytes, head);
+    bytes += head;
+    len -= head;
+
+    uint32_t address = (uint32_t) bytes;
+    if (address >= CRC_HW_ITCM_FLASH_BASE && address < CRC_HW_ITCM_FLASH_END)
+    {
+        address += CRC_HW_AXIM_FLASH_BASE - CRC_HW_ITCM_FLASH_BASE;
+    }
+    else
+    {
+        // DMA reads memory, CPU writes can still be in D-cache
+        dma_buf_clean(bytes, len);
+    }
+
+    periph_clock_acquire(RCC_DMA2);
+    crc32_start(result);
+    dma_next = (const uint32_t *) address;
+    dma_left = len / 4;
+    dma_done = false;
+    dma_failed = false;
+    event_take(EVENT_CRC);
+    dma_start_chunk();
+
+    uint64_t start = millis();
+    while (!dma_done)
+    {
+        uint64_t elapsed = millis() - start;
+        if (elapsed >= CRC_HW_DMA_TIMEOUT)
+        {
+            break;
+        }
+        event_wait(EVENT_CRC, CRC_HW_DMA_TIMEOUT - elapsed);
+    }
+
+    bool ok = dma_done && !dma_failed;
+    if (!dma_done)
+    {
+        // Interrupt of the stopped stream must not start the next part
+        dma_left = 0;
+        dma_disable_stream(DMA2, DMA_STREAM1);
+        while (DMA_SCR(DMA2, DMA_STREAM1) & DMA_SxCR_EN);
+    }
+    result = ~CRC_DR;
+    periph_clock_release(RCC_DMA2);
+    crc_release();
+
+    if (ok)
+    {
+        *crc = crc32_soft(result, bytes + (len & ~3U), len & 3);
+    }
+    return ok;
+}
+
+/*!
+ * @brief   Starts next part of the DMA block, NDTR takes 65535 words
+ */
+static void dma_start_chunk()
+{
+    uint32_t words = dma_left;
+    if (words > CRC_HW_DMA_MAX_WORDS)
+    {
+        words = CRC_HW_DMA_MAX_WORDS;
+    }
+
+    dma_clear_interrupt_flags(DMA2, DMA_STREAM1, CRC_HW_DMA_FLAGS);
+    dma_set_peripheral_address(DMA2, DMA_STREAM1, (uint32_t) dma_next);
+    dma_set_number_of_data(DMA2, DMA_STREAM1, words);
+    dma_next += words;
+    dma_left -= words;
+    dma_enable_stream(DMA2, DMA_STREAM1);
+}
+
+void dma2_stream1_isr()
+{
+    bool failed = dma_get_interrupt_flag(DMA2, DMA_STREAM1, DMA_TEIF);
+    dma_clear_interrupt_flags(DMA2, DMA_STREAM1, CRC_HW_DMA_FLAGS);
+
+    if (!failed && dma_left)
+    {
+        dma_start_chunk();
+        return;
+    }
+    dma_failed = failed;
+    dma_done = true;
+    event_post(EVENT_CRC);
+}
+
+/*!
+ * @brief   Takes the unit, false if another context has it
+ */
+static bool crc_acquire()
+{
+    bool masked = cm_mask_interrupts(true);
+    bool free = !owned;
+    owned = true;
+    cm_mask_interrupts(masked);
+    if (free)
+    {
+        periph_clock_acquire(RCC_CRC);
+    }
+    return free;
+}
+
+static void crc_release()
+{
+    periph_clock_release(RCC_CRC);
+    owned = false;
+}
+
+/*!
+ * @brief   Sets polynomial, reversal and initial value and resets the unit
+ */
+static void crc_start(uint32_t cr, uint32_t poly, uint32_t init)
+{
+    CRC_CR = cr;
+    CRC_POL = poly;
+    CRC_INIT = init;
+    CRC_CR = cr | CRC_HW_CR_RESET;
+}
+/*** end of file ***/
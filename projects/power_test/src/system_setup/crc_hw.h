@@ -0,0 +1,27 @@
+#ifndef CRC_HW_H
+#define CRC_HW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Longest wait of crc_hw_crc32_dma(), 1 MB of flash takes around 2 ms
+#define CRC_HW_DMA_TIMEOUT      (100)   // In ms
+
+void crc_hw_setup();
+uint16_t crc_hw_ccitt16(uint16_t crc, const void * data, uint32_t len);
+uint16_t crc_hw_ccitt16_words(uint16_t crc, const uint16_t * words,
+                              uint32_t num_words);
+uint32_t crc_hw_crc32(uint32_t crc, const void * data, uint32_t len);
+bool crc_hw_crc32_dma(const void * data, uint32_t len, uint32_t * crc);
+void dma2_stream1_isr();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CRC_HW_H */
+/*** end of file ***/
@@ -0,0 +1,112 @@
+#include <libopencm3/cm3/cortex.h>
+#include "cycle_budget.h"
+#include "counters.h"
+#include "trace.h"
+#include "printf.h"
+
+/* Explanation: CYCLE_BUDGET() takes DWT cycle counter when it is declared
+ * and compiler calls cycle_budget_end() on every way out of the scope.
+ * Region keeps count, sum, min and max since the last print, updated with
+ * interrupts masked for a few instructions, as a region of an interrupt
+ * can preempt the same region of main context. Overruns are kept since
+ * boot, their sum is also COUNTER_BUDGET_OVERRUNS and each one is a trace
+ * event, so a slow packet can be found on the timeline. Nothing is printed
+ * in the hot path, STATS shows the table and starts a new window.
+ *
+ * Cycles of a region include interrupts that preempted it, a packet that
+ * lands in load_data() is counted in both.
+ * */
+#ifdef CYCLE_BUDGETS
+typedef struct
+{
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t max_cycles;    // Budget of the last record
+    uint32_t overruns;
+    uint64_t sum;
+} cycle_budget_region_t;
+
+static cycle_budget_region_t regions[BUDGET_REGIONS];
+
+static const char * const region_names[BUDGET_REGIONS] = {
+    "vospi_packet",
+    "spi_dma_isr",
+    "vsync_isr",
+    "console_rx_isr",
+    "load_data",
+    "op_eval",
+};
+
+/*!
+ * @brief               Adds one measurement to the region
+ *
+ * @param[in] id        cycle_budget_id_t
+ * @param[in] cycles    Cycles the region took
+ * @param[in] max_cycles Budget of the region
+ *
+ * @note                Can be called from interrupts, use CYCLE_BUDGET()
+ *                      instead of calling it directly.
+ */
+void cycle_budget_record(cycle_budget_id_t id, uint32_t cycles,
+                         uint32_t max_cycles)
+{
+    cycle_budget_region_t * region = &regions[id];
+    bool overrun = cycles > max_cycles;
+
+    bool masked = cm_mask_interrupts(true);
+    if (!region->count || cycles < region->min)
+    {
+        region->min = cycles;
+    }
+    if (cycles > region->max)
+    {
+        region->max = cycles;
+    }
+    region->count++;
+    region->sum += cycles;
+    region->max_cycles = max_cycles;
+    if (overrun)
+    {
+        region->overruns++;
+    }
+    cm_mask_interrupts(masked);
+
+    if (overrun)
+    {
+        counter_add(COUNTER_BUDGET_OVERRUNS, 1);
+        TRACE(TRACE_BUDGET_OVERRUN, id);
+    }
+}
+
+/*!
+ * @brief   Prints min, average and max cycles of every region since the
+ *          last print, with its budget and overruns since boot
+ *
+ * @note    Call it from main context only, window starts again.
+ */
+void cycle_budget_print()
+{
+    printf("%-16s %8s %8s %8s %8s %8s %8s\n", "region", "count", "min",
+           "avg", "max", "budget", "overruns");
+    for (uint32_t id = 0; id < BUDGET_REGIONS; id++)
+    {
+        cycle_budget_region_t region;
+
+        bool masked = cm_mask_interrupts(true);
+        region = regions[id];
+        regions[id].count = 0;
+        regions[id].min = 0;
+        regions[id].max = 0;
+        regions[id].sum = 0;
+        cm_mask_interrupts(masked);
+
+        uint32_t average = region.count ?
+                           (uint32_t) (region.sum / region.count) : 0;
+        printf("%-16s %8lu %8lu %8lu %8lu %8lu %8lu\n", region_names[id],
+               region.count, region.min, average, region.max,
+               region.max_cycles, region.overruns);
+    }
+}
+#endif
+/*** end of file ***/
@@ -0,0 +1,93 @@
+#ifndef CYCLE_BUDGET_H
+#define CYCLE_BUDGET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libopencm3/cm3/dwt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Measures real-time sections with DWT cycle counter and counts the ones
+// that took longer than their budget, look at cycle_budget.c. Comment out
+// to compile CYCLE_BUDGET() to nothing.
+#define CYCLE_BUDGETS
+
+// Regions that STATS shell command prints, names are in region_names[] of
+// cycle_budget.c, keep both lists in the same order
+typedef enum
+{
+    BUDGET_VOSPI_PACKET,        // capture_packet_done(), one VoSPI packet
+    BUDGET_SPI_DMA_ISR,         // dma2_stream0_isr(), packet handling too
+    BUDGET_VSYNC_ISR,           // exti3_isr()
+    BUDGET_CONSOLE_RX_ISR,      // usart2_isr() and dma1_stream5_isr()
+    BUDGET_LOAD_DATA,           // load_data()
+    BUDGET_OP_EVAL,             // The longest operator of Invoke()
+    BUDGET_REGIONS,
+} cycle_budget_id_t;
+
+// Budgets in core cycles at 216 MHz. Packet has to be handled before the
+// next one is read, which is 164 bytes or 21k cycles at 13.5 MHz SPI.
+// Lower clock profiles run the same code in about the same cycles, but
+// packets take less of them, so expect overruns of VoSPI below 100 MHz.
+#define BUDGET_VOSPI_PACKET_CYCLES      (10000)
+#define BUDGET_SPI_DMA_ISR_CYCLES       (12000)
+#define BUDGET_VSYNC_ISR_CYCLES         (2000)
+#define BUDGET_CONSOLE_RX_ISR_CYCLES    (4000)
+#define BUDGET_LOAD_DATA_CYCLES         (40000)
+#define BUDGET_OP_EVAL_CYCLES           (20000000)
+
+#ifdef CYCLE_BUDGETS
+// One measured region, lives on the stack of its scope
+typedef struct
+{
+    cycle_budget_id_t id;
+    uint32_t max_cycles;
+    uint32_t start;
+} cycle_budget_scope_t;
+
+void cycle_budget_record(cycle_budget_id_t id, uint32_t cycles,
+                         uint32_t max_cycles);
+void cycle_budget_print();
+
+/*!
+ * @brief           Ends a region of CYCLE_BUDGET(), compiler calls it when
+ *                  the scope is left, returns included
+ */
+static inline void cycle_budget_end(cycle_budget_scope_t * scope)
+{
+    // Unsigned subtraction also covers counter overflow
+    cycle_budget_record(scope->id, DWT_CYCCNT - scope->start,
+                        scope->max_cycles);
+}
+
+#define CYCLE_BUDGET_NAME2(line)    cycle_budget_scope_##line
+#define CYCLE_BUDGET_NAME(line)     CYCLE_BUDGET_NAME2(line)
+
+/*!
+ * @brief               Measures the rest of the enclosing scope
+ *
+ * @param[in] id        cycle_budget_id_t
+ * @param[in] max_cycles Cycles above which the region is an overrun
+ *
+ * @note                Can be used in interrupts, it costs a call and a
+ *                      few instructions with interrupts masked, nothing
+ *                      is printed. Use it once per scope.
+ */
+#define CYCLE_BUDGET(id, max_cycles)                                       \
+    cycle_budget_scope_t CYCLE_BUDGET_NAME(__LINE__)                       \
+        __attribute__((cleanup(cycle_budget_end))) =                       \
+        {(id), (max_cycles), DWT_CYCCNT}
+#else
+#define CYCLE_BUDGET(id, max_cycles)        ((void) 0)
+#define cycle_budget_record(id, c, max)     ((void) 0)
+#define cycle_budget_print()                ((void) 0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CYCLE_BUDGET_H */
+/*** end of file ***/
@@ -0,0 +1,590 @@
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/nvic.h>
+#include "dcmi_cam.h"
+#include "sys_init.h"
+#include "i2c_async.h"
+#include "irq_prio.h"
+#include "dma_buf.h"
+#include "events.h"
+#include "trace.h"
+#include "periph_clock.h"
+#include "utility.h"
+#include "printf.h"
+
+#ifdef DCMI_CAMERA
+
+/* Explanation: OV7670 sends QQVGA frames, 160x120 pixels of YUYV, two
+ * bytes a pixel. DCMI keeps only the first byte of every four and the
+ * first line of every two, that is Y of every other pixel on every other
+ * line, so 80x60 grayscale arrives without any work of the core. DMA2
+ * stream 7, channel 1 moves it in words straight into a frame buffer of
+ * the stream, the layout is the same as AGC frames of the Lepton.
+ *
+ * DCMI runs in snapshot mode, one frame per start, so every frame begins
+ * at its own VSYNC and a lost word can never shift the next one. The
+ * frame interrupt queues the finished buffer and starts the next capture,
+ * the core touches each frame once with a handful of register writes,
+ * well inside the vertical blanking of the camera. A frame whose DMA did
+ * not finish is short and the same buffer is used again. The line
+ * interrupt is on only for the first line of a frame, for its timestamp.
+ *
+ * Queue is the one of flir_stream_start(), consumer takes the oldest
+ * frame with dcmi_cam_stream_peek() and gives it back with
+ * dcmi_cam_stream_release(). DMA can not drop a frame half way, so when
+ * all buffers are queued the newest queued one is captured again and
+ * counted as dropped, the oldest one that consumer may be reading is
+ * never touched. Depth is at least 2 for that reason.
+ *
+ * XCLK is HSI on MCO1, 16 MHz in every clock profile, HSI is the kernel
+ * clock of I2C1 too and stays on. PCLK of the camera is a quarter of
+ * that in QQVGA, far below HCLK / 2.5 that DCMI needs even in the
+ * slowest profile. STOP stops HSI and so the camera, stop the stream
+ * before, like the one of the Lepton.
+ * */
+
+#ifndef DCMI_BASE
+#define DCMI_BASE               0x50050000U
+#endif
+
+#define DCMI_HW_CR              MMIO32(DCMI_BASE + 0x00)
+#define DCMI_HW_RIS             MMIO32(DCMI_BASE + 0x08)
+#define DCMI_HW_IER             MMIO32(DCMI_BASE + 0x0C)
+#define DCMI_HW_MIS             MMIO32(DCMI_BASE + 0x10)
+#define DCMI_HW_ICR             MMIO32(DCMI_BASE + 0x14)
+#define DCMI_HW_DR              (DCMI_BASE + 0x28)
+
+#define DCMI_CR_CAPTURE         (1 << 0)
+#define DCMI_CR_SNAPSHOT        (1 << 1)
+#define DCMI_CR_PCKPOL_RISING   (1 << 5)
+#define DCMI_CR_VSPOL_HIGH      (1 << 7)    // HSYNC stays low active
+#define DCMI_CR_ENABLE          (1 << 14)
+#define DCMI_CR_BSM_1_OF_4      (2 << 16)   // First byte of every four
+#define DCMI_CR_LSM             (1 << 19)   // First line of every two
+
+#define DCMI_IT_FRAME           (1 << 0)
+#define DCMI_IT_OVR             (1 << 1)
+#define DCMI_IT_ERR             (1 << 2)
+#define DCMI_IT_VSYNC           (1 << 3)
+#define DCMI_IT_LINE            (1 << 4)
+#define DCMI_IT_ALL             (DCMI_IT_FRAME | DCMI_IT_OVR | DCMI_IT_ERR | \
+                                 DCMI_IT_VSYNC | DCMI_IT_LINE)
+
+// MCO1 source and prescaler, HSI without division is all zeros
+#define RCC_CFGR_MCO1_FIELDS    ((0x3 << 21) | (0x7 << 24))
+
+#define DCMI_CAM_DMA_FLAGS      (DMA_TCIF | DMA_HTIF | DMA_TEIF | DMA_DMEIF | \
+                                 DMA_FEIF)
+
+// OV7670 registers
+#define OV_CLKRC                0x11
+#define OV_COM7                 0x12
+#define OV_COM7_RESET           0x80
+#define OV_PID                  0x0A
+#define OV_RESET_MS             2
+
+typedef struct
+{
+    uint32_t port;
+    enum rcc_periph_clken rcc;
+    uint16_t pins;
+} dcmi_cam_pins_t;
+
+static const dcmi_cam_pins_t dcmi_cam_pins[] =
+{
+    {GPIOA, RCC_GPIOA, GPIO4 | GPIO6},
+    {GPIOB, RCC_GPIOB, GPIO7},
+    {GPIOC, RCC_GPIOC, GPIO6 | GPIO7 | GPIO8 | GPIO11},
+    {GPIOD, RCC_GPIOD, GPIO3},
+    {GPIOE, RCC_GPIOE, GPIO5 | GPIO6},
+    {GPIOG, RCC_GPIOG, GPIO11},
+};
+
+// QQVGA YUYV with scaling of the camera, values of the Linux ov7670
+// driver, COM10 left at reset: HREF high and VSYNC high, data valid on
+// rising edge of PCLK
+static const uint8_t ov_qqvga_yuv[][2] =
+{
+    {OV_CLKRC,  0x01},          // Internal clock XCLK / 2
+    {OV_COM7,   0x00},          // YUV
+    {0x3A,      0x04},          // TSLB, YUYV order with COM13
+    {0x3D,      0x88},          // COM13, gamma, UV saturation auto
+    {0x0C,      0x04},          // COM3, DCW and scaling
+    {0x3E,      0x1A},          // COM14, manual scaling, PCLK / 4
+    {0x70,      0x3A},          // SCALING_XSC
+    {0x71,      0x35},          // SCALING_YSC
+    {0x72,      0x22},          // SCALING_DCWCTR, down by 4 both ways
+    {0x73,      0xF2},          // SCALING_PCLK_DIV, by 4
+    {0xA2,      0x02},          // SCALING_PCLK_DELAY
+    {0x17,      0x16},          // HSTART
+    {0x18,      0x04},          // HSTOP
+    {0x32,      0xA4},          // HREF
+    {0x19,      0x02},          // VSTART
+    {0x1A,      0x7A},          // VSTOP
+    {0x03,      0x0A},          // VREF
+    {0x13,      0xE7},          // COM8, AGC, AWB and AEC on
+};
+
+// SCCB has no repeated start, register address and read are separate
+static i2c_xfer_t sccb_xfer;
+static uint8_t sccb_tx[2];
+static uint8_t sccb_rx[DMA_BUF_ALIGN] DMA_BUFFER;
+static volatile bool sccb_done = false;
+static volatile bool sccb_ok = false;
+
+// Buffers of the stream, head and tail run over twice the depth, as in
+// flir.c, so a full queue differs from an empty one
+static uint8_t * stream_frames = NULL;
+static uint8_t stream_depth = 0;
+static volatile bool stream_on = false;
+static volatile uint8_t stream_head = 0;
+static volatile uint8_t stream_tail = 0;
+static dcmi_cam_timestamp_t stream_times[DCMI_CAM_STREAM_MAX_DEPTH];
+
+// Buffer DMA is filling and when its first line came
+static uint8_t * capture_frame = NULL;
+static uint64_t capture_first_us = 0;
+
+static dcmi_cam_stats_t stats;
+static bool ready = false;
+
+static uint8_t stream_next(uint8_t index);
+static uint8_t stream_prev(uint8_t index);
+static void capture_arm();
+
+static void sccb_xfer_done(i2c_xfer_t * xfer, bool status)
+{
+    (void) xfer;
+    sccb_ok = status;
+    sccb_done = true;
+}
+
+/*!
+ * @brief   Runs one SCCB transfer through i2c_async.c and waits for it
+ */
+static bool sccb_run(const uint8_t * tx, uint8_t tx_len, uint8_t rx_len)
+{
+    sccb_done = false;
+    sccb_xfer.addr = DCMI_CAM_SCCB_ADDR;
+    sccb_xfer.tx = tx;
+    sccb_xfer.tx_len = tx_len;
+    sccb_xfer.rx = sccb_rx;
+    sccb_xfer.rx_len = rx_len;
+    sccb_xfer.callback = sccb_xfer_done;
+    sccb_xfer.context = NULL;
+    if (!i2c_async_submit(&sccb_xfer))
+    {
+        return false;
+    }
+    while (!sccb_done);
+    return sccb_ok;
+}
+
+static bool sccb_write(uint8_t reg, uint8_t value)
+{
+    sccb_tx[0] = reg;
+    sccb_tx[1] = value;
+    return sccb_run(sccb_tx, 2, 0);
+}
+
+static bool sccb_read(uint8_t reg, uint8_t * value)
+{
+    sccb_tx[0] = reg;
+    if (!sccb_run(sccb_tx, 1, 0) || !sccb_run(NULL, 0, 1))
+    {
+        return false;
+    }
+    *value = sccb_rx[0];
+    return true;
+}
+
+/*!
+ * @brief           Starts XCLK, configures the camera over SCCB and
+ *                  prepares DCMI and its DMA stream
+ *
+ * @return          False if no OV7670 answers, stream can not be started
+ *                  then
+ *
+ * @note            Call after flir_setup(), I2C1 is shared with the CCI
+ *                  of the Lepton. Takes a few ms, most of it the reset of
+ *                  the camera.
+ */
+bool dcmi_cam_setup()
+{
+    rcc_periph_clock_enable(RCC_GPIOA);
+    gpio_mode_setup(DCMI_CAM_XCLK_PORT, GPIO_MODE_AF, GPIO_PUPD_NONE,
+                    DCMI_CAM_XCLK_PIN);
+    gpio_set_output_options(DCMI_CAM_XCLK_PORT, GPIO_OTYPE_PP,
+                            GPIO_OSPEED_50MHZ, DCMI_CAM_XCLK_PIN);
+    gpio_set_af(DCMI_CAM_XCLK_PORT, GPIO_AF0, DCMI_CAM_XCLK_PIN);
+    RCC_CFGR &= ~RCC_CFGR_MCO1_FIELDS;
+
+    for (uint32_t i = 0; i < sizeof(dcmi_cam_pins) / sizeof(dcmi_cam_pins[0]);
+         i++)
+    {
+        const dcmi_cam_pins_t * pins = &dcmi_cam_pins[i];
+        rcc_periph_clock_enable(pins->rcc);
+        gpio_mode_setup(pins->port, GPIO_MODE_AF, GPIO_PUPD_NONE, pins->pins);
+        gpio_set_af(pins->port, GPIO_AF13, pins->pins);
+    }
+
+    // Camera needs XCLK before it answers SCCB
+    sys_require(SYS_PERIPH_I2C);
+    delay(OV_RESET_MS);
+    uint8_t pid = 0;
+    if (!sccb_write(OV_COM7, OV_COM7_RESET))
+    {
+        return false;
+    }
+    delay(OV_RESET_MS);
+    if (!sccb_read(OV_PID, &pid) || pid != DCMI_CAM_PID)
+    {
+        return false;
+    }
+    for (uint32_t i = 0; i < sizeof(ov_qqvga_yuv) / sizeof(ov_qqvga_yuv[0]);
+         i++)
+    {
+        if (!sccb_write(ov_qqvga_yuv[i][0], ov_qqvga_yuv[i][1]))
+        {
+            return false;
+        }
+    }
+
+    periph_clock_acquire(RCC_DCMI);
+    DCMI_HW_CR = DCMI_CR_SNAPSHOT | DCMI_CR_PCKPOL_RISING |
+                 DCMI_CR_VSPOL_HIGH | DCMI_CR_BSM_1_OF_4 | DCMI_CR_LSM;
+    DCMI_HW_IER = 0;
+    DCMI_HW_ICR = DCMI_IT_ALL;
+
+    periph_clock_acquire(RCC_DMA2);
+    dma_stream_reset(DMA2, DMA_STREAM7);
+    dma_channel_select(DMA2, DMA_STREAM7, DMA_SxCR_CHSEL_1);
+    dma_set_priority(DMA2, DMA_STREAM7, DMA_SxCR_PL_HIGH);
+    dma_set_transfer_mode(DMA2, DMA_STREAM7, DMA_SxCR_DIR_PERIPHERAL_TO_MEM);
+    dma_set_peripheral_address(DMA2, DMA_STREAM7, DCMI_HW_DR);
+    dma_set_peripheral_size(DMA2, DMA_STREAM7, DMA_SxCR_PSIZE_32BIT);
+    dma_set_memory_size(DMA2, DMA_STREAM7, DMA_SxCR_MSIZE_32BIT);
+    dma_enable_memory_increment_mode(DMA2, DMA_STREAM7);
+    periph_clock_release(RCC_DMA2);
+    periph_clock_release(RCC_DCMI);
+
+    nvic_enable_irq(NVIC_DCMI_IRQ);
+    ready = true;
+    return true;
+}
+
+/*!
+ * @brief   Tells if the camera answered at setup
+ */
+bool dcmi_cam_ready()
+{
+    return ready;
+}
+
+/*!
+ * @brief           Starts continuous capture, every frame of the camera is
+ *                  queued until it is stopped
+ *
+ * @param[in] frames    Array of depth DMA_BUFFER frames of
+ *                      DCMI_CAM_FRAME_BYTES
+ * @param[in] depth     Number of frames, 2 up to DCMI_CAM_STREAM_MAX_DEPTH
+ *
+ * @return          False if camera is missing or stream already runs
+ *
+ * @note            Runs next to the stream of the Lepton, neither one
+ *                  needs the core between frames.
+ */
+bool dcmi_cam_stream_start(void * frames, uint8_t depth)
+{
+    if (!ready || stream_on || depth < 2 ||
+        depth > DCMI_CAM_STREAM_MAX_DEPTH)
+    {
+        return false;
+    }
+
+    stream_frames = frames;
+    stream_depth = depth;
+    stream_head = 0;
+    stream_tail = 0;
+    event_take(EVENT_CAMERA);
+
+    periph_clock_acquire(RCC_DCMI);
+    periph_clock_acquire(RCC_DMA2);
+    uint32_t masked = irq_lock(IRQ_PRIO_IO);
+    stream_on = true;
+    DCMI_HW_CR |= DCMI_CR_ENABLE;
+    capture_frame = stream_frames;
+    capture_arm();
+    irq_unlock(masked);
+    return true;
+}
+
+/*!
+ * @brief           Stops continuous capture at once, frame that is being
+ *                  received is lost
+ *
+ * @note            Frames that are still queued can be taken. Buffers can
+ *                  be used for something else once it returns.
+ */
+void dcmi_cam_stream_stop()
+{
+    if (!stream_on)
+    {
+        return;
+    }
+
+    uint32_t masked = irq_lock(IRQ_PRIO_IO);
+    stream_on = false;
+    DCMI_HW_IER = 0;
+    DCMI_HW_CR &= ~(DCMI_CR_CAPTURE | DCMI_CR_ENABLE);
+    dma_disable_stream(DMA2, DMA_STREAM7);
+    while (DMA_SCR(DMA2, DMA_STREAM7) & DMA_SxCR_EN);
+    irq_unlock(masked);
+    periph_clock_release(RCC_DMA2);
+    periph_clock_release(RCC_DCMI);
+}
+
+/*!
+ * @brief           Tells if continuous capture was started and not stopped
+ */
+bool dcmi_cam_stream_running()
+{
+    return stream_on;
+}
+
+/*!
+ * @brief           Returns number of queued frames, including the one that
+ *                  consumer is using
+ */
+uint8_t dcmi_cam_stream_pending()
+{
+    uint8_t head = stream_head;
+    uint8_t tail = stream_tail;
+    return head >= tail ? head - tail : head + 2 * stream_depth - tail;
+}
+
+/*!
+ * @brief           Returns the oldest queued frame, without removing it
+ *
+ * @return          DCMI_CAM_ROWS x DCMI_CAM_COLS pixels, NULL if queue is
+ *                  empty
+ *
+ * @note            Frame is not written until dcmi_cam_stream_release().
+ */
+void * dcmi_cam_stream_peek()
+{
+    uint8_t tail = stream_tail;
+    if (stream_head == tail)
+    {
+        return NULL;
+    }
+    return stream_frames + (tail % stream_depth) * DCMI_CAM_FRAME_BYTES;
+}
+
+/*!
+ * @brief           Sleeps until a frame is queued and returns it, as
+ *                  dcmi_cam_stream_peek()
+ *
+ * @return          Frame, NULL if stream is stopped and queue is empty or
+ *                  no frame came for DCMI_CAM_FRAME_TIMEOUT
+ */
+void * dcmi_cam_stream_wait()
+{
+    void * frame;
+    uint64_t start = millis();
+
+    while (!(frame = dcmi_cam_stream_peek()))
+    {
+        uint64_t waited = millis() - start;
+        if (!stream_on)
+        {
+            return NULL;
+        }
+        if (waited >= DCMI_CAM_FRAME_TIMEOUT)
+        {
+            stats.timeouts++;
+            return NULL;
+        }
+        event_wait(EVENT_CAMERA, DCMI_CAM_FRAME_TIMEOUT - waited);
+    }
+    return frame;
+}
+
+/*!
+ * @brief           Copies arrival times of the oldest queued frame, the
+ *                  one dcmi_cam_stream_peek() returns
+ *
+ * @param[out] stamp
+ *
+ * @return          False if queue is empty
+ */
+bool dcmi_cam_stream_timestamp(dcmi_cam_timestamp_t * stamp)
+{
+    uint8_t tail = stream_tail;
+    if (stream_head == tail)
+    {
+        return false;
+    }
+    *stamp = stream_times[tail % stream_depth];
+    return true;
+}
+
+/*!
+ * @brief           Gives the oldest queued frame back to the stream
+ */
+void dcmi_cam_stream_release()
+{
+    // Interrupt moves head back when it takes the newest frame again
+    uint32_t masked = irq_lock(IRQ_PRIO_IO);
+    if (stream_head != stream_tail)
+    {
+        stream_tail = stream_next(stream_tail);
+    }
+    irq_unlock(masked);
+}
+
+/*!
+ * @brief           Returns counters of the capture since boot
+ */
+const dcmi_cam_stats_t * dcmi_cam_get_stats()
+{
+    return &stats;
+}
+
+/*!
+ * @brief   Prints counters of the capture, part of STATS
+ */
+void dcmi_cam_report()
+{
+    if (!ready)
+    {
+        printf("DCMI: camera not found\n");
+        return;
+    }
+    printf("DCMI: %lu frames, %lu dropped, %lu short, %lu overruns, "
+           "%lu timeouts\n", stats.frames, stats.dropped, stats.short_frames,
+           stats.overruns, stats.timeouts);
+}
+
+/*!
+ * @brief           Returns the next value of stream_head or stream_tail
+ */
+static uint8_t stream_next(uint8_t index)
+{
+    return index + 1 == 2 * stream_depth ? 0 : index + 1;
+}
+
+static uint8_t stream_prev(uint8_t index)
+{
+    return index == 0 ? 2 * stream_depth - 1 : index - 1;
+}
+
+/*!
+ * @brief           Points DMA at capture_frame and starts capture of the
+ *                  next frame
+ *
+ * @note            Called with DCMI interrupt masked or from it, DMA stream
+ *                  is off.
+ */
+static void capture_arm()
+{
+    // Consumer could have left dirty lines in it
+    dma_buf_invalidate(capture_frame, DCMI_CAM_FRAME_BYTES);
+    dma_clear_interrupt_flags(DMA2, DMA_STREAM7, DCMI_CAM_DMA_FLAGS);
+    dma_set_memory_address(DMA2, DMA_STREAM7, (uint32_t) capture_frame);
+    dma_set_number_of_data(DMA2, DMA_STREAM7, DCMI_CAM_FRAME_BYTES / 4);
+    dma_enable_stream(DMA2, DMA_STREAM7);
+
+    DCMI_HW_ICR = DCMI_IT_ALL;
+    DCMI_HW_IER = DCMI_IT_FRAME | DCMI_IT_OVR | DCMI_IT_LINE;
+    DCMI_HW_CR |= DCMI_CR_CAPTURE;
+}
+
+/*!
+ * @brief           Queues the frame DMA just filled and selects buffer for
+ *                  the next one
+ *
+ * @note            Called from interrupt. With all buffers queued the
+ *                  newest one is taken back.
+ */
+static void capture_push(uint64_t now)
+{
+    // Lines that were read ahead while DMA wrote the frame
+    dma_buf_invalidate(capture_frame, DCMI_CAM_FRAME_BYTES);
+    stream_times[stream_head % stream_depth].first_us = capture_first_us;
+    stream_times[stream_head % stream_depth].complete_us = now;
+    // Frame and time have to be in place before consumer sees head
+    __asm__ volatile ("" ::: "memory");
+    stream_head = stream_next(stream_head);
+    stats.frames++;
+
+    if (dcmi_cam_stream_pending() >= stream_depth)
+    {
+        stream_head = stream_prev(stream_head);
+        stats.dropped++;
+    }
+    else
+    {
+        event_post(EVENT_CAMERA);
+    }
+    capture_frame = stream_frames +
+                    (stream_head % stream_depth) * DCMI_CAM_FRAME_BYTES;
+}
+
+/*!
+ * @brief   First line, end of frame or overrun of DCMI
+ */
+void dcmi_isr()
+{
+    uint32_t flags = DCMI_HW_MIS;
+    DCMI_HW_ICR = flags;
+
+    if (flags & DCMI_IT_LINE)
+    {
+        capture_first_us = micros();
+        DCMI_HW_IER &= ~DCMI_IT_LINE;
+    }
+
+    // DCMI waits for the next VSYNC after an overrun, DMA starts over
+    // with it
+    if (flags & DCMI_IT_OVR)
+    {
+        dma_disable_stream(DMA2, DMA_STREAM7);
+        while (DMA_SCR(DMA2, DMA_STREAM7) & DMA_SxCR_EN);
+        stats.overruns++;
+        TRACE(TRACE_CAMERA_ISR, 0);
+        if (stream_on)
+        {
+            capture_arm();
+        }
+        return;
+    }
+
+    if (!(flags & DCMI_IT_FRAME))
+    {
+        return;
+    }
+
+    // Normal mode clears EN once the last word is written
+    uint64_t now = micros();
+    dma_disable_stream(DMA2, DMA_STREAM7);
+    while (DMA_SCR(DMA2, DMA_STREAM7) & DMA_SxCR_EN);
+    if (DMA_SNDTR(DMA2, DMA_STREAM7))
+    {
+        stats.short_frames++;
+        TRACE(TRACE_CAMERA_ISR, 0);
+    }
+    else if (stream_on)
+    {
+        capture_push(now);
+        TRACE(TRACE_CAMERA_ISR, 1);
+    }
+
+    if (stream_on)
+    {
+        capture_arm();
+    }
+}
+#endif
+/*** end of file ***/
@@ -0,0 +1,80 @@
+#ifndef DCMI_CAM_H
+#define DCMI_CAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Define on units with an OV7670 visible light camera on DCMI, frames are
+// queued next to the ones of the Lepton, look at dcmi_cam.c. Nucleo-F767ZI
+// has no camera connector, wiring is listed below.
+//#define DCMI_CAMERA
+
+// Grayscale frames of the same geometry as Lepton 2.x AGC frames, so
+// frame_convert.h and the models take them as they are
+#define DCMI_CAM_ROWS           (60)
+#define DCMI_CAM_COLS           (80)
+#define DCMI_CAM_FRAME_BYTES    (DCMI_CAM_ROWS * DCMI_CAM_COLS)
+
+// Most frame buffers of the stream, look at dcmi_cam_stream_start()
+#define DCMI_CAM_STREAM_MAX_DEPTH   (4)
+
+// SCCB address of OV7670, 0x42 on the datasheet counts the R/W bit
+#define DCMI_CAM_SCCB_ADDR      (0x21)
+#define DCMI_CAM_PID            (0x76)
+// OV7670 sends about 20 frames per second with 16 MHz XCLK, missing
+// frames for this long end dcmi_cam_stream_wait(), in ms
+#define DCMI_CAM_FRAME_TIMEOUT  (250)
+
+// Pins, all AF13 but XCLK. PA6 is MISO of VoSPI on Nucleo wiring, it moves
+// to PG9 with DCMI_CAMERA, look at spi_setup(). VSYNC takes LD2 and D6, D7
+// take MARKER_INVOKE and MARKER_REPORT of sys_init.h.
+// - XCLK PA8 (MCO1, AF0), PIXCLK PA6, HSYNC PA4, VSYNC PB7
+// - D0-D2 PC6-PC8, D3 PG11, D4 PC11, D5 PD3, D6-D7 PE5-PE6
+// SIOC and SIOD go to I2C1 next to the Lepton CCI.
+#define DCMI_CAM_XCLK_PORT      GPIOA
+#define DCMI_CAM_XCLK_PIN       GPIO8
+
+// Counters of the capture, look at dcmi_cam_isr()
+typedef struct
+{
+    uint32_t frames;
+    uint32_t dropped;           // Newest queued frame was overwritten
+    uint32_t short_frames;      // Frame ended before the buffer was full
+    uint32_t overruns;          // DMA did not empty the FIFO of DCMI
+    uint32_t timeouts;          // dcmi_cam_stream_wait() gave up
+}dcmi_cam_stats_t;
+
+// Time of a frame in micros(), taken in DCMI interrupt
+typedef struct
+{
+    uint64_t first_us;          // First line of the frame was received
+    uint64_t complete_us;       // Last line of the frame was received
+}dcmi_cam_timestamp_t;
+
+#ifdef DCMI_CAMERA
+bool dcmi_cam_setup();
+bool dcmi_cam_ready();
+bool dcmi_cam_stream_start(void * frames, uint8_t depth);
+void dcmi_cam_stream_stop();
+bool dcmi_cam_stream_running();
+uint8_t dcmi_cam_stream_pending();
+void * dcmi_cam_stream_peek();
+void * dcmi_cam_stream_wait();
+bool dcmi_cam_stream_timestamp(dcmi_cam_timestamp_t * stamp);
+void dcmi_cam_stream_release();
+const dcmi_cam_stats_t * dcmi_cam_get_stats();
+void dcmi_cam_report();
+#else
+#define dcmi_cam_ready()        (false)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DCMI_CAM_H */
+/*** end of file ***/
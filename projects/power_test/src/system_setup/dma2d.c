@@ -0,0 +1,295 @@
+#include <string.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/cm3/nvic.h>
+#include "dma2d.h"
+#include "dma_buf.h"
+#include "events.h"
+#include "utility.h"
+#include "periph_clock.h"
+
+/* Explanation: DMA2D (Chrom-ART) moves rectangles between memories on its
+ * own AHB master, so copies of frames and tensors run while CPU does
+ * something else, for example Invoke(). Rectangles are given in bytes,
+ * width and strides of source and destination can all differ, which
+ * covers crops, packing rows without VoSPI ID and CRC words and plain
+ * copies, height 1 is a linear copy.
+ *
+ * Unit only knows pixels of 16, 24 and 32 bits, there is no 8 bit output
+ * format and no arithmetic besides alpha blending. Rectangle is therefore
+ * moved as ARGB8888 words when addresses, width and strides are multiples
+ * of 4, or as RGB565 halfwords when they are even, both without pixel
+ * format conversion, bytes arrive as they were. Anything else, and 8 bit
+ * conversions with scale or offset, stays with the CPU, look at
+ * frame_convert.h. dma2d_copy() falls back to memcpy() of rows itself.
+ *
+ * Source is cleaned out of D-cache before start, destination invalidated
+ * before start and again in the interrupt, so once dma2d_busy() returns
+ * false CPU reads what unit wrote. Unit can not read ITCM, code flash has
+ * to be given by its AXIM address.
+ *
+ * One transfer is in flight at a time and only main context starts them.
+ * Unit is clocked only while a transfer runs, the interrupt or the abort
+ * of dma2d_wait() gates it again.
+ * */
+
+#ifndef DMA2D_BASE
+#define DMA2D_BASE              0x4002B000U
+#endif
+
+#define DMA2D_HW_CR             MMIO32(DMA2D_BASE + 0x00)
+#define DMA2D_HW_ISR            MMIO32(DMA2D_BASE + 0x04)
+#define DMA2D_HW_IFCR           MMIO32(DMA2D_BASE + 0x08)
+#define DMA2D_HW_FGMAR          MMIO32(DMA2D_BASE + 0x0C)
+#define DMA2D_HW_FGOR           MMIO32(DMA2D_BASE + 0x10)
+#define DMA2D_HW_FGPFCCR        MMIO32(DMA2D_BASE + 0x1C)
+#define DMA2D_HW_OPFCCR         MMIO32(DMA2D_BASE + 0x34)
+#define DMA2D_HW_OCOLR          MMIO32(DMA2D_BASE + 0x38)
+#define DMA2D_HW_OMAR           MMIO32(DMA2D_BASE + 0x3C)
+#define DMA2D_HW_OOR            MMIO32(DMA2D_BASE + 0x40)
+#define DMA2D_HW_NLR            MMIO32(DMA2D_BASE + 0x44)
+
+#define DMA2D_HW_CR_START       (1 << 0)
+#define DMA2D_HW_CR_ABORT       (1 << 2)
+#define DMA2D_HW_CR_TEIE        (1 << 8)
+#define DMA2D_HW_CR_TCIE        (1 << 9)
+#define DMA2D_HW_CR_CAEIE       (1 << 11)
+#define DMA2D_HW_CR_CEIE        (1 << 13)
+#define DMA2D_HW_MODE_M2M       (0 << 16)
+#define DMA2D_HW_MODE_R2M       (3 << 16)
+
+#define DMA2D_HW_TEIF           (1 << 0)
+#define DMA2D_HW_TCIF           (1 << 1)
+#define DMA2D_HW_CAEIF          (1 << 3)
+#define DMA2D_HW_CEIF           (1 << 5)
+#define DMA2D_HW_FLAGS          (0x3F)
+#define DMA2D_HW_ERRORS         (DMA2D_HW_TEIF | DMA2D_HW_CAEIF | \
+                                 DMA2D_HW_CEIF)
+
+#define DMA2D_HW_ARGB8888       (0)
+#define DMA2D_HW_RGB565         (2)
+
+#define DMA2D_HW_MAX_PIXELS     (16383)     // Pixels per line and offsets
+#define DMA2D_HW_MAX_LINES      (65535)
+
+static volatile bool running = false;
+static volatile bool failed = false;
+static void * dst_addr;
+static uint32_t dst_span;
+
+static bool transfer_start(uint32_t mode, uint32_t unit, void * dst,
+                           uint32_t dst_stride, uint32_t width,
+                           uint32_t height);
+
+/*!
+ * @brief   Span of bytes that rectangle touches, first to last row
+ */
+static inline uint32_t rect_span(uint32_t stride, uint32_t width,
+                                 uint32_t height)
+{
+    return (height - 1) * stride + width;
+}
+
+/*!
+ * @brief   Largest pixel that unit can move for given addresses and sizes
+ *
+ * @return  4 or 2 bytes, 0 if rectangle is not even
+ */
+static inline uint32_t pixel_bytes(uint32_t bits)
+{
+    if (!(bits & 3))
+    {
+        return 4;
+    }
+    return (bits & 1) ? 0 : 2;
+}
+
+/*!
+ * @brief   Enables DMA2D, its interrupt signals end of each transfer
+ */
+void dma2d_setup()
+{
+    periph_clock_acquire(RCC_DMA2D);
+    DMA2D_HW_IFCR = DMA2D_HW_FLAGS;
+    periph_clock_release(RCC_DMA2D);
+    nvic_enable_irq(NVIC_DMA2D_IRQ);
+}
+
+/*!
+ * @brief                   Starts copy of a rectangle of bytes
+ *
+ * @param[in] src           First byte of the rectangle
+ * @param[in] src_stride    Bytes from start of one source row to the next
+ * @param[out] dst
+ * @param[in] dst_stride
+ * @param[in] width         Bytes of each row
+ * @param[in] height        Number of rows
+ *
+ * @return                  False if transfer is in flight, or rectangle
+ *                          is odd or too large for the unit, copy it with
+ *                          CPU then
+ *
+ * @note                    Returns right away, buffers must not be touched
+ *                          until dma2d_busy() is false or dma2d_wait().
+ */
+bool dma2d_copy_start(const void * src, uint32_t src_stride,
+                      void * dst, uint32_t dst_stride,
+                      uint32_t width, uint32_t height)
+{
+    uint32_t unit = pixel_bytes((uint32_t) src | (uint32_t) dst | width |
+                                src_stride | dst_stride);
+    if (!unit || running || !width || !height || src_stride < width ||
+        (src_stride - width) / unit > DMA2D_HW_MAX_PIXELS)
+    {
+        return false;
+    }
+
+    dma_buf_clean(src, rect_span(src_stride, width, height));
+    periph_clock_acquire(RCC_DMA2D);
+    DMA2D_HW_FGMAR = (uint32_t) src;
+    DMA2D_HW_FGOR = (src_stride - width) / unit;
+    DMA2D_HW_FGPFCCR = unit == 4 ? DMA2D_HW_ARGB8888 : DMA2D_HW_RGB565;
+    return transfer_start(DMA2D_HW_MODE_M2M, unit, dst, dst_stride, width,
+                          height);
+}
+
+/*!
+ * @brief                   Starts fill of a rectangle with one byte value
+ *
+ * @return                  False if transfer is in flight, or rectangle is
+ *                          odd or too large for the unit
+ *
+ * @note                    Same rules as dma2d_copy_start()
+ */
+bool dma2d_fill_start(void * dst, uint32_t dst_stride,
+                      uint32_t width, uint32_t height, uint8_t value)
+{
+    uint32_t unit = pixel_bytes((uint32_t) dst | width | dst_stride);
+    if (!unit || running || !width || !height)
+    {
+        return false;
+    }
+
+    // Output colour is written as a whole pixel of the output format
+    periph_clock_acquire(RCC_DMA2D);
+    DMA2D_HW_OCOLR = value * (unit == 4 ? 0x01010101U : 0x0101U);
+    return transfer_start(DMA2D_HW_MODE_R2M, unit, dst, dst_stride, width,
+                          height);
+}
+
+/*!
+ * @brief   Tells if the last transfer is still running
+ */
+bool dma2d_busy()
+{
+    return running;
+}
+
+/*!
+ * @brief   Sleeps until the last transfer is done
+ *
+ * @return  False if unit reported an error or transfer took longer than
+ *          DMA2D_TIMEOUT, destination is then incomplete
+ *
+ * @note    Returns true right away when nothing was started.
+ */
+bool dma2d_wait()
+{
+    uint64_t start = millis();
+    while (running)
+    {
+        uint64_t elapsed = millis() - start;
+        if (elapsed >= DMA2D_TIMEOUT)
+        {
+            break;
+        }
+        event_wait(EVENT_DMA2D, DMA2D_TIMEOUT - elapsed);
+    }
+
+    if (running)
+    {
+        DMA2D_HW_CR |= DMA2D_HW_CR_ABORT;
+        while (DMA2D_HW_CR & DMA2D_HW_CR_START);
+        DMA2D_HW_IFCR = DMA2D_HW_FLAGS;
+        periph_clock_release(RCC_DMA2D);
+        running = false;
+        failed = true;
+    }
+    return !failed;
+}
+
+/*!
+ * @brief                   Copies rectangle of bytes and waits for it,
+ *                          with CPU if unit can not do it
+ *
+ * @note                    Same arguments as dma2d_copy_start(). CPU
+ *                          sleeps while unit copies.
+ */
+void dma2d_copy(const void * src, uint32_t src_stride,
+                void * dst, uint32_t dst_stride,
+                uint32_t width, uint32_t height)
+{
+    dma2d_wait();
+    if (dma2d_copy_start(src, src_stride, dst, dst_stride, width, height) &&
+        dma2d_wait())
+    {
+        return;
+    }
+
+    const uint8_t * in = (const uint8_t *) src;
+    uint8_t * out = (uint8_t *) dst;
+    for (uint32_t row = 0; row < height; row++)
+    {
+        memcpy(out + row * dst_stride, in + row * src_stride, width);
+    }
+}
+
+void dma2d_isr()
+{
+    uint32_t flags = DMA2D_HW_ISR;
+    DMA2D_HW_IFCR = DMA2D_HW_FLAGS;
+    periph_clock_release(RCC_DMA2D);
+
+    // Lines that CPU speculatively read meanwhile are dropped again
+    dma_buf_invalidate(dst_addr, dst_span);
+    failed = (flags & DMA2D_HW_ERRORS) || !(flags & DMA2D_HW_TCIF);
+    running = false;
+    event_post(EVENT_DMA2D);
+}
+
+/*!
+ * @brief   Programs output side and starts the unit
+ *
+ * @note    Caller acquired the clock, it is released here if the
+ *          rectangle does not fit.
+ */
+static bool transfer_start(uint32_t mode, uint32_t unit, void * dst,
+                           uint32_t dst_stride, uint32_t width,
+                           uint32_t height)
+{
+    uint32_t pixels = width / unit;
+    if (dst_stride < width || pixels > DMA2D_HW_MAX_PIXELS ||
+        (dst_stride - width) / unit > DMA2D_HW_MAX_PIXELS ||
+        height > DMA2D_HW_MAX_LINES)
+    {
+        periph_clock_release(RCC_DMA2D);
+        return false;
+    }
+
+    dst_addr = dst;
+    dst_span = rect_span(dst_stride, width, height);
+    dma_buf_invalidate(dst, dst_span);
+
+    DMA2D_HW_OMAR = (uint32_t) dst;
+    DMA2D_HW_OOR = (dst_stride - width) / unit;
+    DMA2D_HW_OPFCCR = unit == 4 ? DMA2D_HW_ARGB8888 : DMA2D_HW_RGB565;
+    DMA2D_HW_NLR = (pixels << 16) | height;
+    DMA2D_HW_IFCR = DMA2D_HW_FLAGS;
+
+    running = true;
+    failed = false;
+    event_take(EVENT_DMA2D);
+    DMA2D_HW_CR = mode | DMA2D_HW_CR_TCIE | DMA2D_HW_CR_TEIE |
+                  DMA2D_HW_CR_CAEIE | DMA2D_HW_CR_CEIE | DMA2D_HW_CR_START;
+    return true;
+}
+/*** end of file ***/
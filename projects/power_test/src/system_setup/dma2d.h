@@ -0,0 +1,32 @@
+#ifndef DMA2D_H
+#define DMA2D_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Longest wait of dma2d_wait(), a 320 KB copy takes around 1 ms
+#define DMA2D_TIMEOUT           (20)    // In ms
+
+void dma2d_setup();
+bool dma2d_copy_start(const void * src, uint32_t src_stride,
+                      void * dst, uint32_t dst_stride,
+                      uint32_t width, uint32_t height);
+bool dma2d_fill_start(void * dst, uint32_t dst_stride,
+                      uint32_t width, uint32_t height, uint8_t value);
+bool dma2d_busy();
+bool dma2d_wait();
+void dma2d_copy(const void * src, uint32_t src_stride,
+                void * dst, uint32_t dst_stride,
+                uint32_t width, uint32_t height);
+void dma2d_isr();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DMA2D_H */
+/*** end of file ***/
@@ -0,0 +1,107 @@
+#include "dma_buf.h"
+#include "sys_init.h"
+
+/* Explanation: with D-cache on, CPU and DMA can see different contents of
+ * the same memory. CPU writes can stay in dirty lines that DMA does not
+ * see, and after DMA wrote memory, CPU can still read old lines. Worse,
+ * a dirty line evicted during a transfer overwrites what DMA just wrote,
+ * and invalidating a line that is shared with another variable loses CPU
+ * writes to that variable. So every DMA buffer starts on a cache line and
+ * covers whole lines, either as static DMA_BUFFER array or as region
+ * from dma_buf_alloc(), and transfers are surrounded by dma_buf_clean()
+ * or dma_buf_invalidate().
+ *
+ * Allocator is a simple bump pointer over one pool, buffers are taken in
+ * setup functions and never freed. With DMA_BUF_NONCACHEABLE the pool is
+ * aligned to its size and mpu_setup() in sys_init.c covers it with normal
+ * non-cacheable region, so maintenance is skipped for it. That is cheaper
+ * for small buffers that are touched often, like packet buffers, but CPU
+ * accesses to them are not cached either.
+ * */
+#ifdef DMA_BUF_NONCACHEABLE
+uint8_t dma_buf_pool[DMA_BUF_POOL_SIZE] 
+    __attribute__((aligned(DMA_BUF_POOL_SIZE))) NOINIT_BSS;
+#else
+uint8_t dma_buf_pool[DMA_BUF_POOL_SIZE] DMA_BUFFER NOINIT_BSS;
+#endif
+static uint32_t dma_buf_used = 0;
+
+/*!
+ * @brief   Empties the pool
+ *
+ * @note    Call it before first dma_buf_alloc(), MPU region of the pool is
+ *          set by mpu_setup()
+ */
+void dma_buf_setup()
+{
+    dma_buf_used = 0;
+}
+
+/*!
+ * @brief           Takes DMA buffer from the pool
+ *
+ * @param[in] size  Number of bytes, rounded up to whole cache lines
+ *
+ * @return          Cache line aligned buffer, NULL if pool is exhausted
+ *
+ * @note            Buffers are never freed, call it from setup functions.
+ *                  Contents are not zeroed.
+ */
+void * dma_buf_alloc(uint32_t size)
+{
+    size = DMA_BUF_ROUND(size);
+    if (size == 0 || size > DMA_BUF_POOL_SIZE - dma_buf_used)
+    {
+        return NULL;
+    }
+
+    void * buf = &dma_buf_pool[dma_buf_used];
+    dma_buf_used += size;
+    return buf;
+}
+
+/*!
+ * @brief   Returns number of bytes left in the pool
+ */
+uint32_t dma_buf_available()
+{
+    return DMA_BUF_POOL_SIZE - dma_buf_used;
+}
+
+/*!
+ * @brief           Invalidates cache lines of the buffer, partial first 
+ *                  and last line are cleaned and invalidated
+ *
+ * @param[in] addr  Buffer
+ * @param[in] size  Number of bytes
+ *
+ * @note            Use dma_buf_invalidate(), it skips uncached memory.
+ */
+void dma_buf_invalidate_lines(void * addr, uint32_t size)
+{
+    if (size == 0)
+    {
+        return;
+    }
+
+    uint32_t start = (uint32_t) addr;
+    uint32_t end = start + size;
+    uint32_t line = start & ~(uint32_t) (DMA_BUF_ALIGN - 1);
+
+    __DSB();
+    for (; line < end; line += DMA_BUF_ALIGN)
+    {
+        if (line < start || line + DMA_BUF_ALIGN > end)
+        {
+            SCB_DCCIMVAC = line;
+        }
+        else
+        {
+            SCB_DCIMVAC = line;
+        }
+    }
+    __DSB();
+    __ISB();
+}
+
+/*** end of file ***/
@@ -0,0 +1,115 @@
+#ifndef DMA_BUF_H
+#define DMA_BUF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "fastflash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// D-cache stays on, buffers that DMA touches are kept coherent either by
+// cache maintenance, look at dma_buf.c, or by MPU region that makes the
+// pool of dma_buf_alloc() non-cacheable, look at mpu_setup(). Maintenance calls then skip the
+// pool, static DMA_BUFFER arrays still need them.
+//#define DMA_BUF_NONCACHEABLE
+
+#define DMA_BUF_POOL_SIZE   16384   // Bytes, power of two, for MPU region
+#define DMA_BUF_ALIGN       32      // Cortex-M7 D-cache line
+
+// Size rounded up to whole cache lines
+#define DMA_BUF_ROUND(size) (((size) + DMA_BUF_ALIGN - 1) & \
+                             ~(uint32_t) (DMA_BUF_ALIGN - 1))
+
+// Static buffer that starts on its own cache line, its size has to be a 
+// multiple of DMA_BUF_ALIGN too, so no other variable shares its last line
+#define DMA_BUFFER          __attribute__((aligned(DMA_BUF_ALIGN)))
+
+// DTCM is never cached, DMA reaches it through AHBS
+#define DMA_BUF_DTCM_BASE   0x20000000U
+#define DMA_BUF_DTCM_END    0x20020000U
+
+extern uint8_t dma_buf_pool[DMA_BUF_POOL_SIZE];
+
+void dma_buf_setup();
+void * dma_buf_alloc(uint32_t size);
+uint32_t dma_buf_available();
+void dma_buf_invalidate_lines(void * addr, uint32_t size);
+
+/*!
+ * @brief           Checks if buffer has to be maintained by software
+ *
+ * @return          False when D-cache is off or buffer is in uncached memory
+ */
+static inline bool dma_buf_cached(const void * addr)
+{
+    uint32_t a = (uint32_t) addr;
+
+    if (!(SCB_CCR & SCB_CCR_DC_Msk))
+    {
+        return false;
+    }
+    if (a >= DMA_BUF_DTCM_BASE && a < DMA_BUF_DTCM_END)
+    {
+        return false;
+    }
+#ifdef DMA_BUF_NONCACHEABLE
+    if (a - (uint32_t) dma_buf_pool < DMA_BUF_POOL_SIZE)
+    {
+        return false;
+    }
+#endif
+    return true;
+}
+
+/*!
+ * @brief           Writes CPU data out of D-cache, so DMA reads it
+ *
+ * @param[in] addr  Buffer that DMA will read, memory to peripheral
+ * @param[in] size  Number of bytes
+ *
+ * @note            Call it after buffer is filled and before DMA starts.
+ */
+static inline void dma_buf_clean(const void * addr, uint32_t size)
+{
+    if (dma_buf_cached(addr))
+    {
+        SCB_CleanDCache_by_Addr((void *) addr, (int32_t) size);
+    }
+    else
+    {
+        // Writes still have to reach memory before DMA starts
+        __DSB();
+    }
+}
+
+/*!
+ * @brief           Drops D-cache lines of buffer that DMA writes
+ *
+ * @param[in] addr  Buffer that DMA writes, peripheral to memory
+ * @param[in] size  Number of bytes
+ *
+ * @note            Call it before DMA starts, so no dirty line is written
+ *                  back over received data, and after DMA finished, before 
+ *                  CPU reads the data. Can be called from interrupts. 
+ *                  Lines that buffer shares with other variables are 
+ *                  cleaned first instead of being dropped, so unaligned 
+ *                  buffers are safe too, but CPU should not write those 
+ *                  variables while DMA runs.
+ */
+static inline void dma_buf_invalidate(void * addr, uint32_t size)
+{
+    if (dma_buf_cached(addr))
+    {
+        dma_buf_invalidate_lines(addr, size);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DMA_BUF_H */
+/*** end of file ***/
@@ -0,0 +1,384 @@
+#include <string.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include "eth_udp.h"
+#include "sys_init.h"
+#include "dma_buf.h"
+#include "dcmi_cam.h"
+#include "config_store.h"
+#include "counters.h"
+#include "utility.h"
+#include "printf.h"
+
+#ifdef ETH_UDP
+
+/* Explanation: MAC of the F767 with its own DMA sends UDP datagrams, there
+ * is no receive path, no ARP and no IP stack. Each datagram is one
+ * transmit descriptor with two buffers: the first is the header block of
+ * the descriptor, Ethernet, IPv4 and UDP headers from a template and a
+ * few bytes of message header, the second points straight at the payload,
+ * rows of a frame or a record on the result bus, which DMA reads from
+ * where it is. IPv4 and UDP checksums are inserted by the MAC, that needs
+ * store and forward of whole frames in the transmit FIFO.
+ *
+ * Descriptors and header blocks are in DTCM, which is not cached and DMA
+ * reaches through AHBS, so only payloads are cleaned out of D-cache. A
+ * payload has to stay as it is until DMA took it, at 100 Mbit/s a full
+ * datagram is on the wire in about 120 us. Descriptors are taken back
+ * when the ring comes round to them, a send that finds its descriptor
+ * still owned by DMA drops the datagram and counts it in eth_dropped,
+ * nothing waits. Without link everything is dropped.
+ *
+ * Datagrams go to broadcast MAC address and to ETH_UDP_COLLECTOR, set
+ * eth_ip and eth_collector with SET for units on a network, values are
+ * IPv4 addresses as 32 bit numbers, for example 3232235826 for
+ * 192.168.1.50. MAC address is locally administered and comes from the
+ * unique id of the chip.
+ *
+ * SMI clock divider of 150 to 216 MHz keeps MDC under 2.5 MHz with both
+ * clock profiles, SMI is only used here and by eth_udp_report(). MAC
+ * needs HCLK of at least 25 MHz for 100 Mbit/s, IDLE has 48.
+ * */
+
+#if defined(DCMI_CAMERA)
+#error "ETH_UDP needs PG11, which is D3 of DCMI_CAMERA"
+#endif
+
+#define ETH_HW_BASE             0x40028000U
+#define ETH_HW_MACCR            MMIO32(ETH_HW_BASE + 0x0000)
+#define ETH_HW_MACMIIAR         MMIO32(ETH_HW_BASE + 0x0010)
+#define ETH_HW_MACMIIDR         MMIO32(ETH_HW_BASE + 0x0014)
+#define ETH_HW_MACA0HR          MMIO32(ETH_HW_BASE + 0x0040)
+#define ETH_HW_MACA0LR          MMIO32(ETH_HW_BASE + 0x0044)
+#define ETH_HW_DMABMR           MMIO32(ETH_HW_BASE + 0x1000)
+#define ETH_HW_DMATPDR          MMIO32(ETH_HW_BASE + 0x1004)
+#define ETH_HW_DMATDLAR         MMIO32(ETH_HW_BASE + 0x1010)
+#define ETH_HW_DMAOMR           MMIO32(ETH_HW_BASE + 0x1018)
+#define ETH_HW_SYSCFG_PMC       MMIO32(0x40013804U)
+
+#define MACCR_TE                (1 << 3)
+#define MACCR_DM                (1 << 11)   // Full duplex
+#define MACCR_FES               (1 << 14)   // 100 Mbit/s
+#define MACMIIAR_MB             (1 << 0)
+#define MACMIIAR_MW             (1 << 1)
+#define MACMIIAR_CR_102         (4 << 2)    // HCLK 150 to 216 MHz
+#define MACMIIAR_MR(reg)        ((reg) << 6)
+#define MACMIIAR_PA(phy)        ((phy) << 11)
+#define DMABMR_SR               (1 << 0)
+#define DMABMR_PBL(beats)       ((beats) << 8)
+#define DMABMR_AAB              (1 << 25)
+#define DMAOMR_ST               (1 << 13)
+#define DMAOMR_FTF              (1 << 20)
+#define DMAOMR_TSF              (1 << 21)
+#define SYSCFG_PMC_RMII         (1 << 23)
+
+// Normal transmit descriptor, ring mode with both buffers
+#define TDES0_OWN               (1U << 31)
+#define TDES0_LS                (1 << 29)
+#define TDES0_FS                (1 << 28)
+#define TDES0_CIC_FULL          (3 << 22)   // IPv4 and UDP with pseudo header
+#define TDES0_TER               (1 << 21)
+#define TDES0_ES                (1 << 15)   // Error summary of last send
+#define TDES1_SIZES(b1, b2)     ((b1) | ((uint32_t) (b2) << 16))
+
+// LAN8742A
+#define PHY_BCR                 0
+#define PHY_BSR                 1
+#define PHY_PSCSR               31
+#define PHY_BCR_RESET           (1 << 15)
+#define PHY_BCR_AN              (1 << 12)
+#define PHY_BCR_AN_RESTART      (1 << 9)
+#define PHY_BSR_LINK            (1 << 2)
+#define PHY_BSR_AN_DONE         (1 << 5)
+#define PHY_PSCSR_100           (1 << 3)
+#define PHY_PSCSR_FULL          (1 << 4)
+
+#define ETH_UID_ADDRESS         0x1FF0F420U
+#define ETH_RESET_TIMEOUT       10          // ms, needs REF_CLK of the PHY
+
+// Ethernet, IPv4 without options and UDP
+#define ETH_HEADERS             42
+#define ETH_IP_LEN              16          // Offsets of fields that change
+#define ETH_IP_ID               18
+#define ETH_UDP_LEN             38
+
+typedef struct
+{
+    volatile uint32_t status;
+    uint32_t sizes;
+    const void * buffer1;
+    const void * buffer2;
+} eth_tx_desc_t;
+
+typedef struct
+{
+    uint32_t port;
+    enum rcc_periph_clken rcc;
+    uint16_t pins;
+} eth_pins_t;
+
+static const eth_pins_t eth_pins[] =
+{
+    {GPIOA, RCC_GPIOA, GPIO1 | GPIO2 | GPIO7},
+    {GPIOB, RCC_GPIOB, GPIO13},
+    {GPIOC, RCC_GPIOC, GPIO1 | GPIO4 | GPIO5},
+    {GPIOG, RCC_GPIOG, GPIO11 | GPIO13},
+};
+
+static eth_tx_desc_t descs[ETH_UDP_DESCRIPTORS] DTCM_FAST_BSS;
+static uint8_t headers[ETH_UDP_DESCRIPTORS][ETH_HEADERS + ETH_UDP_MAX_HEAD]
+    DTCM_FAST_BSS;
+static uint8_t header_template[ETH_HEADERS];
+static uint8_t next_desc = 0;
+static uint16_t ip_id = 0;
+static bool linked = false;
+static bool fast = false;
+static bool full_duplex = false;
+
+static void put_be16(uint8_t * p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value;
+}
+
+static void put_be32(uint8_t * p, uint32_t value)
+{
+    put_be16(p, value >> 16);
+    put_be16(p + 2, value);
+}
+
+static uint16_t smi_read(uint8_t reg)
+{
+    ETH_HW_MACMIIAR = MACMIIAR_PA(ETH_UDP_PHY) | MACMIIAR_MR(reg) |
+                      MACMIIAR_CR_102 | MACMIIAR_MB;
+    while (ETH_HW_MACMIIAR & MACMIIAR_MB);
+    return ETH_HW_MACMIIDR;
+}
+
+static void smi_write(uint8_t reg, uint16_t value)
+{
+    ETH_HW_MACMIIDR = value;
+    ETH_HW_MACMIIAR = MACMIIAR_PA(ETH_UDP_PHY) | MACMIIAR_MR(reg) |
+                      MACMIIAR_CR_102 | MACMIIAR_MW | MACMIIAR_MB;
+    while (ETH_HW_MACMIIAR & MACMIIAR_MB);
+}
+
+/*!
+ * @brief   Waits until all bits of mask are set in a PHY register
+ *
+ * @return  False after timeout in ms
+ */
+static bool phy_wait(uint8_t reg, uint16_t mask, uint32_t timeout)
+{
+    uint64_t start = millis();
+    while ((smi_read(reg) & mask) != mask)
+    {
+        if (millis() - start > timeout)
+        {
+            return false;
+        }
+        delay(10);
+    }
+    return true;
+}
+
+/*!
+ * @brief   Fills headers that are the same for every datagram
+ */
+static void template_setup(const uint8_t mac[6])
+{
+    uint8_t * h = header_template;
+    uint32_t ip = config_store_value(CONFIG_ETH_IP, ETH_UDP_IP);
+    uint32_t collector = config_store_value(CONFIG_ETH_COLLECTOR,
+                                            ETH_UDP_COLLECTOR);
+
+    memset(h, 0xFF, 6);
+    memcpy(&h[6], mac, 6);
+    put_be16(&h[12], 0x0800);       // IPv4
+
+    h[14] = 0x45;                   // Version 4, 5 words of header
+    h[15] = 0;
+    put_be16(&h[20], 0x4000);       // Do not fragment
+    h[22] = 64;                     // TTL
+    h[23] = 17;                     // UDP
+    put_be16(&h[24], 0);            // Checksums are inserted by MAC
+    put_be32(&h[26], ip);
+    put_be32(&h[30], collector);
+
+    put_be16(&h[34], ETH_UDP_PORT);
+    put_be16(&h[36], ETH_UDP_PORT);
+    put_be16(&h[40], 0);
+}
+
+/*!
+ * @brief   Sets up RMII pins, MAC, transmit DMA and the PHY, waits for
+ *          auto-negotiation
+ *
+ * @return  False if MAC does not come out of reset or there is no link,
+ *          sends are then dropped
+ *
+ * @note    Call from main context. Auto-negotiation takes around two
+ *          seconds with a cable, ETH_UDP_LINK_TIMEOUT without one, main()
+ *          calls it while the Lepton boots.
+ */
+bool eth_udp_setup()
+{
+    // Interface is selected while MAC is still in reset
+    rcc_periph_clock_enable(RCC_SYSCFG);
+    ETH_HW_SYSCFG_PMC |= SYSCFG_PMC_RMII;
+
+    for (uint32_t i = 0; i < sizeof(eth_pins) / sizeof(eth_pins[0]); i++)
+    {
+        const eth_pins_t * pins = &eth_pins[i];
+        rcc_periph_clock_enable(pins->rcc);
+        gpio_mode_setup(pins->port, GPIO_MODE_AF, GPIO_PUPD_NONE, pins->pins);
+        gpio_set_output_options(pins->port, GPIO_OTYPE_PP,
+                                GPIO_OSPEED_100MHZ, pins->pins);
+        gpio_set_af(pins->port, GPIO_AF11, pins->pins);
+    }
+
+    rcc_periph_clock_enable(RCC_ETHMAC);
+    rcc_periph_clock_enable(RCC_ETHMACTX);
+    rcc_periph_clock_enable(RCC_ETHMACRX);
+    rcc_periph_reset_pulse(RST_ETHMAC);
+
+    ETH_HW_DMABMR |= DMABMR_SR;
+    uint64_t start = millis();
+    while (ETH_HW_DMABMR & DMABMR_SR)
+    {
+        if (millis() - start > ETH_RESET_TIMEOUT)
+        {
+            printf("Ethernet: no clock from PHY\n");
+            return false;
+        }
+    }
+
+    // Reset bit clears itself within 0.5 ms
+    smi_write(PHY_BCR, PHY_BCR_RESET);
+    start = millis();
+    while ((smi_read(PHY_BCR) & PHY_BCR_RESET) &&
+           millis() - start < ETH_RESET_TIMEOUT);
+    smi_write(PHY_BCR, PHY_BCR_AN | PHY_BCR_AN_RESTART);
+    linked = phy_wait(PHY_BSR, PHY_BSR_AN_DONE | PHY_BSR_LINK,
+                      ETH_UDP_LINK_TIMEOUT);
+    uint16_t pscsr = smi_read(PHY_PSCSR);
+    fast = pscsr & PHY_PSCSR_100;
+    full_duplex = pscsr & PHY_PSCSR_FULL;
+
+    // MAC address from the unique id, with locally administered bit
+    uint32_t uid = MMIO32(ETH_UID_ADDRESS) ^ MMIO32(ETH_UID_ADDRESS + 4) ^
+                   MMIO32(ETH_UID_ADDRESS + 8);
+    uint8_t mac[6] = {0x02, 0x4D, uid >> 24, uid >> 16, uid >> 8, uid};
+    ETH_HW_MACA0HR = (mac[5] << 8) | mac[4];
+    ETH_HW_MACA0LR = ((uint32_t) mac[3] << 24) | (mac[2] << 16) |
+                     (mac[1] << 8) | mac[0];
+    template_setup(mac);
+
+    // Configuration register is written twice, the first write can be
+    // lost while MAC synchronises its clock domains
+    uint32_t maccr = MACCR_TE | (fast ? MACCR_FES : 0) |
+                     (full_duplex ? MACCR_DM : 0);
+    ETH_HW_MACCR = maccr;
+    delay(1);
+    ETH_HW_MACCR = maccr;
+
+    memset(descs, 0, sizeof(descs));
+    next_desc = 0;
+    ETH_HW_DMATDLAR = (uint32_t) descs;
+    ETH_HW_DMABMR = DMABMR_AAB | DMABMR_PBL(32);
+    ETH_HW_DMAOMR = DMAOMR_FTF;
+    while (ETH_HW_DMAOMR & DMAOMR_FTF);
+    ETH_HW_DMAOMR = DMAOMR_TSF | DMAOMR_ST;
+
+    if (!linked)
+    {
+        printf("Ethernet: no link\n");
+    }
+    return linked;
+}
+
+/*!
+ * @brief   Returns true if auto-negotiation of setup found a link
+ */
+bool eth_udp_link()
+{
+    return linked;
+}
+
+/*!
+ * @brief                   Queues one datagram, message header is copied
+ *                          behind UDP header, payload is sent in place
+ *
+ * @param[in] head          Message header, up to ETH_UDP_MAX_HEAD bytes
+ * @param[in] head_len
+ * @param[in] payload       Stays untouched until DMA took it
+ * @param[in] payload_len   Message is up to ETH_UDP_MAX_PAYLOAD bytes
+ *
+ * @return                  False if datagram was dropped
+ *
+ * @note                    Call from main context. Does not wait, a full
+ *                          ring or missing link drops the datagram.
+ */
+bool eth_udp_send(const void * head, uint16_t head_len,
+                  const void * payload, uint16_t payload_len)
+{
+    if (head_len > ETH_UDP_MAX_HEAD ||
+        head_len + payload_len > ETH_UDP_MAX_PAYLOAD)
+    {
+        return false;
+    }
+
+    eth_tx_desc_t * desc = &descs[next_desc];
+    if (!linked || (desc->status & TDES0_OWN))
+    {
+        counter_add(COUNTER_ETH_DROPPED, 1);
+        return false;
+    }
+    if (desc->status & TDES0_ES)
+    {
+        counter_add(COUNTER_ETH_ERRORS, 1);
+    }
+
+    uint8_t * h = headers[next_desc];
+    uint16_t udp_len = 8 + head_len + payload_len;
+    memcpy(h, header_template, ETH_HEADERS);
+    put_be16(&h[ETH_IP_LEN], 20 + udp_len);
+    put_be16(&h[ETH_IP_ID], ip_id++);
+    put_be16(&h[ETH_UDP_LEN], udp_len);
+    memcpy(&h[ETH_HEADERS], head, head_len);
+    dma_buf_clean(payload, payload_len);
+
+    desc->buffer1 = h;
+    desc->buffer2 = payload;
+    desc->sizes = TDES1_SIZES(ETH_HEADERS + head_len, payload_len);
+    uint32_t status = TDES0_OWN | TDES0_FS | TDES0_LS | TDES0_CIC_FULL;
+    if (next_desc == ETH_UDP_DESCRIPTORS - 1)
+    {
+        status |= TDES0_TER;
+    }
+    // Buffers and sizes are written before DMA may take the descriptor
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    desc->status = status;
+    __asm__ volatile ("dsb" ::: "memory");
+    // Resumes DMA if it suspended on a descriptor it did not own
+    ETH_HW_DMATPDR = 0;
+
+    next_desc = (next_desc + 1) % ETH_UDP_DESCRIPTORS;
+    counter_add(COUNTER_ETH_DATAGRAMS, 1);
+    return true;
+}
+
+/*!
+ * @brief   Prints link and addresses, part of STATS
+ */
+void eth_udp_report()
+{
+    const uint8_t * h = header_template;
+    bool up = linked && (smi_read(PHY_BSR) & PHY_BSR_LINK);
+    printf("Ethernet: %s, %s %s duplex, %u.%u.%u.%u to %u.%u.%u.%u:%u\n",
+           up ? "link" : "no link", fast ? "100M" : "10M",
+           full_duplex ? "full" : "half", h[26], h[27], h[28], h[29],
+           h[30], h[31], h[32], h[33], ETH_UDP_PORT);
+}
+#endif
+/*** end of file ***/
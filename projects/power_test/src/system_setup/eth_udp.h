@@ -0,0 +1,42 @@
+#ifndef ETH_UDP_H
+#define ETH_UDP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Define to send telemetry as UDP datagrams over the Ethernet port of
+// Nucleo-F767ZI, LAN8742A PHY on RMII, look at eth_udp.c. Transmit only,
+// there is no ARP, datagrams go to broadcast MAC address, so the
+// collector has to be on the same segment. Messages are the ones of
+// shared/telemetry.h, frames and result records are sent from where they
+// are, without a copy.
+//#define ETH_UDP
+
+#define ETH_UDP_PORT            5005        // Source and destination
+#define ETH_UDP_IP              0xC0A80132  // 192.168.1.50, SET eth_ip
+#define ETH_UDP_COLLECTOR       0xFFFFFFFF  // Broadcast, SET eth_collector
+#define ETH_UDP_PHY             0           // SMI address of LAN8742A
+#define ETH_UDP_LINK_TIMEOUT    3000        // ms for auto-negotiation
+#define ETH_UDP_DESCRIPTORS     8           // Datagrams in flight
+#define ETH_UDP_MAX_HEAD        16          // Message header, copied
+#define ETH_UDP_MAX_PAYLOAD     1472        // Without IP fragmentation
+#define ETH_UDP_FRAME_ROWS      15          // 1200 bytes of 80x60 frame
+
+#ifdef ETH_UDP
+bool eth_udp_setup();
+bool eth_udp_link();
+bool eth_udp_send(const void * head, uint16_t head_len,
+                  const void * payload, uint16_t payload_len);
+void eth_udp_report();
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ETH_UDP_H */
+/*** end of file ***/
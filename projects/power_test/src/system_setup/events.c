@@ -0,0 +1,165 @@
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/cm3/cortex.h>
+#include "events.h"
+#include "sys_init.h"
+#include "utility.h"
+#include "soft_timer.h"
+#include "trace.h"
+#include "log.h"
+#include "background.h"
+
+/* Explanation: main context is cooperative, it runs until it has nothing
+ * to do and then waits in event_wait(). Interrupts (console DMA, FLIR
+ * capture DMA, ...) post events, which wake it up again. Core sleeps in
+ * WFI meanwhile, which is where power_test spends most of the time
+ * between frames.
+ *
+ * Without SYSTICK_TIMER time is kept by DWT cycle counter, which stops
+ * while core sleeps. TIM5 of soft_timer.c bounds every sleep and tells
+ * how long the core slept, so DWT counter is moved forward by that amount
+ * and millis() stays correct. With SYSTICK_TIMER tick interrupt wakes the
+ * core every ms anyway.
+ *
+ * Shell and capture run as tasks of scheduler.c on top of this, which
+ * waits here when none of them is ready. With BACKGROUND_INVOKE the wait
+ * of main context runs the background job instead of WFI, until an event
+ * of its mask is posted, look at background.c.
+ *
+ * STOP mode is not used here, PLL and peripheral clocks would stop with
+ * it, but USART and SPI DMA keep running between frames. Duty cycle of
+ * TRAP command uses it between wake ups, look at stop_mode.c.
+ * */
+
+static volatile uint32_t pending_events = 0;
+
+/*!
+ * @brief               Marks events as pending
+ *
+ * @param[in] events    EVENT_* flags
+ *
+ * @note                Can be called from interrupts.
+ */
+void event_post(uint32_t events)
+{
+    bool masked = cm_mask_interrupts(true);
+    pending_events |= events;
+#ifdef BACKGROUND_INVOKE
+    background_wake(events);
+#endif
+    cm_mask_interrupts(masked);
+}
+
+/*!
+ * @brief               Takes pending events without waiting
+ *
+ * @param[in] mask      EVENT_* flags to take
+ *
+ * @return              Events from mask that were pending, they are
+ *                      cleared
+ */
+uint32_t event_take(uint32_t mask)
+{
+    bool masked = cm_mask_interrupts(true);
+    uint32_t events = pending_events & mask;
+    pending_events &= ~events;
+    cm_mask_interrupts(masked);
+    return events;
+}
+
+/*!
+ * @brief               Sleeps until next interrupt or for max_sleep ms
+ *
+ * @param[in] max_sleep In ms, at most EVENT_MAX_SLEEP
+ *
+ * @note                Has to be called with interrupts masked, pending
+ *                      interrupt wakes core, but it is served only once
+ *                      caller unmasks them.
+ */
+static void sleep_until_interrupt(uint32_t max_sleep)
+{
+#ifdef SYSTICK_TIMER
+    (void) max_sleep;
+    __asm__ volatile ("wfi");
+#else
+    soft_timer_sleep(max_sleep * 1000);
+#endif
+}
+
+/*!
+ * @brief               Waits until any of events in mask is posted
+ *
+ * @param[in] mask      EVENT_* flags that end the wait
+ * @param[in] timeout   In ms or EVENT_FOREVER
+ *
+ * @return              Events from mask that were pending, they are
+ *                      cleared, 0 on timeout
+ *
+ * @note                Events are only a hint that something happened,
+ *                      check the state itself as well, before waiting.
+ *                      If called with interrupts masked, they stay masked
+ *                      and only the timeout ends the wait.
+ */
+uint32_t event_wait(uint32_t mask, uint32_t timeout)
+{
+    uint64_t start = millis();
+
+    while (1)
+    {
+        // Deferred logs are formatted here, where they do not disturb
+        // anything. Trace goes out in batches, events posted meanwhile
+        // end the wait.
+        log_flush();
+        bool trace_left = trace_drain();
+
+        bool masked = cm_mask_interrupts(true);
+
+        uint32_t events = pending_events & mask;
+        if (events)
+        {
+            pending_events &= ~events;
+            cm_mask_interrupts(masked);
+            return events;
+        }
+
+        uint32_t sleep = EVENT_MAX_SLEEP;
+        if (timeout != EVENT_FOREVER)
+        {
+            uint64_t elapsed = millis() - start;
+            if (elapsed >= timeout)
+            {
+                cm_mask_interrupts(masked);
+                return 0;
+            }
+            if (timeout - elapsed < sleep)
+            {
+                sleep = timeout - elapsed;
+            }
+        }
+
+        bool yielded = false;
+#ifdef BACKGROUND_INVOKE
+        // Job runs instead of WFI once interrupts are unmasked below, a
+        // caller that masked them gets the plain sleep
+        yielded = !trace_left && !masked &&
+                  background_yield(mask, sleep * 1000);
+#endif
+        if (!trace_left && !yielded)
+        {
+            sleep_until_interrupt(sleep);
+        }
+
+        // Interrupt that woke us up is served here
+        cm_mask_interrupts(masked);
+    }
+}
+
+/*!
+ * @brief               Sleeps for given time, interrupts are served
+ *
+ * @param[in] duration  In ms
+ */
+void event_sleep(uint32_t duration)
+{
+    event_wait(0, duration);
+}
+/*** end of file ***/
@@ -0,0 +1,39 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Events are posted from interrupts and waited for in main context
+#define EVENT_CONSOLE_LINE      (1 << 0)    // Line is in console queue
+#define EVENT_CAPTURE           (1 << 1)    // FLIR capture changed state
+#define EVENT_REMOTE            (1 << 2)    // Companion MCU answered
+#define EVENT_CRC               (1 << 3)    // DMA block of crc_hw.c is done
+#define EVENT_DMA2D             (1 << 4)    // Transfer of dma2d.c is done
+#define EVENT_CAPTURE_ROW       (1 << 5)    // Image row of FLIR is converted
+#define EVENT_AUDIO             (1 << 6)    // Hop of mic_i2s.c is received
+#define EVENT_CONSOLE_RAW       (1 << 7)    // Binary block of console is in
+#define EVENT_BACKGROUND        (1 << 8)    // Job of background.c returned
+#define EVENT_FLASH             (1 << 9)    // flash_async_* operation ended
+#define EVENT_CAMERA            (1 << 10)   // Frame of dcmi_cam.c is queued
+
+#define EVENT_FOREVER           UINT32_MAX  // Timeout of event_wait()
+
+// Longest single sleep, at most SOFT_TIMER_MAX_SLEEP of soft_timer.h
+#define EVENT_MAX_SLEEP         500         // In ms
+
+void event_post(uint32_t events);
+uint32_t event_take(uint32_t mask);
+uint32_t event_wait(uint32_t mask, uint32_t timeout);
+void event_sleep(uint32_t duration);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENTS_H */
+/*** end of file ***/
@@ -113,17 +113,287 @@ __STATIC_FORCEINLINE void SCB_EnableDCache (void)
 }
 
 
+#define SCB_DCIMVAC     MMIO32(0xE000EF5C)
+#define SCB_DCCMVAC     MMIO32(0xE000EF68)
+#define SCB_DCCIMVAC    MMIO32(0xE000EF70)
+
+/**
+  \brief   D-Cache Invalidate by address
+  \details Invalidates D-Cache for the given address.
+           D-Cache is invalidated starting from a 32 byte aligned address in 32 byte granularity.
+           D-Cache memory blocks which are part of given address + given size are invalidated.
+  \param[in]   addr    address
+  \param[in]   dsize   size of memory block (in number of bytes)
+*/
+__STATIC_FORCEINLINE void SCB_InvalidateDCache_by_Addr (void *addr, int32_t dsize)
+{
+    if ( dsize > 0 ) {
+       int32_t op_size = dsize + (((uint32_t)addr) & (__SCB_DCACHE_LINE_SIZE - 1U));
+      uint32_t op_addr = (uint32_t)addr /* & ~(__SCB_DCACHE_LINE_SIZE - 1U) */;
+
+      __DSB();
+
+      do {
+        SCB_DCIMVAC = op_addr;             /* register accepts only 32byte aligned values, only bits 31..5 are valid */
+        op_addr += __SCB_DCACHE_LINE_SIZE;
+        op_size -= __SCB_DCACHE_LINE_SIZE;
+      } while ( op_size > 0 );
+
+      __DSB();
+      __ISB();
+    }
+}
+
+/**
+  \brief   D-Cache Clean by address
+  \details Cleans D-Cache for the given address
+           D-Cache is cleaned starting from a 32 byte aligned address in 32 byte granularity.
+           D-Cache memory blocks which are part of given address + given size are cleaned.
+  \param[in]   addr    address
+  \param[in]   dsize   size of memory block (in number of bytes)
+*/
+__STATIC_FORCEINLINE void SCB_CleanDCache_by_Addr (void *addr, int32_t dsize)
+{
+    if ( dsize > 0 ) {
+       int32_t op_size = dsize + (((uint32_t)addr) & (__SCB_DCACHE_LINE_SIZE - 1U));
+      uint32_t op_addr = (uint32_t)addr /* & ~(__SCB_DCACHE_LINE_SIZE - 1U) */;
+
+      __DSB();
+
+      do {
+        SCB_DCCMVAC = op_addr;             /* register accepts only 32byte aligned values, only bits 31..5 are valid */
+        op_addr += __SCB_DCACHE_LINE_SIZE;
+        op_size -= __SCB_DCACHE_LINE_SIZE;
+      } while ( op_size > 0 );
+
+      __DSB();
+      __ISB();
+    }
+}
+
+/**
+  \brief   D-Cache Clean and Invalidate by address
+  \details Cleans and invalidates D_Cache for the given address
+           D-Cache is cleaned and invalidated starting from a 32 byte aligned address in 32 byte granularity.
+           D-Cache memory blocks which are part of given address + given size are cleaned and invalidated.
+  \param[in]   addr    address (aligned to 32-byte boundary)
+  \param[in]   dsize   size of memory block (in number of bytes)
+*/
+__STATIC_FORCEINLINE void SCB_CleanInvalidateDCache_by_Addr (void *addr, int32_t dsize)
+{
+    if ( dsize > 0 ) {
+       int32_t op_size = dsize + (((uint32_t)addr) & (__SCB_DCACHE_LINE_SIZE - 1U));
+      uint32_t op_addr = (uint32_t)addr /* & ~(__SCB_DCACHE_LINE_SIZE - 1U) */;
+
+      __DSB();
+
+      do {
+        SCB_DCCIMVAC = op_addr;            /* register accepts only 32byte aligned values, only bits 31..5 are valid */
+        op_addr += __SCB_DCACHE_LINE_SIZE;
+        op_size -= __SCB_DCACHE_LINE_SIZE;
+      } while ( op_size > 0 );
+
+      __DSB();
+      __ISB();
+    }
+}
+
+
+// Same flash can be read through AXIM interface, where it is cached by 
+// L1 D-cache, or through ITCM interface, where it goes through ART 
+// accelerator and does not compete with data in D-cache.
+#define FLASH_AXIM_BASE     0x08000000U
+#define FLASH_ITCM_BASE     0x00200000U
+
+/**
+  \brief   Returns ITCM alias of the constant placed in flash
+  \details Pointer has to point to flash on AXIM interface, that is where 
+           linker puts all constants.
+ */
+__STATIC_FORCEINLINE const void * flash_itcm_alias(const void * addr)
+{
+    return (const void *) ((uint32_t) addr - FLASH_AXIM_BASE + FLASH_ITCM_BASE);
+}
+
+
+/**
+  \brief   Disable I-Cache
+  \details Turns off I-Cache
+  */
+__STATIC_FORCEINLINE void SCB_DisableICache (void)
+{
+    __DSB();
+    __ISB();
+    SCB_CCR &= ~(uint32_t)SCB_CCR_IC_Msk;  /* disable I-Cache */
+    SCB_ICIALLU = 0UL;                     /* invalidate I-Cache */
+    __DSB();
+    __ISB();
+}
+
+#define SCB_DCCISW  MMIO32(0xE000EF74)
+
+/**
+  \brief   Disable D-Cache
+  \details Turns off D-Cache, dirty lines are written back to memory
+  */
+__STATIC_FORCEINLINE void SCB_DisableDCache (void)
+{
+    uint32_t ccsidr;
+    uint32_t sets;
+    uint32_t ways;
+
+    SCB_CSSELR = 0U;                       /* select Level 1 data cache */
+    __DSB();
+
+    SCB_CCR &= ~(uint32_t)SCB_CCR_DC_Msk;  /* disable D-Cache */
+    __DSB();
+
+    ccsidr = SCB_CCSIDR;
+
+                                            /* clean & invalidate D-Cache */
+    sets = (uint32_t)(CCSIDR_SETS(ccsidr));
+    do {
+      ways = (uint32_t)(CCSIDR_WAYS(ccsidr));
+      do {
+        SCB_DCCISW = (((sets << SCB_DCISW_SET_Pos) & SCB_DCISW_SET_Msk) |
+                       ((ways << SCB_DCISW_WAY_Pos) & SCB_DCISW_WAY_Msk)  );
+      } while (ways-- != 0U);
+    } while(sets-- != 0U);
+
+    __DSB();
+    __ISB();
+}
+
+
 #define SET_BIT(REG, BIT)     ((REG) |= (BIT))
 
 #define __HAL_FLASH_ART_ENABLE()  SET_BIT(FLASH_ACR, FLASH_ACR_ARTEN)
 #define __HAL_FLASH_PREFETCH_BUFFER_ENABLE()  (FLASH_ACR |= FLASH_ACR_PRFTEN)
 
-void enable_fastflash()
+// Parts of the memory system that fastflash_set() switches, any 
+// combination can be chosen at run time, look at inference_cache_sweep()
+#define FASTFLASH_ICACHE        (1 << 0)
+#define FASTFLASH_DCACHE        (1 << 1)
+#define FASTFLASH_ART           (1 << 2)
+#define FASTFLASH_PREFETCH      (1 << 3)
+#define FASTFLASH_ALL           0x0F
+#define FASTFLASH_COMBINATIONS  16
+
+/**
+  \brief   Returns FASTFLASH_* bits of parts that are enabled
+ */
+static inline uint8_t fastflash_get()
+{
+    uint8_t config = 0;
+    if (SCB_CCR & SCB_CCR_IC_Msk)       config |= FASTFLASH_ICACHE;
+    if (SCB_CCR & SCB_CCR_DC_Msk)       config |= FASTFLASH_DCACHE;
+    if (FLASH_ACR & FLASH_ACR_ARTEN)    config |= FASTFLASH_ART;
+    if (FLASH_ACR & FLASH_ACR_PRFTEN)   config |= FASTFLASH_PREFETCH;
+    return config;
+}
+
+/**
+  \brief   Enables parts given by FASTFLASH_* bits and disables the rest
+  \details Parts that are already in the wanted state are not touched. 
+           ART is reset before it is enabled again, so it does not return
+           instructions that changed in flash meanwhile. D-cache is 
+           cleaned when it is disabled, so it is safe with DMA buffers too.
+ */
+static inline void fastflash_set(uint8_t config)
+{
+    uint8_t previous = fastflash_get();
+
+    if ((config & FASTFLASH_ICACHE) && !(previous & FASTFLASH_ICACHE))
+    {
+        SCB_EnableICache();
+    }
+    else if (!(config & FASTFLASH_ICACHE) && (previous & FASTFLASH_ICACHE))
+    {
+        SCB_DisableICache();
+    }
+
+    if ((config & FASTFLASH_DCACHE) && !(previous & FASTFLASH_DCACHE))
+    {
+        SCB_EnableDCache();
+    }
+    else if (!(config & FASTFLASH_DCACHE) && (previous & FASTFLASH_DCACHE))
+    {
+        SCB_DisableDCache();
+    }
+
+    if ((config & FASTFLASH_ART) && !(previous & FASTFLASH_ART))
+    {
+        FLASH_ACR |= FLASH_ACR_ARTRST;
+        FLASH_ACR &= ~FLASH_ACR_ARTRST;
+        __HAL_FLASH_ART_ENABLE();
+    }
+    else if (!(config & FASTFLASH_ART))
+    {
+        FLASH_ACR &= ~FLASH_ACR_ARTEN;
+    }
+
+    if (config & FASTFLASH_PREFETCH)
+    {
+        __HAL_FLASH_PREFETCH_BUFFER_ENABLE();
+    }
+    else
+    {
+        FLASH_ACR &= ~FLASH_ACR_PRFTEN;
+    }
+    __DSB();
+    __ISB();
+}
+
+/**
+  \brief   Empties I-cache, D-cache and ART, leaves them enabled
+  \details Next accesses miss everywhere, as the first Invoke() after 
+           boot or wake up from STOP does. Dirty lines are written back 
+           first, so data and DMA buffers stay valid.
+ */
+static inline void fastflash_flush()
+{
+    uint8_t config = fastflash_get();
+
+    if (config & FASTFLASH_DCACHE)
+    {
+        uint32_t ccsidr;
+        uint32_t sets;
+        uint32_t ways;
+
+        SCB_CSSELR = 0U;
+        __DSB();
+        ccsidr = SCB_CCSIDR;
+        sets = (uint32_t)(CCSIDR_SETS(ccsidr));
+        do {
+          ways = (uint32_t)(CCSIDR_WAYS(ccsidr));
+          do {
+            SCB_DCCISW = (((sets << SCB_DCISW_SET_Pos) & SCB_DCISW_SET_Msk) |
+                           ((ways << SCB_DCISW_WAY_Pos) & SCB_DCISW_WAY_Msk)  );
+          } while (ways-- != 0U);
+        } while(sets-- != 0U);
+    }
+
+    __DSB();
+    __ISB();
+    SCB_ICIALLU = 0UL;
+
+    // ART can only be reset while it is disabled
+    if (config & FASTFLASH_ART)
+    {
+        FLASH_ACR &= ~FLASH_ACR_ARTEN;
+        FLASH_ACR |= FLASH_ACR_ARTRST;
+        FLASH_ACR &= ~FLASH_ACR_ARTRST;
+        __HAL_FLASH_ART_ENABLE();
+    }
+    __DSB();
+    __ISB();
+}
+
+// Static, so that cache maintenance functions above can be used from more
+// than one translation unit
+static inline void enable_fastflash()
 {
-    SCB_EnableICache();
-    SCB_EnableDCache();
-    __HAL_FLASH_ART_ENABLE();
-    __HAL_FLASH_PREFETCH_BUFFER_ENABLE();
+    fastflash_set(FASTFLASH_ALL);
 }
 
 #ifdef __cplusplus
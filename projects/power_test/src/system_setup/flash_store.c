@@ -0,0 +1,425 @@
+#include <string.h>
+#include <libopencm3/stm32/flash.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
+#include "flash_store.h"
+#include "fastflash.h"
+#include "crc_hw.h"
+#include "events.h"
+
+/* Explanation: Sector at FLASH_STORE_ADDRESS keeps data that firmware
+ * makes once and reads on later boots, like the prepared interpreter state
+ * of inference.cc. It is read in place through its AXIM address. Contents
+ * are only valid for the firmware that wrote them, writers tag them with
+ * flash_store_image_crc(), CRC-32 of everything the linker put in flash
+ * before the sector.
+ *
+ * Erase of a 256 KB sector takes one to two seconds and programming a
+ * word around 16 us, code runs from the same bank, so the core stalls
+ * on fetches meanwhile and interrupts wait. Only write at boot, before
+ * capture starts. Words are programmed with 32 bit parallelism, supply
+ * is 3.3 V. D-cache keeps lines of the sector from before the write,
+ * they are dropped at the end.
+ *
+ * With nDBANK option bit cleared, set once with a programmer, flash is two
+ * banks of 1 MB and a bank can be read while the other one is written.
+ * Sectors are half as large then, stores are erased by address, so the
+ * same code works with both layouts. flash_async_erase() and
+ * flash_async_program() run from FLASH interrupt, one word or sector per
+ * end of operation, main context and capture keep running meanwhile from
+ * bank 1 when bank 2 is written. In single bank mode they work the same,
+ * but every fetch from flash stalls until the operation is over.
+ * */
+
+#define FLASH_STORE_IMAGE_START 0x08000000U
+#define FLASH_STORE_SR_ERRORS   (FLASH_SR_ERSERR | FLASH_SR_PGPERR | \
+                                 FLASH_SR_PGAERR | FLASH_SR_WRPERR | \
+                                 FLASH_SR_OPERR)
+#define FLASH_BANK_SIZE         (1024 * 1024)
+#define FLASH_NDBANK            (1U << 29)  // FLASH_OPTCR, 0 is dual bank
+#define FLASH_BANK2_SNB         0x10        // SNB of sector 12 in dual bank
+#define FLASH_PSIZE_X32         (FLASH_CR_PROGRAM_X32 << FLASH_CR_PROGRAM_SHIFT)
+
+typedef enum
+{
+    ASYNC_IDLE,
+    ASYNC_ERASE,
+    ASYNC_PROGRAM,
+}async_op_e;
+
+static volatile async_op_e async_op = ASYNC_IDLE;
+static volatile bool async_ok = true;
+static uint32_t async_address;
+static uint32_t async_end;
+static const uint8_t * async_data;
+
+// From the linker script of libopencm3, .data is the last part of image
+extern uint32_t _data_loadaddr, _data, _edata;
+
+static bool flash_ok();
+
+/*!
+ * @brief   Returns start of the sector, memory mapped
+ */
+const void * flash_store_data()
+{
+    return (const void *) FLASH_STORE_ADDRESS;
+}
+
+/*!
+ * @brief   Erases the whole sector, it reads 0xFF afterwards
+ *
+ * @return  False if flash reported an error
+ */
+bool flash_store_erase()
+{
+    return flash_erase(FLASH_STORE_ADDRESS, FLASH_STORE_SIZE);
+}
+
+/*!
+ * @brief               Programs len bytes at offset of erased sector
+ *
+ * @param[in] offset    Multiple of 4
+ * @param[in] data      Source, does not need to be aligned
+ * @param[in] len       Tail that is not a whole word is padded with 0xFF
+ *
+ * @return              False if data does not fit or flash reported an 
+ *                      error
+ */
+bool flash_store_write(uint32_t offset, const void * data, uint32_t len)
+{
+    if ((offset & 3) || offset > FLASH_STORE_SIZE || 
+        len > FLASH_STORE_SIZE - offset)
+    {
+        return false;
+    }
+    return flash_program(FLASH_STORE_ADDRESS + offset, data, len);
+}
+
+/*!
+ * @brief   Tells if flash is in dual bank mode, nDBANK option bit cleared
+ */
+bool flash_dual_bank()
+{
+    return (FLASH_OPTCR & FLASH_NDBANK) == 0;
+}
+
+/*!
+ * @brief               Finds sector that holds address, in the layout of
+ *                      the current bank mode
+ *
+ * @param[in] address   AXIM address
+ * @param[out] snb      Value of SNB field of FLASH_CR
+ * @param[out] start    First address of the sector
+ * @param[out] size     Bytes of the sector
+ *
+ * @return              False if address is not in flash
+ */
+static bool sector_of(uint32_t address, uint8_t * snb, uint32_t * start,
+                      uint32_t * size)
+{
+    uint32_t offset = address - FLASH_STORE_IMAGE_START;
+    uint32_t base = FLASH_STORE_IMAGE_START;
+    // Smallest sector, four of them, one of 4 units, the rest are 8 units
+    uint32_t unit = 32 * 1024;
+    uint8_t bank = 0;
+
+    if (address < FLASH_STORE_IMAGE_START || offset >= 2 * FLASH_BANK_SIZE)
+    {
+        return false;
+    }
+    if (flash_dual_bank())
+    {
+        unit = 16 * 1024;
+        if (offset >= FLASH_BANK_SIZE)
+        {
+            offset -= FLASH_BANK_SIZE;
+            base += FLASH_BANK_SIZE;
+            bank = FLASH_BANK2_SNB;
+        }
+    }
+
+    uint32_t number;
+    if (offset < 4 * unit)
+    {
+        number = offset / unit;
+        *start = base + number * unit;
+        *size = unit;
+    }
+    else if (offset < 8 * unit)
+    {
+        number = 4;
+        *start = base + 4 * unit;
+        *size = 4 * unit;
+    }
+    else
+    {
+        number = 4 + offset / (8 * unit);
+        *start = base + (number - 4) * 8 * unit;
+        *size = 8 * unit;
+    }
+    *snb = bank | number;
+    return true;
+}
+
+/*!
+ * @brief               Erases sectors that cover address to address + len,
+ *                      they read 0xFF afterwards
+ *
+ * @param[in] address   Start of a sector, firmware image must not reach it
+ *
+ * @return              False if address is not a sector start or flash
+ *                      reported an error
+ */
+bool flash_erase(uint32_t address, uint32_t len)
+{
+    uint8_t snb;
+    uint32_t start;
+    uint32_t size;
+
+    if (flash_async_busy() || !sector_of(address, &snb, &start, &size) ||
+        start != address)
+    {
+        return false;
+    }
+
+    flash_unlock();
+    FLASH_SR = FLASH_STORE_SR_ERRORS;
+    for (uint32_t done = 0; done < len; done += size)
+    {
+        if (!sector_of(address + done, &snb, &start, &size))
+        {
+            break;
+        }
+        flash_erase_sector(snb, FLASH_CR_PROGRAM_X32);
+        if (FLASH_SR & FLASH_STORE_SR_ERRORS)
+        {
+            break;
+        }
+    }
+    flash_lock();
+
+    fastflash_flush();
+    return flash_ok();
+}
+
+/*!
+ * @brief               Programs len bytes of erased flash
+ *
+ * @param[in] address   AXIM address, multiple of 4
+ * @param[in] data      Source, does not need to be aligned
+ * @param[in] len       Tail that is not a whole word is padded with 0xFF
+ *
+ * @return              False if flash reported an error or an
+ *                      asynchronous operation runs
+ */
+bool flash_program(uint32_t address, const void * data, uint32_t len)
+{
+    if ((address & 3) || flash_async_busy())
+    {
+        return false;
+    }
+
+    const uint8_t * bytes = (const uint8_t *) data;
+    flash_unlock();
+    FLASH_SR = FLASH_STORE_SR_ERRORS;
+    for (uint32_t i = 0; i < len; i += 4)
+    {
+        uint32_t word = 0xFFFFFFFFU;
+        memcpy(&word, bytes + i, len - i < 4 ? len - i : 4);
+        flash_program_word(address + i, word);
+        if (FLASH_SR & FLASH_STORE_SR_ERRORS)
+        {
+            break;
+        }
+    }
+    flash_lock();
+
+    fastflash_flush();
+    return flash_ok();
+}
+
+/*!
+ * @brief   Starts erase of the next sector or programming of the next word
+ *          of the asynchronous operation
+ *
+ * @return  False if nothing is left
+ */
+static bool async_next()
+{
+    if (async_address >= async_end)
+    {
+        return false;
+    }
+
+    if (async_op == ASYNC_ERASE)
+    {
+        uint8_t snb;
+        uint32_t start;
+        uint32_t size;
+        if (!sector_of(async_address, &snb, &start, &size))
+        {
+            return false;
+        }
+        async_address = start + size;
+        FLASH_CR = FLASH_PSIZE_X32 | FLASH_CR_SER | FLASH_CR_EOPIE |
+                   FLASH_CR_ERRIE | (snb << FLASH_CR_SNB_SHIFT);
+        FLASH_CR |= FLASH_CR_STRT;
+        return true;
+    }
+
+    uint32_t left = async_end - async_address;
+    uint32_t word = 0xFFFFFFFFU;
+    memcpy(&word, async_data, left < 4 ? left : 4);
+    FLASH_CR = FLASH_PSIZE_X32 | FLASH_CR_PG | FLASH_CR_EOPIE | FLASH_CR_ERRIE;
+    MMIO32(async_address) = word;
+    __asm__ volatile ("dsb");
+    async_address += 4;
+    async_data += 4;
+    return true;
+}
+
+/*!
+ * @brief   Unlocks flash and runs the first step of an operation
+ */
+static bool async_start(async_op_e op, uint32_t address, uint32_t len)
+{
+    if (flash_async_busy())
+    {
+        return false;
+    }
+    async_op = op;
+    async_ok = true;
+    async_address = address;
+    async_end = address + len;
+
+    flash_unlock();
+    FLASH_SR = FLASH_STORE_SR_ERRORS | FLASH_SR_EOP;
+    event_take(EVENT_FLASH);
+    nvic_enable_irq(NVIC_FLASH_IRQ);
+    if (!async_next())
+    {
+        async_op = ASYNC_IDLE;
+        flash_lock();
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief               Starts erase of the sectors that cover address to
+ *                      address + len, EVENT_FLASH is posted at the end
+ *
+ * @param[in] address   Start of a sector
+ *
+ * @return              False if another operation runs or address is not
+ *                      a sector start
+ */
+bool flash_async_erase(uint32_t address, uint32_t len)
+{
+    uint8_t snb;
+    uint32_t start;
+    uint32_t size;
+
+    if (!sector_of(address, &snb, &start, &size) || start != address)
+    {
+        return false;
+    }
+    return async_start(ASYNC_ERASE, address, len);
+}
+
+/*!
+ * @brief               Starts programming len bytes of erased flash,
+ *                      EVENT_FLASH is posted at the end
+ *
+ * @param[in] address   AXIM address, multiple of 4
+ * @param[in] data      Source in RAM, it has to stay until the end, tail
+ *                      that is not a whole word is padded with 0xFF
+ *
+ * @return              False if another operation runs
+ */
+bool flash_async_program(uint32_t address, const void * data, uint32_t len)
+{
+    if (address & 3)
+    {
+        return false;
+    }
+    async_data = (const uint8_t *) data;
+    return async_start(ASYNC_PROGRAM, address, len);
+}
+
+/*!
+ * @brief   Tells if an asynchronous operation runs
+ */
+bool flash_async_busy()
+{
+    return async_op != ASYNC_IDLE;
+}
+
+/*!
+ * @brief   Tells if the last asynchronous operation ended without error
+ */
+bool flash_async_ok()
+{
+    return !flash_async_busy() && async_ok;
+}
+
+/*!
+ * @brief   Interrupt handler of flash, end of operation or error
+ *
+ * @note    Function name is important, it is defined in
+ *          libopencm3/include/libopencm3/stm32/f7/nvic.h .
+ */
+void flash_isr()
+{
+    uint32_t status = FLASH_SR;
+    FLASH_SR = status & (FLASH_STORE_SR_ERRORS | FLASH_SR_EOP);
+
+    if (async_op == ASYNC_IDLE)
+    {
+        return;
+    }
+    if (status & FLASH_STORE_SR_ERRORS)
+    {
+        async_ok = false;
+    }
+    else if (async_next())
+    {
+        return;
+    }
+
+    FLASH_CR = 0;
+    flash_lock();
+    fastflash_flush();
+    async_op = ASYNC_IDLE;
+    event_post(EVENT_FLASH);
+}
+
+/*!
+ * @brief   CRC-32 of the firmware image, from vector table to the end of
+ *          .data load image, changes with every build that moves anything
+ *
+ * @note    Around 0.5 ms with DMA for a 300 KB image.
+ */
+uint32_t flash_store_image_crc()
+{
+    uint32_t end = (uint32_t) &_data_loadaddr + 
+                   ((uint32_t) &_edata - (uint32_t) &_data);
+    uint32_t len = end - FLASH_STORE_IMAGE_START;
+    uint32_t crc = 0;
+
+    if (!crc_hw_crc32_dma((const void *) FLASH_STORE_IMAGE_START, len, &crc))
+    {
+        crc = crc_hw_crc32(0, (const void *) FLASH_STORE_IMAGE_START, len);
+    }
+    return crc;
+}
+
+/*!
+ * @brief   Checks error flags of the last erase or program
+ */
+static bool flash_ok()
+{
+    return (FLASH_SR & FLASH_STORE_SR_ERRORS) == 0;
+}
+/*** end of file ***/
@@ -0,0 +1,42 @@
+#ifndef FLASH_STORE_H
+#define FLASH_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Last 256 KB of the 2 MB flash, one sector, two in dual bank mode,
+// firmware must not reach it, see memory_sections.ld
+#define FLASH_STORE_ADDRESS     0x081C0000U
+#define FLASH_STORE_SIZE        (256 * 1024)
+
+// Upper half of flash, it is bank 2 in dual bank mode
+#define FLASH_BANK2_ADDRESS     0x08100000U
+
+const void * flash_store_data();
+bool flash_store_erase();
+bool flash_store_write(uint32_t offset, const void * data, uint32_t len);
+uint32_t flash_store_image_crc();
+
+// Erase and programming of any flash area, for other stores like the one
+// of config_store.h, the same timing notes apply
+bool flash_dual_bank();
+bool flash_erase(uint32_t address, uint32_t len);
+bool flash_program(uint32_t address, const void * data, uint32_t len);
+
+// Same from FLASH interrupt, main context goes on, one at a time
+bool flash_async_erase(uint32_t address, uint32_t len);
+bool flash_async_program(uint32_t address, const void * data, uint32_t len);
+bool flash_async_busy();
+bool flash_async_ok();
+void flash_isr();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FLASH_STORE_H */
+/*** end of file ***/
@@ -0,0 +1,357 @@
+#include <stddef.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/i2c.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/nvic.h>
+#include "i2c_async.h"
+#include "dma_buf.h"
+#include "i2c_timing.h"
+#include "periph_clock.h"
+#include "irq_prio.h"
+
+/* Explanation: transfers on I2C1 are queued and run one after another from
+ * interrupts, caller continues immediately and gets a callback at the end.
+ * Write part is moved by TXIS interrupt, at 400 kHz that is one short
+ * interrupt every 23 us, 9 us at 1 MHz of the Lepton, it is only a
+ * register address or a few command bytes. Read part goes with DMA1
+ * stream 0, channel 1 (I2C1_RX) straight into rx, so a sensor block
+ * costs two interrupts however long it is.
+ *
+ * Write part is sent without AUTOEND, when it is done TC fires and read
+ * part is started with repeated start. Transfer ends with STOPF, which
+ * also follows NACK, so both ways finish in one place.
+ *
+ * Blocking i2c_* functions in utility.c use the same peripheral. They call
+ * i2c_async_hold() first, which waits for the queue to drain and keeps
+ * new transfers queued. Blocking functions return before their STOP is
+ * out, so hold ends in the STOPF interrupt, which starts the queue again.
+ * One that gives up before its STOP calls i2c_async_release().
+ *
+ * Queue is shared with sensors.c tick and the callbacks, all of them on
+ * IRQ_PRIO_IO, so its sections only mask that level and capture
+ * interrupts run through them.
+ * */
+
+#define I2C_ASYNC_INTERRUPTS    (I2C_CR1_TXIE | I2C_CR1_TCIE | \
+                                 I2C_CR1_NACKIE | I2C_CR1_STOPIE | \
+                                 I2C_CR1_ERRIE)
+
+// Read part, bytes are moved by DMA
+#define I2C_ASYNC_READ_INTERRUPTS   (I2C_CR1_NACKIE | I2C_CR1_STOPIE | \
+                                     I2C_CR1_ERRIE)
+
+#define I2C_ASYNC_DMA_FLAGS     (DMA_TCIF | DMA_HTIF | DMA_TEIF | DMA_DMEIF | \
+                                 DMA_FEIF)
+
+static i2c_xfer_t * volatile queue_head = NULL;
+static i2c_xfer_t * queue_tail = NULL;
+
+// Blocking transfer of utility.c owns the bus, queue is not started
+static volatile bool held = false;
+
+static void xfer_start(i2c_xfer_t * xfer);
+static void xfer_start_read(i2c_xfer_t * xfer);
+static void xfer_finish();
+
+/*!
+ * @brief   Prepares DMA1 stream 0 and enables I2C1 interrupts, call after 
+ *          i2c_setup()
+ *
+ * @note    Stream has no interrupt, end of read part is STOPF of I2C1.
+ */
+void i2c_async_setup()
+{
+    periph_clock_acquire(RCC_DMA1);
+    dma_stream_reset(DMA1, DMA_STREAM0);
+    dma_channel_select(DMA1, DMA_STREAM0, DMA_SxCR_CHSEL_1);
+    dma_set_priority(DMA1, DMA_STREAM0, DMA_SxCR_PL_MEDIUM);
+    dma_set_transfer_mode(DMA1, DMA_STREAM0, DMA_SxCR_DIR_PERIPHERAL_TO_MEM);
+    dma_set_peripheral_address(DMA1, DMA_STREAM0, (uint32_t) &I2C_RXDR(I2C1));
+    dma_set_peripheral_size(DMA1, DMA_STREAM0, DMA_SxCR_PSIZE_8BIT);
+    dma_set_memory_size(DMA1, DMA_STREAM0, DMA_SxCR_MSIZE_8BIT);
+    dma_enable_memory_increment_mode(DMA1, DMA_STREAM0);
+
+    nvic_enable_irq(NVIC_I2C1_EV_IRQ);
+    nvic_enable_irq(NVIC_I2C1_ER_IRQ);
+}
+
+/*!
+ * @brief               Adds transfer at the end of the queue
+ *
+ * @param[in] xfer      Transfer, it is owned by the engine until callback
+ *
+ * @return              False if transfer is not valid
+ *
+ * @note                Can be called from callbacks, that is how multi step
+ *                      protocols are chained.
+ */
+bool i2c_async_submit(i2c_xfer_t * xfer)
+{
+    if (!xfer || (!xfer->tx_len && !xfer->rx_len))
+    {
+        return false;
+    }
+
+    xfer->next = NULL;
+    xfer->pos = 0;
+    xfer->failed = false;
+
+    uint32_t masked = irq_lock(IRQ_PRIO_IO);
+    bool idle = queue_head == NULL;
+    if (idle)
+    {
+        queue_head = xfer;
+    }
+    else
+    {
+        queue_tail->next = xfer;
+    }
+    queue_tail = xfer;
+
+    if (idle && !held)
+    {
+        xfer_start(xfer);
+    }
+    irq_unlock(masked);
+    return true;
+}
+
+/*!
+ * @brief   Returns true while any transfer is queued or running
+ */
+bool i2c_async_busy()
+{
+    return queue_head != NULL;
+}
+
+/*!
+ * @brief   Waits until queued transfers are done and keeps the peripheral
+ *          for one blocking transfer, until its STOP
+ *
+ * @note    Call from main context only, utility.c does it before every
+ *          blocking transfer.
+ */
+void i2c_async_hold()
+{
+    while (1)
+    {
+        // STOP of the previous blocking transfer has to be out, its STOPF
+        // would end this hold before it starts
+        uint32_t masked = irq_lock(IRQ_PRIO_IO);
+        if (queue_head == NULL && !(I2C_ISR(I2C1) & I2C_ISR_BUSY))
+        {
+            I2C_ICR(I2C1) = I2C_ICR_STOPCF;
+            held = true;
+            i2c_enable_interrupt(I2C1, I2C_CR1_STOPIE);
+            irq_unlock(masked);
+            return;
+        }
+        irq_unlock(masked);
+    }
+}
+
+/*!
+ * @brief   Ends hold of a blocking transfer that failed before its STOP
+ *
+ * @note    Transfer that still has the bus gets a STOP, its STOPF ends
+ *          the hold as usual. Otherwise queue is started here.
+ */
+void i2c_async_release()
+{
+    uint32_t masked = irq_lock(IRQ_PRIO_IO);
+    if (held)
+    {
+        if (I2C_ISR(I2C1) & I2C_ISR_BUSY)
+        {
+            i2c_send_stop(I2C1);
+        }
+        else
+        {
+            I2C_ICR(I2C1) = I2C_ICR_STOPCF;
+            i2c_disable_interrupt(I2C1, I2C_ASYNC_INTERRUPTS);
+            held = false;
+            if (queue_head)
+            {
+                xfer_start(queue_head);
+            }
+        }
+    }
+    irq_unlock(masked);
+}
+
+/*!
+ * @brief   Starts first part of the transfer
+ */
+static void xfer_start(i2c_xfer_t * xfer)
+{
+    // Bus is idle, previous transfer ended with STOP
+    i2c_timing_select(xfer->addr);
+    if (!xfer->tx_len)
+    {
+        xfer_start_read(xfer);
+        return;
+    }
+
+    I2C_ICR(I2C1) = I2C_ICR_NACKCF | I2C_ICR_STOPCF;
+    i2c_set_7bit_address(I2C1, xfer->addr);
+    i2c_set_write_transfer_dir(I2C1);
+    i2c_set_bytes_to_transfer(I2C1, xfer->tx_len);
+    if (xfer->rx_len)
+    {
+        i2c_disable_autoend(I2C1);
+    }
+    else
+    {
+        i2c_enable_autoend(I2C1);
+    }
+    i2c_enable_interrupt(I2C1, I2C_ASYNC_INTERRUPTS);
+    i2c_send_start(I2C1);
+}
+
+/*!
+ * @brief   Starts read part of the transfer, with repeated start if write
+ *          part was sent before
+ */
+static void xfer_start_read(i2c_xfer_t * xfer)
+{
+    xfer->pos = 0;
+
+    // No dirty line of rx may be written back over received bytes
+    dma_buf_invalidate(xfer->rx, xfer->rx_len);
+    dma_disable_stream(DMA1, DMA_STREAM0);
+    dma_clear_interrupt_flags(DMA1, DMA_STREAM0, I2C_ASYNC_DMA_FLAGS);
+    dma_set_memory_address(DMA1, DMA_STREAM0, (uint32_t) xfer->rx);
+    dma_set_number_of_data(DMA1, DMA_STREAM0, xfer->rx_len);
+    dma_enable_stream(DMA1, DMA_STREAM0);
+
+    i2c_disable_interrupt(I2C1, I2C_ASYNC_INTERRUPTS);
+    i2c_set_7bit_address(I2C1, xfer->addr);
+    i2c_set_read_transfer_dir(I2C1);
+    i2c_set_bytes_to_transfer(I2C1, xfer->rx_len);
+    i2c_enable_autoend(I2C1);
+    I2C_CR1(I2C1) |= I2C_CR1_RXDMAEN;
+    i2c_enable_interrupt(I2C1, I2C_ASYNC_READ_INTERRUPTS);
+    i2c_send_start(I2C1);
+}
+
+/*!
+ * @brief   Stops DMA of the read part and counts received bytes
+ */
+static void xfer_stop_read(i2c_xfer_t * xfer)
+{
+    if (!(I2C_CR1(I2C1) & I2C_CR1_RXDMAEN))
+    {
+        return;
+    }
+
+    // Last byte can still be on its way to memory when STOPF fires
+    while ((I2C_ISR(I2C1) & I2C_ISR_RXNE) && DMA_SNDTR(DMA1, DMA_STREAM0))
+    {
+    }
+
+    I2C_CR1(I2C1) &= ~I2C_CR1_RXDMAEN;
+    dma_disable_stream(DMA1, DMA_STREAM0);
+    xfer->pos = xfer->rx_len - DMA_SNDTR(DMA1, DMA_STREAM0);
+    if (dma_get_interrupt_flag(DMA1, DMA_STREAM0, DMA_TEIF))
+    {
+        xfer->failed = true;
+    }
+    dma_buf_invalidate(xfer->rx, xfer->rx_len);
+}
+
+/*!
+ * @brief   Removes finished transfer from the queue, starts next one and
+ *          calls callback of the finished one
+ *
+ * @note    Next transfer is started before callback, so callback that
+ *          submits a new transfer just queues it.
+ */
+static void xfer_finish()
+{
+    i2c_xfer_t * xfer = queue_head;
+
+    i2c_disable_interrupt(I2C1, I2C_ASYNC_INTERRUPTS);
+    xfer_stop_read(xfer);
+    queue_head = xfer->next;
+    if (queue_head)
+    {
+        xfer_start(queue_head);
+    }
+
+    if (xfer->callback)
+    {
+        xfer->callback(xfer, !xfer->failed);
+    }
+}
+
+void i2c1_ev_isr()
+{
+    i2c_xfer_t * xfer = queue_head;
+    uint32_t isr = I2C_ISR(I2C1);
+
+    if (held)
+    {
+        // Blocking transfer is off the bus
+        if (isr & I2C_ISR_STOPF)
+        {
+            I2C_ICR(I2C1) = I2C_ICR_STOPCF;
+            i2c_disable_interrupt(I2C1, I2C_ASYNC_INTERRUPTS);
+            held = false;
+            if (xfer)
+            {
+                xfer_start(xfer);
+            }
+        }
+        return;
+    }
+
+    if (!xfer)
+    {
+        i2c_disable_interrupt(I2C1, I2C_ASYNC_INTERRUPTS);
+        return;
+    }
+
+    if (isr & I2C_ISR_NACKF)
+    {
+        // Hardware sends STOP after NACK, transfer ends on STOPF
+        I2C_ICR(I2C1) = I2C_ICR_NACKCF;
+        xfer->failed = true;
+    }
+
+    if (isr & I2C_ISR_TXIS)
+    {
+        i2c_send_data(I2C1, xfer->tx[xfer->pos++]);
+    }
+
+    if (isr & I2C_ISR_TC)
+    {
+        // Write part is done, TC stays set until next START
+        xfer_start_read(xfer);
+    }
+
+    if (isr & I2C_ISR_STOPF)
+    {
+        I2C_ICR(I2C1) = I2C_ICR_STOPCF;
+        xfer_stop_read(xfer);
+        if (xfer->rx_len && xfer->pos != xfer->rx_len)
+        {
+            xfer->failed = true;
+        }
+        xfer_finish();
+    }
+}
+
+void i2c1_er_isr()
+{
+    // Bus error, arbitration lost or overrun, peripheral is reset
+    I2C_ICR(I2C1) = I2C_ICR_BERRCF | I2C_ICR_ARLOCF | I2C_ICR_OVRCF;
+    i2c_peripheral_disable(I2C1);
+    i2c_peripheral_enable(I2C1);
+
+    if (queue_head)
+    {
+        queue_head->failed = true;
+        xfer_finish();
+    }
+}
+/*** end of file ***/
@@ -0,0 +1,52 @@
+#ifndef I2C_ASYNC_H
+#define I2C_ASYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Longest write or read part of one transfer
+#define I2C_ASYNC_MAX_BYTES     (255)
+
+typedef struct i2c_xfer i2c_xfer_t;
+
+// Called from I2C1 interrupt when transfer is finished
+typedef void (*i2c_xfer_callback)(i2c_xfer_t * xfer, bool status);
+
+// Write of tx_len bytes, followed by repeated start and read of rx_len
+// bytes, either part can be empty. Transfer has to stay valid until its
+// callback is called. Read part is received with DMA, rx should not share
+// cache lines with data that CPU writes meanwhile, look at dma_buf.h.
+struct i2c_xfer
+{
+    uint8_t addr;               // 7 bit slave address
+    const uint8_t * tx;
+    uint8_t tx_len;
+    uint8_t * rx;
+    uint8_t rx_len;
+    i2c_xfer_callback callback;
+    void * context;             // Free for callback
+
+    // Used by the engine
+    i2c_xfer_t * next;
+    uint8_t pos;
+    bool failed;
+};
+
+void i2c_async_setup();
+bool i2c_async_submit(i2c_xfer_t * xfer);
+bool i2c_async_busy();
+void i2c_async_hold();
+void i2c_async_release();
+void i2c1_ev_isr();
+void i2c1_er_isr();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* I2C_ASYNC_H */
+/*** end of file ***/
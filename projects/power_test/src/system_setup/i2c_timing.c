@@ -0,0 +1,293 @@
+#include <stddef.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/i2c.h>
+#include <libopencm3/cm3/common.h>
+#include <libopencm3/stm32/memorymap.h>
+#include "i2c_timing.h"
+#include "periph_clock.h"
+
+/* Explanation: I2C1 TIMINGR is computed from kernel clock and bus timing
+ * of the I2C specification, the way RM0410 describes it, instead of a
+ * fixed table. For each prescaler, smallest first so that resolution is
+ * the finest, it looks for:
+ * - SCLDEL, data setup after SDA edge: rise + tSU;DAT,
+ * - SDADEL, data hold after SCL falls: at least fall time past the input
+ *   filter, at most tHD;DAT without rise and filter,
+ * - SCLL and SCLH, that meet tLOW and tHIGH and together with the
+ *   synchronization of each edge (edge, analog filter, 2 kernel clocks)
+ *   give period that is not shorter than the one of the speed.
+ * Fm+ with 16 MHz HSI does not fit with analog filter on, its delay eats
+ * the whole hold time, second attempt is without the filter.
+ *
+ * Speeds are kept per slave address. Blocking functions of utility.c and
+ * transfers of i2c_async.c call i2c_timing_select() before START, TIMINGR
+ * can only be written with peripheral disabled, so it is only rewritten
+ * when the address needs another speed. Bus is idle then, disabling
+ * I2C1 only resets its state machine and flags, CR1 and CR2 stay.
+ * */
+
+// Fm+ drive of I2C1 pins, RM0410 SYSCFG_PMC
+#ifndef SYSCFG_PMC
+#define SYSCFG_PMC              MMIO32(SYSCFG_BASE + 0x04)
+#endif
+#define SYSCFG_PMC_I2C1_FMP     (1 << 0)
+
+// Delay of analog filter, datasheet of STM32F767
+#define I2C_AF_MIN_PS           50000
+#define I2C_AF_MAX_PS           260000
+
+typedef struct
+{
+    uint32_t hz;
+    uint32_t low_ps;        // tLOW min
+    uint32_t high_ps;       // tHIGH min
+    uint32_t su_dat_ps;     // tSU;DAT min
+    uint32_t hd_dat_ps;     // tHD;DAT max
+} i2c_spec_t;
+
+// UM10204, table 10
+static const i2c_spec_t specs[I2C_SPEED_END] =
+{
+    [I2C_SPEED_STANDARD]    = {100000,  4700000, 4000000, 250000, 3450000},
+    [I2C_SPEED_FAST]        = {400000,  1300000,  600000, 100000,  900000},
+    [I2C_SPEED_FAST_PLUS]   = {1000000,  500000,  260000,  50000,  450000},
+};
+
+typedef struct
+{
+    uint8_t addr;
+    i2c_speed_t speed;
+} i2c_device_t;
+
+static i2c_device_t devices[I2C_TIMING_MAX_DEVICES];
+static uint8_t num_devices = 0;
+static i2c_timing_t timings[I2C_SPEED_END];
+static i2c_speed_t current_speed = I2C_SPEED_END;
+
+static bool timing_try(uint32_t tclk_ps, const i2c_spec_t * spec,
+                       uint32_t af_min_ps, uint32_t af_max_ps,
+                       i2c_timing_t * timing);
+static void timing_apply(i2c_speed_t speed);
+
+static uint32_t div_up(uint32_t value, uint32_t divider)
+{
+    return (value + divider - 1) / divider;
+}
+
+/*!
+ * @brief               Computes TIMINGR for one speed
+ *
+ * @param[in] kernel_hz Kernel clock of I2C1
+ * @param[out] timing   TIMINGR and analog filter setting
+ *
+ * @return              False if kernel clock is too slow for the speed
+ *
+ * @note                Bus is never faster than the speed, it can be
+ *                      a few percent slower as counters are whole clocks.
+ */
+bool i2c_timing_calc(uint32_t kernel_hz, i2c_speed_t speed,
+                     i2c_timing_t * timing)
+{
+    timing->timingr = 0;
+    timing->analog_filter = true;
+    if (speed >= I2C_SPEED_END || kernel_hz < 1000000)
+    {
+        return false;
+    }
+
+    uint32_t tclk_ps = 1000000000U / (kernel_hz / 1000);
+    if (timing_try(tclk_ps, &specs[speed], I2C_AF_MIN_PS, I2C_AF_MAX_PS,
+                   timing))
+    {
+        return true;
+    }
+    timing->analog_filter = false;
+    return timing_try(tclk_ps, &specs[speed], 0, 0, timing);
+}
+
+/*!
+ * @brief   Searches prescaler and counters with the given filter delay
+ */
+static bool timing_try(uint32_t tclk_ps, const i2c_spec_t * spec,
+                       uint32_t af_min_ps, uint32_t af_max_ps,
+                       i2c_timing_t * timing)
+{
+    const uint32_t rise_ps = I2C_RISE_NS * 1000;
+    const uint32_t fall_ps = I2C_FALL_NS * 1000;
+    const uint32_t period_ps = 1000000000U / (spec->hz / 1000);
+    const uint32_t sync_low_ps = fall_ps + af_min_ps + 2 * tclk_ps;
+    const uint32_t sync_high_ps = rise_ps + af_min_ps + 2 * tclk_ps;
+    const int32_t sdadel_min_ps = (int32_t) fall_ps - (int32_t) af_min_ps -
+                                  3 * (int32_t) tclk_ps;
+    const int32_t sdadel_max_ps = (int32_t) spec->hd_dat_ps -
+                                  (int32_t) rise_ps - (int32_t) af_max_ps -
+                                  4 * (int32_t) tclk_ps;
+
+    for (uint32_t presc = 0; presc < 16; presc++)
+    {
+        uint32_t tpresc_ps = (presc + 1) * tclk_ps;
+
+        uint32_t scldel = div_up(rise_ps + spec->su_dat_ps, tpresc_ps);
+        scldel = scldel ? scldel - 1 : 0;
+        uint32_t sdadel = sdadel_min_ps > 0 ?
+                          div_up((uint32_t) sdadel_min_ps, tpresc_ps) : 0;
+        if (scldel > 15 || sdadel > 15 ||
+            (int32_t) (sdadel * tpresc_ps) > sdadel_max_ps)
+        {
+            continue;
+        }
+
+        uint32_t low = spec->low_ps > sync_low_ps ?
+                       div_up(spec->low_ps - sync_low_ps, tpresc_ps) : 1;
+        uint32_t high = spec->high_ps > sync_high_ps ?
+                        div_up(spec->high_ps - sync_high_ps, tpresc_ps) : 1;
+
+        // Rest of the period is shared in the ratio of minimums
+        uint32_t sync_ps = sync_low_ps + sync_high_ps;
+        uint32_t total = period_ps > sync_ps ?
+                         div_up(period_ps - sync_ps, tpresc_ps) : 0;
+        if (total > low + high)
+        {
+            uint32_t extra = total - low - high;
+            uint32_t extra_low = extra * low / (low + high);
+            low += extra_low;
+            high += extra - extra_low;
+        }
+        if (low > 256 || high > 256)
+        {
+            continue;
+        }
+
+        timing->timingr = (presc << 28) | (scldel << 20) | (sdadel << 16) |
+                          ((high - 1) << 8) | (low - 1);
+        return true;
+    }
+    return false;
+}
+
+/*!
+ * @brief               Computes timing of every speed and sets the
+ *                      default one
+ *
+ * @param[in] kernel_hz Kernel clock of I2C1, look at i2c_setup()
+ *
+ * @note                Call with I2C1 disabled. Speed that kernel clock
+ *                      can not reach uses timing of the next slower one.
+ */
+void i2c_timing_setup(uint32_t kernel_hz)
+{
+    for (uint8_t speed = 0; speed < I2C_SPEED_END; speed++)
+    {
+        if (!i2c_timing_calc(kernel_hz, (i2c_speed_t) speed,
+                             &timings[speed]) && speed > 0)
+        {
+            timings[speed] = timings[speed - 1];
+        }
+    }
+
+    periph_clock_acquire(RCC_SYSCFG);
+    current_speed = I2C_SPEED_END;
+    timing_apply(I2C_DEFAULT_SPEED);
+}
+
+/*!
+ * @brief               Sets speed of one slave, others keep default one
+ *
+ * @param[in] addr      7 bit slave address
+ *
+ * @return              False if there is no room for another device
+ *
+ * @note                Can be called before i2c_setup(), only the table
+ *                      is written. All slaves see the faster bus when
+ *                      another one is addressed, check that they ignore
+ *                      it before mixing speeds.
+ */
+bool i2c_timing_set_device(uint8_t addr, i2c_speed_t speed)
+{
+    if (speed >= I2C_SPEED_END)
+    {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < num_devices; i++)
+    {
+        if (devices[i].addr == addr)
+        {
+            devices[i].speed = speed;
+            return true;
+        }
+    }
+    if (num_devices >= I2C_TIMING_MAX_DEVICES)
+    {
+        return false;
+    }
+    devices[num_devices].addr = addr;
+    devices[num_devices].speed = speed;
+    num_devices++;
+    return true;
+}
+
+/*!
+ * @brief               Switches I2C1 to the speed of the slave
+ *
+ * @note                Call while bus is idle, before START. It is a
+ *                      compare only when speed stays the same.
+ */
+void i2c_timing_select(uint8_t addr)
+{
+    i2c_speed_t speed = I2C_DEFAULT_SPEED;
+    for (uint8_t i = 0; i < num_devices; i++)
+    {
+        if (devices[i].addr == addr)
+        {
+            speed = devices[i].speed;
+            break;
+        }
+    }
+
+    if (speed != current_speed && current_speed != I2C_SPEED_END)
+    {
+        timing_apply(speed);
+    }
+}
+
+/*!
+ * @brief   Writes TIMINGR, filter and Fm+ drive with I2C1 disabled
+ */
+static void timing_apply(i2c_speed_t speed)
+{
+    const i2c_timing_t * timing = &timings[speed];
+    bool enabled = I2C_CR1(I2C1) & I2C_CR1_PE;
+
+    // PE has to stay low for three APB clocks, reads wait for them
+    I2C_CR1(I2C1) &= ~I2C_CR1_PE;
+    while (I2C_CR1(I2C1) & I2C_CR1_PE);
+    (void) I2C_CR1(I2C1);
+    (void) I2C_CR1(I2C1);
+
+    if (timing->analog_filter)
+    {
+        I2C_CR1(I2C1) &= ~I2C_CR1_ANFOFF;
+    }
+    else
+    {
+        I2C_CR1(I2C1) |= I2C_CR1_ANFOFF;
+    }
+    I2C_TIMINGR(I2C1) = timing->timingr;
+
+    if (speed == I2C_SPEED_FAST_PLUS)
+    {
+        SYSCFG_PMC |= SYSCFG_PMC_I2C1_FMP;
+    }
+    else
+    {
+        SYSCFG_PMC &= ~SYSCFG_PMC_I2C1_FMP;
+    }
+
+    if (enabled)
+    {
+        I2C_CR1(I2C1) |= I2C_CR1_PE;
+    }
+    current_speed = speed;
+}
+/*** end of file ***/
@@ -0,0 +1,45 @@
+#ifndef I2C_TIMING_H
+#define I2C_TIMING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+    I2C_SPEED_STANDARD,     // 100 kHz
+    I2C_SPEED_FAST,         // 400 kHz
+    I2C_SPEED_FAST_PLUS,    // 1 MHz, Fm+ drive of PB8 and PB9 is enabled
+    I2C_SPEED_END,
+} i2c_speed_t;
+
+// Speed of every device that has no entry of i2c_timing_set_device()
+#define I2C_DEFAULT_SPEED       I2C_SPEED_FAST
+#define I2C_TIMING_MAX_DEVICES  (4)
+
+// Edges of SCL and SDA on the bus, measure them with a scope when pull-ups
+// change, longer edges give slower but safe timing
+#define I2C_RISE_NS             (100)
+#define I2C_FALL_NS             (10)
+
+typedef struct
+{
+    uint32_t timingr;       // I2C_TIMINGR value, 0 if speed can not be met
+    bool analog_filter;
+} i2c_timing_t;
+
+bool i2c_timing_calc(uint32_t kernel_hz, i2c_speed_t speed,
+                     i2c_timing_t * timing);
+void i2c_timing_setup(uint32_t kernel_hz);
+bool i2c_timing_set_device(uint8_t addr, i2c_speed_t speed);
+void i2c_timing_select(uint8_t addr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* I2C_TIMING_H */
+/*** end of file ***/
@@ -0,0 +1,118 @@
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/scb.h>
+#include <libopencm3/cm3/cortex.h>
+#include "irq_prio.h"
+#include "printf.h"
+
+/* Explanation: every interrupt of the firmware gets its level here, in
+ * one table, before the first nvic_enable_irq(). VoSPI is the only hard
+ * deadline, a packet that is not read before the next one comes loses
+ * the frame and Lepton has to be resynchronised, so VSYNC, SPI1 DMA and
+ * DMA of the second Lepton of flir_port.c are the only ones on
+ * IRQ_PRIO_CAPTURE and preempt everything else. Soft timers come next,
+ * sleeps and timeouts of every driver depend on them.
+ * Console receive is above the rest of the I/O, its DMA ring is short.
+ * I2C, sensors, microphone, CRC and DMA2D all have a DMA or a FIFO that
+ * covers a late interrupt, late one of flash only delays the next word.
+ * DCMI restarts capture in the vertical blanking of the camera, which is
+ * milliseconds long. Temperature bursts only come every THERMAL_PERIOD_MS.
+ * STOP wake lines do nothing but clear a flag.
+ * PendSV switches to the background job and has to be below everything.
+ * A driver for DMA of SD card adds its source here.
+ *
+ * Sections that share data only with interrupts of IRQ_PRIO_TIMER and
+ * below use irq_lock() of the most urgent of them, capture preempts them
+ * and never waits. Data that capture interrupts touch, events.c,
+ * spi_bus.c, crc_hw.c, trace.h, cycle_budget.c and flir.c, keep
+ * cm_mask_interrupts() with PRIMASK, those sections are a few
+ * instructions long.
+ *
+ * With IRQ_LOCK_LATENCY every outermost irq_lock() section is timed with
+ * DWT, the longest one of each level is how late an interrupt just below
+ * it could be served because of the section. Interrupts of a more urgent
+ * level that run meanwhile are counted in, the number is an upper bound.
+ * STATS prints them and starts a new window.
+ * */
+
+typedef struct
+{
+    uint8_t irq;
+    uint8_t level;
+} irq_priority_t;
+
+static const irq_priority_t irq_priorities[] =
+{
+    {NVIC_EXTI3_IRQ,            IRQ_PRIO_CAPTURE},  // flir.c VSYNC
+    {NVIC_DMA2_STREAM0_IRQ,     IRQ_PRIO_CAPTURE},  // spi_bus.c, VoSPI
+    {NVIC_DMA1_STREAM2_IRQ,     IRQ_PRIO_CAPTURE},  // flir_port.c, VoSPI
+    {NVIC_TIM5_IRQ,             IRQ_PRIO_TIMER},    // soft_timer.c
+    {NVIC_SYSTICK_IRQ,          IRQ_PRIO_TIMER},    // SYSTICK_TIMER
+    {NVIC_TIM7_IRQ,             IRQ_PRIO_TIMER},    // pc_sample.c
+    {NVIC_USART2_IRQ,           IRQ_PRIO_CONSOLE},  // uart_ctrl.c
+    {NVIC_DMA1_STREAM5_IRQ,     IRQ_PRIO_CONSOLE},  // uart_ctrl.c
+    {NVIC_USART3_IRQ,           IRQ_PRIO_CONSOLE},  // uart_tx.c
+    {NVIC_I2C1_EV_IRQ,          IRQ_PRIO_IO},       // i2c_async.c
+    {NVIC_I2C1_ER_IRQ,          IRQ_PRIO_IO},
+    {NVIC_TIM6_DAC_IRQ,         IRQ_PRIO_IO},       // sensors.c
+    {NVIC_DMA1_STREAM3_IRQ,     IRQ_PRIO_IO},       // mic_i2s.c
+    {NVIC_EXTI2_IRQ,            IRQ_PRIO_IO},       // remote_link.c
+    {NVIC_DMA2_STREAM1_IRQ,     IRQ_PRIO_IO},       // crc_hw.c
+    {NVIC_DMA2D_IRQ,            IRQ_PRIO_IO},       // dma2d.c
+    {NVIC_FLASH_IRQ,            IRQ_PRIO_IO},       // flash_store.c
+    {NVIC_DCMI_IRQ,             IRQ_PRIO_IO},       // dcmi_cam.c
+    {NVIC_DMA2_STREAM4_IRQ,     IRQ_PRIO_IO},       // thermal_gov.c
+    {NVIC_OTG_FS_IRQ,           IRQ_PRIO_USB},      // usb_cdc.c
+    {NVIC_EXTI15_10_IRQ,        IRQ_PRIO_WAKE},     // stop_mode.c
+    {NVIC_EXTI9_5_IRQ,          IRQ_PRIO_WAKE},
+    {NVIC_PENDSV_IRQ,           IRQ_PRIO_BACKGROUND}, // background.c
+};
+
+#ifdef IRQ_LOCK_LATENCY
+volatile uint32_t irq_lock_max_cycles[IRQ_PRIO_LEVELS];
+volatile uint32_t irq_lock_start;
+#endif
+
+/*!
+ * @brief   Sets priority grouping and level of every interrupt source
+ *
+ * @note    Call first in system_setup(), before any interrupt is enabled.
+ *          Sources that are not in the table stay on level 0.
+ */
+void irq_setup()
+{
+    // All 4 bits are preemption
+    scb_set_priority_grouping(SCB_AIRCR_PRIGROUP_GROUP16_NOSUB);
+    for (uint32_t i = 0; i < sizeof(irq_priorities) / sizeof(irq_priorities[0]);
+         i++)
+    {
+        nvic_set_priority(irq_priorities[i].irq,
+                          irq_priorities[i].level << IRQ_PRIO_SHIFT);
+    }
+}
+
+/*!
+ * @brief   Prints longest irq_lock() section of each level, part of STATS
+ *
+ * @note    Call it from main context only, window starts again.
+ */
+void irq_report()
+{
+#ifdef IRQ_LOCK_LATENCY
+    uint32_t mhz = rcc_ahb_frequency / 1000000;
+    for (uint32_t level = 1; level < IRQ_PRIO_LEVELS; level++)
+    {
+        bool masked = cm_mask_interrupts(true);
+        uint32_t cycles = irq_lock_max_cycles[level];
+        irq_lock_max_cycles[level] = 0;
+        cm_mask_interrupts(masked);
+
+        if (cycles)
+        {
+            printf("IRQ lock level %lu: %lu cycles, %lu us at most\n",
+                   level, cycles, cycles / mhz);
+        }
+    }
+#endif
+}
+/*** end of file ***/
@@ -0,0 +1,101 @@
+#ifndef IRQ_PRIO_H
+#define IRQ_PRIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libopencm3/cm3/dwt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Preemption levels of interrupts, 0 is the most urgent. STM32F7 has 4
+// priority bits and all of them are preemption, there are no sub
+// priorities. Table of sources is irq_priorities[] of irq_prio.c, add new
+// interrupts there, not next to their nvic_enable_irq().
+#define IRQ_PRIO_CAPTURE    0   // VSYNC and SPI1 DMA, VoSPI deadlines
+#define IRQ_PRIO_TIMER      1   // TIM5 soft timers, SysTick, TIM7
+#define IRQ_PRIO_CONSOLE    2   // USART2 receive, USART3 log transmit
+#define IRQ_PRIO_IO         3   // I2C1, sensors, mic, CRC, DMA2D, DCMI, ADC
+#define IRQ_PRIO_USB        4   // USB CDC console
+#define IRQ_PRIO_WAKE       5   // EXTI lines that only wake from STOP
+#define IRQ_PRIO_BACKGROUND 15  // PendSV of background.c, below all
+#define IRQ_PRIO_LEVELS     16
+
+#define IRQ_PRIO_SHIFT      4   // Implemented bits are the upper ones
+
+// Times every outermost irq_lock() section with DWT, STATS prints the
+// longest one of each level, that is how late an interrupt of the level
+// can be served because of it. Comment out to leave sections at two
+// instructions.
+#define IRQ_LOCK_LATENCY
+
+void irq_setup();
+void irq_report();
+
+#ifdef IRQ_LOCK_LATENCY
+// Longest masked time of each irq_lock() level, in DWT cycles
+extern volatile uint32_t irq_lock_max_cycles[IRQ_PRIO_LEVELS];
+extern volatile uint32_t irq_lock_start;
+#endif
+
+/*!
+ * @brief               Masks interrupts of level and every less urgent
+ *                      one with BASEPRI, more urgent ones still run
+ *
+ * @param[in] level     IRQ_PRIO_ level of the most urgent interrupt that
+ *                      touches the data, 1 or more
+ *
+ * @return              Previous mask for irq_unlock()
+ *
+ * @note                Sections only raise the mask, nested ones can use
+ *                      any level. Data that IRQ_PRIO_CAPTURE interrupts
+ *                      touch needs cm_mask_interrupts(), BASEPRI of 0
+ *                      masks nothing. Do not sleep in a section, WFI does
+ *                      not wake for interrupts that BASEPRI masks.
+ */
+static inline uint32_t irq_lock(uint32_t level)
+{
+    uint32_t previous;
+    __asm__ volatile ("mrs %0, basepri" : "=r" (previous));
+    __asm__ volatile ("msr basepri_max, %0"
+                      :: "r" (level << IRQ_PRIO_SHIFT) : "memory");
+#ifdef IRQ_LOCK_LATENCY
+    // Only outermost section is timed, nested ones are part of it
+    if (!previous)
+    {
+        irq_lock_start = DWT_CYCCNT;
+    }
+#endif
+    return previous;
+}
+
+/*!
+ * @brief               Ends section of irq_lock()
+ *
+ * @param[in] previous  What irq_lock() returned
+ */
+static inline void irq_unlock(uint32_t previous)
+{
+#ifdef IRQ_LOCK_LATENCY
+    if (!previous)
+    {
+        uint32_t level;
+        __asm__ volatile ("mrs %0, basepri" : "=r" (level));
+        level >>= IRQ_PRIO_SHIFT;
+        uint32_t cycles = DWT_CYCCNT - irq_lock_start;
+        if (cycles > irq_lock_max_cycles[level])
+        {
+            irq_lock_max_cycles[level] = cycles;
+        }
+    }
+#endif
+    __asm__ volatile ("msr basepri, %0" :: "r" (previous) : "memory");
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IRQ_PRIO_H */
+/*** end of file ***/
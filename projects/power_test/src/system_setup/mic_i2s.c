@@ -0,0 +1,219 @@
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/spi.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/nvic.h>
+#include "mic_i2s.h"
+#include "dma_buf.h"
+#include "events.h"
+#include "trace.h"
+#include "periph_clock.h"
+
+/* Explanation: SPI2 runs as I2S master receiver, Philips standard with
+ * 32 bit channels, of which only the upper 16 bits are read, that is
+ * where 24 bit MEMS microphones put their sample. Both channels are
+ * clocked, mono microphone answers in the left one, right one is
+ * dropped when samples are copied out.
+ *
+ * I2S kernel clock comes from PLLI2S, which shares the input divider of
+ * the main PLL, clock profiles keep that at 1 MHz. VCO of 256 MHz over
+ * R = 2 gives 128 MHz, divided by 64 bit clocks of a frame and 125 that
+ * is exactly 16 kHz. PLLI2S is not touched by clock_switch(), so the
+ * sample rate stays the same in every clock profile.
+ *
+ * DMA1 stream 3, channel 0 (SPI2_RX) runs in circular mode over two
+ * hops, half transfer and transfer complete interrupts post EVENT_AUDIO
+ * when a half is full. mic_i2s_read() copies the oldest full half, DMA
+ * meanwhile fills the other one. Reader that is late by more than a hop
+ * skips to the newest half and the lost hops are counted as overruns.
+ *
+ * SPI2 and DMA1 are configured once in mic_i2s_setup() and clocked only
+ * from mic_i2s_start() to mic_i2s_stop(), DMA1 stays on while
+ * i2c_async.c or uart_ctrl.c hold it.
+ * */
+
+#define PLLI2SCFGR_N_SHIFT      6
+#define PLLI2SCFGR_R_SHIFT      28
+#define RCC_CFGR_I2SSRC_EXT     (1 << 23)
+
+#define MIC_PLLI2S_N            256     // VCO in MHz, input is 1 MHz
+#define MIC_PLLI2S_R            2
+#define MIC_I2S_DIV             62      // 2 * DIV + ODD = 125
+#define MIC_I2S_ODD             1
+
+#define MIC_DMA_FLAGS           (DMA_TCIF | DMA_HTIF | DMA_TEIF | DMA_DMEIF | \
+                                 DMA_FEIF)
+
+// Two halves, each hop of left and right samples
+static int16_t dma_samples[2][MIC_HOP_SAMPLES * 2] DMA_BUFFER;
+_Static_assert(sizeof(dma_samples) % DMA_BUF_ALIGN == 0,
+               "Sample buffer shares a cache line");
+
+// Halves filled by DMA and taken by mic_i2s_read(), they run freely
+static volatile uint32_t filled = 0;
+static uint32_t taken = 0;
+static uint32_t overruns = 0;
+static bool running = false;
+
+/*!
+ * @brief   Sets up pins, PLLI2S, SPI2 as I2S receiver and its DMA stream,
+ *          capture starts with mic_i2s_start()
+ */
+void mic_i2s_setup()
+{
+    rcc_periph_clock_enable(RCC_GPIOB);
+    gpio_mode_setup(MIC_WS_PORT, GPIO_MODE_AF, GPIO_PUPD_NONE, MIC_WS_PIN);
+    gpio_set_af(MIC_WS_PORT, GPIO_AF5, MIC_WS_PIN);
+    gpio_mode_setup(MIC_CK_PORT, GPIO_MODE_AF, GPIO_PUPD_NONE, MIC_CK_PIN);
+    gpio_set_af(MIC_CK_PORT, GPIO_AF5, MIC_CK_PIN);
+    gpio_mode_setup(MIC_SD_PORT, GPIO_MODE_AF, GPIO_PUPD_PULLDOWN, MIC_SD_PIN);
+    gpio_set_af(MIC_SD_PORT, GPIO_AF5, MIC_SD_PIN);
+
+    RCC_CR &= ~RCC_CR_PLLI2SON;
+    while (RCC_CR & RCC_CR_PLLI2SRDY);
+    RCC_PLLI2SCFGR = (RCC_PLLI2SCFGR &
+                      ~((0x1FF << PLLI2SCFGR_N_SHIFT) |
+                        (0x7 << PLLI2SCFGR_R_SHIFT))) |
+                     (MIC_PLLI2S_N << PLLI2SCFGR_N_SHIFT) |
+                     (MIC_PLLI2S_R << PLLI2SCFGR_R_SHIFT);
+    RCC_CFGR &= ~RCC_CFGR_I2SSRC_EXT;
+    RCC_CR |= RCC_CR_PLLI2SON;
+    while (!(RCC_CR & RCC_CR_PLLI2SRDY));
+
+    periph_clock_acquire(RCC_SPI2);
+    SPI_I2SCFGR(SPI2) = 0;
+    SPI_I2SPR(SPI2) = MIC_I2S_DIV | (MIC_I2S_ODD ? SPI_I2SPR_ODD : 0);
+    SPI_I2SCFGR(SPI2) = SPI_I2SCFGR_I2SMOD |
+        (SPI_I2SCFGR_I2SCFG_MASTER_RECEIVE << SPI_I2SCFGR_I2SCFG_LSB) |
+        (SPI_I2SCFGR_I2SSTD_I2S_PHILIPS << SPI_I2SCFGR_I2SSTD_LSB) |
+        (SPI_I2SCFGR_DATLEN_16BIT << SPI_I2SCFGR_DATLEN_LSB) |
+        SPI_I2SCFGR_CHLEN;
+    SPI_CR2(SPI2) |= SPI_CR2_RXDMAEN;
+
+    periph_clock_acquire(RCC_DMA1);
+    dma_stream_reset(DMA1, DMA_STREAM3);
+    dma_channel_select(DMA1, DMA_STREAM3, DMA_SxCR_CHSEL_0);
+    dma_set_priority(DMA1, DMA_STREAM3, DMA_SxCR_PL_HIGH);
+    dma_set_transfer_mode(DMA1, DMA_STREAM3, DMA_SxCR_DIR_PERIPHERAL_TO_MEM);
+    dma_set_peripheral_address(DMA1, DMA_STREAM3, (uint32_t) &SPI_DR(SPI2));
+    dma_set_peripheral_size(DMA1, DMA_STREAM3, DMA_SxCR_PSIZE_16BIT);
+    dma_set_memory_size(DMA1, DMA_STREAM3, DMA_SxCR_MSIZE_16BIT);
+    dma_enable_memory_increment_mode(DMA1, DMA_STREAM3);
+    dma_enable_circular_mode(DMA1, DMA_STREAM3);
+    dma_set_memory_address(DMA1, DMA_STREAM3, (uint32_t) dma_samples);
+    dma_set_number_of_data(DMA1, DMA_STREAM3,
+                           sizeof(dma_samples) / sizeof(int16_t));
+    dma_enable_half_transfer_interrupt(DMA1, DMA_STREAM3);
+    dma_enable_transfer_complete_interrupt(DMA1, DMA_STREAM3);
+    dma_enable_transfer_error_interrupt(DMA1, DMA_STREAM3);
+    nvic_enable_irq(NVIC_DMA1_STREAM3_IRQ);
+    periph_clock_release(RCC_DMA1);
+    periph_clock_release(RCC_SPI2);
+}
+
+/*!
+ * @brief   Starts capture, first hop is ready 20 ms later
+ */
+void mic_i2s_start()
+{
+    if (running)
+    {
+        return;
+    }
+    running = true;
+    periph_clock_acquire(RCC_SPI2);
+    periph_clock_acquire(RCC_DMA1);
+
+    // Nothing dirty may be written back over samples
+    dma_buf_invalidate(dma_samples, sizeof(dma_samples));
+    filled = 0;
+    taken = 0;
+
+    dma_clear_interrupt_flags(DMA1, DMA_STREAM3, MIC_DMA_FLAGS);
+    dma_enable_stream(DMA1, DMA_STREAM3);
+    SPI_I2SCFGR(SPI2) |= SPI_I2SCFGR_I2SE;
+}
+
+/*!
+ * @brief   Stops capture, for example before stop mode
+ */
+void mic_i2s_stop()
+{
+    if (!running)
+    {
+        return;
+    }
+    SPI_I2SCFGR(SPI2) &= ~SPI_I2SCFGR_I2SE;
+    dma_disable_stream(DMA1, DMA_STREAM3);
+    while (DMA_SCR(DMA1, DMA_STREAM3) & DMA_SxCR_EN);
+    periph_clock_release(RCC_DMA1);
+    periph_clock_release(RCC_SPI2);
+    running = false;
+    event_take(EVENT_AUDIO);
+}
+
+/*!
+ * @brief               Copies left channel of the oldest full hop
+ *
+ * @param[out] hop      MIC_HOP_SAMPLES samples
+ *
+ * @return              False if no hop is ready, or if DMA overwrote it
+ *                      while it was copied
+ */
+bool mic_i2s_read(int16_t * hop)
+{
+    uint32_t newest = filled;
+    if (newest == taken)
+    {
+        return false;
+    }
+    if (newest - taken > 1)
+    {
+        overruns += newest - taken - 1;
+        taken = newest - 1;
+    }
+
+    int16_t * half = dma_samples[taken & 1];
+    dma_buf_invalidate(half, sizeof(dma_samples[0]));
+    for (uint32_t i = 0; i < MIC_HOP_SAMPLES; i++)
+    {
+        hop[i] = half[2 * i];
+    }
+    taken++;
+
+    // DMA filled the other half and came back into this one meanwhile
+    if (filled != taken)
+    {
+        overruns++;
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief   Returns number of hops lost since setup, reader was too late
+ */
+uint32_t mic_i2s_overruns()
+{
+    return overruns;
+}
+
+/*!
+ * @brief   Half of the buffer is full, hand it over to main context
+ */
+void dma1_stream3_isr()
+{
+    if (dma_get_interrupt_flag(DMA1, DMA_STREAM3, DMA_TEIF))
+    {
+        dma_clear_interrupt_flags(DMA1, DMA_STREAM3, DMA_TEIF);
+        TRACE(TRACE_AUDIO_ISR, 0);
+    }
+    if (dma_get_interrupt_flag(DMA1, DMA_STREAM3, DMA_HTIF | DMA_TCIF))
+    {
+        dma_clear_interrupt_flags(DMA1, DMA_STREAM3, DMA_HTIF | DMA_TCIF);
+        filled++;
+        event_post(EVENT_AUDIO);
+        TRACE(TRACE_AUDIO_ISR, 1);
+    }
+}
+/*** end of file ***/
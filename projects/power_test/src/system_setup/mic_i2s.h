@@ -0,0 +1,37 @@
+#ifndef MIC_I2S_H
+#define MIC_I2S_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "audio_features.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// I2S microphone on SPI2, like INMP441 or SPH0645 with L/R pin low, look
+// at mic_i2s.c. Samples are received by circular DMA one hop of
+// shared/audio_features.h at a time, the core only copies them out.
+#define MIC_SAMPLE_RATE     AUDIO_SAMPLE_RATE
+#define MIC_HOP_SAMPLES     AUDIO_HOP
+
+#define MIC_WS_PORT         GPIOB   // I2S2_WS, AF5
+#define MIC_WS_PIN          GPIO12
+#define MIC_CK_PORT         GPIOB   // I2S2_CK, AF5
+#define MIC_CK_PIN          GPIO10
+// PC3 would be I2S2_SD as well, but it is FLIR_VSYNC_PIN of flir.h
+#define MIC_SD_PORT         GPIOB   // I2S2_SD, AF5
+#define MIC_SD_PIN          GPIO15
+
+void mic_i2s_setup();
+void mic_i2s_start();
+void mic_i2s_stop();
+bool mic_i2s_read(int16_t * hop);
+uint32_t mic_i2s_overruns();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MIC_I2S_H */
+/*** end of file ***/
@@ -0,0 +1,215 @@
+#include <stddef.h>
+#include "model_slot.h"
+#include "crc_hw.h"
+#include "events.h"
+#include "utility.h"
+#include "printf.h"
+
+#ifdef MODEL_UPDATE
+
+/* Explanation: the 512 KB of bank 2 below config store hold one model
+ * besides the ones linked into firmware in bank 1. An update erases the
+ * slot, programs the model chunk by chunk as the host sends it and checks
+ * CRC-32 of all of it with crc_hw.c, only then the header is programmed.
+ * Header is the first 16 bytes of the slot, model starts at
+ * MODEL_SLOT_HEADER. It is the last thing that is written, so a slot that
+ * was cut by reset or a failed transfer has no valid header and is never
+ * loaded, there is no half new model.
+ *
+ * Erase and programming run from FLASH interrupt, see flash_store.c, in
+ * dual bank mode code, built-in models and the rest of flash are read
+ * from bank 1 meanwhile and the model that is in use keeps classifying.
+ * Slot model itself can not be the one in use while the slot is written,
+ * inference.cc switches to a built-in model before model_slot_begin().
+ * Switch to the new model is one interpreter setup between inferences,
+ * inference_load_model() goes back to the previous model if it fails.
+ *
+ * In single bank mode the same sectors are 8 and 9, update still works,
+ * but fetches stall while flash is busy, seconds for the erase, capture
+ * then has to resynchronise.
+ * */
+
+static uint32_t update_len = 0;         // Bytes of the update, 0 if none
+static uint32_t update_offset = 0;      // Bytes handed to flash so far
+
+static const model_slot_header_t * header()
+{
+    return (const model_slot_header_t *) MODEL_SLOT_ADDRESS;
+}
+
+/*!
+ * @brief   Returns the model of the slot, memory mapped
+ */
+const unsigned char * model_slot_data()
+{
+    return (const unsigned char *) (MODEL_SLOT_ADDRESS + MODEL_SLOT_HEADER);
+}
+
+/*!
+ * @brief               Reads header of the slot
+ *
+ * @param[out] len      Bytes of the model
+ * @param[out] crc32    CRC-32 of the model
+ *
+ * @return              False if slot is empty, incomplete or an update
+ *                      writes it
+ */
+bool model_slot_read(uint32_t * len, uint32_t * crc32)
+{
+    const model_slot_header_t * slot = header();
+    if (update_len || slot->magic != MODEL_SLOT_MAGIC ||
+        slot->len == 0 || slot->len > MODEL_SLOT_SIZE - MODEL_SLOT_HEADER ||
+        crc_hw_crc32(0, slot, offsetof(model_slot_header_t, header_crc)) !=
+            slot->header_crc)
+    {
+        return false;
+    }
+    *len = slot->len;
+    *crc32 = slot->crc32;
+    return true;
+}
+
+/*!
+ * @brief               Starts erase of the slot for a model of len bytes
+ *
+ * @return              False if model does not fit or flash is busy
+ *
+ * @note                Caller makes sure that slot model is not in use.
+ *                      Erase goes on in the background, model_slot_write()
+ *                      waits for it.
+ */
+bool model_slot_begin(uint32_t len)
+{
+    if (len == 0 || len > MODEL_SLOT_SIZE - MODEL_SLOT_HEADER ||
+        !flash_async_erase(MODEL_SLOT_ADDRESS, MODEL_SLOT_SIZE))
+    {
+        return false;
+    }
+    update_len = len;
+    update_offset = 0;
+    return true;
+}
+
+/*!
+ * @brief               Waits for the flash operation of the update
+ *
+ * @return              False if it failed or took too long
+ */
+bool model_slot_wait()
+{
+    uint64_t start = millis();
+    while (flash_async_busy())
+    {
+        uint32_t elapsed = (uint32_t) (millis() - start);
+        if (elapsed >= MODEL_SLOT_ERASE_TIMEOUT)
+        {
+            return false;
+        }
+        event_wait(EVENT_FLASH, MODEL_SLOT_ERASE_TIMEOUT - elapsed);
+    }
+    return flash_async_ok();
+}
+
+/*!
+ * @brief               Programs the next part of the model
+ *
+ * @param[in] data      RAM buffer, it has to stay until the step after,
+ *                      so two buffers take turns
+ * @param[in] len       Multiple of 4, except for the last part
+ *
+ * @return              False if there is no update, part does not fit or
+ *                      the previous step failed
+ */
+bool model_slot_write(const void * data, uint32_t len)
+{
+    if (!update_len || (update_offset & 3) || 
+        len > update_len - update_offset || !model_slot_wait())
+    {
+        return false;
+    }
+    if (!flash_async_program(MODEL_SLOT_ADDRESS + MODEL_SLOT_HEADER + 
+                             update_offset, data, len))
+    {
+        return false;
+    }
+    update_offset += len;
+    return true;
+}
+
+/*!
+ * @brief   Returns bytes of the update that were handed to flash
+ */
+uint32_t model_slot_received()
+{
+    return update_offset;
+}
+
+/*!
+ * @brief               Checks the whole model and programs the header,
+ *                      slot holds the new model afterwards
+ *
+ * @param[in] crc32     CRC-32 of the model, from host
+ *
+ * @return              False if model is not complete or differs, slot
+ *                      stays empty then
+ */
+bool model_slot_commit(uint32_t crc32)
+{
+    if (!update_len || update_offset != update_len || !model_slot_wait())
+    {
+        return false;
+    }
+
+    uint32_t crc = 0;
+    if (!crc_hw_crc32_dma(model_slot_data(), update_len, &crc))
+    {
+        crc = crc_hw_crc32(0, model_slot_data(), update_len);
+    }
+    if (crc != crc32)
+    {
+        printf("Model slot CRC-32 %08lX instead of %08lX\n",
+               (unsigned long) crc, (unsigned long) crc32);
+        return false;
+    }
+
+    model_slot_header_t slot = {
+        .magic = MODEL_SLOT_MAGIC,
+        .len = update_len,
+        .crc32 = crc,
+    };
+    slot.header_crc = crc_hw_crc32(0, &slot,
+                                   offsetof(model_slot_header_t, header_crc));
+    if (!flash_program(MODEL_SLOT_ADDRESS, &slot, sizeof(slot)))
+    {
+        return false;
+    }
+    update_len = 0;
+    return true;
+}
+
+/*!
+ * @brief   Prints state of the slot, part of STATS
+ */
+void model_slot_report()
+{
+    uint32_t len;
+    uint32_t crc;
+    const char * banks = flash_dual_bank() ? "dual" : "single";
+
+    if (update_len)
+    {
+        printf("Model slot: update %lu of %lu bytes, %s bank\n",
+               update_offset, update_len, banks);
+    }
+    else if (model_slot_read(&len, &crc))
+    {
+        printf("Model slot: %lu bytes, CRC-32 %08lX, %s bank\n",
+               len, (unsigned long) crc, banks);
+    }
+    else
+    {
+        printf("Model slot: empty, %s bank\n", banks);
+    }
+}
+#endif
+/*** end of file ***/
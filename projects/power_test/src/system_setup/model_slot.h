@@ -0,0 +1,51 @@
+#ifndef MODEL_SLOT_H
+#define MODEL_SLOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "flash_store.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Define to receive a new model over the console into flash bank 2 while
+// the current one keeps classifying, and switch to it without reset, look
+// at model_slot.c, UPDATE, UPLOAD and COMMIT commands and model_update.py.
+// Flash has to be in dual bank mode, otherwise writes stall capture.
+#define MODEL_UPDATE
+
+// Slot is the bank 2 half below config store, firmware image with its
+// built-in models has to end before it, see memory_sections.ld
+#define MODEL_SLOT_ADDRESS      FLASH_BANK2_ADDRESS
+#define MODEL_SLOT_SIZE         (512 * 1024)
+#define MODEL_SLOT_HEADER       32          // Model follows, 16 B aligned
+#define MODEL_SLOT_MAGIC        0x55444F4DU // "MODU"
+#define MODEL_SLOT_CHUNK        2048        // Bytes of one UPLOAD
+#define MODEL_SLOT_TIMEOUT      5000        // In ms, one chunk
+#define MODEL_SLOT_ERASE_TIMEOUT 20000      // In ms, all sectors of slot
+
+// Written last, slot holds a model only when it is complete
+typedef struct
+{
+    uint32_t magic;
+    uint32_t len;           // Bytes of the model
+    uint32_t crc32;         // Of the model, its id in config_store.h
+    uint32_t header_crc;    // Of the fields above
+}model_slot_header_t;
+
+const unsigned char * model_slot_data();
+bool model_slot_read(uint32_t * len, uint32_t * crc32);
+bool model_slot_begin(uint32_t len);
+bool model_slot_write(const void * data, uint32_t len);
+bool model_slot_wait();
+uint32_t model_slot_received();
+bool model_slot_commit(uint32_t crc32);
+void model_slot_report();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MODEL_SLOT_H */
+/*** end of file ***/
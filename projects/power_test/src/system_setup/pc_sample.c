@@ -0,0 +1,217 @@
+#include <string.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+#include <libopencm3/cm3/nvic.h>
+#include "pc_sample.h"
+#include "periph_clock.h"
+#include "printf.h"
+
+#ifdef PC_SAMPLER
+
+/* Explanation: TIM7 interrupts whatever runs at its rate and counts the
+ * PC that the exception entry stacked, so the histogram is where the core
+ * spends its time, kernels of CMSIS-NN, drivers and the WFI of idle
+ * alike, without any instrumentation. Handler is naked and takes the
+ * frame from MSP or PSP as EXC_RETURN tells, so the background job of
+ * background.c is sampled as well. TIM7 runs on IRQ_PRIO_TIMER, capture
+ * interrupts and TIM5 are not sampled, a sample that falls into them is
+ * taken right after and counted to the code they preempted.
+ *
+ * Histogram is an open addressing table of PC buckets, PC_SAMPLE_SHIFT
+ * bits are dropped, a bucket is found with multiplicative hash and
+ * linear probe. Firmware has far more code than slots, but a profile only
+ * touches a few hundred buckets. Sample that finds no slot in
+ * PC_SAMPLE_PROBES tries is counted as dropped.
+ *
+ * Period gets up to 1/8 of random jitter from an LFSR, so sampling does
+ * not lock to periodic work like the frame loop. Handler takes around 40
+ * cycles, at 2 kHz that is 0.04 % of the core at 216 MHz.
+ *
+ * pc_profile.py reads the PCPROF dump from the console log and names the
+ * buckets with symbols of firmware.elf.
+ * */
+
+#define PC_SAMPLE_SLOTS         (1U << PC_SAMPLE_SLOT_BITS)
+#define PC_SAMPLE_USED          1U      // Thumb PCs are even
+#define PC_SAMPLE_FRAME_PC      6       // Word of stacked PC in the frame
+
+static uint32_t slot_pcs[PC_SAMPLE_SLOTS];
+static uint32_t slot_counts[PC_SAMPLE_SLOTS];
+static volatile uint32_t samples = 0;
+static volatile uint32_t dropped = 0;
+static uint32_t rate = 0;
+static uint32_t period = 0;
+static uint32_t lfsr = 0xACE1U;
+
+void pc_sample_record(const uint32_t * frame) __attribute__((used));
+
+/*!
+ * @brief   Returns TIM7 input clock, it is twice APB1 when APB1 is divided
+ */
+static uint32_t timer_clock()
+{
+    return rcc_apb1_frequency == rcc_ahb_frequency ? rcc_apb1_frequency :
+                                                     2 * rcc_apb1_frequency;
+}
+
+/*!
+ * @brief               Clears histogram and starts sampling
+ *
+ * @param[in] rate_hz   Samples per second, up to PC_SAMPLE_MAX_HZ
+ */
+void pc_sample_start(uint32_t rate_hz)
+{
+    if (rate_hz == 0 || rate_hz > PC_SAMPLE_MAX_HZ)
+    {
+        return;
+    }
+    pc_sample_stop();
+
+    memset(slot_pcs, 0, sizeof(slot_pcs));
+    memset(slot_counts, 0, sizeof(slot_counts));
+    samples = 0;
+    dropped = 0;
+
+    rate = rate_hz;
+    periph_clock_acquire(RCC_TIM7);
+    rcc_periph_reset_pulse(RST_TIM7);
+    timer_enable_preload(TIM7);
+    pc_sample_clock_changed();
+    timer_enable_irq(TIM7, TIM_DIER_UIE);
+    nvic_enable_irq(NVIC_TIM7_IRQ);
+    timer_enable_counter(TIM7);
+}
+
+/*!
+ * @brief   Stops sampling, histogram is kept for pc_sample_dump()
+ */
+void pc_sample_stop()
+{
+    if (!rate)
+    {
+        return;
+    }
+    timer_disable_counter(TIM7);
+    nvic_disable_irq(NVIC_TIM7_IRQ);
+    periph_clock_release(RCC_TIM7);
+    rate = 0;
+}
+
+/*!
+ * @brief   Returns sampling rate, 0 if sampler is stopped
+ */
+uint32_t pc_sample_rate()
+{
+    return rate;
+}
+
+/*!
+ * @brief   Keeps sampling rate after APB1 clock changed
+ *
+ * @note    Called by clock_profile_set() with interrupts masked.
+ */
+void pc_sample_clock_changed()
+{
+    if (!rate)
+    {
+        return;
+    }
+    period = PC_SAMPLE_TIMER_HZ / rate;
+    timer_set_prescaler(TIM7, timer_clock() / PC_SAMPLE_TIMER_HZ - 1);
+    timer_set_period(TIM7, period - 1);
+    // Loads prescaler now, not on the next update
+    timer_generate_event(TIM7, TIM_EGR_UG);
+    timer_clear_flag(TIM7, TIM_SR_UIF);
+}
+
+/*!
+ * @brief   Prints histogram and clears it, lines are "PCPROF <pc> <count>"
+ *          between a header and an end line
+ *
+ * @note    Call from main context. Sampling pauses while it prints.
+ */
+void pc_sample_dump()
+{
+    bool running = rate != 0;
+    if (running)
+    {
+        nvic_disable_irq(NVIC_TIM7_IRQ);
+    }
+
+    printf("PCPROF: %lu samples, %lu dropped, %lu Hz, %u byte buckets\n",
+           samples, dropped, rate, 1U << PC_SAMPLE_SHIFT);
+    for (uint32_t i = 0; i < PC_SAMPLE_SLOTS; i++)
+    {
+        if (slot_pcs[i])
+        {
+            printf("PCPROF %08lx %lu\n", slot_pcs[i] & ~PC_SAMPLE_USED,
+                   slot_counts[i]);
+        }
+    }
+    printf("PCPROF: end\n");
+
+    memset(slot_pcs, 0, sizeof(slot_pcs));
+    memset(slot_counts, 0, sizeof(slot_counts));
+    samples = 0;
+    dropped = 0;
+
+    if (running)
+    {
+        nvic_enable_irq(NVIC_TIM7_IRQ);
+    }
+}
+
+/*!
+ * @brief               Counts PC of the exception frame
+ *
+ * @param[in] frame     Hardware frame of the interrupted context
+ */
+void pc_sample_record(const uint32_t * frame)
+{
+    timer_clear_flag(TIM7, TIM_SR_UIF);
+
+    // Galois LFSR, next period is loaded at the next update
+    lfsr = (lfsr >> 1) ^ (-(lfsr & 1U) & 0xB400U);
+    timer_set_period(TIM7, period - 1 - (lfsr % (period / 8 + 1)));
+
+    uint32_t key = (frame[PC_SAMPLE_FRAME_PC] &
+                    ~((1U << PC_SAMPLE_SHIFT) - 1)) | PC_SAMPLE_USED;
+    uint32_t slot = (key * 2654435761U) >> (32 - PC_SAMPLE_SLOT_BITS);
+    samples++;
+
+    for (uint32_t probe = 0; probe < PC_SAMPLE_PROBES; probe++)
+    {
+        if (slot_pcs[slot] == key)
+        {
+            slot_counts[slot]++;
+            return;
+        }
+        if (!slot_pcs[slot])
+        {
+            slot_pcs[slot] = key;
+            slot_counts[slot] = 1;
+            return;
+        }
+        slot = (slot + 1) & (PC_SAMPLE_SLOTS - 1);
+    }
+    dropped++;
+}
+
+/*!
+ * @brief   Interrupt handler of TIM7, passes the stacked frame on
+ *
+ * @note    Function name is important, it is defined in
+ *          libopencm3/include/libopencm3/stm32/f7/nvic.h .
+ */
+__attribute__((naked)) void tim7_isr()
+{
+    __asm__ volatile (
+        "tst     lr, #4\n"
+        "ite     eq\n"
+        "mrseq   r0, msp\n"
+        "mrsne   r0, psp\n"
+        "b       pc_sample_record\n"
+    );
+}
+#endif
+/*** end of file ***/
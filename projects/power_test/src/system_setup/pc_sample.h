@@ -0,0 +1,40 @@
+#ifndef PC_SAMPLE_H
+#define PC_SAMPLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Statistical profiler, TIM7 interrupt counts the interrupted PC in a
+// histogram, PCPROF shell command starts it and prints it, pc_profile.py
+// resolves it against firmware.elf, look at pc_sample.c. Comment out to
+// leave the table and the command out.
+#define PC_SAMPLER
+
+#define PC_SAMPLE_SLOT_BITS     10      // 1024 distinct buckets, 8 KB
+#define PC_SAMPLE_SHIFT         2       // Bucket is 4 bytes of code
+#define PC_SAMPLE_PROBES        8       // Slots tried before a drop
+#define PC_SAMPLE_DEFAULT_HZ    2000    // PCPROF without running sampler
+#define PC_SAMPLE_TIMER_HZ      1000000 // Counter clock of TIM7
+#define PC_SAMPLE_MAX_HZ        20000
+
+#ifdef PC_SAMPLER
+void pc_sample_start(uint32_t rate_hz);
+void pc_sample_stop();
+uint32_t pc_sample_rate();
+void pc_sample_clock_changed();
+void pc_sample_dump();
+void tim7_isr();
+#else
+#define pc_sample_clock_changed()   ((void) 0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PC_SAMPLE_H */
+/*** end of file ***/
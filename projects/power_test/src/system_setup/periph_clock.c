@@ -0,0 +1,115 @@
+#include <stddef.h>
+#include <stdbool.h>
+#include <libopencm3/cm3/cortex.h>
+#include "periph_clock.h"
+#include "printf.h"
+
+/* Explanation: peripheral clocks are gated by their users, not left
+ * running from setup on. Every user of a peripheral acquires its clock
+ * before it touches the registers and releases it when it is done, the
+ * clock is on while at least one user holds it. DMA1, DMA2 and SYSCFG
+ * have several users, counts keep one of them from gating the clock
+ * under another one. Peripherals keep their registers while they are
+ * gated, so a driver can configure once in setup and only hold the clock
+ * around its transfers, like crc_hw.c, dma2d.c and mic_i2s.c do.
+ *
+ * enum rcc_periph_clken of libopencm3 is offset of the enable register
+ * shifted by 5 plus the bit, counts are indexed the same way. Enable
+ * registers are AHB1ENR to APB2ENR, 0x30 to 0x44, 0x3C is reserved.
+ * Enable register is read back after the write, RCC errata of STM32F7
+ * asks for it before the first access of the peripheral.
+ *
+ * GPIO clocks are enabled as before and never gated, pins keep their
+ * mode only while the port is clocked.
+ * */
+
+#define PERIPH_CLOCK_FIRST_REG  0x30
+#define PERIPH_CLOCK_REGS       6
+
+static uint8_t counts[PERIPH_CLOCK_REGS][32];
+
+static uint8_t * count_of(enum rcc_periph_clken clken)
+{
+    uint32_t reg = (((uint32_t) clken >> 5) - PERIPH_CLOCK_FIRST_REG) / 4;
+    if (reg >= PERIPH_CLOCK_REGS)
+    {
+        return NULL;
+    }
+    return &counts[reg][clken & 31];
+}
+
+/*!
+ * @brief               Takes peripheral clock, enables it for the first
+ *                      user
+ *
+ * @note                Can be called from interrupts.
+ */
+void periph_clock_acquire(enum rcc_periph_clken clken)
+{
+    uint8_t * count = count_of(clken);
+
+    bool masked = cm_mask_interrupts(true);
+    if (!count || (*count)++ == 0)
+    {
+        rcc_periph_clock_enable(clken);
+        (void) MMIO32(RCC_BASE + ((uint32_t) clken >> 5));
+    }
+    cm_mask_interrupts(masked);
+}
+
+/*!
+ * @brief               Gives peripheral clock back, disables it when the
+ *                      last user is gone
+ *
+ * @note                Can be called from interrupts. Release without
+ *                      acquire is ignored.
+ */
+void periph_clock_release(enum rcc_periph_clken clken)
+{
+    uint8_t * count = count_of(clken);
+    if (!count)
+    {
+        return;
+    }
+
+    bool masked = cm_mask_interrupts(true);
+    if (*count && --(*count) == 0)
+    {
+        rcc_periph_clock_disable(clken);
+    }
+    cm_mask_interrupts(masked);
+}
+
+/*!
+ * @brief   Prints enable registers and peripherals that are held, part
+ *          of STATS
+ */
+void periph_clock_report()
+{
+    static const char * const names[PERIPH_CLOCK_REGS] =
+    {
+        "AHB1", "AHB2", "AHB3", NULL, "APB1", "APB2",
+    };
+
+    printf("Clocks:");
+    for (uint32_t reg = 0; reg < PERIPH_CLOCK_REGS; reg++)
+    {
+        if (names[reg])
+        {
+            printf(" %s %08lx", names[reg],
+                   MMIO32(RCC_BASE + PERIPH_CLOCK_FIRST_REG + reg * 4));
+        }
+    }
+    printf("\n");
+
+    uint32_t held = 0;
+    for (uint32_t reg = 0; reg < PERIPH_CLOCK_REGS; reg++)
+    {
+        for (uint32_t bit = 0; bit < 32; bit++)
+        {
+            held += counts[reg][bit] != 0;
+        }
+    }
+    printf("Clocks: %lu peripherals held\n", held);
+}
+/*** end of file ***/
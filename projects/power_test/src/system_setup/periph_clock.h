@@ -0,0 +1,19 @@
+#ifndef PERIPH_CLOCK_H
+#define PERIPH_CLOCK_H
+
+#include <libopencm3/stm32/rcc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void periph_clock_acquire(enum rcc_periph_clken clken);
+void periph_clock_release(enum rcc_periph_clken clken);
+void periph_clock_report();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PERIPH_CLOCK_H */
+/*** end of file ***/
@@ -0,0 +1,337 @@
+#include <libopencm3/cm3/cortex.h>
+#include <stddef.h>
+#include <string.h>
+#include "power_meter.h"
+#include "i2c_async.h"
+#include "soft_timer.h"
+#include "sys_init.h"
+#include "utility.h"
+#include "printf.h"
+
+#ifdef POWER_METER
+
+/* Explanation: INA226 or INA219 measures current through a shunt in the
+ * supply of the board and multiplies it with bus voltage itself, so one
+ * 2 byte read of its power register is a sample. Register pointer is left
+ * at the power register after init, a sample is then a read without a
+ * write. Soft timer submits it every 1 / POWER_METER_RATE_HZ through
+ * i2c_async.c, DMA receives it, and the callback in I2C1 interrupt adds
+ * power times the time since the previous sample to the phase that the
+ * pipeline was in when the read was started. Neither the timer nor the
+ * callback waits on the bus, which is shared with the CCI and
+ * sensors.c, a tick that finds the last read still queued is counted as
+ * an overrun and the next sample covers both intervals.
+ *
+ * Phase is set by TRACE() markers, look at trace_phase() of trace.h, so
+ * energy goes to capture, preprocess, Invoke() and the rest without
+ * calls in the pipeline of its own. Conversion of INA226 with 140 us of
+ * shunt and bus is continuous, INA219 with 532 us, a sample is the last
+ * finished one, so energy lags the markers by one conversion, a few
+ * percent of a phase that takes milliseconds. Phases shorter than that
+ * are of no use. STATS prints per phase time, energy, average power and
+ * energy per entry, the cost of one capture, preprocess or Invoke().
+ * */
+
+#define INA_REG_CONFIG          0x00
+#define INA_REG_CALIBRATION     0x05
+
+#ifdef POWER_METER_INA219
+// 32 V bus, 320 mV shunt range, 12 bit, continuous shunt and bus
+#define INA_CONFIG              0x399F
+#define INA_REG_POWER           0x04
+// Calibration is 0.04096 / (current LSB * shunt), power LSB 20 current LSB
+#define INA_CALIBRATION         (40960000UL / (POWER_METER_CURRENT_UA * \
+                                               POWER_METER_SHUNT_MOHM))
+#define INA_POWER_LSB_UW        (20 * POWER_METER_CURRENT_UA)
+#else
+// No averaging, 140 us shunt and bus conversion, continuous shunt and bus
+#define INA_CONFIG              0x4007
+#define INA_REG_POWER           0x03
+// Calibration is 0.00512 / (current LSB * shunt), power LSB 25 current LSB
+#define INA_CALIBRATION         (5120000UL / (POWER_METER_CURRENT_UA * \
+                                              POWER_METER_SHUNT_MOHM))
+#define INA_POWER_LSB_UW        (25 * POWER_METER_CURRENT_UA)
+#endif
+
+#define POWER_METER_PERIOD_US   (SOFT_TIMER_HZ / POWER_METER_RATE_HZ)
+
+volatile uint8_t power_phase = POWER_PHASE_OTHER;
+volatile uint32_t power_phase_entries[POWER_PHASES];
+
+typedef struct
+{
+    uint64_t energy_pj;         // uW times us
+    uint64_t time_us;
+}phase_energy_t;
+
+static const char * const phase_names[POWER_PHASES] =
+{
+    [POWER_PHASE_OTHER] = "other",
+    [POWER_PHASE_CAPTURE] = "capture",
+    [POWER_PHASE_PREPROCESS] = "preprocess",
+    [POWER_PHASE_INVOKE] = "invoke",
+};
+
+// Register writes of init, the last one leaves the pointer at power
+static const uint8_t init_writes[][3] =
+{
+    {INA_REG_CONFIG, INA_CONFIG >> 8, INA_CONFIG & 0xFF},
+    {INA_REG_CALIBRATION, INA_CALIBRATION >> 8, INA_CALIBRATION & 0xFF},
+    {INA_REG_POWER},
+};
+static const uint8_t init_lens[] = {3, 3, 1};
+#define INIT_STEPS  (sizeof(init_lens) / sizeof(init_lens[0]))
+
+// DMA writes the sample, DTCM is not cached
+static uint8_t sample_rx[2] DTCM_BSS;
+static i2c_xfer_t xfer;
+static soft_timer_t sample_timer;
+static volatile bool running = false;
+static volatile bool busy = false;
+static volatile bool init_failed = false;
+static volatile uint8_t init_step = 0;
+static volatile uint8_t sample_phase = POWER_PHASE_OTHER;
+static volatile uint32_t latest_mw = 0;
+
+// Written by the I2C1 interrupt only
+static phase_energy_t phases[POWER_PHASES];
+static uint64_t last_us = 0;
+static uint64_t window_start_us = 0;
+static uint32_t samples = 0;
+static uint32_t errors = 0;
+static uint32_t overruns = 0;
+
+static void init_done(i2c_xfer_t * done, bool status);
+static void sample_done(i2c_xfer_t * done, bool status);
+
+/*!
+ * @brief       Submits register write of init_step
+ */
+static void init_submit()
+{
+    xfer.addr = POWER_METER_ADDR;
+    xfer.tx = init_writes[init_step];
+    xfer.tx_len = init_lens[init_step];
+    xfer.rx = NULL;
+    xfer.rx_len = 0;
+    xfer.callback = init_done;
+    xfer.context = NULL;
+    i2c_async_submit(&xfer);
+}
+
+/*!
+ * @brief   Chains the next register write, stops at the first failure
+ */
+static void init_done(i2c_xfer_t * done, bool status)
+{
+    (void) done;
+    if (!status)
+    {
+        init_failed = true;
+        busy = false;
+        return;
+    }
+    if (++init_step < INIT_STEPS)
+    {
+        init_submit();
+        return;
+    }
+    busy = false;
+}
+
+/*!
+ * @brief   Starts read of the power register
+ *
+ * @note    Called from TIM5 interrupt.
+ */
+static void sample_start(soft_timer_t * timer)
+{
+    if (!running)
+    {
+        return;
+    }
+    soft_timer_start(timer, POWER_METER_PERIOD_US);
+    if (busy)
+    {
+        overruns++;
+        return;
+    }
+
+    busy = true;
+    sample_phase = power_phase;
+    xfer.addr = POWER_METER_ADDR;
+    xfer.tx = NULL;
+    xfer.tx_len = 0;
+    xfer.rx = sample_rx;
+    xfer.rx_len = sizeof(sample_rx);
+    xfer.callback = sample_done;
+    xfer.context = NULL;
+    i2c_async_submit(&xfer);
+}
+
+/*!
+ * @brief   Adds energy since the previous sample to the phase of this one
+ */
+static void sample_done(i2c_xfer_t * done, bool status)
+{
+    (void) done;
+    busy = false;
+    if (!status)
+    {
+        errors++;
+        return;
+    }
+
+    uint64_t now = micros();
+    uint32_t power_uw = ((uint32_t) sample_rx[0] << 8 | sample_rx[1]) *
+                        INA_POWER_LSB_UW;
+    latest_mw = power_uw / 1000;
+    samples++;
+
+    if (last_us)
+    {
+        phase_energy_t * phase = &phases[sample_phase];
+        uint64_t elapsed = now - last_us;
+        phase->energy_pj += (uint64_t) power_uw * elapsed;
+        phase->time_us += elapsed;
+    }
+    last_us = now;
+}
+
+/*!
+ * @brief   Restarts the window of STATS
+ *
+ * @note    Call with interrupts masked, sample_done() writes the same.
+ */
+static void window_reset()
+{
+    memset(phases, 0, sizeof(phases));
+    for (uint32_t i = 0; i < POWER_PHASES; i++)
+    {
+        power_phase_entries[i] = 0;
+    }
+    samples = 0;
+    errors = 0;
+    overruns = 0;
+    window_start_us = micros();
+}
+
+/*!
+ * @brief   Configures the sensor and starts sampling in the background
+ *
+ * @return  False if the sensor does not answer
+ *
+ * @note    Call after system_setup() and once nothing else holds I2C1 for
+ *          long, after dcmi_cam_setup().
+ */
+bool power_meter_start()
+{
+    sys_require(SYS_PERIPH_I2C);
+    power_meter_stop();
+    while (busy);
+
+    init_failed = false;
+    init_step = 0;
+    busy = true;
+    init_submit();
+    while (busy);
+    if (init_failed)
+    {
+        return false;
+    }
+
+    bool masked = cm_mask_interrupts(true);
+    last_us = 0;
+    latest_mw = 0;
+    window_reset();
+    cm_mask_interrupts(masked);
+    running = true;
+    sample_timer.callback = sample_start;
+    sample_timer.context = NULL;
+    soft_timer_start(&sample_timer, POWER_METER_PERIOD_US);
+    return true;
+}
+
+/*!
+ * @brief   Stops sampling, a read that is queued still finishes
+ */
+void power_meter_stop()
+{
+    if (!running)
+    {
+        return;
+    }
+    running = false;
+    soft_timer_stop(&sample_timer);
+}
+
+/*!
+ * @brief   Returns power of the last sample in mW, 0 before the first one
+ */
+uint32_t power_meter_latest_mw()
+{
+    return latest_mw;
+}
+
+/*!
+ * @brief   Prints energy per phase since the last report and starts a new
+ *          window
+ */
+void power_meter_report()
+{
+    if (!running)
+    {
+        printf("Power: not running\n");
+        return;
+    }
+
+    phase_energy_t copy[POWER_PHASES];
+    uint32_t entries[POWER_PHASES];
+    uint32_t copy_samples;
+    uint32_t copy_errors;
+    uint32_t copy_overruns;
+    uint64_t window_us;
+    bool masked = cm_mask_interrupts(true);
+    memcpy(copy, phases, sizeof(copy));
+    for (uint32_t i = 0; i < POWER_PHASES; i++)
+    {
+        entries[i] = power_phase_entries[i];
+    }
+    copy_samples = samples;
+    copy_errors = errors;
+    copy_overruns = overruns;
+    window_us = micros() - window_start_us;
+    window_reset();
+    cm_mask_interrupts(masked);
+
+    uint64_t total_pj = 0;
+    for (uint32_t i = 0; i < POWER_PHASES; i++)
+    {
+        total_pj += copy[i].energy_pj;
+    }
+    printf("Power: %lu mW now, %lu mJ in %lu ms, %lu samples, %lu errors, "
+           "%lu overruns\n", latest_mw, (uint32_t) (total_pj / 1000000000),
+           (uint32_t) (window_us / 1000), copy_samples, copy_errors,
+           copy_overruns);
+
+    for (uint32_t i = 0; i < POWER_PHASES; i++)
+    {
+        const phase_energy_t * phase = &copy[i];
+        // pJ over us is uW
+        uint32_t average_mw = phase->time_us ?
+            (uint32_t) (phase->energy_pj / phase->time_us / 1000) : 0;
+        printf("%-10s %7lu ms %6lu mW %7lu mJ", phase_names[i],
+               (uint32_t) (phase->time_us / 1000), average_mw,
+               (uint32_t) (phase->energy_pj / 1000000000));
+        if (i != POWER_PHASE_OTHER && entries[i])
+        {
+            printf(", %lu uJ each of %lu",
+                   (uint32_t) (phase->energy_pj / 1000000 / entries[i]),
+                   entries[i]);
+        }
+        printf("\n");
+    }
+}
+
+#endif
+/*** end of file ***/
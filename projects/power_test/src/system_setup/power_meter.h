@@ -0,0 +1,52 @@
+#ifndef POWER_METER_H
+#define POWER_METER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Define with an INA226 or INA219 current sensor in the supply of the
+// board, look at power_meter.c. Its power register is read in the
+// background on I2C1 and energy is added up per phase of the pipeline,
+// which TRACE() markers of trace.h set, STATS prints energy per capture,
+// preprocess and Invoke() and starts a new window.
+//#define POWER_METER
+
+// Define for INA219, INA226 otherwise
+//#define POWER_METER_INA219
+
+#define POWER_METER_ADDR        0x40    // A0 and A1 to GND
+#define POWER_METER_SHUNT_MOHM  100     // Shunt resistor in mOhm
+#define POWER_METER_CURRENT_UA  100     // Current LSB in uA, 3.2 A INA219
+#define POWER_METER_RATE_HZ     2000    // Reads of the power register
+
+// What the core does while a sample is taken, in order of trace.h ids
+typedef enum
+{
+    POWER_PHASE_OTHER,      // Shell, idle, sleep, formatting results
+    POWER_PHASE_CAPTURE,    // Waiting for a frame of the Lepton
+    POWER_PHASE_PREPROCESS, // load_data(), normalize_frame()
+    POWER_PHASE_INVOKE,     // Classifier or gate
+    POWER_PHASES,
+} power_phase_t;
+
+#ifdef POWER_METER
+// Written by TRACE() markers, look at trace_phase() of trace.h
+extern volatile uint8_t power_phase;
+extern volatile uint32_t power_phase_entries[POWER_PHASES];
+
+bool power_meter_start();
+void power_meter_stop();
+uint32_t power_meter_latest_mw();
+void power_meter_report();
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* POWER_METER_H */
+/*** end of file ***/
@@ -0,0 +1,281 @@
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include "qspi_flash.h"
+#include "periph_clock.h"
+#include "utility.h"
+#include "printf.h"
+
+#ifdef QSPI_MODEL
+
+/* Explanation: QUADSPI maps the external flash into the address space at
+ * QSPI_FLASH_ADDRESS, every read there turns into a quad output fast read
+ * 0xEB of the chip, so a model linked into .qspi_rodata is used in place
+ * by GetModel() as if it was in internal flash, nothing is copied to
+ * RAM. The chip is reset, its quad enable bit set and its id read with
+ * indirect commands first, mapped mode is entered only if all of them
+ * work, an access to the region without it faults. qspi_flash_ready()
+ * tells the rest of the firmware whether the model is there.
+ *
+ * Timeout counter stays off, so after a read the controller keeps chip
+ * select low and goes on fetching the next bytes into its FIFO. A read
+ * that continues where the previous one ended is served from there
+ * without a new command, address and dummy cycles, which is how weights
+ * are read when layout_weights.py put every layer in execution order.
+ * A jump elsewhere aborts the prefetch and costs the whole command. MPU
+ * region makes it read only and write-through cached like internal
+ * flash, so L1 D-cache and its line fills stay in front of it.
+ *
+ * Clock is HCLK / (QSPI_FLASH_PRESCALER + 1), 72 MHz at 216 MHz, slower
+ * clock profiles only make it slower. Clock of QUADSPI is acquired once
+ * and never released, mapped reads can come at any time.
+ * */
+
+#ifndef QUADSPI_BASE
+#define QUADSPI_BASE            0xA0001000U
+#endif
+
+#define QSPI_HW_CR              MMIO32(QUADSPI_BASE + 0x00)
+#define QSPI_HW_DCR             MMIO32(QUADSPI_BASE + 0x04)
+#define QSPI_HW_SR              MMIO32(QUADSPI_BASE + 0x08)
+#define QSPI_HW_FCR             MMIO32(QUADSPI_BASE + 0x0C)
+#define QSPI_HW_DLR             MMIO32(QUADSPI_BASE + 0x10)
+#define QSPI_HW_CCR             MMIO32(QUADSPI_BASE + 0x14)
+#define QSPI_HW_ABR             MMIO32(QUADSPI_BASE + 0x1C)
+#define QSPI_HW_DR8             MMIO8(QUADSPI_BASE + 0x20)
+#define QSPI_HW_PSMKR           MMIO32(QUADSPI_BASE + 0x24)
+#define QSPI_HW_PSMAR           MMIO32(QUADSPI_BASE + 0x28)
+#define QSPI_HW_PIR             MMIO32(QUADSPI_BASE + 0x2C)
+
+#define QSPI_HW_CR_EN           (1 << 0)
+#define QSPI_HW_CR_ABORT        (1 << 1)
+#define QSPI_HW_CR_SSHIFT       (1 << 4)
+#define QSPI_HW_CR_FTHRES(n)    (((n) - 1) << 8)
+#define QSPI_HW_CR_APMS         (1 << 22)
+#define QSPI_HW_CR_PRESCALER(n) ((n) << 24)
+
+#define QSPI_HW_DCR_CSHT(n)     (((n) - 1) << 8)
+#define QSPI_HW_DCR_FSIZE(n)    ((__builtin_ctz(n) - 1) << 16)
+
+#define QSPI_HW_SR_TEF          (1 << 0)
+#define QSPI_HW_SR_TCF          (1 << 1)
+#define QSPI_HW_SR_FTF          (1 << 2)
+#define QSPI_HW_SR_SMF          (1 << 3)
+#define QSPI_HW_SR_BUSY         (1 << 5)
+#define QSPI_HW_FCR_ALL         (0x1B)
+
+// Fields of CCR, lines are 1 for single, 3 for quad
+#define CCR_INST(i)             (i)
+#define CCR_IMODE(l)            ((l) << 8)
+#define CCR_ADMODE(l)           ((l) << 10)
+#define CCR_ADSIZE_24           (2 << 12)
+#define CCR_ABMODE(l)           ((l) << 14)
+#define CCR_ABSIZE_8            (0 << 16)
+#define CCR_DCYC(n)             ((n) << 18)
+#define CCR_DMODE(l)            ((l) << 24)
+#define CCR_FMODE_WRITE         (0 << 26)
+#define CCR_FMODE_READ          (1 << 26)
+#define CCR_FMODE_POLL          (2 << 26)
+#define CCR_FMODE_MAPPED        (3 << 26)
+#define LINES_1                 1
+#define LINES_4                 3
+
+// Commands of W25Q and compatible chips
+#define CMD_RESET_ENABLE        0x66
+#define CMD_RESET               0x99
+#define CMD_READ_ID             0x9F
+#define CMD_WRITE_ENABLE        0x06
+#define CMD_READ_STATUS1        0x05
+#define CMD_READ_STATUS2        0x35
+#define CMD_WRITE_STATUS2       0x31
+#define CMD_QUAD_IO_READ        0xEB
+#define STATUS1_BUSY            (1 << 0)
+#define STATUS2_QE              (1 << 1)
+#define MODE_NO_CONTINUOUS      0xFF        // Every read sends 0xEB
+
+static bool ready = false;
+static uint32_t jedec_id = 0;
+
+/*!
+ * @brief           Waits for flags of SR, clears them afterwards
+ *
+ * @return          False on timeout or transfer error
+ */
+static bool wait_flags(uint32_t flags)
+{
+    uint64_t start = micros();
+    while (!(QSPI_HW_SR & flags))
+    {
+        if (QSPI_HW_SR & QSPI_HW_SR_TEF ||
+            micros() - start > QSPI_FLASH_TIMEOUT * 1000)
+        {
+            QSPI_HW_CR |= QSPI_HW_CR_ABORT;
+            QSPI_HW_FCR = QSPI_HW_FCR_ALL;
+            return false;
+        }
+    }
+    QSPI_HW_FCR = QSPI_HW_FCR_ALL;
+    return true;
+}
+
+/*!
+ * @brief                   Runs an indirect command of one line with
+ *                          len bytes of data, none for 0
+ *
+ * @param[in] inst          Command byte
+ * @param[in,out] data      Bytes to send, or buffer of read ones
+ * @param[in] read          Direction of data
+ *
+ * @return                  False on timeout
+ */
+static bool command(uint8_t inst, uint8_t * data, uint32_t len, bool read)
+{
+    while (QSPI_HW_SR & QSPI_HW_SR_BUSY);
+
+    uint32_t ccr = CCR_INST(inst) | CCR_IMODE(LINES_1) |
+                   (read ? CCR_FMODE_READ : CCR_FMODE_WRITE);
+    if (len)
+    {
+        QSPI_HW_DLR = len - 1;
+        ccr |= CCR_DMODE(LINES_1);
+    }
+    // Read without address starts here, write when data is in the FIFO
+    QSPI_HW_CCR = ccr;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        if (!wait_flags(QSPI_HW_SR_FTF | QSPI_HW_SR_TCF))
+        {
+            return false;
+        }
+        if (read)
+        {
+            data[i] = QSPI_HW_DR8;
+        }
+        else
+        {
+            QSPI_HW_DR8 = data[i];
+        }
+    }
+    return wait_flags(QSPI_HW_SR_TCF);
+}
+
+/*!
+ * @brief   Waits until the chip finished a status register write
+ */
+static bool wait_idle()
+{
+    QSPI_HW_PSMKR = STATUS1_BUSY;
+    QSPI_HW_PSMAR = 0;
+    QSPI_HW_PIR = 16;
+    QSPI_HW_DLR = 0;
+    QSPI_HW_CR |= QSPI_HW_CR_APMS;
+    QSPI_HW_CCR = CCR_INST(CMD_READ_STATUS1) | CCR_IMODE(LINES_1) |
+                  CCR_DMODE(LINES_1) | CCR_FMODE_POLL;
+    return wait_flags(QSPI_HW_SR_SMF);
+}
+
+/*!
+ * @brief   Sets quad enable bit of status register 2 unless it is set
+ *
+ * @note    Bit is non-volatile, so it is written once in the life of the
+ *          chip, later boots only read it.
+ */
+static bool quad_enable()
+{
+    uint8_t status;
+    if (!command(CMD_READ_STATUS2, &status, 1, true))
+    {
+        return false;
+    }
+    if (status & STATUS2_QE)
+    {
+        return true;
+    }
+    status |= STATUS2_QE;
+    return command(CMD_WRITE_ENABLE, NULL, 0, false) &&
+           command(CMD_WRITE_STATUS2, &status, 1, false) && wait_idle();
+}
+
+/*!
+ * @brief           Sets up pins and QUADSPI, resets the chip and maps it
+ *                  at QSPI_FLASH_ADDRESS
+ *
+ * @return          False if the chip does not answer, region stays
+ *                  unmapped and qspi_flash_ready() false
+ *
+ * @note            Call from system_setup() after mpu_setup(), before
+ *                  anything reads the region.
+ */
+bool qspi_flash_setup()
+{
+    rcc_periph_clock_enable(RCC_GPIOB);
+    rcc_periph_clock_enable(RCC_GPIOF);
+    gpio_mode_setup(QSPI_NCS_PORT, GPIO_MODE_AF, GPIO_PUPD_PULLUP,
+                    QSPI_NCS_PIN);
+    gpio_set_af(QSPI_NCS_PORT, GPIO_AF10, QSPI_NCS_PIN);
+    gpio_mode_setup(QSPI_CLK_PORT, GPIO_MODE_AF, GPIO_PUPD_NONE,
+                    QSPI_CLK_PIN);
+    gpio_set_af(QSPI_CLK_PORT, GPIO_AF9, QSPI_CLK_PIN);
+    gpio_mode_setup(QSPI_IO_PORT, GPIO_MODE_AF, GPIO_PUPD_NONE,
+                    QSPI_IO01_PINS | QSPI_IO23_PINS);
+    gpio_set_af(QSPI_IO_PORT, GPIO_AF10, QSPI_IO01_PINS);
+    gpio_set_af(QSPI_IO_PORT, GPIO_AF9, QSPI_IO23_PINS);
+    gpio_set_output_options(QSPI_NCS_PORT, GPIO_OTYPE_PP,
+                            GPIO_OSPEED_100MHZ, QSPI_NCS_PIN);
+    gpio_set_output_options(QSPI_IO_PORT, GPIO_OTYPE_PP, GPIO_OSPEED_100MHZ,
+                            QSPI_CLK_PIN | QSPI_IO01_PINS | QSPI_IO23_PINS);
+
+    periph_clock_acquire(RCC_QSPI);
+    QSPI_HW_CR = 0;
+    QSPI_HW_DCR = QSPI_HW_DCR_FSIZE(QSPI_FLASH_SIZE) | QSPI_HW_DCR_CSHT(2);
+    // Sample shift of half a cycle gives data time to settle at 72 MHz
+    QSPI_HW_CR = QSPI_HW_CR_PRESCALER(QSPI_FLASH_PRESCALER) |
+                 QSPI_HW_CR_FTHRES(1) | QSPI_HW_CR_SSHIFT | QSPI_HW_CR_EN;
+
+    uint8_t id[3] = {0};
+    bool ok = command(CMD_RESET_ENABLE, NULL, 0, false) &&
+              command(CMD_RESET, NULL, 0, false);
+    delay_us(50);
+    ok = ok && command(CMD_READ_ID, id, sizeof(id), true);
+    jedec_id = ((uint32_t) id[0] << 16) | (id[1] << 8) | id[2];
+    // Missing chip reads as all zeroes or all ones
+    ok = ok && jedec_id != 0 && jedec_id != 0xFFFFFF && quad_enable();
+    if (!ok)
+    {
+        QSPI_HW_CR = 0;
+        return false;
+    }
+
+    QSPI_HW_ABR = MODE_NO_CONTINUOUS;
+    QSPI_HW_CCR = CCR_INST(CMD_QUAD_IO_READ) | CCR_IMODE(LINES_1) |
+                  CCR_ADMODE(LINES_4) | CCR_ADSIZE_24 |
+                  CCR_ABMODE(LINES_4) | CCR_ABSIZE_8 |
+                  CCR_DCYC(QSPI_FLASH_DUMMY) | CCR_DMODE(LINES_4) |
+                  CCR_FMODE_MAPPED;
+    ready = true;
+    return true;
+}
+
+/*!
+ * @brief   Tells if the region is mapped and can be read
+ */
+bool qspi_flash_ready()
+{
+    return ready;
+}
+
+/*!
+ * @brief   Prints state of QSPI flash, part of STATS
+ */
+void qspi_flash_report()
+{
+    if (!ready)
+    {
+        printf("QSPI: no flash, id %06lX\n", jedec_id);
+        return;
+    }
+    printf("QSPI: id %06lX, %u KB mapped at %08lX, %lu MHz\n", jedec_id,
+           QSPI_FLASH_SIZE / 1024, QSPI_FLASH_ADDRESS,
+           rcc_ahb_frequency / (QSPI_FLASH_PRESCALER + 1) / 1000000);
+}
+#endif
+/*** end of file ***/
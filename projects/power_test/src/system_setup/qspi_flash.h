@@ -0,0 +1,45 @@
+#ifndef QSPI_FLASH_H
+#define QSPI_FLASH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Define to map an external QSPI NOR flash at QSPI_FLASH_ADDRESS and run
+// the model linked there in place, look at qspi_flash.c and BLOBS in
+// project.mk. Nucleo-F767ZI has no QSPI flash, a W25Q128 or another chip
+// with quad output fast read 0xEB is wired to the pins below.
+//#define QSPI_MODEL
+
+#define QSPI_FLASH_ADDRESS      0x90000000U
+#define QSPI_FLASH_SIZE         (16 * 1024 * 1024)
+#define QSPI_FLASH_PRESCALER    2           // 216 MHz / 3 = 72 MHz
+#define QSPI_FLASH_DUMMY        4           // Cycles after mode byte of 0xEB
+#define QSPI_FLASH_TIMEOUT      10          // In ms, one indirect command
+
+// Pins, bank 1 of QUADSPI, none of them is used by anything else
+#define QSPI_CLK_PORT           GPIOF       // PF10, AF9
+#define QSPI_CLK_PIN            GPIO10
+#define QSPI_NCS_PORT           GPIOB       // PB6, AF10
+#define QSPI_NCS_PIN            GPIO6
+#define QSPI_IO_PORT            GPIOF
+#define QSPI_IO01_PINS          (GPIO8 | GPIO9) // IO0, IO1, AF10
+#define QSPI_IO23_PINS          (GPIO7 | GPIO6) // IO2, IO3, AF9
+
+#ifdef QSPI_MODEL
+bool qspi_flash_setup();
+bool qspi_flash_ready();
+void qspi_flash_report();
+#else
+#define qspi_flash_ready()      (false)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QSPI_FLASH_H */
+/*** end of file ***/
@@ -0,0 +1,233 @@
+#include <string.h>
+#include "rate_gov.h"
+#include "counters.h"
+#include "events.h"
+#include "utility.h"
+#include "printf.h"
+
+#ifdef RATE_GOVERNOR
+
+/* Explanation: ML loop of the shell reports after each frame whether the
+ * scene had anything in it, inference_activity() of inference.h, and
+ * asks before the next one how long to wait. Active frame sets the loop
+ * back to every frame of the Lepton at once. Each RATE_DECAY_FRAMES
+ * quiet frames in a row double the interval, from RATE_FIRST_INTERVAL_MS
+ * up to the slowest one of the policy, so a quiet scene costs a frame
+ * every 2 s with ADAPTIVE instead of nine per second, and the core
+ * sleeps in between. Anything that stays in view longer than the
+ * interval is still seen, and from its first frame on the loop runs at
+ * full rate again.
+ *
+ * STANDBY goes on to RATE_STANDBY_MAX_MS. From RATE_STANDBY_MIN_MS on the
+ * shell stops the pipeline and powers the Lepton down for the wait, it
+ * draws 5 mW instead of 150 mW then, and starts the boot
+ * RATE_BOOT_LEAD_MS before the frame is due. Intervals shorter than that
+ * would spend more on boots than they save.
+ *
+ * Wait ends early when a command line arrives, so the loop stops as it
+ * did without governor, and the line event is posted again for the shell
+ * task. COUNTER_RATE_STEPS counts interval changes, COUNTER_RATE_HOLD_MS
+ * the time frames waited, COUNTER_RATE_STANDBYS the waits in standby.
+ * */
+
+static rate_policy_t policy = RATE_DEFAULT_POLICY;
+static uint32_t interval = 0;           // In ms, 0 for every frame
+static uint32_t quiet = 0;              // Quiet frames in a row at interval
+static uint64_t last_frame_ms = 0;
+
+static struct
+{
+    uint32_t frames;
+    uint32_t active;
+    uint32_t rises;                     // Back to every frame
+    uint32_t standby_ms;
+    uint32_t slowest_ms;
+}stats;
+
+static const char * const policy_names[RATE_POLICY_END] =
+{
+    [RATE_POLICY_FIXED] = "FIXED",
+    [RATE_POLICY_ADAPTIVE] = "ADAPTIVE",
+    [RATE_POLICY_STANDBY] = "STANDBY",
+};
+
+static const uint32_t policy_max_ms[RATE_POLICY_END] =
+{
+    [RATE_POLICY_FIXED] = 0,
+    [RATE_POLICY_ADAPTIVE] = RATE_ADAPTIVE_MAX_MS,
+    [RATE_POLICY_STANDBY] = RATE_STANDBY_MAX_MS,
+};
+
+/*!
+ * @brief           Sets policy by its name
+ *
+ * @param[in] name  "FIXED", "ADAPTIVE" or "STANDBY"
+ *
+ * @return          False if name is unknown
+ */
+bool rate_gov_policy_set_name(const char * name)
+{
+    for (uint8_t i = 0; i < RATE_POLICY_END; i++)
+    {
+        if (0 == strcmp(policy_names[i], name))
+        {
+            rate_gov_policy_set((rate_policy_t) i);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief   Sets policy, interval is limited to the slowest one of it
+ */
+void rate_gov_policy_set(rate_policy_t policy_new)
+{
+    if (policy_new >= RATE_POLICY_END)
+    {
+        return;
+    }
+    policy = policy_new;
+    if (interval > policy_max_ms[policy])
+    {
+        interval = policy_max_ms[policy];
+        counter_add(COUNTER_RATE_STEPS, 1);
+    }
+    quiet = 0;
+}
+
+/*!
+ * @brief   Returns the current policy
+ */
+rate_policy_t rate_gov_policy_get()
+{
+    return policy;
+}
+
+/*!
+ * @brief   Returns name of the current policy
+ */
+const char * rate_gov_policy_name()
+{
+    return policy_names[policy];
+}
+
+/*!
+ * @brief   Returns time between two frames in ms, 0 for every frame
+ */
+uint32_t rate_gov_interval()
+{
+    return interval;
+}
+
+/*!
+ * @brief           Moves interval after a frame of the ML loop
+ *
+ * @param[in] active    Frame had motion, presence or tracked objects
+ */
+void rate_gov_update(bool active)
+{
+    last_frame_ms = millis();
+    stats.frames++;
+
+    if (active)
+    {
+        stats.active++;
+        quiet = 0;
+        if (interval)
+        {
+            interval = 0;
+            stats.rises++;
+            counter_add(COUNTER_RATE_STEPS, 1);
+        }
+        return;
+    }
+
+    if (policy == RATE_POLICY_FIXED || ++quiet < RATE_DECAY_FRAMES)
+    {
+        return;
+    }
+    quiet = 0;
+
+    uint32_t next = interval ? interval * 2 : RATE_FIRST_INTERVAL_MS;
+    if (next > policy_max_ms[policy])
+    {
+        next = policy_max_ms[policy];
+    }
+    if (next != interval)
+    {
+        interval = next;
+        counter_add(COUNTER_RATE_STEPS, 1);
+        stats.slowest_ms = next > stats.slowest_ms ? next : stats.slowest_ms;
+    }
+}
+
+/*!
+ * @brief   Returns time in ms until the next frame may start, 0 if now
+ */
+uint32_t rate_gov_hold()
+{
+    uint64_t since = millis() - last_frame_ms;
+    return since < interval ? interval - (uint32_t) since : 0;
+}
+
+/*!
+ * @brief           Decides if camera goes into standby for the wait
+ *
+ * @param[in] hold  Of rate_gov_hold()
+ */
+bool rate_gov_standby(uint32_t hold)
+{
+    return policy == RATE_POLICY_STANDBY &&
+           interval >= RATE_STANDBY_MIN_MS && hold > RATE_BOOT_LEAD_MS;
+}
+
+/*!
+ * @brief               Sleeps until the next frame is due
+ *
+ * @param[in] duration  In ms
+ * @param[in] standby   Camera is powered down meanwhile, for counters
+ *
+ * @return              False if a command line ended the wait early
+ *
+ * @note                Call from main context, ML loop of the shell does.
+ *                      Interrupts are served, the core sleeps otherwise.
+ */
+bool rate_gov_wait(uint32_t duration, bool standby)
+{
+    if (!duration)
+    {
+        return true;
+    }
+
+    uint64_t start = millis();
+    bool line = event_wait(EVENT_CONSOLE_LINE, duration) != 0;
+    if (line)
+    {
+        // Shell task waits for it as well
+        event_post(EVENT_CONSOLE_LINE);
+    }
+
+    uint32_t waited = (uint32_t) (millis() - start);
+    counter_add(COUNTER_RATE_HOLD_MS, waited);
+    if (standby)
+    {
+        counter_add(COUNTER_RATE_STANDBYS, 1);
+        stats.standby_ms += waited;
+    }
+    return !line;
+}
+
+/*!
+ * @brief   Prints policy, interval and share of active frames, part of
+ *          STATS
+ */
+void rate_gov_report()
+{
+    printf("Rate: %s, interval %lu ms, slowest %lu ms\n",
+           policy_names[policy], interval, stats.slowest_ms);
+    printf("Rate: %lu frames, %lu active, %lu rises, %lu s in standby\n",
+           stats.frames, stats.active, stats.rises, stats.standby_ms / 1000);
+}
+#endif
+/*** end of file ***/
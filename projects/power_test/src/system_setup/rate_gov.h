@@ -0,0 +1,57 @@
+#ifndef RATE_GOV_H
+#define RATE_GOV_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Define to pace frames of the ML loop by activity of the scene, look at
+// rate_gov.c. Motion gate, cascade gate or tracker tell if a frame had
+// anything in it, without any of them every frame is active and the loop
+// runs at full rate as before. RATE command of the shell sets the policy.
+#define RATE_GOVERNOR
+
+#define RATE_DEFAULT_POLICY     RATE_POLICY_ADAPTIVE
+
+// Quiet frames in a row at an interval before it doubles, active frame
+// goes straight back to every frame
+#define RATE_DECAY_FRAMES       4
+#define RATE_FIRST_INTERVAL_MS  250     // First step from full rate
+#define RATE_ADAPTIVE_MAX_MS    2000    // Slowest interval of ADAPTIVE
+#define RATE_STANDBY_MAX_MS     8000    // Of STANDBY
+
+// STANDBY powers the Lepton down for intervals this long, boot takes
+// 600-900 ms, look at flir_wait_ready(), and starts this early
+#define RATE_STANDBY_MIN_MS     4000
+#define RATE_BOOT_LEAD_MS       1000
+
+typedef enum
+{
+    RATE_POLICY_FIXED,      // Every frame, as without governor
+    RATE_POLICY_ADAPTIVE,   // Slower while quiet, camera keeps running
+    RATE_POLICY_STANDBY,    // Slower still, camera in standby in between
+    RATE_POLICY_END,
+} rate_policy_t;
+
+#ifdef RATE_GOVERNOR
+bool rate_gov_policy_set_name(const char * name);
+void rate_gov_policy_set(rate_policy_t policy);
+rate_policy_t rate_gov_policy_get();
+const char * rate_gov_policy_name();
+uint32_t rate_gov_interval();
+void rate_gov_update(bool active);
+uint32_t rate_gov_hold();
+bool rate_gov_standby(uint32_t hold);
+bool rate_gov_wait(uint32_t duration, bool standby);
+void rate_gov_report();
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RATE_GOV_H */
+/*** end of file ***/
@@ -0,0 +1,250 @@
+#include <stddef.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/spi.h>
+#include <libopencm3/cm3/nvic.h>
+#include "remote_link.h"
+#include "remote_infer.h"
+#include "spi_bus.h"
+#include "sys_init.h"
+#include "clock_profile.h"
+#include "dma_buf.h"
+#include "events.h"
+#include "utility.h"
+#include "counters.h"
+#include "log.h"
+#include "periph_clock.h"
+
+/* Explanation: master side of shared/remote_infer.h. Tensors are never
+ * copied, request is two queued transfers of spi_bus.c, header from a
+ * small DMA buffer and input tensor from where caller keeps it, response
+ * is header into the same buffer and output tensor of the companion
+ * straight into caller's output tensor. Both pairs hold chip select for
+ * the whole message, FLIR transfers wait behind them and the other way
+ * round, so a message goes out between two VoSPI segments.
+ *
+ * Companion needs the whole Invoke() between request and response, it
+ * tells when it is done with a rising edge on READY, EXTI2 then queues
+ * the response from interrupt. Nothing polls, main context only waits for
+ * EVENT_REMOTE.
+ * */
+
+typedef enum
+{
+    REMOTE_IDLE,
+    REMOTE_SENDING,         // Request is queued or going out
+    REMOTE_WAIT_READY,      // Companion runs Invoke()
+    REMOTE_RECEIVING,       // Response is coming in
+    REMOTE_DONE,
+    REMOTE_FAILED,
+} remote_state_t;
+
+static spi_device_t remote_dev;
+static spi_xfer_t header_xfer;
+static spi_xfer_t payload_xfer;
+// Own cache line, so invalidating it never touches other variables
+static union
+{
+    remote_header_t fields;
+    uint8_t line[DMA_BUF_ALIGN];
+} header_buf DMA_BUFFER;
+static remote_header_t * const header = &header_buf.fields;
+
+static volatile remote_state_t state = REMOTE_IDLE;
+static uint8_t sequence = 0;
+static void * output_buf;
+static uint16_t output_bytes;
+
+static void request_done(spi_xfer_t * xfer, bool status);
+static void response_done(spi_xfer_t * xfer, bool status);
+
+/*!
+ * @brief   Prepares chip select, READY line and SPI1 device of the
+ *          companion
+ *
+ * @note    SPI1 is set up on the first request, look at sys_require().
+ */
+void remote_link_setup()
+{
+    rcc_periph_clock_enable(REMOTE_PORT_RCC);
+    gpio_set(REMOTE_CS_PORT, REMOTE_CS_PIN);
+    gpio_mode_setup(REMOTE_CS_PORT, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE,
+                    REMOTE_CS_PIN);
+    gpio_set_output_options(REMOTE_CS_PORT, GPIO_OTYPE_PP, GPIO_OSPEED_25MHZ,
+                            REMOTE_CS_PIN);
+    gpio_mode_setup(REMOTE_READY_PORT, GPIO_MODE_INPUT, GPIO_PUPD_PULLDOWN,
+                    REMOTE_READY_PIN);
+
+    periph_clock_acquire(RCC_SYSCFG);
+    exti_select_source(REMOTE_READY_EXTI, REMOTE_READY_PORT);
+    exti_set_trigger(REMOTE_READY_EXTI, EXTI_TRIGGER_RISING);
+    exti_reset_request(REMOTE_READY_EXTI);
+    exti_enable_request(REMOTE_READY_EXTI);
+    nvic_enable_irq(REMOTE_READY_IRQ);
+
+    // Byte stream, SPI mode 0 as STM32 slaves work out of reset
+    spi_bus_device_init(&remote_dev,
+                        REMOTE_CS_PORT,
+                        REMOTE_CS_PIN,
+                        SPI_CR1_CPOL_CLK_TO_0_WHEN_IDLE,
+                        SPI_CR1_CPHA_CLK_TRANSITION_1,
+                        clock_spi1_prescaler(),
+                        false,
+                        0);
+}
+
+/*!
+ * @brief               Sends tensor to the companion, returns right away
+ *
+ * @param[in] input     Input tensor, must not change until done
+ * @param[in] output    Output tensor, written when response comes in
+ *
+ * @return              False if previous exchange is still running
+ */
+bool remote_infer_start(const void * input, uint16_t input_len,
+                        void * output, uint16_t output_len)
+{
+    if (state != REMOTE_IDLE && state != REMOTE_DONE &&
+        state != REMOTE_FAILED)
+    {
+        return false;
+    }
+    sys_require(SYS_PERIPH_SPI);
+    spi_bus_set_prescaler(&remote_dev, clock_spi1_prescaler());
+
+    output_buf = output;
+    output_bytes = output_len;
+    remote_header_init(header, REMOTE_REQUEST, ++sequence, input, input_len);
+    // Tensor may be in cached SRAM, DMA reads memory
+    dma_buf_clean(header, sizeof(*header));
+    dma_buf_clean(input, input_len);
+
+    header_xfer.device = &remote_dev;
+    header_xfer.tx = header;
+    header_xfer.rx = NULL;
+    header_xfer.len = sizeof(*header);
+    header_xfer.release = false;
+    header_xfer.callback = NULL;
+
+    payload_xfer.device = &remote_dev;
+    payload_xfer.tx = input;
+    payload_xfer.rx = NULL;
+    payload_xfer.len = input_len;
+    payload_xfer.release = true;
+    payload_xfer.callback = request_done;
+
+    state = REMOTE_SENDING;
+    spi_bus_submit(&header_xfer);
+    spi_bus_submit(&payload_xfer);
+    return true;
+}
+
+/*!
+ * @brief   Called when request is out, companion is running Invoke()
+ */
+static void request_done(spi_xfer_t * xfer, bool status)
+{
+    (void) xfer;
+    state = status ? REMOTE_WAIT_READY : REMOTE_FAILED;
+    if (!status)
+    {
+        event_post(EVENT_REMOTE);
+    }
+}
+
+/*!
+ * @brief   Queues response when companion raised READY
+ */
+void exti2_isr()
+{
+    exti_reset_request(REMOTE_READY_EXTI);
+    if (state != REMOTE_WAIT_READY)
+    {
+        return;
+    }
+    state = REMOTE_RECEIVING;
+
+    dma_buf_invalidate(header, sizeof(*header));
+    dma_buf_invalidate(output_buf, output_bytes);
+
+    header_xfer.tx = NULL;
+    header_xfer.rx = header;
+    header_xfer.release = false;
+    header_xfer.callback = NULL;
+
+    payload_xfer.tx = NULL;
+    payload_xfer.rx = output_buf;
+    payload_xfer.len = output_bytes;
+    payload_xfer.release = true;
+    payload_xfer.callback = response_done;
+
+    spi_bus_submit(&header_xfer);
+    spi_bus_submit(&payload_xfer);
+}
+
+/*!
+ * @brief   Checks response of the companion
+ */
+static void response_done(spi_xfer_t * xfer, bool status)
+{
+    (void) xfer;
+    if (status && header->sequence == sequence &&
+        remote_check(header, REMOTE_SCORES, output_buf,
+                     output_bytes) == REMOTE_OK)
+    {
+        state = REMOTE_DONE;
+    }
+    else
+    {
+        state = REMOTE_FAILED;
+    }
+    event_post(EVENT_REMOTE);
+}
+
+/*!
+ * @brief   Tells if the last exchange is finished, successfully or not
+ */
+bool remote_infer_done()
+{
+    return state == REMOTE_DONE || state == REMOTE_FAILED;
+}
+
+/*!
+ * @brief               Waits for the response of the last request
+ *
+ * @param[in] timeout   In ms
+ *
+ * @return              True if output tensor holds valid scores
+ *
+ * @note                On timeout exchange is dropped, a late READY edge
+ *                      is ignored.
+ */
+bool remote_infer_wait(uint32_t timeout)
+{
+    uint64_t start = millis();
+    while (!remote_infer_done())
+    {
+        uint64_t elapsed = millis() - start;
+        if (elapsed >= timeout)
+        {
+            break;
+        }
+        event_wait(EVENT_REMOTE, timeout - elapsed);
+    }
+
+    bool ok = state == REMOTE_DONE;
+    if (!ok)
+    {
+        LOG_WARN("Remote inference %d failed in state %d\n", sequence,
+                 state);
+        counter_add(COUNTER_REMOTE_ERRORS, 1);
+    }
+    // Transfers that are still queued finish on their own and are ignored
+    if (state == REMOTE_WAIT_READY)
+    {
+        state = REMOTE_FAILED;
+    }
+    return ok;
+}
+/*** end of file ***/
@@ -0,0 +1,36 @@
+#ifndef REMOTE_LINK_H
+#define REMOTE_LINK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Companion MCU that runs inference for us, on SPI1 next to the Lepton,
+// protocol is in shared/remote_infer.h. Chip select and READY line are on
+// CN10 of Nucleo-144, READY is driven by companion and active high.
+#define REMOTE_CS_PORT          GPIOG
+#define REMOTE_CS_PIN           GPIO3
+#define REMOTE_READY_PORT       GPIOG
+#define REMOTE_READY_PIN        GPIO2
+#define REMOTE_READY_EXTI       EXTI2
+#define REMOTE_READY_IRQ        NVIC_EXTI2_IRQ
+#define REMOTE_PORT_RCC         RCC_GPIOG
+
+#define REMOTE_TIMEOUT          1000    // ms for Invoke() of the companion
+
+void remote_link_setup();
+bool remote_infer_start(const void * input, uint16_t input_len,
+                        void * output, uint16_t output_len);
+bool remote_infer_done();
+bool remote_infer_wait(uint32_t timeout);
+void exti2_isr();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REMOTE_LINK_H */
+/*** end of file ***/
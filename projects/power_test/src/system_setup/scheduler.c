@@ -0,0 +1,217 @@
+#include <stddef.h>
+#include "scheduler.h"
+#include "events.h"
+#include "utility.h"
+#include "printf.h"
+
+/* Explanation: main context is a table of tasks instead of one loop that
+ * knows about everything. Interrupts keep posting EVENT_* flags with
+ * event_post(), sched_run() takes them and hands each flag to the tasks
+ * that listen to it, then runs ready tasks one at a time, highest priority
+ * first. A task runs to completion, it does a bounded piece of work and
+ * returns, if more is left it calls sched_ready() on itself or
+ * sched_delay() for work that is due later, like capture resync.
+ *
+ * Priority alone would let a busy high priority task starve the rest, so
+ * a ready task that was passed over SCHED_MAX_WAIT times runs next no
+ * matter its priority. Tasks of the same priority take turns.
+ *
+ * When no task is ready, sched_run() waits in event_wait() until the next
+ * event or delay. That is the idle path of the old loop, deferred logs and
+ * trace are drained there and core sleeps in WFI, so UART and SWO output
+ * has the lowest priority of all.
+ *
+ * Commands that block, for example ML or BENCH, still wait in
+ * event_wait() inside their task. Events they wait for are taken there
+ * and not seen by the scheduler, which is fine as events are only hints
+ * and every task checks state it depends on itself.
+ * */
+
+static sched_task_t * tasks[SCHED_MAX_TASKS];
+static uint32_t num_tasks = 0;
+static uint32_t all_events = 0;
+
+/*!
+ * @brief               Registers task, it is not ready until its event
+ *
+ * @return              False if table is full
+ */
+bool sched_add(sched_task_t * task)
+{
+    if (num_tasks == SCHED_MAX_TASKS || task->prio >= SCHED_PRIOS)
+    {
+        return false;
+    }
+
+    task->pending = 0;
+    task->ready = false;
+    task->deadline = 0;
+    task->waited = 0;
+    task->runs = 0;
+    task->max_us = 0;
+    tasks[num_tasks++] = task;
+    all_events |= task->events;
+    return true;
+}
+
+/*!
+ * @brief               Makes task ready without an event
+ *
+ * @note                Main context only, interrupts post events instead.
+ */
+void sched_ready(sched_task_t * task)
+{
+    task->ready = true;
+    task->deadline = 0;
+}
+
+/*!
+ * @brief               Makes task ready after ms, replaces earlier delay
+ */
+void sched_delay(sched_task_t * task, uint32_t ms)
+{
+    if (ms == 0)
+    {
+        sched_ready(task);
+        return;
+    }
+    task->deadline = millis() + ms;
+}
+
+/*!
+ * @brief               Gives taken events to tasks that listen to them
+ */
+static void distribute(uint32_t events)
+{
+    for (uint32_t i = 0; events && i < num_tasks; i++)
+    {
+        tasks[i]->pending |= events & tasks[i]->events;
+    }
+}
+
+/*!
+ * @brief               Makes tasks whose delay passed ready
+ *
+ * @return              Time until next delay in ms, EVENT_FOREVER if none
+ */
+static uint32_t expire_delays()
+{
+    uint64_t now = millis();
+    uint32_t sleep = EVENT_FOREVER;
+
+    for (uint32_t i = 0; i < num_tasks; i++)
+    {
+        sched_task_t * task = tasks[i];
+        if (!task->deadline)
+        {
+            continue;
+        }
+        if (now >= task->deadline)
+        {
+            sched_ready(task);
+            continue;
+        }
+        if (task->deadline - now < sleep)
+        {
+            sleep = (uint32_t) (task->deadline - now);
+        }
+    }
+    return sleep;
+}
+
+/*!
+ * @brief               Returns ready task that runs next, NULL if none
+ */
+static sched_task_t * pick()
+{
+    sched_task_t * best = NULL;
+
+    for (uint32_t i = 0; i < num_tasks; i++)
+    {
+        sched_task_t * task = tasks[i];
+        if (!task->ready && !task->pending)
+        {
+            continue;
+        }
+        if (!best)
+        {
+            best = task;
+            continue;
+        }
+
+        bool starved = task->waited >= SCHED_MAX_WAIT;
+        bool best_starved = best->waited >= SCHED_MAX_WAIT;
+        if (starved != best_starved)
+        {
+            if (starved)
+            {
+                best = task;
+            }
+            continue;
+        }
+        if (task->prio < best->prio ||
+            (task->prio == best->prio && task->waited > best->waited))
+        {
+            best = task;
+        }
+    }
+
+    for (uint32_t i = 0; best && i < num_tasks; i++)
+    {
+        sched_task_t * task = tasks[i];
+        if (task != best && (task->ready || task->pending))
+        {
+            task->waited++;
+        }
+    }
+    return best;
+}
+
+/*!
+ * @brief               Runs tasks forever, sleeps when none is ready
+ */
+void sched_run()
+{
+    while (1)
+    {
+        distribute(event_take(all_events));
+        uint32_t sleep = expire_delays();
+
+        sched_task_t * task = pick();
+        if (!task)
+        {
+            distribute(event_wait(all_events, sleep));
+            continue;
+        }
+
+        uint32_t events = task->pending;
+        task->pending = 0;
+        task->ready = false;
+        task->waited = 0;
+
+        uint64_t start = micros();
+        task->handler(events);
+        uint32_t took = (uint32_t) (micros() - start);
+
+        task->runs++;
+        if (took > task->max_us)
+        {
+            task->max_us = took;
+        }
+    }
+}
+
+/*!
+ * @brief   Prints runs and the longest run of every task
+ */
+void sched_report()
+{
+    printf("Tasks\n");
+    for (uint32_t i = 0; i < num_tasks; i++)
+    {
+        const sched_task_t * task = tasks[i];
+        printf("%-10s prio %d: %lu runs, max %lu us\n", task->name,
+               task->prio, task->runs, task->max_us);
+    }
+}
+/*** end of file ***/
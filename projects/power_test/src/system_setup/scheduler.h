@@ -0,0 +1,55 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Cooperative scheduler of main context, look at scheduler.c. Tasks run
+// to completion and are made ready by EVENT_* flags that interrupts post,
+// by sched_ready() or by sched_delay().
+#define SCHED_MAX_TASKS     8
+#define SCHED_MAX_WAIT      4       // Runs a ready task lets others go first
+
+typedef enum
+{
+    SCHED_PRIO_HIGH,        // Deadlines of hardware, capture
+    SCHED_PRIO_NORMAL,      // Shell commands, inference
+    SCHED_PRIO_LOW,         // Background work
+    SCHED_PRIOS,
+} sched_prio_t;
+
+typedef void (*sched_handler_t)(uint32_t events);
+
+// Allocated statically by the owner of the task, scheduler keeps pointers
+typedef struct
+{
+    const char * name;
+    sched_handler_t handler;    // Called with events it was made ready by
+    uint32_t events;            // EVENT_* flags that make it ready
+    sched_prio_t prio;
+
+    // Kept by the scheduler, zeroed by sched_add()
+    uint32_t pending;           // Events taken for the next run
+    bool ready;                 // sched_ready() or delay expired
+    uint64_t deadline;          // millis() of sched_delay(), 0 if none
+    uint32_t waited;            // Runs of others while it was ready
+    uint32_t runs;
+    uint32_t max_us;            // Longest run
+}sched_task_t;
+
+bool sched_add(sched_task_t * task);
+void sched_ready(sched_task_t * task);
+void sched_delay(sched_task_t * task, uint32_t ms);
+void sched_run();
+void sched_report();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCHEDULER_H */
+/*** end of file ***/
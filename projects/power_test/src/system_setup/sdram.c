@@ -0,0 +1,258 @@
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include "sdram.h"
+#include "periph_clock.h"
+#include "utility.h"
+#include "printf.h"
+
+#ifdef EXT_SDRAM
+
+/* Explanation: FMC drives the SDRAM at SDRAM_ADDRESS, it is plain memory
+ * from then on. Large buffers that are not read by the hot loops go
+ * there with SDRAM_BSS, for example second memory of the kernel bench,
+ * long frame queues or staging of files, internal SRAM and DTCM stay for
+ * arenas and activations. It is NOLOAD like .noinit and set up only in
+ * system_setup(), so C++ objects with constructors can not be placed
+ * there, those run before main().
+ *
+ * Default memory map makes this address range Device memory, neither
+ * cached nor executable, MPU region of mpu_setup() turns it into normal
+ * write-back memory with write allocate instead, so L1 D-cache hides
+ * most of the latency of sequential reads.
+ *
+ * SDCLK is HCLK / 2, 108 MHz in RUN, timings below are in its cycles and
+ * only get longer with slower profiles, so they are set once. Refresh
+ * counter is in the same cycles, sdram_clock_changed() computes it again
+ * after every switch. For the 200 us a switch runs on HSI the rows are
+ * refreshed less often, which the 64 ms retention covers many times
+ * over. STOP stops SDCLK, chip refreshes itself meanwhile, look at
+ * sdram_sleep().
+ *
+ * Pins, all AF12, 16 bit data, 12 address lines, 2 bank lines:
+ * - A0-A5 PF0-PF5, A6-A9 PF12-PF15, A10-A11 PG0-PG1, BA0-BA1 PG4-PG5
+ * - D0-D1 PD14-PD15, D2-D3 PD0-PD1, D4-D12 PE7-PE15, D13-D15 PD8-PD10
+ * - NBL0-NBL1 PE0-PE1, SDCLK PG8, SDNCAS PG15, SDNRAS PF11
+ * - SDNWE PC0, SDCKE1 PB5, SDNE1 PB6
+ * PC0 is FLIR_PWR_DWN_PIN of flir.h and PD8, PD9 are USART3 on Nucleo
+ * wiring, with EXT_SDRAM they move to PA3 and PC10, PC11, look at flir.h
+ * and uart_tx.h. SDNE0 and SDCKE0 would be PC2 and PC3, VSYNC of the
+ * Lepton, so bank 2 is used.
+ * */
+
+#ifndef FMC_BASE
+#define FMC_BASE                0xA0000000U
+#endif
+
+#define FMC_HW_SDCR1            MMIO32(FMC_BASE + 0x140)
+#define FMC_HW_SDCR2            MMIO32(FMC_BASE + 0x144)
+#define FMC_HW_SDTR1            MMIO32(FMC_BASE + 0x148)
+#define FMC_HW_SDTR2            MMIO32(FMC_BASE + 0x14C)
+#define FMC_HW_SDCMR            MMIO32(FMC_BASE + 0x150)
+#define FMC_HW_SDRTR            MMIO32(FMC_BASE + 0x154)
+#define FMC_HW_SDSR             MMIO32(FMC_BASE + 0x158)
+
+// SDCR, SDCLK, RBURST and RPIPE only exist in SDCR1, for both banks
+#define SDCR_NC_8               (0 << 0)    // Column address bits
+#define SDCR_NR_12              (1 << 2)    // Row address bits
+#define SDCR_MWID_16            (1 << 4)
+#define SDCR_NB_4               (1 << 6)
+#define SDCR_CAS(n)             ((n) << 7)
+#define SDCR_SDCLK_HCLK2        (2 << 10)
+#define SDCR_RBURST             (1 << 12)
+
+// SDTR fields in SDCLK cycles, TRC and TRP only exist in SDTR1
+#define SDTR(mrd, xsr, ras, rc, wr, rp, rcd) \
+    (((mrd) - 1) | (((xsr) - 1) << 4) | (((ras) - 1) << 8) | \
+     (((rc) - 1) << 12) | (((wr) - 1) << 16) | (((rp) - 1) << 20) | \
+     (((rcd) - 1) << 24))
+// IS42S16400J-7 at 108 MHz, 9.3 ns a cycle
+#define SDRAM_TIMING            SDTR(2, 7, 4, 7, 3, 2, 2)
+
+#define SDCMR_NORMAL            0
+#define SDCMR_CLOCK_ENABLE      1
+#define SDCMR_PALL              2
+#define SDCMR_AUTO_REFRESH      3
+#define SDCMR_LOAD_MODE         4
+#define SDCMR_SELF_REFRESH      5
+#define SDCMR_BANK2             (1 << 3)
+#define SDCMR_NRFS(n)           (((n) - 1) << 5)
+#define SDCMR_MRD(m)            ((m) << 9)
+#define SDSR_BUSY               (1 << 5)
+
+// Mode register of the chip, burst of 1, CAS latency, single writes
+#define SDRAM_MODE              ((SDRAM_CAS_LATENCY << 4) | (1 << 9))
+#define SDRAM_COMMAND_TIMEOUT   1000        // In us
+#define SDRAM_TEST_WORD         0x5A5AA5A5U
+
+typedef struct
+{
+    uint32_t port;
+    enum rcc_periph_clken rcc;
+    uint16_t pins;
+} sdram_pins_t;
+
+static const sdram_pins_t sdram_pins[] =
+{
+    {GPIOB, RCC_GPIOB, GPIO5 | GPIO6},
+    {GPIOC, RCC_GPIOC, GPIO0},
+    {GPIOD, RCC_GPIOD, GPIO0 | GPIO1 | GPIO8 | GPIO9 | GPIO10 | GPIO14 |
+                       GPIO15},
+    {GPIOE, RCC_GPIOE, GPIO0 | GPIO1 | GPIO7 | GPIO8 | GPIO9 | GPIO10 |
+                       GPIO11 | GPIO12 | GPIO13 | GPIO14 | GPIO15},
+    {GPIOF, RCC_GPIOF, GPIO0 | GPIO1 | GPIO2 | GPIO3 | GPIO4 | GPIO5 |
+                       GPIO11 | GPIO12 | GPIO13 | GPIO14 | GPIO15},
+    {GPIOG, RCC_GPIOG, GPIO0 | GPIO1 | GPIO4 | GPIO5 | GPIO8 | GPIO15},
+};
+
+// Bounds of .sdram_bss, defined in memory_sections.ld
+extern uint8_t _sdram_bss;
+extern uint8_t _esdram_bss;
+
+static bool ready = false;
+
+/*!
+ * @brief   Sends a command to the chip on bank 2 and waits until FMC
+ *          took it
+ */
+static bool command(uint32_t cmd)
+{
+    FMC_HW_SDCMR = cmd | SDCMR_BANK2;
+    uint64_t start = micros();
+    while (FMC_HW_SDSR & SDSR_BUSY)
+    {
+        if (micros() - start > SDRAM_COMMAND_TIMEOUT)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!
+ * @brief   Refresh period of one row in SDCLK cycles for the current
+ *          HCLK, less 20 cycles of margin that the reference manual asks
+ *          for
+ */
+static uint32_t refresh_count()
+{
+    uint32_t sdclk_khz = rcc_ahb_frequency / 2 / 1000;
+    return SDRAM_REFRESH_MS * sdclk_khz / SDRAM_ROWS - 20;
+}
+
+/*!
+ * @brief           Sets up pins and FMC, runs the power up sequence of
+ *                  the chip and checks that it holds data
+ *
+ * @return          False if the chip does not answer, SDRAM_BSS must not
+ *                  be used then
+ *
+ * @note            Call from system_setup() after clock_setup() and
+ *                  mpu_setup(), before caches are on, so the test reads
+ *                  the chip and not D-cache.
+ */
+bool sdram_setup()
+{
+    for (uint32_t i = 0; i < sizeof(sdram_pins) / sizeof(sdram_pins[0]); i++)
+    {
+        const sdram_pins_t * pins = &sdram_pins[i];
+        rcc_periph_clock_enable(pins->rcc);
+        gpio_mode_setup(pins->port, GPIO_MODE_AF, GPIO_PUPD_NONE, pins->pins);
+        gpio_set_output_options(pins->port, GPIO_OTYPE_PP,
+                                GPIO_OSPEED_100MHZ, pins->pins);
+        gpio_set_af(pins->port, GPIO_AF12, pins->pins);
+    }
+
+    periph_clock_acquire(RCC_FMC);
+    FMC_HW_SDCR1 = SDCR_SDCLK_HCLK2 | SDCR_RBURST;
+    FMC_HW_SDCR2 = SDCR_NC_8 | SDCR_NR_12 | SDCR_MWID_16 | SDCR_NB_4 |
+                   SDCR_CAS(SDRAM_CAS_LATENCY);
+    FMC_HW_SDTR1 = SDRAM_TIMING;
+    FMC_HW_SDTR2 = SDRAM_TIMING;
+
+    // Power up sequence of the chip, 100 us of clock before anything else
+    bool ok = command(SDCMR_CLOCK_ENABLE);
+    delay_us(100);
+    ok = ok && command(SDCMR_PALL) &&
+         command(SDCMR_AUTO_REFRESH | SDCMR_NRFS(8)) &&
+         command(SDCMR_LOAD_MODE | SDCMR_MRD(SDRAM_MODE));
+    FMC_HW_SDRTR = refresh_count() << 1;
+
+    // Missing chip reads back floating bus, not the pattern
+    volatile uint32_t * first = (volatile uint32_t *) SDRAM_ADDRESS;
+    volatile uint32_t * last =
+        (volatile uint32_t *) (SDRAM_ADDRESS + SDRAM_SIZE - 4);
+    *first = SDRAM_TEST_WORD;
+    *last = ~SDRAM_TEST_WORD;
+    __asm__ volatile ("dsb" ::: "memory");
+    ready = ok && *first == SDRAM_TEST_WORD && *last == ~SDRAM_TEST_WORD;
+    return ready;
+}
+
+/*!
+ * @brief   Tells if the chip answered at setup
+ */
+bool sdram_ready()
+{
+    return ready;
+}
+
+/*!
+ * @brief   Computes refresh counter again for the new HCLK
+ *
+ * @note    Called by peripherals_update() of clock_profile.c.
+ */
+void sdram_clock_changed()
+{
+    if (ready)
+    {
+        FMC_HW_SDRTR = refresh_count() << 1;
+    }
+}
+
+/*!
+ * @brief   Puts the chip into self refresh, it keeps its data while
+ *          SDCLK stops
+ *
+ * @note    Call before STOP with interrupts masked, nothing may touch
+ *          SDRAM until sdram_wake().
+ */
+void sdram_sleep()
+{
+    if (ready)
+    {
+        __asm__ volatile ("dsb" ::: "memory");
+        command(SDCMR_SELF_REFRESH);
+    }
+}
+
+/*!
+ * @brief   Returns the chip to normal mode after STOP
+ *
+ * @note    Call after the clock is restored.
+ */
+void sdram_wake()
+{
+    if (ready)
+    {
+        command(SDCMR_NORMAL);
+        FMC_HW_SDRTR = refresh_count() << 1;
+    }
+}
+
+/*!
+ * @brief   Prints size and use of SDRAM, part of STATS
+ */
+void sdram_report()
+{
+    if (!ready)
+    {
+        printf("SDRAM: not found, SDRAM_BSS is not usable\n");
+        return;
+    }
+    printf("SDRAM: %u KB at %08lX, %lu KB used, refresh %lu cycles\n",
+           SDRAM_SIZE / 1024, SDRAM_ADDRESS,
+           (uint32_t) (&_esdram_bss - &_sdram_bss) / 1024,
+           (FMC_HW_SDRTR >> 1) & 0x1FFF);
+}
+#endif
+/*** end of file ***/
@@ -0,0 +1,43 @@
+#ifndef SDRAM_H
+#define SDRAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Define on carrier boards with SDRAM on FMC, variables with SDRAM_BSS of
+// sys_init.h then go there instead of internal RAM, look at sdram.c and
+// memory_sections.ld. Nucleo-F767ZI has no SDRAM, the pins are listed in
+// sdram.c, USART3 and FLIR_PWR_DWN_PIN move off them with it.
+//#define EXT_SDRAM
+
+// 16 bit chip like IS42S16400J, 4 internal banks of 4096 rows of 256
+// columns, on SDRAM bank 2 of FMC
+#define SDRAM_ADDRESS           0xD0000000U
+#define SDRAM_SIZE              (8 * 1024 * 1024)
+#define SDRAM_ROWS              4096
+#define SDRAM_REFRESH_MS        64          // Every row once in this time
+#define SDRAM_CAS_LATENCY       2
+
+#ifdef EXT_SDRAM
+bool sdram_setup();
+bool sdram_ready();
+void sdram_clock_changed();
+void sdram_sleep();
+void sdram_wake();
+void sdram_report();
+#else
+#define sdram_clock_changed()   ((void) 0)
+#define sdram_sleep()           ((void) 0)
+#define sdram_wake()            ((void) 0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SDRAM_H */
+/*** end of file ***/
@@ -0,0 +1,374 @@
+#include <stddef.h>
+#include <string.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
+#include "sensors.h"
+#include "i2c_async.h"
+#include "sys_init.h"
+#include "utility.h"
+#include "counters.h"
+#include "printf.h"
+#include "periph_clock.h"
+
+/* Explanation: TIM6 interrupt is the sampling clock. On every tick each
+ * sensor that is due gets one i2c_async.c transfer, register address
+ * write followed by DMA read of its block, straight into the next slot of
+ * its ring. Completion callback only publishes the slot, so a sample
+ * costs a few short interrupts and nothing runs in main context, inference
+ * and capture go on while sensors are read.
+ *
+ * Each slot has timestamp of the tick in micros(), same base as FLIR frame
+ * timestamps, so sensors_nearest() gives context of a frame. Readers copy
+ * from the ring without masking interrupts and check the head afterwards,
+ * a slot overwritten meanwhile is not returned.
+ *
+ * A sensor whose previous read is still queued, for example behind a CCI
+ * command of the Lepton, skips the tick and counts an overrun. TIM6 runs
+ * from APB1, prescaler is recalculated by sensors_clock_changed() after
+ * every clock profile switch, ticks are 10 kHz in both profiles. Its
+ * clock is held from sensors_start() to sensors_stop().
+ * */
+
+#define SENSORS_TIMER_HZ    10000   // TIM6 counter clock
+
+// LIS3DH style accelerometer, 100 Hz, all axes, register auto increment
+#define IMU_ADDR            0x19
+#define IMU_CTRL_REG1       0x20
+#define IMU_OUT_X_L         0x28
+#define IMU_AUTO_INC        0x80
+
+// BH1750, continuous high resolution mode, 120 ms per conversion
+#define LIGHT_ADDR          0x23
+#define LIGHT_CONT_H_MODE   0x10
+
+// STHS34PF80 presence sensor, 15 Hz with block data update
+#define PIR_ADDR            0x5A
+#define PIR_CTRL1           0x20
+#define PIR_TPRESENCE_L     0x3A
+
+#ifdef SENSORS_IMU
+static const uint8_t imu_init[] = {IMU_CTRL_REG1, 0x57};
+#endif
+#ifdef SENSORS_LIGHT
+static const uint8_t light_init[] = {LIGHT_CONT_H_MODE};
+#endif
+#ifdef SENSORS_PIR
+static const uint8_t pir_init[] = {PIR_CTRL1, 0x17};
+#endif
+
+static const sensor_config_t configs[SENSORS] =
+{
+#ifdef SENSORS_IMU
+    [SENSOR_IMU] = {"imu", IMU_ADDR, IMU_OUT_X_L | IMU_AUTO_INC, 6, 1,
+                    imu_init, sizeof(imu_init)},
+#endif
+#ifdef SENSORS_LIGHT
+    [SENSOR_LIGHT] = {"light", LIGHT_ADDR, SENSOR_NO_REG, 2, 20,
+                      light_init, sizeof(light_init)},
+#endif
+#ifdef SENSORS_PIR
+    [SENSOR_PIR] = {"pir", PIR_ADDR, PIR_TPRESENCE_L, 2, 10,
+                    pir_init, sizeof(pir_init)},
+#endif
+};
+
+typedef struct
+{
+    sensor_sample_t ring[SENSORS_RING_LEN];
+    volatile uint32_t head;     // Samples published, counts up
+    volatile bool busy;         // Transfer queued or running
+    i2c_xfer_t xfer;
+    uint8_t reg;
+    uint32_t samples;
+    uint32_t errors;
+    uint32_t overruns;
+}sensor_state_t;
+
+// DMA writes into rings, DTCM is not cached. Init transfers are chained
+// through the same state, they finish before the first tick.
+static sensor_state_t sensors[SENSORS] DTCM_BSS;
+static uint32_t rate = 0;
+static uint32_t tick = 0;
+
+static void sample_done(i2c_xfer_t * xfer, bool status);
+static void init_done(i2c_xfer_t * xfer, bool status);
+
+/*!
+ * @brief   Returns TIM6 input clock, it is twice APB1 when APB1 is divided
+ */
+static uint32_t timer_clock()
+{
+    return rcc_apb1_frequency == rcc_ahb_frequency ? rcc_apb1_frequency :
+                                                     2 * rcc_apb1_frequency;
+}
+
+/*!
+ * @brief               Writes init bytes of all sensors and starts sampling
+ *
+ * @param[in] rate_hz   Tick rate, from 1 to SENSORS_TIMER_HZ
+ *
+ * @note                Call after system_setup(). A sensor that is not
+ *                      fitted only counts errors.
+ */
+void sensors_start(uint32_t rate_hz)
+{
+    if (rate_hz == 0 || rate_hz > SENSORS_TIMER_HZ)
+    {
+        return;
+    }
+    sys_require(SYS_PERIPH_I2C);
+    sensors_stop();
+    while (i2c_async_busy());
+
+    memset(sensors, 0, sizeof(sensors));
+    for (uint32_t id = 0; id < SENSORS; id++)
+    {
+        const sensor_config_t * config = &configs[id];
+        sensor_state_t * sensor = &sensors[id];
+
+        sensor->reg = (uint8_t) config->reg;
+        if (config->init)
+        {
+            sensor->busy = true;
+            sensor->xfer.addr = config->addr;
+            sensor->xfer.tx = config->init;
+            sensor->xfer.tx_len = config->init_len;
+            sensor->xfer.rx = NULL;
+            sensor->xfer.rx_len = 0;
+            sensor->xfer.callback = init_done;
+            sensor->xfer.context = sensor;
+            i2c_async_submit(&sensor->xfer);
+        }
+    }
+
+    rate = rate_hz;
+    tick = 0;
+    periph_clock_acquire(RCC_TIM6);
+    rcc_periph_reset_pulse(RST_TIM6);
+    sensors_clock_changed();
+    timer_enable_irq(TIM6, TIM_DIER_UIE);
+    nvic_enable_irq(NVIC_TIM6_DAC_IRQ);
+    timer_enable_counter(TIM6);
+}
+
+/*!
+ * @brief   Stops the tick, reads that are queued still finish
+ */
+void sensors_stop()
+{
+    if (!rate)
+    {
+        return;
+    }
+    timer_disable_counter(TIM6);
+    nvic_disable_irq(NVIC_TIM6_DAC_IRQ);
+    periph_clock_release(RCC_TIM6);
+    rate = 0;
+}
+
+/*!
+ * @brief   Returns tick rate, 0 if sampling is stopped
+ */
+uint32_t sensors_rate()
+{
+    return rate;
+}
+
+/*!
+ * @brief   Keeps tick rate after APB1 clock changed
+ *
+ * @note    Called by clock_profile_set() with interrupts masked.
+ */
+void sensors_clock_changed()
+{
+    if (!rate)
+    {
+        return;
+    }
+    timer_set_prescaler(TIM6, timer_clock() / SENSORS_TIMER_HZ - 1);
+    timer_set_period(TIM6, SENSORS_TIMER_HZ / rate - 1);
+    // Loads prescaler now, not on the next update
+    timer_generate_event(TIM6, TIM_EGR_UG);
+    timer_clear_flag(TIM6, TIM_SR_UIF);
+}
+
+/*!
+ * @brief   Called when init bytes of a sensor were written
+ */
+static void init_done(i2c_xfer_t * xfer, bool status)
+{
+    sensor_state_t * sensor = (sensor_state_t *) xfer->context;
+    if (!status)
+    {
+        sensor->errors++;
+        counter_add(COUNTER_SENSOR_ERRORS, 1);
+    }
+    sensor->busy = false;
+}
+
+/*!
+ * @brief   Publishes the slot that DMA has filled
+ */
+static void sample_done(i2c_xfer_t * xfer, bool status)
+{
+    sensor_state_t * sensor = (sensor_state_t *) xfer->context;
+    if (status)
+    {
+        sensor->head++;
+        sensor->samples++;
+        counter_add(COUNTER_SENSOR_SAMPLES, 1);
+    }
+    else
+    {
+        sensor->errors++;
+        counter_add(COUNTER_SENSOR_ERRORS, 1);
+    }
+    sensor->busy = false;
+}
+
+void tim6_dac_isr()
+{
+    timer_clear_flag(TIM6, TIM_SR_UIF);
+    uint64_t now = micros();
+
+    for (uint32_t id = 0; id < SENSORS; id++)
+    {
+        const sensor_config_t * config = &configs[id];
+        sensor_state_t * sensor = &sensors[id];
+
+        if (tick % config->divider)
+        {
+            continue;
+        }
+        if (sensor->busy)
+        {
+            sensor->overruns++;
+            counter_add(COUNTER_SENSOR_OVERRUNS, 1);
+            continue;
+        }
+
+        // Slot is not visible to readers until head moves over it
+        sensor_sample_t * slot = &sensor->ring[sensor->head %
+                                               SENSORS_RING_LEN];
+        slot->timestamp_us = now;
+
+        sensor->busy = true;
+        sensor->xfer.addr = config->addr;
+        sensor->xfer.tx = &sensor->reg;
+        sensor->xfer.tx_len = config->reg == SENSOR_NO_REG ? 0 : 1;
+        sensor->xfer.rx = slot->data;
+        sensor->xfer.rx_len = config->len;
+        sensor->xfer.callback = sample_done;
+        sensor->xfer.context = sensor;
+        i2c_async_submit(&sensor->xfer);
+    }
+    tick++;
+}
+
+/*!
+ * @brief               Copies sample at index and checks it was not
+ *                      overwritten meanwhile
+ */
+static bool copy_sample(sensor_state_t * sensor,
+                        uint32_t index,
+                        sensor_sample_t * sample)
+{
+    *sample = sensor->ring[index % SENSORS_RING_LEN];
+    __asm__ volatile ("dmb" ::: "memory");
+    // Slot at head is being filled, it is one past the published ones
+    return sensor->head - index < SENSORS_RING_LEN;
+}
+
+/*!
+ * @brief               Returns the newest sample of a sensor
+ *
+ * @return              False if sensor has no sample yet
+ */
+bool sensors_latest(sensor_id_t id, sensor_sample_t * sample)
+{
+    if (id >= SENSORS)
+    {
+        return false;
+    }
+
+    sensor_state_t * sensor = &sensors[id];
+    uint32_t head = sensor->head;
+    return head && copy_sample(sensor, head - 1, sample);
+}
+
+/*!
+ * @brief                   Returns sample of a sensor closest to a time,
+ *                          for example flir_timestamp_t of a frame
+ *
+ * @param[in] timestamp_us  In micros()
+ *
+ * @return                  False if sensor has no sample in its ring
+ */
+bool sensors_nearest(sensor_id_t id,
+                     uint64_t timestamp_us,
+                     sensor_sample_t * sample)
+{
+    if (id >= SENSORS)
+    {
+        return false;
+    }
+
+    sensor_state_t * sensor = &sensors[id];
+    uint32_t head = sensor->head;
+    uint32_t count = head < SENSORS_RING_LEN - 1 ? head :
+                                                   SENSORS_RING_LEN - 1;
+    bool found = false;
+    uint64_t best = UINT64_MAX;
+
+    // Newest first, timestamps only go back from there
+    for (uint32_t i = 1; i <= count; i++)
+    {
+        sensor_sample_t candidate;
+        if (!copy_sample(sensor, head - i, &candidate))
+        {
+            break;
+        }
+        uint64_t distance = candidate.timestamp_us > timestamp_us ?
+                            candidate.timestamp_us - timestamp_us :
+                            timestamp_us - candidate.timestamp_us;
+        if (distance > best)
+        {
+            break;
+        }
+        best = distance;
+        *sample = candidate;
+        found = true;
+    }
+    return found;
+}
+
+/*!
+ * @brief   Prints counters and the newest sample of every sensor
+ */
+void sensors_report()
+{
+    printf("Sensors at %lu Hz\n", rate);
+    for (uint32_t id = 0; id < SENSORS; id++)
+    {
+        const sensor_config_t * config = &configs[id];
+        sensor_state_t * sensor = &sensors[id];
+
+        printf("%-6s 0x%02x: %lu samples, %lu errors, %lu overruns",
+               config->name, config->addr, sensor->samples, sensor->errors,
+               sensor->overruns);
+
+        sensor_sample_t sample;
+        if (sensors_latest((sensor_id_t) id, &sample))
+        {
+            printf(", %lu ms:", (uint32_t) (sample.timestamp_us / 1000));
+            for (uint8_t i = 0; i < config->len; i++)
+            {
+                printf(" %02x", sample.data[i]);
+            }
+        }
+        printf("\n");
+    }
+}
+/*** end of file ***/
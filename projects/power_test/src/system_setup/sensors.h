@@ -0,0 +1,72 @@
+#ifndef SENSORS_H
+#define SENSORS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Auxiliary sensors on I2C1, sampled in the background by TIM6, look at
+// sensors.c. Define the ones that are fitted, IMU is the accelerometer of
+// i2c_stm32f7 demo.
+#define SENSORS_IMU
+//#define SENSORS_LIGHT
+//#define SENSORS_PIR
+
+#define SENSORS_RATE_HZ     100     // Tick rate, sensors divide it down
+#define SENSORS_MAX_BYTES   6       // Longest register block of a sample
+#define SENSORS_RING_LEN    32      // Samples kept per sensor, power of two
+
+// Register is not written before the read, for sensors like BH1750
+#define SENSOR_NO_REG       0xFFFF
+
+typedef enum
+{
+#ifdef SENSORS_IMU
+    SENSOR_IMU,             // Acceleration X, Y, Z, 16 bit little endian
+#endif
+#ifdef SENSORS_LIGHT
+    SENSOR_LIGHT,           // Illuminance, 16 bit big endian, lx * 1.2
+#endif
+#ifdef SENSORS_PIR
+    SENSOR_PIR,             // Presence, 16 bit little endian
+#endif
+    SENSORS,
+} sensor_id_t;
+
+typedef struct
+{
+    uint64_t timestamp_us;  // micros() when the read was started
+    uint8_t data[SENSORS_MAX_BYTES];
+}sensor_sample_t;
+
+typedef struct
+{
+    const char * name;
+    uint8_t addr;           // 7 bit slave address
+    uint16_t reg;           // First register of the block or SENSOR_NO_REG
+    uint8_t len;            // Bytes of a sample, up to SENSORS_MAX_BYTES
+    uint8_t divider;        // Sampled every divider ticks
+    const uint8_t * init;   // Written once by sensors_start(), can be NULL
+    uint8_t init_len;
+}sensor_config_t;
+
+void sensors_start(uint32_t rate_hz);
+void sensors_stop();
+uint32_t sensors_rate();
+void sensors_clock_changed();
+bool sensors_latest(sensor_id_t id, sensor_sample_t * sample);
+bool sensors_nearest(sensor_id_t id,
+                     uint64_t timestamp_us,
+                     sensor_sample_t * sample);
+void sensors_report();
+void tim6_dac_isr();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SENSORS_H */
+/*** end of file ***/
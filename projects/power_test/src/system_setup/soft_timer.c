@@ -0,0 +1,288 @@
+#include <stddef.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/dwt.h>
+#include "soft_timer.h"
+#include "utility.h"
+#include "periph_clock.h"
+
+/* Explanation: TIM5 is a 32 bit timer of APB1, its counter runs at 1 MHz
+ * and wraps every 71 minutes, update interrupt extends it to 64 bits. Its
+ * clock keeps running in WFI, unlike DWT counter, so it can both wake the
+ * core and tell how long it slept. There is no LSE or RTC on this board,
+ * so LPTIM would run from LSI, which is off by several percent.
+ *
+ * Armed timers are a list sorted by expiry, there are only a few of them.
+ * Compare channel 1 is set to the first one, ISR takes every timer that
+ * expired, calls its callback and moves the compare to the next one.
+ * Expiry that is more than a wrap away is left to the update interrupt.
+ *
+ * soft_timer_sleep() is the sleep of event_wait() and delay_us(), it arms
+ * a private timer as the bound and moves DWT counter forward by the time
+ * the core slept, so micros() stays correct without SYSTICK_TIMER.
+ *
+ * Prescaler is only loaded by an update, so when APB1 clock changes time
+ * is folded into the base and counter restarts from 0, the switch loses
+ * less than a us. Timer is frozen in STOP, timers that were armed expire
+ * late by the time spent there, as micros() does.
+ * */
+
+static volatile uint64_t time_base = 0;
+static soft_timer_t * volatile armed_list = NULL;
+static soft_timer_t wake_timer;
+static bool running = false;
+
+static void program_next();
+
+/*!
+ * @brief   Returns TIM5 input clock, it is twice APB1 when APB1 is divided
+ */
+static uint32_t timer_clock()
+{
+    return rcc_apb1_frequency == rcc_ahb_frequency ? rcc_apb1_frequency :
+                                                     2 * rcc_apb1_frequency;
+}
+
+/*!
+ * @brief   Starts TIM5 time base
+ *
+ * @note    Call after clock_setup(), from system_setup().
+ */
+void soft_timer_setup()
+{
+    periph_clock_acquire(RCC_TIM5);
+    rcc_periph_reset_pulse(RST_TIM5);
+
+    timer_set_period(TIM5, UINT32_MAX);
+    // UG of soft_timer_clock_changed() must not count as a wrap
+    timer_update_on_overflow(TIM5);
+    timer_set_oc_value(TIM5, TIM_OC1, 0);
+    running = true;
+    time_base = 0;
+    soft_timer_clock_changed();
+
+    timer_enable_irq(TIM5, TIM_DIER_UIE);
+    nvic_enable_irq(NVIC_TIM5_IRQ);
+    timer_enable_counter(TIM5);
+}
+
+/*!
+ * @brief   Keeps 1 MHz counter after APB1 clock changed
+ *
+ * @note    Called by clock_profile_set() with interrupts masked.
+ */
+void soft_timer_clock_changed()
+{
+    if (!running)
+    {
+        return;
+    }
+
+    bool masked = cm_mask_interrupts(true);
+    uint64_t now = soft_timer_now();
+    timer_set_prescaler(TIM5, timer_clock() / SOFT_TIMER_HZ - 1);
+    // Loads prescaler now and restarts counter from 0
+    timer_generate_event(TIM5, TIM_EGR_UG);
+    time_base = now;
+    program_next();
+    cm_mask_interrupts(masked);
+}
+
+/*!
+ * @brief   Returns us since soft_timer_setup()
+ *
+ * @note    Can be called from interrupts. Wrap that is pending while
+ *          interrupts are masked is counted as well.
+ */
+uint64_t soft_timer_now()
+{
+    bool masked = cm_mask_interrupts(true);
+    uint32_t count = TIM_CNT(TIM5);
+    uint64_t base = time_base;
+
+    // Counter wrapped, but its interrupt is not served yet. Small count
+    // is from after the wrap, a large one was read before it.
+    if ((TIM_SR(TIM5) & TIM_SR_UIF) && count < (UINT32_MAX / 2))
+    {
+        base += (uint64_t) UINT32_MAX + 1;
+    }
+    cm_mask_interrupts(masked);
+    return base + count;
+}
+
+/*!
+ * @brief           Arms timer, replaces earlier expiry of the same timer
+ *
+ * @param[in] us    Time until expiry
+ *
+ * @note            Can be called from interrupts and from callbacks.
+ */
+void soft_timer_start(soft_timer_t * timer, uint32_t us)
+{
+    bool masked = cm_mask_interrupts(true);
+    soft_timer_stop(timer);
+
+    timer->expires = soft_timer_now() + us;
+    timer->expired = false;
+    timer->armed = true;
+
+    // Timers with the same expiry run in order they were started
+    soft_timer_t * volatile * link = &armed_list;
+    while (*link && (*link)->expires <= timer->expires)
+    {
+        link = &(*link)->next;
+    }
+    timer->next = *link;
+    *link = timer;
+
+    if (armed_list == timer)
+    {
+        program_next();
+    }
+    cm_mask_interrupts(masked);
+}
+
+/*!
+ * @brief   Disarms timer, its callback is not called
+ *
+ * @note    Can be called from interrupts, also for a timer that is not
+ *          armed.
+ */
+void soft_timer_stop(soft_timer_t * timer)
+{
+    bool masked = cm_mask_interrupts(true);
+    if (timer->armed)
+    {
+        soft_timer_t * volatile * link = &armed_list;
+        while (*link && *link != timer)
+        {
+            link = &(*link)->next;
+        }
+        if (*link)
+        {
+            *link = timer->next;
+        }
+        timer->armed = false;
+        timer->next = NULL;
+    }
+    cm_mask_interrupts(masked);
+}
+
+/*!
+ * @brief   Sets compare to the first armed timer
+ *
+ * @note    Call with interrupts masked. Compare that is already behind
+ *          the counter is made pending by software, so it is never lost.
+ */
+static void program_next()
+{
+    soft_timer_t * first = armed_list;
+    if (!first)
+    {
+        timer_disable_irq(TIM5, TIM_DIER_CC1IE);
+        return;
+    }
+
+    uint64_t now = soft_timer_now();
+    if (first->expires > now && first->expires - now > UINT32_MAX / 2)
+    {
+        // Update interrupt comes first and programs it again
+        timer_disable_irq(TIM5, TIM_DIER_CC1IE);
+        return;
+    }
+
+    uint32_t left = first->expires > now ?
+                    (uint32_t) (first->expires - now) : 0;
+    timer_set_oc_value(TIM5, TIM_OC1, TIM_CNT(TIM5) + left);
+    timer_clear_flag(TIM5, TIM_SR_CC1IF);
+    timer_enable_irq(TIM5, TIM_DIER_CC1IE);
+
+    // Counter can pass the compare while it is written
+    if (soft_timer_now() + 1 >= first->expires)
+    {
+        timer_generate_event(TIM5, TIM_EGR_CC1G);
+    }
+}
+
+/*!
+ * @brief   Sleeps until the next interrupt or for max_us
+ *
+ * @param[in] max_us
+ *
+ * @note    Call with interrupts masked from main context, pending
+ *          interrupt wakes the core, but it is served only once caller
+ *          unmasks them.
+ */
+void soft_timer_sleep(uint32_t max_us)
+{
+    if (max_us == 0 || !running)
+    {
+        return;
+    }
+    // Cycles to move DWT counter by have to fit 32 bits
+    if (max_us > SOFT_TIMER_MAX_SLEEP)
+    {
+        max_us = SOFT_TIMER_MAX_SLEEP;
+    }
+
+    wake_timer.callback = NULL;
+    soft_timer_start(&wake_timer, max_us);
+
+    uint64_t before = soft_timer_now();
+    uint32_t dwt_before = dwt_read_cycle_counter();
+    __asm__ volatile ("wfi");
+    uint32_t dwt_ran = dwt_read_cycle_counter() - dwt_before;
+    uint64_t slept = soft_timer_now() - before;
+
+    soft_timer_stop(&wake_timer);
+
+#ifndef SYSTICK_TIMER
+    // If debugger keeps DWT running in sleep, there is nothing to add
+    uint64_t cycles = slept * (rcc_ahb_frequency / SOFT_TIMER_HZ);
+    if (cycles > dwt_ran)
+    {
+        dwt_add_cycles((uint32_t) (cycles - dwt_ran));
+    }
+#else
+    (void) slept;
+    (void) dwt_ran;
+#endif
+}
+
+/*!
+ * @brief   Interrupt handler of TIM5, wrap of the counter and compare
+ *
+ * @note    Function name is important, it is defined in
+ *          libopencm3/include/libopencm3/stm32/f7/nvic.h .
+ */
+void tim5_isr()
+{
+    if (timer_get_flag(TIM5, TIM_SR_UIF))
+    {
+        timer_clear_flag(TIM5, TIM_SR_UIF);
+        time_base += (uint64_t) UINT32_MAX + 1;
+    }
+    timer_clear_flag(TIM5, TIM_SR_CC1IF);
+
+    uint64_t now = soft_timer_now();
+    while (armed_list && armed_list->expires <= now)
+    {
+        soft_timer_t * timer = armed_list;
+        armed_list = timer->next;
+        timer->next = NULL;
+        timer->armed = false;
+        timer->expired = true;
+
+        if (timer->callback)
+        {
+            timer->callback(timer);
+        }
+    }
+
+    bool masked = cm_mask_interrupts(true);
+    program_next();
+    cm_mask_interrupts(masked);
+}
+/*** end of file ***/
@@ -0,0 +1,74 @@
+#ifndef SOFT_TIMER_H
+#define SOFT_TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Software timers on 32 bit TIM5 that counts us, look at soft_timer.c
+#define SOFT_TIMER_HZ           1000000
+#define SOFT_TIMER_MAX_SLEEP    1000000     // In us, longest single sleep
+
+typedef struct soft_timer soft_timer_t;
+
+// Called from TIM5 interrupt, it can start the timer again
+typedef void (*soft_timer_callback_t)(soft_timer_t * timer);
+
+// Allocated statically by the owner of the timer, soft_timer.c keeps
+// pointers to armed ones
+struct soft_timer
+{
+    soft_timer_callback_t callback;     // NULL if expiry is only polled
+    void * context;
+
+    // Kept by soft_timer.c
+    uint64_t expires;                   // soft_timer_now() of expiry
+    soft_timer_t * next;
+    volatile bool armed;
+    volatile bool expired;
+};
+
+void soft_timer_setup();
+void soft_timer_clock_changed();
+uint64_t soft_timer_now();
+void soft_timer_start(soft_timer_t * timer, uint32_t us);
+void soft_timer_stop(soft_timer_t * timer);
+void soft_timer_sleep(uint32_t max_us);
+void tim5_isr();
+
+/*!
+ * @brief           Returns true once the timer expired, until it is
+ *                  started again
+ */
+static inline bool soft_timer_expired(const soft_timer_t * timer)
+{
+    return timer->expired;
+}
+
+/*!
+ * @brief           Returns soft_timer_now() value timeout ms from now,
+ *                  for soft_timer_passed()
+ */
+static inline uint64_t soft_timer_deadline(uint32_t timeout_ms)
+{
+    return soft_timer_now() + (uint64_t) timeout_ms * 1000;
+}
+
+/*!
+ * @brief           Checks deadline of soft_timer_deadline(), two register
+ *                  reads and a compare, cheap enough for polling loops
+ */
+static inline bool soft_timer_passed(uint64_t deadline)
+{
+    return soft_timer_now() > deadline;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SOFT_TIMER_H */
+/*** end of file ***/
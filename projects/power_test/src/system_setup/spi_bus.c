@@ -0,0 +1,379 @@
+#include <stddef.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/spi.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/cortex.h>
+#include "spi_bus.h"
+#include "trace.h"
+#include "cycle_budget.h"
+
+/* Explanation: SPI1 is shared by devices with different clock polarity,
+ * frame size and speed, like FLIR (16 bit, CPOL = 1, CPHA = 1) and an SD
+ * card in SPI mode (8 bit, CPOL = 0, CPHA = 0). Instead of spi_reset()
+ * and a full init for each of them, registers of every device are
+ * computed once and switching is SPE off, two register writes and SPE on,
+ * which takes well under a microsecond. It happens only when the next
+ * device differs from the last one.
+ *
+ * Device that is acquired owns the bus, its chip select is held low
+ * between transfers, as FLIR needs for segments and SD for a command
+ * with its data. Transfers are queued like in i2c_async.c and run over
+ * DMA2 stream 0 (RX) and stream 3 (TX), one after another. Transfers of
+ * the owner may overtake queued transfers of other devices, those wait
+ * until the owner releases the bus and then acquire it themselves, so SD
+ * writes run in the gaps where FLIR is deselected.
+ *
+ * Streams are set up by spi_dma_setup() in sys_init.c, here only word
+ * size, memory address and increment are changed per transfer.
+ * */
+
+#define SPI_CR1_BR_SHIFT        3
+#define SPI_CR1_BR_MASK         (0x7 << SPI_CR1_BR_SHIFT)
+#define DMA_SIZE_MASK           (DMA_SxCR_PSIZE_MASK | DMA_SxCR_MSIZE_MASK)
+
+static spi_xfer_t * volatile queue_head = NULL;
+static spi_xfer_t * volatile running = NULL;
+static spi_device_t * volatile owner = NULL;
+static spi_device_t * configured = NULL;
+
+// Fill word and sink for transfers without tx or rx
+static uint16_t tx_fill;
+static uint16_t rx_dummy;
+
+static void bus_start_next();
+
+/*!
+ * @brief   Forgets SPI1 configuration, call after spi_setup() and
+ *          spi_dma_setup()
+ */
+void spi_bus_setup()
+{
+    configured = NULL;
+    owner = NULL;
+    running = NULL;
+    queue_head = NULL;
+}
+
+/*!
+ * @brief               Computes registers of a device and deselects it
+ *
+ * @param[in] cs_port   GPIO port of chip select, pin has to be set up as
+ *                      push-pull output already
+ * @param[in] cpol      SPI_CR1_CPOL_CLK_TO_x_WHEN_IDLE
+ * @param[in] cpha      SPI_CR1_CPHA_CLK_TRANSITION_x
+ * @param[in] prescaler SPI_CR1 BR value, 0 is divider 2, 7 divider 256
+ * @param[in] word16    True for 16 bit frames, 8 bit otherwise
+ * @param[in] fill      Word that is clocked out by receive only transfers
+ */
+void spi_bus_device_init(spi_device_t * device,
+                         uint32_t cs_port,
+                         uint16_t cs_pin,
+                         uint32_t cpol,
+                         uint32_t cpha,
+                         uint8_t prescaler,
+                         bool word16,
+                         uint16_t fill)
+{
+    device->cs_port = cs_port;
+    device->cs_pin = cs_pin;
+    device->cr1 = SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI | cpol | cpha |
+                  ((prescaler << SPI_CR1_BR_SHIFT) & SPI_CR1_BR_MASK);
+    // 8 bit frames need RXNE at 8 bits, otherwise it waits for two
+    device->cr2 = word16 ? SPI_CR2_DS_16BIT :
+                           (SPI_CR2_DS_8BIT | SPI_CR2_FRXTH);
+    device->dma_size = word16 ? (DMA_SxCR_PSIZE_16BIT | DMA_SxCR_MSIZE_16BIT) :
+                                (DMA_SxCR_PSIZE_8BIT | DMA_SxCR_MSIZE_8BIT);
+    device->fill = fill;
+    gpio_set(cs_port, cs_pin);
+}
+
+/*!
+ * @brief               Changes clock prescaler of a device
+ *
+ * @note                Applied right away if device is the configured one
+ *                      and nothing runs, otherwise on the next switch or
+ *                      transfer.
+ */
+void spi_bus_set_prescaler(spi_device_t * device, uint8_t prescaler)
+{
+    bool masked = cm_mask_interrupts(true);
+    device->cr1 = (device->cr1 & ~SPI_CR1_BR_MASK) |
+                  ((prescaler << SPI_CR1_BR_SHIFT) & SPI_CR1_BR_MASK);
+    if (configured == device && !running)
+    {
+        SPI_CR1(SPI1) = (SPI_CR1(SPI1) & ~SPI_CR1_BR_MASK) |
+                        (device->cr1 & SPI_CR1_BR_MASK);
+    }
+    cm_mask_interrupts(masked);
+}
+
+/*!
+ * @brief   Loads registers of the device, if it is not configured already
+ *
+ * @note    Bus is idle, no chip select is low
+ */
+static void bus_configure(spi_device_t * device)
+{
+    if (configured == device)
+    {
+        return;
+    }
+    while (SPI_SR(SPI1) & SPI_SR_BSY);
+
+    spi_disable(SPI1);
+    SPI_CR1(SPI1) = device->cr1;
+    SPI_CR2(SPI1) = device->cr2;
+    // Idle clock level of the new CPOL comes into effect here
+    spi_enable(SPI1);
+    configured = device;
+}
+
+/*!
+ * @brief               Selects device, if bus is free
+ *
+ * @return              True if device owns the bus now
+ *
+ * @note                Can be called from interrupts.
+ */
+bool spi_bus_try_acquire(spi_device_t * device)
+{
+    bool masked = cm_mask_interrupts(true);
+    bool acquired = owner == device;
+    if (!owner && !running)
+    {
+        bus_configure(device);
+        gpio_clear(device->cs_port, device->cs_pin);
+        owner = device;
+        acquired = true;
+    }
+    cm_mask_interrupts(masked);
+    return acquired;
+}
+
+/*!
+ * @brief               Selects device, waits until the bus is free
+ *
+ * @note                Transfers of other devices finish from DMA
+ *                      interrupt, do not call it from interrupts of the
+ *                      same or higher priority while they can run.
+ */
+void spi_bus_acquire(spi_device_t * device)
+{
+    while (!spi_bus_try_acquire(device));
+}
+
+/*!
+ * @brief               Deselects device, queued transfers of other
+ *                      devices start
+ *
+ * @note                Can be called from interrupts. Transfer that runs
+ *                      for the device is finished first.
+ */
+void spi_bus_release(spi_device_t * device)
+{
+    bool masked = cm_mask_interrupts(true);
+    if (owner == device)
+    {
+        if (running && running->device == device)
+        {
+            running->release = true;
+        }
+        else
+        {
+            while (SPI_SR(SPI1) & SPI_SR_BSY);
+            gpio_set(device->cs_port, device->cs_pin);
+            owner = NULL;
+            if (!running)
+            {
+                bus_start_next();
+            }
+        }
+    }
+    else
+    {
+        gpio_set(device->cs_port, device->cs_pin);
+    }
+    cm_mask_interrupts(masked);
+}
+
+/*!
+ * @brief               Adds transfer at the end of the queue
+ *
+ * @param[in] xfer      Transfer, it is owned by the engine until callback
+ *
+ * @return              False if transfer is not valid
+ *
+ * @note                Can be called from callbacks, that is how packets
+ *                      are chained. Device is acquired when its transfer
+ *                      starts, if it does not own the bus yet.
+ */
+bool spi_bus_submit(spi_xfer_t * xfer)
+{
+    if (!xfer || !xfer->device || !xfer->len)
+    {
+        return false;
+    }
+
+    xfer->next = NULL;
+
+    bool masked = cm_mask_interrupts(true);
+    if (!queue_head)
+    {
+        queue_head = xfer;
+    }
+    else
+    {
+        spi_xfer_t * last = queue_head;
+        while (last->next)
+        {
+            last = last->next;
+        }
+        last->next = xfer;
+    }
+
+    if (!running)
+    {
+        bus_start_next();
+    }
+    cm_mask_interrupts(masked);
+    return true;
+}
+
+/*!
+ * @brief   Returns true while any transfer is queued or running
+ */
+bool spi_bus_busy()
+{
+    return queue_head != NULL || running != NULL;
+}
+
+/*!
+ * @brief   Starts DMA of the transfer, device owns the bus
+ */
+static void xfer_start(spi_xfer_t * xfer)
+{
+    spi_device_t * device = xfer->device;
+    running = xfer;
+
+    // Stream can not be enabled, if any of its flags is still set
+    dma_clear_interrupt_flags(DMA2, DMA_STREAM0, DMA_TCIF | DMA_HTIF | DMA_TEIF |
+                                                 DMA_DMEIF | DMA_FEIF);
+    dma_clear_interrupt_flags(DMA2, DMA_STREAM3, DMA_TCIF | DMA_HTIF | DMA_TEIF |
+                                                 DMA_DMEIF | DMA_FEIF);
+
+    // Streams are disabled, size bits can change
+    DMA_SCR(DMA2, DMA_STREAM0) = (DMA_SCR(DMA2, DMA_STREAM0) & ~DMA_SIZE_MASK) |
+                                 device->dma_size;
+    DMA_SCR(DMA2, DMA_STREAM3) = (DMA_SCR(DMA2, DMA_STREAM3) & ~DMA_SIZE_MASK) |
+                                 device->dma_size;
+
+    if (xfer->rx)
+    {
+        dma_enable_memory_increment_mode(DMA2, DMA_STREAM0);
+        dma_set_memory_address(DMA2, DMA_STREAM0, (uint32_t) xfer->rx);
+    }
+    else
+    {
+        dma_disable_memory_increment_mode(DMA2, DMA_STREAM0);
+        dma_set_memory_address(DMA2, DMA_STREAM0, (uint32_t) &rx_dummy);
+    }
+    if (xfer->tx)
+    {
+        dma_enable_memory_increment_mode(DMA2, DMA_STREAM3);
+        dma_set_memory_address(DMA2, DMA_STREAM3, (uint32_t) xfer->tx);
+    }
+    else
+    {
+        tx_fill = device->fill;
+        dma_disable_memory_increment_mode(DMA2, DMA_STREAM3);
+        dma_set_memory_address(DMA2, DMA_STREAM3, (uint32_t) &tx_fill);
+    }
+    dma_set_number_of_data(DMA2, DMA_STREAM0, xfer->len);
+    dma_set_number_of_data(DMA2, DMA_STREAM3, xfer->len);
+
+    // Prescaler might have changed while the device was configured
+    SPI_CR1(SPI1) = (SPI_CR1(SPI1) & ~SPI_CR1_BR_MASK) |
+                    (device->cr1 & SPI_CR1_BR_MASK);
+
+    // Receive side has to be ready before first word is clocked out
+    spi_enable_rx_dma(SPI1);
+    dma_enable_stream(DMA2, DMA_STREAM0);
+    dma_enable_stream(DMA2, DMA_STREAM3);
+    spi_enable_tx_dma(SPI1);
+}
+
+/*!
+ * @brief   Starts first queued transfer that may run, transfers of the
+ *          owner first
+ *
+ * @note    Interrupts are masked, nothing is running
+ */
+static void bus_start_next()
+{
+    spi_xfer_t * prev = NULL;
+    for (spi_xfer_t * xfer = queue_head; xfer; prev = xfer, xfer = xfer->next)
+    {
+        if (owner && xfer->device != owner)
+        {
+            continue;
+        }
+
+        if (prev)
+        {
+            prev->next = xfer->next;
+        }
+        else
+        {
+            queue_head = xfer->next;
+        }
+
+        if (!owner)
+        {
+            bus_configure(xfer->device);
+            gpio_clear(xfer->device->cs_port, xfer->device->cs_pin);
+            owner = xfer->device;
+        }
+        xfer_start(xfer);
+        return;
+    }
+}
+
+/*!
+ * @brief   Interrupt handler for SPI1_RX DMA stream
+ *
+ * @note    Function name is important, it is defined in
+ *          libopencm3/include/libopencm3/stm32/f7/nvic.h . Next transfer
+ *          is started before callback, so callback that submits a new
+ *          transfer just queues it, unless the bus is free.
+ */
+void dma2_stream0_isr()
+{
+    CYCLE_BUDGET(BUDGET_SPI_DMA_ISR, BUDGET_SPI_DMA_ISR_CYCLES);
+    spi_xfer_t * xfer = running;
+    bool status = !dma_get_interrupt_flag(DMA2, DMA_STREAM0, DMA_TEIF);
+    TRACE(TRACE_SPI_DMA_ISR, status);
+
+    dma_clear_interrupt_flags(DMA2, DMA_STREAM0, DMA_TCIF | DMA_TEIF);
+    spi_disable_tx_dma(SPI1);
+    spi_disable_rx_dma(SPI1);
+    running = NULL;
+
+    if (!xfer)
+    {
+        return;
+    }
+
+    if (xfer->release && owner == xfer->device)
+    {
+        while (SPI_SR(SPI1) & SPI_SR_BSY);
+        gpio_set(xfer->device->cs_port, xfer->device->cs_pin);
+        owner = NULL;
+    }
+    bus_start_next();
+
+    if (xfer->callback)
+    {
+        xfer->callback(xfer, status);
+    }
+}
+/*** end of file ***/
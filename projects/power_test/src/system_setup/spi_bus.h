@@ -0,0 +1,66 @@
+#ifndef SPI_BUS_H
+#define SPI_BUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Device on SPI1 with its own chip select and configuration. Registers
+// are computed once by spi_bus_device_init() and only copied on switch.
+typedef struct
+{
+    uint32_t cs_port;
+    uint16_t cs_pin;
+    uint16_t cr1;               // SPI_CR1 without SPE
+    uint16_t cr2;               // SPI_CR2 without DMA enables
+    uint32_t dma_size;          // PSIZE and MSIZE of both DMA streams
+    uint16_t fill;              // Clocked out when transfer has no tx
+}spi_device_t;
+
+typedef struct spi_xfer spi_xfer_t;
+
+// Called from DMA2 stream 0 interrupt when transfer is finished
+typedef void (*spi_xfer_callback)(spi_xfer_t * xfer, bool status);
+
+// Full duplex transfer of len words of the device, either side can be
+// NULL. Transfer has to stay valid until its callback is called.
+struct spi_xfer
+{
+    spi_device_t * device;
+    const void * tx;            // NULL clocks out device fill word
+    void * rx;                  // NULL drops received words
+    uint16_t len;
+    bool release;               // Deselects device when done
+    spi_xfer_callback callback;
+    void * context;             // Free for callback
+
+    // Used by the engine
+    spi_xfer_t * next;
+};
+
+void spi_bus_setup();
+void spi_bus_device_init(spi_device_t * device,
+                         uint32_t cs_port,
+                         uint16_t cs_pin,
+                         uint32_t cpol,
+                         uint32_t cpha,
+                         uint8_t prescaler,
+                         bool word16,
+                         uint16_t fill);
+void spi_bus_set_prescaler(spi_device_t * device, uint8_t prescaler);
+bool spi_bus_try_acquire(spi_device_t * device);
+void spi_bus_acquire(spi_device_t * device);
+void spi_bus_release(spi_device_t * device);
+bool spi_bus_submit(spi_xfer_t * xfer);
+bool spi_bus_busy();
+void dma2_stream0_isr();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SPI_BUS_H */
+/*** end of file ***/
@@ -0,0 +1,134 @@
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/pwr.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/scb.h>
+#include <libopencm3/cm3/cortex.h>
+#include "stop_mode.h"
+#include "clock_profile.h"
+#include "uart_tx.h"
+#include "utility.h"
+#include "counters.h"
+#include "periph_clock.h"
+#include "sdram.h"
+
+/* Explanation: STOP keeps SRAM and registers, but stops every clock of
+ * the 1.2 V domain, PLL, HSI and HSE included. Regulator goes to low power
+ * mode and flash is powered down, board then draws a few hundred uA
+ * instead of tens of mA in WFI. Only EXTI lines wake the core, here the
+ * STOP_WAKE_PIN and, so that the console is not locked out, falling edge
+ * of USART2 RX.
+ *
+ * Core wakes on HSI at 16 MHz, clock_profile_resume() locks PLL of the
+ * profile that was used before and updates bus clock dependent
+ * peripherals, around 200 us. Peripherals that were running are frozen,
+ * not stopped, so transfers like FLIR capture, I2C or console DMA have to
+ * be finished before stop_mode_enter(). SDRAM of EXT_SDRAM refreshes
+ * itself in the meantime.
+ *
+ * DWT counter and SysTick stop as well, so micros() and millis() do not
+ * count the time spent in STOP, there is no RTC on this board to add it.
+ * stop_mode_wake_time() is micros() right after the clock is restored,
+ * latencies are measured from there.
+ * */
+
+static uint64_t wake_time = 0;
+
+/*!
+ * @brief   Configures wake pin and EXTI lines
+ *
+ * @note    Console line is only enabled while in STOP.
+ */
+void stop_mode_setup()
+{
+    rcc_periph_clock_enable(STOP_WAKE_PORT_RCC);
+    gpio_mode_setup(STOP_WAKE_PORT, GPIO_MODE_INPUT, GPIO_PUPD_PULLDOWN,
+                    STOP_WAKE_PIN);
+
+    periph_clock_acquire(RCC_SYSCFG);
+    exti_select_source(STOP_WAKE_EXTI, STOP_WAKE_PORT);
+    exti_set_trigger(STOP_WAKE_EXTI, EXTI_TRIGGER_RISING);
+    exti_select_source(STOP_CONSOLE_EXTI, STOP_CONSOLE_PORT);
+    exti_set_trigger(STOP_CONSOLE_EXTI, EXTI_TRIGGER_FALLING);
+
+    nvic_enable_irq(STOP_WAKE_IRQ);
+    nvic_enable_irq(STOP_CONSOLE_IRQ);
+}
+
+/*!
+ * @brief   Enters STOP mode and returns once the core is woken up and
+ *          clock is restored
+ *
+ * @return  What woke the core
+ *
+ * @note    Waits for log output. Wake pin that is already high does not
+ *          wake, only its next rising edge.
+ */
+stop_wake_t stop_mode_enter()
+{
+    uart_tx_flush(100);
+
+    bool masked = cm_mask_interrupts(true);
+    while (!usart_get_flag(USART2, USART_ISR_TC));
+
+    // Edges before this point are old news
+    exti_reset_request(STOP_WAKE_EXTI | STOP_CONSOLE_EXTI);
+    exti_enable_request(STOP_WAKE_EXTI | STOP_CONSOLE_EXTI);
+
+    // SDCLK stops, chip keeps its data on its own
+    sdram_sleep();
+    PWR_CR1 = (PWR_CR1 & ~PWR_CR1_PDDS) | PWR_CR1_LPDS | PWR_CR1_FPDS;
+    SCB_SCR |= SCB_SCR_SLEEPDEEP;
+    __asm__ volatile ("dsb");
+    __asm__ volatile ("wfi");
+    SCB_SCR &= ~SCB_SCR_SLEEPDEEP;
+
+    uint32_t pending = EXTI_PR;
+    stop_wake_t wake = STOP_WAKE_NONE;
+    if (pending & STOP_CONSOLE_EXTI)
+    {
+        wake = STOP_WAKE_CONSOLE;
+    }
+    else if (pending & STOP_WAKE_EXTI)
+    {
+        wake = STOP_WAKE_PIN_EDGE;
+    }
+
+    // Pending interrupt makes WFI return without STOP, switching again
+    // does no harm then
+    clock_profile_resume();
+    sdram_wake();
+    exti_disable_request(STOP_CONSOLE_EXTI);
+    exti_reset_request(STOP_WAKE_EXTI | STOP_CONSOLE_EXTI);
+
+    wake_time = micros();
+    if (wake != STOP_WAKE_NONE)
+    {
+        counter_add(COUNTER_STOP_WAKEUPS, 1);
+    }
+    cm_mask_interrupts(masked);
+    return wake;
+}
+
+/*!
+ * @brief   Returns micros() of the last wake up from STOP
+ */
+uint64_t stop_mode_wake_time()
+{
+    return wake_time;
+}
+
+// Lines are read and cleared by stop_mode_enter(), handlers only make 
+// sure that an edge outside of STOP does not stay pending
+void exti15_10_isr()
+{
+    exti_reset_request(STOP_WAKE_EXTI);
+}
+
+void exti9_5_isr()
+{
+    exti_reset_request(STOP_CONSOLE_EXTI);
+}
+/*** end of file ***/
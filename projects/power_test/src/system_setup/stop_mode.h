@@ -0,0 +1,44 @@
+#ifndef STOP_MODE_H
+#define STOP_MODE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Pin that wakes the core from STOP, output of a PIR motion sensor, active
+// high. PC13 is also the user button of Nucleo-144, so it can be tested
+// without the sensor.
+#define STOP_WAKE_PORT          GPIOC
+#define STOP_WAKE_PORT_RCC      RCC_GPIOC
+#define STOP_WAKE_PIN           GPIO13
+#define STOP_WAKE_EXTI          EXTI13
+#define STOP_WAKE_IRQ           NVIC_EXTI15_10_IRQ
+
+// Start bit on USART2 RX (PD6) wakes the core as well, so the console can
+// end STOP cycles. Characters received before the clock is back are lost.
+#define STOP_CONSOLE_PORT       GPIOD
+#define STOP_CONSOLE_EXTI       EXTI6
+#define STOP_CONSOLE_IRQ        NVIC_EXTI9_5_IRQ
+
+typedef enum
+{
+    STOP_WAKE_NONE,         // Another interrupt was pending, nothing slept
+    STOP_WAKE_PIN_EDGE,     // Rising edge on STOP_WAKE_PIN
+    STOP_WAKE_CONSOLE,      // Character on the console
+} stop_wake_t;
+
+void stop_mode_setup();
+stop_wake_t stop_mode_enter();
+uint64_t stop_mode_wake_time();
+void exti15_10_isr();
+void exti9_5_isr();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STOP_MODE_H */
+/*** end of file ***/
@@ -3,46 +3,211 @@
 #include <libopencm3/stm32/usart.h>
 #include <libopencm3/stm32/i2c.h>
 #include <libopencm3/stm32/spi.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/nvic.h>
 #include <libopencm3/cm3/systick.h>
 #include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/mpu.h>
+#include <libopencm3/cm3/scb.h>
 #include "sys_init.h"
 #include "fastflash.h"
+#include "dma_buf.h"
+#include "crc_hw.h"
+#include "dma2d.h"
+#include "soft_timer.h"
 #include "printf.h"
+#include "uart_tx.h"
+#include "clock_profile.h"
+#include "i2c_async.h"
+#include "i2c_timing.h"
+#include "spi_bus.h"
+#include "utility.h"
+#include "trace.h"
+#include "stop_mode.h"
+#include "periph_clock.h"
+#include "irq_prio.h"
+#include "qspi_flash.h"
+#include "sdram.h"
+#include "dcmi_cam.h"
+#include "eth_udp.h"
+#include "flash_store.h"
+#include "config_store.h"
+#include "model_slot.h"
+
+#if defined(EXT_SDRAM) && defined(QSPI_MODEL)
+#error "SDNE1 of SDRAM and NCS of QSPI flash are both on PB6"
+#endif
+#if defined(EXT_SDRAM) && defined(DCMI_CAMERA)
+#error "USART3 RX is on PC11 with EXT_SDRAM, which is D4 of DCMI_CAMERA"
+#endif
+#if defined(DCMI_CAMERA) && defined(CLOCK_MCO_OUTPUT)
+#error "MCO1 is XCLK of the camera with DCMI_CAMERA"
+#endif
+
+// printf output goes through interrupt driven buffer, so logging does not
+// stall inference, use uart_tx_flush() if output has to be out
 void _putchar(char character)
 {
-    usart_send_blocking(USART3, character);
+    uart_tx_putc(character);
 }
 
-// Our clock frequency in MHz, it has to be set manually by programmer in clock setup
-// It is used for calculating micros in utility.c
-volatile uint8_t g_clock_mhz = 0;
+// Our clock frequency in MHz, it is set together with the clock profile
+// It is used for calculating micros in utility.c. Core comes out of reset
+// on 16 MHz HSI, so micros() is right before clock_setup() as well.
+volatile uint8_t g_clock_mhz = 16;
+
+/* Explanation: until enable_fastflash() every instruction is fetched from
+ * flash with 7 wait states and no ART, as clock_setup() sets them for
+ * 216 MHz, so system_setup() first switches the clock and turns the
+ * caches on and only then runs the rest. I2C1 and SPI1 are not set up
+ * here, their first user calls sys_require(), Lepton boots for more than
+ * a second anyway and nothing before it needs them.
+ *
+ * Boot phases are stamped with micros() by boot_mark(), DWT is started
+ * first, so the time of the startup code before main() is all that is
+ * missing. boot_report() prints them, with bytes that the reset handler
+ * copies and zeroes before main(). Startup runs on 16 MHz HSI with flash
+ * wait states, so frame buffers and other large arrays are NOINIT_BSS and
+ * not zeroed, tensor arena is DTCM_BSS, which is not zeroed either.
+ * */
+
+// Bounds of what reset handler copies and zeroes, from libopencm3 linker
+// script, and of .noinit that it skips, from memory_sections.ld
+extern uint8_t _data;
+extern uint8_t _edata;
+extern uint8_t _ebss;
+extern uint8_t _noinit;
+extern uint8_t _enoinit;
+
+static const char * const boot_phase_names[BOOT_PHASES] =
+{
+    [BOOT_CORE]         = "core",
+    [BOOT_SYSTEM]       = "system",
+    [BOOT_INFERENCE]    = "inference",
+    [BOOT_CAMERA]       = "camera",
+    [BOOT_FIRST_FRAME]  = "first_frame",
+};
+
+static uint32_t boot_us[BOOT_PHASES];
+static volatile uint32_t periphs_ready = 0;
 
 void system_setup()
 {
+    // Levels are set before the first interrupt is enabled
+    irq_setup();
+    // DWT is the timestamp base in both cases, see dwt_cycles64()
+    dwt_setup();
+    itcm_setup();
     clock_setup();
-    usart_setup();
-    gpio_setup();
-    i2c_setup();
-    spi_setup();
+    // Sleeps of event_wait() and delay_us() need it, see soft_timer.c
+    soft_timer_setup();
+    // Before caches are on, so nothing is cached from non-cacheable regions
+    mpu_setup();
+#ifdef EXT_SDRAM
+    // Before caches are on, its test has to reach the chip, STATS tells
+    // if it failed
+    sdram_setup();
+#endif
     enable_fastflash();
-
+#ifdef QSPI_MODEL
+    // Model in QSPI flash is read from inference_setup() on
+    qspi_flash_setup();
+#endif
 #ifdef SYSTICK_TIMER
     systick_setup();
-#else
-    dwt_setup();
 #endif
+    boot_mark(BOOT_CORE);
+
+    dma_buf_setup();
+    crc_hw_setup();
+    dma2d_setup();
+    usart_setup();
+    uart_tx_setup();
+    gpio_setup();
+    trace_setup();
+    stop_mode_setup();
+    boot_mark(BOOT_SYSTEM);
+}
 
+/*!
+ * @brief               Sets up peripherals that system_setup() left out,
+ *                      the ones that are ready already are skipped
+ *
+ * @param[in] periphs   SYS_PERIPH_ flags
+ *
+ * @note                Call from main context before the first transfer,
+ *                      afterwards it is only a check and can be called
+ *                      from anywhere.
+ */
+void sys_require(uint32_t periphs)
+{
+    uint32_t missing = periphs & ~periphs_ready;
+    if (!missing)
+    {
+        return;
+    }
+
+    if (missing & SYS_PERIPH_I2C)
+    {
+        i2c_setup();
+        i2c_async_setup();
+    }
+    if (missing & SYS_PERIPH_SPI)
+    {
+        spi_setup();
+        spi_dma_setup();
+    }
+    periphs_ready |= missing;
+}
+
+/*!
+ * @brief               Stamps the first time a boot phase is reached
+ *
+ * @note                Can be called from interrupts, later calls of the
+ *                      same phase are ignored.
+ */
+void boot_mark(boot_phase_t phase)
+{
+    if (phase < BOOT_PHASES && !boot_us[phase])
+    {
+        boot_us[phase] = (uint32_t) micros();
+    }
+}
+
+/*!
+ * @brief   Prints time of every boot phase since reset and since the 
+ *          phase before it
+ */
+void boot_report()
+{
+    uint32_t last = 0;
+
+    printf("Boot phases in us\n");
+    for (uint32_t i = 0; i < BOOT_PHASES; i++)
+    {
+        if (!boot_us[i])
+        {
+            printf("%-12s not reached\n", boot_phase_names[i]);
+            continue;
+        }
+        printf("%-12s %9lu, +%lu\n", boot_phase_names[i], boot_us[i],
+                                      boot_us[i] - last);
+        last = boot_us[i];
+    }
+    printf("Reset: %lu bytes copied, %lu zeroed, %lu not initialised\n",
+           (uint32_t) (&_edata - &_data), (uint32_t) (&_ebss - &_edata),
+           (uint32_t) (&_enoinit - &_noinit));
 }
 
 
 void clock_setup()
 {
     // First, let's ensure that our clock is running off the high-speed internal
-    // oscillator (HSI) at 216MHz.
-    rcc_clock_setup_hsi(&rcc_3v3[RCC_CLOCK_3V3_216MHZ]);
-
-    g_clock_mhz = 216;     // Has to be the same as our clock in Mhz
+    // oscillator (HSI) at 216MHz. Profile can be changed later, look at
+    // clock_profile.c, g_clock_mhz follows it.
+    clock_profile_init();
 
+#ifdef CLOCK_MCO_OUTPUT
     // Turn on MCO1 and MCO2 pins which show you internal frequencies
     // Both will have prescaler division of 4
 
@@ -57,11 +222,12 @@ void clock_setup()
     gpio_mode_setup(GPIOC, GPIO_MODE_AF, GPIO_PUPD_NONE, GPIO9);
 	gpio_set_af(GPIOC, GPIO_AF0, GPIO9);
     RCC_CFGR |= (RCC_CFGR_MCOPRE_DIV_4 << RCC_CFGR_MCO2PRE_SHIFT);
+#endif
 }
 
 void i2c_setup(void)
 {
-    rcc_periph_clock_enable(RCC_I2C1);
+    periph_clock_acquire(RCC_I2C1);
     rcc_periph_clock_enable(RCC_GPIOB);
 
     // Setup PB8 and PB9 as I2C pins
@@ -72,14 +238,15 @@ void i2c_setup(void)
 	i2c_reset(I2C1);
 	i2c_peripheral_disable(I2C1);
 
-	// Set HSI as clock for I2C peripheral
-	RCC_DCKCFGR2 |= (0x10 << RCC_DCKCFGR2_I2C1SEL_SHIFT);
+	// Set HSI as kernel clock of I2C1, so it does not change with profiles
+	RCC_DCKCFGR2 = (RCC_DCKCFGR2 & ~(0x3 << RCC_DCKCFGR2_I2C1SEL_SHIFT)) | 
+	               (0x2 << RCC_DCKCFGR2_I2C1SEL_SHIFT);
 
-	i2c_enable_analog_filter(I2C1);
 	i2c_set_digital_filter(I2C1, 0); //Disabled
 
-	// HSI is at 16Mhz
-	i2c_set_speed(I2C1, i2c_speed_sm_100k, 16);
+	// Analog filter and TIMINGR of default speed, slaves can get their
+	// own with i2c_timing_set_device()
+	i2c_timing_setup(CLOCK_I2C1_MHZ * 1000000);
 	i2c_enable_stretching(I2C1);
 	i2c_set_7bit_addr_mode(I2C1);
 
@@ -89,7 +256,7 @@ void i2c_setup(void)
 void spi_setup()
 {
     // Enable clock for SPI1 peripheral and gpio pins
-    rcc_periph_clock_enable(RCC_SPI1);
+    periph_clock_acquire(RCC_SPI1);
     rcc_periph_clock_enable(RCC_GPIOA);
     // SPI1 pins are:
     // - MISO = PA6, But we do not need it here, we are doing master recive only
@@ -97,26 +264,37 @@ void spi_setup()
     // - SCK  = PA5 
     
     // Setup GPIOA PB8 and PB9 as I2C pins
+#ifdef DCMI_CAMERA
+    // PA6 is PIXCLK of the camera, MISO moves to PG9
+    rcc_periph_clock_enable(RCC_GPIOG);
+	gpio_set_af(GPIOG, GPIO_AF5, GPIO9);
+    gpio_mode_setup(GPIOG, GPIO_MODE_AF, GPIO_PUPD_NONE, GPIO9);
+	gpio_set_af(GPIOA, GPIO_AF5, GPIO5 | GPIO7);
+    gpio_mode_setup(GPIOA, GPIO_MODE_AF, GPIO_PUPD_NONE, GPIO5 | GPIO7);
+#elif defined(ETH_UDP)
+    // PA7 is CRS_DV of the PHY, which drives it, MOSI is not needed
+	gpio_set_af(GPIOA, GPIO_AF5, GPIO5 | GPIO6);
+    gpio_mode_setup(GPIOA, GPIO_MODE_AF, GPIO_PUPD_NONE, GPIO5 | GPIO6);
+#else
 	gpio_set_af(GPIOA, GPIO_AF5, GPIO5 | GPIO6 | GPIO7);
     gpio_mode_setup(GPIOA, GPIO_MODE_AF, GPIO_PUPD_NONE, GPIO5 | GPIO6 | GPIO7);
+#endif
 
     // Notice that after above two lines we do not do anything with PA6,
     // as it is treated as input
+#ifdef ETH_UDP
 	gpio_set_output_options(GPIOA, 
                             GPIO_OTYPE_PP, 
                             GPIO_OSPEED_25MHZ, 
-                            GPIO5 | GPIO7);
-
-    //Prepare our SS pin
-    rcc_periph_clock_enable(RCC_GPIOB);
-
-    //Pull it high, before stting it as output
-    gpio_set(GPIOB, GPIO4); 
-    gpio_mode_setup(GPIOB, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, GPIO4);
-	gpio_set_output_options(GPIOB, 
+                            GPIO5);
+#else
+	gpio_set_output_options(GPIOA, 
                             GPIO_OTYPE_PP, 
                             GPIO_OSPEED_25MHZ, 
-                            GPIO4);
+                            GPIO5 | GPIO7);
+#endif
+
+    // SS pin is driven high by gpio_setup() already, Lepton boots with it
 
     // Reset our peripheral
     spi_reset(SPI1);
@@ -124,8 +302,7 @@ void spi_setup()
     // Set main SPI settings:
     // - CPOL = 1, CPHA = 1
     // - Send the most significant bit (MSB) first
-    // - Highest possible speed, take note that you will have to change this 
-    // if you set system clock higher
+    // - Prescaler is replaced below with the one for current APB2 clock
     spi_init_master(SPI1, 
                     SPI_CR1_BAUDRATE_FPCLK_DIV_8, 
                     SPI_CR1_CPOL_CLK_TO_1_WHEN_IDLE,
@@ -147,27 +324,254 @@ void spi_setup()
     // We're using 16 bit per packet
     spi_set_data_size(SPI1, SPI_CR2_DS_16BIT);
 
+    // Fastest SCK that Lepton allows, look at clock_profile.c
+    spi_set_baudrate_prescaler(SPI1, clock_spi1_prescaler());
+
     // Enable the peripheral, CPOL = 1 will come into effect here
     spi_enable(SPI1);
+
+    // Same settings once more, so spi_bus.c can switch back to them when
+    // another device used SPI1
+    spi_bus_setup();
+    spi_bus_device_init(&spi_flir,
+                        GPIOB,
+                        GPIO4,
+                        SPI_CR1_CPOL_CLK_TO_1_WHEN_IDLE,
+                        SPI_CR1_CPHA_CLK_TRANSITION_2,
+                        clock_spi1_prescaler(),
+                        true,
+                        0);
+}
+
+/*!
+ * @brief   Prepares DMA2 streams used by SPI1
+ *
+ * @note    SPI1_RX is mapped on DMA2 stream 0, channel 3 and SPI1_TX on 
+ *          DMA2 stream 3, channel 3. TX stream only clocks out dummy words, 
+ *          so that SPI clock runs only while we are receiving a packet. 
+ *          Word size, memory address and number of data are set per
+ *          transfer by spi_bus.c, which also contains the interrupt handler.
+ */
+void spi_dma_setup()
+{
+    periph_clock_acquire(RCC_DMA2);
+
+    // Receive stream
+    dma_stream_reset(DMA2, DMA_STREAM0);
+    dma_channel_select(DMA2, DMA_STREAM0, DMA_SxCR_CHSEL_3);
+    dma_set_priority(DMA2, DMA_STREAM0, DMA_SxCR_PL_VERY_HIGH);
+    dma_set_transfer_mode(DMA2, DMA_STREAM0, DMA_SxCR_DIR_PERIPHERAL_TO_MEM);
+    dma_set_peripheral_address(DMA2, DMA_STREAM0, (uint32_t) &SPI1_DR);
+    dma_set_peripheral_size(DMA2, DMA_STREAM0, DMA_SxCR_PSIZE_16BIT);
+    dma_set_memory_size(DMA2, DMA_STREAM0, DMA_SxCR_MSIZE_16BIT);
+    dma_enable_memory_increment_mode(DMA2, DMA_STREAM0);
+    dma_enable_transfer_complete_interrupt(DMA2, DMA_STREAM0);
+    dma_enable_transfer_error_interrupt(DMA2, DMA_STREAM0);
+
+    // Transmit stream, memory address is not incremented, 
+    // we are always sending the same dummy word
+    dma_stream_reset(DMA2, DMA_STREAM3);
+    dma_channel_select(DMA2, DMA_STREAM3, DMA_SxCR_CHSEL_3);
+    dma_set_priority(DMA2, DMA_STREAM3, DMA_SxCR_PL_HIGH);
+    dma_set_transfer_mode(DMA2, DMA_STREAM3, DMA_SxCR_DIR_MEM_TO_PERIPHERAL);
+    dma_set_peripheral_address(DMA2, DMA_STREAM3, (uint32_t) &SPI1_DR);
+    dma_set_peripheral_size(DMA2, DMA_STREAM3, DMA_SxCR_PSIZE_16BIT);
+    dma_set_memory_size(DMA2, DMA_STREAM3, DMA_SxCR_MSIZE_16BIT);
+    dma_disable_memory_increment_mode(DMA2, DMA_STREAM3);
+
+    // Only receive stream fires an interrupt, as it finishes last
+    nvic_enable_irq(NVIC_DMA2_STREAM0_IRQ);
+}
+
+// Bounds of ITCM code and its copy in flash, from memory_sections.ld
+extern uint32_t _itcm_text;
+extern uint32_t _eitcm_text;
+extern uint32_t _itcm_text_loadaddr;
+
+/*!
+ * @brief   Copies code of .itcm_text from flash into ITCM RAM
+ *
+ * @note    Call it first, before any function placed in ITCM runs. ITCM
+ *          is not cached, so only the pipeline has to be flushed.
+ */
+void itcm_setup()
+{
+    const uint32_t * src = &_itcm_text_loadaddr;
+    for (uint32_t * dst = &_itcm_text; dst < &_eitcm_text; dst++)
+    {
+        *dst = *src++;
+    }
+    __DSB();
+    __ISB();
+}
+
+/* Explanation: MPU regions are described by the table in mpu_setup(),
+ * addresses that no region covers keep default memory map, peripherals
+ * among them. Where regions overlap, the one with higher number wins, so
+ * small regions come after the big ones they cut out of.
+ *
+ * - ITCM RAM holds code copied by itcm_setup(), it is read only from then
+ *   on, which also turns writes through null pointer into faults.
+ * - Flash on AXIM holds code, constants and model weights. It is read
+ *   only and write-through cached, which equals default attributes, but a
+ *   stray write into weights now faults instead of being ignored.
+ * - Bank 2, the upper 1 MB of flash, holds model slot, config store and
+ *   flash store, flash_store.c programs them with word stores. It is read
+ *   write and non-cacheable, so those stores pass and no stale line of a
+ *   sector is read after it was written. Model of the slot is read
+ *   without D-cache, only ART on ITCM would cache it.
+ * - RAM is DTCM, SRAM1 and SRAM2 as one 512 KB region, write-back with
+ *   write allocate, which suits arena scratch. DTCM is never cached, so
+ *   attributes only matter for the part of arena that spills into SRAM1.
+ *   Nothing runs from RAM, so it is marked execute never.
+ * - DMA pool of dma_buf.c is normal non-cacheable memory, with
+ *   DMA_BUF_NONCACHEABLE only.
+ * - SDRAM with EXT_SDRAM is write-back with write allocate like RAM and
+ *   execute never, default map would make it device memory.
+ * - QSPI flash with QSPI_MODEL is read only and write-through cached,
+ *   the same as internal flash, look at qspi_flash.c.
+ * - Stack guard sits between the end of static data, that is arena, and 
+ *   stack that grows down towards it. No access, so a stack that overflows
+ *   into arena stops in mem_manage_handler() instead of corrupting tensors.
+ *   Heap is not used, malloc() would run into the guard too.
+ * */
+typedef struct
+{
+    uint32_t base;      // Aligned to size
+    uint32_t size;      // Power of two, at least 32 bytes
+    uint32_t attr;      // MPU_RASR bits without size and enable
+}mpu_region_t;
+
+// TEX, C and B bits of MPU_RASR
+#define REGION_NORMAL_WT        (1 << 17)
+#define REGION_NORMAL_WBWA      ((1 << 19) | (1 << 17) | (1 << 16))
+#define REGION_NORMAL_NC        (1 << 19)
+
+// AP bits of MPU_RASR
+#define REGION_NO_ACCESS        (0 << 24)
+#define REGION_READ_WRITE       (3 << 24)
+#define REGION_READ_ONLY        (6 << 24)
+#define REGION_XN               (1 << 28)
+
+#define MPU_ITCM_BASE           0x00000000U
+#define MPU_ITCM_SIZE           (16 * 1024)
+#define MPU_FLASH_BASE          0x08000000U
+#define MPU_FLASH_SIZE          (2 * 1024 * 1024)
+#define MPU_STORES_BASE         FLASH_BANK2_ADDRESS
+#define MPU_STORES_SIZE         (1024 * 1024)
+#define MPU_RAM_BASE            0x20000000U
+#define MPU_RAM_SIZE            (512 * 1024)
+#define MPU_STACK_GUARD_SIZE    256
+
+#define MPU_IN_STORES(address, size) \
+    ((address) >= MPU_STORES_BASE && \
+     (address) + (size) <= MPU_STORES_BASE + MPU_STORES_SIZE)
+
+_Static_assert(MPU_IN_STORES(FLASH_STORE_ADDRESS, FLASH_STORE_SIZE),
+               "Flash store is outside of the writable flash region");
+_Static_assert(MPU_IN_STORES(CONFIG_STORE_ADDRESS, CONFIG_STORE_SIZE),
+               "Config store is outside of the writable flash region");
+_Static_assert(MPU_IN_STORES(MODEL_SLOT_ADDRESS, MODEL_SLOT_SIZE),
+               "Model slot is outside of the writable flash region");
+
+// End of .bss and .noinit, defined by libopencm3 linker script
+extern uint8_t end;
+
+// Address of the access that hit the guard or another region, read it with
+// debugger after mem_manage_handler() stopped
+volatile uint32_t g_mpu_fault_address = 0;
+
+/*!
+ * @brief   Configures MPU regions and enables MemManage fault
+ *
+ * @note    Call it before enable_fastflash()
+ */
+void mpu_setup()
+{
+    uint32_t guard = ((uint32_t) &end + MPU_STACK_GUARD_SIZE - 1) & 
+                     ~(uint32_t) (MPU_STACK_GUARD_SIZE - 1);
+
+    const mpu_region_t regions[] =
+    {
+        {MPU_ITCM_BASE, MPU_ITCM_SIZE, REGION_NORMAL_WT | REGION_READ_ONLY},
+        {MPU_FLASH_BASE, MPU_FLASH_SIZE, REGION_NORMAL_WT | REGION_READ_ONLY},
+        {MPU_STORES_BASE, MPU_STORES_SIZE, 
+         REGION_NORMAL_NC | REGION_READ_WRITE | REGION_XN},
+#ifdef EXT_SDRAM
+        {SDRAM_ADDRESS, SDRAM_SIZE, 
+         REGION_NORMAL_WBWA | REGION_READ_WRITE | REGION_XN},
+#endif
+#ifdef QSPI_MODEL
+        {QSPI_FLASH_ADDRESS, QSPI_FLASH_SIZE, 
+         REGION_NORMAL_WT | REGION_READ_ONLY},
+#endif
+        {MPU_RAM_BASE, MPU_RAM_SIZE, 
+         REGION_NORMAL_WBWA | REGION_READ_WRITE | REGION_XN},
+#ifdef DMA_BUF_NONCACHEABLE
+        {(uint32_t) dma_buf_pool, DMA_BUF_POOL_SIZE, 
+         REGION_NORMAL_NC | REGION_READ_WRITE | REGION_XN},
+#endif
+        {guard, MPU_STACK_GUARD_SIZE, REGION_NO_ACCESS | REGION_XN},
+    };
+    uint32_t num_regions = sizeof(regions) / sizeof(regions[0]);
+    _Static_assert(sizeof(regions) / sizeof(regions[0]) <= 8,
+                   "Cortex-M7 of F767 has 8 MPU regions");
+
+    __DSB();
+    MPU_CTRL = 0;
+
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        MPU_RNR = i;
+        if (i >= num_regions)
+        {
+            MPU_RASR = 0;
+            continue;
+        }
+        MPU_RBAR = regions[i].base;
+        // Region size is 2^(SIZE + 1) bytes
+        MPU_RASR = regions[i].attr | 
+                   ((__builtin_ctz(regions[i].size) - 1) << MPU_RASR_SIZE_LSB) | 
+                   MPU_RASR_ENABLE;
+    }
+
+    // Default memory map stays in place where no region is defined
+    MPU_CTRL = MPU_CTRL_PRIVDEFENA | MPU_CTRL_ENABLE;
+    SCB_SHCSR |= SCB_SHCSR_MEMFAULTENA;
+    __DSB();
+    __ISB();
+}
+
+/*!
+ * @brief   Stops on MPU violation, for example stack overflow
+ *
+ * @note    Nothing is printed, stack might be the thing that overflowed.
+ *          Look at g_mpu_fault_address and SCB_CFSR with debugger.
+ */
+void mem_manage_handler(void)
+{
+    g_mpu_fault_address = SCB_MMFAR;
+    while (1);
 }
 
 void usart_setup(void)
 {
     // In order to use our UART, we must enable the clock to it as well.
-    rcc_periph_clock_enable(RCC_USART2);
-    rcc_periph_clock_enable(RCC_USART3);
+    periph_clock_acquire(RCC_USART2);
+    periph_clock_acquire(RCC_USART3);
+    rcc_periph_clock_enable(UART_TX_PORT_RCC);
     rcc_periph_clock_enable(RCC_GPIOD);
 
 	/* Setup GPIO pins for USART3 transmit. */
-	gpio_mode_setup(GPIOD, GPIO_MODE_AF, GPIO_PUPD_NONE, GPIO8 | GPIO9);
-	gpio_set_af(GPIOD, GPIO_AF7, GPIO8 | GPIO9);
+	gpio_mode_setup(UART_TX_PORT, GPIO_MODE_AF, GPIO_PUPD_NONE, UART_TX_PINS);
+	gpio_set_af(UART_TX_PORT, GPIO_AF7, UART_TX_PINS);
 
 	/* Setup GPIO pins for USART2 transmit. */
 	gpio_mode_setup(GPIOD, GPIO_MODE_AF, GPIO_PUPD_NONE, GPIO5 | GPIO6);
 	gpio_set_af(GPIOD, GPIO_AF7, GPIO5 | GPIO6);
 
 	/* Setup USART3 parameters. */
-	usart_set_baudrate(USART3, 115200);
+	usart_set_baudrate(USART3, UART_TX_BAUDRATE);
 	usart_set_databits(USART3, 8);
 	usart_set_stopbits(USART3, USART_STOPBITS_1);
 	usart_set_mode(USART3, USART_MODE_TX_RX);
@@ -175,7 +579,7 @@ void usart_setup(void)
 	usart_set_flow_control(USART3, USART_FLOWCONTROL_NONE);
 
 	/* Setup USART2 parameters. */
-	usart_set_baudrate(USART2, 115200);
+	usart_set_baudrate(USART2, CONSOLE_BAUDRATE);
 	usart_set_databits(USART2, 8);
 	usart_set_stopbits(USART2, USART_STOPBITS_1);
 	usart_set_mode(USART2, USART_MODE_TX_RX);
@@ -212,6 +616,26 @@ void gpio_setup()
 {
     rcc_periph_clock_enable(RCC_GPIOB);
     gpio_mode_setup(GPIOB, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, GPIO0);
+#ifndef DCMI_CAMERA
+    // LD2 is VSYNC of the camera otherwise
     gpio_mode_setup(GPIOB, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, GPIO7);
+#endif
     gpio_mode_setup(GPIOB, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, GPIO14);
+
+    // Lepton SS pin, pulled high before setting it as output, so camera 
+    // is not selected while SPI1 waits for sys_require()
+    gpio_set(GPIOB, GPIO4); 
+    gpio_mode_setup(GPIOB, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, GPIO4);
+	gpio_set_output_options(GPIOB, 
+                            GPIO_OTYPE_PP, 
+                            GPIO_OSPEED_25MHZ, 
+                            GPIO4);
+
+    rcc_periph_clock_enable(RCC_GPIOE);
+    gpio_clear(MARKER_PORT, MARKER_PINS);
+    gpio_mode_setup(MARKER_PORT, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, MARKER_PINS);
+    gpio_set_output_options(MARKER_PORT, 
+                            GPIO_OTYPE_PP, 
+                            GPIO_OSPEED_25MHZ, 
+                            MARKER_PINS);
 }
@@ -2,6 +2,8 @@
 #define SYS_INIT_H
 
 #include <stdint.h>
+#include "sdram.h"
+#include "dcmi_cam.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -9,16 +11,85 @@ extern "C" {
 
 extern volatile uint8_t g_clock_mhz; //defined in sys_init.c
 
+// Places variable at the beginning of RAM, which is DTCM, look at 
+// memory_sections.ld. Variable is not zeroed at reset.
+#define DTCM_BSS __attribute__((section(".dtcm_bss")))
+
+// Same, but placed before all DTCM_BSS variables, for small buffers that
+// have to be in DTCM even when the rest spills over to SRAM1
+#define DTCM_FAST_BSS __attribute__((section(".dtcm_bss.fast")))
+
+// Places variable after .bss, look at memory_sections.ld. It is not zeroed
+// at reset either, only for buffers that are written before they are read.
+#define NOINIT_BSS __attribute__((section(".noinit")))
+
+// Places variable into external SDRAM with EXT_SDRAM of sdram.h, into
+// .noinit without it, look at memory_sections.ld. Not zeroed either, and
+// only for plain buffers, SDRAM is set up after constructors ran.
+#ifdef EXT_SDRAM
+#define SDRAM_BSS __attribute__((section(".sdram_bss")))
+#else
+#define SDRAM_BSS NOINIT_BSS
+#endif
+
+// Places function into ITCM RAM, look at memory_sections.ld. Use it only 
+// for hot loops, it is 16 KB only.
+#define ITCM_TEXT __attribute__((section(".itcm_text"), noinline))
+
 //#define SYSTICK_TIMER
 
+// Drives HSI / 4 on PA8 (MCO1) and SYSCLK / 4 on PC9 (MCO2) for a scope,
+// both pins toggle all the time and cost power, leave it off otherwise
+//#define CLOCK_MCO_OUTPUT
+
+// Peripherals that are set up by their first user through sys_require()
+#define SYS_PERIPH_I2C      (1 << 0)    // I2C1 and i2c_async.c
+#define SYS_PERIPH_SPI      (1 << 1)    // SPI1, its DMA streams, spi_bus.c
+
+// Boot phases stamped by boot_mark(), in the order they are reached
+typedef enum
+{
+    BOOT_CORE,          // Clock, MPU and caches are on
+    BOOT_SYSTEM,        // system_setup() returned
+    BOOT_INFERENCE,     // Interpreter is ready
+    BOOT_CAMERA,        // Lepton finished booting
+    BOOT_FIRST_FRAME,   // First frame was received
+    BOOT_PHASES,
+} boot_phase_t;
+
+#define CONSOLE_BAUDRATE    115200  // USART2, shell commands
+#define SPI1_MAX_HZ         20000000 // Lepton VoSPI clock limit
+
+// Benchmark phase markers on CN9 connector, pin is high while its phase 
+// runs, look at inference_benchmark() and inference_cache_sweep()
+#define MARKER_PORT         GPIOE
+#define MARKER_CAPTURE      GPIO2
+#define MARKER_PREPROCESS   GPIO4
+#define MARKER_INVOKE       GPIO5
+#define MARKER_REPORT       GPIO6
+#ifdef DCMI_CAMERA
+// PE5 and PE6 are D6 and D7 of the camera, writes of their markers do
+// nothing while the pins are in AF mode
+#define MARKER_PINS         (MARKER_CAPTURE | MARKER_PREPROCESS)
+#else
+#define MARKER_PINS         (MARKER_CAPTURE | MARKER_PREPROCESS | \
+                             MARKER_INVOKE | MARKER_REPORT)
+#endif
+
 void clock_setup();
 void i2c_setup();
 void spi_setup();
+void spi_dma_setup();
 void usart_setup();
 void systick_setup();
 void dwt_setup();
 void gpio_setup();
+void mpu_setup();
+void itcm_setup();
 void system_setup();
+void sys_require(uint32_t periphs);
+void boot_mark(boot_phase_t phase);
+void boot_report();
 
 #ifdef __cplusplus
 }
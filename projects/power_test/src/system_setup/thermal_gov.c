@@ -0,0 +1,267 @@
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/adc.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/nvic.h>
+#include "thermal_gov.h"
+#include "clock_profile.h"
+#include "soft_timer.h"
+#include "periph_clock.h"
+#include "counters.h"
+#include "events.h"
+#include "irq_prio.h"
+#include "utility.h"
+#include "printf.h"
+
+#ifdef THERMAL_GOVERNOR
+
+/* Explanation: soft timer starts a burst of THERMAL_SAMPLES conversions of
+ * the die temperature sensor every THERMAL_PERIOD_MS, DMA2 Stream4 moves
+ * them and its transfer complete interrupt averages them, so the core
+ * only runs two short interrupts per period. ADC is powered only for the
+ * burst, around 0.5 ms in IDLE. Sensor wants 10 us of sampling, 480
+ * cycles of ADCCLK are 18 us in RUN and 40 us in IDLE with APB2 / 4.
+ *
+ * Temperature comes from the two factory points of the system memory,
+ * measured at 30 and 110 degrees C with 3.3 V VDDA, which Nucleo has.
+ * Interrupt only sets the level, with hysteresis. Switching clock profile
+ * masks interrupts and waits for the UARTs, so thermal_gov_pace() applies
+ * the level in main context, between two frames of the ML loop:
+ * - WARM limits clock profiles to IDLE, policy of CLOCK stays as it was
+ *   and comes back when the die cools down, Invoke() takes 4.5 times
+ *   longer at lower voltage scale,
+ * - HOT also keeps frames THERMAL_HOT_INTERVAL_MS apart, core sleeps in
+ *   event_sleep() for the rest, Lepton frames meanwhile are dropped by
+ *   the stream.
+ * Both go to STATS counters, thermal_steps counts level changes and
+ * thermal_hold_ms the time frames waited.
+ * */
+
+// Channel of the sensor on F76x, shared with VBAT, TSVREFE selects it
+#define THERMAL_ADC_CHANNEL     18
+
+// Factory calibration, 12 bit readings at 30 and 110 degrees C
+#define THERMAL_TS_CAL1         MMIO16(0x1FF0F44C)
+#define THERMAL_TS_CAL2         MMIO16(0x1FF0F44E)
+#define THERMAL_TS_CAL1_C       30
+#define THERMAL_TS_CAL2_C       110
+
+#define THERMAL_DMA_FLAGS       (DMA_TCIF | DMA_TEIF | DMA_DMEIF | DMA_FEIF)
+
+static uint16_t samples[THERMAL_SAMPLES];
+static soft_timer_t period_timer;
+static volatile bool running = false;
+static volatile int32_t temperature = 0;    // In 0.1 degrees C
+static volatile int32_t temperature_max = INT32_MIN;
+static volatile thermal_level_t level = THERMAL_NORMAL;
+static volatile uint32_t bursts = 0;
+static thermal_level_t applied = THERMAL_NORMAL;    // By main context
+static uint64_t last_frame_ms = 0;
+
+static const int32_t level_enter_c[THERMAL_LEVELS] =
+{
+    [THERMAL_NORMAL] = INT32_MIN,
+    [THERMAL_WARM] = THERMAL_WARM_C,
+    [THERMAL_HOT] = THERMAL_HOT_C,
+};
+
+static const char * const level_names[THERMAL_LEVELS] =
+{
+    [THERMAL_NORMAL] = "NORMAL",
+    [THERMAL_WARM] = "WARM",
+    [THERMAL_HOT] = "HOT",
+};
+
+/*!
+ * @brief   Powers ADC and lets DMA take the next burst
+ *
+ * @note    Called from TIM5 interrupt, clocks are held until the burst
+ *          is in.
+ */
+static void burst_start(soft_timer_t * timer)
+{
+    (void) timer;
+    if (!running)
+    {
+        return;
+    }
+
+    periph_clock_acquire(RCC_ADC1);
+    periph_clock_acquire(RCC_DMA2);
+
+    dma_clear_interrupt_flags(DMA2, DMA_STREAM4, THERMAL_DMA_FLAGS);
+    dma_set_memory_address(DMA2, DMA_STREAM4, (uint32_t) samples);
+    dma_set_number_of_data(DMA2, DMA_STREAM4, THERMAL_SAMPLES);
+    dma_enable_stream(DMA2, DMA_STREAM4);
+
+    // DMA bit is cleared and set again, that re-arms requests after the
+    // last burst ended with full count
+    adc_disable_dma(ADC1);
+    adc_enable_dma(ADC1);
+    adc_power_on(ADC1);
+    delay_us(3);
+    adc_start_conversion_regular(ADC1);
+
+    soft_timer_start(&period_timer, THERMAL_PERIOD_MS * 1000);
+}
+
+/*!
+ * @brief   Prepares ADC for continuous conversions of the sensor and DMA
+ *          for bursts into samples[], then starts the first burst
+ *
+ * @note    Call from main context, after soft_timer_setup(). Sensor
+ *          needs 10 us after TSVREFE, the first burst comes much later.
+ */
+void thermal_gov_start()
+{
+    if (running)
+    {
+        return;
+    }
+
+    periph_clock_acquire(RCC_ADC1);
+    adc_power_off(ADC1);
+    adc_set_clk_prescale(ADC_CCR_ADCPRE_BY4);
+    adc_enable_temperature_sensor();
+    adc_set_resolution(ADC1, ADC_CR1_RES_12BIT);
+    adc_set_right_aligned(ADC1);
+    adc_set_continuous_conversion_mode(ADC1);
+    uint8_t channel = THERMAL_ADC_CHANNEL;
+    adc_set_regular_sequence(ADC1, 1, &channel);
+    adc_set_sample_time(ADC1, THERMAL_ADC_CHANNEL, ADC_SMPR_SMP_480CYC);
+    periph_clock_release(RCC_ADC1);
+
+    // Stream 4 channel 0 is ADC1, Stream 0 is taken by VoSPI
+    periph_clock_acquire(RCC_DMA2);
+    dma_stream_reset(DMA2, DMA_STREAM4);
+    dma_channel_select(DMA2, DMA_STREAM4, DMA_SxCR_CHSEL_0);
+    dma_set_priority(DMA2, DMA_STREAM4, DMA_SxCR_PL_LOW);
+    dma_set_transfer_mode(DMA2, DMA_STREAM4, DMA_SxCR_DIR_PERIPHERAL_TO_MEM);
+    dma_set_peripheral_address(DMA2, DMA_STREAM4, (uint32_t) &ADC_DR(ADC1));
+    dma_set_peripheral_size(DMA2, DMA_STREAM4, DMA_SxCR_PSIZE_16BIT);
+    dma_set_memory_size(DMA2, DMA_STREAM4, DMA_SxCR_MSIZE_16BIT);
+    dma_enable_memory_increment_mode(DMA2, DMA_STREAM4);
+    dma_enable_transfer_complete_interrupt(DMA2, DMA_STREAM4);
+    periph_clock_release(RCC_DMA2);
+    nvic_enable_irq(NVIC_DMA2_STREAM4_IRQ);
+
+    period_timer.callback = burst_start;
+    running = true;
+    soft_timer_start(&period_timer, THERMAL_PERIOD_MS * 1000);
+}
+
+/*!
+ * @brief   Stops bursts, last temperature and level stay
+ *
+ * @note    Call from main context. Burst that is in flight ends in the
+ *          interrupt and gives its clocks back.
+ */
+void thermal_gov_stop()
+{
+    running = false;
+    soft_timer_stop(&period_timer);
+}
+
+/*!
+ * @brief   Returns die temperature of the last burst in 0.1 degrees C
+ */
+int32_t thermal_gov_temperature()
+{
+    return temperature;
+}
+
+/*!
+ * @brief   Returns level that the last burst decided on
+ */
+thermal_level_t thermal_gov_level()
+{
+    return level;
+}
+
+/*!
+ * @brief   Applies the level, limits clock profile and waits until the
+ *          next frame may start
+ *
+ * @note    Call from main context before each frame, ML loop of the
+ *          shell does. Profile switch takes around 200 us, it only
+ *          happens when level changes.
+ */
+void thermal_gov_pace()
+{
+    thermal_level_t now = level;
+    if (now != applied)
+    {
+        clock_profile_limit(now >= THERMAL_WARM ? CLOCK_PROFILE_IDLE :
+                                                  CLOCK_PROFILE_RUN);
+        counter_add(COUNTER_THERMAL_STEPS, 1);
+        printf("Thermal: %s at %ld C\n", level_names[now],
+               temperature / 10);
+        applied = now;
+    }
+
+    uint64_t since = millis() - last_frame_ms;
+    if (applied == THERMAL_HOT && since < THERMAL_HOT_INTERVAL_MS)
+    {
+        uint32_t hold = THERMAL_HOT_INTERVAL_MS - (uint32_t) since;
+        event_sleep(hold);
+        counter_add(COUNTER_THERMAL_HOLD_MS, hold);
+    }
+    last_frame_ms = millis();
+}
+
+/*!
+ * @brief   Prints temperature and level, part of STATS
+ */
+void thermal_gov_report()
+{
+    if (!bursts)
+    {
+        printf("Thermal: no burst yet\n");
+        return;
+    }
+    printf("Thermal: %s, die %ld C, max %ld C, %lu bursts\n",
+           level_names[level], temperature / 10, temperature_max / 10,
+           bursts);
+}
+
+/*!
+ * @brief   Burst is in, averages it and moves the level
+ */
+void dma2_stream4_isr()
+{
+    dma_clear_interrupt_flags(DMA2, DMA_STREAM4, THERMAL_DMA_FLAGS);
+    adc_power_off(ADC1);
+    periph_clock_release(RCC_DMA2);
+    periph_clock_release(RCC_ADC1);
+
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < THERMAL_SAMPLES; i++)
+    {
+        sum += samples[i];
+    }
+
+    // Line through the two factory points, in 0.1 degrees C
+    int32_t cal1 = THERMAL_TS_CAL1;
+    int32_t cal2 = THERMAL_TS_CAL2;
+    int32_t raw = (int32_t) (sum / THERMAL_SAMPLES);
+    int32_t now = THERMAL_TS_CAL1_C * 10 +
+                  (raw - cal1) * (THERMAL_TS_CAL2_C - THERMAL_TS_CAL1_C) * 10 /
+                  (cal2 - cal1);
+    temperature = now;
+    temperature_max = now > temperature_max ? now : temperature_max;
+    bursts++;
+
+    // One level per burst, up at its threshold, down below it
+    thermal_level_t next = level;
+    if (next + 1 < THERMAL_LEVELS && now >= level_enter_c[next + 1] * 10)
+    {
+        next++;
+    }
+    else if (next > THERMAL_NORMAL &&
+             now < (level_enter_c[next] - THERMAL_HYSTERESIS_C) * 10)
+    {
+        next--;
+    }
+    level = next;
+}
+#endif
+/*** end of file ***/
@@ -0,0 +1,51 @@
+#ifndef THERMAL_GOV_H
+#define THERMAL_GOV_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Define to read the die temperature sensor in the background and slow
+// inference down when the die gets hot, look at thermal_gov.c. Sensor is
+// inside the MCU, nothing has to be fitted.
+#define THERMAL_GOVERNOR
+
+#define THERMAL_PERIOD_MS       500     // Between two temperature bursts
+#define THERMAL_SAMPLES         16      // Conversions averaged per burst
+
+// Die temperature of the levels in degrees C, a level is left only
+// THERMAL_HYSTERESIS below where it was entered
+#define THERMAL_WARM_C          70      // No RUN profile any more
+#define THERMAL_HOT_C           85      // And at most one frame per interval
+#define THERMAL_HYSTERESIS_C    5
+#define THERMAL_HOT_INTERVAL_MS 1000    // Shortest time between two frames
+
+typedef enum
+{
+    THERMAL_NORMAL,         // Clock policy as it was set
+    THERMAL_WARM,           // Profiles limited to IDLE, 48 MHz
+    THERMAL_HOT,            // IDLE and frames paced, core sleeps between
+    THERMAL_LEVELS,
+} thermal_level_t;
+
+#ifdef THERMAL_GOVERNOR
+void thermal_gov_start();
+void thermal_gov_stop();
+int32_t thermal_gov_temperature();
+thermal_level_t thermal_gov_level();
+void thermal_gov_pace();
+void thermal_gov_report();
+void dma2_stream4_isr();
+#else
+#define thermal_gov_pace()      ((void) 0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* THERMAL_GOV_H */
+/*** end of file ***/
@@ -0,0 +1,50 @@
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Division by a divider that rarely changes, as multiplication by its Q64
+// reciprocal. Cortex-M7 divides 32 bits in hardware, but 64 bit division
+// is a library call of around a hundred cycles, millis() and micros() did
+// one per call. Reciprocal is rounded up, quotient is then exact for
+// every value below 2^64 / divider, at 216 MHz that is 12 years of cycles.
+//
+// Usage example:
+// static uint64_t recip = TIMEBASE_RECIP(216);
+// uint64_t us = timebase_div(cycles, recip);
+
+// Divider has to be at least 2
+#define TIMEBASE_RECIP(divider)     (UINT64_MAX / (divider) + 1)
+
+/*!
+ * @brief               Returns value / divider of TIMEBASE_RECIP()
+ *
+ * @note                High half of 64 x 64 bit product, four UMULL and
+ *                      a few adds. Can be called from interrupts.
+ */
+static inline uint64_t timebase_div(uint64_t value, uint64_t recip)
+{
+    uint32_t value_lo = (uint32_t) value;
+    uint32_t value_hi = (uint32_t) (value >> 32);
+    uint32_t recip_lo = (uint32_t) recip;
+    uint32_t recip_hi = (uint32_t) (recip >> 32);
+
+    uint64_t lo_lo = (uint64_t) value_lo * recip_lo;
+    uint64_t hi_lo = (uint64_t) value_hi * recip_lo;
+    uint64_t lo_hi = (uint64_t) value_lo * recip_hi;
+    uint64_t hi_hi = (uint64_t) value_hi * recip_hi;
+
+    uint64_t middle = (lo_lo >> 32) + (uint32_t) hi_lo + (uint32_t) lo_hi;
+    return hi_hi + (hi_lo >> 32) + (lo_hi >> 32) + (middle >> 32);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TIMEBASE_H */
+/*** end of file ***/
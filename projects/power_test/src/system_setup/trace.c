@@ -0,0 +1,135 @@
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/dbgmcu.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/itm.h>
+#include <libopencm3/cm3/tpiu.h>
+#include <libopencm3/cm3/scs.h>
+#include "sys_init.h"
+#include "trace.h"
+
+#ifdef TRACE_BUFFER
+
+/* Explanation: TRACE() only stores 8 bytes into the ring, anywhere, even
+ * in interrupts, so it costs tens of cycles instead of a printf. Ring is
+ * drained from event_wait(), in batches before core goes to sleep, so
+ * sending never runs in the middle of capture or inference and posted
+ * events are still noticed between batches. Each event is written
+ * as two words to two ITM stimulus ports, timestamp first, so decoder
+ * finds the pairs again even if it starts in the middle of the stream.
+ *
+ * SWO is the debug pin of the ST-LINK, USART3 with its log buffer stays
+ * untouched. Capture it for example with openocd:
+ *     tpiu config internal trace.swo uart off 216000000 2000000
+ * and decode it with trace_decode.py in the repository root.
+ *
+ * Head is written by trace_event() with interrupts masked, tail only by
+ * trace_drain() in main context. If ring fills up, oldest events are
+ * overwritten and drain reports the loss with a TRACE_DROPPED event.
+ * */
+trace_event_t trace_ring[TRACE_EVENTS] DTCM_BSS;
+volatile uint32_t trace_head = 0;
+static uint32_t trace_tail = 0;
+
+// Not defined by every libopencm3 version
+#ifndef ITM_LAR
+#define ITM_LAR     MMIO32(ITM_BASE + 0xFB0)
+#endif
+
+/*!
+ * @brief   Enables ITM stimulus ports and SWO output in asynchronous mode
+ *
+ * @note    Call it after clock_setup(). Debugger usually configures TPIU
+ *          too, values written here are the same.
+ */
+void trace_setup()
+{
+    trace_head = 0;
+    trace_tail = 0;
+
+    SCS_DEMCR |= SCS_DEMCR_TRCENA;
+    DBGMCU_CR |= DBGMCU_CR_TRACE_IOEN;
+
+    // One bit wide port, NRZ (UART) encoding, no formatter
+    TPIU_CSPSR = 1;
+    TPIU_SPPR = TPIU_SPPR_ASYNC_NRZ;
+    TPIU_FFCR &= ~TPIU_FFCR_ENFCONT;
+    trace_clock_changed(rcc_ahb_frequency / 1000000);
+
+    ITM_LAR = 0xC5ACCE55;
+    ITM_TCR = (1 << 16) | ITM_TCR_ITMENA;
+    ITM_TER[0] |= (1 << TRACE_ITM_PORT_TIME) | (1 << TRACE_ITM_PORT_DATA);
+}
+
+/*!
+ * @brief                   Keeps SWO baudrate after core clock switch
+ *
+ * @param[in] clock_mhz     New core clock in MHz
+ *
+ * @note                    TPIU is clocked from core clock, so SWO
+ *                          prescaler has to follow it. Switch is recorded
+ *                          too, decoder needs it to turn cycles into us.
+ */
+void trace_clock_changed(uint8_t clock_mhz)
+{
+    TPIU_ACPR = (uint32_t) clock_mhz * 1000000 / TRACE_SWO_BAUDRATE - 1;
+    trace_event(TRACE_CLOCK, clock_mhz);
+}
+
+/*!
+ * @brief   Writes one word to stimulus port, waits until FIFO has space
+ */
+static void itm_write(uint32_t port, uint32_t word)
+{
+    while (!(ITM_STIM32(port) & ITM_STIM_FIFOREADY));
+    ITM_STIM32(port) = word;
+}
+
+/*!
+ * @brief   Sends up to TRACE_DRAIN_BATCH recorded events over ITM
+ *
+ * @return  True if there are more events to send
+ *
+ * @note    Called from event_wait(), with interrupts enabled. At 2 Mbaud 
+ *          one event takes about 50 us on SWO, a batch under 1 ms. Events 
+ *          are discarded if debugger disabled ITM.
+ */
+bool trace_drain()
+{
+    uint32_t ports = (1 << TRACE_ITM_PORT_TIME) | (1 << TRACE_ITM_PORT_DATA);
+    if (!(ITM_TCR & ITM_TCR_ITMENA) || (ITM_TER[0] & ports) != ports)
+    {
+        trace_tail = trace_head;
+        return false;
+    }
+
+    for (uint32_t sent = 0; 
+         sent < TRACE_DRAIN_BATCH && trace_tail != trace_head; 
+         sent++)
+    {
+        bool masked = cm_mask_interrupts(true);
+
+        // Events that were overwritten since the last drain
+        uint32_t lost = 0;
+        if (trace_head - trace_tail > TRACE_EVENTS)
+        {
+            lost = trace_head - trace_tail - TRACE_EVENTS;
+            trace_tail = trace_head - TRACE_EVENTS;
+        }
+        trace_event_t event = trace_ring[trace_tail & (TRACE_EVENTS - 1)];
+        trace_tail++;
+
+        cm_mask_interrupts(masked);
+
+        if (lost)
+        {
+            trace_event(TRACE_DROPPED, lost > UINT16_MAX ? UINT16_MAX : lost);
+        }
+
+        itm_write(TRACE_ITM_PORT_TIME, event.cycles);
+        itm_write(TRACE_ITM_PORT_DATA, ((uint32_t) event.arg << 16) | event.id);
+    }
+    return trace_tail != trace_head;
+}
+
+#endif
+/*** end of file ***/
@@ -0,0 +1,130 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/dwt.h>
+#include "power_meter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Records binary events of hot paths into RAM ring, drained over ITM/SWO,
+// look at trace.c. Without it TRACE() compiles to nothing, or only sets
+// the phase of POWER_METER.
+//#define TRACE_BUFFER
+
+#define TRACE_EVENTS            512         // Ring size, power of two
+#define TRACE_DRAIN_BATCH       16          // Events sent per trace_drain()
+#define TRACE_ITM_PORT_TIME     1           // Stimulus port of timestamps
+#define TRACE_ITM_PORT_DATA     2           // Stimulus port of id and arg
+#define TRACE_SWO_BAUDRATE      2000000     // Kept on clock switches
+
+// Event ids, trace_decode.py reads names from here, keep one per line
+typedef enum
+{
+    TRACE_CAPTURE_BEGIN     = 1,    // get_flir_image(), arg 1 pipeline
+    TRACE_CAPTURE_END       = 2,    // arg: 1 on success
+    TRACE_LOAD_BEGIN        = 3,    // load_data(), arg 1 normalize_frame()
+    TRACE_LOAD_END          = 4,
+    TRACE_INVOKE_BEGIN      = 5,    // arg: 0 classifier, 1 gate
+    TRACE_INVOKE_END        = 6,    // arg: 1 on success
+    TRACE_OP_BEGIN          = 7,    // arg: operator index
+    TRACE_OP_END            = 8,    // arg: operator index
+    TRACE_CONSOLE_RX_ISR    = 9,    // USART2 idle or DMA1 stream 5
+    TRACE_LOG_TX_DONE_ISR   = 10,   // USART3 sent the whole log buffer
+    TRACE_SPI_DMA_ISR       = 11,   // arg: 1 on success
+    TRACE_CLOCK             = 12,   // arg: new core clock in MHz
+    TRACE_DROPPED           = 13,   // arg: events lost to full ring
+    TRACE_BUDGET_OVERRUN    = 14,   // arg: cycle_budget_id_t
+    TRACE_AUDIO_ISR         = 15,   // arg: 1 hop is full, 0 DMA error
+    TRACE_CAMERA_ISR        = 16,   // arg: 1 frame queued, 0 frame lost
+} trace_id_t;
+
+// Timestamp is DWT cycle counter, low 32 bits are enough for a timeline,
+// decoder counts wraps
+typedef struct
+{
+    uint32_t cycles;
+    uint16_t id;
+    uint16_t arg;
+} trace_event_t;
+
+#ifdef POWER_METER
+/*!
+ * @brief           Sets phase of the pipeline that power_meter.c adds
+ *                  energy of samples to
+ *
+ * @note            Ids are constants at every TRACE(), so only the store
+ *                  of the phase is left, operators keep the phase.
+ */
+static inline void trace_phase(uint16_t id)
+{
+    uint8_t phase;
+    switch (id)
+    {
+    case TRACE_CAPTURE_BEGIN:   phase = POWER_PHASE_CAPTURE;    break;
+    case TRACE_LOAD_BEGIN:      phase = POWER_PHASE_PREPROCESS; break;
+    case TRACE_INVOKE_BEGIN:    phase = POWER_PHASE_INVOKE;     break;
+    case TRACE_CAPTURE_END:
+    case TRACE_LOAD_END:
+    case TRACE_INVOKE_END:      phase = POWER_PHASE_OTHER;      break;
+    default:
+        return;
+    }
+    power_phase = phase;
+    if (phase != POWER_PHASE_OTHER)
+    {
+        power_phase_entries[phase]++;
+    }
+}
+#else
+#define trace_phase(id)             ((void) 0)
+#endif
+
+#ifdef TRACE_BUFFER
+extern trace_event_t trace_ring[TRACE_EVENTS];
+extern volatile uint32_t trace_head;
+
+/*!
+ * @brief           Records one event
+ *
+ * @param[in] id    trace_id_t
+ * @param[in] arg
+ *
+ * @note            Can be called from interrupts, it only masks them for
+ *                  a few instructions. Oldest events are overwritten when
+ *                  ring is full, trace_drain() reports how many.
+ */
+static inline void trace_event(uint16_t id, uint16_t arg)
+{
+    bool masked = cm_mask_interrupts(true);
+    trace_event_t * event = &trace_ring[trace_head & (TRACE_EVENTS - 1)];
+    event->cycles = DWT_CYCCNT;
+    event->id = id;
+    event->arg = arg;
+    trace_head++;
+    cm_mask_interrupts(masked);
+}
+
+void trace_setup();
+void trace_clock_changed(uint8_t clock_mhz);
+bool trace_drain();
+
+#define TRACE(id, arg)              do { trace_event((id), (arg)); \
+                                         trace_phase(id); } while (0)
+#else
+#define TRACE(id, arg)              trace_phase(id)
+#define trace_setup()               ((void) 0)
+#define trace_clock_changed(mhz)    ((void) 0)
+#define trace_drain()               (false)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACE_H */
+/*** end of file ***/
@@ -0,0 +1,192 @@
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
+#include "uart_tx.h"
+#include "utility.h"
+#include "trace.h"
+#include "printf.h"
+
+// Queue of deferred logs and log_flush(), they end up in this buffer anyway
+#define LOG_IMPLEMENTATION
+#include "log.h"
+
+/* Explanation: ring buffer has single producer (main context, printf and
+ * debug log) and single consumer (USART3 TXE interrupt). Producer only
+ * writes tx_head and consumer only writes tx_tail, so no locking is needed.
+ * Indexes run freely and are masked on access, which means that
+ * head - tail is always number of bytes in the buffer.
+ * Printing from interrupts is not supported, as it would add a second
+ * producer.
+ * */
+static char tx_buf[UART_TX_BUF_LEN];
+static volatile uint32_t tx_head = 0;
+static volatile uint32_t tx_tail = 0;
+
+#define UART_TX_MASK    (UART_TX_BUF_LEN - 1)
+
+/*!
+ * @brief   Enables USART3 interrupt, transmit interrupt itself is enabled
+ *          only while there is something in the buffer
+ *
+ * @note    Call it after usart_setup()
+ */
+void uart_tx_setup()
+{
+    tx_head = 0;
+    tx_tail = 0;
+    nvic_enable_irq(NVIC_USART3_IRQ);
+}
+
+/*!
+ * @brief       Puts one character into transmit buffer
+ *
+ * @param[in] c Character that will be sent
+ *
+ * @note        If buffer is full, function waits for interrupt to make
+ *              space. If interrupts are disabled, characters are sent
+ *              directly from here instead, so we never deadlock.
+ */
+void uart_tx_putc(char c)
+{
+    while ((tx_head - tx_tail) >= UART_TX_BUF_LEN)
+    {
+        if (cm_is_masked_interrupts())
+        {
+            // Interrupt can not run, do its job
+            usart_send_blocking(USART3, tx_buf[tx_tail & UART_TX_MASK]);
+            tx_tail++;
+        }
+    }
+
+    tx_buf[tx_head & UART_TX_MASK] = c;
+
+    // Character has to be in buffer before interrupt can see new head
+    __asm__ volatile ("" ::: "memory");
+    tx_head++;
+
+    usart_enable_tx_interrupt(USART3);
+}
+
+/*!
+ * @brief           Puts array of characters into transmit buffer
+ *
+ * @param[in] data  Characters that will be sent
+ * @param[in] len   Number of characters
+ */
+void uart_tx_write(const char * data, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++)
+    {
+        uart_tx_putc(data[i]);
+    }
+}
+
+#ifdef LOG_BINARY
+/*!
+ * @brief           Output of binary logs of log.h, they share the buffer
+ *                  with printf(), so text and messages stay in order
+ */
+void log_binary_write(const uint8_t * data, uint32_t len)
+{
+    uart_tx_write((const char *) data, len);
+}
+#endif
+
+static void uart_tx_out(char c, void * arg)
+{
+    (void) arg;
+    uart_tx_putc(c);
+}
+
+/*!
+ * @brief               Formats printf() output straight into the buffer
+ *
+ * @return              Number of printed characters
+ *
+ * @note                Replaces weak vprintf_() of shared printf.c, so
+ *                      printf() does not enable transmit interrupt once per
+ *                      character. Output that does not fit into free space
+ *                      is formatted again and put in character by character,
+ *                      which waits for the interrupt like uart_tx_putc().
+ */
+int vprintf_(const char * format, va_list va)
+{
+    uint32_t head = tx_head;
+    // Consumer only makes more space meanwhile
+    uint32_t space = UART_TX_BUF_LEN - (head - tx_tail);
+    va_list copy;
+
+    va_copy(copy, va);
+    int len = vsnprintf_ring(tx_buf, UART_TX_BUF_LEN, head & UART_TX_MASK,
+                             space, format, copy);
+    va_end(copy);
+
+    if (len >= 0 && (uint32_t)len <= space)
+    {
+        if (len)
+        {
+            // Characters have to be in buffer before interrupt can see new head
+            __asm__ volatile ("" ::: "memory");
+            tx_head = head + len;
+            usart_enable_tx_interrupt(USART3);
+        }
+        return len;
+    }
+
+    return vfctprintf(uart_tx_out, NULL, format, va);
+}
+
+/*!
+ * @brief               Waits until all characters were sent out
+ *
+ * @param[in] timeout   In ms
+ *
+ * @return              True if everything was sent before timeout
+ *
+ * @note                Use it before going to sleep or resetting the
+ *                      core, otherwise end of the log is lost.
+ */
+bool uart_tx_flush(uint32_t timeout)
+{
+    uint64_t start = millis();
+
+    while (tx_head != tx_tail || !usart_get_flag(USART3, USART_ISR_TC))
+    {
+        if ((millis() - start) > timeout)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!
+ * @brief   Returns number of characters that wait to be sent
+ */
+uint32_t uart_tx_pending()
+{
+    return tx_head - tx_tail;
+}
+
+/*!
+ * @brief   Sends next character from ring buffer, disables transmit
+ *          interrupt once buffer is empty
+ */
+void usart3_isr()
+{
+    if (!usart_get_flag(USART3, USART_ISR_TXE))
+    {
+        return;
+    }
+
+    if (tx_head == tx_tail)
+    {
+        usart_disable_tx_interrupt(USART3);
+        TRACE(TRACE_LOG_TX_DONE_ISR, 0);
+        return;
+    }
+
+    usart_send(USART3, tx_buf[tx_tail & UART_TX_MASK]);
+    tx_tail++;
+}
+/*** end of file ***/
@@ -0,0 +1,58 @@
+#ifndef UART_TX_H
+#define UART_TX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdram.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Size of transmit ring buffer, has to be power of two.
+// At 115200 baud it takes about 90 ms to send whole buffer.
+#define UART_TX_BUF_LEN     1024
+
+// Define to stream frames and inference results as binary telemetry on
+// USART3, see shared/telemetry.h. Whole frame does not fit into 115200 baud
+// between two inferences, so log port runs faster then. With USB_CONSOLE
+// in uart_ctrl.h telemetry goes over USB instead.
+//#define BINARY_TELEMETRY
+
+// Frame of BINARY_TELEMETRY is sent as box filtered preview, 2 or 4 times
+// smaller in both directions, see frame_downscale_u8() of
+// shared/frame_convert.h. 1 sends the whole input frame.
+#define TELEMETRY_PREVIEW   1
+
+// USART3 pins, PD8 and PD9 go to ST-LINK virtual COM port of Nucleo.
+// With EXT_SDRAM of sdram.h they are FMC data lines, carrier board then
+// takes the log port out on PC10 and PC11, both AF7 as well.
+#ifdef EXT_SDRAM
+#define UART_TX_PORT        GPIOC
+#define UART_TX_PORT_RCC    RCC_GPIOC
+#define UART_TX_PINS        (GPIO10 | GPIO11)
+#else
+#define UART_TX_PORT        GPIOD
+#define UART_TX_PORT_RCC    RCC_GPIOD
+#define UART_TX_PINS        (GPIO8 | GPIO9)
+#endif
+
+#ifdef BINARY_TELEMETRY
+#define UART_TX_BAUDRATE    921600
+#else
+#define UART_TX_BAUDRATE    115200
+#endif
+
+void uart_tx_setup();
+void uart_tx_putc(char c);
+void uart_tx_write(const char * data, uint32_t len);
+bool uart_tx_flush(uint32_t timeout);
+uint32_t uart_tx_pending();
+void usart3_isr();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UART_TX_H */
+/*** end of file ***/
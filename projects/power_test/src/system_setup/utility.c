@@ -1,16 +1,50 @@
 #include <libopencm3/stm32/i2c.h>
 #include <libopencm3/stm32/spi.h>
-#include <libopencm3/stm32/spi.h>
+#include <libopencm3/stm32/dma.h>
 #include <libopencm3/cm3/systick.h>
 #include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/scb.h>
 #include "printf.h"
 #include "utility.h"
+#include "events.h"
+#include "trace.h"
 #include "sys_init.h" //Needed because of g_clock_mhz
+#include "clock_profile.h"
+#include "i2c_async.h"
+#include "i2c_timing.h"
+#include "soft_timer.h"
+#include "timebase.h"
 
 // Storage for our monotonic system clock.
 // Note that it needs to be volatile since we're modifying it from an interrupt.
 static volatile uint64_t _millis = 0;
 
+// DWT cycle counter is 32 bit and wraps every 19.9 s at 216 MHz, upper half
+// is counted here. Counter has to be read at least once per wrap, with 
+// SYSTICK_TIMER tick interrupt does it, otherwise event_wait() wakes up 
+// often enough for that.
+static uint32_t dwt_high = 0;
+static uint32_t dwt_last = 0;
+
+#ifndef SYSTICK_TIMER
+// Core clock can change at runtime, time is counted from the last change
+static uint64_t time_base_us = 0;
+static uint64_t time_base_cycles = 0;
+#endif
+
+// Reciprocals of g_clock_mhz and of 1000, look at timebase.h. Core clock
+// one is set by time_rescale() together with g_clock_mhz.
+static volatile uint64_t cycles_recip = TIMEBASE_RECIP(16);
+static const uint64_t ms_recip = TIMEBASE_RECIP(1000);
+
+// FLIR on SPI1, set up by spi_setup()
+spi_device_t spi_flir;
+
+// Called from DMA interrupt, when whole transfer was received
+static void (*spi_dma_callback)(bool status) = NULL;
+static spi_xfer_t spi_flir_xfer;
+
 /*!
  * @brief                   Prepares i2c peripheral for transfer of data 
  *
@@ -20,10 +54,14 @@ static volatile uint64_t _millis = 0;
  *                          if one then we are writing
  * @param[in] num_bytes     That we will write/read
  *
- * @note                    This is here because of refactoring
+ * @note                    This is here because of refactoring. Queued
+ *                          transfers of i2c_async.c are finished first and
+ *                          new ones wait until this one is off the bus.
  */
 void i2c_prepare(uint32_t i2c, uint8_t addr, uint8_t dir, uint8_t num_bytes)
 {
+    i2c_async_hold();
+    i2c_timing_select(addr);
     i2c_set_7bit_address(i2c, addr);
     
     if(dir)
@@ -424,6 +462,120 @@ bool i2c_read16_array(uint8_t addr, uint16_t * data, uint8_t num_words)
     return true; 
 }
 
+/*!
+ * @brief                   Writes bytes and reads bytes back in one 
+ *                          transaction, with repeated start in between
+ *
+ * @param[in] addr          Address of the slave
+ * @param[in] tx            Bytes that we will write, like register address
+ * @param[in] tx_len        Number of bytes that we will write, at least one
+ * @param[in] rx            Reference to array of data that we will receive
+ * @param[in] rx_len        Number of bytes that we expect, at least one
+ *
+ * @return                  True if everything is ok, otherwise false
+ *
+ * @note                    Bus is never released between the two parts, 
+ *                          so there is no STOP, bus free time and second 
+ *                          arbitration of a separate write and read. Use 
+ *                          struct i2c_xfer of i2c_async.h for the same 
+ *                          transaction without waiting.
+ */
+bool i2c_write_read(uint8_t addr, const uint8_t * tx, uint8_t tx_len,
+                    uint8_t * rx, uint8_t rx_len)
+{
+    if (!tx_len || !rx_len)
+    {
+        return false;
+    }
+
+    // Write part without AUTOEND, TC is set after its last byte
+    i2c_async_hold();
+    i2c_timing_select(addr);
+    i2c_set_7bit_address(I2C1, addr);
+    i2c_set_write_transfer_dir(I2C1);
+    i2c_set_bytes_to_transfer(I2C1, tx_len);
+    i2c_disable_autoend(I2C1);
+    i2c_send_start(I2C1);
+
+    for (uint8_t i = 0; i < tx_len; i++)
+    {
+        bool wait = true;
+        while (wait) 
+        {
+            if (i2c_transmit_int_status(I2C1)) 
+            {
+                wait = false;
+            }
+            //blocks until ack is received, or it timeouts
+            if(!wait_for_ack(I2C_TIMEOUT))
+            {
+                i2c_async_release();
+                return false; 
+            }
+        }
+        i2c_send_data(I2C1, tx[i]);
+    }
+
+    if (!wait_for_transfer_complete(I2C_TIMEOUT))
+    {
+        i2c_async_release();
+        return false;
+    }
+
+    // Read part, START while TC is set is the repeated start. Not with
+    // i2c_prepare(), its i2c_async_hold() waits for a free bus, and
+    // BUSY stays set until our STOP.
+    i2c_set_read_transfer_dir(I2C1);
+    i2c_set_bytes_to_transfer(I2C1, rx_len);
+    i2c_send_start(I2C1);
+    i2c_enable_autoend(I2C1);
+
+    for (uint8_t i = 0; i < rx_len; i++) 
+    {
+        if(!wait_for_empty_data_reg(I2C_TIMEOUT))
+        {
+            i2c_async_release();
+            return false; 
+        }
+        rx[i] = i2c_get_data(I2C1);
+    }
+    return true;
+}
+
+/*!
+ * @brief                   Reads words from consecutive registers with 
+ *                          16 bit address, in one transaction
+ *
+ * @param[in] addr          Address of the slave
+ * @param[in] reg           Address of the first register
+ * @param[in] data          Reference to array of data that we will receive
+ * @param[in] num_words     Number of words that we expect
+ *
+ * @return                  True if everything is ok, otherwise false
+ */
+bool i2c_read16_reg(uint8_t addr, uint16_t reg, uint16_t * data, 
+                    uint8_t num_words)
+{
+    uint8_t reg_bytes[2] = {(uint8_t) (reg >> 8), (uint8_t) reg};
+    uint8_t * bytes = (uint8_t *) data;
+
+    if (num_words > I2C_ASYNC_MAX_BYTES / 2)
+    {
+        return false;
+    }
+    if (!i2c_write_read(addr, reg_bytes, 2, bytes, 2 * num_words))
+    {
+        return false;
+    }
+
+    // Words come high byte first, swap them in place
+    for (uint8_t i = 0; i < num_words; i++)
+    {
+        data[i] = (uint16_t) ((bytes[2 * i] << 8) | bytes[2 * i + 1]);
+    }
+    return true;
+}
+
 /*!
  * @brief               Waits for ACK bit until timeout
  *
@@ -433,11 +585,32 @@ bool i2c_read16_array(uint8_t addr, uint16_t * data, uint8_t num_words)
  */
 bool wait_for_ack(uint32_t timeout)
 {
-    const uint64_t until = millis() + timeout;
+    const uint64_t until = soft_timer_deadline(timeout);
 
     while (i2c_nack(I2C1))
     {
-        if (millis() > until)
+        if (soft_timer_passed(until))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!
+ * @brief               Waits until write part without AUTOEND is out
+ *
+ * @param[in] timeout   In milliseconds
+ *
+ * @return              True if TC was set, false on NACK or timeout
+ */
+bool wait_for_transfer_complete(uint32_t timeout)
+{
+    const uint64_t until = soft_timer_deadline(timeout);
+
+    while (!i2c_transfer_complete(I2C1))
+    {
+        if (i2c_nack(I2C1) || soft_timer_passed(until))
         {
             return false;
         }
@@ -454,11 +627,11 @@ bool wait_for_ack(uint32_t timeout)
  */
 bool wait_for_empty_data_reg(uint32_t timeout)
 {
-    const uint64_t until = millis() + timeout;
+    const uint64_t until = soft_timer_deadline(timeout);
 
     while (i2c_received_data(I2C1) == 0)
     {
-        if (millis() > until)
+        if (soft_timer_passed(until))
         {
             return false;
         }
@@ -525,17 +698,144 @@ void spi_read16(uint16_t * data, uint16_t num_words)
 
 
 /*!
- * @brief   Returns how long microcontroller has been running in microseconds
+ * @brief               Sets function that is called from interrupt 
+ *                      when spi_dma_read16() transfer is finished
+ *
+ * @param[in] callback  Status is false if DMA reported transfer error
+ *
+ * @note                Callback runs in interrupt context, keep it short. 
+ *                      It is allowed to call spi_dma_read16() from it, 
+ *                      this is how consecutive packets are chained.
+ */
+void spi_dma_set_callback(void (*callback)(bool status))
+{
+    spi_dma_callback = callback;
+}
+
+/*!
+ * @brief   Passes end of FLIR transfer to the callback
+ */
+static void spi_flir_done(spi_xfer_t * xfer, bool status)
+{
+    (void) xfer;
+    if (spi_dma_callback)
+    {
+        spi_dma_callback(status);
+    }
+}
+
+/*!
+ * @brief               Starts non-blocking read of 16bit words from SPI 
+ *                      into data array
+ *
+ * @param[in] data      Array where data will be received, 
+ *                      it is written by DMA
+ * @param[in] num_words How many words to read
+ *
+ * @note                SPI is kept in full duplex mode and clock is driven 
+ *                      by TX stream sending dummy words. That way clock 
+ *                      stops by itself after the last word, which is not 
+ *                      the case in receive only mode used by spi_read16().
+ *                      If D-cache is enabled, data has to be invalidated 
+ *                      before CPU reads it, look at fastflash.h .
+ *                      Transfer goes through spi_bus.c, FLIR has to be
+ *                      selected with enable_flir_cs() and no read may run.
+ */
+void spi_dma_read16(uint16_t * data, uint16_t num_words)
+{
+    // SPI is idle between packets, clock switch might have changed APB2
+    spi_bus_set_prescaler(&spi_flir, clock_spi1_prescaler());
+
+    spi_flir_xfer.device = &spi_flir;
+    spi_flir_xfer.tx = NULL;
+    spi_flir_xfer.rx = data;
+    spi_flir_xfer.len = num_words;
+    spi_flir_xfer.release = false;
+    spi_flir_xfer.callback = spi_flir_done;
+    spi_bus_submit(&spi_flir_xfer);
+}
+
+/*!
+ * @brief   Returns DWT cycle counter extended to 64 bits
+ *
+ * @note    Can be called from interrupts, it is the cycle accurate 
+ *          timestamp, take one at both ends and convert the difference 
+ *          with dwt_cycles_to_us(). Counter does not wrap, but it is not 
+ *          in us, convert only differences that were taken without a 
+ *          clock change in between. With SYSTICK_TIMER nothing adds time
+ *          core slept in WFI, so settle for micros() across event_wait().
+ */
+uint64_t dwt_cycles64()
+{
+    bool masked = cm_mask_interrupts(true);
+
+    uint32_t now = dwt_read_cycle_counter();
+    if (now < dwt_last)
+    {
+        dwt_high++;
+    }
+    dwt_last = now;
+    uint64_t cycles = ((uint64_t) dwt_high << 32) | now;
+
+    cm_mask_interrupts(masked);
+    return cycles;
+}
+
+#ifndef SYSTICK_TIMER
+/*!
+ * @brief               Moves DWT counter forward
+ *
+ * @param[in] cycles    Cycles that passed while counter was stopped, 
+ *                      for example in sleep, look at events.c
+ */
+void dwt_add_cycles(uint32_t cycles)
+{
+    bool masked = cm_mask_interrupts(true);
+
+    // Wrap caused by the addition is caught here, not in dwt_cycles64()
+    uint64_t total = dwt_cycles64() + cycles;
+    dwt_high = (uint32_t) (total >> 32);
+    dwt_last = (uint32_t) total;
+    DWT_CYCCNT = dwt_last;
+
+    cm_mask_interrupts(masked);
+}
+#endif
+
+/*!
+ * @brief                   Keeps time continuous when core clock changes
+ *
+ * @param[in] clock_mhz     New core clock in MHz
+ *
+ * @note                    Call right before the switch, with interrupts
+ *                          masked. Time that passed until now is folded
+ *                          with the old clock. Switch itself is counted
+ *                          with the new one, which is off by a few us.
+ */
+void time_rescale(uint8_t clock_mhz)
+{
+#ifndef SYSTICK_TIMER
+    uint64_t cycles = dwt_cycles64();
+    time_base_us += timebase_div(cycles - time_base_cycles, cycles_recip);
+    time_base_cycles = cycles;
+#endif
+    g_clock_mhz = clock_mhz;
+    cycles_recip = TIMEBASE_RECIP(clock_mhz);
+}
+
+/*!
+ * @brief   Returns how long microcontroller has been running in milliseconds
  *
  * @return  Time alive in milliseconds
- * @note    This value is incremented in sys_tick_handler
+ * @note    This value is incremented in sys_tick_handler or derived from 
+ *          DWT cycles, which is monotonic, it does not wrap
  */
 uint64_t millis()
 {
 #ifdef SYSTICK_TIMER
     return _millis;
 #else
-    return dwt_cycles_to_ms(dwt_read_cycle_counter());
+    return timebase_div(micros(), ms_recip);
 #endif
 }
 
@@ -554,10 +854,41 @@ uint64_t millis()
  *          cycles_in_systick = systick_get_value();
  *          time_in_us = (number_of_cycles_in_ms - cycles_in_systick)/(rcc_ahb_frequency/1000000);
  *          return (millis() * 1000) + time_in_us;
+ *
+ *          Tick that is pending while interrupts are masked is counted
+ *          as well, so time does not jump back by 1 ms in interrupts.
+ *
+ *          Without systick timer it is taken from DWT cycles counted
+ *          since the last clock change, see time_rescale().
+ *
+ *          Can be called from interrupts in both cases.
  */
 uint64_t micros()
 {
-    return (millis() * 1000) + (1000 - (systick_get_value() / g_clock_mhz));
+#ifdef SYSTICK_TIMER
+    bool masked = cm_mask_interrupts(true);
+    uint64_t ms = _millis;
+    uint32_t value = systick_get_value();
+
+    // Counter reloaded, but tick interrupt is not served yet, either 
+    // because interrupts are masked here or caller is a higher priority 
+    // interrupt. Value is read again, it could be from before the reload.
+    if (SCB_ICSR & SCB_ICSR_PENDSTSET)
+    {
+        ms++;
+        value = systick_get_value();
+    }
+    cm_mask_interrupts(masked);
+
+    return (ms * 1000) + (systick_get_reload() - value) / g_clock_mhz;
+#else
+    bool masked = cm_mask_interrupts(true);
+    uint64_t us = time_base_us + 
+                  timebase_div(dwt_cycles64() - time_base_cycles, 
+                               cycles_recip);
+    cm_mask_interrupts(masked);
+    return us;
+#endif
 }
 
 /*!
@@ -574,6 +905,9 @@ void sys_tick_handler(void)
 {
     // Increment our monotonic clock
     _millis++;
+
+    // Keeps upper half of DWT counter, it is read at least once per wrap
+    (void) dwt_cycles64();
 }
 
 /*!
@@ -581,17 +915,12 @@ void sys_tick_handler(void)
  *
  * @param[in] duration      In milliseconds
  *
- * @note                    Blocks for specified duration
+ * @note                    Blocks for specified duration, core sleeps 
+ *                          meanwhile, interrupts are still served
  */
 void delay(uint64_t duration)
 {
-    /* This is needed because DWT counter does not automaticaly reload*/
-#ifndef SYSTICK_TIMER
-	DWT_CYCCNT = 0;         
-                            
-#endif
-    const uint64_t until = millis() + duration;
-    while (millis() < until);
+    event_sleep(duration);
 }
 
 /*!
@@ -599,12 +928,28 @@ void delay(uint64_t duration)
  *
  * @param[in] duration      In microseconds
  *
- * @note                    Blocks for specified duration
+ * @note                    Blocks for specified duration, core sleeps 
+ *                          until TIM5 compare, look at soft_timer.c. 
+ *                          Interrupts are served, unless they were masked 
+ *                          by the caller.
  */
 void delay_us(uint64_t duration)
 {
-    const uint64_t until = micros() + duration;
-    while (micros() < until);
+    const uint64_t until = soft_timer_now() + duration;
+    bool masked = cm_mask_interrupts(true);
+
+    uint64_t now;
+    while ((now = soft_timer_now()) < until)
+    {
+        uint64_t left = until - now;
+        soft_timer_sleep(left > SOFT_TIMER_MAX_SLEEP ? SOFT_TIMER_MAX_SLEEP :
+                                                       (uint32_t) left);
+
+        // Interrupt that woke us up is served here
+        cm_mask_interrupts(masked);
+        cm_mask_interrupts(true);
+    }
+    cm_mask_interrupts(masked);
 }
 
 /*!
@@ -613,8 +958,28 @@ void delay_us(uint64_t duration)
  * @param[in] dwt_cycles
  *
  * @return                  Time in milliseconds
+ *
+ * @note                    Uses current core clock, cycles have to be
+ *                          counted without a clock change in between.
  */
 uint32_t dwt_cycles_to_ms(uint32_t dwt_cycles)
 {
-    return dwt_cycles * (1.0f / (g_clock_mhz * 1000.0f)) ;
+    return (uint32_t) timebase_div(timebase_div(dwt_cycles, cycles_recip),
+                                   ms_recip);
+}
+
+/*!
+ * @brief                   Converts dwt cycles to microseconds
+ *
+ * @param[in] dwt_cycles    Difference of two dwt_cycles64() timestamps
+ *
+ * @return                  Time in microseconds
+ *
+ * @note                    Uses current core clock, same as 
+ *                          dwt_cycles_to_ms(). Can be called from 
+ *                          interrupts.
+ */
+uint64_t dwt_cycles_to_us(uint64_t dwt_cycles)
+{
+    return timebase_div(dwt_cycles, cycles_recip);
 }
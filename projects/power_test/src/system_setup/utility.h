@@ -1,6 +1,8 @@
 #ifndef utility_H
 #define utility_H
 
+#include "spi_bus.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -23,12 +25,20 @@ bool i2c_read(uint8_t addr, uint8_t * data);
 bool i2c_read16(uint8_t addr, uint16_t * data);
 bool i2c_read_array(uint8_t addr, uint8_t * data, uint8_t num_bytes);
 bool i2c_read16_array(uint8_t addr, uint16_t * data, uint8_t num_words);
+bool i2c_write_read(uint8_t addr, const uint8_t * tx, uint8_t tx_len,
+                    uint8_t * rx, uint8_t rx_len);
+bool i2c_read16_reg(uint8_t addr, uint16_t reg, uint16_t * data, 
+                    uint8_t num_words);
 
 bool wait_for_ack(uint32_t timeout);
+bool wait_for_transfer_complete(uint32_t timeout);
 bool wait_for_empty_data_reg(uint32_t timeout);
 
 // SPI related functions
+extern spi_device_t spi_flir;
 void spi_read16(uint16_t * data, uint16_t num_words);
+void spi_dma_set_callback(void (*callback)(bool status));
+void spi_dma_read16(uint16_t * data, uint16_t num_words);
 
 // Time delay related functions, systick_setup is in sys_init.c
 uint64_t millis();
@@ -37,6 +47,10 @@ void sys_tick_handler();
 void delay(uint64_t duration);
 void delay_us(uint64_t duration);
 uint32_t dwt_cycles_to_ms(uint32_t dwt_cycles);
+uint64_t dwt_cycles_to_us(uint64_t dwt_cycles);
+uint64_t dwt_cycles64();
+void dwt_add_cycles(uint32_t cycles);
+void time_rescale(uint8_t clock_mhz);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,145 @@
+#include <string.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/dma.h>
+#include "weight_dma.h"
+#include "dma_buf.h"
+#include "periph_clock.h"
+#include "utility.h"
+
+#ifdef WEIGHT_PREFETCH
+
+/* Explanation: WeightStreamResolver of shared/weight_stream.h starts a
+ * copy of the next FullyConnected weights before the current layer runs
+ * and waits for it when that layer comes, so the copy has a whole layer
+ * to finish. DMA2 stream 2 copies flash into the DTCM buffer in memory
+ * to memory mode, which DMA1 does not have. Stream 2 is free, SPI1 has
+ * 0 and 3, crc_hw.c 1, thermal_gov.c 4, dcmi_cam.c 7.
+ * Priority is low, VoSPI RX on stream 0 wins every arbitration, and the
+ * copy takes turns with the core on the flash interface only while the
+ * layer before computes, the one that needs the weights reads DTCM.
+ *
+ * DMA can not read ITCM, flash behind ITCM alias is read over AXIM. The
+ * copy is polled, no interrupt, it is done long before the wait in
+ * nearly every case and the wait may come from Invoke() in any context
+ * of background.h. DTCM is not cached, buffer elsewhere has to be a
+ * DMA_BUFFER one, its lines are invalidated after the copy. Unaligned
+ * weights are copied by CPU, kernels run on them all the same.
+ *
+ * DMA2 clock is held from weight_dma_start() to weight_dma_wait(), look
+ * at periph_clock.c. Stream is configured once in weight_dma_setup(), it
+ * keeps its registers while DMA2 is gated.
+ * */
+
+#define WEIGHT_DMA_FLAGS        (DMA_TCIF | DMA_HTIF | DMA_TEIF | \
+                                 DMA_DMEIF | DMA_FEIF)
+#define WEIGHT_DMA_MAX_WORDS    (65535)
+#define WEIGHT_DMA_FLASH_SIZE   (2 * 1024 * 1024)
+
+static volatile bool busy = false;
+static void * busy_dst;
+static uint32_t busy_len;
+
+/*!
+ * @brief   Configures DMA2 stream 2 for word copies through its FIFO
+ */
+void weight_dma_setup()
+{
+    periph_clock_acquire(RCC_DMA2);
+    dma_stream_reset(DMA2, DMA_STREAM2);
+    dma_set_priority(DMA2, DMA_STREAM2, DMA_SxCR_PL_LOW);
+    dma_set_transfer_mode(DMA2, DMA_STREAM2, DMA_SxCR_DIR_MEM_TO_MEM);
+    dma_enable_peripheral_increment_mode(DMA2, DMA_STREAM2);
+    dma_enable_memory_increment_mode(DMA2, DMA_STREAM2);
+    dma_set_peripheral_size(DMA2, DMA_STREAM2, DMA_SxCR_PSIZE_32BIT);
+    dma_set_memory_size(DMA2, DMA_STREAM2, DMA_SxCR_MSIZE_32BIT);
+    // Memory to memory needs the FIFO
+    dma_enable_fifo_mode(DMA2, DMA_STREAM2);
+    dma_set_fifo_threshold(DMA2, DMA_STREAM2, DMA_SxFCR_FTH_4_4_FULL);
+    periph_clock_release(RCC_DMA2);
+}
+
+/*!
+ * @brief           Starts copy of weights, returns before it is done
+ *
+ * @param[out] dst  Half of the prefetch buffer, in DTCM
+ * @param[in] src   Weights in flash, also behind ITCM alias, or in RAM
+ *
+ * @return          False if the last copy was not waited for
+ *
+ * @note            Copies by CPU when src or dst is not word aligned.
+ */
+bool weight_dma_start(void * dst, const void * src, uint32_t len)
+{
+    if (busy)
+    {
+        return false;
+    }
+
+    uint32_t address = (uint32_t) src;
+    uint32_t words = len / 4;
+    if (((address | (uint32_t) dst) & 3) || words == 0 ||
+        words > WEIGHT_DMA_MAX_WORDS)
+    {
+        memcpy(dst, src, len);
+        return true;
+    }
+
+    if (address - FLASH_ITCM_BASE < WEIGHT_DMA_FLASH_SIZE)
+    {
+        address += FLASH_AXIM_BASE - FLASH_ITCM_BASE;
+    }
+    else
+    {
+        // Model that was loaded into RAM can still be in D-cache
+        dma_buf_clean(src, len);
+    }
+    // The last bytes of an odd length are not worth a second transfer
+    memcpy((uint8_t *) dst + words * 4, (const uint8_t *) src + words * 4,
+           len & 3);
+
+    periph_clock_acquire(RCC_DMA2);
+    dma_clear_interrupt_flags(DMA2, DMA_STREAM2, WEIGHT_DMA_FLAGS);
+    dma_set_peripheral_address(DMA2, DMA_STREAM2, address);
+    dma_set_memory_address(DMA2, DMA_STREAM2, (uint32_t) dst);
+    dma_set_number_of_data(DMA2, DMA_STREAM2, words);
+    busy_dst = dst;
+    busy_len = words * 4;
+    busy = true;
+    dma_enable_stream(DMA2, DMA_STREAM2);
+    return true;
+}
+
+/*!
+ * @brief   Waits for the copy of weight_dma_start()
+ *
+ * @return  False if DMA failed or took longer than WEIGHT_DMA_TIMEOUT,
+ *          the buffer is not complete then
+ */
+bool weight_dma_wait()
+{
+    if (!busy)
+    {
+        return true;
+    }
+
+    // Stream clears EN when the last word is written or on error
+    uint64_t start = millis();
+    while ((DMA_SCR(DMA2, DMA_STREAM2) & DMA_SxCR_EN) &&
+           millis() - start < WEIGHT_DMA_TIMEOUT);
+
+    bool ok = !(DMA_SCR(DMA2, DMA_STREAM2) & DMA_SxCR_EN) &&
+              dma_get_interrupt_flag(DMA2, DMA_STREAM2, DMA_TCIF) &&
+              !dma_get_interrupt_flag(DMA2, DMA_STREAM2, DMA_TEIF);
+    if (!ok)
+    {
+        dma_disable_stream(DMA2, DMA_STREAM2);
+        while (DMA_SCR(DMA2, DMA_STREAM2) & DMA_SxCR_EN);
+    }
+    periph_clock_release(RCC_DMA2);
+    dma_buf_invalidate(busy_dst, busy_len);
+    busy = false;
+    return ok;
+}
+
+#endif
+/*** end of file ***/
@@ -0,0 +1,35 @@
+#ifndef WEIGHT_DMA_H
+#define WEIGHT_DMA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Define to copy weights of the next FullyConnected layer from flash into
+// a double buffer in DTCM while the current layer runs, look at
+// PrefetchResident() of shared/weight_stream.h and weight_dma.c. Buffer
+// comes out of DTCM before the arena, so the arena moves by as much
+// towards SRAM1.
+//#define WEIGHT_PREFETCH
+
+#define WEIGHT_PREFETCH_SIZE    (2 * 16 * 1024) // Both halves, in bytes
+#define WEIGHT_PREFETCH_MIN     (2 * 1024)      // Smaller layers stay in flash
+
+// Longest wait of weight_dma_wait(), 16 KB of flash take around 0.3 ms
+#define WEIGHT_DMA_TIMEOUT      (10)    // In ms
+
+#ifdef WEIGHT_PREFETCH
+void weight_dma_setup();
+bool weight_dma_start(void * dst, const void * src, uint32_t len);
+bool weight_dma_wait();
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WEIGHT_DMA_H */
+/*** end of file ***/
@@ -0,0 +1,13 @@
+#include "tensorflow/lite/micro/debug_log.h"
+#include <string.h>
+#include "board.h"
+
+extern "C" void DebugLog(const char* s) 
+{
+  // Simpler version of printing to serial, we can use what
+  // Tensorflow created.
+  for (size_t i = 0, j = strlen(s); i < j; i++) 
+  {
+      board_putc(s[i]);
+  }
+}
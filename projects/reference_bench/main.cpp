@@ -0,0 +1,107 @@
+// Includes connected with Tensorflow
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/micro/micro_error_reporter.h"
+#include "tensorflow/lite/micro/benchmarks/keyword_scrambled_model_data.h"
+#include "tensorflow/lite/micro/testing/test_conv_model.h"
+
+// Includes connected with micro
+#define BOARD_IMPLEMENTATION
+#include "board.h"
+#include "printf.h"
+#include "cycle_profiler.h"
+#include "inference_engine.h"
+#include "model_ops.h"
+#include "target_bench.h"
+
+// Reference workloads of TFLM benchmarks, the keyword spotting model with
+// scrambled weights and the small conv model of interpreter tests, run
+// with the profiler attached on any board of board.h. Both are already
+// compiled into microlite.a, so numbers can be compared with published
+// TFLM ones and between our kernel and placement changes, which are not
+// tuned for these models. Resolver is the plain engine one, kernels are
+// the CMSIS-NN ones of the archive. Each model prints one JSON object of
+// target_bench.h, 'make matrix' builds firmware for every board and
+// 'make BENCH_SWEEP=1' measures all cache and flash combinations.
+
+// Exact size measured with ARENA_REPORT=1 build, see shared/arena_report.h
+#if !defined(ARENA_REPORT) && __has_include("arena_size.h")
+#include "arena_size.h"
+#endif
+
+#ifdef ARENA_SIZE_BYTES
+constexpr int tensor_arena_size = ARENA_SIZE_BYTES;
+#else
+constexpr int tensor_arena_size = 32 * 1024;
+#endif
+
+// One engine for both models, operators are the union of them
+InferenceEngine<tensor_arena_size, MODEL_ENGINE_OPS> engine;
+
+struct ReferenceModel
+{
+    const char * name;
+    const unsigned char * data;
+};
+
+const ReferenceModel models[] = {
+    {"keyword_scrambled", g_keyword_scrambled_model_data},
+    {"test_conv", kTestConvModelData},
+};
+constexpr int model_count = sizeof(models) / sizeof(models[0]);
+
+// Input of every run, values do not change cycles of these models, so a
+// fixed pattern keeps runs comparable between boards
+constexpr int kInputSize = 4 * 1024;
+alignas(16) static signed char bench_input[kInputSize];
+
+int main()
+{
+    board_init();
+
+    printf("System setup done on %s at %lu MHz!\n", BOARD_NAME,
+           rcc_ahb_frequency / 1000000);
+
+    tflite::MicroErrorReporter micro_error_reporter;
+    tflite::ErrorReporter* error_reporter = &micro_error_reporter;
+
+    // Measures cycles of each operator
+    static CycleProfiler profiler(error_reporter);
+
+    uint32_t state = 0x12345678;
+    for (int i = 0; i < kInputSize; i++)
+    {
+        state = state * 1664525u + 1013904223u;
+        bench_input[i] = static_cast<signed char>(state >> 24);
+    }
+    const TargetBenchImage images[] = {{"pattern", bench_input,
+                                        kTargetBenchNoLabel}};
+
+    for (int m = 0; m < model_count; m++)
+    {
+        // Interpreter of the previous model is replaced over the same arena
+        if (!engine.Setup(models[m].data, error_reporter, &profiler))
+        {
+            printf("%s: setup failed\n", models[m].name);
+            continue;
+        }
+        engine.PrintInfo();
+
+        if (engine.input()->bytes > static_cast<size_t>(kInputSize))
+        {
+            printf("%s: input of %u bytes is larger than %d\n",
+                   models[m].name, (unsigned) engine.input()->bytes,
+                   kInputSize);
+            continue;
+        }
+
+        TargetBenchConfig config = {20, 2, TARGET_BENCH_SWEEP};
+        target_bench_run(models[m].name, engine.interpreter(), &profiler,
+                         images, 1, config, error_reporter);
+    }
+
+    while(1)
+    {
+    }
+
+    return 0;
+}
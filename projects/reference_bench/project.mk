@@ -0,0 +1,37 @@
+######################################
+# Project settings
+######################################
+# Name of the MCU, use exact name, for example stm32f405vg, this is needed by libopencm3
+# Builds for every board of board.h, 'make matrix' gives all of them
+DEVICE = stm32f767zi
+
+# General settings
+OPT = -O3
+DEBUG = -g
+
+# Source files are added here, wildcard function adds them automatically,
+# if you are going to create seperate folders you have to add them by yourself.
+# example: driver/motor.c -> $(wildcard driver/*.c)
+CFILES = $(wildcard *.c)
+CXXFILES = $(wildcard *.cpp)
+CCFILES = $(wildcard *.cc)
+AFILES = $(wildcard *.s)
+
+# It is needed to add archived microlite library, it already has both
+# reference models compiled in
+LIBDEPS := microlite_build/microlite.a
+
+# Models from which model_ops.h with needed operators is generated, the
+# reference workloads of TFLM benchmarks
+TFLM_MICRO_DIR := ../../tensorflow/tensorflow/lite/micro
+MODEL_SRC := $(TFLM_MICRO_DIR)/benchmarks/keyword_scrambled_model_data.cc \
+	$(TFLM_MICRO_DIR)/testing/test_conv_model.cc
+
+# Header only code shared between projects
+SHARED_DIR := ../../shared
+
+# Sources from shared folder that are compiled into the project
+SHARED_CFILES := printf.c
+
+# If you add new folders do not forget to update the INCLUDES!
+INCLUDES += $(patsubst %,-I%, . $(SHARED_DIR))
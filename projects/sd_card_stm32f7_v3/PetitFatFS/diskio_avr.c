@@ -13,6 +13,7 @@
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/spi.h>
+#include <libopencm3/stm32/dma.h>
 #include "utility.h"
 
 #define DESELECT()	(gpio_set(GPIO_PORT_CS, GPIOCS))      /* MMC CS = H */
@@ -30,6 +31,22 @@
 #define RCC_SPI                  RCC_SPI1
 #define RCC_GPIO_PORT_SPI        RCC_GPIOA
 
+/* SPI1 DMA requests, both on channel 3 */
+#define DMA_SD                   DMA2
+#define RCC_DMA_SD               RCC_DMA2
+#define DMA_STREAM_SD_RX         DMA_STREAM0
+#define DMA_STREAM_SD_TX         DMA_STREAM3
+
+/* Card is initialized with slow clock, afterwards SPI runs at 
+ * APB2/4 = 27 MHz. This is slightly above 25 MHz of default speed mode, 
+ * most cards handle it, use DIV_8 if writes start to fail. */
+#define SD_SPI_INIT_BAUDRATE     SPI_CR1_BAUDRATE_FPCLK_DIV_64
+#define SD_SPI_FAST_BAUDRATE     SPI_CR1_BAUDRATE_FPCLK_DIV_4
+#define SPI_CR1_BAUDRATE_MASK    (0x7 << 3)
+
+/* How long card can stay busy after a block, in ms */
+#define SD_WRITE_TIMEOUT         500
+
 static void init_spi(void)
 {
     rcc_periph_clock_enable(RCC_GPIO_PORT_CS);
@@ -61,7 +78,7 @@ static void init_spi(void)
 
 	/* SPI configuration */
     spi_init_master(SPI_SD, 
-                    SPI_CR1_BAUDRATE_FPCLK_DIV_64,
+                    SD_SPI_INIT_BAUDRATE,
                     SPI_CR1_CPOL_CLK_TO_0_WHEN_IDLE,
                     SPI_CR1_CPHA_CLK_TRANSITION_1,
                     SPI_CR1_MSBFIRST);
@@ -93,7 +110,38 @@ static void init_spi(void)
 	/* Wait for transfer finished. */
 	//while (!(SPI_SR(SPI_SD) & SPI_SR_TXE));
 	//uint16_t dummyread = SPI_DR(SPI_SD);
-     
+
+    /* DMA streams for block transfers, memory side is set per transfer */
+    rcc_periph_clock_enable(RCC_DMA_SD);
+
+    dma_stream_reset(DMA_SD, DMA_STREAM_SD_RX);
+    dma_channel_select(DMA_SD, DMA_STREAM_SD_RX, DMA_SxCR_CHSEL_3);
+    dma_set_priority(DMA_SD, DMA_STREAM_SD_RX, DMA_SxCR_PL_VERY_HIGH);
+    dma_set_transfer_mode(DMA_SD, DMA_STREAM_SD_RX, 
+                          DMA_SxCR_DIR_PERIPHERAL_TO_MEM);
+    dma_set_peripheral_address(DMA_SD, DMA_STREAM_SD_RX, 
+                               (uint32_t) &SPI_DR(SPI_SD));
+    dma_set_peripheral_size(DMA_SD, DMA_STREAM_SD_RX, DMA_SxCR_PSIZE_8BIT);
+    dma_set_memory_size(DMA_SD, DMA_STREAM_SD_RX, DMA_SxCR_MSIZE_8BIT);
+
+    dma_stream_reset(DMA_SD, DMA_STREAM_SD_TX);
+    dma_channel_select(DMA_SD, DMA_STREAM_SD_TX, DMA_SxCR_CHSEL_3);
+    dma_set_priority(DMA_SD, DMA_STREAM_SD_TX, DMA_SxCR_PL_HIGH);
+    dma_set_transfer_mode(DMA_SD, DMA_STREAM_SD_TX, 
+                          DMA_SxCR_DIR_MEM_TO_PERIPHERAL);
+    dma_set_peripheral_address(DMA_SD, DMA_STREAM_SD_TX, 
+                               (uint32_t) &SPI_DR(SPI_SD));
+    dma_set_peripheral_size(DMA_SD, DMA_STREAM_SD_TX, DMA_SxCR_PSIZE_8BIT);
+    dma_set_memory_size(DMA_SD, DMA_STREAM_SD_TX, DMA_SxCR_MSIZE_8BIT);
+}
+
+/* Switches SPI to fast clock, call only after card is initialized */
+static void spi_set_fast_clock(void)
+{
+    spi_disable(SPI_SD);
+    SPI_CR1(SPI_SD) = (SPI_CR1(SPI_SD) & ~SPI_CR1_BAUDRATE_MASK) | 
+                      SD_SPI_FAST_BAUDRATE;
+    spi_enable(SPI_SD);
 }
 
 static BYTE spi(BYTE d)
@@ -129,6 +177,115 @@ static BYTE rcv_spi(void)
 	return spi(0xff);
 }
 
+/*
+ * Moves len bytes over SPI with DMA. If tx is NULL, fill byte is clocked 
+ * out len times, if rx is NULL received bytes are dropped. Blocks until 
+ * last byte was received, so SPI is idle when it returns. Returns 0 on 
+ * success. D-cache is not enabled in this project, otherwise buffers 
+ * would have to be cleaned/invalidated around the transfer.
+ */
+static BYTE spi_dma(const BYTE *tx, BYTE fill, BYTE *rx, UINT len)
+{
+	static BYTE tx_fill;
+	static BYTE dummy_rx;
+	BYTE        err;
+
+	/* Stream can not be enabled, if any of its flags is still set */
+	dma_clear_interrupt_flags(DMA_SD, DMA_STREAM_SD_RX, DMA_TCIF | DMA_HTIF | DMA_TEIF | 
+	                                                    DMA_DMEIF | DMA_FEIF);
+	dma_clear_interrupt_flags(DMA_SD, DMA_STREAM_SD_TX, DMA_TCIF | DMA_HTIF | DMA_TEIF | 
+	                                                    DMA_DMEIF | DMA_FEIF);
+
+	if (rx) {
+		dma_enable_memory_increment_mode(DMA_SD, DMA_STREAM_SD_RX);
+		dma_set_memory_address(DMA_SD, DMA_STREAM_SD_RX, (uint32_t)rx);
+	} else {
+		dma_disable_memory_increment_mode(DMA_SD, DMA_STREAM_SD_RX);
+		dma_set_memory_address(DMA_SD, DMA_STREAM_SD_RX, (uint32_t)&dummy_rx);
+	}
+	if (tx) {
+		dma_enable_memory_increment_mode(DMA_SD, DMA_STREAM_SD_TX);
+		dma_set_memory_address(DMA_SD, DMA_STREAM_SD_TX, (uint32_t)tx);
+	} else {
+		tx_fill = fill;
+		dma_disable_memory_increment_mode(DMA_SD, DMA_STREAM_SD_TX);
+		dma_set_memory_address(DMA_SD, DMA_STREAM_SD_TX, (uint32_t)&tx_fill);
+	}
+	dma_set_number_of_data(DMA_SD, DMA_STREAM_SD_RX, len);
+	dma_set_number_of_data(DMA_SD, DMA_STREAM_SD_TX, len);
+
+	/* Receive side has to be ready before first byte is clocked out */
+	spi_enable_rx_dma(SPI_SD);
+	dma_enable_stream(DMA_SD, DMA_STREAM_SD_RX);
+	dma_enable_stream(DMA_SD, DMA_STREAM_SD_TX);
+	spi_enable_tx_dma(SPI_SD);
+
+	/* Receive stream finishes last, after that whole transfer is done */
+	while (!dma_get_interrupt_flag(DMA_SD, DMA_STREAM_SD_RX, DMA_TCIF | DMA_TEIF))
+		;
+	err = dma_get_interrupt_flag(DMA_SD, DMA_STREAM_SD_RX, DMA_TEIF) || 
+	      dma_get_interrupt_flag(DMA_SD, DMA_STREAM_SD_TX, DMA_TEIF);
+
+	dma_disable_stream(DMA_SD, DMA_STREAM_SD_TX);
+	dma_disable_stream(DMA_SD, DMA_STREAM_SD_RX);
+	spi_disable_tx_dma(SPI_SD);
+	spi_disable_rx_dma(SPI_SD);
+
+	return err;
+}
+
+/* 
+ * Block helpers, short runs (FAT entries, directory fields) are cheaper 
+ * byte by byte than setting up both DMA streams.
+ */
+#define SPI_DMA_MIN_LEN 16
+
+static BYTE xmit_spi_multi(const BYTE *buff, UINT len)
+{
+	if (len < SPI_DMA_MIN_LEN) {
+		while (len--)
+			xmit_spi(*buff++);
+		return 0;
+	}
+	return spi_dma(buff, 0, 0, len);
+}
+
+static BYTE fill_spi_multi(BYTE value, UINT len)
+{
+	if (len < SPI_DMA_MIN_LEN) {
+		while (len--)
+			xmit_spi(value);
+		return 0;
+	}
+	return spi_dma(0, value, 0, len);
+}
+
+/* Receives len bytes into buff, or drops them if buff is NULL */
+static BYTE rcv_spi_multi(BYTE *buff, UINT len)
+{
+	if (len < SPI_DMA_MIN_LEN) {
+		while (len--) {
+			BYTE d = rcv_spi();
+			if (buff)
+				*buff++ = d;
+		}
+		return 0;
+	}
+	return spi_dma(0, 0xFF, buff, len);
+}
+
+/* Waits until card releases busy (MISO high), returns 0 when ready */
+static BYTE wait_ready(UINT timeout)
+{
+	uint64_t start = millis();
+
+	while (rcv_spi() != 0xFF) {
+		if ((millis() - start) > timeout)
+			return 1;
+	}
+	return 0;
+}
+
 /*--------------------------------------------------------------------------
 
    Module Private Functions
@@ -143,6 +300,8 @@ static BYTE rcv_spi(void)
 #define CMD16 (0x40 + 16)  /* SET_BLOCKLEN */
 #define CMD17 (0x40 + 17)  /* READ_SINGLE_BLOCK */
 #define CMD24 (0x40 + 24)  /* WRITE_BLOCK */
+#define ACMD23 (0xC0 + 23) /* SET_WR_BLK_ERASE_COUNT (SDC) */
+#define CMD25 (0x40 + 25)  /* WRITE_MULTIPLE_BLOCK */
 #define CMD55 (0x40 + 55)  /* APP_CMD */
 #define CMD58 (0x40 + 58)  /* READ_OCR */
 
@@ -264,6 +423,9 @@ DSTATUS disk_initialize(void)
 	DESELECT();
 	rcv_spi();
 
+	if (ty)
+		spi_set_fast_clock();
+
 	return ty ? 0 : STA_NOINIT;
 }
 
@@ -296,26 +458,16 @@ DRESULT disk_readp(BYTE *buff,   /* Pointer to the read buffer (NULL:Forward to
 
 			bc = 512 + 2 - offset - count; /* Number of trailing bytes to skip */
 
-			/* Skip leading bytes */
-			while (offset--)
+			/* Skip leading bytes, receive a part of the sector, then skip 
+			 * trailing bytes and CRC. Forwarding to a stream is not used, 
+			 * with NULL buff the part is dropped as well. */
+			if (rcv_spi_multi(0, offset) || rcv_spi_multi(buff, count) || 
+			    rcv_spi_multi(0, bc)) {
+				DESELECT();
 				rcv_spi();
-
-			/* Receive a part of the sector */
-			if (buff) { /* Store data to the memory */
-				do {
-					*buff++ = rcv_spi();
-				} while (--count);
-			} else { /* Forward data to the outgoing stream */
-				do {
-					// FORWARD(rcv_spi());
-				} while (--count);
+				return RES_ERROR;
 			}
 
-			/* Skip trailing bytes and CRC */
-			do
-				rcv_spi();
-			while (--bc);
-
 			res = RES_OK;
 		}
 	}
@@ -343,12 +495,12 @@ DRESULT disk_writep(const BYTE *buff, /* Pointer to the bytes to be written (NUL
 
 	if (buff) { /* Send data bytes */
 		bc = sc;
-		while (bc && wc) { /* Send data bytes to the card */
-			xmit_spi(*buff++);
-			wc--;
-			bc--;
+		if (bc > wc)
+			bc = wc;
+		if (!xmit_spi_multi(buff, bc)) { /* Send data bytes to the card */
+			wc -= bc;
+			res = RES_OK;
 		}
-		res = RES_OK;
 	} else {
 		if (sc) { /* Initiate sector write process */
 			if (!(CardType & CT_BLOCK))
@@ -360,20 +512,12 @@ DRESULT disk_writep(const BYTE *buff, /* Pointer to the bytes to be written (NUL
 				res = RES_OK;
 			}
 		} else { /* Finalize sector write process */
-			bc = wc + 2;
-			while (bc--) {
-				xmit_spi(0); /* Fill left bytes and CRC with zeros */
-			}
+			fill_spi_multi(0, wc + 2); /* Fill left bytes and CRC with zeros */
 			do {
 				res = rcv_spi();
 			} while (res == 0xFF);
-			if ((res & 0x1F) == 0x05) { /* Receive data resp and wait for end of write process in timeout of 500ms */
-				for (bc = 5000; rcv_spi() != 0xFF && bc; bc--) /* Wait for ready */
-					//_delay_us(100);
-                    delay(1);
-				if (bc)
-					res = RES_OK;
-			}
+			if ((res & 0x1F) == 0x05) /* Receive data resp and wait for end of write process in timeout of 500ms */
+				res = wait_ready(SD_WRITE_TIMEOUT) ? RES_ERROR : RES_OK;
 			DESELECT();
 			rcv_spi();
 		}
@@ -382,3 +526,72 @@ DRESULT disk_writep(const BYTE *buff, /* Pointer to the bytes to be written (NUL
 	return res;
 }
 #endif
+
+/*-----------------------------------------------------------------------*/
+/* Write consecutive sectors                                             */
+/*-----------------------------------------------------------------------*/
+
+/* Explanation: pf_write() programs every sector with its own CMD24, so 
+ * card erases and programs one sector at a time and waits for the whole 
+ * command sequence in between. With CMD25 card stays selected, blocks 
+ * follow each other with only a data token and the card can program them
+ * in the background. Start, write any number of sectors and stop; no 
+ * other disk function may be called in between, as the card stays 
+ * selected for the whole sequence.
+ */
+
+#if _USE_WRITE
+DRESULT disk_write_multi_start(DWORD sector, /* First sector number (LBA) */
+                               DWORD count   /* Expected number of sectors, 0 if unknown */
+                               )
+{
+	/* Pre-erase hint, lets card prepare whole area at once */
+	if (count && (CardType & (CT_SD1 | CT_SD2)))
+		send_cmd(ACMD23, count);
+
+	if (!(CardType & CT_BLOCK))
+		sector *= 512; /* Convert to byte address if needed */
+
+	if (send_cmd(CMD25, sector) != 0) {
+		DESELECT();
+		rcv_spi();
+		return RES_ERROR;
+	}
+
+	return RES_OK;
+}
+
+DRESULT disk_write_multi_block(const BYTE *buff /* 512 bytes of sector data */
+                               )
+{
+	BYTE resp;
+
+	xmit_spi(0xFF);
+	xmit_spi(0xFC); /* Multiple block write data token */
+	if (xmit_spi_multi(buff, 512))
+		return RES_ERROR;
+	xmit_spi(0xFF); /* Dummy CRC */
+	xmit_spi(0xFF);
+
+	resp = rcv_spi();
+	if ((resp & 0x1F) != 0x05) /* Data rejected */
+		return RES_ERROR;
+
+	return wait_ready(SD_WRITE_TIMEOUT) ? RES_ERROR : RES_OK;
+}
+
+DRESULT disk_write_multi_stop(void)
+{
+	DRESULT res = RES_OK;
+
+	xmit_spi(0xFD); /* Stop transmission token */
+	rcv_spi();      /* Card needs one byte before it signals busy */
+	if (wait_ready(SD_WRITE_TIMEOUT))
+		res = RES_ERROR;
+
+	DESELECT();
+	rcv_spi();
+
+	return res;
+}
+#endif
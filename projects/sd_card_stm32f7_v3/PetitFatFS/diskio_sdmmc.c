@@ -0,0 +1,499 @@
+/*-------------------------------------------------------------------------*/
+/* PFF - Low level disk control module for STM32F7 SDMMC1                  */
+/* Same interface as diskio_avr.c, card runs in SD mode on 4-bit bus       */
+/*-------------------------------------------------------------------------*/
+
+#include <string.h>
+#include "pff.h"
+#include "diskio.h"
+
+#include <libopencm3/cm3/common.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/dma.h>
+#include "utility.h"
+
+/* Explanation: in SPI mode card is on SPI1 together with the Lepton and
+ * moves one bit per clock. SDMMC1 has its own pins, 4 data lines and
+ * checks CRC in hardware, at 24 MHz that is 12 MB/s on the bus against
+ * about 3 MB/s of SPI at 27 MHz, and SPI1 stays free for VoSPI. Sectors
+ * are moved by DMA2 stream 6 with SDMMC as flow controller, buffers that
+ * are not word aligned go through sector_buf.
+ *
+ * Pins: CK PC12, CMD PD2, D0-D3 PC8-PC11, all AF12. PC9 is MCO2 in
+ * sys_init.c, it is not set up when SD_BUS_SDMMC is defined.
+ */
+
+/* SDMMC1 registers, libopencm3 has no SDMMC driver for F7 */
+#define SDMMC1_ADDR              (PERIPH_BASE_APB2 + 0x2C00)
+#define SDMMC_POWER              MMIO32(SDMMC1_ADDR + 0x00)
+#define SDMMC_CLKCR              MMIO32(SDMMC1_ADDR + 0x04)
+#define SDMMC_ARG                MMIO32(SDMMC1_ADDR + 0x08)
+#define SDMMC_CMD                MMIO32(SDMMC1_ADDR + 0x0C)
+#define SDMMC_RESPCMD            MMIO32(SDMMC1_ADDR + 0x10)
+#define SDMMC_RESP1              MMIO32(SDMMC1_ADDR + 0x14)
+#define SDMMC_DTIMER             MMIO32(SDMMC1_ADDR + 0x24)
+#define SDMMC_DLEN               MMIO32(SDMMC1_ADDR + 0x28)
+#define SDMMC_DCTRL              MMIO32(SDMMC1_ADDR + 0x2C)
+#define SDMMC_STA                MMIO32(SDMMC1_ADDR + 0x34)
+#define SDMMC_ICR                MMIO32(SDMMC1_ADDR + 0x38)
+#define SDMMC_FIFO_ADDR          (SDMMC1_ADDR + 0x80)
+
+#define SDMMC_POWER_ON           0x3
+#define SDMMC_CLKCR_CLKEN        (1 << 8)
+#define SDMMC_CLKCR_PWRSAV       (1 << 9)
+#define SDMMC_CLKCR_WIDBUS_4     (1 << 11)
+#define SDMMC_CLKCR_HWFC_EN      (1 << 14)
+#define SDMMC_CMD_SHORT          (1 << 6)
+#define SDMMC_CMD_LONG           (3 << 6)
+#define SDMMC_CMD_CPSMEN         (1 << 10)
+#define SDMMC_DCTRL_DTEN         (1 << 0)
+#define SDMMC_DCTRL_DTDIR        (1 << 1)   /* Card to controller */
+#define SDMMC_DCTRL_DMAEN        (1 << 3)
+#define SDMMC_DCTRL_BLOCK_512    (9 << 4)
+
+#define SDMMC_STA_CCRCFAIL       (1 << 0)
+#define SDMMC_STA_DCRCFAIL       (1 << 1)
+#define SDMMC_STA_CTIMEOUT       (1 << 2)
+#define SDMMC_STA_DTIMEOUT       (1 << 3)
+#define SDMMC_STA_TXUNDERR       (1 << 4)
+#define SDMMC_STA_RXOVERR        (1 << 5)
+#define SDMMC_STA_CMDREND        (1 << 6)
+#define SDMMC_STA_CMDSENT        (1 << 7)
+#define SDMMC_STA_DATAEND        (1 << 8)
+#define SDMMC_STA_DATA_ERRORS    (SDMMC_STA_DCRCFAIL | SDMMC_STA_DTIMEOUT | \
+                                  SDMMC_STA_TXUNDERR | SDMMC_STA_RXOVERR)
+#define SDMMC_ICR_STATIC         0x5FF
+/* Only command flags, data of a read can already come in meanwhile */
+#define SDMMC_ICR_CMD            (SDMMC_STA_CCRCFAIL | SDMMC_STA_CTIMEOUT | \
+                                  SDMMC_STA_CMDREND | SDMMC_STA_CMDSENT)
+
+/* SDMMC clock is PLL48CLK, 48 MHz with the 216 MHz setup of
+ * rcc_clock_setup_hsi(). Bus clock is 48 MHz / (CLKDIV + 2). */
+#define SD_INIT_CLKDIV           118        /* 400 kHz during identification */
+#define SD_FAST_CLKDIV           0          /* 24 MHz, default speed mode */
+
+/* Data timeout in bus clocks, 250 ms at 24 MHz */
+#define SD_DATA_TIMEOUT          (24000000 / 4)
+
+/* How long card can stay busy after a block, in ms */
+#define SD_WRITE_TIMEOUT         500
+
+#define DMA_SD                   DMA2
+#define RCC_DMA_SD               RCC_DMA2
+#define DMA_STREAM_SD            DMA_STREAM6    /* SDMMC1 on channel 4 */
+
+/* Definitions for SD commands in SD mode */
+#define CMD0  0     /* GO_IDLE_STATE */
+#define CMD2  2     /* ALL_SEND_CID */
+#define CMD3  3     /* SEND_RELATIVE_ADDR */
+#define ACMD6 6     /* SET_BUS_WIDTH */
+#define CMD7  7     /* SELECT_CARD */
+#define CMD8  8     /* SEND_IF_COND */
+#define CMD12 12    /* STOP_TRANSMISSION */
+#define CMD13 13    /* SEND_STATUS */
+#define CMD16 16    /* SET_BLOCKLEN */
+#define CMD17 17    /* READ_SINGLE_BLOCK */
+#define CMD24 24    /* WRITE_BLOCK */
+#define ACMD23 23   /* SET_WR_BLK_ERASE_COUNT */
+#define CMD25 25    /* WRITE_MULTIPLE_BLOCK */
+#define ACMD41 41   /* SD_SEND_OP_COND */
+#define CMD55 55    /* APP_CMD */
+
+/* Card status of R1 */
+#define R1_READY_FOR_DATA        (1UL << 8)
+#define R1_STATE(r)              (((r) >> 9) & 0xF)
+#define R1_STATE_TRAN            4
+#define R1_ERRORS                0xFDFFE008UL
+
+/* Response types */
+#define RESP_NONE                0
+#define RESP_R1                  1
+#define RESP_R2                  2
+#define RESP_R3                  3  /* OCR, has no valid CRC */
+#define RESP_R6                  6
+#define RESP_R7                  7
+
+/* Card type flags (CardType), same as in diskio_avr.c */
+#define CT_SD1 0x02   /* SD ver 1 */
+#define CT_SD2 0x04   /* SD ver 2 */
+#define CT_BLOCK 0x08 /* Block addressing */
+
+BYTE CardType = 0;
+
+static DWORD rca;                   /* Relative card address << 16 */
+
+/* Partial reads and writes of PetitFatFS and unaligned buffers */
+static BYTE  sector_buf[512] __attribute__((aligned(4)));
+static DWORD write_sector;          /* Sector of disk_writep() */
+static UINT  write_count;           /* Bytes in sector_buf */
+
+static void init_sdmmc(void)
+{
+	rcc_periph_clock_enable(RCC_GPIOC);
+	rcc_periph_clock_enable(RCC_GPIOD);
+	rcc_periph_clock_enable(RCC_SDMMC1);
+	rcc_periph_clock_enable(RCC_DMA_SD);
+
+	/* Data and command lines need pull ups, clock does not */
+	gpio_mode_setup(GPIOC, GPIO_MODE_AF, GPIO_PUPD_PULLUP,
+	                GPIO8 | GPIO9 | GPIO10 | GPIO11);
+	gpio_mode_setup(GPIOC, GPIO_MODE_AF, GPIO_PUPD_NONE, GPIO12);
+	gpio_mode_setup(GPIOD, GPIO_MODE_AF, GPIO_PUPD_PULLUP, GPIO2);
+	gpio_set_output_options(GPIOC, GPIO_OTYPE_PP, GPIO_OSPEED_100MHZ,
+	                        GPIO8 | GPIO9 | GPIO10 | GPIO11 | GPIO12);
+	gpio_set_output_options(GPIOD, GPIO_OTYPE_PP, GPIO_OSPEED_100MHZ, GPIO2);
+	gpio_set_af(GPIOC, GPIO_AF12, GPIO8 | GPIO9 | GPIO10 | GPIO11 | GPIO12);
+	gpio_set_af(GPIOD, GPIO_AF12, GPIO2);
+
+	rcc_periph_reset_pulse(RST_SDMMC1);
+
+	/* Slow 1-bit clock for identification, card needs 74 clocks after
+	 * power up before the first command */
+	SDMMC_POWER = SDMMC_POWER_ON;
+	SDMMC_CLKCR = SD_INIT_CLKDIV | SDMMC_CLKCR_CLKEN;
+	delay(2);
+
+	/* Memory side is set per transfer, SDMMC decides when to stop */
+	dma_stream_reset(DMA_SD, DMA_STREAM_SD);
+	dma_channel_select(DMA_SD, DMA_STREAM_SD, DMA_SxCR_CHSEL_4);
+	dma_set_priority(DMA_SD, DMA_STREAM_SD, DMA_SxCR_PL_VERY_HIGH);
+	dma_set_peripheral_address(DMA_SD, DMA_STREAM_SD, SDMMC_FIFO_ADDR);
+	dma_set_peripheral_size(DMA_SD, DMA_STREAM_SD, DMA_SxCR_PSIZE_32BIT);
+	dma_set_memory_size(DMA_SD, DMA_STREAM_SD, DMA_SxCR_MSIZE_32BIT);
+	dma_enable_memory_increment_mode(DMA_SD, DMA_STREAM_SD);
+	dma_set_peripheral_flow_control(DMA_SD, DMA_STREAM_SD);
+	dma_enable_fifo_mode(DMA_SD, DMA_STREAM_SD);
+	dma_set_fifo_threshold(DMA_SD, DMA_STREAM_SD, DMA_SxFCR_FTH_4_4_FULL);
+	dma_set_memory_burst(DMA_SD, DMA_STREAM_SD, DMA_SxCR_MBURST_INCR4);
+	dma_set_peripheral_burst(DMA_SD, DMA_STREAM_SD, DMA_SxCR_PBURST_INCR4);
+}
+
+/*
+ * Sends a command and waits for its response. Returns 0 on success, R1
+ * card status is checked for errors and returned in resp, R2 and R3 only
+ * give the first word there.
+ */
+static BYTE send_cmd(BYTE cmd, DWORD arg, BYTE type, DWORD *resp)
+{
+	DWORD wait, sta;
+
+	SDMMC_ICR = SDMMC_ICR_CMD;
+	SDMMC_ARG = arg;
+
+	if (type == RESP_NONE) {
+		SDMMC_CMD = cmd | SDMMC_CMD_CPSMEN;
+		wait = SDMMC_STA_CMDSENT;
+	} else {
+		SDMMC_CMD = cmd | SDMMC_CMD_CPSMEN |
+		            (type == RESP_R2 ? SDMMC_CMD_LONG : SDMMC_CMD_SHORT);
+		wait = SDMMC_STA_CMDREND | SDMMC_STA_CCRCFAIL;
+	}
+
+	/* Command path has its own 64 clock timeout */
+	do {
+		sta = SDMMC_STA;
+	} while (!(sta & (wait | SDMMC_STA_CTIMEOUT)));
+	SDMMC_ICR = SDMMC_ICR_CMD;
+
+	if (sta & SDMMC_STA_CTIMEOUT)
+		return 1;
+	if (type == RESP_NONE)
+		return 0;
+	if ((sta & SDMMC_STA_CCRCFAIL) && type != RESP_R3)
+		return 1;
+
+	if (resp)
+		*resp = SDMMC_RESP1;
+	if (type == RESP_R1 &&
+	    (SDMMC_RESPCMD != cmd || (SDMMC_RESP1 & R1_ERRORS)))
+		return 1;
+	return 0;
+}
+
+/* ACMD<n> is the command sequence of CMD55-CMD<n> */
+static BYTE send_acmd(BYTE cmd, DWORD arg, BYTE type, DWORD *resp)
+{
+	if (send_cmd(CMD55, rca, RESP_R1, 0))
+		return 1;
+	return send_cmd(cmd, arg, type, resp);
+}
+
+/* Waits until card is ready for data again, returns 0 when it is */
+static BYTE wait_ready(UINT timeout)
+{
+	uint64_t start = millis();
+	DWORD    status;
+
+	do {
+		if (send_cmd(CMD13, rca, RESP_R1, &status))
+			return 1;
+		if ((status & R1_READY_FOR_DATA) &&
+		    R1_STATE(status) == R1_STATE_TRAN)
+			return 0;
+	} while ((millis() - start) <= timeout);
+	return 1;
+}
+
+/*
+ * Sets DMA and data path up for one 512 byte block between card and buff.
+ * For reads this comes before the command, card can start sending the
+ * block right after its response. For writes after it, card waits for
+ * the data. buff has to be word aligned. D-cache is not enabled in this
+ * project, otherwise buffer would have to be cleaned/invalidated around
+ * the transfer.
+ */
+static void start_transfer(BYTE *buff, int read)
+{
+	dma_clear_interrupt_flags(DMA_SD, DMA_STREAM_SD, DMA_TCIF | DMA_HTIF |
+	                          DMA_TEIF | DMA_DMEIF | DMA_FEIF);
+	dma_set_transfer_mode(DMA_SD, DMA_STREAM_SD,
+	                      read ? DMA_SxCR_DIR_PERIPHERAL_TO_MEM :
+	                             DMA_SxCR_DIR_MEM_TO_PERIPHERAL);
+	dma_set_memory_address(DMA_SD, DMA_STREAM_SD, (uint32_t)buff);
+	dma_enable_stream(DMA_SD, DMA_STREAM_SD);
+
+	SDMMC_ICR = SDMMC_ICR_STATIC;
+	SDMMC_DTIMER = SD_DATA_TIMEOUT;
+	SDMMC_DLEN = 512;
+	SDMMC_DCTRL = SDMMC_DCTRL_BLOCK_512 | SDMMC_DCTRL_DMAEN |
+	              SDMMC_DCTRL_DTEN | (read ? SDMMC_DCTRL_DTDIR : 0);
+}
+
+/* Stops DMA and data path without waiting, when the command failed */
+static void abort_transfer(void)
+{
+	dma_disable_stream(DMA_SD, DMA_STREAM_SD);
+	SDMMC_DCTRL = 0;
+	SDMMC_ICR = SDMMC_ICR_STATIC;
+}
+
+/* Waits until the block of start_transfer() is done, returns 0 on success */
+static BYTE finish_transfer(int read)
+{
+	DWORD sta;
+
+	/* DATAEND comes after the CRC of the card was checked */
+	do {
+		sta = SDMMC_STA;
+	} while (!(sta & (SDMMC_STA_DATAEND | SDMMC_STA_DATA_ERRORS)));
+
+	if (read) {
+		while (!dma_get_interrupt_flag(DMA_SD, DMA_STREAM_SD,
+		                               DMA_TCIF | DMA_TEIF))
+			;
+	}
+	dma_disable_stream(DMA_SD, DMA_STREAM_SD);
+	SDMMC_DCTRL = 0;
+	SDMMC_ICR = SDMMC_ICR_STATIC;
+
+	return (sta & SDMMC_STA_DATA_ERRORS) ||
+	       dma_get_interrupt_flag(DMA_SD, DMA_STREAM_SD, DMA_TEIF);
+}
+
+/* Sends one block after CMD24 or CMD25 was answered */
+static BYTE transfer_block(const BYTE *buff)
+{
+	start_transfer((BYTE *)buff, 0);
+	return finish_transfer(0);
+}
+
+static BYTE read_block(DWORD sector, BYTE *buff)
+{
+	if (!(CardType & CT_BLOCK))
+		sector *= 512; /* Convert to byte address if needed */
+
+	/* Data path is enabled first, card sends the block right after the
+	 * response, DPSM would miss its start bit otherwise */
+	start_transfer(buff, 1);
+	if (send_cmd(CMD17, sector, RESP_R1, 0)) {
+		abort_transfer();
+		return 1;
+	}
+	return finish_transfer(1);
+}
+
+/* Sends sector_buf after CMD24 and waits until it is programmed */
+static BYTE write_block(void)
+{
+	if (transfer_block(sector_buf))
+		return 1;
+	return wait_ready(SD_WRITE_TIMEOUT);
+}
+
+/*--------------------------------------------------------------------------
+
+   Public Functions
+
+---------------------------------------------------------------------------*/
+
+/*-----------------------------------------------------------------------*/
+/* Initialize Disk Drive                                                 */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS disk_initialize(void)
+{
+	DWORD resp, hcs;
+	UINT  tmr;
+	BYTE  ty = 0;
+
+	init_sdmmc();
+	CardType = 0;
+	rca = 0;
+
+	send_cmd(CMD0, 0, RESP_NONE, 0); /* GO_IDLE_STATE */
+
+	/* SDv2 answers CMD8, SDv1 times out. MMC is not supported. */
+	hcs = 0;
+	if (send_cmd(CMD8, 0x1AA, RESP_R7, &resp) == 0) {
+		if ((resp & 0xFFF) != 0x1AA)
+			return STA_NOINIT;
+		hcs = 1UL << 30;
+	}
+
+	/* Wait for leaving idle state, 3.2-3.4 V window */
+	for (tmr = 1000; tmr; tmr--) {
+		if (send_acmd(ACMD41, 0x00300000 | hcs, RESP_R3, &resp))
+			return STA_NOINIT;
+		if (resp & (1UL << 31))
+			break;
+		delay(1);
+	}
+	if (!tmr)
+		return STA_NOINIT;
+	ty = hcs ? ((resp & (1UL << 30)) ? CT_SD2 | CT_BLOCK : CT_SD2) : CT_SD1;
+
+	if (send_cmd(CMD2, 0, RESP_R2, 0) ||
+	    send_cmd(CMD3, 0, RESP_R6, &resp))
+		return STA_NOINIT;
+	rca = resp & 0xFFFF0000;
+
+	/* Select card, switch it and SDMMC to 4-bit bus and fast clock */
+	if (send_cmd(CMD7, rca, RESP_R1, 0) ||
+	    send_acmd(ACMD6, 2, RESP_R1, 0))
+		return STA_NOINIT;
+	if (!(ty & CT_BLOCK) && send_cmd(CMD16, 512, RESP_R1, 0))
+		return STA_NOINIT;
+
+	SDMMC_CLKCR = SD_FAST_CLKDIV | SDMMC_CLKCR_CLKEN | SDMMC_CLKCR_PWRSAV |
+	              SDMMC_CLKCR_WIDBUS_4 | SDMMC_CLKCR_HWFC_EN;
+
+	CardType = ty;
+	return 0;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Read partial sector                                                   */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_readp(BYTE *buff,   /* Pointer to the read buffer (NULL:Forward to the stream) */
+                   DWORD sector, /* Sector number (LBA) */
+                   UINT  offset, /* Byte offset to read from (0..511) */
+                   UINT  count   /* Number of bytes to read (ofs + cnt mus be <= 512) */
+                   )
+{
+	/* Card always sends the whole block, aligned whole sectors go
+	 * straight into buff */
+	if (buff && offset == 0 && count == 512 && !((DWORD)buff & 3))
+		return read_block(sector, buff) ? RES_ERROR : RES_OK;
+
+	if (read_block(sector, sector_buf))
+		return RES_ERROR;
+	if (buff)
+		memcpy(buff, sector_buf + offset, count);
+	return RES_OK;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Write partial sector                                                  */
+/*-----------------------------------------------------------------------*/
+
+#if _USE_WRITE
+DRESULT disk_writep(const BYTE *buff, /* Pointer to the bytes to be written (NULL:Initiate/Finalize sector write) */
+                    DWORD       sc    /* Number of bytes to send, Sector number (LBA) or zero */
+                    )
+{
+	DWORD sector;
+	UINT  bc;
+
+	if (buff) { /* Collect data bytes, block is sent on finalize */
+		bc = sc;
+		if (bc > 512 - write_count)
+			bc = 512 - write_count;
+		memcpy(sector_buf + write_count, buff, bc);
+		write_count += bc;
+		return RES_OK;
+	}
+
+	if (sc) { /* Initiate sector write process */
+		write_sector = sc;
+		write_count = 0;
+		return RES_OK;
+	}
+
+	/* Finalize sector write process, left bytes are zeros */
+	memset(sector_buf + write_count, 0, 512 - write_count);
+	sector = write_sector;
+	if (!(CardType & CT_BLOCK))
+		sector *= 512; /* Convert to byte address if needed */
+	if (send_cmd(CMD24, sector, RESP_R1, 0) || write_block())
+		return RES_ERROR;
+	return RES_OK;
+}
+#endif
+
+/*-----------------------------------------------------------------------*/
+/* Write consecutive sectors                                             */
+/*-----------------------------------------------------------------------*/
+
+/* Explanation: same sequence as in diskio_avr.c, CMD25 stays open and
+ * every block is one DMA transfer. Between blocks CMD13 waits until card
+ * has room for the next one, CMD12 ends the sequence. No other disk
+ * function may be called in between.
+ */
+
+#if _USE_WRITE
+DRESULT disk_write_multi_start(DWORD sector, /* First sector number (LBA) */
+                               DWORD count   /* Expected number of sectors, 0 if unknown */
+                               )
+{
+	/* Pre-erase hint, lets card prepare whole area at once */
+	if (count)
+		send_acmd(ACMD23, count, RESP_R1, 0);
+
+	if (!(CardType & CT_BLOCK))
+		sector *= 512; /* Convert to byte address if needed */
+
+	return send_cmd(CMD25, sector, RESP_R1, 0) ? RES_ERROR : RES_OK;
+}
+
+DRESULT disk_write_multi_block(const BYTE *buff /* 512 bytes of sector data */
+                               )
+{
+	/* Between blocks card is in receive state, not in transfer state */
+	DWORD status;
+
+	if ((DWORD)buff & 3) {
+		memcpy(sector_buf, buff, 512);
+		buff = sector_buf;
+	}
+	if (transfer_block(buff))
+		return RES_ERROR;
+
+	uint64_t start = millis();
+	do {
+		if (send_cmd(CMD13, rca, RESP_R1, &status))
+			return RES_ERROR;
+		if (status & R1_READY_FOR_DATA)
+			return RES_OK;
+	} while ((millis() - start) <= SD_WRITE_TIMEOUT);
+	return RES_ERROR;
+}
+
+DRESULT disk_write_multi_stop(void)
+{
+	if (send_cmd(CMD12, 0, RESP_R1, 0))
+		return RES_ERROR;
+	return wait_ready(SD_WRITE_TIMEOUT) ? RES_ERROR : RES_OK;
+}
+#endif
@@ -0,0 +1,1068 @@
+#include <string.h>
+#include "fat_stream.h"
+#include "PetitFatFS/diskio.h"
+
+/* Explanation: file is written run by run, a run is a range of
+ * contiguous clusters that is allocated at once, preallocated size at
+ * open and the same size every time it is used up. Inside a run next
+ * sector is just the previous one plus one, so data goes out with a
+ * single CMD25 multi-block write and FAT is not read at all. Only at
+ * the end of a run writing stops, FAT gets the next run linked in and
+ * the multi-block write starts again at the new run; a run directly
+ * after the previous one is taken if it is free, so files stay
+ * contiguous on an empty card.
+ *
+ * Directory entry and FSInfo are written by fat_stream_sync() and
+ * fat_stream_close(), between them only the data sectors change. After
+ * power loss the file has the size of the last sync, clusters that were
+ * allocated after it are freed again on the next fat_stream_open().
+ * fat_stream_close() also gives back preallocated clusters that were
+ * not used.
+ * */
+
+#define SECTOR_SIZE         512
+#define DIR_ENTRY_SIZE      32
+#define DIR_ENTRIES         (SECTOR_SIZE / DIR_ENTRY_SIZE)
+#define FAT_ENTRIES         (SECTOR_SIZE / 4)
+#define FAT_MASK            0x0FFFFFFFUL
+#define FAT_EOC             0x0FFFFFFFUL
+#define FAT_UNKNOWN         0xFFFFFFFFUL
+
+#define DIR_ATTR            11
+#define DIR_CLUSTER_HI      20
+#define DIR_DATE            24
+#define DIR_CLUSTER_LO      26
+#define DIR_SIZE            28
+#define ATTR_VOLUME         0x08
+#define ATTR_LFN            0x0F
+#define ATTR_ARCHIVE        0x20
+#define DATE_1980_01_01     0x0021
+
+#define FSI_FREE            488
+#define FSI_NEXT            492
+
+static struct
+{
+    bool mounted;
+    uint32_t fat_start;         // First sector of the first FAT
+    uint32_t fat_sectors;       // Sectors of each FAT
+    uint8_t num_fats;
+    uint8_t cluster_sectors;
+    uint32_t data_start;        // Sector of cluster 2
+    uint32_t last_cluster;
+    uint32_t root_cluster;
+    uint32_t fsinfo_sector;     // 0 if volume has none
+    uint32_t free_clusters;
+    uint32_t next_free;         // Where search for free clusters starts
+}vol;
+
+static struct
+{
+    bool open;
+    bool streaming;             // Multi-block write is in progress
+    uint32_t dir_sector;        // Directory entry of the file
+    uint8_t dir_index;
+    uint32_t first_cluster;     // 0 while file has no clusters
+    uint32_t prev_cluster;      // Cluster before current run, 0 if none
+    uint32_t run_cluster;       // First cluster of current run
+    uint32_t run_clusters;
+    uint32_t run_sector;        // Next sector to write, relative to run
+    uint32_t run_size;          // Clusters of each new run
+    uint32_t size;
+    uint32_t partial;           // Bytes in data, last sector of the file
+}file;
+
+// FAT, directory and FSInfo sectors go through the window, file data
+// through data buffer, so metadata never has to be read again in between
+static uint8_t window[SECTOR_SIZE] __attribute__((aligned(4)));
+static uint32_t window_sector = 0xFFFFFFFFUL;
+static bool window_dirty = false;
+static uint8_t data[SECTOR_SIZE] __attribute__((aligned(4)));
+
+static uint16_t ld16(const uint8_t * p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t ld32(const uint8_t * p)
+{
+    return p[0] | (p[1] << 8) | ((uint32_t) p[2] << 16) |
+           ((uint32_t) p[3] << 24);
+}
+
+static void st16(uint8_t * p, uint16_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static void st32(uint8_t * p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static bool read_sector(uint32_t sector, uint8_t * buff)
+{
+    return disk_readp(buff, sector, 0, SECTOR_SIZE) == RES_OK;
+}
+
+static bool write_sector(uint32_t sector, const uint8_t * buff)
+{
+    return disk_writep(0, sector) == RES_OK &&
+           disk_writep(buff, SECTOR_SIZE) == RES_OK &&
+           disk_writep(0, 0) == RES_OK;
+}
+
+/*!
+ * @brief   Writes window back, FAT sectors into every copy of FAT
+ */
+static bool flush_window(void)
+{
+    if (!window_dirty)
+    {
+        return true;
+    }
+
+    uint32_t copies = 1;
+    if (window_sector >= vol.fat_start &&
+        window_sector < vol.fat_start + vol.fat_sectors)
+    {
+        copies = vol.num_fats;
+    }
+    for (uint32_t i = 0; i < copies; i++)
+    {
+        if (!write_sector(window_sector + i * vol.fat_sectors, window))
+        {
+            return false;
+        }
+    }
+    window_dirty = false;
+    return true;
+}
+
+static bool load_window(uint32_t sector)
+{
+    if (sector == window_sector)
+    {
+        return true;
+    }
+    if (!flush_window())
+    {
+        return false;
+    }
+    window_sector = 0xFFFFFFFFUL;
+    if (!read_sector(sector, window))
+    {
+        return false;
+    }
+    window_sector = sector;
+    return true;
+}
+
+static uint32_t cluster_sector(uint32_t cluster)
+{
+    return vol.data_start + (cluster - 2) * vol.cluster_sectors;
+}
+
+static bool fat_get(uint32_t cluster, uint32_t * value)
+{
+    if (!load_window(vol.fat_start + cluster / FAT_ENTRIES))
+    {
+        return false;
+    }
+    *value = ld32(window + (cluster % FAT_ENTRIES) * 4) & FAT_MASK;
+    return true;
+}
+
+static bool fat_set(uint32_t cluster, uint32_t value)
+{
+    if (!load_window(vol.fat_start + cluster / FAT_ENTRIES))
+    {
+        return false;
+    }
+    // Upper 4 bits are reserved and keep their value
+    uint8_t * entry = window + (cluster % FAT_ENTRIES) * 4;
+    st32(entry, (ld32(entry) & ~FAT_MASK) | (value & FAT_MASK));
+    window_dirty = true;
+    return true;
+}
+
+/*!
+ * @brief               Frees chain that starts at cluster
+ */
+static bool free_chain(uint32_t cluster)
+{
+    while (cluster >= 2 && cluster <= vol.last_cluster)
+    {
+        uint32_t next;
+        if (!fat_get(cluster, &next) || !fat_set(cluster, 0))
+        {
+            return false;
+        }
+        vol.free_clusters++;
+        if (cluster < vol.next_free)
+        {
+            vol.next_free = cluster;
+        }
+        cluster = next;
+    }
+    return true;
+}
+
+/*!
+ * @brief               Finds count free clusters in a row
+ *
+ * @param[in] count
+ * @param[out] start    First of them
+ *
+ * @return              FAT_STREAM_FULL if there is no such run
+ *
+ * @note                Search starts at the next free hint and wraps
+ *                      around once, so FAT is usually read only from
+ *                      where the last allocation ended.
+ */
+static fat_stream_result_t find_run(uint32_t count, uint32_t * start)
+{
+    uint32_t from = vol.next_free;
+    if (from < 2 || from > vol.last_cluster)
+    {
+        from = 2;
+    }
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        uint32_t first = pass ? 2 : from;
+        uint32_t last = pass ? from + count - 2 : vol.last_cluster;
+        if (last > vol.last_cluster)
+        {
+            last = vol.last_cluster;
+        }
+
+        uint32_t run = 0;
+        for (uint32_t cluster = first; cluster <= last; cluster++)
+        {
+            uint32_t value;
+            if (!fat_get(cluster, &value))
+            {
+                return FAT_STREAM_DISK_ERR;
+            }
+            run = value ? 0 : run + 1;
+            if (run == count)
+            {
+                *start = cluster - count + 1;
+                return FAT_STREAM_OK;
+            }
+        }
+    }
+    return FAT_STREAM_FULL;
+}
+
+/*!
+ * @brief               Returns true if count clusters from start are free
+ */
+static bool run_is_free(uint32_t start, uint32_t count, bool * error)
+{
+    *error = false;
+    if (start < 2 || start + count - 1 > vol.last_cluster)
+    {
+        return false;
+    }
+    for (uint32_t cluster = start; cluster < start + count; cluster++)
+    {
+        uint32_t value;
+        if (!fat_get(cluster, &value))
+        {
+            *error = true;
+            return false;
+        }
+        if (value)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!
+ * @brief               Chains count clusters from start and links them
+ *                      after prev
+ *
+ * @param[in] prev      Last cluster of the chain so far, 0 for new chain
+ */
+static bool link_run(uint32_t prev, uint32_t start, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (!fat_set(start + i, i + 1 < count ? start + i + 1 : FAT_EOC))
+        {
+            return false;
+        }
+    }
+    if (prev && !fat_set(prev, start))
+    {
+        return false;
+    }
+    vol.free_clusters -= count;
+    vol.next_free = start + count;
+    return true;
+}
+
+/*!
+ * @brief               Allocates next run of the file, right after the
+ *                      current one if possible, smaller if card is
+ *                      nearly full
+ */
+static fat_stream_result_t extend(void)
+{
+    uint32_t last = file.run_clusters ?
+                    file.run_cluster + file.run_clusters - 1 : 0;
+    bool error;
+
+    // Continuing the current run keeps the file contiguous
+    if (last && run_is_free(last + 1, file.run_size, &error))
+    {
+        if (!link_run(last, last + 1, file.run_size))
+        {
+            return FAT_STREAM_DISK_ERR;
+        }
+        file.run_clusters += file.run_size;
+        return FAT_STREAM_OK;
+    }
+    if (last && error)
+    {
+        return FAT_STREAM_DISK_ERR;
+    }
+
+    for (uint32_t count = file.run_size; count; count /= 2)
+    {
+        uint32_t start;
+        fat_stream_result_t result = find_run(count, &start);
+        if (result == FAT_STREAM_FULL)
+        {
+            continue;
+        }
+        if (result != FAT_STREAM_OK)
+        {
+            return result;
+        }
+        if (!link_run(last, start, count))
+        {
+            return FAT_STREAM_DISK_ERR;
+        }
+
+        if (!file.first_cluster)
+        {
+            file.first_cluster = start;
+        }
+        file.prev_cluster = last;
+        file.run_cluster = start;
+        file.run_clusters = count;
+        file.run_sector = 0;
+        return FAT_STREAM_OK;
+    }
+    return FAT_STREAM_FULL;
+}
+
+static bool stop_stream(void)
+{
+    if (!file.streaming)
+    {
+        return true;
+    }
+    file.streaming = false;
+    return disk_write_multi_stop() == RES_OK;
+}
+
+/*!
+ * @brief               Links in the next run if the current one is used
+ *                      up, before the next sector of the file is written
+ *
+ * @note                Also for the partial sector of sync and close, a
+ *                      file reopened at a cluster boundary starts with a
+ *                      full run as well.
+ */
+static fat_stream_result_t make_room(void)
+{
+    if (file.run_sector < file.run_clusters * vol.cluster_sectors)
+    {
+        return FAT_STREAM_OK;
+    }
+    if (!stop_stream())
+    {
+        return FAT_STREAM_DISK_ERR;
+    }
+    return extend();
+}
+
+/*!
+ * @brief               Writes full data buffer as the next sector
+ */
+static fat_stream_result_t write_data_sector(void)
+{
+    fat_stream_result_t result = make_room();
+    if (result != FAT_STREAM_OK)
+    {
+        return result;
+    }
+
+    if (!file.streaming)
+    {
+        // Metadata has to be on the card before the card stays selected
+        if (!flush_window())
+        {
+            return FAT_STREAM_DISK_ERR;
+        }
+        uint32_t left = file.run_clusters * vol.cluster_sectors -
+                        file.run_sector;
+        if (disk_write_multi_start(cluster_sector(file.run_cluster) +
+                                   file.run_sector, left))
+        {
+            return FAT_STREAM_DISK_ERR;
+        }
+        file.streaming = true;
+    }
+
+    if (disk_write_multi_block(data))
+    {
+        file.streaming = false;
+        disk_write_multi_stop();
+        return FAT_STREAM_DISK_ERR;
+    }
+    file.run_sector++;
+    return FAT_STREAM_OK;
+}
+
+/*!
+ * @brief               Converts name to directory entry form
+ *
+ * @return              False if name is not 8.3
+ */
+static bool make_name(const char * name, uint8_t out[11])
+{
+    static const char invalid[] = "\"*+,/:;<=>?[\\]|";
+    memset(out, ' ', 11);
+
+    int i = 0;
+    int limit = 8;
+    for (; *name; name++)
+    {
+        char c = *name;
+        if (c == '.' && limit == 8 && i > 0)
+        {
+            i = 8;
+            limit = 11;
+            continue;
+        }
+        if (c <= ' ' || c == '.' || strchr(invalid, c) || i == limit)
+        {
+            return false;
+        }
+        if (c >= 'a' && c <= 'z')
+        {
+            c -= 'a' - 'A';
+        }
+        out[i++] = c;
+    }
+    return i > 0;
+}
+
+/*!
+ * @brief               Finds entry of name in root directory, or a free
+ *                      entry for it, root directory grows by a cluster
+ *                      if it is full
+ *
+ * @param[out] found    True if name exists
+ */
+static fat_stream_result_t find_entry(const uint8_t name[11],
+                                      bool * found)
+{
+    uint32_t cluster = vol.root_cluster;
+    uint32_t last = 0;
+    bool have_free = false;
+    *found = false;
+
+    while (cluster >= 2 && cluster <= vol.last_cluster)
+    {
+        for (uint32_t s = 0; s < vol.cluster_sectors; s++)
+        {
+            uint32_t sector = cluster_sector(cluster) + s;
+            if (!load_window(sector))
+            {
+                return FAT_STREAM_DISK_ERR;
+            }
+            for (uint8_t i = 0; i < DIR_ENTRIES; i++)
+            {
+                const uint8_t * entry = window + i * DIR_ENTRY_SIZE;
+                bool end = entry[0] == 0;
+                if ((end || entry[0] == 0xE5) && !have_free)
+                {
+                    file.dir_sector = sector;
+                    file.dir_index = i;
+                    have_free = true;
+                }
+                if (end)
+                {
+                    return FAT_STREAM_OK;
+                }
+                if (entry[0] != 0xE5 && entry[DIR_ATTR] != ATTR_LFN &&
+                    !(entry[DIR_ATTR] & ATTR_VOLUME) &&
+                    !memcmp(entry, name, 11))
+                {
+                    file.dir_sector = sector;
+                    file.dir_index = i;
+                    *found = true;
+                    return FAT_STREAM_OK;
+                }
+            }
+        }
+        last = cluster;
+        if (!fat_get(cluster, &cluster))
+        {
+            return FAT_STREAM_DISK_ERR;
+        }
+    }
+
+    if (have_free)
+    {
+        return FAT_STREAM_OK;
+    }
+
+    // Directory is full, it gets one more zeroed cluster
+    uint32_t start;
+    if (find_run(1, &start) != FAT_STREAM_OK || !last)
+    {
+        return FAT_STREAM_DIR_FULL;
+    }
+    if (!link_run(last, start, 1) || !flush_window())
+    {
+        return FAT_STREAM_DISK_ERR;
+    }
+    memset(window, 0, sizeof(window));
+    for (uint32_t s = 0; s < vol.cluster_sectors; s++)
+    {
+        if (!write_sector(cluster_sector(start) + s, window))
+        {
+            window_sector = 0xFFFFFFFFUL;
+            return FAT_STREAM_DISK_ERR;
+        }
+    }
+    window_sector = cluster_sector(start);
+    file.dir_sector = window_sector;
+    file.dir_index = 0;
+    return FAT_STREAM_OK;
+}
+
+/*!
+ * @brief               Finds FAT32 volume on the card
+ *
+ * @return              FAT_STREAM_OK if volume is FAT32
+ *
+ * @note                Card has to be initialized with disk_initialize().
+ *                      Volume is either the whole card or the first
+ *                      partition. Free cluster count is counted once if
+ *                      FSInfo does not know it, which reads whole FAT.
+ */
+fat_stream_result_t fat_stream_mount(void)
+{
+    vol.mounted = false;
+    window_sector = 0xFFFFFFFFUL;
+    window_dirty = false;
+
+    uint32_t base = 0;
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        if (!load_window(base))
+        {
+            return FAT_STREAM_DISK_ERR;
+        }
+        if (ld16(window + 510) != 0xAA55)
+        {
+            return FAT_STREAM_NO_FAT32;
+        }
+        if ((window[0] == 0xEB || window[0] == 0xE9) &&
+            ld16(window + 11) == SECTOR_SIZE && ld16(window + 22) == 0 &&
+            ld32(window + 36) != 0)
+        {
+            break;
+        }
+        if (attempt)
+        {
+            return FAT_STREAM_NO_FAT32;
+        }
+        // Master boot record, volume is the first partition
+        base = ld32(window + 454);
+    }
+
+    uint32_t reserved = ld16(window + 14);
+    uint32_t total = ld16(window + 19) ? ld16(window + 19) :
+                                         ld32(window + 32);
+    vol.cluster_sectors = window[13];
+    vol.num_fats = window[16];
+    vol.fat_sectors = ld32(window + 36);
+    vol.root_cluster = ld32(window + 44);
+    vol.fsinfo_sector = ld16(window + 48) ? base + ld16(window + 48) : 0;
+    vol.fat_start = base + reserved;
+    vol.data_start = vol.fat_start + vol.num_fats * vol.fat_sectors;
+    if (!vol.cluster_sectors || !vol.num_fats ||
+        total <= vol.data_start - base)
+    {
+        return FAT_STREAM_NO_FAT32;
+    }
+    vol.last_cluster = (total - (vol.data_start - base)) /
+                       vol.cluster_sectors + 1;
+    if (vol.last_cluster > vol.fat_sectors * FAT_ENTRIES - 1)
+    {
+        vol.last_cluster = vol.fat_sectors * FAT_ENTRIES - 1;
+    }
+
+    vol.free_clusters = FAT_UNKNOWN;
+    vol.next_free = 2;
+    if (vol.fsinfo_sector)
+    {
+        if (!load_window(vol.fsinfo_sector))
+        {
+            return FAT_STREAM_DISK_ERR;
+        }
+        if (ld32(window) == 0x41615252 && ld32(window + 484) == 0x61417272)
+        {
+            vol.free_clusters = ld32(window + FSI_FREE);
+            vol.next_free = ld32(window + FSI_NEXT);
+        }
+        else
+        {
+            vol.fsinfo_sector = 0;
+        }
+    }
+
+    if (vol.free_clusters > vol.last_cluster - 1)
+    {
+        vol.free_clusters = 0;
+        for (uint32_t cluster = 2; cluster <= vol.last_cluster; cluster++)
+        {
+            uint32_t value;
+            if (!fat_get(cluster, &value))
+            {
+                return FAT_STREAM_DISK_ERR;
+            }
+            vol.free_clusters += value == 0;
+        }
+    }
+
+    file.open = false;
+    vol.mounted = true;
+    return FAT_STREAM_OK;
+}
+
+/*!
+ * @brief               Opens file in root directory for appending,
+ *                      creates it if it does not exist
+ *
+ * @param[in] name      8.3 name
+ * @param[in] prealloc  Bytes allocated at once, each time space runs out
+ *
+ * @return              FAT_STREAM_OK if file is open
+ *
+ * @note                Clusters after the end of the file, left from a
+ *                      power loss, are freed.
+ */
+fat_stream_result_t fat_stream_open(const char * name, uint32_t prealloc)
+{
+    if (!vol.mounted)
+    {
+        return FAT_STREAM_NOT_OPEN;
+    }
+    if (file.open)
+    {
+        fat_stream_close();
+    }
+
+    uint8_t short_name[11];
+    if (!make_name(name, short_name))
+    {
+        return FAT_STREAM_BAD_NAME;
+    }
+
+    bool found;
+    fat_stream_result_t result = find_entry(short_name, &found);
+    if (result != FAT_STREAM_OK)
+    {
+        return result;
+    }
+    if (!load_window(file.dir_sector))
+    {
+        return FAT_STREAM_DISK_ERR;
+    }
+    uint8_t * entry = window + file.dir_index * DIR_ENTRY_SIZE;
+    if (!found)
+    {
+        memset(entry, 0, DIR_ENTRY_SIZE);
+        memcpy(entry, short_name, 11);
+        entry[DIR_ATTR] = ATTR_ARCHIVE;
+        st16(entry + DIR_DATE, DATE_1980_01_01);
+        window_dirty = true;
+    }
+
+    const uint32_t cluster_bytes = vol.cluster_sectors * SECTOR_SIZE;
+    file.first_cluster = ((uint32_t) ld16(entry + DIR_CLUSTER_HI) << 16) |
+                         ld16(entry + DIR_CLUSTER_LO);
+    file.size = ld32(entry + DIR_SIZE);
+    file.run_size = (prealloc + cluster_bytes - 1) / cluster_bytes;
+    if (!file.run_size)
+    {
+        file.run_size = 1;
+    }
+    file.streaming = false;
+    file.prev_cluster = 0;
+    file.run_clusters = 0;
+    file.run_sector = 0;
+    file.partial = file.size % SECTOR_SIZE;
+
+    if (file.first_cluster && !file.size)
+    {
+        // Empty file starts over with a preallocated run
+        if (!free_chain(file.first_cluster))
+        {
+            return FAT_STREAM_DISK_ERR;
+        }
+        file.first_cluster = 0;
+    }
+
+    if (file.first_cluster)
+    {
+        // Cluster with the last byte, the rest of the chain is freed
+        uint32_t cluster = file.first_cluster;
+        uint32_t prev = 0;
+        for (uint32_t i = (file.size - 1) / cluster_bytes; i > 0; i--)
+        {
+            prev = cluster;
+            if (!fat_get(cluster, &cluster) || cluster < 2 ||
+                cluster > vol.last_cluster)
+            {
+                return FAT_STREAM_DISK_ERR;
+            }
+        }
+        uint32_t next;
+        if (!fat_get(cluster, &next))
+        {
+            return FAT_STREAM_DISK_ERR;
+        }
+        if (next >= 2 && next <= vol.last_cluster &&
+            (!fat_set(cluster, FAT_EOC) || !free_chain(next)))
+        {
+            return FAT_STREAM_DISK_ERR;
+        }
+
+        file.prev_cluster = prev;
+        file.run_cluster = cluster;
+        file.run_clusters = 1;
+        file.run_sector = ((file.size - 1) % cluster_bytes + 1) /
+                          SECTOR_SIZE;
+        if (file.partial &&
+            !read_sector(cluster_sector(cluster) + file.run_sector, data))
+        {
+            return FAT_STREAM_DISK_ERR;
+        }
+    }
+    else
+    {
+        result = extend();
+        if (result != FAT_STREAM_OK)
+        {
+            return result;
+        }
+    }
+
+    file.open = true;
+    return fat_stream_sync();
+}
+
+/*!
+ * @brief               Appends data to the open file
+ *
+ * @return              FAT_STREAM_OK if all data was written
+ *
+ * @note                Full sectors go to the card right away, the last
+ *                      partial sector on sync. Whole sectors of data keep
+ *                      records sector aligned.
+ */
+fat_stream_result_t fat_stream_write(const void * src, uint32_t len)
+{
+    if (!file.open)
+    {
+        return FAT_STREAM_NOT_OPEN;
+    }
+
+    const uint8_t * p = (const uint8_t *) src;
+    while (len)
+    {
+        uint32_t n = SECTOR_SIZE - file.partial;
+        if (n > len)
+        {
+            n = len;
+        }
+        memcpy(data + file.partial, p, n);
+        file.partial += n;
+        p += n;
+        len -= n;
+
+        if (file.partial == SECTOR_SIZE)
+        {
+            fat_stream_result_t result = write_data_sector();
+            if (result != FAT_STREAM_OK)
+            {
+                return result;
+            }
+            file.partial = 0;
+        }
+        file.size += n;
+    }
+    return FAT_STREAM_OK;
+}
+
+/*!
+ * @brief               Writes last partial sector, size of the file and
+ *                      FSInfo, after this the card has a consistent file
+ *
+ * @note                Multi-block write is stopped, it starts again with
+ *                      the next write.
+ */
+fat_stream_result_t fat_stream_sync(void)
+{
+    if (!file.open)
+    {
+        return FAT_STREAM_NOT_OPEN;
+    }
+    if (!stop_stream())
+    {
+        return FAT_STREAM_DISK_ERR;
+    }
+
+    if (file.partial)
+    {
+        fat_stream_result_t result = make_room();
+        if (result != FAT_STREAM_OK)
+        {
+            return result;
+        }
+        // Zero tail, sector is written again when it fills up
+        memset(data + file.partial, 0, SECTOR_SIZE - file.partial);
+        if (!write_sector(cluster_sector(file.run_cluster) + file.run_sector,
+                          data))
+        {
+            return FAT_STREAM_DISK_ERR;
+        }
+    }
+
+    if (!load_window(file.dir_sector))
+    {
+        return FAT_STREAM_DISK_ERR;
+    }
+    uint8_t * entry = window + file.dir_index * DIR_ENTRY_SIZE;
+    st16(entry + DIR_CLUSTER_HI, file.first_cluster >> 16);
+    st16(entry + DIR_CLUSTER_LO, file.first_cluster);
+    st32(entry + DIR_SIZE, file.size);
+    window_dirty = true;
+
+    if (vol.fsinfo_sector)
+    {
+        if (!load_window(vol.fsinfo_sector))
+        {
+            return FAT_STREAM_DISK_ERR;
+        }
+        st32(window + FSI_FREE, vol.free_clusters);
+        st32(window + FSI_NEXT, vol.next_free);
+        window_dirty = true;
+    }
+    return flush_window() ? FAT_STREAM_OK : FAT_STREAM_DISK_ERR;
+}
+
+/*!
+ * @brief               Syncs the file and frees preallocated clusters
+ *                      after its end
+ */
+fat_stream_result_t fat_stream_close(void)
+{
+    if (!file.open)
+    {
+        return FAT_STREAM_NOT_OPEN;
+    }
+    if (!stop_stream())
+    {
+        file.open = false;
+        return FAT_STREAM_DISK_ERR;
+    }
+    if (file.partial)
+    {
+        // Partial sector goes into the next run, that is trimmed as well
+        fat_stream_result_t result = make_room();
+        if (result != FAT_STREAM_OK)
+        {
+            file.open = false;
+            return result;
+        }
+    }
+
+    // Only the current run can have clusters that were never written
+    uint32_t sectors = file.run_sector + (file.partial ? 1 : 0);
+    uint32_t used = (sectors + vol.cluster_sectors - 1) / vol.cluster_sectors;
+    bool ok = true;
+    if (used < file.run_clusters)
+    {
+        uint32_t tail = file.run_cluster + used;
+        if (used)
+        {
+            ok = fat_set(tail - 1, FAT_EOC);
+        }
+        else if (file.prev_cluster)
+        {
+            ok = fat_set(file.prev_cluster, FAT_EOC);
+        }
+        else
+        {
+            file.first_cluster = 0;
+        }
+        ok = ok && free_chain(tail);
+    }
+
+    fat_stream_result_t result = ok ? fat_stream_sync() : FAT_STREAM_DISK_ERR;
+    file.open = false;
+    return result;
+}
+
+/*!
+ * @brief                   Finds file of one contiguous run, or creates
+ *                          it with its whole size, and closes it again
+ *
+ * @param[in] name          8.3 name
+ * @param[in] bytes         Size, rounded up to whole clusters
+ * @param[out] first_sector Sector of the first byte
+ * @param[out] created      True if file did not exist, its sectors hold
+ *                          whatever the card had there
+ *
+ * @return                  FAT_STREAM_EXISTS if the file is there with
+ *                          another size or in more than one run
+ *
+ * @note                    Open file is closed first. Sectors of the file
+ *                          can be written with diskio.h afterwards, as
+ *                          long as no other file is written meanwhile.
+ */
+fat_stream_result_t fat_stream_reserve(const char * name, uint32_t bytes,
+                                       uint32_t * first_sector,
+                                       bool * created)
+{
+    if (!vol.mounted)
+    {
+        return FAT_STREAM_NOT_OPEN;
+    }
+    if (file.open)
+    {
+        fat_stream_close();
+    }
+
+    uint8_t short_name[11];
+    if (!make_name(name, short_name))
+    {
+        return FAT_STREAM_BAD_NAME;
+    }
+
+    const uint32_t cluster_bytes = vol.cluster_sectors * SECTOR_SIZE;
+    uint32_t count = (bytes + cluster_bytes - 1) / cluster_bytes;
+    if (!count || count > 0xFFFFFFFFUL / cluster_bytes)
+    {
+        return FAT_STREAM_FULL;
+    }
+
+    bool found;
+    fat_stream_result_t result = find_entry(short_name, &found);
+    if (result != FAT_STREAM_OK)
+    {
+        return result;
+    }
+    if (!load_window(file.dir_sector))
+    {
+        return FAT_STREAM_DISK_ERR;
+    }
+    uint8_t * entry = window + file.dir_index * DIR_ENTRY_SIZE;
+    uint32_t first = ((uint32_t) ld16(entry + DIR_CLUSTER_HI) << 16) |
+                     ld16(entry + DIR_CLUSTER_LO);
+
+    if (found && first)
+    {
+        if (ld32(entry + DIR_SIZE) != count * cluster_bytes)
+        {
+            return FAT_STREAM_EXISTS;
+        }
+        // Every cluster has to point to the next one, the last ends it
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint32_t next;
+            if (!fat_get(first + i, &next))
+            {
+                return FAT_STREAM_DISK_ERR;
+            }
+            if (next != (i + 1 < count ? first + i + 1 : FAT_EOC))
+            {
+                return FAT_STREAM_EXISTS;
+            }
+        }
+        *first_sector = cluster_sector(first);
+        *created = false;
+        return FAT_STREAM_OK;
+    }
+
+    if (!found)
+    {
+        memset(entry, 0, DIR_ENTRY_SIZE);
+        memcpy(entry, short_name, 11);
+        entry[DIR_ATTR] = ATTR_ARCHIVE;
+        st16(entry + DIR_DATE, DATE_1980_01_01);
+        window_dirty = true;
+    }
+
+    result = find_run(count, &first);
+    if (result != FAT_STREAM_OK)
+    {
+        return result;
+    }
+    if (!link_run(0, first, count))
+    {
+        return FAT_STREAM_DISK_ERR;
+    }
+
+    // Sync writes entry and FSInfo of an open file, then it is closed
+    file.first_cluster = first;
+    file.size = count * cluster_bytes;
+    file.partial = 0;
+    file.streaming = false;
+    file.open = true;
+    result = fat_stream_sync();
+    file.open = false;
+    if (result != FAT_STREAM_OK)
+    {
+        return result;
+    }
+
+    *first_sector = cluster_sector(first);
+    *created = true;
+    return FAT_STREAM_OK;
+}
+
+/*!
+ * @brief   Returns size of the open file in bytes
+ */
+uint32_t fat_stream_size(void)
+{
+    return file.size;
+}
+
+/*!
+ * @brief   Returns free clusters of the volume, kept in RAM
+ */
+uint32_t fat_stream_free_clusters(void)
+{
+    return vol.free_clusters;
+}
+/*** end of file ***/
@@ -0,0 +1,64 @@
+#ifndef FAT_STREAM_H
+#define FAT_STREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Create and append for FAT32, for sequential logging at high rate.
+//
+// PetitFatFS can only overwrite files that already exist. This layer
+// creates files in the root directory and appends to them. Clusters are
+// allocated as contiguous runs of at least the preallocated size, so
+// data is written to consecutive sectors with one multi-block write.
+// FAT is only touched when a run is used up, never per cluster. Free
+// cluster count and next free hint of FSInfo are kept in RAM and written
+// back on sync.
+//
+// One file is open at a time. Until fat_stream_close() do not call
+// PetitFatFS, both use the same card. Names are 8.3, without long names.
+//
+// Usage example:
+// fat_stream_mount();
+// fat_stream_open("LOG.BIN", 16 * 1024 * 1024);
+// fat_stream_write(data, len);
+// fat_stream_sync();           // Size and FAT are on the card
+// fat_stream_close();          // Unused preallocated clusters are freed
+//
+// fat_stream_reserve() makes a file of one contiguous run instead and
+// only returns where it is, data is then written with the sector
+// functions of diskio.h, FAT and directory never change again. That is
+// the raw ring of frame_logger.c.
+
+typedef enum
+{
+    FAT_STREAM_OK = 0,
+    FAT_STREAM_DISK_ERR,        // Card did not respond or rejected data
+    FAT_STREAM_NO_FAT32,        // Volume is not FAT32 with 512 byte sectors
+    FAT_STREAM_BAD_NAME,        // Name is not 8.3
+    FAT_STREAM_DIR_FULL,        // No free directory entry and no cluster
+    FAT_STREAM_FULL,            // No free run of clusters large enough
+    FAT_STREAM_NOT_OPEN,
+    FAT_STREAM_EXISTS,          // File of reserve has another size or runs
+}fat_stream_result_t;
+
+fat_stream_result_t fat_stream_mount(void);
+fat_stream_result_t fat_stream_open(const char * name, uint32_t prealloc);
+fat_stream_result_t fat_stream_write(const void * data, uint32_t len);
+fat_stream_result_t fat_stream_sync(void);
+fat_stream_result_t fat_stream_close(void);
+fat_stream_result_t fat_stream_reserve(const char * name, uint32_t bytes,
+                                       uint32_t * first_sector,
+                                       bool * created);
+uint32_t fat_stream_size(void);
+uint32_t fat_stream_free_clusters(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FAT_STREAM_H */
+/*** end of file ***/
@@ -0,0 +1,693 @@
+#include <string.h>
+#include "frame_logger.h"
+#include "fat_stream.h"
+#include "utility.h"
+#include "frame_codec.h"
+#include "PetitFatFS/diskio.h"
+
+/* Explanation: log file is created or appended to with fat_stream.c,
+ * which allocates it in contiguous runs of prealloc_records records, so
+ * records go to the card with one CMD25 multi-block write per run and
+ * FAT is touched only when a run is used up.
+ *
+ * logger_append() only copies the record into a RAM ring of sectors and
+ * returns, card busy time does not reach the caller. logger_poll(),
+ * called from the main loop between frames, writes a limited number of
+ * sectors from the ring, as one fat_stream_write() per contiguous part.
+ * If the ring is full the record is dropped and counted, logging never
+ * blocks.
+ *
+ * Every LOGGER_COMMIT_RECORDS records a one sector commit marker follows.
+ * When the marker is written, fat_stream_sync() writes file size, so a
+ * power loss loses only records after the last marker, and a reader
+ * knows that everything before a marker is complete.
+ *
+ * With compression frames are coded with frame_codec.h before they go
+ * into the ring, a typical thermal frame then takes 4 to 6 sectors
+ * instead of 10, so the card is busy half as long and the ring holds
+ * twice as many records. Frame that does not save a sector is stored raw.
+ *
+ * Ring mode of logger_open_ring() writes no file system at all while it
+ * logs. fat_stream_reserve() makes the file once as one contiguous run,
+ * so the host can still copy it from the card, and after that sectors go
+ * into it with diskio.h directly, one CMD25 multi-block write from where
+ * logging is up to the end of the file, then again from its start. FAT,
+ * directory and FSInfo are never written again, there is nothing to sync
+ * and nothing that power loss can leave half done.
+ * Records never run over the end of the file, sectors up to it are zero
+ * if the next record does not fit. Index counts on over sessions, and a
+ * record is complete only if the tag in its last sector has the same
+ * index, so a torn record as well as the rest of an older one that it
+ * partly overwrote are both not taken. Across the file, index rises from
+ * its start up to the newest record and is lower behind it, that is
+ * where logger_open_ring() finds the newest record with a binary search,
+ * logging goes on right after it. New file is zeroed once, so that
+ * sectors of deleted files are not taken for records.
+ * CMD25 gets no pre-erase count in ring mode, card may erase the whole
+ * count once the write is stopped early, and that would be older records.
+ * */
+
+#define MARKER_SECTORS      1
+#define TAG_OFFSET          (512 - sizeof(logger_tag_t))
+
+static struct
+{
+    bool opened;
+    bool compress;          // Code frames with frame_codec.h
+    uint32_t count;         // Records appended in this session
+    uint32_t dropped;       // Records that did not fit into the ring
+    uint32_t head;          // Sectors put into the ring, counts up
+    uint32_t tail;          // Sectors written to the card, counts up
+    uint32_t commit;        // Head after the last marker
+    bool synced;            // Last marker was synced
+    bool raw;               // Ring mode, no file system
+    bool streaming;         // Ring mode multi-block write is in progress
+    uint32_t first_index;   // Index of the first record of this session
+    uint32_t start;         // First sector of the ring file
+    uint32_t sectors;       // Sectors of the ring file
+    uint32_t base;          // Ring file sector of head and tail 0
+}logger;
+
+// Ring is written to the card, records keep sector alignment in it
+static uint8_t ring[LOGGER_RING_SECTORS * 512] __attribute__((aligned(4)));
+
+// Coded frame, uint32_t length followed by frame_codec.h data
+static uint8_t coded[sizeof(uint32_t) + LOGGER_CODED_MAX_BYTES]
+    __attribute__((aligned(4)));
+
+/*!
+ * @brief   Returns free sectors of the ring
+ */
+static uint32_t ring_free()
+{
+    return LOGGER_RING_SECTORS - (logger.head - logger.tail);
+}
+
+/*!
+ * @brief               Copies data into the ring, offset bytes after head,
+ *                      wraps around the ring end
+ */
+static void ring_copy(uint32_t offset, const void * data, uint32_t len)
+{
+    const uint8_t * src = (const uint8_t *) data;
+    uint32_t at = ((logger.head % LOGGER_RING_SECTORS) * 512 + offset) %
+                  sizeof(ring);
+    while (len)
+    {
+        uint32_t n = sizeof(ring) - at;
+        if (n > len)
+        {
+            n = len;
+        }
+        if (src)
+        {
+            memcpy(ring + at, src, n);
+            src += n;
+        }
+        else
+        {
+            memset(ring + at, 0, n);
+        }
+        len -= n;
+        at = 0;
+    }
+}
+
+/*!
+ * @brief               Returns sectors of record with payload of len bytes
+ */
+static uint32_t record_sectors(uint32_t len)
+{
+    uint32_t tag = logger.raw ? sizeof(logger_tag_t) : 0;
+    return (sizeof(logger_header_t) + len + tag + 511) / 512;
+}
+
+/*!
+ * @brief               Puts record header and its payload into ring,
+ *                      space was checked
+ *
+ * @param[in] payload   Raw or coded frame, can be NULL if len is 0
+ */
+static void ring_put_record(const logger_header_t * header,
+                            const uint8_t * payload,
+                            uint32_t len)
+{
+    uint32_t sectors = record_sectors(len);
+    uint32_t used = sizeof(*header);
+
+    ring_copy(0, header, sizeof(*header));
+    if (len)
+    {
+        ring_copy(used, payload, len);
+        used += len;
+    }
+    // Padding up to the end of the last sector
+    ring_copy(used, NULL, sectors * 512 - used);
+    if (logger.raw)
+    {
+        logger_tag_t tag = {LOGGER_RING_MAGIC, header->index};
+        ring_copy((sectors - 1) * 512 + TAG_OFFSET, &tag, sizeof(tag));
+    }
+    logger.head += sectors;
+}
+
+/*!
+ * @brief               Queues commit marker after the appended records
+ */
+static void put_marker()
+{
+    logger_header_t marker;
+    memset(&marker, 0, sizeof(marker));
+    marker.magic = LOGGER_COMMIT_MAGIC;
+    marker.index = logger.count;
+    marker.timestamp = (uint32_t) millis();
+    ring_put_record(&marker, NULL, 0);
+    logger.commit = logger.head;
+    logger.synced = false;
+}
+
+/*!
+ * @brief                       Opens log file for appending, creates it
+ *                              if it does not exist
+ *
+ * @param[in] path              8.3 name in root directory
+ * @param[in] prealloc_records  Records allocated at once
+ * @param[in] compress          Code frames with frame_codec.h
+ *
+ * @return                      True if file is ready for logging
+ *
+ * @note                        Card has to be initialized. Do not use
+ *                              PetitFatFS until logger_close().
+ */
+bool logger_open(const char * path, uint32_t prealloc_records, bool compress)
+{
+    logger.opened = false;
+
+    fat_stream_result_t result = fat_stream_mount();
+    if (result != FAT_STREAM_OK)
+    {
+        printf("Log volume not mounted: %d\n", result);
+        return false;
+    }
+
+    result = fat_stream_open(path,
+                             prealloc_records * LOGGER_RECORD_SECTORS * 512);
+    if (result != FAT_STREAM_OK)
+    {
+        printf("Log file %s not opened: %d\n", path, result);
+        return false;
+    }
+
+    // Records of earlier sessions are whole sectors, so this only happens
+    // if something else wrote to the file
+    if (fat_stream_size() % 512)
+    {
+        printf("Log file %s is not sector aligned\n", path);
+        fat_stream_close();
+        return false;
+    }
+
+    memset(&logger, 0, sizeof(logger));
+    logger.compress = compress;
+    logger.synced = true;
+    logger.opened = true;
+    return true;
+}
+
+/*!
+ * @brief               Checks for complete record at ring file sector
+ *
+ * @param[out] index    Index of the record
+ * @param[out] sectors  Sectors of the record
+ * @param[out] error    Set if card could not be read
+ *
+ * @return              True if header and tag match
+ */
+static bool read_record(uint32_t sector, uint32_t * index,
+                        uint32_t * sectors, bool * error)
+{
+    uint8_t buff[sizeof(logger_header_t) + sizeof(uint32_t)];
+    logger_header_t header;
+    if (disk_readp(buff, logger.start + sector, 0, sizeof(buff)))
+    {
+        *error = true;
+        return false;
+    }
+    memcpy(&header, buff, sizeof(header));
+    if (header.magic != LOGGER_MAGIC ||
+        header.num_scores > LOGGER_MAX_SCORES)
+    {
+        return false;
+    }
+
+    uint32_t len;
+    if (!header.cols && !header.rows)
+    {
+        len = 0;
+    }
+    else if (header.cols != LOGGER_FRAME_COLS ||
+             header.rows != LOGGER_FRAME_ROWS)
+    {
+        return false;
+    }
+    else if (header.encoding == LOGGER_ENCODING_RAW)
+    {
+        len = LOGGER_FRAME_COLS * LOGGER_FRAME_ROWS;
+    }
+    else if (header.encoding == LOGGER_ENCODING_DELTA)
+    {
+        memcpy(&len, buff + sizeof(header), sizeof(len));
+        if (len > LOGGER_CODED_MAX_BYTES)
+        {
+            return false;
+        }
+        len += sizeof(uint32_t);
+    }
+    else
+    {
+        return false;
+    }
+
+    uint32_t n = record_sectors(len);
+    if (sector + n > logger.sectors)
+    {
+        return false;
+    }
+    logger_tag_t tag;
+    if (disk_readp((uint8_t *) &tag, logger.start + sector + n - 1,
+                   TAG_OFFSET, sizeof(tag)))
+    {
+        *error = true;
+        return false;
+    }
+    if (tag.magic != LOGGER_RING_MAGIC || tag.index != header.index)
+    {
+        return false;
+    }
+    *index = header.index;
+    *sectors = n;
+    return true;
+}
+
+/*!
+ * @brief               Finds first complete record at sector or less than
+ *                      two records after it, a torn record is shorter
+ *                      than one and can hide the start of the next
+ *
+ * @param[in,out] sector    Sector to start at, sector of the record
+ *
+ * @return              False if there is none, or card error was set
+ */
+static bool find_record(uint32_t * sector, uint32_t * index,
+                        uint32_t * sectors, bool * error)
+{
+    for (uint32_t s = *sector; s < *sector + 2 * LOGGER_RECORD_SECTORS &&
+                               s < logger.sectors; s++)
+    {
+        if (read_record(s, index, sectors, error))
+        {
+            *sector = s;
+            return true;
+        }
+        if (*error)
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief               Writes zeros to all sectors of the ring file
+ */
+static bool zero_ring()
+{
+    memset(ring, 0, 512);
+    if (disk_write_multi_start(logger.start, logger.sectors))
+    {
+        return false;
+    }
+    for (uint32_t i = 0; i < logger.sectors; i++)
+    {
+        if (disk_write_multi_block(ring))
+        {
+            disk_write_multi_stop();
+            return false;
+        }
+    }
+    return disk_write_multi_stop() == RES_OK;
+}
+
+/*!
+ * @brief                   Opens log in ring mode, records go round and
+ *                          round a file of fixed size, the oldest are
+ *                          overwritten
+ *
+ * @param[in] path          8.3 name in root directory
+ * @param[in] ring_bytes    Size of the file, when it is created
+ * @param[in] compress      Code frames with frame_codec.h
+ *
+ * @return                  True if ring is ready for logging
+ *
+ * @note                    File that exists has to have the same size and
+ *                          be contiguous. Finding the newest record reads
+ *                          a few hundred sectors, zeroing a new file takes
+ *                          as long as writing it. Do not use PetitFatFS
+ *                          until logger_close().
+ */
+bool logger_open_ring(const char * path, uint32_t ring_bytes, bool compress)
+{
+    logger.opened = false;
+
+    fat_stream_result_t result = fat_stream_mount();
+    if (result != FAT_STREAM_OK)
+    {
+        printf("Log volume not mounted: %d\n", result);
+        return false;
+    }
+
+    uint32_t start;
+    bool created;
+    result = fat_stream_reserve(path, ring_bytes, &start, &created);
+    if (result != FAT_STREAM_OK)
+    {
+        printf("Log ring %s not reserved: %d\n", path, result);
+        return false;
+    }
+
+    memset(&logger, 0, sizeof(logger));
+    logger.raw = true;
+    logger.start = start;
+    logger.sectors = ring_bytes / 512;
+    logger.compress = compress;
+    logger.synced = true;
+
+    // A record and the zeros before the end have to fit in
+    if (logger.sectors < 2 * LOGGER_RECORD_SECTORS)
+    {
+        printf("Log ring %s is too small\n", path);
+        return false;
+    }
+    if (created && !zero_ring())
+    {
+        printf("Log ring %s not zeroed\n", path);
+        return false;
+    }
+
+    // Index of the first record is where the newer part of the ring starts,
+    // binary search finds the last sector that still leads to that part
+    bool error = false;
+    uint32_t first = 0;
+    uint32_t first_index;
+    uint32_t sectors;
+    if (find_record(&first, &first_index, &sectors, &error))
+    {
+        uint32_t lo = first;
+        uint32_t hi = logger.sectors;
+        uint32_t index = first_index;
+        while (hi - lo > 1 && !error)
+        {
+            uint32_t mid = lo + (hi - lo) / 2;
+            uint32_t at = mid;
+            uint32_t mid_index;
+            uint32_t mid_sectors;
+            if (find_record(&at, &mid_index, &mid_sectors, &error) &&
+                mid_index - first_index < 0x80000000UL)
+            {
+                lo = mid;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+        if (!error && find_record(&lo, &index, &sectors, &error))
+        {
+            logger.base = (lo + sectors) % logger.sectors;
+            logger.first_index = index + 1;
+        }
+    }
+    if (error)
+    {
+        printf("Log ring %s not read\n", path);
+        return false;
+    }
+
+    printf("Log ring %s at sector %lu, record %lu\n", path, logger.base,
+                                                       logger.first_index);
+    logger.opened = true;
+    return true;
+}
+
+/*!
+ * @brief               Queues frame and its classification results
+ *
+ * @param[in] frame     LOGGER_FRAME_ROWS x LOGGER_FRAME_COLS 8-bit pixels,
+ *                      NULL logs only the scores in one sector
+ * @param[in] scores    Model output, can be NULL if num_scores is 0
+ * @param[in] num_scores
+ *
+ * @return              False if the ring is full and record was dropped
+ *
+ * @note                Only copies into RAM, around 5 us for a record with
+ *                      frame, coding the frame adds around 50 us. Call
+ *                      logger_poll() to write it out.
+ */
+bool logger_append(const uint8_t * frame,
+                   const float * scores,
+                   uint8_t num_scores)
+{
+    if (!logger.opened)
+    {
+        return false;
+    }
+
+    const uint8_t * payload = frame;
+    uint32_t len = frame ? LOGGER_FRAME_COLS * LOGGER_FRAME_ROWS : 0;
+    uint8_t encoding = LOGGER_ENCODING_RAW;
+    if (frame && logger.compress)
+    {
+        uint32_t coded_len = frame_codec_encode_u8(frame,
+                                                   LOGGER_FRAME_COLS,
+                                                   LOGGER_FRAME_ROWS,
+                                                   LOGGER_FRAME_COLS,
+                                                   coded + sizeof(uint32_t),
+                                                   LOGGER_CODED_MAX_BYTES);
+        if (coded_len)
+        {
+            memcpy(coded, &coded_len, sizeof(coded_len));
+            payload = coded;
+            len = sizeof(uint32_t) + coded_len;
+            encoding = LOGGER_ENCODING_DELTA;
+        }
+    }
+
+    // Commit marker is due after this record, it needs space as well
+    bool commit = !logger.raw &&
+                  (logger.count + 1) % LOGGER_COMMIT_RECORDS == 0;
+    uint32_t sectors = record_sectors(len) + (commit ? MARKER_SECTORS : 0);
+
+    // Record in ring mode goes to the start of the file if it does not fit
+    uint32_t zeros = 0;
+    if (logger.raw)
+    {
+        uint32_t at = (logger.base + logger.head) % logger.sectors;
+        if (at + sectors > logger.sectors)
+        {
+            zeros = logger.sectors - at;
+        }
+    }
+    if (ring_free() < zeros + sectors)
+    {
+        logger.dropped++;
+        return false;
+    }
+    ring_copy(0, NULL, zeros * 512);
+    logger.head += zeros;
+
+    if (num_scores > LOGGER_MAX_SCORES)
+    {
+        num_scores = LOGGER_MAX_SCORES;
+    }
+
+    logger_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = LOGGER_MAGIC;
+    header.index = logger.first_index + logger.count;
+    header.timestamp = (uint32_t) millis();
+    header.cols = frame ? LOGGER_FRAME_COLS : 0;
+    header.rows = frame ? LOGGER_FRAME_ROWS : 0;
+    header.num_scores = num_scores;
+    header.encoding = encoding;
+    if (num_scores)
+    {
+        memcpy(header.scores, scores, num_scores * sizeof(float));
+    }
+
+    ring_put_record(&header, payload, len);
+    logger.count++;
+
+    if (commit)
+    {
+        put_marker();
+    }
+    return true;
+}
+
+/*!
+ * @brief               Writes sectors of the ring to the ring file, the
+ *                      multi-block write stays open until its end
+ */
+static bool raw_write(const uint8_t * src, uint32_t sectors)
+{
+    while (sectors--)
+    {
+        uint32_t at = (logger.base + logger.tail) % logger.sectors;
+        if (!logger.streaming)
+        {
+            if (disk_write_multi_start(logger.start + at, 0))
+            {
+                return false;
+            }
+            logger.streaming = true;
+        }
+        if (disk_write_multi_block(src))
+        {
+            logger.streaming = false;
+            disk_write_multi_stop();
+            return false;
+        }
+        src += 512;
+        logger.tail++;
+
+        if (at + 1 == logger.sectors)
+        {
+            logger.streaming = false;
+            if (disk_write_multi_stop())
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*!
+ * @brief               Writes queued sectors to the card
+ *
+ * @param[in] max_sectors   At most this many, 0 for all of them
+ *
+ * @return              False if card reported an error
+ *
+ * @note                One sector at 24 MHz on SDMMC takes around 50 us
+ *                      plus card programming time, write a few per frame
+ *                      so that the ring empties faster than it fills.
+ */
+bool logger_poll(uint32_t max_sectors)
+{
+    if (!logger.opened)
+    {
+        return false;
+    }
+
+    uint32_t pending = logger.head - logger.tail;
+    if (max_sectors && pending > max_sectors)
+    {
+        pending = max_sectors;
+    }
+
+    while (pending)
+    {
+        // Contiguous part up to the ring end
+        uint32_t pos = logger.tail % LOGGER_RING_SECTORS;
+        uint32_t n = LOGGER_RING_SECTORS - pos;
+        if (n > pending)
+        {
+            n = pending;
+        }
+
+        if (logger.raw)
+        {
+            if (!raw_write(ring + pos * 512, n))
+            {
+                printf("Log write failed at record %lu\n", logger.count);
+                return false;
+            }
+            pending -= n;
+            continue;
+        }
+
+        fat_stream_result_t result = fat_stream_write(ring + pos * 512,
+                                                      n * 512);
+        if (result != FAT_STREAM_OK)
+        {
+            printf("Log write failed at record %lu: %d\n", logger.count,
+                                                          result);
+            return false;
+        }
+        logger.tail += n;
+        pending -= n;
+    }
+
+    // Records up to the marker are on the card, make them survive
+    if (!logger.synced && logger.tail - logger.commit < 0x80000000UL)
+    {
+        logger.synced = true;
+        return fat_stream_sync() == FAT_STREAM_OK;
+    }
+    return true;
+}
+
+/*!
+ * @brief   Writes the ring, a final commit marker and size of the file,
+ *          frees unused preallocated space, after this card can be used
+ *          by PetitFatFS again
+ *
+ * @return  True if card finished programming
+ *
+ * @note    Ring mode only writes the ring and stops multi-block write.
+ */
+bool logger_close()
+{
+    if (!logger.opened)
+    {
+        return false;
+    }
+
+    bool ok = logger_poll(0);
+    if (logger.raw)
+    {
+        if (logger.streaming)
+        {
+            logger.streaming = false;
+            ok = disk_write_multi_stop() == RES_OK && ok;
+        }
+        logger.opened = false;
+        return ok;
+    }
+    if (logger.commit != logger.head && ring_free() >= MARKER_SECTORS)
+    {
+        put_marker();
+        ok = logger_poll(0) && ok;
+    }
+
+    logger.opened = false;
+    return fat_stream_close() == FAT_STREAM_OK && ok;
+}
+
+/*!
+ * @brief   Returns number of records appended since logger_open()
+ */
+uint32_t logger_count()
+{
+    return logger.count;
+}
+
+/*!
+ * @brief   Returns number of records dropped because the ring was full
+ */
+uint32_t logger_dropped()
+{
+    return logger.dropped;
+}
+/*** end of file ***/
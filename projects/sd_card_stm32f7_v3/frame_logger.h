@@ -0,0 +1,81 @@
+#ifndef FRAME_LOGGER_H
+#define FRAME_LOGGER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOGGER_FRAME_COLS       80
+#define LOGGER_FRAME_ROWS       60
+#define LOGGER_MAX_SCORES       8
+#define LOGGER_MAGIC            0x474F4C46  // "FLOG" in little endian
+#define LOGGER_COMMIT_MAGIC     0x544D4346  // "FCMT" in little endian
+#define LOGGER_COMMIT_RECORDS   64          // Records lost at most on power loss
+#define LOGGER_RING_MAGIC       0x474E5246  // "FRNG" in little endian
+
+#define LOGGER_ENCODING_RAW     0
+#define LOGGER_ENCODING_DELTA   1
+
+// Every record starts at a sector boundary, so records can be found again
+// by their magic, even if logging was interrupted by power loss. Record
+// without frame has cols and rows 0 and takes one sector. Commit marker
+// is such a record with LOGGER_COMMIT_MAGIC, index is the number of
+// records before it, everything up to it is on the card.
+// Frame is stored raw, or with LOGGER_ENCODING_DELTA as uint32_t length
+// followed by frame_codec.h data, record then takes only the sectors it
+// needs. Frames that do not compress are kept raw.
+// In ring mode of logger_open_ring() there are no commit markers, last
+// bytes of the last sector of every record are a logger_tag_t instead.
+typedef struct
+{
+    uint32_t magic;
+    uint32_t index;                         // Counts from 0 for each session,
+                                            // over all of them in ring mode
+    uint32_t timestamp;                     // millis() at append
+    uint8_t cols;
+    uint8_t rows;
+    uint8_t num_scores;
+    uint8_t encoding;                       // LOGGER_ENCODING_*
+    float scores[LOGGER_MAX_SCORES];
+}logger_header_t;
+
+// Record in ring mode is complete only if its tag has the same index,
+// anything torn by power loss is not
+typedef struct
+{
+    uint32_t magic;                         // LOGGER_RING_MAGIC
+    uint32_t index;
+}logger_tag_t;
+
+#define LOGGER_RECORD_BYTES     (sizeof(logger_header_t) + \
+                                 LOGGER_FRAME_COLS * LOGGER_FRAME_ROWS + \
+                                 sizeof(logger_tag_t))
+#define LOGGER_RECORD_SECTORS   ((LOGGER_RECORD_BYTES + 511) / 512)
+
+// Coded frame is used only if it saves at least one sector
+#define LOGGER_CODED_MAX_BYTES  ((LOGGER_RECORD_SECTORS - 1) * 512 - \
+                                 sizeof(logger_header_t) - sizeof(uint32_t) - \
+                                 sizeof(logger_tag_t))
+
+// RAM ring that logger_poll() writes to the card from
+#define LOGGER_RING_SECTORS     (4 * LOGGER_RECORD_SECTORS)
+
+bool logger_open(const char * path, uint32_t prealloc_records, bool compress);
+bool logger_open_ring(const char * path, uint32_t ring_bytes, bool compress);
+bool logger_append(const uint8_t * frame,
+                   const float * scores,
+                   uint8_t num_scores);
+bool logger_poll(uint32_t max_sectors);
+bool logger_close();
+uint32_t logger_count();
+uint32_t logger_dropped();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FRAME_LOGGER_H */
+/*** end of file ***/
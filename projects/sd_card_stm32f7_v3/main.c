@@ -3,13 +3,28 @@
 #include "sys_init.h"
 #include "utility.h"
 #include "printf.h"
-#include "PetitFatFS/pff.h"
 #include "PetitFatFS/diskio.h"
+#include "fat_stream.h"
+#include "frame_logger.h"
 
-// Global variables for writing to SD card
-FATFS file_system;
-char write_buffer[300] = "";
-UINT byte_counter = 0;
+// Number of test frames written to the log file by the demo
+#define LOG_TEST_FRAMES     100
+
+// Records allocated at once, contiguous on the card
+#define LOG_PREALLOC_RECORDS 1024
+
+// Sectors written per frame, a record with frame is LOGGER_RECORD_SECTORS
+#define LOG_POLL_SECTORS    16
+
+// Code frames before they are logged, see frame_codec.h
+#define LOG_COMPRESS        true
+
+// Define to log into RING.BIN in ring mode of frame_logger.c instead, the
+// oldest records are overwritten, ring_extract.py reads them back
+//#define LOG_RING
+#define LOG_RING_BYTES      (4 * 1024 * 1024)
+
+uint8_t test_frame[LOGGER_FRAME_ROWS][LOGGER_FRAME_COLS];
 
 int main(void)
 {
@@ -23,7 +38,6 @@ int main(void)
     printf("System setup done!\n");
 
 	DSTATUS status;
-	FRESULT result;
 	bool flag = false; 
 	
 	/* Initialize physical drive */
@@ -46,37 +60,50 @@ int main(void)
         delay(1000);
 	} while (flag == false);
 	
-	/* Mount volume */
-	result = pf_mount(&file_system);
-	
-	
-	if (result == FR_OK)
-	{
-		printf("MOUNT OK\n");	
-	}
-	else
-	{
-		printf("MOUNT NOT OK\n");	
-		printf("FR is: %d\n", result);	
-	}
+    /* Append a line to a text file, file is created on first run */
+    const char line[] = "Hello there\n";
+    if (fat_stream_mount() == FAT_STREAM_OK &&
+        fat_stream_open("HELLO.TXT", 0) == FAT_STREAM_OK &&
+        fat_stream_write(line, sizeof(line) - 1) == FAT_STREAM_OK &&
+        fat_stream_close() == FAT_STREAM_OK)
+    {
+        printf("Appending OK\n");
+    }
+    else
+    {
+        printf("Appending NOT OK\n");
+    }
+
+    /* Log test frames, see frame_logger.c */
+#ifdef LOG_RING
+    if (logger_open_ring("RING.BIN", LOG_RING_BYTES, LOG_COMPRESS))
+#else
+    if (logger_open("LOG.BIN", LOG_PREALLOC_RECORDS, LOG_COMPRESS))
+#endif
+    {
+        float scores[4] = {0.0f};
+        uint64_t start = millis();
 
-	/* Open file */
-	result = pf_open("test.txt");
+        for (uint32_t i = 0; i < LOG_TEST_FRAMES; i++)
+        {
+            memset(test_frame, (uint8_t) i, sizeof(test_frame));
+            scores[i % 4] = 1.0f;
+            // Ring takes the record right away, card is written after it
+            logger_append(&test_frame[0][0], scores, 4);
+            scores[i % 4] = 0.0f;
+            if (!logger_poll(LOG_POLL_SECTORS))
+            {
+                break;
+            }
+        }
 
-	if (result == FR_OK)
-	{
-		printf("Opening OK\n");	
-		result = pf_write("Hello there\n", 300, &byte_counter);
-	    if (result == FR_OK)
-		printf("Writing OK\n");	
-        result = pf_write(0, 0, &byte_counter);
-	    if (result == FR_OK)
-		printf("Writing OK\n");	
+        uint64_t duration = millis() - start;
+        logger_close();
+        printf("Logged %lu frames in %lu ms, %lu dropped\n",
+               logger_count(),
+               (uint32_t) duration,
+               logger_dropped());
     }
-	else
-	{
-		printf("Opening NOT OK");	
-	}
 
     while(1)
     {
@@ -11,12 +11,29 @@ DEBUG = -g
 # Source files are added here, wildcard function adds them automaticaly,
 # if you are going to create seperate folders you have to add them by yourself.
 # example: driver/motor.c -> $(wildcard driver/*.c)
-CFILES = $(wildcard *.c) $(wildcard PetitFatFS/*.c)
+CFILES = $(wildcard *.c) PetitFatFS/pff.c
+# SD card bus, SDMMC is SDMMC1 with 4-bit bus, SPI is SPI1 shared with the
+# Lepton. Do 'make clean' when switching.
+SD_BUS ?= SDMMC
+ifeq ($(SD_BUS),SPI)
+CFILES += PetitFatFS/diskio_avr.c
+else
+CFILES += PetitFatFS/diskio_sdmmc.c
+CPPFLAGS += -DSD_BUS_SDMMC
+endif
 #CFILES = $(wildcard *.c) 
+# Host test of fat_stream.c in test/, not part of the firmware, build
+# command is at the top of test/fat_stream_test.c
 CXXFILES = $(wildcard *.cpp)
 CXXFILES += $(wildcard *.cc)
 AFILES = $(wildcard *.s)
 # SHARED_DIR += FatFS
 
+# Code shared between projects
+SHARED_DIR := ../../shared
+
+# Sources from shared folder that are compiled into the project
+SHARED_CFILES := printf.c
+
 # If you add new folders do not forget to update the INCLUDES!
 INCLUDES += $(patsubst %,-I%, . $(SHARED_DIR))
@@ -26,11 +26,13 @@ void clock_setup()
 	gpio_set_af(GPIOA, GPIO_AF0, GPIO8);
     RCC_CFGR |= (RCC_CFGR_MCOPRE_DIV_4 << RCC_CFGR_MCO1PRE_SHIFT);
 
-    // MCO2 setup on pin PC9, showing SYSCLK
+#ifndef SD_BUS_SDMMC
+    // MCO2 setup on pin PC9, showing SYSCLK, with SDMMC the pin is D1
     rcc_periph_clock_enable(RCC_GPIOC);
     gpio_mode_setup(GPIOC, GPIO_MODE_AF, GPIO_PUPD_NONE, GPIO9);
 	gpio_set_af(GPIOC, GPIO_AF0, GPIO9);
     RCC_CFGR |= (RCC_CFGR_MCOPRE_DIV_4 << RCC_CFGR_MCO2PRE_SHIFT);
+#endif
 }
 
 void i2c_setup(void)
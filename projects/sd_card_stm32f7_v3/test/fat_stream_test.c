@@ -0,0 +1,254 @@
+/* Host test of fat_stream.c on a FAT32 image in RAM, no card needed.
+ *
+ * Build and run in project directory:
+ * gcc -std=gnu11 -Wall -I. test/fat_stream_test.c fat_stream.c \
+ *     -o fat_stream_test && ./fat_stream_test
+ *
+ * Files are written in small pieces so that runs fill up in the middle of
+ * a sector, and the cluster chain in FAT is checked against the size in
+ * the directory entry and the data against what was written.
+ * */
+
+#include <stdio.h>
+#include <string.h>
+#include "fat_stream.h"
+#include "PetitFatFS/diskio.h"
+
+#define SECTOR          512
+#define SECTORS         4096
+#define RESERVED        32
+#define FAT_SECTORS     16
+#define CLUSTER_SECTORS 2
+#define CLUSTER_BYTES   (CLUSTER_SECTORS * SECTOR)
+#define DATA_START      (RESERVED + FAT_SECTORS)
+#define ROOT_CLUSTER    2
+
+static uint8_t card[SECTORS][SECTOR];
+static uint32_t write_at;          // Sector of disk_writep() or multi write
+static uint32_t write_offset;
+static int failures = 0;
+
+#define CHECK(cond)                                                     \
+    do                                                                  \
+    {                                                                   \
+        if (!(cond))                                                    \
+        {                                                               \
+            printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond);    \
+            failures++;                                                 \
+        }                                                               \
+    } while (0)
+
+DRESULT disk_readp(BYTE * buff, DWORD sector, UINT offset, UINT count)
+{
+    if (sector >= SECTORS)
+    {
+        return RES_PARERR;
+    }
+    memcpy(buff, card[sector] + offset, count);
+    return RES_OK;
+}
+
+DRESULT disk_writep(const BYTE * buff, DWORD sc)
+{
+    if (buff)
+    {
+        memcpy(card[write_at] + write_offset, buff, sc);
+        write_offset += sc;
+    }
+    else if (sc)
+    {
+        if (sc >= SECTORS)
+        {
+            return RES_PARERR;
+        }
+        write_at = sc;
+        write_offset = 0;
+    }
+    return RES_OK;
+}
+
+DRESULT disk_write_multi_start(DWORD sector, DWORD count)
+{
+    if (sector + count > SECTORS)
+    {
+        return RES_PARERR;
+    }
+    write_at = sector;
+    return RES_OK;
+}
+
+DRESULT disk_write_multi_block(const BYTE * buff)
+{
+    memcpy(card[write_at++], buff, SECTOR);
+    return RES_OK;
+}
+
+DRESULT disk_write_multi_stop(void)
+{
+    return RES_OK;
+}
+
+static void st16(uint8_t * p, uint16_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static void st32(uint8_t * p, uint32_t value)
+{
+    st16(p, value);
+    st16(p + 2, value >> 16);
+}
+
+static uint32_t ld32(const uint8_t * p)
+{
+    return p[0] | (p[1] << 8) | ((uint32_t) p[2] << 16) |
+           ((uint32_t) p[3] << 24);
+}
+
+static uint32_t fat_entry(uint32_t cluster)
+{
+    return ld32(card[RESERVED + cluster / 128] + (cluster % 128) * 4) &
+           0x0FFFFFFFUL;
+}
+
+static uint8_t * cluster_data(uint32_t cluster)
+{
+    return card[DATA_START + (cluster - 2) * CLUSTER_SECTORS];
+}
+
+static void format(void)
+{
+    memset(card, 0, sizeof(card));
+    uint8_t * boot = card[0];
+    boot[0] = 0xEB;
+    st16(boot + 11, SECTOR);
+    boot[13] = CLUSTER_SECTORS;
+    st16(boot + 14, RESERVED);
+    boot[16] = 1;
+    st32(boot + 32, SECTORS);
+    st32(boot + 36, FAT_SECTORS);
+    st32(boot + 44, ROOT_CLUSTER);
+    st16(boot + 48, 1);
+    st16(boot + 510, 0xAA55);
+
+    // Free count unknown, mount counts it
+    st32(card[1], 0x41615252);
+    st32(card[1] + 484, 0x61417272);
+    st32(card[1] + 488, 0xFFFFFFFFUL);
+    st32(card[1] + 492, 3);
+
+    st32(card[RESERVED], 0x0FFFFFF8UL);
+    st32(card[RESERVED] + 4, 0x0FFFFFFFUL);
+    st32(card[RESERVED] + ROOT_CLUSTER * 4, 0x0FFFFFFFUL);
+}
+
+static uint8_t pattern(uint32_t at)
+{
+    return (uint8_t) (at * 7 + (at >> 8));
+}
+
+static void append(uint32_t from, uint32_t len, uint32_t piece)
+{
+    uint8_t buff[64];
+    while (len)
+    {
+        uint32_t n = len < piece ? len : piece;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            buff[i] = pattern(from + i);
+        }
+        CHECK(fat_stream_write(buff, n) == FAT_STREAM_OK);
+        from += n;
+        len -= n;
+    }
+}
+
+/*!
+ * @brief   Checks chain and data of the file with the only entry in root
+ */
+static void check_file(uint32_t size)
+{
+    const uint8_t * entry = cluster_data(ROOT_CLUSTER);
+    uint32_t cluster = ((uint32_t) entry[21] << 24 | entry[20] << 16 |
+                        entry[27] << 8 | entry[26]);
+    CHECK(ld32(entry + 28) == size);
+
+    uint32_t clusters = 0;
+    uint32_t at = 0;
+    while (cluster >= 2 && cluster < 0x0FFFFFF8UL && clusters < SECTORS)
+    {
+        const uint8_t * p = cluster_data(cluster);
+        for (uint32_t i = 0; i < CLUSTER_BYTES && at < size; i++, at++)
+        {
+            if (p[i] != pattern(at))
+            {
+                printf("byte %u differs\n", at);
+                failures++;
+                return;
+            }
+        }
+        clusters++;
+        cluster = fat_entry(cluster);
+    }
+    CHECK(clusters == (size + CLUSTER_BYTES - 1) / CLUSTER_BYTES);
+}
+
+static void test_partial_after_full_run(void)
+{
+    format();
+    CHECK(fat_stream_mount() == FAT_STREAM_OK);
+    uint32_t free_clusters = fat_stream_free_clusters();
+
+    // Run of one cluster fills up, last byte is in a partial sector
+    CHECK(fat_stream_open("A.BIN", 0) == FAT_STREAM_OK);
+    append(0, CLUSTER_BYTES + 1, 7);
+    CHECK(fat_stream_sync() == FAT_STREAM_OK);
+    check_file(CLUSTER_BYTES + 1);
+    CHECK(fat_stream_close() == FAT_STREAM_OK);
+    check_file(CLUSTER_BYTES + 1);
+    CHECK(fat_stream_free_clusters() == free_clusters - 2);
+}
+
+static void test_close_after_full_run(void)
+{
+    format();
+    CHECK(fat_stream_mount() == FAT_STREAM_OK);
+
+    // Partial sector seen first by close, with preallocated clusters
+    CHECK(fat_stream_open("B.BIN", 3 * CLUSTER_BYTES) == FAT_STREAM_OK);
+    append(0, 3 * CLUSTER_BYTES + 5, 13);
+    CHECK(fat_stream_close() == FAT_STREAM_OK);
+    check_file(3 * CLUSTER_BYTES + 5);
+}
+
+static void test_reopen_at_cluster_boundary(void)
+{
+    format();
+    CHECK(fat_stream_mount() == FAT_STREAM_OK);
+    uint32_t free_clusters = fat_stream_free_clusters();
+
+    CHECK(fat_stream_open("C.BIN", 0) == FAT_STREAM_OK);
+    append(0, CLUSTER_BYTES, 64);
+    CHECK(fat_stream_close() == FAT_STREAM_OK);
+    check_file(CLUSTER_BYTES);
+
+    CHECK(fat_stream_open("C.BIN", 0) == FAT_STREAM_OK);
+    append(CLUSTER_BYTES, 3, 1);
+    CHECK(fat_stream_sync() == FAT_STREAM_OK);
+    check_file(CLUSTER_BYTES + 3);
+    append(CLUSTER_BYTES + 3, CLUSTER_BYTES, 31);
+    CHECK(fat_stream_close() == FAT_STREAM_OK);
+    check_file(2 * CLUSTER_BYTES + 3);
+    CHECK(fat_stream_free_clusters() == free_clusters - 3);
+}
+
+int main(void)
+{
+    test_partial_after_full_run();
+    test_close_after_full_run();
+    test_reopen_at_cluster_boundary();
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
+/*** end of file ***/
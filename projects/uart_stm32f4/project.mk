@@ -16,5 +16,11 @@ CXXFILES = $(wildcard *.cpp)
 CXXFILES += $(wildcard *.cc)
 AFILES = $(wildcard *.s)
 
+# Header only code shared between projects, board.h is from here
+SHARED_DIR := ../../shared
+
+# Sources from shared folder that are compiled into the project
+SHARED_CFILES := printf.c
+
 # If you add new folders do not forget to update the INCLUDES!
 INCLUDES += $(patsubst %,-I%, . $(SHARED_DIR))
@@ -0,0 +1,212 @@
+#!/usr/bin/env python3
+"""Requantizes FullyConnected weights of a TFLite model to signed 4 bits.
+
+Usage:
+    quantize_int4.py [--min-bytes N] MODEL OUTPUT
+
+MODEL is either a .tflite flatbuffer or a .cc file with the model as C
+array, OUTPUT is written in the same format. Large FullyConnected layers
+are limited by flash bandwidth, every weight is read once per inference.
+Each int8 weight w is requantized as round(w * 7 / m), m the largest
+magnitude of the tensor, and the scale of the tensor grows by m / 7, so
+the model keeps its meaning. FullyConnectedInt4Resolver in fc_int4.h
+multiplies packed weights directly, original FullyConnected kernel can
+not run such a model.
+
+Weights buffer then holds:
+    "I4X8", rows of (depth + 1) / 2 bytes, low nibble first, weights of
+    each whole group of 8 stored as 0 4 1 5 2 6 3 7
+Group order is the one FullyConnectedInt4Resolver unpacks pairs of
+weights in, 0 2, 1 3, 4 6 and 5 7, so input does not have to be
+permuted on every Invoke(). Older "INT4" rows in plain order still run.
+Unlike palettize_weights.py this changes every weight, so printed error,
+in units of the old weight scale, is larger. Check accuracy of the model
+afterwards, tensors with per channel scales are skipped.
+
+Only weights of at least --min-bytes bytes are converted, 4096 by
+default. Freed part of the buffer is removed the same way as in
+palettize_weights.py.
+"""
+
+import struct
+import sys
+
+import gen_model_ops as ops
+import palettize_weights as palette
+
+MAGIC = b"I4X8"
+PLAIN_MAGIC = b"INT4"
+GROUP = 8
+LEVEL = 7                   # Largest magnitude, -8 is not used
+
+TENSOR_QUANTIZATION = 4
+QUANTIZATION_SCALE = 2
+QUANTIZATION_ZERO_POINT = 3
+
+
+def interleave(nibbles):
+    """Returns nibbles of a row with each whole group in stored order."""
+    stored = list(nibbles)
+    whole = len(nibbles) - len(nibbles) % GROUP
+    for i in range(whole):
+        k = i % GROUP
+        stored[i - k + k % 4 * 2 + k // 4] = nibbles[i]
+    return stored
+
+
+def pack(weights, rows, depth):
+    """Returns packed buffer, scale factor, largest and mean squared
+    error."""
+    largest = max(max(abs(w) for w in weights), 1)
+    data = bytearray(MAGIC)
+    worst = 0
+    squares = 0
+    for r in range(rows):
+        row = weights[r * depth:(r + 1) * depth]
+        nibbles = [int(round(w * LEVEL / largest)) for w in row]
+        for w, n in zip(row, nibbles):
+            error = abs(w - n * largest / LEVEL)
+            worst = max(worst, error)
+            squares += error ** 2
+        nibbles = interleave(nibbles)
+        if depth % 2:
+            nibbles.append(0)
+        data += bytes((nibbles[i] & 0x0F) | (nibbles[i + 1] & 0x0F) << 4
+                      for i in range(0, depth, 2))
+    return data, largest / LEVEL, worst, squares / (rows * depth)
+
+
+def scale_pos(buf, tensor):
+    """Returns position of the only scale of the tensor, None if it has
+    none or per channel scales, or a zero point other than 0."""
+    pos = ops.field_pos(buf, tensor, TENSOR_QUANTIZATION)
+    if pos is None:
+        return None
+    quantization = pos + ops.u32(buf, pos)
+    scales = ops.vector_pos(buf, quantization, QUANTIZATION_SCALE)
+    if scales is None or ops.u32(buf, scales) != 1:
+        return None
+    zero_points = ops.vector_pos(buf, quantization, QUANTIZATION_ZERO_POINT)
+    if zero_points is not None and any(
+            struct.unpack_from("<q", buf, zero_points + 4 + 8 * i)[0]
+            for i in range(ops.u32(buf, zero_points))):
+        return None
+    return scales + 4
+
+
+def quantize(buf, min_bytes):
+    """Returns number of converted tensors, buf is a bytearray."""
+    if buf[4:8] != b"TFL3":
+        raise ValueError("not a TFLite flatbuffer")
+
+    model = ops.u32(buf, 0)
+    subgraphs = ops.vector_tables(buf, model, ops.MODEL_SUBGRAPHS)
+    if len(subgraphs) != 1:
+        raise ValueError("only models with one subgraph are supported")
+
+    codes = []
+    for opcode in ops.vector_tables(buf, model, ops.MODEL_OPERATOR_CODES):
+        code = 0
+        pos = ops.field_pos(buf, opcode, ops.OPCODE_DEPRECATED_BUILTIN_CODE)
+        if pos is not None:
+            code = struct.unpack_from("<b", buf, pos)[0]
+        pos = ops.field_pos(buf, opcode, ops.OPCODE_BUILTIN_CODE)
+        if pos is not None:
+            code = max(code, struct.unpack_from("<i", buf, pos)[0])
+        codes.append(code)
+
+    weights = []
+    for operator in ops.vector_tables(buf, subgraphs[0],
+                                      ops.SUBGRAPH_OPERATORS):
+        pos = ops.field_pos(buf, operator, ops.OPERATOR_OPCODE_INDEX)
+        if codes[ops.u32(buf, pos) if pos is not None else 0] == \
+                palette.FULLY_CONNECTED:
+            weights.append(ops.int_vector(buf, operator,
+                                          palette.OPERATOR_INPUTS)[1])
+
+    count = 0
+    for index in sorted(set(weights)):
+        # Positions move after each removal, so everything is found again
+        model = ops.u32(buf, 0)
+        subgraph = ops.vector_tables(buf, model, ops.MODEL_SUBGRAPHS)[0]
+        tensor = ops.vector_tables(buf, subgraph,
+                                   palette.SUBGRAPH_TENSORS)[index]
+        shape = ops.int_vector(buf, tensor, palette.TENSOR_SHAPE)
+        tensor_type = struct.unpack_from(
+            "<b", buf, ops.field_pos(buf, tensor, palette.TENSOR_TYPE))[0]
+        pos = ops.field_pos(buf, tensor, palette.TENSOR_BUFFER)
+        buffer = ops.vector_tables(buf, model, palette.MODEL_BUFFERS)[
+            ops.u32(buf, pos) if pos is not None else 0]
+        data = ops.vector_pos(buf, buffer, palette.BUFFER_DATA)
+        if tensor_type != palette.TYPE_INT8 or len(shape) != 2 or \
+                data is None or ops.u32(buf, data) != shape[0] * shape[1] \
+                or ops.u32(buf, data) < min_bytes:
+            continue
+        if bytes(buf[data + 4:data + 8]) in (MAGIC, PLAIN_MAGIC):
+            raise ValueError("tensor %d is already converted" % index)
+        scale = scale_pos(buf, tensor)
+        if scale is None:
+            print("Tensor %d: needs one scale and zero point 0, skipped"
+                  % index)
+            continue
+
+        rows, depth = shape
+        values = struct.unpack_from("<%db" % (rows * depth), buf, data + 4)
+        packed, factor, worst, mse = pack(values, rows, depth)
+
+        # Scale is a float of the flatbuffer, it moves with the removal
+        old_scale = struct.unpack_from("<f", buf, scale)[0]
+        struct.pack_into("<f", buf, scale, old_scale * factor)
+
+        old_length = ops.u32(buf, data)
+        slots = palette.offset_slots(buf)
+        struct.pack_into("<I", buf, data, len(packed))
+        buf[data + 4:data + 4 + len(packed)] = packed
+
+        # Whole alignment units are removed, the rest stays as padding
+        start = data + 4 + len(packed)
+        start += -start % palette.ALIGNMENT
+        end = start + (data + 4 + old_length - start) // \
+            palette.ALIGNMENT * palette.ALIGNMENT
+        palette.remove(buf, start, end, slots)
+
+        print("Tensor %d %dx%d: %d -> %d bytes, error max %.2f, rms %.2f"
+              % (index, rows, depth, old_length, len(packed), worst,
+                 mse ** 0.5))
+        count += 1
+    return count
+
+
+def main():
+    args = sys.argv[1:]
+    min_bytes = 4096
+    if len(args) == 4 and args[0] == "--min-bytes":
+        min_bytes = int(args[1])
+        args = args[2:]
+    if len(args) != 2:
+        print("Usage:\nquantize_int4.py [--min-bytes N] MODEL OUTPUT")
+        return 1
+
+    model_path, output_path = args
+    if model_path.endswith(".cc") != output_path.endswith(".cc"):
+        print("MODEL and OUTPUT have to be in the same format")
+        return 1
+
+    try:
+        buf = bytearray(ops.read_model(model_path))
+        count = quantize(buf, min_bytes)
+    except (ValueError, struct.error, IndexError) as e:
+        print("%s: %s" % (model_path, e))
+        return 1
+
+    if not count:
+        print("%s: no FullyConnected weights to convert" % model_path)
+        return 1
+
+    ops.write_model(output_path, model_path, buf)
+    print("Converted %d tensor(s), model is %d bytes" % (count, len(buf)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+"""Prints records of a frame_logger.c ring file in order, writes frames.
+
+Usage:
+    ring_extract.py RING [DIR]
+
+RING is the file of logger_open_ring(), RING.BIN copied from the card,
+or an image of the whole card, for example what "dd if=/dev/sdX
+of=card.img" writes. With DIR every frame is also written there as
+<index>.pgm.
+
+Every record starts at a sector with a logger_header_t of
+projects/sd_card_stm32f7_v3/frame_logger.h, and the last 8 bytes of its
+last sector are a logger_tag_t with the same index. Records without a
+matching tag were torn by power loss or partly overwritten and are
+skipped. Records are sorted by index, which counts on over sessions, so
+the oldest comes first wherever it is in the ring, and gaps in index are
+reported, those records were dropped or overwritten.
+"""
+
+import os
+import struct
+import sys
+
+SECTOR = 512
+LOGGER_MAGIC = 0x474F4C46
+LOGGER_RING_MAGIC = 0x474E5246
+LOGGER_MAX_SCORES = 8
+LOGGER_ENCODING_RAW = 0
+LOGGER_ENCODING_DELTA = 1
+HEADER = struct.Struct("<III4B%df" % LOGGER_MAX_SCORES)
+TAG = struct.Struct("<II")
+
+FRAME_CODEC_ESCAPE = 0xE0
+
+
+def frame_predict(a, b, c):
+    # Median edge detector, a is left, b above and c above left
+    if c >= max(a, b):
+        return min(a, b)
+    if c <= min(a, b):
+        return max(a, b)
+    return (a + b - c) & 0xFF
+
+
+def frame_decode(data, cols, rows):
+    """Decodes frame coded with shared/frame_codec.h, as flir_image.py."""
+    residuals = []
+    i = 0
+    while i < len(data):
+        token = data[i]
+        i += 1
+        if token < 0x80:
+            residuals += [0] * (token + 1)
+        elif token < 0xC0:
+            residuals += [((token >> 3) & 0x7) - 4, (token & 0x7) - 4]
+        elif token < FRAME_CODEC_ESCAPE:
+            residuals.append((token & 0x1F) - 16)
+        elif token == FRAME_CODEC_ESCAPE and i < len(data):
+            residuals.append(data[i])
+            i += 1
+        else:
+            raise ValueError("bad frame token")
+    if len(residuals) != cols * rows:
+        raise ValueError("bad frame length")
+
+    p = bytearray(cols * rows)
+    for row in range(rows):
+        for col in range(cols):
+            at = row * cols + col
+            if row == 0:
+                pred = p[at - 1] if col else 0
+            elif col == 0:
+                pred = p[at - cols]
+            else:
+                pred = frame_predict(p[at - 1], p[at - cols],
+                                     p[at - cols - 1])
+            p[at] = (pred + residuals[at]) & 0xFF
+    return bytes(p)
+
+
+def read_record(data, offset):
+    """Returns (sectors, record) of complete record at offset or None."""
+    if offset + HEADER.size + 4 > len(data):
+        return None
+    fields = HEADER.unpack_from(data, offset)
+    magic, index, timestamp, cols, rows, num_scores, encoding = fields[:7]
+    if magic != LOGGER_MAGIC or num_scores > LOGGER_MAX_SCORES:
+        return None
+
+    payload = offset + HEADER.size
+    if cols == 0 and rows == 0:
+        length = 0
+    elif encoding == LOGGER_ENCODING_RAW:
+        length = cols * rows
+    elif encoding == LOGGER_ENCODING_DELTA:
+        length = 4 + struct.unpack_from("<I", data, payload)[0]
+    else:
+        return None
+
+    sectors = (HEADER.size + length + TAG.size + SECTOR - 1) // SECTOR
+    end = offset + sectors * SECTOR
+    if end > len(data):
+        return None
+    if TAG.unpack_from(data, end - TAG.size) != (LOGGER_RING_MAGIC, index):
+        return None
+
+    frame = None
+    if length and encoding == LOGGER_ENCODING_RAW:
+        frame = data[payload:payload + length]
+    elif length:
+        try:
+            frame = frame_decode(data[payload + 4:payload + length],
+                                 cols, rows)
+        except ValueError:
+            frame = None
+    return sectors, {
+        "index": index,
+        "timestamp": timestamp,
+        "cols": cols,
+        "rows": rows,
+        "encoding": encoding,
+        "scores": list(fields[7:7 + num_scores]),
+        "frame": frame,
+        "sector": offset // SECTOR,
+    }
+
+
+def extract(data):
+    """Returns complete records of data sorted by index."""
+    records = []
+    offset = 0
+    while offset + SECTOR <= len(data):
+        found = read_record(data, offset)
+        if found:
+            sectors, record = found
+            records.append(record)
+            offset += sectors * SECTOR
+        else:
+            offset += SECTOR
+    records.sort(key=lambda r: r["index"])
+    return records
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        print("Usage:\nring_extract.py RING [DIR]")
+        return 1
+
+    with open(sys.argv[1], "rb") as f:
+        data = f.read()
+    records = extract(data)
+    out = sys.argv[2] if len(sys.argv) == 3 else None
+    if out:
+        os.makedirs(out, exist_ok=True)
+
+    last = None
+    missing = 0
+    for record in records:
+        if last is not None and record["index"] > last + 1:
+            missing += record["index"] - last - 1
+            print("-- %d records missing" % (record["index"] - last - 1))
+        last = record["index"]
+
+        scores = " ".join("%.3f" % s for s in record["scores"])
+        if record["frame"] is not None:
+            kind = "frame" if record["encoding"] == LOGGER_ENCODING_RAW \
+                else "coded"
+        elif record["cols"]:
+            kind = "bad frame"
+        else:
+            kind = "scores"
+        print("%8d %10d ms  sector %-8d %-9s %s" % (
+            record["index"], record["timestamp"], record["sector"], kind,
+            scores))
+
+        if out and record["frame"] is not None:
+            path = os.path.join(out, "%08d.pgm" % record["index"])
+            with open(path, "wb") as f:
+                f.write(b"P5\n%d %d\n255\n" % (record["cols"],
+                                                record["rows"]))
+                f.write(record["frame"])
+
+    print("%d records, %d missing" % (len(records), missing))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -50,6 +50,53 @@ INCLUDES += \
 -I$(THIRD_PARTY_DIR)/cmsis/CMSIS/NN/Include/  \
 
 
+################################################################################
+# Board matrix																   #
+################################################################################
+# shared/board.h sets up clock, timebase, UART, SPI, I2C and caches of
+# STM32F4, STM32F7 and STM32L4 boards, family follows DEVICE. Projects built
+# on it run on every family, 'make matrix' builds the project for each
+# DEVICE in BOARD_MATRIX into MATRIX_BUILD_DIR/<device>, together with
+# microlite.a for its core, and prints their memory usage. Options are
+# passed on, 'make matrix TARGET_BENCH=1' gives benchmark firmware of each
+# part. One device is built with for example 'make matrix-stm32l476rg'.
+BOARD_MATRIX ?= stm32f405vg stm32f767zi stm32l476rg
+MATRIX_BUILD_DIR ?= matrix_build
+BOARD_FAMILY := $(strip $(foreach f,stm32f4 stm32f7 stm32l4, \
+	$(if $(filter $(f)%,$(DEVICE)),$(f))))
+
+# Set by 'make matrix', library of the device is in its own folder
+ifneq ($(MATRIX_LIB_DIR),)
+LIBDEPS := $(LIBDEPS:microlite_build/%=$(MATRIX_LIB_DIR)/%)
+endif
+
+################################################################################
+# Release build 															   #
+################################################################################
+# 'make RELEASE=1' builds firmware with -O3 and link time optimization into
+# its own folder, against microlite_release.a. Create that one first with
+# 'make -f archive_makefile RELEASE=1 PROJECT=<name>' in root directory,
+# add PGO=use there to use profiles of a host run, see archive_makefile.
+RELEASE ?= 0
+RELEASE_BUILD_DIR ?= release_build
+ifeq ($(RELEASE),1)
+BUILD_DIR := $(RELEASE_BUILD_DIR)
+OPT := -O3
+LIBDEPS := $(LIBDEPS:%microlite.a=%microlite_release.a)
+endif
+
+# OPT_POLICY := 1 in project.mk builds sources listed in HOT_FILES, inner
+# loops like capture and image conversion, with HOT_OPT and every other
+# source with COLD_OPT, so speed goes where it is spent and the rest stays
+# small, also in the instruction cache. OPT still applies to the link.
+# archive_makefile has the same policy for microlite.a, see LIB_HOT_SRC
+# there. Flag of the file comes last on the command line, later -O wins.
+OPT_POLICY ?= 0
+HOT_OPT ?= -O3 -funroll-loops
+COLD_OPT ?= -Os
+file_opt = $(if $(filter 1,$(OPT_POLICY)), \
+	$(if $(filter $(HOT_FILES),$(1)),$(HOT_OPT),$(COLD_OPT)))
+
 ################################################################################
 # Objects and binaries														   #
 ################################################################################
@@ -59,10 +106,74 @@ OBJS += $(CXXFILES:%.cpp=$(BUILD_DIR)/%.o)
 OBJS += $(CCFILES:%.cc=$(BUILD_DIR)/%.o)
 OBJS += $(AFILES:%.S=$(BUILD_DIR)/%.o)
 
+# Sources of SHARED_DIR listed in SHARED_CFILES of project.mk, like
+# printf.c, are built into BUILD_DIR/shared
+OBJS += $(SHARED_CFILES:%.c=$(BUILD_DIR)/shared/%.o)
+
 GENERATED_BINS = firmware.elf firmware.bin firmware.map
 
+# Sections in external memory, like .qspi_rodata of power_test, set with
+# EXTERNAL_SECTIONS in project.mk. firmware.bin would otherwise fill the
+# gap between internal flash and them, so they are left out of it and
+# written to external.bin, which starts at the first of them. Programmer
+# with a loader for that memory takes it or firmware.elf.
+EXTERNAL_SECTIONS ?=
+ifneq ($(EXTERNAL_SECTIONS),)
+GENERATED_BINS += external.bin
+endif
+
+# Benchmark assets, a dataset of make_dataset.py in ASSET_FILE, are not
+# linked but flashed on their own at ASSET_ADDRESS with make assets_flash,
+# firmware finds them there as _bench_assets, see BENCH_ASSETS of
+# power_test. Linker script of the project checks that firmware ends below
+# the address. Assets change without a new build and firmware does not
+# carry them.
+ASSET_ADDRESS ?=
+ASSET_FILE ?=
+ifneq ($(ASSET_ADDRESS),)
+LDFLAGS += -Wl,--defsym=_bench_assets=$(ASSET_ADDRESS)
+endif
+
+# Binary files in BLOBS of project.mk, like .tflite models or .npy images,
+# are linked as they are with .incbin, see gen_blob.py. Each one gives 
+# array with the name that xxd -i gives, on BLOB_ALIGN boundary (cache
+# line by default) in BLOB_SECTION.<name>, and its CRC-32 as <name>_crc32. Both can be set for one file
+# with BLOB_ALIGN_<name> and BLOB_SECTION_<name>. Tests and host benchmark
+# get the same blobs.
+BLOB_ALIGN ?= 32
+BLOB_SECTION ?= .rodata
+blob_name = $(shell echo '$(notdir $(1))' | sed 's/[^A-Za-z0-9_]/_/g')
+OBJS += $(BLOBS:%=$(BUILD_DIR)/blobs/%.o)
+
+# Operators needed by the model, set MODEL_SRC in project.mk to a .tflite
+# or a .cc model file and include model_ops.h, see gen_model_ops.py.
+# With several files header registers operators of all of them.
+ifneq ($(MODEL_SRC),)
+MODEL_OPS_HEADER := $(BUILD_DIR)/generated/model_ops.h
+INCLUDES += -I$(BUILD_DIR)/generated
+endif
+
+# Model compiled to direct CMSIS-NN calls, STATIC_MODEL_SRC is a .tflite
+# or a .cc model file, see gen_static_model.py. Firmware includes
+# static_model.h under STATIC_MODEL, the model itself still has to be in
+# BLOBS, its weights are read from there.
+ifneq ($(STATIC_MODEL_SRC),)
+STATIC_MODEL_CC := $(BUILD_DIR)/generated/static_model.cc
+OBJS += $(STATIC_MODEL_CC:.cc=.o)
+INCLUDES += -I$(BUILD_DIR)/generated
+endif
+
 # Test
 TEST_OBJS = $(TESTFILES:%.cc=$(TEST_BUILD_DIR)/%.o)
+TEST_OBJS += $(BLOBS:%=$(TEST_BUILD_DIR)/blobs/%.o)
+
+# Host benchmark, built like tests from BENCHFILES
+BENCH_OBJS = $(BENCHFILES:%.cc=$(TEST_BUILD_DIR)/%.o)
+BENCH_OBJS += $(BLOBS:%=$(TEST_BUILD_DIR)/blobs/%.o)
+
+# Host evaluation over a dataset, built like tests from EVALFILES
+EVAL_OBJS = $(EVALFILES:%.cc=$(TEST_BUILD_DIR)/%.o)
+EVAL_OBJS += $(BLOBS:%=$(TEST_BUILD_DIR)/blobs/%.o)
  
 
 ################################################################################
@@ -74,6 +185,75 @@ CXX_DEFS :=  \
 -DTF_LITE_STATIC_MEMORY \
 -DGEMMLOWP_ALLOW_SLOW_SCALAR_FALLBACK 
 
+# Build with 'make ARENA_REPORT=1' to print tensor arena usage, see
+# shared/arena_report.h. Do 'make clean' first, objects are not rebuilt
+# just because of changed defines.
+ARENA_REPORT ?= 0
+ifeq ($(ARENA_REPORT),1)
+CXX_DEFS += -DARENA_REPORT
+endif
+
+# Levels of shared/log.h that are compiled in, 0 none to 4 debug, default
+# is 3 info. With LOG_DEFERRED=1 logs are formatted later in log_flush(),
+# LOG_BINARY=1 sends them and TF_LITE_REPORT_ERROR of log_reporter.h as
+# binary messages instead, printed on host by log_decode.py. Project needs
+# .log_fmt section in its linker script, see power_test. All can be set in project.mk or with 'make LOG_LEVEL=4', do 'make clean'
+# first, same as for ARENA_REPORT.
+ifneq ($(LOG_LEVEL),)
+C_DEFS += -DLOG_LEVEL=$(LOG_LEVEL)
+CXX_DEFS += -DLOG_LEVEL=$(LOG_LEVEL)
+endif
+ifeq ($(LOG_DEFERRED),1)
+C_DEFS += -DLOG_DEFERRED
+CXX_DEFS += -DLOG_DEFERRED
+endif
+ifeq ($(LOG_BINARY),1)
+C_DEFS += -DLOG_BINARY
+CXX_DEFS += -DLOG_BINARY
+endif
+
+# Set with STATIC_MODEL_SRC, see above, 'make clean' first as well
+ifneq ($(STATIC_MODEL_SRC),)
+CXX_DEFS += -DSTATIC_MODEL
+endif
+
+# Parts of shared/printf.c, PRINTF_FLOAT=0 drops %f, PRINTF_LONG_LONG=0
+# drops %ll and PRINTF_EXPONENTIAL=1 adds %e and %g, which no project
+# uses. Do 'make clean' first, same as for ARENA_REPORT.
+PRINTF_FLOAT ?= 1
+PRINTF_LONG_LONG ?= 1
+PRINTF_EXPONENTIAL ?= 0
+ifeq ($(PRINTF_FLOAT),0)
+C_DEFS += -DPRINTF_DISABLE_SUPPORT_FLOAT
+endif
+ifeq ($(PRINTF_LONG_LONG),0)
+C_DEFS += -DPRINTF_DISABLE_SUPPORT_LONG_LONG
+endif
+ifeq ($(PRINTF_EXPONENTIAL),0)
+C_DEFS += -DPRINTF_DISABLE_SUPPORT_EXPONENTIAL
+endif
+
+# Set by 'make bench', main() then runs shared/target_bench.h instead of
+# the application
+TARGET_BENCH ?= 0
+ifeq ($(TARGET_BENCH),1)
+C_DEFS += -DTARGET_BENCH
+CXX_DEFS += -DTARGET_BENCH
+endif
+# Set by 'make kbench', main() then runs shared/kernel_bench.h, single
+# CMSIS-NN kernels on shapes of our models
+KERNEL_BENCH ?= 0
+ifeq ($(KERNEL_BENCH),1)
+C_DEFS += -DKERNEL_BENCH
+CXX_DEFS += -DKERNEL_BENCH
+endif
+# 'make bench BENCH_SWEEP=1' measures all 16 combinations of I-cache,
+# D-cache, ART and prefetch instead of caches off and on, do 'make clean'
+# first when switching
+ifeq ($(BENCH_SWEEP),1)
+CXX_DEFS += -DTARGET_BENCH_SWEEP=1
+endif
+
 
 ################################################################################
 # Compiler Flags															   #
@@ -91,21 +271,53 @@ FLAGS :=\
 -fno-unwind-tables \
 -fomit-frame-pointer \
 -fno-common \
+-MMD -MP \
 $(ARCH_FLAGS) \
 $(OPT) \
 $(DEBUG) \
 $(CPPFLAGS)  			# These come from libopencm3
 FLAGS += -DCMSIS_NN 	# Needed due to ifdef statement in tensorflow code
+ifeq ($(RELEASE),1)
+FLAGS += -flto
+endif
+ifeq ($(STACK_USAGE),1)
+FLAGS += -fstack-usage -fcallgraph-info=su
+endif
 
+# C++ standard of firmware and tests, the same is used by archive_makefile.
+# TensorFlow sources build with 11 or 17, code of projects and shared 
+# headers may use C++17. Set CXX_STD := 11 in project.mk only for a 
+# compiler older than GCC 7. CMSIS headers still use register keyword, 
+# which C++17 warns about.
+CXX_STD ?= 17
+CXX_STD_FLAGS := $(if $(filter 17,$(CXX_STD)),-Wno-register)
 
 C_FLAGS := $(FLAGS) $(C_DEFS) -std=c11 
-CXX_FLAGS := $(FLAGS) $(CXX_DEFS) -std=c++11 -std=gnu++11 \
+CXX_FLAGS := $(FLAGS) $(CXX_DEFS) -std=gnu++$(CXX_STD) $(CXX_STD_FLAGS) \
 	-fno-rtti -fpermissive -fno-threadsafe-statics -fno-use-cxa-atexit
 AS_FLAGS := $(FLAGS)
 
 # Test flags
-TESTLITE_CXXFLAGS 	= -std=c++11 -DTF_LITE_STATIC_MEMORY -Wno-narrowing
+TESTLITE_CXXFLAGS 	= -std=c++$(CXX_STD) $(CXX_STD_FLAGS) -DTF_LITE_STATIC_MEMORY 
+TESTLITE_CXXFLAGS  += -Wno-narrowing
 TESTLITE_CXXFLAGS  += -O3 -DTF_LITE_DISABLE_X86_NEON 
+# 'make host_bench PGO=gen' or 'make test PGO=gen' with testlite.a from
+# 'make -f archive_makefile test PGO=gen' writes profiles for release build,
+# do 'make clean_test' first
+ifeq ($(PGO),gen)
+TESTLITE_CXXFLAGS  += -fprofile-generate
+endif
+# Profiles of testlite.a objects go into PGO_DIR of this project, not next
+# to the objects in the shared cache, where runs of every project with the
+# same flags would add up. GCOV_PREFIX_STRIP drops the path of the cache
+# folder, which the stamp of testlite.a holds.
+PGO_DIR = $(TEST_BUILD_DIR)/pgo
+ifeq ($(PGO),gen)
+PGO_OBJ_DIR = $(abspath ../../$(shell cat testlite_build/testlite.a.* \
+	2>/dev/null))
+PGO_RUN = GCOV_PREFIX=$(CURDIR)/$(PGO_DIR) \
+	GCOV_PREFIX_STRIP=$(words $(subst /, ,$(PGO_OBJ_DIR)))
+endif
 
 ################################################################################
 # Linker Flags and Lib			    										   #
@@ -118,8 +330,9 @@ $(ARCH_FLAGS) \
 -specs=nosys.specs \
 -L$(OPENCM3_DIR)/lib \
 -T$(LDSCRIPT) \
+$(patsubst %,-T%,$(LDFRAGMENTS)) \
 $(LIBS) \
--Wl,-Map=$(BUILD_DIR)/$(TARGET).map,--cref \
+-Wl,-Map=$(BUILD_DIR)/firmware.map,--cref \
 -Wl,--gc-sections \
 -Wl,--no-wchar-size-warning \
 -funsigned-char \
@@ -134,6 +347,11 @@ ifeq ($(V),99)
 LDFLAGS += -Wl,--print-gc-sections
 endif
 
+# Code is generated at link time, with the same OPT
+ifeq ($(RELEASE),1)
+LDFLAGS += -flto
+endif
+
 # error if not using linker script generator
 ifeq (,$(DEVICE))
 $(LDSCRIPT):
@@ -170,85 +388,308 @@ endif
 # Rules																		   #
 ################################################################################
 
-# DO NOT CALL get_size.sh for now
-# All command will also call get_size script, right now we are hardcoding 
-# flash and ram values, however this should be auto generated
-	#@printf "  SIZE\t$<\n"
-	#$(Q)bash ../../get_size.sh $(BUILD_DIR)/firmware.elf 0x200000 0x60000
-	#$(Q)$(SIZE) $(BUILD_DIR)/firmware.elf
-all: $(BUILD_DIR)/firmware.elf $(BUILD_DIR)/firmware.bin
+# Every build ends with memory report, see Size report below
+all: $(BUILD_DIR)/firmware.elf $(BUILD_DIR)/firmware.bin \
+	$(BUILD_DIR)/size_report.txt \
+	$(if $(EXTERNAL_SECTIONS),$(BUILD_DIR)/external.bin)
 
 $(BUILD_DIR)/%.o: %.c
 	@printf "  CC\t$<\n"
 	@mkdir -p $(dir $@)
-	$(Q)$(CC) $(C_FLAGS) $(INCLUDES) -o $@ -c $<
+	$(Q)$(CC) $(C_FLAGS) $(call file_opt,$<) $(INCLUDES) -o $@ -c $<
+
+$(BUILD_DIR)/shared/%.o: $(SHARED_DIR)/%.c
+	@printf "  CC\t$<\n"
+	@mkdir -p $(dir $@)
+	$(Q)$(CC) $(C_FLAGS) $(call file_opt,$<) $(INCLUDES) -o $@ -c $<
 
 $(BUILD_DIR)/%.o: %.cxx
 	@printf "  CXX\t$<\n"
 	@mkdir -p $(dir $@)
-	$(Q)$(CC) $(CXX_FLAGS) $(INCLUDES) -o $@ -c $<
+	$(Q)$(CC) $(CXX_FLAGS) $(call file_opt,$<) $(INCLUDES) -o $@ -c $<
 
 $(BUILD_DIR)/%.o: %.cpp
 	@printf "  CXX\t$<\n"
 	@mkdir -p $(dir $@)
-	$(Q)$(CXX) $(CXX_FLAGS) $(INCLUDES) -o $@ -c $<
+	$(Q)$(CXX) $(CXX_FLAGS) $(call file_opt,$<) $(INCLUDES) -o $@ -c $<
 
 $(BUILD_DIR)/%.o: %.cc
 	@printf "  CXX\t$<\n"
 	@mkdir -p $(dir $@)
-	$(Q)$(CXX) $(CXX_FLAGS) $(INCLUDES) -o $@ -c $<
+	$(Q)$(CXX) $(CXX_FLAGS) $(call file_opt,$<) $(INCLUDES) -o $@ -c $<
 
 $(BUILD_DIR)/%.o: %.S
 	@printf "  AS\t$<\n"
 	@mkdir -p $(dir $@)
 	$(Q)$(AS) $(AS_FLAGS) $(INCLUDES) -o $@ -c $<
 
-$(BUILD_DIR)/firmware.elf: $(OBJS) $(LDSCRIPT) $(LIBDEPS)
+# Blob for target or host, $(1) are flags of assembler
+define blob_recipe
+	@printf "  BLOB\t$<\n"
+	@mkdir -p $(dir $@)
+	$(Q)python3 ../../gen_blob.py $< $(@:.o=.S) \
+		--align=$(or $(BLOB_ALIGN_$(call blob_name,$<)),$(BLOB_ALIGN)) \
+		--section=$(or $(BLOB_SECTION_$(call blob_name,$<)),$(BLOB_SECTION))
+	$(Q)$(AS) $(1) -o $@ -c $(@:.o=.S)
+endef
+
+$(BUILD_DIR)/blobs/%.o: % ../../gen_blob.py
+	$(call blob_recipe,$(ARCH_FLAGS))
+
+$(TEST_BUILD_DIR)/blobs/%.o: % ../../gen_blob.py
+	$(call blob_recipe,)
+
+ifneq ($(MODEL_SRC),)
+$(MODEL_OPS_HEADER): $(MODEL_SRC) ../../gen_model_ops.py
+	@printf "  GEN\t$@\n"
+	@mkdir -p $(dir $@)
+	$(Q)python3 ../../gen_model_ops.py $(MODEL_SRC) $@
+
+# Every object is rebuilt when model changes, we do not track which ones
+# include the header
+$(OBJS): $(MODEL_OPS_HEADER)
+$(BENCH_OBJS): $(MODEL_OPS_HEADER)
+$(EVAL_OBJS): $(MODEL_OPS_HEADER)
+endif
+
+ifneq ($(STATIC_MODEL_SRC),)
+$(STATIC_MODEL_CC): $(STATIC_MODEL_SRC) ../../gen_static_model.py \
+		../../gen_memory_plan.py
+	@printf "  GEN\t$@\n"
+	@mkdir -p $(dir $@)
+	$(Q)python3 ../../gen_static_model.py $(STATIC_MODEL_SRC) $@
+
+$(STATIC_MODEL_CC:.cc=.o): $(STATIC_MODEL_CC)
+	@printf "  CXX\t$<\n"
+	$(Q)$(CXX) $(CXX_FLAGS) $(call file_opt,$<) $(INCLUDES) -o $@ -c $<
+
+$(OBJS): $(STATIC_MODEL_CC)
+endif
+
+# Functions from LIBDEPS that are listed in ITCM_FUNCTIONS of project.mk run
+# from ITCM RAM. Libraries are compiled with -ffunction-sections, so each
+# function has its own .text.<name> section, C++ names are mangled. Copy of
+# the library with those sections renamed to .itcm_text.<name> is linked,
+# linker fragment of the project then places .itcm_text* into ITCM and
+# startup code copies it there from flash, look at power_test.
+ifneq ($(ITCM_FUNCTIONS),)
+LINK_LIBS = $(LIBDEPS:%.a=$(BUILD_DIR)/%_itcm.a)
+else
+LINK_LIBS = $(LIBDEPS)
+endif
+
+$(BUILD_DIR)/%_itcm.a: %.a project.mk
+	@printf "  OBJCOPY\t$@\n"
+	@mkdir -p $(dir $@)
+	$(Q)$(OBJCOPY) $(foreach f,$(ITCM_FUNCTIONS), \
+		--rename-section .text.$(f)=.itcm_text.$(f)) $< $@
+
+$(BUILD_DIR)/firmware.elf: $(OBJS) $(LDSCRIPT) $(LDFRAGMENTS) $(LINK_LIBS)
 	@printf "  LD\t$@\n"
-	$(Q)$(LD) $(OBJS) $(LDFLAGS) $(INCLUDES) $(LIBDEPS) -o $@
+	$(Q)$(LD) $(OBJS) $(LDFLAGS) $(INCLUDES) $(LINK_LIBS) -o $@
 
 $(BUILD_DIR)/firmware.bin: $(BUILD_DIR)/firmware.elf
 	@printf "  OBJCOPY\t$@\n"
-	$(Q)$(OBJCOPY) -O binary -S $< $@
+	$(Q)$(OBJCOPY) -O binary -S $(EXTERNAL_SECTIONS:%=-R %) $< $@
+
+$(BUILD_DIR)/external.bin: $(BUILD_DIR)/firmware.elf
+	@printf "  OBJCOPY\t$@\n"
+	$(Q)$(OBJCOPY) -O binary -S $(EXTERNAL_SECTIONS:%=-j %) $< $@
+
+# Size report, used and free bytes of each memory region with the largest
+# sections and objects, read from firmware.map by size_report.py. Regions
+# come from the linker script, ram of stm32f76x/77x is split into DTCM,
+# SRAM1 and SRAM2. Set SIZE_BUDGET in project.mk to fail the build when a
+# region grows over it, for example SIZE_BUDGET := rom=1M DTCM=120K.
+# Report is kept in the build folder, failed one is removed, so the next
+# make checks again.
+ifneq ($(filter stm32f76% stm32f77%,$(DEVICE)),)
+SIZE_SPLIT ?= --split=ram=DTCM:128K,SRAM1:368K,SRAM2:16K
+endif
+
+$(BUILD_DIR)/size_report.txt: $(BUILD_DIR)/firmware.elf ../../size_report.py
+	@printf "  SIZE\t$<\n"
+	$(Q)python3 ../../size_report.py $(BUILD_DIR)/firmware.map $(SIZE_SPLIT) \
+		$(SIZE_BUDGET) > $@ || (cat $@; rm -f $@; false)
+	$(Q)cat $@
 
 # Test rules, clear prefix first, so we can use native gcc
 test: PREFIX = 
 test: $(TEST_BUILD_DIR)/test_firmware
 	@printf "  SIZE\t$<\n"
 	$(Q)$(SIZE) $(TEST_BUILD_DIR)/test_firmware
-	@./$(TEST_BUILD_DIR)/test_firmware
+	@$(PGO_RUN) ./$(TEST_BUILD_DIR)/test_firmware
 
 $(TEST_BUILD_DIR)/test_firmware: $(TEST_OBJS)
 	@printf "  LD\t$@\n"
 	$(Q)$(LD) $(TESTLITE_CXXFLAGS) $(TEST_OBJS) $(TEST_LDLIBS) -lm -o $@
 
+# Kernel tests of shared/test, each *_test.cc is its own program that
+# compares a kernel of shared/ with the reference one of testlite.a, see
+# shared/test/kernel_test.h. Only projects with SHARED_DIR and testlite.a
+# can build them, for example elephant_stm32f7.
+KERNEL_TEST_DIR = $(TEST_BUILD_DIR)/kernel_test
+KERNEL_TESTS = $(patsubst $(SHARED_DIR)/test/%.cc,$(KERNEL_TEST_DIR)/%, \
+	$(wildcard $(SHARED_DIR)/test/*_test.cc))
+
+kernel_test: PREFIX = 
+kernel_test: $(KERNEL_TESTS)
+	$(Q)$(foreach t,$^,printf "  TEST\t$(t)\n" && ./$(t) &&) true
+
+$(KERNEL_TEST_DIR)/%: $(SHARED_DIR)/test/%.cc $(TEST_LDLIBS)
+	@printf "  CXX\t$<\n"
+	@mkdir -p $(dir $@)
+	$(Q)$(CXX) $(TESTLITE_CXXFLAGS) $(INCLUDES) -MMD -MP $< $(TEST_LDLIBS) \
+		-lm -o $@
+
+# Host benchmark, prints JSON with latency and per operator times, see
+# shared/host_bench.h. Arguments are passed with BENCH_ARGS, for example
+# make host_bench BENCH_ARGS="-n 500 -w 20"
+host_bench: PREFIX = 
+host_bench: $(TEST_BUILD_DIR)/host_bench
+	@$(PGO_RUN) ./$(TEST_BUILD_DIR)/host_bench $(BENCH_ARGS)
+
+$(TEST_BUILD_DIR)/host_bench: $(BENCH_OBJS)
+	@printf "  LD\t$@\n"
+	$(Q)$(LD) $(TESTLITE_CXXFLAGS) $(BENCH_OBJS) $(TEST_LDLIBS) -lm -o $@
+
+# Host evaluation, one interpreter per core over a memory mapped .npy
+# dataset, prints JSON with accuracy and throughput, see shared/host_eval.h.
+# Arguments are passed with EVAL_ARGS, for example
+# make host_eval EVAL_ARGS="-d images.npy -l labels.npy -j 8"
+host_eval: PREFIX = 
+host_eval: $(TEST_BUILD_DIR)/host_eval
+	@./$(TEST_BUILD_DIR)/host_eval $(EVAL_ARGS)
+
+$(TEST_BUILD_DIR)/host_eval: $(EVAL_OBJS)
+	@printf "  LD\t$@\n"
+	$(Q)$(LD) $(TESTLITE_CXXFLAGS) -pthread $(EVAL_OBJS) $(TEST_LDLIBS) -lm -o $@
+
+# On target benchmark, firmware is built with TARGET_BENCH into its own
+# folder, so objects of the application are not mixed with it. It prints
+# JSON with cycles per inference and per operator over UART, with caches
+# off and on or with BENCH_SWEEP=1 for every cache and flash combination,
+# see shared/target_bench.h. Flash it with make bench_flash.
+BENCH_BUILD_DIR ?= bench_build
+BENCH_OPENOCD_CFG ?= -f interface/stlink-v2-1.cfg \
+	-f target/$(or $(BOARD_FAMILY),stm32f7)x.cfg
+
+bench:
+	$(Q)$(MAKE) --no-print-directory BUILD_DIR=$(BENCH_BUILD_DIR) \
+		TARGET_BENCH=1 all
+
+# Kernel benchmark, firmware is built with KERNEL_BENCH into its own
+# folder the same way. It prints JSON with cycles of each CMSIS-NN kernel
+# case per memory and with caches off and on, see shared/kernel_bench.h.
+# Flash it with make kbench_flash.
+KBENCH_BUILD_DIR ?= kbench_build
+
+kbench:
+	$(Q)$(MAKE) --no-print-directory BUILD_DIR=$(KBENCH_BUILD_DIR) \
+		KERNEL_BENCH=1 all
+
+# Performance gate, host benchmark and firmware.elf section sizes are
+# compared with perf_baseline.json of the project by perf_check.py, make
+# fails if latency grows over PERF_THRESHOLD percent or arena or a section
+# over PERF_SIZE_THRESHOLD percent. On target numbers are added with
+# PERF_TARGET_LOG, UART log of bench firmware, for example
+# make perf_check PERF_TARGET_LOG=bench.log
+# Accepted changes are written into baseline with PERF_UPDATE=1, commit it
+# with them. Projects without BENCHFILES only compare sizes.
+PERF_BASELINE ?= perf_baseline.json
+PERF_THRESHOLD ?= 5
+PERF_SIZE_THRESHOLD ?= 0
+PERF_BENCH_ARGS ?= -n 200 -w 20
+
+perf_check:
+ifneq ($(BENCHFILES),)
+	$(Q)$(MAKE) --no-print-directory PREFIX= $(TEST_BUILD_DIR)/host_bench
+	@printf "  BENCH\t$(TEST_BUILD_DIR)/host_bench\n"
+	$(Q)./$(TEST_BUILD_DIR)/host_bench $(PERF_BENCH_ARGS) \
+		> $(TEST_BUILD_DIR)/perf_host.json
+endif
+	$(Q)$(MAKE) --no-print-directory all
+	$(Q)$(SIZE) -A $(BUILD_DIR)/firmware.elf > $(BUILD_DIR)/perf_size.txt
+	@printf "  PERF\t$(PERF_BASELINE)\n"
+	$(Q)python3 ../../perf_check.py $(PERF_BASELINE) \
+		$(if $(BENCHFILES),--host=$(TEST_BUILD_DIR)/perf_host.json) \
+		--size=$(BUILD_DIR)/perf_size.txt \
+		$(if $(PERF_TARGET_LOG),--target=$(PERF_TARGET_LOG)) \
+		--threshold=$(PERF_THRESHOLD) \
+		--size-threshold=$(PERF_SIZE_THRESHOLD) \
+		$(if $(PERF_UPDATE),--update)
+
+# Stack analysis, firmware is built into its own folder with -fstack-usage
+# and -fcallgraph-info (GCC 10 or newer), stack_report.py then prints
+# worst case depth of main() and interrupt handlers against free ram
+# between end of bss and top of stack, which is what arenas can still get.
+# Library functions have stack data only if the archive was built with
+# 'make -f archive_makefile STACK_USAGE=1', otherwise they are listed and
+# count as 0. Call graphs of the library are found through its stamp file.
+STACK_BUILD_DIR ?= stack_build
+
+stack:
+	$(Q)$(MAKE) --no-print-directory BUILD_DIR=$(STACK_BUILD_DIR) \
+		STACK_USAGE=1 all
+	@printf "  STACK\t$(STACK_BUILD_DIR)/firmware.elf\n"
+	$(Q)python3 ../../stack_report.py $(STACK_BUILD_DIR)/firmware.map \
+		$(STACK_BUILD_DIR) $(addprefix ../../, \
+		$(shell cat $(addsuffix .*, $(LIBDEPS)) 2>/dev/null))
+
+matrix: $(BOARD_MATRIX:%=matrix-%)
+	$(Q)$(foreach d,$(BOARD_MATRIX),printf "\n$(d)\n"; \
+		sed '/^$$/q' $(MATRIX_BUILD_DIR)/$(d)/size_report.txt;)
+
+matrix-%:
+ifneq ($(LIBDEPS),)
+	$(Q)$(MAKE) --no-print-directory -C ../.. -f archive_makefile \
+		PROJECT=$(PROJECT) DEVICE=$* \
+		MICROLITE_BUILD=projects/$(PROJECT)/$(MATRIX_BUILD_DIR)/$*
+endif
+	$(Q)$(MAKE) --no-print-directory DEVICE=$* \
+		BUILD_DIR=$(MATRIX_BUILD_DIR)/$* MATRIX_LIB_DIR=$(MATRIX_BUILD_DIR)/$* all
+
+bench_flash: bench
+	@printf "  OPENOCD\t$(BENCH_BUILD_DIR)/firmware.elf\n"
+	$(Q)$(OPENOCD) $(BENCH_OPENOCD_CFG) \
+		-c "program $(BENCH_BUILD_DIR)/firmware.elf verify reset exit"
+
+assets_flash: $(ASSET_FILE)
+	@printf "  OPENOCD\t$<\n"
+	$(Q)$(OPENOCD) $(BENCH_OPENOCD_CFG) \
+		-c "program $< $(ASSET_ADDRESS) verify reset exit"
+
+kbench_flash: kbench
+	@printf "  OPENOCD\t$(KBENCH_BUILD_DIR)/firmware.elf\n"
+	$(Q)$(OPENOCD) $(BENCH_OPENOCD_CFG) \
+		-c "program $(KBENCH_BUILD_DIR)/firmware.elf verify reset exit"
+
 $(TEST_BUILD_DIR)/%.o: %.cc
 	@printf "  CXX\t$<\n"
 	@mkdir -p $(dir $@)
-	$(Q)$(CXX) $(TESTLITE_CXXFLAGS) $(INCLUDES) -o $@ -c $<
+	$(Q)$(CXX) $(TESTLITE_CXXFLAGS) $(INCLUDES) -MMD -MP -o $@ -c $<
 
 
 # It is expected that a openocd.cfg file is in project folder
-flash: $(BUILD_DIR)/firmware.bin
-	@printf "  SIZE\t$<\n"
-	$(Q)bash ../../get_size.sh $(BUILD_DIR)/firmware.elf 0x200000 0x60000
-	#$(Q)$(SIZE) $(BUILD_DIR)/firmware.elf
+flash: $(BUILD_DIR)/firmware.bin $(BUILD_DIR)/size_report.txt
 	@printf "  OPENOCD\t$<\n"
 	$(Q)$(OPENOCD)
 
-monitor: $(BUILD_DIR)/firmware.bin
-	@printf "  SIZE\t$<\n"
-	$(Q)$(SIZE) $(BUILD_DIR)/firmware.elf
+monitor: $(BUILD_DIR)/firmware.bin $(BUILD_DIR)/size_report.txt
 	@printf "  OPENOCD\t$<\n"
 	$(Q)$(OPENOCD)
 	@printf "  MINICOM\t$<\n"
 	$(Q)$(MINICOM)
 
 clean:
-	rm -rf $(BUILD_DIR) generated.*
+	rm -rf $(BUILD_DIR) $(BENCH_BUILD_DIR) $(KBENCH_BUILD_DIR) \
+		$(RELEASE_BUILD_DIR) $(STACK_BUILD_DIR) $(MATRIX_BUILD_DIR) \
+		generated.*
 
 clean_all:
-	rm -rf $(BUILD_DIR) generated.* microlite_build
+	rm -rf $(BUILD_DIR) $(BENCH_BUILD_DIR) $(KBENCH_BUILD_DIR) \
+		$(RELEASE_BUILD_DIR) $(STACK_BUILD_DIR) $(MATRIX_BUILD_DIR) \
+		generated.* microlite_build
 
 clean_test:
 	rm -rf $(TEST_BUILD_DIR)
@@ -256,6 +697,8 @@ clean_test:
 clean_test_all:
 	rm -rf $(TEST_BUILD_DIR) testlite_build
 
-.PHONY: all clean flash monitor
--include $(OBJS:.o=.d)
+.PHONY: all clean flash monitor host_bench host_eval bench bench_flash kbench \
+	kbench_flash assets_flash stack matrix perf_check kernel_test
+-include $(OBJS:.o=.d) $(TEST_OBJS:.o=.d) $(BENCH_OBJS:.o=.d) \
+	$(EVAL_OBJS:.o=.d) $(KERNEL_TESTS:=.d)
 
@@ -0,0 +1,126 @@
+#ifndef ARENA_REPORT_H
+#define ARENA_REPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tensorflow/lite/core/api/error_reporter.h"
+#include "tensorflow/lite/micro/memory_helpers.h"
+#include "tensorflow/lite/micro/micro_allocator.h"
+#include "tensorflow/lite/schema/schema_generated.h"
+
+#ifdef ARENA_REPORT
+#include "tensorflow/lite/micro/recording_micro_allocator.h"
+#endif
+
+// Measures how much of the tensor arena model really needs.
+//
+// Build with "make clean && make ARENA_REPORT=1", then the allocator is
+// replaced with RecordingMicroAllocator and arena_report() prints persistent
+// (tail) and non-persistent (head) usage, recorded allocations and size of
+// each tensor. Last block of the report is a ready arena_size.h, save the
+// serial log and extract it with ../../get_arena_size.sh, for example:
+// bash ../../get_arena_size.sh minicom.log arena_size.h
+//
+// Without ARENA_REPORT the normal MicroAllocator is used and arena_report()
+// does nothing, so projects can keep both calls in place.
+//
+// Usage example:
+// tflite::MicroAllocator* allocator = arena_allocator(arena, size, reporter);
+// static tflite::MicroInterpreter interpreter(model, resolver, allocator,
+//                                             reporter);
+// interpreter.AllocateTensors();
+// arena_report(reporter, model, allocator);
+
+// Added to measured size, covers alignment of the arena start
+#define ARENA_REPORT_MARGIN     16
+
+#define ARENA_REPORT_BEGIN      "----- arena_size.h begin -----"
+#define ARENA_REPORT_END        "----- arena_size.h end -----"
+
+/*!
+ * @brief                   Creates allocator for MicroInterpreter
+ *
+ * @param[in] arena         Tensor arena
+ * @param[in] arena_size    Size of arena in bytes
+ * @param[in] reporter      Error reporter
+ *
+ * @return                  RecordingMicroAllocator if ARENA_REPORT is
+ *                          defined, otherwise plain MicroAllocator
+ */
+static inline tflite::MicroAllocator* arena_allocator(
+    uint8_t* arena, size_t arena_size, tflite::ErrorReporter* reporter) {
+#ifdef ARENA_REPORT
+  return tflite::RecordingMicroAllocator::Create(arena, arena_size, reporter);
+#else
+  return tflite::MicroAllocator::Create(arena, arena_size, reporter);
+#endif
+}
+
+/*!
+ * @brief                   Prints arena usage and generated arena_size.h
+ *
+ * @param[in] reporter      Error reporter
+ * @param[in] model         Model that interpreter was created with
+ * @param[in] allocator     Allocator returned by arena_allocator()
+ *
+ * @note                    Call it after AllocateTensors(), before that
+ *                          non-persistent memory is not planned yet.
+ */
+static inline void arena_report(tflite::ErrorReporter* reporter,
+                                const tflite::Model* model,
+                                tflite::MicroAllocator* allocator) {
+#ifdef ARENA_REPORT
+  const tflite::RecordingMicroAllocator* recording =
+      static_cast<const tflite::RecordingMicroAllocator*>(allocator);
+  const tflite::SimpleMemoryAllocator* memory =
+      recording->GetSimpleMemoryAllocator();
+
+  unsigned used = memory->GetUsedBytes();
+  unsigned head = memory->GetHeadUsedBytes();
+  unsigned tail = memory->GetTailUsedBytes();
+
+  TF_LITE_REPORT_ERROR(reporter, "Arena used: %u bytes", used);
+  TF_LITE_REPORT_ERROR(reporter, "Non-persistent (head): %u bytes", head);
+  TF_LITE_REPORT_ERROR(reporter, "Persistent (tail): %u bytes", tail);
+  recording->PrintAllocations();
+
+  // Weights stay in flash, only tensors without buffer data are planned
+  // in the arena, but shared buffers mean their sum is not the head size.
+  const tflite::SubGraph* subgraph = model->subgraphs()->Get(0);
+  TF_LITE_REPORT_ERROR(reporter, "Tensor\tBytes\tWhere\tName");
+  for (uint32_t i = 0; i < subgraph->tensors()->size(); i++) {
+    const tflite::Tensor* tensor = subgraph->tensors()->Get(i);
+    const tflite::Buffer* buffer = model->buffers()->Get(tensor->buffer());
+    bool constant = buffer->data() != nullptr && buffer->data()->size() > 0;
+
+    size_t bytes = 0;
+    size_t type_size = 0;
+    if (tflite::BytesRequiredForTensor(*tensor, &bytes, &type_size,
+                                       reporter) != kTfLiteOk) {
+      bytes = 0;
+    }
+
+    TF_LITE_REPORT_ERROR(reporter, "%d\t%u\t%s\t%s", i,
+                         static_cast<unsigned>(bytes),
+                         constant ? "flash" : "arena",
+                         tensor->name() ? tensor->name()->c_str() : "-");
+  }
+
+  unsigned size = (used + ARENA_REPORT_MARGIN + 15) & ~15u;
+  TF_LITE_REPORT_ERROR(reporter, ARENA_REPORT_BEGIN);
+  TF_LITE_REPORT_ERROR(reporter, "#ifndef ARENA_SIZE_H");
+  TF_LITE_REPORT_ERROR(reporter, "#define ARENA_SIZE_H");
+  TF_LITE_REPORT_ERROR(reporter, "// Generated with ARENA_REPORT=1 build");
+  TF_LITE_REPORT_ERROR(reporter, "// head %u, tail %u bytes", head, tail);
+  TF_LITE_REPORT_ERROR(reporter, "#define ARENA_SIZE_BYTES %u", size);
+  TF_LITE_REPORT_ERROR(reporter, "#endif /* ARENA_SIZE_H */");
+  TF_LITE_REPORT_ERROR(reporter, ARENA_REPORT_END);
+#else
+  (void)reporter;
+  (void)model;
+  (void)allocator;
+#endif
+}
+
+#endif  // ARENA_REPORT_H
@@ -0,0 +1,258 @@
+#ifndef AUDIO_FEATURES_H
+#define AUDIO_FEATURES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "arm_math.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Log-mel spectrogram of a keyword model, computed incrementally. Each hop
+// of new samples completes one window, only that window is transformed and
+// its mel energies are written over the oldest row of a ring, rows before
+// it stay as they are. audio_features_copy() then writes the ring into the
+// model input in time order, oldest row first.
+//
+// Window goes through Hann window and arm_rfft_q15(), which is part of
+// microlite.a already. Windowed samples are shifted up to use the whole
+// Q15 range first, shift is removed again in the log domain, so quiet
+// input keeps its resolution. Triangular mel filters are stored as one
+// weight per FFT bin, each bin is in the rising edge of one band and in
+// the falling edge of the one below it. Energies are taken to natural log
+// and quantized with scale and zero point of the model input.
+//
+// Layout is the one of the TFLM micro_speech example, 30 ms windows every
+// 20 ms, 40 bands between 125 and 7500 Hz and 49 rows for one second, but
+// features are plain log-mel without noise reduction, so the model has to
+// be trained on these. One hop is around 25k cycles, well under 1 % of
+// the core at 216 MHz.
+#define AUDIO_SAMPLE_RATE   16000   // Hz
+#define AUDIO_WINDOW        480     // Samples, 30 ms
+#define AUDIO_HOP           320     // Samples, 20 ms
+#define AUDIO_FFT_LEN       512
+#define AUDIO_FFT_BINS      (AUDIO_FFT_LEN / 2 + 1)
+#define AUDIO_FFT_UPSCALE   9       // Bits arm_rfft_q15() of 512 drops
+#define AUDIO_MEL_BANDS     40
+#define AUDIO_MEL_LOW_HZ    125.0f
+#define AUDIO_MEL_HIGH_HZ   7500.0f
+#define AUDIO_FRAMES        49      // Rows of the model input
+
+#define AUDIO_BAND_NONE     0xFF    // Bin is outside of all bands
+
+#if AUDIO_HOP > AUDIO_WINDOW || AUDIO_WINDOW > AUDIO_FFT_LEN
+#error "Hop has to fit into the window and window into the FFT"
+#endif
+
+typedef struct
+{
+    arm_rfft_instance_q15 fft;
+    int16_t window[AUDIO_WINDOW];               // Hann in Q15
+    int16_t history[AUDIO_WINDOW - AUDIO_HOP];  // Tail of the last window
+    uint8_t band[AUDIO_FFT_BINS];       // Band that bin rises into
+    uint16_t weight[AUDIO_FFT_BINS];    // Q15 of band[], rest goes below
+    int16_t fft_in[AUDIO_FFT_LEN];
+    int16_t fft_out[AUDIO_FFT_LEN * 2];
+    int8_t frames[AUDIO_FRAMES][AUDIO_MEL_BANDS];
+    uint16_t head;                      // Row that the next hop replaces
+    uint16_t count;                     // Rows computed, up to AUDIO_FRAMES
+    int32_t multiplier;                 // Q16 log2 into steps, Q32
+    int32_t zero_point;
+}audio_features_t;
+
+static inline float audio_mel(float hz)
+{
+    return 1127.0f * logf(1.0f + hz / 700.0f);
+}
+
+/*!
+ * @brief                   Prepares window, filter bank and FFT, ring
+ *                          starts empty
+ *
+ * @param[out] af
+ * @param[in] scale         Quantization of the model input, feature is
+ * @param[in] zero_point    ln(energy) / scale + zero_point
+ *
+ * @return                  False if FFT length is not supported
+ *
+ * @note                    Uses float, call it once at setup.
+ */
+static inline bool audio_features_init(audio_features_t * af, float scale,
+                                       int32_t zero_point)
+{
+    memset(af, 0, sizeof(*af));
+    if (arm_rfft_init_q15(&af->fft, AUDIO_FFT_LEN, 0, 1) != ARM_MATH_SUCCESS)
+    {
+        return false;
+    }
+
+    for (int n = 0; n < AUDIO_WINDOW; n++)
+    {
+        float w = 0.5f - 0.5f * cosf(2.0f * PI * n / AUDIO_WINDOW);
+        af->window[n] = (int16_t) (w * 32767.0f + 0.5f);
+    }
+
+    // Band b starts at edge b, peaks at b + 1 and ends at b + 2
+    float low = audio_mel(AUDIO_MEL_LOW_HZ);
+    float step = (audio_mel(AUDIO_MEL_HIGH_HZ) - low) / (AUDIO_MEL_BANDS + 1);
+    for (int k = 0; k < AUDIO_FFT_BINS; k++)
+    {
+        float pos = (audio_mel((float) k * AUDIO_SAMPLE_RATE / AUDIO_FFT_LEN) -
+                     low) / step;
+        if (pos < 0.0f || pos >= AUDIO_MEL_BANDS + 1)
+        {
+            af->band[k] = AUDIO_BAND_NONE;
+            continue;
+        }
+        int edge = (int) pos;
+        af->band[k] = (uint8_t) edge;
+        af->weight[k] = (uint16_t) ((pos - edge) * 32768.0f);
+    }
+
+    af->multiplier = (int32_t) (0.69314718f / scale * 65536.0f + 0.5f);
+    af->zero_point = zero_point;
+    return true;
+}
+
+/*!
+ * @brief           Base 2 logarithm in Q16
+ *
+ * @note            Fraction is f + 0.34375 * f * (1 - f), off by less
+ *                  than 0.01, far below a step of int8 features.
+ */
+static inline int32_t audio_log2_q16(uint64_t x)
+{
+    int msb = 63 - __builtin_clzll(x);
+    uint32_t f = (msb >= 16 ? (uint32_t) (x >> (msb - 16)) :
+                              (uint32_t) (x << (16 - msb))) & 0xFFFF;
+    uint32_t curve = (f * (65536 - f)) >> 16;
+
+    return (msb << 16) + (int32_t) f + (int32_t) ((curve * 22) >> 6);
+}
+
+/*!
+ * @brief               Adds one hop of samples, its window replaces the
+ *                      oldest row
+ *
+ * @param[in,out] af
+ * @param[in] hop       AUDIO_HOP samples at AUDIO_SAMPLE_RATE
+ */
+static inline void audio_features_push(audio_features_t * af,
+                                       const int16_t * hop)
+{
+    const int keep = AUDIO_WINDOW - AUDIO_HOP;
+    int16_t * in = af->fft_in;
+
+    memcpy(in, af->history, sizeof(af->history));
+    memcpy(in + keep, hop, AUDIO_HOP * sizeof(int16_t));
+    memcpy(af->history, in + AUDIO_HOP, sizeof(af->history));
+
+    uint32_t peak = 0;
+    for (int n = 0; n < AUDIO_WINDOW; n++)
+    {
+        int32_t v = (in[n] * af->window[n]) >> 15;
+        in[n] = (int16_t) v;
+        peak |= (uint32_t) (v ^ (v >> 31));
+    }
+    memset(in + AUDIO_WINDOW, 0,
+           (AUDIO_FFT_LEN - AUDIO_WINDOW) * sizeof(int16_t));
+
+    // Largest sample gets bit 14, rest of the window follows it
+    int shift = peak ? __builtin_clz(peak) - 17 : 0;
+    if (shift > 0)
+    {
+        for (int n = 0; n < AUDIO_WINDOW; n++)
+        {
+            in[n] = (int16_t) (in[n] << shift);
+        }
+    }
+
+    arm_rfft_q15(&af->fft, in, af->fft_out);
+
+    uint64_t energy[AUDIO_MEL_BANDS];
+    memset(energy, 0, sizeof(energy));
+    for (int k = 0; k < AUDIO_FFT_BINS; k++)
+    {
+        uint8_t b = af->band[k];
+        if (b == AUDIO_BAND_NONE)
+        {
+            continue;
+        }
+        int32_t re = af->fft_out[2 * k];
+        int32_t im = af->fft_out[2 * k + 1];
+        uint64_t power = (uint32_t) (re * re) + (uint32_t) (im * im);
+        if (b < AUDIO_MEL_BANDS)
+        {
+            energy[b] += power * af->weight[k];
+        }
+        if (b > 0)
+        {
+            energy[b - 1] += power * (32768U - af->weight[k]);
+        }
+    }
+
+    // Energy of input samples, without FFT scaling, shift and Q15 weights
+    int32_t offset = (2 * (AUDIO_FFT_UPSCALE - shift) - 15) << 16;
+    int8_t * row = af->frames[af->head];
+    for (int b = 0; b < AUDIO_MEL_BANDS; b++)
+    {
+        if (!energy[b])
+        {
+            row[b] = INT8_MIN;
+            continue;
+        }
+        int64_t log2 = audio_log2_q16(energy[b]) + offset;
+        int32_t q = (int32_t) ((log2 * af->multiplier + (1LL << 31)) >> 32) +
+                    af->zero_point;
+        row[b] = (int8_t) (q < INT8_MIN ? INT8_MIN : q > INT8_MAX ? INT8_MAX : q);
+    }
+
+    af->head = (af->head + 1) % AUDIO_FRAMES;
+    if (af->count < AUDIO_FRAMES)
+    {
+        af->count++;
+    }
+}
+
+/*!
+ * @brief           Checks if every row of the ring has been computed
+ */
+static inline bool audio_features_ready(const audio_features_t * af)
+{
+    return af->count == AUDIO_FRAMES;
+}
+
+/*!
+ * @brief           Writes the ring in time order, oldest row first
+ *
+ * @param[in] af
+ * @param[out] dst  AUDIO_FRAMES x AUDIO_MEL_BANDS, for example model input
+ */
+static inline void audio_features_copy(const audio_features_t * af,
+                                       int8_t * dst)
+{
+    uint32_t older = (AUDIO_FRAMES - af->head) * AUDIO_MEL_BANDS;
+
+    memcpy(dst, af->frames[af->head], older);
+    memcpy(dst + older, af->frames[0], af->head * AUDIO_MEL_BANDS);
+}
+
+/*!
+ * @brief           Forgets all rows, for example after capture was stopped
+ */
+static inline void audio_features_reset(audio_features_t * af)
+{
+    memset(af->history, 0, sizeof(af->history));
+    af->head = 0;
+    af->count = 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AUDIO_FEATURES_H */
+/*** end of file ***/
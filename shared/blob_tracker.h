@@ -0,0 +1,457 @@
+#ifndef BLOB_TRACKER_H
+#define BLOB_TRACKER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "frame_convert.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Follows warm objects of a thermal frame from one frame to the next, so
+// an animal that was classified once is not classified again on every
+// frame while it walks through the scene.
+// Frame is cut into BLOB_BLOCK x BLOB_BLOCK blocks, block with mean at or
+// above the hot threshold is hot, touching hot blocks form a blob with
+// bounding box and centroid. Threshold comes from the caller, usually
+// from the histogram that capture already made, look at frame_stats.h.
+// Blobs continue the track they overlap most, IoU in Q8, or the one whose
+// centroid is close when a fast object does not overlap its last box.
+// Classifier is wanted when a track starts, when a classified track ends
+// and every refresh_frames frames, other frames keep the last result.
+// Integers only, block sums use USADA8, four pixels per instruction, for
+// 80x60 frame around 2500 cycles with the grouping.
+//
+// Usage example:
+// static blob_tracker_t tracker;
+// blob_config_t config = blob_tracker_default_config();
+// blob_tracker_init(&tracker, 80, 60, &config);
+// if (blob_tracker_update(&tracker, &frame[0][0], 80, hot)) {
+//     ...Invoke()...
+//     blob_tracker_classified(&tracker);
+// }
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#include "cmsis_gcc.h"
+#define BLOB_TRACKER_SIMD
+#endif
+
+#define BLOB_BLOCK          4
+#ifndef BLOB_MAX_BLOCKS
+#define BLOB_MAX_BLOCKS     ((80 / BLOB_BLOCK) * (60 / BLOB_BLOCK))
+#endif
+#define BLOB_MAX_BLOBS      4       // Largest blobs of a frame that count
+#define BLOB_MAX_TRACKS     4
+
+typedef struct
+{
+    uint8_t min_iou;            // Q8 overlap that continues a track
+    uint8_t max_step;           // Centroid move in pixels that continues
+                                // a track without overlap
+    uint16_t min_blocks;        // Smaller blobs are noise
+    uint8_t max_missed;         // Frames a track lives without its blob
+    uint16_t refresh_frames;    // Frames between classifications, 0 to
+                                // classify only on track changes
+}blob_config_t;
+
+typedef struct
+{
+    frame_roi_t box;            // In pixels
+    uint16_t cx;                // Centroid of hot blocks in pixels
+    uint16_t cy;
+    uint16_t blocks;            // Hot blocks
+}blob_t;
+
+typedef struct
+{
+    blob_t blob;                // Where it was seen last
+    uint16_t id;
+    uint16_t frames;            // Frames since it started
+    uint8_t missed;             // Frames in a row without its blob
+    bool classified;            // Classifier saw it at least once
+}blob_track_t;
+
+typedef struct
+{
+    blob_config_t config;
+    uint16_t cols;
+    uint16_t rows;
+    uint8_t count;              // Live tracks
+    uint16_t next_id;
+    uint16_t since_classified;  // Frames since blob_tracker_classified()
+    bool ended;                 // Classified track ended since then
+    blob_track_t tracks[BLOB_MAX_TRACKS];
+    uint8_t hot[BLOB_MAX_BLOCKS];   // Blocks of the last frame, 0 or 1
+
+    // Since init, for reports
+    uint32_t frames;
+    uint32_t wanted;            // Frames blob_tracker_update() wanted
+    uint32_t started;           // Tracks
+}blob_tracker_t;
+
+/*!
+ * @brief   Returns limits for 80x60 Lepton frames at 9 frames per second,
+ *          track needs a quarter of overlap or a step of two blocks, is
+ *          kept for three frames without blob and classified again about
+ *          every three seconds
+ */
+static inline blob_config_t blob_tracker_default_config()
+{
+    blob_config_t config;
+    config.min_iou = 64;
+    config.max_step = 2 * BLOB_BLOCK;
+    config.min_blocks = 2;
+    config.max_missed = 3;
+    config.refresh_frames = 30;
+    return config;
+}
+
+/*!
+ * @brief                   Forgets all tracks, next frame is classified
+ *
+ * @note                    Use it when results of old frames do not apply
+ *                          any more, for example after model change.
+ */
+static inline void blob_tracker_reset(blob_tracker_t * tracker)
+{
+    tracker->count = 0;
+    tracker->ended = true;
+    tracker->since_classified = 0;
+}
+
+/*!
+ * @brief                   Prepares tracker for frames of given size
+ *
+ * @param[out] tracker
+ * @param[in] cols          Multiple of BLOB_BLOCK
+ * @param[in] rows          Multiple of BLOB_BLOCK
+ * @param[in] config        Limits, copied into tracker
+ *
+ * @return                  False if frame has too many blocks
+ */
+static inline bool blob_tracker_init(blob_tracker_t * tracker,
+                                     uint16_t cols,
+                                     uint16_t rows,
+                                     const blob_config_t * config)
+{
+    if ((cols / BLOB_BLOCK) * (rows / BLOB_BLOCK) > BLOB_MAX_BLOCKS)
+    {
+        return false;
+    }
+
+    memset(tracker, 0, sizeof(*tracker));
+    tracker->config = *config;
+    tracker->cols = cols;
+    tracker->rows = rows;
+    blob_tracker_reset(tracker);
+    return true;
+}
+
+/*!
+ * @brief                   Returns sum of one block of 8 bit pixels
+ */
+static inline uint32_t blob_block_sum(const uint8_t * frame, uint32_t stride)
+{
+    uint32_t sum = 0;
+
+    for (uint8_t row = 0; row < BLOB_BLOCK; row++)
+    {
+        const uint8_t * src = frame + row * stride;
+#if defined(BLOB_TRACKER_SIMD) && (BLOB_BLOCK == 4)
+        uint32_t packed;
+        memcpy(&packed, src, 4);
+        sum = __USADA8(packed, 0, sum);
+#else
+        for (uint8_t col = 0; col < BLOB_BLOCK; col++)
+        {
+            sum += src[col];
+        }
+#endif
+    }
+    return sum;
+}
+
+/*!
+ * @brief                   Finds blobs of hot blocks, blocks that share an
+ *                          edge belong to the same blob
+ *
+ * @param[in] tracker
+ * @param[in] frame         8 bit pixels, for example AGC frame
+ * @param[in] stride        Pixels from one row to the next
+ * @param[in] threshold     Mean pixel of a hot block
+ * @param[out] blobs        Largest blobs first
+ *
+ * @return                  Number of blobs, at most BLOB_MAX_BLOBS
+ */
+static inline uint8_t blob_tracker_find(blob_tracker_t * tracker,
+                                        const uint8_t * frame,
+                                        uint32_t stride,
+                                        uint8_t threshold,
+                                        blob_t * blobs)
+{
+    const uint16_t block_cols = tracker->cols / BLOB_BLOCK;
+    const uint16_t blocks = block_cols * (tracker->rows / BLOB_BLOCK);
+    const uint32_t hot_sum = (uint32_t) threshold * BLOB_BLOCK * BLOB_BLOCK;
+    uint16_t stack[BLOB_MAX_BLOCKS];
+    uint8_t found = 0;
+
+    for (uint16_t i = 0; i < blocks; i++)
+    {
+        const uint8_t * src = frame + (i / block_cols) * BLOB_BLOCK * stride +
+                              (i % block_cols) * BLOB_BLOCK;
+        tracker->hot[i] = blob_block_sum(src, stride) >= hot_sum;
+    }
+
+    for (uint16_t start = 0; start < blocks; start++)
+    {
+        if (tracker->hot[start] != 1)
+        {
+            continue;
+        }
+
+        // Flood fill, each block is pushed once because it is marked first
+        uint16_t x0 = block_cols, y0 = blocks, x1 = 0, y1 = 0;
+        uint32_t sum_x = 0, sum_y = 0;
+        uint16_t size = 0;
+        uint16_t top = 0;
+
+        tracker->hot[start] = 2;
+        stack[top++] = start;
+        while (top)
+        {
+            uint16_t i = stack[--top];
+            uint16_t bx = i % block_cols;
+            uint16_t by = i / block_cols;
+
+            size++;
+            sum_x += bx;
+            sum_y += by;
+            x0 = bx < x0 ? bx : x0;
+            x1 = bx > x1 ? bx : x1;
+            y0 = by < y0 ? by : y0;
+            y1 = by > y1 ? by : y1;
+
+            if (bx > 0 && tracker->hot[i - 1] == 1)
+            {
+                tracker->hot[i - 1] = 2;
+                stack[top++] = i - 1;
+            }
+            if (bx + 1 < block_cols && tracker->hot[i + 1] == 1)
+            {
+                tracker->hot[i + 1] = 2;
+                stack[top++] = i + 1;
+            }
+            if (i >= block_cols && tracker->hot[i - block_cols] == 1)
+            {
+                tracker->hot[i - block_cols] = 2;
+                stack[top++] = i - block_cols;
+            }
+            if (i + block_cols < blocks &&
+                tracker->hot[i + block_cols] == 1)
+            {
+                tracker->hot[i + block_cols] = 2;
+                stack[top++] = i + block_cols;
+            }
+        }
+
+        if (size < tracker->config.min_blocks)
+        {
+            continue;
+        }
+
+        // Keeps blobs sorted by size, smallest one falls out when full
+        uint8_t pos = found < BLOB_MAX_BLOBS ? found++ : BLOB_MAX_BLOBS;
+        if (pos == BLOB_MAX_BLOBS)
+        {
+            if (size <= blobs[BLOB_MAX_BLOBS - 1].blocks)
+            {
+                continue;
+            }
+            pos = BLOB_MAX_BLOBS - 1;
+        }
+        while (pos > 0 && blobs[pos - 1].blocks < size)
+        {
+            blobs[pos] = blobs[pos - 1];
+            pos--;
+        }
+
+        blob_t * blob = &blobs[pos];
+        blob->box.x = x0 * BLOB_BLOCK;
+        blob->box.y = y0 * BLOB_BLOCK;
+        blob->box.w = (x1 - x0 + 1) * BLOB_BLOCK;
+        blob->box.h = (y1 - y0 + 1) * BLOB_BLOCK;
+        blob->cx = (uint16_t) ((2 * sum_x + size) * BLOB_BLOCK / (2 * size));
+        blob->cy = (uint16_t) ((2 * sum_y + size) * BLOB_BLOCK / (2 * size));
+        blob->blocks = size;
+    }
+    return found;
+}
+
+/*!
+ * @brief                   Returns overlap of two boxes over their union
+ *                          in Q8, 256 for the same box
+ */
+static inline uint32_t blob_iou(const frame_roi_t * a, const frame_roi_t * b)
+{
+    int32_t x0 = a->x > b->x ? a->x : b->x;
+    int32_t y0 = a->y > b->y ? a->y : b->y;
+    int32_t x1 = a->x + a->w < b->x + b->w ? a->x + a->w : b->x + b->w;
+    int32_t y1 = a->y + a->h < b->y + b->h ? a->y + a->h : b->y + b->h;
+    if (x1 <= x0 || y1 <= y0)
+    {
+        return 0;
+    }
+
+    uint32_t inter = (uint32_t) ((x1 - x0) * (y1 - y0));
+    uint32_t both = (uint32_t) a->w * a->h + (uint32_t) b->w * b->h - inter;
+    return (inter << 8) / both;
+}
+
+/*!
+ * @brief                   Returns how well blob continues track, 0 if
+ *                          it does not, overlap beats any centroid step
+ */
+static inline uint32_t blob_match_score(const blob_tracker_t * tracker,
+                                        const blob_track_t * track,
+                                        const blob_t * blob)
+{
+    uint32_t iou = blob_iou(&track->blob.box, &blob->box);
+    if (iou >= tracker->config.min_iou)
+    {
+        return 256 + iou;
+    }
+
+    int32_t dx = (int32_t) blob->cx - track->blob.cx;
+    int32_t dy = (int32_t) blob->cy - track->blob.cy;
+    uint32_t step = (uint32_t) ((dx < 0 ? -dx : dx) + (dy < 0 ? -dy : dy));
+    return step <= tracker->config.max_step ?
+           tracker->config.max_step - step + 1 : 0;
+}
+
+/*!
+ * @brief                   Finds blobs of the frame, continues or starts
+ *                          tracks with them and decides if the frame has
+ *                          to be classified
+ *
+ * @param[in] tracker
+ * @param[in] frame         8 bit pixels, cols x rows of init
+ * @param[in] stride        Pixels from one row to the next
+ * @param[in] threshold     Mean pixel of a hot block
+ *
+ * @return                  True if a track started, a classified one
+ *                          ended or refresh_frames passed, call
+ *                          blob_tracker_classified() once the result of
+ *                          the frame is known
+ */
+static inline bool blob_tracker_update(blob_tracker_t * tracker,
+                                       const uint8_t * frame,
+                                       uint32_t stride,
+                                       uint8_t threshold)
+{
+    blob_t blobs[BLOB_MAX_BLOBS];
+    uint8_t found = blob_tracker_find(tracker, frame, stride, threshold,
+                                      blobs);
+    bool blob_used[BLOB_MAX_BLOBS] = {false};
+    bool track_seen[BLOB_MAX_TRACKS] = {false};
+
+    // Best pair first, at most 4 x 4 of them
+    while (1)
+    {
+        uint32_t best = 0;
+        uint8_t best_track = 0;
+        uint8_t best_blob = 0;
+        for (uint8_t t = 0; t < tracker->count; t++)
+        {
+            for (uint8_t b = 0; b < found && !track_seen[t]; b++)
+            {
+                uint32_t score = blob_used[b] ? 0 :
+                    blob_match_score(tracker, &tracker->tracks[t], &blobs[b]);
+                if (score > best)
+                {
+                    best = score;
+                    best_track = t;
+                    best_blob = b;
+                }
+            }
+        }
+        if (!best)
+        {
+            break;
+        }
+
+        blob_track_t * track = &tracker->tracks[best_track];
+        track->blob = blobs[best_blob];
+        track->frames++;
+        track->missed = 0;
+        track_seen[best_track] = true;
+        blob_used[best_blob] = true;
+    }
+
+    // Tracks without blob age, long missing ones end
+    uint8_t kept = 0;
+    for (uint8_t t = 0; t < tracker->count; t++)
+    {
+        blob_track_t * track = &tracker->tracks[t];
+        if (!track_seen[t] && ++track->missed > tracker->config.max_missed)
+        {
+            tracker->ended |= track->classified;
+            continue;
+        }
+        tracker->tracks[kept++] = *track;
+    }
+    tracker->count = kept;
+
+    // Blob that continues nothing is a new object
+    bool started = false;
+    for (uint8_t b = 0; b < found; b++)
+    {
+        if (blob_used[b] || tracker->count == BLOB_MAX_TRACKS)
+        {
+            continue;
+        }
+        blob_track_t * track = &tracker->tracks[tracker->count++];
+        track->blob = blobs[b];
+        track->id = tracker->next_id++;
+        track->frames = 1;
+        track->missed = 0;
+        track->classified = false;
+        tracker->started++;
+        started = true;
+    }
+
+    tracker->frames++;
+    tracker->since_classified++;
+    bool refresh = tracker->config.refresh_frames &&
+                   tracker->since_classified >= tracker->config.refresh_frames;
+    bool wanted = started || tracker->ended || refresh;
+    for (uint8_t t = 0; t < tracker->count && !wanted; t++)
+    {
+        // Track that started while classifier failed
+        wanted = !tracker->tracks[t].classified;
+    }
+    tracker->wanted += wanted;
+    return wanted;
+}
+
+/*!
+ * @brief                   Tells tracker that the last frame was classified,
+ *                          its tracks keep the result
+ */
+static inline void blob_tracker_classified(blob_tracker_t * tracker)
+{
+    for (uint8_t t = 0; t < tracker->count; t++)
+    {
+        tracker->tracks[t].classified = true;
+    }
+    tracker->since_classified = 0;
+    tracker->ended = false;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLOB_TRACKER_H */
+/*** end of file ***/
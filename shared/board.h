@@ -0,0 +1,512 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libopencm3/cm3/common.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/scb.h>
+#include <libopencm3/cm3/systick.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/flash.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/spi.h>
+#include <libopencm3/stm32/i2c.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Board layer, clock, timebase, UART, SPI, I2C and caches of one board per
+// family, so the same application builds for STM32F4, STM32F7 and STM32L4.
+// Family comes from DEVICE in project.mk, genlink-config.mk of libopencm3
+// turns it into STM32F4, STM32F7 or STM32L4 define. 'make matrix' builds a
+// project for each family, see rules.mk.
+//
+// Boards:
+// - STM32F7: Nucleo-F767ZI, 216 MHz from HSI, USART3 on PD8 (ST-LINK VCP),
+//            LED on PB7, L1 caches, ART accelerator and prefetch.
+// - STM32F4: STM32F405VG board, 168 MHz from HSI, USART6 on PC6, LED on
+//            PC4, flash I-cache, D-cache and prefetch.
+// - STM32L4: Nucleo-L476RG, 80 MHz from HSI16, USART2 on PA2 (ST-LINK
+//            VCP), LED on PA5, flash I-cache, D-cache and prefetch. With
+//            BOARD_LPUART defined (CPPFLAGS += -DBOARD_LPUART in
+//            project.mk) output goes to LPUART1 on PC1 (CN7 pin 36)
+//            instead, its kernel clock is HSI16, so baud rate stays the
+//            same when the core clock changes.
+// All of them have SPI1 on PA5 (SCK), PA6 (MISO), PA7 (MOSI) with software
+// slave select on PB4 and I2C1 on PB8 (SCL) and PB9 (SDA). SPI1 SCK and
+// LED share PA5 on Nucleo-L476RG, so the LED does not work there once SPI
+// is set up.
+//
+// board_init() sets up clock, caches, SysTick, UART and LED, SPI and I2C
+// are set up only by projects that use them. millis(), micros(), delay()
+// and delay_us() are the same as in utility.c of other projects and
+// _putchar() of printf.c prints over UART of the board.
+// Everything is compiled in one source file of the project, which defines
+// BOARD_IMPLEMENTATION before the include.
+//
+// Usage example:
+// #define BOARD_IMPLEMENTATION
+// #include "board.h"
+// board_init();
+// printf("Running on %s at %lu Hz\n", BOARD_NAME, rcc_ahb_frequency);
+
+#if defined(STM32F7)
+#define BOARD_NAME              "stm32f7"
+#define BOARD_UART              USART3
+#define BOARD_UART_RCC          RCC_USART3
+#define BOARD_UART_PORT         GPIOD
+#define BOARD_UART_PORT_RCC     RCC_GPIOD
+#define BOARD_UART_TX           GPIO8
+#define BOARD_UART_AF           GPIO_AF7
+#define BOARD_LED_PORT          GPIOB
+#define BOARD_LED_PORT_RCC      RCC_GPIOB
+#define BOARD_LED               GPIO7
+#elif defined(STM32F4)
+#define BOARD_NAME              "stm32f4"
+#define BOARD_UART              USART6
+#define BOARD_UART_RCC          RCC_USART6
+#define BOARD_UART_PORT         GPIOC
+#define BOARD_UART_PORT_RCC     RCC_GPIOC
+#define BOARD_UART_TX           GPIO6
+#define BOARD_UART_AF           GPIO_AF8
+#define BOARD_LED_PORT          GPIOC
+#define BOARD_LED_PORT_RCC      RCC_GPIOC
+#define BOARD_LED               GPIO4
+#elif defined(STM32L4)
+#define BOARD_NAME              "stm32l4"
+#ifdef BOARD_LPUART
+#ifndef LPUART1
+#define LPUART1                 LPUART1_BASE
+#endif
+#define BOARD_UART              LPUART1
+#define BOARD_UART_RCC          RCC_LPUART1
+#define BOARD_UART_PORT         GPIOC
+#define BOARD_UART_PORT_RCC     RCC_GPIOC
+#define BOARD_UART_TX           GPIO1
+#define BOARD_UART_AF           GPIO_AF8
+#else
+#define BOARD_UART              USART2
+#define BOARD_UART_RCC          RCC_USART2
+#define BOARD_UART_PORT         GPIOA
+#define BOARD_UART_PORT_RCC     RCC_GPIOA
+#define BOARD_UART_TX           GPIO2
+#define BOARD_UART_AF           GPIO_AF7
+#endif
+#define BOARD_LED_PORT          GPIOA
+#define BOARD_LED_PORT_RCC      RCC_GPIOA
+#define BOARD_LED               GPIO5
+#else
+#error "board.h supports STM32F4, STM32F7 and STM32L4, check DEVICE"
+#endif
+
+#define BOARD_UART_BAUDRATE     115200
+
+void board_init();
+void board_clock_setup();
+void board_cache_enable();
+void board_systick_setup();
+void board_uart_setup();
+void board_led_setup();
+void board_spi_setup();
+void board_i2c_setup();
+
+void board_putc(char character);
+void board_led_set(bool on);
+void board_led_toggle();
+
+uint64_t millis();
+uint64_t micros();
+void sys_tick_handler();
+void delay(uint64_t duration);
+void delay_us(uint64_t duration);
+
+#ifdef BOARD_IMPLEMENTATION
+
+// Cortex-M7 cache maintenance registers
+#define BOARD_SCB_CCR       MMIO32(0xE000ED14)
+#define BOARD_SCB_CCSIDR    MMIO32(0xE000ED80)
+#define BOARD_SCB_CSSELR    MMIO32(0xE000ED84)
+#define BOARD_SCB_ICIALLU   MMIO32(0xE000EF50)
+#define BOARD_SCB_DCISW     MMIO32(0xE000EF60)
+#define BOARD_SCB_CCR_IC    (1UL << 17)
+#define BOARD_SCB_CCR_DC    (1UL << 16)
+
+// LPUART1 kernel clock selection of STM32L4, LPUART1SEL of RCC_CCIPR
+#define BOARD_RCC_CCIPR             MMIO32(RCC_BASE + 0x88)
+#define BOARD_CCIPR_LPUART1SEL      (3UL << 10)
+#define BOARD_CCIPR_LPUART1_HSI16   (2UL << 10)
+#define BOARD_LPUART_CLOCK          16000000
+
+// Storage for our monotonic system clock.
+// Note that it needs to be volatile since we're modifying it from an interrupt.
+static volatile uint64_t board_millis = 0;
+
+/*!
+ * @brief   Sets up clock, caches, SysTick, UART and LED of the board
+ */
+void board_init()
+{
+    board_clock_setup();
+    board_cache_enable();
+    board_systick_setup();
+    board_uart_setup();
+    board_led_setup();
+}
+
+/*!
+ * @brief   Runs the core at the highest clock of the family from HSI
+ *
+ * @note    rcc_ahb_frequency, rcc_apb1_frequency and rcc_apb2_frequency
+ *          are set here, timebase and UART baudrate depend on them.
+ */
+void board_clock_setup()
+{
+#if defined(STM32F7)
+    rcc_clock_setup_hsi(&rcc_3v3[RCC_CLOCK_3V3_216MHZ]);
+#elif defined(STM32F4)
+    rcc_clock_setup_pll(&rcc_hsi_configs[RCC_CLOCK_3V3_168MHZ]);
+#elif defined(STM32L4)
+    rcc_osc_on(RCC_HSI16);
+    rcc_wait_for_osc_ready(RCC_HSI16);
+
+    // 4 wait states are needed at 80 MHz in voltage range 1
+    flash_prefetch_enable();
+    flash_set_ws(4);
+
+    // 16 MHz / 4 * 40 = 160 MHz VCO, / 2 = 80 MHz system clock
+    rcc_set_main_pll(RCC_PLLCFGR_PLLSRC_HSI16, 4, 40,
+                     0, 0, RCC_PLLCFGR_PLLR_DIV2);
+    rcc_osc_on(RCC_PLL);
+    rcc_wait_for_osc_ready(RCC_PLL);
+
+    rcc_set_sysclk_source(RCC_CFGR_SW_PLL);
+    rcc_wait_for_sysclk_status(RCC_PLL);
+
+    // Library does not track the clock on L4, AHB and APB are not divided
+    rcc_ahb_frequency = 80000000;
+    rcc_apb1_frequency = 80000000;
+    rcc_apb2_frequency = 80000000;
+#endif
+}
+
+/*!
+ * @brief   Enables every cache and flash accelerator of the family
+ *
+ * @note    On STM32F7 these are L1 I-cache and D-cache of Cortex-M7, ART
+ *          accelerator and prefetch of flash. D-cache is write back, so
+ *          buffers of DMA need cache maintenance or non-cacheable memory.
+ *          On STM32F4 and STM32L4 there is no L1 cache, only instruction
+ *          and data cache and prefetch of the flash interface.
+ */
+void board_cache_enable()
+{
+#if defined(STM32F7)
+    FLASH_ACR |= FLASH_ACR_ARTEN | FLASH_ACR_PRFTEN;
+
+    if (!(BOARD_SCB_CCR & BOARD_SCB_CCR_IC))
+    {
+        __asm volatile("dsb 0xF\n\tisb 0xF" ::: "memory");
+        BOARD_SCB_ICIALLU = 0;
+        __asm volatile("dsb 0xF\n\tisb 0xF" ::: "memory");
+        BOARD_SCB_CCR |= BOARD_SCB_CCR_IC;
+        __asm volatile("dsb 0xF\n\tisb 0xF" ::: "memory");
+    }
+
+    if (!(BOARD_SCB_CCR & BOARD_SCB_CCR_DC))
+    {
+        // Invalidate every set and way of L1 D-cache before it is used
+        BOARD_SCB_CSSELR = 0;
+        __asm volatile("dsb 0xF" ::: "memory");
+        uint32_t ccsidr = BOARD_SCB_CCSIDR;
+        uint32_t sets = (ccsidr >> 13) & 0x7FFF;
+        do
+        {
+            uint32_t ways = (ccsidr >> 3) & 0x3FF;
+            do
+            {
+                BOARD_SCB_DCISW = ((sets << 5) & 0x3FE0) |
+                                  ((ways << 30) & 0xC0000000);
+            } while (ways-- != 0);
+        } while (sets-- != 0);
+        __asm volatile("dsb 0xF" ::: "memory");
+        BOARD_SCB_CCR |= BOARD_SCB_CCR_DC;
+        __asm volatile("dsb 0xF\n\tisb 0xF" ::: "memory");
+    }
+#else
+    flash_prefetch_enable();
+    flash_icache_enable();
+    flash_dcache_enable();
+#endif
+}
+
+/*!
+ * @brief   Sets up SysTick interrupt every millisecond
+ */
+void board_systick_setup()
+{
+    // Set the systick clock source to our main clock
+    systick_set_clocksource(STK_CSR_CLKSOURCE_AHB);
+    // Clear the Current Value Register so that we start at 0
+    STK_CVR = 0;
+    // In order to trigger an interrupt every millisecond, we can set the reload
+    // value to be the speed of the processor / 1000 -1
+    systick_set_reload(rcc_ahb_frequency / 1000 - 1);
+    // Enable interrupts from the system tick clock
+    systick_interrupt_enable();
+    // Enable the system tick counter
+    systick_counter_enable();
+}
+
+/*!
+ * @brief   Sets up UART of the board, transmit only, 115200 8N1
+ */
+void board_uart_setup()
+{
+    rcc_periph_clock_enable(BOARD_UART_RCC);
+    rcc_periph_clock_enable(BOARD_UART_PORT_RCC);
+
+    gpio_mode_setup(BOARD_UART_PORT, GPIO_MODE_AF, GPIO_PUPD_NONE,
+                    BOARD_UART_TX);
+    gpio_set_af(BOARD_UART_PORT, BOARD_UART_AF, BOARD_UART_TX);
+
+#if defined(STM32L4) && defined(BOARD_LPUART)
+    // HSI16 is kept on by board_clock_setup(), BRR of LPUART is
+    // 256 * clock / baud rate
+    BOARD_RCC_CCIPR = (BOARD_RCC_CCIPR & ~BOARD_CCIPR_LPUART1SEL) |
+                      BOARD_CCIPR_LPUART1_HSI16;
+    USART_BRR(BOARD_UART) = (uint32_t) (((uint64_t) BOARD_LPUART_CLOCK * 256 +
+                            BOARD_UART_BAUDRATE / 2) / BOARD_UART_BAUDRATE);
+#else
+    usart_set_baudrate(BOARD_UART, BOARD_UART_BAUDRATE);
+#endif
+    usart_set_databits(BOARD_UART, 8);
+    usart_set_stopbits(BOARD_UART, USART_STOPBITS_1);
+    usart_set_mode(BOARD_UART, USART_MODE_TX);
+    usart_set_parity(BOARD_UART, USART_PARITY_NONE);
+    usart_set_flow_control(BOARD_UART, USART_FLOWCONTROL_NONE);
+    usart_enable(BOARD_UART);
+}
+
+/*!
+ * @brief   Sets up LED pin of the board as output, LED is off
+ */
+void board_led_setup()
+{
+    rcc_periph_clock_enable(BOARD_LED_PORT_RCC);
+    gpio_clear(BOARD_LED_PORT, BOARD_LED);
+    gpio_mode_setup(BOARD_LED_PORT, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE,
+                    BOARD_LED);
+}
+
+/*!
+ * @brief   Sets up SPI1 as master, 16 bit words, CPOL = 1, CPHA = 1, MSB
+ *          first, slave select on PB4 is driven by software
+ *
+ * @note    Clock is APB2 / 8, 13.5 MHz on STM32F7, 10.5 MHz on STM32F4
+ *          and 10 MHz on STM32L4.
+ */
+void board_spi_setup()
+{
+    rcc_periph_clock_enable(RCC_SPI1);
+    rcc_periph_clock_enable(RCC_GPIOA);
+    rcc_periph_clock_enable(RCC_GPIOB);
+
+    gpio_set_af(GPIOA, GPIO_AF5, GPIO5 | GPIO6 | GPIO7);
+    gpio_mode_setup(GPIOA, GPIO_MODE_AF, GPIO_PUPD_NONE,
+                    GPIO5 | GPIO6 | GPIO7);
+    gpio_set_output_options(GPIOA, GPIO_OTYPE_PP, GPIO_OSPEED_25MHZ,
+                            GPIO5 | GPIO7);
+
+    // Slave select is pulled high before it becomes output
+    gpio_set(GPIOB, GPIO4);
+    gpio_mode_setup(GPIOB, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, GPIO4);
+    gpio_set_output_options(GPIOB, GPIO_OTYPE_PP, GPIO_OSPEED_25MHZ, GPIO4);
+
+    spi_reset(SPI1);
+    spi_init_master(SPI1,
+                    SPI_CR1_BAUDRATE_FPCLK_DIV_8,
+                    SPI_CR1_CPOL_CLK_TO_1_WHEN_IDLE,
+                    SPI_CR1_CPHA_CLK_TRANSITION_2,
+                    SPI_CR1_MSBFIRST);
+
+    // NSS is high, so peripheral does not switch itself to slave mode
+    spi_enable_software_slave_management(SPI1);
+    spi_set_nss_high(SPI1);
+
+#if defined(STM32F4)
+    spi_set_dff_16bit(SPI1);
+#else
+    spi_set_data_size(SPI1, SPI_CR2_DS_16BIT);
+#endif
+
+    spi_enable(SPI1);
+}
+
+/*!
+ * @brief   Sets up I2C1 as master at 100 kHz, 7 bit addresses
+ *
+ * @note    On STM32F7 and STM32L4 peripheral runs from HSI at 16 MHz, so
+ *          timing does not depend on the system clock, STM32F4 has no
+ *          clock selection and runs it from APB1.
+ */
+void board_i2c_setup()
+{
+    rcc_periph_clock_enable(RCC_I2C1);
+    rcc_periph_clock_enable(RCC_GPIOB);
+
+    gpio_set_af(GPIOB, GPIO_AF4, GPIO8 | GPIO9);
+    gpio_set_output_options(GPIOB, GPIO_OTYPE_OD, GPIO_OSPEED_100MHZ,
+                            GPIO8 | GPIO9);
+    gpio_mode_setup(GPIOB, GPIO_MODE_AF, GPIO_PUPD_NONE, GPIO8 | GPIO9);
+
+    i2c_reset(I2C1);
+    i2c_peripheral_disable(I2C1);
+
+#if defined(STM32F4)
+    i2c_set_speed(I2C1, i2c_speed_sm_100k, rcc_apb1_frequency / 1000000);
+#else
+#if defined(STM32F7)
+    // HSI, 0b10 of the two bit field, as sys_init.c of power_test does
+    RCC_DCKCFGR2 = (RCC_DCKCFGR2 & ~(0x3 << RCC_DCKCFGR2_I2C1SEL_SHIFT)) |
+                   (0x2 << RCC_DCKCFGR2_I2C1SEL_SHIFT);
+#else
+    RCC_CCIPR |= (RCC_CCIPR_I2CxSEL_HSI16 << RCC_CCIPR_I2C1SEL_SHIFT);
+#endif
+    i2c_enable_analog_filter(I2C1);
+    i2c_set_digital_filter(I2C1, 0);
+    i2c_set_speed(I2C1, i2c_speed_sm_100k, 16);
+    i2c_enable_stretching(I2C1);
+    i2c_set_7bit_addr_mode(I2C1);
+#endif
+
+    i2c_peripheral_enable(I2C1);
+}
+
+/*!
+ * @brief                   Sends one character over UART of the board
+ *
+ * @param[in] character     Character that we will send
+ *
+ * @note                    Blocks until transmit register is empty
+ */
+void board_putc(char character)
+{
+    usart_send_blocking(BOARD_UART, character);
+}
+
+// Output of printf.c
+void _putchar(char character)
+{
+    board_putc(character);
+}
+
+/*!
+ * @brief               Turns LED of the board on or off
+ *
+ * @param[in] on        True turns it on
+ */
+void board_led_set(bool on)
+{
+    if (on)
+    {
+        gpio_set(BOARD_LED_PORT, BOARD_LED);
+    }
+    else
+    {
+        gpio_clear(BOARD_LED_PORT, BOARD_LED);
+    }
+}
+
+void board_led_toggle()
+{
+    gpio_toggle(BOARD_LED_PORT, BOARD_LED);
+}
+
+/*!
+ * @brief   Returns how long microcontroller has been running in milliseconds
+ *
+ * @note    64 bit value is read twice, so a tick in between does not tear it
+ */
+uint64_t millis()
+{
+    uint64_t ms;
+    do
+    {
+        ms = board_millis;
+    } while (ms != board_millis);
+    return ms;
+}
+
+/*!
+ * @brief   Returns how long microcontroller has been running in microseconds
+ *
+ * @note    SysTick counts down from reload value to 0. Tick that is
+ *          pending while interrupts are masked, or in a higher priority
+ *          interrupt, is counted as well, so time does not jump back by
+ *          1 ms. Can be called from interrupts.
+ */
+uint64_t micros()
+{
+    uint32_t reload = systick_get_reload() + 1;
+    bool masked = cm_mask_interrupts(true);
+    uint64_t ms = board_millis;
+    uint32_t value = systick_get_value();
+
+    // Counter reloaded, but tick interrupt is not served yet, value is
+    // read again, it could be from before the reload
+    if (SCB_ICSR & SCB_ICSR_PENDSTSET)
+    {
+        ms++;
+        value = systick_get_value();
+    }
+    cm_mask_interrupts(masked);
+
+    // reload is rcc_ahb_frequency / 1000, product fits in 32 bits
+    return ms * 1000 + (reload - value) * 1000 / reload;
+}
+
+/*!
+ * @brief   This is our interrupt handler for the systick reload interrupt.
+ */
+void sys_tick_handler()
+{
+    // Increment our monotonic clock
+    board_millis++;
+}
+
+/*!
+ * @brief                   Delay for a real number of milliseconds
+ *
+ * @param[in] duration      In milliseconds
+ *
+ * @note                    Blocks for specified duration
+ */
+void delay(uint64_t duration)
+{
+    const uint64_t until = millis() + duration;
+    while (millis() < until);
+}
+
+/*!
+ * @brief                   Delay for a real number of microseconds
+ *
+ * @param[in] duration      In microseconds
+ *
+ * @note                    Blocks for specified duration
+ */
+void delay_us(uint64_t duration)
+{
+    const uint64_t until = micros() + duration;
+    while (micros() < until);
+}
+#endif /* BOARD_IMPLEMENTATION */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BOARD_H */
+/*** end of file ***/
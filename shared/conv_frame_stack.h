@@ -0,0 +1,180 @@
+#ifndef CONV_FRAME_STACK_H
+#define CONV_FRAME_STACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/micro_op_resolver.h"
+
+#include "frame_stack.h"
+
+// Conv2D over the frame ring of frame_stack.h.
+//
+// Ring keeps the last kDepth frames as input channels, but only writes
+// the newest one, so channel order rotates by one with every frame. Each
+// output is a sum over input channels, rotating input channels of the
+// filter by the same amount gives exactly the output of the ordered
+// tensor. Node whose input is the bound ring keeps a rotated copy of its
+// filter in the persistent arena, copy is rebuilt only when rotation
+// changed, which is kOutputs * kKernel * kDepth bytes for a frame and
+// much less than moving kDepth frames.
+//
+// Filter of the eval tensor is pointed to the copy for the call of the
+// wrapped kernel and back afterwards, so the kernel below, specialised,
+// fused or generic, does not know about it. Kernels read filter data in
+// Eval(), none of them keeps the pointer from Prepare().
+//
+// Usage example:
+// static Conv2DStackResolver<kNumRows, kNumCols, kNumChannels>
+//     stack_resolver(conv_resolver);
+// engine.SetResolver(&stack_resolver);
+// Conv2DStackResolver<kNumRows, kNumCols, kNumChannels>::Bind(&stack);
+
+template <int kRows, int kCols, int kDepth>
+class Conv2DStackResolver : public tflite::MicroOpResolver {
+ public:
+  explicit Conv2DStackResolver(const tflite::MicroOpResolver& base)
+      : base_(base) {}
+
+  const TfLiteRegistration* FindOp(tflite::BuiltinOperator op) const override {
+    const TfLiteRegistration* registration = base_.FindOp(op);
+    if (op != tflite::BuiltinOperator_CONV_2D || registration == nullptr) {
+      return registration;
+    }
+
+    // Keep builtin code and version, so profiler still reports CONV_2D
+    generic_ = registration;
+    registration_ = *registration;
+    registration_.init = Init;
+    registration_.free = nullptr;
+    registration_.prepare = Prepare;
+    registration_.invoke = Eval;
+    return &registration_;
+  }
+
+  const TfLiteRegistration* FindOp(const char* op) const override {
+    return base_.FindOp(op);
+  }
+
+  BuiltinParseFunction GetOpDataParser(
+      tflite::BuiltinOperator op) const override {
+    return base_.GetOpDataParser(op);
+  }
+
+  // Ring whose tensor is rotated, nullptr runs every node as it is
+  static void Bind(const frame_stack_t* stack) { Stack() = stack; }
+
+ private:
+  struct OpData {
+    void* generic_data;
+    int8_t* rotated;  // Filter with input channels of rotation, or nullptr
+    int cells;        // Filter elements per input channel
+    int rotation;     // Slot of the oldest frame in rotated, -1 none yet
+  };
+
+  static void* Init(TfLiteContext* context, const char* buffer,
+                    size_t length) {
+    OpData* data = static_cast<OpData*>(
+        context->AllocatePersistentBuffer(context, sizeof(OpData)));
+    if (data == nullptr) {
+      return nullptr;
+    }
+    data->generic_data = generic_->init
+                             ? generic_->init(context, buffer, length)
+                             : nullptr;
+    data->rotated = nullptr;
+    data->rotation = -1;
+    return data;
+  }
+
+  static TfLiteStatus Prepare(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+
+    node->user_data = data->generic_data;
+    TfLiteStatus status =
+        generic_->prepare ? generic_->prepare(context, node) : kTfLiteOk;
+    node->user_data = data;
+    if (status != kTfLiteOk) {
+      return status;
+    }
+
+    // Only nodes that can read the ring get a copy, the first layer
+    const TfLiteTensor* input = tflite::GetInput(context, node, 0);
+    const TfLiteTensor* filter = tflite::GetInput(context, node, 1);
+    const TfLiteIntArray* in = input->dims;
+    const TfLiteIntArray* f = filter->dims;
+    if (input->type != kTfLiteInt8 || filter->type != kTfLiteInt8 ||
+        !(in->size == 4 && in->data[0] == 1 && in->data[1] == kRows &&
+          in->data[2] == kCols && in->data[3] == kDepth && f->size == 4 &&
+          f->data[3] == kDepth)) {
+      return kTfLiteOk;
+    }
+
+    data->cells = f->data[0] * f->data[1] * f->data[2];
+    data->rotated = static_cast<int8_t*>(context->AllocatePersistentBuffer(
+        context, data->cells * kDepth));
+    return data->rotated != nullptr ? kTfLiteOk : kTfLiteError;
+  }
+
+  static TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+    const frame_stack_t* stack = Stack();
+    const TfLiteEvalTensor* input = tflite::micro::GetEvalInput(context, node, 0);
+    const int rotation =
+        data->rotated != nullptr && stack != nullptr &&
+                input->data.data == stack->data
+            ? frame_stack_oldest(stack)
+            : 0;
+
+    // Filter is a constant of the model, eval tensor only points to it
+    TfLiteEvalTensor* filter = const_cast<TfLiteEvalTensor*>(
+        tflite::micro::GetEvalInput(context, node, 1));
+    void* original = filter->data.data;
+    if (rotation != 0) {
+      if (rotation != data->rotation) {
+        Rotate(static_cast<const int8_t*>(original), data->cells, rotation,
+               data->rotated);
+        data->rotation = rotation;
+      }
+      filter->data.data = data->rotated;
+    }
+
+    node->user_data = data->generic_data;
+    TfLiteStatus status = generic_->invoke(context, node);
+    node->user_data = data;
+    filter->data.data = original;
+    return status;
+  }
+
+  // Channel c of training order is read from slot (rotation + c) % kDepth
+  static void Rotate(const int8_t* filter, int cells, int rotation,
+                     int8_t* rotated) {
+    for (int i = 0; i < cells; i++) {
+      const int8_t* src = filter + i * kDepth;
+      int8_t* dst = rotated + i * kDepth;
+      for (int c = 0; c < kDepth; c++) {
+        int slot = rotation + c;
+        dst[slot < kDepth ? slot : slot - kDepth] = src[c];
+      }
+    }
+  }
+
+  static const frame_stack_t*& Stack() {
+    static const frame_stack_t* stack = nullptr;
+    return stack;
+  }
+
+  const tflite::MicroOpResolver& base_;
+  mutable TfLiteRegistration registration_;
+
+  static const TfLiteRegistration* generic_;
+};
+
+template <int kRows, int kCols, int kDepth>
+const TfLiteRegistration* Conv2DStackResolver<kRows, kCols, kDepth>::generic_ =
+    nullptr;
+
+#endif  // CONV_FRAME_STACK_H
@@ -0,0 +1,565 @@
+#ifndef CONV_POOL_FUSED_H
+#define CONV_POOL_FUSED_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "tensorflow/lite/c/builtin_op_data.h"
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/kernels/internal/common.h"
+#include "tensorflow/lite/kernels/internal/reference/integer_ops/conv.h"
+#include "tensorflow/lite/kernels/internal/types.h"
+#include "tensorflow/lite/kernels/kernel_util.h"
+#include "tensorflow/lite/kernels/padding.h"
+#include "tensorflow/lite/micro/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/micro_op_resolver.h"
+
+#include "conv_tuning.h"
+
+#ifdef CMSIS_NN
+#include "arm_nnfunctions.h"
+#endif
+
+// Conv2D fused with the KxK max pool that follows it.
+//
+// fuse_conv_pool.py removes MaxPool2D that only pools output of a Conv2D
+// and lets Conv2D write the pooled tensor, so Conv2D output, the largest
+// activation of Conv2D -> MaxPool2D stacks, is never stored. ReLU is
+// already part of Conv2D, converter folds it into the activation range,
+// and max commutes with it. Fused node is recognised by its output: it
+// is K times smaller in both dimensions than the convolution gives.
+//
+// Kernel convolves K rows at a time into a scratch strip, with CMSIS-NN
+// on target and the reference kernel on host, and writes their KxK
+// maximum. Strip is a view of the input with its own top padding, so
+// every row is exactly what the whole convolution computes and the
+// result is bit exact. Strip is in cache when it is pooled, output is
+// written once and never read back.
+//
+// CMSIS-NN parameter structs are filled once in Prepare() and kept in
+// the persistent arena, Eval() only patches top padding and input rows
+// of each strip. On target int8 nodes that are not fused take the same
+// path as a single strip of the whole output, so small layers skip the
+// per call setup of the original kernel too.
+//
+// Each node on the CMSIS-NN path takes the kernel ConvTuning chose for
+// it, the wrapper by default. While ConvTuning calibrates, Eval() runs
+// the node with every kernel it is eligible for, twice each so the second
+// run has warm caches, and keeps the fastest, see conv_tuning.h.
+//
+// Resolver wraps the project resolver and only replaces Conv2D
+// registration, other nodes that are not fused run through the original
+// kernel. A fused model can not run without it. Streamed filters of
+// weight_stream.h are only filled in Eval() of the wrapped registration,
+// so those nodes always take the original kernel, and a fused one fails
+// in Prepare().
+//
+// Usage example:
+// static Conv2DPoolResolver pool_resolver(engine.resolver());
+// engine.SetResolver(&pool_resolver);
+// engine.Setup(model_data, error_reporter);
+
+class Conv2DPoolResolver : public tflite::MicroOpResolver {
+ public:
+  explicit Conv2DPoolResolver(const tflite::MicroOpResolver& base)
+      : base_(base) {}
+
+  const TfLiteRegistration* FindOp(tflite::BuiltinOperator op) const override {
+    const TfLiteRegistration* registration = base_.FindOp(op);
+    if (op != tflite::BuiltinOperator_CONV_2D || registration == nullptr) {
+      return registration;
+    }
+
+    // Keep builtin code and version, so profiler still reports CONV_2D
+    Generic() = registration;
+    registration_ = *registration;
+    registration_.init = Init;
+    registration_.free = nullptr;
+    registration_.prepare = Prepare;
+    registration_.invoke = Eval;
+    return &registration_;
+  }
+
+  const TfLiteRegistration* FindOp(const char* op) const override {
+    return base_.FindOp(op);
+  }
+
+  BuiltinParseFunction GetOpDataParser(
+      tflite::BuiltinOperator op) const override {
+    return base_.GetOpDataParser(op);
+  }
+
+  // Returns K of the pool fused into node, 1 if output is what the
+  // convolution gives, 0 if output fits neither
+  static int PoolFactor(const TfLiteTensor* input, const TfLiteTensor* filter,
+                        const TfLiteTensor* output,
+                        const TfLiteConvParams* params) {
+    const TfLiteIntArray* in = input->dims;
+    const TfLiteIntArray* f = filter->dims;
+    const TfLiteIntArray* out = output->dims;
+    if (in->size != 4 || f->size != 4 || out->size != 4 ||
+        out->data[1] <= 0 || out->data[2] <= 0) {
+      return 0;
+    }
+
+    const int rows = tflite::ComputeOutSize(
+        params->padding, in->data[1], f->data[1], params->stride_height,
+        params->dilation_height_factor);
+    const int cols = tflite::ComputeOutSize(
+        params->padding, in->data[2], f->data[2], params->stride_width,
+        params->dilation_width_factor);
+
+    // Script only fuses pools whose K is the only one that fits
+    for (int pool = 1; pool <= rows; pool++) {
+      if (rows / pool == out->data[1] && cols / pool == out->data[2]) {
+        return pool;
+      }
+    }
+    return 0;
+  }
+
+ private:
+  // Filter is a stub of stream_weights.py, the same test as IsStreamed()
+  // of weight_stream.h
+  static bool Streamed(const TfLiteTensor* filter) {
+    return filter->data.raw != nullptr &&
+           memcmp(filter->data.raw, "EXT1", 4) == 0;
+  }
+
+  struct OpData {
+    void* generic_data;
+    int pool;               // K of fused KxK max pool, 1 if not fused
+    bool cached;            // Not fused, runs on parameters below
+    int strip_rows;         // Convolution rows computed at a time
+    int cols;               // Convolution output, before pooling
+    int channels;
+    TfLitePaddingValues padding;
+    int32_t input_offset;
+    int32_t output_offset;
+    int32_t activation_min;
+    int32_t activation_max;
+    int32_t* multiplier;
+    int32_t* shift;
+    int strip_buffer_index; // K convolution rows
+    int im2col_buffer_index;
+#ifdef CMSIS_NN
+    int slot;               // Of ConvTuning, -1 if not tuned
+    uint32_t candidates;    // Bit of each kernel node is eligible for
+    ConvTuning::Kernel kernel;
+    cmsis_nn_conv_params conv_params;
+    cmsis_nn_per_channel_quant_params quant_params;
+    cmsis_nn_dims input_dims;
+    cmsis_nn_dims filter_dims;
+    cmsis_nn_dims bias_dims;
+    cmsis_nn_dims strip_dims;
+#endif
+  };
+
+  static void* Init(TfLiteContext* context, const char* buffer,
+                    size_t length) {
+    OpData* data = static_cast<OpData*>(
+        context->AllocatePersistentBuffer(context, sizeof(OpData)));
+    if (data == nullptr) {
+      return nullptr;
+    }
+    data->generic_data = Generic()->init
+                             ? Generic()->init(context, buffer, length)
+                             : nullptr;
+    data->pool = 1;
+    data->cached = false;
+    return data;
+  }
+
+  static TfLiteStatus Prepare(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+
+    const TfLiteTensor* input = tflite::GetInput(context, node, 0);
+    const TfLiteTensor* filter = tflite::GetInput(context, node, 1);
+    const TfLiteTensor* bias = tflite::GetOptionalInputTensor(context, node, 2);
+    TfLiteTensor* output = tflite::GetOutput(context, node, 0);
+    const TfLiteConvParams* params =
+        static_cast<const TfLiteConvParams*>(node->builtin_data);
+
+    data->pool = PoolFactor(input, filter, output, params);
+    const bool streamed = Streamed(filter);
+    const bool int8 = input->type == kTfLiteInt8 &&
+                      filter->type == kTfLiteInt8 &&
+                      output->type == kTfLiteInt8 &&
+                      filter->quantization.type == kTfLiteAffineQuantization;
+#ifdef CMSIS_NN
+    // Original kernel handles batches and dilation without CMSIS-NN
+    data->cached = data->pool == 1 && int8 && !streamed &&
+                   input->dims->data[0] == 1 &&
+                   params->dilation_height_factor == 1 &&
+                   params->dilation_width_factor == 1;
+#else
+    data->cached = false;
+#endif
+    if (data->pool == 1 && !data->cached) {
+      node->user_data = data->generic_data;
+      TfLiteStatus status =
+          Generic()->prepare ? Generic()->prepare(context, node) : kTfLiteOk;
+      node->user_data = data;
+      return status;
+    }
+
+    if (streamed) {
+      TF_LITE_KERNEL_LOG(context, "Fused Conv2D can not stream weights");
+      return kTfLiteError;
+    }
+    if (data->pool == 0 || !int8) {
+      TF_LITE_KERNEL_LOG(context, "Fused Conv2D needs int8 KxK pool");
+      return kTfLiteError;
+    }
+
+    const int channels = filter->dims->data[0];
+    data->channels = channels;
+    data->cols = tflite::ComputeOutSize(
+        params->padding, input->dims->data[2], filter->dims->data[2],
+        params->stride_width, params->dilation_width_factor);
+
+    int unused_height;
+    int unused_width;
+    data->padding = tflite::ComputePaddingHeightWidth(
+        params->stride_height, params->stride_width,
+        params->dilation_height_factor, params->dilation_width_factor,
+        input->dims->data[1], input->dims->data[2], filter->dims->data[1],
+        filter->dims->data[2], params->padding, &unused_height, &unused_width);
+
+    data->multiplier = static_cast<int32_t*>(context->AllocatePersistentBuffer(
+        context, channels * sizeof(int32_t)));
+    data->shift = static_cast<int32_t*>(context->AllocatePersistentBuffer(
+        context, channels * sizeof(int32_t)));
+    if (data->multiplier == nullptr || data->shift == nullptr) {
+      return kTfLiteError;
+    }
+
+    int32_t unused_multiplier;
+    int unused_shift;
+    TF_LITE_ENSURE_STATUS(tflite::PopulateConvolutionQuantizationParams(
+        context, input, filter, bias, output, params->activation,
+        &unused_multiplier, &unused_shift, &data->activation_min,
+        &data->activation_max, data->multiplier,
+        reinterpret_cast<int*>(data->shift), channels));
+
+    data->input_offset = -input->params.zero_point;
+    data->output_offset = output->params.zero_point;
+
+    // Unfused node is one strip that writes output directly
+    data->strip_rows = data->cached ? output->dims->data[1] : data->pool;
+    data->strip_buffer_index = -1;
+    if (!data->cached) {
+      TF_LITE_ENSURE_STATUS(context->RequestScratchBufferInArena(
+          context, data->pool * data->cols * channels,
+          &data->strip_buffer_index));
+    }
+
+    data->im2col_buffer_index = -1;
+#ifdef CMSIS_NN
+    StripDims(data, params, input->dims, filter->dims);
+    data->candidates = Candidates(data);
+    data->slot = ConvTuning::Slot();
+    data->kernel = ConvTuning::Choice(data->slot, data->candidates);
+
+    // Calibration needs scratch of the kernel that needs most
+    int32_t im2col_size = 0;
+    for (int k = 0; k < ConvTuning::kKernels; k++) {
+      const ConvTuning::Kernel kernel = static_cast<ConvTuning::Kernel>(k);
+      if ((data->candidates & (1u << k)) &&
+          (ConvTuning::calibrating() || kernel == data->kernel)) {
+        const int32_t size = BufferSize(data, kernel);
+        im2col_size = size > im2col_size ? size : im2col_size;
+      }
+    }
+    if (im2col_size > 0) {
+      TF_LITE_ENSURE_STATUS(context->RequestScratchBufferInArena(
+          context, im2col_size, &data->im2col_buffer_index));
+    }
+#endif
+    return kTfLiteOk;
+  }
+
+  static TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+
+    if (data->pool == 1 && !data->cached) {
+      node->user_data = data->generic_data;
+      TfLiteStatus status = Generic()->invoke(context, node);
+      node->user_data = data;
+      return status;
+    }
+
+#ifdef CMSIS_NN
+    if (ConvTuning::calibrating()) {
+      return Calibrate(context, node, data);
+    }
+#endif
+    return Convolve(context, node, data);
+  }
+
+  static TfLiteStatus Convolve(TfLiteContext* context, TfLiteNode* node,
+                               OpData* data) {
+    const TfLiteEvalTensor* input = tflite::micro::GetEvalInput(context, node, 0);
+    const TfLiteEvalTensor* filter =
+        tflite::micro::GetEvalInput(context, node, 1);
+    const TfLiteEvalTensor* bias =
+        node->inputs->size > 2 ? tflite::micro::GetEvalInput(context, node, 2)
+                               : nullptr;
+    TfLiteEvalTensor* output = tflite::micro::GetEvalOutput(context, node, 0);
+    const TfLiteConvParams* params =
+        static_cast<const TfLiteConvParams*>(node->builtin_data);
+    void* im2col = data->im2col_buffer_index >= 0
+                       ? context->GetScratchBuffer(context,
+                                                   data->im2col_buffer_index)
+                       : nullptr;
+
+    if (data->cached) {
+      return ConvStrip(data, params, input, filter, bias, 0, im2col,
+                       tflite::micro::GetTensorData<int8_t>(output));
+    }
+    int8_t* strip = static_cast<int8_t*>(
+        context->GetScratchBuffer(context, data->strip_buffer_index));
+
+    const int pool = data->pool;
+    const int channels = data->channels;
+    const int row_size = data->cols * channels;
+    const int out_rows = output->dims->data[1];
+    const int out_cols = output->dims->data[2];
+    int8_t* out = tflite::micro::GetTensorData<int8_t>(output);
+
+    for (int py = 0; py < out_rows; py++) {
+      TF_LITE_ENSURE_STATUS(ConvStrip(data, params, input, filter, bias,
+                                      py * pool, im2col, strip));
+
+      // Pool rows and columns that do not fill a window are dropped, the
+      // same as VALID MaxPool2D does
+      for (int px = 0; px < out_cols; px++) {
+        for (int c = 0; c < channels; c++) {
+          int8_t max = strip[px * pool * channels + c];
+          for (int i = 0; i < pool; i++) {
+            const int8_t* src = strip + i * row_size + px * pool * channels + c;
+            for (int j = 0; j < pool; j++) {
+              if (src[j * channels] > max) max = src[j * channels];
+            }
+          }
+          *out++ = max;
+        }
+      }
+    }
+    return kTfLiteOk;
+  }
+
+  // Input rows that strip of convolution rows from first_row reads.
+  // Rows above the input become top padding of the strip, rows below it
+  // are cut off, kernels pad them the same way.
+  static void StripInput(const OpData* data, const TfLiteConvParams* params,
+                         int input_rows, int filter_rows, int first_row,
+                         int* start, int* count, int* pad_top) {
+    const int top = first_row * params->stride_height - data->padding.height;
+    const int span = (data->strip_rows - 1) * params->stride_height +
+                     (filter_rows - 1) * params->dilation_height_factor + 1;
+    *pad_top = top < 0 ? -top : 0;
+    *start = top < 0 ? 0 : top;
+    *count = span - *pad_top;
+    if (*count > input_rows - *start) {
+      *count = input_rows - *start;
+    }
+  }
+
+#ifdef CMSIS_NN
+  // Times every kernel the node is eligible for, output of the last run
+  // is the output of the node, all of them give the same
+  static TfLiteStatus Calibrate(TfLiteContext* context, TfLiteNode* node,
+                                OpData* data) {
+    ConvTuning::Kernel fastest = ConvTuning::kWrapper;
+    uint32_t best = UINT32_MAX;
+    for (int k = 0; k < ConvTuning::kKernels; k++) {
+      if (!(data->candidates & (1u << k))) {
+        continue;
+      }
+      data->kernel = static_cast<ConvTuning::Kernel>(k);
+      uint32_t cycles = UINT32_MAX;
+      for (int run = 0; run < 2; run++) {
+        const uint32_t start = ConvTuning::cycles();
+        TF_LITE_ENSURE_STATUS(Convolve(context, node, data));
+        const uint32_t elapsed = ConvTuning::cycles() - start;
+        cycles = elapsed < cycles ? elapsed : cycles;
+      }
+      ConvTuning::Record(data->slot, data->kernel, cycles);
+      if (cycles < best) {
+        best = cycles;
+        fastest = data->kernel;
+      }
+    }
+    data->kernel = fastest;
+    ConvTuning::Choose(data->slot, fastest);
+    return kTfLiteOk;
+  }
+
+  // Same rules as arm_convolve_wrapper_s8() uses, on the first strip.
+  // Later strips only differ in top padding, which 1x1 and 1xN filters do
+  // not have.
+  static uint32_t Candidates(const OpData* data) {
+    const cmsis_nn_conv_params* conv = &data->conv_params;
+    const cmsis_nn_dims* in = &data->input_dims;
+    const cmsis_nn_dims* f = &data->filter_dims;
+    uint32_t candidates = 1u << ConvTuning::kWrapper;
+    if (conv->dilation.w != 1 || conv->dilation.h != 1) {
+      return candidates;
+    }
+    candidates |= 1u << ConvTuning::kGeneric;
+    if (f->w == 1 && f->h == 1 && conv->padding.w == 0 &&
+        conv->padding.h == 0 && conv->stride.w == 1 && conv->stride.h == 1 &&
+        in->c % 4 == 0) {
+      candidates |= 1u << ConvTuning::kFast1x1;
+    }
+    if (in->n == 1 && in->h == 1 && f->h == 1 && data->strip_dims.w % 4 == 0) {
+      candidates |= 1u << ConvTuning::k1xN;
+    }
+    return candidates;
+  }
+
+  static int32_t BufferSize(const OpData* data, ConvTuning::Kernel kernel) {
+    switch (kernel) {
+      case ConvTuning::kGeneric:
+        return arm_convolve_s8_get_buffer_size(&data->input_dims,
+                                               &data->filter_dims);
+      case ConvTuning::kFast1x1:
+        return arm_convolve_1x1_s8_fast_get_buffer_size(&data->input_dims);
+      case ConvTuning::k1xN:
+        return arm_convolve_1_x_n_s8_get_buffer_size(&data->input_dims,
+                                                     &data->filter_dims);
+      default:
+        return arm_convolve_wrapper_s8_get_buffer_size(
+            &data->conv_params, &data->input_dims, &data->filter_dims,
+            &data->strip_dims);
+    }
+  }
+
+  static arm_status RunKernel(OpData* data, const cmsis_nn_context* ctx,
+                           const int8_t* input, const int8_t* filter,
+                           const int32_t* bias, int8_t* output) {
+    typedef arm_status (*KernelFunction)(
+        const cmsis_nn_context*, const cmsis_nn_conv_params*,
+        const cmsis_nn_per_channel_quant_params*, const cmsis_nn_dims*,
+        const int8_t*, const cmsis_nn_dims*, const int8_t*,
+        const cmsis_nn_dims*, const int32_t*, const cmsis_nn_dims*, int8_t*);
+    static const KernelFunction kernels[ConvTuning::kKernels] = {
+        arm_convolve_wrapper_s8, arm_convolve_s8, arm_convolve_1x1_s8_fast,
+        arm_convolve_1_x_n_s8};
+    return kernels[data->kernel](ctx, &data->conv_params, &data->quant_params,
+                                 &data->input_dims, input, &data->filter_dims,
+                                 filter, &data->bias_dims, bias,
+                                 &data->strip_dims, output);
+  }
+
+  // Fills parameters of the first strip, later strips only differ in top
+  // padding and input rows
+  static void StripDims(OpData* data, const TfLiteConvParams* params,
+                        const TfLiteIntArray* in, const TfLiteIntArray* f) {
+    int start;
+    int count;
+    int pad_top;
+    StripInput(data, params, in->data[1], f->data[1], 0, &start, &count,
+               &pad_top);
+
+    cmsis_nn_conv_params* conv_params = &data->conv_params;
+    cmsis_nn_dims* input_dims = &data->input_dims;
+    cmsis_nn_dims* filter_dims = &data->filter_dims;
+    cmsis_nn_dims* strip_dims = &data->strip_dims;
+    conv_params->input_offset = data->input_offset;
+    conv_params->output_offset = data->output_offset;
+    conv_params->stride.h = params->stride_height;
+    conv_params->stride.w = params->stride_width;
+    conv_params->padding.h = pad_top;
+    conv_params->padding.w = data->padding.width;
+    conv_params->dilation.h = params->dilation_height_factor;
+    conv_params->dilation.w = params->dilation_width_factor;
+    conv_params->activation.min = data->activation_min;
+    conv_params->activation.max = data->activation_max;
+
+    input_dims->n = 1;
+    input_dims->h = count;
+    input_dims->w = in->data[2];
+    input_dims->c = in->data[3];
+    filter_dims->n = f->data[0];
+    filter_dims->h = f->data[1];
+    filter_dims->w = f->data[2];
+    filter_dims->c = f->data[3];
+    strip_dims->n = 1;
+    strip_dims->h = data->strip_rows;
+    strip_dims->w = data->cols;
+    strip_dims->c = data->channels;
+    data->bias_dims = {1, 1, 1, data->channels};
+    data->quant_params = {data->multiplier, data->shift};
+  }
+#endif
+
+  // Writes strip of convolution rows from first_row
+  static TfLiteStatus ConvStrip(OpData* data,
+                                const TfLiteConvParams* params,
+                                const TfLiteEvalTensor* input,
+                                const TfLiteEvalTensor* filter,
+                                const TfLiteEvalTensor* bias, int first_row,
+                                void* im2col, int8_t* strip) {
+    const TfLiteIntArray* in = input->dims;
+    const TfLiteIntArray* f = filter->dims;
+    int start;
+    int count;
+    int pad_top;
+    StripInput(data, params, in->data[1], f->data[1], first_row, &start,
+               &count, &pad_top);
+    const int8_t* input_data = tflite::micro::GetTensorData<int8_t>(input) +
+                               start * in->data[2] * in->data[3];
+    const int32_t* bias_data =
+        bias ? tflite::micro::GetTensorData<int32_t>(bias) : nullptr;
+
+#ifdef CMSIS_NN
+    data->conv_params.padding.h = pad_top;
+    data->input_dims.h = count;
+    cmsis_nn_context ctx = {im2col, 0};
+
+    if (RunKernel(data, &ctx, input_data,
+               tflite::micro::GetTensorData<int8_t>(filter), bias_data,
+               strip) != ARM_MATH_SUCCESS) {
+      return kTfLiteError;
+    }
+#else
+    (void) im2col;
+    tflite::ConvParams op_params;
+    op_params.padding_type = tflite::PaddingType::kSame;
+    op_params.padding_values.height = pad_top;
+    op_params.padding_values.width = data->padding.width;
+    op_params.stride_height = params->stride_height;
+    op_params.stride_width = params->stride_width;
+    op_params.dilation_height_factor = params->dilation_height_factor;
+    op_params.dilation_width_factor = params->dilation_width_factor;
+    op_params.input_offset = data->input_offset;
+    op_params.output_offset = data->output_offset;
+    op_params.quantized_activation_min = data->activation_min;
+    op_params.quantized_activation_max = data->activation_max;
+
+    tflite::reference_integer_ops::ConvPerChannel(
+        op_params, data->multiplier, data->shift,
+        tflite::RuntimeShape({1, count, in->data[2], in->data[3]}),
+        input_data, tflite::micro::GetTensorShape(filter),
+        tflite::micro::GetTensorData<int8_t>(filter),
+        tflite::RuntimeShape({data->channels}), bias_data,
+        tflite::RuntimeShape({1, data->strip_rows, data->cols,
+                              data->channels}),
+        strip);
+#endif
+    return kTfLiteOk;
+  }
+
+  const tflite::MicroOpResolver& base_;
+  mutable TfLiteRegistration registration_;
+
+  static const TfLiteRegistration*& Generic() {
+    static const TfLiteRegistration* generic = nullptr;
+    return generic;
+  }
+};
+
+#endif  // CONV_POOL_FUSED_H
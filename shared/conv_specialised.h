@@ -0,0 +1,483 @@
+#ifndef CONV_SPECIALISED_H
+#define CONV_SPECIALISED_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "tensorflow/lite/c/builtin_op_data.h"
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/kernels/internal/common.h"
+#include "tensorflow/lite/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/micro_op_resolver.h"
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#include "cmsis_gcc.h"
+#define CONV_SPECIALISED_SIMD
+#endif
+
+// Conv2D kernel specialised for single channel input of fixed size.
+//
+// First layer of our thermal models convolves 60x80x1 frame with 3x4
+// filter, SAME padding and stride 1. It is the hottest operator in the
+// profile, generic CMSIS-NN path does im2col for it on every call.
+// Specialised kernel knows all dimensions at compile time: it keeps
+// KH padded input rows as int16, loads the filter window once per pixel
+// and does multiply accumulate over output channels with two pixels per
+// SMLAD instruction.
+//
+// Conv2D fused with KxK max pool by fuse_conv_pool.py has output of
+// kRows/K x kCols/K. Kernel then computes K conv rows into a scratch strip
+// and writes their KxK maximum, so the full resolution tensor, which was
+// most of the arena, is never stored. Fused nodes of other dimensions need
+// Conv2DPoolResolver of conv_pool_fused.h below this one.
+//
+// Resolver wraps the project resolver and only replaces Conv2D
+// registration. Specialised kernel is used for nodes that match template
+// dimensions, all other Conv2D nodes run through the original kernel.
+//
+// Input can also be convolved while it is still arriving, look at
+// ConvRowStream below.
+//
+// Usage example:
+// static Conv2DPoolResolver pool_resolver(engine.resolver());
+// static Conv2DSpecialisedResolver<kNumRows, kNumCols, 3, 4>
+//     conv_resolver(pool_resolver);
+// engine.SetResolver(&conv_resolver);
+// engine.Setup(model_data, error_reporter);
+
+// Rows of an input tensor that are written while Invoke() already runs,
+// for example by capture DMA interrupt.
+struct ConvRowSource {
+  // Tensor data the rows are written into, only node with this input
+  // streams
+  const void* data;
+  // Returns number of complete rows from the top and sets frame to the
+  // frame they belong to, frame changes when writer starts over. Negative
+  // if no more rows will come.
+  int (*ready)(uint32_t* frame);
+  // Sleeps until more rows may be ready
+  void (*wait)();
+};
+
+// Specialised node whose input is source data waits before each conv row,
+// or each pooled row, only until input rows under its filter are ready,
+// so first layer runs between packets instead of after the whole frame.
+// When frame changes under it, node starts over from row 0 of the new
+// one. Frame that was convolved is kept for the caller, who has to check
+// that the input is still this frame after Invoke(), rows of the next one
+// may have been written meanwhile.
+class ConvRowStream {
+ public:
+  // Source stays in use until it is set to nullptr
+  static void Set(const ConvRowSource* source) {
+    source_() = source;
+    streamed_() = false;
+  }
+  static const ConvRowSource* source() { return source_(); }
+
+  // True and frame of the last node that streamed, since Set()
+  static bool streamed(uint32_t* frame) {
+    *frame = frame_();
+    return streamed_();
+  }
+  static void Done(uint32_t frame) {
+    frame_() = frame;
+    streamed_() = true;
+  }
+
+ private:
+  // Function local statics, so header is enough without a definition file
+  static const ConvRowSource*& source_() {
+    static const ConvRowSource* source = nullptr;
+    return source;
+  }
+  static uint32_t& frame_() {
+    static uint32_t frame = 0;
+    return frame;
+  }
+  static bool& streamed_() {
+    static bool streamed = false;
+    return streamed;
+  }
+};
+
+template <int kRows, int kCols, int kKernelH, int kKernelW>
+class Conv2DSpecialisedResolver : public tflite::MicroOpResolver {
+ public:
+  explicit Conv2DSpecialisedResolver(const tflite::MicroOpResolver& base)
+      : base_(base) {}
+
+  const TfLiteRegistration* FindOp(tflite::BuiltinOperator op) const override {
+    const TfLiteRegistration* registration = base_.FindOp(op);
+    if (op != tflite::BuiltinOperator_CONV_2D || registration == nullptr) {
+      return registration;
+    }
+
+    // Keep builtin code and version, so profiler still reports CONV_2D
+    generic_ = registration;
+    registration_ = *registration;
+    registration_.init = Init;
+    registration_.free = nullptr;
+    registration_.prepare = Prepare;
+    registration_.invoke = Eval;
+    return &registration_;
+  }
+
+  const TfLiteRegistration* FindOp(const char* op) const override {
+    return base_.FindOp(op);
+  }
+
+  BuiltinParseFunction GetOpDataParser(
+      tflite::BuiltinOperator op) const override {
+    return base_.GetOpDataParser(op);
+  }
+
+ private:
+  // Filter width rounded up to pairs of int16, extra weight is zero
+  static constexpr int kKernelWPadded = (kKernelW + 1) & ~1;
+  static constexpr int kPairs = kKernelWPadded / 2;
+  static constexpr int kPadTop = (kKernelH - 1) / 2;
+  static constexpr int kPadLeft = (kKernelW - 1) / 2;
+  static constexpr int kRowLength = kCols + kKernelWPadded - 1;
+  static constexpr int kWindow = kKernelH * kKernelWPadded;
+
+  struct OpData {
+    void* generic_data;
+    bool specialised;
+    int channels;
+    int32_t input_offset;
+    int32_t output_offset;
+    int32_t activation_min;
+    int32_t activation_max;
+    int32_t* multiplier;
+    int32_t* shift;
+    int16_t* weights;       // kWindow weights per output channel
+    int rows_buffer_index;  // kKernelH padded input rows
+    int pool;               // K of fused KxK max pool, 1 if not fused
+    int strip_buffer_index; // K conv output rows of fused node
+  };
+
+  static void* Init(TfLiteContext* context, const char* buffer,
+                    size_t length) {
+    OpData* data = static_cast<OpData*>(
+        context->AllocatePersistentBuffer(context, sizeof(OpData)));
+    if (data == nullptr) {
+      return nullptr;
+    }
+    data->generic_data = generic_->init
+                             ? generic_->init(context, buffer, length)
+                             : nullptr;
+    data->specialised = false;
+    return data;
+  }
+
+  static TfLiteStatus Prepare(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+
+    const TfLiteTensor* input = tflite::GetInput(context, node, 0);
+    const TfLiteTensor* filter = tflite::GetInput(context, node, 1);
+    const TfLiteTensor* bias = tflite::GetOptionalInputTensor(context, node, 2);
+    TfLiteTensor* output = tflite::GetOutput(context, node, 0);
+    const TfLiteConvParams* params =
+        static_cast<const TfLiteConvParams*>(node->builtin_data);
+
+    // Generic kernel is only prepared for nodes we do not handle, so its
+    // scratch buffers are not requested for nothing
+    const int pool = PoolFactor(input, filter, output, params);
+    if (pool == 0) {
+      node->user_data = data->generic_data;
+      TfLiteStatus status =
+          generic_->prepare ? generic_->prepare(context, node) : kTfLiteOk;
+      node->user_data = data;
+      return status;
+    }
+
+    const int channels = filter->dims->data[0];
+    data->channels = channels;
+    data->multiplier = static_cast<int32_t*>(context->AllocatePersistentBuffer(
+        context, channels * sizeof(int32_t)));
+    data->shift = static_cast<int32_t*>(context->AllocatePersistentBuffer(
+        context, channels * sizeof(int32_t)));
+    data->weights = static_cast<int16_t*>(context->AllocatePersistentBuffer(
+        context, channels * kWindow * sizeof(int16_t)));
+    if (data->multiplier == nullptr || data->shift == nullptr ||
+        data->weights == nullptr) {
+      return kTfLiteError;
+    }
+
+    int32_t unused_multiplier;
+    int unused_shift;
+    TF_LITE_ENSURE_STATUS(tflite::PopulateConvolutionQuantizationParams(
+        context, input, filter, bias, output, params->activation,
+        &unused_multiplier, &unused_shift, &data->activation_min,
+        &data->activation_max, data->multiplier,
+        reinterpret_cast<int*>(data->shift), channels));
+
+    data->input_offset = -input->params.zero_point;
+    data->output_offset = output->params.zero_point;
+
+    // Filter is [channels][kKernelH][kKernelW][1], widen it once here
+    const int8_t* filter_data = filter->data.int8;
+    for (int c = 0; c < channels; c++) {
+      for (int kh = 0; kh < kKernelH; kh++) {
+        for (int kw = 0; kw < kKernelWPadded; kw++) {
+          data->weights[c * kWindow + kh * kKernelWPadded + kw] =
+              kw < kKernelW
+                  ? filter_data[(c * kKernelH + kh) * kKernelW + kw]
+                  : 0;
+        }
+      }
+    }
+
+    TF_LITE_ENSURE_STATUS(context->RequestScratchBufferInArena(
+        context, kKernelH * kRowLength * sizeof(int16_t),
+        &data->rows_buffer_index));
+    data->pool = pool;
+    if (pool > 1) {
+      TF_LITE_ENSURE_STATUS(context->RequestScratchBufferInArena(
+          context, pool * kCols * channels, &data->strip_buffer_index));
+    }
+
+    data->specialised = true;
+    return kTfLiteOk;
+  }
+
+  static TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+
+    if (!data->specialised) {
+      node->user_data = data->generic_data;
+      TfLiteStatus status = generic_->invoke(context, node);
+      node->user_data = data;
+      return status;
+    }
+
+    const TfLiteEvalTensor* input = tflite::micro::GetEvalInput(context, node, 0);
+    const TfLiteEvalTensor* bias =
+        node->inputs->size > 2 ? tflite::micro::GetEvalInput(context, node, 2)
+                               : nullptr;
+    TfLiteEvalTensor* output = tflite::micro::GetEvalOutput(context, node, 0);
+    int16_t* rows = static_cast<int16_t*>(
+        context->GetScratchBuffer(context, data->rows_buffer_index));
+    const int8_t* input_data = tflite::micro::GetTensorData<int8_t>(input);
+    const int32_t* bias_data =
+        bias ? tflite::micro::GetTensorData<int32_t>(bias) : nullptr;
+    int8_t* output_data = tflite::micro::GetTensorData<int8_t>(output);
+
+    int8_t* strip =
+        data->pool > 1 ? static_cast<int8_t*>(context->GetScratchBuffer(
+                             context, data->strip_buffer_index))
+                       : nullptr;
+
+    const ConvRowSource* source = ConvRowStream::source();
+    if (source != nullptr && source->data == input_data) {
+      return RunStreamed(data, source, input_data, bias_data, output_data, rows,
+                         strip);
+    }
+
+    for (int py = 0; py < kRows / data->pool; py++) {
+      RunOutputRow(data, input_data, bias_data, py, rows, strip, output_data);
+    }
+    return kTfLiteOk;
+  }
+
+  // Output row py of a node that is pooled or not
+  static void RunOutputRow(const OpData* data, const int8_t* input,
+                           const int32_t* bias, int py, int16_t* rows,
+                           int8_t* strip, int8_t* output) {
+    const int row_size = (kCols / data->pool) * data->channels;
+    if (data->pool > 1) {
+      RunPooled(data, input, bias, py, rows, strip, output + py * row_size);
+    } else {
+      RunRow(data, input, bias, py, rows, output + py * row_size);
+    }
+  }
+
+  // Output rows are computed as soon as input rows under them are ready.
+  // Row that was computed while writer started over may mix two frames,
+  // so frame is checked again after each one.
+  static TfLiteStatus RunStreamed(const OpData* data,
+                                  const ConvRowSource* source,
+                                  const int8_t* input, const int32_t* bias,
+                                  int8_t* output, int16_t* rows,
+                                  int8_t* strip) {
+    const int pool = data->pool;
+    uint32_t frame;
+    uint32_t now;
+    if (source->ready(&frame) < 0) {
+      return kTfLiteError;
+    }
+
+    for (int py = 0; py < kRows / pool;) {
+      // Last conv row of the output row needs kKernelH - 1 - kPadTop below
+      int needed = (py + 1) * pool + kKernelH - 1 - kPadTop;
+      if (needed > kRows) needed = kRows;
+
+      int ready;
+      while ((ready = source->ready(&now)) >= 0 && now == frame &&
+             ready < needed) {
+        source->wait();
+      }
+      if (ready < 0) {
+        return kTfLiteError;
+      }
+      if (now == frame) {
+        RunOutputRow(data, input, bias, py, rows, strip, output);
+        if (source->ready(&now) < 0) {
+          return kTfLiteError;
+        }
+      }
+      if (now != frame) {
+        frame = now;
+        py = 0;
+        continue;
+      }
+      py++;
+    }
+
+    ConvRowStream::Done(frame);
+    return kTfLiteOk;
+  }
+
+  // Returns 1 for node of template dimensions, K if its output is pooled
+  // KxK, 0 if specialised kernel does not handle it
+  static int PoolFactor(const TfLiteTensor* input, const TfLiteTensor* filter,
+                        const TfLiteTensor* output,
+                        const TfLiteConvParams* params) {
+    if (input->type != kTfLiteInt8 || filter->type != kTfLiteInt8 ||
+        output->type != kTfLiteInt8) {
+      return 0;
+    }
+    if (params->padding != kTfLitePaddingSame || params->stride_width != 1 ||
+        params->stride_height != 1 || params->dilation_width_factor != 1 ||
+        params->dilation_height_factor != 1) {
+      return 0;
+    }
+
+    const TfLiteIntArray* in = input->dims;
+    const TfLiteIntArray* f = filter->dims;
+    const TfLiteIntArray* out = output->dims;
+    if (!(in->size == 4 && in->data[0] == 1 && in->data[1] == kRows &&
+          in->data[2] == kCols && in->data[3] == 1 && f->size == 4 &&
+          f->data[1] == kKernelH && f->data[2] == kKernelW &&
+          f->data[3] == 1 && out->size == 4 && out->data[1] > 0 &&
+          out->data[3] == f->data[0] &&
+          filter->quantization.type == kTfLiteAffineQuantization)) {
+      return 0;
+    }
+
+    const int pool = kRows / out->data[1];
+    return out->data[1] * pool == kRows && out->data[2] * pool == kCols
+               ? pool
+               : 0;
+  }
+
+  // Fills padded row, positions outside of frame get zero, which is the
+  // same as zero point of the input after offset is added.
+  static void LoadRow(const int8_t* input, int row, int32_t input_offset,
+                      int16_t* dst) {
+    memset(dst, 0, kRowLength * sizeof(int16_t));
+    if (row < 0 || row >= kRows) {
+      return;
+    }
+
+    const int8_t* src = input + row * kCols;
+    for (int x = 0; x < kCols; x++) {
+      dst[kPadLeft + x] = src[x] + input_offset;
+    }
+  }
+
+  // Writes kCols x channels outputs of conv row y
+  static void RunRow(const OpData* data, const int8_t* input,
+                     const int32_t* bias, int y, int16_t* rows,
+                     int8_t* output) {
+    const int channels = data->channels;
+
+    for (int kh = 0; kh < kKernelH; kh++) {
+      LoadRow(input, y + kh - kPadTop, data->input_offset,
+              rows + kh * kRowLength);
+    }
+
+    for (int x = 0; x < kCols; x++) {
+#ifdef CONV_SPECIALISED_SIMD
+      // Window is loaded once and reused for every output channel
+      uint32_t window[kKernelH * kPairs];
+      for (int kh = 0; kh < kKernelH; kh++) {
+        for (int p = 0; p < kPairs; p++) {
+          memcpy(&window[kh * kPairs + p],
+                 rows + kh * kRowLength + x + 2 * p, 4);
+        }
+      }
+#endif
+      for (int c = 0; c < channels; c++) {
+        const int16_t* w = data->weights + c * kWindow;
+        int32_t acc = bias ? bias[c] : 0;
+
+#ifdef CONV_SPECIALISED_SIMD
+        for (int i = 0; i < kKernelH * kPairs; i++) {
+          uint32_t weights;
+          memcpy(&weights, w + 2 * i, 4);
+          acc = __SMLAD(window[i], weights, acc);
+        }
+#else
+        for (int kh = 0; kh < kKernelH; kh++) {
+          const int16_t* row = rows + kh * kRowLength + x;
+          for (int kw = 0; kw < kKernelWPadded; kw++) {
+            acc += row[kw] * w[kh * kKernelWPadded + kw];
+          }
+        }
+#endif
+        acc = tflite::MultiplyByQuantizedMultiplier(acc, data->multiplier[c],
+                                                    data->shift[c]);
+        acc += data->output_offset;
+        if (acc < data->activation_min) acc = data->activation_min;
+        if (acc > data->activation_max) acc = data->activation_max;
+        *output++ = static_cast<int8_t>(acc);
+      }
+    }
+  }
+
+  // Pooled row needs K conv rows, they are computed into the strip one
+  // after another and reduced with max, which is exact for int8 because
+  // fused pool has the same quantization as the conv output.
+  static void RunPooled(const OpData* data, const int8_t* input,
+                        const int32_t* bias, int py, int16_t* rows,
+                        int8_t* strip, int8_t* output) {
+    const int pool = data->pool;
+    const int channels = data->channels;
+    const int row_size = kCols * channels;
+
+    for (int i = 0; i < pool; i++) {
+      RunRow(data, input, bias, py * pool + i, rows, strip + i * row_size);
+    }
+
+    for (int px = 0; px < kCols / pool; px++) {
+      for (int c = 0; c < channels; c++) {
+        int8_t max = strip[px * pool * channels + c];
+        for (int i = 0; i < pool; i++) {
+          const int8_t* src = strip + i * row_size + px * pool * channels + c;
+          for (int j = 0; j < pool; j++) {
+            if (src[j * channels] > max) max = src[j * channels];
+          }
+        }
+        *output++ = max;
+      }
+    }
+  }
+
+  const tflite::MicroOpResolver& base_;
+  mutable TfLiteRegistration registration_;
+
+  // Kernel callbacks are plain functions, so they reach original
+  // registration through a static member, one per specialisation.
+  static const TfLiteRegistration* generic_;
+};
+
+template <int kRows, int kCols, int kKernelH, int kKernelW>
+const TfLiteRegistration*
+    Conv2DSpecialisedResolver<kRows, kCols, kKernelH, kKernelW>::generic_ =
+        nullptr;
+
+#endif  // CONV_SPECIALISED_H
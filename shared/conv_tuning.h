@@ -0,0 +1,139 @@
+#ifndef CONV_TUNING_H
+#define CONV_TUNING_H
+
+#include <stdint.h>
+
+// CMSIS-NN kernel of each Conv2D node, chosen by timing on the device.
+//
+// arm_convolve_wrapper_s8() picks 1x1 fast, 1xN or the generic kernel by
+// static rules on the shape. Which one is really the fastest also depends
+// on clock, flash wait states and caches, so Conv2DPoolResolver can time
+// every kernel a node is eligible for during one calibration Invoke() and
+// keep the fastest. Kernels give exactly the same output, a choice only
+// changes speed.
+//
+// Choices are 2 bits per node, in the order Conv2D nodes on the CMSIS-NN
+// path are prepared, which is fixed for a model. Packed() gives them as
+// one word to persist, Load() of that word before a later Setup() applies
+// them without timing. Application keeps track of the model and clock
+// they were tuned for. Stored kernel that a node can not use, and nodes
+// after kMaxSlots, fall back to the wrapper.
+//
+// Calibration Setup() requests scratch for every eligible kernel, set the
+// model up again after it, so only the chosen kernel keeps its scratch.
+//
+// Usage example:
+// ConvTuning::Calibrate(read_cycles);
+// engine.Setup(model_data, error_reporter);
+// engine.interpreter()->Invoke();
+// ConvTuning::Calibrate(nullptr);
+// store(ConvTuning::Packed());
+// ...
+// ConvTuning::Load(stored);
+// engine.Setup(model_data, error_reporter);
+
+class ConvTuning {
+ public:
+  enum Kernel {
+    kWrapper = 0,   // arm_convolve_wrapper_s8(), rules of CMSIS-NN
+    kGeneric = 1,   // arm_convolve_s8()
+    kFast1x1 = 2,   // arm_convolve_1x1_s8_fast()
+    k1xN = 3,       // arm_convolve_1_x_n_s8()
+    kKernels = 4,
+  };
+
+  static constexpr int kMaxSlots = 16;
+
+  // Applies choices of Packed() to the next Setup()
+  static void Load(uint32_t packed) {
+    State& state = Get();
+    state.choices = packed;
+    state.prepared = 0;
+  }
+
+  // Times kernels of next Setup() and Invoke() with cycles, nullptr stops
+  static void Calibrate(uint32_t (*cycles)()) {
+    State& state = Get();
+    state.cycles = cycles;
+    if (cycles != nullptr) {
+      state.choices = 0;
+      state.prepared = 0;
+      for (int i = 0; i < kMaxSlots; i++) {
+        for (int k = 0; k < kKernels; k++) {
+          state.measured[i][k] = 0;
+        }
+      }
+    }
+  }
+
+  static bool calibrating() { return Get().cycles != nullptr; }
+  static uint32_t cycles() { return Get().cycles(); }
+  static uint32_t Packed() { return Get().choices; }
+
+  // Nodes prepared since Load() or Calibrate()
+  static int slots() {
+    const int prepared = Get().prepared;
+    return prepared < kMaxSlots ? prepared : kMaxSlots;
+  }
+
+  // Slot of the node being prepared, -1 if there are too many
+  static int Slot() {
+    const int slot = Get().prepared++;
+    return slot < kMaxSlots ? slot : -1;
+  }
+
+  // Kernel of slot, candidates has bit of each kernel the node can use
+  static Kernel Choice(int slot, uint32_t candidates) {
+    if (slot < 0) {
+      return kWrapper;
+    }
+    const uint32_t kernel = (Get().choices >> (2 * slot)) & 3u;
+    return candidates & (1u << kernel) ? static_cast<Kernel>(kernel)
+                                       : kWrapper;
+  }
+
+  // Keeps cycles of a calibration run, 0 for kernels that were not timed
+  static void Record(int slot, Kernel kernel, uint32_t cycles) {
+    if (slot >= 0) {
+      Get().measured[slot][kernel] = cycles;
+    }
+  }
+
+  static void Choose(int slot, Kernel kernel) {
+    if (slot >= 0) {
+      State& state = Get();
+      state.choices &= ~(3u << (2 * slot));
+      state.choices |= static_cast<uint32_t>(kernel) << (2 * slot);
+    }
+  }
+
+  static Kernel chosen(int slot) {
+    return static_cast<Kernel>((Get().choices >> (2 * slot)) & 3u);
+  }
+
+  static uint32_t measured(int slot, Kernel kernel) {
+    return Get().measured[slot][kernel];
+  }
+
+  static const char* Name(Kernel kernel) {
+    static const char* const names[kKernels] = {"wrapper", "generic",
+                                                "1x1_fast", "1xN"};
+    return names[kernel];
+  }
+
+ private:
+  struct State {
+    uint32_t (*cycles)();
+    uint32_t choices;
+    int prepared;
+    uint32_t measured[kMaxSlots][kKernels];
+  };
+
+  // Function-local static, header works with C++11 too
+  static State& Get() {
+    static State state = {};
+    return state;
+  }
+};
+
+#endif  // CONV_TUNING_H
@@ -0,0 +1,401 @@
+#ifndef CONV_WINOGRAD_H
+#define CONV_WINOGRAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "tensorflow/lite/c/builtin_op_data.h"
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/kernels/internal/common.h"
+#include "tensorflow/lite/kernels/kernel_util.h"
+#include "tensorflow/lite/kernels/padding.h"
+#include "tensorflow/lite/micro/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/micro_op_resolver.h"
+
+#include "conv_pool_fused.h"
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#include "cmsis_gcc.h"
+#define CONV_WINOGRAD_SIMD
+#endif
+
+// Conv2D 3x3, stride 1, in Winograd domain F(2x2, 3x3).
+//
+// Each 2x2 tile of output comes from a 4x4 tile of input d and filter g
+// as Y = A' [U . V] A, U = G g G' and V = B' d B. Sum over input channels
+// is done on U . V, so a tile costs 16 multiplies per channel pair instead
+// of 36, 2.25 times fewer. Transforms of B and A only add and subtract.
+//
+// winograd_weights.py computes U offline with 2G, whose entries are
+// integers, so U is exact int16 and Y is exactly 4 times the int32
+// accumulator of direct convolution. Input is offset into int16 before V,
+// |V| <= 4 * 255. Script converts a layer only when the largest Y of any
+// input still fits int32, Prepare() checks it again, so every converted
+// layer gives bit exact results of the original kernel.
+//
+// Weights buffer holds "WGD2" and U as int16 [16][out channels][in
+// channels rounded up to even], which is 3.5 times the int8 filter. So
+// layers are selected when the model is converted, flash is traded for
+// Invoke time only where it pays off. Other Conv2D nodes run through the
+// original kernel.
+//
+// Fused 2x2 max pool of fuse_conv_pool.py is one output tile, it is
+// reduced right away and conv output is never stored.
+//
+// Usage example:
+// static Conv2DPoolResolver pool_resolver(engine.resolver());
+// static Conv2DWinogradResolver winograd_resolver(pool_resolver);
+// engine.SetResolver(&winograd_resolver);
+// engine.Setup(model_data, error_reporter);
+
+class Conv2DWinogradResolver : public tflite::MicroOpResolver {
+ public:
+  explicit Conv2DWinogradResolver(const tflite::MicroOpResolver& base)
+      : base_(base) {}
+
+  const TfLiteRegistration* FindOp(tflite::BuiltinOperator op) const override {
+    const TfLiteRegistration* registration = base_.FindOp(op);
+    if (op != tflite::BuiltinOperator_CONV_2D || registration == nullptr) {
+      return registration;
+    }
+
+    // Keep builtin code and version, so profiler still reports CONV_2D
+    Generic() = registration;
+    registration_ = *registration;
+    registration_.init = Init;
+    registration_.free = nullptr;
+    registration_.prepare = Prepare;
+    registration_.invoke = Eval;
+    return &registration_;
+  }
+
+  const TfLiteRegistration* FindOp(const char* op) const override {
+    return base_.FindOp(op);
+  }
+
+  BuiltinParseFunction GetOpDataParser(
+      tflite::BuiltinOperator op) const override {
+    return base_.GetOpDataParser(op);
+  }
+
+  // Returns true if weights were written by winograd_weights.py
+  static bool IsWinograd(const void* weights) {
+    return weights != nullptr && memcmp(weights, "WGD2", 4) == 0;
+  }
+
+ private:
+  static constexpr int kTile = 16;  // 4x4 values of a transformed tile
+  // Bound of |V|, 4 input values with offset, each at most 255
+  static constexpr int64_t kMaxInput = 4 * 255;
+
+  struct OpData {
+    void* generic_data;
+    bool winograd;
+    int pool;               // 2 if 2x2 max pool is fused, else 1
+    int in_channels;
+    int pairs;              // Input channels rounded up to even, / 2
+    int channels;
+    int rows;               // Convolution output, before pooling
+    int cols;
+    TfLitePaddingValues padding;
+    int32_t input_offset;
+    int32_t output_offset;
+    int32_t activation_min;
+    int32_t activation_max;
+    int32_t* multiplier;
+    int32_t* shift;
+    int tile_buffer_index;  // V of each input channel, int16
+    int sums_buffer_index;  // U . V of each output channel, int32
+  };
+
+  static void* Init(TfLiteContext* context, const char* buffer,
+                    size_t length) {
+    OpData* data = static_cast<OpData*>(
+        context->AllocatePersistentBuffer(context, sizeof(OpData)));
+    if (data == nullptr) {
+      return nullptr;
+    }
+    data->generic_data = Generic()->init
+                             ? Generic()->init(context, buffer, length)
+                             : nullptr;
+    data->winograd = false;
+    return data;
+  }
+
+  static TfLiteStatus Prepare(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+
+    const TfLiteTensor* input = tflite::GetInput(context, node, 0);
+    const TfLiteTensor* filter = tflite::GetInput(context, node, 1);
+    const TfLiteTensor* bias = tflite::GetOptionalInputTensor(context, node, 2);
+    TfLiteTensor* output = tflite::GetOutput(context, node, 0);
+    const TfLiteConvParams* params =
+        static_cast<const TfLiteConvParams*>(node->builtin_data);
+
+    data->winograd = IsWinograd(filter->data.raw);
+    if (!data->winograd) {
+      node->user_data = data->generic_data;
+      TfLiteStatus status =
+          Generic()->prepare ? Generic()->prepare(context, node) : kTfLiteOk;
+      node->user_data = data;
+      return status;
+    }
+
+    const TfLiteIntArray* in = input->dims;
+    const TfLiteIntArray* f = filter->dims;
+    data->pool = Conv2DPoolResolver::PoolFactor(input, filter, output, params);
+    if (input->type != kTfLiteInt8 || filter->type != kTfLiteInt8 ||
+        output->type != kTfLiteInt8 ||
+        filter->quantization.type != kTfLiteAffineQuantization ||
+        in->size != 4 || in->data[0] != 1 || f->size != 4 ||
+        f->data[1] != 3 || f->data[2] != 3 || params->stride_width != 1 ||
+        params->stride_height != 1 || params->dilation_width_factor != 1 ||
+        params->dilation_height_factor != 1 ||
+        (data->pool != 1 && data->pool != 2)) {
+      TF_LITE_KERNEL_LOG(context, "Winograd Conv2D needs int8 3x3 stride 1");
+      return kTfLiteError;
+    }
+
+    const int channels = f->data[0];
+    data->channels = channels;
+    data->in_channels = in->data[3];
+    data->pairs = (data->in_channels + 1) / 2;
+    data->rows = tflite::ComputeOutSize(params->padding, in->data[1], 3, 1, 1);
+    data->cols = tflite::ComputeOutSize(params->padding, in->data[2], 3, 1, 1);
+
+    int unused_height;
+    int unused_width;
+    data->padding = tflite::ComputePaddingHeightWidth(
+        1, 1, 1, 1, in->data[1], in->data[2], 3, 3, params->padding,
+        &unused_height, &unused_width);
+
+    if (!Exact(Weights(filter->data.raw), channels, data->pairs * 2)) {
+      TF_LITE_KERNEL_LOG(context, "Winograd Conv2D may overflow int32");
+      return kTfLiteError;
+    }
+
+    data->multiplier = static_cast<int32_t*>(context->AllocatePersistentBuffer(
+        context, channels * sizeof(int32_t)));
+    data->shift = static_cast<int32_t*>(context->AllocatePersistentBuffer(
+        context, channels * sizeof(int32_t)));
+    if (data->multiplier == nullptr || data->shift == nullptr) {
+      return kTfLiteError;
+    }
+
+    int32_t unused_multiplier;
+    int unused_shift;
+    TF_LITE_ENSURE_STATUS(tflite::PopulateConvolutionQuantizationParams(
+        context, input, filter, bias, output, params->activation,
+        &unused_multiplier, &unused_shift, &data->activation_min,
+        &data->activation_max, data->multiplier,
+        reinterpret_cast<int*>(data->shift), channels));
+
+    data->input_offset = -input->params.zero_point;
+    data->output_offset = output->params.zero_point;
+
+    TF_LITE_ENSURE_STATUS(context->RequestScratchBufferInArena(
+        context, kTile * data->pairs * 2 * sizeof(int16_t),
+        &data->tile_buffer_index));
+    return context->RequestScratchBufferInArena(
+        context, kTile * channels * sizeof(int32_t), &data->sums_buffer_index);
+  }
+
+  static TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+
+    if (!data->winograd) {
+      node->user_data = data->generic_data;
+      TfLiteStatus status = Generic()->invoke(context, node);
+      node->user_data = data;
+      return status;
+    }
+
+    const TfLiteEvalTensor* input = tflite::micro::GetEvalInput(context, node, 0);
+    const TfLiteEvalTensor* filter =
+        tflite::micro::GetEvalInput(context, node, 1);
+    const TfLiteEvalTensor* bias =
+        node->inputs->size > 2 ? tflite::micro::GetEvalInput(context, node, 2)
+                               : nullptr;
+    TfLiteEvalTensor* output = tflite::micro::GetEvalOutput(context, node, 0);
+    int16_t* tile = static_cast<int16_t*>(
+        context->GetScratchBuffer(context, data->tile_buffer_index));
+    int32_t* sums = static_cast<int32_t*>(
+        context->GetScratchBuffer(context, data->sums_buffer_index));
+
+    const int16_t* weights = Weights(filter->data.data);
+    const int8_t* input_data = tflite::micro::GetTensorData<int8_t>(input);
+    const int32_t* bias_data =
+        bias ? tflite::micro::GetTensorData<int32_t>(bias) : nullptr;
+    int8_t* out = tflite::micro::GetTensorData<int8_t>(output);
+    const int in_rows = input->dims->data[1];
+    const int in_cols = input->dims->data[2];
+    const int channels = data->channels;
+    const int stride = data->pairs * 2;
+
+    // Pool drops the last row and column of odd outputs, without pool the
+    // last tile is only partly written
+    const int tile_rows = data->pool == 2 ? output->dims->data[1]
+                                          : (data->rows + 1) / 2;
+    const int tile_cols = data->pool == 2 ? output->dims->data[2]
+                                          : (data->cols + 1) / 2;
+
+    for (int ty = 0; ty < tile_rows; ty++) {
+      for (int tx = 0; tx < tile_cols; tx++) {
+        TransformInput(data, input_data, in_rows, in_cols,
+                       2 * ty - data->padding.height,
+                       2 * tx - data->padding.width, tile);
+        for (int k = 0; k < kTile; k++) {
+          const int16_t* u = weights + k * channels * stride;
+          for (int c = 0; c < channels; c++) {
+            sums[k * channels + c] =
+                Dot(u + c * stride, tile + k * stride, data->pairs);
+          }
+        }
+        for (int c = 0; c < channels; c++) {
+          int8_t y[4];
+          TransformOutput(data, sums + c, bias_data ? bias_data[c] : 0, c, y);
+          if (data->pool == 2) {
+            int8_t max = y[0] > y[1] ? y[0] : y[1];
+            int8_t low = y[2] > y[3] ? y[2] : y[3];
+            out[(ty * tile_cols + tx) * channels + c] = max > low ? max : low;
+            continue;
+          }
+          for (int i = 0; i < 2 && 2 * ty + i < data->rows; i++) {
+            for (int j = 0; j < 2 && 2 * tx + j < data->cols; j++) {
+              out[((2 * ty + i) * data->cols + 2 * tx + j) * channels + c] =
+                  y[i * 2 + j];
+            }
+          }
+        }
+      }
+    }
+    return kTfLiteOk;
+  }
+
+  static const int16_t* Weights(const void* raw) {
+    return reinterpret_cast<const int16_t*>(
+        static_cast<const uint8_t*>(raw) + 4);
+  }
+
+  // True if no output channel can exceed int32 for any input, Y sums 9
+  // products of U . V for each channel
+  static bool Exact(const int16_t* weights, int channels, int stride) {
+    for (int c = 0; c < channels; c++) {
+      int64_t bound = 0;
+      for (int i = 0; i < stride; i++) {
+        int32_t largest = 0;
+        for (int k = 0; k < kTile; k++) {
+          int32_t u = weights[(k * channels + c) * stride + i];
+          u = u < 0 ? -u : u;
+          largest = u > largest ? u : largest;
+        }
+        bound += largest;
+      }
+      if (9 * kMaxInput * bound > INT32_MAX) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // V = B' d B of the 4x4 input tile at y0, x0 for every input channel,
+  // rows and columns outside of input are zero, the offset input value of
+  // the zero point. Padding channel of odd count stays zero.
+  static void TransformInput(const OpData* data, const int8_t* input,
+                             int in_rows, int in_cols, int y0, int x0,
+                             int16_t* tile) {
+    const int in_channels = data->in_channels;
+    const int stride = data->pairs * 2;
+
+    for (int c = 0; c < stride; c++) {
+      int32_t d[kTile];
+      for (int i = 0; i < 4; i++) {
+        const int y = y0 + i;
+        for (int j = 0; j < 4; j++) {
+          const int x = x0 + j;
+          d[i * 4 + j] =
+              c < in_channels && y >= 0 && y < in_rows && x >= 0 && x < in_cols
+                  ? input[(y * in_cols + x) * in_channels + c] +
+                        data->input_offset
+                  : 0;
+        }
+      }
+
+      // B' on rows, then B on columns
+      int32_t r[kTile];
+      for (int j = 0; j < 4; j++) {
+        r[0 + j] = d[0 + j] - d[8 + j];
+        r[4 + j] = d[4 + j] + d[8 + j];
+        r[8 + j] = d[8 + j] - d[4 + j];
+        r[12 + j] = d[4 + j] - d[12 + j];
+      }
+      for (int i = 0; i < 4; i++) {
+        const int32_t* row = r + i * 4;
+        tile[(i * 4 + 0) * stride + c] = row[0] - row[2];
+        tile[(i * 4 + 1) * stride + c] = row[1] + row[2];
+        tile[(i * 4 + 2) * stride + c] = row[2] - row[1];
+        tile[(i * 4 + 3) * stride + c] = row[1] - row[3];
+      }
+    }
+  }
+
+  // Sum over input channels of U . V for one position of the tile
+  static int32_t Dot(const int16_t* u, const int16_t* v, int pairs) {
+    int32_t acc = 0;
+#ifdef CONV_WINOGRAD_SIMD
+    for (int p = 0; p < pairs; p++) {
+      uint32_t weights;
+      uint32_t values;
+      memcpy(&weights, u + 2 * p, 4);
+      memcpy(&values, v + 2 * p, 4);
+      acc = __SMLAD(weights, values, acc);
+    }
+#else
+    for (int i = 0; i < 2 * pairs; i++) {
+      acc += u[i] * v[i];
+    }
+#endif
+    return acc;
+  }
+
+  // Y = A' M A of output channel c, sums are strided by channels. 2G
+  // makes M four times the direct sum, which is divided out exactly.
+  static void TransformOutput(const OpData* data, const int32_t* sums,
+                              int32_t bias, int c, int8_t y[4]) {
+    const int channels = data->channels;
+    int32_t m[kTile];
+    for (int k = 0; k < kTile; k++) {
+      m[k] = sums[k * channels];
+    }
+
+    int32_t t[8];
+    for (int j = 0; j < 4; j++) {
+      t[0 + j] = m[0 + j] + m[4 + j] + m[8 + j];
+      t[4 + j] = m[4 + j] - m[8 + j] - m[12 + j];
+    }
+    for (int i = 0; i < 2; i++) {
+      const int32_t* row = t + i * 4;
+      const int32_t acc[2] = {row[0] + row[1] + row[2],
+                              row[1] - row[2] - row[3]};
+      for (int j = 0; j < 2; j++) {
+        int32_t value = tflite::MultiplyByQuantizedMultiplier(
+            acc[j] / 4 + bias, data->multiplier[c], data->shift[c]);
+        value += data->output_offset;
+        if (value < data->activation_min) value = data->activation_min;
+        if (value > data->activation_max) value = data->activation_max;
+        y[i * 2 + j] = static_cast<int8_t>(value);
+      }
+    }
+  }
+
+  const tflite::MicroOpResolver& base_;
+  mutable TfLiteRegistration registration_;
+
+  static const TfLiteRegistration*& Generic() {
+    static const TfLiteRegistration* generic = nullptr;
+    return generic;
+  }
+};
+
+#endif  // CONV_WINOGRAD_H
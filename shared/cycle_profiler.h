@@ -0,0 +1,129 @@
+#ifndef CYCLE_PROFILER_H
+#define CYCLE_PROFILER_H
+
+#include <stdint.h>
+#include <libopencm3/cm3/dwt.h>
+
+#include "tensorflow/lite/core/api/error_reporter.h"
+#include "tensorflow/lite/core/api/profiler.h"
+#include "tensorflow/lite/micro/compatibility.h"
+
+// Per operator profiler for MicroInterpreter, based on DWT cycle counter.
+//
+// Pass it as the last argument of MicroInterpreter constructor, interpreter
+// then wraps each operator in Invoke() with BeginEvent()/EndEvent().
+// Cycles are accumulated per operator over all Invoke() calls until Reset(),
+// PrintTable() reports operator name, average cycles and percentage.
+//
+// Usage example:
+// static CycleProfiler profiler(error_reporter);
+// static tflite::MicroInterpreter interpreter(model, resolver, arena,
+//                                             arena_size, error_reporter,
+//                                             &profiler);
+// interpreter.Invoke();
+// profiler.PrintTable();
+//
+// Note that delay() in utility.c resets DWT counter, so it should not be
+// called while an operator is being measured.
+class CycleProfiler : public tflite::Profiler {
+ public:
+  // Graphs with more operators than this only get first kMaxOps reported
+  static constexpr int kMaxOps = 64;
+
+  explicit CycleProfiler(tflite::ErrorReporter* reporter)
+      : reporter_(reporter) {
+    // Cycle counter might not be enabled if project uses systick timer
+    DWT_LAR = 0xC5ACCE55;
+    dwt_enable_cycle_counter();
+    Reset();
+  }
+  ~CycleProfiler() override = default;
+
+  using tflite::Profiler::BeginEvent;
+  using tflite::Profiler::EndEvent;
+
+  // Interpreter passes operator index as event_metadata1, it is used as
+  // slot for accumulated cycles. Tag has to be valid until PrintTable().
+  uint32_t BeginEvent(const char* tag, EventType event_type,
+                      int64_t event_metadata1,
+                      int64_t event_metadata2) override {
+    uint32_t handle = static_cast<uint32_t>(event_metadata1);
+    if (handle >= kMaxOps) {
+      return kMaxOps;
+    }
+
+    tags_[handle] = tag;
+    if (handle >= num_ops_) {
+      num_ops_ = handle + 1;
+    }
+    start_cycles_[handle] = DWT_CYCCNT;
+    return handle;
+  }
+
+  void EndEvent(uint32_t event_handle) override {
+    uint32_t end = DWT_CYCCNT;
+    if (event_handle >= kMaxOps) {
+      return;
+    }
+
+    // Unsigned subtraction also covers counter overflow
+    cycles_[event_handle] += end - start_cycles_[event_handle];
+    counts_[event_handle]++;
+  }
+
+  void Reset() {
+    num_ops_ = 0;
+    for (int i = 0; i < kMaxOps; i++) {
+      tags_[i] = nullptr;
+      cycles_[i] = 0;
+      counts_[i] = 0;
+    }
+  }
+
+  // Total cycles of all operators, divided by number of Invoke() calls
+  uint32_t TotalCycles() const {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < num_ops_; i++) {
+      total += Average(i);
+    }
+    return static_cast<uint32_t>(total);
+  }
+
+  void PrintTable() const {
+    uint32_t total = TotalCycles();
+
+    TF_LITE_REPORT_ERROR(reporter_, "Op\tName\tCycles\tPercent");
+    for (uint32_t i = 0; i < num_ops_; i++) {
+      uint32_t average = Average(i);
+      uint32_t permille = total ? static_cast<uint32_t>(
+                                      (uint64_t)average * 1000 / total)
+                                : 0;
+      TF_LITE_REPORT_ERROR(reporter_, "%d\t%s\t%u\t%d.%d%%", i,
+                           tags_[i] ? tags_[i] : "-", average,
+                           permille / 10, permille % 10);
+    }
+    TF_LITE_REPORT_ERROR(reporter_, "Total\t\t%u", total);
+  }
+
+  uint32_t num_ops() const { return num_ops_; }
+  const char* tag(uint32_t index) const { return tags_[index]; }
+
+  // Average cycles of the operator over all Invoke() calls since Reset()
+  uint32_t Average(uint32_t index) const {
+    return counts_[index] ? static_cast<uint32_t>(cycles_[index] /
+                                                  counts_[index])
+                          : 0;
+  }
+
+ private:
+  tflite::ErrorReporter* reporter_;
+  uint32_t num_ops_;
+  const char* tags_[kMaxOps];
+  uint32_t start_cycles_[kMaxOps];
+  uint64_t cycles_[kMaxOps];
+  uint32_t counts_[kMaxOps];
+
+  TF_LITE_REMOVE_VIRTUAL_DELETE
+};
+
+#endif  // CYCLE_PROFILER_H
@@ -0,0 +1,156 @@
+#ifndef DATASET_FILE_H
+#define DATASET_FILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Container of quantized samples and their labels, written by
+// make_dataset.py and read the same way on host and target.
+//
+// File starts with one block of header, then a table of uint16 labels if
+// there are any, then the samples. Labels and samples start on a block
+// boundary and every sample takes a whole number of blocks, its stride,
+// the tail of the last block is zero padding. Blocks are 512 bytes, the
+// sector of SD cards, so a sample is one multi-block read that starts at
+// sector dataset_sample_block() of the file and can go straight into the
+// input tensor with DMA. Samples are already quantized with scale and
+// zero point of the header, nothing is parsed or converted.
+//
+// Mapped file, host_eval.h with mmap, a blob of BLOBS in project.mk or
+// QSPI flash in memory mapped mode, is used in place with
+// dataset_sample() and dataset_label(). Samples are 512 byte aligned in
+// the file, blobs are linked 32 byte aligned, so DMA2D and D-cache
+// maintenance see whole cache lines. From SD card the file has to be
+// contiguous, which it is when it is written to an empty card, and reads
+// of whole blocks need sample_stride bytes, not sample_bytes, at the
+// destination. All fields are little endian.
+//
+// Usage example:
+// const dataset_header_t * set = (const dataset_header_t *) test_set_mlds;
+// if (!dataset_check(set, test_set_mlds_len)) return false;
+// for (uint32_t i = 0; i < set->count; i++)
+//     memcpy(input->data.int8, dataset_sample(set, i), set->sample_bytes);
+#define DATASET_MAGIC       0x53444C4Du // "MLDS"
+#define DATASET_VERSION     1
+#define DATASET_BLOCK       512         // Bytes, SD card sector
+
+#define DATASET_TYPE_INT8   0
+#define DATASET_TYPE_UINT8  1
+
+#define DATASET_NO_LABEL    0xFFFF      // Label of unlabelled samples
+
+typedef struct
+{
+    uint32_t magic;             // DATASET_MAGIC
+    uint16_t version;           // DATASET_VERSION
+    uint16_t type;              // DATASET_TYPE_*
+    uint32_t count;             // Number of samples
+    uint32_t sample_bytes;      // Bytes of one sample, input->bytes
+    uint32_t sample_stride;     // sample_bytes rounded up to blocks
+    uint32_t labels_offset;     // uint16 per sample, 0 if there are none
+    uint32_t samples_offset;    // First sample, multiple of DATASET_BLOCK
+    uint32_t file_bytes;        // Whole file with padding
+    uint32_t dims[4];           // Shape of one sample, unused ones are 1
+    float scale;                // Quantization of the samples
+    int32_t zero_point;
+    uint32_t data_crc32;        // zlib CRC-32 of everything after header
+    uint32_t reserved;
+} dataset_header_t;
+
+/*!
+ * @brief           Checks that header describes a file of given size
+ *
+ * @param[in] size  Bytes that are there, of the blob or the file
+ *
+ * @return          False for other files, other versions or a header that
+ *                  points outside of the file. CRC-32 is not checked, it
+ *                  takes a pass over the whole file, see crc_hw.c.
+ */
+static inline bool dataset_check(const dataset_header_t * header,
+                                 uint32_t size)
+{
+    if (size < DATASET_BLOCK ||
+        header->magic != DATASET_MAGIC ||
+        header->version != DATASET_VERSION ||
+        header->type > DATASET_TYPE_UINT8 ||
+        header->file_bytes > size ||
+        header->sample_bytes == 0 ||
+        header->sample_stride < header->sample_bytes ||
+        header->sample_stride % DATASET_BLOCK ||
+        header->samples_offset % DATASET_BLOCK ||
+        header->samples_offset < DATASET_BLOCK)
+    {
+        return false;
+    }
+    // 64 bit, count * stride of a broken header may wrap
+    uint64_t end = header->samples_offset +
+                   (uint64_t) header->count * header->sample_stride;
+    if (end > header->file_bytes)
+    {
+        return false;
+    }
+    if (header->labels_offset &&
+        (header->labels_offset < DATASET_BLOCK ||
+         header->labels_offset + 2ull * header->count >
+         header->samples_offset))
+    {
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief           Returns byte offset of sample in the file
+ */
+static inline uint32_t dataset_sample_offset(const dataset_header_t * header,
+                                             uint32_t index)
+{
+    return header->samples_offset + index * header->sample_stride;
+}
+
+/*!
+ * @brief           Returns first block of sample, relative to the first
+ *                  sector of the file, it has sample_stride / DATASET_BLOCK
+ *                  of them
+ */
+static inline uint32_t dataset_sample_block(const dataset_header_t * header,
+                                            uint32_t index)
+{
+    return dataset_sample_offset(header, index) / DATASET_BLOCK;
+}
+
+/*!
+ * @brief           Returns sample of a mapped file, header is its start
+ */
+static inline const void * dataset_sample(const dataset_header_t * header,
+                                          uint32_t index)
+{
+    return (const uint8_t *) header + dataset_sample_offset(header, index);
+}
+
+/*!
+ * @brief           Returns label of a mapped file, DATASET_NO_LABEL if it
+ *                  has none
+ */
+static inline uint16_t dataset_label(const dataset_header_t * header,
+                                     uint32_t index)
+{
+    if (!header->labels_offset)
+    {
+        return DATASET_NO_LABEL;
+    }
+    const uint8_t * label = (const uint8_t *) header +
+                            header->labels_offset + 2 * index;
+    return label[0] | (label[1] << 8);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DATASET_FILE_H */
+/*** end of file ***/
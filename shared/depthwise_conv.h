@@ -0,0 +1,368 @@
+#ifndef DEPTHWISE_CONV_H
+#define DEPTHWISE_CONV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tensorflow/lite/c/builtin_op_data.h"
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/kernels/internal/common.h"
+#include "tensorflow/lite/kernels/kernel_util.h"
+#include "tensorflow/lite/kernels/padding.h"
+#include "tensorflow/lite/micro/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/micro_op_resolver.h"
+
+#ifdef CMSIS_NN
+#include "arm_nnfunctions.h"
+#endif
+
+// DepthwiseConv2D kernel selection with a report and wider fast paths.
+//
+// cmsis-nn/depthwise_conv.cc only calls CMSIS-NN for depth multiplier 1
+// without dilation. arm_depthwise_conv_wrapper_s8 then takes the 3x3
+// kernel for 3x3 filters with padding of at most 1 and the optimised
+// kernel otherwise, any stride. Everything else falls back to the
+// reference loops, which recompute bounds and offsets for every
+// multiply.
+//
+// This resolver logs the path of every int8 node in Prepare() and routes
+// the cases that used to fall back:
+// - depth multiplier > 1 without dilation: arm_depthwise_conv_s8, which
+//   handles multipliers
+// - dilation: kernel below, channels are innermost, so it walks each
+//   input pixel once per filter tap and accumulates all their output
+//   channels in a scratch row, bounds are checked per tap
+// Other nodes run through the original kernel.
+//
+// Usage example:
+// static DepthwiseConvResolver depthwise_resolver(engine.resolver());
+// engine.SetResolver(&depthwise_resolver);
+// engine.Setup(model_data, error_reporter);
+
+class DepthwiseConvResolver : public tflite::MicroOpResolver {
+ public:
+  enum Path { kGeneric, k3x3, kOptimised, kReference, kCmsisS8, kDilated };
+
+  explicit DepthwiseConvResolver(const tflite::MicroOpResolver& base)
+      : base_(base) {}
+
+  const TfLiteRegistration* FindOp(tflite::BuiltinOperator op) const override {
+    const TfLiteRegistration* registration = base_.FindOp(op);
+    if (op != tflite::BuiltinOperator_DEPTHWISE_CONV_2D ||
+        registration == nullptr) {
+      return registration;
+    }
+
+    // Keep builtin code and version, so profiler still reports it
+    Generic() = registration;
+    registration_ = *registration;
+    registration_.init = Init;
+    registration_.free = nullptr;
+    registration_.prepare = Prepare;
+    registration_.invoke = Eval;
+    return &registration_;
+  }
+
+  const TfLiteRegistration* FindOp(const char* op) const override {
+    return base_.FindOp(op);
+  }
+
+  BuiltinParseFunction GetOpDataParser(
+      tflite::BuiltinOperator op) const override {
+    return base_.GetOpDataParser(op);
+  }
+
+  static const char* PathName(Path path) {
+    switch (path) {
+      case k3x3:
+        return "arm_depthwise_conv_3x3_s8";
+      case kOptimised:
+        return "arm_depthwise_conv_s8_opt";
+      case kReference:
+        return "reference";
+      case kCmsisS8:
+        return "arm_depthwise_conv_s8";
+      case kDilated:
+        return "dilated";
+      default:
+        return "original kernel";
+    }
+  }
+
+ private:
+  struct OpData {
+    void* generic_data;
+    Path path;
+    TfLitePaddingValues padding;
+    int32_t input_offset;
+    int32_t output_offset;
+    int32_t activation_min;
+    int32_t activation_max;
+    int32_t* multiplier;
+    int32_t* shift;
+    int acc_buffer_index;   // Dilated, one output pixel of accumulators
+  };
+
+  static void* Init(TfLiteContext* context, const char* buffer,
+                    size_t length) {
+    OpData* data = static_cast<OpData*>(
+        context->AllocatePersistentBuffer(context, sizeof(OpData)));
+    if (data == nullptr) {
+      return nullptr;
+    }
+    data->generic_data = Generic()->init
+                             ? Generic()->init(context, buffer, length)
+                             : nullptr;
+    data->path = kGeneric;
+    return data;
+  }
+
+  // Path of the original kernel, the same conditions as it checks
+  static Path OriginalPath(const TfLiteDepthwiseConvParams* params,
+                           const TfLiteIntArray* in, const TfLiteIntArray* f,
+                           const TfLitePaddingValues& padding) {
+#ifdef CMSIS_NN
+    if (params->depth_multiplier != 1 || params->dilation_height_factor != 1 ||
+        params->dilation_width_factor != 1) {
+      return kReference;
+    }
+    if (in->data[0] != 1) {
+      return kCmsisS8;
+    }
+    if (f->data[1] == 3 && f->data[2] == 3 && padding.height <= 1 &&
+        padding.width <= 1) {
+      return k3x3;
+    }
+    return kOptimised;
+#else
+    (void) params;
+    (void) in;
+    (void) f;
+    (void) padding;
+    return kReference;
+#endif
+  }
+
+  static TfLiteStatus Prepare(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+
+    const TfLiteTensor* input = tflite::GetInput(context, node, 0);
+    const TfLiteTensor* filter = tflite::GetInput(context, node, 1);
+    const TfLiteTensor* bias = tflite::GetOptionalInputTensor(context, node, 2);
+    TfLiteTensor* output = tflite::GetOutput(context, node, 0);
+    const TfLiteDepthwiseConvParams* params =
+        static_cast<const TfLiteDepthwiseConvParams*>(node->builtin_data);
+
+    const bool int8 = input->type == kTfLiteInt8 &&
+                      filter->type == kTfLiteInt8 &&
+                      output->type == kTfLiteInt8 &&
+                      filter->quantization.type == kTfLiteAffineQuantization;
+    int unused_height;
+    int unused_width;
+    data->padding = tflite::ComputePaddingHeightWidth(
+        params->stride_height, params->stride_width,
+        params->dilation_height_factor, params->dilation_width_factor,
+        input->dims->data[1], input->dims->data[2], filter->dims->data[1],
+        filter->dims->data[2], params->padding, &unused_height, &unused_width);
+
+    const bool dilated = params->dilation_height_factor != 1 ||
+                         params->dilation_width_factor != 1;
+    data->path = kGeneric;
+    if (int8 && dilated) {
+      data->path = kDilated;
+    }
+#ifdef CMSIS_NN
+    if (int8 && !dilated && params->depth_multiplier != 1 &&
+        input->dims->data[0] == 1) {
+      data->path = kCmsisS8;
+    }
+#endif
+
+    if (int8) {
+      const Path path = data->path == kGeneric
+                            ? OriginalPath(params, input->dims, filter->dims,
+                                           data->padding)
+                            : data->path;
+      TF_LITE_KERNEL_LOG(context,
+                         "DepthwiseConv2D %dx%d stride %d dilation %d "
+                         "multiplier %d: %s",
+                         filter->dims->data[1], filter->dims->data[2],
+                         params->stride_width, params->dilation_width_factor,
+                         params->depth_multiplier, PathName(path));
+    }
+
+    if (data->path == kGeneric) {
+      node->user_data = data->generic_data;
+      TfLiteStatus status =
+          Generic()->prepare ? Generic()->prepare(context, node) : kTfLiteOk;
+      node->user_data = data;
+      return status;
+    }
+
+    const int channels = filter->dims->data[3];
+    data->multiplier = static_cast<int32_t*>(context->AllocatePersistentBuffer(
+        context, channels * sizeof(int32_t)));
+    data->shift = static_cast<int32_t*>(context->AllocatePersistentBuffer(
+        context, channels * sizeof(int32_t)));
+    if (data->multiplier == nullptr || data->shift == nullptr) {
+      return kTfLiteError;
+    }
+
+    int32_t unused_multiplier;
+    int unused_shift;
+    TF_LITE_ENSURE_STATUS(tflite::PopulateConvolutionQuantizationParams(
+        context, input, filter, bias, output, params->activation,
+        &unused_multiplier, &unused_shift, &data->activation_min,
+        &data->activation_max, data->multiplier,
+        reinterpret_cast<int*>(data->shift), channels));
+    data->input_offset = -input->params.zero_point;
+    data->output_offset = output->params.zero_point;
+
+    data->acc_buffer_index = -1;
+    if (data->path == kDilated) {
+      TF_LITE_ENSURE_STATUS(context->RequestScratchBufferInArena(
+          context, channels * sizeof(int32_t), &data->acc_buffer_index));
+    }
+    return kTfLiteOk;
+  }
+
+  static TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+
+    if (data->path == kGeneric) {
+      node->user_data = data->generic_data;
+      TfLiteStatus status = Generic()->invoke(context, node);
+      node->user_data = data;
+      return status;
+    }
+
+    const TfLiteEvalTensor* input = tflite::micro::GetEvalInput(context, node, 0);
+    const TfLiteEvalTensor* filter =
+        tflite::micro::GetEvalInput(context, node, 1);
+    const TfLiteEvalTensor* bias =
+        node->inputs->size > 2 ? tflite::micro::GetEvalInput(context, node, 2)
+                               : nullptr;
+    TfLiteEvalTensor* output = tflite::micro::GetEvalOutput(context, node, 0);
+    const TfLiteDepthwiseConvParams* params =
+        static_cast<const TfLiteDepthwiseConvParams*>(node->builtin_data);
+    const int32_t* bias_data =
+        bias ? tflite::micro::GetTensorData<int32_t>(bias) : nullptr;
+
+#ifdef CMSIS_NN
+    if (data->path == kCmsisS8) {
+      const TfLiteIntArray* in = input->dims;
+      const TfLiteIntArray* f = filter->dims;
+      const TfLiteIntArray* out = output->dims;
+      cmsis_nn_dw_conv_params dw_params;
+      dw_params.input_offset = data->input_offset;
+      dw_params.output_offset = data->output_offset;
+      dw_params.ch_mult = params->depth_multiplier;
+      dw_params.stride.h = params->stride_height;
+      dw_params.stride.w = params->stride_width;
+      dw_params.padding.h = data->padding.height;
+      dw_params.padding.w = data->padding.width;
+      dw_params.dilation.h = 1;
+      dw_params.dilation.w = 1;
+      dw_params.activation.min = data->activation_min;
+      dw_params.activation.max = data->activation_max;
+      cmsis_nn_per_channel_quant_params quant_params = {data->multiplier,
+                                                        data->shift};
+      cmsis_nn_dims input_dims = {1, in->data[1], in->data[2], in->data[3]};
+      cmsis_nn_dims filter_dims = {1, f->data[1], f->data[2], f->data[3]};
+      cmsis_nn_dims bias_dims = {1, 1, 1, out->data[3]};
+      cmsis_nn_dims output_dims = {1, out->data[1], out->data[2],
+                                   out->data[3]};
+      cmsis_nn_context ctx = {nullptr, 0};
+
+      if (arm_depthwise_conv_s8(
+              &ctx, &dw_params, &quant_params, &input_dims,
+              tflite::micro::GetTensorData<int8_t>(input), &filter_dims,
+              tflite::micro::GetTensorData<int8_t>(filter), &bias_dims,
+              bias_data, &output_dims,
+              tflite::micro::GetTensorData<int8_t>(output)) !=
+          ARM_MATH_SUCCESS) {
+        return kTfLiteError;
+      }
+      return kTfLiteOk;
+    }
+#endif
+
+    int32_t* acc = static_cast<int32_t*>(
+        context->GetScratchBuffer(context, data->acc_buffer_index));
+    EvalDilated(data, params, input, filter, bias_data, output, acc);
+    return kTfLiteOk;
+  }
+
+  static void EvalDilated(const OpData* data,
+                          const TfLiteDepthwiseConvParams* params,
+                          const TfLiteEvalTensor* input,
+                          const TfLiteEvalTensor* filter,
+                          const int32_t* bias, TfLiteEvalTensor* output,
+                          int32_t* acc) {
+    const TfLiteIntArray* in = input->dims;
+    const TfLiteIntArray* f = filter->dims;
+    const TfLiteIntArray* out = output->dims;
+    const int rows = in->data[1];
+    const int cols = in->data[2];
+    const int depth = in->data[3];
+    const int mult = params->depth_multiplier;
+    const int channels = f->data[3];
+    const int8_t* input_data = tflite::micro::GetTensorData<int8_t>(input);
+    const int8_t* filter_data = tflite::micro::GetTensorData<int8_t>(filter);
+    int8_t* out_data = tflite::micro::GetTensorData<int8_t>(output);
+
+    for (int b = 0; b < out->data[0]; b++) {
+      for (int oy = 0; oy < out->data[1]; oy++) {
+        const int top = oy * params->stride_height - data->padding.height;
+        for (int ox = 0; ox < out->data[2]; ox++) {
+          const int left = ox * params->stride_width - data->padding.width;
+          for (int c = 0; c < channels; c++) {
+            acc[c] = bias ? bias[c] : 0;
+          }
+
+          for (int ky = 0; ky < f->data[1]; ky++) {
+            const int iy = top + ky * params->dilation_height_factor;
+            if (iy < 0 || iy >= rows) {
+              continue;
+            }
+            for (int kx = 0; kx < f->data[2]; kx++) {
+              const int ix = left + kx * params->dilation_width_factor;
+              if (ix < 0 || ix >= cols) {
+                continue;
+              }
+              const int8_t* x =
+                  input_data + ((b * rows + iy) * cols + ix) * depth;
+              const int8_t* w = filter_data + (ky * f->data[2] + kx) * channels;
+              int32_t* a = acc;
+              for (int ic = 0; ic < depth; ic++) {
+                const int32_t value = x[ic] + data->input_offset;
+                for (int m = 0; m < mult; m++) {
+                  *a++ += value * *w++;
+                }
+              }
+            }
+          }
+
+          for (int c = 0; c < channels; c++) {
+            int32_t value = tflite::MultiplyByQuantizedMultiplier(
+                acc[c], data->multiplier[c], data->shift[c]);
+            value += data->output_offset;
+            value = value < data->activation_min ? data->activation_min : value;
+            value = value > data->activation_max ? data->activation_max : value;
+            *out_data++ = static_cast<int8_t>(value);
+          }
+        }
+      }
+    }
+  }
+
+  const tflite::MicroOpResolver& base_;
+  mutable TfLiteRegistration registration_;
+
+  static const TfLiteRegistration*& Generic() {
+    static const TfLiteRegistration* generic = nullptr;
+    return generic;
+  }
+};
+
+#endif  // DEPTHWISE_CONV_H
@@ -0,0 +1,485 @@
+#ifndef DETECTION_POSTPROCESS_H
+#define DETECTION_POSTPROCESS_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "flatbuffers/flexbuffers.h"
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/micro_op_resolver.h"
+#include "tensorflow/lite/schema/schema_generated.h"
+
+// TFLite_Detection_PostProcess of SSD models on int8 box encodings and
+// class scores, without Dequantize in front of it.
+//
+// Box encodings and class scores stay int8. Box encodings have only 256
+// values, so Prepare() turns each of them into a table entry in Q16, the
+// center offset ty / y_scale and half of the size exp(th / h_scale) / 2,
+// and decoding is two table loads and multiplies with the anchor per
+// coordinate. Score threshold is quantized with the scale of the scores,
+// the pass over all anchors only finds the top class of each one and
+// compares int8 values.
+//
+// Anchors above threshold are counting sorted by their int8 score, which
+// has 256 levels, and the best kMaxCandidates of them take part in NMS,
+// ties keep anchor order. Only those are decoded. Greedy NMS compares IoU
+// with the threshold in integers, intersection * 2^16 against threshold
+// in Q16 * union, in 64 bits. Outputs are float tensors of the original
+// op, boxes, classes, scores and count, only max_detections of them are
+// converted. When more than kMaxCandidates anchors pass the threshold,
+// boxes that only the ones behind them would have given are lost, set
+// the threshold so that this is rare.
+//
+// This is the fast, class agnostic NMS with one class per detection.
+// Nodes with use_regular_nms, several classes per detection or other
+// types run through a kernel of the project resolver, if it has one,
+// otherwise Prepare() fails. gen_model_ops.py leaves the op out of
+// model_ops.h, this resolver provides it.
+//
+// Usage example:
+// static DetectionPostProcessResolver detection_resolver(engine.resolver());
+// engine.SetResolver(&detection_resolver);
+// engine.Setup(model_data, error_reporter);
+
+class DetectionPostProcessResolver : public tflite::MicroOpResolver {
+ public:
+  static constexpr int kMaxCandidates = 128;
+
+  explicit DetectionPostProcessResolver(const tflite::MicroOpResolver& base)
+      : base_(base) {}
+
+  const TfLiteRegistration* FindOp(tflite::BuiltinOperator op) const override {
+    return base_.FindOp(op);
+  }
+
+  const TfLiteRegistration* FindOp(const char* op) const override {
+    const TfLiteRegistration* registration = base_.FindOp(op);
+    if (strcmp(op, kOpName) != 0) {
+      return registration;
+    }
+
+    // Project resolver usually does not have it, then this is the kernel
+    Generic() = registration;
+    if (registration != nullptr) {
+      registration_ = *registration;
+    } else {
+      memset(&registration_, 0, sizeof(registration_));
+      registration_.builtin_code = tflite::BuiltinOperator_CUSTOM;
+      registration_.custom_name = kOpName;
+      registration_.version = 1;
+    }
+    registration_.init = Init;
+    registration_.free = nullptr;
+    registration_.prepare = Prepare;
+    registration_.invoke = Eval;
+    return &registration_;
+  }
+
+  BuiltinParseFunction GetOpDataParser(
+      tflite::BuiltinOperator op) const override {
+    return base_.GetOpDataParser(op);
+  }
+
+  static constexpr const char* kOpName = "TFLite_Detection_PostProcess";
+
+ private:
+  enum { kBoxEncodings, kClassPredictions, kAnchors };
+  enum { kBoxes, kClasses, kScores, kNumDetections };
+
+  struct OpData {
+    void* generic_data;
+    bool native;
+
+    // Custom options of the converter
+    int max_detections;
+    int max_classes_per_detection;
+    bool use_regular_nms;
+    float nms_score_threshold;
+    float nms_iou_threshold;
+    int num_classes;
+    float y_scale;
+    float x_scale;
+    float h_scale;
+    float w_scale;
+
+    int num_anchors;
+    int box_stride;           // Encodings per anchor, 4 or more
+    int class_stride;         // Scores per anchor, with background
+    int label_offset;         // 1 if the first score is background
+    int8_t score_threshold;   // Lowest int8 score that passes
+    int32_t iou_threshold;    // Q16
+    float score_scale;
+    int32_t score_zero_point;
+
+    // Q16 of ty / y_scale, tx / x_scale, exp(th / h_scale) / 2 and
+    // exp(tw / w_scale) / 2 for each int8 encoding
+    int32_t* tables;
+
+    // Anchors, ycenter, xcenter, h and w, float or quantized
+    TfLiteType anchor_type;
+    float anchor_scale;
+    int32_t anchor_zero_point;
+
+    int scratch_index;
+  };
+
+  struct Box {
+    int32_t ymin;
+    int32_t xmin;
+    int32_t ymax;
+    int32_t xmax;
+    int64_t area;
+  };
+
+  static void* Init(TfLiteContext* context, const char* buffer,
+                    size_t length) {
+    OpData* data = static_cast<OpData*>(
+        context->AllocatePersistentBuffer(context, sizeof(OpData)));
+    if (data == nullptr) {
+      return nullptr;
+    }
+    data->generic_data = Generic() && Generic()->init
+                             ? Generic()->init(context, buffer, length)
+                             : nullptr;
+    data->native = false;
+    data->max_detections = 0;
+    if (buffer == nullptr) {
+      return data;
+    }
+
+    // Same keys and defaults as the TFLite kernel
+    const flexbuffers::Map& m =
+        flexbuffers::GetRoot(reinterpret_cast<const uint8_t*>(buffer), length)
+            .AsMap();
+    data->max_detections = m["max_detections"].AsInt32();
+    data->max_classes_per_detection =
+        m["max_classes_per_detection"].IsNull()
+            ? 1
+            : m["max_classes_per_detection"].AsInt32();
+    data->use_regular_nms = m["use_regular_nms"].AsBool();
+    data->nms_score_threshold = m["nms_score_threshold"].AsFloat();
+    data->nms_iou_threshold = m["nms_iou_threshold"].AsFloat();
+    data->num_classes = m["num_classes"].AsInt32();
+    data->y_scale = m["y_scale"].AsFloat();
+    data->x_scale = m["x_scale"].AsFloat();
+    data->h_scale = m["h_scale"].AsFloat();
+    data->w_scale = m["w_scale"].AsFloat();
+    return data;
+  }
+
+  static TfLiteStatus Prepare(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+    const TfLiteTensor* boxes = tflite::GetInput(context, node, kBoxEncodings);
+    const TfLiteTensor* scores =
+        tflite::GetInput(context, node, kClassPredictions);
+    const TfLiteTensor* anchors = tflite::GetInput(context, node, kAnchors);
+
+    data->native =
+        boxes->type == kTfLiteInt8 && scores->type == kTfLiteInt8 &&
+        (anchors->type == kTfLiteFloat32 || anchors->type == kTfLiteInt8 ||
+         anchors->type == kTfLiteUInt8) &&
+        !data->use_regular_nms && data->max_classes_per_detection == 1 &&
+        data->num_classes > 0 && data->num_classes <= 255 &&
+        data->max_detections > 0 && boxes->dims->size == 3 &&
+        scores->dims->size == 3 && anchors->dims->size == 2 &&
+        boxes->dims->data[2] >= 4 && anchors->dims->data[1] == 4 &&
+        boxes->dims->data[1] == anchors->dims->data[0] &&
+        scores->dims->data[1] == anchors->dims->data[0] &&
+        scores->dims->data[2] >= data->num_classes &&
+        anchors->dims->data[0] <= UINT16_MAX && node->outputs->size == 4;
+    for (int i = 0; data->native && i < 4; i++) {
+      const TfLiteTensor* output = tflite::GetOutput(context, node, i);
+      const int size = i == kNumDetections ? 1 : data->max_detections;
+      data->native = output->type == kTfLiteFloat32 &&
+                     tflite::NumElements(output) >= size * (i ? 1 : 4);
+    }
+
+    if (!data->native) {
+      if (Generic() == nullptr) {
+        TF_LITE_KERNEL_LOG(context, "%s needs int8 inputs, fast NMS and "
+                           "one class per detection", kOpName);
+        return kTfLiteError;
+      }
+      node->user_data = data->generic_data;
+      TfLiteStatus status = Generic()->prepare
+                                ? Generic()->prepare(context, node)
+                                : kTfLiteOk;
+      node->user_data = data;
+      return status;
+    }
+
+    data->num_anchors = anchors->dims->data[0];
+    data->box_stride = boxes->dims->data[2];
+    data->class_stride = scores->dims->data[2];
+    data->label_offset = data->class_stride - data->num_classes;
+    data->score_scale = scores->params.scale;
+    data->score_zero_point = scores->params.zero_point;
+    data->anchor_type = anchors->type;
+    data->anchor_scale = anchors->params.scale;
+    data->anchor_zero_point = anchors->params.zero_point;
+
+    // Scores equal to the threshold pass, as in the float kernel
+    float threshold = ceilf(data->nms_score_threshold / data->score_scale) +
+                      data->score_zero_point;
+    if (threshold > 127.0f) {
+      threshold = 127.0f;
+    }
+    data->score_threshold =
+        static_cast<int8_t>(threshold < -128.0f ? -128.0f : threshold);
+    data->iou_threshold =
+        static_cast<int32_t>(lroundf(data->nms_iou_threshold * 65536.0f));
+
+    data->tables = static_cast<int32_t*>(context->AllocatePersistentBuffer(
+        context, 4 * 256 * sizeof(int32_t)));
+    if (data->tables == nullptr) {
+      return kTfLiteError;
+    }
+    const float scale = boxes->params.scale;
+    const int32_t zero_point = boxes->params.zero_point;
+    const float center_scales[2] = {data->y_scale, data->x_scale};
+    const float size_scales[2] = {data->h_scale, data->w_scale};
+    for (int q = -128; q < 128; q++) {
+      const float value = scale * (q - zero_point);
+      for (int i = 0; i < 2; i++) {
+        data->tables[i * 256 + q + 128] =
+            ToQ16(value / center_scales[i]);
+        data->tables[(2 + i) * 256 + q + 128] =
+            ToQ16(0.5f * expf(value / size_scales[i]));
+      }
+    }
+
+    // Best score and class of every anchor, sorted candidates, their
+    // boxes and suppression flags
+    const size_t bytes = data->num_anchors * 2 +
+                         kMaxCandidates * (sizeof(Box) + sizeof(uint16_t) + 1) +
+                         sizeof(int64_t);
+    return context->RequestScratchBufferInArena(context, bytes,
+                                                &data->scratch_index);
+  }
+
+  static TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+
+    if (!data->native) {
+      node->user_data = data->generic_data;
+      TfLiteStatus status = Generic()->invoke(context, node);
+      node->user_data = data;
+      return status;
+    }
+
+    const TfLiteEvalTensor* boxes =
+        tflite::micro::GetEvalInput(context, node, kBoxEncodings);
+    const TfLiteEvalTensor* scores =
+        tflite::micro::GetEvalInput(context, node, kClassPredictions);
+    const TfLiteEvalTensor* anchors =
+        tflite::micro::GetEvalInput(context, node, kAnchors);
+    const int8_t* encodings = tflite::micro::GetTensorData<int8_t>(boxes);
+    const int8_t* classes = tflite::micro::GetTensorData<int8_t>(scores);
+
+    // Boxes first, they need 8 byte alignment
+    uint8_t* scratch =
+        static_cast<uint8_t*>(context->GetScratchBuffer(
+            context, data->scratch_index));
+    Box* candidate_boxes = reinterpret_cast<Box*>(
+        (reinterpret_cast<uintptr_t>(scratch) + 7) & ~static_cast<uintptr_t>(7));
+    uint16_t* candidates =
+        reinterpret_cast<uint16_t*>(candidate_boxes + kMaxCandidates);
+    uint8_t* suppressed = reinterpret_cast<uint8_t*>(candidates + kMaxCandidates);
+    int8_t* best_score = reinterpret_cast<int8_t*>(suppressed + kMaxCandidates);
+    uint8_t* best_class =
+        reinterpret_cast<uint8_t*>(best_score + data->num_anchors);
+
+    // Top class of each anchor and histogram of the ones that pass
+    uint16_t histogram[256];
+    memset(histogram, 0, sizeof(histogram));
+    const int8_t threshold = data->score_threshold;
+    for (int a = 0; a < data->num_anchors; a++) {
+      const int8_t* row = classes + a * data->class_stride + data->label_offset;
+      int8_t best = row[0];
+      int best_index = 0;
+      for (int c = 1; c < data->num_classes; c++) {
+        if (row[c] > best) {
+          best = row[c];
+          best_index = c;
+        }
+      }
+      best_score[a] = best;
+      best_class[a] = static_cast<uint8_t>(best_index);
+      if (best >= threshold) {
+        histogram[best + 128]++;
+      }
+    }
+
+    // Lowest level that still fits, part of its anchors may not
+    int count = 0;
+    int lowest = 127;
+    int start[256];
+    for (int level = 127; level >= threshold && count < kMaxCandidates;
+         level--) {
+      start[level + 128] = count;
+      count += histogram[level + 128];
+      lowest = level;
+    }
+    if (count > kMaxCandidates) {
+      count = kMaxCandidates;
+    }
+
+    // Counting sort, higher score first, anchor order within a level
+    for (int a = 0; a < data->num_anchors; a++) {
+      const int level = best_score[a];
+      if (level < lowest) {
+        continue;
+      }
+      int& slot = start[level + 128];
+      if (slot < count) {
+        candidates[slot] = static_cast<uint16_t>(a);
+      }
+      slot++;
+    }
+
+    for (int i = 0; i < count; i++) {
+      Decode(data, encodings + candidates[i] * data->box_stride, anchors,
+             candidates[i], &candidate_boxes[i]);
+      suppressed[i] = 0;
+    }
+
+    // Greedy NMS, a kept box suppresses every later one it overlaps
+    TfLiteEvalTensor* out_boxes =
+        tflite::micro::GetEvalOutput(context, node, kBoxes);
+    TfLiteEvalTensor* out_classes =
+        tflite::micro::GetEvalOutput(context, node, kClasses);
+    TfLiteEvalTensor* out_scores =
+        tflite::micro::GetEvalOutput(context, node, kScores);
+    TfLiteEvalTensor* out_count =
+        tflite::micro::GetEvalOutput(context, node, kNumDetections);
+    float* box_data = tflite::micro::GetTensorData<float>(out_boxes);
+    float* class_data = tflite::micro::GetTensorData<float>(out_classes);
+    float* score_data = tflite::micro::GetTensorData<float>(out_scores);
+
+    int kept = 0;
+    for (int i = 0; i < count && kept < data->max_detections; i++) {
+      if (suppressed[i]) {
+        continue;
+      }
+      const Box& box = candidate_boxes[i];
+      for (int j = i + 1; j < count; j++) {
+        if (!suppressed[j] &&
+            Overlaps(box, candidate_boxes[j], data->iou_threshold)) {
+          suppressed[j] = 1;
+        }
+      }
+
+      const int anchor = candidates[i];
+      box_data[kept * 4 + 0] = box.ymin * (1.0f / 65536.0f);
+      box_data[kept * 4 + 1] = box.xmin * (1.0f / 65536.0f);
+      box_data[kept * 4 + 2] = box.ymax * (1.0f / 65536.0f);
+      box_data[kept * 4 + 3] = box.xmax * (1.0f / 65536.0f);
+      class_data[kept] = best_class[anchor];
+      score_data[kept] = data->score_scale *
+                         (best_score[anchor] - data->score_zero_point);
+      kept++;
+    }
+    for (int i = kept; i < data->max_detections; i++) {
+      box_data[i * 4 + 0] = box_data[i * 4 + 1] = 0.0f;
+      box_data[i * 4 + 2] = box_data[i * 4 + 3] = 0.0f;
+      class_data[i] = 0.0f;
+      score_data[i] = 0.0f;
+    }
+    tflite::micro::GetTensorData<float>(out_count)[0] =
+        static_cast<float>(kept);
+    return kTfLiteOk;
+  }
+
+  static int32_t ToQ16(float value) {
+    const float q = value * 65536.0f;
+    // Room for the anchor multiply and the sum of two of them
+    if (q > 1073741823.0f) return 1073741823;
+    if (q < -1073741823.0f) return -1073741823;
+    return static_cast<int32_t>(lroundf(q));
+  }
+
+  // Boxes are normalised to the image, anything beyond 8 images away is
+  // garbage of a saturated encoding
+  static int32_t Clamp(int32_t value) {
+    const int32_t limit = 8 << 16;
+    return value < -limit ? -limit : (value > limit ? limit : value);
+  }
+
+  // Center and size of an anchor in Q16
+  static void Anchor(const OpData* data, const TfLiteEvalTensor* anchors,
+                     int index, int32_t anchor[4]) {
+    for (int i = 0; i < 4; i++) {
+      float value;
+      if (data->anchor_type == kTfLiteFloat32) {
+        value = tflite::micro::GetTensorData<float>(anchors)[index * 4 + i];
+      } else if (data->anchor_type == kTfLiteInt8) {
+        value = data->anchor_scale *
+                (tflite::micro::GetTensorData<int8_t>(anchors)[index * 4 + i] -
+                 data->anchor_zero_point);
+      } else {
+        value = data->anchor_scale *
+                (tflite::micro::GetTensorData<uint8_t>(anchors)[index * 4 + i] -
+                 data->anchor_zero_point);
+      }
+      anchor[i] = ToQ16(value);
+    }
+  }
+
+  static void Decode(const OpData* data, const int8_t* encoding,
+                     const TfLiteEvalTensor* anchors, int index, Box* box) {
+    int32_t anchor[4];
+    Anchor(data, anchors, index, anchor);
+    const int32_t* tables = data->tables;
+
+    // ycenter = ty / y_scale * ha + ya, half height = exp(th / h_scale) *
+    // ha / 2, the same for x and w
+    const int64_t ha = anchor[2];
+    const int64_t wa = anchor[3];
+    const int32_t y = anchor[0] +
+        static_cast<int32_t>(tables[encoding[0] + 128] * ha >> 16);
+    const int32_t x = anchor[1] +
+        static_cast<int32_t>(tables[256 + encoding[1] + 128] * wa >> 16);
+    const int32_t h =
+        static_cast<int32_t>(tables[512 + encoding[2] + 128] * ha >> 16);
+    const int32_t w =
+        static_cast<int32_t>(tables[768 + encoding[3] + 128] * wa >> 16);
+    box->ymin = Clamp(y - h);
+    box->xmin = Clamp(x - w);
+    box->ymax = Clamp(y + h);
+    box->xmax = Clamp(x + w);
+    box->area = static_cast<int64_t>(box->ymax - box->ymin) *
+                (box->xmax - box->xmin);
+  }
+
+  // IoU above threshold, inter / (area_a + area_b - inter) > t in Q16
+  static bool Overlaps(const Box& a, const Box& b, int32_t threshold) {
+    const int32_t ymin = a.ymin > b.ymin ? a.ymin : b.ymin;
+    const int32_t xmin = a.xmin > b.xmin ? a.xmin : b.xmin;
+    const int32_t ymax = a.ymax < b.ymax ? a.ymax : b.ymax;
+    const int32_t xmax = a.xmax < b.xmax ? a.xmax : b.xmax;
+    if (ymax <= ymin || xmax <= xmin) {
+      return false;
+    }
+    // Coordinates are clamped to 2^19, so both sides stay under 2^58
+    const int64_t inter = static_cast<int64_t>(ymax - ymin) * (xmax - xmin);
+    const int64_t area = a.area + b.area - inter;
+    if (area <= 0) {
+      return false;
+    }
+    return (inter << 16) > area * threshold;
+  }
+
+  const tflite::MicroOpResolver& base_;
+  mutable TfLiteRegistration registration_;
+
+  static const TfLiteRegistration*& Generic() {
+    static const TfLiteRegistration* generic = nullptr;
+    return generic;
+  }
+};
+
+#endif  // DETECTION_POSTPROCESS_H
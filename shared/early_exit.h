@@ -0,0 +1,174 @@
+#ifndef EARLY_EXIT_H
+#define EARLY_EXIT_H
+
+#include <stdint.h>
+#include <libopencm3/cm3/dwt.h>
+
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/schema/schema_generated.h"
+
+#include "output_scores.h"
+
+// Anytime inference for models with intermediate classifier heads.
+//
+// Every output of the model is an exit, they are ordered by the operator
+// that writes them, so exit 0 is the earliest head and the last one is
+// the full model. Invoke() runs the graph with InferenceEngine::InvokeStep()
+// one operator at a time and stops at an exit when:
+// - its top score reaches the threshold, answer is sure enough, or
+// - next exit can not be reached before the deadline, estimated from
+//   cycles of the operators in earlier runs.
+// The first exit is always reached, the rest of the graph is dropped.
+// Scores of later heads are stale then, read only scores() of exit().
+//
+// Model with one output has one exit and runs as with Invoke(), so the
+// same code works with any model.
+//
+// Usage example:
+// static EarlyExit<Engine> early_exit;
+// if (!early_exit.Bind(&engine)) return;    // after every Setup()
+// early_exit.Invoke(deadline_cycles, 900);
+// early_exit.scores().Format(buf, sizeof(buf), 4);
+template <typename Engine>
+class EarlyExit {
+ public:
+  static constexpr int kMaxExits = 4;
+  // Same as CycleProfiler, graphs with more operators are not supported
+  static constexpr int kMaxOps = 64;
+
+  // Finds exits of the loaded model, returns false if there are more
+  // outputs than kMaxExits or one of them is not int8 or float scores
+  bool Bind(Engine* engine) {
+    engine_ = engine;
+    num_exits_ = 0;
+    exit_ = -1;
+
+    const tflite::SubGraph* graph = engine->model()->subgraphs()->Get(0);
+    num_ops_ = static_cast<int>(graph->operators()->size());
+    int outputs = static_cast<int>(graph->outputs()->size());
+    if (num_ops_ > kMaxOps || outputs > kMaxExits) {
+      return false;
+    }
+    for (int i = 0; i < num_ops_; i++) {
+      op_cycles_[i] = 0;
+    }
+
+    for (int k = 0; k < outputs; k++) {
+      int op = Producer(graph, graph->outputs()->Get(k));
+      if (op < 0 || !scores_[num_exits_].Bind(engine->output(k))) {
+        return false;
+      }
+
+      // Insertion by operator, output order of the converter is arbitrary
+      int at = num_exits_++;
+      OutputScores scores = scores_[at];
+      while (at > 0 && exit_op_[at - 1] > op) {
+        exit_op_[at] = exit_op_[at - 1];
+        scores_[at] = scores_[at - 1];
+        at--;
+      }
+      exit_op_[at] = op;
+      scores_[at] = scores;
+    }
+    return num_exits_ > 0;
+  }
+
+  // Runs inference up to an exit, deadline_cycles 0 is no deadline,
+  // threshold_milli above 1000 never stops on confidence
+  bool Invoke(uint32_t deadline_cycles, int32_t threshold_milli) {
+    uint32_t start = DWT_CYCCNT;
+    int next = 0;
+    exit_ = -1;
+    confident_ = false;
+
+    for (int op = 0; op < num_ops_ && next < num_exits_; op++) {
+      uint32_t before = DWT_CYCCNT;
+      if (!engine_->InvokeStep(1)) {
+        return false;
+      }
+      uint32_t took = DWT_CYCCNT - before;
+      // Running average over 4 runs, first run sets it
+      op_cycles_[op] = op_cycles_[op] ? op_cycles_[op] - op_cycles_[op] / 4 +
+                                        took / 4
+                                      : took;
+
+      if (op != exit_op_[next]) {
+        continue;
+      }
+      exit_ = next++;
+      if (next == num_exits_) {
+        break;
+      }
+      if (Top(scores_[exit_]) >= threshold_milli) {
+        confident_ = true;
+        break;
+      }
+      if (deadline_cycles && (DWT_CYCCNT - start) +
+                                 Estimate(op + 1, exit_op_[next]) >
+                             deadline_cycles) {
+        break;
+      }
+    }
+
+    engine_->InvokeCancel();
+    cycles_ = DWT_CYCCNT - start;
+    return exit_ >= 0;
+  }
+
+  // Exit taken by the last Invoke(), -1 if it failed
+  int exit() const { return exit_; }
+  int exits() const { return num_exits_; }
+  // Last Invoke() stopped because score reached the threshold
+  bool confident() const { return confident_; }
+  uint32_t cycles() const { return cycles_; }
+  const OutputScores& scores() const {
+    return scores_[exit_ < 0 ? num_exits_ - 1 : exit_];
+  }
+
+ private:
+  // Operator that writes tensor, -1 if it is not written by any
+  static int Producer(const tflite::SubGraph* graph, int32_t tensor) {
+    for (int op = static_cast<int>(graph->operators()->size()) - 1; op >= 0;
+         op--) {
+      const flatbuffers::Vector<int32_t>* outputs =
+          graph->operators()->Get(op)->outputs();
+      for (uint32_t i = 0; i < outputs->size(); i++) {
+        if (outputs->Get(i) == tensor) {
+          return op;
+        }
+      }
+    }
+    return -1;
+  }
+
+  static int32_t Top(const OutputScores& scores) {
+    int32_t top = INT32_MIN;
+    for (int i = 0; i < scores.count(); i++) {
+      int32_t milli = scores.Milli(i);
+      top = milli > top ? milli : top;
+    }
+    return top;
+  }
+
+  // Cycles of operators first..last, operators that never ran count 0,
+  // so the first run goes through the whole graph
+  uint32_t Estimate(int first, int last) const {
+    uint32_t cycles = 0;
+    for (int op = first; op <= last; op++) {
+      cycles += op_cycles_[op];
+    }
+    return cycles;
+  }
+
+  Engine* engine_ = nullptr;
+  int num_ops_ = 0;
+  int num_exits_ = 0;
+  int exit_ = -1;
+  bool confident_ = false;
+  uint32_t cycles_ = 0;
+  int exit_op_[kMaxExits];
+  OutputScores scores_[kMaxExits];
+  uint32_t op_cycles_[kMaxOps];
+};
+
+#endif  // EARLY_EXIT_H
@@ -0,0 +1,185 @@
+#ifndef FAST_SCRATCH_H
+#define FAST_SCRATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/micro/micro_op_resolver.h"
+
+// Scratch buffers of kernels in a small pool of fast memory.
+//
+// Kernels request scratch, like im2col buffer of CMSIS-NN convolution,
+// with RequestScratchBufferInArena() in Prepare() and get it with
+// GetScratchBuffer() in Eval(), both through TfLiteContext. Resolver
+// wraps kernels it knows and swaps these two context functions while
+// the kernel runs, so its requests are served from the pool first and
+// only what does not fit goes to the arena. Inner GEMM loads then hit
+// zero wait state memory, even when the arena has to live in SRAM.
+//
+// Nodes run one after another and scratch does not outlive Eval(), so
+// every node gets the pool from its start and the pool only needs the
+// largest node. Pool indices start at kIndexBase, far above any index
+// of the arena, kernels just pass them back.
+//
+// Callbacks are plain functions, so state is static and only one pool
+// can exist. Wrap it around all other resolvers, then requests of
+// Conv2DPoolResolver and Conv2DSpecialisedResolver land in it too. Call
+// Reset() before each model is set up.
+//
+// Usage example:
+// static uint8_t pool[8 * 1024] DTCM_FAST_BSS;
+// static FastScratchResolver scratch_resolver(engine.resolver(), pool,
+//                                             sizeof(pool));
+// engine.SetResolver(&scratch_resolver);
+// scratch_resolver.Reset();
+// engine.Setup(model_data, error_reporter);
+
+class FastScratchResolver : public tflite::MicroOpResolver {
+ public:
+  static constexpr int kIndexBase = 0x4000;
+  static constexpr int kMaxBuffers = 16;
+
+  FastScratchResolver(const tflite::MicroOpResolver& base, void* pool,
+                      size_t size)
+      : base_(base) {
+    State& state = GetState();
+    state.pool = static_cast<uint8_t*>(pool);
+    state.size = size;
+    Reset();
+  }
+
+  // Forgets buffers of the previous model, its interpreter must not run
+  void Reset() {
+    State& state = GetState();
+    state.count = 0;
+    state.node_used = 0;
+    state.peak = 0;
+  }
+
+  // Largest pool use of one node, pool can be shrunk down to it
+  size_t peak() const { return GetState().peak; }
+  size_t size() const { return GetState().size; }
+
+  // Buffers handed out in Prepare() live here and not in the arena, add
+  // them as a region to InferenceEngine::SaveState() and RestoreState()
+  void* state() const { return &GetState(); }
+  size_t state_size() const { return sizeof(State); }
+
+  const TfLiteRegistration* FindOp(tflite::BuiltinOperator op) const override {
+    const TfLiteRegistration* registration = base_.FindOp(op);
+    if (registration == nullptr) {
+      return nullptr;
+    }
+
+    // Kernels that request scratch
+    switch (op) {
+      case tflite::BuiltinOperator_CONV_2D:
+        return Wrap<0>(registration);
+      case tflite::BuiltinOperator_DEPTHWISE_CONV_2D:
+        return Wrap<1>(registration);
+      case tflite::BuiltinOperator_FULLY_CONNECTED:
+        return Wrap<2>(registration);
+      case tflite::BuiltinOperator_AVERAGE_POOL_2D:
+        return Wrap<3>(registration);
+      default:
+        return registration;
+    }
+  }
+
+  const TfLiteRegistration* FindOp(const char* op) const override {
+    return base_.FindOp(op);
+  }
+
+  BuiltinParseFunction GetOpDataParser(
+      tflite::BuiltinOperator op) const override {
+    return base_.GetOpDataParser(op);
+  }
+
+ private:
+  static constexpr int kSlots = 4;
+
+  struct State {
+    uint8_t* pool;
+    size_t size;
+    size_t node_used;       // Pool used by node that is being prepared
+    size_t peak;
+    int count;
+    uint32_t offsets[kMaxBuffers];
+    const TfLiteRegistration* generic[kSlots];
+    TfLiteStatus (*request)(TfLiteContext*, size_t, int*);
+    void* (*get)(TfLiteContext*, int);
+  };
+
+  template <int kSlot>
+  const TfLiteRegistration* Wrap(const TfLiteRegistration* registration) const {
+    // Keep init, free, builtin code and version, node data is untouched
+    GetState().generic[kSlot] = registration;
+    registrations_[kSlot] = *registration;
+    registrations_[kSlot].prepare = Prepare<kSlot>;
+    registrations_[kSlot].invoke = Eval<kSlot>;
+    return &registrations_[kSlot];
+  }
+
+  template <int kSlot>
+  static TfLiteStatus Prepare(TfLiteContext* context, TfLiteNode* node) {
+    State& state = GetState();
+    const TfLiteRegistration* generic = state.generic[kSlot];
+    if (generic->prepare == nullptr) {
+      return kTfLiteOk;
+    }
+
+    state.node_used = 0;
+    state.request = context->RequestScratchBufferInArena;
+    context->RequestScratchBufferInArena = Request;
+    TfLiteStatus status = generic->prepare(context, node);
+    context->RequestScratchBufferInArena = state.request;
+    return status;
+  }
+
+  template <int kSlot>
+  static TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
+    State& state = GetState();
+    state.get = context->GetScratchBuffer;
+    context->GetScratchBuffer = Get;
+    TfLiteStatus status = state.generic[kSlot]->invoke(context, node);
+    context->GetScratchBuffer = state.get;
+    return status;
+  }
+
+  static TfLiteStatus Request(TfLiteContext* context, size_t bytes,
+                              int* buffer_index) {
+    State& state = GetState();
+    const size_t aligned = (bytes + 15) & ~static_cast<size_t>(15);
+    if (state.count == kMaxBuffers ||
+        state.node_used + aligned > state.size) {
+      return state.request(context, bytes, buffer_index);
+    }
+
+    state.offsets[state.count] = state.node_used;
+    state.node_used += aligned;
+    if (state.node_used > state.peak) {
+      state.peak = state.node_used;
+    }
+    *buffer_index = kIndexBase + state.count++;
+    return kTfLiteOk;
+  }
+
+  static void* Get(TfLiteContext* context, int buffer_index) {
+    State& state = GetState();
+    if (buffer_index >= kIndexBase) {
+      return state.pool + state.offsets[buffer_index - kIndexBase];
+    }
+    return state.get(context, buffer_index);
+  }
+
+  static State& GetState() {
+    static State state;
+    return state;
+  }
+
+  const tflite::MicroOpResolver& base_;
+  mutable TfLiteRegistration registrations_[kSlots];
+};
+
+#endif  // FAST_SCRATCH_H
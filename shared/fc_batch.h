@@ -0,0 +1,264 @@
+#ifndef FC_BATCH_H
+#define FC_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tensorflow/lite/c/builtin_op_data.h"
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/kernels/internal/common.h"
+#include "tensorflow/lite/kernels/internal/quantization_util.h"
+#include "tensorflow/lite/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/micro_op_resolver.h"
+
+#ifdef CMSIS_NN
+#include "arm_nnsupportfunctions.h"
+#endif
+
+// FullyConnected that reads each weight once for two batch rows.
+//
+// Large FullyConnected layers are limited by flash bandwidth. Original
+// kernel runs arm_fully_connected_s8() over the whole weight matrix once
+// per batch row, so a model with batch 2, see batch_model.py, streams the
+// weights twice. Here every loaded weight is multiplied with both rows,
+// arm_nn_mat_mult_nt_t_s8() on target, which takes two rows of input and
+// two of weights at a time, and a loop with two accumulators on host.
+// Results are the same as of the original kernel, per frame flash traffic
+// of the layer is halved and its cost nearly so.
+//
+// Application fills the input tensor with two frames, or two crops of one
+// frame, one after the other, and reads two rows of output. First frame
+// waits for the second, that is the latency this trades for throughput.
+//
+// Only int8 nodes with more than one batch row and plain weights run here,
+// everything else, including batch 1, goes to the original kernel.
+// Weights of fc_palette.h, fc_int4.h and fc_sparse.h have their own size,
+// so wrap this resolver inside those ones and it passes their fallback
+// nodes on.
+//
+// Usage example:
+// static FullyConnectedBatchResolver batch_resolver(engine.resolver());
+// static FullyConnectedInt4Resolver int4_resolver(batch_resolver);
+// engine.SetResolver(&int4_resolver);
+// engine.Setup(batch_model_data, error_reporter);
+
+class FullyConnectedBatchResolver : public tflite::MicroOpResolver {
+ public:
+  explicit FullyConnectedBatchResolver(const tflite::MicroOpResolver& base)
+      : base_(base) {}
+
+  const TfLiteRegistration* FindOp(tflite::BuiltinOperator op) const override {
+    const TfLiteRegistration* registration = base_.FindOp(op);
+    if (op != tflite::BuiltinOperator_FULLY_CONNECTED ||
+        registration == nullptr) {
+      return registration;
+    }
+
+    // Keep builtin code and version, so profiler still reports it
+    Generic() = registration;
+    registration_ = *registration;
+    registration_.init = Init;
+    registration_.free = nullptr;
+    registration_.prepare = Prepare;
+    registration_.invoke = Eval;
+    return &registration_;
+  }
+
+  const TfLiteRegistration* FindOp(const char* op) const override {
+    return base_.FindOp(op);
+  }
+
+  BuiltinParseFunction GetOpDataParser(
+      tflite::BuiltinOperator op) const override {
+    return base_.GetOpDataParser(op);
+  }
+
+ private:
+  struct OpData {
+    void* generic_data;
+    bool batched;
+    int rows;               // Output depth
+    int depth;              // Weights of a row
+    int batches;
+    int32_t input_offset;
+    int32_t output_offset;
+    int32_t output_multiplier;
+    int output_shift;
+    int32_t activation_min;
+    int32_t activation_max;
+#ifdef CMSIS_NN
+    // Kernel takes a multiplier and shift per row, and needs a bias
+    int32_t* multipliers;
+    int32_t* shifts;
+    int32_t* zero_bias;
+#endif
+  };
+
+  static void* Init(TfLiteContext* context, const char* buffer,
+                    size_t length) {
+    OpData* data = static_cast<OpData*>(
+        context->AllocatePersistentBuffer(context, sizeof(OpData)));
+    if (data == nullptr) {
+      return nullptr;
+    }
+    data->generic_data = Generic()->init
+                             ? Generic()->init(context, buffer, length)
+                             : nullptr;
+    data->batched = false;
+    return data;
+  }
+
+  static TfLiteStatus Prepare(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+
+    const TfLiteTensor* input = tflite::GetInput(context, node, 0);
+    const TfLiteTensor* filter = tflite::GetInput(context, node, 1);
+    const TfLiteTensor* bias = tflite::GetOptionalInputTensor(context, node, 2);
+    TfLiteTensor* output = tflite::GetOutput(context, node, 0);
+    const TfLiteFullyConnectedParams* params =
+        static_cast<const TfLiteFullyConnectedParams*>(node->builtin_data);
+
+    data->batched = input->type == kTfLiteInt8 &&
+                    filter->type == kTfLiteInt8 &&
+                    output->type == kTfLiteInt8 && filter->dims->size == 2 &&
+                    filter->params.zero_point == 0 &&
+                    params->weights_format ==
+                        kTfLiteFullyConnectedWeightsFormatDefault;
+    if (data->batched) {
+      data->rows = filter->dims->data[0];
+      data->depth = filter->dims->data[1];
+      data->batches = tflite::NumElements(input) / data->depth;
+      data->batched = data->batches > 1 &&
+                      filter->bytes ==
+                          static_cast<size_t>(data->rows) * data->depth;
+    }
+    if (!data->batched) {
+      node->user_data = data->generic_data;
+      TfLiteStatus status =
+          Generic()->prepare ? Generic()->prepare(context, node) : kTfLiteOk;
+      node->user_data = data;
+      return status;
+    }
+
+    double real_multiplier = 0.0;
+    TF_LITE_ENSURE_STATUS(tflite::GetQuantizedConvolutionMultipler(
+        context, input, filter, bias, output, &real_multiplier));
+    tflite::QuantizeMultiplier(real_multiplier, &data->output_multiplier,
+                               &data->output_shift);
+    TF_LITE_ENSURE_STATUS(tflite::CalculateActivationRangeQuantized(
+        context, params->activation, output, &data->activation_min,
+        &data->activation_max));
+
+    data->input_offset = -input->params.zero_point;
+    data->output_offset = output->params.zero_point;
+
+#ifdef CMSIS_NN
+    const int arrays = bias ? 2 : 3;
+    data->multipliers = static_cast<int32_t*>(context->AllocatePersistentBuffer(
+        context, arrays * data->rows * sizeof(int32_t)));
+    if (data->multipliers == nullptr) {
+      return kTfLiteError;
+    }
+    data->shifts = data->multipliers + data->rows;
+    data->zero_bias = bias ? nullptr : data->shifts + data->rows;
+    for (int r = 0; r < data->rows; r++) {
+      data->multipliers[r] = data->output_multiplier;
+      data->shifts[r] = data->output_shift;
+      if (data->zero_bias) {
+        data->zero_bias[r] = 0;
+      }
+    }
+#endif
+    return kTfLiteOk;
+  }
+
+  static TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+
+    if (!data->batched) {
+      node->user_data = data->generic_data;
+      TfLiteStatus status = Generic()->invoke(context, node);
+      node->user_data = data;
+      return status;
+    }
+
+    const TfLiteEvalTensor* input = tflite::micro::GetEvalInput(context, node, 0);
+    const TfLiteEvalTensor* filter =
+        tflite::micro::GetEvalInput(context, node, 1);
+    const TfLiteEvalTensor* bias =
+        node->inputs->size > 2 ? tflite::micro::GetEvalInput(context, node, 2)
+                               : nullptr;
+    TfLiteEvalTensor* output = tflite::micro::GetEvalOutput(context, node, 0);
+
+    const int8_t* input_data = tflite::micro::GetTensorData<int8_t>(input);
+    const int8_t* weights = tflite::micro::GetTensorData<int8_t>(filter);
+    const int32_t* bias_data =
+        bias ? tflite::micro::GetTensorData<int32_t>(bias) : nullptr;
+    int8_t* out = tflite::micro::GetTensorData<int8_t>(output);
+
+#ifdef CMSIS_NN
+    if (arm_nn_mat_mult_nt_t_s8(
+            input_data, weights, bias_data ? bias_data : data->zero_bias, out,
+            data->multipliers, data->shifts, data->batches, data->rows,
+            data->depth, data->input_offset, data->output_offset,
+            data->activation_min, data->activation_max) != ARM_MATH_SUCCESS) {
+      return kTfLiteError;
+    }
+#else
+    const int rows = data->rows;
+    const int depth = data->depth;
+    const int32_t offset = data->input_offset;
+    int b = 0;
+    for (; b + 1 < data->batches; b += 2) {
+      const int8_t* first = input_data + b * depth;
+      const int8_t* second = first + depth;
+      for (int r = 0; r < rows; r++) {
+        const int8_t* row = weights + r * depth;
+        int32_t acc0 = bias_data ? bias_data[r] : 0;
+        int32_t acc1 = acc0;
+        for (int d = 0; d < depth; d++) {
+          const int32_t w = row[d];
+          acc0 += (first[d] + offset) * w;
+          acc1 += (second[d] + offset) * w;
+        }
+        out[b * rows + r] = Requantize(data, acc0);
+        out[(b + 1) * rows + r] = Requantize(data, acc1);
+      }
+    }
+    if (b < data->batches) {
+      const int8_t* last = input_data + b * depth;
+      for (int r = 0; r < rows; r++) {
+        const int8_t* row = weights + r * depth;
+        int32_t acc = bias_data ? bias_data[r] : 0;
+        for (int d = 0; d < depth; d++) {
+          acc += (last[d] + offset) * row[d];
+        }
+        out[b * rows + r] = Requantize(data, acc);
+      }
+    }
+#endif
+    return kTfLiteOk;
+  }
+
+#ifndef CMSIS_NN
+  static int8_t Requantize(const OpData* data, int32_t acc) {
+    acc = tflite::MultiplyByQuantizedMultiplier(acc, data->output_multiplier,
+                                                data->output_shift);
+    acc += data->output_offset;
+    acc = acc < data->activation_min ? data->activation_min : acc;
+    acc = acc > data->activation_max ? data->activation_max : acc;
+    return static_cast<int8_t>(acc);
+  }
+#endif
+
+  const tflite::MicroOpResolver& base_;
+  mutable TfLiteRegistration registration_;
+
+  static const TfLiteRegistration*& Generic() {
+    static const TfLiteRegistration* generic = nullptr;
+    return generic;
+  }
+};
+
+#endif  // FC_BATCH_H
@@ -0,0 +1,310 @@
+#ifndef FC_INT4_H
+#define FC_INT4_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "tensorflow/lite/c/builtin_op_data.h"
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/kernels/internal/common.h"
+#include "tensorflow/lite/kernels/internal/quantization_util.h"
+#include "tensorflow/lite/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/micro_op_resolver.h"
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#include "cmsis_gcc.h"
+#define FC_INT4_SIMD
+#endif
+
+// FullyConnected with signed 4 bit weights.
+//
+// quantize_int4.py requantizes large FullyConnected weights to -8..7 with
+// a per tensor scale, which it writes into the tensor, and stores two
+// weights per byte. Unlike fc_palette.h weights are not decoded into a
+// buffer: multiply accumulate reads packed words from flash and unpacks
+// them in registers, so flash holds and streams half of the bytes and
+// there is no decode pass.
+//
+// A word holds 8 weights, low nibble first. Masking nibbles into the high
+// half of each byte and SXTB16 with and without rotation give four pairs
+// of int16 weights, each 16 times the weight, which go straight into
+// SMLAD, two multiply accumulates per instruction. Input of a batch is
+// widened once into a scratch row, with its offset and in the order of
+// those pairs. Sum is exactly 16 times the int4 sum, it is shifted back
+// before requantization, so SIMD and plain loop give the same results.
+//
+// Weights are recognised by "INT4" at the start of their data, each row
+// has (depth + 1) / 2 bytes, other nodes run through the original kernel.
+// An int4 model can not run without it.
+//
+// Lane order of "INT4" rows makes Widen() permute input through a table
+// on every Invoke(). quantize_int4.py writes "I4X8" by default: weights of
+// each whole group are stored as 0 4 1 5 2 6 3 7, so unpacking gives
+// pairs of weights 0 2, 1 3, 4 6 and 5 7. That is the order SXTB16 gives
+// input bytes in, so a word of input is widened and offset with two
+// SXTAB16, and Dot() stays the same.
+//
+// Usage example:
+// static FullyConnectedInt4Resolver int4_resolver(engine.resolver());
+// engine.SetResolver(&int4_resolver);
+// engine.Setup(model_data, error_reporter);
+
+class FullyConnectedInt4Resolver : public tflite::MicroOpResolver {
+ public:
+  explicit FullyConnectedInt4Resolver(const tflite::MicroOpResolver& base)
+      : base_(base) {}
+
+  const TfLiteRegistration* FindOp(tflite::BuiltinOperator op) const override {
+    const TfLiteRegistration* registration = base_.FindOp(op);
+    if (op != tflite::BuiltinOperator_FULLY_CONNECTED ||
+        registration == nullptr) {
+      return registration;
+    }
+
+    // Keep builtin code and version, so profiler still reports it
+    Generic() = registration;
+    registration_ = *registration;
+    registration_.init = Init;
+    registration_.free = nullptr;
+    registration_.prepare = Prepare;
+    registration_.invoke = Eval;
+    return &registration_;
+  }
+
+  const TfLiteRegistration* FindOp(const char* op) const override {
+    return base_.FindOp(op);
+  }
+
+  BuiltinParseFunction GetOpDataParser(
+      tflite::BuiltinOperator op) const override {
+    return base_.GetOpDataParser(op);
+  }
+
+  // Returns true if weights were written by quantize_int4.py
+  static bool IsInt4(const void* weights) {
+    return weights != nullptr && (memcmp(weights, "INT4", 4) == 0 ||
+                                  IsInterleaved(weights));
+  }
+
+  static bool IsInterleaved(const void* weights) {
+    return memcmp(weights, "I4X8", 4) == 0;
+  }
+
+ private:
+  // Weights of one packed word
+  static constexpr int kGroup = 8;
+
+  struct OpData {
+    void* generic_data;
+    bool int4;
+    bool interleaved;       // "I4X8" order of whole groups
+    int rows;               // Output depth
+    int depth;              // Weights of a row
+    int32_t input_offset;
+    int32_t output_offset;
+    int32_t output_multiplier;
+    int output_shift;
+    int32_t activation_min;
+    int32_t activation_max;
+    int input_buffer_index;  // Widened input, int16 of each weight
+  };
+
+  static void* Init(TfLiteContext* context, const char* buffer,
+                    size_t length) {
+    OpData* data = static_cast<OpData*>(
+        context->AllocatePersistentBuffer(context, sizeof(OpData)));
+    if (data == nullptr) {
+      return nullptr;
+    }
+    data->generic_data = Generic()->init
+                             ? Generic()->init(context, buffer, length)
+                             : nullptr;
+    data->int4 = false;
+    return data;
+  }
+
+  static TfLiteStatus Prepare(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+
+    const TfLiteTensor* input = tflite::GetInput(context, node, 0);
+    const TfLiteTensor* filter = tflite::GetInput(context, node, 1);
+    const TfLiteTensor* bias = tflite::GetOptionalInputTensor(context, node, 2);
+    TfLiteTensor* output = tflite::GetOutput(context, node, 0);
+    const TfLiteFullyConnectedParams* params =
+        static_cast<const TfLiteFullyConnectedParams*>(node->builtin_data);
+
+    data->int4 = IsInt4(filter->data.raw);
+    if (!data->int4) {
+      node->user_data = data->generic_data;
+      TfLiteStatus status =
+          Generic()->prepare ? Generic()->prepare(context, node) : kTfLiteOk;
+      node->user_data = data;
+      return status;
+    }
+
+    if (input->type != kTfLiteInt8 || output->type != kTfLiteInt8 ||
+        filter->dims->size != 2 || filter->params.zero_point != 0 ||
+        params->weights_format != kTfLiteFullyConnectedWeightsFormatDefault) {
+      TF_LITE_KERNEL_LOG(context, "Int4 FullyConnected needs int8");
+      return kTfLiteError;
+    }
+
+    data->rows = filter->dims->data[0];
+    data->depth = filter->dims->data[1];
+    data->interleaved = IsInterleaved(filter->data.raw);
+
+    double real_multiplier = 0.0;
+    TF_LITE_ENSURE_STATUS(tflite::GetQuantizedConvolutionMultipler(
+        context, input, filter, bias, output, &real_multiplier));
+    tflite::QuantizeMultiplier(real_multiplier, &data->output_multiplier,
+                               &data->output_shift);
+    TF_LITE_ENSURE_STATUS(tflite::CalculateActivationRangeQuantized(
+        context, params->activation, output, &data->activation_min,
+        &data->activation_max));
+
+    data->input_offset = -input->params.zero_point;
+    data->output_offset = output->params.zero_point;
+
+    return context->RequestScratchBufferInArena(
+        context, data->depth * sizeof(int16_t), &data->input_buffer_index);
+  }
+
+  static TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+
+    if (!data->int4) {
+      node->user_data = data->generic_data;
+      TfLiteStatus status = Generic()->invoke(context, node);
+      node->user_data = data;
+      return status;
+    }
+
+    const TfLiteEvalTensor* input = tflite::micro::GetEvalInput(context, node, 0);
+    const TfLiteEvalTensor* filter =
+        tflite::micro::GetEvalInput(context, node, 1);
+    const TfLiteEvalTensor* bias =
+        node->inputs->size > 2 ? tflite::micro::GetEvalInput(context, node, 2)
+                               : nullptr;
+    TfLiteEvalTensor* output = tflite::micro::GetEvalOutput(context, node, 0);
+    int16_t* widened = static_cast<int16_t*>(
+        context->GetScratchBuffer(context, data->input_buffer_index));
+
+    const int rows = data->rows;
+    const int depth = data->depth;
+    const int batches = tflite::micro::GetTensorShape(input).FlatSize() / depth;
+    const uint8_t* packed =
+        reinterpret_cast<const uint8_t*>(
+            tflite::micro::GetTensorData<int8_t>(filter)) +
+        4;
+    const int packed_row = (depth + 1) / 2;
+    const int8_t* input_data = tflite::micro::GetTensorData<int8_t>(input);
+    const int32_t* bias_data =
+        bias ? tflite::micro::GetTensorData<int32_t>(bias) : nullptr;
+    int8_t* out = tflite::micro::GetTensorData<int8_t>(output);
+
+    for (int b = 0; b < batches; b++) {
+      const int8_t* in = input_data + b * depth;
+      Widen(in, depth, data->input_offset, data->interleaved, widened);
+      for (int r = 0; r < rows; r++) {
+        int32_t acc =
+            Dot(packed + r * packed_row, widened, depth, data->interleaved);
+        if (bias_data) {
+          acc += bias_data[r];
+        }
+        acc = tflite::MultiplyByQuantizedMultiplier(
+            acc, data->output_multiplier, data->output_shift);
+        acc += data->output_offset;
+        acc = acc < data->activation_min ? data->activation_min : acc;
+        acc = acc > data->activation_max ? data->activation_max : acc;
+        out[b * rows + r] = static_cast<int8_t>(acc);
+      }
+    }
+    return kTfLiteOk;
+  }
+
+  // Weight i of a row, whole groups of "I4X8" store weight k of the group
+  // at nibble k % 4 * 2 + k / 4
+  static int32_t Nibble(const uint8_t* row, int i, bool interleaved,
+                        int depth) {
+    if (interleaved && i - i % kGroup + kGroup <= depth) {
+      const int k = i % kGroup;
+      i += k % 4 * 2 + k / 4 - k;
+    }
+    const uint8_t pair = row[i / 2];
+    // Nibble is moved to the top of a byte and shifted back with its sign
+    const int8_t top = static_cast<int8_t>(i & 1 ? pair & 0xF0 : pair << 4);
+    return top >> 4;
+  }
+
+  // Whole groups of the SIMD path are stored in lane order of Dot(),
+  // inputs 0 4 2 6 1 5 3 7 for "INT4" and 0 2 1 3 4 6 5 7 for "I4X8", the
+  // rest of the row in order
+  static void Widen(const int8_t* input, int depth, int32_t offset,
+                    bool interleaved, int16_t* widened) {
+    int d = 0;
+#ifdef FC_INT4_SIMD
+    if (interleaved) {
+      const uint32_t offsets = (offset & 0xFFFF) * 0x10001u;
+      const int whole = depth - depth % kGroup;
+      for (; d < whole; d += 4) {
+        uint32_t word;
+        memcpy(&word, input + d, 4);
+        const uint32_t pairs[2] = {__SXTAB16(offsets, word),
+                                   __SXTAB16(offsets, __ROR(word, 8))};
+        memcpy(widened + d, pairs, sizeof(pairs));
+      }
+    }
+    static const int kLanes[kGroup] = {0, 4, 2, 6, 1, 5, 3, 7};
+    for (; d + kGroup <= depth; d += kGroup) {
+      for (int i = 0; i < kGroup; i++) {
+        widened[d + i] = input[d + kLanes[i]] + offset;
+      }
+    }
+#else
+    (void) interleaved;
+#endif
+    for (; d < depth; d++) {
+      widened[d] = input[d] + offset;
+    }
+  }
+
+  static int32_t Dot(const uint8_t* row, const int16_t* widened, int depth,
+                     bool interleaved) {
+    int d = 0;
+    int32_t acc = 0;
+#ifdef FC_INT4_SIMD
+    int32_t acc16 = 0;
+    for (; d + kGroup <= depth; d += kGroup) {
+      uint32_t word;
+      uint32_t x[4];
+      memcpy(&word, row + d / 2, 4);
+      memcpy(x, widened + d, sizeof(x));
+      // Byte k holds weights 2k and 2k + 1, each lands in the top nibble
+      const uint32_t low = (word << 4) & 0xF0F0F0F0u;
+      const uint32_t high = word & 0xF0F0F0F0u;
+      acc16 = __SMLAD(__SXTB16(low), x[0], acc16);
+      acc16 = __SMLAD(__SXTB16(__ROR(low, 8)), x[1], acc16);
+      acc16 = __SMLAD(__SXTB16(high), x[2], acc16);
+      acc16 = __SMLAD(__SXTB16(__ROR(high, 8)), x[3], acc16);
+    }
+    // Every product is a multiple of 16, shift is exact
+    acc = acc16 >> 4;
+#endif
+    for (; d < depth; d++) {
+      acc += Nibble(row, d, interleaved, depth) * widened[d];
+    }
+    return acc;
+  }
+
+  const tflite::MicroOpResolver& base_;
+  mutable TfLiteRegistration registration_;
+
+  static const TfLiteRegistration*& Generic() {
+    static const TfLiteRegistration* generic = nullptr;
+    return generic;
+  }
+};
+
+#endif  // FC_INT4_H
@@ -0,0 +1,306 @@
+#ifndef FC_PALETTE_H
+#define FC_PALETTE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "tensorflow/lite/c/builtin_op_data.h"
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/kernels/internal/common.h"
+#include "tensorflow/lite/kernels/internal/quantization_util.h"
+#include "tensorflow/lite/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/micro_op_resolver.h"
+
+#ifdef CMSIS_NN
+#include "arm_nnfunctions.h"
+#endif
+
+// FullyConnected with 4 bit palettized weights.
+//
+// palettize_weights.py stores each row of large FullyConnected weights as
+// 16 int8 values and a nibble per weight, flash then holds and streams
+// half of the bytes. Kernel decodes a tile of rows into a scratch buffer
+// and runs the int8 multiply accumulate over it, CMSIS-NN on target and
+// a plain loop on host. Decoded weights are ordinary int8 with the
+// quantization of the tensor, so only clustering changes the results.
+//
+// Palettized weights are recognised by "PLT4" and kVersion at the start of
+// their data, in a buffer that is not rows * depth bytes long, so plain
+// int8 weights that happen to start with the same bytes still run through
+// the original kernel like other nodes. "PLT4" with another version or
+// size stops Prepare() with an error. Tile is at most
+// kTileBytes, wrap FastScratchResolver around this resolver and it is
+// decoded into DTCM. A palettized model can not run without it.
+//
+// Usage example:
+// static FullyConnectedPaletteResolver palette_resolver(engine.resolver());
+// engine.SetResolver(&palette_resolver);
+// engine.Setup(model_data, error_reporter);
+
+class FullyConnectedPaletteResolver : public tflite::MicroOpResolver {
+ public:
+  static constexpr int kPaletteSize = 16;
+  static constexpr int kVersion = 1;
+  static constexpr int kHeaderBytes = 8;   // "PLT4", version, 3 zero
+  static constexpr int kTileBytes = 4096;
+
+  explicit FullyConnectedPaletteResolver(const tflite::MicroOpResolver& base)
+      : base_(base) {}
+
+  const TfLiteRegistration* FindOp(tflite::BuiltinOperator op) const override {
+    const TfLiteRegistration* registration = base_.FindOp(op);
+    if (op != tflite::BuiltinOperator_FULLY_CONNECTED ||
+        registration == nullptr) {
+      return registration;
+    }
+
+    // Keep builtin code and version, so profiler still reports it
+    Generic() = registration;
+    registration_ = *registration;
+    registration_.init = Init;
+    registration_.free = nullptr;
+    registration_.prepare = Prepare;
+    registration_.invoke = Eval;
+    return &registration_;
+  }
+
+  const TfLiteRegistration* FindOp(const char* op) const override {
+    return base_.FindOp(op);
+  }
+
+  BuiltinParseFunction GetOpDataParser(
+      tflite::BuiltinOperator op) const override {
+    return base_.GetOpDataParser(op);
+  }
+
+  // Returns true if weights look like palettize_weights.py wrote them,
+  // Prepare() checks version and size
+  static bool IsPalettized(const TfLiteTensor* filter) {
+    return filter->data.raw != nullptr && filter->dims->size == 2 &&
+           filter->bytes >= 4 &&
+           filter->bytes != static_cast<size_t>(filter->dims->data[0]) *
+                                filter->dims->data[1] &&
+           memcmp(filter->data.raw, "PLT4", 4) == 0;
+  }
+
+ private:
+  struct OpData {
+    void* generic_data;
+    bool palettized;
+    int rows;               // Output depth, one palette each
+    int depth;              // Weights of a row
+    int tile_rows;          // Rows decoded at a time
+    int32_t input_offset;
+    int32_t filter_offset;
+    int32_t output_offset;
+    int32_t output_multiplier;
+    int output_shift;
+    int32_t activation_min;
+    int32_t activation_max;
+    int tile_buffer_index;
+  };
+
+  static void* Init(TfLiteContext* context, const char* buffer,
+                    size_t length) {
+    OpData* data = static_cast<OpData*>(
+        context->AllocatePersistentBuffer(context, sizeof(OpData)));
+    if (data == nullptr) {
+      return nullptr;
+    }
+    data->generic_data = Generic()->init
+                             ? Generic()->init(context, buffer, length)
+                             : nullptr;
+    data->palettized = false;
+    return data;
+  }
+
+  static TfLiteStatus Prepare(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+
+    const TfLiteTensor* input = tflite::GetInput(context, node, 0);
+    const TfLiteTensor* filter = tflite::GetInput(context, node, 1);
+    const TfLiteTensor* bias = tflite::GetOptionalInputTensor(context, node, 2);
+    TfLiteTensor* output = tflite::GetOutput(context, node, 0);
+    const TfLiteFullyConnectedParams* params =
+        static_cast<const TfLiteFullyConnectedParams*>(node->builtin_data);
+
+    data->palettized = IsPalettized(filter);
+    if (!data->palettized) {
+      node->user_data = data->generic_data;
+      TfLiteStatus status =
+          Generic()->prepare ? Generic()->prepare(context, node) : kTfLiteOk;
+      node->user_data = data;
+      return status;
+    }
+
+    if (input->type != kTfLiteInt8 || output->type != kTfLiteInt8 ||
+        filter->dims->size != 2 ||
+        params->weights_format != kTfLiteFullyConnectedWeightsFormatDefault) {
+      TF_LITE_KERNEL_LOG(context, "Palettized FullyConnected needs int8");
+      return kTfLiteError;
+    }
+
+    data->rows = filter->dims->data[0];
+    data->depth = filter->dims->data[1];
+    const size_t expected =
+        kHeaderBytes + static_cast<size_t>(data->rows) *
+                           (kPaletteSize + (data->depth + 1) / 2);
+    if (filter->bytes < kHeaderBytes ||
+        filter->data.raw[4] != kVersion || filter->bytes != expected) {
+      TF_LITE_KERNEL_LOG(context,
+                         "Palettized weights of version %d, %d bytes, "
+                         "kernel knows version %d of %d bytes",
+                         filter->bytes >= kHeaderBytes ? filter->data.raw[4]
+                                                       : -1,
+                         static_cast<int>(filter->bytes), kVersion,
+                         static_cast<int>(expected));
+      return kTfLiteError;
+    }
+    data->tile_rows = kTileBytes / data->depth;
+    if (data->tile_rows < 1) {
+      data->tile_rows = 1;
+    }
+    if (data->tile_rows > data->rows) {
+      data->tile_rows = data->rows;
+    }
+
+    double real_multiplier = 0.0;
+    TF_LITE_ENSURE_STATUS(tflite::GetQuantizedConvolutionMultipler(
+        context, input, filter, bias, output, &real_multiplier));
+    tflite::QuantizeMultiplier(real_multiplier, &data->output_multiplier,
+                               &data->output_shift);
+    TF_LITE_ENSURE_STATUS(tflite::CalculateActivationRangeQuantized(
+        context, params->activation, output, &data->activation_min,
+        &data->activation_max));
+
+    data->input_offset = -input->params.zero_point;
+    data->filter_offset = -filter->params.zero_point;
+    data->output_offset = output->params.zero_point;
+
+    return context->RequestScratchBufferInArena(
+        context, data->tile_rows * data->depth, &data->tile_buffer_index);
+  }
+
+  static TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+
+    if (!data->palettized) {
+      node->user_data = data->generic_data;
+      TfLiteStatus status = Generic()->invoke(context, node);
+      node->user_data = data;
+      return status;
+    }
+
+    const TfLiteEvalTensor* input = tflite::micro::GetEvalInput(context, node, 0);
+    const TfLiteEvalTensor* filter =
+        tflite::micro::GetEvalInput(context, node, 1);
+    const TfLiteEvalTensor* bias =
+        node->inputs->size > 2 ? tflite::micro::GetEvalInput(context, node, 2)
+                               : nullptr;
+    TfLiteEvalTensor* output = tflite::micro::GetEvalOutput(context, node, 0);
+    int8_t* tile = static_cast<int8_t*>(
+        context->GetScratchBuffer(context, data->tile_buffer_index));
+
+    const int rows = data->rows;
+    const int depth = data->depth;
+    const int batches = tflite::micro::GetTensorShape(input).FlatSize() / depth;
+    const int8_t* palettes =
+        tflite::micro::GetTensorData<int8_t>(filter) + kHeaderBytes;
+    const uint8_t* packed = reinterpret_cast<const uint8_t*>(
+        palettes + rows * kPaletteSize);
+    const int packed_row = (depth + 1) / 2;
+    const int8_t* input_data = tflite::micro::GetTensorData<int8_t>(input);
+    const int32_t* bias_data =
+        bias ? tflite::micro::GetTensorData<int32_t>(bias) : nullptr;
+    int8_t* out = tflite::micro::GetTensorData<int8_t>(output);
+
+    for (int first = 0; first < rows; first += data->tile_rows) {
+      const int count =
+          rows - first < data->tile_rows ? rows - first : data->tile_rows;
+      for (int r = 0; r < count; r++) {
+        DecodeRow(palettes + (first + r) * kPaletteSize,
+                  packed + (first + r) * packed_row, depth, tile + r * depth);
+      }
+
+      for (int b = 0; b < batches; b++) {
+        TF_LITE_ENSURE_STATUS(MultiplyTile(
+            data, input_data + b * depth, tile, count,
+            bias_data ? bias_data + first : nullptr,
+            out + b * rows + first));
+      }
+    }
+    return kTfLiteOk;
+  }
+
+  static void DecodeRow(const int8_t* palette, const uint8_t* packed,
+                        int depth, int8_t* row) {
+    int i = 0;
+    for (; i + 1 < depth; i += 2) {
+      const uint8_t pair = *packed++;
+      row[i] = palette[pair & 0x0F];
+      row[i + 1] = palette[pair >> 4];
+    }
+    if (i < depth) {
+      row[i] = palette[*packed & 0x0F];
+    }
+  }
+
+  // Writes count outputs of one batch for rows decoded into tile
+  static TfLiteStatus MultiplyTile(const OpData* data, const int8_t* input,
+                                   const int8_t* tile, int count,
+                                   const int32_t* bias, int8_t* out) {
+    const int depth = data->depth;
+#ifdef CMSIS_NN
+    cmsis_nn_context ctx = {nullptr, 0};
+    cmsis_nn_fc_params fc_params;
+    fc_params.input_offset = data->input_offset;
+    fc_params.filter_offset = data->filter_offset;
+    fc_params.output_offset = data->output_offset;
+    fc_params.activation.min = data->activation_min;
+    fc_params.activation.max = data->activation_max;
+    cmsis_nn_per_tensor_quant_params quant_params = {data->output_multiplier,
+                                                     data->output_shift};
+    cmsis_nn_dims input_dims = {1, 1, 1, depth};
+    cmsis_nn_dims filter_dims = {depth, 1, 1, count};
+    cmsis_nn_dims bias_dims = {1, 1, 1, count};
+    cmsis_nn_dims output_dims = {1, 1, 1, count};
+
+    if (arm_fully_connected_s8(&ctx, &fc_params, &quant_params, &input_dims,
+                               input, &filter_dims, tile, &bias_dims, bias,
+                               &output_dims, out) != ARM_MATH_SUCCESS) {
+      return kTfLiteError;
+    }
+#else
+    for (int r = 0; r < count; r++) {
+      const int8_t* weights = tile + r * depth;
+      int32_t acc = 0;
+      for (int d = 0; d < depth; d++) {
+        acc += (input[d] + data->input_offset) *
+               (weights[d] + data->filter_offset);
+      }
+      if (bias) {
+        acc += bias[r];
+      }
+      acc = tflite::MultiplyByQuantizedMultiplier(
+          acc, data->output_multiplier, data->output_shift);
+      acc += data->output_offset;
+      acc = acc < data->activation_min ? data->activation_min : acc;
+      acc = acc > data->activation_max ? data->activation_max : acc;
+      out[r] = static_cast<int8_t>(acc);
+    }
+#endif
+    return kTfLiteOk;
+  }
+
+  const tflite::MicroOpResolver& base_;
+  mutable TfLiteRegistration registration_;
+
+  static const TfLiteRegistration*& Generic() {
+    static const TfLiteRegistration* generic = nullptr;
+    return generic;
+  }
+};
+
+#endif  // FC_PALETTE_H
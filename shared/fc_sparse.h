@@ -0,0 +1,252 @@
+#ifndef FC_SPARSE_H
+#define FC_SPARSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "tensorflow/lite/c/builtin_op_data.h"
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/kernels/internal/common.h"
+#include "tensorflow/lite/kernels/internal/quantization_util.h"
+#include "tensorflow/lite/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/micro_op_resolver.h"
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#include "cmsis_gcc.h"
+#define FC_SPARSE_SIMD
+#endif
+
+// FullyConnected with block sparse weights.
+//
+// sparsify_weights.py splits each row of FullyConnected weights into
+// blocks of 4 and stores only blocks that are not all zero, with a bitmap
+// per row. Kernel walks set bits of the bitmap and does multiply
+// accumulate of the 4 weights with the matching inputs, two SMLAD
+// instructions on target, zero blocks cost nothing but their bit. With
+// half of the blocks pruned the layer reads and multiplies half as much.
+//
+// Input offset is folded into a per row constant in Prepare(), together
+// with bias, so inner loop only multiplies raw int8 values. Weights have
+// zero point 0, the same as converter gives, so left out blocks are
+// exactly zero and results match dense kernel for the same weights.
+//
+// Sparse weights are recognised by "BSP4" at the start of their data,
+// other nodes run through the original kernel. A sparse model can not
+// run without it.
+//
+// Usage example:
+// static FullyConnectedSparseResolver sparse_resolver(engine.resolver());
+// engine.SetResolver(&sparse_resolver);
+// engine.Setup(model_data, error_reporter);
+
+class FullyConnectedSparseResolver : public tflite::MicroOpResolver {
+ public:
+  static constexpr int kBlock = 4;
+
+  explicit FullyConnectedSparseResolver(const tflite::MicroOpResolver& base)
+      : base_(base) {}
+
+  const TfLiteRegistration* FindOp(tflite::BuiltinOperator op) const override {
+    const TfLiteRegistration* registration = base_.FindOp(op);
+    if (op != tflite::BuiltinOperator_FULLY_CONNECTED ||
+        registration == nullptr) {
+      return registration;
+    }
+
+    // Keep builtin code and version, so profiler still reports it
+    Generic() = registration;
+    registration_ = *registration;
+    registration_.init = Init;
+    registration_.free = nullptr;
+    registration_.prepare = Prepare;
+    registration_.invoke = Eval;
+    return &registration_;
+  }
+
+  const TfLiteRegistration* FindOp(const char* op) const override {
+    return base_.FindOp(op);
+  }
+
+  BuiltinParseFunction GetOpDataParser(
+      tflite::BuiltinOperator op) const override {
+    return base_.GetOpDataParser(op);
+  }
+
+  // Returns true if weights were written by sparsify_weights.py
+  static bool IsSparse(const void* weights) {
+    return weights != nullptr && memcmp(weights, "BSP4", 4) == 0;
+  }
+
+ private:
+  struct OpData {
+    void* generic_data;
+    bool sparse;
+    int rows;               // Output depth
+    int depth;              // Inputs of a row, multiple of kBlock
+    int bitmap_row;         // Bitmap bytes of a row
+    int32_t* row_offset;    // Bias + input offset * sum of row weights
+    int32_t output_offset;
+    int32_t output_multiplier;
+    int output_shift;
+    int32_t activation_min;
+    int32_t activation_max;
+  };
+
+  static void* Init(TfLiteContext* context, const char* buffer,
+                    size_t length) {
+    OpData* data = static_cast<OpData*>(
+        context->AllocatePersistentBuffer(context, sizeof(OpData)));
+    if (data == nullptr) {
+      return nullptr;
+    }
+    data->generic_data = Generic()->init
+                             ? Generic()->init(context, buffer, length)
+                             : nullptr;
+    data->sparse = false;
+    return data;
+  }
+
+  static TfLiteStatus Prepare(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+
+    const TfLiteTensor* input = tflite::GetInput(context, node, 0);
+    const TfLiteTensor* filter = tflite::GetInput(context, node, 1);
+    const TfLiteTensor* bias = tflite::GetOptionalInputTensor(context, node, 2);
+    TfLiteTensor* output = tflite::GetOutput(context, node, 0);
+    const TfLiteFullyConnectedParams* params =
+        static_cast<const TfLiteFullyConnectedParams*>(node->builtin_data);
+
+    data->sparse = IsSparse(filter->data.raw);
+    if (!data->sparse) {
+      node->user_data = data->generic_data;
+      TfLiteStatus status =
+          Generic()->prepare ? Generic()->prepare(context, node) : kTfLiteOk;
+      node->user_data = data;
+      return status;
+    }
+
+    if (input->type != kTfLiteInt8 || output->type != kTfLiteInt8 ||
+        filter->dims->size != 2 || filter->dims->data[1] % kBlock != 0 ||
+        filter->params.zero_point != 0 ||
+        params->weights_format != kTfLiteFullyConnectedWeightsFormatDefault) {
+      TF_LITE_KERNEL_LOG(context, "Sparse FullyConnected needs int8");
+      return kTfLiteError;
+    }
+
+    data->rows = filter->dims->data[0];
+    data->depth = filter->dims->data[1];
+    data->bitmap_row = (data->depth / kBlock + 7) / 8;
+
+    double real_multiplier = 0.0;
+    TF_LITE_ENSURE_STATUS(tflite::GetQuantizedConvolutionMultipler(
+        context, input, filter, bias, output, &real_multiplier));
+    tflite::QuantizeMultiplier(real_multiplier, &data->output_multiplier,
+                               &data->output_shift);
+    TF_LITE_ENSURE_STATUS(tflite::CalculateActivationRangeQuantized(
+        context, params->activation, output, &data->activation_min,
+        &data->activation_max));
+    data->output_offset = output->params.zero_point;
+
+    data->row_offset = static_cast<int32_t*>(context->AllocatePersistentBuffer(
+        context, data->rows * sizeof(int32_t)));
+    if (data->row_offset == nullptr) {
+      return kTfLiteError;
+    }
+
+    // Weights are constant, their sums are known now
+    const int32_t input_offset = -input->params.zero_point;
+    const uint8_t* bitmap = reinterpret_cast<const uint8_t*>(
+        filter->data.raw + 4);
+    const int8_t* blocks = reinterpret_cast<const int8_t*>(
+        bitmap + data->rows * data->bitmap_row);
+    for (int r = 0; r < data->rows; r++) {
+      int32_t sum = 0;
+      for (int i = 0; i < data->bitmap_row; i++) {
+        for (uint8_t bits = bitmap[i]; bits; bits &= bits - 1) {
+          sum += blocks[0] + blocks[1] + blocks[2] + blocks[3];
+          blocks += kBlock;
+        }
+      }
+      bitmap += data->bitmap_row;
+      data->row_offset[r] =
+          (bias ? bias->data.i32[r] : 0) + input_offset * sum;
+    }
+    return kTfLiteOk;
+  }
+
+  static TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+
+    if (!data->sparse) {
+      node->user_data = data->generic_data;
+      TfLiteStatus status = Generic()->invoke(context, node);
+      node->user_data = data;
+      return status;
+    }
+
+    const TfLiteEvalTensor* input = tflite::micro::GetEvalInput(context, node, 0);
+    const TfLiteEvalTensor* filter =
+        tflite::micro::GetEvalInput(context, node, 1);
+    TfLiteEvalTensor* output = tflite::micro::GetEvalOutput(context, node, 0);
+
+    const int rows = data->rows;
+    const int depth = data->depth;
+    const int batches = tflite::micro::GetTensorShape(input).FlatSize() / depth;
+    const uint8_t* bitmaps = reinterpret_cast<const uint8_t*>(
+        tflite::micro::GetTensorData<int8_t>(filter) + 4);
+    const int8_t* stored = reinterpret_cast<const int8_t*>(
+        bitmaps + rows * data->bitmap_row);
+    const int8_t* input_data = tflite::micro::GetTensorData<int8_t>(input);
+    int8_t* out = tflite::micro::GetTensorData<int8_t>(output);
+
+    for (int b = 0; b < batches; b++) {
+      const int8_t* x = input_data + b * depth;
+      const uint8_t* bitmap = bitmaps;
+      const int8_t* blocks = stored;
+
+      for (int r = 0; r < rows; r++) {
+        int32_t acc = 0;
+        for (int i = 0; i < data->bitmap_row; i++) {
+          for (uint32_t bits = bitmap[i]; bits; bits &= bits - 1) {
+            const int8_t* in = x + (i * 8 + __builtin_ctz(bits)) * kBlock;
+#ifdef FC_SPARSE_SIMD
+            uint32_t in4;
+            uint32_t w4;
+            memcpy(&in4, in, 4);
+            memcpy(&w4, blocks, 4);
+            acc = __SMLAD(__SXTB16(in4), __SXTB16(w4), acc);
+            acc = __SMLAD(__SXTB16(__ROR(in4, 8)), __SXTB16(__ROR(w4, 8)),
+                          acc);
+#else
+            acc += in[0] * blocks[0] + in[1] * blocks[1] + in[2] * blocks[2] +
+                   in[3] * blocks[3];
+#endif
+            blocks += kBlock;
+          }
+        }
+        bitmap += data->bitmap_row;
+
+        acc = tflite::MultiplyByQuantizedMultiplier(
+            acc + data->row_offset[r], data->output_multiplier,
+            data->output_shift);
+        acc += data->output_offset;
+        acc = acc < data->activation_min ? data->activation_min : acc;
+        acc = acc > data->activation_max ? data->activation_max : acc;
+        out[b * rows + r] = static_cast<int8_t>(acc);
+      }
+    }
+    return kTfLiteOk;
+  }
+
+  const tflite::MicroOpResolver& base_;
+  mutable TfLiteRegistration registration_;
+
+  static const TfLiteRegistration*& Generic() {
+    static const TfLiteRegistration* generic = nullptr;
+    return generic;
+  }
+};
+
+#endif  // FC_SPARSE_H
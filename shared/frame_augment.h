@@ -0,0 +1,143 @@
+#ifndef FRAME_AUGMENT_H
+#define FRAME_AUGMENT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Deterministic variants of 8 bit frames for soak tests: shift with edge
+// clamp, brightness gain and offset, and uniform noise. Everything comes
+// from xorshift32, so the same seed gives the same frame on every run and
+// every board, and a variant can be generated again to check that the
+// model still gives the same output for it.
+//
+// Usage example:
+// uint32_t state = frame_rng_seed(run);
+// frame_augment_t augment = frame_augment_random(&state, &limits);
+// frame_augment_u8(&src[0][0], &dst[0][0], 80, 60, &augment, &state);
+
+typedef struct
+{
+    int8_t dx;                  // Pixels moved right, left if negative
+    int8_t dy;                  // Pixels moved down, up if negative
+    uint16_t gain;              // Q8, 256 keeps brightness
+    int16_t offset;             // Added after gain
+    uint8_t noise;              // Noise is uniform in -noise..noise
+}frame_augment_t;
+
+/*!
+ * @brief               Returns PRNG state for a seed, never zero
+ */
+static inline uint32_t frame_rng_seed(uint32_t seed)
+{
+    // Spreads consecutive seeds, xorshift of small states starts slowly
+    seed = (seed ^ 61) ^ (seed >> 16);
+    seed *= 9;
+    seed ^= seed >> 4;
+    seed *= 0x27d4eb2d;
+    seed ^= seed >> 15;
+    return seed ? seed : 1;
+}
+
+/*!
+ * @brief               Returns next 32 bit number of xorshift32
+ */
+static inline uint32_t frame_rng_next(uint32_t * state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/*!
+ * @brief               Returns number in -limit..limit
+ */
+static inline int32_t frame_rng_range(uint32_t * state, uint32_t limit)
+{
+    uint64_t span = 2 * limit + 1;
+    return (int32_t) ((frame_rng_next(state) * span) >> 32) - (int32_t) limit;
+}
+
+/*!
+ * @brief               Picks a variant inside of limits
+ *
+ * @param[in,out] state PRNG state
+ * @param[in] limits    Largest shift, offset and noise, gain is the most
+ *                      it moves away from 256
+ */
+static inline frame_augment_t frame_augment_random(uint32_t * state,
+                                                   const frame_augment_t * limits)
+{
+    frame_augment_t augment;
+    augment.dx = frame_rng_range(state, limits->dx);
+    augment.dy = frame_rng_range(state, limits->dy);
+    augment.gain = 256 + frame_rng_range(state, limits->gain);
+    augment.offset = frame_rng_range(state, limits->offset);
+    augment.noise = ((uint64_t) frame_rng_next(state) * 
+                     (limits->noise + 1)) >> 32;
+    return augment;
+}
+
+/*!
+ * @brief               Writes variant of the frame
+ *
+ * @param[in] src       cols x rows pixels
+ * @param[out] dst      cols x rows pixels, not src
+ * @param[in] cols
+ * @param[in] rows
+ * @param[in] augment
+ * @param[in,out] state PRNG state for noise
+ *
+ * @note                Pixels shifted in from outside repeat the edge,
+ *                      which is what border of a thermal scene looks
+ *                      like more than black. One PRNG step gives noise of
+ *                      four pixels.
+ */
+static inline void frame_augment_u8(const uint8_t * src,
+                                    uint8_t * dst,
+                                    uint32_t cols,
+                                    uint32_t rows,
+                                    const frame_augment_t * augment,
+                                    uint32_t * state)
+{
+    uint32_t span = 2 * augment->noise + 1;
+    uint32_t random = 0;
+
+    for (uint32_t y = 0; y < rows; y++)
+    {
+        int32_t sy = (int32_t) y - augment->dy;
+        sy = sy < 0 ? 0 : (sy >= (int32_t) rows ? (int32_t) rows - 1 : sy);
+        const uint8_t * line = src + sy * cols;
+
+        for (uint32_t x = 0; x < cols; x++)
+        {
+            int32_t sx = (int32_t) x - augment->dx;
+            sx = sx < 0 ? 0 : (sx >= (int32_t) cols ? (int32_t) cols - 1 : sx);
+
+            if ((x & 3) == 0)
+            {
+                random = frame_rng_next(state);
+            }
+            int32_t noise = (int32_t) (((random & 0xFF) * span) >> 8) -
+                            augment->noise;
+            random >>= 8;
+
+            int32_t value = ((line[sx] * augment->gain + 128) >> 8) +
+                            augment->offset + noise;
+            dst[y * cols + x] = value < 0 ? 0 : (value > 255 ? 255 : value);
+        }
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FRAME_AUGMENT_H */
+/*** end of file ***/
@@ -0,0 +1,302 @@
+#ifndef FRAME_CODEC_H
+#define FRAME_CODEC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Lossless codec for 8-bit thermal frames, for the SD logger and the
+// telemetry link.
+// Every pixel is predicted from its neighbours with the median edge
+// detector of LOCO-I (left, above and above left), first row from the
+// left and first column from above. Thermal backgrounds are smooth, so
+// residuals are mostly 0 or a few steps, and they are coded with byte
+// tokens:
+//
+//     0xxxxxxx     run of x + 1 zero residuals, runs go across rows
+//     10aaabbb     two residuals in -4..3, stored as a + 4 and b + 4
+//     110vvvvv     one residual in -16..15, stored as v + 16
+//     11100000 r   residual r, modulo 256
+//
+// Typical Lepton frame of 80x60 takes 1.5-3 KB instead of 4.8 KB, encoding
+// is one pass of around 10 cycles per pixel, so well under 0.1 ms on M7.
+// Output that would be larger than max_len is not written, caller keeps
+// raw pixels then. Decoder in Python is in
+// projects/camera_stm32f7/flir_image.py.
+
+#define FRAME_CODEC_MAX_COLS    255
+#define FRAME_CODEC_ESCAPE      0xE0
+
+typedef struct
+{
+    uint8_t * out;
+    uint32_t len;
+    uint32_t max_len;
+    uint32_t run;           // Zero residuals not coded yet
+    bool overflow;
+}frame_codec_t;
+
+static inline void frame_codec_emit(frame_codec_t * codec, uint8_t byte)
+{
+    if (codec->len == codec->max_len)
+    {
+        codec->overflow = true;
+        return;
+    }
+    codec->out[codec->len++] = byte;
+}
+
+static inline void frame_codec_flush_run(frame_codec_t * codec)
+{
+    while (codec->run)
+    {
+        uint32_t n = codec->run > 128 ? 128 : codec->run;
+        frame_codec_emit(codec, (uint8_t) (n - 1));
+        codec->run -= n;
+    }
+}
+
+/*!
+ * @brief               Predicts pixel from left (a), above (b) and above
+ *                      left (c) neighbour
+ */
+static inline uint8_t frame_codec_predict(uint8_t a, uint8_t b, uint8_t c)
+{
+    uint8_t lo = a < b ? a : b;
+    uint8_t hi = a < b ? b : a;
+    if (c >= hi)
+    {
+        return lo;
+    }
+    if (c <= lo)
+    {
+        return hi;
+    }
+    return (uint8_t) (a + b - c);
+}
+
+/*!
+ * @brief               Computes residuals of a row
+ *
+ * @param[in] prev      Row above, NULL for the first row
+ */
+static inline void frame_codec_residuals(const uint8_t * row,
+                                         const uint8_t * prev,
+                                         uint8_t cols,
+                                         int8_t * res)
+{
+    if (!prev)
+    {
+        uint8_t left = 0;
+        for (uint8_t col = 0; col < cols; col++)
+        {
+            res[col] = (int8_t) (uint8_t) (row[col] - left);
+            left = row[col];
+        }
+        return;
+    }
+
+    res[0] = (int8_t) (uint8_t) (row[0] - prev[0]);
+    for (uint8_t col = 1; col < cols; col++)
+    {
+        uint8_t pred = frame_codec_predict(row[col - 1], prev[col],
+                                           prev[col - 1]);
+        res[col] = (int8_t) (uint8_t) (row[col] - pred);
+    }
+}
+
+/*!
+ * @brief               Codes residuals of one row
+ */
+static inline void frame_codec_put_row(frame_codec_t * codec,
+                                       const int8_t * res,
+                                       uint8_t cols)
+{
+    for (uint32_t col = 0; col < cols; col++)
+    {
+        int32_t r = res[col];
+        if (r == 0)
+        {
+            codec->run++;
+            continue;
+        }
+        frame_codec_flush_run(codec);
+
+        // Pair of small residuals, second one may be zero
+        if (r >= -4 && r <= 3 && col + 1 < cols &&
+            res[col + 1] >= -4 && res[col + 1] <= 3)
+        {
+            frame_codec_emit(codec, (uint8_t) (0x80 | ((r + 4) << 3) |
+                                               (res[col + 1] + 4)));
+            col++;
+        }
+        else if (r >= -16 && r <= 15)
+        {
+            frame_codec_emit(codec, (uint8_t) (0xC0 | (r + 16)));
+        }
+        else
+        {
+            frame_codec_emit(codec, FRAME_CODEC_ESCAPE);
+            frame_codec_emit(codec, (uint8_t) r);
+        }
+    }
+}
+
+/*!
+ * @brief               Encodes 8-bit frame
+ *
+ * @param[in] pixels    Row major pixels
+ * @param[in] stride    Distance between rows in pixels
+ * @param[out] out      Coded frame
+ * @param[in] max_len   Size of out
+ *
+ * @return              Length of coded frame, 0 if it is longer than
+ *                      max_len
+ */
+static inline uint32_t frame_codec_encode_u8(const uint8_t * pixels,
+                                             uint8_t cols,
+                                             uint8_t rows,
+                                             uint32_t stride,
+                                             uint8_t * out,
+                                             uint32_t max_len)
+{
+    frame_codec_t codec = {out, 0, max_len, 0, false};
+    int8_t res[FRAME_CODEC_MAX_COLS];
+
+    for (uint8_t row = 0; row < rows && !codec.overflow; row++)
+    {
+        const uint8_t * line = pixels + row * stride;
+        frame_codec_residuals(line, row ? line - stride : NULL, cols, res);
+        frame_codec_put_row(&codec, res, cols);
+    }
+    frame_codec_flush_run(&codec);
+    return codec.overflow ? 0 : codec.len;
+}
+
+/*!
+ * @brief               Encodes 16-bit frame, for example VoSPI packets
+ *                      with AGC output, pixels are saturated to 8 bits
+ *
+ * @param[in] stride    Distance between rows in words, 82 for VoSPI
+ */
+static inline uint32_t frame_codec_encode_u16(const uint16_t * pixels,
+                                              uint8_t cols,
+                                              uint8_t rows,
+                                              uint32_t stride,
+                                              uint8_t * out,
+                                              uint32_t max_len)
+{
+    frame_codec_t codec = {out, 0, max_len, 0, false};
+    uint8_t lines[2][FRAME_CODEC_MAX_COLS];
+    int8_t res[FRAME_CODEC_MAX_COLS];
+
+    for (uint8_t row = 0; row < rows && !codec.overflow; row++)
+    {
+        uint8_t * line = lines[row & 1];
+        for (uint8_t col = 0; col < cols; col++)
+        {
+            uint16_t pixel = pixels[row * stride + col];
+            line[col] = pixel > 255 ? 255 : (uint8_t) pixel;
+        }
+        frame_codec_residuals(line, row ? lines[(row & 1) ^ 1] : NULL,
+                              cols, res);
+        frame_codec_put_row(&codec, res, cols);
+    }
+    frame_codec_flush_run(&codec);
+    return codec.overflow ? 0 : codec.len;
+}
+
+/*!
+ * @brief               Decodes frame of cols x rows pixels
+ *
+ * @return              False if data is corrupted
+ */
+static inline bool frame_codec_decode(const uint8_t * in,
+                                      uint32_t len,
+                                      uint8_t * pixels,
+                                      uint8_t cols,
+                                      uint8_t rows)
+{
+    const uint32_t total = (uint32_t) cols * rows;
+    uint32_t pos = 0;
+    uint32_t i = 0;
+    int8_t pending = 0;     // Second residual of a pair
+    bool has_pending = false;
+    uint32_t run = 0;
+
+    while (i < total)
+    {
+        int32_t r;
+        if (run)
+        {
+            run--;
+            r = 0;
+        }
+        else if (has_pending)
+        {
+            r = pending;
+            has_pending = false;
+        }
+        else
+        {
+            if (pos == len)
+            {
+                return false;
+            }
+            uint8_t t = in[pos++];
+            if (t < 0x80)
+            {
+                run = t;
+                r = 0;
+            }
+            else if (t < 0xC0)
+            {
+                r = ((t >> 3) & 0x7) - 4;
+                pending = (int8_t) ((t & 0x7) - 4);
+                has_pending = true;
+            }
+            else if (t < FRAME_CODEC_ESCAPE)
+            {
+                r = (t & 0x1F) - 16;
+            }
+            else if (t == FRAME_CODEC_ESCAPE && pos < len)
+            {
+                r = (int8_t) in[pos++];
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        uint32_t row = i / cols;
+        uint32_t col = i % cols;
+        uint8_t pred;
+        if (row == 0)
+        {
+            pred = col ? pixels[i - 1] : 0;
+        }
+        else if (col == 0)
+        {
+            pred = pixels[i - cols];
+        }
+        else
+        {
+            pred = frame_codec_predict(pixels[i - 1], pixels[i - cols],
+                                       pixels[i - cols - 1]);
+        }
+        pixels[i++] = (uint8_t) (pred + r);
+    }
+    return pos == len && run == 0 && !has_pending;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FRAME_CODEC_H */
+/*** end of file ***/
@@ -0,0 +1,607 @@
+#ifndef FRAME_CONVERT_H
+#define FRAME_CONVERT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#include "cmsis_gcc.h"
+#define FRAME_CONVERT_SIMD
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Conversion of raw pixels into quantized int8 model input.
+// Every pixel p is converted as:
+// q = clamp(round(p * multiplier / 2^16) + offset, -128, 127)
+// When multiplier is exactly 1.0 and offset is integer, fast path is taken,
+// which converts four pixels per instruction on Cortex-M7 DSP extension.
+// frame_downscale_u8() makes 2x or 4x smaller previews of 8 bit frames for
+// the telemetry link, model input is not touched by it.
+// Header only, so that every project can use it without changing its build.
+
+#define FRAME_QUANT_ONE     (1 << 16)  // Multiplier of 1.0 in Q16
+
+typedef struct
+{
+    int32_t multiplier;     // Q16 gain
+    int32_t bias;           // Q16 offset, rounding is already included
+}frame_quant_t;
+
+/*!
+ * @brief                   Prepares conversion parameters from
+ *                          normalisation and input quantization params
+ *
+ * @param[out] quant        Parameters that will be prepared
+ * @param[in] mean          Subtracted from raw pixel during training
+ * @param[in] std           Raw pixel was divided by it during training
+ * @param[in] scale         input->params.scale of the model
+ * @param[in] zero_point    input->params.zero_point of the model
+ *
+ * @note                    Real value is r = (p - mean) / std and
+ *                          quantized value is q = r / scale + zero_point.
+ */
+static inline void frame_quant_init(frame_quant_t * quant,
+                                    float mean,
+                                    float std,
+                                    float scale,
+                                    int32_t zero_point)
+{
+    float gain = 1.0f / (std * scale);
+    float offset = (float) zero_point - mean * gain;
+
+    quant->multiplier = (int32_t) (gain * FRAME_QUANT_ONE + 0.5f);
+    quant->bias = (int32_t) (offset * FRAME_QUANT_ONE +
+                             (offset < 0 ? -0.5f : 0.5f)) + FRAME_QUANT_ONE / 2;
+}
+
+/*!
+ * @brief                   Prepares conversion parameters that only
+ *                          add offset to each pixel
+ *
+ * @param[out] quant        Parameters that will be prepared
+ * @param[in] offset        For example -128 for AGC output and model with
+ *                          scale 1.0 and zero point -128
+ */
+static inline void frame_quant_offset(frame_quant_t * quant, int32_t offset)
+{
+    quant->multiplier = FRAME_QUANT_ONE;
+    quant->bias = offset * FRAME_QUANT_ONE + FRAME_QUANT_ONE / 2;
+}
+
+/*!
+ * @brief                   Returns integer offset if conversion does not
+ *                          scale pixels, so fast path can be used
+ *
+ * @param[in] quant
+ * @param[out] offset       Valid only if function returns true
+ *
+ * @return                  True if fast path can be used
+ */
+static inline bool frame_quant_is_offset(const frame_quant_t * quant,
+                                         int32_t * offset)
+{
+    if (quant->multiplier != FRAME_QUANT_ONE ||
+        (quant->bias & (FRAME_QUANT_ONE - 1)) != FRAME_QUANT_ONE / 2)
+    {
+        return false;
+    }
+
+    *offset = quant->bias >> 16;
+
+    // Offset is applied as -128 and saturated int8 add of the rest
+    return (*offset + 128) >= -128 && (*offset + 128) <= 127;
+}
+
+/*!
+ * @brief                   Converts one pixel with given parameters
+ */
+static inline int8_t frame_convert_pixel(int32_t pixel,
+                                         const frame_quant_t * quant)
+{
+    // 64 bit product, gain of a model with scale 1/255 overflows 32 bits
+    int64_t value = ((int64_t) pixel * quant->multiplier + quant->bias) >> 16;
+
+    if (value < -128) return -128;
+    if (value > 127) return 127;
+    return (int8_t) value;
+}
+
+#ifdef FRAME_CONVERT_SIMD
+/*!
+ * @brief   Applies offset to four packed unsigned pixels
+ *
+ * @note    USUB8 subtracts 128 from each lane, which maps 0..255 exactly
+ *          on -128..127, then rest of the offset is added with saturation.
+ */
+__STATIC_FORCEINLINE uint32_t frame_offset4(uint32_t packed, uint32_t residual)
+{
+    uint32_t lanes = __USUB8(packed, 0x80808080);
+
+    if (residual)
+    {
+        lanes = __QADD8(lanes, residual);
+    }
+    return lanes;
+}
+#endif
+
+/*!
+ * @brief                   Converts array of 16 bit pixels into int8
+ *
+ * @param[in] src           Pixels, for example payload of VoSPI packet
+ * @param[out] dst          Quantized pixels
+ * @param[in] num_pixels    Number of pixels to convert
+ * @param[in] quant         Conversion parameters
+ *
+ * @note                    In fast path pixels are first saturated to
+ *                          0..255 by USAT16 and packed four into a word
+ *                          with PKHBT/PKHTB. Pointers should be word
+ *                          aligned for best speed.
+ */
+static inline void frame_convert_u16(const uint16_t * src,
+                                     int8_t * dst,
+                                     uint32_t num_pixels,
+                                     const frame_quant_t * quant)
+{
+    uint32_t i = 0;
+    int32_t offset;
+
+    if (frame_quant_is_offset(quant, &offset))
+    {
+#ifdef FRAME_CONVERT_SIMD
+        uint32_t residual = (uint8_t) (offset + 128) * 0x01010101u;
+
+        for (; i + 4 <= num_pixels; i += 4)
+        {
+            uint32_t p01, p23;
+            memcpy(&p01, src + i, 4);
+            memcpy(&p23, src + i + 2, 4);
+
+            p01 = __USAT16(p01, 8);
+            p23 = __USAT16(p23, 8);
+
+            // [p2:p0] | [p3:p1] << 8 gives bytes p3 p2 p1 p0
+            uint32_t packed = __PKHBT(p01, p23, 16) |
+                             (__PKHTB(p23, p01, 16) << 8);
+
+            packed = frame_offset4(packed, residual);
+            memcpy(dst + i, &packed, 4);
+        }
+#endif
+        for (; i < num_pixels; i++)
+        {
+            int32_t value = (src[i] > 255 ? 255 : src[i]) + offset;
+            dst[i] = value < -128 ? -128 : (value > 127 ? 127 : value);
+        }
+        return;
+    }
+
+    for (; i < num_pixels; i++)
+    {
+        dst[i] = frame_convert_pixel(src[i], quant);
+    }
+}
+
+/*!
+ * @brief                   Packs array of 16 bit pixels into 8 bit ones
+ *
+ * @param[in] src           Pixels, for example AGC payload of VoSPI packet
+ * @param[out] dst          Pixels saturated to 0..255
+ * @param[in] num_pixels    Number of pixels to pack
+ *
+ * @note                    Same packing as frame_convert_u16(), without
+ *                          offset.
+ */
+static inline void frame_pack_u16(const uint16_t * src,
+                                  uint8_t * dst,
+                                  uint32_t num_pixels)
+{
+    uint32_t i = 0;
+
+#ifdef FRAME_CONVERT_SIMD
+    for (; i + 4 <= num_pixels; i += 4)
+    {
+        uint32_t p01, p23;
+        memcpy(&p01, src + i, 4);
+        memcpy(&p23, src + i + 2, 4);
+
+        p01 = __USAT16(p01, 8);
+        p23 = __USAT16(p23, 8);
+
+        uint32_t packed = __PKHBT(p01, p23, 16) |
+                         (__PKHTB(p23, p01, 16) << 8);
+        memcpy(dst + i, &packed, 4);
+    }
+#endif
+    for (; i < num_pixels; i++)
+    {
+        dst[i] = src[i] > 255 ? 255 : src[i];
+    }
+}
+
+/*!
+ * @brief                   Converts array of 8 bit pixels into int8
+ *
+ * @param[in] src           Pixels, for example raw camera image
+ * @param[out] dst          Quantized pixels, can be the same as src
+ * @param[in] num_pixels    Number of pixels to convert
+ * @param[in] quant         Conversion parameters
+ *
+ * @note                    Offset of -128, AGC frame and model with scale 
+ *                          1.0 and zero point -128, only flips the top bit,
+ *                          so whole frame is converted four pixels per XOR 
+ *                          on any core.
+ */
+static inline void frame_convert_u8(const uint8_t * src,
+                                    int8_t * dst,
+                                    uint32_t num_pixels,
+                                    const frame_quant_t * quant)
+{
+    uint32_t i = 0;
+    int32_t offset;
+
+    if (frame_quant_is_offset(quant, &offset) && offset == -128)
+    {
+        for (; i + 4 <= num_pixels; i += 4)
+        {
+            uint32_t packed;
+            memcpy(&packed, src + i, 4);
+            packed ^= 0x80808080u;
+            memcpy(dst + i, &packed, 4);
+        }
+        for (; i < num_pixels; i++)
+        {
+            dst[i] = (int8_t) (src[i] ^ 0x80);
+        }
+        return;
+    }
+
+    if (frame_quant_is_offset(quant, &offset))
+    {
+#ifdef FRAME_CONVERT_SIMD
+        uint32_t residual = (uint8_t) (offset + 128) * 0x01010101u;
+
+        for (; i + 4 <= num_pixels; i += 4)
+        {
+            uint32_t packed;
+            memcpy(&packed, src + i, 4);
+            packed = frame_offset4(packed, residual);
+            memcpy(dst + i, &packed, 4);
+        }
+#endif
+        for (; i < num_pixels; i++)
+        {
+            int32_t value = src[i] + offset;
+            dst[i] = value < -128 ? -128 : (value > 127 ? 127 : value);
+        }
+        return;
+    }
+
+    for (; i < num_pixels; i++)
+    {
+        dst[i] = frame_convert_pixel(src[i], quant);
+    }
+}
+
+// Lookup table from 8 bit pixel into model input. Any chain of per pixel
+// steps, gamma, normalisation and quantization, is folded into 256 bytes
+// once per model, so conversion costs the same for every model.
+typedef struct
+{
+    int8_t table[256];
+}frame_lut_t;
+
+/*!
+ * @brief                   Prepares table from gamma, normalisation and
+ *                          input quantization params
+ *
+ * @param[out] lut          Table that will be prepared
+ * @param[in] gamma         1.0 for none, pixel is first remapped as
+ *                          255 * (p / 255)^gamma
+ * @param[in] mean          Subtracted from pixel during training
+ * @param[in] std           Pixel was divided by it during training
+ * @param[in] scale         input->params.scale of the model
+ * @param[in] zero_point    input->params.zero_point of the model
+ *
+ * @note                    Same rounding as frame_quant_init(), with gamma
+ *                          1.0 table gives the same values as
+ *                          frame_convert_pixel().
+ */
+static inline void frame_lut_init(frame_lut_t * lut,
+                                  float gamma,
+                                  float mean,
+                                  float std,
+                                  float scale,
+                                  int32_t zero_point)
+{
+    frame_quant_t quant;
+    frame_quant_init(&quant, mean, std, scale, zero_point);
+
+    for (int32_t p = 0; p < 256; p++)
+    {
+        if (gamma == 1.0f)
+        {
+            lut->table[p] = frame_convert_pixel(p, &quant);
+            continue;
+        }
+        float pixel = 255.0f * powf(p / 255.0f, gamma);
+        float value = floorf(pixel * ((float) quant.multiplier /
+                                      FRAME_QUANT_ONE) +
+                             (float) quant.bias / FRAME_QUANT_ONE);
+        lut->table[p] = value < -128.0f ? -128 :
+                        (value > 127.0f ? 127 : (int8_t) value);
+    }
+}
+
+/*!
+ * @brief                   Converts array of 8 bit pixels into int8 with
+ *                          lookup table
+ *
+ * @param[in] src           Pixels, for example raw camera image
+ * @param[out] dst          Quantized pixels, can be the same as src
+ * @param[in] num_pixels    Number of pixels to convert
+ * @param[in] lut           Table from frame_lut_init()
+ *
+ * @note                    Cortex-M has no gather, so four pixels are read
+ *                          as a word, looked up with byte loads from the
+ *                          table, which stays in L1, and stored as one
+ *                          word. That is 6 loads and stores per four pixels
+ *                          against 12 of a byte loop, and no multiply.
+ */
+static inline void frame_convert_lut(const uint8_t * src,
+                                     int8_t * dst,
+                                     uint32_t num_pixels,
+                                     const frame_lut_t * lut)
+{
+    const uint8_t * table = (const uint8_t *) lut->table;
+    uint32_t i = 0;
+
+    for (; i + 4 <= num_pixels; i += 4)
+    {
+        uint32_t packed;
+        memcpy(&packed, src + i, 4);
+        packed = (uint32_t) table[packed & 0xFF] |
+                 ((uint32_t) table[(packed >> 8) & 0xFF] << 8) |
+                 ((uint32_t) table[(packed >> 16) & 0xFF] << 16) |
+                 ((uint32_t) table[packed >> 24] << 24);
+        memcpy(dst + i, &packed, 4);
+    }
+    for (; i < num_pixels; i++)
+    {
+        dst[i] = lut->table[src[i]];
+    }
+}
+
+// Region of a frame in pixels
+typedef struct
+{
+    uint16_t x;
+    uint16_t y;
+    uint16_t w;
+    uint16_t h;
+}frame_roi_t;
+
+#define FRAME_RESIZE_MAX_COLS   (160)   // Longest output row
+
+/*!
+ * @brief                   Crops region of 16 bit frame and resizes it
+ *                          into int8 image with nearest neighbour
+ *
+ * @param[in] src           First pixel of the frame
+ * @param[in] src_stride    Words between two rows, for example 82 for
+ *                          VoSPI packets
+ * @param[in] roi           Region inside the frame
+ * @param[out] dst          dst_cols x dst_rows quantized pixels
+ * @param[in] dst_cols      At most FRAME_RESIZE_MAX_COLS
+ * @param[in] dst_rows
+ * @param[in] quant         Conversion parameters
+ *
+ * @note                    Source columns of an output row are the same
+ *                          for every row, so they are computed once in
+ *                          Q16. Each row is gathered into a small buffer
+ *                          and converted with frame_convert_u16(), which
+ *                          takes the SIMD path, rows that come from the
+ *                          same source row are copied.
+ */
+static inline void frame_crop_resize_u16(const uint16_t * src,
+                                         uint32_t src_stride,
+                                         const frame_roi_t * roi,
+                                         int8_t * dst,
+                                         uint32_t dst_cols,
+                                         uint32_t dst_rows,
+                                         const frame_quant_t * quant)
+{
+    uint16_t cols[FRAME_RESIZE_MAX_COLS];
+    uint16_t row_buf[FRAME_RESIZE_MAX_COLS] __attribute__((aligned(4)));
+
+    if (dst_cols > FRAME_RESIZE_MAX_COLS)
+    {
+        return;
+    }
+
+    // Centre of output pixel is mapped onto the source pixel it falls in
+    uint32_t step_x = ((uint32_t) roi->w << 16) / dst_cols;
+    uint32_t step_y = ((uint32_t) roi->h << 16) / dst_rows;
+
+    for (uint32_t x = 0; x < dst_cols; x++)
+    {
+        cols[x] = roi->x + ((x * step_x + step_x / 2) >> 16);
+    }
+
+    int32_t last_row = -1;
+    for (uint32_t y = 0; y < dst_rows; y++)
+    {
+        int32_t src_row = roi->y + ((y * step_y + step_y / 2) >> 16);
+        int8_t * out = dst + y * dst_cols;
+
+        if (src_row == last_row)
+        {
+            memcpy(out, out - dst_cols, dst_cols);
+            continue;
+        }
+
+        const uint16_t * line = src + src_row * src_stride;
+        for (uint32_t x = 0; x < dst_cols; x++)
+        {
+            row_buf[x] = line[cols[x]];
+        }
+        frame_convert_u16(row_buf, out, dst_cols, quant);
+        last_row = src_row;
+    }
+}
+
+/*!
+ * @brief                   Crops region of 8 bit frame and resizes it
+ *                          into int8 image, as frame_crop_resize_u16()
+ *
+ * @param[in] src_stride    Bytes between two rows, for example 80 for
+ *                          AGC frame
+ */
+static inline void frame_crop_resize_u8(const uint8_t * src,
+                                        uint32_t src_stride,
+                                        const frame_roi_t * roi,
+                                        int8_t * dst,
+                                        uint32_t dst_cols,
+                                        uint32_t dst_rows,
+                                        const frame_quant_t * quant)
+{
+    uint16_t cols[FRAME_RESIZE_MAX_COLS];
+    uint8_t row_buf[FRAME_RESIZE_MAX_COLS] __attribute__((aligned(4)));
+
+    if (dst_cols > FRAME_RESIZE_MAX_COLS)
+    {
+        return;
+    }
+
+    uint32_t step_x = ((uint32_t) roi->w << 16) / dst_cols;
+    uint32_t step_y = ((uint32_t) roi->h << 16) / dst_rows;
+
+    for (uint32_t x = 0; x < dst_cols; x++)
+    {
+        cols[x] = roi->x + ((x * step_x + step_x / 2) >> 16);
+    }
+
+    int32_t last_row = -1;
+    for (uint32_t y = 0; y < dst_rows; y++)
+    {
+        int32_t src_row = roi->y + ((y * step_y + step_y / 2) >> 16);
+        int8_t * out = dst + y * dst_cols;
+
+        if (src_row == last_row)
+        {
+            memcpy(out, out - dst_cols, dst_cols);
+            continue;
+        }
+
+        const uint8_t * line = src + src_row * src_stride;
+        for (uint32_t x = 0; x < dst_cols; x++)
+        {
+            row_buf[x] = line[cols[x]];
+        }
+        frame_convert_u8(row_buf, out, dst_cols, quant);
+        last_row = src_row;
+    }
+}
+
+/*!
+ * @brief                   Downscales 8 bit frame 2x or 4x with box filter,
+ *                          for example 80x60 into 40x30 or 20x15 preview
+ *
+ * @param[in] src           First pixel of the frame
+ * @param[in] src_stride    Bytes between two rows, for example 80 for
+ *                          AGC frame
+ * @param[in] cols          Multiple of factor
+ * @param[in] rows          Multiple of factor
+ * @param[in] factor        2 or 4
+ * @param[out] dst          (cols / factor) x (rows / factor) pixels, each
+ *                          the rounded mean of its block
+ *
+ * @return                  False for other factor or size, nothing is
+ *                          written then
+ *
+ * @note                    On DSP extension 2x takes four source columns
+ *                          at once, UXTB16 splits them into even and odd
+ *                          bytes, sums of two rows fit 16 bit halves, so
+ *                          two output pixels come from one add chain. 4x
+ *                          sums four bytes of each row with USADA8.
+ */
+static inline bool frame_downscale_u8(const uint8_t * src,
+                                      uint32_t src_stride,
+                                      uint32_t cols,
+                                      uint32_t rows,
+                                      uint32_t factor,
+                                      uint8_t * dst)
+{
+    if ((factor != 2 && factor != 4) || (cols % factor) || (rows % factor))
+    {
+        return false;
+    }
+
+    uint32_t dst_cols = cols / factor;
+    uint32_t shift = factor == 2 ? 2 : 4;
+
+    for (uint32_t y = 0; y < rows / factor; y++)
+    {
+        const uint8_t * block = src + y * factor * src_stride;
+        uint8_t * out = dst + y * dst_cols;
+        uint32_t x = 0;
+
+#ifdef FRAME_CONVERT_SIMD
+        if (factor == 2)
+        {
+            for (; x + 2 <= dst_cols; x += 2)
+            {
+                uint32_t top, bottom;
+                memcpy(&top, block + 2 * x, 4);
+                memcpy(&bottom, block + src_stride + 2 * x, 4);
+
+                uint32_t sum = __UXTB16(top) + __UXTB16(__ROR(top, 8)) +
+                               __UXTB16(bottom) + __UXTB16(__ROR(bottom, 8));
+                sum = ((sum + 0x00020002u) >> 2) & 0x00FF00FFu;
+                out[x] = (uint8_t) sum;
+                out[x + 1] = (uint8_t) (sum >> 16);
+            }
+        }
+        else
+        {
+            for (; x < dst_cols; x++)
+            {
+                uint32_t sum = 0;
+                for (uint32_t row = 0; row < 4; row++)
+                {
+                    uint32_t packed;
+                    memcpy(&packed, block + row * src_stride + 4 * x, 4);
+                    sum = __USADA8(packed, 0, sum);
+                }
+                out[x] = (uint8_t) ((sum + 8) >> 4);
+            }
+        }
+#endif
+        for (; x < dst_cols; x++)
+        {
+            uint32_t sum = 0;
+            for (uint32_t row = 0; row < factor; row++)
+            {
+                const uint8_t * line = block + row * src_stride + x * factor;
+                for (uint32_t col = 0; col < factor; col++)
+                {
+                    sum += line[col];
+                }
+            }
+            out[x] = (uint8_t) ((sum + (1u << (shift - 1))) >> shift);
+        }
+    }
+    return true;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FRAME_CONVERT_H */
+/*** end of file ***/
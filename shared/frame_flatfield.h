@@ -0,0 +1,294 @@
+#ifndef FRAME_FLATFIELD_H
+#define FRAME_FLATFIELD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "frame_convert.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Correction of fixed pattern noise of 8 bit frames, fused with the int8
+// conversion of frame_convert_u16(). Every pixel p of frame position i is
+// corrected before it is quantized:
+// c = clamp((p * gain[i] + bias[i]) >> 8, 0, 255)
+// Gain and bias are Q8, rounding is included in the bias, so the table of
+// no correction is gain 256 and bias 128. Dead pixels are replaced by their
+// left neighbour, the right one in the first column.
+//
+// Bias is learnt with an exponential average from uniform frames, like
+// frames with the shutter closed, see frame_flat_learn_u16(). Reference of
+// a frame is the mean of the previous uniform frame, so the first one only
+// gives the mean. Gain needs two uniform scenes of different temperature,
+// it is not learnt, fill it from a two point calibration or keep it at 1.0.
+
+#define FRAME_FLAT_ONE          (1 << 8)    // Gain of 1.0 in Q8
+#define FRAME_FLAT_MAX_DEAD     (32)
+// Weight of a uniform frame in the average is 1 / 2^FRAME_FLAT_LEARN_SHIFT
+#define FRAME_FLAT_LEARN_SHIFT  (2)
+
+typedef struct
+{
+    int16_t * bias;                     // Q8 per pixel, written by learning
+    uint16_t * gain;                    // Q8 per pixel
+    uint32_t num_pixels;
+    uint16_t dead[FRAME_FLAT_MAX_DEAD]; // Ascending pixel indices
+    uint8_t dead_count;
+    uint32_t learn_sum;                 // Pixels of the frame being learnt
+    int32_t learn_mean;                 // Q8 reference, negative before it
+}frame_flat_t;
+
+/*!
+ * @brief                   Prepares table that does not change pixels
+ *
+ * @param[out] flat
+ * @param[in] bias          Storage of num_pixels biases
+ * @param[in] gain          Storage of num_pixels gains
+ * @param[in] num_pixels    Pixels of a frame
+ */
+static inline void frame_flat_init(frame_flat_t * flat,
+                                   int16_t * bias,
+                                   uint16_t * gain,
+                                   uint32_t num_pixels)
+{
+    flat->bias = bias;
+    flat->gain = gain;
+    flat->num_pixels = num_pixels;
+    for (uint32_t i = 0; i < num_pixels; i++)
+    {
+        bias[i] = FRAME_FLAT_ONE / 2;
+        gain[i] = FRAME_FLAT_ONE;
+    }
+    flat->dead_count = 0;
+    flat->learn_sum = 0;
+    flat->learn_mean = -1;
+}
+
+/*!
+ * @brief                   Corrects one pixel of position i
+ */
+static inline int32_t frame_flat_pixel(const frame_flat_t * flat,
+                                       uint32_t pixel,
+                                       uint32_t i)
+{
+    int32_t value = ((int32_t) (pixel > 255 ? 255 : pixel) * flat->gain[i] +
+                     flat->bias[i]) >> 8;
+
+    if (value < 0) return 0;
+    if (value > 255) return 255;
+    return value;
+}
+
+#ifdef FRAME_CONVERT_SIMD
+/*!
+ * @brief   Corrects two packed halfword pixels of 0..255
+ *
+ * @note    Products are signed 16 x 16 bit, GCC emits SMLABB and SMLATT
+ *          for them. Results are packed back with PKHBT, USAT16 then
+ *          clamps both halfwords to 0..255.
+ */
+__STATIC_FORCEINLINE uint32_t frame_flat2(uint32_t pixels,
+                                          uint32_t gains,
+                                          uint32_t biases)
+{
+    int32_t lo = (int16_t) pixels * (int16_t) gains + (int16_t) biases;
+    int32_t hi = ((int32_t) pixels >> 16) * ((int32_t) gains >> 16) +
+                 ((int32_t) biases >> 16);
+
+    return __USAT16(__PKHBT((uint32_t) (lo >> 8), (uint32_t) hi, 8), 8);
+}
+#endif
+
+/*!
+ * @brief                   Corrects array of 16 bit pixels and converts
+ *                          them into int8, as frame_convert_u16()
+ *
+ * @param[in] src           Pixels, for example payload of VoSPI packet
+ * @param[out] dst          Quantized pixels
+ * @param[in] first         Frame position of src[0], index into the table
+ * @param[in] num_pixels    Number of pixels to convert
+ * @param[in] flat          Correction table
+ * @param[in] quant         Conversion parameters
+ *
+ * @note                    In fast path pixels are saturated by USAT16,
+ *                          corrected two per frame_flat2() and packed four
+ *                          into a word as in frame_convert_u16(). Offset
+ *                          is then applied with USUB8 and QADD8. Dead
+ *                          pixels are not replaced here, call
+ *                          frame_flat_fix_dead() on dst.
+ */
+static inline void frame_flat_convert_u16(const uint16_t * src,
+                                          int8_t * dst,
+                                          uint32_t first,
+                                          uint32_t num_pixels,
+                                          const frame_flat_t * flat,
+                                          const frame_quant_t * quant)
+{
+    uint32_t i = 0;
+    int32_t offset;
+
+    if (frame_quant_is_offset(quant, &offset))
+    {
+#ifdef FRAME_CONVERT_SIMD
+        uint32_t residual = (uint8_t) (offset + 128) * 0x01010101u;
+        const int16_t * bias = flat->bias + first;
+        const uint16_t * gain = flat->gain + first;
+
+        for (; i + 4 <= num_pixels; i += 4)
+        {
+            uint32_t p01, p23, g01, g23, b01, b23;
+            memcpy(&p01, src + i, 4);
+            memcpy(&p23, src + i + 2, 4);
+            memcpy(&g01, gain + i, 4);
+            memcpy(&g23, gain + i + 2, 4);
+            memcpy(&b01, bias + i, 4);
+            memcpy(&b23, bias + i + 2, 4);
+
+            p01 = frame_flat2(__USAT16(p01, 8), g01, b01);
+            p23 = frame_flat2(__USAT16(p23, 8), g23, b23);
+
+            uint32_t packed = __PKHBT(p01, p23, 16) |
+                             (__PKHTB(p23, p01, 16) << 8);
+
+            packed = frame_offset4(packed, residual);
+            memcpy(dst + i, &packed, 4);
+        }
+#endif
+        for (; i < num_pixels; i++)
+        {
+            int32_t value = frame_flat_pixel(flat, src[i], first + i) + offset;
+            dst[i] = value < -128 ? -128 : (value > 127 ? 127 : value);
+        }
+        return;
+    }
+
+    for (; i < num_pixels; i++)
+    {
+        dst[i] = frame_convert_pixel(frame_flat_pixel(flat, src[i], first + i),
+                                     quant);
+    }
+}
+
+/*!
+ * @brief                   Replaces dead pixels of converted span
+ *
+ * @param[in,out] dst       Pixels of frame positions first and on
+ * @param[in] first         Frame position of dst[0]
+ * @param[in] num_pixels    Pixels of the span, one row for neighbours to
+ *                          stay in the row
+ * @param[in] flat
+ */
+static inline void frame_flat_fix_dead(int8_t * dst,
+                                       uint32_t first,
+                                       uint32_t num_pixels,
+                                       const frame_flat_t * flat)
+{
+    for (uint8_t d = 0; d < flat->dead_count; d++)
+    {
+        uint32_t i = flat->dead[d];
+        if (i < first)
+        {
+            continue;
+        }
+        if (i >= first + num_pixels)
+        {
+            break;
+        }
+        i -= first;
+        dst[i] = i > 0 ? dst[i - 1] : dst[i + 1];
+    }
+}
+
+/*!
+ * @brief                   Learns bias from a span of an uniform frame
+ *
+ * @param[in] src           Raw pixels, before correction
+ * @param[in] first         Frame position of src[0]
+ * @param[in] num_pixels
+ * @param[in,out] flat
+ *
+ * @note                    Bias of each pixel moves towards the one which
+ *                          maps the pixel on the reference mean. Spans of
+ *                          the frame can come in any order, frame ends
+ *                          with frame_flat_learn_end().
+ */
+static inline void frame_flat_learn_u16(const uint16_t * src,
+                                        uint32_t first,
+                                        uint32_t num_pixels,
+                                        frame_flat_t * flat)
+{
+    int32_t mean = flat->learn_mean;
+
+    for (uint32_t i = 0; i < num_pixels; i++)
+    {
+        int32_t pixel = src[i] > 255 ? 255 : src[i];
+        flat->learn_sum += pixel;
+
+        if (mean >= 0)
+        {
+            int16_t * bias = &flat->bias[first + i];
+            int32_t target = mean - pixel * flat->gain[first + i] +
+                             FRAME_FLAT_ONE / 2;
+            int32_t value = *bias + ((target - *bias) >> FRAME_FLAT_LEARN_SHIFT);
+
+            *bias = value < INT16_MIN ? INT16_MIN :
+                    (value > INT16_MAX ? INT16_MAX : value);
+        }
+    }
+}
+
+/*!
+ * @brief                   Ends uniform frame, its mean is the reference
+ *                          of the next one
+ */
+static inline void frame_flat_learn_end(frame_flat_t * flat)
+{
+    flat->learn_mean = (int32_t) (((uint64_t) flat->learn_sum * FRAME_FLAT_ONE +
+                                   flat->num_pixels / 2) / flat->num_pixels);
+    flat->learn_sum = 0;
+}
+
+/*!
+ * @brief                   Marks pixels that need more correction than
+ *                          threshold as dead
+ *
+ * @param[in,out] flat
+ * @param[in] threshold     Bias away from no correction, in 8 bit counts
+ *
+ * @return                  Number of dead pixels, the first
+ *                          FRAME_FLAT_MAX_DEAD of them are replaced
+ *
+ * @note                    Gain of zero marks pixel as dead too. Table is
+ *                          scanned in order, so indices are ascending.
+ */
+static inline uint32_t frame_flat_find_dead(frame_flat_t * flat,
+                                            uint32_t threshold)
+{
+    int32_t limit = (int32_t) threshold * FRAME_FLAT_ONE;
+    uint32_t count = 0;
+
+    flat->dead_count = 0;
+    for (uint32_t i = 0; i < flat->num_pixels; i++)
+    {
+        int32_t deviation = flat->bias[i] - FRAME_FLAT_ONE / 2;
+        if (flat->gain[i] != 0 && deviation <= limit && deviation >= -limit)
+        {
+            continue;
+        }
+        if (flat->dead_count < FRAME_FLAT_MAX_DEAD)
+        {
+            flat->dead[flat->dead_count++] = (uint16_t) i;
+        }
+        count++;
+    }
+    return count;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FRAME_FLATFIELD_H */
+/*** end of file ***/
@@ -0,0 +1,324 @@
+#ifndef FRAME_NORMALIZE_H
+#define FRAME_NORMALIZE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "frame_convert.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Normalisation of raw 14 bit frames, Lepton with AGC off, into 8 bit
+// pixels that frame_convert_u8() then quantizes for the model. Every
+// remap is a lookup table over FRAME_REMAP_BINS bins of a raw window:
+// bin = clamp((p - base) >> shift, 0, FRAME_REMAP_BINS - 1)
+// Fixed window keeps absolute temperature, window from percentiles of the
+// histogram stretches contrast of each frame, equalisation is global
+// histogram equalisation with clip limit, as one tile of CLAHE.
+
+#define FRAME_REMAP_BITS    (8)
+#define FRAME_REMAP_BINS    (1 << FRAME_REMAP_BITS)
+
+typedef struct
+{
+    uint16_t base;                      // Raw value of the first bin
+    uint8_t shift;                      // log2 of raw values per bin
+    uint8_t lut[FRAME_REMAP_BINS];      // 8 bit pixel of each bin
+}frame_remap_t;
+
+typedef struct
+{
+    uint16_t bins[FRAME_REMAP_BINS];
+    uint32_t count;
+}frame_hist_t;
+
+#ifdef FRAME_CONVERT_SIMD
+/*!
+ * @brief   Returns larger halfword of each lane of a and b
+ *
+ * @note    USUB16 sets GE flags of lanes where a >= b and SEL picks them,
+ *          both are in one asm statement so flags can not be clobbered.
+ */
+__STATIC_FORCEINLINE uint32_t frame_max2(uint32_t a, uint32_t b)
+{
+    uint32_t result;
+    __ASM ("usub16 %0, %1, %2\n\tsel %0, %1, %2"
+           : "=&r" (result) : "r" (a), "r" (b) : "cc");
+    return result;
+}
+
+/*!
+ * @brief   Returns smaller halfword of each lane of a and b
+ */
+__STATIC_FORCEINLINE uint32_t frame_min2(uint32_t a, uint32_t b)
+{
+    uint32_t result;
+    __ASM ("usub16 %0, %1, %2\n\tsel %0, %2, %1"
+           : "=&r" (result) : "r" (a), "r" (b) : "cc");
+    return result;
+}
+#endif
+
+/*!
+ * @brief                   Finds the smallest and the largest pixel
+ *
+ * @param[in] src           First pixel of the frame
+ * @param[in] stride        Words between two rows, 82 for VoSPI packets
+ * @param[in] cols          Even number of pixels in a row
+ * @param[in] rows
+ * @param[out] min
+ * @param[out] max
+ *
+ * @note                    In fast path two pixels are compared per
+ *                          instruction, rows should be word aligned.
+ */
+static inline void frame_range_u16(const uint16_t * src,
+                                   uint32_t stride,
+                                   uint32_t cols,
+                                   uint32_t rows,
+                                   uint16_t * min,
+                                   uint16_t * max)
+{
+    uint32_t low = UINT16_MAX;
+    uint32_t high = 0;
+
+    for (uint32_t y = 0; y < rows; y++)
+    {
+        const uint16_t * line = src + y * stride;
+        uint32_t x = 0;
+#ifdef FRAME_CONVERT_SIMD
+        uint32_t low2 = 0xFFFFFFFFu;
+        uint32_t high2 = 0;
+        for (; x + 2 <= cols; x += 2)
+        {
+            uint32_t pair;
+            memcpy(&pair, line + x, 4);
+            low2 = frame_min2(low2, pair);
+            high2 = frame_max2(high2, pair);
+        }
+        if ((low2 & 0xFFFF) < low) low = low2 & 0xFFFF;
+        if ((low2 >> 16) < low) low = low2 >> 16;
+        if ((high2 & 0xFFFF) > high) high = high2 & 0xFFFF;
+        if ((high2 >> 16) > high) high = high2 >> 16;
+#endif
+        for (; x < cols; x++)
+        {
+            if (line[x] < low) low = line[x];
+            if (line[x] > high) high = line[x];
+        }
+    }
+
+    *min = low;
+    *max = high;
+}
+
+/*!
+ * @brief                   Places bins of remap over raw window
+ *
+ * @param[out] remap        Table is not touched
+ * @param[in] low           First raw value of the window
+ * @param[in] high          Last raw value of the window
+ *
+ * @note                    Bins are as narrow as the window allows.
+ */
+static inline void frame_remap_window(frame_remap_t * remap,
+                                      uint16_t low,
+                                      uint16_t high)
+{
+    uint32_t span = high > low ? high - low : 0;
+    uint8_t shift = 0;
+
+    while ((span >> shift) >= FRAME_REMAP_BINS)
+    {
+        shift++;
+    }
+    remap->base = low;
+    remap->shift = shift;
+}
+
+/*!
+ * @brief                   Returns bin of raw pixel
+ */
+static inline uint32_t frame_remap_bin(const frame_remap_t * remap,
+                                       uint32_t pixel)
+{
+    if (pixel <= remap->base)
+    {
+        return 0;
+    }
+    uint32_t bin = (pixel - remap->base) >> remap->shift;
+    return bin < FRAME_REMAP_BINS ? bin : FRAME_REMAP_BINS - 1;
+}
+
+/*!
+ * @brief                   Counts pixels of the frame in bins of remap
+ *
+ * @param[out] hist
+ * @param[in] remap         Window, look at frame_remap_window()
+ * @param[in] src           First pixel of the frame
+ * @param[in] stride        Words between two rows
+ * @param[in] cols
+ * @param[in] rows
+ */
+static inline void frame_hist_u16(frame_hist_t * hist,
+                                  const frame_remap_t * remap,
+                                  const uint16_t * src,
+                                  uint32_t stride,
+                                  uint32_t cols,
+                                  uint32_t rows)
+{
+    memset(hist, 0, sizeof(*hist));
+
+    for (uint32_t y = 0; y < rows; y++)
+    {
+        const uint16_t * line = src + y * stride;
+        for (uint32_t x = 0; x < cols; x++)
+        {
+            hist->bins[frame_remap_bin(remap, line[x])]++;
+        }
+    }
+    hist->count = cols * rows;
+}
+
+/*!
+ * @brief                   Returns raw value below which given part of
+ *                          pixels is
+ *
+ * @param[in] hist          Histogram made with remap
+ * @param[in] remap
+ * @param[in] per_mille     Part of pixels, 0 to 1000
+ */
+static inline uint16_t frame_hist_percentile(const frame_hist_t * hist,
+                                             const frame_remap_t * remap,
+                                             uint32_t per_mille)
+{
+    uint32_t target = hist->count * per_mille / 1000;
+    uint32_t sum = 0;
+    uint32_t bin = 0;
+
+    for (; bin < FRAME_REMAP_BINS - 1; bin++)
+    {
+        sum += hist->bins[bin];
+        if (sum > target)
+        {
+            break;
+        }
+    }
+    return remap->base + (bin << remap->shift);
+}
+
+/*!
+ * @brief                   Prepares linear remap of raw window onto
+ *                          0..255
+ *
+ * @param[out] remap
+ * @param[in] low           Raw value that becomes 0
+ * @param[in] high          Raw value that becomes 255
+ *
+ * @note                    Centre of each bin is mapped, pixels outside
+ *                          of the window saturate.
+ */
+static inline void frame_remap_linear(frame_remap_t * remap,
+                                      uint16_t low,
+                                      uint16_t high)
+{
+    frame_remap_window(remap, low, high);
+
+    uint32_t span = high > low ? high - low : 1;
+    uint32_t half = (1U << remap->shift) >> 1;
+    for (uint32_t bin = 0; bin < FRAME_REMAP_BINS; bin++)
+    {
+        uint32_t offset = (bin << remap->shift) + half;
+        uint32_t value = (offset * 255 + span / 2) / span;
+        remap->lut[bin] = value > 255 ? 255 : value;
+    }
+}
+
+/*!
+ * @brief                   Prepares histogram equalisation with clip
+ *                          limit
+ *
+ * @param[in,out] remap     Window of hist, table is written
+ * @param[in] hist          Histogram of the frame
+ * @param[in] clip          Most pixels of a bin, as multiple of the
+ *                          average bin in Q8, 0 for no limit
+ *
+ * @note                    Pixels above clip limit are spread evenly
+ *                          over all bins, so large flat areas, like
+ *                          background walls, do not take most of the
+ *                          output range. Each bin gets the middle of its
+ *                          part of the cumulative histogram.
+ */
+static inline void frame_remap_equalize(frame_remap_t * remap,
+                                        const frame_hist_t * hist,
+                                        uint32_t clip)
+{
+    uint32_t limit = clip ? (hist->count * clip) >> (8 + FRAME_REMAP_BITS)
+                          : hist->count;
+    uint32_t excess = 0;
+
+    if (limit == 0)
+    {
+        limit = 1;
+    }
+    for (uint32_t bin = 0; bin < FRAME_REMAP_BINS; bin++)
+    {
+        if (hist->bins[bin] > limit)
+        {
+            excess += hist->bins[bin] - limit;
+        }
+    }
+
+    // Spread part, remainder goes to the first bins
+    uint32_t spread = excess / FRAME_REMAP_BINS;
+    uint32_t rest = excess % FRAME_REMAP_BINS;
+    uint32_t total = hist->count ? hist->count : 1;
+    uint32_t sum = 0;
+
+    for (uint32_t bin = 0; bin < FRAME_REMAP_BINS; bin++)
+    {
+        uint32_t count = hist->bins[bin] > limit ? limit : hist->bins[bin];
+        count += spread + (bin < rest ? 1 : 0);
+        uint32_t middle = sum + count / 2;
+        sum += count;
+        uint32_t value = (middle * 255 + total / 2) / total;
+        remap->lut[bin] = value > 255 ? 255 : value;
+    }
+}
+
+/*!
+ * @brief                   Remaps raw frame into 8 bit pixels
+ *
+ * @param[in] remap
+ * @param[in] src           First pixel of the frame
+ * @param[in] stride        Words between two rows
+ * @param[out] dst          cols x rows pixels
+ * @param[in] cols
+ * @param[in] rows
+ */
+static inline void frame_remap_u16(const frame_remap_t * remap,
+                                   const uint16_t * src,
+                                   uint32_t stride,
+                                   uint8_t * dst,
+                                   uint32_t cols,
+                                   uint32_t rows)
+{
+    for (uint32_t y = 0; y < rows; y++)
+    {
+        const uint16_t * line = src + y * stride;
+        uint8_t * out = dst + y * cols;
+        for (uint32_t x = 0; x < cols; x++)
+        {
+            out[x] = remap->lut[frame_remap_bin(remap, line[x])];
+        }
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FRAME_NORMALIZE_H */
+/*** end of file ***/
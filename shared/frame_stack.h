@@ -0,0 +1,151 @@
+#ifndef FRAME_STACK_H
+#define FRAME_STACK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "frame_convert.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Last depth frames as channels of one int8 input tensor, for models that
+// see motion. Tensor is [1][rows][cols][depth], so channel k of every pixel
+// is one slot of a ring. Newest frame overwrites the slot of the oldest
+// one, with stride depth, and the rest of the tensor stays as it is, so a
+// new frame costs one conversion and not depth of them.
+//
+// Slots are then rotated against the channel order of training, oldest
+// frame is in channel frame_stack_oldest() and not in channel 0. First
+// layer sums over input channels, so Conv2DStackResolver of
+// conv_frame_stack.h rotates input channels of its filter the same way
+// and the model gives exactly the result of the ordered tensor.
+//
+// First frame after frame_stack_reset() fills every slot, model sees a
+// still scene until the ring has depth frames of its own.
+
+#define FRAME_STACK_MAX_DEPTH   (8)
+
+typedef struct
+{
+    int8_t * data;          // Input tensor
+    uint32_t pixels;        // Rows * cols of one frame
+    uint8_t depth;          // Frames, channels of the tensor
+    uint8_t newest;         // Slot of the last frame
+    uint32_t frames;        // Pushed since reset, saturates at depth
+}frame_stack_t;
+
+/*!
+ * @brief                   Prepares empty ring over input tensor
+ *
+ * @param[out] stack
+ * @param[in] data          Tensor of pixels * depth bytes
+ * @param[in] pixels        Pixels of one frame
+ * @param[in] depth         2 to FRAME_STACK_MAX_DEPTH frames
+ *
+ * @return                  False if depth is out of range
+ */
+static inline bool frame_stack_init(frame_stack_t * stack,
+                                    int8_t * data,
+                                    uint32_t pixels,
+                                    uint8_t depth)
+{
+    if (depth < 2 || depth > FRAME_STACK_MAX_DEPTH)
+    {
+        return false;
+    }
+
+    stack->data = data;
+    stack->pixels = pixels;
+    stack->depth = depth;
+    stack->newest = depth - 1;
+    stack->frames = 0;
+    return true;
+}
+
+/*!
+ * @brief                   Forgets frames, for example when capture
+ *                          stopped and the next frame is not consecutive
+ */
+static inline void frame_stack_reset(frame_stack_t * stack)
+{
+    stack->newest = stack->depth - 1;
+    stack->frames = 0;
+}
+
+/*!
+ * @brief                   Returns channel that holds the oldest frame,
+ *                          channel of training order c is in slot
+ *                          (oldest + c) % depth
+ */
+static inline uint8_t frame_stack_oldest(const frame_stack_t * stack)
+{
+    return stack->newest + 1 == stack->depth ? 0 : stack->newest + 1;
+}
+
+/*!
+ * @brief                   Tells if every slot has a frame of its own
+ */
+static inline bool frame_stack_full(const frame_stack_t * stack)
+{
+    return stack->frames >= stack->depth;
+}
+
+/*!
+ * @brief                   Writes converted frame into its slot, or every
+ *                          slot for the first frame
+ *
+ * @param[in,out] stack
+ * @param[in] src           8 bit frame of stack->pixels
+ * @param[in] lut           Table from frame_lut_init(), NULL for quant
+ * @param[in] quant         Used when lut is NULL
+ *
+ * @note                    Slot is strided, so pixels are converted one at
+ *                          a time, with table or fast offset path of
+ *                          frame_convert_pixel().
+ */
+static inline void frame_stack_push_u8(frame_stack_t * stack,
+                                       const uint8_t * src,
+                                       const frame_lut_t * lut,
+                                       const frame_quant_t * quant)
+{
+    const uint8_t depth = stack->depth;
+    stack->newest = frame_stack_oldest(stack);
+    int8_t * dst = stack->data + stack->newest;
+
+    if (lut)
+    {
+        for (uint32_t i = 0; i < stack->pixels; i++)
+        {
+            dst[i * depth] = lut->table[src[i]];
+        }
+    }
+    else
+    {
+        for (uint32_t i = 0; i < stack->pixels; i++)
+        {
+            dst[i * depth] = frame_convert_pixel(src[i], quant);
+        }
+    }
+
+    if (stack->frames == 0)
+    {
+        int8_t * pixel = stack->data;
+        for (uint32_t i = 0; i < stack->pixels; i++, pixel += depth)
+        {
+            memset(pixel, pixel[stack->newest], depth);
+        }
+    }
+    if (stack->frames < depth)
+    {
+        stack->frames++;
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FRAME_STACK_H */
+/*** end of file ***/
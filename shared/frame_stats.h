@@ -0,0 +1,193 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "frame_normalize.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Minimum, maximum, mean and histogram of a frame in one pass over its
+// rows, so it can run on each row as soon as it arrives, while pixels are
+// still in cache. Histogram has FRAME_REMAP_BINS bins over a window that
+// has to be known before the first row, it is the range of the previous
+// frame, pixels outside of it are counted in the first or the last bin.
+// Rows of the first frame are binned over the whole range given to
+// frame_stats_init(). Window and histogram are those of frame_remap_t and
+// frame_hist_t, so remap of frame_normalize.h is prepared straight from
+// the statistics, look at frame_stats_remap().
+
+typedef struct
+{
+    uint16_t min;
+    uint16_t max;
+    uint32_t sum;
+    uint16_t base;              // Raw value of the first bin
+    uint8_t shift;              // log2 of raw values per bin
+    frame_hist_t hist;
+}frame_stats_t;
+
+/*!
+ * @brief                   Prepares statistics of the first frame
+ *
+ * @param[out] stats
+ * @param[in] max_value     Largest pixel value, for example 16383 for raw
+ *                          Lepton pixels and 255 for AGC
+ */
+static inline void frame_stats_init(frame_stats_t * stats, uint16_t max_value)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    frame_remap_t window;
+    frame_remap_window(&window, 0, max_value);
+    stats->base = window.base;
+    stats->shift = window.shift;
+}
+
+/*!
+ * @brief                   Starts next frame, its window is the range of
+ *                          the frame that was measured until now
+ *
+ * @param[in,out] stats
+ */
+static inline void frame_stats_begin(frame_stats_t * stats)
+{
+    if (stats->hist.count)
+    {
+        frame_remap_t window;
+        frame_remap_window(&window, stats->min, stats->max);
+        stats->base = window.base;
+        stats->shift = window.shift;
+    }
+
+    stats->min = UINT16_MAX;
+    stats->max = 0;
+    stats->sum = 0;
+    memset(&stats->hist, 0, sizeof(stats->hist));
+}
+
+/*!
+ * @brief                   Adds row of pixels to the statistics
+ *
+ * @param[in,out] stats
+ * @param[in] src           Pixels, for example payload of VoSPI packet
+ * @param[in] cols
+ *
+ * @note                    In fast path each instruction works on two
+ *                          pixels: USUB16 with SEL for minimum and maximum,
+ *                          SMLAD for the sum and UQSUB16 for the offset
+ *                          into the window. Pixels have to be below 32768,
+ *                          as raw 14 bit and AGC ones are, row should be
+ *                          word aligned.
+ */
+static inline void frame_stats_row_u16(frame_stats_t * stats,
+                                       const uint16_t * src,
+                                       uint32_t cols)
+{
+    uint16_t * bins = stats->hist.bins;
+    uint32_t low = stats->min;
+    uint32_t high = stats->max;
+    uint32_t sum = stats->sum;
+    uint32_t x = 0;
+
+#ifdef FRAME_CONVERT_SIMD
+    uint32_t low2 = 0xFFFFFFFFu;
+    uint32_t high2 = 0;
+    uint32_t base2 = stats->base * 0x00010001u;
+    uint32_t mask2 = (0xFFFFu >> stats->shift) * 0x00010001u;
+    uint32_t last2 = (FRAME_REMAP_BINS - 1) * 0x00010001u;
+
+    for (; x + 2 <= cols; x += 2)
+    {
+        uint32_t pair;
+        memcpy(&pair, src + x, 4);
+
+        low2 = frame_min2(low2, pair);
+        high2 = frame_max2(high2, pair);
+        sum = __SMLAD(pair, 0x00010001u, sum);
+
+        uint32_t bin2 = frame_min2((__UQSUB16(pair, base2) >> stats->shift) &
+                                   mask2, last2);
+        bins[bin2 & 0xFFFF]++;
+        bins[bin2 >> 16]++;
+    }
+    if ((low2 & 0xFFFF) < low) low = low2 & 0xFFFF;
+    if ((low2 >> 16) < low) low = low2 >> 16;
+    if ((high2 & 0xFFFF) > high) high = high2 & 0xFFFF;
+    if ((high2 >> 16) > high) high = high2 >> 16;
+#endif
+    for (; x < cols; x++)
+    {
+        uint32_t pixel = src[x];
+        uint32_t bin = pixel > stats->base ?
+                       (pixel - stats->base) >> stats->shift : 0;
+
+        if (pixel < low) low = pixel;
+        if (pixel > high) high = pixel;
+        sum += pixel;
+        bins[bin < FRAME_REMAP_BINS ? bin : FRAME_REMAP_BINS - 1]++;
+    }
+
+    stats->min = low;
+    stats->max = high;
+    stats->sum = sum;
+    stats->hist.count += cols;
+}
+
+/*!
+ * @brief                   Returns rounded mean pixel, 0 before any row
+ */
+static inline uint16_t frame_stats_mean(const frame_stats_t * stats)
+{
+    uint32_t count = stats->hist.count;
+    return count ? (uint16_t) ((stats->sum + count / 2) / count) : 0;
+}
+
+/*!
+ * @brief                   Returns raw value below which given part of
+ *                          pixels is, as frame_hist_percentile()
+ *
+ * @param[in] stats
+ * @param[in] per_mille     Part of pixels, 0 to 1000
+ */
+static inline uint16_t frame_stats_percentile(const frame_stats_t * stats,
+                                              uint32_t per_mille)
+{
+    uint32_t target = stats->hist.count * per_mille / 1000;
+    uint32_t sum = 0;
+    uint32_t bin = 0;
+
+    for (; bin < FRAME_REMAP_BINS - 1; bin++)
+    {
+        sum += stats->hist.bins[bin];
+        if (sum > target)
+        {
+            break;
+        }
+    }
+    return stats->base + (bin << stats->shift);
+}
+
+/*!
+ * @brief                   Places bins of remap over window of the
+ *                          histogram, as needed by frame_remap_equalize()
+ *
+ * @param[in] stats
+ * @param[out] remap        Table is not touched
+ */
+static inline void frame_stats_remap(const frame_stats_t * stats,
+                                     frame_remap_t * remap)
+{
+    remap->base = stats->base;
+    remap->shift = stats->shift;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FRAME_STATS_H */
+/*** end of file ***/
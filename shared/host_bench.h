@@ -0,0 +1,208 @@
+#ifndef HOST_BENCH_H
+#define HOST_BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/core/api/profiler.h"
+#include "tensorflow/lite/micro/compatibility.h"
+#include "tensorflow/lite/micro/micro_interpreter.h"
+
+// Latency benchmark of a model on the development machine.
+//
+// Built with "make host_bench" against testlite.a, the same way as tests,
+// from BENCHFILES of project.mk. Each iteration runs the model once on
+// every image, warm-up iterations are not measured. Result is one JSON
+// object on stdout with min, median, p99 and mean latency of Invoke() and
+// average time of each operator, so it can be compared between commits
+// by a script before anything is flashed.
+//
+// Arguments: -n iterations (default 100), -w warm-up iterations
+// (default 10), -m memory stall estimate of each operator after the
+// JSON, pass them with make host_bench BENCH_ARGS="-n 500".
+//
+// Usage example:
+// static HostOpProfiler profiler;
+// tflite::MicroInterpreter interpreter(model, resolver, arena, size,
+//                                      reporter, &profiler);
+// interpreter.AllocateTensors();
+// HostBenchConfig config = host_bench_parse_args(argc, argv);
+// const HostBenchImage images[] = {{"image0", image0}, {"image1", image1}};
+// return host_bench_run("elephant", &interpreter, &profiler, images, 2,
+//                       config) ? 0 : 1;
+
+// Per operator time, same slots as CycleProfiler, but with host clock
+class HostOpProfiler : public tflite::Profiler {
+ public:
+  static constexpr int kMaxOps = 64;
+
+  HostOpProfiler() { Reset(); }
+  ~HostOpProfiler() override = default;
+
+  using tflite::Profiler::BeginEvent;
+  using tflite::Profiler::EndEvent;
+
+  uint32_t BeginEvent(const char* tag, EventType event_type,
+                      int64_t event_metadata1,
+                      int64_t event_metadata2) override {
+    uint32_t handle = static_cast<uint32_t>(event_metadata1);
+    if (handle >= kMaxOps) {
+      return kMaxOps;
+    }
+
+    tags_[handle] = tag;
+    if (handle >= num_ops_) {
+      num_ops_ = handle + 1;
+    }
+    start_[handle] = std::chrono::steady_clock::now();
+    return handle;
+  }
+
+  void EndEvent(uint32_t event_handle) override {
+    auto end = std::chrono::steady_clock::now();
+    if (event_handle >= kMaxOps) {
+      return;
+    }
+
+    ns_[event_handle] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             end - start_[event_handle]).count();
+    counts_[event_handle]++;
+  }
+
+  void Reset() {
+    num_ops_ = 0;
+    for (int i = 0; i < kMaxOps; i++) {
+      tags_[i] = nullptr;
+      ns_[i] = 0;
+      counts_[i] = 0;
+    }
+  }
+
+  uint32_t num_ops() const { return num_ops_; }
+  const char* tag(uint32_t index) const { return tags_[index]; }
+
+  // Average time of the operator over all Invoke() calls since Reset()
+  double AverageUs(uint32_t index) const {
+    return counts_[index] ? ns_[index] / 1000.0 / counts_[index] : 0.0;
+  }
+
+ private:
+  uint32_t num_ops_;
+  const char* tags_[kMaxOps];
+  std::chrono::steady_clock::time_point start_[kMaxOps];
+  uint64_t ns_[kMaxOps];
+  uint32_t counts_[kMaxOps];
+
+  TF_LITE_REMOVE_VIRTUAL_DELETE
+};
+
+struct HostBenchImage {
+  const char* name;
+  const signed char* data;
+};
+
+struct HostBenchConfig {
+  int iterations;
+  int warmup;
+  // Estimate STM32F7 memory stalls afterwards, see shared/mem_model.h
+  bool mem_model;
+};
+
+// Reads -n, -w and -m, unknown arguments are reported and ignored
+inline HostBenchConfig host_bench_parse_args(int argc, char** argv) {
+  HostBenchConfig config = {100, 10, false};
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+      config.iterations = atoi(argv[++i]);
+    } else if (i + 1 < argc && strcmp(argv[i], "-w") == 0) {
+      config.warmup = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-m") == 0) {
+      config.mem_model = true;
+    } else {
+      fprintf(stderr, "Unknown argument %s\n", argv[i]);
+    }
+  }
+  if (config.iterations < 1) config.iterations = 1;
+  if (config.warmup < 0) config.warmup = 0;
+  return config;
+}
+
+// Returns value at given fraction of sorted samples, nearest rank
+inline double host_bench_percentile(const std::vector<double>& sorted,
+                                    double fraction) {
+  size_t rank = static_cast<size_t>(fraction * sorted.size() + 0.999999);
+  if (rank < 1) rank = 1;
+  if (rank > sorted.size()) rank = sorted.size();
+  return sorted[rank - 1];
+}
+
+// Runs the benchmark and prints JSON, returns false if any Invoke() failed
+inline bool host_bench_run(const char* model_name,
+                           tflite::MicroInterpreter* interpreter,
+                           HostOpProfiler* profiler,
+                           const HostBenchImage* images, int image_count,
+                           const HostBenchConfig& config) {
+  TfLiteTensor* input = interpreter->input(0);
+  std::vector<double> samples;
+  samples.reserve(config.iterations * image_count);
+
+  for (int run = 0; run < config.warmup + config.iterations; run++) {
+    // Operators are measured only after warm-up
+    if (run == config.warmup) profiler->Reset();
+
+    for (int i = 0; i < image_count; i++) {
+      memcpy(input->data.int8, images[i].data, input->bytes);
+
+      auto start = std::chrono::steady_clock::now();
+      if (interpreter->Invoke() != kTfLiteOk) {
+        fprintf(stderr, "Invoke failed on %s\n", images[i].name);
+        return false;
+      }
+      auto end = std::chrono::steady_clock::now();
+
+      if (run >= config.warmup) {
+        samples.push_back(
+            std::chrono::duration<double, std::micro>(end - start).count());
+      }
+    }
+  }
+
+  std::sort(samples.begin(), samples.end());
+  double total = 0.0;
+  for (double sample : samples) total += sample;
+
+  printf("{\"model\": \"%s\", \"images\": %d, \"iterations\": %d, "
+         "\"warmup\": %d, \"arena_used\": %u,\n", model_name, image_count,
+         config.iterations, config.warmup,
+         static_cast<unsigned>(interpreter->arena_used_bytes()));
+  printf(" \"latency_us\": {\"min\": %.2f, \"median\": %.2f, "
+         "\"p99\": %.2f, \"mean\": %.2f, \"max\": %.2f},\n",
+         samples.front(), host_bench_percentile(samples, 0.5),
+         host_bench_percentile(samples, 0.99), total / samples.size(),
+         samples.back());
+
+  double ops_total = 0.0;
+  for (uint32_t i = 0; i < profiler->num_ops(); i++) {
+    ops_total += profiler->AverageUs(i);
+  }
+
+  printf(" \"ops\": [");
+  for (uint32_t i = 0; i < profiler->num_ops(); i++) {
+    double us = profiler->AverageUs(i);
+    printf("%s\n  {\"index\": %u, \"name\": \"%s\", \"us\": %.2f, "
+           "\"percent\": %.1f}", i ? "," : "", i,
+           profiler->tag(i) ? profiler->tag(i) : "-", us,
+           ops_total > 0.0 ? us * 100.0 / ops_total : 0.0);
+  }
+  printf("]}\n");
+  return true;
+}
+
+#endif  // HOST_BENCH_H
@@ -0,0 +1,503 @@
+#ifndef HOST_EVAL_H
+#define HOST_EVAL_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/micro/micro_interpreter.h"
+
+#include "dataset_file.h"
+
+// Accuracy and throughput of a model over a whole dataset on the
+// development machine.
+//
+// Built with "make host_eval" against testlite.a, the same way as tests,
+// from EVALFILES of project.mk. Dataset is a container of
+// make_dataset.py with its labels, see dataset_file.h, or a .npy array of
+// quantized input tensors, one per row of the first axis, with labels in
+// an optional .npy array of class indexes, the same files eval_stream.py
+// sends to the board. Files are memory mapped, so datasets larger than
+// memory work and pages are shared by all threads.
+//
+// Every thread has its own interpreter and arena, created by the project
+// factory, the op resolver and the model are shared, they are read only
+// once interpreters are allocated. Images are split into one contiguous
+// range per thread, a thread takes chunks from the front of its own range
+// and, when it is empty, steals the back half of the range of another
+// thread, so slow threads do not hold up the end of the run. Result is one
+// JSON object on stdout with accuracy, images per second, latency of
+// Invoke() and how many images each thread did.
+//
+// Arguments: -d dataset (required), -l labels of a .npy dataset, -j
+// threads (default one per core), -c images per chunk (default 16), pass
+// them with make host_eval EVAL_ARGS="-d images.mlds" or
+// EVAL_ARGS="-d images.npy -l labels.npy".
+//
+// Usage example:
+// HostEvalConfig config;
+// if (!host_eval_parse_args(argc, argv, &config)) return 1;
+// auto factory = [&](uint8_t* arena, size_t size) {
+//   return std::unique_ptr<tflite::MicroInterpreter>(
+//       new tflite::MicroInterpreter(model, resolver, arena, size, reporter));
+// };
+// return host_eval_run("elephant", factory, kArenaSize, config) ? 0 : 1;
+
+// Memory mapped array with its first axis as rows, of a .npy file or of
+// a dataset container
+struct HostEvalArray {
+  const uint8_t* data;
+  size_t rows;
+  size_t row_bytes;
+  size_t stride;   // From one row to the next, padded in a container
+  char kind;       // 'i', 'u', 'f' or 'b' of numpy
+  int item_size;
+  void* map;
+  size_t map_size;
+};
+
+// Value of key in the header dictionary, right after its colon
+inline const char* host_eval_npy_field(const char* header, const char* key) {
+  const char* field = strstr(header, key);
+  if (!field) return nullptr;
+  field = strchr(field + strlen(key), ':');
+  if (!field) return nullptr;
+  field++;
+  while (*field == ' ') field++;
+  return field;
+}
+
+// Maps the whole file, returns false with a message
+inline bool host_eval_map(const char* path, HostEvalArray* array) {
+  memset(array, 0, sizeof(*array));
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Can not open %s\n", path);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < 10) {
+    fprintf(stderr, "%s is too short\n", path);
+    close(fd);
+    return false;
+  }
+  array->map_size = static_cast<size_t>(st.st_size);
+  array->map = mmap(nullptr, array->map_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (array->map == MAP_FAILED) {
+    array->map = nullptr;
+    fprintf(stderr, "Can not map %s\n", path);
+    return false;
+  }
+  madvise(array->map, array->map_size, MADV_SEQUENTIAL);
+  return true;
+}
+
+// Parses a mapped C ordered little endian array, false with a message
+inline bool host_eval_npy_parse(const char* path, HostEvalArray* array) {
+  // Magic, version, header length of 2 bytes in 1.0 and 4 bytes later
+  const uint8_t* file = static_cast<const uint8_t*>(array->map);
+  if (memcmp(file, "\x93NUMPY", 6) != 0) {
+    fprintf(stderr, "%s is not a .npy file or a dataset\n", path);
+    return false;
+  }
+  size_t start = file[6] == 1 ? 10 : 12;
+  size_t header_len = file[8] | (file[9] << 8);
+  if (file[6] != 1) {
+    header_len |= (file[10] << 16) | (static_cast<size_t>(file[11]) << 24);
+  }
+  if (start + header_len > array->map_size) {
+    fprintf(stderr, "%s has a broken header\n", path);
+    return false;
+  }
+  std::string header(reinterpret_cast<const char*>(file + start), header_len);
+
+  const char* descr = host_eval_npy_field(header.c_str(), "'descr'");
+  const char* order = host_eval_npy_field(header.c_str(), "'fortran_order'");
+  const char* shape = host_eval_npy_field(header.c_str(), "'shape'");
+  if (!descr || !order || !shape || descr[0] != '\'' || shape[0] != '(') {
+    fprintf(stderr, "%s has a broken header\n", path);
+    return false;
+  }
+  // '<i4', '|i1' and friends, big endian arrays are not supported
+  if ((descr[1] != '<' && descr[1] != '|') || !strchr("iufb", descr[2])) {
+    fprintf(stderr, "%s: type %.5s is not supported\n", path, descr);
+    return false;
+  }
+  array->kind = descr[2];
+  array->item_size = atoi(descr + 3);
+  if (strncmp(order, "False", 5) != 0) {
+    fprintf(stderr, "%s is in Fortran order\n", path);
+    return false;
+  }
+
+  size_t row_items = 1;
+  bool first = true;
+  for (const char* dim = shape + 1; *dim && *dim != ')';) {
+    char* end;
+    size_t value = strtoul(dim, &end, 10);
+    if (end == dim) {
+      dim++;
+      continue;
+    }
+    if (first) {
+      array->rows = value;
+      first = false;
+    } else {
+      row_items *= value;
+    }
+    dim = end;
+  }
+  if (first) {
+    fprintf(stderr, "%s is a scalar, not an array\n", path);
+    return false;
+  }
+  array->row_bytes = row_items * array->item_size;
+  array->stride = array->row_bytes;
+  array->data = file + start + header_len;
+  if (array->data + array->rows * array->stride > file + array->map_size) {
+    fprintf(stderr, "%s is shorter than its shape\n", path);
+    return false;
+  }
+  return true;
+}
+
+inline bool host_eval_npy_open(const char* path, HostEvalArray* array) {
+  return host_eval_map(path, array) && host_eval_npy_parse(path, array);
+}
+
+// Maps a container or a .npy file, labels of the container are a view of
+// the same mapping and are not closed on their own
+inline bool host_eval_dataset_open(const char* path, HostEvalArray* samples,
+                                   HostEvalArray* labels) {
+  memset(labels, 0, sizeof(*labels));
+  if (!host_eval_map(path, samples)) return false;
+
+  const dataset_header_t* header =
+      static_cast<const dataset_header_t*>(samples->map);
+  if (samples->map_size < sizeof(*header) ||
+      header->magic != DATASET_MAGIC) {
+    return host_eval_npy_parse(path, samples);
+  }
+  if (samples->map_size > UINT32_MAX ||
+      !dataset_check(header, static_cast<uint32_t>(samples->map_size))) {
+    fprintf(stderr, "%s is a broken dataset\n", path);
+    return false;
+  }
+  samples->data = static_cast<const uint8_t*>(dataset_sample(header, 0));
+  samples->rows = header->count;
+  samples->row_bytes = header->sample_bytes;
+  samples->stride = header->sample_stride;
+  samples->kind = header->type == DATASET_TYPE_INT8 ? 'i' : 'u';
+  samples->item_size = 1;
+  if (header->labels_offset) {
+    labels->data = static_cast<const uint8_t*>(samples->map) +
+                   header->labels_offset;
+    labels->rows = header->count;
+    labels->row_bytes = labels->stride = 2;
+    labels->kind = 'u';
+    labels->item_size = 2;
+  }
+  return true;
+}
+
+inline void host_eval_close(HostEvalArray* array) {
+  if (array->map) munmap(array->map, array->map_size);
+  array->map = nullptr;
+}
+
+// Class index of labels, any integer type numpy gives
+inline int64_t host_eval_label(const HostEvalArray& labels, size_t row) {
+  const uint8_t* value = labels.data + row * labels.stride;
+  bool is_signed = labels.kind == 'i';
+  switch (labels.item_size) {
+    case 1: return is_signed ? *reinterpret_cast<const int8_t*>(value)
+                             : *value;
+    case 2: return is_signed ? *reinterpret_cast<const int16_t*>(value)
+                             : *reinterpret_cast<const uint16_t*>(value);
+    case 4: return is_signed ? *reinterpret_cast<const int32_t*>(value)
+                             : *reinterpret_cast<const uint32_t*>(value);
+    default: return *reinterpret_cast<const int64_t*>(value);
+  }
+}
+
+// Index of the top score, -1 for outputs that are not scores
+inline int host_eval_argmax(const TfLiteTensor* output) {
+  int count = 0;
+  switch (output->type) {
+    case kTfLiteInt8: count = output->bytes; break;
+    case kTfLiteUInt8: count = output->bytes; break;
+    case kTfLiteFloat32: count = output->bytes / sizeof(float); break;
+    default: return -1;
+  }
+  int best = 0;
+  for (int i = 1; i < count; i++) {
+    bool higher;
+    if (output->type == kTfLiteInt8) {
+      higher = output->data.int8[i] > output->data.int8[best];
+    } else if (output->type == kTfLiteUInt8) {
+      higher = output->data.uint8[i] > output->data.uint8[best];
+    } else {
+      higher = output->data.f[i] > output->data.f[best];
+    }
+    if (higher) best = i;
+  }
+  return best;
+}
+
+// Per thread ranges of image indexes, owner takes from the front, thieves
+// take the back half. Ranges only shrink, except when the owner puts what
+// it stole into its own, so a thread that finds all of them empty is done.
+class HostEvalQueue {
+ public:
+  HostEvalQueue(size_t images, int threads, size_t chunk)
+      : ranges_(threads), steals_(threads, 0), chunk_(chunk) {
+    for (int t = 0; t < threads; t++) {
+      ranges_[t].begin = images * t / threads;
+      ranges_[t].end = images * (t + 1) / threads;
+    }
+  }
+
+  // Next chunk of thread, returns false when every range is empty
+  bool Pop(int thread, size_t* begin, size_t* end) {
+    if (PopOwn(thread, begin, end)) return true;
+
+    int threads = static_cast<int>(ranges_.size());
+    for (int i = 1; i < threads; i++) {
+      Range& victim = ranges_[(thread + i) % threads];
+      size_t stolen_begin, stolen_end;
+      {
+        std::lock_guard<std::mutex> lock(victim.lock);
+        size_t left = victim.end - victim.begin;
+        if (left == 0) continue;
+        stolen_end = victim.end;
+        victim.end -= (left + 1) / 2;
+        stolen_begin = victim.end;
+      }
+      {
+        std::lock_guard<std::mutex> lock(ranges_[thread].lock);
+        ranges_[thread].begin = stolen_begin;
+        ranges_[thread].end = stolen_end;
+      }
+      steals_[thread]++;
+      return PopOwn(thread, begin, end);
+    }
+    return false;
+  }
+
+  uint32_t steals(int thread) const { return steals_[thread]; }
+
+ private:
+  struct Range {
+    std::mutex lock;
+    size_t begin = 0;
+    size_t end = 0;
+  };
+
+  bool PopOwn(int thread, size_t* begin, size_t* end) {
+    Range& own = ranges_[thread];
+    std::lock_guard<std::mutex> lock(own.lock);
+    if (own.begin == own.end) return false;
+    *begin = own.begin;
+    own.begin = std::min(own.begin + chunk_, own.end);
+    *end = own.begin;
+    return true;
+  }
+
+  std::vector<Range> ranges_;
+  std::vector<uint32_t> steals_;
+  size_t chunk_;
+};
+
+struct HostEvalConfig {
+  const char* dataset = nullptr;
+  const char* labels = nullptr;
+  int threads = 0;
+  size_t chunk = 16;
+};
+
+// Reads -d, -l, -j and -c, returns false without a dataset
+inline bool host_eval_parse_args(int argc, char** argv,
+                                 HostEvalConfig* config) {
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 < argc && strcmp(argv[i], "-d") == 0) {
+      config->dataset = argv[++i];
+    } else if (i + 1 < argc && strcmp(argv[i], "-l") == 0) {
+      config->labels = argv[++i];
+    } else if (i + 1 < argc && strcmp(argv[i], "-j") == 0) {
+      config->threads = atoi(argv[++i]);
+    } else if (i + 1 < argc && strcmp(argv[i], "-c") == 0) {
+      config->chunk = strtoul(argv[++i], nullptr, 10);
+    } else {
+      fprintf(stderr, "Unknown argument %s\n", argv[i]);
+    }
+  }
+  if (config->threads < 1) {
+    config->threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  if (config->chunk < 1) config->chunk = 1;
+  if (!config->dataset) {
+    fprintf(stderr, "Dataset is missing, pass it with -d images.mlds\n");
+    return false;
+  }
+  return true;
+}
+
+// Creates an interpreter over the given arena, called once per thread,
+// never by two threads at once
+using HostEvalFactory = std::function<std::unique_ptr<tflite::MicroInterpreter>(
+    uint8_t* arena, size_t arena_size)>;
+
+// Runs the dataset and prints JSON, returns false if an interpreter could
+// not be created or any Invoke() failed
+inline bool host_eval_run(const char* model_name,
+                          const HostEvalFactory& factory, size_t arena_size,
+                          const HostEvalConfig& config) {
+  HostEvalArray images;
+  HostEvalArray labels;
+  if (!host_eval_dataset_open(config.dataset, &images, &labels)) {
+    host_eval_close(&images);
+    return false;
+  }
+  if (config.labels) {
+    if (!host_eval_npy_open(config.labels, &labels) ||
+        (labels.kind != 'i' && labels.kind != 'u')) {
+      fprintf(stderr, "%s has to be integer class indexes\n", config.labels);
+      host_eval_close(&images);
+      host_eval_close(&labels);
+      return false;
+    }
+  }
+  if (labels.data && labels.rows < images.rows) {
+    fprintf(stderr, "%zu labels for %zu images\n", labels.rows, images.rows);
+    host_eval_close(&images);
+    host_eval_close(&labels);
+    return false;
+  }
+
+  const int threads = config.threads;
+  HostEvalQueue queue(images.rows, threads, config.chunk);
+  std::vector<int> predictions(images.rows, -1);
+  std::vector<std::vector<double>> samples(threads);
+  std::vector<size_t> done(threads, 0);
+  // Not vector<bool>, its bits are shared by neighbouring threads
+  std::vector<char> failed(threads, 0);
+  size_t arena_used = 0;
+  std::mutex setup_lock;
+
+  auto worker = [&](int thread) {
+    std::unique_ptr<uint8_t[]> arena(new uint8_t[arena_size]);
+    std::unique_ptr<tflite::MicroInterpreter> interpreter;
+    {
+      std::lock_guard<std::mutex> lock(setup_lock);
+      interpreter = factory(arena.get(), arena_size);
+      if (!interpreter || interpreter->AllocateTensors() != kTfLiteOk) {
+        fprintf(stderr, "Thread %d: AllocateTensors() failed\n", thread);
+        failed[thread] = 1;
+        return;
+      }
+      arena_used = interpreter->arena_used_bytes();
+    }
+
+    TfLiteTensor* input = interpreter->input(0);
+    if (input->bytes != images.row_bytes) {
+      fprintf(stderr, "Model takes %zu bytes, images have %zu\n",
+              input->bytes, images.row_bytes);
+      failed[thread] = 1;
+      return;
+    }
+
+    size_t begin, end;
+    while (queue.Pop(thread, &begin, &end)) {
+      for (size_t i = begin; i < end; i++) {
+        memcpy(input->data.raw, images.data + i * images.stride,
+               images.row_bytes);
+
+        auto start = std::chrono::steady_clock::now();
+        if (interpreter->Invoke() != kTfLiteOk) {
+          fprintf(stderr, "Invoke failed on image %zu\n", i);
+          failed[thread] = 1;
+          return;
+        }
+        auto stop = std::chrono::steady_clock::now();
+
+        samples[thread].push_back(
+            std::chrono::duration<double, std::micro>(stop - start).count());
+        predictions[i] = host_eval_argmax(interpreter->output(0));
+        done[thread]++;
+      }
+    }
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> pool;
+  for (int t = 0; t < threads; t++) pool.emplace_back(worker, t);
+  for (std::thread& thread : pool) thread.join();
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start).count();
+
+  bool ok = std::find(failed.begin(), failed.end(), 1) == failed.end();
+  std::vector<double> latency;
+  latency.reserve(images.rows);
+  for (const std::vector<double>& thread : samples) {
+    latency.insert(latency.end(), thread.begin(), thread.end());
+  }
+  if (!ok || latency.empty()) {
+    host_eval_close(&images);
+    host_eval_close(&labels);
+    return false;
+  }
+  std::sort(latency.begin(), latency.end());
+  double total = 0.0;
+  for (double sample : latency) total += sample;
+  auto percentile = [&](double fraction) {
+    size_t rank = static_cast<size_t>(fraction * latency.size() + 0.999999);
+    rank = std::min(std::max<size_t>(rank, 1), latency.size());
+    return latency[rank - 1];
+  };
+
+  printf("{\"model\": \"%s\", \"images\": %zu, \"threads\": %d, "
+         "\"chunk\": %zu, \"arena_used\": %zu,\n", model_name, images.rows,
+         threads, config.chunk, arena_used);
+  printf(" \"seconds\": %.3f, \"images_per_s\": %.1f,\n", seconds,
+         images.rows / seconds);
+  printf(" \"latency_us\": {\"min\": %.2f, \"median\": %.2f, "
+         "\"p99\": %.2f, \"mean\": %.2f, \"max\": %.2f},\n",
+         latency.front(), percentile(0.5), percentile(0.99),
+         total / latency.size(), latency.back());
+  if (labels.data) {
+    size_t correct = 0;
+    for (size_t i = 0; i < images.rows; i++) {
+      correct += predictions[i] == host_eval_label(labels, i);
+    }
+    printf(" \"accuracy\": %.4f, \"correct\": %zu,\n",
+           static_cast<double>(correct) / images.rows, correct);
+  }
+  printf(" \"workers\": [");
+  for (int t = 0; t < threads; t++) {
+    printf("%s\n  {\"thread\": %d, \"images\": %zu, \"steals\": %u}",
+           t ? "," : "", t, done[t], queue.steals(t));
+  }
+  printf("]}\n");
+
+  host_eval_close(&images);
+  host_eval_close(&labels);
+  return true;
+}
+
+#endif  // HOST_EVAL_H
@@ -0,0 +1,912 @@
+#ifndef INFERENCE_ENGINE_H
+#define INFERENCE_ENGINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <new>
+
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/core/api/error_reporter.h"
+#include "tensorflow/lite/core/api/profiler.h"
+#include "tensorflow/lite/micro/micro_interpreter.h"
+#include "tensorflow/lite/micro/micro_mutable_op_resolver.h"
+#include "tensorflow/lite/micro/simple_memory_allocator.h"
+#include "tensorflow/lite/schema/schema_generated.h"
+#include "tensorflow/lite/version.h"
+
+#include "arena_report.h"
+
+// Common model loading, op registration and tensor arena for all projects.
+//
+// Engine is configured at compile time with arena size and list of
+// operators, only Add functions of listed operators are referenced, so
+// linker drops all other kernels with --gc-sections.
+//
+// Usage example:
+// static InferenceEngine<46400, engine_ops::Conv2D,
+//                               engine_ops::MaxPool2D,
+//                               engine_ops::Softmax> engine;
+// if (!engine.Setup(model_data, error_reporter)) return;
+// load_data(engine.input());
+// engine.Invoke();
+// read_results(engine.output());
+//
+// Arena is a member, so engine object can be placed in a specific section,
+// for example with DTCM_BSS in power_test.
+//
+// Model can be replaced at runtime with Reload(), interpreter is destroyed
+// and created again over the same arena. Resolver only has operators from
+// the template list, so new model may not need any other ones.
+//
+// Several engines can share one arena, see shared/shared_arena.h. They are
+// declared with arena size 0 and get allocator in Setup(), Reload() is not
+// available for them.
+//
+// StateChecksum() covers what AllocateTensors() leaves behind and Invoke()
+// does not change, so a caller can check that retained RAM still holds a
+// usable interpreter, for example after STOP, and skip Setup().
+//
+// InvokeStep() runs the graph a few operators at a time, the same loop
+// as MicroInterpreter::Invoke(), so time critical work can run between
+// layers:
+// do {
+//   if (!engine.InvokeStep(1)) return;
+//   serve_camera();
+// } while (engine.InvokeInProgress());
+// Input and output tensors must not be touched until the last step.
+//
+// LoadInput() points the input tensor at a constant buffer, for example a
+// test image in flash, instead of copying it into the arena, so benchmark
+// loops measure the model only. After it the tensor may be read-only,
+// call UnbindInput() before writing into input()->data again. Bound
+// pointers are part of StateChecksum().
+//
+// Freeze() takes the kernel calls out of the interpreter into a flat
+// array, see FrozenGraph below, InvokeFrozen() then runs them without the
+// per operator work of MicroInterpreter::Invoke(). It is for small models
+// invoked at a high rate, where that work is a visible part of inference.
+//
+// SaveState() writes the engine object and the persistent part of the
+// arena, RestoreState() copies them back on a later boot of the same
+// firmware instead of Setup(), so AllocateTensors() does not parse the
+// flatbuffer and run Prepare() of every kernel again:
+// if (!engine.RestoreState(flash_state, model_data, build_id)) {
+//   engine.Setup(model_data, error_reporter);
+//   engine.SaveState(flash_write, nullptr, build_id);
+// }
+//
+// BorrowArena() lends the arena below its persistent tail, activations,
+// scratch and the free middle, to the application between inferences,
+// for example for frame buffers or compression scratch. Activations are
+// rewritten by every Invoke(), so nothing is lost but the contents of
+// input and output tensors, read results before and fill input after
+// ReturnArena(). Borrowing and every kind of Invoke() claim the arena
+// with compare and swap, so an interrupt can borrow it too, whichever
+// comes second fails:
+// size_t bytes;
+// uint8_t* buffer = engine.BorrowArena(&bytes);
+// if (buffer) {
+//   compress_frame(buffer, bytes);
+//   engine.ReturnArena();
+// }
+// Only engines with their own arena lend it, the head of a shared one
+// belongs to all of its models.
+
+// Operator tags, add new ones here when a model needs them
+namespace engine_ops {
+#define ENGINE_OP(name)                                             \
+  struct name {                                                     \
+    template <typename Resolver>                                    \
+    static TfLiteStatus Register(Resolver& resolver) {              \
+      return resolver.Add##name();                                  \
+    }                                                               \
+  };
+
+ENGINE_OP(Add)
+ENGINE_OP(AveragePool2D)
+ENGINE_OP(Conv2D)
+ENGINE_OP(DepthwiseConv2D)
+ENGINE_OP(Dequantize)
+ENGINE_OP(FullyConnected)
+ENGINE_OP(Logistic)
+ENGINE_OP(MaxPool2D)
+ENGINE_OP(Mul)
+ENGINE_OP(Quantize)
+ENGINE_OP(Relu)
+ENGINE_OP(Reshape)
+ENGINE_OP(Softmax)
+ENGINE_OP(Svdf)
+
+#undef ENGINE_OP
+}  // namespace engine_ops
+
+namespace engine_internal {
+// C++11 has no fold expressions, so operators are added recursively
+template <typename Resolver>
+inline TfLiteStatus AddOps(Resolver&) {
+  return kTfLiteOk;
+}
+
+template <typename Resolver, typename Op, typename... Rest>
+inline TfLiteStatus AddOps(Resolver& resolver) {
+  if (Op::Register(resolver) != kTfLiteOk) {
+    return kTfLiteError;
+  }
+  return AddOps<Resolver, Rest...>(resolver);
+}
+
+const uint32_t kChecksumSeed = 2166136261u;
+
+// FNV-1a, a word at a time, buffers are word aligned
+inline uint32_t Checksum(const void* data, size_t bytes, uint32_t hash) {
+  const uint32_t* words = static_cast<const uint32_t*>(data);
+  for (size_t i = 0; i < bytes / 4; i++) {
+    hash = (hash ^ words[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// MicroInterpreter keeps TfLiteContext private, kernels get it only from
+// Invoke(). Template arguments of an explicit instantiation may name
+// private members, so this hands out pointer to the context member and
+// nothing else.
+template <typename Tag, typename Tag::Type kMember>
+struct MemberAccess {
+  friend typename Tag::Type Member(Tag) { return kMember; }
+};
+
+struct InterpreterContext {
+  typedef TfLiteContext tflite::MicroInterpreter::*Type;
+  friend Type Member(InterpreterContext);
+};
+
+template struct MemberAccess<InterpreterContext,
+                             &tflite::MicroInterpreter::context_>;
+
+struct InterpreterNodes {
+  typedef tflite::NodeAndRegistration* tflite::MicroInterpreter::*Type;
+  friend Type Member(InterpreterNodes);
+};
+
+template struct MemberAccess<
+    InterpreterNodes, &tflite::MicroInterpreter::node_and_registrations_>;
+
+// Saved state of SaveState(), header is written after the rest of it, so
+// erased flash and interrupted writes never pass RestoreState()
+const uint32_t kStateMagic = 0x54535445u;  // "ETST"
+const size_t kMaxStateCodes = 16;
+
+struct StateHeader {
+  uint32_t magic;
+  uint32_t build_id;
+  uint32_t engine_address;
+  uint32_t engine_size;
+  uint32_t model_address;   // Of GetModel(), not of the buffer
+  uint32_t prefix_size;     // Engine object up to its arena
+  uint32_t tail_size;       // Persistent tail of the arena
+  uint32_t regions_size;
+  uint32_t num_codes;
+  int32_t codes[kMaxStateCodes];
+  uint32_t checksum;        // Of everything after the header
+};
+
+// State that kernels keep outside the arena, for example in a static of
+// their resolver, its size has to be a multiple of 4
+struct StateRegion {
+  void* data;
+  size_t bytes;
+};
+
+// Writes bytes at offset from the start of saved state, false on error
+typedef bool (*StateWriteFn)(void* context, size_t offset, const void* data,
+                             size_t bytes);
+}  // namespace engine_internal
+
+// Graph of a MicroInterpreter as an array of (eval function, node) pairs.
+//
+// MicroInterpreter::Invoke() looks up node and registration of each
+// operator, checks its invoke pointer, opens a profiler scope, resets temp
+// allocations and reports errors by operator name. For a model of a few
+// small layers, like the sine model of hello_world, that is a visible
+// part of the inference. Build() does the lookups once after
+// AllocateTensors(), Invoke() is a loop of indirect calls over an array
+// of 8 byte entries that points at the nodes of the interpreter.
+//
+// Usage example:
+// static FrozenGraph<16> frozen;
+// interpreter.AllocateTensors();
+// if (!frozen.Build(&interpreter)) return;
+// frozen.Invoke();
+//
+// Profiler is not called, measure operators with Invoke() of the
+// interpreter. Same as InvokeStep(), temp allocations are not reset, so
+// kernels have to use eval tensors in Eval, which all of TFLM do. Build
+// again after AllocateTensors() of another model or interpreter.
+template <size_t kMaxOps>
+class FrozenGraph {
+ public:
+  typedef TfLiteStatus (*InvokeFunction)(TfLiteContext*, TfLiteNode*);
+
+  // Returns false if graph has more than kMaxOps operators with Eval,
+  // the graph is empty then
+  bool Build(tflite::MicroInterpreter* interpreter) {
+    Clear();
+    if (interpreter == nullptr) {
+      return false;
+    }
+
+    tflite::NodeAndRegistration* nodes =
+        interpreter->*Member(engine_internal::InterpreterNodes());
+    size_t ops = interpreter->operators_size();
+    for (size_t i = 0; i < ops; i++) {
+      if (nodes[i].registration->invoke == nullptr) {
+        continue;
+      }
+      if (num_ops_ == kMaxOps) {
+        Clear();
+        return false;
+      }
+      ops_[num_ops_].invoke = nodes[i].registration->invoke;
+      ops_[num_ops_].node = &nodes[i].node;
+      num_ops_++;
+    }
+    context_ = &(interpreter->*Member(engine_internal::InterpreterContext()));
+    return true;
+  }
+
+  void Clear() {
+    num_ops_ = 0;
+    context_ = nullptr;
+  }
+
+  // Runs all operators, stops at the first that fails and returns its
+  // status, failed_op() tells which one
+  TfLiteStatus Invoke() {
+    for (size_t i = 0; i < num_ops_; i++) {
+      TfLiteStatus status = ops_[i].invoke(context_, ops_[i].node);
+      if (status != kTfLiteOk) {
+        failed_op_ = i;
+        return status;
+      }
+    }
+    return kTfLiteOk;
+  }
+
+  bool built() const { return context_ != nullptr; }
+  size_t num_ops() const { return num_ops_; }
+  // Index into the frozen array, operators without Eval are skipped
+  size_t failed_op() const { return failed_op_; }
+
+ private:
+  struct Op {
+    InvokeFunction invoke;
+    TfLiteNode* node;
+  };
+
+  Op ops_[kMaxOps];
+  size_t num_ops_ = 0;
+  size_t failed_op_ = 0;
+  TfLiteContext* context_ = nullptr;
+};
+
+template <size_t kArenaSize, typename... Ops>
+class InferenceEngine {
+ public:
+  typedef tflite::MicroMutableOpResolver<sizeof...(Ops)> Resolver;
+
+  InferenceEngine() {}
+
+  // Resolver that interpreter will use instead of the engine one, for
+  // example a wrapper that replaces some kernels. Call it before Setup().
+  void SetResolver(const tflite::MicroOpResolver* resolver) {
+    override_resolver_ = resolver;
+  }
+
+  // Loads model, registers operators and allocates tensors.
+  // Returns false and reports the reason if any step fails.
+  bool Setup(const void* model_data, tflite::ErrorReporter* reporter,
+             tflite::Profiler* profiler = nullptr) {
+    if (kArenaSize == 0) {
+      TF_LITE_REPORT_ERROR(reporter, "Engine without arena needs allocator");
+      return false;
+    }
+    // Allocator is created at the end of the arena
+    if (arena_lent()) {
+      TF_LITE_REPORT_ERROR(reporter, "Arena is lent to the application");
+      return false;
+    }
+#ifdef ARENA_REPORT
+    tflite::MicroAllocator* allocator =
+        arena_allocator(arena_, kArenaSize, reporter);
+    const tflite::SimpleMemoryAllocator* memory =
+        static_cast<tflite::RecordingMicroAllocator*>(allocator)
+            ->GetSimpleMemoryAllocator();
+#else
+    // Same as arena_allocator(), but tail size stays known for the checksum
+    tflite::SimpleMemoryAllocator* memory =
+        tflite::SimpleMemoryAllocator::Create(reporter, arena_, kArenaSize);
+    tflite::MicroAllocator* allocator =
+        tflite::MicroAllocator::Create(memory, reporter);
+#endif
+    bool ok = Setup(model_data, allocator, reporter, profiler);
+    memory_ = memory;
+    return ok;
+  }
+
+  // Same as above over allocator of external arena, for example from
+  // SharedArena::Allocator()
+  bool Setup(const void* model_data, tflite::MicroAllocator* allocator,
+             tflite::ErrorReporter* reporter,
+             tflite::Profiler* profiler = nullptr) {
+    if (arena_lent()) {
+      TF_LITE_REPORT_ERROR(reporter, "Arena is lent to the application");
+      return false;
+    }
+    Teardown();
+    reporter_ = reporter;
+    profiler_ = profiler;
+    memory_ = nullptr;
+
+    model_ = tflite::GetModel(model_data);
+    if (model_->version() != TFLITE_SCHEMA_VERSION) {
+      TF_LITE_REPORT_ERROR(reporter_,
+          "Model provided is schema version %d not equal to supported "
+          "version %d.", model_->version(), TFLITE_SCHEMA_VERSION);
+      return false;
+    }
+
+    // Resolver keeps registrations over reloads, adding them again fails
+    if (!ops_registered_) {
+      if (engine_internal::AddOps<Resolver, Ops...>(resolver_) != kTfLiteOk) {
+        TF_LITE_REPORT_ERROR(reporter_, "Registering operators failed");
+        return false;
+      }
+      ops_registered_ = true;
+    }
+
+    if (allocator == nullptr) {
+      return false;
+    }
+
+    // Interpreter can only be created once model is known
+    const tflite::MicroOpResolver& resolver =
+        override_resolver_ ? *override_resolver_ : resolver_;
+
+    interpreter_ = new (interpreter_buffer_) tflite::MicroInterpreter(
+        model_, resolver, allocator, reporter_, profiler);
+
+    if (interpreter_->AllocateTensors() != kTfLiteOk) {
+      TF_LITE_REPORT_ERROR(reporter_, "AllocateTensors() failed");
+      Teardown();
+      return false;
+    }
+    // Shared arena reports its slots itself
+    if (kArenaSize > 0) {
+      arena_report(reporter_, model_, allocator);
+    }
+
+    return true;
+  }
+
+  // Replaces model, keeps reporter and profiler from Setup(). Tensors of
+  // the previous model are gone afterwards, fetch input() and output()
+  // again. On failure engine has no model until next successful call.
+  bool Reload(const void* model_data) {
+    return Setup(model_data, reporter_, profiler_);
+  }
+
+  // Checksum of the interpreter object and of the persistent tail of the
+  // arena: tensor structs, node data and offsets of the memory plan.
+  // Activations in the head change with every Invoke() and are left out,
+  // engines over a shared arena only cover the interpreter object, add
+  // SharedArena::TailChecksum(). Returns seed if there is no model.
+  uint32_t StateChecksum(uint32_t hash = engine_internal::kChecksumSeed) const {
+    if (interpreter_ == nullptr) {
+      return hash;
+    }
+    hash = engine_internal::Checksum(interpreter_buffer_,
+                                     sizeof(interpreter_buffer_), hash);
+    if (memory_ != nullptr) {
+      size_t tail = memory_->GetTailUsedBytes();
+      hash = engine_internal::Checksum(arena_ + kArenaSize - tail, tail, hash);
+    }
+    return hash;
+  }
+
+  // Bytes that SaveState() writes, 0 if the state can not be saved: no
+  // model, inference in progress, engine over a shared arena, custom
+  // operators or more than kMaxStateCodes operator codes
+  size_t StateSize(const engine_internal::StateRegion* regions = nullptr,
+                   size_t num_regions = 0) const {
+    engine_internal::StateHeader header;
+    if (!StateHeaderOf(&header, 0, regions, num_regions)) {
+      return 0;
+    }
+    return sizeof(header) + header.prefix_size + header.tail_size +
+           header.regions_size;
+  }
+
+  // Writes what Setup() built, so RestoreState() on a later boot of the
+  // same firmware can skip AllocateTensors(). That is the engine object
+  // up to its arena, with interpreter, resolver and bound inputs, the
+  // persistent tail of the arena with tensors, node data and memory plan,
+  // and the regions, with the same pointers they have now. build_id has
+  // to change with anything that moves code or data, for example CRC of
+  // the firmware image, and with the model if it is not part of it.
+  bool SaveState(engine_internal::StateWriteFn write, void* context,
+                 uint32_t build_id,
+                 const engine_internal::StateRegion* regions = nullptr,
+                 size_t num_regions = 0) const {
+    engine_internal::StateHeader header;
+    if (!StateHeaderOf(&header, build_id, regions, num_regions)) {
+      TF_LITE_REPORT_ERROR(reporter_, "Engine state can not be saved");
+      return false;
+    }
+
+    size_t offset = sizeof(header);
+    bool ok = write(context, offset, this, header.prefix_size);
+    offset += header.prefix_size;
+    ok = ok && write(context, offset, arena_ + kArenaSize - header.tail_size,
+                     header.tail_size);
+    offset += header.tail_size;
+    for (size_t i = 0; ok && i < num_regions; i++) {
+      ok = write(context, offset, regions[i].data, regions[i].bytes);
+      offset += regions[i].bytes;
+    }
+    return ok && write(context, 0, &header, sizeof(header));
+  }
+
+  // Takes state of SaveState() instead of Setup(), for example from
+  // memory mapped flash. Returns false, and leaves the engine without a
+  // model, if state is missing or damaged or does not belong to this
+  // engine, model, build_id and regions. Reporter, profiler and resolver
+  // of the saved state are used, they have to be static objects that
+  // exist at this point. Resolvers that wrap kernels fill their copies
+  // of registrations in FindOp(), so it is called again for every saved
+  // operator code.
+  bool RestoreState(const void* state, const void* model_data,
+                    uint32_t build_id,
+                    const engine_internal::StateRegion* regions = nullptr,
+                    size_t num_regions = 0) {
+    const engine_internal::StateHeader* header =
+        static_cast<const engine_internal::StateHeader*>(state);
+    size_t regions_size = 0;
+    for (size_t i = 0; i < num_regions; i++) {
+      regions_size += regions[i].bytes;
+    }
+    if (arena_lent() || header == nullptr ||
+        header->magic != engine_internal::kStateMagic ||
+        header->build_id != build_id ||
+        header->engine_address != Address(this) ||
+        header->engine_size != sizeof(*this) ||
+        header->model_address != Address(tflite::GetModel(model_data)) ||
+        header->prefix_size != PrefixSize() ||
+        header->tail_size > kArenaSize || header->tail_size % 4 != 0 ||
+        header->regions_size != regions_size ||
+        header->num_codes > engine_internal::kMaxStateCodes) {
+      return false;
+    }
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(header + 1);
+    size_t bytes = header->prefix_size + header->tail_size + regions_size;
+    if (engine_internal::Checksum(data, bytes,
+                                  engine_internal::kChecksumSeed) !=
+        header->checksum) {
+      return false;
+    }
+
+    Teardown();
+    memcpy(static_cast<void*>(this), data, header->prefix_size);
+    data += header->prefix_size;
+    memcpy(arena_ + kArenaSize - header->tail_size, data, header->tail_size);
+    data += header->tail_size;
+    for (size_t i = 0; i < num_regions; i++) {
+      memcpy(regions[i].data, data, regions[i].bytes);
+      data += regions[i].bytes;
+    }
+
+    const tflite::MicroOpResolver& resolver =
+        override_resolver_ ? *override_resolver_ : resolver_;
+    for (size_t i = 0; i < header->num_codes; i++) {
+      if (resolver.FindOp(static_cast<tflite::BuiltinOperator>(
+              header->codes[i])) == nullptr) {
+        interpreter_ = nullptr;
+        Teardown();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Destroys interpreter, arena can be reused afterwards
+  void Teardown() {
+    InvokeCancel();
+    frozen_.Clear();
+    for (size_t i = 0; i < kMaxBoundInputs; i++) {
+      arena_inputs_[i] = nullptr;
+    }
+    if (interpreter_ != nullptr) {
+      interpreter_->~MicroInterpreter();
+      interpreter_ = nullptr;
+    }
+  }
+
+  bool Invoke() {
+    // Inference that was run step-wise holds the arena, it is dropped
+    if (interpreter_ == nullptr || (next_op_ == 0 && !ClaimArena())) {
+      return false;
+    }
+    next_op_ = 0;
+
+    TfLiteStatus status = interpreter_->Invoke();
+    ReleaseArena();
+    if (status != kTfLiteOk) {
+      TF_LITE_REPORT_ERROR(reporter_, "Invoke failed");
+      return false;
+    }
+    return true;
+  }
+
+  // Builds the frozen graph of the loaded model, call it again after
+  // Setup() or Reload(). Returns false if the model has more operators
+  // than kMaxFrozenOps, InvokeFrozen() then runs Invoke().
+  bool Freeze() {
+    if (interpreter_ == nullptr || !frozen_.Build(interpreter_)) {
+      TF_LITE_REPORT_ERROR(reporter_, "Graph can not be frozen");
+      return false;
+    }
+    return true;
+  }
+
+  // Invoke() without the per operator work of the interpreter, profiler
+  // is not called. Inference that was run step-wise is dropped.
+  bool InvokeFrozen() {
+    if (!frozen_.built()) {
+      return Invoke();
+    }
+    if (next_op_ == 0 && !ClaimArena()) {
+      return false;
+    }
+    next_op_ = 0;
+
+    TfLiteStatus status = frozen_.Invoke();
+    ReleaseArena();
+    if (status != kTfLiteOk) {
+      TF_LITE_REPORT_ERROR(reporter_, "Frozen step %d failed",
+                           static_cast<int>(frozen_.failed_op()));
+      return false;
+    }
+    return true;
+  }
+
+  // Runs next max_ops operators of the inference, first call starts it.
+  // On error inference is dropped and next call starts from the first
+  // operator again.
+  bool InvokeStep(size_t max_ops = 1) {
+    // Arena is claimed by the first step and released after the last one
+    if (interpreter_ == nullptr || (next_op_ == 0 && !ClaimArena())) {
+      return false;
+    }
+
+    TfLiteContext* context =
+        &(interpreter_->*Member(engine_internal::InterpreterContext()));
+    // node_and_registration() returns a copy, kernels get the node of the
+    // interpreter itself, as in MicroInterpreter::Invoke()
+    tflite::NodeAndRegistration* nodes =
+        interpreter_->*Member(engine_internal::InterpreterNodes());
+    size_t ops = interpreter_->operators_size();
+    for (size_t end = next_op_ + max_ops; next_op_ < ops && next_op_ < end;
+         next_op_++) {
+      tflite::NodeAndRegistration& op = nodes[next_op_];
+      if (op.registration->invoke == nullptr) {
+        continue;
+      }
+
+      uint32_t event = 0;
+      if (profiler_ != nullptr) {
+        event = profiler_->BeginEvent(
+            OpName(op.registration),
+            tflite::Profiler::EventType::OPERATOR_INVOKE_EVENT,
+            static_cast<int64_t>(next_op_), 0);
+      }
+      TfLiteStatus status = op.registration->invoke(context, &op.node);
+      if (profiler_ != nullptr) {
+        profiler_->EndEvent(event);
+      }
+
+      if (status != kTfLiteOk) {
+        TF_LITE_REPORT_ERROR(reporter_, "Step %d failed",
+                             static_cast<int>(next_op_));
+        InvokeCancel();
+        return false;
+      }
+    }
+
+    // Also when max_ops was 0 and nothing has started
+    if (next_op_ >= ops || next_op_ == 0) {
+      next_op_ = 0;
+      ReleaseArena();
+    }
+    return true;
+  }
+
+  // True from the first InvokeStep() of an inference until its last one
+  bool InvokeInProgress() const { return next_op_ > 0; }
+
+  // Drops inference that was run step-wise, for example after an early
+  // exit, next InvokeStep() starts from the first operator
+  void InvokeCancel() {
+    if (next_op_ > 0) {
+      next_op_ = 0;
+      ReleaseArena();
+    }
+  }
+
+  // Operators of the graph, for choosing max_ops of InvokeStep()
+  size_t OperatorCount() const {
+    return interpreter_ ? interpreter_->operators_size() : 0;
+  }
+
+  // Points input tensor at data, which holds exactly input(index)->bytes
+  // and stays valid while bound. Kernels read graph inputs through their
+  // eval tensor, so it is changed too. Returns false if the interpreter
+  // can not use the buffer: the tensor is written by the graph, because it
+  // is also an output, or an inference is in progress.
+  bool BindInput(const void* data, size_t index = 0) {
+    if (interpreter_ == nullptr || index >= kMaxBoundInputs ||
+        next_op_ > 0) {
+      return false;
+    }
+    const tflite::SubGraph* graph = model_->subgraphs()->Get(0);
+    if (index >= graph->inputs()->size()) {
+      return false;
+    }
+    int32_t tensor_index = graph->inputs()->Get(index);
+    for (uint32_t i = 0; i < graph->outputs()->size(); i++) {
+      if (graph->outputs()->Get(i) == tensor_index) {
+        return false;
+      }
+    }
+
+    TfLiteContext* context =
+        &(interpreter_->*Member(engine_internal::InterpreterContext()));
+    TfLiteEvalTensor* eval = context->GetEvalTensor(context, tensor_index);
+    TfLiteTensor* tensor = input(index);
+    if (arena_inputs_[index] == nullptr) {
+      arena_inputs_[index] = tensor->data.raw;
+    }
+    // Kernels take const input, the buffer itself is never written
+    eval->data.raw = static_cast<char*>(const_cast<void*>(data));
+    tensor->data.raw = eval->data.raw;
+    return true;
+  }
+
+  // Gives input tensor its arena buffer back, contents are undefined
+  void UnbindInput(size_t index = 0) {
+    if (interpreter_ == nullptr || index >= kMaxBoundInputs ||
+        arena_inputs_[index] == nullptr) {
+      return;
+    }
+    TfLiteContext* context =
+        &(interpreter_->*Member(engine_internal::InterpreterContext()));
+    int32_t tensor_index = model_->subgraphs()->Get(0)->inputs()->Get(index);
+    context->GetEvalTensor(context, tensor_index)->data.raw =
+        arena_inputs_[index];
+    input(index)->data.raw = arena_inputs_[index];
+    arena_inputs_[index] = nullptr;
+  }
+
+  // Binds data to input tensor, copies it into the arena if it can not be
+  // bound. Returns false if bytes is not the size of the tensor.
+  bool LoadInput(const void* data, size_t bytes, size_t index = 0) {
+    if (interpreter_ == nullptr || index >= interpreter_->inputs_size() ||
+        bytes != input(index)->bytes) {
+      return false;
+    }
+    if (BindInput(data, index)) {
+      return true;
+    }
+    UnbindInput(index);
+    if (arena_lent()) {
+      return false;
+    }
+    // Word copy of newlib, arena buffers are 16 byte aligned
+    memcpy(input(index)->data.raw, data, bytes);
+    return true;
+  }
+
+  // Prints used arena and shape and type of input and output tensors
+  void PrintInfo() {
+    if (interpreter_ == nullptr) {
+      return;
+    }
+
+    TF_LITE_REPORT_ERROR(reporter_, "Arena used:       %d / %d bytes",
+                         interpreter_->arena_used_bytes(),
+                         static_cast<int>(kArenaSize));
+    if (kArenaSize == 0) {
+      TF_LITE_REPORT_ERROR(reporter_, "Arena is shared with other models");
+    }
+    PrintTensor("Input", input());
+    PrintTensor("Output", output());
+  }
+
+  // Returns the arena up to its persistent tail and its size in bytes, or
+  // nullptr if there is no model, an inference is in progress, the arena
+  // is lent already or shared. Input and output tensors are overwritten.
+  uint8_t* BorrowArena(size_t* bytes) {
+    *bytes = 0;
+    if (interpreter_ == nullptr || memory_ == nullptr) {
+      return nullptr;
+    }
+    uint32_t expected = kArenaFree;
+    if (!__atomic_compare_exchange_n(&arena_state_, &expected, kArenaLent,
+                                     false, __ATOMIC_ACQUIRE,
+                                     __ATOMIC_RELAXED)) {
+      return nullptr;
+    }
+    // Tail starts on the alignment of its first allocation
+    *bytes = (kArenaSize - memory_->GetTailUsedBytes()) &
+             ~static_cast<size_t>(15);
+    return arena_;
+  }
+
+  // Ends BorrowArena(), buffer must not be used afterwards
+  void ReturnArena() {
+    if (arena_lent()) {
+      __atomic_store_n(&arena_state_, kArenaFree, __ATOMIC_RELEASE);
+    }
+  }
+
+  bool arena_lent() const {
+    return __atomic_load_n(&arena_state_, __ATOMIC_ACQUIRE) == kArenaLent;
+  }
+
+  TfLiteTensor* input(size_t index = 0) {
+    return interpreter_->input(index);
+  }
+
+  TfLiteTensor* output(size_t index = 0) {
+    return interpreter_->output(index);
+  }
+
+  const Resolver& resolver() const { return resolver_; }
+  const tflite::Model* model() const { return model_; }
+  tflite::MicroInterpreter* interpreter() { return interpreter_; }
+  uint8_t* arena() { return arena_; }
+
+ private:
+  // Tag of the profiler, as MicroInterpreter::Invoke() reports it
+  static const char* OpName(const TfLiteRegistration* registration) {
+    if (registration->builtin_code == tflite::BuiltinOperator_CUSTOM) {
+      return registration->custom_name;
+    }
+    return tflite::EnumNameBuiltinOperator(
+        static_cast<tflite::BuiltinOperator>(registration->builtin_code));
+  }
+
+  void PrintTensor(const char* title, const TfLiteTensor* tensor) {
+    TF_LITE_REPORT_ERROR(reporter_, "\n%s:", title);
+    TF_LITE_REPORT_ERROR(reporter_, "Type:             %d", tensor->type);
+    TF_LITE_REPORT_ERROR(reporter_, "Bytes:            %d", tensor->bytes);
+    for (int i = 0; i < tensor->dims->size; i++) {
+      TF_LITE_REPORT_ERROR(reporter_, "Dimension %d:      %d", i,
+                           tensor->dims->data[i]);
+    }
+    TF_LITE_REPORT_ERROR(reporter_, "Scale:            %f",
+                         tensor->params.scale);
+    TF_LITE_REPORT_ERROR(reporter_, "Zero point:       %d",
+                         tensor->params.zero_point);
+  }
+
+  // Saved state is only for 32 bit targets
+  static uint32_t Address(const void* pointer) {
+    return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(pointer));
+  }
+
+  // Engine object bytes before the arena, SaveState() keeps them
+  size_t PrefixSize() const {
+    return static_cast<size_t>(reinterpret_cast<const uint8_t*>(arena_) -
+                               reinterpret_cast<const uint8_t*>(this));
+  }
+
+  // Claims arena for an inference, false if it is lent
+  bool ClaimArena() {
+    uint32_t expected = kArenaFree;
+    if (__atomic_compare_exchange_n(&arena_state_, &expected, kArenaInvoking,
+                                    false, __ATOMIC_ACQUIRE,
+                                    __ATOMIC_RELAXED)) {
+      return true;
+    }
+    TF_LITE_REPORT_ERROR(reporter_, "Arena is lent to the application");
+    return false;
+  }
+
+  void ReleaseArena() {
+    __atomic_store_n(&arena_state_, kArenaFree, __ATOMIC_RELEASE);
+  }
+
+  bool StateHeaderOf(engine_internal::StateHeader* header, uint32_t build_id,
+                     const engine_internal::StateRegion* regions,
+                     size_t num_regions) const {
+    // Saved engine object must have the arena free
+    if (interpreter_ == nullptr || memory_ == nullptr || next_op_ > 0 ||
+        arena_state_ != kArenaFree) {
+      return false;
+    }
+    memset(header, 0, sizeof(*header));
+    header->magic = engine_internal::kStateMagic;
+    header->build_id = build_id;
+    header->engine_address = Address(this);
+    header->engine_size = sizeof(*this);
+    header->model_address = Address(model_);
+    header->prefix_size = PrefixSize();
+    // Tail starts on the alignment of its first allocation, a few bytes
+    // of the head more do not matter
+    header->tail_size = (memory_->GetTailUsedBytes() + 3) & ~3u;
+    if (header->tail_size > kArenaSize) {
+      return false;
+    }
+
+    const tflite::NodeAndRegistration* nodes =
+        interpreter_->*Member(engine_internal::InterpreterNodes());
+    for (size_t i = 0; i < interpreter_->operators_size(); i++) {
+      const int32_t code = nodes[i].registration->builtin_code;
+      if (code == tflite::BuiltinOperator_CUSTOM) {
+        return false;
+      }
+      size_t j = 0;
+      while (j < header->num_codes && header->codes[j] != code) {
+        j++;
+      }
+      if (j == header->num_codes) {
+        if (j == engine_internal::kMaxStateCodes) {
+          return false;
+        }
+        header->codes[header->num_codes++] = code;
+      }
+    }
+
+    uint32_t hash = engine_internal::Checksum(this, header->prefix_size,
+                                              engine_internal::kChecksumSeed);
+    hash = engine_internal::Checksum(arena_ + kArenaSize - header->tail_size,
+                                     header->tail_size, hash);
+    for (size_t i = 0; i < num_regions; i++) {
+      if (regions[i].bytes % 4 != 0) {
+        return false;
+      }
+      hash = engine_internal::Checksum(regions[i].data, regions[i].bytes,
+                                       hash);
+      header->regions_size += regions[i].bytes;
+    }
+    header->checksum = hash;
+    return true;
+  }
+
+  tflite::ErrorReporter* reporter_ = nullptr;
+  tflite::Profiler* profiler_ = nullptr;
+  bool ops_registered_ = false;
+  const tflite::Model* model_ = nullptr;
+  tflite::MicroInterpreter* interpreter_ = nullptr;
+  // Allocator of the own arena, nullptr over a shared one
+  const tflite::SimpleMemoryAllocator* memory_ = nullptr;
+  Resolver resolver_;
+  const tflite::MicroOpResolver* override_resolver_ = nullptr;
+  // Next operator of InvokeStep(), 0 when no inference is in progress
+  size_t next_op_ = 0;
+  // Owner of the arena below its tail, see BorrowArena()
+  enum : uint32_t { kArenaFree, kArenaInvoking, kArenaLent };
+  volatile uint32_t arena_state_ = kArenaFree;
+  // Arena buffers of inputs bound with BindInput(), nullptr if not bound
+  static const size_t kMaxBoundInputs = 4;
+  char* arena_inputs_[kMaxBoundInputs] = {};
+  // Kernel calls of Freeze(), 256 bytes
+  static const size_t kMaxFrozenOps = 32;
+  FrozenGraph<kMaxFrozenOps> frozen_;
+
+  alignas(tflite::MicroInterpreter)
+      uint8_t interpreter_buffer_[sizeof(tflite::MicroInterpreter)];
+  alignas(16) uint8_t arena_[kArenaSize > 0 ? kArenaSize : 1];
+};
+
+#endif  // INFERENCE_ENGINE_H
@@ -0,0 +1,452 @@
+#ifndef INT16_KERNELS_H
+#define INT16_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "tensorflow/lite/c/builtin_op_data.h"
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/kernels/internal/common.h"
+#include "tensorflow/lite/kernels/internal/quantization_util.h"
+#include "tensorflow/lite/kernels/kernel_util.h"
+#include "tensorflow/lite/kernels/padding.h"
+#include "tensorflow/lite/micro/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/micro_op_resolver.h"
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#include "cmsis_gcc.h"
+#define INT16_KERNELS_SIMD
+#endif
+
+// Conv2D, FullyConnected, Add and Mul with int16 activations and int8
+// weights, the 16x8 quantization of the TFLite converter.
+//
+// Radiometric thermal frames lose precision when squeezed into int8,
+// float kernels keep it but are several times slower. 16x8 models keep
+// 16 bit activations with the same int8 weights. Activations have zero
+// point 0, bias is int64 and accumulators are 64 bit, rounding follows
+// the reference kernels of TFLite.
+//
+// Dot products take 4 weights at a time: SXTB16 extends them to two
+// pairs, PKHBT and PKHTB pair up matching inputs, two SMLALD instructions
+// accumulate. Original kernels of this TFLite version either lack int16
+// or run the plain reference loops.
+//
+// Resolver wraps the project resolver, nodes with int16 input run these
+// kernels, the rest run the original ones. Add and Mul need inputs of
+// equal shape.
+//
+// Usage example:
+// static Int16KernelResolver int16_resolver(engine.resolver());
+// engine.SetResolver(&int16_resolver);
+// engine.Setup(model_data, error_reporter);
+
+class Int16KernelResolver : public tflite::MicroOpResolver {
+ public:
+  explicit Int16KernelResolver(const tflite::MicroOpResolver& base)
+      : base_(base) {}
+
+  const TfLiteRegistration* FindOp(tflite::BuiltinOperator op) const override {
+    const TfLiteRegistration* registration = base_.FindOp(op);
+    if (registration == nullptr) {
+      return nullptr;
+    }
+
+    switch (op) {
+      case tflite::BuiltinOperator_CONV_2D:
+        return Wrap<kConv>(registration);
+      case tflite::BuiltinOperator_FULLY_CONNECTED:
+        return Wrap<kFullyConnected>(registration);
+      case tflite::BuiltinOperator_ADD:
+        return Wrap<kAdd>(registration);
+      case tflite::BuiltinOperator_MUL:
+        return Wrap<kMul>(registration);
+      default:
+        return registration;
+    }
+  }
+
+  const TfLiteRegistration* FindOp(const char* op) const override {
+    return base_.FindOp(op);
+  }
+
+  BuiltinParseFunction GetOpDataParser(
+      tflite::BuiltinOperator op) const override {
+    return base_.GetOpDataParser(op);
+  }
+
+ private:
+  enum { kConv, kFullyConnected, kAdd, kMul, kSlots };
+
+  struct OpData {
+    void* generic_data;
+    bool int16;             // Node runs kernels below
+    int32_t activation_min;
+    int32_t activation_max;
+    int32_t multiplier;     // Output, all but per channel Conv2D
+    int shift;
+    int32_t* channel_multiplier;
+    int32_t* channel_shift;
+    TfLitePaddingValues padding;
+    int32_t input1_multiplier;  // Add only
+    int input1_shift;
+    int32_t input2_multiplier;
+    int input2_shift;
+  };
+
+  template <int kSlot>
+  const TfLiteRegistration* Wrap(const TfLiteRegistration* registration) const {
+    // Keep builtin code and version, so profiler still reports them
+    Generic<kSlot>() = registration;
+    registrations_[kSlot] = *registration;
+    registrations_[kSlot].init = Init<kSlot>;
+    registrations_[kSlot].free = nullptr;
+    registrations_[kSlot].prepare = Prepare<kSlot>;
+    registrations_[kSlot].invoke = Eval<kSlot>;
+    return &registrations_[kSlot];
+  }
+
+  template <int kSlot>
+  static void* Init(TfLiteContext* context, const char* buffer,
+                    size_t length) {
+    OpData* data = static_cast<OpData*>(
+        context->AllocatePersistentBuffer(context, sizeof(OpData)));
+    if (data == nullptr) {
+      return nullptr;
+    }
+    data->generic_data = Generic<kSlot>()->init
+                             ? Generic<kSlot>()->init(context, buffer, length)
+                             : nullptr;
+    data->int16 = false;
+    return data;
+  }
+
+  template <int kSlot>
+  static TfLiteStatus Prepare(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+    const TfLiteTensor* input = tflite::GetInput(context, node, 0);
+
+    data->int16 = input->type == kTfLiteInt16;
+    if (!data->int16) {
+      node->user_data = data->generic_data;
+      TfLiteStatus status = Generic<kSlot>()->prepare
+                                ? Generic<kSlot>()->prepare(context, node)
+                                : kTfLiteOk;
+      node->user_data = data;
+      return status;
+    }
+
+    const TfLiteTensor* other = tflite::GetInput(context, node, 1);
+    TfLiteTensor* output = tflite::GetOutput(context, node, 0);
+    TF_LITE_ENSURE_EQ(context, input->params.zero_point, 0);
+    TF_LITE_ENSURE_EQ(context, output->type, kTfLiteInt16);
+    TF_LITE_ENSURE_EQ(context, output->params.zero_point, 0);
+
+    if (kSlot == kConv || kSlot == kFullyConnected) {
+      TF_LITE_ENSURE_EQ(context, other->type, kTfLiteInt8);
+      const TfLiteTensor* bias =
+          tflite::GetOptionalInputTensor(context, node, 2);
+      TF_LITE_ENSURE(context, bias == nullptr || bias->type == kTfLiteInt64);
+    } else {
+      TF_LITE_ENSURE_EQ(context, other->type, kTfLiteInt16);
+      TF_LITE_ENSURE_EQ(context, other->params.zero_point, 0);
+      TF_LITE_ENSURE_EQ(context, tflite::NumElements(input),
+                        tflite::NumElements(other));
+      TF_LITE_ENSURE_EQ(context, tflite::NumElements(input),
+                        tflite::NumElements(output));
+    }
+
+    switch (kSlot) {
+      case kConv:
+        return PrepareConv(context, node, data);
+      case kFullyConnected:
+        return PrepareFullyConnected(context, node, data);
+      default:
+        return PrepareElementwise(context, node, data, kSlot == kAdd);
+    }
+  }
+
+  static TfLiteStatus PrepareConv(TfLiteContext* context, TfLiteNode* node,
+                                  OpData* data) {
+    const TfLiteTensor* input = tflite::GetInput(context, node, 0);
+    const TfLiteTensor* filter = tflite::GetInput(context, node, 1);
+    const TfLiteTensor* bias = tflite::GetOptionalInputTensor(context, node, 2);
+    TfLiteTensor* output = tflite::GetOutput(context, node, 0);
+    const TfLiteConvParams* params =
+        static_cast<const TfLiteConvParams*>(node->builtin_data);
+    TF_LITE_ENSURE_EQ(context, filter->quantization.type,
+                      kTfLiteAffineQuantization);
+
+    int unused_height;
+    int unused_width;
+    data->padding = tflite::ComputePaddingHeightWidth(
+        params->stride_height, params->stride_width,
+        params->dilation_height_factor, params->dilation_width_factor,
+        input->dims->data[1], input->dims->data[2], filter->dims->data[1],
+        filter->dims->data[2], params->padding, &unused_height, &unused_width);
+
+    const int channels = filter->dims->data[0];
+    data->channel_multiplier = static_cast<int32_t*>(
+        context->AllocatePersistentBuffer(context, channels * sizeof(int32_t)));
+    data->channel_shift = static_cast<int32_t*>(
+        context->AllocatePersistentBuffer(context, channels * sizeof(int32_t)));
+    if (data->channel_multiplier == nullptr || data->channel_shift == nullptr) {
+      return kTfLiteError;
+    }
+
+    return tflite::PopulateConvolutionQuantizationParams(
+        context, input, filter, bias, output, params->activation,
+        &data->multiplier, &data->shift, &data->activation_min,
+        &data->activation_max, data->channel_multiplier,
+        reinterpret_cast<int*>(data->channel_shift), channels);
+  }
+
+  static TfLiteStatus PrepareFullyConnected(TfLiteContext* context,
+                                            TfLiteNode* node, OpData* data) {
+    const TfLiteTensor* input = tflite::GetInput(context, node, 0);
+    const TfLiteTensor* filter = tflite::GetInput(context, node, 1);
+    const TfLiteTensor* bias = tflite::GetOptionalInputTensor(context, node, 2);
+    TfLiteTensor* output = tflite::GetOutput(context, node, 0);
+    const TfLiteFullyConnectedParams* params =
+        static_cast<const TfLiteFullyConnectedParams*>(node->builtin_data);
+    TF_LITE_ENSURE_EQ(context, filter->params.zero_point, 0);
+
+    double real_multiplier = 0.0;
+    TF_LITE_ENSURE_STATUS(tflite::GetQuantizedConvolutionMultipler(
+        context, input, filter, bias, output, &real_multiplier));
+    tflite::QuantizeMultiplier(real_multiplier, &data->multiplier,
+                               &data->shift);
+    return tflite::CalculateActivationRangeQuantized(
+        context, params->activation, output, &data->activation_min,
+        &data->activation_max);
+  }
+
+  static TfLiteStatus PrepareElementwise(TfLiteContext* context,
+                                         TfLiteNode* node, OpData* data,
+                                         bool add) {
+    const TfLiteTensor* input1 = tflite::GetInput(context, node, 0);
+    const TfLiteTensor* input2 = tflite::GetInput(context, node, 1);
+    TfLiteTensor* output = tflite::GetOutput(context, node, 0);
+    const double scale1 = input1->params.scale;
+    const double scale2 = input2->params.scale;
+    const double scale_out = output->params.scale;
+
+    TfLiteFusedActivation activation;
+    if (add) {
+      // Inputs are brought to twice the larger scale with 15 bits of
+      // headroom, the same as reference int16 Add
+      activation =
+          static_cast<const TfLiteAddParams*>(node->builtin_data)->activation;
+      const double twice_max = 2 * (scale1 > scale2 ? scale1 : scale2);
+      tflite::QuantizeMultiplierSmallerThanOneExp(
+          scale1 / twice_max, &data->input1_multiplier, &data->input1_shift);
+      tflite::QuantizeMultiplierSmallerThanOneExp(
+          scale2 / twice_max, &data->input2_multiplier, &data->input2_shift);
+      tflite::QuantizeMultiplierSmallerThanOneExp(
+          twice_max / ((1 << 15) * scale_out), &data->multiplier,
+          &data->shift);
+    } else {
+      activation =
+          static_cast<const TfLiteMulParams*>(node->builtin_data)->activation;
+      tflite::QuantizeMultiplier(scale1 * scale2 / scale_out,
+                                 &data->multiplier, &data->shift);
+    }
+    return tflite::CalculateActivationRangeQuantized(
+        context, activation, output, &data->activation_min,
+        &data->activation_max);
+  }
+
+  template <int kSlot>
+  static TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+
+    if (!data->int16) {
+      node->user_data = data->generic_data;
+      TfLiteStatus status = Generic<kSlot>()->invoke(context, node);
+      node->user_data = data;
+      return status;
+    }
+
+    switch (kSlot) {
+      case kConv:
+        return EvalConv(context, node, data);
+      case kFullyConnected:
+        return EvalFullyConnected(context, node, data);
+      default:
+        return EvalElementwise(context, node, data, kSlot == kAdd);
+    }
+  }
+
+  static TfLiteStatus EvalConv(TfLiteContext* context, TfLiteNode* node,
+                               const OpData* data) {
+    const TfLiteEvalTensor* input = tflite::micro::GetEvalInput(context, node, 0);
+    const TfLiteEvalTensor* filter =
+        tflite::micro::GetEvalInput(context, node, 1);
+    const TfLiteEvalTensor* bias =
+        node->inputs->size > 2 ? tflite::micro::GetEvalInput(context, node, 2)
+                               : nullptr;
+    TfLiteEvalTensor* output = tflite::micro::GetEvalOutput(context, node, 0);
+    const TfLiteConvParams* params =
+        static_cast<const TfLiteConvParams*>(node->builtin_data);
+
+    const TfLiteIntArray* in = input->dims;
+    const TfLiteIntArray* f = filter->dims;
+    const TfLiteIntArray* out = output->dims;
+    const int rows = in->data[1];
+    const int cols = in->data[2];
+    const int depth = in->data[3];
+    const int16_t* input_data = tflite::micro::GetTensorData<int16_t>(input);
+    const int8_t* filter_data = tflite::micro::GetTensorData<int8_t>(filter);
+    const int64_t* bias_data =
+        bias ? tflite::micro::GetTensorData<int64_t>(bias) : nullptr;
+    int16_t* output_data = tflite::micro::GetTensorData<int16_t>(output);
+
+    for (int b = 0; b < out->data[0]; b++) {
+      for (int oy = 0; oy < out->data[1]; oy++) {
+        const int top = oy * params->stride_height - data->padding.height;
+        for (int ox = 0; ox < out->data[2]; ox++) {
+          const int left = ox * params->stride_width - data->padding.width;
+          for (int oc = 0; oc < f->data[0]; oc++) {
+            int64_t acc = 0;
+            for (int ky = 0; ky < f->data[1]; ky++) {
+              const int iy = top + ky * params->dilation_height_factor;
+              if (iy < 0 || iy >= rows) {
+                continue;
+              }
+              for (int kx = 0; kx < f->data[2]; kx++) {
+                const int ix = left + kx * params->dilation_width_factor;
+                if (ix < 0 || ix >= cols) {
+                  continue;
+                }
+                acc += Dot(input_data + ((b * rows + iy) * cols + ix) * depth,
+                           filter_data +
+                               ((oc * f->data[1] + ky) * f->data[2] + kx) *
+                                   depth,
+                           depth);
+              }
+            }
+            if (bias_data) {
+              acc += bias_data[oc];
+            }
+            *output_data++ = Requantize(acc, data->channel_multiplier[oc],
+                                        data->channel_shift[oc], data);
+          }
+        }
+      }
+    }
+    return kTfLiteOk;
+  }
+
+  static TfLiteStatus EvalFullyConnected(TfLiteContext* context,
+                                         TfLiteNode* node,
+                                         const OpData* data) {
+    const TfLiteEvalTensor* input = tflite::micro::GetEvalInput(context, node, 0);
+    const TfLiteEvalTensor* filter =
+        tflite::micro::GetEvalInput(context, node, 1);
+    const TfLiteEvalTensor* bias =
+        node->inputs->size > 2 ? tflite::micro::GetEvalInput(context, node, 2)
+                               : nullptr;
+    TfLiteEvalTensor* output = tflite::micro::GetEvalOutput(context, node, 0);
+
+    const int rows = filter->dims->data[0];
+    const int depth = filter->dims->data[1];
+    const int batches = tflite::micro::GetTensorShape(input).FlatSize() / depth;
+    const int16_t* input_data = tflite::micro::GetTensorData<int16_t>(input);
+    const int8_t* filter_data = tflite::micro::GetTensorData<int8_t>(filter);
+    const int64_t* bias_data =
+        bias ? tflite::micro::GetTensorData<int64_t>(bias) : nullptr;
+    int16_t* output_data = tflite::micro::GetTensorData<int16_t>(output);
+
+    for (int b = 0; b < batches; b++) {
+      for (int r = 0; r < rows; r++) {
+        int64_t acc = Dot(input_data + b * depth, filter_data + r * depth,
+                          depth);
+        if (bias_data) {
+          acc += bias_data[r];
+        }
+        *output_data++ = Requantize(acc, data->multiplier, data->shift, data);
+      }
+    }
+    return kTfLiteOk;
+  }
+
+  static TfLiteStatus EvalElementwise(TfLiteContext* context,
+                                      TfLiteNode* node, const OpData* data,
+                                      bool add) {
+    const TfLiteEvalTensor* input1 =
+        tflite::micro::GetEvalInput(context, node, 0);
+    const TfLiteEvalTensor* input2 =
+        tflite::micro::GetEvalInput(context, node, 1);
+    TfLiteEvalTensor* output = tflite::micro::GetEvalOutput(context, node, 0);
+    const int16_t* a = tflite::micro::GetTensorData<int16_t>(input1);
+    const int16_t* b = tflite::micro::GetTensorData<int16_t>(input2);
+    int16_t* out = tflite::micro::GetTensorData<int16_t>(output);
+    const int size = tflite::micro::GetTensorShape(input1).FlatSize();
+
+    for (int i = 0; i < size; i++) {
+      int32_t value;
+      if (add) {
+        const int32_t sum =
+            tflite::MultiplyByQuantizedMultiplierSmallerThanOneExp(
+                a[i] * (1 << 15), data->input1_multiplier,
+                data->input1_shift) +
+            tflite::MultiplyByQuantizedMultiplierSmallerThanOneExp(
+                b[i] * (1 << 15), data->input2_multiplier,
+                data->input2_shift);
+        value = tflite::MultiplyByQuantizedMultiplierSmallerThanOneExp(
+            sum, data->multiplier, data->shift);
+      } else {
+        value = tflite::MultiplyByQuantizedMultiplier(
+            a[i] * b[i], data->multiplier, data->shift);
+      }
+      value = value < data->activation_min ? data->activation_min : value;
+      value = value > data->activation_max ? data->activation_max : value;
+      out[i] = static_cast<int16_t>(value);
+    }
+    return kTfLiteOk;
+  }
+
+  // Sum of n products of int16 inputs and int8 weights
+  static int64_t Dot(const int16_t* x, const int8_t* w, int n) {
+    int64_t acc = 0;
+    int i = 0;
+#ifdef INT16_KERNELS_SIMD
+    for (; i + 4 <= n; i += 4) {
+      uint32_t x01;
+      uint32_t x23;
+      uint32_t w4;
+      memcpy(&x01, x + i, 4);
+      memcpy(&x23, x + i + 2, 4);
+      memcpy(&w4, w + i, 4);
+      // Lanes x0, x2 with w0, w2 and x1, x3 with w1, w3
+      acc = __SMLALD(__PKHBT(x01, x23, 16), __SXTB16(w4), acc);
+      acc = __SMLALD(__PKHTB(x23, x01, 16), __SXTB16(__ROR(w4, 8)), acc);
+    }
+#endif
+    for (; i < n; i++) {
+      acc += x[i] * w[i];
+    }
+    return acc;
+  }
+
+  static int16_t Requantize(int64_t acc, int32_t multiplier, int shift,
+                            const OpData* data) {
+    int32_t value = tflite::MultiplyByQuantizedMultiplier(acc, multiplier,
+                                                          shift);
+    value = value < data->activation_min ? data->activation_min : value;
+    value = value > data->activation_max ? data->activation_max : value;
+    return static_cast<int16_t>(value);
+  }
+
+  const tflite::MicroOpResolver& base_;
+  mutable TfLiteRegistration registrations_[kSlots];
+
+  template <int kSlot>
+  static const TfLiteRegistration*& Generic() {
+    static const TfLiteRegistration* generic = nullptr;
+    return generic;
+  }
+};
+
+#endif  // INT16_KERNELS_H
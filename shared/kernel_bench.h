@@ -0,0 +1,464 @@
+#ifndef KERNEL_BENCH_H
+#define KERNEL_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/stm32/rcc.h>
+
+#include "arm_nnfunctions.h"
+#include "arm_nnsupportfunctions.h"
+#include "target_bench.h"
+#include "tensorflow/lite/core/api/error_reporter.h"
+
+// Microbenchmark of single CMSIS-NN kernels on the target.
+//
+// target_bench.h measures whole models, a kernel change then shows up as
+// a few percent of one operator among others. Here each kernel of
+// CMSIS_NN_SRC that our models spend their time in is called on its own,
+// on shapes of layers of cifar and power_test models, see kCases, and
+// measured with DWT cycle counter. Built with "make kbench", main() of the
+// project calls kernel_bench_run() instead of running the application.
+//
+// Every case runs once per memory the project passes, with all operands
+// in it, and once per cache state, I-cache and D-cache off and on. With
+// caches on operands that fit stay in D-cache after warm-up, so slow
+// memory only shows with them off. Memories that are not writable, flash
+// through AXIM or ITCM interface for example, only get weights, input,
+// output and scratch then go to the largest writable memory. Cases that
+// do not fit a memory, or have no weights for a flash one, are reported
+// as skipped. Operands are filled with a fixed pseudo random pattern,
+// weights in flash are whatever the memory holds, cycles of these kernels
+// do not depend on values.
+//
+// Result is one JSON object printed through error reporter between
+// "KBENCH BEGIN" and "KBENCH END" lines, with min, median and max cycles
+// of each case, memory and cache state, and work of the case, MACs or
+// elements, to compare cycles per MAC between shapes.
+//
+// Usage example:
+// #ifdef KERNEL_BENCH
+// static int8_t sram_buffer[96 * 1024];
+// const KernelBenchMemory memories[] = {
+//     {"sram1", sram_buffer, sizeof(sram_buffer), true},
+//     {"flash", model_data, model_len, false}};
+// KernelBenchConfig config = {10, 2};
+// kernel_bench_run(memories, 2, config, error_reporter);
+// while (1);
+// #endif
+//
+// Note that delay() in utility.c resets DWT counter, interrupts that call it
+// must not run during the benchmark.
+
+struct KernelBenchMemory {
+  const char* name;
+  const int8_t* data;
+  size_t size;
+  // Activations and scratch are placed only into writable memories
+  bool writable;
+};
+
+struct KernelBenchConfig {
+  int iterations;
+  int warmup;
+};
+
+namespace kernel_bench {
+
+// Samples of one case, memory and cache state
+constexpr int kMaxSamples = 64;
+constexpr size_t kAlignment = 16;
+
+enum Kernel {
+  kConvolve,        // arm_convolve_s8()
+  kVecMatMult,      // arm_nn_vec_mat_mult_t_s8(), FullyConnected batch 1
+  kMatMultNtT,      // arm_nn_mat_mult_nt_t_s8(), FullyConnected batch N
+  kMaxPool,         // arm_max_pool_s8()
+  kElementwiseAdd,  // arm_elementwise_add_s8()
+  kSoftmax,         // arm_softmax_s8()
+};
+
+// Shape of one case, fields that a kernel does not use are 0
+struct Case {
+  const char* name;  // Model and layer the shape is taken from
+  Kernel kernel;
+  int32_t batch;     // Rows of input, batch of mat mult or softmax
+  int32_t height;
+  int32_t width;
+  int32_t depth;     // Input channels, input row of FullyConnected
+  int32_t outputs;   // Filters of conv, rows of FullyConnected weights
+  int32_t kernel_h;  // Filter or pooling window
+  int32_t kernel_w;
+  int32_t stride;
+  int32_t padding;
+};
+
+// Convolutions have MaxPool2D fused out of them in the models, pools are
+// measured with the shape before fusion
+constexpr Case kCases[] = {
+    {"cifar.conv1", kConvolve, 1, 32, 32, 1, 32, 3, 3, 1, 0},
+    {"cifar.conv2", kConvolve, 1, 15, 15, 32, 64, 3, 3, 1, 0},
+    {"power.conv2", kConvolve, 1, 30, 40, 44, 20, 3, 4, 1, 1},
+    {"power.conv3", kConvolve, 1, 15, 20, 20, 20, 3, 4, 1, 1},
+    {"cifar.fc1", kVecMatMult, 1, 1, 1, 1024, 64, 0, 0, 0, 0},
+    {"power.fc1", kVecMatMult, 1, 1, 1, 6000, 48, 0, 0, 0, 0},
+    {"cifar.fc1.batch2", kMatMultNtT, 2, 1, 1, 1024, 64, 0, 0, 0, 0},
+    {"power.fc1.batch2", kMatMultNtT, 2, 1, 1, 6000, 48, 0, 0, 0, 0},
+    {"cifar.pool1", kMaxPool, 1, 30, 30, 32, 0, 2, 2, 2, 0},
+    {"power.pool2", kMaxPool, 1, 30, 40, 20, 0, 2, 2, 2, 0},
+    {"power.add", kElementwiseAdd, 1, 15, 20, 20, 0, 0, 0, 0, 0},
+    {"cifar.softmax", kSoftmax, 1, 1, 1, 3, 0, 0, 0, 0, 0},
+    {"power.softmax", kSoftmax, 1, 1, 1, 4, 0, 0, 0, 0, 0},
+};
+constexpr int kCaseCount = sizeof(kCases) / sizeof(kCases[0]);
+
+inline const char* KernelName(Kernel kernel) {
+  switch (kernel) {
+    case kConvolve: return "arm_convolve_s8";
+    case kVecMatMult: return "arm_nn_vec_mat_mult_t_s8";
+    case kMatMultNtT: return "arm_nn_mat_mult_nt_t_s8";
+    case kMaxPool: return "arm_max_pool_s8";
+    case kElementwiseAdd: return "arm_elementwise_add_s8";
+    case kSoftmax: return "arm_softmax_s8";
+  }
+  return "-";
+}
+
+inline int32_t OutputSize(int32_t size, int32_t kernel, int32_t stride,
+                          int32_t padding) {
+  return (size + 2 * padding - kernel) / stride + 1;
+}
+
+// Operands of one call, pointers into the memories
+struct Operands {
+  const int8_t* input;
+  const int8_t* input2;    // Second input of add
+  const int8_t* weights;
+  const int32_t* bias;
+  int32_t* multipliers;    // Per output channel
+  int32_t* shifts;
+  int8_t* output;
+  void* scratch;
+  int32_t scratch_size;
+};
+
+// Sizes of operands in bytes, 0 if the kernel has none
+struct Sizes {
+  size_t input;            // Second input of add has the same size
+  size_t output;
+  size_t weights;
+  size_t channels;         // Bias, multiplier and shift, int32 each
+  int32_t scratch;
+  uint32_t work;
+  int32_t out_h;
+  int32_t out_w;
+};
+
+inline Sizes CaseSizes(const Case& c) {
+  Sizes s = {};
+  s.input = c.batch * c.height * c.width * c.depth;
+  switch (c.kernel) {
+    case kConvolve: {
+      s.out_h = OutputSize(c.height, c.kernel_h, c.stride, c.padding);
+      s.out_w = OutputSize(c.width, c.kernel_w, c.stride, c.padding);
+      s.output = s.out_h * s.out_w * c.outputs;
+      s.channels = c.outputs;
+      s.weights = c.outputs * c.kernel_h * c.kernel_w * c.depth;
+      s.work = s.output * c.kernel_h * c.kernel_w * c.depth;
+      cmsis_nn_dims in = {1, c.height, c.width, c.depth};
+      cmsis_nn_dims filter = {c.outputs, c.kernel_h, c.kernel_w, c.depth};
+      s.scratch = arm_convolve_s8_get_buffer_size(&in, &filter);
+      break;
+    }
+    case kVecMatMult:
+    case kMatMultNtT:
+      s.output = c.batch * c.outputs;
+      s.channels = c.outputs;
+      s.weights = c.outputs * c.depth;
+      s.work = s.output * c.depth;
+      break;
+    case kMaxPool:
+      s.out_h = OutputSize(c.height, c.kernel_h, c.stride, c.padding);
+      s.out_w = OutputSize(c.width, c.kernel_w, c.stride, c.padding);
+      s.output = s.out_h * s.out_w * c.depth;
+      s.work = s.output * c.kernel_h * c.kernel_w;
+      break;
+    case kElementwiseAdd:
+    case kSoftmax:
+      s.output = s.input;
+      s.work = s.input;
+      break;
+  }
+  return s;
+}
+
+// Bump allocator within one memory
+struct Placement {
+  uint8_t* next;
+  uint8_t* end;
+
+  void* Take(size_t bytes) {
+    uint8_t* p = reinterpret_cast<uint8_t*>(
+        (reinterpret_cast<uintptr_t>(next) + kAlignment - 1) &
+        ~(kAlignment - 1));
+    if (p + bytes > end) return nullptr;
+    next = p + bytes;
+    return p;
+  }
+};
+
+// Fixed pattern, same for every memory, so runs are comparable
+inline void Fill(int8_t* data, size_t bytes) {
+  uint32_t state = 0x12345678;
+  for (size_t i = 0; i < bytes; i++) {
+    state = state * 1664525u + 1013904223u;
+    data[i] = static_cast<int8_t>(state >> 24);
+  }
+}
+
+inline int8_t* TakeFilled(Placement* memory, size_t bytes) {
+  int8_t* data = static_cast<int8_t*>(memory->Take(bytes));
+  if (data) Fill(data, bytes);
+  return data;
+}
+
+// Places operands of the case, weights into constants, everything else
+// into activations, which may be the same memory. Returns false if they
+// do not fit.
+inline bool Place(const Case& c, const Sizes& s, Placement* activations,
+                  const KernelBenchMemory& constants, Operands* op) {
+  *op = Operands();
+  if (s.weights && !constants.writable) {
+    if (constants.size < s.weights) return false;
+    op->weights = constants.data;
+  } else if (s.weights) {
+    op->weights = TakeFilled(activations, s.weights);
+    if (!op->weights) return false;
+  }
+
+  op->input = TakeFilled(activations, s.input);
+  if (c.kernel == kElementwiseAdd) {
+    op->input2 = TakeFilled(activations, s.input);
+    if (!op->input2) return false;
+  }
+  int32_t* channels = static_cast<int32_t*>(
+      activations->Take(3 * s.channels * sizeof(int32_t)));
+  op->output = static_cast<int8_t*>(activations->Take(s.output));
+  op->scratch = s.scratch ? activations->Take(s.scratch) : nullptr;
+  op->scratch_size = s.scratch;
+  if (!op->input || !channels || !op->output || (s.scratch && !op->scratch)) {
+    return false;
+  }
+
+  if (s.channels) {
+    op->bias = channels;
+    op->multipliers = channels + s.channels;
+    op->shifts = channels + 2 * s.channels;
+  }
+  for (size_t i = 0; i < s.channels; i++) {
+    channels[i] = static_cast<int32_t>(i * 97) - 2000;
+    op->multipliers[i] = 1 << 30;
+    op->shifts[i] = -7;
+  }
+  return true;
+}
+
+// One call of the kernel, returns cycles, 0 if it failed
+inline uint32_t Call(const Case& c, const Sizes& s, const Operands& op) {
+  const cmsis_nn_activation activation = {-128, 127};
+  uint32_t start = DWT_CYCCNT;
+  arm_status status = ARM_MATH_SUCCESS;
+  switch (c.kernel) {
+    case kConvolve: {
+      cmsis_nn_context context = {op.scratch, op.scratch_size};
+      cmsis_nn_conv_params params;
+      params.input_offset = 128;
+      params.output_offset = -128;
+      params.stride = {c.stride, c.stride};
+      params.padding = {c.padding, c.padding};
+      params.dilation = {1, 1};
+      params.activation = activation;
+      cmsis_nn_per_channel_quant_params quant = {op.multipliers, op.shifts};
+      cmsis_nn_dims in = {1, c.height, c.width, c.depth};
+      cmsis_nn_dims filter = {c.outputs, c.kernel_h, c.kernel_w, c.depth};
+      cmsis_nn_dims bias = {1, 1, 1, c.outputs};
+      cmsis_nn_dims out = {1, s.out_h, s.out_w, c.outputs};
+      status = arm_convolve_s8(&context, &params, &quant, &in, op.input,
+                               &filter, op.weights, &bias, op.bias, &out,
+                               op.output);
+      break;
+    }
+    case kVecMatMult:
+      status = arm_nn_vec_mat_mult_t_s8(
+          op.input, op.weights, op.bias, op.output, 128, 0, -128,
+          op.multipliers[0], op.shifts[0], c.depth, c.outputs,
+          activation.min, activation.max);
+      break;
+    case kMatMultNtT:
+      status = arm_nn_mat_mult_nt_t_s8(
+          op.input, op.weights, op.bias, op.output, op.multipliers,
+          op.shifts, c.batch, c.outputs, c.depth, 128, -128,
+          activation.min, activation.max);
+      break;
+    case kMaxPool: {
+      cmsis_nn_context context = {nullptr, 0};
+      cmsis_nn_pool_params params;
+      params.stride = {c.stride, c.stride};
+      params.padding = {c.padding, c.padding};
+      params.activation = activation;
+      cmsis_nn_dims in = {1, c.height, c.width, c.depth};
+      cmsis_nn_dims filter = {1, c.kernel_h, c.kernel_w, 1};
+      cmsis_nn_dims out = {1, s.out_h, s.out_w, c.depth};
+      status = arm_max_pool_s8(&context, &params, &in, op.input, &filter,
+                               &out, op.output);
+      break;
+    }
+    case kElementwiseAdd:
+      // Multipliers and shifts of a typical quantized Add
+      status = arm_elementwise_add_s8(
+          op.input, op.input2, 128, 1073741824, 0, 128, 1073741824, 0, 20,
+          op.output, -128, 1073741824, -19, activation.min, activation.max,
+          c.height * c.width * c.depth);
+      break;
+    case kSoftmax:
+      arm_softmax_s8(op.input, c.batch, c.depth, 1073741824, 23, -248,
+                     op.output);
+      break;
+  }
+  uint32_t cycles = DWT_CYCCNT - start;
+  return status == ARM_MATH_SUCCESS ? cycles : 0;
+}
+
+// Measures one case in one memory with current caches and prints its
+// JSON object, returns false if a call failed
+inline bool RunCaches(const char* cache, const Case& c, const Sizes& s,
+                      const Operands& op, const KernelBenchConfig& config,
+                      bool last, tflite::ErrorReporter* reporter) {
+  static uint32_t samples[kMaxSamples];
+  for (int run = 0; run < config.warmup + config.iterations; run++) {
+    uint32_t cycles = Call(c, s, op);
+    if (cycles == 0) {
+      TF_LITE_REPORT_ERROR(reporter, "%s failed on %s",
+                           KernelName(c.kernel), c.name);
+      return false;
+    }
+    if (run >= config.warmup) samples[run - config.warmup] = cycles;
+  }
+  target_bench::Sort(samples, config.iterations);
+  TF_LITE_REPORT_ERROR(reporter, "      \"%s\": {\"min\": %u, \"median\": "
+                       "%u, \"max\": %u}%s", cache, samples[0],
+                       target_bench::Percentile(samples, config.iterations,
+                                                500),
+                       samples[config.iterations - 1], last ? "" : ",");
+  return true;
+}
+
+// Measures one case and prints its JSON object
+inline bool RunCase(const Case& c, const KernelBenchMemory* memories,
+                    int memory_count, const KernelBenchConfig& config,
+                    bool last, tflite::ErrorReporter* reporter) {
+  const Sizes s = CaseSizes(c);
+  TF_LITE_REPORT_ERROR(reporter, "  {\"name\": \"%s\", \"kernel\": \"%s\", "
+                       "\"work\": %u, \"placements\": [", c.name,
+                       KernelName(c.kernel), s.work);
+
+  // Activations of read only memories go into the largest writable one
+  int scratch = memory_count;
+  for (int m = 0; m < memory_count; m++) {
+    if (memories[m].writable && (scratch == memory_count ||
+                                 memories[m].size > memories[scratch].size)) {
+      scratch = m;
+    }
+  }
+
+  bool ok = true;
+  for (int m = 0; m < memory_count && ok; m++) {
+    const KernelBenchMemory& memory = memories[m];
+    const char* separator = m + 1 < memory_count ? "," : "";
+    const KernelBenchMemory& activations =
+        memory.writable ? memory : memories[scratch];
+    uint8_t* base = const_cast<uint8_t*>(
+        reinterpret_cast<const uint8_t*>(activations.data));
+    Placement placement = {base, base + activations.size};
+
+    Operands op;
+    const char* skipped = nullptr;
+    if (!memory.writable && !s.weights) {
+      skipped = "no weights";
+    } else if (scratch == memory_count ||
+               !Place(c, s, &placement, memory, &op)) {
+      skipped = "does not fit";
+    }
+    if (skipped) {
+      TF_LITE_REPORT_ERROR(reporter, "    {\"memory\": \"%s\", "
+                           "\"skipped\": \"%s\"}%s", memory.name, skipped,
+                           separator);
+      continue;
+    }
+
+    TF_LITE_REPORT_ERROR(reporter, "    {\"memory\": \"%s\", "
+                         "\"activations\": \"%s\",", memory.name,
+                         activations.name);
+    uint32_t previous = target_bench::SetCaches(0);
+    ok = RunCaches("off", c, s, op, config, false, reporter);
+    if (ok) {
+      target_bench::SetCaches(target_bench::kCacheIc |
+                              target_bench::kCacheDc);
+      ok = RunCaches("on", c, s, op, config, true, reporter);
+    }
+    target_bench::SetCaches(previous);
+    TF_LITE_REPORT_ERROR(reporter, "    }%s", separator);
+  }
+  TF_LITE_REPORT_ERROR(reporter, "  ]}%s", last ? "" : ",");
+  return ok;
+}
+
+}  // namespace kernel_bench
+
+// Runs all cases in all memories and prints JSON, returns false if any
+// kernel failed. Caches are left as they were before the call.
+inline bool kernel_bench_run(const KernelBenchMemory* memories,
+                             int memory_count, KernelBenchConfig config,
+                             tflite::ErrorReporter* reporter) {
+  if (config.iterations < 1) config.iterations = 1;
+  if (config.iterations > kernel_bench::kMaxSamples) {
+    config.iterations = kernel_bench::kMaxSamples;
+  }
+  if (config.warmup < 0) config.warmup = 0;
+
+  // Cycle counter might not be enabled if project uses systick timer
+  DWT_LAR = 0xC5ACCE55;
+  dwt_enable_cycle_counter();
+
+  TF_LITE_REPORT_ERROR(reporter, "KBENCH BEGIN");
+  TF_LITE_REPORT_ERROR(reporter, "{\"clock_hz\": %u, \"iterations\": %d, "
+                       "\"warmup\": %d,",
+                       static_cast<unsigned>(rcc_ahb_frequency),
+                       config.iterations, config.warmup);
+  TF_LITE_REPORT_ERROR(reporter, " \"memories\": [");
+  for (int m = 0; m < memory_count; m++) {
+    TF_LITE_REPORT_ERROR(reporter, "  {\"name\": \"%s\", \"address\": %u, "
+                         "\"size\": %u, \"writable\": %s}%s",
+                         memories[m].name,
+                         static_cast<unsigned>(reinterpret_cast<uintptr_t>(
+                             memories[m].data)),
+                         static_cast<unsigned>(memories[m].size),
+                         memories[m].writable ? "true" : "false",
+                         m + 1 < memory_count ? "," : "");
+  }
+  TF_LITE_REPORT_ERROR(reporter, " ],");
+  TF_LITE_REPORT_ERROR(reporter, " \"cases\": [");
+
+  bool ok = true;
+  for (int i = 0; i < kernel_bench::kCaseCount && ok; i++) {
+    ok = kernel_bench::RunCase(kernel_bench::kCases[i], memories,
+                               memory_count, config,
+                               i + 1 == kernel_bench::kCaseCount, reporter);
+  }
+
+  TF_LITE_REPORT_ERROR(reporter, "]}");
+  TF_LITE_REPORT_ERROR(reporter, "KBENCH END");
+  return ok;
+}
+
+#endif  // KERNEL_BENCH_H
@@ -0,0 +1,158 @@
+#ifndef LATENCY_HIST_H
+#define LATENCY_HIST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Histogram of latencies in us with buckets in the HDR histogram layout,
+// log-linear: values below 2 * LATENCY_SUB have a bucket each, above that
+// every power of two is split into LATENCY_SUB linear buckets. Bucket is
+// at most 1/LATENCY_SUB of its value wide, so percentiles keep the same
+// relative precision from a few us of preprocessing to seconds of a slow
+// model, in fixed memory and without division per sample.
+// Values above LATENCY_MAX_BITS saturate into the last bucket, the largest
+// value is kept exactly.
+//
+// Usage example:
+// static latency_hist_t hist;
+// latency_hist_add(&hist, end_us - start_us);
+// printf("p99 %lu us\n", latency_hist_percentile(&hist, 990));
+
+#define LATENCY_SUB_BITS    (3)
+#define LATENCY_SUB         (1 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_BITS    (24)    // 2^24 us, around 16 s
+#define LATENCY_BUCKETS     ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * \
+                             LATENCY_SUB)
+
+typedef struct
+{
+    uint32_t count;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t buckets[LATENCY_BUCKETS];
+}latency_hist_t;
+
+/*!
+ * @brief                   Forgets all samples
+ */
+static inline void latency_hist_reset(latency_hist_t * hist)
+{
+    memset(hist, 0, sizeof(*hist));
+}
+
+/*!
+ * @brief                   Returns bucket of a value
+ *
+ * @note                    Exponent selects the power of two, the next
+ *                          LATENCY_SUB_BITS bits below the leading one
+ *                          select the linear bucket inside of it.
+ */
+static inline uint32_t latency_hist_bucket(uint32_t value)
+{
+    if (value >= (1UL << LATENCY_MAX_BITS))
+    {
+        return LATENCY_BUCKETS - 1;
+    }
+    if (value < 2 * LATENCY_SUB)
+    {
+        return value;
+    }
+
+    uint32_t shift = 31 - __builtin_clz(value) - LATENCY_SUB_BITS;
+    return shift * LATENCY_SUB + (value >> shift);
+}
+
+/*!
+ * @brief                   Returns the smallest value of a bucket
+ */
+static inline uint32_t latency_hist_lowest(uint32_t bucket)
+{
+    if (bucket < 2 * LATENCY_SUB)
+    {
+        return bucket;
+    }
+
+    uint32_t shift = bucket / LATENCY_SUB - 1;
+    return (bucket % LATENCY_SUB + LATENCY_SUB) << shift;
+}
+
+/*!
+ * @brief                   Adds one sample
+ *
+ * @param[in] hist
+ * @param[in] value         Latency in us
+ */
+static inline void latency_hist_add(latency_hist_t * hist, uint32_t value)
+{
+    hist->buckets[latency_hist_bucket(value)]++;
+    hist->count++;
+    hist->sum += value;
+    if (value > hist->max)
+    {
+        hist->max = value;
+    }
+}
+
+/*!
+ * @brief                   Returns value below which given part of
+ *                          samples is
+ *
+ * @param[in] hist
+ * @param[in] per_mille     Part of samples, 0 to 1000, 500 is median
+ *
+ * @return                  Middle of the bucket in us, 0 without samples
+ *
+ * @note                    Result is never above the largest sample, so
+ *                          p100 is exact.
+ */
+static inline uint32_t latency_hist_percentile(const latency_hist_t * hist,
+                                               uint32_t per_mille)
+{
+    if (hist->count == 0)
+    {
+        return 0;
+    }
+
+    // Rank of the sample, rounded up, p0 is the first one
+    uint32_t target = ((uint64_t) hist->count * per_mille + 999) / 1000;
+    uint32_t sum = 0;
+    uint32_t bucket = 0;
+
+    if (target == 0)
+    {
+        target = 1;
+    }
+    for (; bucket < LATENCY_BUCKETS - 1; bucket++)
+    {
+        sum += hist->buckets[bucket];
+        if (sum >= target)
+        {
+            break;
+        }
+    }
+
+    uint32_t low = latency_hist_lowest(bucket);
+    uint32_t width = latency_hist_lowest(bucket + 1) - low;
+    uint32_t value = low + width / 2;
+    return value < hist->max ? value : hist->max;
+}
+
+/*!
+ * @brief                   Returns average of all samples in us
+ */
+static inline uint32_t latency_hist_mean(const latency_hist_t * hist)
+{
+    return hist->count ? (uint32_t) (hist->sum / hist->count) : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LATENCY_HIST_H */
+/*** end of file ***/
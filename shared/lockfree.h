@@ -0,0 +1,297 @@
+#ifndef LOCKFREE_H
+#define LOCKFREE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Hand-off between interrupts and main context without masking interrupts.
+// spsc_ring_t queues fixed size slots from one producer to one consumer,
+// block_pool_t hands out fixed size blocks to any number of contexts.
+// Nothing is allocated, storage comes from the caller, look at
+// LOCKFREE_STORAGE().
+//
+// Ring indexes run freely, head - tail is the number of queued slots.
+// Producer only writes head and consumer only tail. Each side publishes
+// its index with a release store after the slot is written or read, the
+// other side reads it with an acquire load, GCC emits DMB for both on
+// Cortex-M7, so the order holds for the write buffer of the core too and
+// not only for the compiler. Head and tail are in their own cache lines,
+// cache maintenance of one never touches the other.
+//
+// Pool marks used blocks in a bitmap, block is claimed with compare and
+// swap, which is a LDREX/STREX loop on Cortex-M7. Exception entry clears
+// the exclusive monitor, so an interrupted claim retries, and a bitmap has
+// no ABA problem of linked free lists.
+
+#define LOCKFREE_CACHE_LINE     (32)    // D-cache line of Cortex-M7
+
+// Storage of count objects of size bytes, for example ring slots
+#define LOCKFREE_STORAGE(name, size, count) \
+    uint8_t name[(size) * (count)] __attribute__((aligned(LOCKFREE_CACHE_LINE)))
+
+typedef struct __attribute__((aligned(LOCKFREE_CACHE_LINE)))
+{
+    volatile uint32_t head;             // Pushed slots, producer only
+    uint8_t head_pad[LOCKFREE_CACHE_LINE - sizeof(uint32_t)];
+    volatile uint32_t tail;             // Popped slots, consumer only
+    uint8_t tail_pad[LOCKFREE_CACHE_LINE - sizeof(uint32_t)];
+    uint8_t * slots;
+    uint32_t slot_size;
+    uint32_t mask;                      // Number of slots - 1
+}spsc_ring_t;
+
+/*!
+ * @brief                   Prepares empty ring
+ *
+ * @param[out] ring
+ * @param[in] storage       slot_size * slots bytes
+ * @param[in] slot_size     Bytes of one slot
+ * @param[in] slots         Power of two
+ *
+ * @return                  False if slots is not a power of two
+ *
+ * @note                    Call it while neither side uses the ring
+ */
+static inline bool spsc_init(spsc_ring_t * ring,
+                             void * storage,
+                             uint32_t slot_size,
+                             uint32_t slots)
+{
+    if (slots == 0 || (slots & (slots - 1)))
+    {
+        return false;
+    }
+
+    ring->head = 0;
+    ring->tail = 0;
+    ring->slots = (uint8_t *) storage;
+    ring->slot_size = slot_size;
+    ring->mask = slots - 1;
+    return true;
+}
+
+/*!
+ * @brief                   Returns number of queued slots, exact when
+ *                          called by one of the sides
+ */
+static inline uint32_t spsc_count(const spsc_ring_t * ring)
+{
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+}
+
+/*!
+ * @brief                   Returns true if there is nothing to pop
+ */
+static inline bool spsc_empty(const spsc_ring_t * ring)
+{
+    return spsc_count(ring) == 0;
+}
+
+/*!
+ * @brief                   Producer, returns free slot to be filled in
+ *                          place, NULL if ring is full
+ *
+ * @note                    Slot is queued by spsc_commit(), until then
+ *                          consumer does not see it
+ */
+static inline void * spsc_write_slot(spsc_ring_t * ring)
+{
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail > ring->mask)
+    {
+        return NULL;
+    }
+    return ring->slots + (head & ring->mask) * ring->slot_size;
+}
+
+/*!
+ * @brief                   Producer, queues slot of spsc_write_slot()
+ */
+static inline void spsc_commit(spsc_ring_t * ring)
+{
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/*!
+ * @brief                   Consumer, returns the oldest queued slot to be
+ *                          read in place, NULL if ring is empty
+ *
+ * @note                    Slot stays queued until spsc_release()
+ */
+static inline void * spsc_read_slot(spsc_ring_t * ring)
+{
+    uint32_t tail = ring->tail;
+
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+    {
+        return NULL;
+    }
+    return ring->slots + (tail & ring->mask) * ring->slot_size;
+}
+
+/*!
+ * @brief                   Consumer, gives slot of spsc_read_slot() back
+ *                          to the producer
+ */
+static inline void spsc_release(spsc_ring_t * ring)
+{
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+/*!
+ * @brief                   Producer, copies item into the ring
+ *
+ * @return                  False if ring is full, item is dropped
+ */
+static inline bool spsc_push(spsc_ring_t * ring, const void * item)
+{
+    void * slot = spsc_write_slot(ring);
+    if (!slot)
+    {
+        return false;
+    }
+    memcpy(slot, item, ring->slot_size);
+    spsc_commit(ring);
+    return true;
+}
+
+/*!
+ * @brief                   Consumer, copies the oldest item out
+ *
+ * @return                  False if ring is empty
+ */
+static inline bool spsc_pop(spsc_ring_t * ring, void * item)
+{
+    const void * slot = spsc_read_slot(ring);
+    if (!slot)
+    {
+        return false;
+    }
+    memcpy(item, slot, ring->slot_size);
+    spsc_release(ring);
+    return true;
+}
+
+// Largest number of blocks of a pool, 32 per bitmap word
+#ifndef BLOCK_POOL_MAX_BLOCKS
+#define BLOCK_POOL_MAX_BLOCKS   (64)
+#endif
+#define BLOCK_POOL_WORDS        ((BLOCK_POOL_MAX_BLOCKS + 31) / 32)
+
+// Block size that keeps every block in its own cache lines, for blocks
+// that DMA reads or writes
+#define BLOCK_POOL_ROUND(size)  (((size) + LOCKFREE_CACHE_LINE - 1) & \
+                                 ~(LOCKFREE_CACHE_LINE - 1))
+
+typedef struct
+{
+    uint8_t * blocks;
+    uint32_t block_size;
+    uint32_t count;
+    volatile uint32_t used[BLOCK_POOL_WORDS];   // Bit of each taken block
+}block_pool_t;
+
+/*!
+ * @brief                   Prepares pool with all blocks free
+ *
+ * @param[out] pool
+ * @param[in] storage       block_size * count bytes
+ * @param[in] block_size
+ * @param[in] count         Up to BLOCK_POOL_MAX_BLOCKS
+ *
+ * @return                  False if there are too many blocks
+ */
+static inline bool block_pool_init(block_pool_t * pool,
+                                   void * storage,
+                                   uint32_t block_size,
+                                   uint32_t count)
+{
+    if (count == 0 || count > BLOCK_POOL_MAX_BLOCKS)
+    {
+        return false;
+    }
+
+    pool->blocks = (uint8_t *) storage;
+    pool->block_size = block_size;
+    pool->count = count;
+    for (uint32_t w = 0; w < BLOCK_POOL_WORDS; w++)
+    {
+        // Bits past the last block stay taken
+        uint32_t first = w * 32;
+        pool->used[w] = first + 32 <= count ? 0 :
+                        (first >= count ? 0xFFFFFFFFu :
+                                          0xFFFFFFFFu << (count - first));
+    }
+    return true;
+}
+
+/*!
+ * @brief                   Takes a free block, can be called from any
+ *                          context
+ *
+ * @return                  NULL if all blocks are taken
+ */
+static inline void * block_pool_alloc(block_pool_t * pool)
+{
+    for (uint32_t w = 0; w < BLOCK_POOL_WORDS; w++)
+    {
+        uint32_t used = __atomic_load_n(&pool->used[w], __ATOMIC_RELAXED);
+        while (used != 0xFFFFFFFFu)
+        {
+            uint32_t bit = __builtin_ctz(~used);
+            // Failed exchange reloads used, another context took a block
+            if (__atomic_compare_exchange_n(&pool->used[w], &used,
+                                            used | (1u << bit), true,
+                                            __ATOMIC_ACQUIRE,
+                                            __ATOMIC_RELAXED))
+            {
+                return pool->blocks + (w * 32 + bit) * pool->block_size;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief                   Gives block back, can be called from any
+ *                          context
+ *
+ * @param[in] block         From block_pool_alloc() of the same pool
+ */
+static inline void block_pool_free(block_pool_t * pool, void * block)
+{
+    uint32_t index = (uint32_t) ((uint8_t *) block - pool->blocks) /
+                     pool->block_size;
+    __atomic_fetch_and(&pool->used[index / 32], ~(1u << (index % 32)),
+                       __ATOMIC_RELEASE);
+}
+
+/*!
+ * @brief                   Returns number of free blocks, it can change
+ *                          right away if other contexts use the pool
+ */
+static inline uint32_t block_pool_available(const block_pool_t * pool)
+{
+    uint32_t available = 0;
+    for (uint32_t w = 0; w < BLOCK_POOL_WORDS; w++)
+    {
+        available += __builtin_popcount(~__atomic_load_n(&pool->used[w],
+                                                         __ATOMIC_RELAXED));
+    }
+    return available;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOCKFREE_H */
+/*** end of file ***/
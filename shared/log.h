@@ -0,0 +1,358 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Levelled logging, levels are chosen at compile time.
+// Calls above LOG_LEVEL expand to nothing, their format strings and
+// arguments are not compiled in, so they cost neither cycles nor flash.
+// LOG_LEVEL and LOG_DEFERRED are set in project.mk or on make command
+// line, for example make LOG_LEVEL=4, see rules.mk.
+//
+// Enabled calls print with printf of the project right away. With
+// LOG_DEFERRED they only store format pointer and arguments, a few stores
+// even in interrupts, and log_flush() formats them later, when nothing
+// else waits, for example before the core sleeps. Format has to be a
+// string literal then, %s arguments must point to strings that stay valid
+// and every argument is stored as 32 bit word, so %f and %ll do not work.
+// Queue and log_flush() are compiled in one source file of the project,
+// which defines LOG_IMPLEMENTATION and includes its printf.h first.
+//
+// LOG_BINARY is LOG_DEFERRED without format strings on the device. Each
+// literal goes to section .log_fmt, which the linker script keeps in the
+// ELF as INFO section at address 0, so it takes no flash and the address
+// of a string is its id. log_flush() sends id and argument words as a
+// TELEMETRY_LOG message of telemetry.h through log_binary_write() of the
+// project, a few bytes instead of a formatted line, and log_decode.py
+// formats them on the host from firmware.elf. %s arguments are printed
+// there only if they point into the ELF, string literals for example.
+// log_report() sends a message of tflite::ErrorReporter the same way,
+// with address of its format in flash, see log_reporter.h.
+//
+// Usage example:
+// #define LOG_TAG "FLIR"
+// #include "log.h"
+// LOG_INFO("Shutter position: %s\n", shutter_position_str(position));
+// LOG_DEBUG("DONE!\n");     // Not compiled in below LOG_LEVEL_DEBUG
+//
+// Output is "I FLIR: Shutter position: Open". Define LOG_TAG before the
+// include, it is the same for the whole file.
+
+#define LOG_LEVEL_NONE      0
+#define LOG_LEVEL_ERROR     1
+#define LOG_LEVEL_WARN      2
+#define LOG_LEVEL_INFO      3
+#define LOG_LEVEL_DEBUG     4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL           LOG_LEVEL_INFO
+#endif
+
+#ifndef LOG_TAG
+#define LOG_TAG             "LOG"
+#endif
+
+// Deferred entries, power of two, entries that do not fit are counted
+#ifndef LOG_QUEUE_LEN
+#define LOG_QUEUE_LEN       32
+#endif
+#define LOG_MAX_ARGS        6
+
+#if defined(LOG_BINARY) && !defined(LOG_DEFERRED)
+#define LOG_DEFERRED
+#endif
+
+#ifdef LOG_DEFERRED
+void log_push(uint32_t count, const char * fmt, ...);
+void log_flush();
+
+// Number of arguments after format, up to LOG_MAX_ARGS
+#define LOG_COUNT_(f, a1, a2, a3, a4, a5, a6, n, ...)   n
+#define LOG_COUNT(...)  LOG_COUNT_(__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0, 0)
+
+// Arguments after format as 32 bit words, each with a leading comma
+#define LOG_WORD_(a)    ((uint32_t) (uintptr_t) (a))
+#define LOG_WORDS_0(f)
+#define LOG_WORDS_1(f, a)                   , LOG_WORD_(a)
+#define LOG_WORDS_2(f, a, b)                LOG_WORDS_1(f, a), LOG_WORD_(b)
+#define LOG_WORDS_3(f, a, b, c)             LOG_WORDS_2(f, a, b), LOG_WORD_(c)
+#define LOG_WORDS_4(f, a, b, c, d)          LOG_WORDS_3(f, a, b, c), \
+                                            LOG_WORD_(d)
+#define LOG_WORDS_5(f, a, b, c, d, e)       LOG_WORDS_4(f, a, b, c, d), \
+                                            LOG_WORD_(e)
+#define LOG_WORDS_6(f, a, b, c, d, e, g)    LOG_WORDS_5(f, a, b, c, d, e), \
+                                            LOG_WORD_(g)
+#define LOG_FIRST_(f, ...)  f
+#define LOG_CAT_(a, b)  a ## b
+#define LOG_CAT(a, b)   LOG_CAT_(a, b)
+
+#ifdef LOG_BINARY
+// Literal of the call in .log_fmt, where only its address is used
+#define LOG_FMT_(literal) \
+    __extension__ ({ \
+        static const char log_fmt_[] \
+            __attribute__((section(".log_fmt"), used)) = literal; \
+        log_fmt_; \
+    })
+
+void log_report(const char * fmt, va_list args);
+void log_binary_write(const uint8_t * data, uint32_t len);
+#else
+#define LOG_FMT_(literal)   literal
+#endif
+
+#define LOG_WRITE_(prefix, ...) \
+    log_push(LOG_COUNT(__VA_ARGS__), \
+             LOG_FMT_(prefix LOG_TAG ": " LOG_FIRST_(__VA_ARGS__, 0)) \
+             LOG_CAT(LOG_WORDS_, LOG_COUNT(__VA_ARGS__))(__VA_ARGS__))
+#else
+#define LOG_WRITE_(prefix, ...) printf(prefix LOG_TAG ": " __VA_ARGS__)
+#define log_flush()             ((void) 0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...)  LOG_WRITE_("E ", __VA_ARGS__)
+#else
+#define LOG_ERROR(...)  ((void) 0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...)   LOG_WRITE_("W ", __VA_ARGS__)
+#else
+#define LOG_WARN(...)   ((void) 0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...)   LOG_WRITE_("I ", __VA_ARGS__)
+#else
+#define LOG_INFO(...)   ((void) 0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...)  LOG_WRITE_("D ", __VA_ARGS__)
+#else
+#define LOG_DEBUG(...)  ((void) 0)
+#endif
+
+#if defined(LOG_IMPLEMENTATION) && defined(LOG_DEFERRED)
+#include <libopencm3/cm3/cortex.h>
+#ifdef LOG_BINARY
+#include "telemetry.h"
+#endif
+
+typedef struct
+{
+    const char * fmt;
+    uint32_t args[LOG_MAX_ARGS];
+#ifdef LOG_BINARY
+    uint32_t count;
+#endif
+}log_entry_t;
+
+static log_entry_t log_queue[LOG_QUEUE_LEN];
+static volatile uint32_t log_head = 0;
+static volatile uint32_t log_tail = 0;
+static volatile uint32_t log_dropped = 0;
+
+#ifdef LOG_BINARY
+// Longest %s of log_report(), longer strings are cut
+#ifndef LOG_REPORT_MAX_STRING
+#define LOG_REPORT_MAX_STRING   64
+#endif
+
+static void log_send(uint32_t id, const uint32_t * args, uint32_t count);
+
+// Encoder of log messages, sequence of other telemetry is not touched
+static telemetry_t * log_telemetry()
+{
+    static telemetry_t tm;
+    static bool ready = false;
+    if (!ready)
+    {
+        telemetry_init(&tm, log_binary_write);
+        ready = true;
+    }
+    return &tm;
+}
+#endif
+
+/*!
+ * @brief               Stores one entry, called by LOG_* macros
+ *
+ * @param[in] count     Number of 32 bit arguments after fmt
+ *
+ * @note                Can be called from interrupts. Entry is dropped when
+ *                      queue is full, so older entries are printed intact.
+ */
+void log_push(uint32_t count, const char * fmt, ...)
+{
+    bool masked = cm_mask_interrupts(true);
+
+    if (log_head - log_tail >= LOG_QUEUE_LEN)
+    {
+        log_dropped++;
+        cm_mask_interrupts(masked);
+        return;
+    }
+
+    log_entry_t * entry = &log_queue[log_head & (LOG_QUEUE_LEN - 1)];
+    va_list args;
+    va_start(args, fmt);
+    entry->fmt = fmt;
+#ifdef LOG_BINARY
+    entry->count = count;
+#endif
+    for (uint32_t i = 0; i < LOG_MAX_ARGS; i++)
+    {
+        entry->args[i] = i < count ? va_arg(args, uint32_t) : 0;
+    }
+    va_end(args);
+    log_head++;
+
+    cm_mask_interrupts(masked);
+}
+
+/*!
+ * @brief   Formats and prints stored entries
+ *
+ * @note    Call it from main context only, where printing may block.
+ *          Entries pushed meanwhile are printed too.
+ */
+void log_flush()
+{
+    while (log_tail != log_head)
+    {
+        // Entry at tail is not overwritten, full queue drops new ones
+        const log_entry_t * entry = &log_queue[log_tail & (LOG_QUEUE_LEN - 1)];
+#ifdef LOG_BINARY
+        log_send(LOG_WORD_(entry->fmt), entry->args, entry->count);
+#else
+        printf(entry->fmt, entry->args[0], entry->args[1], entry->args[2],
+               entry->args[3], entry->args[4], entry->args[5]);
+#endif
+        log_tail++;
+    }
+
+    if (log_dropped)
+    {
+        bool masked = cm_mask_interrupts(true);
+        uint32_t dropped = log_dropped;
+        log_dropped = 0;
+        cm_mask_interrupts(masked);
+#ifdef LOG_BINARY
+        log_send(LOG_WORD_(LOG_FMT_("W LOG: %ld entries dropped\n")),
+                 &dropped, 1);
+#else
+        printf("W LOG: %ld entries dropped\n", dropped);
+#endif
+    }
+}
+
+#ifdef LOG_BINARY
+/*!
+ * @brief               Sends TELEMETRY_LOG message of flushed entry
+ */
+static void log_send(uint32_t id, const uint32_t * args, uint32_t count)
+{
+    telemetry_begin(log_telemetry(), TELEMETRY_LOG);
+    telemetry_put_u32(log_telemetry(), id);
+    telemetry_put_u8(log_telemetry(), (uint8_t) count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        telemetry_put_u32(log_telemetry(), args[i]);
+    }
+    telemetry_end(log_telemetry());
+}
+
+/*!
+ * @brief               Sends message of tflite::ErrorReporter right away,
+ *                      after queued entries
+ *
+ * @param[in] fmt       printf format, stays in flash, its address is sent
+ * @param[in] args      Arguments of fmt
+ *
+ * @note                Call it from main context only, same as log_flush().
+ *                      Arguments are sent in format order, 4 bytes each,
+ *                      8 for %ll and floating point, %s as its characters
+ *                      up to LOG_REPORT_MAX_STRING and a terminating 0.
+ */
+void log_report(const char * fmt, va_list args)
+{
+    log_flush();
+
+    telemetry_t * tm = log_telemetry();
+    telemetry_begin(tm, TELEMETRY_LOG_REPORT);
+    telemetry_put_u32(tm, LOG_WORD_(fmt));
+    for (const char * c = fmt; *c; c++)
+    {
+        if (*c != '%')
+        {
+            continue;
+        }
+        c++;
+        // Flags, width and precision, * takes an int argument
+        uint32_t longs = 0;
+        while (*c && strchr("-+ #0123456789.*hljztL", *c))
+        {
+            if (*c == '*')
+            {
+                telemetry_put_u32(tm, (uint32_t) va_arg(args, int));
+            }
+            longs += *c == 'l';
+            c++;
+        }
+        if (*c == 0)
+        {
+            break;
+        }
+        if (strchr("diouxXc", *c))
+        {
+            if (longs >= 2)
+            {
+                uint64_t value = va_arg(args, unsigned long long);
+                telemetry_put_u32(tm, (uint32_t) value);
+                telemetry_put_u32(tm, (uint32_t) (value >> 32));
+            }
+            else
+            {
+                telemetry_put_u32(tm, va_arg(args, uint32_t));
+            }
+        }
+        else if (strchr("fFeEgGaA", *c))
+        {
+            double value = va_arg(args, double);
+            uint64_t bits;
+            memcpy(&bits, &value, 8);
+            telemetry_put_u32(tm, (uint32_t) bits);
+            telemetry_put_u32(tm, (uint32_t) (bits >> 32));
+        }
+        else if (*c == 's')
+        {
+            const char * text = va_arg(args, const char *);
+            uint32_t len = text ? strlen(text) : 0;
+            len = len < LOG_REPORT_MAX_STRING ? len : LOG_REPORT_MAX_STRING;
+            telemetry_put(tm, text, len);
+            telemetry_put_u8(tm, 0);
+        }
+        else if (*c == 'p' || *c == 'n')
+        {
+            telemetry_put_u32(tm, LOG_WORD_(va_arg(args, void *)));
+        }
+    }
+    telemetry_end(tm);
+}
+#endif
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOG_H */
+/*** end of file ***/
@@ -0,0 +1,48 @@
+#ifndef LOG_REPORTER_H
+#define LOG_REPORTER_H
+
+#include <stdarg.h>
+
+#include "tensorflow/lite/core/api/error_reporter.h"
+#include "tensorflow/lite/micro/micro_error_reporter.h"
+
+#include "log.h"
+
+// ErrorReporter that sends TF_LITE_REPORT_ERROR as binary log.
+//
+// MicroErrorReporter formats every report with vsnprintf and DebugLog()
+// prints the text, which costs both cycles and UART time, arena and
+// profiler tables have dozens of such lines. With LOG_BINARY, see
+// shared/log.h, Report() sends address of the format, which stays in
+// flash, and its arguments, log_decode.py on host looks the format up in
+// firmware.elf and prints the same text. Deferred log entries are flushed
+// first, so order of the output is kept.
+//
+// Without LOG_BINARY reports go to MicroErrorReporter as before, so the
+// class can be used in every build. DebugLog() of other callers, for
+// example MicroPrintf, stays text.
+//
+// Usage example:
+// static LogErrorReporter log_error_reporter;
+// error_reporter = &log_error_reporter;
+// TF_LITE_REPORT_ERROR(error_reporter, "Arena used: %d bytes", used);
+class LogErrorReporter : public tflite::ErrorReporter {
+ public:
+  ~LogErrorReporter() override = default;
+
+  int Report(const char* format, va_list args) override {
+#ifdef LOG_BINARY
+    log_report(format, args);
+    return 0;
+#else
+    return text_.Report(format, args);
+#endif
+  }
+
+ private:
+#ifndef LOG_BINARY
+  tflite::MicroErrorReporter text_;
+#endif
+};
+
+#endif  // LOG_REPORTER_H
@@ -0,0 +1,220 @@
+#ifndef LUT_ACTIVATIONS_H
+#define LUT_ACTIVATIONS_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tensorflow/lite/c/builtin_op_data.h"
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/micro_op_resolver.h"
+
+// Softmax, Logistic and Tanh of int8 tensors through lookup tables.
+//
+// Int8 input has only 256 values, so Prepare() evaluates the function
+// for each of them from scale and zero point of the tensors and Eval()
+// is a table load per element. Logistic and Tanh tables hold quantized
+// output directly. Softmax table holds exp(beta * scale * -d) for
+// distance d of an input from the row maximum, Eval() sums the row
+// through it and scales each entry by one reciprocal, no exponent is
+// computed at run time. Results are within one step of the reference
+// kernels, which approximate exp in fixed point.
+//
+// Tables live in the persistent arena, 256 bytes for Logistic and Tanh
+// and 1 kB for Softmax. Other types run through the original kernels.
+//
+// Usage example:
+// static LutActivationResolver lut_resolver(engine.resolver());
+// engine.SetResolver(&lut_resolver);
+// engine.Setup(model_data, error_reporter);
+
+class LutActivationResolver : public tflite::MicroOpResolver {
+ public:
+  explicit LutActivationResolver(const tflite::MicroOpResolver& base)
+      : base_(base) {}
+
+  const TfLiteRegistration* FindOp(tflite::BuiltinOperator op) const override {
+    const TfLiteRegistration* registration = base_.FindOp(op);
+    if (registration == nullptr) {
+      return nullptr;
+    }
+
+    switch (op) {
+      case tflite::BuiltinOperator_SOFTMAX:
+        return Wrap<kSoftmax>(registration);
+      case tflite::BuiltinOperator_LOGISTIC:
+        return Wrap<kLogistic>(registration);
+      case tflite::BuiltinOperator_TANH:
+        return Wrap<kTanh>(registration);
+      default:
+        return registration;
+    }
+  }
+
+  const TfLiteRegistration* FindOp(const char* op) const override {
+    return base_.FindOp(op);
+  }
+
+  BuiltinParseFunction GetOpDataParser(
+      tflite::BuiltinOperator op) const override {
+    return base_.GetOpDataParser(op);
+  }
+
+ private:
+  enum { kSoftmax, kLogistic, kTanh, kSlots };
+
+  struct OpData {
+    void* generic_data;
+    void* table;            // nullptr if node runs original kernel
+    float output_scale;     // Softmax only, Eval tensors have no params
+    int32_t output_zero_point;
+  };
+
+  template <int kSlot>
+  const TfLiteRegistration* Wrap(const TfLiteRegistration* registration) const {
+    // Keep builtin code and version, so profiler still reports them
+    Generic<kSlot>() = registration;
+    registrations_[kSlot] = *registration;
+    registrations_[kSlot].init = Init<kSlot>;
+    registrations_[kSlot].free = nullptr;
+    registrations_[kSlot].prepare = Prepare<kSlot>;
+    registrations_[kSlot].invoke = Eval<kSlot>;
+    return &registrations_[kSlot];
+  }
+
+  template <int kSlot>
+  static void* Init(TfLiteContext* context, const char* buffer,
+                    size_t length) {
+    OpData* data = static_cast<OpData*>(
+        context->AllocatePersistentBuffer(context, sizeof(OpData)));
+    if (data == nullptr) {
+      return nullptr;
+    }
+    data->generic_data = Generic<kSlot>()->init
+                             ? Generic<kSlot>()->init(context, buffer, length)
+                             : nullptr;
+    data->table = nullptr;
+    return data;
+  }
+
+  template <int kSlot>
+  static TfLiteStatus Prepare(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+    const TfLiteTensor* input = tflite::GetInput(context, node, 0);
+    const TfLiteTensor* output = tflite::GetOutput(context, node, 0);
+
+    if (input->type != kTfLiteInt8 || output->type != kTfLiteInt8) {
+      data->table = nullptr;
+      node->user_data = data->generic_data;
+      TfLiteStatus status = Generic<kSlot>()->prepare
+                                ? Generic<kSlot>()->prepare(context, node)
+                                : kTfLiteOk;
+      node->user_data = data;
+      return status;
+    }
+
+    const float input_scale = input->params.scale;
+    const int32_t input_zero_point = input->params.zero_point;
+
+    if (kSlot == kSoftmax) {
+      const TfLiteSoftmaxParams* params =
+          static_cast<const TfLiteSoftmaxParams*>(node->builtin_data);
+      float* table = static_cast<float*>(
+          context->AllocatePersistentBuffer(context, 256 * sizeof(float)));
+      if (table == nullptr) {
+        return kTfLiteError;
+      }
+      for (int d = 0; d < 256; d++) {
+        table[d] = expf(-params->beta * input_scale * d);
+      }
+      data->table = table;
+      data->output_scale = output->params.scale;
+      data->output_zero_point = output->params.zero_point;
+      return kTfLiteOk;
+    }
+
+    int8_t* table = static_cast<int8_t*>(
+        context->AllocatePersistentBuffer(context, 256));
+    if (table == nullptr) {
+      return kTfLiteError;
+    }
+    for (int q = -128; q < 128; q++) {
+      const float x = input_scale * (q - input_zero_point);
+      const float y = kSlot == kLogistic ? 1.0f / (1.0f + expf(-x)) : tanhf(x);
+      table[q + 128] = Quantize(y, output);
+    }
+    data->table = table;
+    return kTfLiteOk;
+  }
+
+  template <int kSlot>
+  static TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
+    OpData* data = static_cast<OpData*>(node->user_data);
+
+    if (data->table == nullptr) {
+      node->user_data = data->generic_data;
+      TfLiteStatus status = Generic<kSlot>()->invoke(context, node);
+      node->user_data = data;
+      return status;
+    }
+
+    const TfLiteEvalTensor* input = tflite::micro::GetEvalInput(context, node, 0);
+    TfLiteEvalTensor* output = tflite::micro::GetEvalOutput(context, node, 0);
+    const tflite::RuntimeShape shape = tflite::micro::GetTensorShape(input);
+    const int8_t* in = tflite::micro::GetTensorData<int8_t>(input);
+    int8_t* out = tflite::micro::GetTensorData<int8_t>(output);
+    const int size = shape.FlatSize();
+
+    if (kSlot != kSoftmax) {
+      const int8_t* table = static_cast<const int8_t*>(data->table);
+      for (int i = 0; i < size; i++) {
+        out[i] = table[in[i] + 128];
+      }
+      return kTfLiteOk;
+    }
+
+    const float* table = static_cast<const float*>(data->table);
+    const int depth = shape.Dims(shape.DimensionsCount() - 1);
+    for (int offset = 0; offset < size; offset += depth) {
+      const int8_t* row = in + offset;
+      int8_t max = row[0];
+      for (int i = 1; i < depth; i++) {
+        if (row[i] > max) max = row[i];
+      }
+
+      float sum = 0.0f;
+      for (int i = 0; i < depth; i++) {
+        sum += table[max - row[i]];
+      }
+
+      const float scale = 1.0f / (sum * data->output_scale);
+      for (int i = 0; i < depth; i++) {
+        int32_t q = static_cast<int32_t>(
+                        lroundf(table[max - row[i]] * scale)) +
+                    data->output_zero_point;
+        q = q < -128 ? -128 : (q > 127 ? 127 : q);
+        out[offset + i] = static_cast<int8_t>(q);
+      }
+    }
+    return kTfLiteOk;
+  }
+
+  static int8_t Quantize(float value, const TfLiteTensor* output) {
+    int32_t q = static_cast<int32_t>(lroundf(value / output->params.scale)) +
+                output->params.zero_point;
+    return static_cast<int8_t>(q < -128 ? -128 : (q > 127 ? 127 : q));
+  }
+
+  const tflite::MicroOpResolver& base_;
+  mutable TfLiteRegistration registrations_[kSlots];
+
+  template <int kSlot>
+  static const TfLiteRegistration*& Generic() {
+    static const TfLiteRegistration* generic = nullptr;
+    return generic;
+  }
+};
+
+#endif  // LUT_ACTIVATIONS_H
@@ -0,0 +1,480 @@
+#ifndef MEM_MODEL_H
+#define MEM_MODEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "tensorflow/lite/c/builtin_op_data.h"
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/micro/micro_op_resolver.h"
+#include "tensorflow/lite/schema/schema_generated.h"
+
+// Estimate of STM32F7 memory stalls of each operator, on the host.
+//
+// Resolver wraps every kernel, while enabled each Eval() first replays
+// the loads and stores its target kernel would do as a stream of 32 byte
+// lines through a model of the memory system, then runs the original
+// kernel. Streams follow the loop order of the CMSIS-NN kernels:
+// - Conv2D reads the input patch of two output pixels, then the whole
+//   filter, as the 1x2 im2col GEMM does,
+// - DepthwiseConv2D reads patch and filter once per output pixel,
+// - FullyConnected reads all weights once per batch row,
+// - any other operator reads its inputs and writes its output once.
+// Conv2D fused with pooling by Conv2DPoolResolver is replayed at its
+// pooled output size, so its input patches are undercounted.
+//
+// Tensors inside the arena are activations, everything else comes from
+// the model, that is flash. The same stream is run through four
+// placements at once, arena in DTCM or in SRAM1 behind the D-cache and
+// weights read over AXIM through the D-cache or over ITCM through ART,
+// so report shows what moving the arena or the weights would save and
+// what fusing two operators saves in activation traffic. DTCM has no
+// wait states, every line miss costs the cycles of MemModelConfig.
+//
+// Numbers are estimates for comparing layouts, not cycle counts, CPU
+// work, write buffer and prefetch are not modelled. Check them against
+// SWEEP of power_test or on target benchmark once in a while.
+//
+// Callbacks are plain functions, so state is static and only one model
+// can exist. Wrap it around all other resolvers, so it sees the kernels
+// that really run.
+//
+// Usage example:
+// static MemModelResolver mem_resolver(pool_resolver);
+// tflite::MicroInterpreter interpreter(model, mem_resolver, arena, size,
+//                                      reporter);
+// interpreter.AllocateTensors();
+// mem_resolver.Begin(arena, size);
+// interpreter.Invoke();
+// mem_resolver.Report();
+
+// Memory system of STM32F767 at 216 MHz, change it for other parts
+struct MemModelConfig {
+  uint32_t dcache_bytes = 16 * 1024;    // 4 KB on STM32F74x
+  uint32_t dcache_ways = 4;
+  uint32_t art_lines = 64;              // 256 bit lines of ART on ITCM
+  uint32_t flash_miss_cycles = 12;      // 7 wait states and bus, per line
+  uint32_t sram_miss_cycles = 6;        // AXI line fill from SRAM1
+};
+
+namespace mem_model {
+
+constexpr uint32_t kLineBytes = 32;
+
+// Set associative cache with LRU, tags are host addresses of lines
+class Cache {
+ public:
+  static constexpr uint32_t kMaxLines = 1024;
+
+  void Init(uint32_t lines, uint32_t ways) {
+    ways_ = ways ? ways : 1;
+    if (lines > kMaxLines) lines = kMaxLines;
+    sets_ = lines / ways_ ? lines / ways_ : 1;
+    for (uint32_t i = 0; i < kMaxLines; i++) {
+      tags_[i] = 0;
+      ages_[i] = 0;
+    }
+    clock_ = 0;
+  }
+
+  // Returns true on a hit, a miss replaces the oldest way of the set
+  bool Access(uintptr_t line) {
+    uint32_t set = static_cast<uint32_t>(line % sets_);
+    uintptr_t* tags = &tags_[set * ways_];
+    uint32_t* ages = &ages_[set * ways_];
+    uint32_t oldest = 0;
+    clock_++;
+    for (uint32_t way = 0; way < ways_; way++) {
+      if (tags[way] == line + 1) {
+        ages[way] = clock_;
+        return true;
+      }
+      if (ages[way] < ages[oldest]) oldest = way;
+    }
+    tags[oldest] = line + 1;
+    ages[oldest] = clock_;
+    return false;
+  }
+
+ private:
+  uint32_t sets_ = 1;
+  uint32_t ways_ = 1;
+  uint32_t clock_ = 0;
+  // 0 is an empty way, tags are stored plus one
+  uintptr_t tags_[kMaxLines];
+  uint32_t ages_[kMaxLines];
+};
+
+// Arena in SRAM1 instead of DTCM, weights over ITCM instead of AXIM
+constexpr int kArenaSram = 1 << 0;
+constexpr int kWeightsItcm = 1 << 1;
+constexpr int kPlacements = 4;
+
+struct OpStats {
+  const char* name;
+  uint64_t arena_bytes;
+  uint64_t flash_bytes;
+  uint64_t stalls[kPlacements];
+};
+
+}  // namespace mem_model
+
+class MemModelResolver : public tflite::MicroOpResolver {
+ public:
+  static constexpr int kMaxSlots = 16;
+  static constexpr int kMaxOps = 64;
+
+  explicit MemModelResolver(const tflite::MicroOpResolver& base,
+                            const MemModelConfig& config = MemModelConfig())
+      : base_(base) {
+    GetState().config = config;
+  }
+
+  // Starts a measurement, arena tells activations from weights. Caches
+  // start empty, as after wake up. Kernels run unmeasured until this.
+  void Begin(const void* arena, size_t arena_size) {
+    State& state = GetState();
+    state.arena = static_cast<const uint8_t*>(arena);
+    state.arena_size = arena_size;
+    state.num_ops = 0;
+    state.enabled = true;
+    for (int p = 0; p < mem_model::kPlacements; p++) {
+      state.dcache[p].Init(state.config.dcache_bytes / mem_model::kLineBytes,
+                           state.config.dcache_ways);
+      state.art[p].Init(state.config.art_lines, state.config.art_lines);
+    }
+  }
+
+  // Stops measuring, kernels run on their own again
+  void End() { GetState().enabled = false; }
+
+  // Prints stall cycles of each operator for each placement and ends
+  // the measurement, operators that ran more than once are summed
+  void Report() {
+    State& state = GetState();
+    End();
+    static const char* const kNames[mem_model::kPlacements] = {
+        "dtcm+axim", "sram+axim", "dtcm+itcm", "sram+itcm"};
+
+    printf("Memory stalls, arena+weights, %u KB D-cache, flash miss %u, "
+           "SRAM miss %u cycles\n",
+           static_cast<unsigned>(state.config.dcache_bytes / 1024),
+           static_cast<unsigned>(state.config.flash_miss_cycles),
+           static_cast<unsigned>(state.config.sram_miss_cycles));
+    printf("%-3s %-18s %9s %9s", "op", "name", "arena KB", "flash KB");
+    for (int p = 0; p < mem_model::kPlacements; p++) {
+      printf(" %10s", kNames[p]);
+    }
+    printf("\n");
+
+    mem_model::OpStats total = {"total", 0, 0, {0, 0, 0, 0}};
+    for (int i = 0; i < state.num_ops; i++) {
+      const mem_model::OpStats& op = state.ops[i];
+      Print(i, op);
+      total.arena_bytes += op.arena_bytes;
+      total.flash_bytes += op.flash_bytes;
+      for (int p = 0; p < mem_model::kPlacements; p++) {
+        total.stalls[p] += op.stalls[p];
+      }
+    }
+    Print(-1, total);
+  }
+
+  const TfLiteRegistration* FindOp(tflite::BuiltinOperator op) const override {
+    const TfLiteRegistration* registration = base_.FindOp(op);
+    if (registration == nullptr) {
+      return nullptr;
+    }
+    return Wrap(registration);
+  }
+
+  const TfLiteRegistration* FindOp(const char* op) const override {
+    const TfLiteRegistration* registration = base_.FindOp(op);
+    if (registration == nullptr) {
+      return nullptr;
+    }
+    return Wrap(registration);
+  }
+
+  BuiltinParseFunction GetOpDataParser(
+      tflite::BuiltinOperator op) const override {
+    return base_.GetOpDataParser(op);
+  }
+
+ private:
+  typedef TfLiteStatus (*InvokeFunction)(TfLiteContext*, TfLiteNode*);
+
+  struct State {
+    MemModelConfig config;
+    bool enabled = false;
+    const uint8_t* arena = nullptr;
+    size_t arena_size = 0;
+    const TfLiteRegistration* generic[kMaxSlots] = {};
+    TfLiteRegistration registrations[kMaxSlots];
+    mem_model::Cache dcache[mem_model::kPlacements];
+    mem_model::Cache art[mem_model::kPlacements];
+    int num_ops = 0;
+    mem_model::OpStats ops[kMaxOps];
+  };
+
+  static State& GetState() {
+    static State state;
+    return state;
+  }
+
+  // Slots are shared by all resolvers, as state is
+  static const TfLiteRegistration* Wrap(
+      const TfLiteRegistration* registration) {
+    State& state = GetState();
+    int slot = 0;
+    for (; slot < kMaxSlots && state.generic[slot] != nullptr; slot++) {
+      if (state.generic[slot] == registration) {
+        return &state.registrations[slot];
+      }
+    }
+    if (slot == kMaxSlots) {
+      // More kinds of operators than slots, rest is not measured
+      return registration;
+    }
+
+    static const InvokeFunction kEvals[kMaxSlots] = {
+        Eval<0>,  Eval<1>,  Eval<2>,  Eval<3>,  Eval<4>,  Eval<5>,
+        Eval<6>,  Eval<7>,  Eval<8>,  Eval<9>,  Eval<10>, Eval<11>,
+        Eval<12>, Eval<13>, Eval<14>, Eval<15>};
+    state.generic[slot] = registration;
+    state.registrations[slot] = *registration;
+    state.registrations[slot].invoke = kEvals[slot];
+    return &state.registrations[slot];
+  }
+
+  template <int kSlot>
+  static TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
+    State& state = GetState();
+    const TfLiteRegistration* generic = state.generic[kSlot];
+    if (state.enabled) {
+      Replay(context, node, generic);
+    }
+    return generic->invoke(context, node);
+  }
+
+  static const TfLiteEvalTensor* Tensor(TfLiteContext* context,
+                                        const TfLiteIntArray* indices,
+                                        int i) {
+    if (i >= indices->size || indices->data[i] < 0) {
+      return nullptr;
+    }
+    return context->GetEvalTensor(context, indices->data[i]);
+  }
+
+  static size_t Bytes(const TfLiteEvalTensor* tensor) {
+    if (tensor == nullptr) {
+      return 0;
+    }
+    size_t count = 1;
+    for (int i = 0; i < tensor->dims->size; i++) {
+      count *= tensor->dims->data[i];
+    }
+    size_t type_size;
+    switch (tensor->type) {
+      case kTfLiteInt8:
+      case kTfLiteUInt8:
+        type_size = 1;
+        break;
+      case kTfLiteInt16:
+        type_size = 2;
+        break;
+      default:
+        type_size = 4;
+    }
+    return count * type_size;
+  }
+
+  static int Dim(const TfLiteEvalTensor* tensor, int i) {
+    return i < tensor->dims->size ? tensor->dims->data[i] : 1;
+  }
+
+  // Every line of [data, data + bytes) once through each placement
+  static void Touch(const void* data, size_t bytes, mem_model::OpStats* op) {
+    if (data == nullptr || bytes == 0) {
+      return;
+    }
+    State& state = GetState();
+    const uint8_t* bytes_ptr = static_cast<const uint8_t*>(data);
+    bool in_arena = bytes_ptr >= state.arena &&
+                    bytes_ptr < state.arena + state.arena_size;
+    (in_arena ? op->arena_bytes : op->flash_bytes) += bytes;
+
+    uintptr_t first = reinterpret_cast<uintptr_t>(data) / mem_model::kLineBytes;
+    uintptr_t last = (reinterpret_cast<uintptr_t>(data) + bytes - 1) /
+                     mem_model::kLineBytes;
+    for (int p = 0; p < mem_model::kPlacements; p++) {
+      for (uintptr_t line = first; line <= last; line++) {
+        if (in_arena) {
+          // DTCM is not cached and has no wait states
+          if ((p & mem_model::kArenaSram) && !state.dcache[p].Access(line)) {
+            op->stalls[p] += state.config.sram_miss_cycles;
+          }
+        } else if (p & mem_model::kWeightsItcm) {
+          if (!state.art[p].Access(line)) {
+            op->stalls[p] += state.config.flash_miss_cycles;
+          }
+        } else if (!state.dcache[p].Access(line)) {
+          op->stalls[p] += state.config.flash_miss_cycles;
+        }
+      }
+    }
+  }
+
+  // Window of NHWC input under output pixel oy, ox, row by row
+  static void TouchPatch(const TfLiteEvalTensor* input, int oy, int ox,
+                         int stride_h, int stride_w, int pad_h, int pad_w,
+                         int kernel_h, int kernel_w,
+                         mem_model::OpStats* op) {
+    const int in_h = Dim(input, 1);
+    const int in_w = Dim(input, 2);
+    const int depth = Dim(input, 3);
+    const int x0 = ox * stride_w - pad_w;
+    const int x_start = x0 < 0 ? 0 : x0;
+    const int x_end = x0 + kernel_w > in_w ? in_w : x0 + kernel_w;
+    if (x_end <= x_start) {
+      return;
+    }
+    for (int ky = 0; ky < kernel_h; ky++) {
+      const int y = oy * stride_h - pad_h + ky;
+      if (y < 0 || y >= in_h) {
+        continue;
+      }
+      Touch(input->data.int8 + (y * in_w + x_start) * depth,
+            (x_end - x_start) * depth, op);
+    }
+  }
+
+  static int Padding(TfLitePadding padding, int in, int out, int stride,
+                     int kernel) {
+    if (padding != kTfLitePaddingSame) {
+      return 0;
+    }
+    int pad = ((out - 1) * stride + kernel - in) / 2;
+    return pad > 0 ? pad : 0;
+  }
+
+  static void Replay(TfLiteContext* context, TfLiteNode* node,
+                     const TfLiteRegistration* registration) {
+    State& state = GetState();
+    if (state.num_ops == kMaxOps) {
+      return;
+    }
+    mem_model::OpStats* op = &state.ops[state.num_ops++];
+    *op = mem_model::OpStats();
+    op->name = registration->builtin_code == tflite::BuiltinOperator_CUSTOM
+                   ? registration->custom_name
+                   : tflite::EnumNameBuiltinOperator(
+                         static_cast<tflite::BuiltinOperator>(
+                             registration->builtin_code));
+
+    const TfLiteEvalTensor* input = Tensor(context, node->inputs, 0);
+    const TfLiteEvalTensor* filter = Tensor(context, node->inputs, 1);
+    const TfLiteEvalTensor* bias = Tensor(context, node->inputs, 2);
+    const TfLiteEvalTensor* output = Tensor(context, node->outputs, 0);
+    if (input == nullptr || output == nullptr) {
+      return;
+    }
+
+    switch (registration->builtin_code) {
+      case tflite::BuiltinOperator_CONV_2D:
+      case tflite::BuiltinOperator_DEPTHWISE_CONV_2D: {
+        if (filter == nullptr || input->dims->size != 4 ||
+            output->dims->size != 4) {
+          break;
+        }
+        bool depthwise = registration->builtin_code ==
+                         tflite::BuiltinOperator_DEPTHWISE_CONV_2D;
+        int stride_h, stride_w;
+        TfLitePadding padding;
+        if (depthwise) {
+          const TfLiteDepthwiseConvParams* params =
+              static_cast<const TfLiteDepthwiseConvParams*>(
+                  node->builtin_data);
+          stride_h = params->stride_height;
+          stride_w = params->stride_width;
+          padding = params->padding;
+        } else {
+          const TfLiteConvParams* params =
+              static_cast<const TfLiteConvParams*>(node->builtin_data);
+          stride_h = params->stride_height;
+          stride_w = params->stride_width;
+          padding = params->padding;
+        }
+        const int kernel_h = Dim(filter, 1);
+        const int kernel_w = Dim(filter, 2);
+        const int out_h = Dim(output, 1);
+        const int out_w = Dim(output, 2);
+        const int pad_h = Padding(padding, Dim(input, 1), out_h, stride_h,
+                                  kernel_h);
+        const int pad_w = Padding(padding, Dim(input, 2), out_w, stride_w,
+                                  kernel_w);
+        const size_t out_depth = Dim(output, 3);
+        // GEMM of CMSIS-NN convolution takes two output pixels at a time
+        const int pixels = depthwise ? 1 : 2;
+
+        for (int oy = 0; oy < out_h; oy++) {
+          for (int ox = 0; ox < out_w; ox += pixels) {
+            for (int k = 0; k < pixels && ox + k < out_w; k++) {
+              TouchPatch(input, oy, ox + k, stride_h, stride_w, pad_h, pad_w,
+                         kernel_h, kernel_w, op);
+            }
+            Touch(filter->data.raw, Bytes(filter), op);
+            Touch(bias ? bias->data.raw : nullptr, Bytes(bias), op);
+            int count = ox + pixels <= out_w ? pixels : out_w - ox;
+            Touch(output->data.int8 + (oy * out_w + ox) * out_depth,
+                  count * out_depth, op);
+          }
+        }
+        break;
+      }
+
+      case tflite::BuiltinOperator_FULLY_CONNECTED: {
+        if (filter == nullptr) {
+          break;
+        }
+        const int rows = Dim(output, 0);
+        const size_t row_bytes = Bytes(input) / (rows ? rows : 1);
+        const size_t out_bytes = Bytes(output) / (rows ? rows : 1);
+        for (int row = 0; row < rows; row++) {
+          Touch(input->data.int8 + row * row_bytes, row_bytes, op);
+          Touch(filter->data.raw, Bytes(filter), op);
+          Touch(bias ? bias->data.raw : nullptr, Bytes(bias), op);
+          Touch(output->data.int8 + row * out_bytes, out_bytes, op);
+        }
+        break;
+      }
+
+      default:
+        for (int i = 0; i < node->inputs->size; i++) {
+          const TfLiteEvalTensor* tensor = Tensor(context, node->inputs, i);
+          Touch(tensor ? tensor->data.raw : nullptr, Bytes(tensor), op);
+        }
+        Touch(output->data.raw, Bytes(output), op);
+        break;
+    }
+  }
+
+  static void Print(int index, const mem_model::OpStats& op) {
+    if (index >= 0) {
+      printf("%-3d ", index);
+    } else {
+      printf("%-3s ", "");
+    }
+    printf("%-18s %9.1f %9.1f", op.name ? op.name : "-",
+           op.arena_bytes / 1024.0, op.flash_bytes / 1024.0);
+    for (int p = 0; p < mem_model::kPlacements; p++) {
+      printf(" %10llu", static_cast<unsigned long long>(op.stalls[p]));
+    }
+    printf("\n");
+  }
+
+  const tflite::MicroOpResolver& base_;
+};
+
+#endif  // MEM_MODEL_H
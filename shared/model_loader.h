@@ -0,0 +1,162 @@
+#ifndef MODEL_LOADER_H
+#define MODEL_LOADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "flatbuffers/flatbuffers.h"
+#include "tensorflow/lite/core/api/error_reporter.h"
+#include "tensorflow/lite/schema/schema_generated.h"
+#include "tensorflow/lite/version.h"
+
+#if __has_include("pff.h")
+#include "pff.h"
+#define MODEL_LOADER_PFF
+#elif __has_include("PetitFatFS/pff.h")
+#include "PetitFatFS/pff.h"
+#define MODEL_LOADER_PFF
+#endif
+
+// Loads .tflite model into RAM at boot instead of using C array in flash.
+//
+// File is read in large chunks straight into caller's buffer, then whole
+// flatbuffer is run through the verifier generated from the schema and
+// schema version is checked, so a truncated or wrong file is reported
+// before the interpreter dereferences any offset from it.
+//
+// Placement: interpreter reads weights sequentially once per inference,
+// so the buffer belongs into AXI SRAM (SRAM1/SRAM2), where D-cache hides
+// most of the latency. Keep DTCM for the tensor arena, activations are
+// accessed far more often than weights. ART accelerator only caches flash,
+// it does nothing for a model in RAM; a model that has to stay in flash is
+// still fastest through the ITCM alias, see power_test fastflash.h.
+// Buffer has to be 16 byte aligned, flatbuffer tables require it.
+//
+// Reading is abstracted with a callback, PetitFatFS adapter is included
+// when pff.h is on the include path.
+//
+// Usage example:
+// alignas(16) static uint8_t model_buffer[300 * 1024];
+// pf_mount(&file_system);
+// const tflite::Model* model = model_load_pff(
+//     &file_system, "model.tfl", model_buffer, sizeof(model_buffer),
+//     error_reporter);
+// if (model == nullptr) { ...fall back to model in flash... }
+
+// Size of one read, whole sectors keep PetitFatFS on its DMA path
+#define MODEL_LOADER_CHUNK      (16 * 512)
+
+// Reads up to len bytes into dst, returns number of bytes read or -1
+typedef int32_t (*model_read_fn)(void* context, uint8_t* dst, uint32_t len);
+
+/*!
+ * @brief                   Verifies flatbuffer that is already in memory
+ *
+ * @param[in] data          Model flatbuffer
+ * @param[in] size          Size of model in bytes
+ * @param[in] reporter      Error reporter
+ *
+ * @return                  Model or nullptr if verification failed
+ */
+static inline const tflite::Model* model_verify(
+    const uint8_t* data, size_t size, tflite::ErrorReporter* reporter) {
+  if (reinterpret_cast<uintptr_t>(data) % 16 != 0) {
+    TF_LITE_REPORT_ERROR(reporter, "Model buffer is not 16 byte aligned");
+    return nullptr;
+  }
+
+  flatbuffers::Verifier verifier(data, size);
+  if (!tflite::VerifyModelBuffer(verifier)) {
+    TF_LITE_REPORT_ERROR(reporter, "Model of %d bytes failed verification",
+                         static_cast<int>(size));
+    return nullptr;
+  }
+
+  const tflite::Model* model = tflite::GetModel(data);
+  if (model->version() != TFLITE_SCHEMA_VERSION) {
+    TF_LITE_REPORT_ERROR(reporter,
+                         "Model provided is schema version %d not equal "
+                         "to supported version %d.",
+                         model->version(), TFLITE_SCHEMA_VERSION);
+    return nullptr;
+  }
+  return model;
+}
+
+/*!
+ * @brief                   Reads model with callback and verifies it
+ *
+ * @param[in] read          Reads next part of the file
+ * @param[in] context       Passed to read
+ * @param[in] size          Size of the file in bytes
+ * @param[out] buffer       Where model is placed
+ * @param[in] buffer_size   Size of buffer in bytes
+ * @param[in] reporter      Error reporter
+ *
+ * @return                  Model or nullptr on error
+ */
+static inline const tflite::Model* model_load(
+    model_read_fn read, void* context, uint32_t size, uint8_t* buffer,
+    size_t buffer_size, tflite::ErrorReporter* reporter) {
+  if (size > buffer_size) {
+    TF_LITE_REPORT_ERROR(reporter, "Model of %d bytes does not fit into %d",
+                         static_cast<int>(size),
+                         static_cast<int>(buffer_size));
+    return nullptr;
+  }
+
+  uint32_t loaded = 0;
+  while (loaded < size) {
+    uint32_t len = size - loaded;
+    if (len > MODEL_LOADER_CHUNK) {
+      len = MODEL_LOADER_CHUNK;
+    }
+    int32_t n = read(context, buffer + loaded, len);
+    if (n <= 0) {
+      TF_LITE_REPORT_ERROR(reporter, "Model read failed at byte %d",
+                           static_cast<int>(loaded));
+      return nullptr;
+    }
+    loaded += n;
+  }
+
+  return model_verify(buffer, size, reporter);
+}
+
+#ifdef MODEL_LOADER_PFF
+static inline int32_t model_read_pff(void* context, uint8_t* dst,
+                                     uint32_t len) {
+  (void)context;
+  UINT read = 0;
+  if (pf_read(dst, len, &read) != FR_OK) {
+    return -1;
+  }
+  return read;
+}
+
+/*!
+ * @brief                   Loads model from SD card with PetitFatFS
+ *
+ * @param[in] fs            File system mounted with pf_mount()
+ * @param[in] path          Path to .tflite file
+ * @param[out] buffer       Where model is placed, 16 byte aligned
+ * @param[in] buffer_size   Size of buffer in bytes
+ * @param[in] reporter      Error reporter
+ *
+ * @return                  Model or nullptr on error
+ *
+ * @note                    PetitFatFS has no long file names, use 8.3 name.
+ */
+static inline const tflite::Model* model_load_pff(
+    FATFS* fs, const char* path, uint8_t* buffer, size_t buffer_size,
+    tflite::ErrorReporter* reporter) {
+  if (pf_open(path) != FR_OK) {
+    TF_LITE_REPORT_ERROR(reporter, "Can not open %s", path);
+    return nullptr;
+  }
+  return model_load(model_read_pff, nullptr, fs->fsize, buffer, buffer_size,
+                    reporter);
+}
+#endif
+
+#endif  // MODEL_LOADER_H
@@ -0,0 +1,326 @@
+#ifndef MOTION_GATE_H
+#define MOTION_GATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "frame_convert.h"
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#include "cmsis_gcc.h"
+#define MOTION_GATE_SIMD
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Cheap pre-filter that decides if a frame is worth classifying.
+// Frame is downsampled into MOTION_BLOCK x MOTION_BLOCK blocks, sum of each
+// block is compared with the same block of a slowly adapting background.
+// Frame is active when enough blocks changed by more than the threshold.
+// Block sums are computed with USADA8, four pixels per instruction.
+// For 80x60 frame this is 300 blocks and around 2000 cycles.
+//
+// Usage example:
+// static motion_gate_t gate;
+// motion_config_t config = motion_gate_default_config();
+// motion_gate_init(&gate, 80, 60, &config);
+// load_data(input, frame);
+// if (motion_gate_check(&gate, input->data.int8)) { ...Invoke()... }
+//
+// Changed blocks of the last frame are kept, motion_gate_regions() groups
+// touching ones and returns their bounding boxes, so that only parts of
+// the frame with something moving in them can be classified.
+
+#define MOTION_BLOCK        4
+#ifndef MOTION_MAX_BLOCKS
+#define MOTION_MAX_BLOCKS   ((80 / MOTION_BLOCK) * (60 / MOTION_BLOCK))
+#endif
+#define MOTION_MAX_REGIONS  8
+
+typedef struct
+{
+    uint16_t block_threshold;   // Mean change of block pixels, 0..255
+    uint16_t min_blocks;        // Changed blocks for frame to be active
+    uint8_t adapt_shift;        // Background follows with 1/2^shift
+    uint16_t max_skipped;       // Frame is active after that many idle
+                                // ones anyway, 0 to never force it
+}motion_config_t;
+
+typedef struct
+{
+    motion_config_t config;
+    uint16_t cols;
+    uint16_t rows;
+    bool has_background;
+    uint16_t skipped;           // Idle frames since the last active one
+    uint16_t active_blocks;     // Changed blocks of the last frame
+    uint16_t background[MOTION_MAX_BLOCKS];
+    uint8_t changed[MOTION_MAX_BLOCKS]; // Blocks of the last frame, 0 or 1
+}motion_gate_t;
+
+/*!
+ * @brief   Returns thresholds that work for AGC output of Lepton, 
+ *          background takes 8 frames to follow a change
+ */
+static inline motion_config_t motion_gate_default_config()
+{
+    motion_config_t config;
+    config.block_threshold = 8;
+    config.min_blocks = 3;
+    config.adapt_shift = 3;
+    config.max_skipped = 100;
+    return config;
+}
+
+/*!
+ * @brief                   Prepares gate for frames of given size
+ *
+ * @param[out] gate
+ * @param[in] cols          Multiple of MOTION_BLOCK
+ * @param[in] rows          Multiple of MOTION_BLOCK
+ * @param[in] config        Thresholds, copied into gate
+ *
+ * @return                  False if frame has too many blocks
+ */
+static inline bool motion_gate_init(motion_gate_t * gate,
+                                    uint16_t cols,
+                                    uint16_t rows,
+                                    const motion_config_t * config)
+{
+    if ((cols / MOTION_BLOCK) * (rows / MOTION_BLOCK) > MOTION_MAX_BLOCKS)
+    {
+        return false;
+    }
+
+    gate->config = *config;
+    gate->cols = cols;
+    gate->rows = rows;
+    gate->has_background = false;
+    gate->skipped = 0;
+    gate->active_blocks = 0;
+    return true;
+}
+
+/*!
+ * @brief                   Forgets background, next frame is active
+ *
+ * @note                    Use it when scene changes on purpose, for
+ *                          example after FFC.
+ */
+static inline void motion_gate_reset(motion_gate_t * gate)
+{
+    gate->has_background = false;
+}
+
+/*!
+ * @brief                   Returns sum of one block of int8 pixels, each
+ *                          pixel is moved into 0..255 range
+ */
+static inline uint32_t motion_block_sum(const int8_t * image, uint16_t cols)
+{
+    uint32_t sum = 0;
+
+    for (uint8_t row = 0; row < MOTION_BLOCK; row++)
+    {
+        const int8_t * src = image + row * cols;
+#if defined(MOTION_GATE_SIMD) && (MOTION_BLOCK == 4)
+        uint32_t packed;
+        memcpy(&packed, src, 4);
+
+        // Flipping sign bit gives unsigned pixel, USADA8 with zero adds
+        // four bytes to the sum
+        sum = __USADA8(packed ^ 0x80808080u, 0, sum);
+#else
+        for (uint8_t col = 0; col < MOTION_BLOCK; col++)
+        {
+            sum += (uint8_t) (src[col] ^ 0x80);
+        }
+#endif
+    }
+    return sum;
+}
+
+/*!
+ * @brief                   Compares frame with background and updates it
+ *
+ * @param[in] gate
+ * @param[in] image         Quantized int8 frame, for example input tensor
+ *
+ * @return                  True if frame should be classified
+ */
+static inline bool motion_gate_check(motion_gate_t * gate,
+                                     const int8_t * image)
+{
+    const uint16_t block_cols = gate->cols / MOTION_BLOCK;
+    const uint16_t block_rows = gate->rows / MOTION_BLOCK;
+    const int32_t threshold = gate->config.block_threshold *
+                              MOTION_BLOCK * MOTION_BLOCK;
+    uint16_t active = 0;
+    uint16_t * background = gate->background;
+
+    for (uint16_t by = 0; by < block_rows; by++)
+    {
+        const int8_t * src = image + by * MOTION_BLOCK * gate->cols;
+
+        for (uint16_t bx = 0; bx < block_cols; bx++)
+        {
+            int32_t sum = motion_block_sum(src + bx * MOTION_BLOCK,
+                                           gate->cols);
+
+            uint8_t * changed = &gate->changed[by * block_cols + bx];
+            if (!gate->has_background)
+            {
+                *background++ = sum;
+                *changed = 0;
+                continue;
+            }
+
+            int32_t diff = sum - *background;
+            *changed = diff >= threshold || -diff >= threshold;
+            active += *changed;
+
+            // Slow changes, like sun heating the landscape, are absorbed
+            *background++ += diff >> gate->config.adapt_shift;
+        }
+    }
+
+    gate->active_blocks = active;
+
+    if (!gate->has_background)
+    {
+        gate->has_background = true;
+        gate->skipped = 0;
+        return true;
+    }
+
+    if (active >= gate->config.min_blocks ||
+        (gate->config.max_skipped &&
+         gate->skipped >= gate->config.max_skipped))
+    {
+        gate->skipped = 0;
+        return true;
+    }
+
+    gate->skipped++;
+    return false;
+}
+
+/*!
+ * @brief                   Groups changed blocks of the last frame into
+ *                          regions, blocks that share an edge belong to the
+ *                          same region
+ *
+ * @param[in] gate
+ * @param[out] rois         Bounding boxes in pixels, largest regions first
+ * @param[in] max_rois     At most MOTION_MAX_REGIONS
+ * @param[in] min_blocks    Smaller regions are dropped as noise
+ *
+ * @return                  Number of regions written into rois
+ *
+ * @note                    Marks blocks as visited, call it once after each
+ *                          motion_gate_check().
+ */
+static inline uint8_t motion_gate_regions(motion_gate_t * gate,
+                                          frame_roi_t * rois,
+                                          uint8_t max_rois,
+                                          uint16_t min_blocks)
+{
+    const uint16_t block_cols = gate->cols / MOTION_BLOCK;
+    const uint16_t blocks = block_cols * (gate->rows / MOTION_BLOCK);
+    uint16_t sizes[MOTION_MAX_REGIONS];
+    uint16_t stack[MOTION_MAX_BLOCKS];
+    uint8_t found = 0;
+
+    if (max_rois > MOTION_MAX_REGIONS)
+    {
+        max_rois = MOTION_MAX_REGIONS;
+    }
+
+    for (uint16_t start = 0; start < blocks; start++)
+    {
+        if (gate->changed[start] != 1)
+        {
+            continue;
+        }
+
+        // Flood fill, each block is pushed once because it is marked first
+        uint16_t x0 = block_cols, y0 = gate->rows, x1 = 0, y1 = 0;
+        uint16_t size = 0;
+        uint16_t top = 0;
+
+        gate->changed[start] = 2;
+        stack[top++] = start;
+        while (top)
+        {
+            uint16_t i = stack[--top];
+            uint16_t bx = i % block_cols;
+            uint16_t by = i / block_cols;
+
+            size++;
+            x0 = bx < x0 ? bx : x0;
+            x1 = bx > x1 ? bx : x1;
+            y0 = by < y0 ? by : y0;
+            y1 = by > y1 ? by : y1;
+
+            if (bx > 0 && gate->changed[i - 1] == 1)
+            {
+                gate->changed[i - 1] = 2;
+                stack[top++] = i - 1;
+            }
+            if (bx + 1 < block_cols && gate->changed[i + 1] == 1)
+            {
+                gate->changed[i + 1] = 2;
+                stack[top++] = i + 1;
+            }
+            if (i >= block_cols && gate->changed[i - block_cols] == 1)
+            {
+                gate->changed[i - block_cols] = 2;
+                stack[top++] = i - block_cols;
+            }
+            if (i + block_cols < blocks &&
+                gate->changed[i + block_cols] == 1)
+            {
+                gate->changed[i + block_cols] = 2;
+                stack[top++] = i + block_cols;
+            }
+        }
+
+        if (size < min_blocks || !max_rois)
+        {
+            continue;
+        }
+
+        // Keeps regions sorted by size, smallest one falls out when full
+        uint8_t pos = found < max_rois ? found++ : max_rois;
+        if (pos == max_rois)
+        {
+            if (size <= sizes[max_rois - 1])
+            {
+                continue;
+            }
+            pos = max_rois - 1;
+        }
+        while (pos > 0 && sizes[pos - 1] < size)
+        {
+            sizes[pos] = sizes[pos - 1];
+            rois[pos] = rois[pos - 1];
+            pos--;
+        }
+
+        sizes[pos] = size;
+        rois[pos].x = x0 * MOTION_BLOCK;
+        rois[pos].y = y0 * MOTION_BLOCK;
+        rois[pos].w = (x1 - x0 + 1) * MOTION_BLOCK;
+        rois[pos].h = (y1 - y0 + 1) * MOTION_BLOCK;
+    }
+    return found;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MOTION_GATE_H */
+/*** end of file ***/
@@ -0,0 +1,95 @@
+#ifndef OUTPUT_SCORES_H
+#define OUTPUT_SCORES_H
+
+#include <stdint.h>
+
+#include "tensorflow/lite/c/common.h"
+
+// Reads class scores from output tensor of a classifier.
+//
+// Models without trailing Dequantize, see strip_dequantize.py, have int8
+// output, scores are then converted with output->params in fixed point,
+// so neither float arithmetic nor float printf is needed. Float outputs of
+// models that still end with Dequantize are read too, so application works
+// with both kinds.
+//
+// Scores are in per mille, 1000 is probability 1.0.
+//
+// Usage example:
+// static OutputScores scores;
+// if (!scores.Bind(engine.output())) return;
+// engine.Invoke();
+// scores.Format(buf, sizeof(buf), 4);  // "0.996 0.000 0.004 0.000"
+class OutputScores {
+ public:
+  // Returns false for output types other than int8 and float32
+  bool Bind(const TfLiteTensor* output) {
+    output_ = output;
+    if (output->type == kTfLiteInt8) {
+      // Per mille in Q16, computed once per model
+      zero_point_ = output->params.zero_point;
+      multiplier_ = static_cast<int32_t>(
+          output->params.scale * 1000.0f * 65536.0f + 0.5f);
+      return true;
+    }
+    return output->type == kTfLiteFloat32;
+  }
+
+  bool quantized() const { return output_->type == kTfLiteInt8; }
+
+  // Number of elements in the last dimension
+  int count() const { return output_->dims->data[output_->dims->size - 1]; }
+
+  int32_t Milli(int index) const {
+    if (output_->type == kTfLiteInt8) {
+      int64_t value = output_->data.int8[index] - zero_point_;
+      return static_cast<int32_t>((value * multiplier_ + (1 << 15)) >> 16);
+    }
+    return static_cast<int32_t>(output_->data.f[index] * 1000.0f);
+  }
+
+  // Writes first count scores separated by space, output is always
+  // terminated, returns its length. Digits are written here, projects
+  // have their own printf and this works with any of them.
+  int Format(char* buf, int max_len, int count) const {
+    int32_t milli[kMaxScores];
+    if (count > kMaxScores) count = kMaxScores;
+    for (int i = 0; i < count; i++) milli[i] = Milli(i);
+    return FormatMilli(buf, max_len, milli, count);
+  }
+
+  // Same as Format() for scores that were kept, for example per region
+  static int FormatMilli(char* buf, int max_len, const int32_t* milli,
+                         int count) {
+    // Longest score is " -2147483.648"
+    char digits[16];
+    int len = 0;
+    if (max_len <= 0) return 0;
+
+    for (int i = 0; i < count; i++) {
+      uint32_t value = milli[i] < 0 ? -milli[i] : milli[i];
+      int n = 0;
+      while (n < 4 || value) {
+        if (n == 3) digits[n++] = '.';
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+      }
+      if (milli[i] < 0) digits[n++] = '-';
+      if (i) digits[n++] = ' ';
+
+      if (len + n >= max_len) break;
+      while (n) buf[len++] = digits[--n];
+    }
+    buf[len] = '\0';
+    return len;
+  }
+
+  static constexpr int kMaxScores = 16;
+
+ private:
+  const TfLiteTensor* output_ = nullptr;
+  int32_t zero_point_ = 0;
+  int32_t multiplier_ = 0;
+};
+
+#endif  // OUTPUT_SCORES_H
@@ -129,6 +129,14 @@ typedef struct {
 } out_fct_wrap_type;
 
 
+// wrapper (used as buffer) for ring buffer output, size is a power of two
+typedef struct {
+  char*  ring;
+  size_t mask;
+  size_t start;
+} out_ring_wrap_type;
+
+
 // internal buffer output
 static inline void _out_buffer(char character, void* buffer, size_t idx, size_t maxlen)
 {
@@ -138,6 +146,17 @@ static inline void _out_buffer(char character, void* buffer, size_t idx, size_t
 }
 
 
+// internal ring buffer output, maxlen is free space plus one for the
+// terminating null, which is not stored
+static inline void _out_ring(char character, void* buffer, size_t idx, size_t maxlen)
+{
+  if (idx + 1U < maxlen) {
+    const out_ring_wrap_type* wrap = (const out_ring_wrap_type*)buffer;
+    wrap->ring[(wrap->start + idx) & wrap->mask] = character;
+  }
+}
+
+
 // internal null output
 static inline void _out_null(char character, void* buffer, size_t idx, size_t maxlen)
 {
@@ -335,6 +354,87 @@ static size_t _etoa(out_fct_type out, char* buffer, size_t idx, size_t maxlen, d
 #endif
 
 
+// powers of 10 that fit into 32 bits, for the integer path of _ftoa
+static const uint32_t _pow10_u32[] = { 1U, 10U, 100U, 1000U, 10000U, 100000U, 1000000U, 10000000U, 100000000U, 1000000000U };
+
+
+// internal split of a double into whole part and prec (max 9) rounded
+// fraction digits with integer math only, without software double
+// routines on cores that only have a single precision FPU
+// Fraction is taken as 64 bit fixed point number, rounding is the same as
+// of the double path below. Values below 2^-12 lose bits after 64 bits of
+// fraction, these only matter to rounding of an exact tie.
+// \return false for nan, inf and values of 2^28 and more, which take the double path
+static bool _ftoa_fixed(double value, unsigned int prec, bool* negative, unsigned int* whole, unsigned long* frac)
+{
+  union {
+    double   value;
+    uint64_t bits;
+  } conv;
+  conv.value = value;
+
+  const int exp2 = (int)((conv.bits >> 52U) & 0x7FFU);
+  const uint64_t mantissa = conv.bits & ((1ULL << 52U) - 1U);
+  if ((exp2 == 0x7FF) || (exp2 - 1023 >= 28)) {
+    return false;
+  }
+
+  // -0.0 is printed without sign, like by the double path
+  *negative = (conv.bits >> 63U) && (exp2 || mantissa);
+
+  // value is m / 2^shift, shift is at least 24 here
+  uint64_t m = mantissa;
+  unsigned int shift = 1074U;
+  if (exp2) {
+    m |= 1ULL << 52U;
+    shift = (unsigned int)(1075 - exp2);
+  }
+
+  uint64_t fraction;
+  bool sticky = false;
+  if (shift < 64U) {
+    *whole = (unsigned int)(m >> shift);
+    fraction = (m & ((1ULL << shift) - 1U)) << (64U - shift);
+  }
+  else {
+    *whole = 0U;
+    if (shift - 64U >= 64U) {
+      fraction = 0U;
+      sticky = (m != 0U);
+    }
+    else {
+      fraction = m >> (shift - 64U);
+      sticky = (m & ((1ULL << (shift - 64U)) - 1U)) != 0U;
+    }
+  }
+
+  // fraction * 10^prec as 32.64 fixed point, two 32x32 multiplies
+  const uint32_t pow10 = _pow10_u32[prec];
+  const uint64_t low = (uint64_t)(uint32_t)fraction * pow10;
+  const uint64_t high = (fraction >> 32U) * pow10 + (low >> 32U);
+  const uint64_t rest = (high << 32U) | (uint32_t)low;
+  const uint64_t half = 1ULL << 63U;
+  *frac = (unsigned long)(high >> 32U);
+
+  if (prec == 0U) {
+    // 1.5 -> 2, but 2.5 -> 2
+    if ((rest > half) || ((rest == half) && (sticky || (*whole & 1U)))) {
+      ++*whole;
+    }
+    *frac = 0U;
+  }
+  else if ((rest > half) || ((rest == half) && (sticky || (*frac == 0U) || (*frac & 1U)))) {
+    ++*frac;
+    // handle rollover, e.g. case 0.99 with prec 1 is 1.0
+    if (*frac >= pow10) {
+      *frac = 0U;
+      ++*whole;
+    }
+  }
+  return true;
+}
+
+
 // internal ftoa for fixed decimal floating point
 static size_t _ftoa(out_fct_type out, char* buffer, size_t idx, size_t maxlen, double value, unsigned int prec, unsigned int width, unsigned int flags)
 {
@@ -345,70 +445,79 @@ static size_t _ftoa(out_fct_type out, char* buffer, size_t idx, size_t maxlen, d
   // powers of 10
   static const double pow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
 
-  // test for special values
-  if (value != value)
-    return _out_rev(out, buffer, idx, maxlen, "nan", 3, width, flags);
-  if (value < -DBL_MAX)
-    return _out_rev(out, buffer, idx, maxlen, "fni-", 4, width, flags);
-  if (value > DBL_MAX)
-    return _out_rev(out, buffer, idx, maxlen, (flags & FLAGS_PLUS) ? "fni+" : "fni", (flags & FLAGS_PLUS) ? 4U : 3U, width, flags);
-
-  // test for very large values
-  // standard printf behavior is to print EVERY whole number digit -- which could be 100s of characters overflowing your buffers == bad
-  if ((value > PRINTF_MAX_FLOAT) || (value < -PRINTF_MAX_FLOAT)) {
+  // set default precision, if not set explicitly
+  if (!(flags & FLAGS_PRECISION)) {
+    prec = PRINTF_DEFAULT_FLOAT_PRECISION;
+  }
+
+  bool negative = false;
+  unsigned int whole = 0U;
+  unsigned long frac = 0U;
+  const bool fixed = _ftoa_fixed(value, (prec > 9U) ? 9U : prec, &negative, &whole, &frac);
+  if (!fixed) {
+    // test for special values
+    if (value != value)
+      return _out_rev(out, buffer, idx, maxlen, "nan", 3, width, flags);
+    if (value < -DBL_MAX)
+      return _out_rev(out, buffer, idx, maxlen, "fni-", 4, width, flags);
+    if (value > DBL_MAX)
+      return _out_rev(out, buffer, idx, maxlen, (flags & FLAGS_PLUS) ? "fni+" : "fni", (flags & FLAGS_PLUS) ? 4U : 3U, width, flags);
+
+    // test for very large values
+    // standard printf behavior is to print EVERY whole number digit -- which could be 100s of characters overflowing your buffers == bad
+    if ((value > PRINTF_MAX_FLOAT) || (value < -PRINTF_MAX_FLOAT)) {
 #if defined(PRINTF_SUPPORT_EXPONENTIAL)
-    return _etoa(out, buffer, idx, maxlen, value, prec, width, flags);
+      return _etoa(out, buffer, idx, maxlen, value, prec, width, flags);
 #else
-    return 0U;
+      return 0U;
 #endif
-  }
+    }
 
-  // test for negative
-  bool negative = false;
-  if (value < 0) {
-    negative = true;
-    value = 0 - value;
+    // test for negative
+    if (value < 0) {
+      negative = true;
+      value = 0 - value;
+    }
   }
 
-  // set default precision, if not set explicitly
-  if (!(flags & FLAGS_PRECISION)) {
-    prec = PRINTF_DEFAULT_FLOAT_PRECISION;
-  }
   // limit precision to 9, cause a prec >= 10 can lead to overflow errors
   while ((len < PRINTF_FTOA_BUFFER_SIZE) && (prec > 9U)) {
     buf[len++] = '0';
     prec--;
   }
 
-  int whole = (int)value;
-  double tmp = (value - whole) * pow10[prec];
-  unsigned long frac = (unsigned long)tmp;
-  diff = tmp - frac;
-
-  if (diff > 0.5) {
-    ++frac;
-    // handle rollover, e.g. case 0.99 with prec 1 is 1.0
-    if (frac >= pow10[prec]) {
-      frac = 0;
-      ++whole;
+  if (!fixed) {
+    whole = (unsigned int)value;
+    double tmp = (value - whole) * pow10[prec];
+    frac = (unsigned long)tmp;
+    diff = tmp - frac;
+
+    if (diff > 0.5) {
+      ++frac;
+      // handle rollover, e.g. case 0.99 with prec 1 is 1.0
+      if (frac >= pow10[prec]) {
+        frac = 0;
+        ++whole;
+      }
+    }
+    else if (diff < 0.5) {
+    }
+    else if ((frac == 0U) || (frac & 1U)) {
+      // if halfway, round up if odd OR if last digit is 0
+      ++frac;
     }
-  }
-  else if (diff < 0.5) {
-  }
-  else if ((frac == 0U) || (frac & 1U)) {
-    // if halfway, round up if odd OR if last digit is 0
-    ++frac;
-  }
 
-  if (prec == 0U) {
-    diff = value - (double)whole;
-    if ((!(diff < 0.5) || (diff > 0.5)) && (whole & 1)) {
-      // exactly 0.5 and ODD, then round up
-      // 1.5 -> 2, but 2.5 -> 2
-      ++whole;
+    if (prec == 0U) {
+      diff = value - (double)whole;
+      if ((!(diff < 0.5) || (diff > 0.5)) && (whole & 1)) {
+        // exactly 0.5 and ODD, then round up
+        // 1.5 -> 2, but 2.5 -> 2
+        ++whole;
+      }
     }
   }
-  else {
+
+  if (prec != 0U) {
     unsigned int count = prec;
     // now do fractional part, as an unsigned number
     while (len < PRINTF_FTOA_BUFFER_SIZE) {
@@ -863,8 +972,7 @@ int printf_(const char* format, ...)
 {
   va_list va;
   va_start(va, format);
-  char buffer[1];
-  const int ret = _vsnprintf(_out_char, buffer, (size_t)-1, format, va);
+  const int ret = vprintf_(format, va);
   va_end(va);
   return ret;
 }
@@ -890,7 +998,9 @@ int snprintf_(char* buffer, size_t count, const char* format, ...)
 }
 
 
-int vprintf_(const char* format, va_list va)
+// weak, so a project can send whole printf() output at once, for example
+// with vsnprintf_ring() straight into its UART transmit buffer
+__attribute__((weak)) int vprintf_(const char* format, va_list va)
 {
   char buffer[1];
   return _vsnprintf(_out_char, buffer, (size_t)-1, format, va);
@@ -907,8 +1017,21 @@ int fctprintf(void (*out)(char character, void* arg), void* arg, const char* for
 {
   va_list va;
   va_start(va, format);
-  const out_fct_wrap_type out_fct_wrap = { out, arg };
-  const int ret = _vsnprintf(_out_fct, (char*)(uintptr_t)&out_fct_wrap, (size_t)-1, format, va);
+  const int ret = vfctprintf(out, arg, format, va);
   va_end(va);
   return ret;
 }
+
+
+int vfctprintf(void (*out)(char character, void* arg), void* arg, const char* format, va_list va)
+{
+  const out_fct_wrap_type out_fct_wrap = { out, arg };
+  return _vsnprintf(_out_fct, (char*)(uintptr_t)&out_fct_wrap, (size_t)-1, format, va);
+}
+
+
+int vsnprintf_ring(char* ring, size_t size, size_t start, size_t count, const char* format, va_list va)
+{
+  const out_ring_wrap_type out_ring_wrap = { ring, size - 1U, start };
+  return _vsnprintf(_out_ring, (char*)(uintptr_t)&out_ring_wrap, count + 1U, format, va);
+}
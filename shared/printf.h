@@ -107,6 +107,24 @@ int vprintf_(const char* format, va_list va);
  * \return The number of characters that are sent to the output function, not counting the terminating null character
  */
 int fctprintf(void (*out)(char character, void* arg), void* arg, const char* format, ...);
+int vfctprintf(void (*out)(char character, void* arg), void* arg, const char* format, va_list va);
+
+
+/**
+ * vsnprintf into a ring buffer, for example transmit buffer of UART
+ * Characters are stored from index start on and wrap around at the end. Terminating null
+ * character can be written into free space behind them, it is not counted. Caller moves its
+ * head by the returned length once it fits.
+ * \param ring Ring buffer, its size has to be a power of two
+ * \param size Size of the ring buffer
+ * \param start Index where the first character is stored, it is masked with size - 1
+ * \param count The maximum number of characters to store, free space of the ring buffer
+ * \param format A string that specifies the format of the output
+ * \param va A value identifying a variable arguments list
+ * \return The number of characters that COULD have been written. A value larger than count indicates
+ *         truncation, characters are then only partly stored.
+ */
+int vsnprintf_ring(char* ring, size_t size, size_t start, size_t count, const char* format, va_list va);
 
 
 #ifdef __cplusplus
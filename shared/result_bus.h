@@ -0,0 +1,261 @@
+#ifndef RESULT_BUS_H
+#define RESULT_BUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Hands results of inference to several consumers from one ring, for
+// example binary telemetry, SD card logger, GPIO alarm and network.
+// Producer writes each record in place and publishes it, subscribers read
+// it in place too, nothing is copied per consumer and nothing is formatted
+// by the producer.
+//
+// Producer never waits for a subscriber. Ring holds the last
+// RESULT_BUS_DEPTH records, a subscriber that falls further behind skips
+// to the oldest record still held and counts the ones it missed. Record
+// that is being written is the oldest slot, claimed tells subscribers
+// which one, so a subscriber checks after reading that its record was not
+// claimed meanwhile, the same way as a sequence lock. With producer and
+// subscribers in main context that never happens, it matters for
+// subscribers in interrupts.
+//
+// Notify callback of a subscriber runs in producer context right after
+// publish, it should only do something short, set a pin or make its task
+// ready. It returns whether it is done with the record, slow subscribers
+// read later with result_bus_peek().
+//
+// Usage example:
+// static result_bus_t bus;
+// result_bus_init(&bus);
+// result_record_t * record = result_bus_claim(&bus);
+// ...fill record in...
+// result_bus_publish(&bus);
+//
+// static result_sub_t logger;
+// result_bus_subscribe(&bus, &logger, "SD", NULL, NULL);
+// const result_record_t * next;
+// while ((next = result_bus_peek(&bus, &logger)))
+// {
+//     ...write next out...
+//     result_bus_done(&bus, &logger);
+// }
+
+#define RESULT_BUS_DEPTH            (8)     // Power of two
+#define RESULT_BUS_MAX_SUBSCRIBERS  (4)
+#define RESULT_BUS_MAX_SCORES       (12)
+#define RESULT_BUS_CACHE_LINE       (32)    // D-cache line of Cortex-M7
+
+// Flags of a record
+#define RESULT_FLAG_IDLE        (1 << 0)    // Gate found nothing, no scores
+#define RESULT_FLAG_SKIPPED     (1 << 1)    // Scores of an earlier frame
+#define RESULT_FLAG_TRACKED     (1 << 2)    // Same, kept by a tracker
+#define RESULT_FLAG_LATENCY     (1 << 3)    // latency_us is known
+
+typedef struct
+{
+    uint64_t timestamp_us;      // micros() of publish
+    uint32_t sequence;          // Number of the record, from 0
+    uint32_t latency_us;        // First packet of the frame to publish
+    uint32_t invoke_us;         // Invoke() of the scores, 0 without one
+    uint8_t flags;
+    uint8_t top_class;          // Highest score, RESULT_BUS_NO_CLASS idle
+    uint8_t count;              // Valid scores
+    int8_t zero_point;          // Of the scores, as in the output tensor
+    int8_t scores[RESULT_BUS_MAX_SCORES];   // Raw int8 model output
+}result_record_t;
+
+#define RESULT_BUS_NO_CLASS     (0xFF)
+
+typedef struct result_sub result_sub_t;
+// Returns true if it is done with the record, false to read it later
+typedef bool (*result_notify_t)(result_sub_t * sub,
+                                const result_record_t * record);
+
+struct result_sub
+{
+    volatile uint32_t tail;     // Next record, subscriber only
+    uint32_t received;
+    uint32_t dropped;           // Overwritten before they were read
+    const char * name;
+    result_notify_t notify;     // Can be NULL
+    void * context;             // For notify, not touched by the bus
+};
+
+typedef struct
+{
+    result_record_t records[RESULT_BUS_DEPTH]
+        __attribute__((aligned(RESULT_BUS_CACHE_LINE)));
+    // Published records, producer only
+    volatile uint32_t head __attribute__((aligned(RESULT_BUS_CACHE_LINE)));
+    // Records given out by result_bus_claim(), head or head + 1
+    volatile uint32_t claimed;
+    result_sub_t * subs[RESULT_BUS_MAX_SUBSCRIBERS];
+    uint8_t sub_count;
+}result_bus_t;
+
+/*!
+ * @brief   Prepares empty bus without subscribers
+ *
+ * @note    Call it before anything publishes or subscribes
+ */
+static inline void result_bus_init(result_bus_t * bus)
+{
+    bus->head = 0;
+    bus->claimed = 0;
+    bus->sub_count = 0;
+}
+
+/*!
+ * @brief                   Adds subscriber, it sees records published
+ *                          from now on
+ *
+ * @param[in] bus
+ * @param[out] sub          Kept by the bus, has to stay valid
+ * @param[in] name          For reports
+ * @param[in] notify        Called after each publish, can be NULL
+ * @param[in] context       Given to notify in sub->context
+ *
+ * @return                  False if there are RESULT_BUS_MAX_SUBSCRIBERS
+ *
+ * @note                    Call from producer context
+ */
+static inline bool result_bus_subscribe(result_bus_t * bus,
+                                        result_sub_t * sub,
+                                        const char * name,
+                                        result_notify_t notify,
+                                        void * context)
+{
+    if (bus->sub_count >= RESULT_BUS_MAX_SUBSCRIBERS)
+    {
+        return false;
+    }
+
+    sub->tail = bus->head;
+    sub->received = 0;
+    sub->dropped = 0;
+    sub->name = name;
+    sub->notify = notify;
+    sub->context = context;
+    bus->subs[bus->sub_count] = sub;
+    __atomic_store_n(&bus->sub_count, bus->sub_count + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*!
+ * @brief   Producer, returns slot of the next record to be filled in place
+ *
+ * @note    Slot is the oldest record, subscribers that still read it find
+ *          out in result_bus_done(). Every claim has to be published.
+ */
+static inline result_record_t * result_bus_claim(result_bus_t * bus)
+{
+    uint32_t head = bus->head;
+    __atomic_store_n(&bus->claimed, head + 1, __ATOMIC_RELEASE);
+    // Claim is seen before any byte of the record changes
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    result_record_t * record = &bus->records[head & (RESULT_BUS_DEPTH - 1)];
+    record->sequence = head;
+    return record;
+}
+
+/*!
+ * @brief   Producer, publishes record of result_bus_claim() and calls
+ *          notify of subscribers
+ */
+static inline void result_bus_publish(result_bus_t * bus)
+{
+    uint32_t head = bus->head;
+    const result_record_t * record =
+        &bus->records[head & (RESULT_BUS_DEPTH - 1)];
+    __atomic_store_n(&bus->head, head + 1, __ATOMIC_RELEASE);
+
+    uint8_t count = __atomic_load_n(&bus->sub_count, __ATOMIC_ACQUIRE);
+    for (uint8_t i = 0; i < count; i++)
+    {
+        result_sub_t * sub = bus->subs[i];
+        // Subscriber that is up to date and done moves past it here
+        if (sub->notify && sub->notify(sub, record) && sub->tail == head)
+        {
+            __atomic_store_n(&sub->tail, head + 1, __ATOMIC_RELEASE);
+            sub->received++;
+        }
+    }
+}
+
+/*!
+ * @brief   Returns number of records published since subscriber read last
+ */
+static inline uint32_t result_bus_pending(const result_bus_t * bus,
+                                          const result_sub_t * sub)
+{
+    return __atomic_load_n(&bus->head, __ATOMIC_ACQUIRE) - sub->tail;
+}
+
+/*!
+ * @brief   Subscriber, returns the oldest record it did not read yet, to
+ *          be read in place, NULL if there is none
+ *
+ * @note    Records that were overwritten are skipped and counted as
+ *          dropped. Record stays next until result_bus_done().
+ */
+static inline const result_record_t * result_bus_peek(result_bus_t * bus,
+                                                      result_sub_t * sub)
+{
+    uint32_t head = __atomic_load_n(&bus->head, __ATOMIC_ACQUIRE);
+    uint32_t claimed = __atomic_load_n(&bus->claimed, __ATOMIC_ACQUIRE);
+    uint32_t tail = sub->tail;
+
+    if (tail == head)
+    {
+        return NULL;
+    }
+    // Oldest record that is neither overwritten nor being written
+    if (claimed - tail > RESULT_BUS_DEPTH)
+    {
+        uint32_t oldest = claimed - RESULT_BUS_DEPTH;
+        sub->dropped += oldest - tail;
+        tail = oldest;
+        sub->tail = tail;
+        if (tail == head)
+        {
+            return NULL;
+        }
+    }
+    return &bus->records[tail & (RESULT_BUS_DEPTH - 1)];
+}
+
+/*!
+ * @brief   Subscriber, moves past record of result_bus_peek()
+ *
+ * @return  False if producer claimed the record while it was read, it is
+ *          then counted as dropped and its contents are not valid
+ */
+static inline bool result_bus_done(result_bus_t * bus, result_sub_t * sub)
+{
+    // Reads of the record are done before claimed is checked
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint32_t claimed = __atomic_load_n(&bus->claimed, __ATOMIC_ACQUIRE);
+    uint32_t tail = sub->tail;
+
+    __atomic_store_n(&sub->tail, tail + 1, __ATOMIC_RELEASE);
+    if (claimed - tail > RESULT_BUS_DEPTH)
+    {
+        sub->dropped++;
+        return false;
+    }
+    sub->received++;
+    return true;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RESULT_BUS_H */
+/*** end of file ***/
@@ -0,0 +1,230 @@
+#ifndef RESULT_FILTER_H
+#define RESULT_FILTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Smooths class scores over frames, so that a single noisy frame does not
+// raise or drop an alert.
+// Scores are kept in Q8, 256 is probability 1.0, which is exactly what int8
+// softmax output holds after zero point is removed, so int8 outputs are
+// used without any float conversion.
+// Each class score follows new frames with exponential moving average.
+// Class is confirmed when its average reaches enter_score and stays
+// confirmed until it drops below exit_score, the gap is hysteresis that
+// keeps result from flickering. Once confirmed class is very sure, next
+// skip_frames frames can be skipped without running the model at all.
+//
+// Usage example:
+// static result_filter_t filter;
+// result_config_t config = result_filter_default_config();
+// result_filter_init(&filter, 4, &config);
+// if (!result_filter_skip_next(&filter)) {
+//     ...Invoke()...
+//     result_filter_update_int8(&filter, output->data.int8,
+//                               output->params.zero_point);
+// }
+
+#define RESULT_MAX_CLASSES  8
+#define RESULT_NONE         0xFF    // No class is confirmed
+
+typedef struct
+{
+    uint8_t ema_shift;          // New frame weighs 1/2^shift
+    uint8_t enter_score;        // Q8 average that confirms a class
+    uint8_t exit_score;         // Q8 average that drops confirmed class
+    uint8_t skip_score;         // Q8 average of confirmed class that skips
+    uint8_t skip_frames;        // Frames skipped, 0 to never skip
+}result_config_t;
+
+typedef struct
+{
+    result_config_t config;
+    uint8_t classes;
+    uint8_t confirmed;          // Confirmed class or RESULT_NONE
+    uint8_t skip;               // Frames left to skip
+    uint16_t score[RESULT_MAX_CLASSES];     // Averages in Q16
+}result_filter_t;
+
+/*!
+ * @brief   Returns thresholds that confirm a class after two frames 
+ *          with clear result, after five such frames four are skipped
+ */
+static inline result_config_t result_filter_default_config()
+{
+    result_config_t config;
+    config.ema_shift = 1;
+    config.enter_score = 160;
+    config.exit_score = 96;
+    config.skip_score = 230;
+    config.skip_frames = 4;
+    return config;
+}
+
+/*!
+ * @brief                   Forgets history, averages start from zero
+ *
+ * @note                    Use it when results of old frames do not apply
+ *                          any more, for example after model change.
+ */
+static inline void result_filter_reset(result_filter_t * filter)
+{
+    memset(filter->score, 0, sizeof(filter->score));
+    filter->confirmed = RESULT_NONE;
+    filter->skip = 0;
+}
+
+/*!
+ * @brief                   Prepares filter for given number of classes
+ *
+ * @param[out] filter
+ * @param[in] classes       At most RESULT_MAX_CLASSES
+ * @param[in] config        Thresholds, copied into filter
+ *
+ * @return                  False if there are too many classes
+ */
+static inline bool result_filter_init(result_filter_t * filter,
+                                      uint8_t classes,
+                                      const result_config_t * config)
+{
+    if (classes > RESULT_MAX_CLASSES)
+    {
+        return false;
+    }
+
+    filter->config = *config;
+    filter->classes = classes;
+    result_filter_reset(filter);
+    return true;
+}
+
+/*!
+ * @brief                   Adds scores of one frame to the averages and
+ *                          updates confirmed class
+ *
+ * @param[in] filter
+ * @param[in] scores        Q8 score of each class
+ */
+static inline void result_filter_update_q8(result_filter_t * filter,
+                                           const uint8_t * scores)
+{
+    uint8_t best = 0;
+
+    for (uint8_t i = 0; i < filter->classes; i++)
+    {
+        int32_t score = (int32_t) scores[i] << 8;
+
+        filter->score[i] += (score - filter->score[i]) >> 
+                            filter->config.ema_shift;
+
+        if (filter->score[i] > filter->score[best])
+        {
+            best = i;
+        }
+    }
+
+    uint8_t confirmed = filter->confirmed;
+    if (confirmed != RESULT_NONE &&
+        (filter->score[confirmed] >> 8) < filter->config.exit_score)
+    {
+        confirmed = RESULT_NONE;
+    }
+    if ((filter->score[best] >> 8) >= filter->config.enter_score)
+    {
+        confirmed = best;
+    }
+    filter->confirmed = confirmed;
+
+    if (confirmed != RESULT_NONE &&
+        (filter->score[confirmed] >> 8) >= filter->config.skip_score)
+    {
+        filter->skip = filter->config.skip_frames;
+    }
+}
+
+/*!
+ * @brief                   Adds int8 output of the model
+ *
+ * @param[in] filter
+ * @param[in] scores        Output tensor
+ * @param[in] zero_point    Zero point of output tensor
+ *
+ * @note                    Expects quantization of int8 softmax, which is
+ *                          scale 1/256, so score without zero point is
+ *                          already in Q8.
+ */
+static inline void result_filter_update_int8(result_filter_t * filter,
+                                             const int8_t * scores,
+                                             int32_t zero_point)
+{
+    uint8_t q8[RESULT_MAX_CLASSES];
+
+    for (uint8_t i = 0; i < filter->classes; i++)
+    {
+        int32_t score = scores[i] - zero_point;
+        q8[i] = score < 0 ? 0 : (score > 255 ? 255 : score);
+    }
+    result_filter_update_q8(filter, q8);
+}
+
+/*!
+ * @brief                   Adds float output, for models that still end
+ *                          with Dequantize
+ */
+static inline void result_filter_update_f32(result_filter_t * filter,
+                                            const float * scores)
+{
+    uint8_t q8[RESULT_MAX_CLASSES];
+
+    for (uint8_t i = 0; i < filter->classes; i++)
+    {
+        int32_t score = (int32_t) (scores[i] * 256.0f);
+        q8[i] = score < 0 ? 0 : (score > 255 ? 255 : score);
+    }
+    result_filter_update_q8(filter, q8);
+}
+
+/*!
+ * @brief                   Tells if next frame can be skipped, call it
+ *                          once per frame
+ *
+ * @return                  True if model does not need to run on the frame
+ */
+static inline bool result_filter_skip_next(result_filter_t * filter)
+{
+    if (filter->skip)
+    {
+        filter->skip--;
+        return true;
+    }
+    return false;
+}
+
+/*!
+ * @brief                   Returns confirmed class or RESULT_NONE
+ */
+static inline uint8_t result_filter_class(const result_filter_t * filter)
+{
+    return filter->confirmed;
+}
+
+/*!
+ * @brief                   Returns Q8 average of the class
+ */
+static inline uint8_t result_filter_score(const result_filter_t * filter,
+                                          uint8_t index)
+{
+    return filter->score[index] >> 8;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RESULT_FILTER_H */
+/*** end of file ***/
@@ -0,0 +1,111 @@
+#ifndef SHARED_ARENA_H
+#define SHARED_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tensorflow/lite/core/api/error_reporter.h"
+#include "tensorflow/lite/micro/micro_allocator.h"
+#include "tensorflow/lite/micro/simple_memory_allocator.h"
+
+// One tensor arena for several interpreters.
+//
+// MicroAllocator puts persistent data, like tensor structs and node data,
+// at the end of the arena (tail) and activations planned by greedy memory
+// planner at its start (head). Each model gets allocator over the arena up
+// to the tail of the previous model, so tails are stacked from the end and
+// heads of all models overlap at the start:
+//
+// | scratch, head of each model ... | tail of model 1 | tail of model 0 |
+//
+// Arena then needs the largest head plus sum of tails, instead of sum of
+// whole arenas. Activations of one model are only valid until another
+// model runs, so fill input right before Invoke() and read output right
+// after it, before any other model is invoked.
+//
+// Models are set up in slot order. To replace any of them, Reset() and set
+// all of them up again.
+//
+// Usage example:
+// static SharedArena<64 * 1024> arena;
+// static InferenceEngine<0, engine_ops::FullyConnected> gate;
+// static InferenceEngine<0, engine_ops::Conv2D> classifier;
+// classifier.Setup(classifier_data, arena.Allocator(reporter), reporter);
+// arena.Commit(reporter);
+// gate.Setup(gate_data, arena.Allocator(reporter), reporter);
+// arena.Commit(reporter);
+template <size_t kArenaSize, int kMaxModels = 4>
+class SharedArena {
+ public:
+  SharedArena() { Reset(); }
+
+  // Forgets all models, their interpreters must not be used afterwards
+  void Reset() {
+    models_ = 0;
+    top_ = kArenaSize;
+  }
+
+  // Returns allocator for the next model, pass it to engine Setup() and
+  // call Commit() after it. Returns nullptr when there are no free slots.
+  tflite::MicroAllocator* Allocator(tflite::ErrorReporter* reporter) {
+    if (models_ == kMaxModels) {
+      TF_LITE_REPORT_ERROR(reporter, "Shared arena has no free slot");
+      return nullptr;
+    }
+
+    memory_[models_] =
+        tflite::SimpleMemoryAllocator::Create(reporter, arena_, top_);
+    return tflite::MicroAllocator::Create(memory_[models_], reporter);
+  }
+
+  // Closes the slot of the model that was just set up, its tail is kept
+  // and the next model gets the arena below it. Returns false if head of
+  // any model does not fit below the tails any more.
+  bool Commit(tflite::ErrorReporter* reporter) {
+    size_t tail = memory_[models_]->GetTailUsedBytes();
+    // Next allocator starts aligned, tail grows down from there
+    top_ = (top_ - tail) & ~static_cast<size_t>(15);
+    models_++;
+
+    for (int i = 0; i < models_; i++) {
+      size_t head = memory_[i]->GetHeadUsedBytes();
+#ifdef ARENA_REPORT
+      TF_LITE_REPORT_ERROR(reporter, "Shared arena model %d: head %u, "
+                           "tail %u bytes", i, static_cast<unsigned>(head),
+                           static_cast<unsigned>(
+                               memory_[i]->GetTailUsedBytes()));
+#endif
+      if (head > top_) {
+        TF_LITE_REPORT_ERROR(reporter, "Shared arena: head of model %d "
+                             "needs %u bytes, only %u left below tails", i,
+                             static_cast<unsigned>(head),
+                             static_cast<unsigned>(top_));
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Checksum of tails of all committed models, which Invoke() does not
+  // change, add it to InferenceEngine::StateChecksum() of each model
+  uint32_t TailChecksum(uint32_t hash) const {
+    const uint32_t* words = reinterpret_cast<const uint32_t*>(arena_ + top_);
+    for (size_t i = 0; i < (kArenaSize - top_) / 4; i++) {
+      hash = (hash ^ words[i]) * 16777619u;
+    }
+    return hash;
+  }
+
+  // Bytes below all tails, shared by activations of all models
+  size_t scratch_bytes() const { return top_; }
+  uint8_t* arena() { return arena_; }
+
+ private:
+  int models_ = 0;
+  size_t top_ = kArenaSize;
+  tflite::SimpleMemoryAllocator* memory_[kMaxModels];
+
+  alignas(16) uint8_t arena_[kArenaSize];
+};
+
+#endif  // SHARED_ARENA_H
@@ -0,0 +1,498 @@
+#ifndef TARGET_BENCH_H
+#define TARGET_BENCH_H
+
+#include <stdint.h>
+#include <string.h>
+#include <libopencm3/cm3/common.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/flash.h>
+
+#include "cycle_profiler.h"
+#include "output_scores.h"
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/core/api/error_reporter.h"
+#include "tensorflow/lite/micro/micro_interpreter.h"
+
+// Latency benchmark of a model on the target, counterpart of host_bench.h.
+//
+// Built with "make bench", which compiles the project with TARGET_BENCH
+// defined into its own build folder, main() of the project then calls
+// target_bench_run() instead of running the application. Every inference
+// is measured with DWT cycle counter and every operator with CycleProfiler.
+// Whole measurement is done twice, first with I-cache and D-cache off and
+// then with both on. With sweep set in TargetBenchConfig it is done for
+// all 16 combinations of I-cache, D-cache, ART accelerator and flash
+// prefetch instead. State from before is restored afterwards. On STM32F4
+// and STM32L4 I-cache and D-cache are the caches of flash interface and
+// sweep has the 8 combinations without ART, see board.h.
+//
+// Result is one JSON object printed through error reporter, that is over
+// UART, with min, median, p99, mean and max cycles of Invoke() and average
+// cycles of each operator per cache variant. Copy it from the terminal
+// between "BENCH BEGIN" and "BENCH END" lines and compare it between
+// commits or boards.
+//
+// Usage example:
+// #ifdef TARGET_BENCH
+// const TargetBenchImage images[] = {{"image0", image0}, {"image1", image1}};
+// TargetBenchConfig config = {20, 2, TARGET_BENCH_SWEEP};
+// target_bench_run("elephant", engine.interpreter(), &profiler, images, 2,
+//                  config, error_reporter);
+// while (1);
+// #endif
+//
+// Cycle counts are differences of DWT_CYCCNT, nothing may write it during
+// the benchmark. delay() of elephant_stm32f7 zeroes it when SYSTICK_TIMER
+// is off, interrupts that call it must not run then.
+//
+// target_bench_images() is the lighter loop of the application itself, it
+// runs every image of the registry a few times and prints one line per
+// image with its class and latency, then accuracy over images with a
+// label. First run of each image is reported on its own, it pays for
+// caches that the previous image left behind. Adding an image is one more
+// line in the registry:
+// const TargetBenchImage images[] = {{"image0", image0, 0},
+//                                    {"image1", image1, kTargetBenchNoLabel}};
+// target_bench_images(&engine, images, 2, 5, error_reporter);
+
+// Set with make bench BENCH_SWEEP=1, projects pass it in TargetBenchConfig
+#ifndef TARGET_BENCH_SWEEP
+#define TARGET_BENCH_SWEEP 0
+#endif
+
+// Label of images without known class, they are left out of accuracy
+constexpr int kTargetBenchNoLabel = -1;
+
+struct TargetBenchImage {
+  const char* name;
+  const signed char* data;
+  // Expected class index or kTargetBenchNoLabel
+  int label;
+};
+
+struct TargetBenchConfig {
+  int iterations;
+  int warmup;
+  // Measure every cache and flash combination, not only all off and on
+  bool sweep;
+};
+
+namespace target_bench {
+
+// Samples of one variant, iterations are lowered so they all fit
+constexpr int kMaxSamples = 256;
+
+// Bits of one variant, same as FASTFLASH_* of power_test
+constexpr uint32_t kVariantIc = 1 << 0;
+constexpr uint32_t kVariantDc = 1 << 1;
+constexpr uint32_t kVariantArt = 1 << 2;
+constexpr uint32_t kVariantPrefetch = 1 << 3;
+constexpr uint32_t kVariants = 16;
+
+inline void Barrier() {
+  __asm volatile("dsb 0xF\n\tisb 0xF" ::: "memory");
+}
+
+#if defined(STM32F4) || defined(STM32L4)
+// Cortex-M4 has no L1 cache, ic and dc are instruction and data cache of
+// the flash interface, which STM32F4 calls ART accelerator. There is no
+// other switch for it, so sweep has no art variants.
+constexpr bool kHasArt = false;
+constexpr uint32_t kCacheIc = FLASH_ACR_ICEN;
+constexpr uint32_t kCacheDc = FLASH_ACR_DCEN;
+
+// Returns previous state, FLASH_ACR bits of both caches
+inline uint32_t SetCaches(uint32_t enable) {
+  uint32_t previous = FLASH_ACR & (kCacheIc | kCacheDc);
+  // Caches can only be reset while disabled, nothing stale is returned
+  uint32_t acr = FLASH_ACR & ~(kCacheIc | kCacheDc);
+  FLASH_ACR = acr;
+  FLASH_ACR = acr | FLASH_ACR_ICRST | FLASH_ACR_DCRST;
+  FLASH_ACR = acr | (enable & (kCacheIc | kCacheDc));
+  Barrier();
+  return previous;
+}
+
+inline uint32_t GetVariant() {
+  uint32_t variant = 0;
+  if (FLASH_ACR & kCacheIc) variant |= kVariantIc;
+  if (FLASH_ACR & kCacheDc) variant |= kVariantDc;
+  if (FLASH_ACR & FLASH_ACR_PRFTEN) variant |= kVariantPrefetch;
+  return variant;
+}
+
+inline void SetVariant(uint32_t variant) {
+  SetCaches(((variant & kVariantIc) ? kCacheIc : 0) |
+            ((variant & kVariantDc) ? kCacheDc : 0));
+  if (variant & kVariantPrefetch) {
+    FLASH_ACR |= FLASH_ACR_PRFTEN;
+  } else {
+    FLASH_ACR &= ~FLASH_ACR_PRFTEN;
+  }
+  Barrier();
+}
+#else
+constexpr bool kHasArt = true;
+
+// Cortex-M7 cache maintenance registers, CMSIS names are not used, so this
+// does not clash with fastflash.h of projects that have it
+constexpr uint32_t kCacheIc = 1UL << 17;
+constexpr uint32_t kCacheDc = 1UL << 16;
+#define TARGET_BENCH_CCR     MMIO32(0xE000ED14)
+#define TARGET_BENCH_CCSIDR  MMIO32(0xE000ED80)
+#define TARGET_BENCH_CSSELR  MMIO32(0xE000ED84)
+#define TARGET_BENCH_ICIALLU MMIO32(0xE000EF50)
+#define TARGET_BENCH_DCISW   MMIO32(0xE000EF60)
+#define TARGET_BENCH_DCCISW  MMIO32(0xE000EF74)
+
+// ART accelerator and prefetch bits of STM32F7 FLASH_ACR
+constexpr uint32_t kFlashArtReset = 1UL << 11;
+constexpr uint32_t kFlashArt = 1UL << 9;
+constexpr uint32_t kFlashPrefetch = 1UL << 8;
+#define TARGET_BENCH_FLASH_ACR MMIO32(0x40023C00)
+
+// Writes every set and way of L1 D-cache to the given register
+inline void DCacheSetWay(volatile uint32_t* reg) {
+  TARGET_BENCH_CSSELR = 0;
+  Barrier();
+  uint32_t ccsidr = TARGET_BENCH_CCSIDR;
+  uint32_t sets = (ccsidr >> 13) & 0x7FFF;
+  do {
+    uint32_t ways = (ccsidr >> 3) & 0x3FF;
+    do {
+      *reg = ((sets << 5) & 0x3FE0) | ((ways << 30) & 0xC0000000);
+    } while (ways-- != 0);
+  } while (sets-- != 0);
+  Barrier();
+}
+
+// Returns previous state, CCR bits of both caches
+inline uint32_t SetCaches(uint32_t enable) {
+  uint32_t previous = TARGET_BENCH_CCR & (kCacheIc | kCacheDc);
+
+  if ((previous & kCacheDc) && !(enable & kCacheDc)) {
+    // Dirty lines are written back after cache is off
+    TARGET_BENCH_CCR &= ~kCacheDc;
+    Barrier();
+    DCacheSetWay(&TARGET_BENCH_DCCISW);
+  } else if (!(previous & kCacheDc) && (enable & kCacheDc)) {
+    DCacheSetWay(&TARGET_BENCH_DCISW);
+    TARGET_BENCH_CCR |= kCacheDc;
+    Barrier();
+  }
+
+  if ((previous & kCacheIc) && !(enable & kCacheIc)) {
+    TARGET_BENCH_CCR &= ~kCacheIc;
+    Barrier();
+    TARGET_BENCH_ICIALLU = 0;
+    Barrier();
+  } else if (!(previous & kCacheIc) && (enable & kCacheIc)) {
+    Barrier();
+    TARGET_BENCH_ICIALLU = 0;
+    Barrier();
+    TARGET_BENCH_CCR |= kCacheIc;
+    Barrier();
+  }
+  return previous;
+}
+
+inline uint32_t GetVariant() {
+  uint32_t variant = 0;
+  if (TARGET_BENCH_CCR & kCacheIc) variant |= kVariantIc;
+  if (TARGET_BENCH_CCR & kCacheDc) variant |= kVariantDc;
+  if (TARGET_BENCH_FLASH_ACR & kFlashArt) variant |= kVariantArt;
+  if (TARGET_BENCH_FLASH_ACR & kFlashPrefetch) variant |= kVariantPrefetch;
+  return variant;
+}
+
+inline void SetVariant(uint32_t variant) {
+  SetCaches(((variant & kVariantIc) ? kCacheIc : 0) |
+            ((variant & kVariantDc) ? kCacheDc : 0));
+
+  uint32_t acr = TARGET_BENCH_FLASH_ACR;
+  if ((variant & kVariantArt) && !(acr & kFlashArt)) {
+    // ART must not return instructions from before it was disabled
+    TARGET_BENCH_FLASH_ACR = acr | kFlashArtReset;
+    TARGET_BENCH_FLASH_ACR = acr;
+    acr |= kFlashArt;
+  } else if (!(variant & kVariantArt)) {
+    acr &= ~kFlashArt;
+  }
+  if (variant & kVariantPrefetch) {
+    acr |= kFlashPrefetch;
+  } else {
+    acr &= ~kFlashPrefetch;
+  }
+  TARGET_BENCH_FLASH_ACR = acr;
+  Barrier();
+}
+#endif
+
+// Next variant of the sweep, kVariants after the last one
+inline uint32_t NextVariant(uint32_t variant) {
+  do {
+    variant++;
+  } while (!kHasArt && variant < kVariants && (variant & kVariantArt));
+  return variant;
+}
+
+// Name of the variant in JSON, for example "ic+dc+art"
+inline const char* VariantName(uint32_t variant) {
+  static char name[16];
+  const char* parts[] = {"ic", "dc", "art", "pf"};
+  int len = 0;
+  for (uint32_t bit = 0; bit < 4; bit++) {
+    if (!(variant & (1U << bit))) continue;
+    if (len) name[len++] = '+';
+    for (const char* p = parts[bit]; *p; p++) name[len++] = *p;
+  }
+  if (!len) {
+    memcpy(name, "off", 3);
+    len = 3;
+  }
+  name[len] = '\0';
+  return name;
+}
+
+// Insertion sort, there are only a few hundred samples
+inline void Sort(uint32_t* samples, int count) {
+  for (int i = 1; i < count; i++) {
+    uint32_t value = samples[i];
+    int j = i;
+    for (; j > 0 && samples[j - 1] > value; j--) {
+      samples[j] = samples[j - 1];
+    }
+    samples[j] = value;
+  }
+}
+
+// Value at given per mille of sorted samples, nearest rank
+inline uint32_t Percentile(const uint32_t* sorted, int count,
+                           int permille) {
+  int rank = (count * permille + 999) / 1000;
+  if (rank < 1) rank = 1;
+  if (rank > count) rank = count;
+  return sorted[rank - 1];
+}
+
+// Measures one cache variant and prints its JSON object
+inline bool RunVariant(const char* cache, bool last,
+                       tflite::MicroInterpreter* interpreter,
+                       CycleProfiler* profiler,
+                       const TargetBenchImage* images, int image_count,
+                       const TargetBenchConfig& config,
+                       tflite::ErrorReporter* reporter) {
+  static uint32_t samples[kMaxSamples];
+  TfLiteTensor* input = interpreter->input(0);
+  int count = 0;
+  uint64_t total = 0;
+
+  for (int run = 0; run < config.warmup + config.iterations; run++) {
+    // Operators are measured only after warm-up
+    if (run == config.warmup) profiler->Reset();
+
+    for (int i = 0; i < image_count; i++) {
+      memcpy(input->data.int8, images[i].data, input->bytes);
+
+      uint32_t start = DWT_CYCCNT;
+      if (interpreter->Invoke() != kTfLiteOk) {
+        TF_LITE_REPORT_ERROR(reporter, "Invoke failed on %s",
+                             images[i].name);
+        return false;
+      }
+      // Unsigned subtraction also covers counter overflow
+      uint32_t cycles = DWT_CYCCNT - start;
+
+      if (run >= config.warmup) {
+        samples[count++] = cycles;
+        total += cycles;
+      }
+    }
+  }
+
+  Sort(samples, count);
+  uint32_t mean = static_cast<uint32_t>(total / count);
+  uint32_t mhz = rcc_ahb_frequency / 1000000;
+
+  TF_LITE_REPORT_ERROR(reporter, "  {\"cache\": \"%s\",", cache);
+  TF_LITE_REPORT_ERROR(reporter, "   \"cycles\": {\"min\": %u, "
+                       "\"median\": %u, \"p99\": %u, \"mean\": %u, "
+                       "\"max\": %u},", samples[0],
+                       Percentile(samples, count, 500),
+                       Percentile(samples, count, 990), mean,
+                       samples[count - 1]);
+  TF_LITE_REPORT_ERROR(reporter, "   \"mean_us\": %u,",
+                       mhz ? mean / mhz : 0);
+
+  uint32_t ops_total = profiler->TotalCycles();
+  TF_LITE_REPORT_ERROR(reporter, "   \"ops\": [");
+  for (uint32_t i = 0; i < profiler->num_ops(); i++) {
+    uint32_t average = profiler->Average(i);
+    uint32_t permille = ops_total ? static_cast<uint32_t>(
+                                        (uint64_t)average * 1000 / ops_total)
+                                  : 0;
+    TF_LITE_REPORT_ERROR(reporter, "    {\"index\": %u, \"name\": \"%s\", "
+                         "\"cycles\": %u, \"percent\": %u.%u}%s", i,
+                         profiler->tag(i) ? profiler->tag(i) : "-", average,
+                         permille / 10, permille % 10,
+                         i + 1 < profiler->num_ops() ? "," : "");
+  }
+  TF_LITE_REPORT_ERROR(reporter, "  ]}%s", last ? "" : ",");
+  return true;
+}
+
+}  // namespace target_bench
+
+// Runs all variants and prints JSON, returns false if any Invoke()
+// failed. Caches and flash are left as they were before the call.
+inline bool target_bench_run(const char* model_name,
+                             tflite::MicroInterpreter* interpreter,
+                             CycleProfiler* profiler,
+                             const TargetBenchImage* images, int image_count,
+                             TargetBenchConfig config,
+                             tflite::ErrorReporter* reporter) {
+  if (config.iterations < 1) config.iterations = 1;
+  if (config.warmup < 0) config.warmup = 0;
+  if (config.iterations * image_count > target_bench::kMaxSamples) {
+    config.iterations = target_bench::kMaxSamples / image_count;
+  }
+
+  // Cycle counter might not be enabled if project uses systick timer
+  DWT_LAR = 0xC5ACCE55;
+  dwt_enable_cycle_counter();
+
+  TF_LITE_REPORT_ERROR(reporter, "BENCH BEGIN");
+  TF_LITE_REPORT_ERROR(reporter, "{\"model\": \"%s\", \"clock_hz\": %u, "
+                       "\"images\": %d, \"iterations\": %d, "
+                       "\"warmup\": %d, \"arena_used\": %u,", model_name,
+                       static_cast<unsigned>(rcc_ahb_frequency), image_count,
+                       config.iterations, config.warmup,
+                       static_cast<unsigned>(interpreter->arena_used_bytes()));
+  TF_LITE_REPORT_ERROR(reporter, " \"variants\": [");
+
+  bool ok = true;
+  if (config.sweep) {
+    uint32_t previous = target_bench::GetVariant();
+    for (uint32_t v = 0; v < target_bench::kVariants && ok;
+         v = target_bench::NextVariant(v)) {
+      target_bench::SetVariant(v);
+      ok = target_bench::RunVariant(target_bench::VariantName(v),
+                                    target_bench::NextVariant(v) ==
+                                        target_bench::kVariants,
+                                    interpreter, profiler, images,
+                                    image_count, config, reporter);
+    }
+    target_bench::SetVariant(previous);
+  } else {
+    // ART and prefetch stay as the project set them
+    uint32_t previous = target_bench::SetCaches(0);
+    ok = target_bench::RunVariant("off", false, interpreter, profiler,
+                                  images, image_count, config, reporter);
+    if (ok) {
+      target_bench::SetCaches(target_bench::kCacheIc |
+                              target_bench::kCacheDc);
+      ok = target_bench::RunVariant("on", true, interpreter, profiler,
+                                    images, image_count, config, reporter);
+    }
+    target_bench::SetCaches(previous);
+  }
+
+  TF_LITE_REPORT_ERROR(reporter, "]}");
+  TF_LITE_REPORT_ERROR(reporter, "BENCH END");
+  return ok;
+}
+
+// Runs each image runs times and prints its class and latency, returns
+// false if any Invoke() failed. Images are loaded with LoadInput() of
+// InferenceEngine, so flash images are not copied, scores are read from
+// output 0.
+template <typename Engine>
+inline bool target_bench_images(Engine* engine,
+                                const TargetBenchImage* images,
+                                int image_count, int runs,
+                                tflite::ErrorReporter* reporter) {
+  static uint32_t samples[target_bench::kMaxSamples];
+  // Warm runs of all images are kept for the summary
+  if (image_count < 1 || image_count > target_bench::kMaxSamples) {
+    return false;
+  }
+  if (runs < 2) runs = 2;
+  if ((runs - 1) * image_count > target_bench::kMaxSamples) {
+    runs = target_bench::kMaxSamples / image_count + 1;
+  }
+
+  DWT_LAR = 0xC5ACCE55;
+  dwt_enable_cycle_counter();
+  uint32_t mhz = rcc_ahb_frequency / 1000000;
+  if (mhz == 0) mhz = 1;
+
+  TfLiteTensor* input = engine->input(0);
+  OutputScores scores;
+  if (!scores.Bind(engine->output(0))) {
+    TF_LITE_REPORT_ERROR(reporter, "Output is neither int8 nor float");
+    return false;
+  }
+
+  int count = 0;
+  int labelled = 0;
+  int correct = 0;
+  uint64_t first_total = 0;
+  for (int i = 0; i < image_count; i++) {
+    engine->LoadInput(images[i].data, input->bytes);
+
+    uint32_t* image_samples = samples + count;
+    uint32_t first = 0;
+    for (int run = 0; run < runs; run++) {
+      uint32_t start = DWT_CYCCNT;
+      if (!engine->Invoke()) {
+        TF_LITE_REPORT_ERROR(reporter, "Invoke failed on %s",
+                             images[i].name);
+        return false;
+      }
+      uint32_t cycles = DWT_CYCCNT - start;
+      // First run is not part of warm samples
+      if (run == 0) {
+        first = cycles;
+      } else {
+        samples[count++] = cycles;
+      }
+    }
+    first_total += first;
+
+    int top = 0;
+    for (int c = 1; c < scores.count(); c++) {
+      if (scores.Milli(c) > scores.Milli(top)) top = c;
+    }
+    if (images[i].label != kTargetBenchNoLabel) {
+      labelled++;
+      correct += top == images[i].label;
+    }
+
+    int warm = runs - 1;
+    target_bench::Sort(image_samples, warm);
+    TF_LITE_REPORT_ERROR(reporter, "%-12s class %d (%d.%03d) label %d, "
+                         "first %u us, warm %u/%u/%u us min/median/max",
+                         images[i].name, top, scores.Milli(top) / 1000,
+                         scores.Milli(top) % 1000, images[i].label,
+                         first / mhz, image_samples[0] / mhz,
+                         target_bench::Percentile(image_samples, warm, 500) /
+                             mhz,
+                         image_samples[warm - 1] / mhz);
+  }
+
+  target_bench::Sort(samples, count);
+  TF_LITE_REPORT_ERROR(reporter, "First runs mean %u us, warm median %u us, "
+                       "p99 %u us over %d runs",
+                       static_cast<uint32_t>(first_total / image_count) / mhz,
+                       target_bench::Percentile(samples, count, 500) / mhz,
+                       target_bench::Percentile(samples, count, 990) / mhz,
+                       count);
+  if (labelled) {
+    TF_LITE_REPORT_ERROR(reporter, "Accuracy %d / %d labelled images",
+                         correct, labelled);
+  }
+  return true;
+}
+
+#endif  // TARGET_BENCH_H
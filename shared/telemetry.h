@@ -0,0 +1,407 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "frame_codec.h"
+
+// CRC unit of power_test, look at its system_setup/crc_hw.c
+#if __has_include("system_setup/crc_hw.h")
+#include "system_setup/crc_hw.h"
+#define TELEMETRY_CRC_HW
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Explanation: binary telemetry protocol for frames and inference results.
+ * Every message is:
+ *
+ *     | type (1) | sequence (1) | payload (n) | CRC16 (2, little endian) |
+ *
+ * CRC is CRC-16/CCITT-FALSE over type, sequence and payload. Whole message
+ * is COBS encoded and terminated with 0x00, so receiver can always find
+ * start of the next message, even if it connects in the middle of a frame
+ * or ASCII printf output is mixed in. Encoding is done on the fly with
+ * 254 byte block, so frames do not need a second buffer.
+ * CRC of each payload block goes through CRC unit when the project has
+ * crc_hw.h, byte by byte otherwise.
+ * All multi byte fields are little endian. Decoder is in
+ * projects/camera_stm32f7/flir_image.py, log messages of shared/log.h have
+ * a sequence of their own and are decoded by log_decode.py.
+ *
+ * Over UDP, look at eth_udp.c of power_test, each datagram is one message
+ * without COBS and CRC16, UDP checksum covers it and the datagram already
+ * has its length. Frames do not fit into a datagram and go as
+ * TELEMETRY_FRAME_ROWS parts, results as TELEMETRY_RESULT records of
+ * shared/result_bus.h. udp_collector.py receives them from all units.
+ * */
+
+#define TELEMETRY_VERSION           1
+
+#define TELEMETRY_FRAME             0x01    // u8 cols, u8 rows, cols*rows u8
+#define TELEMETRY_SCORES_F32        0x02    // u8 count, count * f32
+#define TELEMETRY_SCORES_I8         0x03    // u8 count, f32 scale,
+                                            // i32 zero point, count * i8
+#define TELEMETRY_LATENCY           0x04    // u32 capture, u32 inference,
+                                            // u32 total, all in us
+#define TELEMETRY_FRAME_CODED       0x05    // u8 cols, u8 rows, u16 length,
+                                            // length bytes of frame_codec.h
+#define TELEMETRY_FRAME_JPEG        0x06    // u8 cols, u8 rows, u16 length,
+                                            // length bytes of JPEG file
+#define TELEMETRY_LOG               0x07    // u32 format id, u8 count,
+                                            // count * u32, see log.h
+#define TELEMETRY_LOG_REPORT        0x08    // u32 format address, arguments
+                                            // in format order, see log.h
+#define TELEMETRY_FRAME_ROWS        0x09    // u16 frame, u8 cols, u8 rows,
+                                            // u8 first row, u8 row count,
+                                            // count*cols u8, UDP only
+#define TELEMETRY_RESULT            0x0A    // result_record_t, UDP only
+
+#define TELEMETRY_MAX_SCORES        16
+
+typedef struct
+{
+    // Writes encoded bytes to the link, for example uart_tx_write()
+    void (*write)(const uint8_t * data, uint32_t len);
+    uint8_t sequence;
+    uint16_t crc;
+    uint8_t block[255];     // COBS code byte and up to 254 data bytes
+    uint8_t block_len;      // Including code byte
+}telemetry_t;
+
+/*!
+ * @brief               Prepares telemetry encoder
+ *
+ * @param[out] tm       Encoder state
+ * @param[in] write     Function that sends bytes over the link
+ */
+static inline void telemetry_init(telemetry_t * tm,
+                                  void (*write)(const uint8_t * data,
+                                                uint32_t len))
+{
+    tm->write = write;
+    tm->sequence = 0;
+    tm->crc = 0xFFFF;
+    tm->block_len = 1;
+}
+
+static inline uint16_t telemetry_crc16(uint16_t crc, uint8_t byte)
+{
+    crc ^= (uint16_t) byte << 8;
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+/*!
+ * @brief   Sends current COBS block, code byte is number of bytes until
+ *          the next zero
+ */
+static inline void telemetry_flush_block(telemetry_t * tm)
+{
+    tm->block[0] = tm->block_len;
+    tm->write(tm->block, tm->block_len);
+    tm->block_len = 1;
+}
+
+static inline void telemetry_encode_byte(telemetry_t * tm, uint8_t byte)
+{
+    if (byte == 0)
+    {
+        telemetry_flush_block(tm);
+        return;
+    }
+
+    tm->block[tm->block_len++] = byte;
+    if (tm->block_len == 255)
+    {
+        // Maximal block without zero, code 0xFF means no zero follows
+        telemetry_flush_block(tm);
+    }
+}
+
+/*!
+ * @brief   Adds payload bytes to message that is being sent
+ */
+static inline void telemetry_put(telemetry_t * tm,
+                                 const void * data,
+                                 uint32_t len)
+{
+    const uint8_t * bytes = (const uint8_t *) data;
+
+#ifdef TELEMETRY_CRC_HW
+    tm->crc = crc_hw_ccitt16(tm->crc, bytes, len);
+    for (uint32_t i = 0; i < len; i++)
+    {
+        telemetry_encode_byte(tm, bytes[i]);
+    }
+#else
+    for (uint32_t i = 0; i < len; i++)
+    {
+        tm->crc = telemetry_crc16(tm->crc, bytes[i]);
+        telemetry_encode_byte(tm, bytes[i]);
+    }
+#endif
+}
+
+static inline void telemetry_put_u8(telemetry_t * tm, uint8_t value)
+{
+    telemetry_put(tm, &value, 1);
+}
+
+static inline void telemetry_put_u32(telemetry_t * tm, uint32_t value)
+{
+    uint8_t bytes[4] = {(uint8_t) value,
+                        (uint8_t) (value >> 8),
+                        (uint8_t) (value >> 16),
+                        (uint8_t) (value >> 24)};
+    telemetry_put(tm, bytes, 4);
+}
+
+static inline void telemetry_put_f32(telemetry_t * tm, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    telemetry_put_u32(tm, bits);
+}
+
+/*!
+ * @brief   Starts a new message, payload is added with telemetry_put*
+ *          functions and message is closed with telemetry_end()
+ */
+static inline void telemetry_begin(telemetry_t * tm, uint8_t type)
+{
+    tm->crc = 0xFFFF;
+    tm->block_len = 1;
+    telemetry_put_u8(tm, type);
+    telemetry_put_u8(tm, tm->sequence++);
+}
+
+/*!
+ * @brief   Appends CRC, finishes COBS encoding and sends delimiter
+ */
+static inline void telemetry_end(telemetry_t * tm)
+{
+    uint16_t crc = tm->crc;
+    uint8_t bytes[2] = {(uint8_t) crc, (uint8_t) (crc >> 8)};
+
+    // CRC itself is not part of CRC
+    telemetry_encode_byte(tm, bytes[0]);
+    telemetry_encode_byte(tm, bytes[1]);
+    telemetry_flush_block(tm);
+
+    uint8_t delimiter = 0;
+    tm->write(&delimiter, 1);
+}
+
+/*!
+ * @brief               Sends raw 8-bit frame
+ *
+ * @param[in] pixels    Row major pixels
+ * @param[in] cols
+ * @param[in] rows
+ * @param[in] stride    Distance between rows in pixels
+ */
+static inline void telemetry_send_frame_u8(telemetry_t * tm,
+                                           const uint8_t * pixels,
+                                           uint8_t cols,
+                                           uint8_t rows,
+                                           uint32_t stride)
+{
+    telemetry_begin(tm, TELEMETRY_FRAME);
+    telemetry_put_u8(tm, cols);
+    telemetry_put_u8(tm, rows);
+    for (uint8_t row = 0; row < rows; row++)
+    {
+        telemetry_put(tm, pixels + row * stride, cols);
+    }
+    telemetry_end(tm);
+}
+
+/*!
+ * @brief               Sends 16-bit frame, for example VoSPI packets
+ *                      with AGC output, pixels are saturated to 8 bits
+ *
+ * @param[in] pixels    First pixel of the first row
+ * @param[in] stride    Distance between rows in words, 82 for VoSPI
+ */
+static inline void telemetry_send_frame_u16(telemetry_t * tm,
+                                            const uint16_t * pixels,
+                                            uint8_t cols,
+                                            uint8_t rows,
+                                            uint32_t stride)
+{
+    telemetry_begin(tm, TELEMETRY_FRAME);
+    telemetry_put_u8(tm, cols);
+    telemetry_put_u8(tm, rows);
+    for (uint8_t row = 0; row < rows; row++)
+    {
+        for (uint8_t col = 0; col < cols; col++)
+        {
+            uint16_t pixel = pixels[row * stride + col];
+            telemetry_put_u8(tm, pixel > 255 ? 255 : (uint8_t) pixel);
+        }
+    }
+    telemetry_end(tm);
+}
+
+/*!
+ * @brief               Sends 16-bit frame coded with frame_codec.h, around
+ *                      a third of the raw frame on a typical scene, falls
+ *                      back to raw frame if it does not compress
+ *
+ * @param[in] stride    Distance between rows in words, 82 for VoSPI
+ * @param[out] scratch  Coded frame is kept here until it is sent
+ * @param[in] scratch_len   Frames longer than this are sent raw
+ */
+static inline void telemetry_send_frame_coded_u16(telemetry_t * tm,
+                                                  const uint16_t * pixels,
+                                                  uint8_t cols,
+                                                  uint8_t rows,
+                                                  uint32_t stride,
+                                                  uint8_t * scratch,
+                                                  uint16_t scratch_len)
+{
+    uint32_t len = frame_codec_encode_u16(pixels, cols, rows, stride,
+                                          scratch, scratch_len);
+    if (len == 0)
+    {
+        telemetry_send_frame_u16(tm, pixels, cols, rows, stride);
+        return;
+    }
+
+    telemetry_begin(tm, TELEMETRY_FRAME_CODED);
+    telemetry_put_u8(tm, cols);
+    telemetry_put_u8(tm, rows);
+    telemetry_put_u8(tm, (uint8_t) len);
+    telemetry_put_u8(tm, (uint8_t) (len >> 8));
+    telemetry_put(tm, scratch, len);
+    telemetry_end(tm);
+}
+
+/*!
+ * @brief               Sends 8-bit frame coded with frame_codec.h, for
+ *                      example preview of frame_downscale_u8(), falls back
+ *                      to raw frame if it does not compress
+ *
+ * @param[in] stride    Distance between rows in pixels
+ * @param[out] scratch  Coded frame is kept here until it is sent
+ * @param[in] scratch_len   Frames longer than this are sent raw
+ */
+static inline void telemetry_send_frame_coded_u8(telemetry_t * tm,
+                                                 const uint8_t * pixels,
+                                                 uint8_t cols,
+                                                 uint8_t rows,
+                                                 uint32_t stride,
+                                                 uint8_t * scratch,
+                                                 uint16_t scratch_len)
+{
+    uint32_t len = frame_codec_encode_u8(pixels, cols, rows, stride,
+                                         scratch, scratch_len);
+    if (len == 0)
+    {
+        telemetry_send_frame_u8(tm, pixels, cols, rows, stride);
+        return;
+    }
+
+    telemetry_begin(tm, TELEMETRY_FRAME_CODED);
+    telemetry_put_u8(tm, cols);
+    telemetry_put_u8(tm, rows);
+    telemetry_put_u8(tm, (uint8_t) len);
+    telemetry_put_u8(tm, (uint8_t) (len >> 8));
+    telemetry_put(tm, scratch, len);
+    telemetry_end(tm);
+}
+
+/*!
+ * @brief               Sends 8-bit frame that is already a JPEG file, for
+ *                      example of camera_stm32f7/jpeg_hw.c
+ *
+ * @param[in] jpeg      Whole file, SOI to EOI
+ * @param[in] len       Up to 65535 bytes
+ */
+static inline void telemetry_send_frame_jpeg(telemetry_t * tm,
+                                             uint8_t cols,
+                                             uint8_t rows,
+                                             const uint8_t * jpeg,
+                                             uint16_t len)
+{
+    telemetry_begin(tm, TELEMETRY_FRAME_JPEG);
+    telemetry_put_u8(tm, cols);
+    telemetry_put_u8(tm, rows);
+    telemetry_put_u8(tm, (uint8_t) len);
+    telemetry_put_u8(tm, (uint8_t) (len >> 8));
+    telemetry_put(tm, jpeg, len);
+    telemetry_end(tm);
+}
+
+/*!
+ * @brief               Sends dequantized scores
+ */
+static inline void telemetry_send_scores_f32(telemetry_t * tm,
+                                             const float * scores,
+                                             uint8_t count)
+{
+    if (count > TELEMETRY_MAX_SCORES)
+    {
+        count = TELEMETRY_MAX_SCORES;
+    }
+
+    telemetry_begin(tm, TELEMETRY_SCORES_F32);
+    telemetry_put_u8(tm, count);
+    for (uint8_t i = 0; i < count; i++)
+    {
+        telemetry_put_f32(tm, scores[i]);
+    }
+    telemetry_end(tm);
+}
+
+/*!
+ * @brief               Sends quantized scores together with their
+ *                      quantization params, receiver dequantizes them
+ */
+static inline void telemetry_send_scores_i8(telemetry_t * tm,
+                                            const int8_t * scores,
+                                            uint8_t count,
+                                            float scale,
+                                            int32_t zero_point)
+{
+    if (count > TELEMETRY_MAX_SCORES)
+    {
+        count = TELEMETRY_MAX_SCORES;
+    }
+
+    telemetry_begin(tm, TELEMETRY_SCORES_I8);
+    telemetry_put_u8(tm, count);
+    telemetry_put_f32(tm, scale);
+    telemetry_put_u32(tm, (uint32_t) zero_point);
+    telemetry_put(tm, scores, count);
+    telemetry_end(tm);
+}
+
+/*!
+ * @brief                   Sends latency counters, all in us
+ */
+static inline void telemetry_send_latency(telemetry_t * tm,
+                                          uint32_t capture,
+                                          uint32_t inference,
+                                          uint32_t total)
+{
+    telemetry_begin(tm, TELEMETRY_LATENCY);
+    telemetry_put_u32(tm, capture);
+    telemetry_put_u32(tm, inference);
+    telemetry_put_u32(tm, total);
+    telemetry_end(tm);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TELEMETRY_H */
+/*** end of file ***/
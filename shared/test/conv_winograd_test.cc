@@ -0,0 +1,259 @@
+#include "tensorflow/lite/c/builtin_op_data.h"
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/micro/all_ops_resolver.h"
+#include "tensorflow/lite/micro/testing/micro_test.h"
+
+#include "conv_winograd.h"
+#include "kernel_test.h"
+
+// Conv2DWinogradResolver against reference Conv2D, filters are
+// transformed here the same way as winograd_weights.py does it.
+
+namespace {
+
+constexpr int kMaxRows = 9;
+constexpr int kMaxCols = 9;
+constexpr int kMaxDepth = 6;
+constexpr int kMaxChannels = 6;
+constexpr int kMaxInput = kMaxRows * kMaxCols * kMaxDepth;
+constexpr int kMaxOutput = kMaxRows * kMaxCols * kMaxChannels;
+constexpr int kMaxFilter = kMaxChannels * 9 * kMaxDepth;
+constexpr int kMaxPacked = 4 + 16 * kMaxChannels * (kMaxDepth + 1) * 2;
+
+struct ConvCase {
+  int rows;
+  int cols;
+  int depth;
+  int channels;
+  TfLitePadding padding;
+  int stride;
+  bool per_channel;
+  TfLiteFusedActivation activation;
+  bool pool;  // Output is 2x2 max pool of the convolution
+};
+
+// 2G of F(2x2, 3x3), as in winograd_weights.py
+const int kG2[4][3] = {{2, 0, 0}, {1, 1, 1}, {1, -1, 1}, {0, 0, 2}};
+
+// "WGD2" and U as int16 [16][channels][depth rounded up to even]
+void Transform(const int8_t* filter, int channels, int depth,
+               uint8_t* packed) {
+  const int stride = depth + depth % 2;
+  memcpy(packed, "WGD2", 4);
+  int16_t* u = reinterpret_cast<int16_t*>(packed + 4);
+  memset(u, 0, 16 * channels * stride * sizeof(int16_t));
+  for (int o = 0; o < channels; o++) {
+    for (int c = 0; c < depth; c++) {
+      for (int a = 0; a < 4; a++) {
+        for (int b = 0; b < 4; b++) {
+          int value = 0;
+          for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+              value += kG2[a][i] * filter[((o * 3 + i) * 3 + j) * depth + c] *
+                       kG2[b][j];
+            }
+          }
+          u[((a * 4 + b) * channels + o) * stride + c] =
+              static_cast<int16_t>(value);
+        }
+      }
+    }
+  }
+}
+
+int OutSize(TfLitePadding padding, int size, int stride) {
+  return padding == kTfLitePaddingSame ? (size + stride - 1) / stride
+                                       : (size - 3 + stride) / stride;
+}
+
+// Runs case through registration, filter is weights as they are in the
+// model, int8 or packed. Returns status of the run, output is out_rows x
+// out_cols.
+TfLiteStatus RunConv(const TfLiteRegistration* registration,
+                     const ConvCase& test, const int8_t* input,
+                     const void* filter, size_t filter_bytes,
+                     const int32_t* bias, int out_rows, int out_cols,
+                     int8_t* output) {
+  static const float kFilterScales[kMaxChannels] = {0.011f, 0.02f, 0.007f,
+                                                    0.031f, 0.016f, 0.024f};
+  const int channels = test.channels;
+  TfLiteTensor tensors[4];
+  TestQuant quant[4];
+  TestTensor(&tensors[0], &quant[0], kTfLiteInt8, const_cast<int8_t*>(input),
+             test.rows * test.cols * test.depth,
+             {1, test.rows, test.cols, test.depth}, 0.05f, -3);
+  TestTensor(&tensors[1], &quant[1], kTfLiteInt8, const_cast<void*>(filter),
+             filter_bytes, {channels, 3, 3, test.depth}, kFilterScales[0], 0);
+  TestTensor(&tensors[2], &quant[2], kTfLiteInt32, const_cast<int32_t*>(bias),
+             channels * sizeof(int32_t), {channels},
+             0.05f * kFilterScales[0], 0);
+  TestTensor(&tensors[3], &quant[3], kTfLiteInt8, output,
+             out_rows * out_cols * channels, {1, out_rows, out_cols, channels},
+             0.5f, 5);
+  if (test.per_channel) {
+    float bias_scales[kMaxChannels];
+    for (int c = 0; c < channels; c++) {
+      bias_scales[c] = 0.05f * kFilterScales[c];
+    }
+    TestPerChannel(&tensors[1], &quant[1], kFilterScales, channels, 0);
+    TestPerChannel(&tensors[2], &quant[2], bias_scales, channels, 0);
+  }
+
+  TfLiteConvParams params;
+  memset(&params, 0, sizeof(params));
+  params.padding = test.padding;
+  params.stride_width = test.stride;
+  params.stride_height = test.stride;
+  params.dilation_width_factor = 1;
+  params.dilation_height_factor = 1;
+  params.activation = test.activation;
+
+  int inputs[] = {3, 0, 1, 2};
+  int outputs[] = {1, 3};
+  return TestRun(registration, tensors, 4, inputs, outputs, &params);
+}
+
+// Runs case through reference Conv2D, with pool of the result if the case
+// has one, and through the Winograd kernel on transformed filter. Returns
+// index of first output that differs, -1 if none.
+int Compare(const ConvCase& test, uint32_t seed) {
+  static int8_t input[kMaxInput];
+  static int8_t filter[kMaxFilter];
+  alignas(4) static uint8_t packed[kMaxPacked];
+  static int32_t bias[kMaxChannels];
+  static int8_t conv[kMaxOutput];
+  static int8_t expected[kMaxOutput];
+  static int8_t actual[kMaxOutput];
+
+  TestFill(input, test.rows * test.cols * test.depth, &seed);
+  TestFill(filter, test.channels * 9 * test.depth, &seed, -127, 127);
+  for (int c = 0; c < test.channels; c++) {
+    bias[c] = TestRandom(&seed, -2000, 2000);
+  }
+  Transform(filter, test.channels, test.depth, packed);
+
+  tflite::AllOpsResolver resolver;
+  Conv2DWinogradResolver winograd_resolver(resolver);
+  const TfLiteRegistration* reference =
+      resolver.FindOp(tflite::BuiltinOperator_CONV_2D);
+  const TfLiteRegistration* winograd =
+      winograd_resolver.FindOp(tflite::BuiltinOperator_CONV_2D);
+
+  const int rows = OutSize(test.padding, test.rows, test.stride);
+  const int cols = OutSize(test.padding, test.cols, test.stride);
+  if (RunConv(reference, test, input, filter, test.channels * 9 * test.depth,
+              bias, rows, cols, conv) != kTfLiteOk) {
+    return -2;
+  }
+
+  int out_rows = rows;
+  int out_cols = cols;
+  memcpy(expected, conv, rows * cols * test.channels);
+  if (test.pool) {
+    // VALID 2x2 max pool, the one fuse_conv_pool.py folds into Conv2D
+    out_rows = rows / 2;
+    out_cols = cols / 2;
+    for (int y = 0; y < out_rows; y++) {
+      for (int x = 0; x < out_cols; x++) {
+        for (int c = 0; c < test.channels; c++) {
+          int8_t max = -128;
+          for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < 2; j++) {
+              const int8_t value =
+                  conv[((2 * y + i) * cols + 2 * x + j) * test.channels + c];
+              max = value > max ? value : max;
+            }
+          }
+          expected[(y * out_cols + x) * test.channels + c] = max;
+        }
+      }
+    }
+  }
+
+  memset(actual, 0x55, sizeof(actual));
+  const int stride = test.depth + test.depth % 2;
+  if (RunConv(winograd, test, input, packed,
+              4 + 16 * test.channels * stride * 2, bias, out_rows, out_cols,
+              actual) != kTfLiteOk) {
+    return -3;
+  }
+  return TestMismatch(expected, actual, out_rows * out_cols * test.channels);
+}
+
+}  // namespace
+
+TF_LITE_MICRO_TESTS_BEGIN
+
+TF_LITE_MICRO_TEST(SamePaddingOddSizes) {
+  // Last tile row and column are only half inside, depth needs a padding
+  // channel
+  const ConvCase test = {7, 9, 5, 6, kTfLitePaddingSame, 1, true,
+                         kTfLiteActNone, false};
+  TF_LITE_MICRO_EXPECT_EQ(-1, Compare(test, 1));
+}
+
+TF_LITE_MICRO_TEST(ValidPaddingPerTensor) {
+  const ConvCase test = {8, 6, 4, 3, kTfLitePaddingValid, 1, false,
+                         kTfLiteActRelu, false};
+  TF_LITE_MICRO_EXPECT_EQ(-1, Compare(test, 2));
+}
+
+TF_LITE_MICRO_TEST(ExtremeValues) {
+  // Several seeds over the full int8 range, output clamped by Relu6
+  const ConvCase test = {6, 6, 6, 4, kTfLitePaddingSame, 1, true,
+                         kTfLiteActRelu6, false};
+  uint32_t seed = 3;
+  for (int run = 0; run < 4; run++) {
+    TF_LITE_MICRO_EXPECT_EQ(-1, Compare(test, seed));
+    seed = seed * 7 + 1;
+  }
+}
+
+TF_LITE_MICRO_TEST(InputSmallerThanTile) {
+  const ConvCase test = {3, 3, 3, 2, kTfLitePaddingSame, 1, true,
+                         kTfLiteActNone, false};
+  TF_LITE_MICRO_EXPECT_EQ(-1, Compare(test, 4));
+}
+
+TF_LITE_MICRO_TEST(FusedPool) {
+  // Odd convolution width, last column is dropped by the pool
+  const ConvCase test = {8, 7, 6, 4, kTfLitePaddingSame, 1, true,
+                         kTfLiteActNone, true};
+  TF_LITE_MICRO_EXPECT_EQ(-1, Compare(test, 5));
+}
+
+TF_LITE_MICRO_TEST(StrideTwoIsRejected) {
+  // Transformed filter only holds stride 1, Prepare() has to refuse it
+  const ConvCase test = {8, 8, 4, 2, kTfLitePaddingSame, 2, true,
+                         kTfLiteActNone, false};
+  TF_LITE_MICRO_EXPECT_EQ(-3, Compare(test, 6));
+}
+
+TF_LITE_MICRO_TEST(PlainFilterRunsOriginalKernel) {
+  static int8_t input[8 * 8 * 4];
+  static int8_t filter[2 * 9 * 4];
+  static int32_t bias[2];
+  static int8_t expected[4 * 4 * 2];
+  static int8_t actual[4 * 4 * 2];
+  const ConvCase test = {8, 8, 4, 2, kTfLitePaddingSame, 2, true,
+                         kTfLiteActNone, false};
+  uint32_t seed = 7;
+  TestFill(input, sizeof(input), &seed);
+  TestFill(filter, sizeof(filter), &seed, -127, 127);
+  bias[0] = 100;
+  bias[1] = -100;
+
+  tflite::AllOpsResolver resolver;
+  Conv2DWinogradResolver winograd_resolver(resolver);
+  TF_LITE_MICRO_EXPECT_EQ(
+      kTfLiteOk,
+      RunConv(resolver.FindOp(tflite::BuiltinOperator_CONV_2D), test, input,
+              filter, sizeof(filter), bias, 4, 4, expected));
+  TF_LITE_MICRO_EXPECT_EQ(
+      kTfLiteOk,
+      RunConv(winograd_resolver.FindOp(tflite::BuiltinOperator_CONV_2D), test,
+              input, filter, sizeof(filter), bias, 4, 4, actual));
+  TF_LITE_MICRO_EXPECT_EQ(-1, TestMismatch(expected, actual, sizeof(actual)));
+}
+
+TF_LITE_MICRO_TESTS_END
@@ -0,0 +1,202 @@
+#include <math.h>
+
+#include <vector>
+
+#include "flatbuffers/flexbuffers.h"
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/micro/micro_mutable_op_resolver.h"
+#include "tensorflow/lite/micro/testing/micro_test.h"
+
+#include "detection_postprocess.h"
+#include "kernel_test.h"
+
+// DetectionPostProcessResolver on a fixture of six anchors with known
+// boxes and scores, checks which anchors NMS selects and in what order.
+// Project resolver is empty, so every node runs the int8 kernel.
+//
+// Anchors are 0.2 x 0.2, encodings are ty and tx of 10 steps of 0.1,
+// with y_scale and x_scale 10 that moves a box by a tenth of its size.
+// Scores have scale 1 / 256 and zero point -128, after a background
+// score. Anchor 1 overlaps anchor 0 with IoU 0.82 and scores higher,
+// anchor 3 overlaps anchor 2 with IoU 0.6 and scores higher, anchor 4 is
+// below the score threshold of 0.5.
+
+namespace {
+
+constexpr int kAnchors = 6;
+constexpr int kClasses = 2;
+constexpr int kMaxDetections = 4;
+
+const float kAnchorData[kAnchors * 4] = {
+    0.3f, 0.3f, 0.2f, 0.2f, 0.3f, 0.3f,  0.2f, 0.2f,
+    0.7f, 0.7f, 0.2f, 0.2f, 0.7f, 0.75f, 0.2f, 0.2f,
+    0.3f, 0.7f, 0.2f, 0.2f, 0.7f, 0.3f,  0.2f, 0.2f,
+};
+const int8_t kEncodings[kAnchors * 4] = {
+    0, 0, 0, 0, 10, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0,  0, 0, 0, 0, 0, 0, 0,
+};
+const int8_t kScores[kAnchors * (kClasses + 1)] = {
+    -128, 100, -100, -128, 110, 0,   -128, -50, 60,
+    -128, 90,  20,   -128, -20, -30, -128, 5,   10,
+};
+
+// Decoded box, ymin, xmin, ymax and xmax, best class and its int8 score
+// of each anchor
+const float kBoxes[kAnchors][4] = {
+    {0.2f, 0.2f, 0.4f, 0.4f},   {0.22f, 0.2f, 0.42f, 0.4f},
+    {0.6f, 0.6f, 0.8f, 0.8f},   {0.6f, 0.65f, 0.8f, 0.85f},
+    {0.2f, 0.6f, 0.4f, 0.8f},   {0.6f, 0.2f, 0.8f, 0.4f},
+};
+const int kBestClass[kAnchors] = {0, 0, 1, 0, 0, 1};
+const int kBestScore[kAnchors] = {100, 110, 60, 90, -20, 10};
+
+struct Options {
+  int max_detections;
+  float score_threshold;
+  float iou_threshold;
+  bool regular_nms;
+};
+
+// KernelRunner of this TFLite version passes no length with custom
+// options, so Init() of the kernel gets the flexbuffer from here
+std::vector<uint8_t>& OptionBuffer() {
+  static std::vector<uint8_t> buffer;
+  return buffer;
+}
+
+const TfLiteRegistration*& Kernel() {
+  static const TfLiteRegistration* kernel = nullptr;
+  return kernel;
+}
+
+void* InitWithOptions(TfLiteContext* context, const char*, size_t) {
+  return Kernel()->init(context,
+                        reinterpret_cast<const char*>(OptionBuffer().data()),
+                        OptionBuffer().size());
+}
+
+// Runs the fixture, outputs get max_detections entries, returns status of
+// the run
+TfLiteStatus RunFixture(const Options& options, float* boxes,
+                        float* classes, float* scores, float* count) {
+  flexbuffers::Builder fbb;
+  const size_t map = fbb.StartMap();
+  fbb.Int("max_detections", options.max_detections);
+  fbb.Int("max_classes_per_detection", 1);
+  fbb.Int("detections_per_class", 1);
+  fbb.Bool("use_regular_nms", options.regular_nms);
+  fbb.Float("nms_score_threshold", options.score_threshold);
+  fbb.Float("nms_iou_threshold", options.iou_threshold);
+  fbb.Int("num_classes", kClasses);
+  fbb.Float("y_scale", 10.0f);
+  fbb.Float("x_scale", 10.0f);
+  fbb.Float("h_scale", 5.0f);
+  fbb.Float("w_scale", 5.0f);
+  fbb.EndMap(map);
+  fbb.Finish();
+  OptionBuffer() = fbb.GetBuffer();
+
+  const int detections = options.max_detections;
+  TfLiteTensor tensors[7];
+  TestQuant quant[7];
+  TestTensor(&tensors[0], &quant[0], kTfLiteInt8,
+             const_cast<int8_t*>(kEncodings), sizeof(kEncodings),
+             {1, kAnchors, 4}, 0.1f, 0);
+  TestTensor(&tensors[1], &quant[1], kTfLiteInt8,
+             const_cast<int8_t*>(kScores), sizeof(kScores),
+             {1, kAnchors, kClasses + 1}, 1.0f / 256, -128);
+  TestTensor(&tensors[2], &quant[2], kTfLiteFloat32,
+             const_cast<float*>(kAnchorData), sizeof(kAnchorData),
+             {kAnchors, 4});
+  TestTensor(&tensors[3], &quant[3], kTfLiteFloat32, boxes,
+             detections * 4 * sizeof(float), {1, detections, 4});
+  TestTensor(&tensors[4], &quant[4], kTfLiteFloat32, classes,
+             detections * sizeof(float), {1, detections});
+  TestTensor(&tensors[5], &quant[5], kTfLiteFloat32, scores,
+             detections * sizeof(float), {1, detections});
+  TestTensor(&tensors[6], &quant[6], kTfLiteFloat32, count, sizeof(float),
+             {1});
+
+  tflite::MicroMutableOpResolver<1> empty;
+  DetectionPostProcessResolver resolver(empty);
+  Kernel() = resolver.FindOp(DetectionPostProcessResolver::kOpName);
+  TfLiteRegistration registration = *Kernel();
+  registration.init = InitWithOptions;
+
+  int inputs[] = {3, 0, 1, 2};
+  int outputs[] = {4, 3, 4, 5, 6};
+  return TestRun(&registration, tensors, 7, inputs, outputs, nullptr);
+}
+
+// Number of detections that are not the expected anchors in order, with
+// their boxes, classes and scores, and of unused slots that are not zero
+int Mismatches(const Options& options, std::initializer_list<int> expected) {
+  float boxes[kMaxDetections * 4];
+  float classes[kMaxDetections];
+  float scores[kMaxDetections];
+  float count = -1.0f;
+  if (RunFixture(options, boxes, classes, scores, &count) != kTfLiteOk) {
+    return -1;
+  }
+
+  int mismatches = count == static_cast<float>(expected.size()) ? 0 : 1;
+  int i = 0;
+  for (int anchor : expected) {
+    for (int k = 0; k < 4; k++) {
+      mismatches += fabsf(boxes[i * 4 + k] - kBoxes[anchor][k]) > 1e-3f;
+    }
+    mismatches += classes[i] != static_cast<float>(kBestClass[anchor]);
+    mismatches +=
+        fabsf(scores[i] - (kBestScore[anchor] + 128) / 256.0f) > 1e-6f;
+    i++;
+  }
+  for (; i < options.max_detections; i++) {
+    for (int k = 0; k < 4; k++) {
+      mismatches += boxes[i * 4 + k] != 0.0f;
+    }
+    mismatches += classes[i] != 0.0f || scores[i] != 0.0f;
+  }
+  return mismatches;
+}
+
+}  // namespace
+
+TF_LITE_MICRO_TESTS_BEGIN
+
+TF_LITE_MICRO_TEST(SuppressesOverlapsAcrossClasses) {
+  // Anchor 1 takes anchor 0, anchor 3 takes anchor 2 of the other class
+  const Options options = {kMaxDetections, 0.5f, 0.5f, false};
+  TF_LITE_MICRO_EXPECT_EQ(0, Mismatches(options, {1, 3, 5}));
+}
+
+TF_LITE_MICRO_TEST(KeepsBoxesBelowIouThreshold) {
+  const Options options = {kMaxDetections, 0.5f, 0.9f, false};
+  TF_LITE_MICRO_EXPECT_EQ(0, Mismatches(options, {1, 0, 3, 2}));
+}
+
+TF_LITE_MICRO_TEST(StopsAtMaxDetections) {
+  const Options options = {2, 0.5f, 0.5f, false};
+  TF_LITE_MICRO_EXPECT_EQ(0, Mismatches(options, {1, 3}));
+}
+
+TF_LITE_MICRO_TEST(ScoreThreshold) {
+  // 0.9 is int8 103, only anchor 1 reaches it
+  const Options high = {kMaxDetections, 0.9f, 0.5f, false};
+  TF_LITE_MICRO_EXPECT_EQ(0, Mismatches(high, {1}));
+  // Everything passes, max_detections keeps the best four
+  const Options low = {kMaxDetections, 0.0f, 0.9f, false};
+  TF_LITE_MICRO_EXPECT_EQ(0, Mismatches(low, {1, 0, 3, 2}));
+}
+
+TF_LITE_MICRO_TEST(RegularNmsNeedsProjectKernel) {
+  float boxes[kMaxDetections * 4];
+  float classes[kMaxDetections];
+  float scores[kMaxDetections];
+  float count;
+  const Options options = {kMaxDetections, 0.5f, 0.5f, true};
+  TF_LITE_MICRO_EXPECT_EQ(
+      kTfLiteError, RunFixture(options, boxes, classes, scores, &count));
+}
+
+TF_LITE_MICRO_TESTS_END
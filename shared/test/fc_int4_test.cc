@@ -0,0 +1,190 @@
+#include "tensorflow/lite/c/builtin_op_data.h"
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/micro/all_ops_resolver.h"
+#include "tensorflow/lite/micro/testing/micro_test.h"
+
+#include "fc_int4.h"
+#include "kernel_test.h"
+
+// FullyConnectedInt4Resolver against reference FullyConnected. Weights are
+// drawn from -8..7 and given to the reference kernel as int8, so both have
+// to give the same output. Rows are packed the way quantize_int4.py does.
+
+namespace {
+
+constexpr int kMaxBatches = 3;
+constexpr int kMaxDepth = 40;
+constexpr int kMaxRows = 8;
+constexpr int kGroup = 8;
+
+struct FcCase {
+  int batches;
+  int depth;
+  int rows;
+  bool interleaved;  // "I4X8", else "INT4" in plain order
+  TfLiteFusedActivation activation;
+};
+
+// Magic and rows of (depth + 1) / 2 bytes, low nibble first
+int Pack(const int8_t* weights, int rows, int depth, bool interleaved,
+         uint8_t* packed) {
+  memcpy(packed, interleaved ? "I4X8" : "INT4", 4);
+  const int packed_row = (depth + 1) / 2;
+  memset(packed + 4, 0, rows * packed_row);
+  const int whole = interleaved ? depth - depth % kGroup : 0;
+  for (int r = 0; r < rows; r++) {
+    uint8_t* row = packed + 4 + r * packed_row;
+    for (int i = 0; i < depth; i++) {
+      const int k = i % kGroup;
+      const int at = i < whole ? i - k + k % 4 * 2 + k / 4 : i;
+      const uint8_t nibble = weights[r * depth + i] & 0x0F;
+      row[at / 2] |= at & 1 ? nibble << 4 : nibble;
+    }
+  }
+  return 4 + rows * packed_row;
+}
+
+TfLiteStatus RunFc(const TfLiteRegistration* registration, const FcCase& test,
+                   const int8_t* input, const void* filter,
+                   size_t filter_bytes, const int32_t* bias, int8_t* output) {
+  const float kInputScale = 0.04f;
+  const float kFilterScale = 0.09f;
+  TfLiteTensor tensors[4];
+  TestQuant quant[4];
+  TestTensor(&tensors[0], &quant[0], kTfLiteInt8, const_cast<int8_t*>(input),
+             test.batches * test.depth, {test.batches, test.depth},
+             kInputScale, 7);
+  TestTensor(&tensors[1], &quant[1], kTfLiteInt8, const_cast<void*>(filter),
+             filter_bytes, {test.rows, test.depth}, kFilterScale, 0);
+  TestTensor(&tensors[2], &quant[2], kTfLiteInt32, const_cast<int32_t*>(bias),
+             test.rows * sizeof(int32_t), {test.rows},
+             kInputScale * kFilterScale, 0);
+  TestTensor(&tensors[3], &quant[3], kTfLiteInt8, output,
+             test.batches * test.rows, {test.batches, test.rows}, 0.11f, -4);
+
+  TfLiteFullyConnectedParams params;
+  memset(&params, 0, sizeof(params));
+  params.activation = test.activation;
+  params.weights_format = kTfLiteFullyConnectedWeightsFormatDefault;
+  params.keep_num_dims = false;
+
+  int inputs[] = {3, 0, 1, 2};
+  int outputs[] = {1, 3};
+  return TestRun(registration, tensors, 4, inputs, outputs, &params);
+}
+
+// Index of first output of the int4 kernel that differs from reference
+// FullyConnected, -1 if none, -2 or -3 if a kernel fails
+int Compare(const FcCase& test, uint32_t seed) {
+  static int8_t input[kMaxBatches * kMaxDepth];
+  static int8_t weights[kMaxRows * kMaxDepth];
+  alignas(4) static uint8_t packed[4 + kMaxRows * (kMaxDepth + 1) / 2];
+  static int32_t bias[kMaxRows];
+  static int8_t expected[kMaxBatches * kMaxRows];
+  static int8_t actual[kMaxBatches * kMaxRows];
+
+  TestFill(input, test.batches * test.depth, &seed);
+  TestFill(weights, test.rows * test.depth, &seed, -8, 7);
+  for (int r = 0; r < test.rows; r++) {
+    bias[r] = TestRandom(&seed, -500, 500);
+  }
+  const int packed_bytes =
+      Pack(weights, test.rows, test.depth, test.interleaved, packed);
+
+  tflite::AllOpsResolver resolver;
+  FullyConnectedInt4Resolver int4_resolver(resolver);
+  if (RunFc(resolver.FindOp(tflite::BuiltinOperator_FULLY_CONNECTED), test,
+            input, weights, test.rows * test.depth, bias,
+            expected) != kTfLiteOk) {
+    return -2;
+  }
+  memset(actual, 0x55, sizeof(actual));
+  if (RunFc(int4_resolver.FindOp(tflite::BuiltinOperator_FULLY_CONNECTED),
+            test, input, packed, packed_bytes, bias, actual) != kTfLiteOk) {
+    return -3;
+  }
+  return TestMismatch(expected, actual, test.batches * test.rows);
+}
+
+}  // namespace
+
+TF_LITE_MICRO_TESTS_BEGIN
+
+TF_LITE_MICRO_TEST(InterleavedWholeGroups) {
+  const FcCase test = {2, 32, 5, true, kTfLiteActNone};
+  TF_LITE_MICRO_EXPECT_EQ(-1, Compare(test, 1));
+}
+
+TF_LITE_MICRO_TEST(InterleavedOddDepths) {
+  // Rows end in half a byte and a part group stored in plain order
+  const int depths[] = {1, 3, 7, 9, 13, 21, 39};
+  for (int depth : depths) {
+    const FcCase test = {3, depth, 4, true, kTfLiteActNone};
+    TF_LITE_MICRO_EXPECT_EQ(-1, Compare(test, depth));
+  }
+}
+
+TF_LITE_MICRO_TEST(PlainOrder) {
+  const int depths[] = {8, 15, 24, 37};
+  for (int depth : depths) {
+    const FcCase test = {2, depth, 6, false, kTfLiteActRelu};
+    TF_LITE_MICRO_EXPECT_EQ(-1, Compare(test, 100 + depth));
+  }
+}
+
+TF_LITE_MICRO_TEST(NegativeWeights) {
+  // -8 and -1 have the top bit of the nibble set, sign extension has to
+  // hold in either half of the byte
+  static int8_t input[16];
+  static int8_t weights[2 * 16];
+  alignas(4) static uint8_t packed[4 + 2 * 8];
+  static const int32_t bias[2] = {0, 0};
+  static int8_t expected[2];
+  static int8_t actual[2];
+  const FcCase test = {1, 16, 2, true, kTfLiteActNone};
+  uint32_t seed = 9;
+  TestFill(input, 16, &seed);
+  for (int i = 0; i < 16; i++) {
+    weights[i] = -8;
+    weights[16 + i] = i % 2 ? -1 : 7;
+  }
+  const int packed_bytes = Pack(weights, 2, 16, true, packed);
+
+  tflite::AllOpsResolver resolver;
+  FullyConnectedInt4Resolver int4_resolver(resolver);
+  TF_LITE_MICRO_EXPECT_EQ(
+      kTfLiteOk,
+      RunFc(resolver.FindOp(tflite::BuiltinOperator_FULLY_CONNECTED), test,
+            input, weights, sizeof(weights), bias, expected));
+  TF_LITE_MICRO_EXPECT_EQ(
+      kTfLiteOk,
+      RunFc(int4_resolver.FindOp(tflite::BuiltinOperator_FULLY_CONNECTED),
+            test, input, packed, packed_bytes, bias, actual));
+  TF_LITE_MICRO_EXPECT_EQ(-1, TestMismatch(expected, actual, sizeof(actual)));
+}
+
+TF_LITE_MICRO_TEST(Int8WeightsRunOriginalKernel) {
+  static int8_t input[2 * 12];
+  static int8_t weights[3 * 12];
+  static const int32_t bias[3] = {10, -20, 30};
+  static int8_t expected[2 * 3];
+  static int8_t actual[2 * 3];
+  const FcCase test = {2, 12, 3, true, kTfLiteActNone};
+  uint32_t seed = 11;
+  TestFill(input, sizeof(input), &seed);
+  TestFill(weights, sizeof(weights), &seed);
+
+  tflite::AllOpsResolver resolver;
+  FullyConnectedInt4Resolver int4_resolver(resolver);
+  TF_LITE_MICRO_EXPECT_EQ(
+      kTfLiteOk,
+      RunFc(resolver.FindOp(tflite::BuiltinOperator_FULLY_CONNECTED), test,
+            input, weights, sizeof(weights), bias, expected));
+  TF_LITE_MICRO_EXPECT_EQ(
+      kTfLiteOk,
+      RunFc(int4_resolver.FindOp(tflite::BuiltinOperator_FULLY_CONNECTED),
+            test, input, weights, sizeof(weights), bias, actual));
+  TF_LITE_MICRO_EXPECT_EQ(-1, TestMismatch(expected, actual, sizeof(actual)));
+}
+
+TF_LITE_MICRO_TESTS_END
@@ -0,0 +1,186 @@
+#include "tensorflow/lite/c/builtin_op_data.h"
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/micro/all_ops_resolver.h"
+#include "tensorflow/lite/micro/testing/micro_test.h"
+
+#include "fc_palette.h"
+#include "kernel_test.h"
+
+// FullyConnectedPaletteResolver against reference FullyConnected. Rows get
+// random palettes and indices, packed the way palettize_weights.py does,
+// and the reference kernel runs on the decoded int8 weights.
+
+namespace {
+
+using Palette = FullyConnectedPaletteResolver;
+
+constexpr int kMaxBatches = 2;
+constexpr int kMaxDepth = 1100;
+constexpr int kMaxRows = 8;
+constexpr int kMaxPacked =
+    Palette::kHeaderBytes +
+    kMaxRows * (Palette::kPaletteSize + (kMaxDepth + 1) / 2);
+
+struct FcCase {
+  int batches;
+  int depth;
+  int rows;
+  TfLiteFusedActivation activation;
+};
+
+// Header, 16 int8 values of each row and rows of nibbles, low nibble
+// first. Writes decoded weights into weights.
+int Palettize(int rows, int depth, uint32_t* seed, int8_t* weights,
+              uint8_t* packed) {
+  const int packed_row = (depth + 1) / 2;
+  memset(packed, 0, Palette::kHeaderBytes);
+  memcpy(packed, "PLT4", 4);
+  packed[4] = Palette::kVersion;
+  int8_t* palettes = reinterpret_cast<int8_t*>(packed + Palette::kHeaderBytes);
+  uint8_t* indices = packed + Palette::kHeaderBytes +
+                     rows * Palette::kPaletteSize;
+  memset(indices, 0, rows * packed_row);
+  TestFill(palettes, rows * Palette::kPaletteSize, seed);
+  for (int r = 0; r < rows; r++) {
+    for (int i = 0; i < depth; i++) {
+      const int index = TestRandom(seed, 0, Palette::kPaletteSize - 1);
+      weights[r * depth + i] = palettes[r * Palette::kPaletteSize + index];
+      indices[r * packed_row + i / 2] |= i & 1 ? index << 4 : index;
+    }
+  }
+  return Palette::kHeaderBytes + rows * (Palette::kPaletteSize + packed_row);
+}
+
+TfLiteStatus RunFc(const TfLiteRegistration* registration, const FcCase& test,
+                   const int8_t* input, const void* filter,
+                   size_t filter_bytes, const int32_t* bias, int8_t* output) {
+  const float kInputScale = 0.03f;
+  const float kFilterScale = 0.008f;
+  TfLiteTensor tensors[4];
+  TestQuant quant[4];
+  TestTensor(&tensors[0], &quant[0], kTfLiteInt8, const_cast<int8_t*>(input),
+             test.batches * test.depth, {test.batches, test.depth},
+             kInputScale, -11);
+  TestTensor(&tensors[1], &quant[1], kTfLiteInt8, const_cast<void*>(filter),
+             filter_bytes, {test.rows, test.depth}, kFilterScale, 0);
+  TestTensor(&tensors[2], &quant[2], kTfLiteInt32, const_cast<int32_t*>(bias),
+             test.rows * sizeof(int32_t), {test.rows},
+             kInputScale * kFilterScale, 0);
+  TestTensor(&tensors[3], &quant[3], kTfLiteInt8, output,
+             test.batches * test.rows, {test.batches, test.rows},
+             0.1f + test.depth * 0.0005f, 3);
+
+  TfLiteFullyConnectedParams params;
+  memset(&params, 0, sizeof(params));
+  params.activation = test.activation;
+  params.weights_format = kTfLiteFullyConnectedWeightsFormatDefault;
+  params.keep_num_dims = false;
+
+  int inputs[] = {3, 0, 1, 2};
+  int outputs[] = {1, 3};
+  return TestRun(registration, tensors, 4, inputs, outputs, &params);
+}
+
+// Index of first output that differs between the kernels, -1 if none, -2
+// or -3 if a kernel fails
+int Compare(const FcCase& test, uint32_t seed) {
+  static int8_t input[kMaxBatches * kMaxDepth];
+  static int8_t weights[kMaxRows * kMaxDepth];
+  static uint8_t packed[kMaxPacked];
+  static int32_t bias[kMaxRows];
+  static int8_t expected[kMaxBatches * kMaxRows];
+  static int8_t actual[kMaxBatches * kMaxRows];
+
+  TestFill(input, test.batches * test.depth, &seed);
+  const int packed_bytes =
+      Palettize(test.rows, test.depth, &seed, weights, packed);
+  for (int r = 0; r < test.rows; r++) {
+    bias[r] = TestRandom(&seed, -3000, 3000);
+  }
+
+  tflite::AllOpsResolver resolver;
+  Palette palette_resolver(resolver);
+  if (RunFc(resolver.FindOp(tflite::BuiltinOperator_FULLY_CONNECTED), test,
+            input, weights, test.rows * test.depth, bias,
+            expected) != kTfLiteOk) {
+    return -2;
+  }
+  memset(actual, 0x55, sizeof(actual));
+  if (RunFc(palette_resolver.FindOp(tflite::BuiltinOperator_FULLY_CONNECTED),
+            test, input, packed, packed_bytes, bias, actual) != kTfLiteOk) {
+    return -3;
+  }
+  return TestMismatch(expected, actual, test.batches * test.rows);
+}
+
+}  // namespace
+
+TF_LITE_MICRO_TESTS_BEGIN
+
+TF_LITE_MICRO_TEST(OddAndEvenDepths) {
+  const int depths[] = {1, 2, 7, 16, 33};
+  for (int depth : depths) {
+    const FcCase test = {2, depth, 5, kTfLiteActNone};
+    TF_LITE_MICRO_EXPECT_EQ(-1, Compare(test, depth));
+  }
+}
+
+TF_LITE_MICRO_TEST(Relu) {
+  const FcCase test = {1, 48, 8, kTfLiteActRelu};
+  TF_LITE_MICRO_EXPECT_EQ(-1, Compare(test, 40));
+}
+
+TF_LITE_MICRO_TEST(SeveralTiles) {
+  // kTileBytes holds 3 rows of 1100, last tile has 2
+  const FcCase test = {2, 1100, 8, kTfLiteActNone};
+  TF_LITE_MICRO_EXPECT_EQ(-1, Compare(test, 41));
+}
+
+TF_LITE_MICRO_TEST(OtherVersionIsRefused) {
+  static int8_t input[10];
+  static int8_t weights[3 * 10];
+  static uint8_t packed[Palette::kHeaderBytes +
+                        3 * (Palette::kPaletteSize + 5)];
+  static const int32_t bias[3] = {0, 0, 0};
+  static int8_t output[3];
+  const FcCase test = {1, 10, 3, kTfLiteActNone};
+  uint32_t seed = 42;
+  TestFill(input, sizeof(input), &seed);
+  const int packed_bytes = Palettize(3, 10, &seed, weights, packed);
+  packed[4] = Palette::kVersion + 1;
+
+  tflite::AllOpsResolver resolver;
+  Palette palette_resolver(resolver);
+  TF_LITE_MICRO_EXPECT_EQ(
+      kTfLiteError,
+      RunFc(palette_resolver.FindOp(tflite::BuiltinOperator_FULLY_CONNECTED),
+            test, input, packed, packed_bytes, bias, output));
+}
+
+TF_LITE_MICRO_TEST(Int8WeightsWithMagicRunOriginalKernel) {
+  // rows * depth bytes are plain weights, even if they start with "PLT4"
+  static int8_t input[2 * 12];
+  static int8_t weights[3 * 12];
+  static const int32_t bias[3] = {100, -200, 300};
+  static int8_t expected[2 * 3];
+  static int8_t actual[2 * 3];
+  const FcCase test = {2, 12, 3, kTfLiteActNone};
+  uint32_t seed = 43;
+  TestFill(input, sizeof(input), &seed);
+  TestFill(weights, sizeof(weights), &seed);
+  memcpy(weights, "PLT4", 4);
+
+  tflite::AllOpsResolver resolver;
+  Palette palette_resolver(resolver);
+  TF_LITE_MICRO_EXPECT_EQ(
+      kTfLiteOk,
+      RunFc(resolver.FindOp(tflite::BuiltinOperator_FULLY_CONNECTED), test,
+            input, weights, sizeof(weights), bias, expected));
+  TF_LITE_MICRO_EXPECT_EQ(
+      kTfLiteOk,
+      RunFc(palette_resolver.FindOp(tflite::BuiltinOperator_FULLY_CONNECTED),
+            test, input, weights, sizeof(weights), bias, actual));
+  TF_LITE_MICRO_EXPECT_EQ(-1, TestMismatch(expected, actual, sizeof(actual)));
+}
+
+TF_LITE_MICRO_TESTS_END
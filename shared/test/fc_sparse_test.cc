@@ -0,0 +1,198 @@
+#include "tensorflow/lite/c/builtin_op_data.h"
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/micro/all_ops_resolver.h"
+#include "tensorflow/lite/micro/testing/micro_test.h"
+
+#include "fc_sparse.h"
+#include "kernel_test.h"
+
+// FullyConnectedSparseResolver against reference FullyConnected. Random
+// weights get blocks zeroed and are packed the way sparsify_weights.py
+// does, the reference kernel runs on the same weights with the zeros.
+
+namespace {
+
+using Sparse = FullyConnectedSparseResolver;
+
+constexpr int kMaxBatches = 3;
+constexpr int kMaxDepth = 72;
+constexpr int kMaxRows = 8;
+constexpr int kBlock = Sparse::kBlock;
+constexpr int kMaxPacked =
+    4 + kMaxRows * ((kMaxDepth / kBlock + 7) / 8 + kMaxDepth);
+
+struct FcCase {
+  int batches;
+  int depth;
+  int rows;
+  int zero_percent;  // Share of blocks that are zeroed
+  bool bias;
+  TfLiteFusedActivation activation;
+};
+
+// "BSP4", bitmap of each row, LSB first, and 4 weights of each block that
+// is not all zero
+int Sparsify(const int8_t* weights, int rows, int depth, uint8_t* packed) {
+  const int blocks = depth / kBlock;
+  const int bitmap_row = (blocks + 7) / 8;
+  memcpy(packed, "BSP4", 4);
+  uint8_t* bitmap = packed + 4;
+  int8_t* stored = reinterpret_cast<int8_t*>(bitmap + rows * bitmap_row);
+  memset(bitmap, 0, rows * bitmap_row);
+  for (int r = 0; r < rows; r++) {
+    for (int b = 0; b < blocks; b++) {
+      const int8_t* block = weights + r * depth + b * kBlock;
+      if (block[0] || block[1] || block[2] || block[3]) {
+        bitmap[r * bitmap_row + b / 8] |= 1 << (b % 8);
+        memcpy(stored, block, kBlock);
+        stored += kBlock;
+      }
+    }
+  }
+  return reinterpret_cast<uint8_t*>(stored) - packed;
+}
+
+TfLiteStatus RunFc(const TfLiteRegistration* registration, const FcCase& test,
+                   const int8_t* input, const void* filter,
+                   size_t filter_bytes, const int32_t* bias, int8_t* output) {
+  const float kInputScale = 0.02f;
+  const float kFilterScale = 0.01f;
+  TfLiteTensor tensors[4];
+  TestQuant quant[4];
+  TestTensor(&tensors[0], &quant[0], kTfLiteInt8, const_cast<int8_t*>(input),
+             test.batches * test.depth, {test.batches, test.depth},
+             kInputScale, 13);
+  TestTensor(&tensors[1], &quant[1], kTfLiteInt8, const_cast<void*>(filter),
+             filter_bytes, {test.rows, test.depth}, kFilterScale, 0);
+  TestTensor(&tensors[2], &quant[2], kTfLiteInt8, output,
+             test.batches * test.rows, {test.batches, test.rows}, 0.25f, -6);
+  TestTensor(&tensors[3], &quant[3], kTfLiteInt32, const_cast<int32_t*>(bias),
+             test.rows * sizeof(int32_t), {test.rows},
+             kInputScale * kFilterScale, 0);
+
+  TfLiteFullyConnectedParams params;
+  memset(&params, 0, sizeof(params));
+  params.activation = test.activation;
+  params.weights_format = kTfLiteFullyConnectedWeightsFormatDefault;
+  params.keep_num_dims = false;
+
+  int with_bias[] = {3, 0, 1, 3};
+  int without_bias[] = {2, 0, 1};
+  int outputs[] = {1, 2};
+  return TestRun(registration, tensors, 4,
+                 test.bias ? with_bias : without_bias, outputs, &params);
+}
+
+// Index of first output that differs between the kernels, -1 if none, -2
+// or -3 if a kernel fails
+int Compare(const FcCase& test, uint32_t seed) {
+  static int8_t input[kMaxBatches * kMaxDepth];
+  static int8_t weights[kMaxRows * kMaxDepth];
+  static uint8_t packed[kMaxPacked];
+  static int32_t bias[kMaxRows];
+  static int8_t expected[kMaxBatches * kMaxRows];
+  static int8_t actual[kMaxBatches * kMaxRows];
+
+  TestFill(input, test.batches * test.depth, &seed);
+  TestFill(weights, test.rows * test.depth, &seed);
+  for (int i = 0; i < test.rows * test.depth; i += kBlock) {
+    if (TestRandom(&seed, 0, 99) < test.zero_percent) {
+      memset(weights + i, 0, kBlock);
+    } else if (TestRandom(&seed, 0, 3) == 0) {
+      // Block with some zeros is still stored
+      weights[i + TestRandom(&seed, 0, kBlock - 1)] = 0;
+    }
+  }
+  for (int r = 0; r < test.rows; r++) {
+    bias[r] = TestRandom(&seed, -1000, 1000);
+  }
+  const int packed_bytes = Sparsify(weights, test.rows, test.depth, packed);
+
+  tflite::AllOpsResolver resolver;
+  Sparse sparse_resolver(resolver);
+  if (RunFc(resolver.FindOp(tflite::BuiltinOperator_FULLY_CONNECTED), test,
+            input, weights, test.rows * test.depth, bias,
+            expected) != kTfLiteOk) {
+    return -2;
+  }
+  memset(actual, 0x55, sizeof(actual));
+  if (RunFc(sparse_resolver.FindOp(tflite::BuiltinOperator_FULLY_CONNECTED),
+            test, input, packed, packed_bytes, bias, actual) != kTfLiteOk) {
+    return -3;
+  }
+  return TestMismatch(expected, actual, test.batches * test.rows);
+}
+
+}  // namespace
+
+TF_LITE_MICRO_TESTS_BEGIN
+
+TF_LITE_MICRO_TEST(HalfOfBlocksPruned) {
+  const FcCase test = {2, 64, 6, 50, true, kTfLiteActNone};
+  TF_LITE_MICRO_EXPECT_EQ(-1, Compare(test, 1));
+}
+
+TF_LITE_MICRO_TEST(PartBitmapByte) {
+  // 9 and 3 blocks, last bitmap byte of each row is only partly used
+  const FcCase wide = {3, 36, 5, 30, true, kTfLiteActRelu};
+  const FcCase narrow = {1, 12, 8, 30, true, kTfLiteActNone};
+  TF_LITE_MICRO_EXPECT_EQ(-1, Compare(wide, 2));
+  TF_LITE_MICRO_EXPECT_EQ(-1, Compare(narrow, 3));
+}
+
+TF_LITE_MICRO_TEST(DenseAndEmptyRows) {
+  // No block pruned, then every block, which leaves only bias and offset
+  const FcCase dense = {2, 72, 4, 0, true, kTfLiteActNone};
+  const FcCase empty = {2, 72, 4, 100, true, kTfLiteActNone};
+  TF_LITE_MICRO_EXPECT_EQ(-1, Compare(dense, 4));
+  TF_LITE_MICRO_EXPECT_EQ(-1, Compare(empty, 5));
+}
+
+TF_LITE_MICRO_TEST(WithoutBias) {
+  const FcCase test = {2, 40, 7, 60, false, kTfLiteActNone};
+  TF_LITE_MICRO_EXPECT_EQ(-1, Compare(test, 6));
+}
+
+TF_LITE_MICRO_TEST(DepthNotMultipleOfBlockIsRefused) {
+  static int8_t input[10];
+  static uint8_t packed[4 + 1 + 2 * kBlock];
+  static const int32_t bias[2] = {0, 0};
+  static int8_t output[2];
+  const FcCase test = {1, 10, 2, 0, true, kTfLiteActNone};
+  memset(input, 1, sizeof(input));
+  memset(packed, 0, sizeof(packed));
+  memcpy(packed, "BSP4", 4);
+
+  tflite::AllOpsResolver resolver;
+  Sparse sparse_resolver(resolver);
+  TF_LITE_MICRO_EXPECT_EQ(
+      kTfLiteError,
+      RunFc(sparse_resolver.FindOp(tflite::BuiltinOperator_FULLY_CONNECTED),
+            test, input, packed, sizeof(packed), bias, output));
+}
+
+TF_LITE_MICRO_TEST(Int8WeightsRunOriginalKernel) {
+  static int8_t input[2 * 16];
+  static int8_t weights[3 * 16];
+  static const int32_t bias[3] = {10, 20, -30};
+  static int8_t expected[2 * 3];
+  static int8_t actual[2 * 3];
+  const FcCase test = {2, 16, 3, 0, true, kTfLiteActNone};
+  uint32_t seed = 7;
+  TestFill(input, sizeof(input), &seed);
+  TestFill(weights, sizeof(weights), &seed);
+
+  tflite::AllOpsResolver resolver;
+  Sparse sparse_resolver(resolver);
+  TF_LITE_MICRO_EXPECT_EQ(
+      kTfLiteOk,
+      RunFc(resolver.FindOp(tflite::BuiltinOperator_FULLY_CONNECTED), test,
+            input, weights, sizeof(weights), bias, expected));
+  TF_LITE_MICRO_EXPECT_EQ(
+      kTfLiteOk,
+      RunFc(sparse_resolver.FindOp(tflite::BuiltinOperator_FULLY_CONNECTED),
+            test, input, weights, sizeof(weights), bias, actual));
+  TF_LITE_MICRO_EXPECT_EQ(-1, TestMismatch(expected, actual, sizeof(actual)));
+}
+
+TF_LITE_MICRO_TESTS_END
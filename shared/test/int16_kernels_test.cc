@@ -0,0 +1,351 @@
+#include <math.h>
+
+#include "tensorflow/lite/c/builtin_op_data.h"
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/kernels/internal/quantization_util.h"
+#include "tensorflow/lite/kernels/internal/reference/integer_ops/conv.h"
+#include "tensorflow/lite/kernels/internal/reference/integer_ops/fully_connected.h"
+#include "tensorflow/lite/kernels/internal/types.h"
+#include "tensorflow/lite/kernels/padding.h"
+#include "tensorflow/lite/micro/all_ops_resolver.h"
+#include "tensorflow/lite/micro/testing/micro_test.h"
+
+#include "int16_kernels.h"
+#include "kernel_test.h"
+
+// Int16KernelResolver against reference 16x8 kernels. Micro registrations
+// of this TFLite version do not take int16, so Conv2D and FullyConnected
+// are compared exactly with reference_integer_ops of TFLite, with
+// multipliers computed the way Prepare() of TFLite does. Add and Mul are
+// compared with float math, off by at most one step of output.
+
+namespace {
+
+constexpr int kMaxInput = 9 * 9 * 5;
+constexpr int kMaxOutput = 9 * 9 * 4;
+constexpr int kMaxFilter = 4 * 9 * 5;
+constexpr int kMaxChannels = 4;
+constexpr int kMaxElements = 64;
+
+const float kInputScale = 0.001f;
+const float kFilterScales[kMaxChannels] = {0.011f, 0.006f, 0.018f, 0.009f};
+
+void FillInt16(int16_t* data, int count, uint32_t* seed) {
+  for (int i = 0; i < count; i++) {
+    data[i] = static_cast<int16_t>(TestRandom(seed, -32768, 32767));
+  }
+}
+
+void ActivationRange(TfLiteFusedActivation activation, int32_t* min,
+                     int32_t* max) {
+  *min = activation == kTfLiteActNone ? -32768 : 0;
+  *max = 32767;
+}
+
+struct ConvCase {
+  int rows;
+  int cols;
+  int depth;
+  int channels;
+  TfLitePadding padding;
+  int stride;
+  int dilation;
+  TfLiteFusedActivation activation;
+};
+
+// Index of first output of the int16 Conv2D that differs from reference,
+// -1 if none, -3 if the kernel fails
+int CompareConv(const ConvCase& test, uint32_t seed) {
+  static int16_t input[kMaxInput];
+  static int8_t filter[kMaxFilter];
+  static int64_t bias[kMaxChannels];
+  static int16_t expected[kMaxOutput];
+  static int16_t actual[kMaxOutput];
+  const float output_scale = 0.04f;
+
+  FillInt16(input, test.rows * test.cols * test.depth, &seed);
+  TestFill(filter, test.channels * 9 * test.depth, &seed, -127, 127);
+  for (int c = 0; c < test.channels; c++) {
+    bias[c] = TestRandom(&seed, -1000000, 1000000);
+  }
+
+  int out_rows;
+  int out_cols;
+  const TfLitePaddingValues padding = tflite::ComputePaddingHeightWidth(
+      test.stride, test.stride, test.dilation, test.dilation, test.rows,
+      test.cols, 3, 3, test.padding, &out_rows, &out_cols);
+  const int outputs = out_rows * out_cols * test.channels;
+
+  int32_t multipliers[kMaxChannels];
+  int32_t shifts[kMaxChannels];
+  for (int c = 0; c < test.channels; c++) {
+    int shift;
+    tflite::QuantizeMultiplier(static_cast<double>(kInputScale) *
+                                   static_cast<double>(kFilterScales[c]) /
+                                   static_cast<double>(output_scale),
+                               &multipliers[c], &shift);
+    shifts[c] = shift;
+  }
+  tflite::ConvParams op_params;
+  op_params.padding_values.height = padding.height;
+  op_params.padding_values.width = padding.width;
+  op_params.stride_height = test.stride;
+  op_params.stride_width = test.stride;
+  op_params.dilation_height_factor = test.dilation;
+  op_params.dilation_width_factor = test.dilation;
+  op_params.input_offset = 0;
+  op_params.weights_offset = 0;
+  op_params.output_offset = 0;
+  ActivationRange(test.activation, &op_params.quantized_activation_min,
+                  &op_params.quantized_activation_max);
+  tflite::reference_integer_ops::ConvPerChannel(
+      op_params, multipliers, shifts,
+      tflite::RuntimeShape({1, test.rows, test.cols, test.depth}), input,
+      tflite::RuntimeShape({test.channels, 3, 3, test.depth}), filter,
+      tflite::RuntimeShape({test.channels}), bias,
+      tflite::RuntimeShape({1, out_rows, out_cols, test.channels}),
+      expected);
+
+  float bias_scales[kMaxChannels];
+  for (int c = 0; c < test.channels; c++) {
+    bias_scales[c] = kInputScale * kFilterScales[c];
+  }
+  TfLiteTensor tensors[4];
+  TestQuant quant[4];
+  TestTensor(&tensors[0], &quant[0], kTfLiteInt16, input,
+             test.rows * test.cols * test.depth * sizeof(int16_t),
+             {1, test.rows, test.cols, test.depth}, kInputScale, 0);
+  TestTensor(&tensors[1], &quant[1], kTfLiteInt8, filter,
+             test.channels * 9 * test.depth, {test.channels, 3, 3, test.depth});
+  TestPerChannel(&tensors[1], &quant[1], kFilterScales, test.channels, 0);
+  TestTensor(&tensors[2], &quant[2], kTfLiteInt64, bias,
+             test.channels * sizeof(int64_t), {test.channels});
+  TestPerChannel(&tensors[2], &quant[2], bias_scales, test.channels, 0);
+  memset(actual, 0x55, sizeof(actual));
+  TestTensor(&tensors[3], &quant[3], kTfLiteInt16, actual,
+             outputs * sizeof(int16_t), {1, out_rows, out_cols, test.channels},
+             output_scale, 0);
+
+  TfLiteConvParams params;
+  memset(&params, 0, sizeof(params));
+  params.padding = test.padding;
+  params.stride_width = test.stride;
+  params.stride_height = test.stride;
+  params.dilation_width_factor = test.dilation;
+  params.dilation_height_factor = test.dilation;
+  params.activation = test.activation;
+
+  tflite::AllOpsResolver resolver;
+  Int16KernelResolver int16_resolver(resolver);
+  int inputs[] = {3, 0, 1, 2};
+  int output[] = {1, 3};
+  if (TestRun(int16_resolver.FindOp(tflite::BuiltinOperator_CONV_2D), tensors,
+              4, inputs, output, &params) != kTfLiteOk) {
+    return -3;
+  }
+  return TestMismatch(expected, actual, outputs * sizeof(int16_t));
+}
+
+// Same for FullyConnected with per tensor scale
+int CompareFullyConnected(int batches, int depth, int rows,
+                          TfLiteFusedActivation activation, uint32_t seed) {
+  static int16_t input[kMaxElements * 2];
+  static int8_t filter[kMaxElements * kMaxChannels];
+  static int64_t bias[kMaxChannels];
+  static int16_t expected[2 * kMaxChannels];
+  static int16_t actual[2 * kMaxChannels];
+  const float filter_scale = kFilterScales[0];
+  const float output_scale = 0.02f;
+
+  FillInt16(input, batches * depth, &seed);
+  TestFill(filter, rows * depth, &seed, -127, 127);
+  for (int r = 0; r < rows; r++) {
+    bias[r] = TestRandom(&seed, -1000000, 1000000);
+  }
+
+  tflite::FullyConnectedParams op_params;
+  op_params.input_offset = 0;
+  op_params.weights_offset = 0;
+  op_params.output_offset = 0;
+  tflite::QuantizeMultiplier(static_cast<double>(kInputScale) *
+                                 static_cast<double>(filter_scale) /
+                                 static_cast<double>(output_scale),
+                             &op_params.output_multiplier,
+                             &op_params.output_shift);
+  ActivationRange(activation, &op_params.quantized_activation_min,
+                  &op_params.quantized_activation_max);
+  tflite::reference_integer_ops::FullyConnected(
+      op_params, tflite::RuntimeShape({batches, depth}), input,
+      tflite::RuntimeShape({rows, depth}), filter, tflite::RuntimeShape({rows}),
+      bias, tflite::RuntimeShape({batches, rows}), expected);
+
+  TfLiteTensor tensors[4];
+  TestQuant quant[4];
+  TestTensor(&tensors[0], &quant[0], kTfLiteInt16, input,
+             batches * depth * sizeof(int16_t), {batches, depth}, kInputScale,
+             0);
+  TestTensor(&tensors[1], &quant[1], kTfLiteInt8, filter, rows * depth,
+             {rows, depth}, filter_scale, 0);
+  TestTensor(&tensors[2], &quant[2], kTfLiteInt64, bias,
+             rows * sizeof(int64_t), {rows}, kInputScale * filter_scale, 0);
+  memset(actual, 0x55, sizeof(actual));
+  TestTensor(&tensors[3], &quant[3], kTfLiteInt16, actual,
+             batches * rows * sizeof(int16_t), {batches, rows}, output_scale,
+             0);
+
+  TfLiteFullyConnectedParams params;
+  memset(&params, 0, sizeof(params));
+  params.activation = activation;
+  params.weights_format = kTfLiteFullyConnectedWeightsFormatDefault;
+
+  tflite::AllOpsResolver resolver;
+  Int16KernelResolver int16_resolver(resolver);
+  int inputs[] = {3, 0, 1, 2};
+  int output[] = {1, 3};
+  if (TestRun(int16_resolver.FindOp(tflite::BuiltinOperator_FULLY_CONNECTED),
+              tensors, 4, inputs, output, &params) != kTfLiteOk) {
+    return -3;
+  }
+  return TestMismatch(expected, actual, batches * rows * sizeof(int16_t));
+}
+
+// Largest difference of int16 Add or Mul from float math, -1 if the
+// kernel fails
+int ElementwiseError(bool add, float scale1, float scale2, float scale_out,
+                     uint32_t seed) {
+  static int16_t a[kMaxElements];
+  static int16_t b[kMaxElements];
+  static int16_t out[kMaxElements];
+  FillInt16(a, kMaxElements, &seed);
+  FillInt16(b, kMaxElements, &seed);
+
+  TfLiteTensor tensors[3];
+  TestQuant quant[3];
+  TestTensor(&tensors[0], &quant[0], kTfLiteInt16, a, sizeof(a),
+             {1, kMaxElements}, scale1, 0);
+  TestTensor(&tensors[1], &quant[1], kTfLiteInt16, b, sizeof(b),
+             {1, kMaxElements}, scale2, 0);
+  TestTensor(&tensors[2], &quant[2], kTfLiteInt16, out, sizeof(out),
+             {1, kMaxElements}, scale_out, 0);
+
+  TfLiteAddParams add_params;
+  TfLiteMulParams mul_params;
+  memset(&add_params, 0, sizeof(add_params));
+  memset(&mul_params, 0, sizeof(mul_params));
+  add_params.activation = kTfLiteActNone;
+  mul_params.activation = kTfLiteActNone;
+
+  tflite::AllOpsResolver resolver;
+  Int16KernelResolver int16_resolver(resolver);
+  int inputs[] = {2, 0, 1};
+  int outputs[] = {1, 2};
+  if (TestRun(int16_resolver.FindOp(add ? tflite::BuiltinOperator_ADD
+                                        : tflite::BuiltinOperator_MUL),
+              tensors, 3, inputs, outputs,
+              add ? static_cast<void*>(&add_params)
+                  : static_cast<void*>(&mul_params)) != kTfLiteOk) {
+    return -1;
+  }
+
+  int worst = 0;
+  for (int i = 0; i < kMaxElements; i++) {
+    const double real = add ? a[i] * static_cast<double>(scale1) +
+                                  b[i] * static_cast<double>(scale2)
+                            : a[i] * static_cast<double>(scale1) * b[i] *
+                                  static_cast<double>(scale2);
+    double q = round(real / scale_out);
+    q = q < -32768 ? -32768 : q > 32767 ? 32767 : q;
+    const int error = static_cast<int>(fabs(q - out[i]));
+    worst = error > worst ? error : worst;
+  }
+  return worst;
+}
+
+}  // namespace
+
+TF_LITE_MICRO_TESTS_BEGIN
+
+TF_LITE_MICRO_TEST(ConvSamePaddingOddDepth) {
+  // Depth 5 leaves one product after the groups of 4 of Dot()
+  const ConvCase test = {7, 6, 5, 4, kTfLitePaddingSame, 1, 1,
+                         kTfLiteActNone};
+  TF_LITE_MICRO_EXPECT_EQ(-1, CompareConv(test, 1));
+}
+
+TF_LITE_MICRO_TEST(ConvValidStrideTwo) {
+  const ConvCase test = {9, 8, 4, 3, kTfLitePaddingValid, 2, 1,
+                         kTfLiteActRelu};
+  TF_LITE_MICRO_EXPECT_EQ(-1, CompareConv(test, 2));
+}
+
+TF_LITE_MICRO_TEST(ConvDilation) {
+  const ConvCase test = {9, 9, 3, 2, kTfLitePaddingSame, 1, 2,
+                         kTfLiteActNone};
+  TF_LITE_MICRO_EXPECT_EQ(-1, CompareConv(test, 3));
+}
+
+TF_LITE_MICRO_TEST(FullyConnectedDepths) {
+  const int depths[] = {1, 3, 4, 7, 13, 32, 64};
+  for (int depth : depths) {
+    TF_LITE_MICRO_EXPECT_EQ(
+        -1, CompareFullyConnected(2, depth, 4, kTfLiteActNone, depth));
+  }
+  TF_LITE_MICRO_EXPECT_EQ(-1,
+                          CompareFullyConnected(1, 24, 3, kTfLiteActRelu, 99));
+}
+
+TF_LITE_MICRO_TEST(AddWithinOneStep) {
+  const int error = ElementwiseError(true, 0.001f, 0.0007f, 0.002f, 4);
+  TF_LITE_MICRO_EXPECT_GE(error, 0);
+  TF_LITE_MICRO_EXPECT_LE(error, 1);
+}
+
+TF_LITE_MICRO_TEST(MulWithinOneStep) {
+  const int error = ElementwiseError(false, 0.001f, 0.001f, 0.0655f, 5);
+  TF_LITE_MICRO_EXPECT_GE(error, 0);
+  TF_LITE_MICRO_EXPECT_LE(error, 1);
+}
+
+TF_LITE_MICRO_TEST(Int8RunsOriginalKernel) {
+  static int8_t input[2 * 10];
+  static int8_t filter[3 * 10];
+  static const int32_t bias[3] = {50, -50, 0};
+  static int8_t expected[2 * 3];
+  static int8_t actual[2 * 3];
+  uint32_t seed = 6;
+  TestFill(input, sizeof(input), &seed);
+  TestFill(filter, sizeof(filter), &seed);
+
+  TfLiteFullyConnectedParams params;
+  memset(&params, 0, sizeof(params));
+  params.activation = kTfLiteActNone;
+  params.weights_format = kTfLiteFullyConnectedWeightsFormatDefault;
+  int inputs[] = {3, 0, 1, 2};
+  int outputs[] = {1, 3};
+
+  tflite::AllOpsResolver resolver;
+  Int16KernelResolver int16_resolver(resolver);
+  int8_t* results[] = {expected, actual};
+  for (int run = 0; run < 2; run++) {
+    TfLiteTensor tensors[4];
+    TestQuant quant[4];
+    TestTensor(&tensors[0], &quant[0], kTfLiteInt8, input, sizeof(input),
+               {2, 10}, 0.05f, 2);
+    TestTensor(&tensors[1], &quant[1], kTfLiteInt8, filter, sizeof(filter),
+               {3, 10}, 0.01f, 0);
+    TestTensor(&tensors[2], &quant[2], kTfLiteInt32,
+               const_cast<int32_t*>(bias), sizeof(bias), {3}, 0.05f * 0.01f,
+               0);
+    TestTensor(&tensors[3], &quant[3], kTfLiteInt8, results[run], 6, {2, 3},
+               0.1f, 0);
+    const TfLiteRegistration* registration =
+        run == 0 ? resolver.FindOp(tflite::BuiltinOperator_FULLY_CONNECTED)
+                 : int16_resolver.FindOp(
+                       tflite::BuiltinOperator_FULLY_CONNECTED);
+    TF_LITE_MICRO_EXPECT_EQ(
+        kTfLiteOk, TestRun(registration, tensors, 4, inputs, outputs, &params));
+  }
+  TF_LITE_MICRO_EXPECT_EQ(-1, TestMismatch(expected, actual, sizeof(actual)));
+}
+
+TF_LITE_MICRO_TESTS_END
@@ -0,0 +1,135 @@
+#ifndef KERNEL_TEST_H
+#define KERNEL_TEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <initializer_list>
+
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/micro/kernels/kernel_runner.h"
+#include "tensorflow/lite/micro/micro_error_reporter.h"
+
+// Helpers of the kernel tests in shared/test.
+//
+// Every *_test.cc here is its own TF_LITE_MICRO_TESTS program, make
+// kernel_test of rules.mk builds and runs them against testlite.a of the
+// project. A test runs the same tensors through the reference
+// registration of AllOpsResolver and through the resolver of shared/
+// stacked on it and compares outputs exactly, kernels that claim bit
+// exact results have to give them for every input.
+//
+// KernelRunner allocates from one static buffer of 10000 bytes, which
+// each runner starts again from the beginning, so tensors stay small and
+// only one runner exists at a time.
+
+constexpr int kTestMaxDims = 4;
+constexpr int kTestMaxChannels = 32;
+
+// Dims and quantization that TfLiteTensor points into, laid out as
+// TfLiteIntArray and TfLiteFloatArray
+struct TestQuant {
+  struct {
+    int size;
+    int data[kTestMaxDims];
+  } dims;
+  struct {
+    int size;
+    float data[kTestMaxChannels];
+  } scale;
+  struct {
+    int size;
+    int data[kTestMaxChannels];
+  } zero_point;
+  TfLiteAffineQuantization affine;
+};
+
+// Fills tensor with data of bytes, quantized with one scale and zero point.
+// Unquantized types keep the quantization, kernels do not read it.
+inline void TestTensor(TfLiteTensor* tensor, TestQuant* quant, TfLiteType type,
+                       void* data, size_t bytes, std::initializer_list<int> dims,
+                       float scale = 1.0f, int zero_point = 0) {
+  memset(tensor, 0, sizeof(*tensor));
+  memset(quant, 0, sizeof(*quant));
+  for (int d : dims) {
+    quant->dims.data[quant->dims.size++] = d;
+  }
+  quant->scale.size = 1;
+  quant->scale.data[0] = scale;
+  quant->zero_point.size = 1;
+  quant->zero_point.data[0] = zero_point;
+  quant->affine.scale = reinterpret_cast<TfLiteFloatArray*>(&quant->scale);
+  quant->affine.zero_point =
+      reinterpret_cast<TfLiteIntArray*>(&quant->zero_point);
+  quant->affine.quantized_dimension = 0;
+
+  tensor->type = type;
+  tensor->data.data = data;
+  tensor->dims = reinterpret_cast<TfLiteIntArray*>(&quant->dims);
+  tensor->bytes = bytes;
+  tensor->allocation_type = kTfLiteMemNone;
+  tensor->params.scale = scale;
+  tensor->params.zero_point = zero_point;
+  tensor->quantization.type = kTfLiteAffineQuantization;
+  tensor->quantization.params = &quant->affine;
+}
+
+// Gives tensor one scale per channel along dimension, zero points are 0
+inline void TestPerChannel(TfLiteTensor* tensor, TestQuant* quant,
+                           const float* scales, int channels, int dimension) {
+  quant->scale.size = channels;
+  quant->zero_point.size = channels;
+  for (int c = 0; c < channels; c++) {
+    quant->scale.data[c] = scales[c];
+    quant->zero_point.data[c] = 0;
+  }
+  quant->affine.quantized_dimension = dimension;
+  tensor->params.scale = scales[0];
+  tensor->params.zero_point = 0;
+}
+
+// Runs Init(), Prepare() and Invoke() of registration, inputs and outputs
+// are indices into tensors laid out as TfLiteIntArray, {count, index...}
+inline TfLiteStatus TestRun(const TfLiteRegistration* registration,
+                            TfLiteTensor* tensors, int tensors_size,
+                            int* inputs, int* outputs, void* params) {
+  static tflite::MicroErrorReporter reporter;
+  if (registration == nullptr) {
+    return kTfLiteError;
+  }
+  tflite::micro::KernelRunner runner(
+      *registration, tensors, tensors_size,
+      reinterpret_cast<TfLiteIntArray*>(inputs),
+      reinterpret_cast<TfLiteIntArray*>(outputs), params, &reporter);
+  TfLiteStatus status = runner.InitAndPrepare();
+  return status == kTfLiteOk ? runner.Invoke() : status;
+}
+
+// Same random values on every host, seed is the state
+inline int32_t TestRandom(uint32_t* state, int32_t low, int32_t high) {
+  *state = *state * 1664525u + 1013904223u;
+  return low + static_cast<int32_t>((*state >> 8) %
+                                    static_cast<uint32_t>(high - low + 1));
+}
+
+inline void TestFill(int8_t* data, int count, uint32_t* state, int low = -128,
+                     int high = 127) {
+  for (int i = 0; i < count; i++) {
+    data[i] = static_cast<int8_t>(TestRandom(state, low, high));
+  }
+}
+
+// Index of the first byte where a and b differ, -1 if they are equal
+inline int TestMismatch(const void* a, const void* b, size_t bytes) {
+  const uint8_t* x = static_cast<const uint8_t*>(a);
+  const uint8_t* y = static_cast<const uint8_t*>(b);
+  for (size_t i = 0; i < bytes; i++) {
+    if (x[i] != y[i]) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+#endif  // KERNEL_TEST_H
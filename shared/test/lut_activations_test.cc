@@ -0,0 +1,143 @@
+#include "tensorflow/lite/c/builtin_op_data.h"
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/micro/all_ops_resolver.h"
+#include "tensorflow/lite/micro/testing/micro_test.h"
+
+#include "kernel_test.h"
+#include "lut_activations.h"
+
+// LutActivationResolver against reference int8 Softmax, Logistic and
+// Tanh. Reference kernels approximate exp in fixed point, tables are
+// computed in float, so outputs may be one step apart, never more.
+
+namespace {
+
+constexpr int kValues = 256;
+constexpr int kRows = 6;
+constexpr int kDepth = 10;
+
+// Runs op on input of dims through registration, output has the
+// quantization the reference kernel needs
+TfLiteStatus RunActivation(const TfLiteRegistration* registration,
+                           tflite::BuiltinOperator op, const int8_t* input,
+                           int rows, int depth, float input_scale,
+                           int input_zero_point, int8_t* output) {
+  const bool tanh = op == tflite::BuiltinOperator_TANH;
+  TfLiteTensor tensors[2];
+  TestQuant quant[2];
+  TestTensor(&tensors[0], &quant[0], kTfLiteInt8, const_cast<int8_t*>(input),
+             rows * depth, {rows, depth}, input_scale, input_zero_point);
+  TestTensor(&tensors[1], &quant[1], kTfLiteInt8, output, rows * depth,
+             {rows, depth}, tanh ? 1.0f / 128 : 1.0f / 256, tanh ? 0 : -128);
+
+  TfLiteSoftmaxParams params;
+  params.beta = 1.0f;
+  int inputs[] = {1, 0};
+  int outputs[] = {1, 1};
+  return TestRun(registration, tensors, 2, inputs, outputs,
+                 op == tflite::BuiltinOperator_SOFTMAX ? &params : nullptr);
+}
+
+// Largest difference from the reference kernel, -1 if a kernel fails
+int LargestError(tflite::BuiltinOperator op, const int8_t* input, int rows,
+                 int depth, float input_scale, int input_zero_point) {
+  static int8_t expected[kValues];
+  static int8_t actual[kValues];
+  tflite::AllOpsResolver resolver;
+  LutActivationResolver lut_resolver(resolver);
+  if (RunActivation(resolver.FindOp(op), op, input, rows, depth, input_scale,
+                    input_zero_point, expected) != kTfLiteOk ||
+      RunActivation(lut_resolver.FindOp(op), op, input, rows, depth,
+                    input_scale, input_zero_point, actual) != kTfLiteOk) {
+    return -1;
+  }
+  int worst = 0;
+  for (int i = 0; i < rows * depth; i++) {
+    const int error = expected[i] > actual[i] ? expected[i] - actual[i]
+                                              : actual[i] - expected[i];
+    worst = error > worst ? error : worst;
+  }
+  return worst;
+}
+
+// Every int8 value once, the whole table is compared
+const int8_t* AllValues() {
+  static int8_t values[kValues];
+  for (int i = 0; i < kValues; i++) {
+    values[i] = static_cast<int8_t>(i - 128);
+  }
+  return values;
+}
+
+}  // namespace
+
+TF_LITE_MICRO_TESTS_BEGIN
+
+TF_LITE_MICRO_TEST(LogisticEveryInput) {
+  const float scales[] = {0.02f, 0.0625f, 0.2f};
+  for (float scale : scales) {
+    const int error = LargestError(tflite::BuiltinOperator_LOGISTIC,
+                                   AllValues(), 1, kValues, scale, -7);
+    TF_LITE_MICRO_EXPECT_GE(error, 0);
+    TF_LITE_MICRO_EXPECT_LE(error, 1);
+  }
+}
+
+TF_LITE_MICRO_TEST(TanhEveryInput) {
+  const float scales[] = {0.01f, 0.03125f, 0.1f};
+  for (float scale : scales) {
+    const int error = LargestError(tflite::BuiltinOperator_TANH, AllValues(),
+                                   1, kValues, scale, 5);
+    TF_LITE_MICRO_EXPECT_GE(error, 0);
+    TF_LITE_MICRO_EXPECT_LE(error, 1);
+  }
+}
+
+TF_LITE_MICRO_TEST(SoftmaxRows) {
+  static int8_t input[kRows * kDepth];
+  uint32_t seed = 1;
+  TestFill(input, sizeof(input), &seed);
+  // Row of equal values and row with one value far above the rest
+  memset(input, 17, kDepth);
+  memset(input + kDepth, -128, kDepth);
+  input[kDepth + 3] = 127;
+
+  const float scales[] = {0.05f, 0.1f, 0.25f};
+  for (float scale : scales) {
+    const int error = LargestError(tflite::BuiltinOperator_SOFTMAX, input,
+                                   kRows, kDepth, scale, 3);
+    TF_LITE_MICRO_EXPECT_GE(error, 0);
+    TF_LITE_MICRO_EXPECT_LE(error, 1);
+  }
+}
+
+TF_LITE_MICRO_TEST(FloatRunsOriginalKernel) {
+  float input[kDepth];
+  float expected[kDepth];
+  float actual[kDepth];
+  for (int i = 0; i < kDepth; i++) {
+    input[i] = (i - 5) * 0.7f;
+  }
+
+  tflite::AllOpsResolver resolver;
+  LutActivationResolver lut_resolver(resolver);
+  float* results[] = {expected, actual};
+  for (int run = 0; run < 2; run++) {
+    TfLiteTensor tensors[2];
+    TestQuant quant[2];
+    TestTensor(&tensors[0], &quant[0], kTfLiteFloat32, input, sizeof(input),
+               {1, kDepth});
+    TestTensor(&tensors[1], &quant[1], kTfLiteFloat32, results[run],
+               sizeof(input), {1, kDepth});
+    int inputs[] = {1, 0};
+    int outputs[] = {1, 1};
+    const TfLiteRegistration* registration =
+        run == 0 ? resolver.FindOp(tflite::BuiltinOperator_LOGISTIC)
+                 : lut_resolver.FindOp(tflite::BuiltinOperator_LOGISTIC);
+    TF_LITE_MICRO_EXPECT_EQ(kTfLiteOk, TestRun(registration, tensors, 2,
+                                               inputs, outputs, nullptr));
+  }
+  TF_LITE_MICRO_EXPECT_EQ(-1, TestMismatch(expected, actual, sizeof(actual)));
+}
+
+TF_LITE_MICRO_TESTS_END
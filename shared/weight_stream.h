@@ -0,0 +1,377 @@
+#ifndef WEIGHT_STREAM_H
+#define WEIGHT_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/micro_op_resolver.h"
+
+#if __has_include("pff.h")
+#include "pff.h"
+#define WEIGHT_STREAM_PFF
+#elif __has_include("PetitFatFS/pff.h")
+#include "PetitFatFS/pff.h"
+#define WEIGHT_STREAM_PFF
+#endif
+
+// Weights of large layers streamed from external storage.
+//
+// stream_weights.py moves weights of Conv2D, DepthwiseConv2D and
+// FullyConnected into a separate file and leaves a stub with its offset
+// and length in the model, so models larger than internal flash fit.
+// File goes to QSPI flash or SD card. Resolver reads weights of a layer
+// into one half of a RAM buffer before the layer runs and points filter
+// tensor there, then starts reading the next layer into the other half,
+// which overlaps with the current layer if the source reads
+// asynchronously. Last layer prefetches the first one for the next
+// inference.
+//
+// Each half of the buffer has to hold the largest streamed layer, put it
+// into AXI SRAM, the same as a model loaded with model_loader.h. Kernels
+// only see weights in Eval(), so Conv2DSpecialisedResolver and the
+// palette and sparse FullyConnected kernels, which read them in
+// Prepare(), can not be stacked on top of streamed layers. Neither can
+// the fused and cached paths of Conv2DPoolResolver, which run Conv2D
+// without the wrapped registration: they leave streamed nodes to it and
+// reject fused ones in Prepare(). Other nodes run as they are.
+//
+// PrefetchResident() runs the same double buffer over FullyConnected
+// weights that stay in the model, plain int8 ones that fit into a half,
+// so a buffer in DTCM turns flash reads of the heaviest layers into zero
+// wait state ones. The source copies them with Copy(), see
+// weight_dma.c of power_test for DMA2 memory to memory. Layers are
+// numbered in the order Prepare() runs, the order of the memory plan and
+// of Invoke(), so the next one is the one to prefetch. Resolvers that
+// read weights in Eval(), like fc_batch.h, can be wrapped inside it,
+// palette and int4 weights are not plain and are left alone. A copy that
+// fails runs the layer on weights in the model.
+//
+// Callbacks are plain functions, so state is static and only one stream
+// can exist. Call Reset() before each model is set up.
+//
+// Usage example:
+// alignas(16) static uint8_t stream_buffer[2 * 64 * 1024];
+// static MappedWeightSource source(qspi_base);
+// static WeightStreamResolver stream_resolver(engine.resolver(), &source,
+//                                             stream_buffer,
+//                                             sizeof(stream_buffer));
+// engine.SetResolver(&stream_resolver);
+// stream_resolver.Reset();
+// engine.Setup(model_data, error_reporter);
+
+// Reads parts of the weights file
+class WeightSource {
+ public:
+  // Starts reading len bytes at offset into dst, may return before they
+  // arrive. Only one read is in flight at a time.
+  virtual bool Start(uint32_t offset, void* dst, uint32_t len) = 0;
+
+  // Waits until the read of last Start() or Copy() is finished
+  virtual bool Wait() = 0;
+
+  // Starts copying len bytes of weights in the model, at src in memory
+  // CPU reads, into dst. Sources that move data asynchronously override it.
+  virtual bool Copy(const void* src, void* dst, uint32_t len) {
+    memcpy(dst, src, len);
+    return true;
+  }
+
+ protected:
+  ~WeightSource() = default;
+};
+
+// Weights file in memory mapped storage, like QSPI flash in memory mapped
+// mode. Copy is done by CPU, subclass it to start a DMA transfer instead.
+class MappedWeightSource : public WeightSource {
+ public:
+  explicit MappedWeightSource(const void* base)
+      : base_(static_cast<const uint8_t*>(base)) {}
+
+  bool Start(uint32_t offset, void* dst, uint32_t len) override {
+    memcpy(dst, base_ + offset, len);
+    return true;
+  }
+
+  bool Wait() override { return true; }
+
+ private:
+  const uint8_t* base_;
+};
+
+#ifdef WEIGHT_STREAM_PFF
+// Weights file on SD card, opened with pf_open(). PetitFatFS reads
+// synchronously, so Start() returns when data is there and streaming does
+// not overlap with compute. Nothing else may use PetitFatFS meanwhile.
+class PffWeightSource : public WeightSource {
+ public:
+  bool Start(uint32_t offset, void* dst, uint32_t len) override {
+    ok_ = pf_lseek(offset) == FR_OK;
+    uint8_t* out = static_cast<uint8_t*>(dst);
+    while (ok_ && len > 0) {
+      UINT read = 0;
+      ok_ = pf_read(out, len, &read) == FR_OK && read > 0;
+      out += read;
+      len -= read;
+    }
+    return ok_;
+  }
+
+  bool Wait() override { return ok_; }
+
+ private:
+  bool ok_ = false;
+};
+#endif
+
+class WeightStreamResolver : public tflite::MicroOpResolver {
+ public:
+  static constexpr int kMaxLayers = 32;
+
+  WeightStreamResolver(const tflite::MicroOpResolver& base,
+                       WeightSource* source, void* buffer, size_t size)
+      : base_(base) {
+    State& state = GetState();
+    state.source = source;
+    state.buffers[0] = static_cast<uint8_t*>(buffer);
+    state.half = size / 2 & ~static_cast<size_t>(15);
+    state.buffers[1] = state.buffers[0] + state.half;
+    state.pending = -1;
+    state.resident_min = 0;
+    Reset();
+  }
+
+  // Also prefetches weights in the model of FullyConnected nodes with at
+  // least min_bytes, smaller ones stay in cache anyway. 0 turns it off.
+  // Takes effect with the next model that is set up.
+  void PrefetchResident(size_t min_bytes) {
+    GetState().resident_min = min_bytes;
+  }
+
+  // Forgets layers of the previous model, its interpreter must not run
+  void Reset() {
+    State& state = GetState();
+    if (state.pending >= 0) {
+      state.source->Wait();
+    }
+    state.count = 0;
+    state.pending = -1;
+    state.pending_buffer = 0;
+  }
+
+  // Number of streamed and prefetched layers of the model that was set up
+  int layers() const { return GetState().count; }
+
+  // Layers are found in Prepare(), keep the state together with the
+  // interpreter, look at InferenceEngine::SaveState()
+  void* state() const { return &GetState(); }
+  size_t state_size() const { return sizeof(State); }
+
+  const TfLiteRegistration* FindOp(tflite::BuiltinOperator op) const override {
+    const TfLiteRegistration* registration = base_.FindOp(op);
+    if (registration == nullptr) {
+      return nullptr;
+    }
+
+    // Kernels with constant weights in input 1
+    switch (op) {
+      case tflite::BuiltinOperator_CONV_2D:
+        return Wrap<0>(registration);
+      case tflite::BuiltinOperator_DEPTHWISE_CONV_2D:
+        return Wrap<1>(registration);
+      case tflite::BuiltinOperator_FULLY_CONNECTED:
+        return Wrap<2>(registration);
+      default:
+        return registration;
+    }
+  }
+
+  const TfLiteRegistration* FindOp(const char* op) const override {
+    return base_.FindOp(op);
+  }
+
+  BuiltinParseFunction GetOpDataParser(
+      tflite::BuiltinOperator op) const override {
+    return base_.GetOpDataParser(op);
+  }
+
+  // Returns true if weights were moved out by stream_weights.py
+  static bool IsStreamed(const void* weights) {
+    return weights != nullptr && memcmp(weights, "EXT1", 4) == 0;
+  }
+
+ private:
+  static constexpr int kSlots = 3;
+
+  struct Layer {
+    uint32_t offset;        // In weights file
+    uint32_t length;
+    const void* resident;   // Weights in the model, nullptr if streamed
+  };
+
+  struct State {
+    WeightSource* source;
+    uint8_t* buffers[2];
+    size_t half;            // Bytes of each buffer
+    size_t resident_min;    // Of PrefetchResident(), 0 if off
+    int count;
+    int pending;            // Layer being read, -1 if none
+    int pending_buffer;     // Buffer it is read into
+    bool pending_ok;
+    Layer layers[kMaxLayers];
+    const TfLiteRegistration* generic[kSlots];
+  };
+
+  struct OpData {
+    void* generic_data;
+    int layer;              // -1 if weights are in the model
+  };
+
+  template <int kSlot>
+  const TfLiteRegistration* Wrap(const TfLiteRegistration* registration) const {
+    // Keep builtin code and version, so profiler still reports them
+    GetState().generic[kSlot] = registration;
+    registrations_[kSlot] = *registration;
+    registrations_[kSlot].init = Init<kSlot>;
+    registrations_[kSlot].free = nullptr;
+    registrations_[kSlot].prepare = Prepare<kSlot>;
+    registrations_[kSlot].invoke = Eval<kSlot>;
+    return &registrations_[kSlot];
+  }
+
+  template <int kSlot>
+  static void* Init(TfLiteContext* context, const char* buffer,
+                    size_t length) {
+    const TfLiteRegistration* generic = GetState().generic[kSlot];
+    OpData* data = static_cast<OpData*>(
+        context->AllocatePersistentBuffer(context, sizeof(OpData)));
+    if (data == nullptr) {
+      return nullptr;
+    }
+    data->generic_data =
+        generic->init ? generic->init(context, buffer, length) : nullptr;
+    data->layer = -1;
+    return data;
+  }
+
+  template <int kSlot>
+  static TfLiteStatus Prepare(TfLiteContext* context, TfLiteNode* node) {
+    State& state = GetState();
+    OpData* data = static_cast<OpData*>(node->user_data);
+    const TfLiteTensor* filter = tflite::GetInput(context, node, 1);
+
+    data->layer = -1;
+    if (IsStreamed(filter->data.raw)) {
+      if (state.count == kMaxLayers) {
+        TF_LITE_KERNEL_LOG(context, "More than %d streamed layers",
+                           kMaxLayers);
+        return kTfLiteError;
+      }
+      Layer& layer = state.layers[state.count];
+      memcpy(&layer.offset, filter->data.raw + 4, 4);
+      memcpy(&layer.length, filter->data.raw + 8, 4);
+      layer.resident = nullptr;
+      if (layer.length > state.half) {
+        TF_LITE_KERNEL_LOG(context, "Streamed weights of %d bytes do not "
+                           "fit into %d", static_cast<int>(layer.length),
+                           static_cast<int>(state.half));
+        return kTfLiteError;
+      }
+      data->layer = state.count++;
+    } else if (kSlot == 2 && IsResident(filter, state) &&
+               state.count < kMaxLayers) {
+      Layer& layer = state.layers[state.count];
+      layer.offset = 0;
+      layer.length = filter->bytes;
+      layer.resident = filter->data.raw;
+      data->layer = state.count++;
+    }
+
+    const TfLiteRegistration* generic = state.generic[kSlot];
+    node->user_data = data->generic_data;
+    TfLiteStatus status =
+        generic->prepare ? generic->prepare(context, node) : kTfLiteOk;
+    node->user_data = data;
+    return status;
+  }
+
+  template <int kSlot>
+  static TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
+    State& state = GetState();
+    OpData* data = static_cast<OpData*>(node->user_data);
+    const TfLiteRegistration* generic = state.generic[kSlot];
+
+    TfLiteEvalTensor* filter = nullptr;
+    void* weights = nullptr;
+    if (data->layer >= 0) {
+      // Prefetch misses only for the first inference or after an error
+      if (state.pending != data->layer) {
+        if (state.pending >= 0) {
+          state.source->Wait();
+        }
+        Load(data->layer, state.pending_buffer);
+      }
+      bool loaded = state.pending_ok && state.source->Wait();
+      int buffer = state.pending_buffer;
+      if (!loaded && state.layers[data->layer].resident == nullptr) {
+        state.pending = -1;
+        TF_LITE_KERNEL_LOG(context, "Reading streamed weights failed");
+        return kTfLiteError;
+      }
+
+      // Failed copy of weights in the model runs on the model itself
+      if (loaded) {
+        filter = context->GetEvalTensor(context, node->inputs->data[1]);
+        weights = filter->data.data;
+        filter->data.data = state.buffers[buffer];
+      }
+      Load((data->layer + 1) % state.count, buffer ^ 1);
+    }
+
+    node->user_data = data->generic_data;
+    TfLiteStatus status = generic->invoke(context, node);
+    node->user_data = data;
+
+    if (filter != nullptr) {
+      filter->data.data = weights;
+    }
+    return status;
+  }
+
+  // Plain int8 weights of the model that are worth a copy and fit
+  static bool IsResident(const TfLiteTensor* filter, const State& state) {
+    return state.resident_min > 0 && filter->data.raw != nullptr &&
+           filter->allocation_type == kTfLiteMmapRo &&
+           filter->type == kTfLiteInt8 &&
+           filter->bytes == static_cast<size_t>(tflite::NumElements(filter)) &&
+           filter->bytes >= state.resident_min && filter->bytes <= state.half;
+  }
+
+  static void Load(int layer, int buffer) {
+    State& state = GetState();
+    const Layer& next = state.layers[layer];
+    state.pending = layer;
+    state.pending_buffer = buffer;
+    if (next.resident != nullptr) {
+      state.pending_ok = state.source->Copy(next.resident,
+                                            state.buffers[buffer],
+                                            next.length);
+    } else {
+      state.pending_ok = state.source->Start(next.offset,
+                                             state.buffers[buffer],
+                                             next.length);
+    }
+  }
+
+  static State& GetState() {
+    static State state;
+    return state;
+  }
+
+  const tflite::MicroOpResolver& base_;
+  mutable TfLiteRegistration registrations_[kSlots];
+};
+
+#endif  // WEIGHT_STREAM_H
@@ -0,0 +1,245 @@
+#!/usr/bin/env python3
+"""Prints memory usage of firmware from its linker map and checks budgets.
+
+Usage:
+    size_report.py MAP [--split=REGION=NAME:SIZE,...] [NAME=BUDGET ...]
+
+MAP is firmware.map, which rules.mk links with -Map. Memory regions
+(rom, ram, itcm) are read from its "Memory Configuration", so nothing is
+hard-coded per chip. --split divides a region into parts with their own
+name, for example ram of stm32f7 into DTCM, SRAM1 and SRAM2, parts follow
+each other from origin of the region.
+
+For every region or part the report has used and free bytes, then the
+largest input sections, with -ffunction-sections and -fdata-sections these
+are single functions and variables like tensor arena, model or images,
+and the largest objects. Sections with load address in flash, like .data
+and .itcm_text, count in both places. A section that crosses from one
+part into the next counts in each with the bytes that lie there.
+
+NAME=BUDGET sets the most a region or part may use, sizes take K and M
+suffixes, for example rom=1536K DTCM=120K. Every region is also limited
+by its length. Exit status is 1 if anything is over, so make stops.
+"""
+
+import re
+import sys
+
+TOP_COUNT = 8
+
+# Not placed in memory of the target
+SKIPPED_SECTIONS = (".debug", ".comment", ".ARM.attributes", ".stab",
+                    ".gnu.attributes", "/DISCARD/")
+
+
+def parse_size(text):
+    text = text.strip()
+    scale = 1
+    if text[-1] in "kK":
+        scale, text = 1024, text[:-1]
+    elif text[-1] in "mM":
+        scale, text = 1024 * 1024, text[:-1]
+    return int(text, 0) * scale
+
+
+def read_regions(lines):
+    """Returns [(name, origin, length)] from Memory Configuration."""
+    regions = []
+    inside = False
+    for line in lines:
+        if line.startswith("Memory Configuration"):
+            inside = True
+        elif line.startswith("Linker script and memory map"):
+            break
+        elif inside:
+            fields = line.split()
+            if (len(fields) >= 3 and fields[1].startswith("0x") and
+                    fields[0] != "*default*"):
+                regions.append((fields[0], int(fields[1], 16),
+                                int(fields[2], 16)))
+    return regions
+
+
+def object_name(path):
+    """Shortens /long/path/lib.a(member.o) to lib.a(member.o)."""
+    return re.sub(r"^.*/", "", path)
+
+
+def read_sections(lines):
+    """Returns output sections as [(name, address, size, load, inputs)],
+    inputs are [(name, address, size, object)]."""
+    sections = []
+    current = None
+    pending = None
+    started = False
+    for line in lines:
+        if not started:
+            started = line.startswith("Linker script and memory map")
+            continue
+
+        # Output section starts in the first column, long names wrap
+        match = re.match(r"^(\.\S+|\S+)\s*(?:(0x[0-9a-f]+)\s+(0x[0-9a-f]+)"
+                         r"(?:\s+load address (0x[0-9a-f]+))?)?\s*$", line)
+        if match and not line[0].isspace():
+            pending = None
+            name, address, size, load = match.groups()
+            if name.startswith(SKIPPED_SECTIONS) or name.startswith("OUTPUT"):
+                current = None
+                continue
+            current = [name, None, 0, None, []]
+            sections.append(current)
+            if address:
+                current[1:4] = [int(address, 16), int(size, 16),
+                                int(load, 16) if load else None]
+            else:
+                pending = "output"
+            continue
+
+        if current is None:
+            continue
+
+        if pending == "output":
+            match = re.match(r"^\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)"
+                             r"(?:\s+load address (0x[0-9a-f]+))?", line)
+            pending = None
+            if match:
+                address, size, load = match.groups()
+                current[1:4] = [int(address, 16), int(size, 16),
+                                int(load, 16) if load else None]
+                continue
+
+        # Input section, " .text.main 0x08000000 0x40 build/main.o", name
+        # can be on its own line before address, fill has no object
+        match = re.match(r"^ (\S+)\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)"
+                         r"(?:\s+(\S.*?))?\s*$", line)
+        if match:
+            name, address, size, obj = match.groups()
+            if name == "*fill*" or obj is None:
+                obj = "(fill)"
+            current[4].append((name, int(address, 16), int(size, 16),
+                               object_name(obj.strip())))
+            pending = None
+            continue
+        match = re.match(r"^ (\S+)\s*$", line)
+        if match and not match.group(1).startswith("*"):
+            pending = match.group(1)
+            continue
+        match = re.match(r"^\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(\S.*)$", line)
+        if match and pending:
+            address, size, obj = match.groups()
+            current[4].append((pending, int(address, 16), int(size, 16),
+                               object_name(obj.strip())))
+        pending = None
+    return [s for s in sections if s[1] is not None and s[2]]
+
+
+def split_regions(regions, splits):
+    """Replaces split regions with their parts."""
+    areas = []
+    for name, origin, length in regions:
+        if name not in splits:
+            areas.append((name, origin, length))
+            continue
+        for part, size in splits[name]:
+            areas.append((part, origin, size))
+            origin += size
+    return areas
+
+
+def overlaps(areas, address, size):
+    """Returns [(index, bytes)] of areas that [address, address + size)
+    overlaps, a section that spills over a split counts in both parts."""
+    result = []
+    for index, (_, origin, length) in enumerate(areas):
+        start = max(address, origin)
+        end = min(address + size, origin + length)
+        if start < end:
+            result.append((index, end - start))
+    return result
+
+
+def main():
+    args = sys.argv[1:]
+    if not args or args[0].startswith("-"):
+        print(__doc__.split("\n\n")[1])
+        return 1
+
+    splits = {}
+    budgets = {}
+    for arg in args[1:]:
+        if arg.startswith("--split="):
+            region, parts = arg[len("--split="):].split("=", 1)
+            for part in parts.split(","):
+                name, size = part.split(":")
+                splits.setdefault(region, []).append((name, parse_size(size)))
+        elif "=" in arg:
+            name, size = arg.split("=")
+            budgets[name] = parse_size(size)
+
+    with open(args[0]) as f:
+        lines = f.read().splitlines()
+
+    areas = split_regions(read_regions(lines), splits)
+    used = [0] * len(areas)
+    by_section = [{} for _ in areas]
+    by_object = [{} for _ in areas]
+
+    # Input sections are counted by their own address and split over the
+    # areas they cover, a split can fall in the middle of an output section
+    # or of one input section, like a tensor arena that goes on from DTCM
+    # into SRAM1
+    for name, address, size, load, inputs in read_sections(lines):
+        offsets = [0]
+        if load is not None and load != address:
+            offsets.append(load - address)
+        for offset in offsets:
+            if not inputs:
+                for index, part in overlaps(areas, address + offset, size):
+                    used[index] += part
+                    by_section[index][name] = part
+                continue
+            for input_name, input_address, input_size, obj in inputs:
+                label = "%s %s" % (name, input_name) if offset else input_name
+                for index, part in overlaps(areas, input_address + offset,
+                                            input_size):
+                    used[index] += part
+                    by_section[index][label] = (
+                        by_section[index].get(label, 0) + part)
+                    by_object[index][obj] = (by_object[index].get(obj, 0) +
+                                             part)
+
+    failed = False
+    print("%-8s %10s %10s %10s %6s" % ("Region", "Used", "Budget", "Free",
+                                        "Use"))
+    for index, (area, _, length) in enumerate(areas):
+        budget = min(budgets.get(area, length), length)
+        over = used[index] > budget
+        failed |= over
+        print("%-8s %10d %10d %10d %5d%%%s" %
+              (area, used[index], budget, budget - used[index],
+               100 * used[index] // budget if budget else 0,
+               "  OVER BUDGET" if over else ""))
+
+    for index, (area, _, _) in enumerate(areas):
+        if not used[index]:
+            continue
+        print("\n%s, largest sections:" % area)
+        for label, size in sorted(by_section[index].items(),
+                                  key=lambda item: -item[1])[:TOP_COUNT]:
+            print("  %10d  %s" % (size, label))
+        if by_object[index]:
+            print("%s, largest objects:" % area)
+            for obj, size in sorted(by_object[index].items(),
+                                    key=lambda item: -item[1])[:TOP_COUNT]:
+                print("  %10d  %s" % (size, obj))
+
+    unknown = [name for name in budgets if name not in
+               [area for area, _, _ in areas]]
+    if unknown:
+        print("\nNo region named %s" % ", ".join(unknown))
+        failed = True
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,194 @@
+#!/usr/bin/env python3
+"""Stores FullyConnected weights of a TFLite model as sparse 1x4 blocks.
+
+Usage:
+    sparsify_weights.py [--prune FRACTION] MODEL OUTPUT
+
+MODEL is either a .tflite flatbuffer or a .cc file with the model as C
+array, OUTPUT is written in the same format. Weights are split into
+blocks of 4 consecutive weights of a row, blocks that are all zero are
+left out and FullyConnectedSparseResolver in fc_sparse.h skips their
+multiply accumulate. Half of the blocks pruned is close to twice as fast.
+
+Weights buffer then holds:
+    "BSP4", bitmap of each row, (depth / 4 + 7) / 8 bytes, bit set for
+    a stored block, LSB first, 4 int8 values of each stored block
+Quantization of the tensor stays the same, weights need zero point 0.
+
+Models from the converter rarely have zero blocks. --prune zeroes the
+given fraction of blocks of each row, those with the smallest sum of
+absolute values, which is magnitude pruning without fine tuning, so
+check accuracy of the model afterwards. Pruning during training keeps
+it, then no --prune is needed. Only tensors of at least 4096 bytes
+that get smaller are converted, depth has to be a multiple of 4. Freed
+part of the buffer is removed the same way as in palettize_weights.py.
+"""
+
+import struct
+import sys
+
+import gen_model_ops as ops
+import palettize_weights as palette
+
+FULLY_CONNECTED = 9
+MAGIC = b"BSP4"
+BLOCK = 4
+TYPE_INT8 = 9
+MIN_BYTES = 4096        # Pruning small layers costs accuracy for nothing
+
+# Schema field indices, rest of them are in gen_model_ops.py
+TENSOR_QUANTIZATION = 4
+QUANTIZATION_ZERO_POINT = 3
+
+
+def zero_points(buf, tensor):
+    pos = ops.field_pos(buf, tensor, TENSOR_QUANTIZATION)
+    if pos is None:
+        return []
+    table = pos + ops.u32(buf, pos)
+    vector = ops.vector_pos(buf, table, QUANTIZATION_ZERO_POINT)
+    if vector is None:
+        return []
+    return struct.unpack_from("<%dq" % ops.u32(buf, vector), buf, vector + 4)
+
+
+def pack(weights, rows, depth, prune):
+    """Returns packed buffer, number of stored blocks and largest pruned
+    weight."""
+    blocks = depth // BLOCK
+    bitmap = bytearray()
+    packed = bytearray()
+    stored = 0
+    worst = 0
+    for r in range(rows):
+        row = [weights[r * depth + b * BLOCK:r * depth + (b + 1) * BLOCK]
+               for b in range(blocks)]
+        magnitude = sorted(range(blocks),
+                           key=lambda b: sum(abs(w) for w in row[b]))
+        pruned = set(magnitude[:int(blocks * prune)])
+        bits = bytearray((blocks + 7) // 8)
+        for b in range(blocks):
+            if b in pruned:
+                worst = max([worst] + [abs(w) for w in row[b]])
+            elif any(row[b]):
+                bits[b // 8] |= 1 << (b % 8)
+                packed += struct.pack("<4b", *row[b])
+                stored += 1
+        bitmap += bits
+    return MAGIC + bitmap + packed, stored, worst
+
+
+def sparsify(buf, prune):
+    """Returns number of converted tensors, buf is a bytearray."""
+    if buf[4:8] != b"TFL3":
+        raise ValueError("not a TFLite flatbuffer")
+
+    model = ops.u32(buf, 0)
+    subgraphs = ops.vector_tables(buf, model, ops.MODEL_SUBGRAPHS)
+    if len(subgraphs) != 1:
+        raise ValueError("only models with one subgraph are supported")
+
+    codes = []
+    for opcode in ops.vector_tables(buf, model, ops.MODEL_OPERATOR_CODES):
+        code = 0
+        pos = ops.field_pos(buf, opcode, ops.OPCODE_DEPRECATED_BUILTIN_CODE)
+        if pos is not None:
+            code = struct.unpack_from("<b", buf, pos)[0]
+        pos = ops.field_pos(buf, opcode, ops.OPCODE_BUILTIN_CODE)
+        if pos is not None:
+            code = max(code, struct.unpack_from("<i", buf, pos)[0])
+        codes.append(code)
+
+    weights = []
+    for operator in ops.vector_tables(buf, subgraphs[0],
+                                      ops.SUBGRAPH_OPERATORS):
+        pos = ops.field_pos(buf, operator, ops.OPERATOR_OPCODE_INDEX)
+        if codes[ops.u32(buf, pos) if pos is not None else 0] == \
+                FULLY_CONNECTED:
+            weights.append(ops.int_vector(
+                buf, operator, palette.OPERATOR_INPUTS)[1])
+
+    count = 0
+    for index in sorted(set(weights)):
+        # Positions move after each removal, so everything is found again
+        model = ops.u32(buf, 0)
+        subgraph = ops.vector_tables(buf, model, ops.MODEL_SUBGRAPHS)[0]
+        tensor = ops.vector_tables(buf, subgraph,
+                                   palette.SUBGRAPH_TENSORS)[index]
+        shape = ops.int_vector(buf, tensor, palette.TENSOR_SHAPE)
+        tensor_type = struct.unpack_from(
+            "<b", buf, ops.field_pos(buf, tensor, palette.TENSOR_TYPE))[0]
+        pos = ops.field_pos(buf, tensor, palette.TENSOR_BUFFER)
+        buffer = ops.vector_tables(buf, model, palette.MODEL_BUFFERS)[
+            ops.u32(buf, pos) if pos is not None else 0]
+        data = ops.vector_pos(buf, buffer, palette.BUFFER_DATA)
+        if tensor_type != TYPE_INT8 or len(shape) != 2 or data is None or \
+                shape[1] % BLOCK or \
+                ops.u32(buf, data) != shape[0] * shape[1] or \
+                ops.u32(buf, data) < MIN_BYTES or \
+                any(zero_points(buf, tensor)):
+            continue
+        if bytes(buf[data + 4:data + 8]) in (MAGIC, palette.MAGIC):
+            raise ValueError("tensor %d is already converted" % index)
+
+        rows, depth = shape
+        values = struct.unpack_from("<%db" % (rows * depth), buf, data + 4)
+        packed, stored, worst = pack(values, rows, depth, prune)
+        old_length = ops.u32(buf, data)
+        if len(packed) >= old_length:
+            print("Tensor %d %dx%d: %d of %d blocks stored, not smaller"
+                  % (index, rows, depth, stored, rows * depth // BLOCK))
+            continue
+
+        slots = palette.offset_slots(buf)
+        struct.pack_into("<I", buf, data, len(packed))
+        buf[data + 4:data + 4 + len(packed)] = packed
+
+        # Whole alignment units are removed, the rest stays as padding
+        start = data + 4 + len(packed)
+        start += -start % palette.ALIGNMENT
+        end = start + (data + 4 + old_length - start) // \
+            palette.ALIGNMENT * palette.ALIGNMENT
+        palette.remove(buf, start, end, slots)
+
+        print("Tensor %d %dx%d: %d of %d blocks stored, %d -> %d bytes, "
+              "largest pruned weight %d"
+              % (index, rows, depth, stored, rows * depth // BLOCK,
+                 old_length, len(packed), worst))
+        count += 1
+    return count
+
+
+def main():
+    args = sys.argv[1:]
+    prune = 0.0
+    if len(args) == 4 and args[0] == "--prune":
+        prune = float(args[1])
+        args = args[2:]
+    if len(args) != 2 or not 0.0 <= prune < 1.0:
+        print("Usage:\nsparsify_weights.py [--prune FRACTION] MODEL OUTPUT")
+        return 1
+
+    model_path, output_path = args
+    if model_path.endswith(".cc") != output_path.endswith(".cc"):
+        print("MODEL and OUTPUT have to be in the same format")
+        return 1
+
+    try:
+        buf = bytearray(ops.read_model(model_path))
+        count = sparsify(buf, prune)
+    except (ValueError, struct.error, IndexError) as e:
+        print("%s: %s" % (model_path, e))
+        return 1
+
+    if not count:
+        print("%s: no FullyConnected weights to sparsify" % model_path)
+        return 1
+
+    ops.write_model(output_path, model_path, buf)
+    print("Sparsified %d tensor(s), model is %d bytes" % (count, len(buf)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+"""Prints worst case stack depth of firmware from GCC call graph files.
+
+Usage:
+    stack_report.py MAP DIR [DIR ...]
+
+DIRs are searched for .ci files, which GCC writes next to objects with
+-fcallgraph-info=su, 'make stack' in rules.mk builds with it. Every file
+has stack frame of each function and its direct calls, depth of a
+function is its frame plus the deepest function it calls.
+
+Calls through pointers, like kernel Eval() from the interpreter or shell
+handlers, are counted as the deepest function that is never called
+directly, so estimate stays on the safe side. Functions without .ci data,
+from newlib or a library built without it, count as 0 and are listed, also
+recursion and dynamic frames, for which depth is only a lower bound.
+
+Roots are main() and interrupt handlers (*_isr, *_handler). Each handler
+adds exception frame with FPU registers. Available stack is free ram from
+"end" in MAP, end of bss, to "_stack", where libopencm3 starts it.
+"""
+
+import glob
+import os
+import re
+import sys
+
+# Exception entry with lazy FPU stacking, 26 words
+EXCEPTION_FRAME = 104
+TOP_COUNT = 10
+INDIRECT = "__indirect_call"
+
+
+def read_call_graph(dirs):
+    """Returns ({function: (bytes, qualifier)}, {function: set(callees)})."""
+    frames = {}
+    calls = {}
+    for directory in dirs:
+        for path in glob.glob(os.path.join(directory, "**", "*.ci"),
+                              recursive=True):
+            with open(path) as f:
+                text = f.read()
+            for title, label in re.findall(
+                    r'node: \{ title: "([^"]+)" label: "([^"]*)"', text):
+                match = re.search(r"\\n(\d+) bytes \(([^)]*)\)", label)
+                if match:
+                    frames[title] = (int(match.group(1)), match.group(2))
+            for source, target in re.findall(
+                    r'edge: \{ sourcename: "([^"]+)" targetname: "([^"]+)"',
+                    text):
+                calls.setdefault(source, set()).add(target)
+    return frames, calls
+
+
+def read_stack_space(path):
+    """Returns (end of bss, top of stack) from linker map."""
+    symbols = {}
+    with open(path) as f:
+        for line in f:
+            match = re.match(r"^\s+(0x[0-9a-f]+)\s+(?:PROVIDE \()?"
+                             r"(end|_stack)\b", line)
+            if match:
+                symbols[match.group(2)] = int(match.group(1), 16)
+    return symbols.get("end"), symbols.get("_stack")
+
+
+def is_root(name):
+    return name == "main" or name.endswith(("_isr", "_handler"))
+
+
+class StackDepth:
+    def __init__(self, frames, calls):
+        self.frames = frames
+        self.calls = calls
+        self.depth = {}
+        self.active = set()
+        self.unknown = set()
+        self.recursive = set()
+        self.dynamic = set(name for name, (_, qualifier) in frames.items()
+                           if "dynamic" in qualifier)
+
+        # Candidates of indirect calls are measured with indirect calls as
+        # 0, then everything is measured again with the deepest of them
+        called = set()
+        for callees in calls.values():
+            called |= callees
+        self.indirect = (0, [])
+        deepest = (0, [])
+        for name in sorted(frames):
+            if name not in called and not is_root(name):
+                depth = self.of(name)
+                if depth[0] > deepest[0]:
+                    deepest = depth
+        self.indirect = deepest
+        self.depth = {}
+
+    def of(self, name):
+        """Returns (depth, chain) of function."""
+        if name == INDIRECT:
+            return self.indirect[0], [INDIRECT] + self.indirect[1]
+        if name in self.depth:
+            return self.depth[name]
+        if name not in self.frames:
+            self.unknown.add(name)
+            return 0, [name]
+        if name in self.active:
+            self.recursive.add(name)
+            return 0, [name]
+
+        self.active.add(name)
+        worst = (0, [])
+        for callee in sorted(self.calls.get(name, ())):
+            depth = self.of(callee)
+            if depth[0] > worst[0]:
+                worst = depth
+        self.active.discard(name)
+
+        result = (self.frames[name][0] + worst[0], [name] + worst[1])
+        self.depth[name] = result
+        return result
+
+
+def main():
+    if len(sys.argv) < 3:
+        print("Usage:\nstack_report.py MAP DIR [DIR ...]")
+        return 1
+
+    frames, calls = read_call_graph(sys.argv[2:])
+    if not frames:
+        print("No .ci files found, build with -fcallgraph-info=su")
+        return 1
+
+    stack = StackDepth(frames, calls)
+    roots = sorted(name for name in frames if is_root(name))
+    if "main" not in roots:
+        print("main() not found in call graph")
+        return 1
+
+    print("%-40s %8s  %s" % ("Root", "Bytes", "Deepest chain"))
+    handlers = 0
+    deepest_handler = 0
+    for root in roots:
+        depth, chain = stack.of(root)
+        if root != "main":
+            depth += EXCEPTION_FRAME
+            handlers += depth
+            deepest_handler = max(deepest_handler, depth)
+        print("%-40s %8d  %s" % (root, depth, " > ".join(chain)))
+
+    if stack.indirect[1]:
+        print("\nIndirect calls counted as %s, %d bytes" %
+              (stack.indirect[1][0], stack.indirect[0]))
+
+    print("\nLargest frames:")
+    largest = sorted(frames.items(), key=lambda item: -item[1][0])
+    for name, (size, qualifier) in largest[:TOP_COUNT]:
+        print("  %8d  %s (%s)" % (size, name, qualifier))
+
+    for title, names in (("Without stack data, counted as 0",
+                          stack.unknown - {INDIRECT}),
+                         ("Recursive, counted once", stack.recursive),
+                         ("Dynamic frames", stack.dynamic)):
+        if names:
+            print("\n%s:\n  %s" % (title, " ".join(sorted(names))))
+
+    main_depth = stack.of("main")[0]
+    print("\nmain with the deepest interrupt: %d bytes" %
+          (main_depth + deepest_handler))
+    print("main with all interrupts nested: %d bytes" %
+          (main_depth + handlers))
+
+    end, top = read_stack_space(sys.argv[1])
+    if end is None or top is None:
+        print("No end or _stack symbol in %s" % sys.argv[1])
+        return 1
+    available = top - end
+    print("Available for stack between end of bss and _stack: %d bytes" %
+          available)
+    print("Left for arenas with all interrupts nested: %d bytes" %
+          (available - main_depth - handlers))
+    return 0 if available >= main_depth + handlers else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+"""Moves large weights of a TFLite model into a separate file.
+
+Usage:
+    stream_weights.py [--min-bytes N] MODEL OUTPUT WEIGHTS
+
+MODEL is either a .tflite flatbuffer or a .cc file with the model as C
+array, OUTPUT is written in the same format. Weights of Conv2D,
+DepthwiseConv2D and FullyConnected of at least --min-bytes bytes, 16384
+by default, are written to WEIGHTS, a plain binary file for QSPI flash
+or SD card. Model keeps only a stub in place of each of them, so a model
+larger than internal flash fits in it. WeightStreamResolver in
+weight_stream.h loads weights of each layer into RAM before it runs,
+next layer is read while the current one computes.
+
+Stub in the weights buffer:
+    "EXT1", offset in WEIGHTS and length in bytes, both uint32
+Every tensor in WEIGHTS starts at a multiple of 512 bytes, so reads from
+SD card start at a sector. Kernels that read weights in Prepare(), like
+Conv2DSpecialisedResolver, Conv2DWinogradResolver,
+FullyConnectedPaletteResolver, FullyConnectedInt4Resolver and
+FullyConnectedSparseResolver, can not take streamed weights, keep their
+layers under --min-bytes. Freed part of the buffer is removed the same
+way as in palettize_weights.py.
+"""
+
+import struct
+import sys
+
+import gen_model_ops as ops
+import palettize_weights as palette
+
+WEIGHT_OPS = {3, 4, 9}      # CONV_2D, DEPTHWISE_CONV_2D, FULLY_CONNECTED
+MAGIC = b"EXT1"
+SECTOR = 512
+
+
+def stream(buf, min_bytes, weights_file):
+    """Returns number of moved tensors, buf is a bytearray and
+    weights_file a bytearray that receives their data."""
+    if buf[4:8] != b"TFL3":
+        raise ValueError("not a TFLite flatbuffer")
+
+    model = ops.u32(buf, 0)
+    subgraphs = ops.vector_tables(buf, model, ops.MODEL_SUBGRAPHS)
+    if len(subgraphs) != 1:
+        raise ValueError("only models with one subgraph are supported")
+
+    codes = []
+    for opcode in ops.vector_tables(buf, model, ops.MODEL_OPERATOR_CODES):
+        code = 0
+        pos = ops.field_pos(buf, opcode, ops.OPCODE_DEPRECATED_BUILTIN_CODE)
+        if pos is not None:
+            code = struct.unpack_from("<b", buf, pos)[0]
+        pos = ops.field_pos(buf, opcode, ops.OPCODE_BUILTIN_CODE)
+        if pos is not None:
+            code = max(code, struct.unpack_from("<i", buf, pos)[0])
+        codes.append(code)
+
+    # Execution order, so the file is read front to back
+    weights = []
+    for operator in ops.vector_tables(buf, subgraphs[0],
+                                      ops.SUBGRAPH_OPERATORS):
+        pos = ops.field_pos(buf, operator, ops.OPERATOR_OPCODE_INDEX)
+        if codes[ops.u32(buf, pos) if pos is not None else 0] in WEIGHT_OPS:
+            index = ops.int_vector(buf, operator, palette.OPERATOR_INPUTS)[1]
+            if index not in weights:
+                weights.append(index)
+
+    count = 0
+    for index in weights:
+        # Positions move after each removal, so everything is found again
+        model = ops.u32(buf, 0)
+        subgraph = ops.vector_tables(buf, model, ops.MODEL_SUBGRAPHS)[0]
+        tensor = ops.vector_tables(buf, subgraph,
+                                   palette.SUBGRAPH_TENSORS)[index]
+        pos = ops.field_pos(buf, tensor, palette.TENSOR_BUFFER)
+        buffer = ops.vector_tables(buf, model, palette.MODEL_BUFFERS)[
+            ops.u32(buf, pos) if pos is not None else 0]
+        data = ops.vector_pos(buf, buffer, palette.BUFFER_DATA)
+        if data is None or ops.u32(buf, data) < min_bytes:
+            continue
+        if bytes(buf[data + 4:data + 8]) in (MAGIC, palette.MAGIC, b"BSP4",
+                                             b"INT4", b"I4X8", b"WGD2"):
+            raise ValueError("tensor %d is already converted" % index)
+
+        old_length = ops.u32(buf, data)
+        weights_file += b"\0" * (-len(weights_file) % SECTOR)
+        stub = MAGIC + struct.pack("<II", len(weights_file), old_length)
+        weights_file += buf[data + 4:data + 4 + old_length]
+
+        slots = palette.offset_slots(buf)
+        struct.pack_into("<I", buf, data, len(stub))
+        buf[data + 4:data + 4 + len(stub)] = stub
+
+        # Whole alignment units are removed, the rest stays as padding
+        start = data + 4 + len(stub)
+        start += -start % palette.ALIGNMENT
+        end = start + (data + 4 + old_length - start) // \
+            palette.ALIGNMENT * palette.ALIGNMENT
+        palette.remove(buf, start, end, slots)
+
+        print("Tensor %d: %d bytes moved" % (index, old_length))
+        count += 1
+    return count
+
+
+def main():
+    args = sys.argv[1:]
+    min_bytes = 16384
+    if len(args) == 5 and args[0] == "--min-bytes":
+        min_bytes = int(args[1])
+        args = args[2:]
+    if len(args) != 3:
+        print("Usage:\nstream_weights.py [--min-bytes N] MODEL OUTPUT WEIGHTS")
+        return 1
+
+    model_path, output_path, weights_path = args
+    if model_path.endswith(".cc") != output_path.endswith(".cc"):
+        print("MODEL and OUTPUT have to be in the same format")
+        return 1
+
+    weights_file = bytearray()
+    try:
+        buf = bytearray(ops.read_model(model_path))
+        count = stream(buf, min_bytes, weights_file)
+    except (ValueError, struct.error, IndexError) as e:
+        print("%s: %s" % (model_path, e))
+        return 1
+
+    if not count:
+        print("%s: no weights of at least %d bytes" % (model_path, min_bytes))
+        return 1
+
+    ops.write_model(output_path, model_path, buf)
+    with open(weights_path, "wb") as f:
+        f.write(weights_file)
+    print("Moved %d tensor(s), model is %d bytes, %s is %d bytes"
+          % (count, len(buf), weights_path, len(weights_file)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Removes Dequantize operators at the end of a TFLite model.
+
+Usage:
+    strip_dequantize.py MODEL OUTPUT
+
+MODEL is either a .tflite flatbuffer or a .cc file with the model as C
+array, OUTPUT is written in the same format. Fully quantized models end
+with Dequantize that turns int8 softmax into float, without it output
+tensor is int8 and application reads scores with output->params.scale
+and output->params.zero_point. That saves one kernel and float work on
+every inference.
+
+Flatbuffer is edited in place, so its size and all offsets stay the same:
+operators vector is shortened by the trailing Dequantize operators and
+outputs of the subgraph point to their int8 inputs. Float tensor that
+Dequantize produced stays in the model, nothing uses it. Regenerate
+model_ops.h afterwards, gen_model_ops.py only lists operators that are
+used, so Dequantize is not linked any more.
+"""
+
+import struct
+import sys
+
+import gen_model_ops as ops
+
+DEQUANTIZE = 6
+
+# Schema field indices, rest of them are in gen_model_ops.py
+SUBGRAPH_OUTPUTS = 2
+OPERATOR_INPUTS = 1
+OPERATOR_OUTPUTS = 2
+
+
+def opcode_codes(buf, model):
+    codes = []
+    for opcode in ops.vector_tables(buf, model, ops.MODEL_OPERATOR_CODES):
+        code = 0
+        pos = ops.field_pos(buf, opcode, ops.OPCODE_DEPRECATED_BUILTIN_CODE)
+        if pos is not None:
+            code = struct.unpack_from("<b", buf, pos)[0]
+        pos = ops.field_pos(buf, opcode, ops.OPCODE_BUILTIN_CODE)
+        if pos is not None:
+            code = max(code, struct.unpack_from("<i", buf, pos)[0])
+        codes.append(code)
+    return codes
+
+
+def strip(buf):
+    """Returns number of removed operators, buf is a bytearray."""
+    if buf[4:8] != b"TFL3":
+        raise ValueError("not a TFLite flatbuffer")
+
+    model = ops.u32(buf, 0)
+    codes = opcode_codes(buf, model)
+    subgraph = ops.vector_tables(buf, model, ops.MODEL_SUBGRAPHS)[0]
+    operators = ops.vector_pos(buf, subgraph, ops.SUBGRAPH_OPERATORS)
+    outputs = ops.vector_pos(buf, subgraph, SUBGRAPH_OUTPUTS)
+    output_tensors = ops.int_vector(buf, subgraph, SUBGRAPH_OUTPUTS)
+
+    removed = 0
+    count = ops.u32(buf, operators)
+    while count > 1:
+        element = operators + 4 + 4 * (count - 1)
+        operator = element + ops.u32(buf, element)
+        pos = ops.field_pos(buf, operator, ops.OPERATOR_OPCODE_INDEX)
+        opcode = ops.u32(buf, pos) if pos is not None else 0
+        if codes[opcode] != DEQUANTIZE:
+            break
+
+        source = ops.int_vector(buf, operator, OPERATOR_INPUTS)[0]
+        result = ops.int_vector(buf, operator, OPERATOR_OUTPUTS)[0]
+        if result not in output_tensors:
+            break
+
+        # Output of the subgraph is now the int8 input of Dequantize
+        i = output_tensors.index(result)
+        output_tensors[i] = source
+        struct.pack_into("<i", buf, outputs + 4 + 4 * i, source)
+
+        count -= 1
+        removed += 1
+    struct.pack_into("<I", buf, operators, count)
+    return removed
+
+
+def main():
+    if len(sys.argv) != 3:
+        print("Usage:\nstrip_dequantize.py MODEL OUTPUT")
+        return 1
+
+    model_path, output_path = sys.argv[1:]
+    if model_path.endswith(".cc") != output_path.endswith(".cc"):
+        print("MODEL and OUTPUT have to be in the same format")
+        return 1
+
+    try:
+        buf = bytearray(ops.read_model(model_path))
+        removed = strip(buf)
+    except (ValueError, struct.error, IndexError) as e:
+        print("%s: %s" % (model_path, e))
+        return 1
+
+    if not removed:
+        print("%s: model does not end with Dequantize" % model_path)
+        return 1
+
+    ops.write_model(output_path, model_path, buf)
+    print("Removed %d Dequantize operator(s)" % removed)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+"""Decodes trace events that power_test sends over ITM/SWO.
+
+Usage:
+    trace_decode.py SWO_FILE [CLOCK_MHZ]
+
+SWO_FILE is raw SWO capture, for example what openocd writes with
+"tpiu config internal trace.swo uart off 216000000 2000000". CLOCK_MHZ is
+core clock at the start of the capture, 216 by default, later switches
+come with TRACE_CLOCK events.
+
+Each event is sent as two words, DWT timestamp on one stimulus port and id
+with argument on the other, see src/system_setup/trace.c of power_test.
+Prints one line per event with time in us since the first one, then
+count, average and maximum duration of every *_BEGIN/*_END pair.
+
+Event names are read from trace.h, so they can not get out of sync.
+"""
+
+import os
+import re
+import sys
+
+TRACE_HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                            "projects", "power_test", "src",
+                            "system_setup", "trace.h")
+
+
+def read_header():
+    """Returns ({id: name}, port of timestamps, port of data)."""
+    with open(TRACE_HEADER) as f:
+        text = f.read()
+    names = {int(value): name for name, value in
+             re.findall(r"^\s*(TRACE_\w+)\s*=\s*(\d+),", text, re.M)}
+    ports = dict(re.findall(r"#define\s+(TRACE_ITM_PORT_\w+)\s+(\d+)", text))
+    return (names, int(ports["TRACE_ITM_PORT_TIME"]),
+            int(ports["TRACE_ITM_PORT_DATA"]))
+
+
+def itm_words(data):
+    """Yields (port, word) of 32 bit software source packets, everything
+    else in the stream is skipped."""
+    sizes = {1: 1, 2: 2, 3: 4}
+    i = 0
+    while i < len(data):
+        header = data[i]
+        i += 1
+        if header & 0x03:
+            # Source packet, software if bit 2 is clear
+            size = sizes[header & 0x03]
+            payload = data[i:i + size]
+            i += size
+            if not header & 0x04 and size == 4 and len(payload) == 4:
+                yield header >> 3, int.from_bytes(payload, "little")
+        elif header not in (0x00, 0x70, 0x80):
+            # Timestamp or extension packet, continuation bit on each byte
+            while header & 0x80 and i < len(data):
+                header = data[i]
+                i += 1
+        # Sync, its terminating 0x80 and overflow have no payload
+
+
+def events(words, port_time, port_data):
+    """Yields (cycles, id, arg), timestamp is extended to 64 bits."""
+    cycles = None
+    high = 0
+    last = 0
+    for port, word in words:
+        if port == port_time:
+            cycles = word
+        elif port == port_data and cycles is not None:
+            if cycles < last:
+                high += 1 << 32
+            last = cycles
+            yield high + cycles, word & 0xFFFF, word >> 16
+            cycles = None
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        print("Usage:\ntrace_decode.py SWO_FILE [CLOCK_MHZ]")
+        return 1
+
+    names, port_time, port_data = read_header()
+    clock_mhz = float(sys.argv[2]) if len(sys.argv) == 3 else 216.0
+    with open(sys.argv[1], "rb") as f:
+        data = f.read()
+
+    # Time is summed per event, clock can change between two of them
+    time_us = 0.0
+    previous = None
+    begins = {}
+    durations = {}
+    for cycles, event_id, arg in events(itm_words(data), port_time,
+                                        port_data):
+        if previous is not None:
+            time_us += (cycles - previous) / clock_mhz
+        previous = cycles
+
+        name = names.get(event_id, "ID_%d" % event_id)
+        print("%12.1f  %-24s %d" % (time_us, name, arg))
+
+        if name == "TRACE_CLOCK" and arg:
+            clock_mhz = float(arg)
+        elif name.endswith("_BEGIN"):
+            begins[name[:-6], arg if name == "TRACE_OP_BEGIN" else 0] = \
+                time_us
+        elif name.endswith("_END"):
+            key = (name[:-4], arg if name == "TRACE_OP_END" else 0)
+            if key in begins:
+                durations.setdefault(key, []).append(time_us -
+                                                     begins.pop(key))
+
+    if durations:
+        print("\n%-28s %8s %12s %12s" % ("Span", "Count", "Average us",
+                                          "Max us"))
+        for (span, arg), values in sorted(durations.items()):
+            label = "%s %d" % (span, arg) if span == "TRACE_OP" else span
+            print("%-28s %8d %12.1f %12.1f" % (label, len(values),
+                                               sum(values) / len(values),
+                                               max(values)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
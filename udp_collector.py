@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+"""Receives UDP telemetry of power_test units built with ETH_UDP.
+
+Usage:
+    udp_collector.py [PORT] [FRAMES_DIR]
+
+PORT is 5005 by default, ETH_UDP_PORT of src/system_setup/eth_udp.h.
+Datagrams go to the broadcast MAC address, so the collector has to be on
+the same Ethernet segment. Each datagram is one message of
+shared/telemetry.h without COBS and CRC16: type, sequence, payload.
+
+Prints one line per TELEMETRY_RESULT record with the unit it came from,
+class, top score, Invoke() time and latency, and counts messages lost
+from gaps in the sequence of every unit. Frames come as
+TELEMETRY_FRAME_ROWS parts, complete ones are written to FRAMES_DIR as
+PGM files per unit when it is given.
+"""
+
+import os
+import socket
+import struct
+import sys
+
+TELEMETRY_FRAME_ROWS = 0x09
+TELEMETRY_RESULT = 0x0A
+
+# result_record_t of shared/result_bus.h, little endian
+RESULT_FORMAT = "<QIIIBBBb12b"
+RESULT_FLAGS = ((0x01, "IDLE"), (0x02, "SKIP"), (0x04, "TRACK"))
+NO_CLASS = 0xFF
+
+
+class Unit:
+    """State of one unit, keyed by its IP address."""
+
+    def __init__(self, address):
+        self.address = address
+        self.expected = None
+        self.lost = 0
+        self.frame = None       # (number, cols, rows, rows received)
+        self.pixels = None
+        self.frames = 0
+
+    def sequence(self, number):
+        if self.expected is not None and number != self.expected:
+            self.lost += (number - self.expected) & 0xFF
+        self.expected = (number + 1) & 0xFF
+
+
+def handle_result(unit, payload):
+    fields = struct.unpack_from(RESULT_FORMAT, payload)
+    timestamp, number, latency, invoke, flags, top, count, zero_point = \
+        fields[:8]
+    scores = fields[8:8 + count]
+    state = [name for bit, name in RESULT_FLAGS if flags & bit]
+    if top == NO_CLASS:
+        result = "none"
+    else:
+        # int8 softmax output, 256 above zero point is probability 1.0
+        score = (scores[top] - zero_point) / 256 if top < count else 0
+        result = "class %d %.2f" % (top, score)
+    print("%-15s %8.3f s #%-6d %-14s invoke %6d us latency %6s us %s "
+          "lost %d" % (unit.address, timestamp / 1e6, number, result,
+                       invoke, latency if flags & 0x08 else "-",
+                       " ".join(state), unit.lost))
+
+
+def handle_rows(unit, payload, frames_dir):
+    number, cols, rows, first, count = struct.unpack_from("<HBBBB", payload)
+    if unit.frame is None or unit.frame[0] != number:
+        unit.frame = [number, cols, rows, 0]
+        unit.pixels = bytearray(cols * rows)
+    start = first * cols
+    unit.pixels[start:start + count * cols] = payload[6:6 + count * cols]
+    unit.frame[3] += count
+    if unit.frame[3] < rows:
+        return
+
+    unit.frames += 1
+    if frames_dir:
+        name = "%s_%05d.pgm" % (unit.address.replace(".", "_"), number)
+        with open(os.path.join(frames_dir, name), "wb") as f:
+            f.write(b"P5 %d %d 255\n" % (cols, rows))
+            f.write(unit.pixels)
+    unit.frame = None
+
+
+def main():
+    port = int(sys.argv[1]) if len(sys.argv) > 1 else 5005
+    frames_dir = sys.argv[2] if len(sys.argv) > 2 else None
+    if frames_dir:
+        os.makedirs(frames_dir, exist_ok=True)
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", port))
+    units = {}
+
+    while True:
+        data, (address, _) = sock.recvfrom(2048)
+        if len(data) < 2:
+            continue
+        unit = units.setdefault(address, Unit(address))
+        kind, number, payload = data[0], data[1], data[2:]
+        unit.sequence(number)
+        if kind == TELEMETRY_RESULT:
+            handle_result(unit, payload)
+        elif kind == TELEMETRY_FRAME_ROWS:
+            handle_rows(unit, payload, frames_dir)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+"""Stores 3x3 Conv2D weights of a TFLite model in Winograd domain.
+
+Usage:
+    winograd_weights.py [--layers N,M,...] MODEL OUTPUT
+
+MODEL is either a .tflite flatbuffer or a .cc file with the model as C
+array, OUTPUT is written in the same format. Conv2DWinogradResolver in
+conv_winograd.h computes 2x2 outputs of a 3x3, stride 1 convolution
+from a 4x4 input tile with 16 multiplies per input channel instead of
+36, which needs the filter transformed as U = G g G'. Transform is done
+here once, with 2G so that U is integer and exact, original Conv2D
+kernel can not run such a model.
+
+Weights buffer then holds:
+    "WGD2", U as int16 [16][output channels][input channels rounded up
+    to even], tile position of U row major
+Which is 3.5 times the int8 weights, so flash is traded for speed and
+layers are chosen here. Every int8 Conv2D with 3x3 filter, stride and
+dilation 1 and at least 4 input channels qualifies, transforms cost more
+than they save below. --layers limits conversion to the given operator
+indices, as printed. A layer is converted only if no input can overflow
+the int32 sum of the Winograd domain, so results stay bit exact, Prepare()
+checks the same bound again.
+
+Buffer grows in place, new bytes are inserted after the old weights in
+whole alignment units and every offset that jumps over them is
+corrected, the same way as palettize_weights.py removes bytes. Scratch
+of a layer is 32 bytes per input and 64 per output channel, regenerate
+memory plan and arena size afterwards.
+"""
+
+import struct
+import sys
+
+import gen_model_ops as ops
+import palettize_weights as palette
+
+CONV_2D = 3
+MAGIC = b"WGD2"
+MIN_CHANNELS = 4
+MAX_INPUT = 4 * 255         # Bound of the transformed input tile
+TILE = 16
+
+# Schema field indices, rest of them are in gen_model_ops.py
+OPERATOR_BUILTIN_OPTIONS = 4
+CONV_STRIDE_W = 1
+CONV_STRIDE_H = 2
+CONV_DILATION_W = 4
+CONV_DILATION_H = 5
+
+# 2G of F(2x2, 3x3)
+G2 = ((2, 0, 0), (1, 1, 1), (1, -1, 1), (0, 0, 2))
+
+
+def scalar(buf, table, index, fmt, default):
+    pos = ops.field_pos(buf, table, index)
+    return default if pos is None else struct.unpack_from(fmt, buf, pos)[0]
+
+
+def transform(weights, outputs, depth):
+    """Returns U as int16 list in buffer order and the largest bound of
+    an output, weights are [outputs][3][3][depth]."""
+    stride = depth + depth % 2
+    u = [0] * (TILE * outputs * stride)
+    worst = 0
+    for o in range(outputs):
+        bound = 0
+        for c in range(depth):
+            g = [[weights[((o * 3 + i) * 3 + j) * depth + c]
+                  for j in range(3)] for i in range(3)]
+            largest = 0
+            for a in range(4):
+                for b in range(4):
+                    value = sum(G2[a][i] * g[i][j] * G2[b][j]
+                                for i in range(3) for j in range(3))
+                    u[((a * 4 + b) * outputs + o) * stride + c] = value
+                    largest = max(largest, abs(value))
+            bound += largest
+        worst = max(worst, 9 * MAX_INPUT * bound)
+    return u, worst
+
+
+def convert(buf, layers):
+    """Returns number of converted tensors, buf is a bytearray."""
+    if buf[4:8] != b"TFL3":
+        raise ValueError("not a TFLite flatbuffer")
+
+    model = ops.u32(buf, 0)
+    subgraphs = ops.vector_tables(buf, model, ops.MODEL_SUBGRAPHS)
+    if len(subgraphs) != 1:
+        raise ValueError("only models with one subgraph are supported")
+
+    codes = []
+    for opcode in ops.vector_tables(buf, model, ops.MODEL_OPERATOR_CODES):
+        code = 0
+        pos = ops.field_pos(buf, opcode, ops.OPCODE_DEPRECATED_BUILTIN_CODE)
+        if pos is not None:
+            code = struct.unpack_from("<b", buf, pos)[0]
+        pos = ops.field_pos(buf, opcode, ops.OPCODE_BUILTIN_CODE)
+        if pos is not None:
+            code = max(code, struct.unpack_from("<i", buf, pos)[0])
+        codes.append(code)
+
+    weights = []
+    operators = ops.vector_tables(buf, subgraphs[0], ops.SUBGRAPH_OPERATORS)
+    for index, operator in enumerate(operators):
+        pos = ops.field_pos(buf, operator, ops.OPERATOR_OPCODE_INDEX)
+        if codes[ops.u32(buf, pos) if pos is not None else 0] != CONV_2D or \
+                (layers is not None and index not in layers):
+            continue
+        pos = ops.field_pos(buf, operator, OPERATOR_BUILTIN_OPTIONS)
+        options = pos + ops.u32(buf, pos) if pos is not None else None
+        if options is not None and (
+                scalar(buf, options, CONV_STRIDE_W, "<i", 1) != 1 or
+                scalar(buf, options, CONV_STRIDE_H, "<i", 1) != 1 or
+                scalar(buf, options, CONV_DILATION_W, "<i", 1) != 1 or
+                scalar(buf, options, CONV_DILATION_H, "<i", 1) != 1):
+            continue
+        inputs = ops.int_vector(buf, operator, palette.OPERATOR_INPUTS)
+        weights.append((index, inputs[1]))
+
+    count = 0
+    for index, tensor_index in weights:
+        # Positions move after each insertion, so everything is found again
+        model = ops.u32(buf, 0)
+        subgraph = ops.vector_tables(buf, model, ops.MODEL_SUBGRAPHS)[0]
+        tensor = ops.vector_tables(buf, subgraph,
+                                   palette.SUBGRAPH_TENSORS)[tensor_index]
+        shape = ops.int_vector(buf, tensor, palette.TENSOR_SHAPE)
+        tensor_type = struct.unpack_from(
+            "<b", buf, ops.field_pos(buf, tensor, palette.TENSOR_TYPE))[0]
+        pos = ops.field_pos(buf, tensor, palette.TENSOR_BUFFER)
+        buffer = ops.vector_tables(buf, model, palette.MODEL_BUFFERS)[
+            ops.u32(buf, pos) if pos is not None else 0]
+        data = ops.vector_pos(buf, buffer, palette.BUFFER_DATA)
+        if tensor_type != palette.TYPE_INT8 or len(shape) != 4 or \
+                shape[1:3] != [3, 3] or data is None:
+            continue
+        if bytes(buf[data + 4:data + 8]) == MAGIC:
+            raise ValueError("tensor %d is already converted" % tensor_index)
+        outputs, depth = shape[0], shape[3]
+        if ops.u32(buf, data) != outputs * 9 * depth or depth < MIN_CHANNELS:
+            continue
+
+        values = struct.unpack_from("<%db" % (outputs * 9 * depth), buf,
+                                    data + 4)
+        u, worst = transform(values, outputs, depth)
+        if worst > 2 ** 31 - 1:
+            print("Operator %d: sum may reach %d, skipped" % (index, worst))
+            continue
+
+        packed = MAGIC + struct.pack("<%dh" % len(u), *u)
+        old_length = ops.u32(buf, data)
+        growth = len(packed) - old_length
+        growth += -growth % palette.ALIGNMENT
+        palette.insert(buf, data + 4 + old_length, growth,
+                       palette.offset_slots(buf))
+        struct.pack_into("<I", buf, data, len(packed))
+        buf[data + 4:data + 4 + len(packed)] = packed
+
+        print("Operator %d %dx3x3x%d: %d -> %d bytes, bound %.2f of int32"
+              % (index, outputs, depth, old_length, len(packed),
+                 worst / 2.0 ** 31))
+        count += 1
+    return count
+
+
+def main():
+    args = sys.argv[1:]
+    layers = None
+    if len(args) == 4 and args[0] == "--layers":
+        layers = {int(i) for i in args[1].split(",")}
+        args = args[2:]
+    if len(args) != 2:
+        print("Usage:\nwinograd_weights.py [--layers N,M,...] MODEL OUTPUT")
+        return 1
+
+    model_path, output_path = args
+    if model_path.endswith(".cc") != output_path.endswith(".cc"):
+        print("MODEL and OUTPUT have to be in the same format")
+        return 1
+
+    try:
+        buf = bytearray(ops.read_model(model_path))
+        count = convert(buf, layers)
+    except (ValueError, struct.error, IndexError) as e:
+        print("%s: %s" % (model_path, e))
+        return 1
+
+    if not count:
+        print("%s: no 3x3 Conv2D weights to convert" % model_path)
+        return 1
+
+    ops.write_model(output_path, model_path, buf)
+    print("Converted %d tensor(s), model is %d bytes" % (count, len(buf)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())